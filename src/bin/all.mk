@@ -4,6 +4,7 @@ SUBMAKEFILES := \
     radiusd.mk \
     radlast.mk \
     radlock.mk \
+    radperf.mk \
     radsniff.mk \
     radsnmp.mk \
     radwho.mk \
@@ -78,6 +78,18 @@ static fr_packet_list_t *packet_list = NULL;
 static rc_request_t *request_head = NULL;
 static rc_request_t *rc_request_tail = NULL;
 
+static fr_rb_tree_t *nas_tree = NULL;
+static uint32_t nas_parallel = 0;
+
+/*
+ *	Count a result both globally, and for the destination.
+ */
+#define RC_STATS_INC(_request, _field) \
+do { \
+	stats._field++; \
+	if ((_request)->nas) (_request)->nas->stats._field++; \
+} while (0)
+
 static char const *radclient_version = RADIUSD_VERSION_STRING_BUILD("radclient");
 
 static fr_dict_t const *dict_freeradius;
@@ -151,6 +163,7 @@ static NEVER_RETURNS void usage(void)
 	fprintf(stderr, "  -h                     Print usage help information.\n");
 	fprintf(stderr, "  -i <id>                Set request id to 'id'.  Values may be 0..255\n");
 	fprintf(stderr, "  -n <num>               Send N requests/s\n");
+	fprintf(stderr, "  -N <num>               Send at most 'num' packets in parallel to each destination.\n");
 	fprintf(stderr, "  -p <num>               Send 'num' packets from a file in parallel.\n");
 	fprintf(stderr, "  -P <proto>             Use proto (tcp or udp) for transport.\n");
 	fprintf(stderr, "  -r <retries>           If timeout, retry sending the packet 'retries' times.\n");
@@ -734,11 +747,48 @@ static int8_t filename_cmp(void const *one, void const *two)
 	return CMP(ret, 0);
 }
 
+static int8_t nas_cmp(void const *one, void const *two)
+{
+	rc_nas_t const *a = one, *b = two;
+	int8_t ret;
+
+	ret = fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
+	if (ret != 0) return ret;
+
+	return CMP(a->port, b->port);
+}
+
+/*
+ *	Find the destination of a request, adding it if necessary.
+ */
+static rc_nas_t *nas_find(fr_ipaddr_t const *ipaddr, uint16_t port)
+{
+	rc_nas_t *nas, find = { .ipaddr = *ipaddr, .port = port };
+
+	nas = fr_rb_find(nas_tree, &find);
+	if (nas) return nas;
+
+	MEM(nas = talloc_zero(nas_tree, rc_nas_t));
+	nas->ipaddr = *ipaddr;
+	nas->port = port;
+	fr_rb_insert(nas_tree, nas);
+
+	return nas;
+}
+
 /*
  *	Deallocate packet ID, etc.
  */
 static void deallocate_id(rc_request_t *request)
 {
+	/*
+	 *	The destination can take another request.
+	 */
+	if (request && request->outstanding) {
+		request->nas->outstanding--;
+		request->outstanding = false;
+	}
+
 	if (!request || !request->packet ||
 	    (request->packet->id < 0)) {
 		return;
@@ -869,6 +919,12 @@ static int send_one_packet(rc_request_t *request)
 		request->tries = 1;
 		request->resend++;
 
+		if (request->nas) {
+			request->nas->outstanding++;
+			request->nas->sent++;
+			request->outstanding = true;
+		}
+
 	} else {		/* request->packet->id >= 0 */
 		fr_time_delta_t now = fr_time();
 
@@ -918,7 +974,7 @@ static int send_one_packet(rc_request_t *request)
 			if (request->resend == resend_count) {
 				request->done = true;
 			}
-			stats.lost++;
+			RC_STATS_INC(request, lost);
 			return -1;
 		}
 
@@ -1021,7 +1077,7 @@ static int recv_one_packet(fr_time_t wait_time)
 	 */
 	if (fr_radius_packet_verify(reply, request->packet, secret) < 0) {
 		REDEBUG("Reply verification failed");
-		stats.lost++;
+		RC_STATS_INC(request, lost);
 		goto packet_done; /* shared secret is incorrect */
 	}
 
@@ -1039,7 +1095,7 @@ static int recv_one_packet(fr_time_t wait_time)
 	if (fr_radius_packet_decode(request->reply, &request->reply_pairs,
 				    request->packet, RADIUS_MAX_ATTRIBUTES, false, secret) != 0) {
 		REDEBUG("Reply decode failed");
-		stats.lost++;
+		RC_STATS_INC(request, lost);
 		goto packet_done;
 	}
 
@@ -1053,14 +1109,14 @@ static int recv_one_packet(fr_time_t wait_time)
 	case FR_RADIUS_CODE_ACCOUNTING_RESPONSE:
 	case FR_RADIUS_CODE_COA_ACK:
 	case FR_RADIUS_CODE_DISCONNECT_ACK:
-		stats.accepted++;
+		RC_STATS_INC(request, accepted);
 		break;
 
 	case FR_RADIUS_CODE_ACCESS_CHALLENGE:
 		break;
 
 	default:
-		stats.rejected++;
+		RC_STATS_INC(request, rejected);
 	}
 
 	fr_strerror_clear();	/* Clear strerror buffer */
@@ -1077,23 +1133,23 @@ static int recv_one_packet(fr_time_t wait_time)
 			REDEBUG("%s: Expected %u got %i", request->name, request->filter_code,
 				request->reply->code);
 		}
-		stats.failed++;
+		RC_STATS_INC(request, failed);
 	/*
 	 *	Check if the contents of the packet matched the filter
 	 */
 	} else if (fr_pair_list_empty(&request->filter)) {
-		stats.passed++;
+		RC_STATS_INC(request, passed);
 	} else {
 		fr_pair_t const *failed[2];
 
 		fr_pair_list_sort(&request->reply_pairs, fr_pair_cmp_by_da);
 		if (fr_pair_validate(failed, &request->filter, &request->reply_pairs)) {
 			RDEBUG("%s: Response passed filter", request->name);
-			stats.passed++;
+			RC_STATS_INC(request, passed);
 		} else {
 			fr_pair_validate_debug(request, failed);
 			REDEBUG("%s: Response for failed filter", request->name);
-			stats.failed++;
+			RC_STATS_INC(request, failed);
 		}
 	}
 
@@ -1121,6 +1177,8 @@ int main(int argc, char **argv)
 	FILE		*fp;
 	int		do_summary = false;
 	int		persec = 0;
+	fr_time_delta_t	pace = 0;
+	fr_time_t	next_send = 0;
 	int		parallel = 1;
 	rc_request_t	*this;
 	int		force_af = AF_UNSPEC;
@@ -1165,7 +1223,7 @@ int main(int argc, char **argv)
 	default_log.fd = STDOUT_FILENO;
 	default_log.print_level = false;
 
-	while ((c = getopt(argc, argv, "46c:C:d:D:f:Fhi:n:p:P:r:sS:t:vx")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "46c:C:d:D:f:Fhi:n:N:p:P:r:sS:t:vx")) != -1) switch (c) {
 		case '4':
 			force_af = AF_INET;
 			break;
@@ -1240,6 +1298,12 @@ int main(int argc, char **argv)
 			if (persec <= 0) usage();
 			break;
 
+		case 'N':
+			if (!isdigit((int) *optarg)) usage();
+			nas_parallel = atoi(optarg);
+			if (nas_parallel == 0) usage();
+			break;
+
 			/*
 			 *	Note that sending MANY requests in
 			 *	parallel can over-run the kernel
@@ -1484,14 +1548,24 @@ int main(int argc, char **argv)
 	 *	Walk over the list of packets, sanity checking
 	 *	everything.
 	 */
+	nas_tree = fr_rb_inline_talloc_alloc(autofree, rc_nas_t, node, nas_cmp, NULL);
+	if (!nas_tree) {
+		ERROR("Out of memory");
+		fr_exit_now(1);
+	}
+
 	for (this = request_head; this != NULL; this = this->next) {
 		this->packet->socket.inet.src_ipaddr = client_ipaddr;
 		this->packet->socket.inet.src_port = client_port;
 		if (radclient_sane(this) != 0) {
 			fr_exit_now(1);
 		}
+
+		this->nas = nas_find(&this->packet->socket.inet.dst_ipaddr, this->packet->socket.inet.dst_port);
 	}
 
+	if (persec) pace = (persec == 1) ? fr_time_delta_from_sec(1) : (fr_time_delta_from_sec(1) / persec);
+
 	/*
 	 *	Walk over the packets to send, until
 	 *	we're all done.
@@ -1505,6 +1579,7 @@ int main(int argc, char **argv)
 		int n = parallel;
 		rc_request_t *next;
 		char const *filename = NULL;
+		fr_time_delta_t pace_wait = 0;
 
 		done = true;
 		sleep_time = -1;
@@ -1545,6 +1620,38 @@ int main(int argc, char **argv)
 				n = parallel;
 			}
 
+			/*
+			 *	Requests which haven't been sent yet
+			 *	wait if their destination already has
+			 *	too many outstanding, or if sending
+			 *	them would exceed the rate limit.
+			 *	Retransmissions are always sent.
+			 */
+			if ((n > 0) && (!this->tries || (this->packet->id == -1))) {
+				fr_time_t now;
+
+				if (nas_parallel && (this->nas->outstanding >= nas_parallel)) {
+					done = false;
+					continue;
+				}
+
+				if (pace) {
+					now = fr_time();
+					if (now < next_send) {
+						if (!pace_wait || ((next_send - now) < pace_wait)) pace_wait = next_send - now;
+						done = false;
+						continue;
+					}
+
+					/*
+					 *	Don't send a burst to catch
+					 *	up if we fell behind.
+					 */
+					if ((now - next_send) > pace) next_send = now;
+					next_send += pace;
+				}
+			}
+
 			if (n > 0) {
 				n--;
 
@@ -1556,32 +1663,6 @@ int main(int argc, char **argv)
 					break;
 				}
 
-				/*
-				 *	Wait a little before sending
-				 *	the next packet, if told to.
-				 */
-				if (persec) {
-					fr_time_delta_t psec;
-
-					psec = (persec == 1) ? fr_time_delta_from_sec(1) : (1000000 / persec);
-
-					/*
-					 *	Don't sleep elsewhere.
-					 */
-					sleep_time = 0;
-
-
-					/*
-					 *	Sleep for milliseconds,
-					 *	portably.
-					 *
-					 *	If we get an error or
-					 *	a signal, treat it like
-					 *	a normal timeout.
-					 */
-					select(0, NULL, NULL, NULL, &fr_time_delta_to_timeval(psec));
-				}
-
 				/*
 				 *	If we haven't sent this packet
 				 *	often enough, we're not done,
@@ -1613,6 +1694,13 @@ int main(int argc, char **argv)
 			sleep_time = 0;
 		}
 
+		/*
+		 *	Wake up in time to send the next paced request.
+		 */
+		if (!done && pace_wait && ((sleep_time <= 0) || (sleep_time > pace_wait))) {
+			sleep_time = pace_wait;
+		}
+
 		/*
 		 *	Nothing to do until we receive a request, so
 		 *	sleep until then.  Once we receive one packet,
@@ -1650,6 +1738,30 @@ int main(int argc, char **argv)
 		      stats.passed,
 		      stats.failed
 		);
+
+		/*
+		 *	Bulk runs (e.g. CoA or Disconnect to many NASes)
+		 *	need to know which destinations failed.
+		 */
+		if (fr_rb_num_elements(nas_tree) > 1) {
+			fr_rb_iter_inorder_t	iter;
+			rc_nas_t		*nas;
+
+			for (nas = fr_rb_iter_init_inorder(&iter, nas_tree);
+			     nas;
+			     nas = fr_rb_iter_next_inorder(&iter)) {
+				fr_perror("Destination %pV port %u:\n"
+					  "\tSent          : %" PRIu64 "\n"
+					  "\tAccepted      : %" PRIu64 "\n"
+					  "\tRejected      : %" PRIu64 "\n"
+					  "\tLost          : %" PRIu64,
+					  fr_box_ipaddr(nas->ipaddr), nas->port,
+					  nas->sent,
+					  nas->stats.accepted,
+					  nas->stats.rejected,
+					  nas->stats.lost);
+			}
+		}
 	}
 
 	if ((stats.lost > 0) || (stats.failed > 0)) {
@@ -58,6 +58,20 @@ typedef struct {
 	uint64_t failed;			//!< Requests which failed a fitler
 } rc_stats_t;
 
+/** Per-destination counters and concurrency
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;		//!< Entry in the tree of destinations.
+	fr_ipaddr_t		ipaddr;		//!< Destination address.
+	uint16_t		port;		//!< Destination port.
+
+	uint32_t		outstanding;	//!< Requests which have been sent, and not yet
+						///< replied to, or timed out.
+	uint64_t		sent;		//!< Requests which were sent (not counting retransmits).
+	rc_stats_t		stats;		//!< Results for this destination.
+} rc_nas_t;
+
 typedef struct {
 	fr_rb_node_t		node;		//!< rbtree node data.
 	char const		*packets;	//!< The file containing the request packet
@@ -74,6 +88,8 @@ struct rc_request {
 	rc_request_t		*next;
 
 	rc_file_pair_t		*files;		//!< Request and response file names.
+	rc_nas_t		*nas;		//!< The request is sent to.
+	bool			outstanding;	//!< Counted in nas->outstanding.
 
 	fr_pair_t		*password;	//!< Password.Cleartext
 	fr_time_delta_t		timestamp;
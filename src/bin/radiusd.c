@@ -44,6 +44,7 @@ RCSID("$Id$")
 #include <freeradius-devel/unlang/base.h>
 
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/startup.h>
 #include <freeradius-devel/util/syserror.h>
 
 #include <ctype.h>
@@ -186,6 +187,36 @@ static void fr_exit_after(fr_event_list_t *el, fr_time_t now, void *uctx)
 }
 #endif
 
+/** Write out the startup profile, and free it
+ *
+ * The profile is logged in debug mode, and written as JSON
+ * if a report file was given with -S.
+ *
+ * @param[in] report	file to write the JSON report to.  May be NULL.
+ */
+static void startup_report_write(char const *report)
+{
+	FILE *fp;
+
+	if (!fr_startup_profile_enabled()) return;
+
+	if (fr_debug_lvl) fr_startup_profile_log(&default_log);
+
+	if (report) {
+		fp = fopen(report, "w");
+		if (!fp) {
+			ERROR("Failed opening startup report %s: %s", report, fr_syserror(errno));
+		} else {
+			if (fr_startup_profile_json_fprint(fp) < 0) {
+				ERROR("Failed writing startup report %s: %s", report, fr_syserror(errno));
+			}
+			fclose(fp);
+		}
+	}
+
+	fr_startup_profile_free();
+}
+
 /** Entry point for the daemon
  *
  * @hidecallgraph
@@ -207,6 +238,9 @@ int main(int argc, char *argv[])
 
 	bool			raddb_dir_set = false;
 
+	char const		*startup_report = NULL;
+	int			startup_phase = -1, phase;
+
 	size_t			pool_size = 0;
 	void			*pool_page_start = NULL, *pool_page_end = NULL;
 	bool			do_mprotect;
@@ -328,7 +362,7 @@ int main(int argc, char *argv[])
 	}
 
 	/*  Process the options.  */
-	while ((c = getopt(argc, argv, "Cd:D:e:fhi:l:Mmn:p:PrstTvxX")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "Cd:D:e:fhi:l:Mmn:p:PrsS:tTvxX")) != -1) switch (c) {
 		case 'C':
 			check_config = true;
 			config->spawn_workers = false;
@@ -399,6 +433,10 @@ int main(int argc, char *argv[])
 			config->daemonize = false;
 			break;
 
+		case 'S':	/* startup profile */
+			startup_report = optarg;
+			break;
+
 		case 't':	/* no child threads */
 			config->spawn_workers = false;
 			break;
@@ -429,6 +467,15 @@ int main(int argc, char *argv[])
 			break;
 	}
 
+	/*
+	 *	Profile startup if we're debugging, or
+	 *	we've been asked for a report.
+	 */
+	if (fr_debug_lvl || startup_report) {
+		fr_startup_profile_enable();
+		startup_phase = fr_startup_phase_start("startup", NULL);
+	}
+
 	/*
 	 *	Allow the configuration directory to be set from an
 	 *	environment variable.  This allows tests to change the
@@ -544,7 +591,9 @@ int main(int argc, char *argv[])
 	/*
 	 *  Read the configuration files, BEFORE doing anything else.
 	 */
+	phase = fr_startup_phase_start("config", NULL);
 	if (main_config_init(config) < 0) EXIT_WITH_FAILURE;
+	fr_startup_phase_end(phase);
 
 	/*
 	 *  Check we're the only process using this config.
@@ -744,12 +793,16 @@ int main(int argc, char *argv[])
 	 */
 	if (unlang_init_global() < 0) EXIT_WITH_FAILURE;
 
+	phase = fr_startup_phase_start("server init", NULL);
 	if (server_init(config->root_cs) < 0) EXIT_WITH_FAILURE;
+	fr_startup_phase_end(phase);
 
 	/*
 	 *  Everything seems to have loaded OK, exit gracefully.
 	 */
 	if (check_config) {
+		fr_startup_phase_end(startup_phase);
+		startup_report_write(startup_report);
 		DEBUG("Configuration appears to be OK");
 		goto cleanup;
 	}
@@ -790,10 +843,21 @@ int main(int argc, char *argv[])
 		schedule->max_workers = config->max_workers;
 		schedule->max_networks = config->max_networks;
 		schedule->stats_interval = config->stats_interval;
+		schedule->cpu_affinity = config->cpu_affinity;
 
 		schedule->network.max_outstanding = config->max_requests;
+		schedule->network.worker_select = fr_table_value_by_str(fr_network_worker_select_table,
+									config->worker_select, -1);
+		if ((int) schedule->network.worker_select < 0) {
+			ERROR("Invalid value \"%s\" for 'worker_select'", config->worker_select);
+			EXIT_WITH_FAILURE;
+		}
+		schedule->network.queue_delay_target = config->queue_delay_target;
+		schedule->network.queue_delay_interval = config->queue_delay_interval;
 		schedule->worker.max_requests = config->max_requests;
 		schedule->worker.max_request_time = config->max_request_time;
+		schedule->worker.max_detached = config->max_detached_requests;
+		schedule->worker.memory_accounting = config->memory_accounting;
 
 		/*
 		 *	Single server mode: use the global event list.
@@ -804,17 +868,21 @@ int main(int argc, char *argv[])
 			el = main_loop_event_list();
 		}
 
+		phase = fr_startup_phase_start("threads", NULL);
 		sc = fr_schedule_create(NULL, el, &default_log, fr_debug_lvl,
 					thread_instantiate, thread_detach, schedule);
 		if (!sc) {
 			PERROR("Failed starting the scheduler");
 			EXIT_WITH_FAILURE;
 		}
+		fr_startup_phase_end(phase);
 
 		/*
 		 *	Tell the virtual servers to open their sockets.
 		 */
+		phase = fr_startup_phase_start("listeners", NULL);
 		if (virtual_servers_open(sc) < 0) EXIT_WITH_FAILURE;
+		fr_startup_phase_end(phase);
 	}
 
 	/*
@@ -926,6 +994,9 @@ int main(int argc, char *argv[])
 	/*
 	 *  Process requests until HUP or exit.
 	 */
+	fr_startup_phase_end(startup_phase);
+	startup_report_write(startup_report);
+
 	INFO("Ready to process requests");	/* we were actually ready a while ago, but oh well */
 	while ((status = main_loop_start()) == 0x80) {
 #ifdef WITH_STATS
@@ -1026,6 +1097,11 @@ cleanup:
 	 */
 	(void) fr_schedule_destroy(&sc);
 
+	/*
+	 *	Ditto for the startup profile.
+	 */
+	fr_startup_profile_free();
+
 	/*
 	 *  Frees request specific logging resources which is OK
 	 *  because all the requests will have been stopped.
@@ -1123,6 +1199,7 @@ static NEVER_RETURNS void usage(main_config_t const *config, int status)
 #endif
 	fprintf(output, "  -P            Always write out PID, even with -f.\n");
 	fprintf(output, "  -s            Do not spawn child processes to handle requests (same as -ft).\n");
+	fprintf(output, "  -S <file>     Write a JSON report of how long each phase of startup took to this file.\n");
 	fprintf(output, "  -t            Disable threads.\n");
 	fprintf(output, "  -T            Prepend timestamps to  log messages.\n");
 	fprintf(output, "  -v            Print server version information.\n");
@@ -467,6 +467,20 @@ static int cmd_uptime(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr
 
 static int cmd_stats_memory(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
 {
+	/*
+	 *	These come from memory_accounting, and don't
+	 *	need the talloc NULL context to be tracked.
+	 */
+	if (strcmp(info->argv[0], "top") == 0) {
+		if (!radmin_main_config->memory_accounting) {
+			fprintf(fp, "Statistics are only available when 'memory_accounting = yes'.\n");
+			return -1;
+		}
+
+		fr_stats_counters_top_print(fp, "memory", FR_STATS_MEMORY_BYTES, 20);
+		return 0;
+	}
+
 	if (!radmin_main_config->talloc_memory_report) {
 		fprintf(fp, "Statistics are only available when the server is started with '-M'.\n");
 		return -1;
@@ -492,10 +506,25 @@ static int cmd_stats_memory(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_inf
 	 *	Should never reach here.  The command parser will
 	 *	ensure that.
 	 */
-	fprintf(fp_err, "Must use 'stats memory (blocks|full|total)'\n");
+	fprintf(fp_err, "Must use 'stats memory (blocks|full|top|total)'\n");
 	return -1;
 }
 
+#ifdef HAVE_REGEX
+static int cmd_stats_regex(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	uint64_t hits, misses, evictions;
+
+	regex_cache_stats(&hits, &misses, &evictions);
+
+	fprintf(fp, "cache.hits\t\t\t%" PRIu64 "\n", hits);
+	fprintf(fp, "cache.misses\t\t\t%" PRIu64 "\n", misses);
+	fprintf(fp, "cache.evictions\t\t\t%" PRIu64 "\n", evictions);
+
+	return 0;
+}
+#endif
+
 static int cmd_set_debug_level(UNUSED FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
 {
 	int level = atoi(info->argv[0]);
@@ -822,6 +851,29 @@ found:
 	return 0;
 }
 
+static int cmd_stats_client(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
+{
+	RADCLIENT *client;
+
+	client = client_find(NULL, &info->box[0]->vb_ip, IPPROTO_IP); /* hack */
+	if (!client) {
+		fprintf(fp_err, "No such client.\n");
+		return -1;
+	}
+
+	fprintf(fp, "count.rate_limited\t%" PRIu64 "\n",
+		(uint64_t) atomic_load_explicit(&client->rate_limited, memory_order_relaxed));
+
+	return 0;
+}
+
+static int cmd_stats_counters(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
+{
+	fr_stats_counters_print(fp, (info->argc > 0) ? info->argv[0] : NULL);
+
+	return 0;
+}
+
 //#define CMD_TEST (1)
 
 #ifdef CMD_TEST
@@ -983,15 +1035,43 @@ static fr_cmd_table_t cmd_table[] = {
 		.read_only = true
 	},
 
+	{
+		.parent = "stats",
+		.name = "client",
+		.syntax = "IPADDR",
+		.func = cmd_stats_client,
+		.help = "Show statistics for a given client.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats",
+		.name = "counters",
+		.syntax = "[STRING]",
+		.func = cmd_stats_counters,
+		.help = "Show the per-thread counters, summed over all threads.  Optionally limited to one dimension, e.g. 'module'.",
+		.read_only = true
+	},
+
 	{
 		.parent = "stats",
 		.name = "memory",
-		.syntax = "(blocks|full|total)",
+		.syntax = "(blocks|full|top|total)",
 		.func = cmd_stats_memory,
 		.help = "Show memory statistics.",
 		.read_only = true,
 	},
 
+#ifdef HAVE_REGEX
+	{
+		.parent = "stats",
+		.name = "regex",
+		.func = cmd_stats_regex,
+		.help = "Show statistics for the cache of regular expressions compiled at run-time.",
+		.read_only = true,
+	},
+#endif
+
 	{
 		.parent = "set",
 		.name = "debug",
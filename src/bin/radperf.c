@@ -0,0 +1,1084 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/bin/radperf.c
+ * @brief RADIUS load generator.
+ *
+ * Unlike radclient, radperf doesn't wait for a reply before sending the
+ * next packet.  Packets are sent on an open loop schedule, at a fixed
+ * total rate, from several threads and sockets.  Each packet has a time
+ * at which it should have been sent, and its latency is measured from
+ * then, not from when it was actually sent.  If the server (or radperf)
+ * falls behind, the delay is therefore counted against every packet
+ * which was held up, instead of silently lowering the offered load.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/util/conf.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/time.h>
+#include <freeradius-devel/radius/radius.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+/*
+ *	Latencies are recorded in microseconds, in a log-linear
+ *	histogram.  Values below 2^(HIST_SUB_BITS + 1) get a bucket
+ *	each, after that every power of two is split into
+ *	2^HIST_SUB_BITS buckets, which gives about 3% precision.
+ */
+#define HIST_SUB_BITS		5
+#define HIST_SUB_BUCKETS	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS		((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+typedef struct {
+	uint64_t		sent;			//!< Packets written to a socket.
+	uint64_t		late;			//!< Packets sent more than a millisecond after
+							///< they should have been.
+	uint64_t		received;		//!< Replies which matched a request.
+	uint64_t		timeouts;		//!< Requests which didn't get a reply in time.
+	uint64_t		errors;			//!< Packets we couldn't encode or send.
+	uint64_t		invalid;		//!< Replies which were malformed, or failed verification.
+	uint64_t		unexpected;		//!< Replies to requests which had already timed out.
+	uint64_t		codes[FR_RADIUS_CODE_MAX];	//!< Replies by packet code.
+
+	uint64_t		max;			//!< Largest latency seen, in microseconds.
+	uint64_t		hist[HIST_BUCKETS];	//!< Latencies of all replies.
+} radperf_stats_t;
+
+typedef struct radperf_thread_s radperf_thread_t;
+
+/** One outstanding packet
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< In the socket's free list.
+	bool			in_use;
+
+	fr_time_t		intended;		//!< When the packet should have been sent.
+	fr_time_t		expires;		//!< When we give up waiting for the reply.
+	uint8_t			header[RADIUS_HEADER_LENGTH];	//!< Of the request, to verify the reply.
+} radperf_id_t;
+
+/** A connected UDP socket, and its 256 IDs
+ *
+ * Free IDs are re-used in least recently used order, so that a late
+ * reply is unlikely to be matched to a newer request.
+ */
+typedef struct {
+	int			fd;
+	radperf_thread_t	*thread;
+
+	fr_dlist_head_t		free;			//!< IDs which can be used.
+	unsigned int		outstanding;		//!< IDs which are in use.
+	radperf_id_t		ids[256];
+} radperf_socket_t;
+
+struct radperf_thread_s {
+	unsigned int		id;			//!< Offset of this thread in the schedule.
+	pthread_t		pthread;
+	fr_event_list_t		*el;
+
+	fr_event_timer_t const	*send_ev;		//!< Sends the next packet.
+	fr_event_timer_t const	*sweep_ev;		//!< Looks for requests which have timed out.
+
+	radperf_socket_t	*sockets;
+	unsigned int		num_sockets;
+	unsigned int		next_socket;
+
+	fr_pair_list_t		*packets;		//!< This thread's copy of the packet templates.
+	unsigned int		num_packets;
+	unsigned int		next_packet;
+
+	fr_randctx		rand;			//!< Not shared, fr_rand() isn't thread safe.
+
+	uint64_t		next;			//!< Number of the next packet this thread sends.
+	uint64_t		max;			//!< How many packets this thread sends in total.
+	unsigned int		outstanding;		//!< Across all sockets.
+	bool			blocked;		//!< No free IDs when the last packet was due.
+	bool			sending_done;		//!< Whole schedule has been sent.
+
+	radperf_stats_t		stats;
+
+	uint8_t			buffer[RADIUS_MAX_PACKET_SIZE];
+};
+
+static fr_ipaddr_t server_ipaddr;
+static uint16_t server_port = 0;
+static int packet_code = FR_RADIUS_CODE_UNDEFINED;
+static char *secret = NULL;
+static size_t secret_len;
+
+static unsigned int num_threads = 1;
+static unsigned int sockets_per_thread = 1;
+static unsigned int max_outstanding = 256;
+static uint64_t rate = 1000;				//!< Packets per second, across all threads.
+static uint64_t count = 0;				//!< Total packets to send, or 0 for no limit.
+static fr_time_delta_t duration = 0;
+static fr_time_delta_t timeout = ((fr_time_delta_t) 5) * NSEC;
+
+static fr_time_t start;					//!< When the first packet is due.
+static fr_time_t end;					//!< No packets are scheduled at, or after this.
+
+static char const *radperf_version = RADIUSD_VERSION_STRING_BUILD("radperf");
+
+static fr_dict_t const *dict_freeradius;
+static fr_dict_t const *dict_radius;
+
+extern fr_dict_autoload_t radperf_dict[];
+fr_dict_autoload_t radperf_dict[] = {
+	{ .out = &dict_freeradius, .proto = "freeradius" },
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+static NEVER_RETURNS void usage(void)
+{
+	fprintf(stderr, "Usage: radperf [options] server[:port] <command> [<secret>]\n");
+
+	fprintf(stderr, "  <command>              One of auth, acct, status, coa, or disconnect.\n");
+	fprintf(stderr, "  -4                     Use IPv4 address of server\n");
+	fprintf(stderr, "  -6                     Use IPv6 address of server.\n");
+	fprintf(stderr, "  -c <count>             Send 'count' packets in total.\n");
+	fprintf(stderr, "  -d <raddb>             Set user dictionary directory (defaults to " RADDBDIR ").\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -f <file>              Read the packet template from file, not stdin.\n");
+	fprintf(stderr, "  -F <csv>               Substitute ${column} in the template with values from\n");
+	fprintf(stderr, "                         each row of a CSV file.  The first row names the columns.\n");
+	fprintf(stderr, "  -h                     Print usage help information.\n");
+	fprintf(stderr, "  -l <time>              Send packets for 'time' seconds (defaults to 10, unless -c is given).\n");
+	fprintf(stderr, "  -n <num>               Send 'num' requests/s in total (defaults to 1000).\n");
+	fprintf(stderr, "  -o <num>               Allow at most 'num' outstanding requests per socket (1..256).\n");
+	fprintf(stderr, "  -s <num>               Open 'num' sockets per thread.\n");
+	fprintf(stderr, "  -S <file>              read secret from file, not command line.\n");
+	fprintf(stderr, "  -t <timeout>           Wait 'timeout' seconds for each reply (may be a floating point number).\n");
+	fprintf(stderr, "  -T <num>               Send from 'num' threads.\n");
+	fprintf(stderr, "  -v                     Show program version information.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	fr_exit_now(EXIT_SUCCESS);
+}
+
+static void radperf_get_port(fr_radius_packet_code_t type, uint16_t *port)
+{
+	if (*port != 0) return;
+
+	switch (type) {
+	default:
+	case FR_RADIUS_CODE_ACCESS_REQUEST:
+	case FR_RADIUS_CODE_STATUS_SERVER:
+		*port = FR_AUTH_UDP_PORT;
+		return;
+
+	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
+		*port = FR_ACCT_UDP_PORT;
+		return;
+
+	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
+		*port = FR_POD_UDP_PORT;
+		return;
+
+	case FR_RADIUS_CODE_COA_REQUEST:
+		*port = FR_COA_UDP_PORT;
+		return;
+	}
+}
+
+/** Read a whole file into a buffer
+ *
+ */
+static char *radperf_file_read(TALLOC_CTX *ctx, char const *filename)
+{
+	FILE	*fp;
+	char	*buffer;
+	char	chunk[4096];
+	size_t	len;
+
+	if (strcmp(filename, "-") == 0) {
+		fp = stdin;
+	} else {
+		fp = fopen(filename, "r");
+		if (!fp) {
+			fr_strerror_printf("Error opening %s: %s", filename, fr_syserror(errno));
+			return NULL;
+		}
+	}
+
+	MEM(buffer = talloc_strdup(ctx, ""));
+	while ((len = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+		MEM(buffer = talloc_strndup_append_buffer(buffer, chunk, len));
+	}
+
+	if (ferror(fp)) {
+		fr_strerror_printf("Error reading %s: %s", filename, fr_syserror(errno));
+		talloc_free(buffer);
+		buffer = NULL;
+	}
+	if (fp != stdin) fclose(fp);
+
+	return buffer;
+}
+
+/** Split a CSV line into fields, in place
+ *
+ * There's no support for quoting, fields can't contain commas.
+ *
+ * @return the number of fields.
+ */
+static unsigned int radperf_csv_split(char **fields, unsigned int max, char *line)
+{
+	unsigned int	num = 0;
+	char		*p;
+
+	p = line + strlen(line);
+	while ((p > line) && ((p[-1] == '\n') || (p[-1] == '\r'))) *--p = '\0';
+
+	p = line;
+	while (num < max) {
+		fields[num++] = p;
+
+		p = strchr(p, ',');
+		if (!p) break;
+		*p++ = '\0';
+	}
+
+	return num;
+}
+
+/** Expand ${column} references in the template, using one CSV row
+ *
+ */
+static char *radperf_template_expand(TALLOC_CTX *ctx, char const *template,
+				     char **names, char **values, unsigned int num)
+{
+	char const	*p = template, *q, *close;
+	char		*out;
+	unsigned int	i;
+
+	MEM(out = talloc_strdup(ctx, ""));
+
+	while ((q = strstr(p, "${")) != NULL) {
+		MEM(out = talloc_strndup_append_buffer(out, p, q - p));
+
+		close = strchr(q + 2, '}');
+		if (!close) {
+			fr_strerror_const("Unterminated ${ in template");
+		error:
+			talloc_free(out);
+			return NULL;
+		}
+
+		for (i = 0; i < num; i++) {
+			if ((strlen(names[i]) == (size_t) (close - (q + 2))) &&
+			    (strncmp(names[i], q + 2, close - (q + 2)) == 0)) break;
+		}
+		if (i == num) {
+			fr_strerror_printf("Template refers to unknown column \"%.*s\"",
+					   (int) (close - (q + 2)), q + 2);
+			goto error;
+		}
+
+		MEM(out = talloc_strdup_append_buffer(out, values[i]));
+		p = close + 1;
+	}
+
+	MEM(out = talloc_strdup_append_buffer(out, p));
+
+	return out;
+}
+
+/** Parse one expanded template into a list of attributes
+ *
+ */
+static int radperf_template_parse(TALLOC_CTX *ctx, fr_pair_list_t *out, char *text)
+{
+	FILE	*fp;
+	bool	filedone = false;
+	int	ret;
+
+	fp = fmemopen(text, strlen(text), "r");
+	if (!fp) {
+		fr_strerror_printf("Failed opening template: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	fr_pair_list_init(out);
+	ret = fr_pair_list_afrom_file(ctx, dict_radius, out, fp, &filedone);
+	fclose(fp);
+
+	return ret;
+}
+
+/** Build the packet templates, one per CSV row, or just one if there's no CSV file
+ *
+ */
+static int radperf_packets_alloc(TALLOC_CTX *ctx, fr_pair_list_t **out, unsigned int *num,
+				 char const *template_file, char const *csv_file)
+{
+	char		*template, *text, **texts;
+	FILE		*fp;
+	char		header[8192], line[8192];
+	char		*names[256], *values[256];
+	unsigned int	num_names, num_values;
+	fr_pair_list_t	*packets;
+	unsigned int	num_packets = 0, i;
+
+	template = radperf_file_read(ctx, template_file ? template_file : "-");
+	if (!template) return -1;
+
+	if (!csv_file) {
+		MEM(packets = talloc_array(ctx, fr_pair_list_t, 1));
+		if (radperf_template_parse(ctx, &packets[0], template) < 0) return -1;
+
+		*out = packets;
+		*num = 1;
+		return 0;
+	}
+
+	fp = fopen(csv_file, "r");
+	if (!fp) {
+		fr_strerror_printf("Error opening %s: %s", csv_file, fr_syserror(errno));
+		return -1;
+	}
+
+	if (!fgets(header, sizeof(header), fp)) {
+		fr_strerror_printf("No header line in %s", csv_file);
+	error:
+		fclose(fp);
+		return -1;
+	}
+	num_names = radperf_csv_split(names, NUM_ELEMENTS(names), header);
+
+	/*
+	 *	Expand all of the rows first.  The lists can't be
+	 *	parsed into an array which is then re-allocated, as
+	 *	they point back to their heads.
+	 */
+	MEM(texts = talloc_array(ctx, char *, 0));
+	while (fgets(line, sizeof(line), fp)) {
+		if ((line[0] == '\n') || (line[0] == '#')) continue;
+
+		num_values = radperf_csv_split(values, NUM_ELEMENTS(values), line);
+		if (num_values != num_names) {
+			fr_strerror_printf("%s[%u]: Expected %u fields, got %u", csv_file, num_packets + 2,
+					   num_names, num_values);
+			goto error;
+		}
+
+		text = radperf_template_expand(texts, template, names, values, num_values);
+		if (!text) goto error;
+
+		MEM(texts = talloc_realloc(ctx, texts, char *, num_packets + 1));
+		texts[num_packets++] = text;
+	}
+	fclose(fp);
+
+	if (!num_packets) {
+		fr_strerror_printf("No rows in %s", csv_file);
+		return -1;
+	}
+
+	MEM(packets = talloc_array(ctx, fr_pair_list_t, num_packets));
+	for (i = 0; i < num_packets; i++) {
+		if (radperf_template_parse(ctx, &packets[i], texts[i]) < 0) {
+			fr_strerror_printf_push("%s: Failed parsing template for row %u", csv_file, i + 1);
+			return -1;
+		}
+	}
+	talloc_free(texts);
+
+	*out = packets;
+	*num = num_packets;
+	return 0;
+}
+
+/** When packet "n" of a thread should be sent
+ *
+ * Threads interleave, so that together they send at an even total rate.
+ */
+static inline fr_time_t radperf_schedule(radperf_thread_t *t, uint64_t n)
+{
+	return start + (fr_time_t) ((double) (n * num_threads + t->id) * NSEC / rate);
+}
+
+static void radperf_record(radperf_stats_t *stats, uint64_t usec)
+{
+	unsigned int	idx;
+	unsigned int	shift;
+
+	if (usec > stats->max) stats->max = usec;
+
+	if (usec < (HIST_SUB_BUCKETS * 2)) {
+		idx = usec;
+	} else {
+		shift = fr_high_bit_pos(usec) - (HIST_SUB_BITS + 1);
+		idx = (shift * HIST_SUB_BUCKETS) + (usec >> shift);
+	}
+
+	stats->hist[idx]++;
+}
+
+/** The largest latency in a histogram bucket
+ *
+ */
+static uint64_t radperf_bucket_max(unsigned int idx)
+{
+	unsigned int	shift;
+
+	if (idx < (HIST_SUB_BUCKETS * 2)) return idx;
+
+	shift = (idx / HIST_SUB_BUCKETS) - 1;
+	return ((((uint64_t) idx % HIST_SUB_BUCKETS) + HIST_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+static void radperf_send(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+static void radperf_id_release(radperf_socket_t *s, radperf_id_t *rid)
+{
+	radperf_thread_t *t = s->thread;
+
+	rid->in_use = false;
+	fr_dlist_insert_tail(&s->free, rid);
+	s->outstanding--;
+	t->outstanding--;
+
+	if (t->blocked) {
+		t->blocked = false;
+		radperf_send(t->el, fr_time(), t);
+
+	} else if (t->sending_done && !t->outstanding) {
+		fr_event_loop_exit(t->el, 1);
+	}
+}
+
+/** Find a socket with a free ID
+ *
+ */
+static radperf_socket_t *radperf_socket_next(radperf_thread_t *t)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->num_sockets; i++) {
+		radperf_socket_t *s = &t->sockets[t->next_socket++];
+
+		if (t->next_socket == t->num_sockets) t->next_socket = 0;
+
+		if ((s->outstanding < max_outstanding) && (fr_dlist_num_elements(&s->free) > 0)) return s;
+	}
+
+	return NULL;
+}
+
+static void radperf_send_one(radperf_thread_t *t, radperf_socket_t *s, fr_time_t intended, fr_time_t now)
+{
+	radperf_id_t	*rid;
+	uint8_t		*packet = t->buffer;
+	fr_pair_list_t	*vps;
+	ssize_t		len;
+	unsigned int	i;
+	int		id;
+
+	rid = fr_dlist_pop_head(&s->free);
+	id = rid - s->ids;
+
+	vps = &t->packets[t->next_packet++];
+	if (t->next_packet == t->num_packets) t->next_packet = 0;
+
+	/*
+	 *	Callers of fr_radius_encode() have to fill in the
+	 *	authentication vector for these packets.
+	 */
+	if ((packet_code == FR_RADIUS_CODE_ACCESS_REQUEST) || (packet_code == FR_RADIUS_CODE_STATUS_SERVER)) {
+		for (i = 0; i < RADIUS_AUTH_VECTOR_LENGTH; i += sizeof(uint32_t)) {
+			if (t->rand.randcnt >= 256) {
+				t->rand.randcnt = 0;
+				fr_isaac(&t->rand);
+			}
+			memcpy(packet + 4 + i, &t->rand.randrsl[t->rand.randcnt++], sizeof(uint32_t));
+		}
+	}
+
+	len = fr_radius_encode(packet, sizeof(t->buffer), NULL, secret, secret_len, packet_code, id, vps);
+	if (len < 0) {
+		if (fr_debug_lvl) fr_perror("radperf");
+	error:
+		t->stats.errors++;
+		fr_dlist_insert_head(&s->free, rid);
+		return;
+	}
+
+	if (fr_radius_sign(packet, NULL, (uint8_t const *) secret, secret_len) < 0) {
+		if (fr_debug_lvl) fr_perror("radperf");
+		goto error;
+	}
+
+	if (send(s->fd, packet, len, 0) < 0) {
+		if (fr_debug_lvl) ERROR("Failed sending packet: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	memcpy(rid->header, packet, sizeof(rid->header));
+	rid->intended = intended;
+	rid->expires = now + timeout;
+	rid->in_use = true;
+	s->outstanding++;
+	t->outstanding++;
+
+	t->stats.sent++;
+	if ((now - intended) > fr_time_delta_from_msec(1)) t->stats.late++;
+}
+
+/** Send every packet which is due, and wait for the next one
+ *
+ * If all of the IDs are in use, we stop until one is freed.  The
+ * schedule doesn't move, so the packets which are held up are sent as
+ * soon as possible, and their latency includes the wait.
+ */
+static void radperf_send(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	radperf_thread_t	*t = talloc_get_type_abort(uctx, radperf_thread_t);
+	radperf_socket_t	*s;
+	fr_time_t		intended;
+
+	while (!t->sending_done) {
+		intended = radperf_schedule(t, t->next);
+		if ((t->next >= t->max) || (end && (intended >= end))) {
+			t->sending_done = true;
+			break;
+		}
+
+		if (intended > now) {
+			if (fr_event_timer_at(t, t->el, &t->send_ev, intended, radperf_send, t) < 0) {
+				fr_perror("radperf");
+				fr_exit_now(EXIT_FAILURE);
+			}
+			return;
+		}
+
+		s = radperf_socket_next(t);
+		if (!s) {
+			t->blocked = true;
+			return;
+		}
+
+		radperf_send_one(t, s, intended, now);
+		t->next++;
+	}
+
+	if (!t->outstanding) fr_event_loop_exit(t->el, 1);
+}
+
+/** Give up on requests which haven't had a reply
+ *
+ */
+static void radperf_sweep(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	radperf_thread_t	*t = talloc_get_type_abort(uctx, radperf_thread_t);
+	unsigned int		i, j;
+
+	for (i = 0; i < t->num_sockets; i++) {
+		radperf_socket_t *s = &t->sockets[i];
+
+		for (j = 0; (j < NUM_ELEMENTS(s->ids)) && s->outstanding; j++) {
+			if (!s->ids[j].in_use || (s->ids[j].expires > now)) continue;
+
+			t->stats.timeouts++;
+			radperf_id_release(s, &s->ids[j]);
+		}
+	}
+
+	if (fr_event_timer_in(t, t->el, &t->sweep_ev, fr_time_delta_from_msec(100), radperf_sweep, t) < 0) {
+		fr_perror("radperf");
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
+
+static void radperf_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	radperf_socket_t	*s = uctx;
+	radperf_thread_t	*t = s->thread;
+	uint8_t			*packet = t->buffer;
+	radperf_id_t		*rid;
+	ssize_t			data_len;
+	size_t			len;
+	fr_time_t		now;
+	decode_fail_t		reason;
+
+	for (;;) {
+		data_len = recv(fd, packet, sizeof(t->buffer), 0);
+		if (data_len < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+			if (errno == EINTR) continue;
+
+			if (fr_debug_lvl) ERROR("Failed reading reply: %s", fr_syserror(errno));
+			t->stats.errors++;
+			return;
+		}
+		now = fr_time();
+
+		len = data_len;
+		if (!fr_radius_ok(packet, &len, 0, false, &reason)) {
+			t->stats.invalid++;
+			continue;
+		}
+
+		rid = &s->ids[packet[1]];
+		if (!rid->in_use) {
+			t->stats.unexpected++;
+			continue;
+		}
+
+		if (fr_radius_verify(packet, rid->header, (uint8_t const *) secret, secret_len) < 0) {
+			if (fr_debug_lvl) fr_perror("radperf");
+			t->stats.invalid++;
+			continue;
+		}
+
+		t->stats.received++;
+		if (packet[0] < FR_RADIUS_CODE_MAX) t->stats.codes[packet[0]]++;
+		radperf_record(&t->stats, fr_time_delta_to_usec(now - rid->intended));
+
+		radperf_id_release(s, rid);
+	}
+}
+
+static void *radperf_thread(void *arg)
+{
+	radperf_thread_t	*t = arg;
+	unsigned int		i;
+
+	for (i = 0; i < t->num_sockets; i++) {
+		if (fr_event_fd_insert(t, t->el, t->sockets[i].fd, radperf_read, NULL, NULL, &t->sockets[i]) < 0) {
+			fr_perror("radperf");
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+
+	if ((fr_event_timer_at(t, t->el, &t->send_ev, start, radperf_send, t) < 0) ||
+	    (fr_event_timer_in(t, t->el, &t->sweep_ev, fr_time_delta_from_msec(100), radperf_sweep, t) < 0)) {
+		fr_perror("radperf");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	(void) fr_event_loop(t->el);
+
+	for (i = 0; i < t->num_sockets; i++) {
+		(void) fr_event_fd_delete(t->el, t->sockets[i].fd, FR_EVENT_FILTER_IO);
+	}
+
+	return NULL;
+}
+
+static radperf_thread_t *radperf_thread_alloc(unsigned int id, fr_pair_list_t *packets, unsigned int num_packets)
+{
+	radperf_thread_t	*t;
+	unsigned int		i, j;
+
+	/*
+	 *	Not parented, talloc isn't thread safe.
+	 */
+	MEM(t = talloc_zero(NULL, radperf_thread_t));
+	t->id = id;
+	t->max = UINT64_MAX;
+	if (count) t->max = (count / num_threads) + (id < (count % num_threads));
+
+	t->el = fr_event_list_alloc(t, NULL, NULL);
+	if (!t->el) return NULL;
+
+	MEM(t->packets = talloc_array(t, fr_pair_list_t, num_packets));
+	for (i = 0; i < num_packets; i++) {
+		fr_pair_list_init(&t->packets[i]);
+		if (fr_pair_list_copy(t, &t->packets[i], &packets[i]) < 0) return NULL;
+	}
+	t->num_packets = num_packets;
+
+	for (i = 0; i < NUM_ELEMENTS(t->rand.randrsl); i++) t->rand.randrsl[i] = fr_rand();
+	fr_rand_init(&t->rand, 1);
+	t->rand.randcnt = 0;
+
+	MEM(t->sockets = talloc_zero_array(t, radperf_socket_t, sockets_per_thread));
+	for (i = 0; i < sockets_per_thread; i++) {
+		radperf_socket_t *s = &t->sockets[i];
+
+		s->thread = t;
+		s->fd = fr_socket_client_udp(NULL, NULL, &server_ipaddr, server_port, true);
+		if (s->fd < 0) return NULL;
+		t->num_sockets++;
+
+		fr_dlist_init(&s->free, radperf_id_t, entry);
+		for (j = 0; j < NUM_ELEMENTS(s->ids); j++) fr_dlist_insert_tail(&s->free, &s->ids[j]);
+	}
+
+	return t;
+}
+
+static void radperf_thread_free(radperf_thread_t *t)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->num_sockets; i++) close(t->sockets[i].fd);
+	talloc_free(t);
+}
+
+static void radperf_summary(radperf_stats_t *stats, fr_time_delta_t elapsed)
+{
+	static double const	percentiles[] = { 50, 90, 99, 99.9, 99.99 };
+	unsigned int		i, j;
+	uint64_t		total = 0;
+
+	printf("Packet summary:\n"
+	       "\tSent          : %" PRIu64 "\n"
+	       "\tSent late     : %" PRIu64 "\n"
+	       "\tReceived      : %" PRIu64 "\n"
+	       "\tTimed out     : %" PRIu64 "\n"
+	       "\tErrors        : %" PRIu64 "\n"
+	       "\tInvalid       : %" PRIu64 "\n"
+	       "\tUnexpected    : %" PRIu64 "\n",
+	       stats->sent, stats->late, stats->received, stats->timeouts,
+	       stats->errors, stats->invalid, stats->unexpected);
+
+	if (elapsed > 0) {
+		printf("\tRate          : %.1f/s sent, %.1f/s received\n",
+		       (double) stats->sent * NSEC / elapsed, (double) stats->received * NSEC / elapsed);
+	}
+
+	for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
+		if (!stats->codes[i]) continue;
+
+		printf("\t%-14s: %" PRIu64 "\n", fr_packet_codes[i], stats->codes[i]);
+	}
+
+	if (!stats->received) return;
+
+	printf("Latency (usec, from the scheduled send time):\n");
+
+	for (i = 0, j = 0; i < NUM_ELEMENTS(percentiles); i++) {
+		uint64_t want = (stats->received * percentiles[i] + 99) / 100;
+
+		if (!want) want = 1;
+
+		while ((j < HIST_BUCKETS) && ((total + stats->hist[j]) < want)) total += stats->hist[j++];
+
+		printf("\tp%-13g: %" PRIu64 "\n", percentiles[i], radperf_bucket_max(j));
+	}
+
+	printf("\tmax           : %" PRIu64 "\n", stats->max);
+}
+
+/**
+ *
+ * @hidecallgraph
+ */
+int main(int argc, char **argv)
+{
+	int			c;
+	char const		*raddb_dir = RADDBDIR;
+	char const		*dict_dir = DICTDIR;
+	char const		*template_file = NULL;
+	char const		*csv_file = NULL;
+	char			filesecret[256];
+	FILE			*fp;
+	int			force_af = AF_UNSPEC;
+	TALLOC_CTX		*autofree;
+	fr_pair_list_t		*packets;
+	unsigned int		num_packets;
+	radperf_thread_t	**threads;
+	radperf_stats_t		*stats;
+	fr_time_t		finished;
+	unsigned int		i, j;
+	int			ret = EXIT_SUCCESS;
+
+	fr_debug_lvl = 0;
+	fr_log_fp = stdout;
+
+	/*
+	 *	Must be called first, so the handler is called last
+	 */
+	fr_atexit_global_setup();
+
+	autofree = talloc_autofree_context();
+
+#ifndef NDEBUG
+	if (fr_fault_setup(autofree, getenv("PANIC_ACTION"), argv[0]) < 0) {
+		fr_perror("radperf");
+		fr_exit_now(EXIT_FAILURE);
+	}
+#endif
+
+	talloc_set_log_stderr();
+
+	/*
+	 *	Always log to stdout
+	 */
+	default_log.dst = L_DST_STDOUT;
+	default_log.fd = STDOUT_FILENO;
+	default_log.print_level = false;
+
+	while ((c = getopt(argc, argv, "46c:d:D:f:F:hl:n:o:s:S:t:T:vx")) != -1) switch (c) {
+		case '4':
+			force_af = AF_INET;
+			break;
+
+		case '6':
+			force_af = AF_INET6;
+			break;
+
+		case 'c':
+			if (!isdigit((int) *optarg)) usage();
+			count = strtoull(optarg, NULL, 10);
+			if (!count) usage();
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'd':
+			raddb_dir = optarg;
+			break;
+
+		case 'f':
+			template_file = optarg;
+			break;
+
+		case 'F':
+			csv_file = optarg;
+			break;
+
+		case 'l':
+			if (fr_time_delta_from_str(&duration, optarg, FR_TIME_RES_SEC) < 0) {
+				fr_perror("Failed parsing duration");
+				fr_exit_now(EXIT_FAILURE);
+			}
+			if (duration <= 0) usage();
+			break;
+
+		case 'n':
+			if (!isdigit((int) *optarg)) usage();
+			rate = strtoull(optarg, NULL, 10);
+			if (!rate) usage();
+			break;
+
+		case 'o':
+			max_outstanding = atoi(optarg);
+			if ((max_outstanding < 1) || (max_outstanding > 256)) usage();
+			break;
+
+		case 's':
+			sockets_per_thread = atoi(optarg);
+			if ((sockets_per_thread < 1) || (sockets_per_thread > 1024)) usage();
+			break;
+
+		case 'S':
+		{
+			char *p;
+			fp = fopen(optarg, "r");
+			if (!fp) {
+			       ERROR("Error opening %s: %s", optarg, fr_syserror(errno));
+			       fr_exit_now(1);
+			}
+			if (fgets(filesecret, sizeof(filesecret), fp) == NULL) {
+			       ERROR("Error reading %s: %s", optarg, fr_syserror(errno));
+			       fr_exit_now(1);
+			}
+			fclose(fp);
+
+			/* truncate newline */
+			p = filesecret + strlen(filesecret) - 1;
+			while ((p >= filesecret) &&
+			      (*p < ' ')) {
+			       *p = '\0';
+			       --p;
+			}
+
+			if (strlen(filesecret) < 2) {
+			       ERROR("Secret in %s is too short", optarg);
+			       fr_exit_now(1);
+			}
+			secret = talloc_strdup(NULL, filesecret);
+		}
+		       break;
+
+		case 't':
+			if (fr_time_delta_from_str(&timeout, optarg, FR_TIME_RES_SEC) < 0) {
+				fr_perror("Failed parsing timeout value");
+				fr_exit_now(EXIT_FAILURE);
+			}
+			break;
+
+		case 'T':
+			num_threads = atoi(optarg);
+			if ((num_threads < 1) || (num_threads > 1024)) usage();
+			break;
+
+		case 'v':
+			fr_debug_lvl = 1;
+			DEBUG("%s", radperf_version);
+			fr_exit_now(0);
+
+		case 'x':
+			fr_debug_lvl++;
+			if (fr_debug_lvl > 1) default_log.print_level = true;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+	argc -= (optind - 1);
+	argv += (optind - 1);
+
+	if ((argc < 3) || ((secret == NULL) && (argc < 4))) {
+		ERROR("Insufficient arguments");
+		usage();
+	}
+
+	if (!count && !duration) duration = fr_time_delta_from_sec(10);
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("radperf");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (!fr_dict_global_ctx_init(autofree, dict_dir)) {
+		fr_perror("radperf");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_radius_init() < 0) {
+		fr_perror("radperf");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_dict_autoload(radperf_dict) < 0) {
+		fr_perror("radperf");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_dict_read(fr_dict_unconst(dict_freeradius), raddb_dir, FR_DICTIONARY_FILE) == -1) {
+		fr_log_perror(&default_log, L_ERR, __FILE__, __LINE__, NULL,
+			      "Failed to initialize the dictionaries");
+		fr_exit_now(EXIT_FAILURE);
+	}
+	fr_strerror_clear();	/* Clear the error buffer */
+
+	/*
+	 *	Get the request type
+	 */
+	if (!isdigit((int) argv[2][0])) {
+		packet_code = fr_table_value_by_str(fr_request_types, argv[2], -2);
+		if (packet_code == -2) {
+			ERROR("Unrecognised request type \"%s\"", argv[2]);
+			usage();
+		}
+	} else {
+		packet_code = atoi(argv[2]);
+	}
+
+	if (!is_radius_code(packet_code) || !fr_request_packets[packet_code]) {
+		ERROR("Request type \"%s\" can't be used for load testing", argv[2]);
+		usage();
+	}
+
+	if (fr_inet_pton_port(&server_ipaddr, &server_port, argv[1], -1, force_af, true, true) < 0) {
+		fr_perror("radperf");
+		fr_exit_now(EXIT_FAILURE);
+	}
+	radperf_get_port(packet_code, &server_port);
+
+	if (argv[3]) secret = talloc_strdup(NULL, argv[3]);
+	secret_len = talloc_array_length(secret) - 1;
+
+	if (radperf_packets_alloc(autofree, &packets, &num_packets, template_file, csv_file) < 0) {
+		fr_perror("radperf");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	MEM(threads = talloc_zero_array(autofree, radperf_thread_t *, num_threads));
+	for (i = 0; i < num_threads; i++) {
+		threads[i] = radperf_thread_alloc(i, packets, num_packets);
+		if (!threads[i]) {
+			fr_perror("radperf");
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+
+	/*
+	 *	Give the threads time to start, so that the first
+	 *	packets aren't all late.
+	 */
+	start = fr_time() + fr_time_delta_from_msec(100);
+	if (duration) end = start + duration;
+
+	for (i = 0; i < num_threads; i++) {
+		int rcode;
+
+		rcode = pthread_create(&threads[i]->pthread, NULL, radperf_thread, threads[i]);
+		if (rcode != 0) {
+			ERROR("Failed starting thread: %s", fr_syserror(rcode));
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+
+	MEM(stats = talloc_zero(autofree, radperf_stats_t));
+	for (i = 0; i < num_threads; i++) {
+		radperf_thread_t *t = threads[i];
+
+		pthread_join(t->pthread, NULL);
+
+		stats->sent += t->stats.sent;
+		stats->late += t->stats.late;
+		stats->received += t->stats.received;
+		stats->timeouts += t->stats.timeouts;
+		stats->errors += t->stats.errors;
+		stats->invalid += t->stats.invalid;
+		stats->unexpected += t->stats.unexpected;
+		for (j = 0; j < FR_RADIUS_CODE_MAX; j++) stats->codes[j] += t->stats.codes[j];
+		for (j = 0; j < HIST_BUCKETS; j++) stats->hist[j] += t->stats.hist[j];
+		if (t->stats.max > stats->max) stats->max = t->stats.max;
+
+		radperf_thread_free(t);
+	}
+	finished = fr_time();
+
+	radperf_summary(stats, finished - start);
+
+	if (stats->timeouts || stats->errors || stats->invalid) ret = EXIT_FAILURE;
+
+	talloc_free(secret);
+
+	fr_radius_free();
+
+	fr_dict_autofree(radperf_dict);
+
+	fr_exit_now(ret);
+}
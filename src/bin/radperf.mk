@@ -0,0 +1,5 @@
+TARGET		:= radperf
+SOURCES		:= radperf.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
@@ -47,14 +47,22 @@ RCSID("$Id$")
 #define RS_ASSERT(_x) if (!(_x) && !fr_cond_assert(_x)) exit(1)
 
 static rs_t *conf;
-static struct timeval start_pcap = {0, 0};
-static char timestr[50];
-
-static fr_rb_tree_t *request_tree = NULL;
-static fr_rb_tree_t *link_tree = NULL;
-static fr_event_list_t *events;
 static bool cleanup;
 
+/*
+ *	Each worker thread tracks its own requests, with its own
+ *	event list.  Without workers these all belong to the main
+ *	thread.
+ */
+static _Thread_local struct timeval start_pcap = {0, 0};
+static _Thread_local char timestr[50];
+
+static _Thread_local fr_rb_tree_t *request_tree = NULL;
+static _Thread_local fr_rb_tree_t *link_tree = NULL;
+static _Thread_local fr_event_list_t *events;
+static _Thread_local TALLOC_CTX *packet_ctx;		//!< Where requests and packets are allocated.
+static _Thread_local rs_worker_t *rs_worker;		//!< The worker we're running in, or NULL.
+
 static int self_pipe[2] = {-1, -1};		//!< Signals from sig handlers
 
 static char const *radsniff_version = RADIUSD_VERSION_STRING_BUILD("radsniff");
@@ -782,6 +790,51 @@ static void rs_stats_print_csv(rs_update_t *this, rs_stats_t *stats, UNUSED stru
 	fprintf(stdout , "%s\n", buffer);
 }
 
+/** Take the totals the workers have passed us since the last interval
+ *
+ * @return true if any of the workers' capture handles dropped packets.
+ */
+static bool rs_stats_merge(rs_stats_t *stats)
+{
+	unsigned int	i, j;
+	size_t		k;
+	bool		dropped = false;
+
+#define TAKE(_field) atomic_exchange_explicit(&shared->_field, 0, memory_order_relaxed)
+	for (i = 0; i < conf->num_workers; i++) {
+		rs_worker_t *worker = &conf->workers[i];
+
+		if (atomic_exchange_explicit(&worker->dropped, false, memory_order_relaxed)) dropped = true;
+
+		for (k = 0; k < NUM_ELEMENTS(rs_useful_codes); k++) {
+			rs_latency_t		*latency = &stats->exchange[rs_useful_codes[k]];
+			rs_latency_shared_t	*shared = &worker->shared[rs_useful_codes[k]];
+			double			high, low;
+
+			latency->interval.received_total += TAKE(received_total);
+			latency->interval.linked_total += TAKE(linked_total);
+			latency->interval.unlinked_total += TAKE(unlinked_total);
+			latency->interval.reused_total += TAKE(reused_total);
+			latency->interval.lost_total += TAKE(lost_total);
+			for (j = 0; j <= RS_RETRANSMIT_MAX; j++) latency->interval.rt_total[j] += TAKE(rt_total[j]);
+
+			/* Workers record latency in nanoseconds, we want milliseconds */
+			latency->interval.latency_total += ((long double) TAKE(latency_total)) / 1000000;
+
+			high = ((double) TAKE(latency_high)) / 1000000;
+			if (high > latency->interval.latency_high) latency->interval.latency_high = high;
+
+			low = ((double) TAKE(latency_low)) / 1000000;
+			if ((low > 0) && (!latency->interval.latency_low || (low < latency->interval.latency_low))) {
+				latency->interval.latency_low = low;
+			}
+		}
+	}
+#undef TAKE
+
+	return dropped;
+}
+
 /** Process stats for a single interval
  *
  */
@@ -803,6 +856,13 @@ static void rs_stats_process(fr_event_list_t *el, fr_time_t now_t, void *ctx)
 
 	stats->intervals++;
 
+	if (conf->num_workers && rs_stats_merge(stats)) {
+		ERROR("Muting stats for the next %i milliseconds", conf->stats.timeout);
+
+		rs_tv_add_ms(&now, conf->stats.timeout, &stats->quiet);
+		goto clear;
+	}
+
 	for (in_p = this->in;
 	     in_p;
 	     in_p = in_p->next) {
@@ -1221,7 +1281,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	bool			response;		/* Was it a response code */
 
 	decode_fail_t		reason;			/* Why we failed decoding the packet */
-	static uint64_t		captured = 0;
+	static _Thread_local uint64_t captured = 0;
 
 	rs_status_t		status = RS_NORMAL;	/* Any special conditions (RTX, Unlinked, ID-Reused) */
 	fr_radius_packet_t	*packet;		/* Current packet were processing */
@@ -1332,7 +1392,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	 *	recover once some requests timeout, so make an effort to deal
 	 *	with allocation failures gracefully.
 	 */
-	packet = fr_radius_packet_alloc(conf, false);
+	packet = fr_radius_packet_alloc(packet_ctx, false);
 	if (!packet) {
 		REDEBUG("Failed allocating memory to hold decoded packet");
 		rs_tv_add_ms(&header->ts, conf->stats.timeout, &stats->quiet);
@@ -1412,9 +1472,9 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			int ret;
 			FILE *log_fp = fr_log_fp;
 
-			fr_log_fp = NULL;
+			if (!rs_worker) fr_log_fp = NULL;	/* Shared by all workers */
 			ret = fr_radius_packet_verify(packet, original->expect, conf->radius_secret);
-			fr_log_fp = log_fp;
+			if (!rs_worker) fr_log_fp = log_fp;
 			if (ret != 0) {
 				fr_perror("Failed verifying packet ID %d", packet->id);
 				fr_radius_packet_free(&packet);
@@ -1430,10 +1490,10 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			int ret;
 			FILE *log_fp = fr_log_fp;
 
-			fr_log_fp = NULL;
+			if (!rs_worker) fr_log_fp = NULL;	/* Shared by all workers */
 			ret = fr_radius_packet_decode(packet, &decoded, original ? original->expect : NULL,
 						      RADIUS_MAX_ATTRIBUTES, false, conf->radius_secret);
-			fr_log_fp = log_fp;
+			if (!rs_worker) fr_log_fp = log_fp;
 			if (ret != 0) {
 				fr_radius_packet_free(&packet);		/* Also frees vps */
 				REDEBUG("Failed decoding");
@@ -1540,9 +1600,9 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 				int ret;
 				FILE *log_fp = fr_log_fp;
 
-				fr_log_fp = NULL;
+				if (!rs_worker) fr_log_fp = NULL;	/* Shared by all workers */
 				ret = fr_radius_packet_verify(packet, NULL, conf->radius_secret);
-				fr_log_fp = log_fp;
+				if (!rs_worker) fr_log_fp = log_fp;
 				if (ret != 0) {
 					fr_perror("Failed verifying packet ID %d", packet->id);
 					fr_radius_packet_free(&packet);
@@ -1564,10 +1624,10 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			int ret;
 			FILE *log_fp = fr_log_fp;
 
-			fr_log_fp = NULL;
+			if (!rs_worker) fr_log_fp = NULL;	/* Shared by all workers */
 			ret = fr_radius_packet_decode(packet, &decoded, NULL,
 						      RADIUS_MAX_ATTRIBUTES, false, conf->radius_secret);
-			fr_log_fp = log_fp;
+			if (!rs_worker) fr_log_fp = log_fp;
 
 			if (ret != 0) {
 				fr_radius_packet_free(&packet);	/* Also frees vps */
@@ -1689,7 +1749,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 *	...nope it's a new request.
 		 */
 		} else {
-			original = rs_request_alloc(conf);
+			original = rs_request_alloc(packet_ctx);
 			original->id = count;
 			original->in = event->in;
 			original->stats_req = &stats->exchange[packet->code];
@@ -1857,8 +1917,8 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 
 static void rs_got_packet(fr_event_list_t *el, int fd, UNUSED int flags, void *ctx)
 {
-	static uint64_t		count = 0;	/* Packets seen */
-	static fr_time_t	last_sync = 0;
+	static _Thread_local uint64_t count = 0;	/* Packets seen */
+	static _Thread_local fr_time_t last_sync = 0;
 	fr_time_t		now_real;
 	rs_event_t		*event = talloc_get_type(ctx, rs_event_t);
 	pcap_t			*handle = event->in->handle;
@@ -1873,9 +1933,12 @@ static void rs_got_packet(fr_event_list_t *el, int fd, UNUSED int flags, void *c
 	 *	pcap file time, we need to implement our own time
 	 *	tracking here, and run the monotonic/wallclock sync
 	 *	event ourselves.
+	 *
+	 *	Workers only capture live traffic, and the offset is
+	 *	shared by all of them, so it's left alone.
 	 */
 	now_real = fr_time();
-	if ((now_real - last_sync) > fr_time_delta_from_sec(1)) {
+	if (!conf->num_workers && ((now_real - last_sync) > fr_time_delta_from_sec(1))) {
 		fr_time_sync();
 		last_sync = now_real;
 	}
@@ -2114,6 +2177,225 @@ static void _unmark_link(void *request)
 /** Re-open the collectd socket
  *
  */
+static void rs_atomic_max(atomic_uint_fast64_t *store, uint64_t value)
+{
+	uint_fast64_t current = atomic_load_explicit(store, memory_order_relaxed);
+
+	while ((value > current) &&
+	       !atomic_compare_exchange_weak_explicit(store, &current, value,
+						      memory_order_relaxed, memory_order_relaxed));
+}
+
+static void rs_atomic_min(atomic_uint_fast64_t *store, uint64_t value)
+{
+	uint_fast64_t current = atomic_load_explicit(store, memory_order_relaxed);
+
+	while ((!current || (value < current)) &&
+	       !atomic_compare_exchange_weak_explicit(store, &current, value,
+						      memory_order_relaxed, memory_order_relaxed));
+}
+
+/** Pass the totals gathered by a worker since the last flush to the main thread
+ *
+ */
+static void rs_worker_flush(fr_event_list_t *el, UNUSED fr_time_t now, void *ctx)
+{
+	static _Thread_local fr_event_timer_t const *event;
+	rs_stats_t	*stats = ctx;
+	fr_pcap_t	*in_p;
+	size_t		i;
+	unsigned int	j;
+
+#define GIVE(_field, _value) atomic_fetch_add_explicit(&shared->_field, _value, memory_order_relaxed)
+	for (i = 0; i < NUM_ELEMENTS(rs_useful_codes); i++) {
+		rs_latency_t		*latency = &stats->exchange[rs_useful_codes[i]];
+		rs_latency_shared_t	*shared = &rs_worker->shared[rs_useful_codes[i]];
+
+		GIVE(received_total, latency->interval.received_total);
+		GIVE(linked_total, latency->interval.linked_total);
+		GIVE(unlinked_total, latency->interval.unlinked_total);
+		GIVE(reused_total, latency->interval.reused_total);
+		GIVE(lost_total, latency->interval.lost_total);
+		for (j = 0; j <= RS_RETRANSMIT_MAX; j++) GIVE(rt_total[j], latency->interval.rt_total[j]);
+
+		if (latency->interval.linked_total) {
+			GIVE(latency_total, (uint64_t) (latency->interval.latency_total * 1000000));
+			rs_atomic_max(&shared->latency_high, (uint64_t) (latency->interval.latency_high * 1000000));
+			rs_atomic_min(&shared->latency_low, (uint64_t) (latency->interval.latency_low * 1000000));
+		}
+
+		memset(&latency->interval, 0, sizeof(latency->interval));
+	}
+#undef GIVE
+
+	for (in_p = rs_worker->in; in_p; in_p = in_p->next) {
+		if (rs_check_pcap_drop(in_p) < 0) atomic_store_explicit(&rs_worker->dropped, true, memory_order_relaxed);
+	}
+
+	if (fr_event_timer_in(NULL, el, &event, fr_time_delta_from_msec(RS_WORKER_FLUSH), rs_worker_flush, ctx) < 0) {
+		ERROR("Failed inserting worker flush event");
+	}
+}
+
+static void rs_worker_wake(fr_event_list_t *el, int fd, UNUSED int flags, UNUSED void *ctx)
+{
+	uint8_t buffer[1];
+
+	while ((read(fd, buffer, sizeof(buffer)) < 0) && (errno == EINTR));
+
+	fr_event_loop_exit(el, 1);
+}
+
+static void *rs_worker_thread(void *arg)
+{
+	rs_worker_t	*worker = arg;
+	rs_stats_t	*stats;
+	fr_pcap_t	*in_p;
+
+	rs_worker = worker;
+	packet_ctx = worker->ctx;
+
+	request_tree = fr_rb_inline_talloc_alloc(worker->ctx, rs_request_t, request_node, rs_packet_cmp, _unmark_request);
+	events = fr_event_list_alloc(worker->ctx, NULL, NULL);
+	stats = talloc_zero(worker->ctx, rs_stats_t);
+	if (!request_tree || !events || !stats) {
+		ERROR("Worker %u failed allocating memory", worker->id);
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_event_fd_insert(NULL, events, worker->wake[0], rs_worker_wake, NULL, NULL, NULL) < 0) {
+		fr_perror("Worker %u failed inserting wakeup pipe", worker->id);
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	for (in_p = worker->in;
+	     in_p;
+	     in_p = in_p->next) {
+		rs_event_t *event;
+
+		MEM(event = talloc_zero(events, rs_event_t));
+		event->list = events;
+		event->in = in_p;
+		event->stats = stats;
+
+		if (fr_event_fd_insert(NULL, events, in_p->fd, rs_got_packet, NULL, NULL, event) < 0) {
+			fr_perror("Worker %u failed inserting file descriptor", worker->id);
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+
+	if (conf->stats.interval) rs_worker_flush(events, fr_time(), stats);
+
+	fr_event_loop(events);
+
+	/*
+	 *	Requests remove themselves from our trees and event
+	 *	list as they're freed, so this must be done here.
+	 */
+	TALLOC_FREE(worker->ctx);
+
+	return NULL;
+}
+
+/** Open a capture handle on each interface for every worker, and start them
+ *
+ * The first worker uses the handles we've already opened.  All handles
+ * for an interface join the same fanout group, so each worker sees a
+ * share of its flows.
+ */
+static int rs_workers_start(fr_pcap_t *in)
+{
+	unsigned int	i, j;
+	uint16_t	group = getpid() & 0xffff;
+	fr_pcap_t	*in_p;
+
+	MEM(conf->workers = talloc_zero_array(conf, rs_worker_t, conf->num_workers));
+	for (i = 0; i < conf->num_workers; i++) {
+		conf->workers[i].wake[0] = conf->workers[i].wake[1] = -1;
+	}
+
+	for (i = 0; i < conf->num_workers; i++) {
+		rs_worker_t	*worker = &conf->workers[i];
+		fr_pcap_t	**in_head = &worker->in;
+
+		worker->id = i;
+		worker->ctx = talloc_init_const("radsniff worker");
+
+		if (i == 0) {
+			worker->in = in;
+		} else for (in_p = in; in_p; in_p = in_p->next) {
+			fr_pcap_t *this;
+
+			this = fr_pcap_init(worker->ctx, in_p->name, in_p->type);
+			if (!this) return -1;
+
+			this->promiscuous = in_p->promiscuous;
+			this->buffer_pkts = in_p->buffer_pkts;
+			if (fr_pcap_open(this) < 0) {
+				fr_perror("Failed opening pcap handle (%s)", this->name);
+				return -1;
+			}
+
+			if (conf->pcap_filter &&
+			    (!conf->pcap_filter_vlan || (fr_pcap_apply_filter(this, conf->pcap_filter_vlan) < 0)) &&
+			    (fr_pcap_apply_filter(this, conf->pcap_filter) < 0)) {
+				fr_perror("Failed applying filter");
+				return -1;
+			}
+
+			*in_head = this;
+			in_head = &this->next;
+		}
+
+		for (in_p = worker->in, j = 0; in_p; in_p = in_p->next, j++) {
+			if (fr_pcap_fanout(in_p, group + j) < 0) {
+				fr_perror("radsniff");
+				return -1;
+			}
+		}
+
+		if (pipe(worker->wake) < 0) {
+			ERROR("Couldn't open worker pipe: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	for (i = 0; i < conf->num_workers; i++) {
+		rs_worker_t	*worker = &conf->workers[i];
+		int		rcode;
+
+		rcode = pthread_create(&worker->thread, NULL, rs_worker_thread, worker);
+		if (rcode != 0) {
+			ERROR("Failed starting worker %u: %s", i, fr_syserror(rcode));
+			return -1;
+		}
+		worker->started = true;
+	}
+
+	DEBUG("Started %u workers", conf->num_workers);
+
+	return 0;
+}
+
+static void rs_workers_stop(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < conf->num_workers; i++) {
+		rs_worker_t *worker = &conf->workers[i];
+
+		if (worker->started) {
+			while ((write(worker->wake[1], "", 1) < 0) && (errno == EINTR));
+			pthread_join(worker->thread, NULL);
+			worker->started = false;
+		}
+
+		TALLOC_FREE(worker->ctx);
+		if (worker->wake[0] >= 0) close(worker->wake[0]);
+		if (worker->wake[1] >= 0) close(worker->wake[1]);
+	}
+}
+
 static void rs_collectd_reopen(fr_event_list_t *el, fr_time_t now, UNUSED void *ctx)
 {
 	static fr_event_timer_t const *event;
@@ -2215,6 +2497,7 @@ static NEVER_RETURNS void usage(int status)
 	fprintf(output, "  -h                    This help message.\n");
 	fprintf(output, "  -i <interface>        Capture packets from interface (defaults to all if supported).\n");
 	fprintf(output, "  -I <file>             Read packets from <file>\n");
+	fprintf(output, "  -j <threads>          Process live captures in <threads> threads (Linux only).\n");
 	fprintf(output, "  -l <attr>[,<attr>]    Output packet sig and a list of attributes.\n");
 	fprintf(output, "  -L <attr>[,<attr>]    Detect retransmissions using these attributes to link requests.\n");
 	fprintf(output, "  -m                    Don't put interface(s) into promiscuous mode.\n");
@@ -2287,6 +2570,7 @@ int main(int argc, char *argv[])
 
 	conf = talloc_zero(autofree, rs_t);
 	RS_ASSERT(conf);
+	packet_ctx = conf;
 	fr_pair_list_init(&conf->filter_request_vps);
 	fr_pair_list_init(&conf->filter_response_vps);
 
@@ -2311,7 +2595,7 @@ int main(int argc, char *argv[])
 	/*
 	 *  Get options
 	 */
-	while ((c = getopt(argc, argv, "ab:c:C:d:D:e:Ef:hi:I:l:L:mp:P:qr:R:s:Svw:xXW:T:P:N:O:")) != -1) {
+	while ((c = getopt(argc, argv, "ab:c:C:d:D:e:Ef:hi:I:j:l:L:mp:P:qr:R:s:Svw:xXW:T:P:N:O:")) != -1) {
 		switch (c) {
 		case 'a':
 		{
@@ -2405,6 +2689,18 @@ int main(int argc, char *argv[])
 			conf->from_file = true;
 			break;
 
+		case 'j':
+		{
+			int num = atoi(optarg);
+
+			if ((num < 1) || (num > RS_WORKER_MAX)) {
+				ERROR("Number of threads must be between 1 and %i", RS_WORKER_MAX);
+				usage(64);
+			}
+			conf->num_workers = (num > 1) ? num : 0;
+		}
+			break;
+
 		case 'l':
 			conf->list_attributes = optarg;
 			break;
@@ -2553,6 +2849,19 @@ int main(int argc, char *argv[])
 		conf->to_stdout = false;
 	}
 
+	/*
+	 *	Workers share each interface between them, and each
+	 *	only sees its own requests.  Retransmissions linked by
+	 *	attribute may arrive at a different worker, and the
+	 *	capture limit and output file can't be shared.
+	 */
+	if (conf->num_workers &&
+	    (conf->from_file || conf->from_stdin || conf->to_file || conf->to_stdout ||
+	     conf->link_attributes || conf->limit)) {
+		ERROR("-j can only be used with live captures, and not with -c, -L, -S or -w");
+		usage(64);
+	}
+
 	if (conf->to_stdout) {
 		out = fr_pcap_init(conf, "stdout", PCAP_STDIO_OUT);
 		if (!out) {
@@ -2968,13 +3277,14 @@ int main(int argc, char *argv[])
 		 */
 		if (conf->stats.interval && conf->from_dev) {
 			now = fr_time_to_timeval(fr_time());
-			rs_install_stats_processor(stats, events, in, &now, false);
+			rs_install_stats_processor(stats, events, conf->num_workers ? NULL : in, &now, false);
 		}
 
 		/*
-		 *  Now add fd's for each of the pcap sessions we opened
+		 *  Now add fd's for each of the pcap sessions we opened,
+		 *  unless the workers will be reading from them.
 		 */
-		for (in_p = in;
+		for (in_p = conf->num_workers ? NULL : in;
 		     in_p;
 		     in_p = in_p->next) {
 			rs_event_t *event;
@@ -3012,7 +3322,7 @@ int main(int argc, char *argv[])
 	/*
 	 *	If we just have the pipe, then exit.
 	 */
-	if (fr_event_list_num_fds(events) == 1) goto finish;
+	if (!conf->num_workers && (fr_event_list_num_fds(events) == 1)) goto finish;
 
 
 	/*
@@ -3022,6 +3332,14 @@ int main(int argc, char *argv[])
 		rs_daemonize(conf->pidfile);
 	}
 
+	/*
+	 *	Threads don't survive daemonizing, so start them afterwards.
+	 */
+	if (conf->num_workers && (rs_workers_start(in) < 0)) {
+		ret = EXIT_FAILURE;
+		goto finish;
+	}
+
 	/*
 	 *	Setup signal handlers so we always exit gracefully, ensuring output buffers are always
 	 *	flushed.
@@ -3039,6 +3357,8 @@ int main(int argc, char *argv[])
 	DEBUG2("Done sniffing");
 
 finish:
+	if (conf->workers) rs_workers_stop();
+
 	cleanup = true;
 
 	if (conf->daemonize) unlink(conf->pidfile);
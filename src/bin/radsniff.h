@@ -28,6 +28,13 @@
 RCSIDH(radsniff_h, "$Id$")
 
 #include <sys/types.h>
+#include <pthread.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 
 #include <freeradius-devel/util/base.h>
 #include <freeradius-devel/util/pcap.h>
@@ -45,6 +52,8 @@ RCSIDH(radsniff_h, "$Id$")
 #define RS_RETRANSMIT_MAX	5		//!< Maximum number of times we expect to see a packet retransmitted
 #define RS_MAX_ATTRS		50		//!< Maximum number of attributes we can filter on.
 #define RS_SOCKET_REOPEN_DELAY  5000		//!< How long we delay re-opening a collectd socket.
+#define RS_WORKER_FLUSH		100		//!< How often workers pass their stats to the main thread (ms).
+#define RS_WORKER_MAX		256		//!< Maximum number of worker threads.
 
 /*
  *	Logging macros
@@ -172,6 +181,45 @@ typedef struct {
 							//!< dropping packets, or we run out of memory.
 } rs_stats_t;
 
+/** Interval totals passed from a worker thread to the main thread
+ *
+ * Workers add their totals in every #RS_WORKER_FLUSH milliseconds, and
+ * the main thread swaps them for zero when it processes the stats, so
+ * neither ever waits for the other.
+ */
+typedef struct {
+	atomic_uint_fast64_t	received_total;
+	atomic_uint_fast64_t	linked_total;
+	atomic_uint_fast64_t	unlinked_total;
+	atomic_uint_fast64_t	reused_total;
+	atomic_uint_fast64_t	lost_total;
+	atomic_uint_fast64_t	rt_total[RS_RETRANSMIT_MAX + 1];
+
+	atomic_uint_fast64_t	latency_total;		//!< In nanoseconds.
+	atomic_uint_fast64_t	latency_high;		//!< In nanoseconds.
+	atomic_uint_fast64_t	latency_low;		//!< In nanoseconds, 0 if there were no linked packets.
+} rs_latency_shared_t;
+
+/** A thread processing a share of the packets from each interface
+ *
+ * Each worker has its own capture handle for every interface, its own
+ * request and link trees, and its own event list.  The kernel hashes
+ * flows across the handles, so a request and its response are always
+ * seen by the same worker.
+ */
+typedef struct {
+	unsigned int		id;
+	pthread_t		thread;
+	bool			started;		//!< Whether the thread is running.
+
+	TALLOC_CTX		*ctx;			//!< Only used by the worker, once it's started.
+	fr_pcap_t		*in;			//!< This worker's capture handles.
+	int			wake[2];		//!< Written to tell the worker to exit.
+
+	atomic_bool		dropped;		//!< Set if any of our handles dropped packets.
+	rs_latency_shared_t	shared[FR_RADIUS_CODE_MAX + 1];
+} rs_worker_t;
+
 typedef struct {
 	struct pcap_pkthdr	*header;		//!< PCAP packet header.
 	uint8_t			*data;			//!< PCAP packet data.
@@ -303,6 +351,10 @@ struct rs {
 	int			buffer_pkts;		//!< Size of the ring buffer to setup for live capture.
 	uint64_t		limit;			//!< Maximum number of packets to capture
 
+	unsigned int		num_workers;		//!< Threads to process live captures in.
+							///< 0 if packets are processed by the main thread.
+	rs_worker_t		*workers;
+
 	struct {
 		int			interval;		//!< Time between stats updates in seconds.
 		stats_out_t		out;			//!< Where to write stats.
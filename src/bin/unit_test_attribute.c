@@ -60,6 +60,7 @@ typedef struct request_s request_t;
 #include <assert.h>
 #include <libgen.h>
 #include <limits.h>
+#include <pthread.h>
 #include <sys/wait.h>
 
 #ifndef HAVE_SANITIZER_LSAN_INTERFACE_H
@@ -1061,6 +1062,322 @@ static size_t command_normalise_attribute(command_result_t *result, command_file
 	RETURN_OK(slen);
 }
 
+typedef enum {
+	BENCHMARK_DECODE_PAIR = 0,
+	BENCHMARK_DECODE_PROTO,
+	BENCHMARK_ENCODE_PAIR,
+	BENCHMARK_ENCODE_PROTO
+} benchmark_type_t;
+
+static fr_table_num_sorted_t const benchmark_type_table[] = {
+	{ L("decode-pair"),	BENCHMARK_DECODE_PAIR	},
+	{ L("decode-proto"),	BENCHMARK_DECODE_PROTO	},
+	{ L("encode-pair"),	BENCHMARK_ENCODE_PAIR	},
+	{ L("encode-proto"),	BENCHMARK_ENCODE_PROTO	}
+};
+static size_t benchmark_type_table_len = NUM_ELEMENTS(benchmark_type_table);
+
+static char const *benchmark_tp_symbol[] = {
+	[BENCHMARK_DECODE_PAIR]		= "tp_decode_pair",
+	[BENCHMARK_DECODE_PROTO]	= "tp_decode_proto",
+	[BENCHMARK_ENCODE_PAIR]		= "tp_encode_pair",
+	[BENCHMARK_ENCODE_PROTO]	= "tp_encode_proto"
+};
+
+/** What every benchmark thread runs, set up once by #command_benchmark
+ *
+ */
+typedef struct {
+	benchmark_type_t	type;
+	union {
+		fr_test_point_pair_decode_t const	*decode_pair;
+		fr_test_point_proto_decode_t const	*decode_proto;
+		fr_test_point_pair_encode_t const	*encode_pair;
+		fr_test_point_proto_encode_t const	*encode_proto;
+		void					*tp;
+	};
+	fr_dict_t const		*dict;
+	uint8_t const		*in;			//!< Data to decode.
+	size_t			inlen;
+	size_t			iterations;		//!< How many operations each thread performs.
+} benchmark_t;
+
+/** State of one benchmark thread
+ *
+ * Each thread has its own talloc tree, encoder/decoder context, output
+ * buffer and copy of the pairs to encode, so threads only share the
+ * dictionary and the input data.
+ */
+typedef struct {
+	benchmark_t const	*b;
+	pthread_t		thread;
+	TALLOC_CTX		*ctx;			//!< Everything allocated by this thread.
+	TALLOC_CTX		*op_ctx;		//!< Output of a single operation.
+	void			*codec_ctx;		//!< Returned by the testpoint's test_ctx.
+	fr_pair_list_t		vps;			//!< To encode.
+	uint8_t			*buff;			//!< To encode to.
+	size_t			bufflen;
+	bool			failed;
+} benchmark_thread_t;
+
+/** Perform one encode or decode operation
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the encoder or decoder failed.
+ */
+static int benchmark_op(benchmark_thread_t *bt)
+{
+	benchmark_t const	*b = bt->b;
+	fr_pair_list_t		head;
+	fr_dcursor_t		cursor;
+	ssize_t			slen;
+
+	switch (b->type) {
+	case BENCHMARK_DECODE_PAIR:
+	{
+		uint8_t const *p = b->in, *end = b->in + b->inlen;
+
+		fr_pair_list_init(&head);
+		fr_dcursor_init(&cursor, &head);
+		while (p < end) {
+			slen = b->decode_pair->func(bt->op_ctx, &cursor, b->dict, p, end - p, bt->codec_ctx);
+			if ((slen <= 0) || ((size_t)slen > (size_t)(end - p))) return -1;
+			p += slen;
+		}
+	}
+		break;
+
+	case BENCHMARK_DECODE_PROTO:
+		fr_pair_list_init(&head);
+		slen = b->decode_proto->func(bt->op_ctx, &head, b->in, b->inlen, bt->codec_ctx);
+		if (slen <= 0) return -1;
+		break;
+
+	case BENCHMARK_ENCODE_PAIR:
+	{
+		uint8_t		*p = bt->buff, *end = bt->buff + bt->bufflen;
+		fr_pair_t	*vp;
+
+		for (vp = fr_dcursor_talloc_iter_init(&cursor, &bt->vps,
+						     b->encode_pair->next_encodable ?
+						     b->encode_pair->next_encodable : fr_proto_next_encodable,
+						     b->dict, fr_pair_t);
+		     vp;
+		     vp = fr_dcursor_current(&cursor)) {
+			slen = b->encode_pair->func(&FR_DBUFF_TMP(p, end), &cursor, bt->codec_ctx);
+			if ((slen < 0) || (slen > (end - p))) return -1;
+			if (slen == 0) break;
+			p += slen;
+		}
+	}
+		break;
+
+	case BENCHMARK_ENCODE_PROTO:
+		slen = b->encode_proto->func(bt->op_ctx, &bt->vps, bt->buff, bt->bufflen, bt->codec_ctx);
+		if (slen < 0) return -1;
+		break;
+	}
+
+	return 0;
+}
+
+static void *benchmark_thread(void *arg)
+{
+	benchmark_thread_t	*bt = arg;
+	size_t			i;
+
+	for (i = 0; i < bt->b->iterations; i++) {
+		if (benchmark_op(bt) < 0) {
+			bt->failed = true;
+			break;
+		}
+		talloc_free_children(bt->op_ctx);
+	}
+
+	return NULL;
+}
+
+/** Repeat an encode or decode command, and report how expensive it is
+ *
+ * One operation is performed first, to check that it succeeds, and
+ * to count the memory it allocates.  The timed operations then run
+ * in parallel on each thread, and the wall clock time is divided by
+ * the total number of operations.
+ */
+static size_t command_benchmark(command_result_t *result, command_file_ctx_t *cc,
+				char *data, size_t data_used, char *in, size_t inlen)
+{
+	benchmark_t		b = { 0 };
+	benchmark_thread_t	*threads = NULL;
+	unsigned long		num_threads = 1, started = 0, i;
+	fr_pair_list_t		vps;
+	char			*p = in, *end;
+	char const		*q;
+	ssize_t			slen;
+	size_t			allocs = 0, bytes = 0;
+	fr_time_t		start;
+	fr_time_delta_t		elapsed = 0;
+	int			ret;
+	bool			failed = false, codec_failed = false;
+
+	fr_pair_list_init(&vps);
+
+	b.iterations = strtoul(p, &end, 10);
+	if ((end == p) || (b.iterations == 0) || (b.iterations == ULONG_MAX)) {
+		fr_strerror_const("Expected number of iterations");
+		RETURN_PARSE_ERROR(0);
+	}
+	p = end;
+	fr_skip_whitespace(p);
+
+	if (strncmp(p, "threads ", sizeof("threads ") - 1) == 0) {
+		p += sizeof("threads ") - 1;
+		num_threads = strtoul(p, &end, 10);
+		if ((end == p) || (num_threads == 0) || (num_threads > 1024)) {
+			fr_strerror_const("Expected number of threads (1-1024)");
+			RETURN_PARSE_ERROR(p - in);
+		}
+		p = end;
+		fr_skip_whitespace(p);
+	}
+
+	/*
+	 *	The command name may be followed
+	 *	by ".<testpoint_symbol>"
+	 */
+	for (q = p; *q && (*q != '.') && !isspace((uint8_t)*q); q++);
+	b.type = fr_table_value_by_substr(benchmark_type_table, p, q - p, -1);
+	if ((int)b.type < 0) {
+		fr_strerror_const("Expected one of decode-pair, decode-proto, encode-pair or encode-proto");
+		RETURN_PARSE_ERROR(p - in);
+	}
+	p += q - p;
+
+	slen = load_test_point_by_command(&b.tp, p, benchmark_tp_symbol[b.type]);
+	if (!b.tp) {
+		fr_strerror_const_push("Failed locating testpoint");
+		RETURN_COMMAND_ERROR();
+	}
+	p += slen;
+	fr_skip_whitespace(p);
+
+	b.dict = cc->tmpl_rules.dict_def ? cc->tmpl_rules.dict_def : cc->config->dict;
+
+	switch (b.type) {
+	case BENCHMARK_DECODE_PAIR:
+	case BENCHMARK_DECODE_PROTO:
+		if (*p == '-') {
+			p = data;
+			inlen = data_used;
+		} else {
+			inlen -= p - in;
+		}
+
+		/*
+		 *	Decode the hex into a buffer of its own,
+		 *	as the data buffer holds the output.
+		 */
+		slen = hex_to_bin(cc->buffer_start, cc->buffer_end - cc->buffer_start, p, inlen);
+		if (slen <= 0) RETURN_PARSE_ERROR(-(slen));
+		b.in = cc->buffer_start;
+		b.inlen = slen;
+		break;
+
+	case BENCHMARK_ENCODE_PAIR:
+	case BENCHMARK_ENCODE_PROTO:
+		if (fr_pair_list_afrom_str(cc->tmp_ctx, b.dict, p, in + inlen - p, &vps) != T_EOL) {
+			talloc_free_children(cc->tmp_ctx);
+			RETURN_OK_WITH_ERROR();
+		}
+		break;
+	}
+
+	MEM(threads = talloc_zero_array(cc->tmp_ctx, benchmark_thread_t, num_threads));
+	for (i = 0; i < num_threads; i++) {
+		benchmark_thread_t	*bt = &threads[i];
+		void			*tp = b.tp;
+
+		bt->b = &b;
+		MEM(bt->ctx = talloc_new(NULL));
+		MEM(bt->op_ctx = talloc_new(bt->ctx));
+		MEM(bt->buff = talloc_array(bt->ctx, uint8_t, cc->buffer_end - cc->buffer_start));
+		bt->bufflen = talloc_array_length(bt->buff);
+		fr_pair_list_init(&bt->vps);
+
+		/*
+		 *	All the testpoint structures start
+		 *	with the test_ctx callback.
+		 */
+		if (((fr_test_point_pair_decode_t *)tp)->test_ctx &&
+		    (((fr_test_point_pair_decode_t *)tp)->test_ctx(&bt->codec_ctx, bt->ctx) < 0)) {
+			fr_strerror_const_push("Failed initialising testpoint");
+			failed = true;
+			goto finish;
+		}
+
+		if (fr_pair_list_copy(bt->ctx, &bt->vps, &vps) < 0) {
+			failed = true;
+			goto finish;
+		}
+	}
+
+	/*
+	 *	Check the operation works, and count what
+	 *	it allocates, in the thread's ctx, or in
+	 *	the encoder/decoder's context.
+	 */
+	{
+		size_t	blocks_before = talloc_total_blocks(threads[0].ctx);
+		size_t	size_before = talloc_total_size(threads[0].ctx);
+
+		if (benchmark_op(&threads[0]) < 0) {
+			codec_failed = true;
+			goto finish;
+		}
+		allocs = talloc_total_blocks(threads[0].ctx) - blocks_before;
+		bytes = talloc_total_size(threads[0].ctx) - size_before;
+		talloc_free_children(threads[0].op_ctx);
+	}
+
+	start = fr_time();
+	for (i = 0; i < num_threads; i++) {
+		ret = pthread_create(&threads[i].thread, NULL, benchmark_thread, &threads[i]);
+		if (ret != 0) {
+			fr_strerror_printf("Failed creating thread: %s", fr_syserror(ret));
+			failed = true;
+			break;
+		}
+		started++;
+	}
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].failed) codec_failed = true;
+	}
+	elapsed = fr_time() - start;
+
+finish:
+	for (i = 0; i < num_threads; i++) talloc_free(threads[i].ctx);
+	talloc_free_children(cc->tmp_ctx);
+
+	if (failed) RETURN_COMMAND_ERROR();
+	if (codec_failed) {
+		cc->last_ret = -1;
+		RETURN_OK_WITH_ERROR();
+	}
+
+	/*
+	 *	Clear any spurious errors
+	 */
+	fr_strerror_clear();
+	cc->last_ret = 0;
+
+	RETURN_OK(snprintf(data, COMMAND_OUTPUT_MAX, "iterations %zu, threads %lu, %" PRId64 " ns/op, "
+			   "%zu allocs/op, %zu bytes/op",
+			   b.iterations, num_threads, elapsed / (int64_t)(b.iterations * num_threads),
+			   allocs, bytes));
+}
+
 /** Change the working directory
  *
  */
@@ -2409,6 +2726,11 @@ static fr_table_ptr_sorted_t	commands[] = {
 					.usage = "attribute <attr> = <value>",
 					.description = "Parse and reprint an attribute value pair, writing \"ok\" to the data buffer on success"
 				}},
+	{ L("benchmark "),	&(command_entry_t){
+					.func = command_benchmark,
+					.usage = "benchmark <iterations> [threads <num>] (decode-pair|decode-proto|encode-pair|encode-proto)[.<testpoint_symbol>] <args>",
+					.description = "Repeat an encode or decode command, writing the time, number of allocations and bytes allocated per operation to the data buffer.  Protocol must be loaded with \"load <protocol>\" first",
+				}},
 	{ L("cd "),		&(command_entry_t){
 					.func = command_cd,
 					.usage = "cd <path>",
@@ -90,6 +90,13 @@ typedef struct {
 	fr_event_timer_t const	*ev;			//!< Multi-Handle timer.
 	uint64_t		transfers;		//!< How many transfers are current in progress.
 	CURLM			*mandle;		//!< The multi handle.
+
+	uint64_t		conn_opened;		//!< How many connections completed transfers opened.
+	uint64_t		conn_reused;		//!< How many transfers completed over a connection
+							//!< which was already open.
+	uint64_t		streams;		//!< How many transfers completed as HTTP >= 2.0 streams.
+	uint64_t		streams_reused;		//!< How many of those streams were multiplexed onto
+							//!< an existing connection.
 } fr_curl_handle_t;
 
 /** Structure representing an individual request being passed to curl for processing
@@ -123,7 +130,7 @@ int			fr_curl_io_request_enqueue(fr_curl_handle_t *mhandle,
 
 fr_curl_io_request_t	*fr_curl_io_request_alloc(TALLOC_CTX *ctx);
 
-fr_curl_handle_t	*fr_curl_io_init(TALLOC_CTX *ctx, fr_event_list_t *el, bool multiplex);
+fr_curl_handle_t	*fr_curl_io_init(TALLOC_CTX *ctx, fr_event_list_t *el, bool multiplex, uint32_t max_streams);
 
 int			fr_curl_init(void);
 
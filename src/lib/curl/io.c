@@ -43,6 +43,43 @@ do {\
 	}\
 } while (0)
 
+/** Record whether a completed transfer reused a connection
+ *
+ * @param[in] mhandle	to update counters in.
+ * @param[in] request	the transfer was performed for.
+ * @param[in] candle	of the completed transfer.
+ */
+static inline void _fr_curl_io_reuse_stats(fr_curl_handle_t *mhandle, request_t *request, CURL *candle)
+{
+	long	conns = 0;
+#if CURL_AT_LEAST_VERSION(7,50,0)
+	long	version = 0;
+#endif
+
+	/*
+	 *	NUM_CONNECTS is the number of new connections
+	 *	the transfer had to open, so zero means it ran
+	 *	over one which was already in the cache.
+	 */
+	if (curl_easy_getinfo(candle, CURLINFO_NUM_CONNECTS, &conns) != CURLE_OK) return;
+
+	if (conns > 0) {
+		mhandle->conn_opened += conns;
+	} else {
+		mhandle->conn_reused++;
+	}
+
+#if CURL_AT_LEAST_VERSION(7,50,0)
+	if ((curl_easy_getinfo(candle, CURLINFO_HTTP_VERSION, &version) == CURLE_OK) &&
+	    (version >= CURL_HTTP_VERSION_2_0)) {
+		mhandle->streams++;
+		if (conns == 0) mhandle->streams_reused++;
+	}
+#endif
+
+	RDEBUG3("Transfer %s connection", conns > 0 ? "opened a new" : "reused an existing");
+}
+
 /** De-queue curl requests and wake up the requests that initiated them
  *
  * @param[in] mhandle	containing the event loop and request counter.
@@ -82,6 +119,8 @@ static inline void _fr_curl_io_demux(fr_curl_handle_t *mhandle, CURLM *mandle)
 			if (m->data.result != CURLE_OK) {
 				REDEBUG("curl request failed: %s (%i)",
 					curl_easy_strerror(m->data.result), m->data.result);
+			} else {
+				_fr_curl_io_reuse_stats(mhandle, request, candle);
 			}
 			randle->result = m->data.result;
 
@@ -543,6 +582,8 @@ static int _mhandle_free(fr_curl_handle_t *mhandle)
  * @param[in] el		to initial.
  * @param[in] multiplex		Run multiple requests over the same connection simultaneously.
  *				HTTP/2 only.
+ * @param[in] max_streams	Maximum number of simultaneous requests to run over a single
+ *				multiplexed connection.  0 means use the libcurl default.
  * @return
  *	- 0 on success.
  *	- -1 on error.
@@ -552,7 +593,11 @@ fr_curl_handle_t *fr_curl_io_init(TALLOC_CTX *ctx,
 #ifndef CURLPIPE_MULTIPLEX
 				   UNUSED
 #endif
-				   bool multiplex)
+				   bool multiplex,
+#if !CURL_AT_LEAST_VERSION(7,67,0)
+				   UNUSED
+#endif
+				   uint32_t max_streams)
 {
 	CURLMcode		ret;
 	CURLM			*mandle;
@@ -587,6 +632,10 @@ fr_curl_handle_t *fr_curl_io_init(TALLOC_CTX *ctx,
 	SET_MOPTION(mandle, CURLMOPT_PIPELINING, multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
 #endif
 
+#if CURL_AT_LEAST_VERSION(7,67,0)
+	if (max_streams > 0) SET_MOPTION(mandle, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)max_streams);
+#endif
+
 	return mhandle;
 
 error:
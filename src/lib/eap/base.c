@@ -405,13 +405,19 @@ rlm_rcode_t eap_virtual_server(request_t *request, eap_session_t *eap_session, c
 	fr_pair_t	*vp;
 	CONF_SECTION	*server_cs;
 
-	vp = fr_pair_find_by_da(&request->control_pairs, attr_virtual_server, 0);
-	server_cs = vp ? virtual_server_find(vp->vp_strvalue) : virtual_server_find(virtual_server);
+	/*
+	 *	The lookup is only for the debug message, so
+	 *	don't do it on every round unless we're printing it.
+	 */
+	if (RDEBUG_ENABLED2) {
+		vp = fr_pair_find_by_da(&request->control_pairs, attr_virtual_server, 0);
+		server_cs = vp ? virtual_server_find(vp->vp_strvalue) : virtual_server_find(virtual_server);
 
-	if (server_cs) {
-		RDEBUG2("Running request through virtual server \"%s\"", cf_section_name2(unlang_call_current(request)));
-	} else {
-		RDEBUG2("Running request in virtual server");
+		if (server_cs) {
+			RDEBUG2("Running request through virtual server \"%s\"", cf_section_name2(unlang_call_current(request)));
+		} else {
+			RDEBUG2("Running request in virtual server");
+		}
 	}
 
 	/*
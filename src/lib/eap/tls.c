@@ -1018,17 +1018,25 @@ unlang_action_t eap_tls_process(request_t *request, eap_session_t *eap_session)
 		}
 
 		/*
-		 *	Update the dirty_in buffer (data for reading by OpenSSL)
+		 *	Write the fragment straight into OpenSSL's input
+		 *	BIO, instead of reassembling the record in dirty_in
+		 *	first and copying the complete record again.
 		 *
-		 *	This buffer will contain partial data when M bit is set, and should
-		 * 	should only be reinitialized when M bit is not set.
+		 *	The BIO will contain partial data when M bit is set,
+		 *	OpenSSL only reads from it once the record is complete.
 		 */
-		if ((tls_session->record_from_buff)(&tls_session->dirty_in, data, data_len) != data_len) {
+		if ((BIO_ctrl_pending(tls_session->into_ssl) + data_len) > FR_TLS_MAX_RECORD_SIZE) {
 			REDEBUG("Exceeded maximum record size");
 			eap_tls_session->state = EAP_TLS_FAIL;
 			goto done;
 		}
 
+		if ((data_len > 0) && (BIO_write(tls_session->into_ssl, data, data_len) != (int)data_len)) {
+			REDEBUG("Failed writing %zu bytes to TLS BIO", data_len);
+			eap_tls_session->state = EAP_TLS_FAIL;
+			goto done;
+		}
+
 		/*
 		 *	ACK fragments until we get a complete TLS record.
 		 */
@@ -80,6 +80,112 @@ EVP_CIPHER_CTX *aka_sim_crypto_cipher_ctx(void)
 	return evp_chipher_ctx;
 }
 
+/** How many keys we keep expanded AES-128-ECB contexts for, per thread, per direction
+ *
+ * Matches the number of key indexes a 3GPP pseudonym can carry.
+ */
+#define AKA_SIM_KEYED_CTX_MAX	16
+
+typedef struct {
+	uint8_t		key[16];
+	EVP_CIPHER_CTX	*evp_ctx;
+} aka_sim_keyed_ctx_t;
+
+typedef struct {
+	aka_sim_keyed_ctx_t	slot[2][AKA_SIM_KEYED_CTX_MAX];		//!< Decrypt, encrypt.
+	unsigned int		next[2];				//!< Slot to replace when full.
+} aka_sim_keyed_ctx_cache_t;
+
+/** Expanded AES-128-ECB contexts for the pseudonym keys this thread has used
+ *
+ * Avoids running the key schedule for every pseudonym we encrypt or
+ * decrypt, as there are only ever a few keys in use.
+ */
+static _Thread_local aka_sim_keyed_ctx_cache_t *evp_keyed_ctx_cache;
+
+static void _evp_keyed_ctx_cache_free_on_exit(void *arg)
+{
+	aka_sim_keyed_ctx_cache_t	*cache = arg;
+	size_t				i, j;
+
+	for (i = 0; i < NUM_ELEMENTS(cache->slot); i++) {
+		for (j = 0; j < NUM_ELEMENTS(cache->slot[i]); j++) {
+			if (cache->slot[i][j].evp_ctx) EVP_CIPHER_CTX_free(cache->slot[i][j].evp_ctx);
+		}
+	}
+	free(cache);
+}
+
+/** Return an AES-128-ECB context, without padding, for a key
+ *
+ * The context is kept for the thread, and is only re-keyed if more than
+ * #AKA_SIM_KEYED_CTX_MAX keys are used.  Like #aka_sim_crypto_cipher_ctx,
+ * it must not be used for more than one operation at a time.
+ *
+ * @param[in] key	to encrypt or decrypt with.  Must be 128 bits (16 bytes).
+ * @param[in] encrypt	true for an encryption context, false for decryption.
+ * @return
+ *	- A context ready for EVP_CipherUpdate.
+ *	- NULL on error.
+ */
+EVP_CIPHER_CTX *aka_sim_crypto_aes_128_ecb_ctx(uint8_t const key[16], bool encrypt)
+{
+	aka_sim_keyed_ctx_cache_t	*cache = evp_keyed_ctx_cache;
+	aka_sim_keyed_ctx_t		*slots, *keyed;
+	size_t				i;
+
+	if (unlikely(!cache)) {
+		MEM(cache = calloc(1, sizeof(*cache)));
+		fr_atexit_thread_local(evp_keyed_ctx_cache, _evp_keyed_ctx_cache_free_on_exit, cache);
+	}
+	slots = cache->slot[encrypt];
+
+	for (i = 0; i < AKA_SIM_KEYED_CTX_MAX; i++) {
+		keyed = &slots[i];
+
+		if (!keyed->evp_ctx) break;
+		if (memcmp(keyed->key, key, sizeof(keyed->key)) != 0) continue;
+
+		/*
+		 *	Resets the context, but keeps the
+		 *	cipher, the expanded key, and the
+		 *	padding flag.
+		 */
+		if (unlikely(EVP_CipherInit_ex(keyed->evp_ctx, NULL, NULL, NULL, NULL, encrypt) != 1)) {
+			fr_tls_log_strerror_printf("Failed resetting AES-128-ECB context");
+			return NULL;
+		}
+		return keyed->evp_ctx;
+	}
+
+	/*
+	 *	Unused slot, or replace the oldest.
+	 */
+	if (i == AKA_SIM_KEYED_CTX_MAX) {
+		keyed = &slots[cache->next[encrypt]];
+		cache->next[encrypt] = (cache->next[encrypt] + 1) % AKA_SIM_KEYED_CTX_MAX;
+		EVP_CIPHER_CTX_reset(keyed->evp_ctx);
+	} else {
+		MEM(keyed->evp_ctx = EVP_CIPHER_CTX_new());
+	}
+
+	if (unlikely(EVP_CipherInit_ex(keyed->evp_ctx, EVP_aes_128_ecb(), NULL, key, NULL, encrypt) != 1)) {
+		fr_tls_log_strerror_printf("Failed initialising AES-128-ECB context");
+		memset(keyed->key, 0, sizeof(keyed->key));
+		EVP_CIPHER_CTX_reset(keyed->evp_ctx);
+		return NULL;
+	}
+
+	/*
+	 *	Pseudonyms are exactly one block, and
+	 *	never padded.
+	 */
+	EVP_CIPHER_CTX_set_padding(keyed->evp_ctx, 0);
+	memcpy(keyed->key, key, sizeof(keyed->key));
+
+	return keyed->evp_ctx;
+}
+
 /** Explicitly free all thread load cipher ctxs
  *
  */
@@ -87,6 +193,9 @@ void aka_sim_crypto_cipher_ctx_free(void)
 {
 	fr_atexit_trigger(_evp_cipher_ctx_free_on_exit);
 	evp_chipher_ctx = NULL;
+
+	fr_atexit_trigger(_evp_keyed_ctx_cache_free_on_exit);
+	evp_keyed_ctx_cache = NULL;
 }
 
 /** Free OpenSSL memory associated with our checkcode ctx
@@ -32,6 +32,8 @@ void		aka_sim_crypto_cipher_ctx_free(void);
 
 EVP_CIPHER_CTX	*aka_sim_crypto_cipher_ctx(void);
 
+EVP_CIPHER_CTX	*aka_sim_crypto_aes_128_ecb_ctx(uint8_t const key[16], bool encrypt);
+
 #ifdef __cplusplus
 }
 #endif
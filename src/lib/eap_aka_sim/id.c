@@ -467,24 +467,23 @@ int fr_aka_sim_id_3gpp_pseudonym_encrypt(char out[AKA_SIM_3GPP_PSEUDONYM_LEN + 1
 	/*
 	 *	Now we have to encrypt the padded IMSI with AES-ECB
 	 */
-	evp_ctx = aka_sim_crypto_cipher_ctx();
-	if (unlikely(EVP_EncryptInit_ex(evp_ctx, EVP_aes_128_ecb(), NULL, key, NULL) != 1)) {
-		fr_tls_log_strerror_printf("Failed initialising AES-128-ECB context");
-	error:
-		return -1;
-	}
-
 	/*
-	 *	By default OpenSSL will try and pad out a 16 byte
-	 *	plaintext to 32 bytes so that it's detectable that
-	 *	there was padding.
+	 *	The context has padding disabled.  By default
+	 *	OpenSSL will try and pad out a 16 byte plaintext
+	 *	to 32 bytes so that it's detectable that there
+	 *	was padding.
 	 *
 	 *	In this case we know the length of the plaintext
 	 *	we're trying to recover, so we explicitly tell
 	 *	OpenSSL not to pad here, and not to expected padding
 	 *	when decrypting.
 	 */
-	EVP_CIPHER_CTX_set_padding(evp_ctx, 0);
+	evp_ctx = aka_sim_crypto_aes_128_ecb_ctx(key, true);
+	if (unlikely(!evp_ctx)) {
+	error:
+		return -1;
+	}
+
 	if (unlikely(EVP_EncryptUpdate(evp_ctx, encr, (int *)&len, padded, sizeof(padded)) != 1)) {
 		fr_tls_log_strerror_printf("Failed encrypting padded IMSI");
 		goto error;
@@ -610,23 +609,25 @@ int fr_aka_sim_id_3gpp_pseudonym_decrypt(char out[AKA_SIM_IMSI_MAX_LEN + 1],
 		p += 4;	/* 32bit input -> 24bit output */
 	}
 
-	evp_ctx = aka_sim_crypto_cipher_ctx();
-	if (unlikely(EVP_DecryptInit_ex(evp_ctx, EVP_aes_128_ecb(), NULL, key, NULL) != 1)) {
-		fr_tls_log_strerror_printf("Failed initialising AES-128-ECB context");
-	error:
-		return -1;
-	}
-
 	/*
-	 *	By default OpenSSL expects 16 bytes of plaintext
-	 *	to produce 32 bytes of ciphertext, due to padding
-	 *	being added if the plaintext is a multiple of 16.
+	 *	The context has padding disabled.  By default
+	 *	OpenSSL expects 16 bytes of plaintext to produce
+	 *	32 bytes of ciphertext, due to padding being added
+	 *	if the plaintext is a multiple of 16.
 	 *
 	 *	There's no way for OpenSSL to determine if a
 	 *	16 byte ciphertext was padded or not, so we need to
 	 *	inform OpenSSL explicitly that there's no padding.
+	 *
+	 *	The context is kept for the key, so we don't
+	 *	redo the key schedule for every pseudonym.
 	 */
-	EVP_CIPHER_CTX_set_padding(evp_ctx, 0);
+	evp_ctx = aka_sim_crypto_aes_128_ecb_ctx(key, false);
+	if (unlikely(!evp_ctx)) {
+	error:
+		return -1;
+	}
+
 	if (unlikely(EVP_DecryptUpdate(evp_ctx, decr, (int *)&len, dec, sizeof(dec)) != 1)) {
 		fr_tls_log_strerror_printf("Failed decypting IMSI");
 		goto error;
@@ -5,6 +5,7 @@ SOURCES	:= \
 	atomic_queue.c \
 	channel.c \
 	control.c \
+	lang_pool.c \
 	load.c \
 	master.c \
 	message.c \
@@ -12,6 +13,7 @@ SOURCES	:= \
 	queue.c \
 	ring_buffer.c \
 	schedule.c \
+	shm_ring.c \
 	worker.c
 
 TGT_PREREQS	:= libfreeradius-util.la $(LIBFREERADIUS_SERVER)
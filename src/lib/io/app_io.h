@@ -42,6 +42,10 @@ typedef struct {
 	size_t				default_reply_size;	//!< same for replies
 	size_t				thread_inst_size;	//!< thread-specific socket information size
 	bool				track_duplicates;	//!< track duplicate packets
+	bool				single_socket;		//!< Don't open a UDP socket per network thread.
+								//!< Needed when packets are broadcast or multicast,
+								//!< as every socket in a SO_REUSEPORT group gets
+								//!< a copy.
 
 	fr_io_open_t			open;		//!< Open a new socket for listening, or accept/connect a new
 							//!< connection.
@@ -66,6 +70,7 @@ typedef struct {
 
 	fr_io_track_create_t		track;		//!< create a tracking structure
 	fr_io_track_cmp_t		compare;	//!< compare two tracking structures
+	fr_io_track_hash_t		hash;		//!< hash a tracking structure.  If set, dedup uses a hash table.
 
 	fr_io_connection_set_t		connection_set;	//!< set src/dst IP/port of a connection
 	fr_io_network_get_t		network_get;	//!< get dynamic network information
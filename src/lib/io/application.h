@@ -81,6 +81,26 @@ typedef int (*fr_app_open_t)(void *instance, fr_schedule_t *sc, CONF_SECTION *cs
  */
 typedef int (*fr_app_priority_get_t)(void const *instance, uint8_t const *buffer, size_t buflen);
 
+/** Answer a packet in the network thread
+ *
+ * Some packets, such as keepalives, don't need any policy to be run.
+ * Replying to them directly means they don't use up worker capacity,
+ * and don't take a round trip through the channels.
+ *
+ * @param[in] instance		of the #fr_app_t.
+ * @param[in] client		which sent the packet.
+ * @param[in] packet		raw packet.
+ * @param[in] packet_len	length of the packet.
+ * @param[out] reply		where the reply should be written.
+ * @param[in] reply_len		length of the reply buffer.
+ * @return
+ *	- <0 on error, drop the packet.
+ *	- 0 the packet has to be processed by a worker.
+ *	- >0 the length of the reply.
+ */
+typedef ssize_t (*fr_app_reply_t)(void const *instance, RADCLIENT const *client,
+				  uint8_t *packet, size_t packet_len, uint8_t *reply, size_t reply_len);
+
 /** Called by the network thread to pass an event list for the module to use for timer events
  */
 typedef void (*fr_app_event_list_set_t)(fr_listen_t *li, fr_event_list_t *el, void *nr);
@@ -119,6 +139,9 @@ typedef struct {
 							///< to all #fr_app_io_t can be performed by the #fr_app_t.
 
 	fr_app_priority_get_t		priority;	//!< Assign a priority to the packet.
+
+	fr_app_reply_t			reply;		//!< Reply to a packet without a worker.
+							///< May be NULL.
 } fr_app_t;
 
 /** Public structure describing an application (protocol) specialisation
@@ -298,6 +298,18 @@ typedef void *(*fr_io_track_create_t)(TALLOC_CTX *ctx, uint8_t const *packet, si
  */
 typedef int (*fr_io_track_cmp_t)(void const *instance, void *thread_instance, RADCLIENT *client, void const *one, void const *two);
 
+/** Hash a tracking structure for storing in a duplicate detection table.
+ *
+ * The hash MUST only use the fields which are checked by the
+ * corresponding fr_io_track_cmp_t, so that two tracking structures
+ * which compare as identical also hash to the same value.
+ *
+ * @param[in] instance		the context for this function
+ * @param[in] packet		packet tracking structure
+ * @return the hash of the tracking structure.
+ */
+typedef uint32_t (*fr_io_track_hash_t)(void const *instance, void const *packet);
+
 /**  Handle an error on the socket.
  *
  *  In general, the only thing to do on errors is to close the
@@ -66,6 +66,8 @@ size_t channel_direction_len = NUM_ELEMENTS(channel_direction);
 #define SIGNAL_INTERVAL (1000000)	//!< The minimum interval between responder signals.
 #endif
 
+#define IDLE_SPINS (16)			//!< How many times we re-check an empty queue before sleeping.
+
 /** Size of the atomic queues
  *
  * The queue reader MUST service the queue occasionally,
@@ -120,6 +122,8 @@ typedef struct {
 
 	bool			must_signal;	//!< we need to signal the other end
 
+	atomic_bool		polling;	//!< The reader of aq will check it again before sleeping,
+						///< so writers don't need to signal it.
 
 	uint64_t		sequence;	//!< Sequence number for this channel.
 	uint64_t		ack;		//!< Sequence number of the other end.
@@ -239,11 +243,13 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *requestor, fr_con
 	ch->end[TO_RESPONDER].stats.last_read_other = now;
 	ch->end[TO_RESPONDER].stats.last_sent_signal = now;
 	atomic_store(&ch->end[TO_RESPONDER].active, true);
+	atomic_store(&ch->end[TO_RESPONDER].polling, false);
 
 	ch->end[TO_REQUESTOR].stats.last_write = now;
 	ch->end[TO_REQUESTOR].stats.last_read_other = now;
 	ch->end[TO_REQUESTOR].stats.last_sent_signal = now;
 	atomic_store(&ch->end[TO_REQUESTOR].active, true);
+	atomic_store(&ch->end[TO_REQUESTOR].polling, false);
 
 	return ch;
 }
@@ -288,6 +294,28 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 	return fr_control_message_send(end->control, end->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
 }
 
+/** Check whether the reader of an end's queue is polling it
+ *
+ * Must be called after the message has been pushed onto the queue.
+ * The fence pairs with the one in channel_idle(), so that either we
+ * see the reader is polling, or the reader sees our message before
+ * it goes to sleep.
+ *
+ * @param[in] end	of the channel that the message was written to.
+ * @return
+ *	- true if the reader will find the message without being signalled.
+ *	- false if we need to signal the reader.
+ */
+static inline CC_HINT(always_inline) bool channel_reader_polling(fr_channel_end_t *end)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (!atomic_load_explicit(&end->polling, memory_order_relaxed)) return false;
+
+	end->stats.skipped++;
+	return true;
+}
+
 #define IALPHA (8)
 #define RTT(_old, _new) ((_new + ((IALPHA - 1) * _old)) / IALPHA)
 
@@ -385,6 +413,15 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 	}
 #endif
 
+	/*
+	 *	The responder is running, and will drain its queue
+	 *	before it sleeps.  There's no need to wake it up.
+	 */
+	if (channel_reader_polling(requestor)) {
+		MPRINT("REQUESTOR SKIPS signal, responder is polling\n");
+		return 0;
+	}
+
 	/*
 	 *	Tell the other end that there is new data ready.
 	 *
@@ -560,6 +597,17 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 	 */
 	while (fr_channel_recv_request(ch));
 
+	/*
+	 *	The requestor is running, and will pick up this reply,
+	 *	along with any others we send, before it sleeps.  The
+	 *	ACK goes with the reply, so there's nothing else we
+	 *	need to tell it.
+	 */
+	if (channel_reader_polling(responder)) {
+		MPRINT("\tRESPONDER SKIPS signal, requestor is polling\n");
+		return 0;
+	}
+
 	/*
 	 *	No packets outstanding, we HAVE to signal the requestor
 	 *	thread.
@@ -667,6 +715,124 @@ int fr_channel_responder_sleeping(fr_channel_t *ch)
 }
 
 
+/** Mark an end as being polled, and drain its queue
+ *
+ */
+static bool channel_poll(fr_channel_t *ch, fr_channel_end_t *end, bool (*recv)(fr_channel_t *ch))
+{
+	bool received = false;
+
+	atomic_store_explicit(&end->polling, true, memory_order_relaxed);
+
+	while (recv(ch)) received = true;
+
+	return received;
+}
+
+/** Drain an end's queue, and tell writers to signal us if it's empty
+ *
+ * We spin on the queue for a little while first, as having the
+ * writer signal us is much more expensive than checking it a few
+ * more times.
+ */
+static bool channel_idle(fr_channel_t *ch, fr_channel_end_t *end, bool (*recv)(fr_channel_t *ch))
+{
+	int i;
+
+	for (i = 0; i < IDLE_SPINS; i++) {
+		if (recv(ch)) {
+			while (recv(ch));
+			return true;
+		}
+	}
+
+	atomic_store_explicit(&end->polling, false, memory_order_relaxed);
+
+	/*
+	 *	A writer may have pushed a message after we last
+	 *	checked the queue, but before it saw that we stopped
+	 *	polling.  It won't have signalled us, so check again.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!recv(ch)) return false;
+
+	atomic_store_explicit(&end->polling, true, memory_order_relaxed);
+	while (recv(ch));
+
+	return true;
+}
+
+/** Tell requestors that the responder is running, and receive any requests
+ *
+ * While the responder is polling, requestors don't signal it when
+ * they send it new requests.  The responder MUST call
+ * fr_channel_responder_idle() before it next sleeps, or it will miss
+ * requests.
+ *
+ * @param[in] ch	the channel to poll.
+ * @return
+ *	- true if any requests were received.
+ *	- false if there were no requests.
+ */
+bool fr_channel_responder_poll(fr_channel_t *ch)
+{
+	if (ch->same_thread) return false;
+
+	return channel_poll(ch, &ch->end[TO_RESPONDER], fr_channel_recv_request);
+}
+
+/** Tell requestors that the responder is about to sleep
+ *
+ * This should be called from the responders idle loop, before it
+ * waits for events.  Requests which arrive afterwards will be
+ * signalled as normal.
+ *
+ * @param[in] ch	the channel the responder is going to stop polling.
+ * @return
+ *	- true if requests were received, and the responder should not sleep.
+ *	- false if the responder can sleep.
+ */
+bool fr_channel_responder_idle(fr_channel_t *ch)
+{
+	if (ch->same_thread) return false;
+
+	return channel_idle(ch, &ch->end[TO_RESPONDER], fr_channel_recv_request);
+}
+
+/** Tell the responder that the requestor is running, and receive any replies
+ *
+ * While the requestor is polling, the responder doesn't signal it
+ * when it sends replies.  The requestor MUST call
+ * fr_channel_requestor_idle() before it next sleeps, or it will miss
+ * replies.
+ *
+ * @param[in] ch	the channel to poll.
+ * @return
+ *	- true if any replies were received.
+ *	- false if there were no replies.
+ */
+bool fr_channel_requestor_poll(fr_channel_t *ch)
+{
+	if (ch->same_thread) return false;
+
+	return channel_poll(ch, &ch->end[TO_REQUESTOR], fr_channel_recv_reply);
+}
+
+/** Tell the responder that the requestor is about to sleep
+ *
+ * @param[in] ch	the channel the requestor is going to stop polling.
+ * @return
+ *	- true if replies were received, and the requestor should not sleep.
+ *	- false if the requestor can sleep.
+ */
+bool fr_channel_requestor_idle(fr_channel_t *ch)
+{
+	if (ch->same_thread) return false;
+
+	return channel_idle(ch, &ch->end[TO_REQUESTOR], fr_channel_recv_reply);
+}
+
+
 /** Service a control-plane message
  *
  * @param[in] when		The current time.
@@ -963,6 +1129,7 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 	fr_log(log, L_INFO, file, line, "requestor\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.signals);
 	fr_log(log, L_INFO, file, line, "\tsignals re-sent = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.resignals);
+	fr_log(log, L_INFO, file, line, "\tsignals skipped = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.skipped);
 	fr_log(log, L_INFO, file, line, "\tkevents checked = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.kevents);
 	fr_log(log, L_INFO, file, line, "\toutstanding = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.outstanding);
 	fr_log(log, L_INFO, file, line, "\tpackets processed = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.packets);
@@ -973,6 +1140,7 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 
 	fr_log(log, L_INFO, file, line, "responder\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64"\n", ch->end[TO_REQUESTOR].stats.signals);
+	fr_log(log, L_INFO, file, line, "\tsignals skipped = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.skipped);
 	fr_log(log, L_INFO, file, line, "\tkevents checked = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.kevents);
 	fr_log(log, L_INFO, file, line, "\tpackets processed = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.packets);
 	fr_log(log, L_INFO, file, line, "\tmessage interval (RTT) = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.message_interval);
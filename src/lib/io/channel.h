@@ -82,6 +82,7 @@ typedef struct {
 	uint64_t       		outstanding; 	//!< Number of outstanding requests with no reply.
 	uint64_t		signals;	//!< Number of kevent signals we've sent.
 	uint64_t		resignals;	//!< Number of signals resent.
+	uint64_t		skipped;	//!< Number of signals we didn't send, as the other end was polling.
 
 	uint64_t		packets;	//!< Number of actual data packets.
 
@@ -173,6 +174,11 @@ int	fr_channel_set_recv_request(fr_channel_t *ch, void *ctx, fr_channel_recv_cal
 
 int	fr_channel_responder_sleeping(fr_channel_t *ch) CC_HINT(nonnull);
 
+bool	fr_channel_responder_poll(fr_channel_t *ch) CC_HINT(nonnull);
+bool	fr_channel_responder_idle(fr_channel_t *ch) CC_HINT(nonnull);
+bool	fr_channel_requestor_poll(fr_channel_t *ch) CC_HINT(nonnull);
+bool	fr_channel_requestor_idle(fr_channel_t *ch) CC_HINT(nonnull);
+
 int	fr_channel_service_kevent(fr_channel_t *ch, fr_control_t *c, struct kevent const *kev) CC_HINT(nonnull);
 fr_channel_event_t	fr_channel_service_message(fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size) CC_HINT(nonnull);
 
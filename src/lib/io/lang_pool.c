@@ -0,0 +1,786 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file io/lang_pool.c
+ * @brief Run language interpreters in child processes, one per worker thread.
+ *
+ * Embedded interpreters don't scale well across worker threads.  Python
+ * serialises everything on its GIL, and a crash or a stuck script in
+ * either Python or Perl takes the whole server with it.
+ *
+ * Instead, the module forks one child per worker thread when it's
+ * instantiated.  Each worker thread claims a child, and sends it calls
+ * over a single producer, single consumer ring in shared memory.  The
+ * call contains the request's pair lists, encoded with the internal
+ * protocol.  The request yields, and the worker carries on with other
+ * requests.  The child runs the script on a copy of the request, and
+ * sends back the result, and the lists the script may have changed.
+ *
+ * Each side only writes to a pipe to wake the other when the ring it
+ * has written to was empty, so a busy worker and child exchange calls
+ * without any system calls.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/internal/internal.h>
+#include <freeradius-devel/io/lang_pool.h>
+#include <freeradius-devel/io/shm_ring.h>
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/server/main_config.h>
+#include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+/*
+ *	The pair lists which are copied between the
+ *	worker and the child.
+ */
+typedef enum {
+	LANG_POOL_LIST_REQUEST = 0,
+	LANG_POOL_LIST_REPLY,
+	LANG_POOL_LIST_CONTROL,
+	LANG_POOL_LIST_STATE,
+	LANG_POOL_LIST_MAX
+} lang_pool_list_t;
+
+/** Header of calls and replies
+ *
+ * Followed by dict_len bytes of the protocol name, then each list
+ * in lists, in order.
+ */
+typedef struct {
+	uint64_t		id;				//!< Of the call.
+	uint32_t		code;				//!< Method in calls, rcode in replies.
+	uint32_t		log_lvl;			//!< Of the request.
+	uint32_t		lists;				//!< Bitmask of the lists which follow.
+	uint32_t		dict_len;			//!< Length of the protocol name.
+	uint32_t		list_len[LANG_POOL_LIST_MAX];	//!< Encoded length of each list.
+} lang_pool_msg_t;
+
+typedef struct {
+	pid_t			pid;			//!< Of the child.  -1 once reaped.
+	bool			claimed;		//!< By a worker thread.
+
+	fr_shm_ring_t		*call;			//!< Worker to child.
+	fr_shm_ring_t		*reply;			//!< Child to worker.
+
+	int			call_fd[2];		//!< Worker writes to call_fd[1] to wake the child.
+	int			reply_fd[2];		//!< Child writes to reply_fd[1] to wake the worker.
+} lang_pool_proc_t;
+
+struct fr_lang_pool_s {
+	char const		*name;			//!< For log messages.
+	fr_lang_pool_config_t	config;			//!< What to run, and how.
+
+	pthread_mutex_t		mutex;			//!< Protects claimed.
+	unsigned int		num_procs;		//!< One per worker thread.
+	lang_pool_proc_t	*procs;
+};
+
+struct fr_lang_pool_thread_s {
+	fr_lang_pool_t		*pool;			//!< We're a member of.
+	lang_pool_proc_t	*proc;			//!< We've claimed.
+	fr_event_list_t		*el;			//!< reply_fd[0] is inserted into.
+
+	uint64_t		next_id;		//!< Of the next call.
+	fr_dlist_head_t		calls;			//!< Waiting for a reply, oldest first.
+	bool			dead;			//!< The child has exited.
+
+	fr_dbuff_t		dbuff;			//!< Calls are encoded here, then copied to the ring.
+	fr_dbuff_uctx_talloc_t	tctx;
+};
+
+/** A call waiting for a reply
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the thread's list of calls.
+	fr_lang_pool_thread_t	*t;			//!< The call was made by.
+	uint64_t		id;			//!< Matched against the reply.
+	request_t		*request;		//!< To copy the lists back to.
+	rlm_rcode_t		rcode;			//!< From the reply.
+} lang_pool_call_t;
+
+static fr_pair_list_t *lang_pool_list(TALLOC_CTX **ctx, request_t *request, lang_pool_list_t list)
+{
+	switch (list) {
+	case LANG_POOL_LIST_REQUEST:
+		*ctx = request->request_ctx;
+		return &request->request_pairs;
+
+	case LANG_POOL_LIST_REPLY:
+		*ctx = request->reply_ctx;
+		return &request->reply_pairs;
+
+	case LANG_POOL_LIST_CONTROL:
+		*ctx = request->control_ctx;
+		return &request->control_pairs;
+
+	case LANG_POOL_LIST_STATE:
+		*ctx = request->session_state_ctx;
+		return &request->session_state_pairs;
+
+	default:
+		break;
+	}
+
+	fr_assert(0);
+	return NULL;
+}
+
+/** Encode a call or a reply
+ *
+ * @param[in] dbuff	to encode to.  Reset to the start first.
+ * @param[in] request	whose lists we're encoding.
+ * @param[in] id	of the call.
+ * @param[in] code	method or rcode.
+ * @param[in] lists	Bitmask of the lists to encode.
+ * @return
+ *	- The length of the message.
+ *	- -1 on failure.
+ */
+static ssize_t lang_pool_encode(fr_dbuff_t *dbuff, request_t *request, uint64_t id, uint32_t code, uint32_t lists)
+{
+	lang_pool_msg_t	msg = {
+				.id = id,
+				.code = code,
+				.log_lvl = request->log.lvl,
+				.lists = lists,
+			};
+	char const	*dict_name = fr_dict_root(request->dict)->name;
+	unsigned int	i;
+
+	fr_dbuff_set_to_start(dbuff);
+
+	msg.dict_len = strlen(dict_name);
+	if ((fr_dbuff_in_memcpy(dbuff, (uint8_t *)&msg, sizeof(msg)) <= 0) ||
+	    (fr_dbuff_in_memcpy(dbuff, (uint8_t const *)dict_name, msg.dict_len) < 0)) {
+	oom:
+		fr_strerror_const("Insufficient buffer space");
+		return -1;
+	}
+
+	for (i = 0; i < LANG_POOL_LIST_MAX; i++) {
+		TALLOC_CTX	*ctx;
+		fr_pair_list_t	*list;
+		fr_dcursor_t	cursor;
+		fr_pair_t	*vp;
+		size_t		start;
+
+		if (!(lists & (1 << i))) continue;
+
+		list = lang_pool_list(&ctx, request, i);
+		start = fr_dbuff_used(dbuff);
+
+		for (vp = fr_dcursor_init(&cursor, list);
+		     vp;
+		     vp = fr_dcursor_current(&cursor)) {
+			if (fr_internal_encode_pair(dbuff, &cursor, NULL) < 0) goto oom;
+		}
+		msg.list_len[i] = fr_dbuff_used(dbuff) - start;
+	}
+
+	/*
+	 *	Now we know the lengths.
+	 */
+	memcpy(fr_dbuff_start(dbuff), &msg, sizeof(msg));
+
+	return fr_dbuff_used(dbuff);
+}
+
+/** Replace the lists in a request with those in a message
+ *
+ * If any list fails to decode, none of the lists are changed.
+ */
+static int lang_pool_decode(request_t *request, lang_pool_msg_t const *msg, uint8_t const *data, size_t data_len)
+{
+	fr_pair_list_t	decoded[LANG_POOL_LIST_MAX];
+	uint8_t const	*p = data, *end = data + data_len;
+	unsigned int	i;
+
+	for (i = 0; i < LANG_POOL_LIST_MAX; i++) fr_pair_list_init(&decoded[i]);
+
+	for (i = 0; i < LANG_POOL_LIST_MAX; i++) {
+		TALLOC_CTX	*ctx;
+		fr_dbuff_t	dbuff;
+		fr_dcursor_t	cursor;
+
+		if (!(msg->lists & (1 << i))) continue;
+
+		if (msg->list_len[i] > (size_t)(end - p)) {
+			fr_strerror_const("Message is truncated");
+		error:
+			for (i = 0; i < LANG_POOL_LIST_MAX; i++) fr_pair_list_free(&decoded[i]);
+			return -1;
+		}
+
+		(void) lang_pool_list(&ctx, request, i);
+		fr_dcursor_init(&cursor, &decoded[i]);
+		fr_dbuff_init(&dbuff, p, msg->list_len[i]);
+
+		while (fr_dbuff_remaining(&dbuff) > 0) {
+			if (fr_internal_decode_pair_dbuff(ctx, &cursor, request->dict, &dbuff, NULL) < 0) goto error;
+		}
+		p += msg->list_len[i];
+	}
+
+	for (i = 0; i < LANG_POOL_LIST_MAX; i++) {
+		TALLOC_CTX	*ctx;
+		fr_pair_list_t	*list;
+
+		if (!(msg->lists & (1 << i))) continue;
+
+		list = lang_pool_list(&ctx, request, i);
+		fr_pair_list_free(list);
+		fr_pair_list_append(list, &decoded[i]);
+	}
+
+	return 0;
+}
+
+/** Wake the other side, ignoring "pipe full", as it's already due to wake
+ *
+ */
+static void lang_pool_wake(int fd)
+{
+	while ((write(fd, "", 1) < 0) && (errno == EINTR));
+}
+
+/** Write a message to a ring, waiting for the other side to make space if necessary
+ *
+ * Only used by the child.  The worker never waits.
+ */
+static int lang_pool_child_send(lang_pool_proc_t *proc, uint8_t const *data, size_t data_len)
+{
+	uint8_t	*p;
+
+	while (!(p = fr_shm_ring_reserve(proc->reply, data_len))) {
+		struct pollfd	pfd = { .fd = proc->call_fd[0], .events = POLLIN };
+
+		if (data_len > fr_shm_ring_max_message(proc->reply)) return -1;
+
+		/*
+		 *	The worker is draining the ring.  Check
+		 *	now and then that it's still there.
+		 */
+		if ((poll(&pfd, 1, 1) > 0) && (pfd.revents & (POLLHUP | POLLERR))) _exit(EXIT_SUCCESS);
+	}
+
+	memcpy(p, data, data_len);
+	if (fr_shm_ring_commit(proc->reply, data_len)) lang_pool_wake(proc->reply_fd[1]);
+
+	return 0;
+}
+
+/** Run one call in the child, and send the reply
+ *
+ */
+static void lang_pool_child_call(fr_lang_pool_t *pool, lang_pool_proc_t *proc, fr_dbuff_t *dbuff,
+				 uint8_t const *data, size_t data_len)
+{
+	lang_pool_msg_t		msg;
+	request_t		*request;
+	fr_dict_t const		*dict;
+	char			dict_name[128];
+	rlm_rcode_t		rcode;
+	ssize_t			slen;
+
+	if (data_len < sizeof(msg)) return;
+	memcpy(&msg, data, sizeof(msg));
+	data += sizeof(msg);
+	data_len -= sizeof(msg);
+
+	if ((msg.dict_len >= sizeof(dict_name)) || (msg.dict_len > data_len)) {
+	fail:
+		ERROR("%s - Invalid call from worker", pool->name);
+		msg.code = RLM_MODULE_FAIL;
+		msg.lists = 0;
+		msg.dict_len = 0;
+		memset(msg.list_len, 0, sizeof(msg.list_len));
+		(void) lang_pool_child_send(proc, (uint8_t *)&msg, sizeof(msg));
+		return;
+	}
+	memcpy(dict_name, data, msg.dict_len);
+	dict_name[msg.dict_len] = '\0';
+	data += msg.dict_len;
+	data_len -= msg.dict_len;
+
+	dict = fr_dict_by_protocol_name(dict_name);
+	if (!dict) goto fail;
+
+	request = request_local_alloc_internal(NULL, (&(request_init_args_t){ .namespace = dict }));
+	if (!request) goto fail;
+	request->log.lvl = msg.log_lvl;
+
+	if (lang_pool_decode(request, &msg, data, data_len) < 0) {
+		PERROR("%s - Failed decoding call", pool->name);
+		talloc_free(request);
+		goto fail;
+	}
+
+	rcode = pool->config.func(request, msg.code, pool->config.uctx);
+
+	slen = lang_pool_encode(dbuff, request, msg.id, rcode,
+				(1 << LANG_POOL_LIST_REPLY) | (1 << LANG_POOL_LIST_CONTROL) | (1 << LANG_POOL_LIST_STATE) |
+				(pool->config.copy_request ? (1 << LANG_POOL_LIST_REQUEST) : 0));
+	talloc_free(request);
+
+	if ((slen < 0) || (lang_pool_child_send(proc, fr_dbuff_start(dbuff), slen) < 0)) {
+		PERROR("%s - Failed sending reply", pool->name);
+		goto fail;
+	}
+}
+
+/** The main loop of a child
+ *
+ * Never returns.  The child exits when the worker closes its end of
+ * the call pipe, i.e. when the server exits.
+ */
+static NEVER_RETURNS void lang_pool_child_run(fr_lang_pool_t *pool, lang_pool_proc_t *proc)
+{
+	fr_dbuff_t		dbuff;
+	fr_dbuff_uctx_talloc_t	tctx;
+	unsigned int		i;
+
+	/*
+	 *	Close everything which belongs to the worker,
+	 *	or to the other children.
+	 */
+	for (i = 0; i < pool->num_procs; i++) {
+		lang_pool_proc_t *other = &pool->procs[i];
+
+		if (other == proc) {
+			close(other->call_fd[1]);
+			close(other->reply_fd[0]);
+			continue;
+		}
+		if (other->pid < 0) continue;
+
+		close(other->call_fd[1]);
+		close(other->reply_fd[0]);
+	}
+
+	MEM(fr_dbuff_init_talloc(NULL, &dbuff, &tctx, 4096, fr_shm_ring_max_message(proc->reply)));
+
+	for (;;) {
+		uint8_t const	*data;
+		size_t		data_len;
+		uint8_t		buffer[64];
+		ssize_t		slen;
+
+		while ((data = fr_shm_ring_peek(proc->call, &data_len))) {
+			lang_pool_child_call(pool, proc, &dbuff, data, data_len);
+			fr_shm_ring_release(proc->call);
+		}
+
+		/*
+		 *	The ring is empty, the worker will
+		 *	wake us when it isn't.
+		 */
+		slen = read(proc->call_fd[0], buffer, sizeof(buffer));
+		if (slen == 0) _exit(EXIT_SUCCESS);
+		if ((slen < 0) && (errno != EINTR)) {
+			ERROR("%s - Failed reading from worker: %s", pool->name, fr_syserror(errno));
+			_exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static int _lang_pool_free(fr_lang_pool_t *pool)
+{
+	unsigned int	i;
+
+	/*
+	 *	Closing the call pipes tells the
+	 *	children to exit.  If they're stuck
+	 *	in a script, they get a SIGTERM too.
+	 */
+	for (i = 0; i < pool->num_procs; i++) {
+		lang_pool_proc_t *proc = &pool->procs[i];
+
+		if (proc->pid < 0) continue;
+
+		close(proc->call_fd[1]);
+		close(proc->reply_fd[0]);
+		kill(proc->pid, SIGTERM);
+	}
+
+	for (i = 0; i < pool->num_procs; i++) {
+		if (pool->procs[i].pid < 0) continue;
+
+		while ((waitpid(pool->procs[i].pid, NULL, 0) < 0) && (errno == EINTR));
+	}
+
+	pthread_mutex_destroy(&pool->mutex);
+
+	return 0;
+}
+
+/** Fork the children for a module instance
+ *
+ * Should be called from the module's instantiate function, once the
+ * interpreter is ready to run scripts, and before any worker threads
+ * have been started.  The children inherit the interpreter in whatever
+ * state it was left in.
+ *
+ * One child is started for each worker thread.
+ *
+ * @param[in] ctx	to allocate the pool in.  When it's freed, the
+ *			children are told to exit, and are reaped.
+ * @param[in] name	of the pool, used in log messages.
+ * @param[in] config	what to run in the children.
+ * @return
+ *	- A new pool on success.
+ *	- NULL on failure.
+ */
+fr_lang_pool_t *fr_lang_pool_alloc(TALLOC_CTX *ctx, char const *name, fr_lang_pool_config_t const *config)
+{
+	fr_lang_pool_t	*pool;
+	unsigned int	i;
+
+	MEM(pool = talloc_zero(ctx, fr_lang_pool_t));
+	MEM(pool->name = talloc_strdup(pool, name));
+	pool->config = *config;
+	pool->num_procs = main_config->spawn_workers ? main_config->max_workers : 1;
+	MEM(pool->procs = talloc_array(pool, lang_pool_proc_t, pool->num_procs));
+	for (i = 0; i < pool->num_procs; i++) pool->procs[i] = (lang_pool_proc_t){ .pid = -1 };
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	talloc_set_destructor(pool, _lang_pool_free);
+
+	for (i = 0; i < pool->num_procs; i++) {
+		lang_pool_proc_t	*proc = &pool->procs[i];
+		pid_t			pid;
+
+		proc->call = fr_shm_ring_alloc(pool, config->ring_size);
+		proc->reply = fr_shm_ring_alloc(pool, config->ring_size);
+		if (!proc->call || !proc->reply) {
+		error:
+			talloc_free(pool);
+			return NULL;
+		}
+
+		if (pipe(proc->call_fd) < 0) {
+			fr_strerror_printf("Failed creating pipe: %s", fr_syserror(errno));
+			goto error;
+		}
+
+		if (pipe(proc->reply_fd) < 0) {
+			fr_strerror_printf("Failed creating pipe: %s", fr_syserror(errno));
+		close_call:
+			close(proc->call_fd[0]);
+			close(proc->call_fd[1]);
+			goto error;
+		}
+
+		/*
+		 *	The side which wakes the other never
+		 *	blocks.  The child blocks reading
+		 *	call_fd[0], the worker polls reply_fd[0].
+		 */
+		if ((fr_nonblock(proc->call_fd[1]) < 0) ||
+		    (fr_nonblock(proc->reply_fd[0]) < 0) ||
+		    (fr_nonblock(proc->reply_fd[1]) < 0)) {
+			fr_strerror_printf("Failed setting pipe to non-blocking: %s", fr_syserror(errno));
+		close_reply:
+			close(proc->reply_fd[0]);
+			close(proc->reply_fd[1]);
+			goto close_call;
+		}
+
+		if (config->pre_fork) config->pre_fork(config->uctx);
+		pid = fork();
+		if (pid < 0) {
+			fr_strerror_printf("Failed forking %s worker process: %s", name, fr_syserror(errno));
+			if (config->post_fork_parent) config->post_fork_parent(config->uctx);
+			goto close_reply;
+		}
+
+		if (pid == 0) {
+			if (config->post_fork_child) config->post_fork_child(config->uctx);
+			lang_pool_child_run(pool, proc);
+		}
+
+		if (config->post_fork_parent) config->post_fork_parent(config->uctx);
+
+		/*
+		 *	The ends which belong to the child.  Later
+		 *	children only inherit the worker's ends.
+		 */
+		close(proc->call_fd[0]);
+		close(proc->reply_fd[1]);
+		proc->call_fd[0] = proc->reply_fd[1] = -1;
+		proc->pid = pid;
+
+		DEBUG2("%s - Started worker process %u (pid %u)", name, i, (unsigned int)pid);
+	}
+
+	return pool;
+}
+
+/** The child exited, fail every call waiting for it
+ *
+ */
+static void lang_pool_thread_dead(fr_lang_pool_thread_t *t)
+{
+	lang_pool_call_t	*call;
+	int			status;
+
+	if (t->dead) return;
+	t->dead = true;
+
+	(void) fr_event_fd_delete(t->el, t->proc->reply_fd[0], FR_EVENT_FILTER_IO);
+
+	if (waitpid(t->proc->pid, &status, WNOHANG) == t->proc->pid) {
+		if (WIFSIGNALED(status)) {
+			ERROR("%s - Worker process (pid %u) was killed by signal %d",
+			      t->pool->name, (unsigned int)t->proc->pid, WTERMSIG(status));
+		} else {
+			ERROR("%s - Worker process (pid %u) exited with status %d",
+			      t->pool->name, (unsigned int)t->proc->pid, WEXITSTATUS(status));
+		}
+		t->proc->pid = -1;
+	} else {
+		ERROR("%s - Lost contact with worker process (pid %u)", t->pool->name, (unsigned int)t->proc->pid);
+	}
+
+	while ((call = fr_dlist_pop_head(&t->calls))) {
+		call->rcode = RLM_MODULE_FAIL;
+		unlang_interpret_mark_runnable(call->request);
+	}
+}
+
+/** The child has sent us replies
+ *
+ */
+static void lang_pool_reply_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	fr_lang_pool_thread_t	*t = talloc_get_type_abort(uctx, fr_lang_pool_thread_t);
+	uint8_t const		*data;
+	size_t			data_len;
+	uint8_t			buffer[64];
+	ssize_t			slen;
+
+	/*
+	 *	Drain the wakeups before draining the ring,
+	 *	so we don't miss one which arrives in between.
+	 */
+	while ((slen = read(fd, buffer, sizeof(buffer))) > 0);
+
+	while ((data = fr_shm_ring_peek(t->proc->reply, &data_len))) {
+		lang_pool_msg_t		msg;
+		lang_pool_call_t	*call;
+		request_t		*request;
+
+		if (data_len < sizeof(msg)) goto next;
+		memcpy(&msg, data, sizeof(msg));
+
+		/*
+		 *	Replies are in the same order as calls.
+		 *	If the call isn't at the head, it was
+		 *	cancelled.
+		 */
+		call = fr_dlist_head(&t->calls);
+		if (!call || (call->id != msg.id)) goto next;
+
+		fr_dlist_remove(&t->calls, call);
+		request = call->request;
+		call->rcode = msg.code;
+
+		if ((msg.dict_len > (data_len - sizeof(msg))) ||
+		    (lang_pool_decode(request, &msg, data + sizeof(msg) + msg.dict_len,
+				      data_len - sizeof(msg) - msg.dict_len) < 0)) {
+			RPERROR("Failed decoding reply from %s worker process", t->pool->name);
+			call->rcode = RLM_MODULE_FAIL;
+		}
+		unlang_interpret_mark_runnable(request);
+
+	next:
+		fr_shm_ring_release(t->proc->reply);
+	}
+
+	/*
+	 *	The child has exited, after sending
+	 *	whatever replies it managed to.
+	 */
+	if (slen == 0) lang_pool_thread_dead(t);
+}
+
+static void lang_pool_reply_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+				  UNUSED int fd_errno, void *uctx)
+{
+	lang_pool_thread_dead(talloc_get_type_abort(uctx, fr_lang_pool_thread_t));
+}
+
+static int _lang_pool_thread_free(fr_lang_pool_thread_t *t)
+{
+	if (!t->dead) (void) fr_event_fd_delete(t->el, t->proc->reply_fd[0], FR_EVENT_FILTER_IO);
+
+	pthread_mutex_lock(&t->pool->mutex);
+	t->proc->claimed = false;
+	pthread_mutex_unlock(&t->pool->mutex);
+
+	return 0;
+}
+
+/** Claim a child for a worker thread
+ *
+ * Should be called from the module's thread_instantiate function.
+ *
+ * @param[in] ctx	to allocate the thread specific data in.
+ * @param[in] pool	to claim a child from.
+ * @param[in] el	of the worker thread.
+ * @return
+ *	- The thread specific data on success.
+ *	- NULL if there are no children left to claim, or on error.
+ */
+fr_lang_pool_thread_t *fr_lang_pool_thread_alloc(TALLOC_CTX *ctx, fr_lang_pool_t *pool, fr_event_list_t *el)
+{
+	fr_lang_pool_thread_t	*t;
+	lang_pool_proc_t	*proc = NULL;
+	unsigned int		i;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (i = 0; i < pool->num_procs; i++) {
+		if (pool->procs[i].claimed || (pool->procs[i].pid < 0)) continue;
+
+		proc = &pool->procs[i];
+		proc->claimed = true;
+		break;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (!proc) {
+		fr_strerror_printf("All %u %s worker processes are in use", pool->num_procs, pool->name);
+		return NULL;
+	}
+
+	MEM(t = talloc_zero(ctx, fr_lang_pool_thread_t));
+	t->pool = pool;
+	t->proc = proc;
+	t->el = el;
+	fr_dlist_init(&t->calls, lang_pool_call_t, entry);
+	MEM(fr_dbuff_init_talloc(t, &t->dbuff, &t->tctx, 4096, fr_shm_ring_max_message(proc->call)));
+	talloc_set_destructor(t, _lang_pool_thread_free);
+
+	if (fr_event_fd_insert(t, el, proc->reply_fd[0], lang_pool_reply_read, NULL, lang_pool_reply_error, t) < 0) {
+		fr_strerror_const_push("Failed inserting worker process pipe into event loop");
+		t->dead = true;
+		talloc_free(t);
+		return NULL;
+	}
+
+	return t;
+}
+
+static int _lang_pool_call_free(lang_pool_call_t *call)
+{
+	if (fr_dlist_entry_in_list(&call->entry)) fr_dlist_remove(&call->t->calls, call);
+
+	return 0;
+}
+
+static unlang_action_t lang_pool_resume(rlm_rcode_t *p_result, UNUSED module_ctx_t const *mctx,
+					UNUSED request_t *request, void *rctx)
+{
+	lang_pool_call_t	*call = talloc_get_type_abort(rctx, lang_pool_call_t);
+	rlm_rcode_t		rcode = call->rcode;
+
+	talloc_free(call);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+/** The request was cancelled
+ *
+ * The child still runs the call, but the reply is discarded.
+ */
+static void lang_pool_signal(UNUSED module_ctx_t const *mctx, UNUSED request_t *request,
+			     void *rctx, fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	talloc_free(talloc_get_type_abort(rctx, lang_pool_call_t));
+}
+
+/** Send a call to the worker thread's child, and yield until it replies
+ *
+ * @note The module function which calls #fr_lang_pool_call should
+ *	return its result immediately, i.e. ``return fr_lang_pool_call(...)``.
+ *
+ * @param[out] p_result		set to RLM_MODULE_FAIL if the call can't be sent.
+ * @param[in] t			the worker thread's pool data.
+ * @param[in] request		The current request.
+ * @param[in] method		passed to #fr_lang_pool_func_t in the child.
+ * @return
+ *	- UNLANG_ACTION_YIELD on success.
+ *	- UNLANG_ACTION_CALCULATE_RESULT on failure.
+ */
+unlang_action_t fr_lang_pool_call(rlm_rcode_t *p_result, fr_lang_pool_thread_t *t,
+				  request_t *request, unsigned int method)
+{
+	lang_pool_call_t	*call;
+	uint8_t			*p;
+	ssize_t			slen;
+
+	if (t->dead) {
+		REDEBUG("%s worker process has exited", t->pool->name);
+		RETURN_MODULE_FAIL;
+	}
+
+	slen = lang_pool_encode(&t->dbuff, request, t->next_id, method,
+				(1 << LANG_POOL_LIST_REQUEST) | (1 << LANG_POOL_LIST_REPLY) |
+				(1 << LANG_POOL_LIST_CONTROL) | (1 << LANG_POOL_LIST_STATE));
+	if (slen < 0) {
+		RPERROR("Failed encoding call to %s worker process", t->pool->name);
+		RETURN_MODULE_FAIL;
+	}
+
+	/*
+	 *	Don't wait for the child to catch up, as
+	 *	that would stall every other request on
+	 *	this worker.
+	 */
+	p = fr_shm_ring_reserve(t->proc->call, slen);
+	if (!p) {
+		RPERROR("Failed sending call to %s worker process", t->pool->name);
+		RETURN_MODULE_FAIL;
+	}
+	memcpy(p, fr_dbuff_start(&t->dbuff), slen);
+
+	MEM(call = talloc_zero(unlang_interpret_frame_talloc_ctx(request), lang_pool_call_t));
+	call->t = t;
+	call->id = t->next_id++;
+	call->request = request;
+	fr_dlist_insert_tail(&t->calls, call);
+	talloc_set_destructor(call, _lang_pool_call_free);
+
+	if (fr_shm_ring_commit(t->proc->call, slen)) lang_pool_wake(t->proc->call_fd[1]);
+
+	return unlang_module_yield(request, lang_pool_resume, lang_pool_signal, call);
+}
@@ -0,0 +1,86 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file io/lang_pool.h
+ * @brief Run language interpreters in child processes, one per worker thread.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(lang_pool_h, "$Id$")
+
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/unlang/module.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/talloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_lang_pool_s fr_lang_pool_t;
+typedef struct fr_lang_pool_thread_s fr_lang_pool_thread_t;
+
+/** Run a method of the interpreter on a copy of the request
+ *
+ * Called in the child process.  The request has copies of the
+ * request, reply, control and session-state lists of the original.
+ * The changes the function makes to them are copied back to the
+ * original before it resumes.
+ *
+ * @param[in] request	the copy of the original request.
+ * @param[in] method	passed to #fr_lang_pool_call.
+ * @param[in] uctx	from #fr_lang_pool_config_t.
+ * @return the result of the method.
+ */
+typedef rlm_rcode_t (*fr_lang_pool_func_t)(request_t *request, unsigned int method, void *uctx);
+
+/** Called around the fork() of each child process
+ *
+ * @param[in] uctx	from #fr_lang_pool_config_t.
+ */
+typedef void (*fr_lang_pool_fork_t)(void *uctx);
+
+typedef struct {
+	size_t			ring_size;		//!< Of the rings to and from each child.
+
+	bool			copy_request;		//!< Copy the request list back from the child.
+							///< Only needed if func can change it.
+
+	fr_lang_pool_func_t	func;			//!< Run in the child for each call.
+
+	fr_lang_pool_fork_t	pre_fork;		//!< Called in the parent before each fork().  May be NULL.
+	fr_lang_pool_fork_t	post_fork_parent;	//!< Called in the parent after each fork().  May be NULL.
+	fr_lang_pool_fork_t	post_fork_child;	//!< Called in the child after fork().  May be NULL.
+
+	void			*uctx;			//!< Passed to the callbacks.
+} fr_lang_pool_config_t;
+
+fr_lang_pool_t		*fr_lang_pool_alloc(TALLOC_CTX *ctx, char const *name,
+					    fr_lang_pool_config_t const *config) CC_HINT(nonnull);
+
+fr_lang_pool_thread_t	*fr_lang_pool_thread_alloc(TALLOC_CTX *ctx, fr_lang_pool_t *pool,
+						   fr_event_list_t *el) CC_HINT(nonnull);
+
+unlang_action_t		fr_lang_pool_call(rlm_rcode_t *p_result, fr_lang_pool_thread_t *t,
+					  request_t *request, unsigned int method) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -43,6 +43,11 @@ struct fr_listen {
 	bool			track_duplicates;	//!< do we track duplicate packets?
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
+	uint32_t		read_batch;		//!< read up to this many packets each time the
+							///< socket is readable.  0 means use the default.
+	uint32_t		shed_priority;		//!< set by the network when it's overloaded.  Packets
+							///< with a lower priority will be dropped, and so
+							///< can be discarded as soon as they're read.
 };
 
 /**
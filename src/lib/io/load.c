@@ -25,6 +25,10 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/io/load.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/rand.h>
+
+#include <sys/resource.h>
 
 /*
  *	We use *inverse* numbers to avoid numerical calculation issues.
@@ -41,6 +45,18 @@ RCSID("$Id$")
 #define RTTVAR(_rtt, _rttvar, _t) ((((IBETA - 1) * _rttvar) + DIFF(_rtt, _t)) / IBETA)
 #define RTT(_old, _new) ((_new + ((IALPHA - 1) * _old)) / IALPHA)
 
+/*
+ *	ln(2), so that we can turn base 2 logarithms into natural ones.
+ */
+#define LOAD_LN2 (0.69314718055994530942)
+
+fr_table_num_sorted_t const fr_load_arrival_table[] = {
+	{ L("bursty"),		FR_LOAD_ARRIVAL_BURSTY		},
+	{ L("constant"),	FR_LOAD_ARRIVAL_CONSTANT	},
+	{ L("poisson"),		FR_LOAD_ARRIVAL_POISSON		},
+};
+size_t fr_load_arrival_table_len = NUM_ELEMENTS(fr_load_arrival_table);
+
 typedef enum {
 	FR_LOAD_STATE_INIT = 0,
 	FR_LOAD_STATE_SENDING,
@@ -68,8 +84,163 @@ struct fr_load_s {
 
 	fr_time_t		next;			//!< The next time we're supposed to send a packet
 	fr_event_timer_t const	*ev;
+
+	fr_load_hist_t		hist;			//!< response times, for percentiles
 };
 
+/** Map a response time in microseconds to a histogram bucket
+ *
+ */
+static inline unsigned int load_hist_bucket(uint64_t usec)
+{
+	unsigned int shift;
+
+	if (usec < FR_LOAD_HIST_SUB) return usec;
+	if (usec > UINT32_MAX) usec = UINT32_MAX;
+
+	shift = fr_high_bit_pos(usec) - 1 - FR_LOAD_HIST_SUB_BITS;
+
+	return ((shift + 1) * FR_LOAD_HIST_SUB) + ((usec >> shift) & (FR_LOAD_HIST_SUB - 1));
+}
+
+/** Return the largest response time in microseconds which maps to a bucket
+ *
+ */
+static inline uint64_t load_hist_value(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < FR_LOAD_HIST_SUB) return bucket;
+
+	shift = (bucket / FR_LOAD_HIST_SUB) - 1;
+
+	return ((((uint64_t) FR_LOAD_HIST_SUB + (bucket % FR_LOAD_HIST_SUB)) + 1) << shift) - 1;
+}
+
+/** Add a response time to a histogram
+ *
+ * @param[in] h		to add the response time to.
+ * @param[in] t		the response time, in nanoseconds.
+ */
+void fr_load_hist_add(fr_load_hist_t *h, fr_time_delta_t t)
+{
+	h->count++;
+	h->bucket[load_hist_bucket(t / 1000)]++;
+}
+
+/** Find the response time (in microseconds) below which "permille" of entries fall
+ *
+ * @param[in] h		to search.
+ * @param[in] permille	e.g. 500 for the median, or 999 for the 99.9th percentile.
+ * @return the response time in microseconds, or 0 if the histogram is empty.
+ */
+uint64_t fr_load_hist_percentile(fr_load_hist_t const *h, unsigned int permille)
+{
+	uint64_t	want, seen = 0;
+	unsigned int	i;
+
+	if (!h->count) return 0;
+
+	want = ((h->count * permille) + 999) / 1000;
+
+	for (i = 0; i < FR_LOAD_HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= want) return load_hist_value(i);
+	}
+
+	return load_hist_value(FR_LOAD_HIST_BUCKETS - 1);
+}
+
+/** Return a random gap between packets, with an exponential distribution
+ *
+ *  This is what makes the arrivals a Poisson process.  We calculate
+ *  -ln(U) for a uniform U in (0, 1], via a bit-by-bit base 2
+ *  logarithm.  That's accurate to ~16 bits, which is more than
+ *  enough, and doesn't need libm.
+ *
+ * @param[in] mean	average gap between packets.
+ * @return the gap until the next packet.
+ */
+static fr_time_delta_t load_gap_exponential(fr_time_delta_t mean)
+{
+	uint64_t	x = ((uint64_t) fr_rand()) + 1;
+	unsigned int	i, shift;
+	double		m, log2_x, bit = 1;
+
+	/*
+	 *	x is in [2^shift, 2^(shift + 1)), so m is in [1, 2).
+	 */
+	shift = fr_high_bit_pos(x) - 1;
+	m = ((double) x) / ((double) (((uint64_t) 1) << shift));
+	log2_x = shift;
+
+	for (i = 0; i < 16; i++) {
+		m *= m;
+		bit /= 2;
+		if (m >= 2) {
+			m /= 2;
+			log2_x += bit;
+		}
+	}
+
+	/*
+	 *	U = x / 2^32, so -log2(U) = 32 - log2(x).
+	 */
+	return (fr_time_delta_t) ((32 - log2_x) * LOAD_LN2 * ((double) mean));
+}
+
+/** Figure out when the next packets should be sent.
+ *
+ *  Updates l->next, and returns the number of packets which are due
+ *  at the current l->next.
+ */
+static int load_next(fr_load_t *l, fr_time_t now)
+{
+	int count = 0;
+
+	switch (l->config->arrival) {
+	default:
+	case FR_LOAD_ARRIVAL_CONSTANT:
+		/*
+		 *	Skip timers if we're too busy.
+		 */
+		l->next += l->delta;
+		if (l->next < now) {
+			while ((l->next + l->delta) < now) {
+//				l->stats.skipped += l->count;
+				l->next += l->delta;
+			}
+		}
+		return l->config->parallel;
+
+	/*
+	 *	Open loop arrivals.  If we're running late, then all
+	 *	of the packets which should have arrived by now are
+	 *	sent in one batch, instead of being skipped.
+	 */
+	case FR_LOAD_ARRIVAL_POISSON:
+		do {
+			count++;
+			l->next += load_gap_exponential(l->delta / l->config->parallel);
+		} while ((l->next <= now) && (count < (int) l->pps));
+		break;
+
+	case FR_LOAD_ARRIVAL_BURSTY:
+		do {
+			count += l->config->parallel;
+			l->next += load_gap_exponential(l->delta);
+		} while ((l->next <= now) && (count < (int) l->pps));
+		break;
+	}
+
+	/*
+	 *	Don't try to catch up on more than a second of packets.
+	 */
+	if (l->next < now) l->next = now;
+
+	return count;
+}
+
 fr_load_t *fr_load_generator_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_load_config_t *config,
 				    fr_load_callback_t callback, void *uctx)
 {
@@ -116,7 +287,7 @@ static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 {
 	fr_load_t *l = uctx;
 	fr_time_t delta;
-	int count;
+	int count, due;
 
 	/*
 	 *	Keep track of the overall maximum backlog for the
@@ -147,6 +318,12 @@ static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 		}
 	}
 
+	/*
+	 *	Find out how many packets are due now, and when the
+	 *	next ones are due.
+	 */
+	due = load_next(l, now);
+
 	/*
 	 *	We don't have "pps" packets in the backlog, go send
 	 *	some more.  We scale the backlog by 1000 milliseconds
@@ -161,7 +338,7 @@ static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 	if (((uint32_t) l->stats.backlog * 1000) < (l->pps * l->config->milliseconds)) {
 		l->state = FR_LOAD_STATE_SENDING;
 		l->stats.blocked = false;
-		count = l->config->parallel;
+		count = due;
 		l->stats.skipped = 0;
 
 		/*
@@ -183,19 +360,9 @@ static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 		l->state = FR_LOAD_STATE_GATED;
 		l->stats.blocked = true;
 		count = 0;
-		l->stats.skipped += l->count;
+		l->stats.skipped += due;
 	}
 
-	/*
-	 *	Skip timers if we're too busy.
-	 */
-	l->next += l->delta;
-	if (l->next < now) {
-		while ((l->next + l->delta) < now) {
-//			l->stats.skipped += l->count;
-			l->next += l->delta;
-		}
-	}
 	delta = l->next - now;
 
 	/*
@@ -224,7 +391,8 @@ int fr_load_generator_start(fr_load_t *l)
 	l->count = l->config->parallel;
 
 	l->delta = (NSEC * ((uint64_t) l->config->parallel)) / l->pps;
-	l->next = l->step_start + l->delta;
+	l->next = l->step_start;
+	if (l->config->arrival == FR_LOAD_ARRIVAL_CONSTANT) l->next += l->delta;
 
 	load_timer(l->el, l->step_start, l);
 	return 0;
@@ -263,6 +431,7 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 	l->stats.rtt = RTT(l->stats.rtt, t);
 
 	l->stats.received++;
+	fr_load_hist_add(&l->hist, t);
 
 	/*
 	 *	t is in nanoseconds.
@@ -326,13 +495,23 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
  */
 size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer, size_t buflen)
 {
-	double now_f, last_send_f;
+	double now_f, last_send_f, cpu_f = 0;
+	struct rusage ru;
 
 	if (!l->header) {
 		l->header = true;
-		return snprintf(buffer, buflen, "\"time\",\"last_packet\",\"rtt\",\"rttvar\",\"pps\",\"pps_accepted\",\"sent\",\"received\",\"backlog\",\"max_backlog\",\"<usec\",\"us\",\"10us\",\"100us\",\"ms\",\"10ms\",\"100ms\",\"s\",\"blocked\"\n");
+		return snprintf(buffer, buflen, "\"time\",\"last_packet\",\"rtt\",\"rttvar\",\"pps\",\"pps_accepted\",\"sent\",\"received\",\"backlog\",\"max_backlog\",\"<usec\",\"us\",\"10us\",\"100us\",\"ms\",\"10ms\",\"100ms\",\"s\",\"blocked\",\"p50_us\",\"p99_us\",\"p999_us\",\"cpu\"\n");
 	}
 
+	/*
+	 *	CPU time used by the whole process, in seconds.  This
+	 *	includes the load generator itself, but it's a stable
+	 *	enough number to compare between runs.
+	 */
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+		cpu_f = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec;
+		cpu_f += ((double) (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)) / 1000000;
+	}
 
 	now_f = now - l->stats.start;
 	now_f /= NSEC;
@@ -357,7 +536,8 @@ size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer,
 			"%d,%d,"
 			"%d,%d,"
 			"%d,%d,%d,%d,%d,%d,%d,%d,"
-			"%d\n",
+			"%d,"
+			"%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%f\n",
 			now_f, last_send_f,
 			l->stats.rtt, l->stats.rttvar,
 			l->stats.pps, l->stats.pps_accepted,
@@ -365,7 +545,10 @@ size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer,
 			l->stats.backlog, l->stats.max_backlog,
 			l->stats.times[0], l->stats.times[1], l->stats.times[2], l->stats.times[3],
 			l->stats.times[4], l->stats.times[5], l->stats.times[6], l->stats.times[7],
-			l->stats.blocked);
+			l->stats.blocked,
+			fr_load_hist_percentile(&l->hist, 500), fr_load_hist_percentile(&l->hist, 990),
+			fr_load_hist_percentile(&l->hist, 999),
+			cpu_f);
 }
 
 fr_load_stats_t const * fr_load_generator_stats(fr_load_t const *l)
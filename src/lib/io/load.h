@@ -26,8 +26,21 @@
 RCSIDH(load_h, "$Id$")
 
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/talloc.h>
 
+/** How packets are spread out over time
+ *
+ */
+typedef enum {
+	FR_LOAD_ARRIVAL_CONSTANT = 0,	//!< "parallel" packets every "parallel / pps" seconds.
+	FR_LOAD_ARRIVAL_POISSON,	//!< one packet at a time, with exponentially distributed gaps.
+	FR_LOAD_ARRIVAL_BURSTY		//!< bursts of "parallel" packets, with exponentially distributed gaps.
+} fr_load_arrival_t;
+
+extern fr_table_num_sorted_t const fr_load_arrival_table[];
+extern size_t fr_load_arrival_table_len;
+
 /** Load generation configuration.
  *
  *  The load generator runs a callback periodically in order to
@@ -41,6 +54,14 @@ RCSIDH(load_h, "$Id$")
  *
  *  The callback is run "1/pps" times per second.
  *
+ *  With the default "constant" arrival process, packets are sent at
+ *  fixed intervals.  The "poisson" process instead sends packets one
+ *  at a time, with exponentially distributed gaps between them, so
+ *  that the offered load looks like many independent clients.  The
+ *  "bursty" process sends bursts of "parallel" packets, with
+ *  exponentially distributed gaps between the bursts.  All of the
+ *  processes have the same average rate of "pps" packets/s.
+ *
  *  In order to send higher load, it is possible to run the callback
  *  "parallel" times per timeout.  i.e. with "start_pps = 100", and
  *  "parallel = 10", the load generator will run the callback 10
@@ -76,8 +97,24 @@ typedef struct {
 	uint32_t	step;		//!< how much to increase each load test by
 	uint32_t	parallel;	//!< how many packets in parallel to send
 	uint32_t	milliseconds;	//!< how many milliseconds of backlog to top out at
+	fr_load_arrival_t arrival;	//!< how packets are spread out over time
 } fr_load_config_t;
 
+/*
+ *	Response times are tracked in a log-linear histogram, so that
+ *	we can print percentiles.  Each power of two microseconds is
+ *	split into FR_LOAD_HIST_SUB buckets, which gives roughly 12%
+ *	precision from 1us to ~70 minutes.
+ */
+#define FR_LOAD_HIST_SUB_BITS	(3)
+#define FR_LOAD_HIST_SUB	(1 << FR_LOAD_HIST_SUB_BITS)
+#define FR_LOAD_HIST_BUCKETS	((32 - FR_LOAD_HIST_SUB_BITS + 1) * FR_LOAD_HIST_SUB)
+
+typedef struct {
+	uint64_t	count;				//!< total number of response times added
+	uint32_t	bucket[FR_LOAD_HIST_BUCKETS];	//!< response times, for percentiles
+} fr_load_hist_t;
+
 typedef struct {
 	fr_time_t	start;		//! when the test started
 	fr_time_t	end;		//!< when the test ended, due to last reply received
@@ -120,3 +157,7 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer, size_t buflen);
 
 fr_load_stats_t const * fr_load_generator_stats(fr_load_t const *l) CC_HINT(nonnull);
+
+void fr_load_hist_add(fr_load_hist_t *h, fr_time_delta_t t) CC_HINT(nonnull);
+
+uint64_t fr_load_hist_percentile(fr_load_hist_t const *h, unsigned int permille) CC_HINT(nonnull);
@@ -87,6 +87,8 @@ struct fr_io_client_s {
 	fr_ipaddr_t			src_ipaddr;	//!< packets come from this address
 	fr_ipaddr_t			network;	//!< network for dynamic clients
 	RADCLIENT			*radclient;	//!< old-style definition of this client
+	RADCLIENT			*shared;	//!< global definition of this client, for statistics.
+							///< NULL for dynamic clients.
 
 	int				packets;	//!< number of packets using this client
 	int				pending_id;	//!< for pending clients
@@ -100,6 +102,15 @@ struct fr_io_client_s {
 	fr_io_thread_t			*thread;
 	fr_event_timer_t const		*ev;		//!< when we clean up the client
 	fr_rb_tree_t			*table;		//!< tracking table for packets
+	fr_hash_table_t			*hash_table;	//!< tracking table for packets, if the app_io can hash them
+
+	fr_dlist_head_t			expiring;	//!< tracking entries in cleanup_delay, oldest first
+	fr_event_timer_t const		*expiry_ev;	//!< when we clean up the oldest tracking entry
+
+	fr_time_t			rate_last;	//!< when the token bucket was last refilled
+	uint64_t			rate_tokens;	//!< tokens in the bucket, scaled by NSEC.  Only
+							///< used for dynamic clients, which have no shared
+							///< RADCLIENT.
 
 	fr_lst_t			*pending;	//!< pending packets for this client
 	fr_hash_table_t			*addresses;	//!< list of src/dst addresses used by this client
@@ -147,9 +158,48 @@ static fr_event_update_t resume_read[] = {
 	{ 0 }
 };
 
+/*
+ *	Replies generated in the network thread are small, e.g.
+ *	keepalives.  Anything larger goes to a worker.
+ */
+#define FR_IO_FAST_REPLY_SIZE (256)
+
+static void packet_expiry_timer(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+/** Stop the cleanup_delay for a tracking entry
+ *
+ *  The client timer may then fire for an entry which is no longer
+ *  at the head of the list.  It then just re-arms itself.
+ */
+static inline void track_unexpire(fr_io_track_t *track)
+{
+	if (fr_dlist_entry_in_list(&track->entry)) (void) fr_dlist_remove(&track->client->expiring, track);
+}
+
+static inline fr_io_track_t *track_find(fr_io_client_t *client, fr_io_track_t const *track)
+{
+	if (client->hash_table) return fr_hash_table_find(client->hash_table, track);
+
+	return fr_rb_find(client->table, track);
+}
+
+static inline bool track_insert(fr_io_client_t *client, fr_io_track_t *track)
+{
+	if (client->hash_table) return fr_hash_table_insert(client->hash_table, track);
+
+	return fr_rb_insert(client->table, track);
+}
+
+static inline bool track_delete(fr_io_client_t *client, fr_io_track_t *track)
+{
+	if (client->hash_table) return (fr_hash_table_remove(client->hash_table, track) != NULL);
+
+	return fr_rb_delete(client->table, track);
+}
+
 static int track_free(fr_io_track_t *track)
 {
-	if (track->ev) (void) fr_event_timer_delete(&track->ev);
+	track_unexpire(track);
 
 	talloc_free_children(track);
 
@@ -158,10 +208,10 @@ static int track_free(fr_io_track_t *track)
 
 static int track_dedup_free(fr_io_track_t *track)
 {
-	fr_assert(track->client->table != NULL);
-	fr_assert(fr_rb_find(track->client->table, track) != NULL);
+	fr_assert(track->client->table || track->client->hash_table);
+	fr_assert(track_find(track->client, track) != NULL);
 
-	if (!fr_rb_delete(track->client->table, track)) {
+	if (!track_delete(track->client, track)) {
 		fr_assert(0);
 	}
 
@@ -314,6 +364,32 @@ static int8_t track_connected_cmp(void const *one, void const *two)
 	return CMP(ret, 0);
 }
 
+/*
+ *	Hash the same fields as track_cmp(), or track_connected_cmp().
+ */
+static uint32_t track_hash(void const *data)
+{
+	fr_io_track_t const *track = talloc_get_type_abort_const(data, fr_io_track_t);
+	fr_io_address_t const *address = track->address;
+	uint32_t hash;
+
+	hash = track->client->inst->app_io->hash(track->client->inst->app_io_instance, track->packet);
+
+	/*
+	 *	All packets on a connected socket have the same
+	 *	src/dst ip/port.
+	 */
+	if (track->client->connection) return hash;
+
+	hash = fr_hash_update(&address->socket.inet.src_ipaddr, sizeof(address->socket.inet.src_ipaddr), hash);
+	hash = fr_hash_update(&address->socket.inet.src_port, sizeof(address->socket.inet.src_port), hash);
+
+	hash = fr_hash_update(&address->socket.inet.ifindex, sizeof(address->socket.inet.ifindex), hash);
+
+	hash = fr_hash_update(&address->socket.inet.dst_ipaddr, sizeof(address->socket.inet.dst_ipaddr), hash);
+	return fr_hash_update(&address->socket.inet.dst_port, sizeof(address->socket.inet.dst_port), hash);
+}
+
 
 static fr_io_pending_packet_t *pending_packet_pop(fr_io_thread_t *thread)
 {
@@ -351,6 +427,91 @@ static fr_io_pending_packet_t *pending_packet_pop(fr_io_thread_t *thread)
 	return pending;
 }
 
+/** Fill the token bucket for a new client
+ *
+ */
+static inline void client_rate_init(fr_io_client_t *client)
+{
+	client->rate_last = fr_time();
+	client->rate_tokens = (uint64_t) client->radclient->rate_burst * NSEC;
+}
+
+/** Check a client's packet rate against the bucket in the shared RADCLIENT
+ *
+ *  Every network thread, and every connection, from the client uses
+ *  the same bucket.  A token bucket would need two variables updated
+ *  together, so this is its single variable form (GCRA).  "rate_tat"
+ *  is when the bucket will be full again.  Each packet moves it on by
+ *  1/rate_limit seconds, and is allowed if that leaves it no more than
+ *  rate_burst packets ahead of now.
+ */
+static inline bool client_rate_limited_shared(RADCLIENT *shared, RADCLIENT const *radclient, fr_time_t now)
+{
+	uint64_t	interval = NSEC / radclient->rate_limit;
+	uint64_t	limit = (uint64_t) radclient->rate_burst * interval;
+	uint64_t	tat, next;
+
+	tat = atomic_load_explicit(&shared->rate_tat, memory_order_relaxed);
+	do {
+		next = ((tat > (uint64_t) now) ? tat : (uint64_t) now) + interval;
+		if ((next - (uint64_t) now) > limit) return true;
+	} while (!atomic_compare_exchange_weak_explicit(&shared->rate_tat, &tat, next,
+							memory_order_relaxed, memory_order_relaxed));
+
+	return false;
+}
+
+/** Check whether a client has exceeded its packet rate
+ *
+ *  Each packet costs NSEC tokens, and the bucket is refilled with
+ *  "rate_limit" tokens for every nanosecond which has passed.  So
+ *  the client can send "rate_limit" packets per second on average,
+ *  and up to "rate_burst" packets at once.
+ *
+ *  Clients from the client list share one bucket, so the limit
+ *  applies to the client as a whole.  Dynamic clients only exist in
+ *  one network thread, and use a bucket of their own.
+ *
+ * @param[in] client	which sent the packet.
+ * @param[in] now	when the packet was received.
+ * @return
+ *	- true if the packet should be discarded.
+ *	- false if the packet is allowed.
+ */
+static inline bool client_rate_limited(fr_io_client_t *client, fr_time_t now)
+{
+	RADCLIENT const	*radclient = client->radclient;
+	uint64_t	max_tokens;
+	fr_time_delta_t	elapsed;
+
+	if (likely(!radclient->rate_limit)) return false;
+
+	if (client->shared) return client_rate_limited_shared(client->shared, radclient, now);
+
+	max_tokens = (uint64_t) radclient->rate_burst * NSEC;
+	elapsed = now - client->rate_last;
+
+	if (elapsed > 0) {
+		client->rate_last = now;
+
+		/*
+		 *	Avoid overflow when the client has been
+		 *	quiet for a long time.
+		 */
+		if ((uint64_t) elapsed >= (max_tokens / radclient->rate_limit)) {
+			client->rate_tokens = max_tokens;
+		} else {
+			client->rate_tokens += (uint64_t) elapsed * radclient->rate_limit;
+			if (client->rate_tokens > max_tokens) client->rate_tokens = max_tokens;
+		}
+	}
+
+	if (client->rate_tokens < NSEC) return true;
+
+	client->rate_tokens -= NSEC;
+	return false;
+}
+
 static RADCLIENT *radclient_clone(TALLOC_CTX *ctx, RADCLIENT const *parent)
 {
 	RADCLIENT *c;
@@ -381,6 +542,10 @@ static RADCLIENT *radclient_clone(TALLOC_CTX *ctx, RADCLIENT const *parent)
 	COPY_FIELD(proto);
 
 	COPY_FIELD(use_connected);
+	COPY_FIELD(secret_hmac);
+
+	COPY_FIELD(rate_limit);
+	COPY_FIELD(rate_burst);
 
 #ifdef WITH_TLS
 	COPY_FIELD(tls_required);
@@ -513,6 +678,8 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 	memset(connection->client, 0, sizeof(*connection->client));
 
 	MEM(connection->client->radclient = radclient = radclient_clone(connection->client, client->radclient));
+	connection->client->shared = client->shared;
+	client_rate_init(connection->client);
 
 	talloc_set_destructor(connection->client, _client_free);
 	talloc_set_destructor(connection, connection_free);
@@ -526,10 +693,17 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 	 *
 	 *	#todo - unify the code with static clients?
 	 */
-	if (inst->app_io->track_duplicates) {
+	if (!inst->app_io->track_duplicates) {
+		/* nothing */
+
+	} else if (inst->app_io->hash) {
+		MEM(connection->client->hash_table = fr_hash_table_alloc(client, track_hash,
+									 track_connected_cmp, NULL));
+	} else {
 		MEM(connection->client->table = fr_rb_inline_talloc_alloc(client, fr_io_track_t, node,
 									  track_connected_cmp, NULL));
 	}
+	fr_dlist_talloc_init(&connection->client->expiring, fr_io_track_t, entry);
 
 	/*
 	 *	Set this radclient to be dynamic, and active.
@@ -623,6 +797,7 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 		li->thread_instance = connection;
 		li->app_io_instance = dl_inst->data;
 		li->track_duplicates = thread->child->app_io->track_duplicates;
+		li->read_batch = 0;
 
 		/*
 		 *	Create writable thread instance data.
@@ -662,6 +837,7 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 		li->thread_instance = connection;
 		li->app_io_instance = li->thread_instance;
 		li->track_duplicates = thread->child->app_io->track_duplicates;
+		li->read_batch = 0;	/* connected sockets read one packet at a time */
 
 		/*
 		 *	Instantiate the child, and open the socket.
@@ -900,7 +1076,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	/*
 	 *	No existing duplicate.  Return the new tracking entry.
 	 */
-	old = fr_rb_find(client->table, track);
+	old = track_find(client, track);
 	if (!old) goto do_insert;
 
 	fr_assert(old->client == client);
@@ -950,7 +1126,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 		 *	struct while the packet is in the outbound
 		 *	queue.
 		 */
-		if (old->ev) (void) fr_event_timer_delete(&old->ev);
+		track_unexpire(old);
 		return old;
 	}
 
@@ -969,10 +1145,10 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	} else {
 		fr_assert(client == old->client);
 
-		if (!fr_rb_delete(client->table, old)) {
+		if (!track_delete(client, old)) {
 			fr_assert(0);
 		}
-		if (old->ev) (void) fr_event_timer_delete(&old->ev);
+		track_unexpire(old);
 
 		talloc_set_destructor(old, track_free);
 
@@ -980,7 +1156,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	}
 
 do_insert:
-	if (!fr_rb_insert(client->table, track)) {
+	if (!track_insert(client, track)) {
 		fr_assert(0);
 	}
 
@@ -1302,6 +1478,16 @@ do_read:
 			*priority = PRIORITY_NORMAL;
 		}
 
+		/*
+		 *	The network is shedding load, and will drop
+		 *	this packet.  Do it now, before we track it.
+		 */
+		if (*priority < li->shed_priority) {
+			DEBUG3("proto_%s - dropping packet from IP %pV. The server is overloaded",
+			       inst->app_io->name, fr_box_ipaddr(address.socket.inet.src_ipaddr));
+			return 0;
+		}
+
 		/*
 		 *	If the connection is pending, pause reading of
 		 *	more packets.  If mod_write() accepts the
@@ -1353,7 +1539,7 @@ do_read:
 	 *	allowed, try to define a dynamic client.
 	 */
 	if (!client) {
-		RADCLIENT *radclient = NULL;
+		RADCLIENT *radclient = NULL, *shared = NULL;
 		fr_io_client_state_t state;
 		fr_ipaddr_t const *network = NULL;
 
@@ -1365,6 +1551,7 @@ do_read:
 		radclient = inst->app_io->client_find(thread->child, &address.socket.inet.src_ipaddr, inst->ipproto);
 		if (radclient) {
 			state = PR_CLIENT_STATIC;
+			shared = radclient;
 
 			/*
 			 *	Make our own copy that we can modify it.
@@ -1436,8 +1623,10 @@ do_read:
 		client->state = state;
 		client->src_ipaddr = radclient->ipaddr;
 		client->radclient = radclient;
+		client->shared = shared;
 		client->inst = inst;
 		client->thread = thread;
+		client_rate_init(client);
 
 		if (network) {
 			client->network = *network;
@@ -1463,10 +1652,18 @@ do_read:
 		/*
 		 *	Create the packet tracking table for this client.
 		 */
-		if (inst->app_io->track_duplicates) {
+		if (!inst->app_io->track_duplicates) {
+			/* nothing */
+
+		} else if (inst->app_io->hash) {
+			fr_assert(inst->app_io->compare != NULL);
+			MEM(client->hash_table = fr_hash_table_alloc(client, track_hash, track_cmp, NULL));
+
+		} else {
 			fr_assert(inst->app_io->compare != NULL);
 			MEM(client->table = fr_rb_inline_talloc_alloc(client, fr_io_track_t, node, track_cmp, NULL));
 		}
+		fr_dlist_talloc_init(&client->expiring, fr_io_track_t, entry);
 
 		/*
 		 *	Allow connected sockets to be set on a
@@ -1539,6 +1736,20 @@ have_client:
 		 *	"live" packets.
 		 */
 		if (!track) {
+			/*
+			 *	Enforce the rate limit before we
+			 *	spend any more time on the packet.
+			 *	Retransmits count, too, so one broken
+			 *	NAS can't flood us with them.
+			 */
+			if ((client->state != PR_CLIENT_PENDING) && client_rate_limited(client, recv_time)) {
+				if (client->shared) atomic_fetch_add_explicit(&client->shared->rate_limited, 1,
+									      memory_order_relaxed);
+				RATE_LIMIT_GLOBAL(WARN, "Discarding packet from client %s - "
+						  "it exceeded max_packets_per_second", client->radclient->shortname);
+				return 0;
+			}
+
 			track = fr_io_track_add(client, &address, buffer, packet_len, recv_time, is_dup);
 			if (!track) {
 				DEBUG("Failed tracking packet from client %s - discarding it",
@@ -1658,6 +1869,39 @@ have_client:
 			client->ready_to_delete = false;
 		}
 
+		/*
+		 *	Some packets (e.g. keepalives) can be answered
+		 *	without running any policies.  Reply to them
+		 *	here, instead of sending them to a worker.
+		 *	The reply goes through mod_write() as usual,
+		 *	which caches it for duplicates and sets up
+		 *	the cleanup timers.
+		 */
+		if (inst->app->reply && (client->state != PR_CLIENT_PENDING)) {
+			uint8_t		reply[FR_IO_FAST_REPLY_SIZE];
+			ssize_t		reply_len;
+			fr_network_t	*nr;
+
+			reply_len = inst->app->reply(inst->app_instance, client->radclient,
+						     buffer, packet_len, reply, sizeof(reply));
+			if (reply_len != 0) {
+				nr = connection ? connection->nr : thread->nr;
+
+				if (reply_len < 0) {
+					DEBUG("Discarding packet from client %s - %s",
+					      client->radclient->shortname, fr_strerror());
+					track->discard = true;
+					packet_expiry_timer(connection ? connection->el : thread->el, 0, track);
+					return 0;
+				}
+
+				DEBUG2("Sending reply to client %s without using a worker",
+				       client->radclient->shortname);
+				fr_network_listen_write(nr, li, reply, reply_len, track, track->timestamp);
+				return 0;
+			}
+		}
+
 		/*
 		 *	Return the packet.
 		 */
@@ -2062,8 +2306,8 @@ idle_timeout:
 	delay = inst->check_interval;
 
 reset_timer:
-	if (fr_event_timer_in(client, el, &client->ev,
-			      delay, client_expiry_timer, client) < 0) {
+	if (fr_event_timer_coarse_in(client, el, &client->ev,
+				     delay, client_expiry_timer, client) < 0) {
 		ERROR("proto_%s - Failed adding timeout for dynamic client %s.  It will be permanent!",
 		      inst->app_io->name, client->radclient->shortname);
 		return;
@@ -2073,6 +2317,43 @@ reset_timer:
 }
 
 
+/*
+ *	Expire all of the client's cached packets which have
+ *	reached the end of their cleanup_delay.
+ */
+static void client_packet_expiry_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_io_client_t *client = talloc_get_type_abort(uctx, fr_io_client_t);
+	fr_io_track_t *track;
+
+	while ((track = fr_dlist_head(&client->expiring)) != NULL) {
+		if (track->expires > now) break;
+
+		(void) fr_dlist_remove(&client->expiring, track);
+
+		/*
+		 *	Cleaning up the last packet of a dynamic
+		 *	client may also free the client.  The list
+		 *	is then empty, so there's nothing more to do.
+		 */
+		if ((client->state != PR_CLIENT_STATIC) && (client->packets == 1)) {
+			fr_assert(fr_dlist_empty(&client->expiring));
+			packet_expiry_timer(el, now, track);
+			return;
+		}
+
+		packet_expiry_timer(el, now, track);
+	}
+
+	if (!track) return;
+
+	if (fr_event_timer_coarse_at(client, el, &client->expiry_ev,
+				     track->expires, client_packet_expiry_timer, client) < 0) {
+		ERROR("proto_%s - Failed adding cleanup_delay timer for client %s",
+		      client->inst->app_io->name, client->radclient->shortname);
+	}
+}
+
 /*
  *	Expire cached packets after cleanup_delay time
  */
@@ -2093,18 +2374,30 @@ static void packet_expiry_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 
 		track->expires = fr_time() + inst->cleanup_delay;
 
+		/*
+		 *	cleanup_delay is the same for every packet,
+		 *	so appending to the tail keeps the list
+		 *	sorted by expiry time.  The client then needs
+		 *	only one timer, for the head of the list.
+		 */
+		track_unexpire(track);
+		fr_dlist_insert_tail(&client->expiring, track);
+
 		/*
 		 *	if the timer succeeds, then "track"
 		 *	will be cleaned up when the timer
 		 *	fires.
 		 */
-		if (fr_event_timer_at(track, el, &track->ev,
-				      track->expires, packet_expiry_timer, track) == 0) {
+		if (client->expiry_ev ||
+		    (fr_event_timer_coarse_at(client, el, &client->expiry_ev,
+					      track->expires, client_packet_expiry_timer, client) == 0)) {
 			DEBUG("proto_%s - cleaning up request in %d.%06ds", inst->app_io->name,
 			      (int) (inst->cleanup_delay / NSEC), (int) (inst->cleanup_delay % NSEC));
 			return;
 		}
 
+		track_unexpire(track);
+
 		DEBUG("proto_%s - Failed adding cleanup_delay for packet.  Discarding packet immediately",
 		      inst->app_io->name);
 	}
@@ -2277,6 +2570,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 		client->state = PR_CLIENT_NAK;
 		TALLOC_FREE(client->pending);
 		if (client->table) TALLOC_FREE(client->table);
+		if (client->hash_table) TALLOC_FREE(client->hash_table);
 		fr_assert(client->packets == 0);
 
 		/*
@@ -2521,6 +2815,22 @@ reread:
 	return buffer_len;
 }
 
+/** Flush any replies which the child has queued
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	fr_io_instance_t const *inst;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->flush) return 0;
+
+	return inst->app_io->flush(child);
+}
+
 /** Close the socket.
  *
  */
@@ -2892,25 +3202,26 @@ int fr_io_listen_free(fr_listen_t *li)
 	return 0;
 }
 
-int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
-			size_t default_message_size, size_t num_messages)
+/** Open one socket for a listener, and add it to a network thread
+ *
+ * @param[in] ctx			to allocate the listener in.
+ * @param[in] inst			the master IO instance.
+ * @param[in] sc			the scheduler.
+ * @param[in] default_message_size	for the message ring buffer.
+ * @param[in] num_messages		for the message ring buffer.
+ * @param[in] shard			which socket this is.  Shard 0 is the socket
+ *					which is checked for conflicts with other
+ *					listeners, and recorded.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int master_io_listen_shard(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+				  size_t default_message_size, size_t num_messages, unsigned int shard)
 {
 	fr_listen_t	*li, *child;
 	fr_io_thread_t	*thread;
 
-	/*
-	 *	No IO paths, so we don't initialize them.
-	 */
-	if (!inst->app_io) {
-		fr_assert(!inst->dynamic_clients);
-		return 0;
-	}
-
-	if (!inst->app_io->thread_inst_size) {
-		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
-		return -1;
-	}
-
 	/*
 	 *	Build the #fr_listen_t.  This describes the complete
 	 *	path data takes from the socket to the decoder and
@@ -2942,7 +3253,9 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	li->num_messages = num_messages;
 
 	/*
-	 *	Per-socket data lives here.
+	 *	Per-socket data lives here.  Each shard has its own
+	 *	client tables and duplicate tracking, as only its
+	 *	network thread touches them.
 	 */
 	thread = talloc_zero(NULL, fr_io_thread_t);
 	thread->listen = li;
@@ -3016,6 +3329,7 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	}
 
 	li->fd = child->fd;	/* copy this back up */
+	li->read_batch = child->read_batch;
 
 	if (!child->app_io->get_name) {
 		child->name = child->app_io->name;
@@ -3025,9 +3339,10 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	li->name = child->name;
 
 	/*
-	 *	Record which socket we opened.
+	 *	Record which socket we opened.  The other shards are
+	 *	bound to the same address on purpose.
 	 */
-	if (child->app_io_addr) {
+	if (child->app_io_addr && (shard == 0)) {
 		fr_listen_t *other;
 
 		other = listen_find_any(thread->child);
@@ -3048,7 +3363,7 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	 *	Add the socket to the scheduler, where it might end up
 	 *	in a different thread.
 	 */
-	if (!fr_schedule_listen_add(sc, li)) {
+	if (!fr_schedule_listen_add_shard(sc, li, shard)) {
 		talloc_free(li);
 		return -1;
 	}
@@ -3056,6 +3371,55 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	return 0;
 }
 
+int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+			size_t default_message_size, size_t num_messages)
+{
+	unsigned int	i, num_shards = 1;
+
+	/*
+	 *	No IO paths, so we don't initialize them.
+	 */
+	if (!inst->app_io) {
+		fr_assert(!inst->dynamic_clients);
+		return 0;
+	}
+
+	if (!inst->app_io->thread_inst_size) {
+		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
+		return -1;
+	}
+
+	/*
+	 *	UDP sockets are opened with SO_REUSEPORT, so we open
+	 *	one for each network thread.  The kernel then spreads
+	 *	the packets over the sockets by source address, and
+	 *	each network thread reads, decodes, and de-duplicates
+	 *	its share of them.
+	 *
+	 *	Connected sockets are still added to a single network
+	 *	thread, as they're created by the parent listener.
+	 *
+	 *	Broadcast and multicast packets are delivered to every
+	 *	socket in the group, so transports which receive them
+	 *	only get one socket.
+	 */
+	if ((inst->ipproto == IPPROTO_UDP) && !inst->app_io->single_socket) {
+		num_shards = fr_schedule_num_networks(sc);
+	}
+
+	if (master_io_listen_shard(ctx, inst, sc, default_message_size, num_messages, 0) < 0) return -1;
+
+	for (i = 1; i < num_shards; i++) {
+		if (master_io_listen_shard(ctx, inst, sc, default_message_size, num_messages, i) < 0) {
+			PWARN("Failed opening socket %u/%u for %s, only %u network threads will read from it",
+			      i + 1, num_shards, inst->app_io->name, i);
+			break;
+		}
+	}
+
+	return 0;
+}
+
 
 fr_app_io_t fr_master_app_io = {
 	.magic			= RLM_MODULE_INIT,
@@ -3072,6 +3436,7 @@ fr_app_io_t fr_master_app_io = {
 	.inject			= mod_inject,
 
 	.open			= mod_open,
+	.flush			= mod_flush,
 	.close			= mod_close,
 	.event_list_set		= mod_event_list_set,
 	.get_name		= mod_name,
@@ -112,6 +112,32 @@ struct fr_message_set_s {
 };
 
 
+/** Choose the size of the next ring for a message set
+ *
+ *  The new ring is only needed when all of the existing ones are
+ *  full.  So rather than just doubling the largest ring, we size it
+ *  to hold twice everything which is currently in flight.  A burst
+ *  then needs one new ring, rather than a series of them, each of
+ *  which is allocated in the packet path.
+ *
+ * @param[in] array	the rings.
+ * @param[in] max	index of the last ring in the array.
+ * @return the size of the new ring.
+ */
+static size_t fr_message_ring_size_next(fr_ring_buffer_t **array, int max)
+{
+	int	i;
+	size_t	used = 0, size;
+
+	for (i = 0; i <= max; i++) used += fr_ring_buffer_used(array[i]);
+
+	size = fr_ring_buffer_size(array[max]) * 2;
+	if (size < (used * 2)) size = used * 2;
+	if (size > (1 << 30)) size = (1 << 30);
+
+	return size;
+}
+
 /** Create a message set
  *
  * @param[in] ctx the context for talloc
@@ -749,10 +775,10 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 	}
 
 	/*
-	 *	Allocate another message ring, double the size
-	 *	of the previous maximum.
+	 *	Allocate another message ring, at least double the
+	 *	size of the previous maximum.
 	 */
-	mr = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->mr_array[ms->mr_max]) * 2);
+	mr = fr_ring_buffer_create(ms, fr_message_ring_size_next(ms->mr_array, ms->mr_max));
 	if (!mr) {
 		fr_strerror_const_push("Failed allocating ring buffer");
 		return NULL;
@@ -872,10 +898,10 @@ static fr_message_t *fr_message_get_ring_buffer(fr_message_set_t *ms, fr_message
 
 alloc_rb:
 	/*
-	 *	Allocate another message ring, double the size
-	 *	of the previous maximum.
+	 *	Allocate another ring buffer, at least double the
+	 *	size of the previous maximum.
 	 */
-	rb = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->rb_array[ms->rb_max]) * 2);
+	rb = fr_ring_buffer_create(ms, fr_message_ring_size_next(ms->rb_array, ms->rb_max));
 	if (!rb) {
 		fr_strerror_const_push("Failed allocating ring buffer");
 		goto cleanup;
@@ -1277,6 +1303,28 @@ int fr_message_set_messages_used(fr_message_set_t *ms)
 	return used;
 }
 
+/** Return how much memory the message set's rings are using
+ *
+ * This is the allocated size of the message arrays and ring buffers,
+ * not how much of them is in use.
+ *
+ * @param[in] ms the message set
+ * @return
+ *      - bytes allocated for messages and packets.
+ */
+size_t fr_message_set_memory(fr_message_set_t *ms)
+{
+	int i;
+	size_t size = 0;
+
+	(void) talloc_get_type_abort(ms, fr_message_set_t);
+
+	for (i = 0; i <= ms->mr_max; i++) size += fr_ring_buffer_size(ms->mr_array[i]);
+	for (i = 0; i <= ms->rb_max; i++) size += fr_ring_buffer_size(ms->rb_array[i]);
+
+	return size;
+}
+
 /** Garbage collect the message set.
  *
  *  This function should ONLY be called just before freeing the
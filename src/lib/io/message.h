@@ -63,6 +63,7 @@ int fr_message_done(fr_message_t *m) CC_HINT(nonnull);
 fr_message_t *fr_message_localize(TALLOC_CTX *ctx, fr_message_t *m, size_t message_size) CC_HINT(nonnull);
 
 int fr_message_set_messages_used(fr_message_set_t *ms) CC_HINT(nonnull);
+size_t fr_message_set_memory(fr_message_set_t *ms) CC_HINT(nonnull);
 void fr_message_set_gc(fr_message_set_t *ms) CC_HINT(nonnull);
 
 void fr_message_set_debug(fr_message_set_t *ms, FILE *fp) CC_HINT(nonnull);
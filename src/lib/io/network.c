@@ -30,7 +30,9 @@ RCSID("$Id$")
 #define LOG_DST nr->log
 
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/probe.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/rb.h>
 #include <freeradius-devel/util/syserror.h>
@@ -40,6 +42,7 @@ RCSID("$Id$")
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/control.h>
 #include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/io/master.h>
 #include <freeradius-devel/io/network.h>
 #include <freeradius-devel/io/queue.h>
 #include <freeradius-devel/io/ring_buffer.h>
@@ -47,6 +50,12 @@ RCSID("$Id$")
 
 #define MAX_WORKERS 64
 
+/*
+ *	How many times the normal read limit we allow for packets
+ *	which a stream socket already has in its buffer.
+ */
+#define NETWORK_STREAM_DRAIN_FACTOR (16)
+
 static _Thread_local fr_ring_buffer_t *fr_network_rb;
 
 typedef struct {
@@ -94,6 +103,7 @@ typedef struct {
 
 	fr_channel_data_t	*pending;		//!< the currently pending partial packet
 	fr_heap_t		*waiting;		//!< packets waiting to be written
+	fr_dlist_t		flush_entry;		//!< in the list of sockets with queued replies.
 	fr_io_stats_t		stats;
 } fr_network_socket_t;
 
@@ -109,6 +119,10 @@ typedef struct {
  *	"Power of Two-Choices" and
  *	https://www.eecs.harvard.edu/~michaelm/postscripts/mythesis.pdf
  *	https://www.eecs.harvard.edu/~michaelm/postscripts/tpds2001.pdf
+ *
+ *	Other policies (least outstanding, lowest predicted latency,
+ *	client affinity) can be used instead, see
+ *	#fr_network_worker_select_t.
  */
 struct fr_network_s {
 	char const		*name;			//!< Network ID for logging.
@@ -128,6 +142,7 @@ struct fr_network_s {
 	fr_event_list_t		*el;			//!< our event list
 
 	fr_heap_t		*replies;		//!< replies from the worker, ordered by priority / origin time
+	fr_dlist_head_t		flush;			//!< sockets which have queued replies to flush.
 
 	fr_io_stats_t		stats;
 
@@ -145,12 +160,28 @@ struct fr_network_s {
 
 	fr_network_config_t	config;			//!< configuration
 	fr_network_worker_t	*workers[MAX_WORKERS]; 	//!< each worker
+
+	int			shed_level;		//!< how many priority classes we're dropping.
+	fr_time_t		shed_interval_end;	//!< when we next re-evaluate load shedding.
+	fr_time_delta_t		queue_delay_min[FR_NETWORK_SHED_LEVELS];	//!< lowest queue delay seen
+							///< for each priority class in this interval.
+};
+
+/** Lowest priority which is accepted at each load shedding level
+ *
+ */
+static uint32_t const shed_priority[FR_NETWORK_SHED_LEVELS] = {
+	0,
+	PRIORITY_NORMAL,
+	PRIORITY_HIGH,
+	PRIORITY_NOW
 };
 
 static void fr_network_post_event(fr_event_list_t *el, fr_time_t now, void *uctx);
 static int fr_network_pre_event(fr_time_t wake, void *uctx);
 static void fr_network_socket_dead(fr_network_t *nr, fr_network_socket_t *s);
 static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int flags, void *ctx);
+static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUSED int flags, void *ctx);
 
 static int8_t reply_cmp(void const *one, void const *two)
 {
@@ -429,6 +460,124 @@ static void fr_network_unsuspend(fr_network_t *nr)
 #define IALPHA (8)
 #define RTT(_old, _new) ((_new + ((IALPHA - 1) * _old)) / IALPHA)
 
+/** Map a packet priority to its load shedding class
+ *
+ */
+static inline CC_HINT(always_inline) int fr_network_priority_class(uint32_t priority)
+{
+	int i;
+
+	for (i = FR_NETWORK_SHED_LEVELS - 1; i > 0; i--) {
+		if (priority >= shed_priority[i]) return i;
+	}
+
+	return 0;
+}
+
+/** Start a new load shedding interval
+ *
+ */
+static void fr_network_shed_interval_start(fr_network_t *nr, fr_time_t now)
+{
+	int i;
+
+	for (i = 0; i < FR_NETWORK_SHED_LEVELS; i++) nr->queue_delay_min[i] = INT64_MAX;
+	nr->shed_interval_end = now + nr->config.queue_delay_interval;
+}
+
+/** Tell the listeners which packets we're dropping
+ *
+ *  So that they can discard packets as soon as they've been read, or
+ *  tell the client that the server is busy.
+ */
+static void fr_network_shed_set(fr_network_t *nr, int level)
+{
+	fr_rb_iter_inorder_t	iter;
+	fr_network_socket_t	*socket;
+
+	if (level == nr->shed_level) return;
+
+	if (level > nr->shed_level) {
+		RATE_LIMIT_GLOBAL(WARN, "Queue delay is over %pVs - dropping packets with priority lower than %s",
+				  fr_box_time_delta(nr->config.queue_delay_target),
+				  fr_table_str_by_value(channel_packet_priority, shed_priority[level], "<INVALID>"));
+	} else if (!level) {
+		INFO("Queue delay has recovered - no longer dropping packets");
+	}
+
+	nr->shed_level = level;
+
+	for (socket = fr_rb_iter_init_inorder(&iter, nr->sockets);
+	     socket;
+	     socket = fr_rb_iter_next_inorder(&iter)) {
+		socket->listen->shed_priority = shed_priority[level];
+	}
+}
+
+/** Update load shedding from the queue delay of a reply
+ *
+ *  This is CoDel, applied to classes of packets rather than to a
+ *  single queue.  The time a request spent queued is its total time,
+ *  less the time the worker actually spent processing it.  If the
+ *  lowest queue delay seen over an interval is above the target, the
+ *  backlog isn't a burst which is being absorbed, it's a standing
+ *  queue.  We then drop every class up to and including the lowest
+ *  class which is suffering.
+ *
+ *  The workers run higher priority requests first, so the lowest
+ *  class which is still being accepted is the one which sees the
+ *  delay.  Once its delay falls well below the target, we accept one
+ *  more class per interval.
+ *
+ *  PRIORITY_NOW packets (e.g. Status-Server) are never dropped, so
+ *  that clients can always see that the server is alive.
+ */
+static void fr_network_shed_update(fr_network_t *nr, fr_channel_data_t const *cd, fr_time_t now)
+{
+	fr_time_delta_t	delay;
+	int		i, level;
+
+	if (!nr->config.queue_delay_target) return;
+
+	/*
+	 *	NAKs weren't processed, and so tell us nothing
+	 *	about the queue.
+	 */
+	if (cd->reply.processing_time) {
+		delay = now - cd->reply.request_time - cd->reply.processing_time;
+		if (delay < 0) delay = 0;
+
+		i = fr_network_priority_class(cd->priority);
+		if (delay < nr->queue_delay_min[i]) nr->queue_delay_min[i] = delay;
+	}
+
+	if (now < nr->shed_interval_end) return;
+
+	/*
+	 *	Find the lowest class which we're accepting, and
+	 *	which has seen replies in this interval.  If there
+	 *	are none, the load has gone away.
+	 */
+	level = nr->shed_level;
+	for (i = level; i < FR_NETWORK_SHED_LEVELS; i++) {
+		if (nr->queue_delay_min[i] != INT64_MAX) break;
+	}
+
+	if (i == FR_NETWORK_SHED_LEVELS) {
+		if (level > 0) level--;
+
+	} else if (nr->queue_delay_min[i] > nr->config.queue_delay_target) {
+		level = i + 1;
+		if (level >= FR_NETWORK_SHED_LEVELS) level = FR_NETWORK_SHED_LEVELS - 1;
+
+	} else if ((level > 0) && (nr->queue_delay_min[i] < (nr->config.queue_delay_target / 2))) {
+		level--;
+	}
+
+	fr_network_shed_set(nr, level);
+	fr_network_shed_interval_start(nr, now);
+}
+
 /** Callback which handles a message being received on the network side.
  *
  * @param[in] ctx the network
@@ -447,13 +596,32 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 	 */
 	worker = fr_channel_requestor_uctx_get(ch);
 	worker->stats.out++;
-	worker->cpu_time = cd->reply.cpu_time;
-	if (!worker->predicted) {
-		worker->predicted = cd->reply.processing_time;
-	} else {
-		worker->predicted = RTT(worker->predicted, cd->reply.processing_time);
+
+	/*
+	 *	NAKs have no processing time, as the worker didn't
+	 *	run the request.
+	 */
+	if (cd->reply.processing_time) {
+		if (!worker->predicted) {
+			worker->predicted = cd->reply.processing_time;
+		} else {
+			worker->predicted = RTT(worker->predicted, cd->reply.processing_time);
+		}
 	}
 
+	/*
+	 *	The worker tells us how much CPU time it has used.
+	 *	The requests which it hasn't yet replied to will
+	 *	still cost it time, so add our prediction for those
+	 *	back in.  Otherwise a worker with a long queue looks
+	 *	idle as soon as it sends one reply, and gets sent
+	 *	even more requests.
+	 */
+	fr_assert(worker->stats.in >= worker->stats.out);
+	worker->cpu_time = cd->reply.cpu_time + ((worker->stats.in - worker->stats.out) * worker->predicted);
+
+	fr_network_shed_update(nr, cd, fr_time());
+
 	/*
 	 *	Unblock the worker.
 	 */
@@ -544,7 +712,115 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 	}
 }
 
+fr_table_num_sorted_t const fr_network_worker_select_table[] = {
+	{ L("client"),		FR_NETWORK_WORKER_SELECT_CLIENT		},
+	{ L("cpu_time"),	FR_NETWORK_WORKER_SELECT_CPU_TIME	},
+	{ L("latency"),		FR_NETWORK_WORKER_SELECT_LATENCY	},
+	{ L("outstanding"),	FR_NETWORK_WORKER_SELECT_OUTSTANDING	}
+};
+size_t fr_network_worker_select_table_len = NUM_ELEMENTS(fr_network_worker_select_table);
+
+/** Return the number of requests a worker is processing for us
+ *
+ */
+static inline CC_HINT(always_inline) uint64_t fr_network_worker_outstanding(fr_network_worker_t const *worker)
+{
+	fr_assert(worker->stats.in >= worker->stats.out);
+
+	return worker->stats.in - worker->stats.out;
+}
+
+/** Whether a worker can accept another request
+ *
+ */
+static inline CC_HINT(always_inline) bool fr_network_worker_available(fr_network_t *nr, fr_network_worker_t const *worker)
+{
+	if (worker->blocked) return false;
+
+	return !nr->config.max_outstanding || (fr_network_worker_outstanding(worker) < nr->config.max_outstanding);
+}
+
+/** Return the load of a worker, as measured by the configured selection policy
+ *
+ */
+static inline CC_HINT(always_inline) uint64_t fr_network_worker_load(fr_network_t *nr, fr_network_worker_t const *worker)
+{
+	switch (nr->config.worker_select) {
+	case FR_NETWORK_WORKER_SELECT_CPU_TIME:
+		return worker->cpu_time;
+
+	/*
+	 *	Add one so that idle workers are ordered by how
+	 *	quickly they've processed previous requests.
+	 */
+	case FR_NETWORK_WORKER_SELECT_LATENCY:
+		return (fr_network_worker_outstanding(worker) + 1) * worker->predicted;
+
+	case FR_NETWORK_WORKER_SELECT_OUTSTANDING:
+	case FR_NETWORK_WORKER_SELECT_CLIENT:
+		break;
+	}
+
+	return fr_network_worker_outstanding(worker);
+}
+
+/** Find the least loaded worker which can accept another request
+ *
+ * @param nr the network
+ * @return
+ *	- The worker with the lowest load.
+ *	- NULL if all workers are blocked, or have reached max_outstanding.
+ */
+static fr_network_worker_t *fr_network_worker_least_loaded(fr_network_t *nr)
+{
+	int			i;
+	uint64_t		load, lowest = UINT64_MAX;
+	fr_network_worker_t	*worker, *found = NULL;
+
+	for (i = 0; i < nr->num_workers; i++) {
+		worker = nr->workers[i];
+		if (!fr_network_worker_available(nr, worker)) continue;
+
+		load = fr_network_worker_load(nr, worker);
+		if (!found || (load < lowest)) {
+			found = worker;
+			lowest = load;
+		}
+	}
+
+	return found;
+}
+
+/** Hash the client which sent a request
+ *
+ * Packets read via the master IO handler carry a #fr_io_track_t, which
+ * records the address the packet came from.  For other listeners, we
+ * use the listener, which gives the same affinity for connected sockets.
+ */
+static uint32_t fr_network_client_hash(fr_channel_data_t const *cd)
+{
+	fr_io_track_t const	*track;
+	fr_ipaddr_t const	*ipaddr;
+
+	if ((cd->listen->app_io != &fr_master_app_io) || !cd->packet_ctx) {
+		return fr_hash(&cd->listen, sizeof(cd->listen));
+	}
+
+	track = talloc_get_type_abort_const(cd->packet_ctx, fr_io_track_t);
+	ipaddr = &track->address->socket.inet.src_ipaddr;
+
+	if (ipaddr->af == AF_INET) return fr_hash(&ipaddr->addr.v4, sizeof(ipaddr->addr.v4));
+
+	return fr_hash(&ipaddr->addr.v6, sizeof(ipaddr->addr.v6));
+}
+
 /** Send a message on the "best" channel.
+ *
+ * The worker is chosen by the configured #fr_network_worker_select_t
+ * policy.  If that worker is blocked, or has reached max_outstanding,
+ * the least loaded of the remaining workers is used instead.  The
+ * packet is dropped when no worker can accept it, or when we're
+ * shedding load, and its priority is too low.
  *
  * @param nr the network
  * @param cd the message we've received
@@ -555,6 +831,11 @@ static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 
+	if (cd->priority < shed_priority[nr->shed_level]) {
+		RATE_LIMIT_GLOBAL(ERROR, "Queue delay is too high - dropping packet");
+		return -1;
+	}
+
 retry:
 	if (nr->num_workers == 1) {
 		worker = nr->workers[0];
@@ -566,62 +847,66 @@ retry:
 			return -1;
 		}
 
-	} else if (nr->num_blocked == 0) {
-		uint32_t one, two;
+		/*
+		 *	Too many outstanding packets for this worker.
+		 *	Drop the request.
+		 */
+		if (!fr_network_worker_available(nr, worker)) {
+			RATE_LIMIT_GLOBAL(PERROR, "max_outstanding reached - dropping packet");
+			goto drop;
+		}
 
-		one = fr_rand() % nr->num_workers;
-		do {
-			two = fr_rand() % nr->num_workers;
-		} while (two == one);
+	} else {
+		worker = NULL;
+
+		switch (nr->config.worker_select) {
+		case FR_NETWORK_WORKER_SELECT_CPU_TIME:
+			if (nr->num_blocked == 0) {
+				uint32_t one, two;
+
+				one = fr_rand() % nr->num_workers;
+				do {
+					two = fr_rand() % nr->num_workers;
+				} while (two == one);
+
+				if (nr->workers[one]->cpu_time < nr->workers[two]->cpu_time) {
+					worker = nr->workers[one];
+				} else {
+					worker = nr->workers[two];
+				}
+			}
+			break;
 
-		if (nr->workers[one]->cpu_time < nr->workers[two]->cpu_time) {
-			worker = nr->workers[one];
-		} else {
-			worker = nr->workers[two];
+		case FR_NETWORK_WORKER_SELECT_CLIENT:
+			worker = nr->workers[fr_network_client_hash(cd) % nr->num_workers];
+			break;
+
+		case FR_NETWORK_WORKER_SELECT_OUTSTANDING:
+		case FR_NETWORK_WORKER_SELECT_LATENCY:
+			break;
 		}
-	} else {
-		int i;
-		fr_time_t cpu_time = ~((fr_time_t) 0);
-		fr_network_worker_t *found = NULL;
 
 		/*
-		 *	Some workers are blocked.  Pick an active
-		 *	worker with low CPU time.
+		 *	The preferred worker can't take the request,
+		 *	or the policy always wants the least loaded
+		 *	worker.
 		 */
-		for (i = 0; i < nr->num_workers; i++) {
-			worker = nr->workers[i];
-			if (worker->blocked) continue;
-
-			if (worker->cpu_time < cpu_time) {
-				found = worker;
+		if (!worker || !fr_network_worker_available(nr, worker)) {
+			worker = fr_network_worker_least_loaded(nr);
+			if (!worker) {
+				if (nr->num_blocked) {
+					RATE_LIMIT_GLOBAL(PERROR, "Failed sending packet to worker - Couldn't find active worker, "
+							  "%u/%u workers are blocked", nr->num_blocked, nr->num_workers);
+				} else {
+					RATE_LIMIT_GLOBAL(PERROR, "max_outstanding reached on all workers - dropping packet");
+				}
+				return -1;
 			}
 		}
-
-		if (!found) {
-			 RATE_LIMIT_GLOBAL(PERROR, "Failed sending packet to worker - Couldn't find active worker, "
-			 		   "%u/%u workers are blocked", nr->num_blocked, nr->num_workers);
-			 return -1;
-		}
-
-		worker = found;
 	}
 
 	(void) talloc_get_type_abort(worker, fr_network_worker_t);
 
-	/*
-	 *	Too many outstanding packets for this worker.  Drop
-	 *	the request.
-	 *
-	 *	@todo - pick another worker?  Or maybe keep a
-	 *	local/temporary set of blacklisted workers.
-	 */
-	fr_assert(worker->stats.in >= worker->stats.out);
-	if (nr->config.max_outstanding &&
-	    ((worker->stats.in - worker->stats.out) >= nr->config.max_outstanding)) {
-		RATE_LIMIT_GLOBAL(PERROR, "max_outstanding reached - dropping packet");
-		goto drop;
-	}
-
 	/*
 	 *	Send the message to the channel.  If we fail, drop the
 	 *	packet.  The only reason for failure is that the
@@ -645,6 +930,7 @@ retry:
 	}
 
 	worker->stats.in++;
+	FR_PROBE3(network_send_request, cd, cd->m.data_size, cd->priority);
 
 	/*
 	 *	We're projecting that the worker will use more CPU
@@ -696,6 +982,7 @@ static void fr_network_socket_dead(fr_network_t *nr, fr_network_socket_t *s)
 static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int flags, void *ctx)
 {
 	int			num_messages = 0;
+	int			max_messages;
 	fr_network_socket_t	*s = ctx;
 	fr_network_t		*nr = s->nr;
 	ssize_t			data_size;
@@ -723,12 +1010,25 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 
 	fr_assert(cd->m.data != NULL);
 
+	/*
+	 *	Sockets which read packets in batches tell us how
+	 *	many packets they have.  We read all of them, plus
+	 *	one more read, which tells us that the batch is empty.
+	 */
+	max_messages = s->listen->read_batch ? s->listen->read_batch : 16;
+
 next_message:
 	/*
 	 *	Poll this socket, but not too often.  We have to go
 	 *	service other sockets, too.
+	 *
+	 *	Stream sockets may have read many packets at once.
+	 *	The socket won't become readable again for the ones
+	 *	which are already in the buffer, so we keep going
+	 *	while there's data left over, up to a hard limit.
 	 */
-	if (num_messages > 16) {
+	if ((num_messages > max_messages) &&
+	    (!s->leftover || (num_messages > (max_messages * NETWORK_STREAM_DRAIN_FACTOR)))) {
 		s->cd = cd;
 		return;
 	}
@@ -745,7 +1045,13 @@ next_message:
 	 *	usable) this function should return -1, so that the
 	 *	network side knows that it needs to close the
 	 *	connection.
+	 *
+	 *	For batched sockets, the read routine leaves errno
+	 *	set to EWOULDBLOCK when there's no more data.  Any
+	 *	other "no data" return means the packet was
+	 *	discarded, and we go read the next one.
 	 */
+	errno = 0;
 	data_size = s->listen->app_io->read(s->listen, &cd->packet_ctx, &cd->request.recv_time,
 					    cd->m.data, cd->m.rb_size, &s->leftover, &cd->priority, &cd->request.is_dup);
 	if (data_size == 0) {
@@ -760,6 +1066,11 @@ next_message:
 		 *	fr_io_socket_t, no "head of line"
 		 *	blocking issues can happen for stream sockets.
 		 */
+		if (s->listen->read_batch && (errno != EWOULDBLOCK) && (errno != EAGAIN)) {
+			num_messages++;
+			goto next_message;
+		}
+
 		s->cd = cd;
 		return;
 	}
@@ -775,6 +1086,7 @@ next_message:
 	s->cd = NULL;
 
 	DEBUG3("Read %zd byte(s) from FD %u", data_size, sockfd);
+	FR_PROBE3(network_read, sockfd, data_size, cd);
 	nr->stats.in++;
 	s->stats.in++;
 
@@ -851,6 +1163,23 @@ next_message:
 		num_messages++;
 		goto next_message;
 	}
+
+	/*
+	 *	Datagram sockets which read packets in batches.  Go
+	 *	get the next packet from the batch.
+	 */
+	if (s->listen->read_batch) {
+		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
+		if (!cd) {
+			ERROR("Failed allocating message size %zd! - Closing socket",
+			      s->listen->default_message_size);
+			fr_network_socket_dead(nr, s);
+			return;
+		}
+
+		num_messages++;
+		goto next_message;
+	}
 }
 
 
@@ -899,6 +1228,31 @@ static void fr_network_error(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 }
 
 
+/** Wait for a socket to become writable
+ *
+ * @param nr	the network.
+ * @param s	the socket which can't take any more data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int fr_network_write_wait(fr_network_t *nr, fr_network_socket_t *s)
+{
+	if (s->blocked) return 0;
+
+	if (fr_event_fd_insert(nr, nr->el, s->listen->fd,
+			       fr_network_read,
+			       fr_network_write,
+			       fr_network_error,
+			       s) < 0) {
+		PERROR("Failed adding write callback to event loop");
+		return -1;
+	}
+
+	s->blocked = true;
+	return 0;
+}
+
 /** Write packets to the network.
  *
  * @param el the event list
@@ -967,18 +1321,7 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 					cd = (fr_channel_data_t *) lm;
 				}
 
-				if (!s->blocked) {
-					if (fr_event_fd_insert(nr, nr->el, s->listen->fd,
-							       fr_network_read,
-							       fr_network_write,
-							       fr_network_error,
-							       s) < 0) {
-						PERROR("Failed adding write callback to event loop");
-						goto dead;
-					}
-
-					s->blocked = true;
-				}
+				if (fr_network_write_wait(nr, s) < 0) goto dead;
 
 				s->pending = cd;
 				return;
@@ -1012,6 +1355,15 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 
 		s->written = 0;
 
+		/*
+		 *	The app_io may have queued the reply instead
+		 *	of writing it.  Remember to flush it after
+		 *	we've processed all of the replies.
+		 */
+		if (li->app_io->flush && !fr_dlist_entry_in_list(&s->flush_entry)) {
+			fr_dlist_insert_tail(&nr->flush, s);
+		}
+
 		/*
 		 *	Reset for the next message.
 		 */
@@ -1025,6 +1377,19 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		cd = fr_heap_pop(s->waiting);
 	}
 
+	/*
+	 *	We were woken up because the socket became writable.
+	 *	Write any replies which the app_io still has queued,
+	 *	and wait again if it can't write all of them.
+	 */
+	if (s->blocked && li->app_io->flush && (li->app_io->flush(li) < 0)) {
+		if (errno == EWOULDBLOCK) return;
+
+		PERROR("Failed flushing replies to socket %s", s->listen->name);
+		fr_network_socket_dead(nr, s);
+		return;
+	}
+
 	/*
 	 *	We've successfully written all of the packets.  Remove
 	 *	the write callback.
@@ -1048,6 +1413,7 @@ static int _network_socket_free(fr_network_socket_t *s)
 
 	fr_rb_delete(nr->sockets, s);
 	fr_rb_delete(nr->sockets_by_num, s);
+	if (fr_dlist_entry_in_list(&s->flush_entry)) fr_dlist_remove(&nr->flush, s);
 
 	fr_event_fd_delete(nr->el, s->listen->fd, s->filter);
 
@@ -1099,6 +1465,7 @@ static void fr_network_listen_callback(void *ctx, void const *data, size_t data_
 	s->nr = nr;
 	memcpy(&s->listen, data, sizeof(s->listen));
 	s->number = nr->num_sockets++;
+	s->listen->shed_priority = shed_priority[nr->shed_level];
 
 	MEM(s->waiting = fr_heap_alloc(s, waiting_cmp, fr_channel_data_t, channel.heap_id, 0));
 
@@ -1185,6 +1552,7 @@ static void fr_network_directory_callback(void *ctx, void const *data, size_t da
 	s->nr = nr;
 	memcpy(&s->listen, data, sizeof(s->listen));
 	s->number = nr->num_sockets++;
+	s->listen->shed_priority = shed_priority[nr->shed_level];
 
 	MEM(s->waiting = fr_heap_alloc(s, waiting_cmp, fr_channel_data_t, channel.heap_id, 0));
 
@@ -1318,6 +1686,20 @@ static void fr_network_inject_callback(void *ctx, void const *data, size_t data_
 static int fr_network_pre_event(UNUSED fr_time_t wake, void *uctx)
 {
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
+	int i;
+
+	if (fr_heap_num_elements(nr->replies) > 0) return 1;
+
+	/*
+	 *	We're about to sleep.  Tell the workers to signal us
+	 *	when they send new replies.  If any arrived in the
+	 *	mean time, don't sleep.
+	 */
+	for (i = 0; i < nr->num_workers; i++) {
+		if (!nr->workers[i]) continue;
+
+		(void) fr_channel_requestor_idle(nr->workers[i]->channel);
+	}
 
 	if (fr_heap_num_elements(nr->replies) > 0) return 1;
 
@@ -1333,7 +1715,19 @@ static int fr_network_pre_event(UNUSED fr_time_t wake, void *uctx)
 static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
 {
 	fr_channel_data_t *cd;
+	fr_network_socket_t *s;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
+	int i;
+
+	/*
+	 *	We're awake, so pick up any new replies without
+	 *	waiting for the workers to signal us.
+	 */
+	for (i = 0; i < nr->num_workers; i++) {
+		if (!nr->workers[i]) continue;
+
+		(void) fr_channel_requestor_poll(nr->workers[i]->channel);
+	}
 
 	/*
 	 *	Pull the replies off of our global heap, and try to
@@ -1341,7 +1735,6 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 	 */
 	while ((cd = fr_heap_pop(nr->replies)) != NULL) {
 		fr_listen_t *li;
-		fr_network_socket_t *s;
 
 		li = cd->listen;
 
@@ -1388,17 +1781,41 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 		}
 
 		/*
-		 *	No pending message, let's try writing it.
+		 *	Queue the message, and if the socket isn't
+		 *	blocked, try writing it.
 		 *
-		 *	If there is a pending message, then we're
-		 *	waiting for IO write to become ready.
+		 *	If there is a pending message, or the app_io
+		 *	has queued replies it couldn't write, then
+		 *	we're waiting for IO write to become ready.
 		 */
-		if (!s->pending) {
-			fr_assert(!s->blocked);
-			(void) fr_heap_insert(s->waiting, cd);
+		(void) fr_heap_insert(s->waiting, cd);
+		if (!s->blocked) {
+			fr_assert(!s->pending);
 			fr_network_write(nr->el, s->listen->fd, 0, s);
 		}
 	}
+
+	/*
+	 *	Write all of the replies which were queued by the
+	 *	app_io, usually with one system call per socket.
+	 */
+	while ((s = fr_dlist_pop_head(&nr->flush)) != NULL) {
+		if (s->dead) continue;
+
+		if (s->listen->app_io->flush(s->listen) < 0) {
+			/*
+			 *	Stream sockets keep the replies which
+			 *	didn't fit, and write them when the
+			 *	socket becomes writable.
+			 */
+			if (errno == EWOULDBLOCK) {
+				if (fr_network_write_wait(nr, s) < 0) fr_network_socket_dead(nr, s);
+				continue;
+			}
+
+			RATE_LIMIT_GLOBAL(PERROR, "Failed flushing replies to socket %s", s->listen->name);
+		}
+	}
 }
 
 /** Stop a network thread in an orderly way
@@ -1605,6 +2022,7 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 	nr->signal_pipe[0] = -1;
 	nr->signal_pipe[1] = -1;
 	if (config) nr->config = *config;
+	fr_network_shed_interval_start(nr, fr_time());
 
 	nr->aq_control = fr_atomic_queue_alloc(nr, 1024);
 	if (!nr->aq_control) {
@@ -1680,6 +2098,8 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		goto fail2;
 	}
 
+	fr_dlist_init(&nr->flush, fr_network_socket_t, flush_entry);
+
 	if (fr_event_pre_insert(nr->el, fr_network_pre_event, nr) < 0) {
 		fr_strerror_const("Failed adding pre-check to event list");
 		goto fail2;
@@ -42,8 +42,36 @@ typedef struct fr_network_s fr_network_t;
 extern "C" {
 #endif
 
+/** How the network thread chooses a worker for each request
+ *
+ */
+typedef enum {
+	FR_NETWORK_WORKER_SELECT_CPU_TIME = 0,		//!< Power of two choices on worker CPU time.
+	FR_NETWORK_WORKER_SELECT_OUTSTANDING,		//!< Worker with the fewest outstanding requests.
+	FR_NETWORK_WORKER_SELECT_LATENCY,		//!< Worker with the lowest predicted backlog, i.e.
+							///< outstanding requests * average processing time.
+	FR_NETWORK_WORKER_SELECT_CLIENT			//!< Hash of the client address, so that each client
+							///< is always sent to the same worker.
+} fr_network_worker_select_t;
+
+extern fr_table_num_sorted_t const fr_network_worker_select_table[];
+extern size_t fr_network_worker_select_table_len;
+
+/** Number of load shedding levels
+ *
+ * One for each of PRIORITY_LOW, PRIORITY_NORMAL, PRIORITY_HIGH and
+ * PRIORITY_NOW.  At level N, packets in the lowest N classes are dropped.
+ */
+#define FR_NETWORK_SHED_LEVELS		(4)
+
 typedef struct {
-	uint32_t	max_outstanding;
+	uint32_t			max_outstanding;
+	fr_network_worker_select_t	worker_select;		//!< how workers are chosen for new requests.
+
+	fr_time_delta_t			queue_delay_target;	//!< shed load when requests are queued for
+								///< longer than this.  0 disables shedding.
+	fr_time_delta_t			queue_delay_interval;	//!< how long the delay has to stay above
+								///< the target before we shed load.
 } fr_network_config_t;
 
 int		fr_network_listen_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
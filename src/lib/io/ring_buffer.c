@@ -28,6 +28,17 @@ RCSID("$Id$")
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/debug.h>
 #include <string.h>
+#include <sys/mman.h>
+
+/*
+ *	Ring buffers at least this large are mapped directly, so
+ *	that they can be backed by huge pages.
+ */
+#define RING_BUFFER_MMAP_SIZE	(2 * 1024 * 1024)
+
+#ifndef MAP_POPULATE
+#  define MAP_POPULATE		(0)
+#endif
 
 /*
  *	Ring buffers are allocated in a block.
@@ -43,8 +54,45 @@ struct fr_ring_buffer_s {
 	size_t		reserved;	//!< amount of reserved data at write_offset
 
 	bool		closed;		//!< whether allocations are closed
+	bool		mapped;		//!< buffer was allocated with mmap().
 };
 
+static int _ring_buffer_free(fr_ring_buffer_t *rb)
+{
+	if (rb->mapped) munmap(rb->buffer, rb->size);
+
+	return 0;
+}
+
+/** Map memory for a large ring buffer
+ *
+ *  Huge pages are tried first, as the rings are written to
+ *  sequentially, and a 4K page per TLB entry is a poor fit.  Most
+ *  systems don't reserve huge pages, so we fall back to normal pages,
+ *  and ask for transparent huge pages instead.
+ *
+ *  Either way the pages are populated now, so that the packet path
+ *  doesn't take page faults when it first writes to the ring.
+ */
+static uint8_t *ring_buffer_map(size_t size)
+{
+	void *p;
+
+#ifdef MAP_HUGETLB
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+	if (p != MAP_FAILED) return p;
+#endif
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (p == MAP_FAILED) return NULL;
+
+#ifdef MADV_HUGEPAGE
+	(void) madvise(p, size, MADV_HUGEPAGE);
+#endif
+
+	return p;
+}
+
 /** Create a ring buffer.
  *
  *  The size provided will be rounded up to the next highest power of
@@ -91,10 +139,26 @@ fr_ring_buffer_t *fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size)
 	size |= size >> 16;
 	size++;
 
-	rb->buffer = talloc_array(rb, uint8_t, size);
-	if (!rb->buffer) {
-		talloc_free(rb);
-		goto fail;
+	if (size >= RING_BUFFER_MMAP_SIZE) {
+		rb->buffer = ring_buffer_map(size);
+		if (!rb->buffer) {
+			talloc_free(rb);
+			goto fail;
+		}
+		rb->mapped = true;
+		talloc_set_destructor(rb, _ring_buffer_free);
+	} else {
+		rb->buffer = talloc_array(rb, uint8_t, size);
+		if (!rb->buffer) {
+			talloc_free(rb);
+			goto fail;
+		}
+
+		/*
+		 *	Fault the pages in now, rather than when the
+		 *	first packets are written.
+		 */
+		memset(rb->buffer, 0, size);
 	}
 	rb->size = size;
 
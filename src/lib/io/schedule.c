@@ -35,6 +35,16 @@ RCSID("$Id$")
 #include <freeradius-devel/server/trigger.h>
 
 #include <pthread.h>
+#include <unistd.h>
+
+/*
+ *	NUMA nodes are found via sysfs, and we use the glibc
+ *	cpu_set_t API, so pinning is Linux only for now.
+ */
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP) && defined(__linux__)
+#  define HAVE_CPU_AFFINITY 1
+#  include <sched.h>
+#endif
 
 /*
  *	Other OS's have sem_init, OS X doesn't.
@@ -64,6 +74,18 @@ RCSID("$Id$")
 
 #define SEM_WAIT_INTR(_x) do {if (sem_wait(_x) == 0) break;} while (errno == EINTR)
 
+#define MAX_NUMA_NODES	(64)		//!< Highest NUMA node number we look for.
+
+/** CPUs on a NUMA node which threads can be pinned to
+ *
+ */
+typedef struct {
+	int		node;			//!< NUMA node number, as the OS knows it.
+	int		*cpus;			//!< CPUs on this node we're allowed to use.
+	unsigned int	num_cpus;		//!< Number of entries in cpus.
+	unsigned int	next_cpu;		//!< Next CPU to pin a thread to.
+} fr_schedule_node_t;
+
 /**
  *  Track the child thread status.
  */
@@ -87,6 +109,8 @@ typedef struct {
 
 	unsigned int	id;			//!< a unique ID
 	int		uses;			//!< how many network threads are using it
+	int		cpu;			//!< CPU we're pinned to, or -1.
+	int		node;			//!< Index of our NUMA node, or -1.
 	fr_time_t	cpu_time;		//!< how much CPU time this worker has used
 
 	fr_dlist_t	entry;			//!< our entry into the linked list of workers
@@ -107,6 +131,8 @@ typedef struct {
 	pthread_t	pthread_id;		//!< the thread of this network
 
 	unsigned int	id;			//!< a unique ID
+	int		cpu;			//!< CPU we're pinned to, or -1.
+	int		node;			//!< Index of our NUMA node, or -1.
 
 	fr_dlist_t	entry;			//!< our entry into the linked list of networks
 
@@ -146,10 +172,56 @@ struct fr_schedule_s {
 
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
+
+	fr_schedule_node_t *nodes;		//!< NUMA nodes threads are pinned to, if cpu_affinity is set.
+	unsigned int	num_nodes;		//!< Number of entries in nodes.
 };
 
 static _Thread_local int worker_id;		//!< Internal ID of the current worker thread.
 
+static int cmd_stats_openmetrics(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_schedule_t		*sc = ctx;
+	fr_schedule_worker_t	*sw;
+	fr_worker_t const	**workers;
+	size_t			num = 0;
+
+	if (sc->single_worker) {
+		fr_worker_t const *single = sc->single_worker;
+
+		fr_worker_openmetrics_fprint(fp, &single, 1);
+		return 0;
+	}
+
+	workers = talloc_array(NULL, fr_worker_t const *, fr_dlist_num_elements(&sc->workers));
+	if (!workers) return -1;
+
+	for (sw = fr_dlist_head(&sc->workers);
+	     sw != NULL;
+	     sw = fr_dlist_next(&sc->workers, sw)) {
+		if (!sw->worker) continue;
+
+		workers[num++] = sw->worker;
+	}
+
+	fr_worker_openmetrics_fprint(fp, workers, num);
+	talloc_free(workers);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_schedule_table[] = {
+	{
+		.parent = "stats",
+		.name = "openmetrics",
+		.func = cmd_stats_openmetrics,
+		.help = "Show statistics for all worker threads in OpenMetrics format.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
 /** Return the worker id for the current thread
  *
  * @return worker ID
@@ -159,6 +231,124 @@ int fr_schedule_worker_id(void)
 	return worker_id;
 }
 
+#ifdef HAVE_CPU_AFFINITY
+/** Find the NUMA node a CPU is on
+ *
+ * @param[in] cpu	to look up.
+ * @return the NUMA node, or 0 if it can't be determined.
+ */
+static int schedule_cpu_node(int cpu)
+{
+	int node;
+
+	for (node = 0; node < MAX_NUMA_NODES; node++) {
+		char path[64];
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+		if (access(path, F_OK) == 0) return node;
+	}
+
+	return 0;
+}
+
+/** Group the CPUs we're allowed to run on by NUMA node
+ *
+ * @param[in] sc	the scheduler.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int schedule_nodes_init(fr_schedule_t *sc)
+{
+	cpu_set_t	allowed;
+	int		cpu, ret;
+
+	CPU_ZERO(&allowed);
+	ret = pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed);
+	if (ret != 0) {
+		ERROR("Failed getting CPU affinity: %s", fr_syserror(ret));
+		return -1;
+	}
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		fr_schedule_node_t	*node;
+		int			node_num;
+		unsigned int		i;
+
+		if (!CPU_ISSET(cpu, &allowed)) continue;
+
+		node_num = schedule_cpu_node(cpu);
+		for (i = 0; i < sc->num_nodes; i++) if (sc->nodes[i].node == node_num) break;
+
+		if (i == sc->num_nodes) {
+			MEM(sc->nodes = talloc_realloc(sc, sc->nodes, fr_schedule_node_t, sc->num_nodes + 1));
+			sc->nodes[i] = (fr_schedule_node_t) { .node = node_num };
+			sc->num_nodes++;
+		}
+
+		node = &sc->nodes[i];
+		MEM(node->cpus = talloc_realloc(sc, node->cpus, int, node->num_cpus + 1));
+		node->cpus[node->num_cpus++] = cpu;
+	}
+
+	DEBUG2("Pinning threads to %u NUMA node(s)", sc->num_nodes);
+
+	return 0;
+}
+
+/** Pin the current thread to a CPU
+ *
+ * This is done before the thread allocates anything, so that the
+ * memory it touches first is on its own NUMA node.
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] name	of the thread, for log messages.
+ * @param[in] cpu	to pin the thread to.
+ */
+static void schedule_thread_pin(fr_schedule_t *sc, char const *name, int cpu)
+{
+	cpu_set_t	set;
+	int		ret;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret != 0) {
+		WARN("%s - Failed pinning to CPU %d: %s", name, cpu, fr_syserror(ret));
+		return;
+	}
+
+	DEBUG2("%s - Pinned to CPU %d", name, cpu);
+}
+#endif
+
+/** Choose the NUMA node and CPU for a thread
+ *
+ * Threads are spread evenly over the nodes, and then over the CPUs
+ * of each node.  Networks are assigned first, so that they get the
+ * first CPU on each node.
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] i		index of the network or worker.
+ * @param[out] node	index of the node in sc->nodes, or -1 if threads aren't pinned.
+ * @return the CPU to pin the thread to, or -1 if threads aren't pinned.
+ */
+static int schedule_cpu_assign(fr_schedule_t *sc, unsigned int i, int *node)
+{
+	fr_schedule_node_t *n;
+
+	if (!sc->num_nodes) {
+		*node = -1;
+		return -1;
+	}
+
+	*node = i % sc->num_nodes;
+	n = &sc->nodes[*node];
+
+	return n->cpus[n->next_cpu++ % n->num_cpus];
+}
+
 /** Entry point for worker threads
  *
  * @param[in] arg	the fr_schedule_worker_t
@@ -177,6 +367,10 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	snprintf(worker_name, sizeof(worker_name), "Worker %d", sw->id);
 
+#ifdef HAVE_CPU_AFFINITY
+	if (sw->cpu >= 0) schedule_thread_pin(sc, worker_name, sw->cpu);
+#endif
+
 	sw->ctx = ctx = talloc_init("%s", worker_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", worker_name);
@@ -220,10 +414,19 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	/*
 	 *	Add this worker to all network threads.
+	 *
+	 *	If threads are pinned, networks only use workers on
+	 *	their own NUMA node.  Workers are spread over the
+	 *	nodes in order, so node N has workers if there are
+	 *	more than N of them.  If it doesn't, the network on
+	 *	that node uses all of the workers.
 	 */
 	for (sn = fr_dlist_head(&sc->networks);
 	       sn != NULL;
 	       sn = fr_dlist_next(&sc->networks, sn)) {
+		if ((sn->node >= 0) && (sn->node != sw->node) &&
+		    ((unsigned int)sn->node < sc->config->max_workers)) continue;
+
 		(void) fr_network_worker_add(sn->nr, sw->worker);
 	}
 
@@ -296,6 +499,10 @@ static void *fr_schedule_network_thread(void *arg)
 
 	snprintf(network_name, sizeof(network_name), "Network %d", sn->id);
 
+#ifdef HAVE_CPU_AFFINITY
+	if (sn->cpu >= 0) schedule_thread_pin(sc, network_name, sn->cpu);
+#endif
+
 	INFO("%s - Starting", network_name);
 
 	sn->ctx = ctx = talloc_init("%s", network_name);
@@ -478,6 +685,11 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 			goto st_fail;
 		}
 
+		if (fr_command_register_hook(NULL, NULL, sc, cmd_schedule_table) < 0) {
+			PERROR("Failed adding scheduler commands");
+			goto st_fail;
+		}
+
 		(void) fr_network_worker_add(sc->single_network, sc->single_worker);
 		DEBUG("Scheduler created in single-threaded mode");
 
@@ -513,6 +725,17 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		if (sc->config->max_workers > 64) sc->config->max_workers = 64;
 	}
 
+	if (sc->config->cpu_affinity) {
+#ifdef HAVE_CPU_AFFINITY
+		if (schedule_nodes_init(sc) < 0) {
+			talloc_free(sc);
+			return NULL;
+		}
+#else
+		WARN("Ignoring 'cpu_affinity', as it is not supported on this platform");
+#endif
+	}
+
 	/*
 	 *	Create the lists which hold the workers and networks.
 	 */
@@ -550,6 +773,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 
 		sn->id = i;
 		sn->sc = sc;
+		sn->cpu = schedule_cpu_assign(sc, i, &sn->node);
 		sn->status = FR_CHILD_INITIALIZING;
 		fr_dlist_insert_head(&sc->networks, sn);
 
@@ -609,6 +833,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 
 		sw->id = i;
 		sw->sc = sc;
+		sw->cpu = schedule_cpu_assign(sc, i, &sw->node);
 		sw->status = FR_CHILD_INITIALIZING;
 		fr_dlist_insert_head(&sc->workers, sw);
 
@@ -680,6 +905,11 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		}
 	}
 
+	if (fr_command_register_hook(NULL, NULL, sc, cmd_schedule_table) < 0) {
+		PERROR("Failed adding scheduler commands");
+		goto st_fail;
+	}
+
 	if (sc) INFO("Scheduler created successfully with %u networks and %u workers",
 		     sc->config->max_networks, (unsigned int)fr_dlist_num_elements(&sc->workers));
 
@@ -842,6 +1072,58 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 	return nr;
 }
 
+/** Return the number of network threads
+ *
+ * @param[in] sc the scheduler
+ * @return the number of network threads.  1 in single-threaded mode.
+ */
+unsigned int fr_schedule_num_networks(fr_schedule_t *sc)
+{
+	(void) talloc_get_type_abort(sc, fr_schedule_t);
+
+	if (sc->el) return 1;
+
+	return fr_dlist_num_elements(&sc->networks);
+}
+
+/** Add one shard of a listener to a scheduler
+ *
+ * Listeners which open multiple sockets on the same address (e.g.
+ * with SO_REUSEPORT) use this to have each socket read by a
+ * different network thread.
+ *
+ * @param[in] sc	the scheduler
+ * @param[in] li	the ctx and callbacks for the transport.
+ * @param[in] shard	which socket this is, modulo the number
+ *			of network threads.
+ * @return
+ *	- NULL on error
+ *	- the fr_network_t that the socket was added to.
+ */
+fr_network_t *fr_schedule_listen_add_shard(fr_schedule_t *sc, fr_listen_t *li, unsigned int shard)
+{
+	fr_network_t		*nr;
+	fr_schedule_network_t	*sn;
+	unsigned int		i;
+
+	(void) talloc_get_type_abort(sc, fr_schedule_t);
+
+	if (sc->el) return fr_schedule_listen_add(sc, li);
+
+	shard %= fr_dlist_num_elements(&sc->networks);
+
+	for (sn = fr_dlist_head(&sc->networks), i = 0;
+	     sn && (i < shard);
+	     sn = fr_dlist_next(&sc->networks, sn), i++);
+	fr_assert(sn != NULL);
+
+	nr = sn->nr;
+
+	if (fr_network_listen_add(nr, li) < 0) return NULL;
+
+	return nr;
+}
+
 /** Add a directory NOTE_EXTEND to a scheduler.
  *
  * @param[in] sc the scheduler
@@ -0,0 +1,304 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Single producer, single consumer message rings in shared memory.
+ * @file io/shm_ring.c
+ *
+ * Like #fr_ring_buffer_t, messages are written contiguously, and a
+ * message which doesn't fit at the end of the ring is written at the
+ * start.  Like #fr_atomic_queue_t, the producer and consumer only
+ * share a head and a tail index, in separate cache lines.
+ *
+ * Unlike both, the ring lives in an anonymous shared mapping, and
+ * contains no pointers, so that it can be used between a process and
+ * the children it forks after the ring is allocated.
+ *
+ * The ring doesn't block.  Instead, #fr_shm_ring_commit tells the
+ * producer when the consumer may have found the ring empty, and so
+ * may be about to sleep.  The producer then wakes it by some other
+ * means, e.g. a pipe.  A consumer may go to sleep as soon as
+ * #fr_shm_ring_peek returns NULL.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/shm_ring.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <stdalign.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#define CACHE_LINE_SIZE		64
+
+/*
+ *	Every message starts with one of these, and
+ *	messages are padded to a multiple of its size.
+ */
+#define SHM_RING_HDR_SIZE	sizeof(uint64_t)
+
+/*
+ *	The rest of the ring is empty, and the next
+ *	message is at the start.
+ */
+#define SHM_RING_SKIP		UINT32_MAX
+
+/** The part of the ring which is shared between processes
+ *
+ * head and tail count bytes, and are never wrapped.  The offset
+ * into data is the count modulo the size of the ring.
+ */
+typedef struct {
+	alignas(CACHE_LINE_SIZE) _Atomic(uint64_t)	head;	//!< Written by the consumer.
+	alignas(CACHE_LINE_SIZE) _Atomic(uint64_t)	tail;	//!< Written by the producer.
+	alignas(CACHE_LINE_SIZE) uint8_t		data[];
+} fr_shm_ring_shared_t;
+
+/** A process local handle for a ring
+ *
+ * Each process has its own copy of this, so the fields which
+ * only the producer, or only the consumer touch live here.
+ */
+struct fr_shm_ring_s {
+	fr_shm_ring_shared_t	*shared;	//!< The mapping.
+	size_t			mapped;		//!< Length of the mapping.
+	size_t			size;		//!< Of the data area.  A power of 2.
+
+	uint64_t		reserved;	//!< Producer only.  Bytes held for the
+						///< reserved message, including any skip.
+	uint64_t		skip;		//!< Producer only.  Bytes skipped at the
+						///< end of the ring for the reserved message.
+	uint64_t		peeked;		//!< Consumer only.  Bytes used by the
+						///< peeked message, including any skip.
+};
+
+static int _shm_ring_free(fr_shm_ring_t *ring)
+{
+	munmap(ring->shared, ring->mapped);
+
+	return 0;
+}
+
+/** Allocate a ring in shared memory
+ *
+ * The ring is shared with any children forked after this function
+ * returns.  Each process should only ever produce, or only ever
+ * consume.
+ *
+ * @param[in] ctx	to allocate the handle in.  The mapping is
+ *			removed from this process when it's freed.
+ * @param[in] size	of the data area.  Rounded up to a power of 2.
+ * @return
+ *	- A new ring on success.
+ *	- NULL on failure.
+ */
+fr_shm_ring_t *fr_shm_ring_alloc(TALLOC_CTX *ctx, size_t size)
+{
+	fr_shm_ring_t	*ring;
+	void		*mem;
+	size_t		mapped;
+
+	if (size < 1024) size = 1024;
+	if (size > (1U << 30)) {
+		fr_strerror_printf("Ring size %zu is too large", size);
+		return NULL;
+	}
+	size = (size_t)1 << fr_high_bit_pos(size - 1);
+
+	mapped = sizeof(fr_shm_ring_shared_t) + size;
+	mem = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping shared memory: %s", fr_syserror(errno));
+		return NULL;
+	}
+
+	MEM(ring = talloc_zero(ctx, fr_shm_ring_t));
+	ring->shared = mem;
+	ring->mapped = mapped;
+	ring->size = size;
+	talloc_set_destructor(ring, _shm_ring_free);
+
+	atomic_init(&ring->shared->head, 0);
+	atomic_init(&ring->shared->tail, 0);
+
+	return ring;
+}
+
+/** The largest message which can ever be written to the ring
+ *
+ */
+size_t fr_shm_ring_max_message(fr_shm_ring_t const *ring)
+{
+	return (ring->size / 2) - SHM_RING_HDR_SIZE;
+}
+
+/** Reserve space for a message
+ *
+ * Only one message may be reserved at a time.  It isn't visible to
+ * the consumer until #fr_shm_ring_commit is called.
+ *
+ * @param[in] ring	to reserve space in.
+ * @param[in] size	of the message.
+ * @return
+ *	- Where to write the message.
+ *	- NULL if the ring is too full.  The caller should try again
+ *	  once the consumer has caught up.
+ */
+uint8_t *fr_shm_ring_reserve(fr_shm_ring_t *ring, size_t size)
+{
+	uint64_t	head, tail, need, offset, contig;
+
+	fr_assert(!ring->reserved);
+
+	if (size > fr_shm_ring_max_message(ring)) {
+		fr_strerror_printf("Message of %zu bytes is too large for ring of %zu bytes", size, ring->size);
+		return NULL;
+	}
+
+	need = ROUND_UP(SHM_RING_HDR_SIZE + size, SHM_RING_HDR_SIZE);
+	head = atomic_load_explicit(&ring->shared->head, memory_order_acquire);
+	tail = atomic_load_explicit(&ring->shared->tail, memory_order_relaxed);
+	offset = tail & (ring->size - 1);
+	contig = ring->size - offset;
+
+	if (need <= contig) {
+		if ((tail + need - head) > ring->size) goto full;
+
+		ring->reserved = need;
+		ring->skip = 0;
+		return ring->shared->data + offset + SHM_RING_HDR_SIZE;
+	}
+
+	/*
+	 *	Skip the rest of the ring, and write
+	 *	the message at the start.  The skip
+	 *	is past the tail, so the consumer
+	 *	can't see it until we commit.
+	 */
+	if ((tail + contig + need - head) > ring->size) {
+	full:
+		fr_strerror_const("Ring is full");
+		return NULL;
+	}
+
+	*((uint32_t *)(ring->shared->data + offset)) = SHM_RING_SKIP;
+	ring->reserved = contig + need;
+	ring->skip = contig;
+
+	return ring->shared->data + SHM_RING_HDR_SIZE;
+}
+
+/** Make a reserved message visible to the consumer
+ *
+ * @param[in] ring	containing the reserved message.
+ * @param[in] size	of the message.  Must be less than or equal
+ *			to the size passed to #fr_shm_ring_reserve.
+ * @return
+ *	- true if the consumer may be waiting for a message, and
+ *	  should be woken.
+ *	- false if the consumer hasn't finished with earlier messages,
+ *	  and so will see this one without being woken.
+ */
+bool fr_shm_ring_commit(fr_shm_ring_t *ring, size_t size)
+{
+	uint64_t	tail, offset, need, skip = ring->skip;
+
+	fr_assert(ring->reserved);
+
+	tail = atomic_load_explicit(&ring->shared->tail, memory_order_relaxed);
+	need = ROUND_UP(SHM_RING_HDR_SIZE + size, SHM_RING_HDR_SIZE);
+	fr_assert(skip + need <= ring->reserved);
+
+	/*
+	 *	If we skipped to the start of the ring, the
+	 *	message is at the start.
+	 */
+	offset = skip ? 0 : tail & (ring->size - 1);
+
+	*((uint32_t *)(ring->shared->data + offset)) = size;
+	ring->reserved = 0;
+
+	/*
+	 *	Both sides use sequentially consistent ordering
+	 *	for the store of their own index, and the load of
+	 *	the other side's.  So either the consumer sees our
+	 *	new tail, or we see that it has consumed everything
+	 *	up to the old tail, and tell the caller to wake it.
+	 */
+	atomic_store_explicit(&ring->shared->tail, tail + skip + need, memory_order_seq_cst);
+
+	return atomic_load_explicit(&ring->shared->head, memory_order_seq_cst) == tail;
+}
+
+/** Return the oldest message in the ring, without removing it
+ *
+ * @param[in] ring	to read from.
+ * @param[out] size	of the message.
+ * @return
+ *	- The message.  It remains valid until #fr_shm_ring_release is called.
+ *	- NULL if the ring is empty.
+ */
+uint8_t const *fr_shm_ring_peek(fr_shm_ring_t *ring, size_t *size)
+{
+	uint64_t	head, tail, offset, skip = 0;
+	uint32_t	len;
+
+	head = atomic_load_explicit(&ring->shared->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->shared->tail, memory_order_seq_cst);
+	if (head == tail) return NULL;
+
+	offset = head & (ring->size - 1);
+	len = *((uint32_t const *)(ring->shared->data + offset));
+	if (len == SHM_RING_SKIP) {
+		skip = ring->size - offset;
+		offset = 0;
+		len = *((uint32_t const *)(ring->shared->data));
+	}
+
+	ring->peeked = skip + ROUND_UP(SHM_RING_HDR_SIZE + len, SHM_RING_HDR_SIZE);
+	fr_assert(head + ring->peeked <= tail);
+
+	*size = len;
+	return ring->shared->data + offset + SHM_RING_HDR_SIZE;
+}
+
+/** Remove the message returned by #fr_shm_ring_peek
+ *
+ * The space it used may be immediately overwritten by the producer.
+ */
+void fr_shm_ring_release(fr_shm_ring_t *ring)
+{
+	uint64_t	head;
+
+	fr_assert(ring->peeked);
+
+	head = atomic_load_explicit(&ring->shared->head, memory_order_relaxed);
+	atomic_store_explicit(&ring->shared->head, head + ring->peeked, memory_order_seq_cst);
+	ring->peeked = 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file io/shm_ring.h
+ * @brief Single producer, single consumer message rings in shared memory.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(shm_ring_h, "$Id$")
+
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_shm_ring_s fr_shm_ring_t;
+
+fr_shm_ring_t	*fr_shm_ring_alloc(TALLOC_CTX *ctx, size_t size);
+
+size_t		fr_shm_ring_max_message(fr_shm_ring_t const *ring) CC_HINT(nonnull);
+
+uint8_t		*fr_shm_ring_reserve(fr_shm_ring_t *ring, size_t size) CC_HINT(nonnull);
+
+bool		fr_shm_ring_commit(fr_shm_ring_t *ring, size_t size) CC_HINT(nonnull);
+
+uint8_t const	*fr_shm_ring_peek(fr_shm_ring_t *ring, size_t *size) CC_HINT(nonnull);
+
+void		fr_shm_ring_release(fr_shm_ring_t *ring) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -57,9 +57,11 @@ RCSID("$Id$")
 #include <freeradius-devel/io/message.h>
 #include <freeradius-devel/io/time_tracking.h>
 #include <freeradius-devel/io/worker.h>
+#include <freeradius-devel/server/module.h>
 #include <freeradius-devel/unlang/call.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/probe.h>
 
 #include <stdalign.h>
 
@@ -71,6 +73,15 @@ static void worker_verify(fr_worker_t *worker);
 #endif
 
 #define CACHE_LINE_SIZE	64
+
+#define FR_WORKER_HIST_CODES	256	//!< Packet codes we keep latency histograms for.
+#define FR_WORKER_BATCH_SIZE	64	//!< Maximum number of requests bootstrapped together.
+
+#ifdef __GNUC__
+#  define WORKER_PREFETCH(_x)	__builtin_prefetch((_x))
+#else
+#  define WORKER_PREFETCH(_x)
+#endif
 static alignas(CACHE_LINE_SIZE) atomic_uint64_t request_number = 0;
 
 /**
@@ -96,6 +107,8 @@ struct fr_worker_s {
 	int			num_channels;	//!< actual number of channels
 
 	fr_heap_t      		*runnable;	//!< current runnable requests which we've spent time processing
+	fr_heap_t		*detached;	//!< runnable detached requests.  These only run when
+						///< there are no runnable requests in the main heap.
 	fr_heap_t		*time_order;	//!< time ordered heap of requests
 	fr_rb_tree_t		*dedup;		//!< de-dup tree
 
@@ -103,8 +116,22 @@ struct fr_worker_s {
 	fr_time_elapsed_t	cpu_time;	//!< histogram of total CPU time per request
 	fr_time_elapsed_t	wall_clock;	//!< histogram of wall clock time per request
 
+	fr_time_hist_t		latency;	//!< wall clock time per request.
+	fr_time_hist_t		running;	//!< time spent running per request.
+	fr_time_hist_t		waiting;	//!< time spent yielded per request.
+	fr_time_hist_t		*latency_code[FR_WORKER_HIST_CODES];	//!< wall clock time per request, by packet code.
+
+	fr_time_hist_t		request_memory;	//!< bytes used per request, if memory_accounting is set.
+						///< The time histogram is reused, with one microsecond
+						///< standing in for one byte.
+	fr_stats_counters_t	*memory;	//!< memory used by our message sets.
+	fr_stats_slot_t		*memory_slot;	//!< our slot in memory.
+	fr_event_timer_t const	*ev_memory;	//!< timer for sampling memory use.
+
 	uint64_t    		num_naks;	//!< number of messages which were nak'd
 	uint64_t    		num_active;	//!< number of active requests
+	uint64_t		num_detached_shed;	//!< number of detached requests stopped because
+							///< too many were waiting to run.
 
 	fr_time_delta_t		predicted;	//!< How long we predict a request will take to execute.
 	fr_time_tracking_t	tracking;	//!< how much time the worker has spent doing things.
@@ -112,6 +139,10 @@ struct fr_worker_s {
 	bool			was_sleeping;	//!< used to suppress multiple sleep signals in a row
 	bool			exiting;	//!< are we exiting?
 
+	bool			batching;	//!< we're draining the channels, so queue new requests.
+	unsigned int		num_batch;	//!< number of requests waiting to be bootstrapped.
+	fr_channel_data_t	*batch[FR_WORKER_BATCH_SIZE];	//!< requests waiting to be bootstrapped.
+
 	fr_time_t		checked_timeout; //!< when we last checked the tails of the queues
 
 	fr_event_timer_t const	*ev_cleanup;	//!< timer for max_request_time
@@ -120,6 +151,7 @@ struct fr_worker_s {
 };
 
 static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now);
+static void worker_requests_bootstrap(fr_worker_t *worker);
 static void worker_send_reply(fr_worker_t *worker, request_t *request, size_t size, fr_time_t now);
 static void worker_max_request_time(UNUSED fr_event_list_t *el, UNUSED fr_time_t when, void *uctx);
 static void worker_max_request_timer(fr_worker_t *worker);
@@ -137,7 +169,39 @@ static void worker_recv_request(void *ctx, fr_channel_t *ch, fr_channel_data_t *
 	worker->stats.in++;
 	DEBUG3("Received request %" PRIu64 "", worker->stats.in);
 	cd->channel.ch = ch;
-	worker_request_bootstrap(worker, cd, fr_time());
+
+	if (!worker->batching) {
+		worker_request_bootstrap(worker, cd, fr_time());
+		return;
+	}
+
+	worker->batch[worker->num_batch++] = cd;
+	if (worker->num_batch == FR_WORKER_BATCH_SIZE) worker_requests_bootstrap(worker);
+}
+
+/** Queue requests while draining the channels
+ *
+ *  Instead of bootstrapping each request as it's pulled from a
+ *  channel, we drain the channel into an array, and then bootstrap
+ *  the requests in one pass.  The decoders stay hot in the
+ *  instruction cache, and we fetch the packet data for the next
+ *  request while decoding this one.
+ */
+static inline CC_HINT(always_inline) void worker_batch_start(fr_worker_t *worker)
+{
+	fr_assert(!worker->batching);
+	fr_assert(worker->num_batch == 0);
+
+	worker->batching = true;
+}
+
+/** Bootstrap any requests queued by the drain, and stop queueing
+ *
+ */
+static inline CC_HINT(always_inline) void worker_batch_end(fr_worker_t *worker)
+{
+	worker_requests_bootstrap(worker);
+	worker->batching = false;
 }
 
 static void worker_exit(fr_worker_t *worker)
@@ -198,10 +262,12 @@ static void worker_channel_callback(void *ctx, void const *data, size_t data_siz
 	case FR_CHANNEL_DATA_READY_RESPONDER:
 		fr_assert(ch != NULL);
 
+		worker_batch_start(worker);
 		if (!fr_channel_recv_request(ch)) {
 			worker->was_sleeping = was_sleeping;
 
 		} else while (fr_channel_recv_request(ch));
+		worker_batch_end(worker);
 		break;
 
 	case FR_CHANNEL_OPEN:
@@ -337,7 +403,7 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 	 */
 	reply->m.when = now;
 	reply->reply.cpu_time = worker->tracking.running_total;
-	reply->reply.processing_time = 10; /* @todo - set to something better? */
+	reply->reply.processing_time = 0;	/* we didn't process it, so don't skew the network's prediction */
 	reply->reply.request_time = cd->request.recv_time;
 
 	reply->listen = cd->listen;
@@ -445,12 +511,38 @@ static void worker_max_request_timer(fr_worker_t *worker)
 	cleanup += worker->config.max_request_time;
 
 	DEBUG2("Resetting cleanup timer to +%pV", fr_box_time_delta(worker->config.max_request_time));
-	if (fr_event_timer_at(worker, worker->el, &worker->ev_cleanup,
-			      cleanup, worker_max_request_time, worker) < 0) {
+	if (fr_event_timer_coarse_at(worker, worker->el, &worker->ev_cleanup,
+				     cleanup, worker_max_request_time, worker) < 0) {
 		ERROR("Failed inserting max_request_time timer");
 	}
 }
 
+/** Sample how much memory the worker's thread local data is using
+ *
+ * Everything measured here is only touched by this thread, so it has
+ * to be measured here, and the results published via the counters.
+ */
+static void worker_memory_sample(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_worker_t	*worker = talloc_get_type_abort(uctx, fr_worker_t);
+	size_t		size = 0;
+	int		i;
+
+	for (i = 0; i < worker->config.max_channels; i++) {
+		if (!worker->channel[i]) continue;
+
+		size += fr_message_set_memory(fr_channel_responder_uctx_get(worker->channel[i]));
+	}
+	FR_STATS_COUNTER_SET(worker->memory_slot, FR_STATS_MEMORY_BYTES, size);
+
+	modules_thread_memory_sample();
+
+	if (fr_event_timer_at(worker, el, &worker->ev_memory, now + fr_time_delta_from_sec(1),
+			      worker_memory_sample, worker) < 0) {
+		ERROR("Failed inserting memory accounting timer");
+	}
+}
+
 /** Start time tracking for a request, and mark it as runnable.
  *
  */
@@ -484,6 +576,14 @@ static void worker_request_time_tracking_end(fr_worker_t *worker, request_t *req
 	fr_assert(worker->num_active > 0);
 	worker->num_active--;
 
+	/*
+	 *	Requests only grow while they're running, so
+	 *	the size now is their high water mark.
+	 */
+	if (worker->config.memory_accounting) {
+		fr_time_hist_update(&worker->request_memory, fr_time_delta_from_usec(talloc_total_size(request)));
+	}
+
 	if (fr_heap_entry_inserted(request->time_order_id)) (void) fr_heap_extract(worker->time_order, request);
 }
 
@@ -583,7 +683,20 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, size_t si
 	fr_time_elapsed_update(&worker->cpu_time, now, now + reply->reply.processing_time);
 	fr_time_elapsed_update(&worker->wall_clock, reply->reply.request_time, now);
 
+	fr_time_hist_update(&worker->latency, now - reply->reply.request_time);
+	fr_time_hist_update(&worker->running, reply->reply.processing_time);
+	fr_time_hist_update(&worker->waiting, request->async->tracking.waiting_total);
+
+	if (request->packet && (request->packet->code < FR_WORKER_HIST_CODES)) {
+		fr_time_hist_t **hist = &worker->latency_code[request->packet->code];
+
+		if (!*hist) *hist = talloc_zero(worker, fr_time_hist_t);
+		if (*hist) fr_time_hist_update(*hist, now - reply->reply.request_time);
+	}
+
 	RDEBUG("Finished request");
+	FR_PROBE4(worker_send_reply, request->number, request->reply ? request->reply->code : 0,
+		  now - reply->reply.request_time, reply->reply.processing_time);
 
 	/*
 	 *	Send the reply, which also polls the request queue.
@@ -680,6 +793,7 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 
 	worker_request_init(worker, request, now);
 	worker_request_name_number(request);
+	FR_PROBE3(worker_request_bootstrap, request->number, cd->request.recv_time, now);
 
 	/*
 	 *	Associate our interpreter with the request
@@ -818,6 +932,37 @@ nak:
 	worker_request_time_tracking_start(worker, request, now);
 }
 
+/** Bootstrap the requests which were queued while draining the channels
+ *
+ */
+static void worker_requests_bootstrap(fr_worker_t *worker)
+{
+	unsigned int		i, num;
+	bool			batching;
+	fr_time_t		now;
+
+	num = worker->num_batch;
+	if (!num) return;
+
+	/*
+	 *	NAKs send replies, which drain the channel.  Any
+	 *	requests received then are bootstrapped immediately,
+	 *	so that we don't write to the array we're reading.
+	 */
+	batching = worker->batching;
+	worker->batching = false;
+	worker->num_batch = 0;
+	now = fr_time();
+
+	for (i = 0; i < num; i++) {
+		if ((i + 1) < num) WORKER_PREFETCH(worker->batch[i + 1]->m.data);
+
+		worker_request_bootstrap(worker, worker->batch[i], now);
+	}
+
+	worker->batching = batching;
+}
+
 /**
  *  Track a request_t in the "runnable" heap.
  */
@@ -832,6 +977,18 @@ static int8_t worker_runnable_cmp(void const *one, void const *two)
 	return CMP(a->async->recv_time, b->async->recv_time);
 }
 
+/** Key for the "runnable" and "detached" heaps
+ *
+ *  Caching the priority in the heap saves dereferencing
+ *  request->async for most comparisons.
+ */
+static int64_t worker_runnable_key(void const *one)
+{
+	request_t const *a = one;
+
+	return a->async->priority;
+}
+
 /**
  *  Track a request_t in the "time_order" heap.
  */
@@ -842,6 +999,13 @@ static int8_t worker_time_order_cmp(void const *one, void const *two)
 	return CMP(a->async->recv_time, b->async->recv_time);
 }
 
+static int64_t worker_time_order_key(void const *one)
+{
+	request_t const *a = one;
+
+	return a->async->recv_time;
+}
+
 /**
  *  Track a request_t in the "dedup" tree
  */
@@ -895,6 +1059,14 @@ void fr_worker_destroy(fr_worker_t *worker)
 	}
 	fr_assert(fr_heap_num_elements(worker->runnable) == 0);
 
+	/*
+	 *	Detached requests aren't in the time order heap,
+	 *	but the ones waiting to run still need stopping.
+	 */
+	while ((request = fr_heap_peek(worker->detached)) != NULL) {
+		unlang_interpret_signal(request, FR_SIGNAL_CANCEL);
+	}
+
 	/*
 	 *	Signal the channels that we're closing.
 	 *
@@ -1008,6 +1180,17 @@ static void _worker_request_done_internal(request_t *request, UNUSED rlm_rcode_t
 	fr_assert(!fr_heap_entry_inserted(request->time_order_id));
 }
 
+/** Remove a request from whichever runnable heap it's in
+ *
+ * Requests which are detached while already scheduled stay in the
+ * main heap, so the request type doesn't tell us which heap to use.
+ * fr_heap_extract() checks membership, so just try both.
+ */
+static inline CC_HINT(always_inline) void worker_runnable_extract(fr_worker_t *worker, request_t *request)
+{
+	if (fr_heap_extract(worker->runnable, request) < 0) (void) fr_heap_extract(worker->detached, request);
+}
+
 /** Detached request (i.e. one generated by the interpreter with no parent) is now complete
  *
  * As the request has no parent, then there's nothing to free it
@@ -1022,7 +1205,7 @@ static void _worker_request_done_detached(request_t *request, UNUSED rlm_rcode_t
 	 *	so we don't need to call
 	 *	worker_request_time_tracking_end.
 	 */
-	fr_assert(!fr_heap_entry_inserted(request->runnable_id));
+	if (fr_heap_entry_inserted(request->runnable_id)) worker_runnable_extract(worker, request);
 
 	/*
 	 *	Normally worker_request_time_tracking_end
@@ -1094,7 +1277,7 @@ static void _worker_request_stop(request_t *request, void *uctx)
 	 *	yank it back out, so it's not "runnable"
 	 *	when we call request done.
 	 */
-	if (fr_heap_entry_inserted(request->runnable_id)) fr_heap_extract(worker->runnable, request);
+	if (fr_heap_entry_inserted(request->runnable_id)) worker_runnable_extract(worker, request);
 
 	/*
 	 *	The interpreter doesn't currently fix
@@ -1112,6 +1295,17 @@ static void _worker_request_runnable(request_t *request, void *uctx)
 	fr_worker_t	*worker = uctx;
 
 	RDEBUG3("Request marked as runnable");
+
+	/*
+	 *	Detached requests are background work, and
+	 *	go into their own heap so they can't delay
+	 *	requests which someone is waiting on.
+	 */
+	if (request_is_detached(request)) {
+		fr_heap_insert(worker->detached, request);
+		return;
+	}
+
 	fr_heap_insert(worker->runnable, request);
 }
 
@@ -1121,6 +1315,13 @@ static void _worker_request_runnable(request_t *request, void *uctx)
 static void _worker_request_yield(request_t *request, UNUSED void *uctx)
 {
 	RDEBUG3("Request yielded");
+
+	/*
+	 *	Time tracking ends when the request is
+	 *	detached, so don't bother reading the clock.
+	 */
+	if (request_is_detached(request)) return;
+
 	fr_time_tracking_yield(&request->async->tracking, fr_time());
 }
 
@@ -1130,6 +1331,9 @@ static void _worker_request_yield(request_t *request, UNUSED void *uctx)
 static void _worker_request_resume(request_t *request, UNUSED void *uctx)
 {
 	RDEBUG3("Request resuming");
+
+	if (request_is_detached(request)) return;
+
 	fr_time_tracking_resume(&request->async->tracking, fr_time());
 }
 
@@ -1141,6 +1345,31 @@ static bool _worker_request_scheduled(request_t const *request, UNUSED void *uct
 	return fr_heap_entry_inserted(request->runnable_id);
 }
 
+/** Get the next request to run
+ *
+ *  Requests in the main heap always run first.  Detached requests
+ *  only run when nothing else is runnable.  If more than
+ *  max_detached are waiting, the excess are stopped instead of run,
+ *  so that background work sheds load rather than building up.
+ */
+static inline CC_HINT(always_inline) request_t *worker_runnable_pop(fr_worker_t *worker)
+{
+	request_t	*request;
+
+	request = fr_heap_pop(worker->runnable);
+	if (request) return request;
+
+	while ((request = fr_heap_pop(worker->detached)) != NULL) {
+		if (fr_heap_num_elements(worker->detached) < (uint32_t) worker->config.max_detached) return request;
+
+		RWDEBUG("Too many detached requests waiting to run - stopping request");
+		worker->num_detached_shed++;
+		unlang_interpret_signal(request, FR_SIGNAL_CANCEL);
+	}
+
+	return NULL;
+}
+
 /** Run a request
  *
  *  Until it either yields, or is done.
@@ -1167,7 +1396,7 @@ static inline CC_HINT(always_inline) void worker_run_request(fr_worker_t *worker
 	 *	every request.
 	 */
 	while (((now - start) < (NSEC / 100000)) &&
-	       ((request = fr_heap_pop(worker->runnable)) != NULL)) {
+	       ((request = worker_runnable_pop(worker)) != NULL)) {
 
 		REQUEST_VERIFY(request);
 		fr_assert(!fr_heap_entry_inserted(request->runnable_id));
@@ -1227,6 +1456,7 @@ nomem:
 	CHECK_CONFIG(message_set_size, 1024, 8192);
 	CHECK_CONFIG(ring_buffer_size, (1 << 17), (1 << 20));
 	CHECK_CONFIG(max_request_time, fr_time_delta_from_sec(30), fr_time_delta_from_sec(60));
+	CHECK_CONFIG(max_detached, 1024, (1 << 30));
 
 	worker->channel = talloc_zero_array(worker, fr_channel_t *, worker->config.max_channels);
 	if (!worker->channel) {
@@ -1265,13 +1495,27 @@ nomem:
 		goto fail;
 	}
 
-	worker->runnable = fr_heap_talloc_alloc(worker, worker_runnable_cmp, request_t, runnable_id, 0);
+	/*
+	 *	These heaps see an insert and an extract for every
+	 *	request, so use 4-ary heaps with the keys stored
+	 *	inline.
+	 */
+	worker->runnable = fr_heap_dary_talloc_alloc(worker, worker_runnable_cmp, worker_runnable_key, 4,
+						     request_t, runnable_id, 0);
 	if (!worker->runnable) {
 		fr_strerror_const("Failed creating runnable heap");
 		goto fail;
 	}
 
-	worker->time_order = fr_heap_talloc_alloc(worker, worker_time_order_cmp, request_t, time_order_id, 0);
+	worker->detached = fr_heap_dary_talloc_alloc(worker, worker_runnable_cmp, worker_runnable_key, 4,
+						     request_t, runnable_id, 0);
+	if (!worker->detached) {
+		fr_strerror_const("Failed creating detached heap");
+		goto fail;
+	}
+
+	worker->time_order = fr_heap_dary_talloc_alloc(worker, worker_time_order_cmp, worker_time_order_key, 4,
+						       request_t, time_order_id, 0);
 	if (!worker->time_order) {
 		fr_strerror_const("Failed creating time_order heap");
 		goto fail;
@@ -1306,10 +1550,46 @@ nomem:
 	}
 	unlang_interpret_set_thread_default(worker->intp);
 
+	if (worker->config.memory_accounting) {
+		char *memory_name;
+
+		memory_name = talloc_asprintf(worker, "messages.%s", worker->name);
+		if (memory_name) worker->memory = fr_stats_memory_alloc(worker, memory_name);
+		talloc_free(memory_name);
+		if (worker->memory) worker->memory_slot = fr_stats_counters_slot(worker->memory);
+		if (!worker->memory_slot) {
+			fr_strerror_const("Failed allocating memory accounting counters");
+			goto fail;
+		}
+
+		if (fr_event_timer_in(worker, el, &worker->ev_memory, fr_time_delta_from_sec(1),
+				      worker_memory_sample, worker) < 0) {
+			fr_strerror_const_push("Failed inserting memory accounting timer");
+			goto fail;
+		}
+	}
+
 	return worker;
 }
 
 
+/** Receive new requests from all channels, and tell the network threads we're polling
+ *
+ * @param[in] worker	the worker data structure to manage
+ */
+static void worker_channels_poll(fr_worker_t *worker)
+{
+	int i;
+
+	worker_batch_start(worker);
+	for (i = 0; i < worker->config.max_channels; i++) {
+		if (!worker->channel[i]) continue;
+
+		(void) fr_channel_responder_poll(worker->channel[i]);
+	}
+	worker_batch_end(worker);
+}
+
 /** The main loop and entry point of the worker thread.
  *
  * @param[in] worker the worker data structure to manage
@@ -1328,7 +1608,26 @@ void fr_worker(fr_worker_t *worker)
 		 *	There are runnable requests.  We still service
 		 *	the event loop, but we don't wait for events.
 		 */
-		wait_for_event = (fr_heap_num_elements(worker->runnable) == 0);
+		wait_for_event = ((fr_heap_num_elements(worker->runnable) == 0) &&
+				  (fr_heap_num_elements(worker->detached) == 0));
+
+		/*
+		 *	We're about to sleep.  Tell the network threads
+		 *	to signal us when they send new requests.  If
+		 *	any arrived in the mean time, don't sleep.
+		 */
+		if (wait_for_event) {
+			int i;
+
+			worker_batch_start(worker);
+			for (i = 0; i < worker->config.max_channels; i++) {
+				if (!worker->channel[i]) continue;
+
+				if (fr_channel_responder_idle(worker->channel[i])) wait_for_event = false;
+			}
+			worker_batch_end(worker);
+		}
+
 		if (wait_for_event) {
 			DEBUG4("Ready to process requests");
 		}
@@ -1355,6 +1654,12 @@ void fr_worker(fr_worker_t *worker)
 			fr_event_service(worker->el);
 		}
 
+		/*
+		 *	We're awake, so pick up any new requests
+		 *	without waiting to be signalled.
+		 */
+		worker_channels_poll(worker);
+
 		/*
 		 *	Run any outstanding requests.
 		 */
@@ -1372,6 +1677,7 @@ int fr_worker_pre_event(UNUSED fr_time_t wake, void *uctx)
 	request_t *request;
 
 	request = fr_heap_peek(worker->runnable);
+	if (!request) request = fr_heap_peek(worker->detached);
 	if (!request) return 0;
 
 	/*
@@ -1472,6 +1778,9 @@ static void worker_verify(fr_worker_t *worker)
 	fr_assert(worker->runnable != NULL);
 	(void) talloc_get_type_abort(worker->runnable, fr_heap_t);
 
+	fr_assert(worker->detached != NULL);
+	(void) talloc_get_type_abort(worker->detached, fr_heap_t);
+
 	fr_assert(worker->dedup != NULL);
 	(void) talloc_get_type_abort(worker->dedup, fr_rb_tree_t);
 
@@ -1500,7 +1809,111 @@ int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 	return 6;
 }
 
-static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
+/** Print the header for an OpenMetrics metric family
+ *
+ */
+static void worker_openmetrics_family(FILE *fp, char const *name, char const *type, char const *help)
+{
+	fprintf(fp, "# TYPE %s %s\n", name, type);
+	fprintf(fp, "# HELP %s %s\n", name, help);
+}
+
+/** Print a latency histogram as an OpenMetrics summary
+ *
+ */
+static void worker_openmetrics_summary(FILE *fp, char const *name, fr_worker_t const *worker,
+				       fr_time_hist_t const *hist)
+{
+	static char const *quantiles[] = { "0.5", "0.9", "0.99", "0.999" };
+	static double const pct[] = { 50, 90, 99, 99.9 };
+	size_t i;
+
+	for (i = 0; i < NUM_ELEMENTS(quantiles); i++) {
+		fr_time_delta_t when = fr_time_hist_percentile(hist, pct[i]);
+
+		fprintf(fp, "%s{worker=\"%s\",quantile=\"%s\"} %u.%06u\n", name, worker->name, quantiles[i],
+			(unsigned int) (when / NSEC), (unsigned int) (when % NSEC) / 1000);
+	}
+	fprintf(fp, "%s_count{worker=\"%s\"} %" PRIu64 "\n", name, worker->name, hist->count);
+}
+
+/** Print statistics for a set of workers in OpenMetrics text format
+ *
+ * Each metric family is printed once, with one sample per worker, so
+ * the output can be handed as-is to a Prometheus compatible scraper.
+ *
+ * The counters are only ever written by their own worker, so we read
+ * them without locking, the same as the other stats commands.
+ *
+ * @param[in] fp	to write to.
+ * @param[in] workers	to print statistics for.
+ * @param[in] num	number of workers.
+ */
+void fr_worker_openmetrics_fprint(FILE *fp, fr_worker_t const **workers, size_t num)
+{
+	size_t i;
+
+#define WORKER_COUNTER(_name, _help, _field) \
+do { \
+	worker_openmetrics_family(fp, "freeradius_worker_" _name, "counter", _help); \
+	for (i = 0; i < num; i++) { \
+		fprintf(fp, "freeradius_worker_" _name "_total{worker=\"%s\"} %" PRIu64 "\n", \
+			workers[i]->name, (uint64_t) workers[i]->_field); \
+	} \
+} while (0)
+
+#define WORKER_GAUGE(_name, _help, _value) \
+do { \
+	worker_openmetrics_family(fp, "freeradius_worker_" _name, "gauge", _help); \
+	for (i = 0; i < num; i++) { \
+		fr_worker_t const *worker = workers[i]; \
+		fprintf(fp, "freeradius_worker_" _name "{worker=\"%s\"} %" PRIu64 "\n", \
+			worker->name, (uint64_t) (_value)); \
+	} \
+} while (0)
+
+#define WORKER_SECONDS(_name, _help, _field) \
+do { \
+	worker_openmetrics_family(fp, "freeradius_worker_" _name "_seconds", "counter", _help); \
+	for (i = 0; i < num; i++) { \
+		fr_time_delta_t when = workers[i]->_field; \
+		fprintf(fp, "freeradius_worker_" _name "_seconds_total{worker=\"%s\"} %u.%06u\n", \
+			workers[i]->name, (unsigned int) (when / NSEC), (unsigned int) (when % NSEC) / 1000); \
+	} \
+} while (0)
+
+#define WORKER_SUMMARY(_name, _help, _field) \
+do { \
+	worker_openmetrics_family(fp, "freeradius_worker_" _name "_seconds", "summary", _help); \
+	for (i = 0; i < num; i++) { \
+		worker_openmetrics_summary(fp, "freeradius_worker_" _name "_seconds", workers[i], &workers[i]->_field); \
+	} \
+} while (0)
+
+	WORKER_COUNTER("requests_received", "Requests received from network threads.", stats.in);
+	WORKER_COUNTER("replies_sent", "Replies sent to network threads.", stats.out);
+	WORKER_COUNTER("requests_duplicate", "Duplicate requests received.", stats.dup);
+	WORKER_COUNTER("requests_dropped", "Requests dropped.", stats.dropped);
+	WORKER_COUNTER("requests_naked", "Requests NAKed back to the network thread.", num_naks);
+
+	WORKER_GAUGE("requests_active", "Requests currently being processed.", worker->num_active);
+	WORKER_GAUGE("requests_runnable", "Requests waiting to run.", fr_heap_num_elements(worker->runnable));
+	WORKER_GAUGE("requests_detached_runnable", "Detached requests waiting to run.", fr_heap_num_elements(worker->detached));
+	WORKER_COUNTER("requests_detached_shed", "Detached requests stopped because too many were waiting to run.", num_detached_shed);
+
+	WORKER_SECONDS("running", "Time spent running requests.", tracking.running_total);
+	WORKER_SECONDS("waiting", "Time spent waiting for requests.", tracking.waiting_total);
+
+	WORKER_SUMMARY("request_latency", "Wall clock time per request.", latency);
+	WORKER_SUMMARY("request_running", "Time spent running per request.", running);
+	WORKER_SUMMARY("request_waiting", "Time spent yielded per request.", waiting);
+
+	modules_openmetrics_fprint(fp);
+
+	fprintf(fp, "# EOF\n");
+}
+
+static int cmd_stats_worker(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
 {
 	fr_worker_t const *worker = ctx;
 	fr_time_t when;
@@ -1513,6 +1926,8 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fprintf(fp, "count.naks\t\t\t%" PRIu64 "\n", worker->num_naks);
 		fprintf(fp, "count.active\t\t\t%" PRIu64 "\n", worker->num_active);
 		fprintf(fp, "count.runnable\t\t\t%u\n", fr_heap_num_elements(worker->runnable));
+		fprintf(fp, "count.detached_runnable\t\t%u\n", fr_heap_num_elements(worker->detached));
+		fprintf(fp, "count.detached_shed\t\t%" PRIu64 "\n", worker->num_detached_shed);
 	}
 
 	if ((info->argc == 0) || (strcmp(info->argv[0], "cpu") == 0)) {
@@ -1533,6 +1948,44 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fr_time_elapsed_fprint(fp, &worker->wall_clock, "time.requests", 4);
 	}
 
+	if ((info->argc == 0) || (strcmp(info->argv[0], "latency") == 0)) {
+		unsigned int i;
+
+		fr_time_hist_fprint(fp, &worker->latency, "latency.request", 4);
+		fr_time_hist_fprint(fp, &worker->running, "latency.running", 4);
+		fr_time_hist_fprint(fp, &worker->waiting, "latency.waiting", 4);
+
+		for (i = 0; i < FR_WORKER_HIST_CODES; i++) {
+			char prefix[32];
+
+			if (!worker->latency_code[i]) continue;
+
+			snprintf(prefix, sizeof(prefix), "latency.code.%u", i);
+			fr_time_hist_fprint(fp, worker->latency_code[i], prefix, 4);
+		}
+	}
+
+	if ((info->argc != 0) && (strcmp(info->argv[0], "memory") == 0)) {
+		static char const *names[] = { "p50", "p90", "p99", "p999" };
+		static double const pct[] = { 50, 90, 99, 99.9 };
+		unsigned int i;
+
+		if (!worker->config.memory_accounting) {
+			fprintf(fp_err, "Memory statistics are only available when 'memory_accounting = yes'.\n");
+			return -1;
+		}
+
+		fprintf(fp, "memory.request.count\t\t%" PRIu64 "\n", worker->request_memory.count);
+		if (!worker->request_memory.count) return 0;
+
+		for (i = 0; i < NUM_ELEMENTS(names); i++) {
+			fprintf(fp, "memory.request.%s\t\t%" PRIu64 "\n", names[i],
+				(uint64_t) fr_time_delta_to_usec(fr_time_hist_percentile(&worker->request_memory, pct[i])));
+		}
+		fprintf(fp, "memory.request.max\t\t%" PRIu64 "\n",
+			(uint64_t) fr_time_delta_to_usec(worker->request_memory.max));
+	}
+
 	return 0;
 }
 
@@ -1548,7 +2001,7 @@ fr_cmd_table_t cmd_worker_table[] = {
 		.parent = "stats worker",
 		.add_name = true,
 		.name = "self",
-		.syntax = "[(count|cpu)]",
+		.syntax = "[(count|cpu|latency|memory)]",
 		.func = cmd_stats_worker,
 		.help = "Show statistics for a specific worker thread.",
 		.read_only = true
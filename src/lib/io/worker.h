@@ -65,7 +65,11 @@ typedef struct {
 
 	fr_time_delta_t	max_request_time;	//!< maximum time a request can be processed
 
+	int		max_detached;		//!< maximum number of detached requests waiting to run
+
 	size_t		talloc_pool_size;	//!< for each request
+
+	bool		memory_accounting;	//!< record how much memory requests and modules use.
 } fr_worker_config_t;
 
 fr_worker_t	*fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const *name,
@@ -85,6 +89,8 @@ fr_channel_t	*fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_
 
 int		fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats) CC_HINT(nonnull);
 
+void		fr_worker_openmetrics_fprint(FILE *fp, fr_worker_t const **workers, size_t num) CC_HINT(nonnull);
+
 #include <freeradius-devel/server/module.h>
 
 int		fr_worker_subrequest_add(request_t *request) CC_HINT(nonnull);
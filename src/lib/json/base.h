@@ -259,6 +259,9 @@ size_t    	fr_json_from_pair(char *out, size_t outlen, fr_pair_t const *vp);
 
 void		fr_json_version_print(void);
 
+ssize_t		fr_json_pair_list_print(fr_sbuff_t *out, fr_pair_list_t *vps,
+					fr_json_format_t const *format) CC_HINT(nonnull(1,2));
+
 char		*fr_json_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
 					 fr_json_format_t const *format);
 
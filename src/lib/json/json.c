@@ -39,6 +39,7 @@ fr_table_num_sorted_t const fr_json_format_table[] = {
 size_t fr_json_format_table_len = NUM_ELEMENTS(fr_json_format_table);
 
 static fr_json_format_t const default_json_format = {
+	.output_mode = JSON_MODE_OBJECT,
 	.attr = { .prefix = NULL },
 	.value = { .value_as_array = true },
 };
@@ -65,17 +66,6 @@ CONF_PARSER const fr_json_format_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
-static inline CC_HINT(always_inline)
-void json_object_put_assert(json_object *obj)
-{
-	int ret;
-
-	ret = json_object_put(obj);
-	if (ret == 1) return;
-
-	fr_assert_fail("json_object_put did not free object (returned %u), likely leaking memory", ret);
-}
-
 /** Convert json object to fr_value_box_t
  *
  * @param[in] ctx	to allocate any value buffers in (should usually be the same as out).
@@ -265,6 +255,76 @@ json_object *json_object_from_value_box(TALLOC_CTX *ctx, fr_value_box_t const *d
 	}
 }
 
+/** Print a string to an sbuff, escaped the same way json-c escapes strings
+ *
+ * Runs of characters which don't need escaping are copied in one go.
+ *
+ * @param[out] out		Where to write the escaped string.
+ * @param[in] in		String to escape.
+ * @param[in] inlen		Length of in.
+ * @param[in] include_quotes	Add the surrounding quotes of JSON strings.
+ * @return
+ *	- >0 the number of bytes written to out.
+ *	- <0 the number of bytes we would have needed to write the escaped string.
+ */
+static ssize_t json_string_print(fr_sbuff_t *out, char const *in, size_t inlen, bool include_quotes)
+{
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
+	char const	*p = in, *end = in + inlen;
+
+	if (include_quotes) FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
+
+	while (p < end) {
+		char const	*q = p;
+		uint8_t		c;
+
+		while ((q < end) && ((uint8_t)*q >= 0x20) && (*q != '"') && (*q != '\\') && (*q != '/')) q++;
+
+		if (q > p) {
+			FR_SBUFF_IN_BSTRNCPY_RETURN(&our_out, p, q - p);
+			p = q;
+			if (p == end) break;
+		}
+
+		c = (uint8_t)*p++;
+		switch (c) {
+		case '"':
+		case '\\':
+		case '/':
+			FR_SBUFF_IN_CHAR_RETURN(&our_out, '\\', (char)c);
+			break;
+
+		case '\b':
+			FR_SBUFF_IN_CHAR_RETURN(&our_out, '\\', 'b');
+			break;
+
+		case '\f':
+			FR_SBUFF_IN_CHAR_RETURN(&our_out, '\\', 'f');
+			break;
+
+		case '\n':
+			FR_SBUFF_IN_CHAR_RETURN(&our_out, '\\', 'n');
+			break;
+
+		case '\r':
+			FR_SBUFF_IN_CHAR_RETURN(&our_out, '\\', 'r');
+			break;
+
+		case '\t':
+			FR_SBUFF_IN_CHAR_RETURN(&our_out, '\\', 't');
+			break;
+
+		default:
+			FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "\\u00%02x", c);
+			break;
+		}
+	}
+
+	if (include_quotes) FR_SBUFF_IN_CHAR_RETURN(&our_out, '"');
+
+	return fr_sbuff_set(out, &our_out);
+}
+
 /** Escapes string for use as a JSON string
  *
  * @param ctx Talloc context to allocate this string
@@ -274,29 +334,19 @@ json_object *json_object_from_value_box(TALLOC_CTX *ctx, fr_value_box_t const *d
  */
 char *fr_json_from_string(TALLOC_CTX *ctx, char const *s, bool include_quotes)
 {
-	char const *p;
-	char *out = NULL;
-	struct json_object *json;
-	int len;
+	fr_sbuff_t		sbuff;
+	fr_sbuff_uctx_talloc_t	tctx;
+	size_t			len = strlen(s);
 
-	json = json_object_new_string(s);
-	if (!json) return NULL;
+	if (!fr_sbuff_init_talloc(ctx, &sbuff, &tctx, len + 2, SIZE_MAX)) return NULL;
 
-	if ((p = json_object_to_json_string(json))) {
-		if (include_quotes) {
-			out = talloc_typed_strdup(ctx, p);
-		} else {
-			len = strlen(p);
-			out = talloc_bstrndup(ctx, p + 1, len - 2);	/* to_json_string adds quotes (") */
-		}
+	if (json_string_print(&sbuff, s, len, include_quotes) < 0) {
+		talloc_free(sbuff.buff);
+		return NULL;
 	}
+	fr_sbuff_trim_talloc(&sbuff, SIZE_MAX);
 
-	/*
-	 * Free the JSON structure, it's not needed any more
-	 */
-	json_object_put_assert(json);
-
-	return out;
+	return sbuff.buff;
 }
 
 /** Prints attribute as string, escaped suitably for use as JSON string
@@ -340,15 +390,9 @@ size_t fr_json_from_pair(char *out, size_t outlen, fr_pair_t const *vp)
 	}
 
 	if (vp->vp_type == FR_TYPE_STRING) {
-		char *tmp = fr_json_from_string(NULL, vp->vp_strvalue, true);
-
-		/* Indicate truncation */
-		if (!tmp) return outlen + 1;
-		slen = strlen(tmp);
-		if (freespace <= (size_t)slen) return outlen + 1;
-
-		strcpy(out, tmp);
-		talloc_free(tmp);
+		/* A negative return indicates truncation */
+		slen = json_string_print(&FR_SBUFF_OUT(out, freespace), vp->vp_strvalue, vp->vp_length, true);
+		if (slen < 0) return outlen + 1;
 
 		return slen;
 	}
@@ -386,56 +430,154 @@ void fr_json_version_print(void)
 }
 
 
-/** Convert fr_pair_t into a JSON object
- *
- * If format.value.enum_as_int is set, and the given VP is an enum
- * value, the integer value is returned as a json_object rather
- * than the text representation.
+/** Print a boxed value as a JSON value
  *
- * If format.value.always_string is set then a numeric value pair
- * will be returned as a JSON string object.
+ * Produces the same output as serialising the result of
+ * json_object_from_value_box(), without building the object.
  *
- * @param[in] ctx	Talloc context.
- * @param[out] out	returned json object.
- * @param[in] vp	to get the value of.
- * @param[in] format	format definition, or NULL.
+ * @param[out] out	Where to write the JSON value.
+ * @param[in] data	to print.
  * @return
- *	- 1 if 'out' is the integer enum value, 0 otherwise
- *	- -1 on error.
+ *	- >0 the number of bytes written to out.
+ *	- <0 on error, or the number of bytes we would have needed.
  */
-static int json_afrom_value_box(TALLOC_CTX *ctx, json_object **out,
-				fr_pair_t *vp, fr_json_format_t const *format)
+static ssize_t json_value_box_print(fr_sbuff_t *out, fr_value_box_t const *data)
 {
-	struct json_object	*obj;
-	fr_value_box_t const	*vb;
-	fr_value_box_t		vb_str;
-	int			is_enum = 0;
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
 
-	fr_assert(vp);
+	/*
+	 *	We're converting to PRESENTATION format
+	 *	so any attributes with enumeration values
+	 *	should be converted to string types.
+	 */
+	if (data->enumv) {
+		fr_dict_enum_t *enumv;
 
-	vb = &vp->data;
+		enumv = fr_dict_enum_by_value(data->enumv, data);
+		if (enumv) {
+			FR_SBUFF_RETURN(json_string_print, &our_out, enumv->name, strlen(enumv->name), true);
+			return fr_sbuff_set(out, &our_out);
+		}
+	}
+
+	switch (data->type) {
+	default:
+	do_string:
+	{
+		char		buff[128];
+		fr_sbuff_t	tmp = FR_SBUFF_OUT(buff, sizeof(buff));
+		char		*p = NULL;
+		char const	*str = buff;
+		ssize_t		slen;
 
-	if (format && format->value.enum_as_int) {
-		is_enum = fr_pair_value_enum_box(&vb, vp);
-		fr_assert(is_enum >= 0);
+		/*
+		 *	Most values fit on the stack, anything
+		 *	bigger gets a temporary heap buffer.
+		 */
+		slen = fr_value_box_print(&tmp, data, NULL);
+		if (slen < 0) {
+			slen = fr_value_box_aprint(NULL, &p, data, NULL);
+			if (!p) return -1;
+			str = p;
+		}
+
+		slen = json_string_print(&our_out, str, (size_t)slen, true);
+		talloc_free(p);
+		if (slen < 0) return slen;
 	}
+		break;
+
+	case FR_TYPE_STRING:
+		FR_SBUFF_RETURN(json_string_print, &our_out, data->vb_strvalue, data->vb_length, true);
+		break;
+
+	case FR_TYPE_OCTETS:
+		FR_SBUFF_RETURN(json_string_print, &our_out, (char const *)data->vb_octets, data->vb_length, true);
+		break;
 
-	if (format && format->value.always_string) {
-		if (fr_value_box_cast(ctx, &vb_str, FR_TYPE_STRING, NULL, vb) == 0) {
-			vb = &vb_str;
+	case FR_TYPE_BOOL:
+		if (data->vb_bool) {
+			FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, "true");
 		} else {
-			return -1;
+			FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, "false");
 		}
+		break;
+
+	case FR_TYPE_UINT8:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%u", data->vb_uint8);
+		break;
+
+	case FR_TYPE_UINT16:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%u", data->vb_uint16);
+		break;
+
+	case FR_TYPE_UINT32:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%u", data->vb_uint32);
+		break;
+
+	case FR_TYPE_UINT64:
+		if (data->vb_uint64 > INT64_MAX) goto do_string;
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%" PRIu64, data->vb_uint64);
+		break;
+
+	case FR_TYPE_INT8:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%d", data->vb_int8);
+		break;
+
+	case FR_TYPE_INT16:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%d", data->vb_int16);
+		break;
+
+	case FR_TYPE_INT32:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%d", data->vb_int32);
+		break;
+
+	case FR_TYPE_INT64:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%" PRId64, data->vb_int64);
+		break;
+
+	case FR_TYPE_SIZE:
+		FR_SBUFF_IN_SPRINTF_RETURN(&our_out, "%zu", data->vb_size);
+		break;
 	}
 
-	MEM(obj = json_object_from_value_box(ctx, vb));
+	return fr_sbuff_set(out, &our_out);
+}
+
+/** Print the value of a fr_pair_t as a JSON value
+ *
+ * If format.value.enum_as_int is set, and the given VP is an enum
+ * value, the integer value is printed rather than the text
+ * representation.
+ *
+ * If format.value.always_string is set then a numeric value pair
+ * will be printed as a JSON string.
+ *
+ * @param[out] out	Where to write the JSON value.
+ * @param[in] vp	to print the value of.
+ * @param[in] format	format definition.
+ * @return
+ *	- >0 the number of bytes written to out.
+ *	- <0 on error, or the number of bytes we would have needed.
+ */
+static ssize_t json_pair_value_print(fr_sbuff_t *out, fr_pair_t *vp, fr_json_format_t const *format)
+{
+	fr_value_box_t const	*vb = &vp->data;
+	fr_value_box_t		vb_str;
+	ssize_t			slen;
+
+	if (format->value.enum_as_int && (fr_pair_value_enum_box(&vb, vp) < 0)) return -1;
 
-	if (format && format->value.always_string) {
-		fr_value_box_clear(&vb_str);
+	if (!format->value.always_string) return json_value_box_print(out, vb);
+
+	if (fr_value_box_cast(NULL, &vb_str, FR_TYPE_STRING, NULL, vb) < 0) {
+		fr_strerror_const("Failed to convert attribute value to JSON string");
+		return -1;
 	}
+	slen = json_value_box_print(out, &vb_str);
+	fr_value_box_clear(&vb_str);
 
-	*out = obj;
-	return is_enum;
+	return slen;
 }
 
 
@@ -521,456 +663,351 @@ bool fr_json_format_verify(fr_json_format_t const *format, bool verbose)
 }
 
 
-/** Returns a JSON object representation of a list of value pairs
+/** Find the next pair in the list with the same name as vp
+ *
+ */
+static inline fr_pair_t *json_pair_next_same(fr_pair_list_t *vps, fr_pair_t *vp)
+{
+	fr_pair_t *next;
+
+	for (next = fr_pair_list_next(vps, vp); next; next = fr_pair_list_next(vps, next)) {
+		if ((next->da == vp->da) || (strcmp(next->da->name, vp->da->name) == 0)) return next;
+	}
+
+	return NULL;
+}
+
+/** Whether a pair with the same name as vp occurs earlier in the list
+ *
+ * Keys are emitted at the position of the first pair with that name,
+ * so later pairs with the same name are skipped when we get to them.
+ */
+static inline bool json_pair_seen(fr_pair_list_t *vps, fr_pair_t *vp)
+{
+	fr_pair_t *prev;
+
+	for (prev = fr_pair_list_head(vps); prev && (prev != vp); prev = fr_pair_list_next(vps, prev)) {
+		if ((prev->da == vp->da) || (strcmp(prev->da->name, vp->da->name) == 0)) return true;
+	}
+
+	return false;
+}
+
+/** Print a (prefixed) attribute name as a JSON string
+ *
+ */
+static inline ssize_t json_attr_name_print(fr_sbuff_t *out, fr_pair_t *vp, fr_json_format_t const *format)
+{
+	char		buf[FR_DICT_ATTR_MAX_NAME_LEN + 32];
+	char const	*attr_name;
+
+	attr_name = attr_name_with_prefix(buf, sizeof(buf), vp->da->name, format);
+
+	return json_string_print(out, attr_name, strlen(attr_name), true);
+}
+
+/** Print the type of vp as a JSON string
+ *
+ */
+static inline ssize_t json_attr_type_print(fr_sbuff_t *out, fr_pair_t *vp)
+{
+	char const *type_name;
+
+	type_name = fr_table_str_by_value(fr_value_box_type_table, vp->vp_type, "<INVALID>");
+
+	return json_string_print(out, type_name, strlen(type_name), true);
+}
+
+/** Print the values of vp, and all later pairs with the same name
  *
- * The result is a struct json_object, which should be free'd with
- * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+ * If there's only one value, and as_array is false, the value is
+ * printed on its own, otherwise the values are printed as a JSON array.
+ *
+ * @param[out] out	Where to write the values.
+ * @param[in] vps	list vp is in.
+ * @param[in] vp	first pair with this name.
+ * @param[in] format	Formatting control.
+ * @param[in] as_array	Always print the values as a JSON array.
+ * @return
+ *	- >0 the number of bytes written to out.
+ *	- <0 on error, or the number of bytes we would have needed.
+ */
+static ssize_t json_pair_values_print(fr_sbuff_t *out, fr_pair_list_t *vps, fr_pair_t *vp,
+				      fr_json_format_t const *format, bool as_array)
+{
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
+	fr_pair_t	*next = json_pair_next_same(vps, vp);
+
+	if (!as_array && !next) {
+		FR_SBUFF_RETURN(json_pair_value_print, &our_out, vp, format);
+		return fr_sbuff_set(out, &our_out);
+	}
+
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '[');
+	FR_SBUFF_RETURN(json_pair_value_print, &our_out, vp, format);
+	while (next) {
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		FR_SBUFF_RETURN(json_pair_value_print, &our_out, next, format);
+		next = json_pair_next_same(vps, next);
+	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, ']');
+
+	return fr_sbuff_set(out, &our_out);
+}
+
+/** Print a JSON object representation of a list of value pairs
  *
  * This function generates the "object" format, JSON_MODE_OBJECT.
  * @see fr_json_format_s
  *
- * @param[in] ctx	Talloc context.
+ * @param[out] out	Where to write the JSON document.
  * @param[in] vps	a list of value pairs.
  * @param[in] format	Formatting control, must be set.
- * @return JSON object with the generated representation.
+ * @return
+ *	- >0 the number of bytes written to out.
+ *	- <0 on error, or the number of bytes we would have needed.
  */
-static json_object *json_object_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
-						fr_json_format_t const *format)
+static ssize_t json_object_print_pair_list(fr_sbuff_t *out, fr_pair_list_t *vps, fr_json_format_t const *format)
 {
-	fr_pair_t		*vp;
-	struct json_object	*obj;
-	char			buf[FR_DICT_ATTR_MAX_NAME_LEN + 32];
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
+	fr_pair_t	*vp;
+	bool		first = true;
 
 	/* Check format and type */
 	fr_assert(format);
 	fr_assert(format->output_mode == JSON_MODE_OBJECT);
 
-	MEM(obj = json_object_new_object());
-
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '{');
 	for (vp = fr_pair_list_head(vps);
 	     vp;
 	     vp = fr_pair_list_next(vps, vp)) {
-		char const		*attr_name;
-		struct json_object	*vp_object, *values, *value, *type_name;
-
-		/*
-		 *	Get attribute name and value.
-		 */
-		attr_name = attr_name_with_prefix(buf, sizeof(buf), vp->da->name, format);
-
-		if (json_afrom_value_box(ctx, &value, vp, format) < 0) {
-			fr_strerror_const("Failed to convert attribute value to JSON object");
-		error:
-			json_object_put_assert(obj);
-
-			return NULL;
-		}
+		if (json_pair_seen(vps, vp)) continue;
 
-		/*
-		 *	Look in the table to see if we already have
-		 *	a key for the attribute we're working on.
-		 */
-		if (!json_object_object_get_ex(obj, attr_name, &vp_object)) {
-			/*
-			 *	Wasn't there, so create a new object for this attribute.
-			 */
-			MEM(vp_object = json_object_new_object());
-			json_object_object_add(obj, attr_name, vp_object);
-
-			/*
-			 *	Add "type" to newly created keys.
-			 */
-			MEM(type_name = json_object_new_string(fr_table_str_by_value(fr_value_box_type_table,
-										     vp->vp_type, "<INVALID>")));
-			json_object_object_add_ex(vp_object, "type", type_name, JSON_C_OBJECT_KEY_IS_CONSTANT);
-
-			/*
-			 *	Create a "value" array to hold any attribute values for this attribute...
-			 */
-			if (format->value.value_as_array) {
-				MEM(values = json_object_new_array());
-				json_object_object_add_ex(vp_object, "value", values, JSON_C_OBJECT_KEY_IS_CONSTANT);
-			} else {
-				/*
-				 *	...unless this is the first time we've seen the attribute and
-				 *	value_as_array is false, in which case just add the value directly
-				 *	and move on to the next attribute.
-				 */
-				json_object_object_add_ex(vp_object, "value", value, JSON_C_OBJECT_KEY_IS_CONSTANT);
-				continue;
-			}
-		} else {
-			/*
-			 *	Find the 'values' array to add the current value to.
-			 */
-			if (!fr_cond_assert(json_object_object_get_ex(vp_object, "value", &values))) {
-				fr_strerror_const("Inconsistent JSON tree");
-				goto error;
-			}
-
-			/*
-			 *	If value_as_array is no set then "values" may not be an array, so it will
-			 *	need converting to an array to add this extra attribute.
-			 */
-			if (!format->value.value_as_array) {
-				json_type		type;
-				struct json_object	*convert_value = values;
-
-				/* Check "values" type */
-				type = json_object_get_type(values);
-
-				/* It wasn't an array, so turn it into one with the old value as the first entry */
-				if (type != json_type_array) {
-					MEM(values = json_object_new_array());
-					json_object_array_add(values, json_object_get(convert_value));
-					json_object_object_del(vp_object, "value");
-					json_object_object_add_ex(vp_object, "value", values,
-								  JSON_C_OBJECT_KEY_IS_CONSTANT);
-				}
-			}
-		}
+		if (!first) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		first = false;
 
 		/*
-		 *	Append to the JSON array.
+		 *	"<name>":{"type":"<type>","value":<value(s)>}
 		 */
-		json_object_array_add(values, value);
+		FR_SBUFF_RETURN(json_attr_name_print, &our_out, vp, format);
+		FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, ":{\"type\":");
+		FR_SBUFF_RETURN(json_attr_type_print, &our_out, vp);
+		FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, ",\"value\":");
+		FR_SBUFF_RETURN(json_pair_values_print, &our_out, vps, vp, format, format->value.value_as_array);
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, '}');
 	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '}');
 
-	return obj;
+	return fr_sbuff_set(out, &our_out);
 }
 
-
-/** Returns a JSON object representation of a list of value pairs
- *
- * The result is a struct json_object, which should be free'd with
- * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+/** Print a JSON object representation of a list of value pairs
  *
  * This function generates the "simple object" format, JSON_MODE_OBJECT_SIMPLE.
  * @see fr_json_format_s
  *
- * @param[in] ctx	Talloc context.
+ * @param[out] out	Where to write the JSON document.
  * @param[in] vps	a list of value pairs.
  * @param[in] format	Formatting control, must be set.
- * @return JSON object with the generated representation.
+ * @return
+ *	- >0 the number of bytes written to out.
+ *	- <0 on error, or the number of bytes we would have needed.
  */
-static json_object *json_smplobj_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
-						 fr_json_format_t const *format)
+static ssize_t json_smplobj_print_pair_list(fr_sbuff_t *out, fr_pair_list_t *vps, fr_json_format_t const *format)
 {
-	fr_pair_t		*vp;
-	struct json_object	*obj;
-	char			buf[FR_DICT_ATTR_MAX_NAME_LEN + 32];
-	json_type		type;
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
+	fr_pair_t	*vp;
+	bool		first = true;
 
 	/* Check format and type */
 	fr_assert(format);
 	fr_assert(format->output_mode == JSON_MODE_OBJECT_SIMPLE);
 
-	MEM(obj = json_object_new_object());
-
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '{');
 	for (vp = fr_pair_list_head(vps);
 	     vp;
 	     vp = fr_pair_list_next(vps, vp)) {
-		char const		*attr_name;
-		struct json_object	*vp_object, *value;
-		struct json_object	*values = NULL;
-		bool			add_single = false;
+		if (json_pair_seen(vps, vp)) continue;
 
-		/*
-		 *	Get attribute name and value.
-		 */
-		attr_name = attr_name_with_prefix(buf, sizeof(buf), vp->da->name, format);
+		if (!first) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		first = false;
 
-		if (json_afrom_value_box(ctx, &value, vp, format) < 0) {
-			fr_strerror_const("Failed to convert attribute value to JSON object");
-
-			json_object_put_assert(obj);
-			return NULL;
-		}
-
-		/*
-		 *	See if we already have a key in the table we're working on,
-		 *	if not then create a new one.
-		 */
-		if (!json_object_object_get_ex(obj, attr_name, &vp_object)) {
-			if (format->value.value_as_array) {
-				/*
-				 *	We have been asked to ensure /all/ values are lists,
-				 *	even if there's only one attribute.
-				 */
-				MEM(values = json_object_new_array());
-				json_object_object_add(obj, attr_name, values);
-			} else {
-				/*
-				 *	Deal with it later on.
-				 */
-				add_single = true;
-			}
 		/*
-		 *	If we do have the key already, get its value array.
+		 *	"<name>":<value(s)>
 		 */
-		} else {
-			type = json_object_get_type(vp_object);
-
-			if (type == json_type_array) {
-				values = vp_object;
-			} else {
-				/*
-				 *	We've seen one of these before, but didn't add
-				 *	it as an array the first time. Sort that out.
-				 */
-				MEM(values = json_object_new_array());
-				json_object_array_add(values, json_object_get(vp_object));
-
-				/*
-				 *	Existing key will have refcount decremented
-				 *	and will be freed if thise drops to zero.
-				 */
-				json_object_object_add(obj, attr_name, values);
-			}
-		}
-
-		if (add_single) {
-			/*
-			 *	Only ever used the first time adding a new
-			 *	attribute when "value_as_array" is not set.
-			 */
-			json_object_object_add(obj, attr_name, value);
-		} else {
-			/*
-			 *	Otherwise we're always appending to a JSON array.
-			 */
-			json_object_array_add(values, value);
-		}
+		FR_SBUFF_RETURN(json_attr_name_print, &our_out, vp, format);
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, ':');
+		FR_SBUFF_RETURN(json_pair_values_print, &our_out, vps, vp, format, format->value.value_as_array);
 	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '}');
 
-	return obj;
+	return fr_sbuff_set(out, &our_out);
 }
 
-
-/** Returns a JSON array representation of a list of value pairs
- *
- * The result is a struct json_object, which should be free'd with
- * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+/** Print a JSON array representation of a list of value pairs
  *
  * This function generates the "array" format, JSON_MODE_ARRAY.
  * @see fr_json_format_s
  *
- * @param[in] ctx	Talloc context.
+ * @param[out] out	Where to write the JSON document.
  * @param[in] vps	a list of value pairs.
  * @param[in] format	Formatting control, must be set.
- * @return JSON object with the generated representation.
+ * @return
+ *	- >0 the number of bytes written to out.
+ *	- <0 on error, or the number of bytes we would have needed.
  */
-static struct json_object *json_array_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
-						      fr_json_format_t const *format)
+static ssize_t json_array_print_pair_list(fr_sbuff_t *out, fr_pair_list_t *vps, fr_json_format_t const *format)
 {
-	fr_pair_t		*vp;
-	struct json_object	*obj;
-	struct json_object	*seen_attributes = NULL;
-	char			buf[FR_DICT_ATTR_MAX_NAME_LEN + 32];
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
+	fr_pair_t	*vp;
+	bool		first = true;
 
 	/* Check format and type */
 	fr_assert(format);
 	fr_assert(format->output_mode == JSON_MODE_ARRAY);
 
-	MEM(obj = json_object_new_array());
-
-	/*
-	 *	If attribute values should be in a list format, then keep track
-	 *	of the attributes we've previously seen in a JSON object.
-	 */
-	if (format->value.value_as_array) {
-		seen_attributes = json_object_new_object();
-	}
-
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '[');
 	for (vp = fr_pair_list_head(vps);
 	     vp;
 	     vp = fr_pair_list_next(vps, vp)) {
-		char const		*attr_name;
-		struct json_object	*name, *value, *type_name;
-		struct json_object	*values = NULL;
-		struct json_object	*attrobj = NULL;
-		bool			already_seen = false;
-
 		/*
-		 *	Get attribute name and value.
+		 *	If attribute values should be in a list format,
+		 *	all values go in the entry for the first pair
+		 *	with that name.
 		 */
-		attr_name = attr_name_with_prefix(buf, sizeof(buf), vp->da->name, format);
-
-		if (json_afrom_value_box(ctx, &value, vp, format) < 0) {
-			fr_strerror_const("Failed to convert attribute value to JSON object");
-			json_object_put_assert(obj);
-			return NULL;
-		}
+		if (format->value.value_as_array && json_pair_seen(vps, vp)) continue;
 
-		if (format->value.value_as_array) {
-			/*
-			 *	Try and find this attribute in the "seen_attributes" object. If it is
-			 *	there then get the "values" array to add this attribute value to.
-			 */
-			already_seen = json_object_object_get_ex(seen_attributes, attr_name, &values);
-		}
+		if (!first) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		first = false;
 
 		/*
-		 *	If we're adding all attributes to the toplevel array, or we're adding values
-		 *	to an array of an existing attribute but haven't seen it before, then we need
-		 *	to create a new JSON object for this attribute.
+		 *	{"name":"<name>","type":"<type>","value":<value(s)>}
 		 */
-		if (!format->value.value_as_array || !already_seen) {
-			/*
-			 * Create object and add it to top-level array
-			 */
-			MEM(attrobj = json_object_new_object());
-			json_object_array_add(obj, attrobj);
-
-			/*
-			 * Add the attribute name in the "name" key and the type in the "type" key
-			 */
-			MEM(name = json_object_new_string(attr_name));
-			json_object_object_add_ex(attrobj, "name", name, JSON_C_OBJECT_KEY_IS_CONSTANT);
-
-			MEM(type_name = json_object_new_string(fr_table_str_by_value(fr_value_box_type_table,
-										     vp->vp_type, "<INVALID>")));
-			json_object_object_add_ex(attrobj, "type", type_name, JSON_C_OBJECT_KEY_IS_CONSTANT);
-		}
-
+		FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, "{\"name\":");
+		FR_SBUFF_RETURN(json_attr_name_print, &our_out, vp, format);
+		FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, ",\"type\":");
+		FR_SBUFF_RETURN(json_attr_type_print, &our_out, vp);
+		FR_SBUFF_IN_STRCPY_LITERAL_RETURN(&our_out, ",\"value\":");
 		if (format->value.value_as_array) {
-			/*
-			 *	We're adding values to an array for the first copy of this attribute
-			 *	that we saw. First time around we need to create an array.
-			 */
-			if (!already_seen) {
-				MEM(values = json_object_new_array());
-				/*
-				 * Add "value":[] key to the attribute object
-				 */
-				json_object_object_add_ex(attrobj, "value", values, JSON_C_OBJECT_KEY_IS_CONSTANT);
-
-				/*
-				 * Also add to "seen_attributes" to check later
-				 */
-				json_object_object_add(seen_attributes, attr_name, json_object_get(values));
-			}
-
-			/*
-			 *	Always add the value to the respective "values" array.
-			 */
-			json_object_array_add(values, value);
+			FR_SBUFF_RETURN(json_pair_values_print, &our_out, vps, vp, format, true);
 		} else {
-			/*
-			 * This is simpler; just add a "value": key to the attribute object.
-			 */
-			json_object_object_add_ex(attrobj, "value", value, JSON_C_OBJECT_KEY_IS_CONSTANT);
+			FR_SBUFF_RETURN(json_pair_value_print, &our_out, vp, format);
 		}
-
-	}
-
-	/*
-	 *	No longer need the "seen_attributes" object, it was just used for tracking.
-	 */
-	if (format->value.value_as_array) {
-		json_object_put_assert(seen_attributes);
+		FR_SBUFF_IN_CHAR_RETURN(&our_out, '}');
 	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, ']');
 
-	return obj;
+	return fr_sbuff_set(out, &our_out);
 }
 
-
-/** Returns a JSON array of a list of value pairs
- *
- * The result is a struct json_object, which should be free'd with
- * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+/** Print a JSON array of the values of a list of value pairs
  *
  * This function generates the "array_of_values" format,
  * JSON_MODE_ARRAY_OF_VALUES, listing just the attribute values.
  * @see fr_json_format_s
  *
- * @param[in] ctx	Talloc context.
+ * @param[out] out	Where to write the JSON document.
  * @param[in] vps	a list of value pairs.
  * @param[in] format	Formatting control, must be set.
- * @return JSON object with the generated representation.
+ * @return
+ *	- >0 the number of bytes written to out.
+ *	- <0 on error, or the number of bytes we would have needed.
  */
-static struct json_object *json_value_array_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
-							    fr_json_format_t const *format)
+static ssize_t json_value_array_print_pair_list(fr_sbuff_t *out, fr_pair_list_t *vps,
+						fr_json_format_t const *format)
 {
-	fr_pair_t		*vp;
-	struct json_object	*obj;
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
+	fr_pair_t	*vp;
 
 	/* Check format and type */
 	fr_assert(format);
 	fr_assert(format->output_mode == JSON_MODE_ARRAY_OF_VALUES);
 
-	MEM(obj = json_object_new_array());
-
-	/*
-	 *	This array format is very simple - just add all the
-	 *	attribute values to the array in order.
-	 */
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '[');
 	for (vp = fr_pair_list_head(vps);
 	     vp;
 	     vp = fr_pair_list_next(vps, vp)) {
-		struct json_object	*value;
-
-		if (json_afrom_value_box(ctx, &value, vp, format) < 0) {
-			fr_strerror_const("Failed to convert attribute value to JSON object");
-			json_object_put_assert(obj);
-			return NULL;
-		}
-
-		json_object_array_add(obj, value);
+		if (vp != fr_pair_list_head(vps)) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		FR_SBUFF_RETURN(json_pair_value_print, &our_out, vp, format);
 	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, ']');
 
-	return obj;
+	return fr_sbuff_set(out, &our_out);
 }
 
-
-/** Returns a JSON array of a list of value pairs
- *
- * The result is a struct json_object, which should be free'd with
- * json_object_put() by the caller. Intended to only be called by
- * fr_json_afrom_pair_list().
+/** Print a JSON array of the names of a list of value pairs
  *
  * This function generates the "array_of_names" format,
  * JSON_MODE_ARRAY_OF_NAMES, listing just the attribute names.
  * @see fr_json_format_s
  *
- * @param[in] ctx	Talloc context.
+ * @param[out] out	Where to write the JSON document.
  * @param[in] vps	a list of value pairs.
  * @param[in] format	Formatting control, must be set.
- * @return JSON object with the generated representation.
+ * @return
+ *	- >0 the number of bytes written to out.
+ *	- <0 the number of bytes we would have needed.
  */
-static struct json_object *json_attr_array_afrom_pair_list(UNUSED TALLOC_CTX *ctx, fr_pair_list_t *vps,
-							   fr_json_format_t const *format)
+static ssize_t json_attr_array_print_pair_list(fr_sbuff_t *out, fr_pair_list_t *vps,
+					       fr_json_format_t const *format)
 {
-	fr_pair_t		*vp;
-	struct json_object	*obj;
-	char			buf[FR_DICT_ATTR_MAX_NAME_LEN + 32];
+	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
+	fr_pair_t	*vp;
 
 	/* Check format and type */
 	fr_assert(format);
 	fr_assert(format->output_mode == JSON_MODE_ARRAY_OF_NAMES);
 
-	MEM(obj = json_object_new_array());
-
-	/*
-	 *	Add all the attribute names to the array in order.
-	 */
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, '[');
 	for (vp = fr_pair_list_head(vps);
 	     vp;
 	     vp = fr_pair_list_next(vps, vp)) {
-		char const		*attr_name;
-		struct json_object	*value;
+		if (vp != fr_pair_list_head(vps)) FR_SBUFF_IN_CHAR_RETURN(&our_out, ',');
+		FR_SBUFF_RETURN(json_attr_name_print, &our_out, vp, format);
+	}
+	FR_SBUFF_IN_CHAR_RETURN(&our_out, ']');
 
-		attr_name = attr_name_with_prefix(buf, sizeof(buf), vp->da->name, format);
-		value = json_object_new_string(attr_name);
+	return fr_sbuff_set(out, &our_out);
+}
 
-		json_object_array_add(obj, value);
-	}
+/** Print a JSON document representing a list of value pairs
+ *
+ * The document is written directly to the buffer as it's generated,
+ * no intermediary json-c objects are created.
+ *
+ * @param[out] out	Where to write the JSON document.
+ * @param[in] vps	a list of value pairs.
+ * @param[in] format	Formatting control, can be NULL to use default format.
+ * @return
+ *	- >0 the number of bytes written to out.
+ *	- <0 on error, or the number of bytes we would have needed.
+ */
+ssize_t fr_json_pair_list_print(fr_sbuff_t *out, fr_pair_list_t *vps, fr_json_format_t const *format)
+{
+	if (!format) format = &default_json_format;
+
+	switch (format->output_mode) {
+	case JSON_MODE_OBJECT:
+		return json_object_print_pair_list(out, vps, format);
 
-	return obj;
+	case JSON_MODE_OBJECT_SIMPLE:
+		return json_smplobj_print_pair_list(out, vps, format);
+
+	case JSON_MODE_ARRAY:
+		return json_array_print_pair_list(out, vps, format);
+
+	case JSON_MODE_ARRAY_OF_VALUES:
+		return json_value_array_print_pair_list(out, vps, format);
+
+	case JSON_MODE_ARRAY_OF_NAMES:
+		return json_attr_array_print_pair_list(out, vps, format);
+
+	default:
+		/* This should never happen */
+		fr_assert(0);
+		fr_strerror_const("Invalid JSON output mode");
+		return -1;
+	}
 }
 
 
@@ -1009,44 +1046,16 @@ static struct json_object *json_attr_array_afrom_pair_list(UNUSED TALLOC_CTX *ct
 char *fr_json_afrom_pair_list(TALLOC_CTX *ctx, fr_pair_list_t *vps,
 			      fr_json_format_t const *format)
 {
-	struct json_object	*obj = NULL;
-	const char		*p;
-	char			*out;
+	fr_sbuff_t		sbuff;
+	fr_sbuff_uctx_talloc_t	tctx;
 
-	if (!format) format = &default_json_format;
+	MEM(fr_sbuff_init_talloc(ctx, &sbuff, &tctx, 1024, SIZE_MAX));
 
-	switch (format->output_mode) {
-	case JSON_MODE_OBJECT:
-		MEM(obj = json_object_afrom_pair_list(ctx, vps, format));
-		break;
-	case JSON_MODE_OBJECT_SIMPLE:
-		MEM(obj = json_smplobj_afrom_pair_list(ctx, vps, format));
-		break;
-	case JSON_MODE_ARRAY:
-		MEM(obj = json_array_afrom_pair_list(ctx, vps, format));
-		break;
-	case JSON_MODE_ARRAY_OF_VALUES:
-		MEM(obj = json_value_array_afrom_pair_list(ctx, vps, format));
-		break;
-	case JSON_MODE_ARRAY_OF_NAMES:
-		MEM(obj = json_attr_array_afrom_pair_list(ctx, vps, format));
-		break;
-	default:
-		/* This should never happen */
-		fr_assert(0);
+	if (fr_json_pair_list_print(&sbuff, vps, format) < 0) {
+		talloc_free(sbuff.buff);
+		return NULL;
 	}
+	fr_sbuff_trim_talloc(&sbuff, SIZE_MAX);
 
-	/*
-	 *	p is a buff inside obj, and will be freed
-	 *	when it is freed.
-	 */
-	MEM(p = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
-	MEM(out = talloc_typed_strdup(ctx, p));
-
-	/*
-	 * Free the JSON structure, it's not needed any more
-	 */
-	json_object_put_assert(obj);
-
-	return out;
+	return sbuff.buff;
 }
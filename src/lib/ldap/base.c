@@ -680,6 +680,122 @@ finish:
 	return status;
 }
 
+/** Search for something in the LDAP directory, retrieving the results a page at a time
+ *
+ * Uses the paged results control (RFC 2696) so that the server only ever sends
+ * page_size entries at once.  Each entry is passed to func as soon as its page
+ * arrives, and the page is freed before the next one is requested, so memory
+ * use is bounded by the page size rather than the size of the result set.
+ *
+ * If libldap doesn't support the paged results control, or page_size is 0,
+ * a normal search is performed and all entries are passed to func.
+ *
+ * @param[in] request		Current request.
+ * @param[in,out] pconn		to use. May change as this function calls functions which auto re-connect.
+ * @param[in] dn		to use as base for the search.
+ * @param[in] scope		to use (LDAP_SCOPE_BASE, LDAP_SCOPE_ONE, LDAP_SCOPE_SUB).
+ * @param[in] filter		to use, should be pre-escaped.
+ * @param[in] attrs		to retrieve.
+ * @param[in] page_size		Maximum number of entries to retrieve per page.
+ * @param[in] func		to call for each entry.  A negative return value stops the search.
+ * @param[in] uctx		to pass to func.
+ * @return One of the LDAP_PROC_* (#fr_ldap_rcode_t) values.
+ */
+fr_ldap_rcode_t fr_ldap_search_paged(request_t *request, fr_ldap_connection_t **pconn,
+				     char const *dn, int scope, char const *filter, char const * const *attrs,
+				     int page_size, fr_ldap_search_entry_t func, void *uctx)
+{
+	fr_ldap_rcode_t		status;
+	LDAPMessage		*result, *entry;
+
+#ifdef LDAP_CONTROL_PAGEDRESULTS
+	struct berval		cookie = { .bv_len = 0, .bv_val = NULL };
+	int			pages = 0;
+
+	if (page_size > 0) for (;;) {
+		LDAPControl	*serverctrls[2] = { NULL, NULL };
+		LDAPControl	**ctrls = NULL;
+		LDAPMessage	*msg;
+
+		if (fr_ldap_control_paged_create(&serverctrls[0], *pconn, page_size,
+						 cookie.bv_val ? &cookie : NULL) < 0) {
+			ROPTIONAL(RPERROR, PERROR, "Failed creating paged results control");
+			status = LDAP_PROC_ERROR;
+			break;
+		}
+
+		status = fr_ldap_search(&result, request, pconn, dn, scope, filter, attrs, serverctrls, NULL);
+		ldap_control_free(serverctrls[0]);
+		if (status != LDAP_PROC_SUCCESS) {
+			/*
+			 *	An empty page after the first just means
+			 *	we've run out of entries.
+			 */
+			if ((status == LDAP_PROC_NO_RESULT) && (pages > 0)) status = LDAP_PROC_SUCCESS;
+			break;
+		}
+		pages++;
+
+		for (entry = ldap_first_entry((*pconn)->handle, result);
+		     entry;
+		     entry = ldap_next_entry((*pconn)->handle, entry)) {
+			if (func(*pconn, entry, uctx) < 0) {
+				ldap_msgfree(result);
+				status = LDAP_PROC_ERROR;
+				goto finish;
+			}
+		}
+
+		/*
+		 *	The cookie for the next page is in the
+		 *	controls of the search result message.
+		 */
+		for (msg = ldap_first_message((*pconn)->handle, result);
+		     msg;
+		     msg = ldap_next_message((*pconn)->handle, msg)) {
+			if (ldap_msgtype(msg) != LDAP_RES_SEARCH_RESULT) continue;
+
+			(void) ldap_parse_result((*pconn)->handle, msg, NULL, NULL, NULL, NULL, &ctrls, 0);
+			break;
+		}
+		ldap_msgfree(result);
+
+		if (fr_ldap_control_paged_cookie(&cookie, *pconn, ctrls) < 0) {
+			ROPTIONAL(RPERROR, PERROR, "Failed retrieving next page");
+			if (ctrls) ldap_controls_free(ctrls);
+			status = LDAP_PROC_ERROR;
+			break;
+		}
+		if (ctrls) ldap_controls_free(ctrls);
+
+		if (!cookie.bv_val) break;	/* Last page */
+
+		ROPTIONAL(RDEBUG3, DEBUG3, "Requesting page %i", pages + 1);
+	}
+
+finish:
+	if (cookie.bv_val) ber_memfree(cookie.bv_val);
+	if (page_size > 0) return status;
+#else
+	(void) page_size;
+#endif
+
+	status = fr_ldap_search(&result, request, pconn, dn, scope, filter, attrs, NULL, NULL);
+	if (status != LDAP_PROC_SUCCESS) return status;
+
+	for (entry = ldap_first_entry((*pconn)->handle, result);
+	     entry;
+	     entry = ldap_next_entry((*pconn)->handle, entry)) {
+		if (func(*pconn, entry, uctx) < 0) {
+			status = LDAP_PROC_ERROR;
+			break;
+		}
+	}
+	ldap_msgfree(result);
+
+	return status;
+}
+
 /** Search for something in the LDAP directory
  *
  * Binds as the administrative user and performs a search, dealing with any errors.
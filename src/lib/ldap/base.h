@@ -303,8 +303,21 @@ typedef struct {
 	fr_ldap_state_t		state;			//!< LDAP connection state machine.
 
 	void			*uctx;			//!< User data associated with the handle.
+
+	fr_time_t		acquired;		//!< When the handle was last taken from a pool.
 } fr_ldap_connection_t;
 
+/** Called for each entry returned by #fr_ldap_search_paged
+ *
+ * @param[in] conn	the entry was received on.
+ * @param[in] entry	to process.  Freed once the current page has been processed.
+ * @param[in] uctx	passed to #fr_ldap_search_paged.
+ * @return
+ *	- 0 to continue.
+ *	- -1 to stop the search.
+ */
+typedef int (*fr_ldap_search_entry_t)(fr_ldap_connection_t *conn, LDAPMessage *entry, void *uctx);
+
 /** Contains a collection of values
  *
  */
@@ -412,6 +425,10 @@ fr_ldap_rcode_t	fr_ldap_search(LDAPMessage **result, request_t *request,
 			       char const *dn, int scope, char const *filter, char const * const * attrs,
 			       LDAPControl **serverctrls, LDAPControl **clientctrls);
 
+fr_ldap_rcode_t	fr_ldap_search_paged(request_t *request, fr_ldap_connection_t **pconn,
+				     char const *dn, int scope, char const *filter, char const * const *attrs,
+				     int page_size, fr_ldap_search_entry_t func, void *uctx);
+
 fr_ldap_rcode_t	fr_ldap_search_async(int *msgid, request_t *request,
 				     fr_ldap_connection_t **pconn,
 				     char const *dn, int scope, char const *filter, char const * const *attrs,
@@ -454,6 +471,13 @@ void		fr_ldap_control_clear(fr_ldap_connection_t *conn);
 
 int		fr_ldap_control_add_session_tracking(fr_ldap_connection_t *conn, request_t *request);
 
+#ifdef LDAP_CONTROL_PAGEDRESULTS
+int		fr_ldap_control_paged_create(LDAPControl **out, fr_ldap_connection_t *conn,
+					     int page_size, struct berval *cookie);
+
+int		fr_ldap_control_paged_cookie(struct berval *cookie, fr_ldap_connection_t *conn, LDAPControl **ctrls);
+#endif
+
 /*
  *	directory.c - Get directory capabilities from the remote server
  */
@@ -294,3 +294,78 @@ int fr_ldap_control_add_session_tracking(fr_ldap_connection_t *conn, request_t *
 #endif
 
 
+
+#ifdef LDAP_CONTROL_PAGEDRESULTS
+/** Create a paged results control as per RFC 2696
+ *
+ * The control is marked as non-critical, so servers which don't support
+ * paging will return the complete result set instead.
+ *
+ * @param[out] out		Where to write the new control.  Must be freed with ldap_control_free.
+ * @param[in] conn		the control will be used with.
+ * @param[in] page_size		Maximum number of entries the server should return per page.
+ * @param[in] cookie		from the previous page, or NULL to request the first page.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_ldap_control_paged_create(LDAPControl **out, fr_ldap_connection_t *conn,
+				 int page_size, struct berval *cookie)
+{
+	int ret;
+
+	ret = ldap_create_page_control(conn->handle, page_size, cookie, 0, out);
+	if (ret != LDAP_SUCCESS) {
+		fr_strerror_printf("Failed creating paged results control: %s", ldap_err2string(ret));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Extract the cookie for the next page from a set of result controls
+ *
+ * @param[in,out] cookie	Any previous cookie is freed.  On return bv_val will be
+ *				NULL if there are no more pages, else it must be freed
+ *				with ber_memfree.
+ * @param[in] conn		the result was received on.
+ * @param[in] ctrls		from the search result message.  May be NULL.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_ldap_control_paged_cookie(struct berval *cookie, fr_ldap_connection_t *conn, LDAPControl **ctrls)
+{
+	LDAPControl	*ctrl;
+	ber_int_t	estimate;
+	int		ret;
+
+	if (cookie->bv_val) ber_memfree(cookie->bv_val);
+	cookie->bv_val = NULL;
+	cookie->bv_len = 0;
+
+	/*
+	 *	Server ignored the control, everything was
+	 *	returned in a single page.
+	 */
+	if (!ctrls) return 0;
+	ctrl = ldap_control_find(LDAP_CONTROL_PAGEDRESULTS, ctrls, NULL);
+	if (!ctrl) return 0;
+
+	ret = ldap_parse_pageresponse_control(conn->handle, ctrl, &estimate, cookie);
+	if (ret != LDAP_SUCCESS) {
+		fr_strerror_printf("Failed parsing paged results control: %s", ldap_err2string(ret));
+		return -1;
+	}
+
+	/*
+	 *	An empty cookie marks the last page
+	 */
+	if (cookie->bv_len == 0) {
+		if (cookie->bv_val) ber_memfree(cookie->bv_val);
+		cookie->bv_val = NULL;
+	}
+
+	return 0;
+}
+#endif
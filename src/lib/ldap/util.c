@@ -63,32 +63,39 @@ size_t fr_ldap_escape_func(UNUSED request_t *request, char *out, size_t outlen,
 	if (*in && ((*in == ' ') || (*in == '#'))) goto encode;
 
 	while (*in) {
+		size_t run;
+
 		/*
-		 *	Encode unsafe characters.
+		 *	Copy runs of characters which don't need
+		 *	encoding in one go.
 		 */
-		if (memchr(specials, *in, sizeof(specials) - 1)) {
-		encode:
-			/*
-			 *	Only 3 or less bytes available.
-			 */
-			if (left <= 3) break;
+		run = strcspn(in, specials);
+		if (run > 0) {
+			if (left <= 1) break;
+			if (run >= left) run = left - 1;
 
-			*out++ = '\\';
-			*out++ = hextab[(*in >> 4) & 0x0f];
-			*out++ = hextab[*in & 0x0f];
-			in++;
-			left -= 3;
+			memcpy(out, in, run);
+			in += run;
+			out += run;
+			left -= run;
 
 			continue;
 		}
 
-		if (left <= 1) break;
-
 		/*
-		 *	Doesn't need encoding
+		 *	Encode unsafe characters.
 		 */
-		*out++ = *in++;
-		left--;
+	encode:
+		/*
+		 *	Only 3 or less bytes available.
+		 */
+		if (left <= 3) break;
+
+		*out++ = '\\';
+		*out++ = hextab[(*in >> 4) & 0x0f];
+		*out++ = hextab[*in & 0x0f];
+		in++;
+		left -= 3;
 	}
 
 	*out = '\0';
@@ -85,9 +85,13 @@
  *   indexes in the fr_redis_cluster_t.node array.  We use 8bit unsigned integers instead of
  *   pointers to save space.  Using pointers, the node[] array would need 784K, using IDs
  *   it uses 112K.  Still not light on memory, but a bit more acceptable.
- *   Currently the key_slot array is shadowed by key_slot_pending, used to stage new key_slot
- *   mappings.  This doubles the memory used.  We may want to consider allocating key_slot_pending
- *   only during remappings and freeing it after.
+ *
+ *   The key_slot array lives in an immutable #fr_redis_cluster_map_t.  Remaps build a new
+ *   map, and publish it by incrementing the map epoch, so lookups never take the cluster mutex,
+ *   and never see a partially applied map.  There are two map slots, as in server/reload.c.
+ *   Lookups count themselves in to the slot they read from, and copy the key slot out, so a map
+ *   is only ever held for the length of a copy.  Before a slot is reused, the publisher waits
+ *   for its count to reach zero.
  *
  * Mapping/Remapping the cluster
  * -----------------------------
@@ -103,9 +107,9 @@
  *     4. Connecting to nodes that were in the result, but not in the tree.
  *        Note: If we can't connect to any of the masters, we count the map as invalid, roll
  *        back any newly connected nodes, and error out. Slave failure is OK.
- *     5. Mapping keyslot ranges to nodes in the key_slot_pending array.
+ *     5. Mapping keyslot ranges to nodes in a new key slot map.
  *     6. Verifying there are no holes in the ranges (if there are, we roll back and error out).
- *     7. Applying the new keyslot ranges.
+ *     7. Publishing the new map.
  *     8. Removing nodes no longer used by the key slots, and adding them back to the free
  *        nodes queue.
  *
@@ -120,7 +124,27 @@
  *   by following '-ASK' and '-MOVE' redirects.
  *
  *   Remaps are limited to one per second.  If any operation sets the remap_needed flag, or
- *   attempts a remap directly, the remap may be skipped if one occurred recently.
+ *   attempts a remap directly, the remap may be delayed if one occurred recently.
+ *
+ * The coordinator
+ * ---------------
+ *
+ *   After startup, workers never remap a cluster themselves.  #fr_redis_cluster_remap sends
+ *   the cluster's ID to a single coordinator thread, shared by all clusters, and returns
+ *   immediately.  The worker carries on using the current map.  Repeated requests for the
+ *   same cluster are coalesced until the coordinator picks them up.
+ *
+ *   The coordinator sends:
+ *
+ *     MULTI
+ *     CLUSTER INFO
+ *     CLUSTER SLOTS
+ *     EXEC
+ *
+ *   to all the masters in the cluster at once, then collects the replies.  The map from the
+ *   node with the highest 'cluster_current_epoch', then the highest 'cluster_size' wins.  For
+ *   equal values, the first map received is used.  Remaps which are rate limited, or which
+ *   fail while the cluster still needs remapping, are retried by the coordinator.
  *
  *
  * Processing '-ASK' and '-MOVE' redirects
@@ -149,9 +173,19 @@
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/server/cf_parse.h>
 
+#include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/fifo.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/syserror.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#include <fcntl.h>
 
 #include "base.h"
 #include "cluster.h"
@@ -159,8 +193,7 @@
 
 #define KEY_SLOTS		16384			//!< Maximum number of keyslots (should not change).
 
-#define MAX_SLAVES		5			//!< Maximum number of slaves associated
-							//!< with a keyslot.
+#define MAX_SLAVES		FR_REDIS_CLUSTER_MAX_SLAVES
 
 /*
  *	Periods and weights for live node selection
@@ -221,17 +254,14 @@ struct fr_redis_cluster_node_s {
 							//!< we need to issue to every master in the cluster.
 };
 
-/** Indexes in the fr_redis_cluster_node_t array for a single key slot
+/** An immutable map of key slots to nodes
  *
- * When dealing with 16K entries, space is a concern. It's significantly
- * more memory efficient to use 8bit indexes than 64bit pointers for each
- * of the key slot to node mappings.
+ * Once published, a map is never modified.  Remaps build a complete new
+ * map, and swap it in by incrementing the cluster's map epoch.
  */
-struct fr_redis_cluster_key_slot_s {
-	uint8_t			slave[MAX_SLAVES];	//!< R/O node (slave) for this key slot.
-	uint8_t			slave_num;		//!< Number of slaves associated with this key slot.
-	uint8_t			master;			//!< R/W node (master) for this key slot.
-};
+typedef struct {
+	fr_redis_cluster_key_slot_t	key_slot[KEY_SLOTS];	//!< Lookup table of slots to pools.
+} fr_redis_cluster_map_t;
 
 /** A redis cluster
  *
@@ -243,6 +273,15 @@ struct fr_redis_cluster {
 	fr_pair_list_t		trigger_args;		//!< Arguments to pass to triggers.
 	bool			triggers_enabled;	//!< Whether triggers are enabled.
 
+	uint16_t		id;			//!< Locally assigned ID, used to identify the
+							///< cluster to the coordinator.
+	bool			coordinated;		//!< Whether the cluster is registered with the
+							///< coordinator.
+	atomic_bool		remap_queued;		//!< A remap request has been sent to the coordinator,
+							///< and it hasn't started on it yet.
+	bool			remap_pending;		//!< Coordinator's view of outstanding remap requests.
+							///< Protected by the coordinator mutex.
+
 	bool			remapping;		//!< True when cluster is being remapped.
 	bool			remap_needed;		//!< Set true if at least one cluster node is definitely
 							//!< unreachable. Set false on successful remap.
@@ -258,12 +297,37 @@ struct fr_redis_cluster {
 	fr_fifo_t		*free_nodes;		//!< Queue of free nodes (or nodes waiting to be reused).
 	fr_rb_tree_t		*used_nodes;		//!< Tree of used nodes.
 
-	fr_redis_cluster_key_slot_t	key_slot[KEY_SLOTS];		//!< Lookup table of slots to pools.
-	fr_redis_cluster_key_slot_t	key_slot_pending[KEY_SLOTS];	//!< Pending key slot table.
+	atomic_uint_fast64_t	map_epoch;		//!< Incremented whenever a map is published.
+							///< The current map is map[map_epoch & 1].
+	fr_redis_cluster_map_t	*map[2];		//!< The current and previous maps.
+	atomic_uint_fast32_t	map_readers[2];		//!< Lookups currently reading each map.
 
 	pthread_mutex_t		mutex;			//!< Mutex to synchronise cluster operations.
 };
 
+/** Coordinates remaps for all clusters in the server
+ *
+ * Workers never remap a cluster themselves.  They send the cluster's ID
+ * to the coordinator over a pipe, and carry on using the current map,
+ * following redirects as needed.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Protects clusters, and serialises remaps.
+	fr_redis_cluster_t	**clusters;		//!< Registered clusters, indexed by ID.
+	unsigned int		num_clusters;		//!< How many clusters are registered.
+
+	fr_event_list_t		*el;			//!< Owned by the coordinator thread.
+	fr_event_timer_t const	*ev;			//!< Retries remaps which were rate limited, or failed.
+	int			wake[2];		//!< Remap requests, and exit notifications.
+	bool			exiting;		//!< Tell the coordinator thread to exit.
+
+	pthread_t		thread;
+	bool			started;		//!< Whether the coordinator thread has been started.
+} cluster_coordinator_t;
+
+static cluster_coordinator_t	*coordinator;
+static pthread_mutex_t		coordinator_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 fr_table_num_sorted_t const fr_redis_cluster_rcodes_table[] = {
 	{ L("bad-input"),	FR_REDIS_CLUSTER_RCODE_BAD_INPUT	},
 	{ L("failed"),		FR_REDIS_CLUSTER_RCODE_FAILED		},
@@ -318,6 +382,61 @@ static int8_t _cluster_node_cmp(void const *one, void const *two)
 	return CMP(a->addr.inet.dst_port, b->addr.inet.dst_port);
 }
 
+/** Copy a key slot out of the current map
+ *
+ * If a new map is published before we're counted in, the publisher may
+ * already be reusing the slot we read.  Try again with the new current
+ * map.
+ *
+ * @param[out] out	Where to copy the key slot.
+ * @param[in] cluster	to read the map of.
+ * @param[in] idx	of the key slot.
+ */
+static void cluster_key_slot_copy(fr_redis_cluster_key_slot_t *out, fr_redis_cluster_t *cluster, uint16_t idx)
+{
+	uint64_t	epoch;
+
+	for (;;) {
+		epoch = atomic_load(&cluster->map_epoch);
+
+		atomic_fetch_add(&cluster->map_readers[epoch & 1], 1);
+		if (atomic_load(&cluster->map_epoch) == epoch) break;
+		atomic_fetch_sub(&cluster->map_readers[epoch & 1], 1);
+	}
+
+	*out = cluster->map[epoch & 1]->key_slot[idx];
+
+	atomic_fetch_sub_explicit(&cluster->map_readers[epoch & 1], 1, memory_order_release);
+}
+
+/** Publish a new key slot map
+ *
+ * The new map replaces the previous one.  Lookups only hold a map for
+ * as long as it takes to copy a key slot, so the wait for them to
+ * finish with the previous map is short.
+ *
+ * @note Must be called with the cluster mutex held.
+ *
+ * @param[in] cluster	to publish the map for.
+ * @param[in] map	to publish.  Must not be modified afterwards.
+ */
+static void cluster_map_publish(fr_redis_cluster_t *cluster, fr_redis_cluster_map_t *map)
+{
+	uint64_t	epoch = atomic_load(&cluster->map_epoch);
+	unsigned int	slot = (epoch + 1) & 1;
+
+	while (atomic_load(&cluster->map_readers[slot]) > 0) {
+		struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000 };
+
+		(void) nanosleep(&ts, NULL);
+	}
+
+	TALLOC_FREE(cluster->map[slot]);
+	cluster->map[slot] = map;
+
+	atomic_store(&cluster->map_epoch, epoch + 1);
+}
+
 /** Reconnect callback to apply new pool config
  *
  * @param[in] pool to apply new configuration to.
@@ -527,6 +646,7 @@ static fr_redis_cluster_rcode_t cluster_map_apply(fr_redis_cluster_t *cluster, r
 	uint8_t		r = 0;
 
 	fr_redis_cluster_rcode_t	rcode;
+	fr_redis_cluster_map_t		*pending;
 
 	uint8_t		rollback[UINT8_MAX];		// Set of nodes to re-add to the queue on failure.
 	bool		active[UINT8_MAX];		// Set of nodes active in the new cluster map.
@@ -573,9 +693,10 @@ do { \
 	cluster->remapping = true;
 
 	/*
-	 *	Must be cleared with the mutex held
+	 *	Too big for the stack, and it's going to be
+	 *	published if the map is valid.
 	 */
-	memset(&cluster->key_slot_pending, 0, sizeof(cluster->key_slot_pending));
+	MEM(pending = talloc_zero(NULL, fr_redis_cluster_map_t));
 
 	/*
 	 *	Insert new nodes and markup the keyslot indexes
@@ -622,6 +743,7 @@ do { \
 			cluster->last_updated = time(NULL);
 			/* Re-insert new nodes back into the free_nodes queue */
 			for (i = 0; i < r; i++) SET_INACTIVE(&cluster->node[rollback[i]]);
+			talloc_free(pending);
 			return rcode;
 		}
 
@@ -679,8 +801,7 @@ do { \
 		 *	specified by the range for this map.
 		 */
 		for (k = map->element[0]->integer; k <= map->element[1]->integer; k++) {
-			memcpy(&cluster->key_slot_pending[k], &tmpl_slot,
-			       sizeof(*(cluster->key_slot_pending)));
+			memcpy(&pending->key_slot[k], &tmpl_slot, sizeof(pending->key_slot[k]));
 		}
 	}
 
@@ -696,7 +817,7 @@ do { \
 	 *	error out.
 	 */
 	for (i = 0; i < KEY_SLOTS; i++) {
-		if (cluster->key_slot_pending[i].master == 0) {
+		if (pending->key_slot[i].master == 0) {
 			fr_strerror_printf("Cluster is misconfigured, no node assigned for key %zu", i);
 			rcode = FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 			goto error;
@@ -707,12 +828,12 @@ do { \
 	 *	We have connections/pools for all the nodes in
 	 *	the new map, apply it to the live cluster.
 	 *
-	 *	Other workers may be using the key slot table,
+	 *	Other workers may still be using the old map,
 	 *	but that's ok. Nodes and pools are never freed,
 	 *	so the worst that will happen, is they'll hit
 	 *	the wrong node for the key, and get redirected.
 	 */
-	memcpy(&cluster->key_slot, &cluster->key_slot_pending, sizeof(cluster->key_slot));
+	cluster_map_publish(cluster, pending);
 
 	/*
 	 *	Anything not in the active set of nodes gets
@@ -831,49 +952,21 @@ static int cluster_map_node_validate(redisReply *node, int map_idx, int node_idx
 	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
 }
 
-/** Learn a new cluster layout by querying the node that issued the -MOVE
+/** Validate the response to a 'cluster slots' command
  *
- * Also validates the response from the Redis cluster, so we can be sure that
- * it's well formed, before doing more expensive operations.
+ * We need to do extensive validation to avoid SEGV on invalid data, due
+ * to the way libhiredis presents the result.
  *
  * @note Errors may be retrieved with fr_strerror().
  *
- * @param[out] out Where to write cluster map.
- * @param[in] conn to use for learning the new cluster map.
+ * @param[in] reply to 'cluster slots'.
  * @return
- *	- FR_REDIS_CLUSTER_RCODE_IGNORED if 'cluster slots' returned an error (indicating clustering not supported).
- *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
- *	- FR_REDIS_CLUSTER_RCODE_FAILED if issuing the command resulted in an error.
- *	- FR_REDIS_CLUSTER_RCODE_NO_CONNECTION connection failure.
+ *	- FR_REDIS_CLUSTER_RCODE_SUCCESS if the map is well formed.
  *	- FR_REDIS_CLUSTER_RCODE_BAD_INPUT on validation failure (bad data returned from Redis).
  */
-static fr_redis_cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
+static fr_redis_cluster_rcode_t cluster_map_validate(redisReply *reply)
 {
-	redisReply	*reply;
-	size_t		i = 0;
-
-	*out = NULL;
-
-	reply = redisCommand(conn->handle, "cluster slots");
-	switch (fr_redis_command_status(conn, reply)) {
-	case REDIS_RCODE_RECONNECT:
-		fr_redis_reply_free(&reply);
-		fr_strerror_const("No connections available");
-		return FR_REDIS_CLUSTER_RCODE_NO_CONNECTION;
-
-	case REDIS_RCODE_ERROR:
-	default:
-		if (reply && reply->type == REDIS_REPLY_ERROR) {
-			fr_strerror_printf("%.*s", (int)reply->len, reply->str);
-			fr_redis_reply_free(&reply);
-			return FR_REDIS_CLUSTER_RCODE_IGNORED;
-		}
-		fr_strerror_const("Unknown client error");
-		return FR_REDIS_CLUSTER_RCODE_FAILED;
-
-	case REDIS_RCODE_SUCCESS:
-		break;
-	}
+	size_t		i;
 
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		fr_strerror_printf("Bad response to \"cluster slots\" command, expected array got %s",
@@ -901,7 +994,6 @@ static fr_redis_cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_
 			fr_strerror_printf("Cluster map %zu is wrong type, expected array got %s",
 				   	   i, fr_table_str_by_value(redis_reply_types, map->type, "<UNKNOWN>"));
 		error:
-			fr_redis_reply_free(&reply);
 			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 		}
 
@@ -972,117 +1064,563 @@ static fr_redis_cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_
 			if (cluster_map_node_validate(map->element[j], i, j - 2) < 0) goto error;
 		}
 	}
-	*out = reply;
-
 	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
 }
 
-/** Perform a runtime remap of the cluster
+/** Learn a new cluster layout by querying the node that issued the -MOVE
+ *
+ * Also validates the response from the Redis cluster, so we can be sure that
+ * it's well formed, before doing more expensive operations.
  *
  * @note Errors may be retrieved with fr_strerror().
- * @note Must be called with the cluster mutex free.
  *
- * @param[in] request The current request.
- * @param[in,out] cluster to remap.
- * @param[in] conn to use to query the cluster.
+ * @param[out] out Where to write cluster map.
+ * @param[in] conn to use for learning the new cluster map.
  * @return
  *	- FR_REDIS_CLUSTER_RCODE_IGNORED if 'cluster slots' returned an error (indicating clustering not supported).
  *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
- *	- FR_REDIS_CLUSTER_RCODE_FAILED if issuing the 'cluster slots' command resulted in a protocol error.
+ *	- FR_REDIS_CLUSTER_RCODE_FAILED if issuing the command resulted in an error.
  *	- FR_REDIS_CLUSTER_RCODE_NO_CONNECTION connection failure.
  *	- FR_REDIS_CLUSTER_RCODE_BAD_INPUT on validation failure (bad data returned from Redis).
  */
-fr_redis_cluster_rcode_t fr_redis_cluster_remap(request_t *request, fr_redis_cluster_t *cluster, fr_redis_conn_t *conn)
+static fr_redis_cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
 {
-	time_t		now;
-	redisReply	*map;
+	redisReply			*reply;
 	fr_redis_cluster_rcode_t	ret;
-	size_t		i, j;
 
-	/*
-	 *	If the cluster was remapped very recently, or is being
-	 *	remapped it's unlikely that it needs remapping again.
-	 */
-	if (cluster->remapping) {
-	in_progress:
-		ROPTIONAL(RDEBUG2, DEBUG2, "Cluster remapping in progress, ignoring remap request");
-		return FR_REDIS_CLUSTER_RCODE_IGNORED;
-	}
+	*out = NULL;
 
-	now = time(NULL);
-	if (now == cluster->last_updated) {
-	too_soon:
-		ROPTIONAL(RWARN, WARN, "Cluster was updated less than a second ago, ignoring remap request");
-		return FR_REDIS_CLUSTER_RCODE_IGNORED;
-	}
+	reply = redisCommand(conn->handle, "cluster slots");
+	switch (fr_redis_command_status(conn, reply)) {
+	case REDIS_RCODE_RECONNECT:
+		fr_redis_reply_free(&reply);
+		fr_strerror_const("No connections available");
+		return FR_REDIS_CLUSTER_RCODE_NO_CONNECTION;
 
-	ROPTIONAL(RINFO, INFO, "Initiating cluster remap");
+	case REDIS_RCODE_ERROR:
+	default:
+		if (reply && reply->type == REDIS_REPLY_ERROR) {
+			fr_strerror_printf("%.*s", (int)reply->len, reply->str);
+			fr_redis_reply_free(&reply);
+			return FR_REDIS_CLUSTER_RCODE_IGNORED;
+		}
+		fr_strerror_const("Unknown client error");
+		return FR_REDIS_CLUSTER_RCODE_FAILED;
 
-	/*
-	 *	Get new cluster information
-	 */
-	ret = cluster_map_get(&map, conn);
-	switch (ret) {
-	case FR_REDIS_CLUSTER_RCODE_BAD_INPUT:		/* Validation error */
-	case FR_REDIS_CLUSTER_RCODE_NO_CONNECTION:		/* Connection error */
-	case FR_REDIS_CLUSTER_RCODE_FAILED:			/* Error issuing command */
+	case REDIS_RCODE_SUCCESS:
+		break;
+	}
+
+	ret = cluster_map_validate(reply);
+	if (ret < 0) {
+		fr_redis_reply_free(&reply);
 		return ret;
+	}
+	*out = reply;
 
-	case FR_REDIS_CLUSTER_RCODE_IGNORED:		/* Clustering not enabled, or not supported */
-		cluster->remap_needed = false;
-		return FR_REDIS_CLUSTER_RCODE_IGNORED;
+	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
+}
 
-	case FR_REDIS_CLUSTER_RCODE_SUCCESS:		/* Success */
-		break;
-	}
+/** Print a cluster map
+ *
+ * @param[in] cluster	the map is for.
+ * @param[in] map	a validated response to 'cluster slots'.
+ */
+static void cluster_map_debug(fr_redis_cluster_t *cluster, redisReply *map)
+{
+	size_t i, j;
 
-	/*
-	 *	Print the mapping we received
-	 */
-	ROPTIONAL(RINFO, INFO, "Cluster map consists of %zu key ranges", map->elements);
+	DEBUG("%s - Cluster map consists of %zu key ranges", cluster->log_prefix, map->elements);
 	for (i = 0; i < map->elements; i++) {
 		redisReply *map_node = map->element[i];
 
-		ROPTIONAL(RINFO, INFO, "%zu - keys %lli-%lli", i,
-			  map_node->element[0]->integer,
-			  map_node->element[1]->integer);
-
-		if (request) RINDENT();
-		ROPTIONAL(RINFO, INFO, "master: %s:%lli",
-			  map_node->element[2]->element[0]->str,
-			  map_node->element[2]->element[1]->integer);
+		DEBUG("%s - %zu - keys %lli-%lli", cluster->log_prefix, i,
+		      map_node->element[0]->integer,
+		      map_node->element[1]->integer);
+		DEBUG("%s -  master: %s:%lli", cluster->log_prefix,
+		      map_node->element[2]->element[0]->str,
+		      map_node->element[2]->element[1]->integer);
 		for (j = 3; j < map_node->elements; j++) {
-			ROPTIONAL(RINFO, INFO, "slave%zu: %s:%lli", j - 3,
-				  map_node->element[j]->element[0]->str,
-				  map_node->element[j]->element[1]->integer);
+			DEBUG("%s -  slave%zu: %s:%lli", cluster->log_prefix, j - 3,
+			      map_node->element[j]->element[0]->str,
+			      map_node->element[j]->element[1]->integer);
 		}
-		if (request) REXDENT();
 	}
+}
+
+/** Extract the epoch and cluster size from the response to 'cluster info'
+ *
+ * Missing fields are left as 0, so maps from nodes which don't report them
+ * lose to any node which does.
+ *
+ * @param[out] epoch	the value of cluster_current_epoch.
+ * @param[out] size	the value of cluster_size.
+ * @param[in] info	response to 'cluster info'.
+ */
+static void cluster_info_parse(uint64_t *epoch, uint64_t *size, redisReply const *info)
+{
+	char const *p;
+
+	*epoch = 0;
+	*size = 0;
+
+	if (info->type != REDIS_REPLY_STRING) return;
+
+	p = strstr(info->str, "cluster_current_epoch:");
+	if (p) *epoch = strtoull(p + sizeof("cluster_current_epoch:") - 1, NULL, 10);
+
+	p = strstr(info->str, "cluster_size:");
+	if (p) *size = strtoull(p + sizeof("cluster_size:") - 1, NULL, 10);
+}
+
+/** Remap a cluster by querying all of its masters at once
+ *
+ * @note Only called by the coordinator thread, and at most once a second per cluster.
+ * @note Errors may be retrieved with fr_strerror().
+ * @note Must be called with the cluster mutex free.
+ *
+ * @param[in,out] cluster to remap.
+ * @return
+ *	- FR_REDIS_CLUSTER_RCODE_IGNORED if all nodes returned errors for 'cluster slots'
+ *	  (indicating clustering not supported).
+ *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
+ *	- FR_REDIS_CLUSTER_RCODE_FAILED if no valid map was received, or it couldn't be applied.
+ *	- FR_REDIS_CLUSTER_RCODE_NO_CONNECTION if we couldn't contact any nodes.
+ */
+static fr_redis_cluster_rcode_t cluster_remap(fr_redis_cluster_t *cluster)
+{
+	fr_redis_cluster_node_t		*nodes[UINT8_MAX];
+	fr_redis_conn_t			*conns[UINT8_MAX];
+	fr_redis_cluster_node_t		*node;
+	fr_rb_iter_inorder_t		iter;
+	unsigned int			i, num = 0, queried = 0, ignored = 0;
+
+	redisReply			*best = NULL;
+	uint64_t			best_epoch = 0, best_size = 0;
+	fr_redis_cluster_rcode_t	ret;
 
 	/*
-	 *	Check again that the cluster isn't being
-	 *	remapped, or was remapped too recently,
-	 *	now we hold the mutex and the state of
-	 *	those variables is synchronized.
+	 *	Ask every master.  If we don't know which nodes
+	 *	are masters, i.e. we never got a valid map, ask
+	 *	every node we know about.
+	 *
+	 *	Nodes and pools are never freed, so it's fine to
+	 *	use them after releasing the mutex.
 	 */
 	pthread_mutex_lock(&cluster->mutex);
-	if (cluster->remapping) {
-		pthread_mutex_unlock(&cluster->mutex);
-		fr_redis_reply_free(&map);	/* Free the map */
-		goto in_progress;
+	for (node = fr_rb_iter_init_inorder(&iter, cluster->used_nodes);
+	     node;
+	     node = fr_rb_iter_next_inorder(&iter)) {
+		if (node->is_master) nodes[num++] = node;
 	}
-	if (now == cluster->last_updated) {
-		pthread_mutex_unlock(&cluster->mutex);
-		fr_redis_reply_free(&map);	/* Free the map */
-		goto too_soon;
+	if (!num) for (node = fr_rb_iter_init_inorder(&iter, cluster->used_nodes);
+		       node;
+		       node = fr_rb_iter_next_inorder(&iter)) {
+		nodes[num++] = node;
+	}
+	pthread_mutex_unlock(&cluster->mutex);
+
+	INFO("%s - Initiating cluster remap, querying %u node(s)", cluster->log_prefix, num);
+
+	/*
+	 *	Queue the commands on a connection to each node,
+	 *	then write them all out before reading any replies,
+	 *	so that the nodes process them concurrently.
+	 */
+	for (i = 0; i < num; i++) {
+		int done = 0;
+
+		conns[i] = fr_pool_connection_get(nodes[i]->pool, NULL);
+		if (!conns[i]) continue;
+
+		if ((redisAppendCommand(conns[i]->handle, "MULTI") != REDIS_OK) ||
+		    (redisAppendCommand(conns[i]->handle, "CLUSTER INFO") != REDIS_OK) ||
+		    (redisAppendCommand(conns[i]->handle, "CLUSTER SLOTS") != REDIS_OK) ||
+		    (redisAppendCommand(conns[i]->handle, "EXEC") != REDIS_OK)) {
+		close:
+			WARN("%s - [%i] Failed querying %s:%i", cluster->log_prefix,
+			     nodes[i]->id, nodes[i]->name, nodes[i]->addr.inet.dst_port);
+			fr_pool_connection_close(nodes[i]->pool, NULL, conns[i]);
+			conns[i] = NULL;
+			continue;
+		}
+
+		do {
+			if (redisBufferWrite(conns[i]->handle, &done) != REDIS_OK) goto close;
+		} while (!done);
+	}
+
+	for (i = 0; i < num; i++) {
+		redisReply	*reply = NULL;
+		uint64_t	epoch, size;
+		unsigned int	j;
+
+		if (!conns[i]) continue;
+
+		/*
+		 *	MULTI, the two QUEUED responses, then
+		 *	EXEC with the results of both commands.
+		 */
+		for (j = 0; j < 4; j++) {
+			fr_redis_reply_free(&reply);
+			if (redisGetReply(conns[i]->handle, (void **)&reply) != REDIS_OK) break;
+		}
+		if (j < 4) {
+			WARN("%s - [%i] Failed reading cluster map from %s:%i", cluster->log_prefix,
+			     nodes[i]->id, nodes[i]->name, nodes[i]->addr.inet.dst_port);
+			fr_redis_reply_free(&reply);
+			fr_pool_connection_close(nodes[i]->pool, NULL, conns[i]);
+			continue;
+		}
+		fr_pool_connection_release(nodes[i]->pool, NULL, conns[i]);
+		queried++;
+
+		if ((reply->type != REDIS_REPLY_ARRAY) || (reply->elements != 2)) {
+			WARN("%s - [%i] Bad response to cluster map transaction from %s:%i", cluster->log_prefix,
+			     nodes[i]->id, nodes[i]->name, nodes[i]->addr.inet.dst_port);
+			fr_redis_reply_free(&reply);
+			continue;
+		}
+
+		/*
+		 *	Clustering not enabled, or not supported
+		 */
+		if (reply->element[1]->type == REDIS_REPLY_ERROR) {
+			DEBUG2("%s - [%i] %s:%i returned \"%s\"", cluster->log_prefix,
+			       nodes[i]->id, nodes[i]->name, nodes[i]->addr.inet.dst_port, reply->element[1]->str);
+			fr_redis_reply_free(&reply);
+			ignored++;
+			continue;
+		}
+
+		if (cluster_map_validate(reply->element[1]) < 0) {
+			PWARN("%s - [%i] %s:%i returned an invalid cluster map", cluster->log_prefix,
+			      nodes[i]->id, nodes[i]->name, nodes[i]->addr.inet.dst_port);
+			fr_redis_reply_free(&reply);
+			continue;
+		}
+
+		/*
+		 *	Highest epoch, then the largest cluster wins.
+		 *	For equal values, the first map wins.
+		 */
+		cluster_info_parse(&epoch, &size, reply->element[0]);
+		if (best && ((epoch < best_epoch) || ((epoch == best_epoch) && (size <= best_size)))) {
+			fr_redis_reply_free(&reply);
+			continue;
+		}
+
+		fr_redis_reply_free(&best);
+		best = reply;
+		best_epoch = epoch;
+		best_size = size;
+	}
+
+	if (!best) {
+		if (!queried) {
+			fr_strerror_const("No connections available");
+			return FR_REDIS_CLUSTER_RCODE_NO_CONNECTION;
+		}
+
+		if (ignored == queried) {
+			cluster->remap_needed = false;
+			return FR_REDIS_CLUSTER_RCODE_IGNORED;
+		}
+
+		fr_strerror_const("No nodes returned a valid cluster map");
+		return FR_REDIS_CLUSTER_RCODE_FAILED;
 	}
-	ret = cluster_map_apply(cluster, map);
+
+	DEBUG2("%s - Using map with epoch %" PRIu64 " and cluster size %" PRIu64,
+	       cluster->log_prefix, best_epoch, best_size);
+	cluster_map_debug(cluster, best->element[1]);
+
+	pthread_mutex_lock(&cluster->mutex);
+	ret = cluster_map_apply(cluster, best->element[1]);
 	if (ret == FR_REDIS_CLUSTER_RCODE_SUCCESS) cluster->remap_needed = false;	/* Change on successful remap */
 	pthread_mutex_unlock(&cluster->mutex);
 
-	fr_redis_reply_free(&map);	/* Free the map */
+	fr_redis_reply_free(&best);	/* Free the map */
 	if (ret < 0) return FR_REDIS_CLUSTER_RCODE_FAILED;
 
+	INFO("%s - Cluster remap complete", cluster->log_prefix);
+
+	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
+}
+
+static void _coordinator_retry(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+/** Perform any remaps which have been requested
+ *
+ */
+static void coordinator_process(cluster_coordinator_t *coord)
+{
+	size_t	i;
+	time_t	now = time(NULL);
+	bool	retry = false;
+
+	pthread_mutex_lock(&coord->mutex);
+	for (i = 0; i < talloc_array_length(coord->clusters); i++) {
+		fr_redis_cluster_t *cluster = coord->clusters[i];
+
+		if (!cluster || !cluster->remap_pending) continue;
+
+		/*
+		 *	At most one remap a second.  Come back to
+		 *	this one later.
+		 */
+		if (now == cluster->last_updated) {
+			retry = true;
+			continue;
+		}
+
+		/*
+		 *	Requests received from here on need
+		 *	another remap, as workers may have
+		 *	seen new errors.
+		 */
+		cluster->remap_pending = false;
+		atomic_store_explicit(&cluster->remap_queued, false, memory_order_release);
+
+		if (cluster_remap(cluster) >= 0) continue;
+
+		PERROR("%s - Cluster remap failed", cluster->log_prefix);
+		if (cluster->remap_needed) {
+			cluster->remap_pending = true;
+			retry = true;
+		}
+	}
+	pthread_mutex_unlock(&coord->mutex);
+
+	if (retry && (fr_event_timer_in(coord->el, coord->el, &coord->ev, fr_time_delta_from_sec(1),
+					_coordinator_retry, coord) < 0)) {
+		PERROR("Failed scheduling redis cluster remap");
+	}
+}
+
+static void _coordinator_retry(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	coordinator_process(uctx);
+}
+
+/** Read remap requests from workers
+ *
+ * Each request is the ID of the cluster to remap.
+ */
+static void coordinator_wake(fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	cluster_coordinator_t	*coord = uctx;
+	uint16_t		ids[64];
+	ssize_t			len;
+	size_t			i;
+
+	for (;;) {
+		len = read(fd, ids, sizeof(ids));
+		if (len < 0) {
+			if (errno == EINTR) continue;
+			break;			/* EWOULDBLOCK, everything's been read */
+		}
+		if (len == 0) break;
+
+		pthread_mutex_lock(&coord->mutex);
+		for (i = 0; i < ((size_t)len / sizeof(ids[0])); i++) {
+			if ((ids[i] >= talloc_array_length(coord->clusters)) || !coord->clusters[ids[i]]) continue;
+
+			coord->clusters[ids[i]]->remap_pending = true;
+		}
+		pthread_mutex_unlock(&coord->mutex);
+	}
+
+	if (coord->exiting) {
+		fr_event_loop_exit(el, 1);
+		return;
+	}
+
+	coordinator_process(coord);
+}
+
+static void *coordinator_thread(void *arg)
+{
+	cluster_coordinator_t	*coord = arg;
+
+	if (fr_event_fd_insert(coord->el, coord->el, coord->wake[0], coordinator_wake, NULL, NULL, coord) < 0) {
+		PERROR("Failed inserting redis coordinator wakeup pipe");
+		return NULL;
+	}
+
+	(void) fr_event_loop(coord->el);
+
+	(void) fr_event_fd_delete(coord->el, coord->wake[0], FR_EVENT_FILTER_IO);
+
+	return NULL;
+}
+
+/** Stop the coordinator thread, and free the coordinator
+ *
+ * @note Must be called with the coordinator_mutex held.
+ */
+static void coordinator_free(void)
+{
+	if (coordinator->started) {
+		uint16_t id = UINT16_MAX;	/* Never a valid ID */
+
+		coordinator->exiting = true;
+		while ((write(coordinator->wake[1], &id, sizeof(id)) < 0) && (errno == EINTR));
+		pthread_join(coordinator->thread, NULL);
+	}
+
+	TALLOC_FREE(coordinator->el);
+
+	if (coordinator->wake[0] >= 0) close(coordinator->wake[0]);
+	if (coordinator->wake[1] >= 0) close(coordinator->wake[1]);
+
+	pthread_mutex_destroy(&coordinator->mutex);
+	TALLOC_FREE(coordinator);
+}
+
+/** Register a cluster with the coordinator, starting it if required
+ *
+ * Assigns the cluster an ID, which workers use to request remaps.
+ *
+ * @param[in] cluster	to register.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int cluster_coordinator_register(fr_redis_cluster_t *cluster)
+{
+	size_t	i, len;
+	int	ret;
+
+	pthread_mutex_lock(&coordinator_mutex);
+	if (!coordinator) {
+		MEM(coordinator = talloc_zero(NULL, cluster_coordinator_t));
+		coordinator->wake[0] = coordinator->wake[1] = -1;
+		pthread_mutex_init(&coordinator->mutex, NULL);
+
+		if (pipe(coordinator->wake) < 0) {
+			fr_strerror_printf("Failed creating wakeup pipe: %s", fr_syserror(errno));
+		error:
+			coordinator_free();
+			pthread_mutex_unlock(&coordinator_mutex);
+			return -1;
+		}
+
+		/*
+		 *	Workers must never block on the pipe, and
+		 *	the coordinator drains it.
+		 */
+		if ((fr_nonblock(coordinator->wake[0]) < 0) || (fr_nonblock(coordinator->wake[1]) < 0)) {
+			fr_strerror_printf("Failed setting wakeup pipe non-blocking: %s", fr_syserror(errno));
+			goto error;
+		}
+
+		coordinator->el = fr_event_list_alloc(NULL, NULL, NULL);
+		if (!coordinator->el) {
+			fr_strerror_const_push("Failed allocating coordinator event list");
+			goto error;
+		}
+
+		ret = pthread_create(&coordinator->thread, NULL, coordinator_thread, coordinator);
+		if (ret != 0) {
+			fr_strerror_printf("Failed starting redis coordinator thread: %s", fr_syserror(ret));
+			goto error;
+		}
+		coordinator->started = true;
+	}
+
+	pthread_mutex_lock(&coordinator->mutex);
+	len = talloc_array_length(coordinator->clusters);
+	for (i = 0; i < len; i++) if (!coordinator->clusters[i]) break;
+	if (i == len) {
+		if (len >= UINT16_MAX) {
+			pthread_mutex_unlock(&coordinator->mutex);
+			pthread_mutex_unlock(&coordinator_mutex);
+			fr_strerror_const("Too many redis clusters");
+			return -1;
+		}
+		MEM(coordinator->clusters = talloc_realloc(coordinator, coordinator->clusters,
+							   fr_redis_cluster_t *, len + 1));
+	}
+	coordinator->clusters[i] = cluster;
+	coordinator->num_clusters++;
+	pthread_mutex_unlock(&coordinator->mutex);
+
+	cluster->id = (uint16_t) i;
+	cluster->coordinated = true;
+
+	pthread_mutex_unlock(&coordinator_mutex);
+
+	return 0;
+}
+
+/** Remove a cluster from the coordinator, stopping it if this was the last cluster
+ *
+ * Waits for any remap of the cluster which is in progress to complete.
+ *
+ * @param[in] cluster	to unregister.
+ */
+static void cluster_coordinator_unregister(fr_redis_cluster_t *cluster)
+{
+	if (!cluster->coordinated) return;
+
+	pthread_mutex_lock(&coordinator_mutex);
+
+	pthread_mutex_lock(&coordinator->mutex);
+	coordinator->clusters[cluster->id] = NULL;
+	coordinator->num_clusters--;
+	pthread_mutex_unlock(&coordinator->mutex);
+
+	cluster->coordinated = false;
+
+	if (!coordinator->num_clusters) coordinator_free();
+
+	pthread_mutex_unlock(&coordinator_mutex);
+}
+
+/** Request a runtime remap of the cluster
+ *
+ * The remap is performed asynchronously by the coordinator thread.  The
+ * caller should carry on using the current map, which will be replaced
+ * once the remap completes.
+ *
+ * @note Errors may be retrieved with fr_strerror().
+ *
+ * @param[in] request The current request.  May be NULL.
+ * @param[in] cluster to remap.
+ * @return
+ *	- FR_REDIS_CLUSTER_RCODE_IGNORED if a remap has already been requested, or
+ *	  the cluster has no coordinator (we're only checking the config).
+ *	- FR_REDIS_CLUSTER_RCODE_SUCCESS if the remap was queued.
+ *	- FR_REDIS_CLUSTER_RCODE_FAILED if the coordinator couldn't be signalled.
+ */
+fr_redis_cluster_rcode_t fr_redis_cluster_remap(request_t *request, fr_redis_cluster_t *cluster)
+{
+	uint16_t	id = cluster->id;
+
+	if (!cluster->coordinated) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "Cluster has no coordinator, ignoring remap request");
+		return FR_REDIS_CLUSTER_RCODE_IGNORED;
+	}
+
+	/*
+	 *	Only one request per cluster needs to be
+	 *	outstanding.  The coordinator clears the
+	 *	flag when it starts the remap.
+	 */
+	if (atomic_exchange_explicit(&cluster->remap_queued, true, memory_order_acq_rel)) {
+		ROPTIONAL(RDEBUG3, DEBUG3, "Cluster remap already queued");
+		return FR_REDIS_CLUSTER_RCODE_IGNORED;
+	}
+
+	if (write(coordinator->wake[1], &id, sizeof(id)) != sizeof(id)) {
+		fr_strerror_printf("Failed queuing cluster remap: %s", fr_syserror(errno));
+		atomic_store_explicit(&cluster->remap_queued, false, memory_order_release);
+		return FR_REDIS_CLUSTER_RCODE_FAILED;
+	}
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Queued cluster remap");
+
 	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
 }
 
@@ -1546,38 +2084,39 @@ void *fr_redis_cluster_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delt
  * If there's only a single node in the cluster, then we avoid the CRC16
  * and just use key slot 0.
  *
+ * The key slot is copied out of the current map, so it remains valid
+ * after the map is replaced.
+ *
+ * @param[out] out where to write the key slot the key resolves to.
  * @param cluster to determine key slot for.
  * @param request The current request.
  * @param key the key to resolve.
  * @param key_len the length of the key.
- * @return pointer to key slot key resolves to.
  */
-fr_redis_cluster_key_slot_t const *fr_redis_cluster_slot_by_key(fr_redis_cluster_t *cluster, request_t *request,
-								uint8_t const *key, size_t key_len)
+void fr_redis_cluster_slot_by_key(fr_redis_cluster_key_slot_t *out, fr_redis_cluster_t *cluster, request_t *request,
+				  uint8_t const *key, size_t key_len)
 {
-	fr_redis_cluster_key_slot_t *key_slot;
+	uint16_t	idx;
 
 	if (!key || (key_len == 0)) {
-		key_slot = &cluster->key_slot[(uint16_t)(fr_rand() & (KEY_SLOTS - 1))];
-		ROPTIONAL(RDEBUG2, DEBUG2, "Key rand() -> slot %zu", key_slot - cluster->key_slot);
-
-		return key_slot;
-	}
+		idx = (uint16_t)(fr_rand() & (KEY_SLOTS - 1));
+		ROPTIONAL(RDEBUG2, DEBUG2, "Key rand() -> slot %u", idx);
 
 	/*
 	 *	Avoid CRC16 if we're operating with one cluster node or
 	 *	without clustering.
 	 */
-	if (fr_rb_num_elements(cluster->used_nodes) > 1) {
-		key_slot = &cluster->key_slot[cluster_key_hash(key, key_len)];
-		ROPTIONAL(RDEBUG2, DEBUG2, "Key \"%pV\" -> slot %zu",
-			  fr_box_strvalue_len((char const *)key, key_len), key_slot - cluster->key_slot);
+	} else if (fr_rb_num_elements(cluster->used_nodes) > 1) {
+		idx = cluster_key_hash(key, key_len);
+		ROPTIONAL(RDEBUG2, DEBUG2, "Key \"%pV\" -> slot %u",
+			  fr_box_strvalue_len((char const *)key, key_len), idx);
 
-		return key_slot;
+	} else {
+		ROPTIONAL(RDEBUG3, DEBUG3, "Single node available, skipping key selection");
+		idx = 0;
 	}
-	ROPTIONAL(RDEBUG3, DEBUG3, "Single node available, skipping key selection");
 
-	return &cluster->key_slot[0];
+	cluster_key_slot_copy(out, cluster, idx);
 }
 
 /** Return the master node that would be used for a particular key
@@ -1695,7 +2234,7 @@ fr_redis_rcode_t fr_redis_cluster_state_init(fr_redis_cluster_state_t *state, fr
 					     uint8_t const *key, size_t key_len, bool read_only)
 {
 	fr_redis_cluster_node_t			*node;
-	fr_redis_cluster_key_slot_t const	*key_slot;
+	fr_redis_cluster_key_slot_t		key_slot;
 	uint8_t					first, i;
 	uint64_t				used_nodes;
 
@@ -1712,24 +2251,24 @@ fr_redis_rcode_t fr_redis_cluster_state_init(fr_redis_cluster_state_t *state, fr
 		return REDIS_RCODE_RECONNECT;
 	}
 
-again:
-	key_slot = fr_redis_cluster_slot_by_key(cluster, request, key, key_len);
+	fr_redis_cluster_slot_by_key(&key_slot, cluster, request, key, key_len);
 
 	/*
 	 *	1. Try each of the slaves for the key slot
 	 *	2. Fall through to trying the master, and a single alternate node.
 	 */
 	if (read_only) {
-		first = fr_rand() & key_slot->slave_num;
-		for (i = 0; i < key_slot->slave_num; i++) {
+		first = fr_rand() & key_slot.slave_num;
+		for (i = 0; i < key_slot.slave_num; i++) {
 			uint8_t node_id;
 
-			node_id = key_slot->slave[(first + i) % key_slot->slave_num];
+			node_id = key_slot.slave[(first + i) % key_slot.slave_num];
 			node = &cluster->node[node_id];
 			*conn = fr_pool_connection_get(node->pool, request);
 			if (!*conn) {
-				ROPTIONAL(RDEBUG2, DEBUG2, "[%i] No connections available (key slot %zu slave %i)",
-					  node->id, key_slot - cluster->key_slot, (first + i) % key_slot->slave_num);
+				ROPTIONAL(RDEBUG2, DEBUG2, "[%i] No connections available (%s:%i, slave %i)",
+					  node->id, node->name, node->addr.inet.dst_port,
+					  (first + i) % key_slot.slave_num);
 				cluster->remap_needed = true;
 				continue;	/* Continue until we find a live pool */
 			}
@@ -1745,11 +2284,11 @@ again:
 	 *	3. If there are no pools, or we can't reserve a handle,
 	 *	   give up.
 	 */
-	node = &cluster->node[key_slot->master];
+	node = &cluster->node[key_slot.master];
 	*conn = fr_pool_connection_get(node->pool, request);
 	if (!*conn) {
-		ROPTIONAL(RDEBUG2, DEBUG2, "[%i] No connections available (key slot %zu master)",
-			  node->id, key_slot - cluster->key_slot);
+		ROPTIONAL(RDEBUG2, DEBUG2, "[%i] No connections available (%s:%i, master)",
+			  node->id, node->name, node->addr.inet.dst_port);
 		cluster->remap_needed = true;
 
 		if (cluster_node_find_live(&node, conn, request, cluster, node) < 0) return REDIS_RCODE_RECONNECT;
@@ -1757,13 +2296,11 @@ again:
 
 finish:
 	/*
-	 *	Something set the remap_needed flag, and we have a live connection
+	 *	Something set the remap_needed flag.  Ask the
+	 *	coordinator for a new map, and carry on with
+	 *	the live connection we found.
 	 */
-	if (cluster->remap_needed) {
-		if (fr_redis_cluster_remap(request, cluster, *conn) == FR_REDIS_CLUSTER_RCODE_SUCCESS) {
-			fr_pool_connection_release(node->pool, request, *conn);
-			goto again;	/* New map, try again */
-		}
+	if (cluster->remap_needed && (fr_redis_cluster_remap(request, cluster) < 0)) {
 		ROPTIONAL(RPDEBUG2, PDEBUG2, "%s", "");
 	}
 
@@ -1835,21 +2372,12 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 	}
 
 	/*
-	 *	If we have a proven live connection, and something
-	 *	has set the remap_needed flag, do that now before
-	 *	releasing the connection.
+	 *	If something has set the remap_needed flag, ask
+	 *	the coordinator for a new map.  The coordinator
+	 *	clears the flag on a successful remap.
 	 */
-	if (cluster->remap_needed && *conn) switch(status) {
-	case REDIS_RCODE_MOVE:		/* We're going to remap anyway */
-	case REDIS_RCODE_RECONNECT:	/* The connection's dead */
-		break;
-
-	default:
-		/*
-		 *	Remap the cluster. On success, will clear the
-		 *	remap_needed flag.
-		 */
-		if (fr_redis_cluster_remap(request, cluster, *conn) != FR_REDIS_CLUSTER_RCODE_SUCCESS)
+	if (cluster->remap_needed && (status != REDIS_RCODE_MOVE) &&	/* We're going to remap anyway */
+	    (fr_redis_cluster_remap(request, cluster) < 0)) {
 		ROPTIONAL(RPDEBUG2, PDEBUG2, "%s", "");
 	}
 
@@ -1895,7 +2423,7 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 	 */
 	case REDIS_RCODE_RECONNECT:
 	{
-		fr_redis_cluster_key_slot_t const *key_slot;
+		fr_redis_cluster_key_slot_t key_slot;
 
 		ROPTIONAL(RPERROR, PERROR, "[%i] Failed communicating with %s:%i",
 			  state->node->id, state->node->name,
@@ -1912,8 +2440,8 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 		/*
 		 *	Refresh the key slot
 		 */
-		key_slot = fr_redis_cluster_slot_by_key(cluster, request, state->key, state->key_len);
-		state->node = &cluster->node[key_slot->master];
+		fr_redis_cluster_slot_by_key(&key_slot, cluster, request, state->key, state->key_len);
+		state->node = &cluster->node[key_slot.master];
 
 		*conn = fr_pool_connection_get(state->node->pool, request);
 		if (!*conn) {
@@ -1938,9 +2466,7 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 	case REDIS_RCODE_MOVE:
 		fr_assert(*reply);
 
-		if (*conn && (fr_redis_cluster_remap(request, cluster, *conn) != FR_REDIS_CLUSTER_RCODE_SUCCESS)) {
-			ROPTIONAL(RPDEBUG2, PDEBUG2, "%s", "");
-		}
+		if (fr_redis_cluster_remap(request, cluster) < 0) ROPTIONAL(RPDEBUG2, PDEBUG2, "%s", "");
 		FALL_THROUGH;
 
 	/*
@@ -2125,13 +2651,18 @@ ssize_t fr_redis_cluster_node_addr_by_role(TALLOC_CTX *ctx, fr_socket_t *out[],
 	return count;
 }
 
-/** Destroy mutex associated with cluster slots structure
+/** Unregister the cluster from the coordinator, and free its maps
  *
  * @param cluster being freed.
  * @return 0
  */
 static int _fr_redis_cluster_free(fr_redis_cluster_t *cluster)
 {
+	cluster_coordinator_unregister(cluster);
+
+	TALLOC_FREE(cluster->map[0]);
+	TALLOC_FREE(cluster->map[1]);
+
 	pthread_mutex_destroy(&cluster->mutex);
 
 	return 0;
@@ -2224,6 +2755,7 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 
 	uint64_t		num_nodes;
 	fr_redis_cluster_t	*cluster;
+	fr_redis_cluster_map_t	*fallback;
 
 	fr_assert(triggers_enabled || !trigger_prefix);
 	fr_assert(triggers_enabled || (!trigger_args || fr_pair_list_empty(trigger_args)));
@@ -2324,6 +2856,16 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 	pthread_mutex_init(&cluster->mutex, NULL);
 	talloc_set_destructor(cluster, _fr_redis_cluster_free);
 
+	/*
+	 *	Lookups always have a map to use, even if it's
+	 *	empty.
+	 */
+	atomic_init(&cluster->remap_queued, false);
+	MEM(cluster->map[0] = talloc_zero(NULL, fr_redis_cluster_map_t));
+	atomic_init(&cluster->map_epoch, 0);
+	atomic_init(&cluster->map_readers[0], 0);
+	atomic_init(&cluster->map_readers[1], 0);
+
 	/*
 	 *	Node id 0 is reserved, so we can detect misconfigured
 	 *	clusters.
@@ -2358,7 +2900,6 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 		fr_redis_cluster_node_t	*node;
 		fr_redis_conn_t	*conn;
 		redisReply	*map;
-		size_t		j, k;
 
 		node = fr_fifo_peek(cluster->free_nodes);
 		if (!node) {
@@ -2415,22 +2956,7 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 		case FR_REDIS_CLUSTER_RCODE_SUCCESS:
 			fr_pool_connection_release(node->pool, NULL, conn);
 
-			DEBUG("%s - Cluster map consists of %zu key ranges", cluster->log_prefix, map->elements);
-			for (j = 0; j < map->elements; j++) {
-				redisReply *map_node = map->element[j];
-
-				DEBUG("%s - %zu - keys %lli-%lli", cluster->log_prefix, j,
-				      map_node->element[0]->integer,
-				      map_node->element[1]->integer);
-				DEBUG("%s -  master: %s:%lli", cluster->log_prefix,
-				      map_node->element[2]->element[0]->str,
-				      map_node->element[2]->element[1]->integer);
-				for (k = 3; k < map_node->elements; k++) {
-					DEBUG("%s -  slave%zu: %s:%lli", cluster->log_prefix, k - 3,
-					      map_node->element[k]->element[0]->str,
-					      map_node->element[k]->element[1]->integer);
-				}
-			}
+			cluster_map_debug(cluster, map);
 
 			if (cluster_map_apply(cluster, map) < 0) {
 				PWARN("%s: Applying cluster map failed", cluster->log_prefix);
@@ -2439,7 +2965,7 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 			}
 			fr_redis_reply_free(&map);
 
-			return cluster;
+			goto finish;
 
 		/*
 		 *	Unusable bootstrap node
@@ -2481,7 +3007,19 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 	 *	hopefully we'll get one when we start processing
 	 *	requests.
 	 */
-	for (s = 0; s < KEY_SLOTS; s++) cluster->key_slot[s].master = (s % (uint16_t) num_nodes) + 1;
+	MEM(fallback = talloc_zero(NULL, fr_redis_cluster_map_t));
+	for (s = 0; s < KEY_SLOTS; s++) fallback->key_slot[s].master = (s % (uint16_t) num_nodes) + 1;
+	cluster_map_publish(cluster, fallback);
+
+finish:
+	/*
+	 *	From here on, remaps are performed by the
+	 *	coordinator.
+	 */
+	if (cluster_coordinator_register(cluster) < 0) {
+		PERROR("%s - Failed registering cluster with coordinator", cluster->log_prefix);
+		goto error;
+	}
 
 	return cluster;
 }
@@ -36,9 +36,22 @@ extern "C" {
 #endif
 
 typedef struct fr_redis_cluster fr_redis_cluster_t;
-typedef struct fr_redis_cluster_key_slot_s fr_redis_cluster_key_slot_t;
 typedef struct fr_redis_cluster_node_s fr_redis_cluster_node_t;
 
+#define FR_REDIS_CLUSTER_MAX_SLAVES	5		//!< Maximum number of slaves associated with a keyslot.
+
+/** Indexes in the fr_redis_cluster_node_t array for a single key slot
+ *
+ * When dealing with 16K entries, space is a concern. It's significantly
+ * more memory efficient to use 8bit indexes than 64bit pointers for each
+ * of the key slot to node mappings.
+ */
+typedef struct {
+	uint8_t			slave[FR_REDIS_CLUSTER_MAX_SLAVES];	//!< R/O node (slave) for this key slot.
+	uint8_t			slave_num;		//!< Number of slaves associated with this key slot.
+	uint8_t			master;			//!< R/W node (master) for this key slot.
+} fr_redis_cluster_key_slot_t;
+
 /** Redis connection sequence state
  *
  * Tracks how many operations we've performed attempting to execute a single command.
@@ -76,7 +89,7 @@ typedef enum {
 extern fr_table_num_sorted_t const fr_redis_cluster_rcodes_table[];
 extern size_t fr_redis_cluster_rcodes_table_len;
 
-fr_redis_cluster_rcode_t fr_redis_cluster_remap(request_t *request, fr_redis_cluster_t *cluster, fr_redis_conn_t *conn);
+fr_redis_cluster_rcode_t fr_redis_cluster_remap(request_t *request, fr_redis_cluster_t *cluster);
 
 /*
  *	Callback for the connection pool to create a new connection
@@ -86,8 +99,9 @@ void *fr_redis_cluster_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_t ti
 /*
  *	Functions to resolve a key to a cluster node
  */
-fr_redis_cluster_key_slot_t const	*fr_redis_cluster_slot_by_key(fr_redis_cluster_t *cluster, request_t *request,
-								      uint8_t const *key, size_t key_len);
+void				fr_redis_cluster_slot_by_key(fr_redis_cluster_key_slot_t *out,
+							     fr_redis_cluster_t *cluster, request_t *request,
+							     uint8_t const *key, size_t key_len);
 
 fr_redis_cluster_node_t const	*fr_redis_cluster_master(fr_redis_cluster_t *cluster,
 							 fr_redis_cluster_key_slot_t const *key_slot);
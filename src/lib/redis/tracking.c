@@ -0,0 +1,578 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file tracking.c
+ * @brief Client side caching of Redis replies, using server assisted invalidation.
+ *
+ * Replies are cached per thread, and are only served whilst we're receiving
+ * invalidation messages from every master in the cluster.
+ *
+ * Each master gets a dedicated connection, which enables tracking in
+ * broadcasting mode (CLIENT TRACKING on BCAST), redirects invalidation
+ * messages to itself, and subscribes to the __redis__:invalidate channel.
+ * Broadcasting mode means the connections we issue commands on don't need
+ * to enable tracking themselves, so the existing connection pools are
+ * used unaltered.
+ *
+ * If an invalidation connection fails we can't know which keys changed
+ * whilst it was down, so the whole cache is flushed, and nothing is cached
+ * until the connection is re-established.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/redis/tracking.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/inet.h>
+#include <freeradius-devel/util/rb.h>
+
+#define REDIS_TRACKING_CHANNEL		"__redis__:invalidate"
+#define REDIS_TRACKING_MAX_PREFIXES	32
+
+/** All the replies we hold for a given key
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;		//!< Entry in the keys tree.
+	uint8_t			*key;		//!< Redis key.
+	size_t			key_len;	//!< Length of the key.
+	fr_dlist_head_t		entries;	//!< Replies to commands which read this key.
+} redis_tracking_key_t;
+
+/** A cached reply
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;		//!< Entry in the entries tree.
+	fr_dlist_t		lru;		//!< Entry in the LRU list.
+	fr_dlist_t		by_key;		//!< Entry in the key's list of replies.
+	redis_tracking_key_t	*key;		//!< Key the command read.
+
+	uint8_t			*command;	//!< Command and arguments, separated by '\0'.
+	size_t			command_len;	//!< Length of the command.
+
+	uint8_t			*value;		//!< Formatted reply.
+	size_t			value_len;	//!< Length of the reply.
+} redis_tracking_entry_t;
+
+/** Connection we receive invalidation messages on
+ *
+ */
+typedef struct {
+	fr_redis_tracking_t	*tracking;	//!< Tracking context this node belongs to.
+	fr_socket_t		addr;		//!< Address of the master.
+	redisContext		*handle;	//!< Hiredis context.  NULL if not connected.
+	fr_event_timer_t const	*ev;		//!< Reconnection timer.
+} redis_tracking_node_t;
+
+struct fr_redis_tracking_s {
+	fr_event_list_t		*el;		//!< Event list of the thread.
+	fr_redis_conf_t const	*conf;		//!< Connection parameters for the Redis server.
+	char const		*log_prefix;	//!< Prefix to use when logging.
+	char const		**prefixes;	//!< Key prefixes the server should notify us about.
+	uint32_t		max_entries;	//!< Maximum number of replies to hold.
+
+	fr_rb_tree_t		*keys;		//!< Key -> replies, used for invalidation.
+	fr_rb_tree_t		*entries;	//!< Command -> reply, used for lookups.
+	fr_dlist_head_t		lru;		//!< Replies, with the most recently used at the tail.
+
+	redis_tracking_node_t	**nodes;	//!< One per master.
+	unsigned int		connected;	//!< How many masters we're receiving invalidations from.
+};
+
+static int8_t tracking_key_cmp(void const *one, void const *two)
+{
+	redis_tracking_key_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, key, key_len);
+	return 0;
+}
+
+static int8_t tracking_entry_cmp(void const *one, void const *two)
+{
+	redis_tracking_entry_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, command, command_len);
+	return 0;
+}
+
+/** Whether we can currently rely on receiving invalidation messages for all keys
+ *
+ */
+static inline bool tracking_ready(fr_redis_tracking_t const *t)
+{
+	return (t->connected > 0) && (t->connected == talloc_array_length(t->nodes));
+}
+
+/** Remove a reply from the cache, and its key if it was the last reply for it
+ *
+ */
+static void tracking_entry_free(fr_redis_tracking_t *t, redis_tracking_entry_t *e)
+{
+	redis_tracking_key_t *k = e->key;
+
+	fr_dlist_remove(&t->lru, e);
+	fr_dlist_remove(&k->entries, e);
+	fr_rb_delete(t->entries, e);
+	talloc_free(e);
+
+	if (fr_dlist_empty(&k->entries)) {
+		fr_rb_delete(t->keys, k);
+		talloc_free(k);
+	}
+}
+
+/** Remove all replies from the cache
+ *
+ */
+static void tracking_flush(fr_redis_tracking_t *t)
+{
+	redis_tracking_entry_t *e;
+
+	while ((e = fr_dlist_head(&t->lru))) tracking_entry_free(t, e);
+}
+
+/** Remove all the replies for a key which has been modified
+ *
+ */
+static void tracking_invalidate_key(fr_redis_tracking_t *t, uint8_t const *key, size_t key_len)
+{
+	redis_tracking_key_t	*k;
+	redis_tracking_entry_t	*e;
+
+	k = fr_rb_find(t->keys, &(redis_tracking_key_t){ .key = UNCONST(uint8_t *, key), .key_len = key_len });
+	if (!k) return;
+
+	DEBUG3("%s - Invalidating cached replies for key \"%pV\"", t->log_prefix,
+	       fr_box_strvalue_len((char const *)key, key_len));
+
+	while ((e = fr_dlist_head(&k->entries))) {
+		bool last = (fr_dlist_next(&k->entries, e) == NULL);
+
+		tracking_entry_free(t, e);	/* Frees k with the last entry */
+		if (last) break;
+	}
+}
+
+/** Process a message received on the invalidation channel
+ *
+ * Messages are of the form ["message", "__redis__:invalidate", [<key>...]].
+ * A nil key list means the server flushed its dataset, or evicted its
+ * tracking table, and we need to flush everything.
+ */
+static void tracking_message(fr_redis_tracking_t *t, redisReply *reply)
+{
+	redisReply *keys;
+
+	if ((reply->type != REDIS_REPLY_ARRAY) || (reply->elements != 3)) return;
+	if ((reply->element[0]->type != REDIS_REPLY_STRING) || (strcmp(reply->element[0]->str, "message") != 0)) return;
+
+	keys = reply->element[2];
+	switch (keys->type) {
+	case REDIS_REPLY_NIL:
+		DEBUG2("%s - Server requested all cached replies be invalidated", t->log_prefix);
+		tracking_flush(t);
+		break;
+
+	case REDIS_REPLY_ARRAY:
+		for (size_t i = 0; i < keys->elements; i++) {
+			if (keys->element[i]->type != REDIS_REPLY_STRING) continue;
+			tracking_invalidate_key(t, (uint8_t const *)keys->element[i]->str, keys->element[i]->len);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+/** Issue a command on an invalidation connection and check it didn't fail
+ *
+ */
+static redisReply *tracking_command(redis_tracking_node_t *node, redisContext *handle, int argc, char const **argv)
+{
+	fr_redis_tracking_t	*t = node->tracking;
+	redisReply		*reply;
+
+	reply = redisCommandArgv(handle, argc, argv, NULL);
+	if (!reply) {
+		ERROR("%s - Invalidation connection to %pV:%u failed executing %s: %s", t->log_prefix,
+		      fr_box_ipaddr(node->addr.inet.dst_ipaddr), node->addr.inet.dst_port, argv[0], handle->errstr);
+		return NULL;
+	}
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		ERROR("%s - Invalidation connection to %pV:%u failed executing %s: %s", t->log_prefix,
+		      fr_box_ipaddr(node->addr.inet.dst_ipaddr), node->addr.inet.dst_port, argv[0], reply->str);
+		fr_redis_reply_free(&reply);
+		return NULL;
+	}
+
+	return reply;
+}
+
+static void tracking_node_reconnect_schedule(redis_tracking_node_t *node);
+
+/** Tear down an invalidation connection, and schedule a reconnection
+ *
+ */
+static void tracking_node_disconnect(redis_tracking_node_t *node)
+{
+	fr_redis_tracking_t *t = node->tracking;
+
+	fr_event_fd_delete(t->el, node->handle->fd, FR_EVENT_FILTER_IO);
+	redisFree(node->handle);
+	node->handle = NULL;
+	t->connected--;
+
+	/*
+	 *	We may have missed invalidation messages, so
+	 *	nothing we hold can be trusted.
+	 */
+	tracking_flush(t);
+
+	tracking_node_reconnect_schedule(node);
+}
+
+static void _tracking_node_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	redis_tracking_node_t	*node = talloc_get_type_abort(uctx, redis_tracking_node_t);
+	fr_redis_tracking_t	*t = node->tracking;
+	redisReply		*reply;
+
+	if (redisBufferRead(node->handle) != REDIS_OK) {
+		ERROR("%s - Invalidation connection to %pV:%u failed: %s", t->log_prefix,
+		      fr_box_ipaddr(node->addr.inet.dst_ipaddr), node->addr.inet.dst_port, node->handle->errstr);
+		tracking_node_disconnect(node);
+		return;
+	}
+
+	for (;;) {
+		reply = NULL;
+		if (redisGetReplyFromReader(node->handle, (void **)&reply) != REDIS_OK) {
+			ERROR("%s - Invalidation connection to %pV:%u returned malformed data: %s", t->log_prefix,
+			      fr_box_ipaddr(node->addr.inet.dst_ipaddr), node->addr.inet.dst_port, node->handle->errstr);
+			tracking_node_disconnect(node);
+			return;
+		}
+		if (!reply) break;
+
+		tracking_message(t, reply);
+		fr_redis_reply_free(&reply);
+	}
+}
+
+static void _tracking_node_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+				 int fd_errno, void *uctx)
+{
+	redis_tracking_node_t	*node = talloc_get_type_abort(uctx, redis_tracking_node_t);
+	fr_redis_tracking_t	*t = node->tracking;
+
+	ERROR("%s - Invalidation connection to %pV:%u failed: %s", t->log_prefix,
+	      fr_box_ipaddr(node->addr.inet.dst_ipaddr), node->addr.inet.dst_port, fr_syserror(fd_errno));
+	tracking_node_disconnect(node);
+}
+
+/** Open an invalidation connection to a master
+ *
+ * @param[in] node	to connect.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int tracking_node_connect(redis_tracking_node_t *node)
+{
+	fr_redis_tracking_t	*t = node->tracking;
+	fr_redis_conf_t const	*conf = t->conf;
+	fr_time_delta_t		timeout = conf->connection_timeout;
+	char			name[FR_IPADDR_STRLEN];
+	char			id[21];
+	redisContext		*handle;
+	redisReply		*reply;
+
+	int			argc = 0;
+	char const		*argv[6 + (REDIS_TRACKING_MAX_PREFIXES * 2)];
+	size_t			i, num_prefixes;
+
+	if (timeout <= 0) timeout = fr_time_delta_from_sec(3);
+
+	fr_inet_ntop(name, sizeof(name), &node->addr.inet.dst_ipaddr);
+
+	DEBUG2("%s - Opening invalidation connection to %s:%u", t->log_prefix, name, node->addr.inet.dst_port);
+
+	handle = redisConnectWithTimeout(name, node->addr.inet.dst_port, fr_time_delta_to_timeval(timeout));
+	if ((handle != NULL) && handle->err) {
+		ERROR("%s - Invalidation connection to %s:%u failed: %s", t->log_prefix,
+		      name, node->addr.inet.dst_port, handle->errstr);
+	error:
+		redisFree(handle);
+		return -1;
+	} else if (!handle) {
+		ERROR("%s - Invalidation connection to %s:%u failed", t->log_prefix, name, node->addr.inet.dst_port);
+		return -1;
+	}
+
+	if (conf->password) {
+		reply = tracking_command(node, handle, 2, (char const *[]){ "AUTH", conf->password });
+		if (!reply) goto error;
+		fr_redis_reply_free(&reply);
+	}
+
+	/*
+	 *	Invalidation messages are redirected to this
+	 *	connection, so we need to know its ID.
+	 */
+	reply = tracking_command(node, handle, 2, (char const *[]){ "CLIENT", "ID" });
+	if (!reply) goto error;
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		ERROR("%s - Unexpected reply of type %s to CLIENT ID", t->log_prefix,
+		      fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+		fr_redis_reply_free(&reply);
+		goto error;
+	}
+	snprintf(id, sizeof(id), "%lld", reply->integer);
+	fr_redis_reply_free(&reply);
+
+	argv[argc++] = "CLIENT";
+	argv[argc++] = "TRACKING";
+	argv[argc++] = "on";
+	argv[argc++] = "REDIRECT";
+	argv[argc++] = id;
+	argv[argc++] = "BCAST";
+
+	num_prefixes = talloc_array_length(t->prefixes);
+	for (i = 0; i < num_prefixes; i++) {
+		argv[argc++] = "PREFIX";
+		argv[argc++] = t->prefixes[i];
+	}
+
+	reply = tracking_command(node, handle, argc, argv);
+	if (!reply) goto error;
+	fr_redis_reply_free(&reply);
+
+	reply = tracking_command(node, handle, 2, (char const *[]){ "SUBSCRIBE", REDIS_TRACKING_CHANNEL });
+	if (!reply) goto error;
+	fr_redis_reply_free(&reply);
+
+	if (fr_event_fd_insert(node, t->el, handle->fd,
+			       _tracking_node_read, NULL, _tracking_node_error, node) < 0) {
+		PERROR("%s - Failed inserting invalidation connection into event loop", t->log_prefix);
+		goto error;
+	}
+
+	node->handle = handle;
+	t->connected++;
+
+	DEBUG2("%s - Receiving invalidations from %s:%u", t->log_prefix, name, node->addr.inet.dst_port);
+
+	return 0;
+}
+
+static void _tracking_node_reconnect(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	redis_tracking_node_t *node = talloc_get_type_abort(uctx, redis_tracking_node_t);
+
+	if (tracking_node_connect(node) < 0) tracking_node_reconnect_schedule(node);
+}
+
+static void tracking_node_reconnect_schedule(redis_tracking_node_t *node)
+{
+	fr_redis_tracking_t	*t = node->tracking;
+	fr_time_delta_t		delay = t->conf->reconnection_delay;
+
+	if (delay <= 0) delay = fr_time_delta_from_sec(1);
+
+	if (fr_event_timer_in(node, t->el, &node->ev, delay, _tracking_node_reconnect, node) < 0) {
+		PERROR("%s - Failed scheduling reconnection of invalidation connection", t->log_prefix);
+	}
+}
+
+static int _tracking_node_free(redis_tracking_node_t *node)
+{
+	if (!node->handle) return 0;
+
+	fr_event_fd_delete(node->tracking->el, node->handle->fd, FR_EVENT_FILTER_IO);
+	redisFree(node->handle);
+	node->handle = NULL;
+
+	return 0;
+}
+
+/** Allocate a new client side cache
+ *
+ * Opens an invalidation connection to each of the cluster's masters.
+ * Failures to connect aren't fatal, the connection will be retried,
+ * and replies won't be cached until all masters are connected.
+ *
+ * @param[in] ctx		to allocate the cache in.  Should be thread specific.
+ * @param[in] el		Event list of the thread.
+ * @param[in] cluster		to receive invalidation messages from.
+ * @param[in] conf		Connection parameters for the Redis server.
+ * @param[in] log_prefix	to use when logging.
+ * @param[in] max_entries	Maximum number of replies to cache.
+ * @param[in] prefixes		Only cache keys beginning with one of these prefixes.
+ *				May be NULL, in which case all keys are cached.
+ * @return
+ *	- A new cache on success.
+ *	- NULL on failure.
+ */
+fr_redis_tracking_t *fr_redis_tracking_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+					     fr_redis_cluster_t *cluster, fr_redis_conf_t const *conf,
+					     char const *log_prefix, uint32_t max_entries,
+					     char const **prefixes)
+{
+	fr_redis_tracking_t	*t;
+	fr_socket_t		*addrs;
+	ssize_t			num, i;
+
+	if (talloc_array_length(prefixes) > REDIS_TRACKING_MAX_PREFIXES) {
+		ERROR("%s - Too many client cache prefixes, maximum is %u", log_prefix, REDIS_TRACKING_MAX_PREFIXES);
+		return NULL;
+	}
+
+	MEM(t = talloc_zero(ctx, fr_redis_tracking_t));
+	t->el = el;
+	t->conf = conf;
+	t->log_prefix = log_prefix;
+	t->prefixes = prefixes;
+	t->max_entries = max_entries;
+
+	MEM(t->keys = fr_rb_inline_talloc_alloc(t, redis_tracking_key_t, node, tracking_key_cmp, NULL));
+	MEM(t->entries = fr_rb_inline_talloc_alloc(t, redis_tracking_entry_t, node, tracking_entry_cmp, NULL));
+	fr_dlist_talloc_init(&t->lru, redis_tracking_entry_t, lru);
+
+	num = fr_redis_cluster_node_addr_by_role(t, &addrs, cluster, true, false);
+	if (num < 0) {
+		PERROR("%s - Failed retrieving master addresses", log_prefix);
+		talloc_free(t);
+		return NULL;
+	}
+	if (num == 0) WARN("%s - No masters available, client cache disabled", log_prefix);
+
+	MEM(t->nodes = talloc_zero_array(t, redis_tracking_node_t *, num));
+	for (i = 0; i < num; i++) {
+		redis_tracking_node_t *node;
+
+		MEM(node = t->nodes[i] = talloc_zero(t->nodes, redis_tracking_node_t));
+		node->tracking = t;
+		node->addr = addrs[i];
+		talloc_set_destructor(node, _tracking_node_free);
+
+		if (tracking_node_connect(node) < 0) tracking_node_reconnect_schedule(node);
+	}
+	talloc_free(addrs);
+
+	return t;
+}
+
+/** Find a cached reply
+ *
+ * @param[out] out		Where to write a pointer to the reply.
+ *				Only valid until the next call to #fr_redis_tracking_insert
+ *				or until control returns to the event loop.
+ * @param[out] out_len		Length of the reply.
+ * @param[in] t			Cache to search in.
+ * @param[in] command		Command and arguments, separated by '\0'.
+ * @param[in] command_len	Length of the command.
+ * @return
+ *	- true if a cached reply was found.
+ *	- false if there's no cached reply.
+ */
+bool fr_redis_tracking_find(uint8_t const **out, size_t *out_len, fr_redis_tracking_t *t,
+			    uint8_t const *command, size_t command_len)
+{
+	redis_tracking_entry_t *e;
+
+	if (!tracking_ready(t)) return false;
+
+	e = fr_rb_find(t->entries, &(redis_tracking_entry_t){ .command = UNCONST(uint8_t *, command),
+							      .command_len = command_len });
+	if (!e) return false;
+
+	fr_dlist_remove(&t->lru, e);
+	fr_dlist_insert_tail(&t->lru, e);
+
+	*out = e->value;
+	*out_len = e->value_len;
+
+	return true;
+}
+
+/** Cache a reply
+ *
+ * The reply is discarded if we're not currently receiving invalidation
+ * messages from all masters, or if the key doesn't match one of the
+ * prefixes the server is notifying us about.
+ *
+ * @param[in] t			Cache to insert into.
+ * @param[in] key		Redis key the command read.
+ * @param[in] key_len		Length of the key.
+ * @param[in] command		Command and arguments, separated by '\0'.
+ * @param[in] command_len	Length of the command.
+ * @param[in] value		Formatted reply.
+ * @param[in] value_len		Length of the reply.
+ */
+void fr_redis_tracking_insert(fr_redis_tracking_t *t,
+			      uint8_t const *key, size_t key_len,
+			      uint8_t const *command, size_t command_len,
+			      uint8_t const *value, size_t value_len)
+{
+	redis_tracking_key_t	*k;
+	redis_tracking_entry_t	*e;
+	size_t			i, num_prefixes;
+
+	if (!tracking_ready(t) || (t->max_entries == 0)) return;
+
+	num_prefixes = talloc_array_length(t->prefixes);
+	if (num_prefixes > 0) {
+		for (i = 0; i < num_prefixes; i++) {
+			size_t len = strlen(t->prefixes[i]);
+
+			if ((len <= key_len) && (memcmp(key, t->prefixes[i], len) == 0)) break;
+		}
+		if (i == num_prefixes) return;	/* Server won't tell us when this key changes */
+	}
+
+	e = fr_rb_find(t->entries, &(redis_tracking_entry_t){ .command = UNCONST(uint8_t *, command),
+							      .command_len = command_len });
+	if (e) tracking_entry_free(t, e);
+
+	while (fr_dlist_num_elements(&t->lru) >= t->max_entries) tracking_entry_free(t, fr_dlist_head(&t->lru));
+
+	k = fr_rb_find(t->keys, &(redis_tracking_key_t){ .key = UNCONST(uint8_t *, key), .key_len = key_len });
+	if (!k) {
+		MEM(k = talloc_zero(t, redis_tracking_key_t));
+		MEM(k->key = talloc_memdup(k, key, key_len));
+		k->key_len = key_len;
+		fr_dlist_talloc_init(&k->entries, redis_tracking_entry_t, by_key);
+		fr_rb_insert(t->keys, k);
+	}
+
+	MEM(e = talloc_zero(t, redis_tracking_entry_t));
+	MEM(e->command = talloc_memdup(e, command, command_len));
+	e->command_len = command_len;
+	MEM(e->value = talloc_memdup(e, value, value_len));
+	e->value_len = value_len;
+	e->key = k;
+
+	fr_rb_insert(t->entries, e);
+	fr_dlist_insert_tail(&t->lru, e);
+	fr_dlist_insert_tail(&k->entries, e);
+}
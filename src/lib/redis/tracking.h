@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file tracking.h
+ * @brief Client side caching of Redis replies, using server assisted invalidation.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(tracking_h, "$Id$")
+
+#include <freeradius-devel/redis/base.h>
+#include <freeradius-devel/redis/cluster.h>
+#include <freeradius-devel/util/event.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_redis_tracking_s fr_redis_tracking_t;
+
+fr_redis_tracking_t	*fr_redis_tracking_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+						 fr_redis_cluster_t *cluster, fr_redis_conf_t const *conf,
+						 char const *log_prefix, uint32_t max_entries,
+						 char const **prefixes);
+
+bool			fr_redis_tracking_find(uint8_t const **out, size_t *out_len, fr_redis_tracking_t *tracking,
+					       uint8_t const *command, size_t command_len);
+
+void			fr_redis_tracking_insert(fr_redis_tracking_t *tracking,
+						 uint8_t const *key, size_t key_len,
+						 uint8_t const *command, size_t command_len,
+						 uint8_t const *value, size_t value_len);
+
+#ifdef __cplusplus
+}
+#endif
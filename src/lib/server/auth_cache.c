@@ -0,0 +1,205 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/lib/server/auth_cache.c
+ * @brief Per-thread caches of expensive authentication results.
+ *
+ * Some authentication methods spend most of their time on one expensive
+ * step, a slow password hash, a round trip to a KDC, or deriving a
+ * password element.  Modules can remember the result of that step for a
+ * short time, so that repeated authentications by the same user skip it.
+ *
+ * Entries are identified by a digest which the module derives from the
+ * password and whatever else the result depends on, usually with an HMAC
+ * keyed by the password, so the cache never holds the password itself.
+ * An entry may hold an opaque value.
+ *
+ * Every entry in a cache has the same lifetime, so the oldest entry is
+ * always the next to expire.  When the cache is full, the oldest entry is
+ * removed to make room for the new one.
+ *
+ * Caches aren't thread safe.  Each worker should have its own.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/auth_cache.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/rb.h>
+
+struct fr_auth_cache_s {
+	fr_auth_cache_config_t const	*config;
+	fr_rb_tree_t			*tree;		//!< Of entries, by key.
+	fr_dlist_head_t			expiry;		//!< Of entries, oldest first.
+};
+
+typedef struct {
+	fr_rb_node_t		node;				//!< Entry in the tree.
+	fr_dlist_t		entry;				//!< Entry in the expiry list.
+	uint8_t			key[FR_AUTH_CACHE_KEY_LEN];
+	fr_time_t		expires;			//!< When the entry stops being used.
+	uint8_t			*value;				//!< Optional, parented by the entry.
+} fr_auth_cache_entry_t;
+
+static int8_t auth_cache_cmp(void const *one, void const *two)
+{
+	fr_auth_cache_entry_t const *a = one, *b = two;
+
+	return CMP(memcmp(a->key, b->key, sizeof(a->key)), 0);
+}
+
+static void auth_cache_entry_free(fr_auth_cache_t *cache, fr_auth_cache_entry_t *c)
+{
+	fr_rb_remove(cache->tree, c);
+	fr_dlist_remove(&cache->expiry, c);
+	talloc_free(c);
+}
+
+/** Check the cache_lifetime and cache_size options of a module
+ *
+ * @param[in] cs	the module's configuration section.
+ * @param[in] config	parsed from cs.
+ * @return
+ *	- 0 if the configuration is valid.
+ *	- -1 if it isn't.
+ */
+int fr_auth_cache_config_check(CONF_SECTION *cs, fr_auth_cache_config_t const *config)
+{
+	if (config->lifetime && !config->size) {
+		cf_log_err_by_child(cs, "cache_size", "Must be greater than 0 if cache_lifetime is set");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Allocate a cache
+ *
+ * @param[in] ctx	to allocate the cache in.  Entries are freed with it.
+ * @param[in] config	of the cache.  Must remain valid for the
+ *			lifetime of the cache.
+ * @return
+ *	- A new cache.
+ *	- NULL if caching is disabled.
+ */
+fr_auth_cache_t *fr_auth_cache_alloc(TALLOC_CTX *ctx, fr_auth_cache_config_t const *config)
+{
+	fr_auth_cache_t *cache;
+
+	if (!config->lifetime) return NULL;
+
+	fr_assert(config->size > 0);
+
+	MEM(cache = talloc_zero(ctx, fr_auth_cache_t));
+	cache->config = config;
+	MEM(cache->tree = fr_rb_inline_talloc_alloc(cache, fr_auth_cache_entry_t, node, auth_cache_cmp, NULL));
+	fr_dlist_init(&cache->expiry, fr_auth_cache_entry_t, entry);
+
+	return cache;
+}
+
+/** Look for an unexpired entry
+ *
+ * @param[out] value	The value stored with the entry, may be NULL.
+ *			Only valid until the cache is next changed.
+ * @param[out] value_len	Length of the value, may be NULL.
+ * @param[in] cache		to search.
+ * @param[in] key		of the entry.
+ * @return
+ *	- true if the entry was found.
+ *	- false if it wasn't, or it had expired.
+ */
+bool fr_auth_cache_find(uint8_t const **value, size_t *value_len,
+			fr_auth_cache_t *cache, uint8_t const key[static FR_AUTH_CACHE_KEY_LEN])
+{
+	fr_auth_cache_entry_t	find, *c;
+
+	memcpy(find.key, key, sizeof(find.key));
+	c = fr_rb_find(cache->tree, &find);
+	if (!c) return false;
+
+	if (c->expires <= fr_time()) {
+		auth_cache_entry_free(cache, c);
+		return false;
+	}
+
+	if (value) *value = c->value;
+	if (value_len) *value_len = talloc_array_length(c->value);
+
+	return true;
+}
+
+/** Add an entry, replacing any existing entry with the same key
+ *
+ * Expired entries are removed first.  If the cache is still full, the
+ * oldest entries are removed to make room.
+ *
+ * @param[in] cache		to add the entry to.
+ * @param[in] key		of the entry.
+ * @param[in] value		to copy into the entry, may be NULL.
+ * @param[in] value_len		Length of value.
+ */
+void fr_auth_cache_insert(fr_auth_cache_t *cache, uint8_t const key[static FR_AUTH_CACHE_KEY_LEN],
+			  uint8_t const *value, size_t value_len)
+{
+	fr_auth_cache_entry_t	*c;
+	fr_time_t		now = fr_time();
+
+	fr_auth_cache_remove(cache, key);
+
+	while ((c = fr_dlist_head(&cache->expiry)) &&
+	       ((c->expires <= now) || (fr_dlist_num_elements(&cache->expiry) >= cache->config->size))) {
+		auth_cache_entry_free(cache, c);
+	}
+
+	MEM(c = talloc_zero(cache->tree, fr_auth_cache_entry_t));
+	memcpy(c->key, key, sizeof(c->key));
+	c->expires = now + cache->config->lifetime;
+	if (value) MEM(c->value = talloc_memdup(c, value, value_len));
+
+	if (!fr_rb_insert(cache->tree, c)) {
+		talloc_free(c);
+		return;
+	}
+	fr_dlist_insert_tail(&cache->expiry, c);
+}
+
+/** Remove an entry, if it exists
+ *
+ * @param[in] cache	to remove the entry from.
+ * @param[in] key	of the entry.
+ */
+void fr_auth_cache_remove(fr_auth_cache_t *cache, uint8_t const key[static FR_AUTH_CACHE_KEY_LEN])
+{
+	fr_auth_cache_entry_t	find, *c;
+
+	memcpy(find.key, key, sizeof(find.key));
+	c = fr_rb_find(cache->tree, &find);
+	if (c) auth_cache_entry_free(cache, c);
+}
+
+/** Return the number of entries, including any which have expired but not yet been removed
+ *
+ */
+uint32_t fr_auth_cache_num_entries(fr_auth_cache_t const *cache)
+{
+	return fr_dlist_num_elements(&cache->expiry);
+}
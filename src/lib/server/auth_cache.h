@@ -0,0 +1,79 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/auth_cache.h
+ * @brief Per-thread caches of expensive authentication results.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(auth_cache_h, "$Id$")
+
+#include <freeradius-devel/server/cf_parse.h>
+#include <freeradius-devel/server/cf_util.h>
+#include <freeradius-devel/util/sha1.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FR_AUTH_CACHE_KEY_LEN	SHA1_DIGEST_LENGTH
+
+/** Configuration of an authentication cache
+ *
+ * Modules embed this in their instance data, and parse it with
+ * #FR_AUTH_CACHE_CONF.
+ */
+typedef struct {
+	fr_time_delta_t		lifetime;	//!< How long entries are used for.  0 disables the cache.
+	uint32_t		size;		//!< Maximum number of entries.
+} fr_auth_cache_config_t;
+
+/** The cache_lifetime and cache_size options of a module
+ *
+ * @param[in] _struct	the module's instance data.
+ * @param[in] _field	the #fr_auth_cache_config_t within _struct.
+ */
+#define FR_AUTH_CACHE_CONF(_struct, _field) \
+	{ FR_CONF_OFFSET("cache_lifetime", FR_TYPE_TIME_DELTA, _struct, _field.lifetime), .dflt = "0" }, \
+	{ FR_CONF_OFFSET("cache_size", FR_TYPE_UINT32, _struct, _field.size), .dflt = "1024" }
+
+typedef struct fr_auth_cache_s fr_auth_cache_t;
+
+int		fr_auth_cache_config_check(CONF_SECTION *cs, fr_auth_cache_config_t const *config) CC_HINT(nonnull);
+
+fr_auth_cache_t	*fr_auth_cache_alloc(TALLOC_CTX *ctx, fr_auth_cache_config_t const *config) CC_HINT(nonnull(2));
+
+bool		fr_auth_cache_find(uint8_t const **value, size_t *value_len,
+				   fr_auth_cache_t *cache, uint8_t const key[static FR_AUTH_CACHE_KEY_LEN])
+				   CC_HINT(nonnull(3,4));
+
+void		fr_auth_cache_insert(fr_auth_cache_t *cache, uint8_t const key[static FR_AUTH_CACHE_KEY_LEN],
+				     uint8_t const *value, size_t value_len) CC_HINT(nonnull(1,2));
+
+void		fr_auth_cache_remove(fr_auth_cache_t *cache, uint8_t const key[static FR_AUTH_CACHE_KEY_LEN])
+				     CC_HINT(nonnull);
+
+uint32_t	fr_auth_cache_num_entries(fr_auth_cache_t const *cache) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
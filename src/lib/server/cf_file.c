@@ -2617,3 +2617,48 @@ retry:
 
 	return NULL;
 }
+
+/** Check whether any of the files which make up a configuration have changed
+ *
+ * Every file is checked against the size, inode, and modification
+ * time it had when it was first read.
+ *
+ * @param[in] cs	any section of the configuration to check.
+ * @param[in] callback	called for each file which has changed, or which
+ *			can no longer be read.  May be NULL.
+ * @param[in] uctx	passed to callback.
+ * @return
+ *	- #CF_FILE_NONE if nothing has changed.
+ *	- #CF_FILE_CONFIG if one or more files have changed.
+ *	- #CF_FILE_ERROR (possibly with #CF_FILE_CONFIG) if one or more
+ *	  files could not be checked.
+ */
+int cf_file_changed(CONF_SECTION *cs, cf_file_changed_t callback, void *uctx)
+{
+	fr_rb_tree_t		*tree;
+	fr_rb_iter_inorder_t	iter;
+	cf_file_t		*file;
+	struct stat		buf;
+	int			rcode = CF_FILE_NONE;
+
+	tree = cf_data_value(cf_data_find(cf_root(cs), fr_rb_tree_t, "filename"));
+	if (!tree) return CF_FILE_ERROR;
+
+	for (file = fr_rb_iter_init_inorder(&iter, tree);
+	     file;
+	     file = fr_rb_iter_next_inorder(&iter)) {
+		if (stat(file->filename, &buf) < 0) {
+			rcode |= CF_FILE_ERROR;
+			if (callback) callback(file->filename, uctx);
+			continue;
+		}
+
+		if ((buf.st_dev == file->buf.st_dev) && (buf.st_ino == file->buf.st_ino) &&
+		    (buf.st_size == file->buf.st_size) && (buf.st_mtime == file->buf.st_mtime)) continue;
+
+		rcode |= CF_FILE_CONFIG;
+		if (callback) callback(file->filename, uctx);
+	}
+
+	return rcode;
+}
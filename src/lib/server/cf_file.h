@@ -44,6 +44,13 @@ extern "C" {
 #define CF_FILE_CONFIG (1 << 2)
 #define CF_FILE_MODULE (1 << 3)
 
+/** Called for each configuration file which has changed
+ *
+ * @param[in] filename	of the file which has changed.
+ * @param[in] uctx	passed to #cf_file_changed.
+ */
+typedef void (*cf_file_changed_t)(char const *filename, void *uctx);
+
 /*
  *	Config file parsing
  */
@@ -53,6 +60,7 @@ void		cf_file_free(CONF_SECTION *cs);
 
 bool		cf_file_check(CONF_SECTION *cs, char const *filename, bool check_perms);
 void		cf_file_check_user(uid_t uid, gid_t gid);
+int		cf_file_changed(CONF_SECTION *cs, cf_file_changed_t callback, void *uctx);
 
 /*
  *	Config file writing
@@ -32,6 +32,8 @@ RCSID("$Id$")
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/atexit.h>
 
+#include <pthread.h>
+
 static inline int8_t cf_ident2_cmp(void const *a, void const *b);
 static int8_t _cf_ident1_cmp(void const *a, void const *b);
 static int8_t _cf_ident2_cmp(void const *a, void const *b);
@@ -737,7 +739,7 @@ CONF_SECTION *_cf_section_alloc(TALLOC_CTX *ctx, CONF_SECTION *parent,
 		}
 	}
 
-	cs = talloc_zero(ctx, CONF_SECTION);
+	cs = talloc_zero_pooled_object(ctx, CONF_SECTION, 2, strlen(name1) + 1 + (name2 ? strlen(name2) + 1 : 0));
 	if (!cs) return NULL;
 
 	cs->item.type = CONF_ITEM_SECTION;
@@ -820,11 +822,45 @@ CONF_SECTION *_cf_section_alloc(TALLOC_CTX *ctx, CONF_SECTION *parent,
  * @param[in] ci	to set filename on.
  * @param[in] filename	to set.
  */
-void _cf_filename_set(CONF_ITEM *ci, char const *filename)
+static int8_t _cf_filename_cmp(void const *one, void const *two)
+{
+	int ret = strcmp(one, two);
+
+	return CMP(ret, 0);
+}
+
+/** Return a shared copy of a filename
+ *
+ * Every item read from a file has the same filename as all of the
+ * other items in that file.  So we keep one copy of each filename,
+ * instead of allocating a new copy for each item.  The copies are
+ * never freed, and must not be modified.
+ *
+ * Items can be created by any thread, so the tree is protected by a
+ * mutex.
+ */
+static char const *cf_filename_intern(char const *filename)
 {
-	talloc_const_free(ci->filename);
+	static fr_rb_tree_t	*tree;
+	static pthread_mutex_t	mutex = PTHREAD_MUTEX_INITIALIZER;
+	char			*found;
 
-	ci->filename = talloc_typed_strdup(ci, filename);
+	pthread_mutex_lock(&mutex);
+	if (!tree) MEM(tree = fr_rb_talloc_alloc(NULL, char, _cf_filename_cmp, NULL));
+
+	found = fr_rb_find(tree, filename);
+	if (!found) {
+		MEM(found = talloc_typed_strdup(tree, filename));
+		if (!fr_rb_insert(tree, found)) fr_assert(0);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return found;
+}
+
+void _cf_filename_set(CONF_ITEM *ci, char const *filename)
+{
+	ci->filename = filename ? cf_filename_intern(filename) : NULL;
 }
 
 /** Set the line number of a #CONF_ITEM
@@ -1154,7 +1190,11 @@ CONF_PAIR *cf_pair_alloc(CONF_SECTION *parent, char const *attr, char const *val
 	fr_assert(fr_equality_op[op] || fr_assignment_op[op]);
 	if (!attr) return NULL;
 
-	cp = talloc_zero(parent, CONF_PAIR);
+	/*
+	 *	Allocate the attribute and value along with the pair,
+	 *	so that each pair only needs one malloc().
+	 */
+	cp = talloc_zero_pooled_object(parent, CONF_PAIR, 2, strlen(attr) + 1 + (value ? strlen(value) + 1 : 0));
 	if (!cp) return NULL;
 
 	cp->item.type = CONF_ITEM_PAIR;
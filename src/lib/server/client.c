@@ -43,7 +43,14 @@ RCSID("$Id$")
 #include <fcntl.h>
 #include <sys/stat.h>
 
-//#define WITH_TRIE (1)
+/*
+ *	Clients are indexed by longest-prefix match in a trie.  The
+ *	per-prefix rbtrees are kept for builds which don't want the
+ *	trie.
+ */
+#ifndef WITHOUT_CLIENT_TRIE
+#  define WITH_TRIE (1)
+#endif
 
 /** Group of clients
  *
@@ -55,6 +62,8 @@ struct rad_client_list {
 	fr_trie_t	*v6_udp;
 	fr_trie_t	*v4_tcp;
 	fr_trie_t	*v6_tcp;
+	fr_trie_t	*v4_any;		//!< Clients with "proto = *".
+	fr_trie_t	*v6_any;		//!< Clients with "proto = *".
 #else
 	fr_rb_tree_t	*tree[129];
 #endif
@@ -115,26 +124,12 @@ RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
 	clients->name = talloc_strdup(clients, cs ? cf_section_name1(cs) : "root");
 
 #ifdef WITH_TRIE
-	clients->v4_udp = fr_trie_alloc(clients, NULL, NULL);
-	if (!clients->v4_udp) {
-		talloc_free(clients);
-		return NULL;
-	}
-
-	clients->v6_udp = fr_trie_alloc(clients, NULL, NULL);
-	if (!clients->v6_udp) {
-		talloc_free(clients);
-		return NULL;
-	}
-
-	clients->v4_tcp = fr_trie_alloc(clients, NULL, NULL);
-	if (!clients->v4_tcp) {
-		talloc_free(clients);
-		return NULL;
-	}
-
-	clients->v6_tcp = fr_trie_alloc(clients, NULL, NULL);
-	if (!clients->v6_tcp) {
+	if (!(clients->v4_udp = fr_trie_alloc(clients, NULL, NULL)) ||
+	    !(clients->v6_udp = fr_trie_alloc(clients, NULL, NULL)) ||
+	    !(clients->v4_tcp = fr_trie_alloc(clients, NULL, NULL)) ||
+	    !(clients->v6_tcp = fr_trie_alloc(clients, NULL, NULL)) ||
+	    !(clients->v4_any = fr_trie_alloc(clients, NULL, NULL)) ||
+	    !(clients->v6_any = fr_trie_alloc(clients, NULL, NULL))) {
 		talloc_free(clients);
 		return NULL;
 	}
@@ -145,21 +140,17 @@ RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
 
 #ifdef WITH_TRIE
 /*
- *	@todo - either support client definitions where "proto = *",
- *	or udpate this code to allow for that.  i.e. we create yet
- *	another set of v4/v6 tries, for "proto = *" clients.  And then
- *	do lookups there, too.  Or, just unify the udp/tcp tries, and
- *	instead do post-processing?  Though those two clients can have
- *	different secrets... and the trie code doesn't allow 2
- *	fr_trie_user_t nodes in a row.  So we would have to instead
- *	handle that ourselves, with a wrapper around the RADCLIENT
- *	structure that does udp/tcp/wildcard demultiplexing
+ *	Clients with "proto = *" go into their own tries, as udp and
+ *	tcp clients with the same prefix can have different secrets,
+ *	and the trie only holds one entry per prefix.  Lookups check
+ *	both tries, and return the client with the longest prefix.
  */
 static fr_trie_t *clients_trie(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
 			       int proto)
 {
 	if (ipaddr->af == AF_INET) {
 		if (proto == IPPROTO_TCP) return clients->v4_tcp;
+		if (proto == IPPROTO_IP) return clients->v4_any;
 
 		return clients->v4_udp;
 	}
@@ -167,9 +158,43 @@ static fr_trie_t *clients_trie(RADCLIENT_LIST const *clients, fr_ipaddr_t const
 	fr_assert(ipaddr->af == AF_INET6);
 
 	if (proto == IPPROTO_TCP) return clients->v6_tcp;
+	if (proto == IPPROTO_IP) return clients->v6_any;
 
 	return clients->v6_udp;
 }
+
+/** Return whichever client has the longer prefix
+ *
+ */
+static inline CC_HINT(always_inline) RADCLIENT *client_longest(RADCLIENT *a, RADCLIENT *b)
+{
+	if (!a) return b;
+	if (!b) return a;
+
+	return (b->ipaddr.prefix > a->ipaddr.prefix) ? b : a;
+}
+
+/** Find a client with exactly the same prefix, which would clash with a new client
+ *
+ * Wildcard clients clash with udp and tcp clients, and the other way
+ * around.
+ */
+static RADCLIENT *clients_trie_match(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr, int proto)
+{
+	RADCLIENT *old;
+
+	old = fr_trie_match_by_key(clients_trie(clients, ipaddr, proto), &ipaddr->addr, ipaddr->prefix);
+	if (old) return old;
+
+	if (proto != IPPROTO_IP) {
+		return fr_trie_match_by_key(clients_trie(clients, ipaddr, IPPROTO_IP), &ipaddr->addr, ipaddr->prefix);
+	}
+
+	old = fr_trie_match_by_key(clients_trie(clients, ipaddr, IPPROTO_UDP), &ipaddr->addr, ipaddr->prefix);
+	if (old) return old;
+
+	return fr_trie_match_by_key(clients_trie(clients, ipaddr, IPPROTO_TCP), &ipaddr->addr, ipaddr->prefix);
+}
 #endif	/* WITH_TRIE */
 
 /** Add a client to a RADCLIENT_LIST
@@ -224,12 +249,13 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 			CONF_SECTION *cs;
 			CONF_SECTION *subcs;
 
-			if (!client->cs) {
-				ERROR("Failed to find configuration section in client.  Ignoring 'virtual_server' directive");
-				return false;
-			}
-
-			cs = cf_section_find(cf_root(client->cs), "server", client->server);
+			/*
+			 *	Clients loaded from a database don't
+			 *	have a CONF_SECTION in the main config,
+			 *	so look the server up by name.
+			 */
+			cs = client->cs ? cf_section_find(cf_root(client->cs), "server", client->server) : NULL;
+			if (!cs) cs = virtual_server_find(client->server);
 			if (!cs) {
 				ERROR("Failed to find virtual server %s", client->server);
 				return false;
@@ -282,7 +308,7 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	/*
 	 *	Cannot insert the same client twice.
 	 */
-	old = fr_trie_match_by_key(trie, &client->ipaddr.addr, client->ipaddr.prefix);
+	old = clients_trie_match(clients, &client->ipaddr, client->proto);
 
 #else  /* WITH_TRIE */
 
@@ -379,7 +405,7 @@ RADCLIENT *client_findbynumber(UNUSED const RADCLIENT_LIST *clients, UNUSED int
 RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr, int proto)
 {
 #ifdef WITH_TRIE
-	fr_trie_t *trie;
+	RADCLIENT *client;
 #else
 	int i, max;
 	RADCLIENT my_client, *client;
@@ -390,12 +416,24 @@ RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
 	if (!clients || !ipaddr) return NULL;
 
 #ifdef WITH_TRIE
-	trie = clients_trie(clients, ipaddr, proto);
+	if ((ipaddr->af != AF_INET) && (ipaddr->af != AF_INET6)) return NULL;
+
+	client = fr_trie_lookup_by_key(clients_trie(clients, ipaddr, IPPROTO_IP), &ipaddr->addr, ipaddr->prefix);
 
-	return fr_trie_lookup_by_key(trie, &ipaddr->addr, ipaddr->prefix);
+	/*
+	 *	A wildcard lookup matches clients of any protocol.
+	 */
+	if (proto == IPPROTO_IP) {
+		client = client_longest(client, fr_trie_lookup_by_key(clients_trie(clients, ipaddr, IPPROTO_UDP),
+								      &ipaddr->addr, ipaddr->prefix));
+		proto = IPPROTO_TCP;
+	}
+
+	return client_longest(client, fr_trie_lookup_by_key(clients_trie(clients, ipaddr, proto),
+							    &ipaddr->addr, ipaddr->prefix));
 #else
 
-	if (proto == AF_INET) {
+	if (ipaddr->af == AF_INET) {
 		max = 32;
 	} else {
 		max = 128;
@@ -429,6 +467,9 @@ static CONF_PARSER limit_config[] = {
 	{ FR_CONF_OFFSET("lifetime", FR_TYPE_UINT32, RADCLIENT, limit.lifetime), .dflt = "0" },
 
 	{ FR_CONF_OFFSET("idle_timeout", FR_TYPE_UINT32, RADCLIENT, limit.idle_timeout), .dflt = "30" },
+
+	{ FR_CONF_OFFSET("max_packets_per_second", FR_TYPE_UINT32, RADCLIENT, rate_limit), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_burst", FR_TYPE_UINT32, RADCLIENT, rate_burst), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -875,6 +916,25 @@ RADCLIENT *client_afrom_cs(TALLOC_CTX *ctx, CONF_SECTION *cs, CONF_SECTION *serv
 	}
 #endif
 
+	/*
+	 *	Pre-compute the HMAC key, so that signing replies
+	 *	only has to hash the packet.
+	 */
+	if (c->secret) {
+		c->secret_hmac = fr_hmac_md5_key_alloc(c, (uint8_t const *) c->secret,
+						       talloc_array_length(c->secret) - 1);
+		if (!c->secret_hmac) {
+			cf_log_perr(cs, "Failed pre-computing HMAC key for secret");
+			goto error;
+		}
+	}
+
+	/*
+	 *	By default, allow one second's worth of packets to
+	 *	arrive at once.
+	 */
+	if (c->rate_limit && !c->rate_burst) c->rate_burst = c->rate_limit;
+
 	if ((c->proto == IPPROTO_TCP) || (c->proto == IPPROTO_IP)) {
 		if ((c->limit.idle_timeout > 0) && (c->limit.idle_timeout < 5))
 			c->limit.idle_timeout = 5;
@@ -924,6 +984,13 @@ RADCLIENT *client_afrom_query(TALLOC_CTX *ctx, char const *identifier, char cons
 	 *	Other values (secret, shortname, nas_type, virtual_server)
 	 */
 	c->secret = talloc_typed_strdup(c, secret);
+	c->secret_hmac = fr_hmac_md5_key_alloc(c, (uint8_t const *) c->secret, talloc_array_length(c->secret) - 1);
+	if (!c->secret_hmac) {
+		PERROR("Failed pre-computing HMAC key for secret");
+		talloc_free(c);
+
+		return NULL;
+	}
 	if (shortname) c->shortname = talloc_typed_strdup(c, shortname);
 	if (type) c->nas_type = talloc_typed_strdup(c, type);
 	if (server) c->server = talloc_typed_strdup(c, server);
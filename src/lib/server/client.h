@@ -70,6 +70,13 @@ typedef int (*client_value_cb_t)(char **out, CONF_PAIR const *cp, void *data);
 #include <freeradius-devel/server/socket.h>
 #include <freeradius-devel/server/stats.h>
 #include <freeradius-devel/util/inet.h>
+#include <freeradius-devel/util/md5.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 
 /** Describes a host allowed to send packets to the server
  *
@@ -85,6 +92,8 @@ struct rad_client {
 	char const		*shortname;		//!< Client nickname.
 
 	char const		*secret;		//!< Secret PSK.
+	fr_hmac_md5_key_t	*secret_hmac;		//!< The secret, pre-computed for signing packets.
+							///< May be NULL, in which case the secret is used.
 
 	bool			message_authenticator;	//!< Require RADIUS message authenticator in requests.
 	bool			dynamic;		//!< Whether the client was dynamically defined.
@@ -113,6 +122,12 @@ struct rad_client {
 
 	int			proto;			//!< Protocol number.
 	fr_socket_limit_t	limit;			//!< Connections per client (TCP clients only).
+
+	uint32_t		rate_limit;		//!< Maximum packets per second.  0 for no limit.
+	uint32_t		rate_burst;		//!< How many packets may arrive at once.
+	atomic_uint_fast64_t	rate_limited;		//!< Packets discarded because of the rate limit.
+	atomic_uint_fast64_t	rate_tat;		//!< When the rate limit bucket will be full again.
+							///< Shared by all network threads and connections.
 };
 
 RADCLIENT_LIST	*client_list_init(CONF_SECTION *cs);
@@ -67,6 +67,18 @@ typedef enum {
 	PASS2_PAIRCOMPARE
 } fr_cond_pass2_t;
 
+/** Type specific comparator bound at compile time
+ *
+ * @param[in] op	Comparison operator.
+ * @param[in] a		Value taken from the attribute.
+ * @param[in] b		Pre-cast literal.
+ * @return
+ *	- 1 if true.
+ *	- 0 if false.
+ *	- -1 on failure.
+ */
+typedef int (*fr_cond_cmp_t)(fr_token_t op, fr_value_box_t const *a, fr_value_box_t const *b);
+
 /*
  *	Allow for the following structures:
  *
@@ -91,6 +103,9 @@ struct fr_cond_s {
 	bool			negate;		//!< Invert the result of the expression.
 	fr_cond_pass2_t		pass2_fixup;
 
+	fr_cond_cmp_t		cmp;		//!< Comparator for "&Attr OP literal".  If set,
+						///< the map is evaluated without a cursor or casts.
+
 	fr_cond_t		*parent;
 	fr_cond_t		*next;
 };
@@ -110,6 +125,8 @@ fr_cond_t *fr_cond_iter_next(fr_cond_iter_t *iter);
 
 void fr_cond_async_update(fr_cond_t *cond);
 
+void fr_cond_cmp_bind(fr_cond_t *head);
+
 #ifdef __cplusplus
 }
 #endif
@@ -630,6 +630,22 @@ static int cond_eval_map(request_t *request, fr_cond_t const *c,
 #endif
 
 	MAP_VERIFY(map);
+
+	/*
+	 *	&Attr OP literal, with the literal already cast to
+	 *	the attribute's type.  Find the attribute and
+	 *	compare it directly.  Return codes are the same as
+	 *	the cursor based code below.
+	 */
+	if (c->cmp) {
+		fr_pair_t *vp;
+
+		rcode = tmpl_find_vp(&vp, request, map->lhs);
+		if (rcode < 0) return rcode;
+
+		return c->cmp(map->op, &vp->data, tmpl_value(map->rhs));
+	}
+
 	preg = preg_free = NULL;
 
 	/*
@@ -661,8 +677,8 @@ static int cond_eval_map(request_t *request, fr_cond_t const *c,
 
 			if (!fr_cond_assert(rhs && tmpl_contains_regex(map->rhs))) goto done;
 
-			slen = regex_compile(request, &preg_free, rhs->vb_strvalue, rhs->vb_length,
-					     tmpl_regex_flags(map->rhs), true, true);
+			slen = regex_compile_cached(request, &preg_free, rhs->vb_strvalue, rhs->vb_length,
+						    tmpl_regex_flags(map->rhs), true);
 			if (slen <= 0) {
 				REMARKER(rhs->vb_strvalue, -slen, "%s", fr_strerror());
 				EVAL_DEBUG("FAIL %d", __LINE__);
@@ -838,11 +854,199 @@ done:
 	 *	Capture groups may have grabbed preg and put it into
 	 *	request data, in which case we don't free it.
 	 */
-	if (preg) talloc_free(preg_free);
+	if (preg) regex_release(preg_free);
 	return rcode;
 }
 
 
+/** Convert the result of a three way comparison to the result of an operator
+ *
+ */
+static inline CC_HINT(always_inline) int cond_cmp_result(fr_token_t op, int compare)
+{
+	switch (op) {
+	case T_OP_CMP_EQ:
+		return (compare == 0);
+
+	case T_OP_NE:
+		return (compare != 0);
+
+	case T_OP_LT:
+		return (compare < 0);
+
+	case T_OP_GT:
+		return (compare > 0);
+
+	case T_OP_LE:
+		return (compare <= 0);
+
+	case T_OP_GE:
+		return (compare >= 0);
+
+	default:
+		return 0;
+	}
+}
+
+#define COND_CMP_NUM(_type) \
+static int cond_cmp_##_type(fr_token_t op, fr_value_box_t const *a, fr_value_box_t const *b) \
+{ \
+	return cond_cmp_result(op, CMP(a->vb_##_type, b->vb_##_type)); \
+}
+
+COND_CMP_NUM(uint8)
+COND_CMP_NUM(uint16)
+COND_CMP_NUM(uint32)
+COND_CMP_NUM(uint64)
+COND_CMP_NUM(int8)
+COND_CMP_NUM(int16)
+COND_CMP_NUM(int32)
+COND_CMP_NUM(int64)
+COND_CMP_NUM(size)
+
+/** Equality for strings and octets
+ *
+ * Values of different lengths can never be equal, so we only
+ * call memcmp() when the lengths match.
+ */
+static int cond_cmp_buffer_eq(fr_token_t op, fr_value_box_t const *a, fr_value_box_t const *b)
+{
+	bool equal;
+
+	equal = (a->vb_length == b->vb_length) &&
+		((a->vb_length == 0) || (memcmp(a->vb_octets, b->vb_octets, a->vb_length) == 0));
+
+	return (op == T_OP_CMP_EQ) ? equal : !equal;
+}
+
+/** Pick a comparator for a map of the form "&Attr OP literal"
+ *
+ * @return the comparator, or NULL if the map has to go through the
+ *	generic code in cond_eval_map().
+ */
+static fr_cond_cmp_t cond_cmp_select(fr_cond_t const *c)
+{
+	map_t const		*map = c->data.map;
+	tmpl_attr_t const	*ar;
+	fr_dict_attr_t const	*da;
+	fr_type_t		type;
+
+	if (c->pass2_fixup != PASS2_FIXUP_NONE) return NULL;
+
+	switch (map->op) {
+	case T_OP_CMP_EQ:
+	case T_OP_NE:
+	case T_OP_LT:
+	case T_OP_GT:
+	case T_OP_LE:
+	case T_OP_GE:
+		break;
+
+	default:
+		return NULL;
+	}
+
+	/*
+	 *	The LHS must be a single attribute reference which
+	 *	tmpl_find_vp() can resolve without a cursor.
+	 */
+	if (!tmpl_is_attr(map->lhs) || !fr_type_is_null(map->lhs->cast)) return NULL;
+	if (fr_dlist_num_elements(&map->lhs->data.attribute.ar) != 1) return NULL;
+
+	ar = fr_dlist_head(&map->lhs->data.attribute.ar);
+	if ((ar->ar_num != NUM_ANY) && (ar->ar_num < 0)) return NULL;
+
+	da = ar->ar_da;
+	if (da->flags.is_unknown || da->flags.is_raw || da->flags.virtual) return NULL;
+
+	/*
+	 *	The RHS must be a literal, which the tokenizer
+	 *	has already cast to the attribute's type
+	 *	(or to a prefix of it).
+	 */
+	if (!tmpl_is_data(map->rhs)) return NULL;
+	type = tmpl_value_type(map->rhs);
+	if (!fr_type_is_null(map->rhs->cast) && (map->rhs->cast != type)) return NULL;
+
+	if (type != da->type) {
+		switch (da->type) {
+		case FR_TYPE_IPV4_ADDR:
+			if (type != FR_TYPE_IPV4_PREFIX) return NULL;
+			break;
+
+		case FR_TYPE_IPV6_ADDR:
+			if (type != FR_TYPE_IPV6_PREFIX) return NULL;
+			break;
+
+		default:
+			return NULL;
+		}
+
+		return fr_value_box_cmp_op;
+	}
+
+	switch (type) {
+	case FR_TYPE_UINT8:
+		return cond_cmp_uint8;
+
+	case FR_TYPE_UINT16:
+		return cond_cmp_uint16;
+
+	case FR_TYPE_UINT32:
+		return cond_cmp_uint32;
+
+	case FR_TYPE_UINT64:
+		return cond_cmp_uint64;
+
+	case FR_TYPE_INT8:
+		return cond_cmp_int8;
+
+	case FR_TYPE_INT16:
+		return cond_cmp_int16;
+
+	case FR_TYPE_INT32:
+		return cond_cmp_int32;
+
+	case FR_TYPE_INT64:
+		return cond_cmp_int64;
+
+	case FR_TYPE_SIZE:
+		return cond_cmp_size;
+
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+		if ((map->op == T_OP_CMP_EQ) || (map->op == T_OP_NE)) return cond_cmp_buffer_eq;
+		return fr_value_box_cmp_op;
+
+	case FR_TYPE_STRUCTURAL:
+		return NULL;
+
+	default:
+		return fr_value_box_cmp_op;
+	}
+}
+
+/** Bind type specific comparators to simple conditions
+ *
+ * Must be called after all pass2 fixups have been applied, as
+ * those may change the types of either side of the map.
+ *
+ * @param[in] head	of the condition tree.
+ */
+void fr_cond_cmp_bind(fr_cond_t *head)
+{
+	fr_cond_iter_t	iter;
+	fr_cond_t	*c;
+
+	for (c = fr_cond_iter_init(&iter, head);
+	     c;
+	     c = fr_cond_iter_next(&iter)) {
+		if (c->type != COND_TYPE_MAP) continue;
+
+		c->cmp = cond_cmp_select(c);
+	}
+}
+
 /** Evaluate a fr_cond_t;
  *
  * @param[in] request the request_t
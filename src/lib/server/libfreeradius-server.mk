@@ -2,6 +2,7 @@ TARGET		:= libfreeradius-server.a
 
 SOURCES	:= \
 	auth.c \
+	auth_cache.c \
 	base.c \
 	cf_file.c \
 	cf_parse.c \
@@ -15,6 +16,7 @@ SOURCES	:= \
 	dl_module.c \
 	exec.c \
 	exfile.c \
+	line_index.c \
 	log.c \
 	main_config.c \
 	main_loop.c \
@@ -23,11 +25,13 @@ SOURCES	:= \
 	map_proc.c \
 	method.c \
 	module.c \
+	offload.c \
 	paircmp.c \
 	pairmove.c \
 	password.c \
 	pool.c \
 	rcode.c \
+	reload.c \
 	regex.c \
 	request.c \
 	request_data.c \
@@ -0,0 +1,501 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/lib/server/line_index.c
+ * @brief Look up lines of a memory mapped text file by key, using a sorted index.
+ *
+ * Parsing a large file into talloc'd entries costs many times the size of
+ * the file in memory, and takes a long time.  Instead, the file is mapped
+ * read-only, and the only thing built is an array of line offsets, sorted
+ * by key.  Lookups are a binary search over that array, and the caller
+ * parses the matching lines itself, on demand.
+ *
+ * The array can be saved to an index file.  When the text file hasn't
+ * changed, later loads (and other processes) map the saved index instead
+ * of building it again, so the pages of both files are shared through the
+ * page cache, and loading takes no time at all.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/line_index.h>
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LINE_INDEX_MAGIC	"FRLIDX01"
+#define LINE_INDEX_ENDIAN	(0x01020304)
+
+/** Header of a saved index
+ *
+ * Followed by "count" uint64_t offsets.  The index is only valid on the
+ * machine which wrote it, which is checked by the "endian" field.
+ */
+typedef struct {
+	char		magic[8];		//!< LINE_INDEX_MAGIC.
+	uint32_t	endian;			//!< LINE_INDEX_ENDIAN.
+	uint32_t	params;			//!< Hash of fr_line_index_config_t.params.
+	uint64_t	data_len;		//!< Size of the text file when the index was built.
+	int64_t		data_mtime;		//!< Modification time of the text file.
+	uint64_t	data_ino;		//!< Inode of the text file, as it's usually replaced by rename.
+	uint64_t	count;			//!< Number of offsets.
+} line_index_header_t;
+
+struct fr_line_index_s {
+	char const		*filename;	//!< Text file.
+
+	uint8_t const		*data;		//!< Mapped text file.
+	size_t			data_len;
+
+	uint64_t const		*offsets;	//!< Start of each line with a key, sorted by key.
+	size_t			count;
+
+	void			*index_map;	//!< Mapped index file, if we're using one.
+	size_t			index_map_len;
+
+	fr_line_index_key_t	key;
+	void			*uctx;
+};
+
+/** Used to sort the lines when building the index
+ *
+ */
+typedef struct {
+	uint64_t		offset;
+	char const		*key;
+	size_t			keylen;
+} line_index_entry_t;
+
+static int _line_index_free(fr_line_index_t *idx)
+{
+	if (idx->data) munmap(UNCONST(uint8_t *, idx->data), idx->data_len);
+	if (idx->index_map) munmap(idx->index_map, idx->index_map_len);
+
+	return 0;
+}
+
+/** Return the line starting at offset, without the end of line characters
+ *
+ */
+static inline CC_HINT(always_inline) char const *line_index_line(fr_line_index_t const *idx, uint64_t offset, size_t *len)
+{
+	uint8_t const	*p, *end;
+
+	if (offset >= idx->data_len) {
+		*len = 0;
+		return NULL;
+	}
+
+	p = idx->data + offset;
+	end = memchr(p, '\n', idx->data_len - offset);
+	*len = end ? (size_t) (end - p) : (idx->data_len - offset);
+	if (*len && (p[*len - 1] == '\r')) (*len)--;
+
+	return (char const *) p;
+}
+
+static inline CC_HINT(always_inline) int8_t line_index_key_cmp(char const *a, size_t a_len, char const *b, size_t b_len)
+{
+	int ret;
+
+	ret = memcmp(a, b, a_len < b_len ? a_len : b_len);
+	if (ret != 0) return (ret > 0) - (ret < 0);
+
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+/** Compare the key of the line at position pos with a key
+ *
+ */
+static int8_t line_index_cmp(fr_line_index_t const *idx, size_t pos, char const *key, size_t keylen)
+{
+	char const	*line, *line_key;
+	size_t		len, line_keylen;
+
+	line = line_index_line(idx, idx->offsets[pos], &len);
+	if (!line || (idx->key(&line_key, &line_keylen, line, len, idx->uctx) != 1)) return -1;
+
+	return line_index_key_cmp(line_key, line_keylen, key, keylen);
+}
+
+static int line_index_entry_cmp(void const *one, void const *two)
+{
+	line_index_entry_t const *a = one, *b = two;
+	int8_t ret;
+
+	ret = line_index_key_cmp(a->key, a->keylen, b->key, b->keylen);
+	if (ret != 0) return ret;
+
+	/*
+	 *	Lines with the same key stay in file order.
+	 */
+	return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+/** Map a saved index, if it's still valid for the text file
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the saved index doesn't exist, or is out of date.
+ */
+static int line_index_open(fr_line_index_t *idx, char const *index_file, uint32_t params, struct stat const *data_st)
+{
+	int			fd;
+	struct stat		st;
+	void			*map;
+	line_index_header_t	const *hdr;
+
+	fd = open(index_file, O_RDONLY);
+	if (fd < 0) return -1;
+
+	if ((fstat(fd, &st) < 0) || ((size_t) st.st_size < sizeof(*hdr))) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return -1;
+
+	hdr = map;
+	if ((memcmp(hdr->magic, LINE_INDEX_MAGIC, sizeof(hdr->magic)) != 0) ||
+	    (hdr->endian != LINE_INDEX_ENDIAN) ||
+	    (hdr->params != params) ||
+	    (hdr->data_len != (uint64_t) data_st->st_size) ||
+	    (hdr->data_mtime != (int64_t) data_st->st_mtime) ||
+	    (hdr->data_ino != (uint64_t) data_st->st_ino) ||
+	    (hdr->count > (((size_t) st.st_size - sizeof(*hdr)) / sizeof(uint64_t))) ||
+	    ((sizeof(*hdr) + (hdr->count * sizeof(uint64_t))) != (size_t) st.st_size)) {
+		DEBUG2("Index %s is out of date for %s", index_file, idx->filename);
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	idx->index_map = map;
+	idx->index_map_len = st.st_size;
+	idx->offsets = (uint64_t const *) (hdr + 1);
+	idx->count = hdr->count;
+
+	return 0;
+}
+
+static int line_index_write(int fd, void const *data, size_t len)
+{
+	uint8_t const	*p = data;
+	ssize_t		slen;
+
+	while (len > 0) {
+		slen = write(fd, p, len);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += slen;
+		len -= slen;
+	}
+
+	return 0;
+}
+
+/** Save the index, replacing any previous index atomically
+ *
+ */
+static int line_index_save(fr_line_index_t const *idx, char const *index_file, uint32_t params, struct stat const *data_st)
+{
+	char			*tmp;
+	int			fd;
+	line_index_header_t	hdr = {
+					.endian = LINE_INDEX_ENDIAN,
+					.params = params,
+					.data_len = data_st->st_size,
+					.data_mtime = data_st->st_mtime,
+					.data_ino = data_st->st_ino,
+					.count = idx->count
+				};
+
+	memcpy(hdr.magic, LINE_INDEX_MAGIC, sizeof(hdr.magic));
+
+	MEM(tmp = talloc_asprintf(NULL, "%s.XXXXXX", index_file));
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		fr_strerror_printf("Failed creating %s: %s", tmp, fr_syserror(errno));
+		talloc_free(tmp);
+		return -1;
+	}
+
+	if ((line_index_write(fd, &hdr, sizeof(hdr)) < 0) ||
+	    (line_index_write(fd, idx->offsets, idx->count * sizeof(idx->offsets[0])) < 0)) {
+		fr_strerror_printf("Failed writing %s: %s", tmp, fr_syserror(errno));
+	error:
+		close(fd);
+		unlink(tmp);
+		talloc_free(tmp);
+		return -1;
+	}
+
+	if (fchmod(fd, 0644) < 0) {
+		fr_strerror_printf("Failed setting permissions on %s: %s", tmp, fr_syserror(errno));
+		goto error;
+	}
+
+	if (rename(tmp, index_file) < 0) {
+		fr_strerror_printf("Failed renaming %s to %s: %s", tmp, index_file, fr_syserror(errno));
+		goto error;
+	}
+
+	close(fd);
+	talloc_free(tmp);
+
+	return 0;
+}
+
+/** Find the key of every line, and sort the lines by key
+ *
+ */
+static int line_index_build(fr_line_index_t *idx, fr_line_index_config_t const *config)
+{
+	line_index_entry_t	*entries;
+	uint64_t		*offsets;
+	uint8_t const		*p, *end;
+	size_t			max = 1, count = 0, i;
+	uint64_t		offset = 0;
+	unsigned int		lineno = 0;
+
+	/*
+	 *	Count the lines first, so that we only need
+	 *	one allocation.
+	 */
+	for (p = idx->data, end = p + idx->data_len; p < end; p++) {
+		p = memchr(p, '\n', end - p);
+		if (!p) break;
+		max++;
+	}
+
+	MEM(entries = talloc_array(NULL, line_index_entry_t, max));
+
+	while (offset < idx->data_len) {
+		char const	*line;
+		size_t		len;
+		int		ret;
+
+		line = line_index_line(idx, offset, &len);
+		lineno++;
+
+		entries[count].offset = offset;
+
+		p = memchr(line, '\n', idx->data_len - offset);
+		offset = p ? (uint64_t) ((p + 1) - idx->data) : idx->data_len;
+
+		if ((lineno <= config->skip_lines) || !len) continue;
+
+		ret = idx->key(&entries[count].key, &entries[count].keylen, line, len, idx->uctx);
+		if (ret < 0) {
+			fr_strerror_printf("%s[%u]: Malformed line", idx->filename, lineno);
+		error:
+			talloc_free(entries);
+			return -1;
+		}
+		if (ret == 0) continue;
+
+		count++;
+	}
+
+	qsort(entries, count, sizeof(entries[0]), line_index_entry_cmp);
+
+	if (config->unique) {
+		for (i = 1; i < count; i++) {
+			if (line_index_key_cmp(entries[i - 1].key, entries[i - 1].keylen,
+					       entries[i].key, entries[i].keylen) != 0) continue;
+
+			fr_strerror_printf("%s: Multiple entries for key \"%.*s\" are disallowed", idx->filename,
+					   (int) entries[i].keylen, entries[i].key);
+			goto error;
+		}
+	}
+
+	MEM(offsets = talloc_array(idx, uint64_t, count));
+	for (i = 0; i < count; i++) offsets[i] = entries[i].offset;
+	talloc_free(entries);
+
+	idx->offsets = offsets;
+	idx->count = count;
+
+	return 0;
+}
+
+/** Map a text file, and index its lines by key
+ *
+ * If config->index_file is set, and contains a valid index for the text
+ * file, that index is used.  Otherwise a new index is built, and saved to
+ * config->index_file for next time.
+ *
+ * @note The text file should be replaced by renaming a new file over the top
+ *	of it, instead of being edited in place.  Edits made in place are
+ *	visible to lookups immediately, and may not match the index.
+ *
+ * @param[in] ctx	to allocate the index in.  Freeing the index unmaps
+ *			the files.
+ * @param[in] config	describing the file, and its keys.
+ * @return
+ *	- A new index on success.
+ *	- NULL on failure.
+ */
+fr_line_index_t *fr_line_index_alloc(TALLOC_CTX *ctx, fr_line_index_config_t const *config)
+{
+	fr_line_index_t	*idx;
+	int		fd;
+	struct stat	st;
+	uint32_t	params = fr_hash_string(config->params ? config->params : "");
+
+	MEM(idx = talloc_zero(ctx, fr_line_index_t));
+	MEM(idx->filename = talloc_strdup(idx, config->filename));
+	idx->key = config->key;
+	idx->uctx = config->uctx;
+	talloc_set_destructor(idx, _line_index_free);
+
+	fd = open(config->filename, O_RDONLY);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening %s: %s", config->filename, fr_syserror(errno));
+	error:
+		talloc_free(idx);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		fr_strerror_printf("Failed reading %s: %s", config->filename, fr_syserror(errno));
+		close(fd);
+		goto error;
+	}
+
+	/*
+	 *	Empty files can't be mapped.
+	 */
+	if (st.st_size > 0) {
+		void *map;
+
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			fr_strerror_printf("Failed mapping %s: %s", config->filename, fr_syserror(errno));
+			close(fd);
+			goto error;
+		}
+		idx->data = map;
+		idx->data_len = st.st_size;
+	}
+	close(fd);
+
+	if (config->index_file && (line_index_open(idx, config->index_file, params, &st) == 0)) {
+		DEBUG2("Using index %s for %s", config->index_file, config->filename);
+		return idx;
+	}
+
+	if (line_index_build(idx, config) < 0) goto error;
+
+	if (!config->index_file) return idx;
+
+	if (line_index_save(idx, config->index_file, params, &st) < 0) {
+		PWARN("Failed saving index for %s, continuing with an in-memory index", config->filename);
+		return idx;
+	}
+
+	/*
+	 *	Swap to the saved copy, so its pages are shared
+	 *	with any other process using the same files.
+	 */
+	{
+		uint64_t const *offsets = idx->offsets;
+
+		if (line_index_open(idx, config->index_file, params, &st) == 0) {
+			talloc_free(UNCONST(uint64_t *, offsets));
+		}
+	}
+
+	return idx;
+}
+
+/** Find the first line with a key
+ *
+ * @param[in] idx	to search.
+ * @param[out] pos	position of the line in the index, for
+ *			#fr_line_index_next.
+ * @param[out] len	length of the line, not including the end
+ *			of line characters.
+ * @param[in] key	to find.
+ * @param[in] keylen	length of the key.
+ * @return
+ *	- The matching line.  Not '\\0' terminated.
+ *	- NULL if no lines match.
+ */
+char const *fr_line_index_find(fr_line_index_t const *idx, size_t *pos, size_t *len,
+			       char const *key, size_t keylen)
+{
+	size_t lo = 0, hi = idx->count, mid;
+
+	while (lo < hi) {
+		mid = lo + ((hi - lo) / 2);
+
+		if (line_index_cmp(idx, mid, key, keylen) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if ((lo >= idx->count) || (line_index_cmp(idx, lo, key, keylen) != 0)) return NULL;
+
+	*pos = lo;
+	return line_index_line(idx, idx->offsets[lo], len);
+}
+
+/** Find the next line with the same key
+ *
+ * @param[in] idx	to search.
+ * @param[in,out] pos	from the previous call to #fr_line_index_find
+ *			or #fr_line_index_next.
+ * @param[out] len	length of the line.
+ * @param[in] key	to find.
+ * @param[in] keylen	length of the key.
+ * @return
+ *	- The next matching line, in file order.
+ *	- NULL if there are no more matching lines.
+ */
+char const *fr_line_index_next(fr_line_index_t const *idx, size_t *pos, size_t *len,
+			       char const *key, size_t keylen)
+{
+	size_t next = *pos + 1;
+
+	if ((next >= idx->count) || (line_index_cmp(idx, next, key, keylen) != 0)) return NULL;
+
+	*pos = next;
+	return line_index_line(idx, idx->offsets[next], len);
+}
+
+/** Return the number of lines which have keys
+ *
+ */
+size_t fr_line_index_num_lines(fr_line_index_t const *idx)
+{
+	return idx->count;
+}
@@ -0,0 +1,84 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/line_index.h
+ * @brief Look up lines of a memory mapped text file by key, using a sorted index.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(line_index_h, "$Id$")
+
+#include <freeradius-devel/util/talloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_line_index_s fr_line_index_t;
+
+/** Find the key of a line
+ *
+ * Called for every line when the index is built, and for every line
+ * compared during a lookup, possibly from many threads at once.  It
+ * must not modify the line, or anything else.
+ *
+ * @param[out] key	Where to write a pointer to the key.  Must point
+ *			into the line.
+ * @param[out] keylen	Where to write the length of the key.
+ * @param[in] line	to find the key in.  Not '\\0' terminated, and
+ *			does not include the end of line characters.
+ * @param[in] len	Length of the line.
+ * @param[in] uctx	from #fr_line_index_config_t.
+ * @return
+ *	- 1 if the line has a key.
+ *	- 0 if the line should be ignored, e.g. blank lines and comments.
+ *	- -1 if the line is malformed.
+ */
+typedef int (*fr_line_index_key_t)(char const **key, size_t *keylen,
+				   char const *line, size_t len, void *uctx);
+
+typedef struct {
+	char const		*filename;	//!< Text file to index.
+	char const		*index_file;	//!< Where to save the index, so it can be re-used
+						///< by later loads, and by other processes.
+						///< May be NULL.
+	char const		*params;	//!< Describes how keys are found, e.g. which field,
+						///< and the delimiter.  A saved index is only re-used
+						///< when this matches.
+	unsigned int		skip_lines;	//!< Leading lines to ignore, e.g. a header.
+	bool			unique;		//!< Whether multiple lines may have the same key.
+
+	fr_line_index_key_t	key;		//!< Finds the key of a line.
+	void			*uctx;		//!< Passed to key.
+} fr_line_index_config_t;
+
+fr_line_index_t	*fr_line_index_alloc(TALLOC_CTX *ctx, fr_line_index_config_t const *config);
+
+char const	*fr_line_index_find(fr_line_index_t const *idx, size_t *pos, size_t *len,
+				    char const *key, size_t keylen) CC_HINT(nonnull);
+
+char const	*fr_line_index_next(fr_line_index_t const *idx, size_t *pos, size_t *len,
+				    char const *key, size_t keylen) CC_HINT(nonnull);
+
+size_t		fr_line_index_num_lines(fr_line_index_t const *idx) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -269,6 +269,7 @@ void vlog_request(fr_log_type_t type, fr_log_lvl_t lvl, request_t *request,
 {
 	char const	*filename;
 	FILE		*fp = NULL;
+	int		fd = -1;
 
 	char		*p;
 	char const	*extra = "";
@@ -312,13 +313,16 @@ void vlog_request(fr_log_type_t type, fr_log_lvl_t lvl, request_t *request,
 		/*
 		 *	If we're debugging to a file, then use that.
 		 *
-		 *	@todo: have fr_vlog() take a fr_log_t*, so
-		 *	that we can cache the opened descriptor, and
-		 *	we don't need to re-open it on every log
-		 *	message.
+		 *	The log file is normally already open, so
+		 *	write to its descriptor rather than
+		 *	re-opening the file for every message.
 		 */
 		switch (log_dst->dst) {
 		case L_DST_FILES:
+			if (log_dst->fd >= 0) {
+				fd = log_dst->fd;
+				break;
+			}
 			fp = fopen(log_dst->file, "a");
 			if (!fp) goto finish;
 			break;
@@ -445,34 +449,14 @@ print_fmt:
 	/*
 	 *	Logging to a file descriptor
 	 */
-	if (fp) {
-		char time_buff[64];	/* The current timestamp */
-
-		time_t timeval;
-		timeval = time(NULL);
+	if (fp || (fd >= 0)) {
+		char *msg;
 
 #if 0
 		fmt_location = talloc_typed_asprintf(pool, "%s[%i]: ", file, line);
 #endif
 
-#ifdef HAVE_GMTIME_R
-		if (log_dates_utc) {
-			struct tm utc;
-			gmtime_r(&timeval, &utc);
-			ASCTIME_R(&utc, time_buff, sizeof(time_buff));
-		} else
-#endif
-		{
-			CTIME_R(&timeval, time_buff, sizeof(time_buff));
-		}
-
-		/*
-		 *	Strip trailing new lines
-		 */
-		p = strrchr(time_buff, '\n');
-		if (p) p[0] = '\0';
-
-		fprintf(fp,
+		msg = talloc_typed_asprintf(pool,
 			"%s"		/* location */
 			"%s"		/* prefix */
 			"%s : "		/* time */
@@ -483,12 +467,26 @@ print_fmt:
 			"\n",
 			fmt_location,
 			fmt_prefix,
-			time_buff,
+			fr_log_time_str(log_dates_utc),
 			fr_table_str_by_value(fr_log_levels, type, ""),
 			unlang_indent, spaces,
 			fmt_module,
 			fmt_exp);
-		fclose(fp);
+		if (!msg) {
+			if (fp) fclose(fp);
+			goto finish;
+		}
+
+		/*
+		 *	One write per message, so that messages from
+		 *	different threads aren't interleaved.
+		 */
+		if (fp) {
+			fputs(msg, fp);
+			fclose(fp);
+		} else {
+			(void) write(fd, msg, talloc_array_length(msg) - 1);
+		}
 		goto finish;
 	}
 
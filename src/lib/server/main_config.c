@@ -166,6 +166,10 @@ static const CONF_PARSER thread_config[] = {
 	  .func = num_networks_parse },
 	{ FR_CONF_OFFSET("num_workers", FR_TYPE_UINT32, main_config_t, max_workers), .dflt = STRINGIFY(4),
 	  .func = num_workers_parse },
+	{ FR_CONF_OFFSET("worker_select", FR_TYPE_STRING, main_config_t, worker_select), .dflt = "cpu_time" },
+	{ FR_CONF_OFFSET("cpu_affinity", FR_TYPE_BOOL, main_config_t, cpu_affinity), .dflt = "no" },
+	{ FR_CONF_OFFSET("queue_delay_target", FR_TYPE_TIME_DELTA, main_config_t, queue_delay_target), .dflt = "0.1" },
+	{ FR_CONF_OFFSET("queue_delay_interval", FR_TYPE_TIME_DELTA, main_config_t, queue_delay_interval), .dflt = "0.5" },
 
 	{ FR_CONF_OFFSET("stats_interval", FR_TYPE_TIME_DELTA | FR_TYPE_HIDDEN, main_config_t, stats_interval), },
 
@@ -199,6 +203,8 @@ static const CONF_PARSER server_config[] = {
 
 	{ FR_CONF_OFFSET("debug_level", FR_TYPE_UINT32 | FR_TYPE_HIDDEN, main_config_t, debug_level), .dflt = "0" },
 	{ FR_CONF_OFFSET("max_requests", FR_TYPE_UINT32, main_config_t, max_requests), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_detached_requests", FR_TYPE_UINT32, main_config_t, max_detached_requests), .dflt = "0" },
+	{ FR_CONF_OFFSET("memory_accounting", FR_TYPE_BOOL, main_config_t, memory_accounting), .dflt = "no" },
 
 	{ FR_CONF_POINTER("log", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) log_config },
 
@@ -421,7 +427,8 @@ static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent,
 
 	memcpy(&value, out, sizeof(value));
 
-	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, ==, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, >=, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, <=, 64);
 
 	memcpy(out, &value, sizeof(value));
 
@@ -1260,6 +1267,11 @@ do {\
 	DEBUG("Parsing main configuration.");
 	if (cf_section_parse(config, config, cs) < 0) goto failure;
 
+	/*
+	 *	Size the pool requests allocate their pairs from.
+	 */
+	request_pool_size_set(config->talloc_pool_size);
+
 	/*
 	 *	Reset the colourisation state.  The configuration
 	 *	files can disable colourisation if the terminal
@@ -1359,9 +1371,44 @@ void hup_logfile(main_config_t *config)
 	}
 }
 
+/** Remember a file which has changed since the server started
+ *
+ */
+static void hup_file_changed(char const *filename, void *uctx)
+{
+	char const	***changed = uctx;
+	size_t		num = talloc_array_length(*changed);
+
+	MEM(*changed = talloc_realloc(NULL, *changed, char const *, num + 1));
+	(*changed)[num] = filename;
+
+	INFO("HUP - Configuration file %s has changed", filename);
+}
+
+/** Check whether a section was read from a file which has changed
+ *
+ */
+static bool hup_section_changed(char const **changed, CONF_SECTION const *cs)
+{
+	char const	*filename = cf_filename(cs);
+	size_t		i;
+
+	if (!filename) return false;
+
+	for (i = 0; i < talloc_array_length(changed); i++) {
+		if (strcmp(changed[i], filename) == 0) return true;
+	}
+
+	return false;
+}
+
 void main_config_hup(main_config_t *config)
 {
 	time_t		when;
+	int		rcode;
+	char const	**changed = NULL;
+	CONF_SECTION	*cs, *subcs;
+	unsigned int	num_modules = 0, num_servers = 0;
 
 	static time_t	last_hup = 0;
 
@@ -1384,5 +1431,49 @@ void main_config_hup(main_config_t *config)
 	}
 	last_hup = when;
 
-	INFO("HUP - NYI in version 4");	/* Not yet implemented in v4 */
+	/*
+	 *	Find out which parts of the configuration have
+	 *	changed.  The running configuration is left alone, so
+	 *	any worker threads keep processing requests.
+	 */
+	rcode = cf_file_changed(config->root_cs, hup_file_changed, &changed);
+	if (rcode == CF_FILE_NONE) {
+		INFO("HUP - No configuration files have changed");
+		return;
+	}
+
+	cs = cf_section_find(config->root_cs, "modules", NULL);
+	if (cs) {
+		for (subcs = cf_section_next(cs, NULL);
+		     subcs != NULL;
+		     subcs = cf_section_next(cs, subcs)) {
+			if (!hup_section_changed(changed, subcs)) continue;
+
+			INFO("HUP - Module %s has changed",
+			     cf_section_name2(subcs) ? cf_section_name2(subcs) : cf_section_name1(subcs));
+			num_modules++;
+		}
+	}
+
+	for (subcs = cf_section_find_next(config->root_cs, NULL, "server", CF_IDENT_ANY);
+	     subcs != NULL;
+	     subcs = cf_section_find_next(config->root_cs, subcs, "server", CF_IDENT_ANY)) {
+		if (!hup_section_changed(changed, subcs)) continue;
+
+		INFO("HUP - Virtual server %s has changed", cf_section_name2(subcs));
+		num_servers++;
+	}
+
+	if (rcode & CF_FILE_ERROR) WARN("HUP - One or more configuration files could not be checked");
+
+	/*
+	 *	@todo - compile the new configuration in the
+	 *	background, and switch the workers over to it.  Until
+	 *	then, the changes only take effect on restart.
+	 */
+	INFO("HUP - %zu configuration file(s) changed, affecting %u module(s) and %u virtual server(s).  "
+	     "Reloading is NYI in version 4, restart the server to apply the changes",
+	     talloc_array_length(changed), num_modules, num_servers);
+
+	talloc_free(changed);
 }
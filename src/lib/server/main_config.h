@@ -96,6 +96,10 @@ struct main_config_s {
 
 	uint32_t	max_requests;			//!< maximum number of requests outstanding
 
+	uint32_t	max_detached_requests;		//!< maximum number of detached requests waiting to run
+
+	bool		memory_accounting;		//!< Track memory used by requests, modules, and shared trees.
+
 	bool		write_pid;			//!< write the PID file
 
 #ifdef HAVE_SETUID
@@ -148,6 +152,10 @@ struct main_config_s {
 
 	uint32_t	max_networks;			//!< for the scheduler
 	uint32_t	max_workers;			//!< for the scheduler
+	char const	*worker_select;			//!< how the scheduler chooses a worker for a request.
+	bool		cpu_affinity;			//!< pin network and worker threads to CPUs.
+	fr_time_delta_t	queue_delay_target;		//!< shed load when requests queue for longer than this.
+	fr_time_delta_t	queue_delay_interval;		//!< over this interval.
 	fr_time_delta_t	stats_interval;			//!< for the scheduler
 
 };
@@ -35,6 +35,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/radmin.h>
 #include <freeradius-devel/server/request_data.h>
 #include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/startup.h>
 
 static TALLOC_CTX *instance_ctx = NULL;
 static size_t instance_num = 1;
@@ -165,8 +166,59 @@ static int cmd_set_module_status(UNUSED FILE *fp, FILE *fp_err, void *ctx, fr_cm
 	return 0;
 }
 
+/** Names of the call accounting counters, as printed by radmin
+ *
+ */
+static char const * const module_stats_names[MODULE_STATS_MAX] = {
+	[MODULE_STATS_CALLS]				= "calls",
+	[MODULE_STATS_RESUMES]				= "resumes",
+	[MODULE_STATS_YIELDS]				= "yields",
+	[MODULE_STATS_CANCELLED]			= "cancelled",
+	[MODULE_STATS_CPU_NSEC]				= "cpu_nsec",
+	[MODULE_STATS_WALL_NSEC]			= "wall_nsec",
+
+	[MODULE_STATS_RCODE + RLM_MODULE_REJECT]	= "reject",
+	[MODULE_STATS_RCODE + RLM_MODULE_FAIL]		= "fail",
+	[MODULE_STATS_RCODE + RLM_MODULE_OK]		= "ok",
+	[MODULE_STATS_RCODE + RLM_MODULE_HANDLED]	= "handled",
+	[MODULE_STATS_RCODE + RLM_MODULE_INVALID]	= "invalid",
+	[MODULE_STATS_RCODE + RLM_MODULE_DISALLOW]	= "disallow",
+	[MODULE_STATS_RCODE + RLM_MODULE_NOTFOUND]	= "notfound",
+	[MODULE_STATS_RCODE + RLM_MODULE_NOOP]		= "noop",
+	[MODULE_STATS_RCODE + RLM_MODULE_UPDATED]	= "updated",
+};
+
+static int cmd_show_module_stats(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	module_instance_t	*mi = ctx;
+	size_t			i, len;
+	unsigned int		j;
+
+	len = talloc_array_length(mi->stats);
+	for (i = 0; i < len; i++) {
+		uint64_t	totals[MODULE_STATS_MAX];
+
+		fr_stats_counters_read(totals, mi->stats[i].counters);
+		if (!totals[MODULE_STATS_CALLS]) continue;
+
+		for (j = 0; j < MODULE_STATS_MAX; j++) {
+			fprintf(fp, "%s.%s\t%" PRIu64 "\n", mi->stats[i].method, module_stats_names[j], totals[j]);
+		}
+	}
+
+	return 0;
+}
 
 static fr_cmd_table_t cmd_module_table[] = {
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "stats",
+		.func = cmd_show_module_stats,
+		.help = "Show call counts, CPU and wall clock time, and results for each method of a module.",
+		.read_only = true,
+	},
+
 	{
 		.parent = "show module",
 		.add_name = true,
@@ -1147,6 +1199,177 @@ int modules_init(void)
 	return 0;
 }
 
+/** Find or create the call accounting counters for a method of a module
+ *
+ * Called when module calls are compiled, so that each worker thread
+ * can allocate its slots when it starts.  Methods registered after
+ * the workers have started are not counted.
+ *
+ * @param[in] mi	Module instance being called.
+ * @param[in] name1	of the section the call is in, e.g. "recv".  NULL for
+ *			calls made with unlang_module_push().
+ * @param[in] name2	of the section the call is in, e.g. "Access-Request".  May be NULL.
+ * @return
+ *	- The index of the counters, to pass to module_thread_stats().
+ *	- -1 on failure.
+ */
+int module_stats_method(module_instance_t *mi, char const *name1, char const *name2)
+{
+	module_method_stats_t	*ms;
+	fr_stats_counters_t	*counters;
+	char			*method, *name;
+	size_t			i, len;
+
+	/*
+	 *	Entry 0 always exists, so pushed calls
+	 *	don't need to look anything up.
+	 */
+	if (!mi->stats && name1) {
+		if (module_stats_method(mi, NULL, NULL) < 0) return -1;
+	}
+
+	if (!name1) {
+		method = talloc_strdup(NULL, "push");
+	} else if (!name2) {
+		method = talloc_strdup(NULL, name1);
+	} else {
+		method = talloc_asprintf(NULL, "%s.%s", name1, name2);
+	}
+	if (!method) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	len = talloc_array_length(mi->stats);
+	for (i = 0; i < len; i++) {
+		if (strcmp(mi->stats[i].method, method) == 0) {
+			talloc_free(method);
+			return i;
+		}
+	}
+
+	name = talloc_asprintf(method, "%s.%s", mi->name, method);
+	counters = name ? fr_stats_counters_alloc(mi, "module_calls", name, module_stats_names, MODULE_STATS_MAX) : NULL;
+	if (!counters) {
+		talloc_free(method);
+		goto oom;
+	}
+	talloc_free(name);
+
+	ms = talloc_realloc(mi, mi->stats, module_method_stats_t, len + 1);
+	if (!ms) {
+		talloc_free(counters);
+		talloc_free(method);
+		goto oom;
+	}
+	mi->stats = ms;
+	mi->stats[len] = (module_method_stats_t){
+		.method = talloc_steal(counters, method),
+		.counters = counters
+	};
+
+	return len;
+}
+
+/** Print one OpenMetrics counter family, with a sample for each module method which has been called
+ *
+ */
+static void module_openmetrics_family(FILE *fp, char const *name, char const *help, module_stats_t idx, bool seconds)
+{
+	fr_rb_iter_inorder_t	iter;
+	void			*instance;
+
+	fprintf(fp, "# TYPE %s counter\n", name);
+	fprintf(fp, "# HELP %s %s\n", name, help);
+
+	for (instance = fr_rb_iter_init_inorder(&iter, module_instance_name_tree);
+	     instance;
+	     instance = fr_rb_iter_next_inorder(&iter)) {
+		module_instance_t	*mi = talloc_get_type_abort(instance, module_instance_t);
+		size_t			i, len = talloc_array_length(mi->stats);
+
+		for (i = 0; i < len; i++) {
+			uint64_t	totals[MODULE_STATS_MAX];
+			unsigned int	j;
+
+			fr_stats_counters_read(totals, mi->stats[i].counters);
+			if (!totals[MODULE_STATS_CALLS]) continue;
+
+			if (idx != MODULE_STATS_RCODE) {
+				fprintf(fp, "%s_total{module=\"%s\",method=\"%s\"} ", name, mi->name, mi->stats[i].method);
+				if (seconds) {
+					fprintf(fp, "%" PRIu64 ".%06u\n", totals[idx] / NSEC,
+						(unsigned int) (totals[idx] % NSEC) / 1000);
+				} else {
+					fprintf(fp, "%" PRIu64 "\n", totals[idx]);
+				}
+				continue;
+			}
+
+			for (j = MODULE_STATS_RCODE; j < MODULE_STATS_MAX; j++) {
+				fprintf(fp, "%s_total{module=\"%s\",method=\"%s\",rcode=\"%s\"} %" PRIu64 "\n",
+					name, mi->name, mi->stats[i].method, module_stats_names[j], totals[j]);
+			}
+		}
+	}
+}
+
+/** Print the call accounting counters for all modules in OpenMetrics text format
+ *
+ * The caller is responsible for printing the terminating "# EOF".
+ *
+ * @param[in] fp	to write to.
+ */
+void modules_openmetrics_fprint(FILE *fp)
+{
+	module_openmetrics_family(fp, "freeradius_module_calls", "Module method calls.",
+				  MODULE_STATS_CALLS, false);
+	module_openmetrics_family(fp, "freeradius_module_resumes", "Module resume function calls.",
+				  MODULE_STATS_RESUMES, false);
+	module_openmetrics_family(fp, "freeradius_module_yields", "Times a module yielded.",
+				  MODULE_STATS_YIELDS, false);
+	module_openmetrics_family(fp, "freeradius_module_cancelled", "Module calls cancelled while yielded.",
+				  MODULE_STATS_CANCELLED, false);
+	module_openmetrics_family(fp, "freeradius_module_cpu_seconds", "Thread CPU time spent in module calls.",
+				  MODULE_STATS_CPU_NSEC, true);
+	module_openmetrics_family(fp, "freeradius_module_wall_seconds", "Time from module call to result, including yields.",
+				  MODULE_STATS_WALL_NSEC, true);
+	module_openmetrics_family(fp, "freeradius_module_results", "Module call results, by rcode.",
+				  MODULE_STATS_RCODE, false);
+}
+
+/** Record how much memory this thread's module instance data uses
+ *
+ * Only does anything if memory_accounting is enabled.  The thread
+ * instance data is only ever touched by its own thread, so this must
+ * be called from the thread which owns it.  The totals over all
+ * threads are in the "memory" counters for each module instance.
+ */
+void modules_thread_memory_sample(void)
+{
+	size_t i, len;
+
+	if (!module_thread_inst_array) return;
+
+	len = talloc_array_length(module_thread_inst_array);
+	for (i = 0; i < len; i++) {
+		module_thread_instance_t *ti = module_thread_inst_array[i];
+
+		if (!ti || !ti->memory) continue;
+
+		/*
+		 *	talloc_total_size(NULL) is the size of
+		 *	the NULL context, which is not what we
+		 *	want.
+		 */
+		if (!ti->data) continue;
+
+		FR_STATS_COUNTER_SET(ti->memory, FR_STATS_MEMORY_BYTES, talloc_total_size(ti->data));
+		FR_STATS_COUNTER_SET(ti->memory, FR_STATS_MEMORY_BLOCKS, talloc_total_blocks(ti->data));
+	}
+}
+
 /** Destructor for module_thread_instance_t array
  */
 static int _module_thread_inst_array_free(module_thread_instance_t **array)
@@ -1220,6 +1443,23 @@ int modules_thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el)
 		ti->module = mi->module;
 		ti->mod_inst = mi->dl_inst->data;	/* For efficient lookups */
 
+		/*
+		 *	All methods have been compiled by now, so
+		 *	this is the full set of call accounting
+		 *	counters the thread will ever update.
+		 */
+		ti->num_stats = talloc_array_length(mi->stats);
+		if (ti->num_stats) {
+			unsigned int i;
+
+			MEM(ti->stats = talloc_array(ti, fr_stats_slot_t *, ti->num_stats));
+			for (i = 0; i < ti->num_stats; i++) {
+				MEM(ti->stats[i] = fr_stats_counters_slot(mi->stats[i].counters));
+			}
+		}
+
+		if (mi->memory) MEM(ti->memory = fr_stats_counters_slot(mi->memory));
+
 		if (mi->module->thread_inst_size) {
 			MEM(ti->data = talloc_zero_array(ti, uint8_t, mi->module->thread_inst_size));
 
@@ -1271,6 +1511,7 @@ void modules_thread_detach(void)
 static int _module_instantiate(void *instance)
 {
 	module_instance_t *mi = talloc_get_type_abort(instance, module_instance_t);
+	int phase;
 
 	if (mi->instantiated) return 0;
 
@@ -1279,12 +1520,34 @@ static int _module_instantiate(void *instance)
 		return -1;
 	}
 
+	if (module_stats_method(mi, NULL, NULL) < 0) {
+		PERROR("Failed allocating statistics for module %s", mi->name);
+		return -1;
+	}
+
+	if (main_config->memory_accounting && mi->module->thread_inst_size) {
+		char *name;
+
+		MEM(name = talloc_asprintf(NULL, "module.%s", mi->name));
+		mi->memory = fr_stats_memory_alloc(mi, name);
+		talloc_free(name);
+		if (!mi->memory) {
+			PERROR("Failed allocating memory statistics for module %s", mi->name);
+			return -1;
+		}
+	}
+
+	phase = fr_startup_phase_start("module instantiate", mi->name);
+
 	/*
 	 *	Now that ALL modules are instantiated, and ALL xlats
 	 *	are defined, go compile the config items marked as XLAT.
 	 */
 	if (mi->module->config && (cf_section_parse_pass2(mi->dl_inst->data,
-							  mi->dl_inst->conf) < 0)) return -1;
+							  mi->dl_inst->conf) < 0)) {
+		fr_startup_phase_end(phase);
+		return -1;
+	}
 
 	/*
 	 *	Call the instantiate method, if any.
@@ -1298,10 +1561,11 @@ static int _module_instantiate(void *instance)
 		if ((mi->module->instantiate)(mi->dl_inst->data, mi->dl_inst->conf) < 0) {
 			cf_log_err(mi->dl_inst->conf, "Instantiation failed for module \"%s\"",
 				   mi->name);
-
+			fr_startup_phase_end(phase);
 			return -1;
 		}
 	}
+	fr_startup_phase_end(phase);
 
 	/*
 	 *	If we're threaded, check if the module is thread-safe.
@@ -1465,20 +1729,7 @@ static int _module_instance_free(module_instance_t *mi)
 	return 0;
 }
 
-/** Bootstrap a module
- *
- * Load the module shared library, allocate instance data for it,
- * parse the module configuration, and call the modules "bootstrap" method.
- *
- * @param[in] parent	of the module being bootstrapped, if this is a submodule.
- *			If this is not a submodule parent must be NULL.
- * @param[in] cs	containing the configuration for this module or submodule.
- * @return
- *	- A new module instance handle, containing the module's public interface,
- *	  and private instance data.
- *	- NULL on error.
- */
-module_instance_t *module_bootstrap(module_instance_t const *parent, CONF_SECTION *cs)
+static module_instance_t *_module_bootstrap(module_instance_t const *parent, CONF_SECTION *cs)
 {
 	char			*inst_name = NULL;
 	module_instance_t	*mi;
@@ -1564,6 +1815,32 @@ module_instance_t *module_bootstrap(module_instance_t const *parent, CONF_SECTIO
 	return mi;
 }
 
+/** Bootstrap a module
+ *
+ * Load the module shared library, allocate instance data for it,
+ * parse the module configuration, and call the modules "bootstrap" method.
+ *
+ * @param[in] parent	of the module being bootstrapped, if this is a submodule.
+ *			If this is not a submodule parent must be NULL.
+ * @param[in] cs	containing the configuration for this module or submodule.
+ * @return
+ *	- A new module instance handle, containing the module's public interface,
+ *	  and private instance data.
+ *	- NULL on error.
+ */
+module_instance_t *module_bootstrap(module_instance_t const *parent, CONF_SECTION *cs)
+{
+	module_instance_t	*mi;
+	char const		*name = cf_section_name2(cs);
+	int			phase;
+
+	phase = fr_startup_phase_start("module bootstrap", name ? name : cf_section_name1(cs));
+	mi = _module_bootstrap(parent, cs);
+	fr_startup_phase_end(phase);
+
+	return mi;
+}
+
 /** Bootstrap a virtual module from an instantiate section
  *
  * @param[in] vm_cs	that defines the virtual module.
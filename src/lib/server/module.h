@@ -100,6 +100,18 @@ typedef int (*module_thread_instantiate_t)(CONF_SECTION const *mod_cs, void *ins
  */
 typedef int (*module_thread_detach_t)(fr_event_list_t *el, void *thread);
 
+/** Module cost callback
+ *
+ * Is called by "load-balance" and "redundant-load-balance" sections
+ * to choose between module instances.  The value only has to be
+ * comparable between instances of the same module.
+ *
+ * @param[in] instance		data, specific to an instantiated module.
+ * @param[in] thread		data specific to this module instance.
+ * @return an estimate of the cost of calling the module now.  Lower is better.
+ */
+typedef uint64_t (*module_cost_t)(void const *instance, void *thread);
+
 #define FR_MODULE_COMMON \
 	struct { \
 		module_instantiate_t		bootstrap;		\
@@ -178,8 +190,38 @@ struct module_s {
 	module_method_t			methods[MOD_COUNT];	//!< Pointers to the various section callbacks.
 	module_method_names_t const	*method_names;		//!< named methods
 	fr_dict_t const			**dict;			//!< pointer to local fr_dict_t*
+
+	module_cost_t			cost;			//!< Estimate the cost of calling this module,
+								///< for load-balancing.
 };
 
+/** Indexes into the call accounting counters for a module method
+ *
+ * One set of counters is kept for each method of each module instance,
+ * and each worker thread gets its own slot, so updating them is never
+ * contended.  The totals can be seen with `show module <name> stats`,
+ * `stats counters module_calls`, and `stats openmetrics`.
+ */
+typedef enum {
+	MODULE_STATS_CALLS = 0,					//!< Times the method was called.
+	MODULE_STATS_RESUMES,					//!< Times a resume function was called.
+	MODULE_STATS_YIELDS,					//!< Times the module yielded.
+	MODULE_STATS_CANCELLED,					//!< Calls cancelled while yielded.
+	MODULE_STATS_CPU_NSEC,					//!< Thread CPU time spent in the module.
+	MODULE_STATS_WALL_NSEC,					//!< Time from the call to the result, including
+								///< any time spent yielded.
+	MODULE_STATS_RCODE,					//!< Start of the per rcode result counters.
+	MODULE_STATS_MAX = MODULE_STATS_RCODE + RLM_MODULE_NUMCODES
+} module_stats_t;
+
+/** Call accounting counters for one method of a module instance
+ *
+ */
+typedef struct {
+	char const			*method;		//!< e.g. "recv.Access-Request".
+	fr_stats_counters_t		*counters;		//!< Call, time and result counters.
+} module_method_stats_t;
+
 /** Per instance data
  *
  * Per-instance data structure, to correlate the modules with the
@@ -225,6 +267,12 @@ struct module_instance_s {
 	bool				in_name_tree;	//!< Whether this is in the name lookup tree.
 	bool				in_data_tree;	//!< Whether this is in the data lookup tree.
 	/** @} */
+
+	module_method_stats_t		*stats;		//!< Call accounting, one entry per method compiled.
+							///< Entry 0 is for calls pushed with unlang_module_push().
+
+	fr_stats_counters_t		*memory;	//!< Memory used by each thread's instance data.
+							///< Only allocated if memory_accounting is enabled.
 };
 
 /** Per thread per instance data
@@ -245,6 +293,11 @@ struct module_thread_instance_s {
 
 	uint64_t			total_calls;	//! total number of times we've been called
 	uint64_t			active_callers; //! number of active callers.  i.e. number of current yields
+
+	fr_stats_slot_t			**stats;	//!< This thread's slot for each entry in module_instance_t stats.
+	unsigned int			num_stats;	//!< How many entries there are in stats.
+
+	fr_stats_slot_t			*memory;	//!< This thread's slot in module_instance_t memory.
 };
 
 /** Map string values to module state method
@@ -296,6 +349,31 @@ char const	*module_state_method_to_str(module_state_func_table_t const *table,
 bool		module_section_type_set(request_t *request, fr_dict_attr_t const *type_da, fr_dict_enum_t const *enumv);
 /** @} */
 
+/** @name Call accounting
+ *
+ * @{
+ */
+int		module_stats_method(module_instance_t *mi, char const *name1, char const *name2) CC_HINT(nonnull(1));
+
+/** Return this thread's call accounting slot for a method
+ *
+ * @param[in] ti	Thread instance of the module being called.
+ * @param[in] idx	as returned by module_stats_method().
+ * @return
+ *	- The slot to update.
+ *	- NULL if the method was registered after this thread started.
+ */
+static inline fr_stats_slot_t *module_thread_stats(module_thread_instance_t const *ti, unsigned int idx)
+{
+	if (idx >= ti->num_stats) return NULL;
+	return ti->stats[idx];
+}
+
+void		modules_openmetrics_fprint(FILE *fp) CC_HINT(nonnull);
+
+void		modules_thread_memory_sample(void);
+/** @} */
+
 /** @name Module and module thread lookup
  *
  * @{
@@ -0,0 +1,366 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/lib/server/offload.c
+ * @brief Run blocking library calls on helper threads, and resume the request when they complete.
+ *
+ * Some client libraries (libwbclient for example) only offer a blocking API.
+ * Calling them from a worker stalls every request the worker owns for the
+ * duration of the call.  Instead, the call is queued to a small pool of
+ * helper threads, the request yields, and the helper signals completion
+ * through a pipe that the worker's event loop is watching.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/offload.h>
+#include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <pthread.h>
+
+typedef enum {
+	OFFLOAD_JOB_QUEUED = 0,				//!< Waiting for a helper thread.
+	OFFLOAD_JOB_RUNNING,				//!< A helper thread is running func.
+	OFFLOAD_JOB_DONE,				//!< func has returned, and the worker has been signalled.
+	OFFLOAD_JOB_CANCELLED				//!< The request went away while func was running.
+} fr_offload_job_state_t;
+
+struct fr_offload_s {
+	char const		*name;			//!< For debug messages.
+
+	pthread_mutex_t		mutex;			//!< Protects the queue, and the state of every job.
+	pthread_cond_t		cond;			//!< Signalled when jobs are queued, or on shutdown.
+	fr_dlist_head_t		queue;			//!< Jobs waiting for a helper thread.
+	unsigned int		max_queued;		//!< Refuse new jobs when this many are waiting.
+							///< 0 means no limit.
+
+	unsigned int		num_threads;		//!< How many helper threads to start.
+	pthread_t		*threads;		//!< Started on first use, just in case we fork.
+	bool			started;		//!< Whether the helper threads have been started.
+	bool			stop;			//!< Tell the helper threads to exit.
+};
+
+struct fr_offload_job_s {
+	fr_dlist_t		entry;			//!< Entry in the queue.
+	fr_offload_t		*ol;			//!< The pool this job was queued to.
+
+	fr_offload_job_state_t	state;			//!< Protected by ol->mutex.
+
+	fr_offload_func_t	func;			//!< To run on the helper thread.
+	void			*uctx;			//!< Passed to func, parented by the job.
+
+	request_t		*request;		//!< To mark runnable.  Never touched by helpers.
+	fr_event_list_t		*el;			//!< The event list the read side is inserted into.
+	int			fd[2];			//!< Helper writes to fd[1] when func returns.
+};
+
+/** Close the read side of a job's pipe, and stop watching it
+ *
+ */
+static void offload_job_fd_close(fr_offload_job_t *job)
+{
+	if (job->fd[0] < 0) return;
+
+	(void) fr_event_fd_delete(job->el, job->fd[0], FR_EVENT_FILTER_IO);
+	close(job->fd[0]);
+	job->fd[0] = -1;
+}
+
+static int _offload_job_free(fr_offload_job_t *job)
+{
+	offload_job_fd_close(job);
+	if (job->fd[1] >= 0) close(job->fd[1]);
+
+	return 0;
+}
+
+/** Helper thread has finished running the job
+ *
+ */
+static void offload_job_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	fr_offload_job_t	*job = talloc_get_type_abort(uctx, fr_offload_job_t);
+	uint8_t			buffer[1];
+
+	while ((read(fd, buffer, sizeof(buffer)) < 0) && (errno == EINTR));
+
+	offload_job_fd_close(job);
+	unlang_interpret_mark_runnable(job->request);
+}
+
+static void *offload_thread(void *arg)
+{
+	fr_offload_t		*ol = arg;
+	fr_offload_job_t	*job;
+
+	pthread_mutex_lock(&ol->mutex);
+	for (;;) {
+		while (!ol->stop && !(job = fr_dlist_head(&ol->queue))) pthread_cond_wait(&ol->cond, &ol->mutex);
+		if (ol->stop) break;
+
+		fr_dlist_remove(&ol->queue, job);
+		job->state = OFFLOAD_JOB_RUNNING;
+		pthread_mutex_unlock(&ol->mutex);
+
+		job->func(job->uctx);
+
+		pthread_mutex_lock(&ol->mutex);
+
+		/*
+		 *	The request was cancelled while we
+		 *	were running.  Nothing owns the job
+		 *	but us now.
+		 */
+		if (job->state == OFFLOAD_JOB_CANCELLED) {
+			talloc_free(job);
+			continue;
+		}
+
+		/*
+		 *	Write with the mutex held, so that a
+		 *	cancel can't close the pipe out from
+		 *	under us.
+		 */
+		job->state = OFFLOAD_JOB_DONE;
+		while ((write(job->fd[1], "", 1) < 0) && (errno == EINTR));
+	}
+	pthread_mutex_unlock(&ol->mutex);
+
+	return NULL;
+}
+
+static int _offload_free(fr_offload_t *ol)
+{
+	fr_offload_job_t	*job;
+	unsigned int		i;
+
+	pthread_mutex_lock(&ol->mutex);
+	ol->stop = true;
+	pthread_cond_broadcast(&ol->cond);
+	pthread_mutex_unlock(&ol->mutex);
+
+	if (ol->started) for (i = 0; i < ol->num_threads; i++) pthread_join(ol->threads[i], NULL);
+
+	while ((job = fr_dlist_head(&ol->queue))) {
+		fr_dlist_remove(&ol->queue, job);
+		talloc_free(job);
+	}
+
+	pthread_cond_destroy(&ol->cond);
+	pthread_mutex_destroy(&ol->mutex);
+
+	return 0;
+}
+
+/** Allocate a pool of helper threads
+ *
+ * The threads aren't started until the first job is pushed.
+ *
+ * @param[in] ctx		to allocate the pool in.
+ * @param[in] name		of the pool, used in debug messages.
+ * @param[in] num_threads	how many jobs may run concurrently.
+ * @return
+ *	- A new pool on success.
+ *	- NULL on failure.
+ */
+fr_offload_t *fr_offload_alloc(TALLOC_CTX *ctx, char const *name, unsigned int num_threads)
+{
+	fr_offload_t	*ol;
+
+	if (!num_threads) {
+		fr_strerror_const("Offload pool must have at least one thread");
+		return NULL;
+	}
+
+	MEM(ol = talloc_zero(ctx, fr_offload_t));
+	MEM(ol->name = talloc_strdup(ol, name));
+	MEM(ol->threads = talloc_array(ol, pthread_t, num_threads));
+	ol->num_threads = num_threads;
+	fr_dlist_init(&ol->queue, fr_offload_job_t, entry);
+
+	pthread_mutex_init(&ol->mutex, NULL);
+	pthread_cond_init(&ol->cond, NULL);
+	talloc_set_destructor(ol, _offload_free);
+
+	return ol;
+}
+
+/** Limit how many jobs may be waiting for a helper thread
+ *
+ * Once the limit is reached, #fr_offload_push fails until the helpers
+ * catch up.  Without a limit, a burst of slow jobs just grows the queue,
+ * and every request in it waits longer than the client will.
+ *
+ * @param[in] ol		to limit.
+ * @param[in] max_queued	0 for no limit.
+ */
+void fr_offload_max_queued_set(fr_offload_t *ol, unsigned int max_queued)
+{
+	pthread_mutex_lock(&ol->mutex);
+	ol->max_queued = max_queued;
+	pthread_mutex_unlock(&ol->mutex);
+}
+
+/** Start the helper threads
+ *
+ * @note Must be called with ol->mutex held.
+ */
+static int offload_start(fr_offload_t *ol)
+{
+	unsigned int	i;
+	int		ret;
+
+	for (i = 0; i < ol->num_threads; i++) {
+		ret = pthread_create(&ol->threads[i], NULL, offload_thread, ol);
+		if (ret != 0) {
+			fr_strerror_printf("Failed starting %s helper thread: %s", ol->name, fr_syserror(ret));
+
+			/*
+			 *	Run with what we've got, if we got any.
+			 */
+			if (i == 0) return -1;
+			break;
+		}
+	}
+	ol->num_threads = i;
+	ol->started = true;
+
+	return 0;
+}
+
+/** Queue a blocking function to run on a helper thread
+ *
+ * The caller should yield after this returns successfully.  The request
+ * is marked runnable when func returns, at which point the caller may read
+ * its results from uctx, and must then free the job with talloc_free(),
+ * which frees uctx too.
+ *
+ * If the request is cancelled before then, the caller must call
+ * #fr_offload_cancel instead of freeing the job.
+ *
+ * @param[in] ol	to run the job in.
+ * @param[in] request	to resume when the job completes.
+ * @param[in] func	to run on the helper thread.
+ * @param[in] uctx	Passed to func.  Must be a talloc chunk with no
+ *			parent, as it's reparented to the job, and may be
+ *			freed by a helper thread.
+ * @return
+ *	- The job on success.
+ *	- NULL on failure, including when the queue is full.  uctx is not freed.
+ */
+fr_offload_job_t *fr_offload_push(fr_offload_t *ol, request_t *request, fr_offload_func_t func, void *uctx)
+{
+	fr_offload_job_t	*job;
+
+	fr_assert(!talloc_parent(uctx));
+
+	MEM(job = talloc_zero(NULL, fr_offload_job_t));
+	job->ol = ol;
+	job->func = func;
+	job->request = request;
+	job->el = request->el;
+	job->fd[0] = job->fd[1] = -1;
+	talloc_set_destructor(job, _offload_job_free);
+
+	if (pipe(job->fd) < 0) {
+		fr_strerror_printf("Failed creating pipe: %s", fr_syserror(errno));
+	error:
+		talloc_free(job);
+		return NULL;
+	}
+
+	if ((fr_nonblock(job->fd[0]) < 0) || (fr_nonblock(job->fd[1]) < 0)) {
+		fr_strerror_printf("Failed setting pipe to non-blocking: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	Not linked to the job, as a cancelled job is
+	 *	freed by a helper thread, which must not touch
+	 *	the event list.
+	 */
+	if (fr_event_fd_insert(job->el, job->el, job->fd[0], offload_job_read, NULL, NULL, job) < 0) {
+		fr_strerror_const_push("Failed inserting offload pipe into event loop");
+		goto error;
+	}
+
+	pthread_mutex_lock(&ol->mutex);
+	if (ol->max_queued && (fr_dlist_num_elements(&ol->queue) >= ol->max_queued)) {
+		pthread_mutex_unlock(&ol->mutex);
+		fr_strerror_printf("Too many jobs waiting for %s helper threads", ol->name);
+		goto error;
+	}
+
+	if (!ol->started && (offload_start(ol) < 0)) {
+		pthread_mutex_unlock(&ol->mutex);
+		goto error;
+	}
+
+	job->uctx = talloc_steal(job, uctx);
+	fr_dlist_insert_tail(&ol->queue, job);
+	pthread_cond_signal(&ol->cond);
+	pthread_mutex_unlock(&ol->mutex);
+
+	return job;
+}
+
+/** Abandon a job, because the request it was pushed for is going away
+ *
+ * If the job is still queued, or has already finished, it's freed
+ * immediately.  If a helper thread is running it, the helper frees
+ * it when func returns.
+ *
+ * @param[in] job	to cancel.
+ */
+void fr_offload_cancel(fr_offload_job_t *job)
+{
+	fr_offload_t *ol = job->ol;
+
+	/*
+	 *	Always done on the worker which owns the
+	 *	event list.
+	 */
+	offload_job_fd_close(job);
+
+	pthread_mutex_lock(&ol->mutex);
+	switch (job->state) {
+	case OFFLOAD_JOB_QUEUED:
+		fr_dlist_remove(&ol->queue, job);
+		FALL_THROUGH;
+
+	case OFFLOAD_JOB_DONE:
+		pthread_mutex_unlock(&ol->mutex);
+		talloc_free(job);
+		return;
+
+	case OFFLOAD_JOB_RUNNING:
+		job->state = OFFLOAD_JOB_CANCELLED;
+		break;
+
+	case OFFLOAD_JOB_CANCELLED:
+		fr_assert(0);
+		break;
+	}
+	pthread_mutex_unlock(&ol->mutex);
+}
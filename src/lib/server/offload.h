@@ -0,0 +1,59 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/offload.h
+ * @brief Run blocking library calls on helper threads, and resume the request when they complete.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(offload_h, "$Id$")
+
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/util/talloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_offload_s fr_offload_t;
+typedef struct fr_offload_job_s fr_offload_job_t;
+
+/** Function run on a helper thread
+ *
+ * Must not touch the request, or anything allocated in the request's
+ * talloc hierarchy, and must not use the request logging macros.
+ * Everything it needs should be in uctx, and it should write its results
+ * back to uctx.
+ *
+ * @param[in] uctx	passed to #fr_offload_push.
+ */
+typedef void (*fr_offload_func_t)(void *uctx);
+
+fr_offload_t		*fr_offload_alloc(TALLOC_CTX *ctx, char const *name, unsigned int num_threads);
+
+void			fr_offload_max_queued_set(fr_offload_t *ol, unsigned int max_queued);
+
+fr_offload_job_t	*fr_offload_push(fr_offload_t *ol, request_t *request, fr_offload_func_t func, void *uctx);
+
+void			fr_offload_cancel(fr_offload_job_t *job);
+
+#ifdef __cplusplus
+}
+#endif
@@ -32,15 +32,59 @@ RCSID("$Id$")
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/util/debug.h>
 
+#include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/heap.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/probe.h>
+#include <freeradius-devel/util/syserror.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 
 #include <time.h>
 
+/** Maximum number of initial connections to open at the same time
+ *
+ */
+#ifndef FR_POOL_START_PARALLEL
+#  define FR_POOL_START_PARALLEL	(16)
+#endif
+
 typedef struct fr_pool_connection_s fr_pool_connection_t;
 
 static int connection_check(fr_pool_t *pool, request_t *request);
 
+/** A subset of a pool's connections, used by some of the worker threads
+ *
+ * When a pool is sharded, each thread reserves and releases connections
+ * using the mutex of its own shard, instead of the pool mutex.  The pool
+ * mutex is then only taken to open and close connections.
+ *
+ * The pool mutex may be locked before a shard mutex, but never after.
+ * At most one shard mutex is held at a time.
+ */
+typedef struct {
+	pthread_mutex_t	mutex;			//!< Protects the members below, and the in_use
+						//!< flags of the connections in them.
+	fr_heap_t	*heap;			//!< Idle connections.
+	fr_dlist_head_t	reserved;		//!< Connections reserved by threads using this shard.
+
+	fr_time_t	last_released;		//!< Last time a connection was released.
+	fr_time_t	last_held_min;		//!< Last time we warned about a low latency event.
+	fr_time_t	last_held_max;		//!< Last time we warned about a high latency event.
+} fr_pool_shard_t;
+
+/** Assigned to each thread the first time it uses a sharded pool
+ *
+ * Threads are mapped to shards with index % shards, so a thread always
+ * uses the same shard of a given pool.
+ */
+static _Thread_local uint32_t pool_thread_index;
+static atomic_uint_fast32_t pool_thread_count;
+
 /** An individual connection within the connection pool
  *
  * Defines connection counters, timestamps, and holds a pointer to the
@@ -68,6 +112,12 @@ struct fr_pool_connection_s {
 
 	bool		needs_reconnecting;	//!< Reconnect this connection before use.
 
+	fr_pool_shard_t	*shard;			//!< Shard the connection is idle in, or reserved from.
+						//!< Only changed by the thread which removed the
+						//!< connection from its shard.
+	fr_dlist_t	entry;			//!< Entry in the shard's reserved list, or in a
+						//!< list of connections waiting to be closed.
+
 #ifdef PTHREAD_DEBUG
 	pthread_t	pthread_id;		//!< When 'in_use == true'.
 #endif
@@ -112,6 +162,13 @@ struct fr_pool_s {
 
 	fr_heap_t	*heap;			//!< For the next connection heap
 
+	uint32_t	num_shards;		//!< How many shards to split the pool into.
+	fr_pool_shard_t	*shards;		//!< NULL if the pool isn't sharded.
+	pthread_t	housekeeper;		//!< Closes and opens connections for sharded pools.
+	pthread_cond_t	housekeeping;		//!< Signalled to stop the housekeeper.
+	bool		housekeeper_started;	//!< Whether the housekeeper thread is running.
+	bool		stopping;		//!< Tells the housekeeper to exit.
+
 	fr_pool_connection_t	*head;		//!< Start of the connection list.
 	fr_pool_connection_t	*tail;		//!< End of the connection list.
 
@@ -163,6 +220,7 @@ static const CONF_PARSER pool_config[] = {
 	{ FR_CONF_OFFSET("held_trigger_max", FR_TYPE_TIME_DELTA, fr_pool_t, held_trigger_max), .dflt = "0.5" },
 	{ FR_CONF_OFFSET("retry_delay", FR_TYPE_TIME_DELTA, fr_pool_t, retry_delay), .dflt = "1" },
 	{ FR_CONF_OFFSET("spread", FR_TYPE_BOOL, fr_pool_t, spread), .dflt = "no" },
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, fr_pool_t, num_shards), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -184,6 +242,144 @@ static int8_t last_released_cmp(void const *one, void const *two)
 	return fr_time_cmp(a->last_released, b->last_released);
 }
 
+/** Return the shard used by the current thread
+ *
+ */
+static inline fr_pool_shard_t *shard_self(fr_pool_t *pool)
+{
+	if (!pool_thread_index) {
+		pool_thread_index = atomic_fetch_add_explicit(&pool_thread_count, 1, memory_order_relaxed) + 1;
+	}
+
+	return &pool->shards[pool_thread_index % pool->num_shards];
+}
+
+/** Check whether a connection can still be reserved
+ *
+ * @return
+ *	- NULL if the connection is usable.
+ *	- Why it needs to be closed.
+ */
+static char const *connection_expired(fr_pool_t *pool, fr_pool_connection_t *this, fr_time_t now)
+{
+	if (this->needs_reconnecting) return "Needs reconnecting";
+
+	if ((pool->max_uses > 0) && (this->num_uses >= pool->max_uses)) return "Hit max_uses limit";
+
+	if ((pool->lifetime > 0) && ((this->created + pool->lifetime) < now)) return "Hit lifetime limit";
+
+	return NULL;
+}
+
+/** Remove a reserved connection from the current thread's shard
+ *
+ * @note Must be called with the pool mutex free.
+ *
+ * @param[in] pool	to search in.
+ * @param[in] conn	handle to search for.
+ * @return
+ *	- The connection, which now belongs to the caller.
+ *	- NULL if the connection wasn't reserved by this thread.
+ */
+static fr_pool_connection_t *shard_connection_claim(fr_pool_t *pool, void *conn)
+{
+	fr_pool_shard_t		*s = shard_self(pool);
+	fr_pool_connection_t	*found = NULL;
+
+	pthread_mutex_lock(&s->mutex);
+	fr_dlist_foreach(&s->reserved, fr_pool_connection_t, this) {
+		if (this->connection != conn) continue;
+
+#ifdef PTHREAD_DEBUG
+		fr_assert(pthread_equal(this->pthread_id, pthread_self()) != 0);
+#endif
+		fr_assert(this->in_use == true);
+
+		found = this;
+		break;
+	}
+	if (found) fr_dlist_remove(&s->reserved, found);
+	pthread_mutex_unlock(&s->mutex);
+
+	return found;
+}
+
+/** Remove an idle connection from the shard with the most of them
+ *
+ * Picks the connection which was reserved longest ago.
+ *
+ * @note The pool mutex may be held or free.
+ *
+ * @param[in] pool	to take the connection from.
+ * @return
+ *	- The connection, which now belongs to the caller.
+ *	- NULL if there are no idle connections.
+ */
+static fr_pool_connection_t *shard_idle_claim(fr_pool_t *pool)
+{
+	fr_pool_shard_t		*best = NULL;
+	fr_pool_connection_t	*found = NULL;
+	fr_heap_iter_t		iter;
+	uint32_t		i, num, most = 0;
+
+	for (i = 0; i < pool->num_shards; i++) {
+		pthread_mutex_lock(&pool->shards[i].mutex);
+		num = fr_heap_num_elements(pool->shards[i].heap);
+		pthread_mutex_unlock(&pool->shards[i].mutex);
+
+		if (num > most) {
+			most = num;
+			best = &pool->shards[i];
+		}
+	}
+	if (!best) return NULL;
+
+	/*
+	 *	The shard may have been emptied since we counted.
+	 *	That's fine, the caller will try again later.
+	 */
+	pthread_mutex_lock(&best->mutex);
+	for (fr_pool_connection_t *this = fr_heap_iter_init(best->heap, &iter);
+	     this;
+	     this = fr_heap_iter_next(best->heap, &iter)) {
+		if (!found || (this->last_reserved < found->last_reserved)) found = this;
+	}
+	if (found) {
+		fr_heap_extract(best->heap, found);
+		found->in_use = true;
+	}
+	pthread_mutex_unlock(&best->mutex);
+
+	return found;
+}
+
+/** Add a newly opened idle connection to the shard with the fewest of them
+ *
+ * @note Must be called with the pool mutex held.
+ */
+static void shard_idle_insert(fr_pool_t *pool, fr_pool_connection_t *this)
+{
+	fr_pool_shard_t	*best = NULL;
+	uint32_t	i, num, fewest = UINT32_MAX;
+
+	for (i = 0; i < pool->num_shards; i++) {
+		pthread_mutex_lock(&pool->shards[i].mutex);
+		num = fr_heap_num_elements(pool->shards[i].heap);
+		pthread_mutex_unlock(&pool->shards[i].mutex);
+
+		if (num < fewest) {
+			fewest = num;
+			best = &pool->shards[i];
+		}
+	}
+
+	pthread_mutex_lock(&best->mutex);
+	this->shard = best;
+	this->in_use = false;
+	fr_heap_insert(best->heap, this);
+	pthread_mutex_unlock(&best->mutex);
+}
+
 /** Removes a connection from the connection list
  *
  * @note Must be called with the mutex held.
@@ -267,6 +463,7 @@ static inline void fr_pool_trigger_exec(fr_pool_t *pool, request_t *request, cha
  * @note Will lock mutex and only release mutex if connection handle
  * is not found, so will usually return will mutex held.
  * @note Must be called with the mutex free.
+ * @note For sharded pools, the connection is also removed from its shard.
  *
  * @param[in] pool	to search in.
  * @param[in] conn	handle to search for.
@@ -280,6 +477,15 @@ static fr_pool_connection_t *connection_find(fr_pool_t *pool, void *conn)
 
 	if (!pool || !conn) return NULL;
 
+	if (pool->shards) {
+		this = shard_connection_claim(pool, conn);
+		if (!this) return NULL;
+
+		pthread_mutex_lock(&pool->mutex);
+		/* coverity[missing_unlock] */
+		return this;
+	}
+
 	pthread_mutex_lock(&pool->mutex);
 
 	/*
@@ -480,7 +686,13 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, request_t *reques
 	 *	The connection pool is starting up.  Insert the
 	 *	connection into the heap.
 	 */
-	if (!in_use) fr_heap_insert(pool->heap, this);
+	if (!in_use) {
+		if (pool->shards) {
+			shard_idle_insert(pool, this);
+		} else {
+			fr_heap_insert(pool->heap, this);
+		}
+	}
 
 	connection_link_head(pool, this);
 
@@ -528,6 +740,8 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, request_t *reques
  *
  * @note Will call the 'close' trigger.
  * @note Must be called with the mutex held.
+ * @note For sharded pools, the connection must already have been removed
+ *	from its shard.
  *
  * @param[in] pool	to modify.
  * @param[in] request	The current request.
@@ -535,10 +749,17 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, request_t *reques
  */
 static void connection_close_internal(fr_pool_t *pool, request_t *request, fr_pool_connection_t *this)
 {
+	/*
+	 *	Sharded pools don't track which connections are
+	 *	active in the pool itself.
+	 */
+	if (pool->shards) {
+		this->in_use = false;
+
 	/*
 	 *	If it's in use, release it.
 	 */
-	if (this->in_use) {
+	} else if (this->in_use) {
 #ifdef PTHREAD_DEBUG
 		pthread_t pthread_id = pthread_self();
 		fr_assert(pthread_equal(this->pthread_id, pthread_id) != 0);
@@ -647,6 +868,14 @@ static int connection_check(fr_pool_t *pool, request_t *request)
 	fr_time_t		now = fr_time();
 	fr_pool_connection_t	*this, *next;
 
+	/*
+	 *	Sharded pools are managed by the housekeeper thread.
+	 */
+	if (pool->shards) {
+		pthread_mutex_unlock(&pool->mutex);
+		return 1;
+	}
+
 	if ((now - pool->state.last_checked) < NSEC) {
 		pthread_mutex_unlock(&pool->mutex);
 		return 1;
@@ -804,6 +1033,343 @@ done:
 	return 1;
 }
 
+/** Close connections which have been removed from their shards
+ *
+ * @note Must be called with the mutex held.
+ */
+static void shard_close_list(fr_pool_t *pool, request_t *request, fr_dlist_head_t *list)
+{
+	fr_pool_connection_t *this;
+
+	while ((this = fr_dlist_pop_head(list))) connection_close_internal(pool, request, this);
+}
+
+/** Pop a usable idle connection from a shard
+ *
+ * Expired connections are moved to the stale list, to be closed once
+ * the shard mutex has been released.
+ *
+ * @note Must be called with the shard mutex held.
+ */
+static fr_pool_connection_t *shard_pop(fr_pool_t *pool, request_t *request, fr_pool_shard_t *s,
+				       fr_dlist_head_t *stale, fr_time_t now)
+{
+	fr_pool_connection_t	*this;
+	char const		*reason;
+
+	while ((this = fr_heap_pop(s->heap))) {
+		this->in_use = true;
+
+		reason = connection_expired(pool, this, now);
+		if (!reason) return this;
+
+		ROPTIONAL(RDEBUG2, DEBUG2, "Closing expired connection (%" PRIu64 "): %s", this->number, reason);
+		fr_dlist_insert_tail(stale, this);
+	}
+
+	return NULL;
+}
+
+/** Add a connection to a shard's reserved list
+ *
+ * @note Must be called with the shard mutex held.
+ */
+static void shard_reserve(fr_pool_shard_t *s, fr_pool_connection_t *this)
+{
+	this->shard = s;
+	this->in_use = true;
+	this->num_uses++;
+	this->last_reserved = fr_time();
+
+#ifdef PTHREAD_DEBUG
+	this->pthread_id = pthread_self();
+#endif
+
+	fr_dlist_insert_tail(&s->reserved, this);
+}
+
+/** Get a connection from a sharded pool
+ *
+ * Uses an idle connection from the current thread's shard if there is
+ * one.  Otherwise borrows an idle connection from another shard, skipping
+ * shards whose mutex is busy.  Only when no shard has an idle connection
+ * is a new one opened.
+ *
+ * @note Must be called with the mutex free.
+ *
+ * @param[in] pool	to reserve the connection from.
+ * @param[in] request	The current request.
+ * @param[in] spawn	whether to spawn a new connection
+ * @return
+ *	- A pointer to the connection handle.
+ *	- NULL on error.
+ */
+static void *shard_connection_get(fr_pool_t *pool, request_t *request, bool spawn)
+{
+	fr_pool_shard_t		*s = shard_self(pool);
+	fr_pool_connection_t	*this;
+	fr_dlist_head_t		stale;
+	fr_time_t		now = fr_time();
+	uint32_t		i, self = s - pool->shards;
+
+	fr_dlist_init(&stale, fr_pool_connection_t, entry);
+
+	pthread_mutex_lock(&s->mutex);
+	this = shard_pop(pool, request, s, &stale, now);
+	if (this) shard_reserve(s, this);
+	pthread_mutex_unlock(&s->mutex);
+
+	if (!this) {
+		for (i = 1; i < pool->num_shards; i++) {
+			fr_pool_shard_t *o = &pool->shards[(self + i) % pool->num_shards];
+
+			if (pthread_mutex_trylock(&o->mutex) != 0) continue;
+			this = shard_pop(pool, request, o, &stale, now);
+			pthread_mutex_unlock(&o->mutex);
+
+			if (this) {
+				ROPTIONAL(RDEBUG3, DEBUG3, "Borrowed connection (%" PRIu64 ") from shard %u",
+					  this->number, (unsigned int) (o - pool->shards));
+				break;
+			}
+		}
+
+		/*
+		 *	The connection now belongs to our shard.
+		 */
+		if (this) {
+			pthread_mutex_lock(&s->mutex);
+			shard_reserve(s, this);
+			pthread_mutex_unlock(&s->mutex);
+		}
+	}
+
+	if (fr_dlist_num_elements(&stale) > 0) {
+		pthread_mutex_lock(&pool->mutex);
+		shard_close_list(pool, request, &stale);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	if (!this) {
+		if (!spawn) return NULL;
+
+		ROPTIONAL(RDEBUG2, DEBUG2, "No idle connections in any shard.  You may need to increase \"spare\"");
+
+		this = connection_spawn(pool, request, now, true, true);
+		if (!this) return NULL;
+
+		pthread_mutex_lock(&s->mutex);
+		shard_reserve(s, this);
+		pthread_mutex_unlock(&s->mutex);
+	}
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Reserved connection (%" PRIu64 ")", this->number);
+
+	return this->connection;
+}
+
+/** Release a connection back to the current thread's shard
+ *
+ * @note Must be called with the mutex free.
+ */
+static void shard_connection_release(fr_pool_t *pool, request_t *request, void *conn)
+{
+	fr_pool_shard_t		*s = shard_self(pool);
+	fr_pool_connection_t	*this = NULL;
+	fr_time_delta_t		held;
+	bool			trigger_min = false, trigger_max = false;
+
+	pthread_mutex_lock(&s->mutex);
+	fr_dlist_foreach(&s->reserved, fr_pool_connection_t, c) {
+		if (c->connection == conn) {
+			this = c;
+			break;
+		}
+	}
+	if (!this) {
+		pthread_mutex_unlock(&s->mutex);
+		return;
+	}
+
+#ifdef PTHREAD_DEBUG
+	fr_assert(pthread_equal(this->pthread_id, pthread_self()) != 0);
+#endif
+
+	fr_dlist_remove(&s->reserved, this);
+	this->in_use = false;
+	this->last_released = fr_time();
+	s->last_released = this->last_released;
+
+	held = this->last_released - this->last_reserved;
+
+	if (pool->held_trigger_min &&
+	    (held < pool->held_trigger_min) &&
+	    ((this->last_released - s->last_held_min) >= NSEC)) {
+		trigger_min = true;
+		s->last_held_min = this->last_released;
+	}
+
+	if (pool->held_trigger_max &&
+	    (held > pool->held_trigger_max) &&
+	    ((this->last_released - s->last_held_max) >= NSEC)) {
+		trigger_max = true;
+		s->last_held_max = this->last_released;
+	}
+
+	fr_heap_insert(s->heap, this);
+	pthread_mutex_unlock(&s->mutex);
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ")", this->number);
+
+	if (trigger_min) fr_pool_trigger_exec(pool, request, "min");
+	if (trigger_max) fr_pool_trigger_exec(pool, request, "max");
+}
+
+/** Find an idle connection which should be closed
+ *
+ * @note Must be called with the shard mutex held.
+ */
+static fr_pool_connection_t *shard_find_stale(fr_pool_t *pool, fr_pool_shard_t *s, fr_time_t now)
+{
+	fr_heap_iter_t	iter;
+	char const	*reason;
+
+	for (fr_pool_connection_t *this = fr_heap_iter_init(s->heap, &iter);
+	     this;
+	     this = fr_heap_iter_next(s->heap, &iter)) {
+		reason = connection_expired(pool, this, now);
+		if (reason) {
+			DEBUG2("Closing expired connection (%" PRIu64 "): %s", this->number, reason);
+			return this;
+		}
+
+		if ((pool->idle_timeout > 0) &&
+		    ((this->last_released + pool->idle_timeout) < now)) {
+			INFO("Closing connection (%" PRIu64 "): Hit idle_timeout, was idle for %pVs",
+			     this->number, fr_box_time_delta(now - this->last_released));
+			return this;
+		}
+	}
+
+	return NULL;
+}
+
+/** Maintain the connections in a sharded pool
+ *
+ * This is the equivalent of connection_check(), but it's called from the
+ * housekeeper thread instead of from the workers releasing connections.
+ * It closes expired connections, and then opens or closes at most one
+ * connection to keep the number of spares between 'min' and 'max'.
+ *
+ * @note Must be called with the mutex free.
+ *
+ * @param[in] pool	to manage.
+ */
+static void shard_check(fr_pool_t *pool)
+{
+	fr_time_t		now = fr_time();
+	fr_dlist_head_t		stale;
+	fr_pool_connection_t	*this;
+	uint32_t		i, idle = 0, num, spare;
+
+	fr_dlist_init(&stale, fr_pool_connection_t, entry);
+
+	pthread_mutex_lock(&pool->mutex);
+
+	for (i = 0; i < pool->num_shards; i++) {
+		fr_pool_shard_t *s = &pool->shards[i];
+
+		pthread_mutex_lock(&s->mutex);
+
+		/*
+		 *	Can't extract entries from the heap while
+		 *	iterating over it, so start again after each
+		 *	one.
+		 */
+		while ((this = shard_find_stale(pool, s, now))) {
+			fr_heap_extract(s->heap, this);
+			this->in_use = true;
+			fr_dlist_insert_tail(&stale, this);
+		}
+
+		idle += fr_heap_num_elements(s->heap);
+		if (s->last_released > pool->state.last_released) pool->state.last_released = s->last_released;
+
+		pthread_mutex_unlock(&s->mutex);
+	}
+
+	shard_close_list(pool, NULL, &stale);
+
+	/*
+	 *	Everything which isn't idle is either reserved, or
+	 *	being moved between shards.
+	 */
+	fr_assert(idle <= pool->state.num);
+	pool->state.active = pool->state.num - idle;
+	pool->state.last_checked = now;
+
+	num = pool->state.num + pool->state.pending;
+	spare = pool->state.pending + idle;
+
+	if ((num < pool->min) ||
+	    ((spare < pool->spare) && (num < pool->max) && (pool->state.pending < pool->pending_window))) {
+		if (num < pool->min) {
+			INFO("Need %i more connections to reach min connections (%i)", pool->min - num, pool->min);
+		} else {
+			INFO("Need %i more connections to reach %i spares", pool->spare - spare, pool->spare);
+		}
+
+		pthread_mutex_unlock(&pool->mutex);
+		(void) connection_spawn(pool, NULL, now, false, true);
+		return;
+	}
+
+	/*
+	 *	Too many spares.  Don't close connections too often,
+	 *	in order to prevent flapping.
+	 */
+	if ((spare > pool->spare) && !pool->state.pending && (num > pool->min) &&
+	    (now >= (pool->state.last_spawned + pool->delay_interval))) {
+		this = shard_idle_claim(pool);
+		if (this) {
+			DEBUG2("Closing connection (%" PRIu64 ") as we have too many unused connections",
+			       this->number);
+			connection_close_internal(pool, NULL, this);
+
+			pool->state.next_delay >>= 1;
+			if (pool->state.next_delay == 0) pool->state.next_delay = 1;
+			pool->delay_interval += pool->state.next_delay;
+		}
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/** Run shard_check() once a second, until the pool is freed
+ *
+ */
+static void *pool_housekeeper(void *arg)
+{
+	fr_pool_t	*pool = arg;
+	struct timespec	when;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (!pool->stopping) {
+		clock_gettime(CLOCK_REALTIME, &when);
+		when.tv_sec += 1;
+
+		if ((pthread_cond_timedwait(&pool->housekeeping, &pool->mutex, &when) != ETIMEDOUT) ||
+		    pool->stopping) continue;
+
+		pthread_mutex_unlock(&pool->mutex);
+		shard_check(pool);
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
 /** Get a connection from the connection pool
  *
  * @note Must be called with the mutex free.
@@ -822,6 +1388,8 @@ static void *connection_get_internal(fr_pool_t *pool, request_t *request, bool s
 
 	if (!pool) return NULL;
 
+	if (pool->shards) return shard_connection_get(pool, request, spawn);
+
 	pthread_mutex_lock(&pool->mutex);
 
 	now = fr_time();
@@ -1034,6 +1602,7 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	pthread_mutex_init(&pool->mutex, NULL);
 	pthread_cond_init(&pool->done_spawn, NULL);
 	pthread_cond_init(&pool->done_reconnecting, NULL);
+	pthread_cond_init(&pool->housekeeping, NULL);
 
 	DEBUG2("Initialising connection pool");
 
@@ -1079,6 +1648,35 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	 */
 	FR_TIME_DELTA_BOUND_CHECK("connect_timeout", pool->connect_timeout, >=, fr_time_delta_from_msec(100));
 
+	/*
+	 *	Split the pool into shards, so that workers don't
+	 *	all contend on the pool mutex.  The connections are
+	 *	shared out between the shards, and a worker only
+	 *	borrows from another shard when its own is empty.
+	 */
+	if (pool->num_shards > 1) {
+		uint32_t i;
+
+		FR_INTEGER_BOUND_CHECK("shards", pool->num_shards, <=, pool->max);
+
+		MEM(pool->shards = talloc_zero_array(pool, fr_pool_shard_t, pool->num_shards));
+		for (i = 0; i < pool->num_shards; i++) {
+			fr_pool_shard_t *s = &pool->shards[i];
+
+			pthread_mutex_init(&s->mutex, NULL);
+			fr_dlist_init(&s->reserved, fr_pool_connection_t, entry);
+			s->heap = fr_heap_talloc_alloc(pool->shards, pool->spread ? last_released_cmp : last_reserved_cmp,
+						       fr_pool_connection_t, heap_id, 0);
+		}
+
+		for (i = 0; i < pool->num_shards; i++) {
+			if (!pool->shards[i].heap) {
+				ERROR("%s: Failed creating connection heap", __FUNCTION__);
+				goto error;
+			}
+		}
+	}
+
 	/*
 	 *	Don't open any connections.  Instead, force the limits
 	 *	to only 1 connection.
@@ -1092,10 +1690,28 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	return pool;
 }
 
+/** Open one of the initial connections for a pool
+ *
+ * @param[in] uctx	the pool.
+ * @return
+ *	- The new connection.
+ *	- NULL on failure.
+ */
+static void *_pool_start_spawn(void *uctx)
+{
+	fr_pool_t *pool = uctx;
+
+	/*
+	 *	Call time() once for each spawn attempt as there
+	 *	could be a significant delay.
+	 */
+	return connection_spawn(pool, NULL, time(NULL), false, true);
+}
+
 int fr_pool_start(fr_pool_t *pool)
 {
 	uint32_t		i;
-	fr_pool_connection_t 	*this;
+	pthread_t		threads[FR_POOL_START_PARALLEL];
 
 	/*
 	 *	Don't spawn any connections
@@ -1103,19 +1719,71 @@ int fr_pool_start(fr_pool_t *pool)
 	if (check_config) return 0;
 
 	/*
-	 *	Create all of the connections, unless the admin says
-	 *	not to.
+	 *	Open the first connection on its own.  If the server
+	 *	is down, we then fail after one connection timeout,
+	 *	and don't have many attempts queued up against it.
 	 */
-	for (i = 0; i < pool->start; i++) {
+	if ((pool->start > 0) && !_pool_start_spawn(pool)) {
+	error:
+		ERROR("Failed spawning initial connections");
+		return -1;
+	}
+
+	/*
+	 *	Create the rest of the connections in parallel.
+	 *	connection_spawn() is thread safe, as it's also
+	 *	called from the workers, and releases the mutex while
+	 *	the connection is being opened.
+	 *
+	 *	When a pool has many initial connections to a slow
+	 *	server, this means startup waits for roughly one
+	 *	connection setup time, rather than 'start' of them.
+	 */
+	for (i = 1; i < pool->start; ) {
+		uint32_t	j, batch, started = 0;
+		bool		failed = false;
+
+		batch = pool->start - i;
+		if (batch > NUM_ELEMENTS(threads)) batch = NUM_ELEMENTS(threads);
+
+		for (j = 0; j < batch; j++) {
+			if (pthread_create(&threads[started], NULL, _pool_start_spawn, pool) != 0) break;
+			started++;
+		}
+
 		/*
-		 *	Call time() once for each spawn attempt as there
-		 *	could be a significant delay.
+		 *	If we couldn't create threads, open the
+		 *	remaining connections in this thread.
 		 */
-		this = connection_spawn(pool, NULL, time(NULL), false, true);
-		if (!this) {
-			ERROR("Failed spawning initial connections");
+		for (j = started; j < batch; j++) {
+			if (!_pool_start_spawn(pool)) failed = true;
+		}
+
+		for (j = 0; j < started; j++) {
+			void *this = NULL;
+
+			(void) pthread_join(threads[j], &this);
+			if (!this) failed = true;
+		}
+
+		if (failed) goto error;
+
+		i += batch;
+	}
+
+	/*
+	 *	Workers don't manage sharded pools when they release
+	 *	connections, so something else has to.
+	 */
+	if (pool->shards && !pool->housekeeper_started) {
+		int ret;
+
+		ret = pthread_create(&pool->housekeeper, NULL, pool_housekeeper, pool);
+		if (ret != 0) {
+			ERROR("Failed starting pool housekeeper thread: %s", fr_syserror(ret));
 			return -1;
 		}
+		pool->housekeeper_started = true;
 	}
 
 	fr_pool_trigger_exec(pool, NULL, "start");
@@ -1249,7 +1917,7 @@ int fr_pool_reconnect(fr_pool_t *pool, request_t *request)
 	 *	connections, and then attempt to spawn them again.
 	 */
 	for (i = 0; i < pool->start; i++) {
-		this = fr_heap_peek(pool->heap);
+		this = pool->shards ? shard_idle_claim(pool) : fr_heap_peek(pool->heap);
 		if (!this) break;	/* There wasn't 'start' connections available */
 
 		connection_close_internal(pool, request, this);
@@ -1322,8 +1990,35 @@ void fr_pool_free(fr_pool_t *pool)
 
 	DEBUG2("Removing connection pool");
 
+	if (pool->housekeeper_started) {
+		pthread_mutex_lock(&pool->mutex);
+		pool->stopping = true;
+		pthread_cond_signal(&pool->housekeeping);
+		pthread_mutex_unlock(&pool->mutex);
+
+		pthread_join(pool->housekeeper, NULL);
+		pool->housekeeper_started = false;
+	}
+
 	pthread_mutex_lock(&pool->mutex);
 
+	/*
+	 *	Take all of the connections out of the shards, so
+	 *	they can be closed below.
+	 */
+	if (pool->shards) {
+		uint32_t i;
+
+		for (i = 0; i < pool->num_shards; i++) {
+			fr_pool_shard_t *s = &pool->shards[i];
+
+			pthread_mutex_lock(&s->mutex);
+			while (fr_heap_pop(s->heap));
+			while (fr_dlist_pop_head(&s->reserved));
+			pthread_mutex_unlock(&s->mutex);
+		}
+	}
+
 	/*
 	 *	Don't loop over the list.  Just keep removing the head
 	 *	until they're all gone.
@@ -1340,9 +2035,16 @@ void fr_pool_free(fr_pool_t *pool)
 	fr_assert(pool->tail == NULL);
 	fr_assert(pool->state.num == 0);
 
+	if (pool->shards) {
+		uint32_t i;
+
+		for (i = 0; i < pool->num_shards; i++) pthread_mutex_destroy(&pool->shards[i].mutex);
+	}
+
 	pthread_mutex_destroy(&pool->mutex);
 	pthread_cond_destroy(&pool->done_spawn);
 	pthread_cond_destroy(&pool->done_reconnecting);
+	pthread_cond_destroy(&pool->housekeeping);
 
 	talloc_free(pool);
 }
@@ -1369,7 +2071,12 @@ void fr_pool_free(fr_pool_t *pool)
  */
 void *fr_pool_connection_get(fr_pool_t *pool, request_t *request)
 {
-	return connection_get_internal(pool, request, true);
+	void *conn;
+
+	conn = connection_get_internal(pool, request, true);
+	FR_PROBE3(pool_connection_get, pool ? pool->log_prefix : NULL, request ? request->number : 0, conn);
+
+	return conn;
 }
 
 /** Release a connection
@@ -1388,6 +2095,11 @@ void fr_pool_connection_release(fr_pool_t *pool, request_t *request, void *conn)
 	fr_time_delta_t		held;
 	bool			trigger_min = false, trigger_max = false;
 
+	if (pool->shards) {
+		shard_connection_release(pool, request, conn);
+		return;
+	}
+
 	this = connection_find(pool, conn);
 	if (!this) return;
 
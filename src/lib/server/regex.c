@@ -40,6 +40,18 @@ typedef struct {
 	fr_regmatch_t	*regmatch;	//!< Match vectors.
 } fr_regcapture_t;
 
+#ifdef HAVE_REGEX_PCRE2
+/** Release the reference we hold on a cached expression
+ *
+ */
+static int _regcapture_free(fr_regcapture_t *rc)
+{
+	regex_release(rc->preg);
+
+	return 0;
+}
+#endif
+
 /** Adds subcapture values to request data
  *
  * Allows use of %{n} expansions.
@@ -82,9 +94,18 @@ void regex_sub_to_request(request_t *request, regex_t **preg, fr_regmatch_t **re
 	MEM(new_rc = talloc(request, fr_regcapture_t));
 
 	/*
-	 *	Steal runtime pregs, leave precompiled ones
+	 *	Steal runtime pregs, leave precompiled ones.
+	 *	Cached ones stay in the cache, but we hold
+	 *	a reference until the captures are freed.
 	 */
 #if defined(HAVE_REGEX_PCRE) || defined(HAVE_REGEX_PCRE2)
+#  ifdef HAVE_REGEX_PCRE2
+	if ((*preg)->cached) {
+		regex_retain(*preg);
+		new_rc->preg = *preg;
+		talloc_set_destructor(new_rc, _regcapture_free);
+	} else
+#  endif
 	if (!(*preg)->precompiled) {
 		new_rc->preg = talloc_steal(new_rc, *preg);
 		*preg = NULL;
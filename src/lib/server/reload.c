@@ -0,0 +1,408 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/lib/server/reload.c
+ * @brief Rebuild module data from files when they change, without restarting the server.
+ *
+ * Modules such as rlm_files and rlm_csv read their data once, and then
+ * only ever look things up in it.  Instead of restarting the server when
+ * the files change, a reload thread watches them with a vnode filter,
+ * and builds a complete new copy of the data.  Workers never block, and
+ * never see a partially built generation.
+ *
+ * Publication: there are two slots, each holding one generation and a
+ * count of the workers reading it.  The current generation is the one in
+ * slot (epoch & 1).  The reload thread builds the new generation, puts
+ * it in the other slot, and then increments the epoch.  Once the epoch
+ * store is visible, every new lookup uses the new generation.
+ *
+ * Reading: #fr_reload_acquire loads the epoch, increments the reader
+ * count of that slot, and then checks that the epoch hasn't changed.  If
+ * it has, the slot may already be being reused, so it decrements the
+ * count and tries again.  #fr_reload_release decrements the count.
+ *
+ * Reclaim: the slot a new generation goes into holds the previous
+ * generation.  Before freeing that, the reload thread waits for the
+ * slot's reader count to reach zero.  A reader which counts itself in to
+ * the slot after the swap sees the new epoch, and backs out without using
+ * it.  Workers only hold a generation while doing a synchronous lookup,
+ * so the wait is short, and only the reload thread ever waits.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/reload.h>
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/syserror.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+/** One generation of data
+ *
+ */
+typedef struct {
+	TALLOC_CTX		*ctx;			//!< Owns the data.
+	void			*data;			//!< As returned by load.
+	atomic_uint_fast32_t	readers;		//!< Workers currently using the data.
+} fr_reload_gen_t;
+
+struct fr_reload_s {
+	char const		*name;			//!< For log messages.
+
+	atomic_uint_fast64_t	epoch;			//!< Incremented whenever a generation is published.
+							///< The current generation is gen[epoch & 1].
+	fr_reload_gen_t		gen[2];			//!< The current and previous generations.
+
+	fr_reload_load_t	load;			//!< Builds a new generation.
+	void			*uctx;			//!< Passed to load.
+
+	char const		**files;		//!< Files to watch.
+	int			*fds;			//!< Watched descriptors, -1 if the file couldn't be opened.
+	unsigned int		num_files;
+
+	fr_time_delta_t		delay;			//!< How long the files must be quiet before we reload.
+
+	fr_event_list_t		*el;			//!< Owned by the reload thread.
+	fr_event_timer_t const	*ev;			//!< Pending reload.
+	int			wake[2];		//!< Written to tell the reload thread to exit.
+
+	pthread_t		thread;
+	bool			started;		//!< Whether the reload thread has been started.
+};
+
+static void reload_changed(fr_event_list_t *el, int fd, int flags, void *uctx);
+
+/** Stop watching the files
+ *
+ */
+static void reload_unwatch(fr_reload_t *rl)
+{
+	unsigned int i;
+
+	for (i = 0; i < rl->num_files; i++) {
+		if (rl->fds[i] < 0) continue;
+
+		(void) fr_event_fd_delete(rl->el, rl->fds[i], FR_EVENT_FILTER_VNODE);
+		close(rl->fds[i]);
+		rl->fds[i] = -1;
+	}
+}
+
+/** (Re-)open the files, and watch them for changes
+ *
+ * Editors and configuration management tools usually replace files by
+ * renaming a new one over the top, so the watched descriptor has to be
+ * re-opened by name after every change.
+ *
+ * @return
+ *	- 0 if all of the files are being watched.
+ *	- -1 if one or more of the files couldn't be opened.
+ */
+static int reload_watch(fr_reload_t *rl)
+{
+	unsigned int		i;
+	int			ret = 0;
+	fr_event_vnode_func_t	funcs = {
+					.delete = reload_changed,
+					.write = reload_changed,
+					.attrib = reload_changed,
+					.link = reload_changed,
+					.rename = reload_changed
+				};
+
+	for (i = 0; i < rl->num_files; i++) {
+		if (rl->fds[i] >= 0) continue;
+
+		rl->fds[i] = open(rl->files[i], O_RDONLY);
+		if (rl->fds[i] < 0) {
+			DEBUG("%s - Failed opening %s: %s", rl->name, rl->files[i], fr_syserror(errno));
+			ret = -1;
+			continue;
+		}
+
+		if (fr_event_filter_insert(rl->el, NULL, rl->el, rl->fds[i], FR_EVENT_FILTER_VNODE,
+					   &funcs, NULL, rl) < 0) {
+			PERROR("%s - Failed watching %s", rl->name, rl->files[i]);
+			close(rl->fds[i]);
+			rl->fds[i] = -1;
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+/** Build a new generation, and publish it
+ *
+ */
+static void reload_timer(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_reload_t	*rl = talloc_get_type_abort(uctx, fr_reload_t);
+	TALLOC_CTX	*ctx;
+	void		*data;
+	uint64_t	epoch;
+	fr_reload_gen_t	*gen;
+
+	/*
+	 *	Don't load anything until all of the files are
+	 *	back.  A missing file is most likely half-way
+	 *	through being replaced.
+	 */
+	reload_unwatch(rl);
+	if (reload_watch(rl) < 0) {
+		if (fr_event_timer_in(rl->el, rl->el, &rl->ev, rl->delay, reload_timer, rl) < 0) {
+			PERROR("%s - Failed scheduling reload", rl->name);
+		}
+		return;
+	}
+
+	ctx = talloc_init_const(rl->name);
+	data = rl->load(ctx, rl->uctx);
+	if (!data) {
+		PERROR("%s - Failed reloading, continuing with previous data", rl->name);
+		talloc_free(ctx);
+		return;
+	}
+
+	/*
+	 *	The new generation goes into the slot of the
+	 *	previous one.  Wait for the workers which are
+	 *	still using that to finish.  Nothing new can
+	 *	start using it, it hasn't been current since
+	 *	the last swap.
+	 */
+	epoch = atomic_load(&rl->epoch);
+	gen = &rl->gen[(epoch + 1) & 1];
+
+	while (atomic_load(&gen->readers) > 0) {
+		struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+
+		(void) nanosleep(&ts, NULL);
+	}
+
+	TALLOC_FREE(gen->ctx);
+	gen->ctx = ctx;
+	gen->data = data;
+
+	atomic_store(&rl->epoch, epoch + 1);
+
+	INFO("%s - Reloaded data", rl->name);
+}
+
+/** One of the files changed
+ *
+ * Wait for the files to be quiet before reloading, so that a file being
+ * written in several chunks is only read once it's complete.
+ */
+static void reload_changed(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_reload_t	*rl = talloc_get_type_abort(uctx, fr_reload_t);
+
+	if (fr_event_timer_in(rl->el, rl->el, &rl->ev, rl->delay, reload_timer, rl) < 0) {
+		PERROR("%s - Failed scheduling reload", rl->name);
+	}
+}
+
+static void reload_wake(fr_event_list_t *el, int fd, UNUSED int flags, UNUSED void *uctx)
+{
+	uint8_t		buffer[1];
+
+	while ((read(fd, buffer, sizeof(buffer)) < 0) && (errno == EINTR));
+
+	fr_event_loop_exit(el, 1);
+}
+
+static void *reload_thread(void *arg)
+{
+	fr_reload_t	*rl = arg;
+
+	if ((fr_event_fd_insert(rl->el, rl->el, rl->wake[0], reload_wake, NULL, NULL, rl) < 0)) {
+		PERROR("%s - Failed inserting wakeup pipe", rl->name);
+		return NULL;
+	}
+
+	(void) reload_watch(rl);
+
+	(void) fr_event_loop(rl->el);
+
+	reload_unwatch(rl);
+	(void) fr_event_fd_delete(rl->el, rl->wake[0], FR_EVENT_FILTER_IO);
+
+	return NULL;
+}
+
+static int _reload_free(fr_reload_t *rl)
+{
+	unsigned int i;
+
+	if (rl->started) {
+		while ((write(rl->wake[1], "", 1) < 0) && (errno == EINTR));
+		pthread_join(rl->thread, NULL);
+	}
+
+	TALLOC_FREE(rl->el);
+
+	for (i = 0; i < rl->num_files; i++) if (rl->fds[i] >= 0) close(rl->fds[i]);
+
+	if (rl->wake[0] >= 0) close(rl->wake[0]);
+	if (rl->wake[1] >= 0) close(rl->wake[1]);
+
+	TALLOC_FREE(rl->gen[0].ctx);
+	TALLOC_FREE(rl->gen[1].ctx);
+
+	return 0;
+}
+
+/** Load data from files, and reload it whenever the files change
+ *
+ * The first generation is built before this function returns.  If any
+ * files are given, a reload thread is then started, which rebuilds the
+ * data whenever they change.
+ *
+ * @param[in] ctx	to allocate the reloader in.  Freeing it stops the
+ *			reload thread, and frees all generations of data,
+ *			so no worker may be using them.
+ * @param[in] name	used in log messages.
+ * @param[in] files	to watch.  May be NULL, in which case the data
+ *			is loaded once, and never reloaded.
+ * @param[in] num_files	the number of entries in files.
+ * @param[in] delay	how long the files must be unchanged before
+ *			they're reloaded.
+ * @param[in] load	callback to build a new generation of data.
+ * @param[in] uctx	passed to load.  Must remain valid, and unchanged,
+ *			until the reloader is freed.
+ * @return
+ *	- A new reloader on success.
+ *	- NULL on failure.
+ */
+fr_reload_t *fr_reload_alloc(TALLOC_CTX *ctx, char const *name,
+			     char const **files, unsigned int num_files, fr_time_delta_t delay,
+			     fr_reload_load_t load, void *uctx)
+{
+	fr_reload_t	*rl;
+	void		*data;
+	unsigned int	i;
+	int		ret;
+
+	MEM(rl = talloc_zero(ctx, fr_reload_t));
+	MEM(rl->name = talloc_strdup(rl, name));
+	rl->load = load;
+	rl->uctx = uctx;
+	rl->delay = delay;
+	rl->wake[0] = rl->wake[1] = -1;
+
+	MEM(rl->files = talloc_array(rl, char const *, num_files));
+	MEM(rl->fds = talloc_array(rl, int, num_files));
+	for (i = 0; i < num_files; i++) {
+		MEM(rl->files[i] = talloc_strdup(rl->files, files[i]));
+		rl->fds[i] = -1;
+	}
+	rl->num_files = num_files;
+	talloc_set_destructor(rl, _reload_free);
+
+	rl->gen[0].ctx = talloc_init_const(name);
+	data = load(rl->gen[0].ctx, uctx);
+	if (!data) {
+		talloc_free(rl);
+		return NULL;
+	}
+	rl->gen[0].data = data;
+	atomic_init(&rl->gen[0].readers, 0);
+	atomic_init(&rl->gen[1].readers, 0);
+	atomic_init(&rl->epoch, 0);
+
+	if (!num_files) return rl;
+
+	if (pipe(rl->wake) < 0) {
+		fr_strerror_printf("Failed creating wakeup pipe: %s", fr_syserror(errno));
+	error:
+		talloc_free(rl);
+		return NULL;
+	}
+
+	rl->el = fr_event_list_alloc(NULL, NULL, NULL);
+	if (!rl->el) {
+		fr_strerror_const_push("Failed allocating reload event list");
+		goto error;
+	}
+
+	ret = pthread_create(&rl->thread, NULL, reload_thread, rl);
+	if (ret != 0) {
+		fr_strerror_printf("Failed starting %s reload thread: %s", name, fr_syserror(ret));
+		goto error;
+	}
+	rl->started = true;
+
+	return rl;
+}
+
+/** Start using the current generation of data
+ *
+ * The generation won't be freed until #fr_reload_release is called
+ * with the same ref.  The caller must not yield in between.
+ *
+ * @param[out] ref	to pass to #fr_reload_release.
+ * @param[in] rl	to get the data from.
+ * @return the current generation of data.
+ */
+void *fr_reload_acquire(fr_reload_ref_t *ref, fr_reload_t *rl)
+{
+	uint64_t	epoch;
+	fr_reload_gen_t	*gen;
+
+	/*
+	 *	If the reload thread published a new generation
+	 *	before we were counted in, it may already be
+	 *	reusing the slot we read.  Try again with the
+	 *	new current one.
+	 */
+	for (;;) {
+		epoch = atomic_load(&rl->epoch);
+		gen = &rl->gen[epoch & 1];
+
+		atomic_fetch_add(&gen->readers, 1);
+		if (atomic_load(&rl->epoch) == epoch) break;
+		atomic_fetch_sub(&gen->readers, 1);
+	}
+
+	ref->rl = rl;
+	ref->slot = epoch & 1;
+
+	return gen->data;
+}
+
+/** Finish using a generation of data
+ *
+ * @param[in] ref	from #fr_reload_acquire.
+ */
+void fr_reload_release(fr_reload_ref_t *ref)
+{
+	atomic_fetch_sub_explicit(&ref->rl->gen[ref->slot].readers, 1, memory_order_release);
+}
@@ -0,0 +1,71 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/reload.h
+ * @brief Rebuild module data from files when they change, without restarting the server.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(reload_h, "$Id$")
+
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_reload_s fr_reload_t;
+
+/** A worker's hold on a generation of data
+ *
+ */
+typedef struct {
+	fr_reload_t	*rl;			//!< The generation belongs to.
+	unsigned int	slot;			//!< Which generation is held.
+} fr_reload_ref_t;
+
+/** Build a new generation of data from the watched files
+ *
+ * Called once from #fr_reload_alloc, and then from the reload thread
+ * whenever one of the files changes.  Everything the new generation
+ * needs must be allocated in ctx.  The callback must not modify
+ * anything which the workers can see.
+ *
+ * @param[in] ctx	a new talloc root, which will be freed when the
+ *			generation is retired.
+ * @param[in] uctx	passed to #fr_reload_alloc.
+ * @return
+ *	- The new data on success.
+ *	- NULL on failure, in which case the previous generation is kept.
+ */
+typedef void *(*fr_reload_load_t)(TALLOC_CTX *ctx, void *uctx);
+
+fr_reload_t	*fr_reload_alloc(TALLOC_CTX *ctx, char const *name,
+				 char const **files, unsigned int num_files, fr_time_delta_t delay,
+				 fr_reload_load_t load, void *uctx);
+
+void		*fr_reload_acquire(fr_reload_ref_t *ref, fr_reload_t *rl) CC_HINT(nonnull);
+
+void		fr_reload_release(fr_reload_ref_t *ref) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
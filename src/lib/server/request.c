@@ -60,6 +60,21 @@ fr_dict_attr_autoload_t request_dict_attr[] = {
  */
 static _Thread_local fr_dlist_head_t *request_free_list; /* macro */
 
+/** How much extra memory to reserve in each request's talloc pool
+ *
+ * Pairs, their value buffers, and anything else parented by the request
+ * are bump allocated from this pool.  The whole pool is reset when the
+ * request is returned to the free list, so allocations which fit don't
+ * need to be individually returned to malloc.
+ */
+static size_t request_pool_extra = 8 * 1024;
+
+/** Average size we assume a chunk allocated from the pool to be
+ *
+ * Only used to estimate how many talloc headers need to fit in the pool.
+ */
+#define REQUEST_POOL_CHUNK_AVG	(64)
+
 #ifndef NDEBUG
 static int _state_ctx_free(fr_pair_t *state)
 {
@@ -120,10 +135,9 @@ static inline CC_HINT(always_inline) int request_detachable_init(request_t *chil
 	return 0;
 }
 
-static inline CC_HINT(always_inline) int request_child_init(request_t *child, request_t *parent)
+static inline CC_HINT(always_inline) void request_child_name_init(request_t *child, request_t *parent)
 {
 	child->number = parent->child_number++;
-	if (!child->dict) child->dict = parent->dict;
 
 	if ((parent->seq_start == 0) || (parent->number == parent->seq_start)) {
 		child->name = talloc_typed_asprintf(child, "%s.%" PRIu64, parent->name, child->number);
@@ -133,6 +147,13 @@ static inline CC_HINT(always_inline) int request_child_init(request_t *child, re
 	}
 	child->seq_start = 0;	/* children always start with their own sequence */
 	child->parent = parent;
+}
+
+static inline CC_HINT(always_inline) int request_child_init(request_t *child, request_t *parent)
+{
+	if (!child->dict) child->dict = parent->dict;
+
+	request_child_name_init(child, parent);
 
 	/*
 	 *	For new server support.
@@ -400,11 +421,13 @@ static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *c
 					   1 + 					/* Stack pool */
 					   UNLANG_STACK_MAX + 			/* Stack Frames */
 					   2 + 					/* packets */
-					   10,					/* extra */
+					   10 +					/* extra */
+					   (request_pool_extra / REQUEST_POOL_CHUNK_AVG),	/* pairs and values */
 					   (UNLANG_FRAME_PRE_ALLOC * UNLANG_STACK_MAX) +	/* Stack memory */
 					   (sizeof(fr_pair_t) * 5) +		/* pair lists and root*/
 					   (sizeof(fr_radius_packet_t) * 2) +	/* packets */
-					   128					/* extra */
+					   128 +				/* extra */
+					   request_pool_extra			/* pairs and values */
 					   ));
 	fr_assert(ctx != request);
 
@@ -577,6 +600,51 @@ int request_detach(request_t *child)
 	return 0;
 }
 
+/** Prepare a child request to run again, on behalf of a new parent
+ *
+ * For child requests which outlive their parent, such as the inner
+ * request of an EAP tunnel, which runs once for every round of the
+ * conversation.  The stack, the pair list roots and the packets are
+ * kept.  The request, reply and control lists are emptied, but the
+ * state list and any request data are left alone.
+ *
+ * @note The child must have been allocated with a ctx which outlives
+ *	 the parent, and must not be running.
+ *
+ * @param[in] child		to reuse.
+ * @param[in] parent		the child is now running on behalf of.
+ */
+void request_child_reuse(request_t *child, request_t *parent)
+{
+	fr_assert(child->type == REQUEST_TYPE_INTERNAL);
+	fr_assert(!request_is_detachable(child));
+	fr_assert(unlang_interpret_stack_depth(child) == 0);
+
+	fr_pair_list_free(&child->request_pairs);
+	fr_pair_list_free(&child->reply_pairs);
+	fr_pair_list_free(&child->control_pairs);
+
+	child->packet->code = 0;
+	child->reply->code = 0;
+	child->rcode = RLM_MODULE_NOT_SET;
+
+	talloc_const_free(child->name);
+	request_child_name_init(child, parent);
+	request_log_init_child(child, parent);
+}
+
+/** Set how much memory to reserve in each request for pairs and values
+ *
+ * Only affects requests allocated after the call, so should be called
+ * before any worker threads are started.
+ *
+ * @param[in] size	of the memory to reserve.
+ */
+void request_pool_size_set(size_t size)
+{
+	request_pool_extra = size;
+}
+
 int request_global_init(void)
 {
 	if (fr_dict_autoload(request_dict) < 0) {
@@ -316,6 +316,10 @@ request_t	*_request_local_alloc(char const *file, int line, TALLOC_CTX *ctx,
 
 int		request_detach(request_t *child);
 
+void		request_child_reuse(request_t *child, request_t *parent) CC_HINT(nonnull);
+
+void		request_pool_size_set(size_t size);
+
 int		request_global_init(void);
 void		request_global_free(void);
 
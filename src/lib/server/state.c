@@ -52,16 +52,26 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+typedef struct fr_state_shard_s fr_state_shard_t;
+
 /** Holds a state value, and associated fr_pair_ts and data
  *
  */
 typedef struct {
 	uint64_t		id;				//!< State number within state heap.
 	fr_rb_node_t		node;				//!< Entry in the state rbtree.
+	fr_state_shard_t	*shard;				//!< Shard this entry is in.
 	union {
 		/** Server ID components
 		 *
@@ -131,26 +141,48 @@ typedef struct {
 	request_t		*thawed;			//!< The request that thawed this entry.
 } state_child_entry_t;
 
+/** A shard of the state tree
+ *
+ * Entries are spread over the shards by a hash of their State value.
+ * Each shard has its own lock and expiry list, so that workers handling
+ * different sessions don't contend on the same mutex.
+ */
+struct fr_state_shard_s {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
+	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+};
+
 struct fr_state_tree_s {
-	uint64_t		id;				//!< Next ID to assign.
-	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
+	atomic_uint64_t		id;				//!< Next ID to assign.
+	atomic_uint64_t		timed_out;			//!< Number of states that were cleaned up due to
 								//!< timeout.
+	atomic_uint64_t		num_entries;			//!< Number of entries in all shards.
 	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
-	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+
+	fr_state_shard_t	*shards;			//!< Shards holding the state entries.
+	uint32_t		num_shards;			//!< Number of shards.  Always a power of 2.
 
 	fr_time_delta_t		timeout;			//!< How long to wait before cleaning up state entires.
 
-	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	bool			thread_safe;			//!< Whether we lock the shards whilst modifying them.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 	uint32_t		context_id;			//!< ID binding state values to a context such
 								///< as a virtual server.
 
 	fr_dict_attr_t const	*da;				//!< State attribute used.
+
+	fr_stats_counters_t	*memory;			//!< Memory used by the entries, measured on demand.
 };
 
+/** How many shards a thread safe state tree has
+ *
+ * More shards than workers keeps the chance of two workers
+ * wanting the same shard at the same time low.
+ */
+#define STATE_NUM_SHARDS	(64)
+
 #define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
 #define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
 
@@ -168,27 +200,126 @@ static int8_t state_entry_cmp(void const *one, void const *two)
 	return CMP(ret, 0);
 }
 
-/** Free the state tree
+/** Return the shard an entry belongs in, based on its state value
  *
  */
-static int _state_tree_free(fr_state_tree_t *state)
+static inline CC_HINT(always_inline) fr_state_shard_t *state_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	return &state->shards[fr_hash(entry->state, sizeof(entry->state)) & (state->num_shards - 1)];
+}
+
+/** Free a list of unlinked entries
+ *
+ * We do it outside of the mutex, as freeing may involve significantly
+ * more work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now be freed also,
+ * and it may have complex destructors associated with it.
+ */
+static void state_entries_free(fr_dlist_head_t *to_free)
 {
-	fr_state_entry_t *entry;
+	fr_state_entry_t	*entry;
 
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	while ((entry = fr_dlist_head(to_free)) != NULL) {
+		fr_dlist_remove(to_free, entry);
+		talloc_free(entry);
+	}
+}
 
-	DEBUG4("Freeing state tree %p", state);
+/** Unlink entries which have timed out from a shard
+ *
+ * @note Called with the shard's mutex held.
+ *
+ * @param[in] state	tree the shard belongs to.
+ * @param[in] shard	to remove expired entries from.
+ * @param[out] to_free	list of unlinked entries, to free once the mutex is released.
+ * @param[in] now	the current time.
+ * @return the number of entries which were unlinked.
+ */
+static uint64_t state_shard_expire(fr_state_tree_t *state, fr_state_shard_t *shard,
+				   fr_dlist_head_t *to_free, fr_time_t now)
+{
+	fr_state_entry_t	*entry, *next;
+	uint64_t		timed_out = 0;
+
+	for (entry = fr_dlist_head(&shard->to_expire);
+	     entry != NULL;
+	     entry = next) {
+		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
+		next = fr_dlist_next(&shard->to_expire, entry);		/* Advance *before* potential unlinking */
+
+		/*
+		 *	The list is ordered by cleanup time, so
+		 *	everything after this is newer.
+		 */
+		if (entry->cleanup >= now) break;
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
 		state_entry_unlink(state, entry);
-		talloc_free(entry);
+		fr_dlist_insert_tail(to_free, entry);
+		timed_out++;
 	}
 
+	if (timed_out) atomic_fetch_add_explicit(&state->timed_out, timed_out, memory_order_relaxed);
+
+	return timed_out;
+}
+
+/** Unlink and free entries which have timed out, from all the shards
+ *
+ * @note Called with no mutexes held.
+ */
+static uint64_t state_tree_expire(fr_state_tree_t *state, fr_time_t now)
+{
+	uint32_t		i;
+	uint64_t		timed_out = 0;
+	fr_dlist_head_t		to_free;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, list);
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		timed_out += state_shard_expire(state, shard, &to_free, now);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+		state_entries_free(&to_free);
+	}
+
+	return timed_out;
+}
+
+/** Free the state tree
+ *
+ */
+static int _state_tree_free(fr_state_tree_t *state)
+{
+	fr_state_entry_t	*entry;
+	uint32_t		i;
+
+	DEBUG4("Freeing state tree %p", state);
+
 	/*
-	 *	Free the rbtree
+	 *	Stop anyone measuring the tree while we free it.
 	 */
-	talloc_free(state->tree);
+	TALLOC_FREE(state->memory);
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(state, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+	}
 
 	return 0;
 }
@@ -197,7 +328,9 @@ static int _state_tree_free(fr_state_tree_t *state)
  *
  * @param[in] ctx		to link the lifecycle of the state tree to.
  * @param[in] da		Attribute used to store and retrieve state from.
- * @param[in] thread_safe		Whether we should mutex protect the state tree.
+ * @param[in] thread_safe	Whether we should mutex protect the state tree.
+ *				Thread safe trees are split into shards, each
+ *				with its own mutex.
  * @param[in] max_sessions	we track state for.
  * @param[in] timeout		How long to wait before cleaning up entries.
  * @param[in] server_id		ID byte to use in load-balancing operations.
@@ -212,12 +345,14 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 				    uint8_t server_id, uint32_t context_id)
 {
 	fr_state_tree_t *state;
+	uint32_t	i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	state->thread_safe = thread_safe;
 
 	/*
 	 *	Create a break in the contexts.
@@ -228,36 +363,51 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
+	state->num_shards = thread_safe ? STATE_NUM_SHARDS : 1;
+	state->shards = talloc_zero_array(state, fr_state_shard_t, state->num_shards);
+	if (!state->shards) {
 		talloc_free(state);
 		return NULL;
 	}
 
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, list);
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
-	 */
-	state->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+		if (thread_safe && (pthread_mutex_init(&shard->mutex, NULL) != 0)) goto error;
+
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, list);
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
+		if (!shard->tree) {
+			if (thread_safe) pthread_mutex_destroy(&shard->mutex);
+
+		error:
+			while (i-- > 0) {
+				if (thread_safe) pthread_mutex_destroy(&state->shards[i].mutex);
+				talloc_free(state->shards[i].tree);
+			}
+			talloc_free(state);
+			return NULL;
+		}
 	}
 	talloc_set_destructor(state, _state_tree_free);
 
 	state->da = da;		/* Remember which attribute we use to load/store state */
 	state->server_id = server_id;
 	state->context_id = context_id;
-	state->thread_safe = thread_safe;
 
 	return state;
 }
 
 /** Unlink an entry and remove if from the tree
  *
+ * @note Called with the mutex of the entry's shard held.
  */
 static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
 {
@@ -266,9 +416,11 @@ static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
+	fr_dlist_remove(&entry->shard->to_expire, entry);
+
+	fr_rb_delete(entry->shard->tree, entry);
 
-	fr_rb_delete(state->tree, entry);
+	atomic_fetch_sub_explicit(&state->num_entries, 1, memory_order_relaxed);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
@@ -311,55 +463,42 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	return 0;
 }
 
-/** Create a new state entry
+/** Create a new state entry, and insert it into the tree
+ *
+ * On success, the entry takes ownership of the request's session_state_ctx,
+ * and of the persistable request data in data.
  *
- * @note Called with the mutex held.
+ * @note Called with the mutex of old_shard held, if old_shard isn't NULL.
+ *	 Returns with no mutexes held.
+ *
+ * @param[in] state		tree to insert the entry into.
+ * @param[in] request		the entry is being created for.
+ * @param[in] reply_list	to add the State attribute to.
+ * @param[in] data		persistable request data to store in the entry.
+ * @param[in] old_shard		the shard which the previous entry was searched for in.
+ * @param[in] old		the previous entry in this sequence, may be NULL.
+ * @return
+ *	- The new entry.
+ *	- NULL on failure, in which case data is left untouched.
  */
 static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
-					    fr_pair_list_t *reply_list, fr_state_entry_t *old)
+					    fr_pair_list_t *reply_list, fr_dlist_head_t *data,
+					    fr_state_shard_t *old_shard, fr_state_entry_t *old)
 {
 	size_t			i;
 	uint32_t		x;
 	fr_time_t		now = fr_time();
 	fr_pair_t		*vp;
-	fr_state_entry_t	*entry, *next;
+	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
 
 	uint8_t			old_state[sizeof(old->state)];
 	int			old_tries = 0;
 	uint64_t		timed_out = 0;
-	bool			too_many = false;
 	fr_dlist_head_t		to_free;
 
 	fr_dlist_init(&to_free, fr_state_entry_t, list);
 
-	/*
-	 *	Clean up old entries.
-	 */
-	for (entry = fr_dlist_head(&state->to_expire);
-	     entry != NULL;
-	     entry = next) {
-		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
-
-		if (entry == old) continue;
-
-		/*
-		 *	Too old, we can delete it.
-		 */
-		if (entry->cleanup < now) {
-			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
-			timed_out++;
-			continue;
-		}
-
-		break;
-	}
-
-	state->timed_out += timed_out;
-
-	if (!old && (fr_rb_num_elements(state->tree) >= (uint32_t) state->max_sessions)) too_many = true;
-
 	/*
 	 *	Record the information from the old state, we may base the
 	 *	new state off the old one.
@@ -380,35 +519,24 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 			fr_dlist_insert_tail(&to_free, old);
 		}
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	if (old_shard) PTHREAD_MUTEX_UNLOCK(&old_shard->mutex);
 
-	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+	state_entries_free(&to_free);
 
 	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
+	 *	Entries are normally expired when new entries are
+	 *	added to their shard.  If we're at the limit, check
+	 *	all of the shards before giving up.
 	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
-	}
-
-	/*
-	 *	Have to do this post-cleanup, else we end up returning with
-	 *	a list full of entries to free with none of them being
-	 *	freed which is bad...
-	 */
-	if (too_many) {
-		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
-		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
+	if (!old && (atomic_load_explicit(&state->num_entries, memory_order_relaxed) >= state->max_sessions)) {
+		timed_out = state_tree_expire(state, now);
+		if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+
+		if (atomic_load_explicit(&state->num_entries, memory_order_relaxed) >= state->max_sessions) {
+			RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
+			       state->max_sessions);
+			return NULL;
+		}
 	}
 
 	/*
@@ -419,7 +547,7 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 
 	request_data_list_init(&entry->data);
 	talloc_set_destructor(entry, _state_entry_free);
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -506,8 +634,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	DEBUG4("State ID %" PRIu64 " created, value 0x%pH, expires %" PRIu64 "s",
 	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)), (uint64_t)entry->cleanup - now);
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -516,10 +642,34 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 */
 	*((uint32_t *)(&entry->state_comp.context_id)) ^= state->context_id;
 
-	if (!fr_rb_insert(state->tree, entry)) {
+	/*
+	 *	Hand over the session data before the entry
+	 *	becomes visible to other requests.
+	 */
+	entry->seq_start = request->seq_start;
+	entry->ctx = request->session_state_ctx;
+	fr_dlist_move(&entry->data, data);
+
+	shard = entry->shard = state_shard(state, entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+
+	/*
+	 *	Clean up old entries.
+	 */
+	timed_out = state_shard_expire(state, shard, &to_free, now);
+
+	if (!fr_rb_insert(shard->tree, entry)) {
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
 		RERROR("Failed inserting state entry - Insertion into state tree failed");
 		fr_pair_delete_by_da(reply_list, state->da);
+
+		entry->ctx = NULL;			/* Still owned by the request */
+		fr_dlist_move(data, &entry->data);
 		talloc_free(entry);
+
+		state_entries_free(&to_free);
 		return NULL;
 	}
 
@@ -527,17 +677,32 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 *	Link it to the end of the list, which is implicitely
 	 *	ordered by cleanup time.
 	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
+	fr_dlist_insert_tail(&shard->to_expire, entry);
+	atomic_fetch_add_explicit(&state->num_entries, 1, memory_order_relaxed);
+
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+
+	state_entries_free(&to_free);
 
 	return entry;
 }
 
 /** Find the entry, based on the State attribute
  *
+ * @note Returns with the mutex of the shard that was searched held,
+ *	 whether or not an entry was found.
+ *
+ * @param[out] out	the entry, or NULL if no entry matched.
+ * @param[in] state	tree to search in.
+ * @param[in] vb	the value of the State attribute.
+ * @return the locked shard.
  */
-static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, fr_value_box_t const *vb)
+static fr_state_shard_t *state_entry_find(fr_state_entry_t **out, fr_state_tree_t *state, fr_value_box_t const *vb)
 {
-	fr_state_entry_t *entry, my_entry;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
 
 	/*
 	 *	Assume our own State first.
@@ -566,11 +731,77 @@ static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, fr_value_box_t
 	 */
 	my_entry.state_comp.context_id ^= state->context_id;
 
-	entry = fr_rb_find(state->tree, &my_entry);
+	shard = state_shard(state, &my_entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = fr_rb_find(shard->tree, &my_entry);
 
 	if (entry) (void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	return entry;
+	*out = entry;
+
+	return shard;
+}
+
+/** Measure the memory used by all entries in the tree
+ *
+ * Each shard is locked in turn, so this is only done when someone
+ * asks for the numbers.
+ */
+static void _state_tree_memory_read(uint64_t *out, void *uctx)
+{
+	fr_state_tree_t		*state = talloc_get_type_abort(uctx, fr_state_tree_t);
+	fr_state_entry_t	*entry;
+	uint32_t		i;
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		for (entry = fr_dlist_head(&shard->to_expire);
+		     entry;
+		     entry = fr_dlist_next(&shard->to_expire, entry)) {
+			out[FR_STATS_MEMORY_BYTES] += talloc_total_size(entry);
+			out[FR_STATS_MEMORY_BLOCKS] += talloc_total_blocks(entry);
+
+			/*
+			 *	The session-state isn't parented
+			 *	by the entry.
+			 */
+			if (!entry->ctx) continue;
+			out[FR_STATS_MEMORY_BYTES] += talloc_total_size(entry->ctx);
+			out[FR_STATS_MEMORY_BLOCKS] += talloc_total_blocks(entry->ctx);
+		}
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
+}
+
+/** Report the memory used by a state tree in the "memory" counters
+ *
+ * The entries are only measured when the counters are read, so there's
+ * no cost when nobody is looking.
+ *
+ * @param[in] state	to measure.
+ * @param[in] name	used to identify the tree in the counters, usually
+ *			the name of the virtual server.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_state_tree_memory_register(fr_state_tree_t *state, char const *name)
+{
+	char *counters_name;
+
+	counters_name = talloc_asprintf(NULL, "state.%s", name);
+	if (!counters_name) return -1;
+
+	state->memory = fr_stats_memory_alloc(state, counters_name);
+	talloc_free(counters_name);
+	if (!state->memory) return -1;
+
+	fr_stats_counters_read_func_set(state->memory, _state_tree_memory_read, state);
+
+	return 0;
 }
 
 /** Called when sending an Access-Accept/Access-Reject to discard state information
@@ -579,19 +810,19 @@ static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, fr_value_box_t
 void fr_state_discard(fr_state_tree_t *state, request_t *request)
 {
 	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
 	fr_pair_t		*vp;
 
 	vp = fr_pair_find_by_da(&request->request_pairs, state->da, 0);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, &vp->data);
+	shard = state_entry_find(&entry, state, &vp->data);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 		return;
 	}
 	state_entry_unlink(state, entry);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -636,6 +867,7 @@ void fr_state_discard(fr_state_tree_t *state, request_t *request)
 int fr_state_to_request(fr_state_tree_t *state, request_t *request)
 {
 	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
 	TALLOC_CTX		*old_ctx = NULL;
 	fr_pair_t		*vp;
 
@@ -649,13 +881,12 @@ int fr_state_to_request(fr_state_tree_t *state, request_t *request)
 		return 1;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, &vp->data);
+	shard = state_entry_find(&entry, state, &vp->data);
 	if (entry) {
 		(void)talloc_get_type_abort(entry, fr_state_entry_t);
 		if (entry->thawed) {
 			REDEBUG("State entry has already been thawed by a request %"PRIu64, entry->thawed->number);
-			PTHREAD_MUTEX_UNLOCK(&state->mutex);
+			PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 			return -2;
 		}
 		if (request->session_state_ctx) old_ctx = request->session_state_ctx;	/* Store for later freeing */
@@ -668,9 +899,9 @@ int fr_state_to_request(fr_state_tree_t *state, request_t *request)
 
 		entry->ctx = NULL;
 		entry->thawed = request;
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 	} else {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 		RDEBUG2("No state entry matching &request.%pP found", vp);
 		return 2;
 	}
@@ -702,6 +933,7 @@ int fr_state_to_request(fr_state_tree_t *state, request_t *request)
 int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 {
 	fr_state_entry_t	*entry, *old = NULL;
+	fr_state_shard_t	*old_shard = NULL;
 	fr_dlist_head_t		data;
 	fr_pair_t		*vp;
 
@@ -717,26 +949,17 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 
 	vp = fr_pair_find_by_da(&request->request_pairs, state->da, 0);
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	if (vp) old = state_entry_find(state, &vp->data);
+	if (vp) old_shard = state_entry_find(&old, state, &vp->data);
 
-	entry = state_entry_create(state, request, &request->reply_pairs, old);
+	fr_assert(request->session_state_ctx);
+
+	entry = state_entry_create(state, request, &request->reply_pairs, &data, old_shard, old);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RERROR("Creating state entry failed");
 		request_data_restore(request, &data);	/* Put it back again */
 		return -1;
 	}
 
-	fr_assert(entry->ctx == NULL);
-	fr_assert(request->session_state_ctx);
-
-	entry->seq_start = request->seq_start;
-	entry->ctx = request->session_state_ctx;
-	fr_dlist_move(&entry->data, &data);
-
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
 	MEM(request->session_state_ctx = fr_pair_afrom_da(NULL, request_attr_state));	/* fixme - should use a pool */
 
 	RDEBUG3("%s - saved", state->da->name);
@@ -888,7 +1111,7 @@ void fr_state_discard_child(request_t *parent, void const *unique_ptr, int uniqu
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -896,7 +1119,7 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	return atomic_load_explicit(&state->timed_out, memory_order_relaxed);
 }
 
 /** Return number of entries we're currently tracking
@@ -904,5 +1127,5 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return fr_rb_num_elements(state->tree);
+	return atomic_load_explicit(&state->num_entries, memory_order_relaxed);
 }
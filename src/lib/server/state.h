@@ -39,6 +39,8 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 				    uint32_t max_sessions, fr_time_delta_t timeout,
 				    uint8_t server_id, uint32_t context_id);
 
+int	fr_state_tree_memory_register(fr_state_tree_t *state, char const *name);
+
 void	fr_state_discard(fr_state_tree_t *state, request_t *request);
 
 int	fr_state_to_request(fr_state_tree_t *state, request_t *request);
@@ -29,6 +29,297 @@ RCSID("$Id$")
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/radius/defs.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hw.h>
+
+#include <pthread.h>
+
+/** A registered set of counters
+ *
+ */
+struct fr_stats_counters_s {
+	fr_dlist_t		entry;			//!< in the list of all counter sets.
+
+	char const		*dimension;		//!< what the counters are for, e.g. "module", "client".
+	char const		*name;			//!< which one, e.g. the module instance name.
+
+	char const * const	*counter_names;		//!< names of the individual counters.  May contain NULLs.
+	unsigned int		num_counters;		//!< how many counters there are in each slot.
+
+	pthread_mutex_t		mutex;			//!< protects the list of slots.
+	fr_dlist_head_t		slots;			//!< one for each thread which updates the counters.
+
+	fr_stats_counters_read_t read;			//!< adds values which are calculated on demand.
+	void			*uctx;			//!< passed to read.
+};
+
+/** One thread's copy of the counters
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< in the counter set's list of slots.
+	fr_stats_slot_t		*counters;		//!< cache line aligned, written only by the owning thread.
+} fr_stats_counters_slot_t;
+
+static pthread_mutex_t	counters_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_dlist_head_t	counters_list;
+static bool		counters_list_init;
+
+static int _stats_counters_free(fr_stats_counters_t *sc)
+{
+	pthread_mutex_lock(&counters_mutex);
+	fr_dlist_remove(&counters_list, sc);
+	pthread_mutex_unlock(&counters_mutex);
+
+	pthread_mutex_destroy(&sc->mutex);
+
+	return 0;
+}
+
+/** Register a new set of counters
+ *
+ * @param[in] ctx		to allocate the counters in.  Freeing it unregisters them.
+ * @param[in] dimension		what the counters are for, e.g. "module", "client", or "listener".
+ * @param[in] name		which instance of the dimension they're for.
+ * @param[in] counter_names	names of the counters, used when printing them.  Must
+ *				have at least num_counters entries, and live as long as
+ *				the counters do.  Counters with a NULL name aren't printed.
+ * @param[in] num_counters	How many counters there are.
+ * @return
+ *	- The new counters on success.
+ *	- NULL on failure.
+ */
+fr_stats_counters_t *fr_stats_counters_alloc(TALLOC_CTX *ctx, char const *dimension, char const *name,
+					     char const * const *counter_names, unsigned int num_counters)
+{
+	fr_stats_counters_t *sc;
+
+	sc = talloc_zero(ctx, fr_stats_counters_t);
+	if (!sc) return NULL;
+
+	sc->dimension = talloc_strdup(sc, dimension);
+	sc->name = talloc_strdup(sc, name);
+	sc->counter_names = counter_names;
+	sc->num_counters = num_counters;
+
+	pthread_mutex_init(&sc->mutex, NULL);
+	fr_dlist_talloc_init(&sc->slots, fr_stats_counters_slot_t, entry);
+
+	pthread_mutex_lock(&counters_mutex);
+	if (!counters_list_init) {
+		fr_dlist_init(&counters_list, fr_stats_counters_t, entry);
+		counters_list_init = true;
+	}
+	fr_dlist_insert_tail(&counters_list, sc);
+	pthread_mutex_unlock(&counters_mutex);
+
+	talloc_set_destructor(sc, _stats_counters_free);
+
+	return sc;
+}
+
+/** Names of the counters in the "memory" dimension
+ *
+ */
+static char const * const stats_memory_names[FR_STATS_MEMORY_MAX] = {
+	[FR_STATS_MEMORY_BYTES]		= "bytes",
+	[FR_STATS_MEMORY_BLOCKS]	= "blocks",
+};
+
+/** Register a set of memory usage counters
+ *
+ * The counters are indexed by #fr_stats_memory_t, and are usually
+ * updated with FR_STATS_COUNTER_SET(), or by a read callback.
+ *
+ * @param[in] ctx		to allocate the counters in.  Freeing it unregisters them.
+ * @param[in] name		of what's using the memory, e.g. "module.sql".
+ * @return
+ *	- The new counters on success.
+ *	- NULL on failure.
+ */
+fr_stats_counters_t *fr_stats_memory_alloc(TALLOC_CTX *ctx, char const *name)
+{
+	return fr_stats_counters_alloc(ctx, "memory", name, stats_memory_names, FR_STATS_MEMORY_MAX);
+}
+
+/** Set a callback to calculate additional values when the counters are read
+ *
+ * The callback is run with the list of all counters locked, so it must
+ * not register or free any counters.  It may be run from any thread.
+ *
+ * @param[in] sc	to set the callback for.
+ * @param[in] read	callback, or NULL to remove it.
+ * @param[in] uctx	passed to the callback.
+ */
+void fr_stats_counters_read_func_set(fr_stats_counters_t *sc, fr_stats_counters_read_t read, void *uctx)
+{
+	pthread_mutex_lock(&sc->mutex);
+	sc->read = read;
+	sc->uctx = uctx;
+	pthread_mutex_unlock(&sc->mutex);
+}
+
+/** Allocate a slot for the calling thread
+ *
+ * Slots are never freed before the counter set is, so the counts
+ * from threads which have exited are still included in the totals.
+ *
+ * @param[in] sc	to allocate the slot in.
+ * @return
+ *	- The counters for this thread on success.
+ *	- NULL on failure.
+ */
+fr_stats_slot_t *fr_stats_counters_slot(fr_stats_counters_t *sc)
+{
+	fr_stats_counters_slot_t	*slot;
+	size_t				size = sizeof(fr_stats_slot_t) * sc->num_counters;
+	void				*start;
+
+	/*
+	 *	The slot struct itself is only touched when reading,
+	 *	so it doesn't need to be aligned.  The counters are,
+	 *	and they are padded out to a whole number of cache
+	 *	lines, so no two threads ever share one.
+	 */
+	pthread_mutex_lock(&sc->mutex);
+	slot = talloc_zero(sc, fr_stats_counters_slot_t);
+	if (!slot) {
+	oom:
+		pthread_mutex_unlock(&sc->mutex);
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	if (!talloc_aligned_array(slot, &start, fr_hw_cache_line_size(), size)) {
+		talloc_free(slot);
+		goto oom;
+	}
+	memset(start, 0, size);
+	slot->counters = start;
+
+	fr_dlist_insert_tail(&sc->slots, slot);
+	pthread_mutex_unlock(&sc->mutex);
+
+	return slot->counters;
+}
+
+/** Sum the counters from all threads
+ *
+ * @param[out] out	where to write the totals.  Must have room for
+ *			the number of counters which were registered.
+ * @param[in] sc	to read.
+ */
+void fr_stats_counters_read(uint64_t *out, fr_stats_counters_t *sc)
+{
+	fr_stats_counters_slot_t	*slot = NULL;
+	unsigned int			i;
+
+	memset(out, 0, sizeof(*out) * sc->num_counters);
+
+	pthread_mutex_lock(&sc->mutex);
+	while ((slot = fr_dlist_next(&sc->slots, slot))) {
+		for (i = 0; i < sc->num_counters; i++) {
+			out[i] += atomic_load_explicit(&slot->counters[i], memory_order_relaxed);
+		}
+	}
+	if (sc->read) sc->read(out, sc->uctx);
+	pthread_mutex_unlock(&sc->mutex);
+}
+
+/** Print all registered counters
+ *
+ * Output is one "dimension.name.counter<TAB>value" line per non-zero counter.
+ *
+ * @param[in] fp		to print to.
+ * @param[in] dimension		only print counters for this dimension.  NULL for all counters.
+ */
+void fr_stats_counters_print(FILE *fp, char const *dimension)
+{
+	fr_stats_counters_t	*sc = NULL;
+	unsigned int		i;
+
+	pthread_mutex_lock(&counters_mutex);
+	if (!counters_list_init) {
+		pthread_mutex_unlock(&counters_mutex);
+		return;
+	}
+
+	while ((sc = fr_dlist_next(&counters_list, sc))) {
+		uint64_t	totals[sc->num_counters];
+
+		if (dimension && (strcmp(dimension, sc->dimension) != 0)) continue;
+
+		fr_stats_counters_read(totals, sc);
+
+		for (i = 0; i < sc->num_counters; i++) {
+			if (!sc->counter_names[i] || !totals[i]) continue;
+
+			fprintf(fp, "%s.%s.%s\t%" PRIu64 "\n", sc->dimension, sc->name, sc->counter_names[i], totals[i]);
+		}
+	}
+	pthread_mutex_unlock(&counters_mutex);
+}
+
+typedef struct {
+	fr_stats_counters_t const	*sc;
+	uint64_t			value;
+} stats_counters_top_t;
+
+static int stats_counters_top_cmp(void const *one, void const *two)
+{
+	stats_counters_top_t const *a = one, *b = two;
+
+	return CMP(b->value, a->value);
+}
+
+/** Print the counter sets with the largest values for one counter
+ *
+ * Output is one "name<TAB>value" line per counter set, largest first.
+ * Counter sets where the value is zero aren't printed.
+ *
+ * @param[in] fp		to print to.
+ * @param[in] dimension		to print counters for, e.g. "memory".
+ * @param[in] idx		of the counter to sort by.
+ * @param[in] num		maximum number of counter sets to print.
+ */
+void fr_stats_counters_top_print(FILE *fp, char const *dimension, unsigned int idx, unsigned int num)
+{
+	fr_stats_counters_t	*sc = NULL;
+	stats_counters_top_t	*top;
+	unsigned int		i, count = 0;
+
+	pthread_mutex_lock(&counters_mutex);
+	if (!counters_list_init) {
+		pthread_mutex_unlock(&counters_mutex);
+		return;
+	}
+
+	top = talloc_array(NULL, stats_counters_top_t, fr_dlist_num_elements(&counters_list));
+	if (!top) {
+		pthread_mutex_unlock(&counters_mutex);
+		return;
+	}
+
+	while ((sc = fr_dlist_next(&counters_list, sc))) {
+		uint64_t	totals[sc->num_counters];
+
+		if ((strcmp(dimension, sc->dimension) != 0) || (idx >= sc->num_counters)) continue;
+
+		fr_stats_counters_read(totals, sc);
+		if (!totals[idx]) continue;
+
+		top[count++] = (stats_counters_top_t){ .sc = sc, .value = totals[idx] };
+	}
+
+	qsort(top, count, sizeof(top[0]), stats_counters_top_cmp);
+
+	for (i = 0; (i < count) && (i < num); i++) {
+		fprintf(fp, "%s\t%" PRIu64 "\n", top[i].sc->name, top[i].value);
+	}
+	pthread_mutex_unlock(&counters_mutex);
+
+	talloc_free(top);
+}
 
 
 #ifdef WITH_STATS
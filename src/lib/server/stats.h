@@ -25,10 +25,94 @@
  */
 RCSIDH(stats_h, "$Id$")
 
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdio.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/** A set of named counters, with one copy for each thread which updates them
+ *
+ * Each thread gets its own cache line aligned slot, which only that
+ * thread writes to.  The slots are summed when the counters are read,
+ * so the fast path is a plain increment with no locks, and no cache
+ * lines bouncing between CPUs.
+ */
+typedef struct fr_stats_counters_s fr_stats_counters_t;
+
+/** The counters for one thread
+ *
+ * Obtained via fr_stats_counters_slot(), usually in a thread_instantiate
+ * callback, and then passed to FR_STATS_COUNTER_INC().
+ */
+typedef atomic_uint_fast64_t fr_stats_slot_t;
+
+/** Increment a counter in a thread's slot
+ *
+ * Only the owning thread writes to the slot, so there's no need for a
+ * locked read-modify-write.  The relaxed atomics only ensure that
+ * readers never see a torn value.
+ */
+#define FR_STATS_COUNTER_ADD(_slot, _idx, _n) \
+	atomic_store_explicit(&(_slot)[_idx], \
+			      atomic_load_explicit(&(_slot)[_idx], memory_order_relaxed) + (_n), memory_order_relaxed)
+
+#define FR_STATS_COUNTER_INC(_slot, _idx) FR_STATS_COUNTER_ADD(_slot, _idx, 1)
+
+/** Set a counter in a thread's slot
+ *
+ * For values which are sampled rather than counted, e.g. how much
+ * memory the thread is using.  The total is then the sum of the last
+ * sample from each thread.
+ */
+#define FR_STATS_COUNTER_SET(_slot, _idx, _n) \
+	atomic_store_explicit(&(_slot)[_idx], (_n), memory_order_relaxed)
+
+/** Callback to add values which are calculated when the counters are read
+ *
+ * Used for things which can't cheaply be counted as they change, and are
+ * instead measured on demand, such as the size of a shared cache.
+ *
+ * @param[in,out] out	totals from the per-thread slots, to add to.
+ * @param[in] uctx	passed to fr_stats_counters_read_func_set().
+ */
+typedef void (*fr_stats_counters_read_t)(uint64_t *out, void *uctx);
+
+/** Counters for the "memory" dimension
+ *
+ * Enabled with `memory_accounting = yes` in the main configuration.
+ */
+typedef enum {
+	FR_STATS_MEMORY_BYTES = 0,				//!< Bytes allocated.
+	FR_STATS_MEMORY_BLOCKS,					//!< Number of allocations.
+	FR_STATS_MEMORY_MAX
+} fr_stats_memory_t;
+
+fr_stats_counters_t	*fr_stats_counters_alloc(TALLOC_CTX *ctx, char const *dimension, char const *name,
+						 char const * const *counter_names, unsigned int num_counters);
+
+fr_stats_counters_t	*fr_stats_memory_alloc(TALLOC_CTX *ctx, char const *name);
+
+void			fr_stats_counters_read_func_set(fr_stats_counters_t *sc,
+							fr_stats_counters_read_t read, void *uctx);
+
+fr_stats_slot_t		*fr_stats_counters_slot(fr_stats_counters_t *sc);
+
+void			fr_stats_counters_read(uint64_t *out, fr_stats_counters_t *sc);
+
+void			fr_stats_counters_print(FILE *fp, char const *dimension);
+
+void			fr_stats_counters_top_print(FILE *fp, char const *dimension,
+						    unsigned int idx, unsigned int num) CC_HINT(nonnull);
+
 #ifdef WITH_STATS_64BIT
 typedef uint64_t fr_uint_t;
 #else
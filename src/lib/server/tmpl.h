@@ -518,6 +518,12 @@ struct tmpl_cursor_nested_s {
 	};
 };
 
+/** Number of nested evaluation contexts stored in the cursor ctx itself
+ *
+ * References deeper than this fall back to allocating from a talloc pool.
+ */
+#define TMPL_CURSOR_NESTED_PREALLOC	2
+
 /** Maintains state between cursor calls
  *
  */
@@ -533,6 +539,10 @@ struct tmpl_cursor_ctx_s {
 						///< one of these so it doesn't make sense to
 						///< allocate it later.
 
+	tmpl_cursor_nested_t	prealloc[TMPL_CURSOR_NESTED_PREALLOC];	//!< Nested state for the
+						///< first few levels of structural attributes.
+	unsigned int		prealloc_used;	//!< How many entries in prealloc are in use.
+
 	fr_dlist_head_t		nested;		//!< Nested state.  These are allocated when we
 						///< need to maintain state between multiple
 						///< cursor calls for a particular attribute
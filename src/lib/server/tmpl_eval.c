@@ -816,8 +816,18 @@ void _tmpl_cursor_child_init(TALLOC_CTX *list_ctx, fr_pair_list_t *list, tmpl_at
 {
 	tmpl_cursor_nested_t *ns;
 
-	_tmpl_cursor_pool_init(cc);
-	MEM(ns = talloc(cc->pool, tmpl_cursor_nested_t));
+	/*
+	 *	Most references only go one or two levels
+	 *	deep, so avoid creating a pool for them.
+	 *	Contexts are pushed and popped in stack order
+	 *	so a simple counter is sufficient.
+	 */
+	if (cc->prealloc_used < NUM_ELEMENTS(cc->prealloc)) {
+		ns = &cc->prealloc[cc->prealloc_used++];
+	} else {
+		_tmpl_cursor_pool_init(cc);
+		MEM(ns = talloc(cc->pool, tmpl_cursor_nested_t));
+	}
 	*ns = (tmpl_cursor_nested_t){
 		.ar = ar,
 		.func = _tmpl_cursor_child_eval,
@@ -892,7 +902,14 @@ static inline CC_HINT(always_inline) void _tmpl_cursor_eval_pop(tmpl_pair_cursor
 {
 	tmpl_cursor_nested_t *ns = fr_dlist_pop_tail(&cc->nested);
 
-	if (ns != &cc->leaf) talloc_free(ns);
+	if (ns == &cc->leaf) return;
+
+	if ((ns >= cc->prealloc) && (ns < (cc->prealloc + NUM_ELEMENTS(cc->prealloc)))) {
+		cc->prealloc_used--;
+		return;
+	}
+
+	talloc_free(ns);
 }
 
 /** Evaluates, then, sometimes, pops evaluation contexts from the tmpl stack
@@ -1172,8 +1189,11 @@ void tmpl_pair_cursor_clear(tmpl_pair_cursor_ctx_t *cc)
 {
 	if (!fr_dlist_num_elements(&cc->nested)) return;/* Help simplify dealing with unused cursor ctxs */
 
-	fr_dlist_remove(&cc->nested, &cc->leaf);	/* Noop if leaf isn't inserted */
-	fr_dlist_talloc_free(&cc->nested);
+	/*
+	 *	Pop in stack order so that pre-allocated
+	 *	and leaf contexts aren't passed to talloc.
+	 */
+	while (fr_dlist_tail(&cc->nested)) _tmpl_cursor_eval_pop(cc);
 
 	/*
 	 *	Always free the pool because it's allocated when
@@ -1182,6 +1202,41 @@ void tmpl_pair_cursor_clear(tmpl_pair_cursor_ctx_t *cc)
 	TALLOC_FREE(cc->pool);
 }
 
+/** Resolve the request and list references in a #tmpl_t to a list head
+ *
+ * Used by the functions below when they can operate on the list
+ * directly, without setting up a cursor.
+ *
+ * @param[out] out	Where to write the list head.
+ * @param[in] request	The current #request_t.
+ * @param[in] vpt	to resolve.
+ * @return
+ *	- 0 on success.
+ *	- -2 if list could not be found (doesn't exist in current #request_t).
+ *	- -3 if context could not be found (no parent #request_t available).
+ */
+static int tmpl_list_head_resolve(fr_pair_list_t **out, request_t *request, tmpl_t const *vpt)
+{
+	tmpl_request_t	*rr = NULL;
+
+	while ((rr = fr_dlist_next(&vpt->data.attribute.rr, rr))) {
+		if (tmpl_request_ptr(&request, rr->request) < 0) {
+			fr_strerror_printf("Request context \"%s\" not available",
+					   fr_table_str_by_value(tmpl_request_ref_table, rr->request, "<INVALID>"));
+			return -3;
+		}
+	}
+
+	*out = tmpl_list_head(request, tmpl_list(vpt));
+	if (!*out) {
+		fr_strerror_printf("List \"%s\" not available in this context",
+				   fr_table_str_by_value(pair_list_table, tmpl_list(vpt), "<INVALID>"));
+		return -2;
+	}
+
+	return 0;
+}
+
 /** Copy pairs matching a #tmpl_t in the current #request_t
  *
  * @param ctx to allocate new #fr_pair_t in.
@@ -1209,6 +1264,30 @@ int tmpl_copy_pairs(TALLOC_CTX *ctx, fr_pair_list_t *out, request_t *request, tm
 
 	fr_assert(tmpl_is_attr(vpt) || tmpl_is_list(vpt));
 
+	/*
+	 *	Copying an entire list is common, e.g. when
+	 *	populating subrequests, and doesn't need a
+	 *	cursor to select pairs.
+	 */
+	if (tmpl_is_list(vpt) && (fr_dlist_num_elements(&vpt->data.attribute.ar) == 0)) {
+		fr_pair_list_t	*list_head;
+
+		err = tmpl_list_head_resolve(&list_head, request, vpt);
+		if (err < 0) return err;
+
+		if (fr_pair_list_empty(list_head)) {
+			fr_strerror_printf("List \"%s\" is empty", vpt->name);
+			return -1;
+		}
+
+		if (fr_pair_list_copy(ctx, out, list_head) < 0) {
+			fr_strerror_const("Out of memory");
+			return -4;
+		}
+
+		return 0;
+	}
+
 	for (vp = tmpl_pair_cursor_init(&err, NULL, &cc, &from, request, vpt);
 	     vp;
 	     vp = fr_dcursor_next(&from)) {
@@ -1301,6 +1380,35 @@ int tmpl_find_vp(fr_pair_t **out, request_t *request, tmpl_t const *vpt)
 
 	TMPL_VERIFY(vpt);
 
+	/*
+	 *	Fast path for the common case of a single known
+	 *	attribute in one of the request lists.  This avoids
+	 *	setting up a cursor, and lets the list index do
+	 *	the work of finding the pair.
+	 */
+	if (tmpl_is_attr(vpt) && (fr_dlist_num_elements(&vpt->data.attribute.ar) == 1)) {
+		tmpl_attr_t const	*ar = fr_dlist_head(&vpt->data.attribute.ar);
+		fr_pair_list_t		*list_head;
+
+		if (!ar->ar_da->flags.is_unknown && !ar->ar_da->flags.is_raw &&
+		    ((ar->ar_num == NUM_ANY) || (ar->ar_num >= 0))) {
+			err = tmpl_list_head_resolve(&list_head, request, vpt);
+			if (err < 0) {
+				if (out) *out = NULL;
+				return err;
+			}
+
+			vp = fr_pair_find_by_da(list_head, ar->ar_da, (ar->ar_num == NUM_ANY) ? 0 : ar->ar_num);
+			if (out) *out = vp;
+			if (!vp) {
+				fr_strerror_printf("No matching \"%s\" pairs found", ar->ar_da->name);
+				return -1;
+			}
+
+			return 0;
+		}
+	}
+
 	vp = tmpl_pair_cursor_init(&err, request, &cc, &cursor, request, vpt);
 	tmpl_pair_cursor_clear(&cc);
 
@@ -51,6 +51,8 @@ typedef struct {
 	fr_rb_node_t	node;		//!< Entry in the trigger last fired tree.
 	CONF_ITEM	*ci;		//!< Config item this rate limit counter is associated with.
 	time_t		last_fired;	//!< When this trigger last fired.
+	uint32_t	suppressed;	//!< How many times the trigger was rate limited
+					///< since it last fired.
 } trigger_last_fired_t;
 
 /** Retrieve attributes from a special trigger list
@@ -272,6 +274,7 @@ int trigger_exec(unlang_interpret_t *intp, request_t *request,
 	request_t		*child;
 	fr_trigger_t		*trigger;
 	ssize_t			slen;
+	uint32_t		suppressed = 0;
 
 	/*
 	 *	noop if trigger_exec_init was never called
@@ -337,6 +340,10 @@ int trigger_exec(unlang_interpret_t *intp, request_t *request,
 
 	/*
 	 *	Perform periodic rate_limiting.
+	 *
+	 *	When a home server or database goes away, every
+	 *	connection attempt can fire the same trigger.  Forking
+	 *	a program for each one just makes the outage worse.
 	 */
 	if (rate_limit) {
 		trigger_last_fired_t	find, *found;
@@ -351,17 +358,27 @@ int trigger_exec(unlang_interpret_t *intp, request_t *request,
 			MEM(found = talloc(NULL, trigger_last_fired_t));
 			found->ci = ci;
 			found->last_fired = 0;
+			found->suppressed = 0;
 
 			fr_rb_insert(trigger_last_fired_tree, found);
 		}
 
-		pthread_mutex_unlock(trigger_mutex);
-
 		/*
-		 *	Send the rate_limited traps at most once per second.
+		 *	Send the rate_limited traps at most once per
+		 *	second.  The ones we drop are counted, and the
+		 *	count is passed to the next one which does run,
+		 *	as Trigger-Suppressed.
 		 */
-		if (found->last_fired == now) return -1;
+		if (found->last_fired == now) {
+			found->suppressed++;
+			pthread_mutex_unlock(trigger_mutex);
+			return -1;
+		}
 		found->last_fired = now;
+		suppressed = found->suppressed;
+		found->suppressed = 0;
+
+		pthread_mutex_unlock(trigger_mutex);
 	}
 
 	/*
@@ -403,6 +420,20 @@ int trigger_exec(unlang_interpret_t *intp, request_t *request,
 		(void) fr_pair_list_copy(child->request_ctx, &child->request_pairs, &request->request_pairs);
 	}
 
+	if (suppressed) {
+		fr_dict_attr_t const	*da;
+		fr_pair_t		*vp;
+
+		da = fr_dict_attr_child_by_num(fr_dict_root(fr_dict_internal()), FR_TRIGGER_SUPPRESSED);
+		if (da) {
+			MEM(vp = fr_pair_afrom_da(child->request_ctx, da));
+			vp->vp_uint32 = suppressed;
+			fr_pair_append(&child->request_pairs, vp);
+		}
+
+		ROPTIONAL(RDEBUG2, DEBUG2, "Trigger %s was rate limited %u times since it last ran", attr, suppressed);
+	}
+
 	slen = xlat_tokenize_argv(trigger, &trigger->xlat, NULL,
 				  &FR_SBUFF_IN(trigger->name, talloc_array_length(trigger->name) - 1), NULL, NULL);
 	if (slen <= 0) {
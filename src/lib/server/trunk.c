@@ -41,6 +41,7 @@ typedef struct fr_trunk_s fr_trunk_t;
 #include <freeradius-devel/server/trigger.h>
 #include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/probe.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/table.h>
 
@@ -63,6 +64,11 @@ static fr_time_t test_time(void)
 #define fr_time test_time
 #endif
 
+/** The maximum number of requests written per call to fr_trunk_connection_requests_writev
+ *
+ */
+#define FR_TRUNK_WRITEV_MAX		64
+
 #ifndef NDEBUG
 /** The maximum number of state logs to record per request
  *
@@ -148,6 +154,9 @@ struct fr_trunk_connection_s {
 
 	fr_trunk_request_t	*partial;		//!< Partially written request.
 
+	size_t			partial_written;	//!< How much of the partial request has been
+							///< written by #fr_trunk_connection_requests_writev.
+
 	fr_dlist_head_t		sent;			//!< Sent request.
 
 	fr_dlist_head_t		cancel;			//!< Requests in the cancel state.
@@ -162,6 +171,8 @@ struct fr_trunk_connection_s {
  	 */
  	uint64_t		sent_count;		//!< The number of requests that have been sent using
  							///< this connection.
+
+	fr_time_t		connecting_start;	//!< When the connection entered the connecting state.
  	/** @} */
 
 	/** @name Timers
@@ -269,6 +280,18 @@ struct fr_trunk_s {
 
 	uint64_t		last_req_per_conn;	//!< The last request to connection ratio we calculated.
 	/** @} */
+
+	/** @name Predictive scaling
+	 * @{
+ 	 */
+	fr_time_t		last_predicted;		//!< When we last sampled the request count.
+
+	uint32_t		last_predicted_req_count;	//!< Outstanding requests at the last sample.
+
+	int64_t			req_growth;		//!< Smoothed change in outstanding requests per second.
+
+	fr_time_delta_t		open_time;		//!< Smoothed time connections take to open.
+	/** @} */
 };
 
 static CONF_PARSER const fr_trunk_config_request[] = {
@@ -296,6 +319,7 @@ CONF_PARSER const fr_trunk_config[] = {
 
 	{ FR_CONF_OFFSET("open_delay", FR_TYPE_TIME_DELTA, fr_trunk_conf_t, open_delay), .dflt = "0.2" },
 	{ FR_CONF_OFFSET("close_delay", FR_TYPE_TIME_DELTA, fr_trunk_conf_t, close_delay), .dflt = "10.0" },
+	{ FR_CONF_OFFSET("predictive", FR_TYPE_BOOL, fr_trunk_conf_t, predictive), .dflt = "no" },
 
 	{ FR_CONF_OFFSET("manage_interval", FR_TYPE_TIME_DELTA, fr_trunk_conf_t, manage_interval), .dflt = "0.2" },
 
@@ -1332,6 +1356,7 @@ static void trunk_request_enter_complete(fr_trunk_request_t *treq)
 	}
 
 	REQUEST_STATE_TRANSITION(FR_TRUNK_REQUEST_STATE_COMPLETE);
+	FR_PROBE2(trunk_complete, treq, treq->pub.request ? treq->pub.request->number : 0);
 	DO_REQUEST_COMPLETE(treq);
 	fr_trunk_request_free(&treq);	/* Free the request */
 }
@@ -2375,6 +2400,8 @@ fr_trunk_enqueue_t fr_trunk_request_enqueue(fr_trunk_request_t **treq_out, fr_tr
 		break;
 
 	default:
+		FR_PROBE3(trunk_enqueue, NULL, request ? request->number : 0, ret);
+
 		/*
 		 *	If a trunk request was provided
 		 *	populate the preq and rctx fields
@@ -2390,6 +2417,8 @@ fr_trunk_enqueue_t fr_trunk_request_enqueue(fr_trunk_request_t **treq_out, fr_tr
 		return ret;
 	}
 
+	FR_PROBE3(trunk_enqueue, treq, request ? request->number : 0, ret);
+
 	return ret;
 }
 
@@ -3105,6 +3134,7 @@ static void _trunk_connection_on_connecting(UNUSED fr_connection_t *conn,
 	fr_assert(fr_trunk_request_count_by_connection(tconn, FR_TRUNK_REQUEST_STATE_ALL) == 0);
 
 	fr_dlist_insert_head(&trunk->connecting, tconn);	/* MUST remain a head insertion for reconnect logic */
+	tconn->connecting_start = fr_time();
 	CONN_STATE_TRANSITION(FR_TRUNK_CONN_CONNECTING, INFO);
 }
 
@@ -3197,6 +3227,21 @@ static void _trunk_connection_on_connected(UNUSED fr_connection_t *conn,
 	 */
 	trunk->pub.last_connected = fr_time();
 
+	/*
+	 *	Record how long connections take to open,
+	 *	so predictive scaling knows how far ahead
+	 *	it needs to look.
+	 */
+	if (tconn->connecting_start > 0) {
+		fr_time_delta_t open_time = trunk->pub.last_connected - tconn->connecting_start;
+
+		if (trunk->open_time == 0) {
+			trunk->open_time = open_time;
+		} else {
+			trunk->open_time += (open_time - trunk->open_time) / 4;
+		}
+	}
+
 	/*
 	 *	Insert a timer to reconnect the
 	 *	connection periodically.
@@ -3611,6 +3656,145 @@ int fr_trunk_connection_pop_request(fr_trunk_request_t **treq_out, fr_trunk_conn
 	return 0;
 }
 
+/** Write multiple pending requests to a stream connection with a single writev() call
+ *
+ * A helper for request_mux callbacks which work at the socket level.  Up to
+ * max requests are dequeued (starting with any partially written request),
+ * the iov_func is used to get the serialised form of each request, and all
+ * of them are written with one writev() call.
+ *
+ * Requests which were written completely are signalled as sent.  If the
+ * write was short, the request which was partially written is signalled as
+ * partial, and the trunk tracks how much of it was written, so the next call
+ * continues from the correct offset.  Requests which weren't written at all
+ * remain pending.
+ *
+ * If the write fails for any reason other than the socket buffer being full,
+ * the connection is signalled to reconnect.
+ *
+ * @note Only suitable for stream connections.  For datagram connections each
+ *	request must be written separately, sendmmsg() should be used instead.
+ *
+ * @param[in] tconn	to write requests to.
+ * @param[in] fd	to write requests to.
+ * @param[in] iov_func	to retrieve the serialised form of each request.
+ * @param[in] uctx	to pass to iov_func.
+ * @param[in] max	Maximum number of requests to write.  0 for the default.
+ * @return
+ *	- >= 0 the number of requests completely written.
+ *	- -1 if the connection was signalled to reconnect, or was previously freed.
+ *	  Caller *MUST NOT* touch any memory or requests associated with the connection.
+ *	- -2 if called outside of the muxer.
+ */
+int fr_trunk_connection_requests_writev(fr_trunk_connection_t *tconn, int fd,
+					fr_trunk_request_iov_t iov_func, void *uctx, unsigned int max)
+{
+	fr_trunk_t		*trunk = tconn->pub.trunk;
+	fr_trunk_request_t	*batch[FR_TRUNK_WRITEV_MAX];
+	struct iovec		iov[FR_TRUNK_WRITEV_MAX];
+	fr_trunk_request_t	*treq;
+	unsigned int		num = 0, popped, i;
+	bool			partial = false;
+	ssize_t			slen;
+	size_t			written;
+
+	if (unlikely(tconn->pub.state == FR_TRUNK_CONN_HALTED)) return -1;
+
+	if (!fr_cond_assert_msg(IN_REQUEST_MUX(trunk),
+				"%s can only be called from within request_mux handler",
+				__FUNCTION__)) return -2;
+
+	if ((max == 0) || (max > FR_TRUNK_WRITEV_MAX)) max = FR_TRUNK_WRITEV_MAX;
+
+	/*
+	 *	The remainder of a partially written
+	 *	request must go out first.
+	 */
+	if (tconn->partial) {
+		treq = tconn->partial;
+
+		if ((iov_func(&iov[0], tconn, treq, uctx) < 0) ||
+		    !fr_cond_assert(iov[0].iov_len > tconn->partial_written)) {
+			/*
+			 *	Part of the request is already in the
+			 *	stream, so we can't just skip it.
+			 */
+			ERROR("[%" PRIu64 "] Failed serialising partially written request", tconn->pub.conn->id);
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return -1;
+		}
+		iov[0].iov_base = ((uint8_t *)iov[0].iov_base) + tconn->partial_written;
+		iov[0].iov_len -= tconn->partial_written;
+		batch[num++] = treq;
+		partial = true;
+	}
+
+	/*
+	 *	Requests are popped so we can get at the
+	 *	ones behind them in priority order.  They're
+	 *	all reinserted before any state changes are
+	 *	signalled.
+	 */
+	popped = num;
+	while ((popped < max) && (treq = fr_heap_pop(tconn->pending))) {
+		batch[popped++] = treq;
+	}
+
+	for (i = num; i < popped; i++) {
+		treq = batch[i];
+
+		fr_heap_insert(tconn->pending, treq);
+		if (iov_func(&iov[num], tconn, treq, uctx) < 0) {
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+		batch[num++] = treq;
+	}
+
+	if (num == 0) return 0;
+
+	slen = writev(fd, iov, num);
+	if (slen < 0) {
+		switch (errno) {
+#if defined(EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
+		case EWOULDBLOCK:
+#endif
+		case EAGAIN:
+		case EINTR:
+			return 0;
+
+		default:
+			ERROR("[%" PRIu64 "] Failed writing requests: %s", tconn->pub.conn->id, fr_syserror(errno));
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return -1;
+		}
+	}
+
+	written = (size_t)slen;
+	for (i = 0; i < num; i++) {
+		treq = batch[i];
+
+		if (written < iov[i].iov_len) break;
+		written -= iov[i].iov_len;
+
+		fr_trunk_request_signal_sent(treq);
+	}
+
+	/*
+	 *	Short write, remember how far we got.
+	 */
+	if ((i < num) && (written > 0)) {
+		if ((i == 0) && partial) {
+			tconn->partial_written += written;
+		} else {
+			fr_trunk_request_signal_partial(batch[i]);
+			tconn->partial_written = written;
+		}
+	}
+
+	return (int)i;
+}
+
 /** Signal that a trunk connection is writable
  *
  * Should be called from the 'write' I/O handler to signal that requests can be enqueued.
@@ -3803,6 +3987,111 @@ static void trunk_rebalance(fr_trunk_t *trunk)
 	       					 FR_TRUNK_REQUEST_STATE_PENDING, 1, false));
 }
 
+/** Estimate how many connections we'll need once any we open now have connected
+ *
+ * Samples the number of outstanding requests once per management interval,
+ * and keeps a smoothed rate of change.  The rate is projected forward by the
+ * time connections take to open, plus the management interval, to give the
+ * number of requests we should be able to service by the time a connection
+ * opened now becomes usable.
+ *
+ * @param[in] trunk	to estimate connections for.
+ * @param[in] now	The current time.
+ * @param[in] req_count	Requests currently outstanding.
+ * @return The number of connections needed to keep the projected requests
+ *	per connection at or below the target.
+ */
+static uint32_t trunk_connections_predicted(fr_trunk_t *trunk, fr_time_t now, uint32_t req_count)
+{
+	fr_time_delta_t	elapsed = now - trunk->last_predicted;
+	fr_time_delta_t	horizon;
+	int64_t		projected;
+
+	if (trunk->last_predicted == 0) {
+		trunk->last_predicted = now;
+		trunk->last_predicted_req_count = req_count;
+	} else if (elapsed >= trunk->conf.manage_interval) {
+		int64_t growth = (((int64_t)req_count - (int64_t)trunk->last_predicted_req_count) * NSEC) / elapsed;
+
+		trunk->req_growth += (growth - trunk->req_growth) / 2;
+		trunk->last_predicted = now;
+		trunk->last_predicted_req_count = req_count;
+	}
+
+	if (!trunk->conf.target_req_per_conn) return 0;
+
+	/*
+	 *	Until a connection has opened, assume the
+	 *	worst case.
+	 */
+	if (trunk->open_time) {
+		horizon = trunk->open_time;
+	} else {
+		horizon = trunk->conf.conn_conf ? trunk->conf.conn_conf->connection_timeout : 0;
+	}
+	horizon += trunk->conf.manage_interval;
+
+	projected = req_count;
+	if (trunk->req_growth > 0) projected += (trunk->req_growth * horizon) / NSEC;
+
+	return ROUND_UP_DIV((uint64_t)projected, trunk->conf.target_req_per_conn);
+}
+
+/** Open connections ahead of predicted demand
+ *
+ * Unlike the reactive algorithm in #trunk_manage, this isn't damped by
+ * open_delay, and may open multiple connections at once, up to the
+ * limit on connections in the connecting state.
+ *
+ * @param[in] trunk	to manage.
+ * @param[in] now	The current time.
+ * @return
+ *	- true if connections were opened or reactivated.
+ *	- false if no additional connections are predicted to be needed.
+ */
+static bool trunk_manage_predictive(fr_trunk_t *trunk, fr_time_t now)
+{
+	fr_trunk_connection_t	*tconn;
+	uint32_t		req_count, needed;
+	uint16_t		conn_count, connecting;
+	bool			opened = false;
+
+	trunk_requests_per_connection(&conn_count, &req_count, trunk, now, false);
+
+	needed = trunk_connections_predicted(trunk, now, req_count);
+	if ((trunk->conf.max > 0) && (needed > trunk->conf.max)) needed = trunk->conf.max;
+	if (needed <= conn_count) return false;
+
+	/*
+	 *	Reactivating draining connections is
+	 *	cheaper than opening new ones.
+	 */
+	while ((conn_count < needed) && (tconn = fr_dlist_head(&trunk->draining))) {
+		if (trunk_connection_is_full(tconn)) {
+			trunk_connection_enter_full(tconn);
+		} else {
+			trunk_connection_enter_active(tconn);
+		}
+		conn_count++;
+		opened = true;
+	}
+
+	connecting = fr_trunk_connection_count_by_state(trunk, FR_TRUNK_CONN_CONNECTING);
+	while (conn_count < needed) {
+		if ((trunk->conf.connecting > 0) && (connecting >= trunk->conf.connecting)) break;
+
+		DEBUG3("Opening connection - Predicted to need %u connections (have %u, growth %" PRId64 " req/s)",
+		       needed, conn_count, trunk->req_growth);
+
+		if (trunk_connection_spawn(trunk, now) < 0) break;
+		conn_count++;
+		connecting++;
+		opened = true;
+	}
+
+	return opened;
+}
+
 /** Implements the algorithm we use to manage requests per connection levels
  *
  * This is executed periodically using a timer event, and opens/closes
@@ -3887,6 +4176,8 @@ static void trunk_manage(fr_trunk_t *trunk, fr_time_t now)
 	 */
 	if (!trunk->managing_connections) return;
 
+	if (trunk->conf.predictive && trunk_manage_predictive(trunk, now)) return;
+
 	/*
 	 *	We're above the target requests per connection
 	 *	spawn more connections!
@@ -4021,6 +4312,12 @@ static void trunk_manage(fr_trunk_t *trunk, fr_time_t now)
 			return;
 		}
 
+		if (trunk->conf.predictive && ((conn_count - 1) < trunk_connections_predicted(trunk, now, req_count))) {
+			DEBUG3("Not closing connection - Predicted to need %u connections",
+			       trunk_connections_predicted(trunk, now, req_count));
+			return;
+		}
+
 		if (!req_count) {
 			DEBUG3("Closing connection - No outstanding requests");
 			goto close;
@@ -30,6 +30,8 @@ RCSIDH(server_trunk_h, "$Id$")
 #include <freeradius-devel/server/request.h>
 #include <freeradius-devel/server/cf_parse.h>
 
+#include <sys/uio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -246,6 +248,10 @@ typedef struct {
 	bool			backlog_on_failed_conn;	//!< Assign requests to the backlog when there are no
 							//!< available connections and the last connection event
 							//!< was a failure, instead of failing them immediately.
+
+	bool			predictive;		//!< Open connections ahead of demand, based on how
+							///< quickly the number of outstanding requests is
+							///< growing, and how long connections take to open.
 } fr_trunk_conf_t;
 
 /** Public fields for the trunk
@@ -437,6 +443,10 @@ typedef void (*fr_trunk_connection_notify_t)(fr_trunk_connection_t *tconn, fr_co
  * After calling #fr_trunk_request_signal_partial this callback *MUST NOT*
  * call #fr_trunk_connection_pop_request again, and should immediately return.
  *
+ * Callbacks writing to stream sockets can instead call
+ * #fr_trunk_connection_requests_writev, which dequeues multiple requests, writes
+ * them with a single writev() call, and handles partial writes.
+ *
  * If the request can't be written to the connection because it the connection
  * has become unusable, this callback should call
  * `fr_connection_signal_reconnect(conn)` to notify the connection API that the
@@ -463,6 +473,29 @@ typedef void (*fr_trunk_connection_notify_t)(fr_trunk_connection_t *tconn, fr_co
 typedef void (*fr_trunk_request_mux_t)(fr_event_list_t *el,
 				       fr_trunk_connection_t *tconn, fr_connection_t *conn, void *uctx);
 
+/** Provide the serialised form of a request, so it can be written by #fr_trunk_connection_requests_writev
+ *
+ * This callback may be called multiple times for the same request if the
+ * request couldn't be written (or was only partially written) on a previous
+ * call to #fr_trunk_connection_requests_writev.  The protocol request (preq)
+ * should retain the serialised data, and the callback *MUST* return the same
+ * data for a request which has been partially written.
+ *
+ * This callback *MUST NOT* signal a state change for the treq.  If the request
+ * can't be serialised, it should return -1 and the request will be failed.
+ *
+ * @param[out] out		Where to write a pointer to, and the length of,
+ *				the serialised request.
+ * @param[in] tconn		The request is being written to.
+ * @param[in] treq		to serialise.
+ * @param[in] uctx		User context data passed to #fr_trunk_connection_requests_writev.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the request can't be serialised.
+ */
+typedef int (*fr_trunk_request_iov_t)(struct iovec *out, fr_trunk_connection_t *tconn,
+				      fr_trunk_request_t *treq, void *uctx);
+
 /** Demultiplex on or more responses, reading them from a connection, decoding them, and matching them with their requests
  *
  * This callback should either:
@@ -763,6 +796,9 @@ void		fr_trunk_request_state_log(fr_log_t const *log, fr_log_type_t log_type, ch
 int fr_trunk_connection_pop_cancellation(fr_trunk_request_t **treq_out, fr_trunk_connection_t *tconn);
 
 int fr_trunk_connection_pop_request(fr_trunk_request_t **treq_out, fr_trunk_connection_t *tconn);
+
+int fr_trunk_connection_requests_writev(fr_trunk_connection_t *tconn, int fd,
+					fr_trunk_request_iov_t iov_func, void *uctx, unsigned int max);
 /** @} */
 
 /** @name Connection state signalling
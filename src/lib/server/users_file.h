@@ -42,6 +42,9 @@ typedef struct pair_list {
 	int			order;		//!< Sequence of entry in source file
 	char const		*filename;	//!< Filename entry read from
 	int			lineno;		//!< Line number entry read from
+	unsigned int		required;	//!< 1 + index of an attribute in the list's "required"
+						//!< array which the request must have for this
+						//!< entry to match.  0 if there isn't one.
 	fr_dlist_t		entry;		//!< Entry in dlist of PAIR_LIST with matching name
 } PAIR_LIST;
 
@@ -49,6 +52,7 @@ typedef struct pair_list_list {
 	fr_dlist_head_t 	head;		//!< Head of the list of PAIR_LISTs.
 	char const		*name;		//!< name of the key used for matching entry.
 	fr_value_box_t		*box;		//!< parsed version of "name".
+	fr_dict_attr_t const	**required;	//!< Request attributes which entries test for.
 } PAIR_LIST_LIST;
 
 /* users_file.c */
@@ -42,6 +42,7 @@ RCSID("$Id$")
 #include <freeradius-devel/io/listen.h>
 
 #include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/startup.h>
 
 typedef struct {
 	dl_module_inst_t	*proto_module;		//!< The proto_* module for a listen section.
@@ -776,6 +777,7 @@ int virtual_servers_instantiate(void)
 		CONF_SECTION		*server_cs = virtual_servers[i]->server_cs;
 		CONF_DATA const		*cd;
 		virtual_server_dict_t	*dict = NULL;
+		int			phase;
 
 		cd = cf_data_find(server_cs, virtual_server_dict_t, "dictionary");
 		if (cd) {	/* only NULl for the control socket */
@@ -812,10 +814,19 @@ int virtual_servers_instantiate(void)
 			return -1; /* should never happen */
 		}
 
-		if (process_instantiate(server_cs, virtual_servers[i]->process_module, dict->dict) < 0) return -1;
-
-		if (virtual_servers[i]->dynamic_client_module &&
-		    (process_instantiate(server_cs, virtual_servers[i]->dynamic_client_module, dict->dict) < 0)) return -1;
+		/*
+		 *	This is where the policies are compiled,
+		 *	so it's the interesting part for the
+		 *	startup profile.
+		 */
+		phase = fr_startup_phase_start("virtual server compile", cf_section_name2(server_cs));
+		if ((process_instantiate(server_cs, virtual_servers[i]->process_module, dict->dict) < 0) ||
+		    (virtual_servers[i]->dynamic_client_module &&
+		     (process_instantiate(server_cs, virtual_servers[i]->dynamic_client_module, dict->dict) < 0))) {
+			fr_startup_phase_end(phase);
+			return -1;
+		}
+		fr_startup_phase_end(phase);
 
 		/*
 		 *	Print out warnings for unused "recv" and
@@ -1018,10 +1029,12 @@ int virtual_servers_open(fr_schedule_t *sc)
 	for (i = 0; i < server_cnt; i++) {
 		fr_virtual_listen_t	**listener;
 		size_t			j, listen_cnt;
+		int			phase;
 
  		listener = virtual_servers[i]->listener;
  		listen_cnt = talloc_array_length(listener);
 
+		phase = fr_startup_phase_start("virtual server open", cf_section_name2(virtual_servers[i]->server_cs));
 		for (j = 0; j < listen_cnt; j++) {
 			fr_virtual_listen_t *listen = listener[j];
 
@@ -1044,6 +1057,7 @@ int virtual_servers_open(fr_schedule_t *sc)
 			    listen->app->open(listen->proto_module->data, sc, listen->proto_module->conf) < 0) {
 				cf_log_err(listen->proto_module->conf, "Opening %s I/O interface failed",
 					   listen->app->name);
+				fr_startup_phase_end(phase);
 				return -1;
 			}
 
@@ -1053,6 +1067,7 @@ int virtual_servers_open(fr_schedule_t *sc)
 			 */
 			DEBUG3("Opened listener for %s", listen->app->name);
 		}
+		fr_startup_phase_end(phase);
 	}
 
 	return 0;
@@ -9,6 +9,7 @@ SOURCES	:= \
 	bio.c \
 	cache.c \
 	conf.c \
+	crl.c \
 	ctx.c \
 	engine.c \
 	log.c \
@@ -37,6 +37,8 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/unlang/function.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 
 #include "attrs.h"
 #include "base.h"
@@ -44,6 +46,226 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include "log.h"
 #include "verify.h"
 
+#include <pthread.h>
+
+#define TLS_CACHE_LOCAL_SHARDS	16		//!< Number of independently locked parts of the local cache.
+
+/** An entry in the local session cache
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the shard's insertion ordered list.
+	uint8_t const		*id;			//!< Session ID.
+	size_t			id_len;			//!< Length of the Session ID.
+	uint8_t			*data;			//!< Serialised session, as would be passed to
+							///< `store session { ... }`.
+	fr_time_t		expires;		//!< When the session can no longer be resumed.
+} tls_cache_local_entry_t;
+
+/** One part of the local session cache
+ *
+ * The cache is split so that workers storing and loading different
+ * sessions rarely contend on the same mutex.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Protects the fields below.
+	fr_hash_table_t		*ht;			//!< Entries, keyed by Session ID.
+	fr_dlist_head_t		order;			//!< Entries, oldest first.
+} tls_cache_local_shard_t;
+
+/** In-memory session cache, shared by all workers
+ *
+ * Sits in front of the `load session { ... }` section, so that a
+ * session stored on this server can be resumed without a round trip
+ * through the TLS virtual server.  Stores and clears are still written
+ * through to the virtual server, so other servers sharing the same
+ * datastore keep working.
+ */
+struct fr_tls_cache_local_s {
+	uint32_t		max_entries;		//!< Maximum number of entries per shard.
+	tls_cache_local_shard_t	shard[TLS_CACHE_LOCAL_SHARDS];
+};
+
+static uint32_t tls_cache_local_hash(void const *data)
+{
+	tls_cache_local_entry_t const *a = data;
+
+	return fr_hash(a->id, a->id_len);
+}
+
+static int8_t tls_cache_local_cmp(void const *one, void const *two)
+{
+	tls_cache_local_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->id_len, b->id_len);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->id, b->id, a->id_len);
+	return CMP(ret, 0);
+}
+
+static int _tls_cache_local_free(fr_tls_cache_local_t *local)
+{
+	size_t i;
+
+	for (i = 0; i < TLS_CACHE_LOCAL_SHARDS; i++) pthread_mutex_destroy(&local->shard[i].mutex);
+
+	return 0;
+}
+
+/** Allocate a local session cache
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] max_entries	Maximum number of sessions to hold.
+ * @return
+ *	- A new local cache on success.
+ *	- NULL on failure.
+ */
+fr_tls_cache_local_t *fr_tls_cache_local_alloc(TALLOC_CTX *ctx, uint32_t max_entries)
+{
+	fr_tls_cache_local_t	*local;
+	size_t			i;
+
+	local = talloc_zero(ctx, fr_tls_cache_local_t);
+	if (!local) return NULL;
+
+	local->max_entries = (max_entries + TLS_CACHE_LOCAL_SHARDS - 1) / TLS_CACHE_LOCAL_SHARDS;
+
+	for (i = 0; i < TLS_CACHE_LOCAL_SHARDS; i++) {
+		tls_cache_local_shard_t *shard = &local->shard[i];
+
+		shard->ht = fr_hash_table_alloc(local, tls_cache_local_hash, tls_cache_local_cmp, NULL);
+		if (!shard->ht) {
+			talloc_free(local);
+			return NULL;
+		}
+		fr_dlist_talloc_init(&shard->order, tls_cache_local_entry_t, entry);
+		pthread_mutex_init(&shard->mutex, NULL);
+	}
+	talloc_set_destructor(local, _tls_cache_local_free);
+
+	return local;
+}
+
+static inline CC_HINT(always_inline)
+tls_cache_local_shard_t *tls_cache_local_shard(fr_tls_cache_local_t *local, uint8_t const *id, size_t id_len)
+{
+	return &local->shard[fr_hash(id, id_len) % TLS_CACHE_LOCAL_SHARDS];
+}
+
+/** Remove an entry from a shard
+ *
+ * @note Must be called with the shard mutex held.
+ */
+static void tls_cache_local_entry_free(tls_cache_local_shard_t *shard, tls_cache_local_entry_t *entry)
+{
+	fr_hash_table_remove(shard->ht, entry);
+	fr_dlist_remove(&shard->order, entry);
+	talloc_free(entry);
+}
+
+/** Add serialised session data to the local cache
+ *
+ * @param[in] local	cache to add the session to.
+ * @param[in] id	Session ID.
+ * @param[in] data	Serialised session data.
+ * @param[in] len	Length of the serialised session data.
+ * @param[in] expires	When the session can no longer be resumed.
+ */
+static void tls_cache_local_store(fr_tls_cache_local_t *local, uint8_t const *id, size_t id_len,
+				  uint8_t const *data, size_t len, fr_time_t expires)
+{
+	tls_cache_local_shard_t	*shard = tls_cache_local_shard(local, id, id_len);
+	tls_cache_local_entry_t	*entry, *old;
+	fr_time_t		now = fr_time();
+	uint8_t			*id_copy;
+
+	pthread_mutex_lock(&shard->mutex);
+
+	entry = talloc_zero(shard->ht, tls_cache_local_entry_t);
+	if (!entry) {
+	error:
+		talloc_free(entry);
+		pthread_mutex_unlock(&shard->mutex);
+		return;
+	}
+
+	id_copy = talloc_memdup(entry, id, id_len);
+	entry->data = talloc_memdup(entry, data, len);
+	if (!id_copy || !entry->data) goto error;
+
+	entry->id = id_copy;
+	entry->id_len = id_len;
+	entry->expires = expires;
+
+	old = fr_hash_table_find(shard->ht, entry);
+	if (old) tls_cache_local_entry_free(shard, old);
+
+	/*
+	 *	All sessions have the same lifetime, so the oldest
+	 *	entries expire first.  Make room by discarding them.
+	 */
+	while ((old = fr_dlist_head(&shard->order)) &&
+	       ((old->expires <= now) || (fr_dlist_num_elements(&shard->order) >= local->max_entries))) {
+		tls_cache_local_entry_free(shard, old);
+	}
+
+	if (!fr_hash_table_insert(shard->ht, entry)) goto error;
+	fr_dlist_insert_tail(&shard->order, entry);
+
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+/** Retrieve a copy of serialised session data from the local cache
+ *
+ * @param[in] ctx	to allocate the copy in.
+ * @param[in] local	cache to search.
+ * @param[in] id	Session ID.
+ * @param[in] id_len	Length of the Session ID.
+ * @return
+ *	- A copy of the serialised session data.
+ *	- NULL if the session isn't in the cache, or has expired.
+ */
+static uint8_t *tls_cache_local_load(TALLOC_CTX *ctx, fr_tls_cache_local_t *local, uint8_t const *id, size_t id_len)
+{
+	tls_cache_local_shard_t	*shard = tls_cache_local_shard(local, id, id_len);
+	tls_cache_local_entry_t	*entry, find = { .id = id, .id_len = id_len };
+	uint8_t			*data = NULL;
+
+	pthread_mutex_lock(&shard->mutex);
+
+	entry = fr_hash_table_find(shard->ht, &find);
+	if (entry) {
+		if (entry->expires <= fr_time()) {
+			tls_cache_local_entry_free(shard, entry);
+		} else {
+			data = talloc_memdup(ctx, entry->data, talloc_array_length(entry->data));
+		}
+	}
+
+	pthread_mutex_unlock(&shard->mutex);
+
+	return data;
+}
+
+/** Remove a session from the local cache
+ *
+ * @param[in] local	cache to remove the session from.
+ * @param[in] id	Session ID.
+ * @param[in] id_len	Length of the Session ID.
+ */
+static void tls_cache_local_clear(fr_tls_cache_local_t *local, uint8_t const *id, size_t id_len)
+{
+	tls_cache_local_shard_t	*shard = tls_cache_local_shard(local, id, id_len);
+	tls_cache_local_entry_t	*entry, find = { .id = id, .id_len = id_len };
+
+	pthread_mutex_lock(&shard->mutex);
+	entry = fr_hash_table_find(shard->ht, &find);
+	if (entry) tls_cache_local_entry_free(shard, entry);
+	pthread_mutex_unlock(&shard->mutex);
+}
+
 /** Retrieve session ID (in binary form) from the session
  *
  * @param[in] ctx	Where to allocate the array to hold the session id.
@@ -254,40 +476,31 @@ static void tls_cache_delete_request(SSL_SESSION *sess)
 	ASYNC_pause_job();	/* Jumps back to SSL_read() in session.c */
 }
 
-/** Process the result of `session load { ... }`
+/** Deserialise session data, and make it available to tls_cache_load_cb
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	The current TLS session.
+ * @param[in] data		Serialised session data.
+ * @param[in] data_len		Length of the serialised session data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
  */
-static unlang_action_t tls_cache_load_result(UNUSED rlm_rcode_t *p_result, UNUSED int *priority,
-					     request_t *request, void *uctx)
+static int tls_cache_load_data(request_t *request, fr_tls_session_t *tls_session, uint8_t const *data, size_t data_len)
 {
-	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
 	fr_tls_cache_t		*tls_cache = tls_session->cache;
-	fr_pair_t		*vp;
 	uint8_t const		*q, **p;
 	SSL_SESSION		*sess;
 
-	vp = fr_pair_find_by_da(&request->reply_pairs, attr_tls_packet_type, 0);
-	if (!vp || (vp->vp_uint32 != enum_tls_packet_type_success->vb_uint32)) {
-		RWDEBUG("Failed acquiring session data");
-	error:
-		tls_cache->load.state = FR_TLS_CACHE_LOAD_FAILED;
-		return UNLANG_ACTION_CALCULATE_RESULT;
-	}
-
-	vp = fr_pair_find_by_da(&request->reply_pairs, attr_tls_session_data, 0);
-	if (!vp) {
-		RWDEBUG("No cached session found");
-		goto error;
-	}
-
-	q = vp->vp_octets;	/* openssl will mutate q, so we can't use vp_octets directly */
+	q = data;	/* openssl will mutate q, so we can't use data directly */
 	p = (unsigned char const **)&q;
 
-	sess = d2i_SSL_SESSION(NULL, p, vp->vp_length);
+	sess = d2i_SSL_SESSION(NULL, p, data_len);
 	if (!sess) {
 		fr_tls_log_error(request, "Failed loading persisted session");
-		goto error;
+		return -1;
 	}
-	RDEBUG3("Read %zu bytes of session data.  Session deserialized successfully", vp->vp_length);
+	RDEBUG3("Read %zu bytes of session data.  Session deserialized successfully", data_len);
 	if (RDEBUG_ENABLED3) SSL_SESSION_print(fr_tls_request_log_bio(request, L_DBG, L_DBG_LVL_3), sess);
 
 	/*
@@ -304,6 +517,34 @@ static unlang_action_t tls_cache_load_result(UNUSED rlm_rcode_t *p_result, UNUSE
 	tls_cache->load.state = FR_TLS_CACHE_LOAD_RETRIEVED;
 	tls_cache->load.sess = sess;	/* This is consumed in tls_cache_load_cb */
 
+	return 0;
+}
+
+/** Process the result of `session load { ... }`
+ */
+static unlang_action_t tls_cache_load_result(UNUSED rlm_rcode_t *p_result, UNUSED int *priority,
+					     request_t *request, void *uctx)
+{
+	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
+	fr_tls_cache_t		*tls_cache = tls_session->cache;
+	fr_pair_t		*vp;
+
+	vp = fr_pair_find_by_da(&request->reply_pairs, attr_tls_packet_type, 0);
+	if (!vp || (vp->vp_uint32 != enum_tls_packet_type_success->vb_uint32)) {
+		RWDEBUG("Failed acquiring session data");
+	error:
+		tls_cache->load.state = FR_TLS_CACHE_LOAD_FAILED;
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+
+	vp = fr_pair_find_by_da(&request->reply_pairs, attr_tls_session_data, 0);
+	if (!vp) {
+		RWDEBUG("No cached session found");
+		goto error;
+	}
+
+	if (tls_cache_load_data(request, tls_session, vp->vp_octets, vp->vp_length) < 0) goto error;
+
 	return UNLANG_ACTION_CALCULATE_RESULT;
 }
 
@@ -470,6 +711,18 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 	}
 	fr_pair_value_memdup_buffer_shallow(vp, data, true);
 
+	/*
+	 *	Keep a copy in memory, so this server can
+	 *	resume the session without calling
+	 *	`load session { ... }`.
+	 */
+	if (conf->cache.local) {
+		unsigned int	id_len;
+		uint8_t const	*id = SSL_SESSION_get_id(sess, &id_len);
+
+		tls_cache_local_store(conf->cache.local, id, id_len, data, len, expires);
+	}
+
 	/*
 	 *	Allocate a child, and set it up to call
 	 *      the TLS virtual server.
@@ -523,6 +776,10 @@ unlang_action_t tls_cache_clear_push(request_t *request, fr_tls_conf_t *conf, fr
 	fr_assert(tls_cache->clear.state == FR_TLS_CACHE_CLEAR_REQUESTED);
 	fr_assert(tls_cache->clear.id);
 
+	if (conf->cache.local) {
+		tls_cache_local_clear(conf->cache.local, tls_cache->clear.id, talloc_array_length(tls_cache->clear.id));
+	}
+
 	MEM(child = unlang_subrequest_alloc(request, dict_tls));
 	request = child;
 
@@ -703,11 +960,34 @@ static SSL_SESSION *tls_cache_load_cb(SSL *ssl,
 again:
 	switch (tls_cache->load.state) {
 	case FR_TLS_CACHE_LOAD_INIT:
+	{
+		fr_tls_conf_t	*conf = fr_tls_session_conf(ssl);
+
 		fr_assert(!tls_cache->load.id);
 
-		tls_cache->load.state = FR_TLS_CACHE_LOAD_REQUESTED;
 		MEM(tls_cache->load.id = talloc_typed_memdup(tls_cache, (uint8_t const *)key, key_len));
 
+		/*
+		 *	Check the local cache first.  If we have the
+		 *	session there's no need to call
+		 *	`load session { ... }`.
+		 */
+		if (conf->cache.local) {
+			uint8_t *data;
+
+			data = tls_cache_local_load(request, conf->cache.local, (uint8_t const *)key, key_len);
+			if (data) {
+				int ret;
+
+				RDEBUG3("Found session in local cache - ID %pV", fr_box_octets_buffer(tls_cache->load.id));
+				ret = tls_cache_load_data(request, tls_session, data, talloc_array_length(data));
+				talloc_free(data);
+				if (ret == 0) goto again;
+			}
+		}
+
+		tls_cache->load.state = FR_TLS_CACHE_LOAD_REQUESTED;
+
 		RDEBUG3("Requested session load - ID %pV", fr_box_octets_buffer(tls_cache->load.id));
 		ASYNC_pause_job();	/* Jumps back to SSL_read() in session.c */
 
@@ -722,6 +1002,7 @@ again:
 			return NULL;
 
 		}
+	}
 		goto again;
 
 	case FR_TLS_CACHE_LOAD_REQUESTED:
@@ -111,6 +111,8 @@ void		fr_tls_cache_session_alloc(fr_tls_session_t *tls_session);
 
 int		fr_tls_cache_ctx_init(SSL_CTX *ctx, fr_tls_cache_conf_t const *cache_conf);
 
+fr_tls_cache_local_t	*fr_tls_cache_local_alloc(TALLOC_CTX *ctx, uint32_t max_entries);
+
 #ifdef __cplusplus
 }
 #endif
@@ -41,6 +41,7 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/util/syserror.h>
 
 #include "base.h"
+#include "crl.h"
 #include "log.h"
 
 /** Certificate formats
@@ -88,6 +89,7 @@ static CONF_PARSER tls_cache_config[] = {
 	{ FR_CONF_OFFSET("name", FR_TYPE_TMPL, fr_tls_cache_conf_t, id_name),
 			 .dflt = "%{EAP-Type}%{Virtual-Server}", .quote = T_DOUBLE_QUOTED_STRING },
 	{ FR_CONF_OFFSET("lifetime", FR_TYPE_UINT32, fr_tls_cache_conf_t, lifetime), .dflt = "86400" },
+	{ FR_CONF_OFFSET("local_max_entries", FR_TYPE_UINT32, fr_tls_cache_conf_t, local_max_entries), .dflt = "0" },
 
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
 	{ FR_CONF_OFFSET("require_extended_master_secret", FR_TYPE_BOOL, fr_tls_cache_conf_t, require_extms), .dflt = "yes" },
@@ -146,6 +148,10 @@ static CONF_PARSER tls_verify_config[] = {
 			 .dflt = "client-and-issuer" },
 	{ FR_CONF_OFFSET("check_crl", FR_TYPE_BOOL, fr_tls_verify_conf_t, check_crl), .dflt = "no" },
 	{ FR_CONF_OFFSET("allow_expired_crl", FR_TYPE_BOOL, fr_tls_verify_conf_t, allow_expired_crl) },
+	{ FR_CONF_OFFSET("cache_max_entries", FR_TYPE_UINT32, fr_tls_verify_conf_t, cache_max_entries), .dflt = "0" },
+	{ FR_CONF_OFFSET("cache_lifetime", FR_TYPE_TIME_DELTA, fr_tls_verify_conf_t, cache_lifetime), .dflt = "3600" },
+	{ FR_CONF_OFFSET("crl_file", FR_TYPE_FILE_INPUT, fr_tls_verify_conf_t, crl_file) },
+	{ FR_CONF_OFFSET("crl_reload_interval", FR_TYPE_TIME_DELTA, fr_tls_verify_conf_t, crl_reload_interval), .dflt = "60" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -463,6 +469,35 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 		break;
 	}
 
+	/*
+	 *	Allocate the in-memory caches shared by all workers.
+	 */
+	if ((conf->cache.mode & FR_TLS_CACHE_STATEFUL) && (conf->cache.local_max_entries > 0)) {
+		conf->cache.local = fr_tls_cache_local_alloc(conf, conf->cache.local_max_entries);
+		if (!conf->cache.local) {
+			PERROR("Failed allocating local session cache");
+			goto error;
+		}
+	}
+
+	if (conf->verify.cache_max_entries > 0) {
+		conf->verify.cache = fr_tls_verify_cache_alloc(conf, conf->verify.cache_max_entries,
+							       conf->verify.cache_lifetime);
+		if (!conf->verify.cache) {
+			PERROR("Failed allocating certificate verification cache");
+			goto error;
+		}
+	}
+
+	if (conf->verify.crl_file) {
+		conf->verify.crl = fr_tls_crl_alloc(conf, conf->verify.crl_file, conf->verify.crl_reload_interval,
+						    conf->ca_file, conf->ca_path);
+		if (!conf->verify.crl) {
+			PERROR("Failed loading crl_file \"%s\"", conf->verify.crl_file);
+			goto error;
+		}
+	}
+
 	/*
 	 *	Generate random, ephemeral, session-ticket keys.
 	 */
@@ -0,0 +1,549 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls/crl.c
+ * @brief Index certificate revocation lists in memory.
+ *
+ * OpenSSL searches the revoked entries of a CRL every time a certificate
+ * is checked against it, and the only way to pick up a new CRL is to
+ * rebuild the X509_STORE.  With very large CRLs this makes both startup
+ * and every handshake slow.
+ *
+ * Here the CRLs are parsed once, and the serial numbers of the revoked
+ * certificates are placed in an open addressed hash set per issuer.
+ * A background thread watches the file, and when it changes, builds a
+ * complete new set of indexes which is swapped in under a write lock.
+ * Lookups only ever hold the read lock for the duration of a probe.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#ifdef WITH_TLS
+#define LOG_PREFIX "tls - crl - "
+
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "base.h"
+#include "crl.h"
+#include "log.h"
+
+#define TLS_CRL_SERIAL_MAX	32		//!< Longest serial number we index.  RFC 5280 allows 20 octets.
+
+/** A slot in an issuer's revoked serial set
+ *
+ * A slot with a len of 0 is empty.
+ */
+typedef struct {
+	uint8_t			len;			//!< Length of the serial number.
+	uint8_t			serial[TLS_CRL_SERIAL_MAX];	//!< Serial number, big endian.
+} tls_crl_serial_t;
+
+/** Revoked serials for one issuer
+ *
+ */
+typedef struct {
+	uint8_t const		*name;			//!< DER encoded issuer name.
+	size_t			name_len;		//!< Length of the issuer name.
+	time_t			next_update;		//!< Earliest nextUpdate of this issuer's CRLs.
+							///< 0 if none of them had one.
+	size_t			mask;			//!< Number of slots - 1.
+	size_t			num;			//!< Number of revoked serials.
+	tls_crl_serial_t	*slot;			//!< Open addressed set of revoked serials.
+} tls_crl_issuer_t;
+
+/** One complete load of the CRL file
+ *
+ * All memory for the set hangs off this structure, so it can be
+ * freed in one go once it's been replaced.
+ */
+typedef struct {
+	fr_hash_table_t		*issuers;		//!< Issuers, keyed by DER encoded name.
+} tls_crl_set_t;
+
+struct fr_tls_crl_s {
+	char const		*file;			//!< File containing the PEM encoded CRLs.
+	char const		*ca_file;		//!< Used to find the issuers of the CRLs
+	char const		*ca_path;		//!< so their signatures can be checked.
+	fr_time_delta_t		interval;		//!< How often to check the file for changes.
+
+	pthread_rwlock_t	lock;			//!< Protects set.
+	tls_crl_set_t		*set;			//!< Currently active indexes.
+
+	struct timespec		mtime;			//!< Modification time of the file when last loaded.
+
+	pthread_mutex_t		mutex;			//!< Protects the fields below.
+	pthread_cond_t		cond;			//!< Signalled to stop the reload thread.
+	pthread_t		thread;			//!< Checks the file for changes.
+	bool			running;		//!< Whether the reload thread has been started.
+	bool			stop;			//!< Tell the reload thread to exit.
+};
+
+static uint32_t tls_crl_issuer_hash(void const *data)
+{
+	tls_crl_issuer_t const *a = data;
+
+	return fr_hash(a->name, a->name_len);
+}
+
+static int8_t tls_crl_issuer_cmp(void const *one, void const *two)
+{
+	tls_crl_issuer_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->name_len, b->name_len);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->name, b->name, a->name_len);
+	return CMP(ret, 0);
+}
+
+/** Find the issuer entry for an X509_NAME
+ *
+ * @param[in] set	to search.
+ * @param[in] name	of the issuer.
+ * @return
+ *	- The issuer entry.
+ *	- NULL if the issuer has no CRL.
+ */
+static inline CC_HINT(always_inline)
+tls_crl_issuer_t *tls_crl_issuer_find(tls_crl_set_t *set, X509_NAME *name)
+{
+	tls_crl_issuer_t	find;
+
+	if (X509_NAME_get0_der(name, &find.name, &find.name_len) != 1) return NULL;
+
+	return fr_hash_table_find(set->issuers, &find);
+}
+
+/** Find the slot for a serial number, or the empty slot it would occupy
+ *
+ */
+static inline CC_HINT(always_inline)
+tls_crl_serial_t *tls_crl_slot(tls_crl_issuer_t const *issuer, uint8_t const *serial, size_t len)
+{
+	size_t			i;
+	tls_crl_serial_t	*slot;
+
+	for (i = fr_hash(serial, len) & issuer->mask;; i = (i + 1) & issuer->mask) {
+		slot = &issuer->slot[i];
+		if (!slot->len) return slot;
+		if ((slot->len == len) && (memcmp(slot->serial, serial, len) == 0)) return slot;
+	}
+}
+
+/** Add every revoked serial from a CRL to its issuer's set
+ *
+ */
+static int tls_crl_issuer_add(tls_crl_issuer_t *issuer, X509_CRL *crl)
+{
+	STACK_OF(X509_REVOKED)	*revoked = X509_CRL_get_REVOKED(crl);
+	int			i, num = revoked ? sk_X509_REVOKED_num(revoked) : 0;
+
+	for (i = 0; i < num; i++) {
+		ASN1_INTEGER const	*serial = X509_REVOKED_get0_serialNumber(sk_X509_REVOKED_value(revoked, i));
+		int			len = ASN1_STRING_length(serial);
+		tls_crl_serial_t	*slot;
+
+		if ((len <= 0) || (len > TLS_CRL_SERIAL_MAX)) {
+			fr_strerror_printf("Revoked serial number is %i bytes, maximum is %u",
+					   len, TLS_CRL_SERIAL_MAX);
+			return -1;
+		}
+
+		slot = tls_crl_slot(issuer, ASN1_STRING_get0_data(serial), len);
+		if (slot->len) continue;	/* Duplicate */
+
+		slot->len = len;
+		memcpy(slot->serial, ASN1_STRING_get0_data(serial), len);
+		issuer->num++;
+	}
+
+	return 0;
+}
+
+/** Check a CRL was signed by an issuer we trust
+ *
+ */
+static int tls_crl_verify(X509_STORE *store, X509_CRL *crl)
+{
+	X509_STORE_CTX	*store_ctx;
+	X509_OBJECT	*obj;
+	X509		*issuer;
+	int		ret = -1;
+
+	MEM(store_ctx = X509_STORE_CTX_new());
+	if (X509_STORE_CTX_init(store_ctx, store, NULL, NULL) != 1) {
+		fr_tls_log_strerror_printf("Failed initialising store ctx");
+		goto finish;
+	}
+
+	obj = X509_STORE_CTX_get_obj_by_subject(store_ctx, X509_LU_X509, X509_CRL_get_issuer(crl));
+	if (!obj) {
+		fr_strerror_const("Issuer of CRL not found in ca_file or ca_path");
+		goto finish;
+	}
+	issuer = X509_OBJECT_get0_X509(obj);
+
+	if (X509_CRL_verify(crl, X509_get0_pubkey(issuer)) != 1) {
+		fr_tls_log_strerror_printf("CRL signature is invalid");
+	} else {
+		ret = 0;
+	}
+	X509_OBJECT_free(obj);
+
+finish:
+	X509_STORE_CTX_free(store_ctx);
+
+	return ret;
+}
+
+/** Parse the CRL file into a new set of indexes
+ *
+ * @param[in] crl	configuration.
+ * @return
+ *	- A new set on success.
+ *	- NULL on failure.
+ */
+static tls_crl_set_t *tls_crl_set_load(fr_tls_crl_t *crl)
+{
+	tls_crl_set_t		*set;
+	STACK_OF(X509_CRL)	*crls = NULL;
+	X509_STORE		*store = NULL;
+	X509_CRL		*this;
+	BIO			*bio;
+	int			i, num;
+
+	set = talloc_zero(NULL, tls_crl_set_t);
+	if (!set) return NULL;
+
+	set->issuers = fr_hash_table_alloc(set, tls_crl_issuer_hash, tls_crl_issuer_cmp, NULL);
+	if (!set->issuers) goto error;
+
+	bio = BIO_new_file(crl->file, "r");
+	if (!bio) {
+		fr_tls_log_strerror_printf("Failed opening \"%s\"", crl->file);
+		goto error;
+	}
+
+	MEM(crls = sk_X509_CRL_new_null());
+	while ((this = PEM_read_bio_X509_CRL(bio, NULL, NULL, NULL))) {
+		if (!sk_X509_CRL_push(crls, this)) {
+			X509_CRL_free(this);
+			BIO_free(bio);
+			fr_strerror_const("Out of memory");
+			goto error;
+		}
+	}
+	BIO_free(bio);
+	ERR_clear_error();	/* PEM_read_bio_X509_CRL fails at EOF */
+
+	num = sk_X509_CRL_num(crls);
+	if (num == 0) {
+		fr_strerror_printf("No CRLs found in \"%s\"", crl->file);
+		goto error;
+	}
+
+	MEM(store = X509_STORE_new());
+	if ((crl->ca_file || crl->ca_path) && !X509_STORE_load_locations(store, crl->ca_file, crl->ca_path)) {
+		fr_tls_log_strerror_printf("Failed loading CA certificates");
+		goto error;
+	}
+
+	/*
+	 *	First pass - Check signatures, and count the
+	 *	revoked serials for each issuer, so that the
+	 *	sets can be sized correctly.
+	 */
+	for (i = 0; i < num; i++) {
+		tls_crl_issuer_t	*issuer;
+		STACK_OF(X509_REVOKED)	*revoked;
+		ASN1_TIME const		*next_update;
+		time_t			next = 0;
+
+		this = sk_X509_CRL_value(crls, i);
+		if (tls_crl_verify(store, this) < 0) goto error;
+
+		issuer = tls_crl_issuer_find(set, X509_CRL_get_issuer(this));
+		if (!issuer) {
+			uint8_t const	*der;
+			size_t		len;
+
+			if (X509_NAME_get0_der(X509_CRL_get_issuer(this), &der, &len) != 1) {
+				fr_tls_log_strerror_printf("Failed encoding CRL issuer");
+				goto error;
+			}
+
+			MEM(issuer = talloc_zero(set, tls_crl_issuer_t));
+			MEM(issuer->name = talloc_memdup(issuer, der, len));
+			issuer->name_len = len;
+			if (!fr_hash_table_insert(set->issuers, issuer)) {
+				fr_strerror_const("Failed inserting CRL issuer");
+				goto error;
+			}
+		}
+
+		next_update = X509_CRL_get0_nextUpdate(this);
+		if (next_update && (fr_tls_utils_asn1time_to_epoch(&next, next_update) == 0) &&
+		    (!issuer->next_update || (next < issuer->next_update))) issuer->next_update = next;
+
+		revoked = X509_CRL_get_REVOKED(this);
+		if (revoked) issuer->num += sk_X509_REVOKED_num(revoked);
+	}
+
+	/*
+	 *	Second pass - Size each set so it's never more
+	 *	than half full, and add the serials.
+	 */
+	{
+		fr_hash_iter_t		iter;
+		tls_crl_issuer_t	*issuer;
+
+		for (issuer = fr_hash_table_iter_init(set->issuers, &iter);
+		     issuer;
+		     issuer = fr_hash_table_iter_next(set->issuers, &iter)) {
+			size_t slots = 2;
+
+			while (slots < (issuer->num * 2)) slots <<= 1;
+
+			issuer->slot = talloc_zero_array(issuer, tls_crl_serial_t, slots);
+			if (!issuer->slot) {
+				fr_strerror_const("Out of memory");
+				goto error;
+			}
+			issuer->mask = slots - 1;
+			issuer->num = 0;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		tls_crl_issuer_t	*issuer;
+
+		this = sk_X509_CRL_value(crls, i);
+
+		issuer = tls_crl_issuer_find(set, X509_CRL_get_issuer(this));
+		fr_assert(issuer);
+
+		if (tls_crl_issuer_add(issuer, this) < 0) goto error;
+	}
+
+	X509_STORE_free(store);
+	sk_X509_CRL_pop_free(crls, X509_CRL_free);
+
+	return set;
+
+error:
+	X509_STORE_free(store);
+	if (crls) sk_X509_CRL_pop_free(crls, X509_CRL_free);
+	talloc_free(set);
+
+	return NULL;
+}
+
+/** Reload the CRL file if it has changed
+ *
+ * @param[in] crl	to reload.
+ * @param[in] force	Reload even if the modification time hasn't changed.
+ * @return
+ *	- 1 if the file was reloaded.
+ *	- 0 if the file hadn't changed.
+ *	- -1 on error.  The current indexes are left in place.
+ */
+static int tls_crl_reload(fr_tls_crl_t *crl, bool force)
+{
+	struct stat	buf;
+	tls_crl_set_t	*set, *old;
+
+	if (stat(crl->file, &buf) < 0) {
+		fr_strerror_printf("Failed checking \"%s\": %s", crl->file, fr_syserror(errno));
+		return -1;
+	}
+
+	if (!force && (buf.st_mtim.tv_sec == crl->mtime.tv_sec) && (buf.st_mtim.tv_nsec == crl->mtime.tv_nsec)) {
+		return 0;
+	}
+
+	set = tls_crl_set_load(crl);
+	if (!set) return -1;
+
+	crl->mtime = buf.st_mtim;
+
+	pthread_rwlock_wrlock(&crl->lock);
+	old = crl->set;
+	crl->set = set;
+	pthread_rwlock_unlock(&crl->lock);
+
+	talloc_free(old);
+
+	return 1;
+}
+
+static void *tls_crl_thread(void *arg)
+{
+	fr_tls_crl_t	*crl = arg;
+	struct timespec	when;
+
+	pthread_mutex_lock(&crl->mutex);
+	while (!crl->stop) {
+		clock_gettime(CLOCK_REALTIME, &when);
+		when.tv_sec += fr_time_delta_to_sec(crl->interval);
+		when.tv_nsec += crl->interval % NSEC;
+		if (when.tv_nsec >= NSEC) {
+			when.tv_sec++;
+			when.tv_nsec -= NSEC;
+		}
+
+		if ((pthread_cond_timedwait(&crl->cond, &crl->mutex, &when) != ETIMEDOUT) || crl->stop) continue;
+
+		switch (tls_crl_reload(crl, false)) {
+		case 1:
+			INFO("Reloaded \"%s\"", crl->file);
+			break;
+
+		case 0:
+			break;
+
+		default:
+			PERROR("Failed reloading \"%s\", continuing to use previous CRLs", crl->file);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&crl->mutex);
+
+	return NULL;
+}
+
+static int _tls_crl_free(fr_tls_crl_t *crl)
+{
+	if (crl->running) {
+		pthread_mutex_lock(&crl->mutex);
+		crl->stop = true;
+		pthread_cond_signal(&crl->cond);
+		pthread_mutex_unlock(&crl->mutex);
+
+		pthread_join(crl->thread, NULL);
+	}
+
+	talloc_free(crl->set);
+
+	pthread_rwlock_destroy(&crl->lock);
+	pthread_mutex_destroy(&crl->mutex);
+	pthread_cond_destroy(&crl->cond);
+
+	return 0;
+}
+
+/** Load and index a file of CRLs
+ *
+ * @param[in] ctx	to allocate the CRL structure in.
+ * @param[in] file	containing one or more PEM encoded CRLs.
+ * @param[in] interval	How often to check the file for changes.
+ *			Zero means the file is only loaded at startup.
+ * @param[in] ca_file	to use to find the issuers of CRLs.
+ * @param[in] ca_path	to use to find the issuers of CRLs.
+ * @return
+ *	- A new CRL structure on success.
+ *	- NULL on failure.
+ */
+fr_tls_crl_t *fr_tls_crl_alloc(TALLOC_CTX *ctx, char const *file, fr_time_delta_t interval,
+			       char const *ca_file, char const *ca_path)
+{
+	fr_tls_crl_t	*crl;
+
+	MEM(crl = talloc_zero(ctx, fr_tls_crl_t));
+	crl->file = talloc_strdup(crl, file);
+	if (ca_file) crl->ca_file = talloc_strdup(crl, ca_file);
+	if (ca_path) crl->ca_path = talloc_strdup(crl, ca_path);
+	crl->interval = interval;
+
+	pthread_rwlock_init(&crl->lock, NULL);
+	pthread_mutex_init(&crl->mutex, NULL);
+	pthread_cond_init(&crl->cond, NULL);
+	talloc_set_destructor(crl, _tls_crl_free);
+
+	if (tls_crl_reload(crl, true) < 0) {
+		talloc_free(crl);
+		return NULL;
+	}
+
+	return crl;
+}
+
+/** Start the reload thread
+ *
+ * This is done on first use rather than at startup, as threads don't
+ * survive the server daemonizing.
+ */
+static void tls_crl_thread_start(fr_tls_crl_t *crl)
+{
+	pthread_mutex_lock(&crl->mutex);
+	if (!crl->running) {
+		if (pthread_create(&crl->thread, NULL, tls_crl_thread, crl) != 0) {
+			ERROR("Failed starting thread to reload \"%s\": %s", crl->file, fr_syserror(errno));
+			crl->interval = 0;
+		} else {
+			crl->running = true;
+		}
+	}
+	pthread_mutex_unlock(&crl->mutex);
+}
+
+/** Check whether a certificate has been revoked
+ *
+ * @param[in] crl	to check the certificate against.
+ * @param[in] cert	to check.
+ * @return
+ *	- FR_TLS_CRL_GOOD if the certificate is not revoked, or its issuer has no CRL.
+ *	- FR_TLS_CRL_REVOKED if the certificate is revoked.
+ *	- FR_TLS_CRL_EXPIRED if the issuer's CRL is out of date.
+ */
+fr_tls_crl_status_t fr_tls_crl_check(fr_tls_crl_t *crl, X509 *cert)
+{
+	ASN1_INTEGER const	*serial = X509_get0_serialNumber(cert);
+	tls_crl_issuer_t	*issuer;
+	fr_tls_crl_status_t	status = FR_TLS_CRL_GOOD;
+	int			serial_len;
+
+	if (unlikely(crl->interval && !crl->running)) tls_crl_thread_start(crl);
+
+	pthread_rwlock_rdlock(&crl->lock);
+	issuer = tls_crl_issuer_find(crl->set, X509_get_issuer_name(cert));
+	if (issuer) {
+		if (issuer->next_update && (issuer->next_update < time(NULL))) status = FR_TLS_CRL_EXPIRED;
+
+		serial_len = ASN1_STRING_length(serial);
+		if ((serial_len > 0) && (serial_len <= TLS_CRL_SERIAL_MAX) &&
+		    tls_crl_slot(issuer, ASN1_STRING_get0_data(serial), serial_len)->len) status = FR_TLS_CRL_REVOKED;
+	}
+	pthread_rwlock_unlock(&crl->lock);
+
+	return status;
+}
+#endif /* WITH_TLS */
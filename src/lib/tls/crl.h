@@ -0,0 +1,53 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifdef WITH_TLS
+/**
+ * $Id$
+ *
+ * @file lib/tls/crl.h
+ * @brief Indexed certificate revocation lists.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(crl_h, "$Id$")
+
+#include <openssl/x509.h>
+
+#include "conf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Result of checking a certificate against the revocation lists
+ *
+ */
+typedef enum {
+	FR_TLS_CRL_GOOD = 0,				//!< Not revoked, or the issuer has no CRL.
+	FR_TLS_CRL_REVOKED,				//!< The certificate has been revoked.
+	FR_TLS_CRL_EXPIRED				//!< The issuer's CRL is past its nextUpdate time.
+} fr_tls_crl_status_t;
+
+fr_tls_crl_t		*fr_tls_crl_alloc(TALLOC_CTX *ctx, char const *file, fr_time_delta_t interval,
+					  char const *ca_file, char const *ca_path);
+
+fr_tls_crl_status_t	fr_tls_crl_check(fr_tls_crl_t *crl, X509 *cert);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* WITH_TLS */
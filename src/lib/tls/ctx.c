@@ -553,6 +553,16 @@ SSL_CTX *fr_tls_ctx_alloc(fr_tls_conf_t const *conf, bool client)
 		 */
 		if (!conf->auto_chain) mode |= SSL_MODE_NO_AUTO_CHAIN;
 
+		/*
+		 *	Sessions spend most of their lives waiting for
+		 *	the next round from the peer.  Don't keep
+		 *	OpenSSL's read/write buffers allocated while
+		 *	they're idle.
+		 */
+#ifdef SSL_MODE_RELEASE_BUFFERS
+		mode |= SSL_MODE_RELEASE_BUFFERS;
+#endif
+
 		if (client) {
 			mode |= SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER;
 			mode |= SSL_MODE_AUTO_RETRY;
@@ -787,6 +797,7 @@ post_ca:
 	verify_mode |= SSL_VERIFY_FAIL_IF_NO_PEER_CERT;
 	verify_mode |= SSL_VERIFY_CLIENT_ONCE;
 	SSL_CTX_set_verify(ctx, verify_mode, fr_tls_verify_cert_cb);
+	if (conf->verify.cache) SSL_CTX_set_cert_verify_callback(ctx, fr_tls_verify_cache_cb, NULL);
 
 	if (conf->verify_depth) {
 		SSL_CTX_set_verify_depth(ctx, conf->verify_depth);
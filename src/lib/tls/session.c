@@ -177,12 +177,30 @@ static char const *tls_handshake_type_str[] = {
 #endif
 };
 
-/** Clear a record buffer
+/** Return the buffer for a record, allocating it if required
+ *
+ * Buffers are only allocated while they hold data, so sessions
+ * which are waiting for the next round from the peer don't keep
+ * FR_TLS_MAX_RECORD_SIZE bytes per record alive.
+ *
+ * @param record buffer to allocate.
+ * @return the start of the record's buffer.
+ */
+inline static uint8_t *record_buffer(fr_tls_record_t *record)
+{
+	if (!record->data) MEM(record->data = talloc_array(NULL, uint8_t, FR_TLS_MAX_RECORD_SIZE));
+
+	return record->data;
+}
+
+/** Clear a record buffer, releasing its memory
  *
  * @param record buffer to clear.
  */
 inline static void record_init(fr_tls_record_t *record)
 {
+	TALLOC_FREE(record->data);
+	record->start = 0;
 	record->used = 0;
 }
 
@@ -192,6 +210,8 @@ inline static void record_init(fr_tls_record_t *record)
  */
 inline static void record_close(fr_tls_record_t *record)
 {
+	TALLOC_FREE(record->data);
+	record->start = 0;
 	record->used = 0;
 }
 
@@ -204,18 +224,32 @@ inline static void record_close(fr_tls_record_t *record)
  */
 inline static unsigned int record_from_buff(fr_tls_record_t *record, void const *in, unsigned int inlen)
 {
-	unsigned int added = FR_TLS_MAX_RECORD_SIZE - record->used;
+	unsigned int added;
+
+	/*
+	 *	Only shift unread data to the start of the
+	 *	buffer if we need the space.
+	 */
+	if ((record->start > 0) && ((FR_TLS_MAX_RECORD_SIZE - (record->start + record->used)) < inlen)) {
+		memmove(record->data, record->data + record->start, record->used);
+		record->start = 0;
+	}
 
+	added = FR_TLS_MAX_RECORD_SIZE - (record->start + record->used);
 	if (added > inlen) added = inlen;
 	if (added == 0) return 0;
 
-	memcpy(record->data + record->used, in, added);
+	memcpy(record_buffer(record) + record->start + record->used, in, added);
 	record->used += added;
 
 	return added;
 }
 
 /** Take data from the buffer, and give it to the caller
+ *
+ * The data isn't moved, the start of the unread data is advanced instead,
+ * so a record can be drained a fragment at a time without copying the
+ * remainder on every call.
  *
  * @param[in] record	buffer to read from.
  * @param[out] out	where to write data from record buffer.
@@ -228,14 +262,14 @@ inline static unsigned int record_to_buff(fr_tls_record_t *record, void *out, un
 
 	if (taken > outlen) taken = outlen;
 	if (taken == 0) return 0;
-	if (out) memcpy(out, record->data, taken);
+	if (out) memcpy(out, record->data + record->start, taken);
 
 	record->used -= taken;
-
-	/*
-	 *	This is pretty bad...
-	 */
-	if (record->used > 0) memmove(record->data, record->data + taken, record->used);
+	if (record->used == 0) {
+		record_init(record);	/* Drained, release the buffer */
+	} else {
+		record->start += taken;
+	}
 
 	return taken;
 }
@@ -870,7 +904,7 @@ int fr_tls_session_recv(request_t *request, fr_tls_session_t *tls_session)
 	 *      SSL session, and put it into the decrypted
 	 *      data buffer.
 	 */
-	ret = SSL_read(tls_session->ssl, tls_session->clean_out.data, sizeof(tls_session->clean_out.data));
+	ret = SSL_read(tls_session->ssl, record_buffer(&tls_session->clean_out), FR_TLS_MAX_RECORD_SIZE);
 	if (ret < 0) {
 		int code;
 
@@ -953,19 +987,21 @@ int fr_tls_session_send(request_t *request, fr_tls_session_t *tls_session)
 	 */
 	if (tls_session->clean_in.used > 0) {
 		if (RDEBUG_ENABLED3) {
-			RHEXDUMP3(tls_session->clean_in.data, tls_session->clean_in.used,
+			RHEXDUMP3(tls_session->clean_in.data + tls_session->clean_in.start, tls_session->clean_in.used,
 				 "TLS application data to encrypt (%zu bytes)", tls_session->clean_in.used);
 		} else {
 			RDEBUG2("TLS application data to encrypt (%zu bytes)", tls_session->clean_in.used);
 		}
 
-		ret = SSL_write(tls_session->ssl, tls_session->clean_in.data, tls_session->clean_in.used);
+		ret = SSL_write(tls_session->ssl, tls_session->clean_in.data + tls_session->clean_in.start,
+				tls_session->clean_in.used);
 		record_to_buff(&tls_session->clean_in, NULL, ret);
 
 		/* Get the dirty data from Bio to send it */
-		ret = BIO_read(tls_session->from_ssl, tls_session->dirty_out.data,
-			       sizeof(tls_session->dirty_out.data));
+		ret = BIO_read(tls_session->from_ssl, record_buffer(&tls_session->dirty_out),
+			       FR_TLS_MAX_RECORD_SIZE);
 		if (ret > 0) {
+			tls_session->dirty_out.start = 0;
 			tls_session->dirty_out.used = ret;
 			ret = 0;
 		} else {
@@ -1008,6 +1044,7 @@ static void fr_tls_session_alert_send(request_t *request, fr_tls_session_t *sess
 	session->info.alert_level = session->pending_alert_level;
 	session->info.alert_description = session->pending_alert_description;
 
+	record_buffer(&session->dirty_out);
 	session->dirty_out.data[0] = session->info.content_type;
 	session->dirty_out.data[1] = 3;
 	session->dirty_out.data[2] = 1;
@@ -1016,6 +1053,7 @@ static void fr_tls_session_alert_send(request_t *request, fr_tls_session_t *sess
 	session->dirty_out.data[5] = session->pending_alert_level;
 	session->dirty_out.data[6] = session->pending_alert_description;
 
+	session->dirty_out.start = 0;
 	session->dirty_out.used = 7;
 
 	session->pending_alert = false;
@@ -1140,9 +1178,10 @@ static unlang_action_t tls_session_async_handshake_done_round(UNUSED rlm_rcode_t
 	 */
 	ret = BIO_ctrl_pending(tls_session->from_ssl);
 	if (ret > 0) {
-		ret = BIO_read(tls_session->from_ssl, tls_session->dirty_out.data,
-			       sizeof(tls_session->dirty_out.data));
+		ret = BIO_read(tls_session->from_ssl, record_buffer(&tls_session->dirty_out),
+			       FR_TLS_MAX_RECORD_SIZE);
 		if (ret > 0) {
+			tls_session->dirty_out.start = 0;
 			tls_session->dirty_out.used = ret;
 		} else if (BIO_should_retry(tls_session->from_ssl)) {
 			record_init(&tls_session->dirty_in);
@@ -1192,6 +1231,12 @@ static void tls_session_async_handshake_signal(UNUSED request_t *request, fr_sta
 
 	if (action != FR_SIGNAL_CANCEL) return;
 
+	/*
+	 *	Stop waiting on any engine file descriptors,
+	 *	the request is going away.
+	 */
+	TALLOC_FREE(tls_session->async_fds);
+
 	/*
 	 *	If SSL_get_error returns SSL_ERROR_WANT_ASYNC
 	 *	it means we're yielded in the middle of a
@@ -1206,8 +1251,8 @@ static void tls_session_async_handshake_signal(UNUSED request_t *request, fr_sta
 	 */
 	for (ret = tls_session->last_ret;
 	     SSL_get_error(tls_session->ssl, ret) == SSL_ERROR_WANT_ASYNC;
-	     ret = SSL_read(tls_session->ssl, tls_session->clean_out.data + tls_session->clean_out.used,
-        		    sizeof(tls_session->clean_out.data) - tls_session->clean_out.used));
+	     ret = SSL_read(tls_session->ssl, record_buffer(&tls_session->clean_out) + tls_session->clean_out.used,
+        		    FR_TLS_MAX_RECORD_SIZE - tls_session->clean_out.used));
 
 	/*
 	 *	Unbind the cancelled request from the SSL *
@@ -1215,6 +1260,71 @@ static void tls_session_async_handshake_signal(UNUSED request_t *request, fr_sta
 	fr_tls_session_request_unbind(tls_session->ssl);
 }
 
+/** Resume a request once an engine has completed an asynchronous crypto operation
+ *
+ * @param[in] el	the file descriptor was inserted into.
+ * @param[in] fd	which became readable.
+ * @param[in] flags	as returned by kevent.
+ * @param[in] uctx	the #fr_tls_session_t waiting on the engine.
+ */
+static void tls_session_async_fd_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
+	request_t		*request = fr_tls_session_request(tls_session->ssl);
+
+	RDEBUG3("Engine signalled asynchronous operation complete");
+
+	TALLOC_FREE(tls_session->async_fds);	/* Removes the events for all the fds */
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Wait for an engine to complete an asynchronous crypto operation
+ *
+ * Engines which offload crypto operations to hardware (such as Intel QAT)
+ * pause the ASYNC_JOB running the handshake, and provide one or more
+ * file descriptors which become readable when the operation completes.
+ *
+ * Rather than spinning on SSL_read(), we insert the file descriptors
+ * into the request's event list and yield until one of them fires.
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	waiting on the engine.
+ * @return
+ *	- UNLANG_ACTION_YIELD if we're waiting on the engine.
+ *	- UNLANG_ACTION_CALCULATE_RESULT if there's nothing to wait on.
+ *	- UNLANG_ACTION_FAIL on error.
+ */
+static unlang_action_t tls_session_async_fd_wait(request_t *request, fr_tls_session_t *tls_session)
+{
+	OSSL_ASYNC_FD	*fds;
+	size_t		num_fds = 0, i;
+
+	if ((SSL_get_all_async_fds(tls_session->ssl, NULL, &num_fds) != 1) || (num_fds == 0)) {
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+
+	MEM(tls_session->async_fds = talloc_new(request));
+	MEM(fds = talloc_array(tls_session->async_fds, OSSL_ASYNC_FD, num_fds));
+	if (SSL_get_all_async_fds(tls_session->ssl, fds, &num_fds) != 1) {
+		fr_tls_log_error(request, "Failed retrieving async file descriptors");
+	error:
+		TALLOC_FREE(tls_session->async_fds);
+		return UNLANG_ACTION_FAIL;
+	}
+
+	for (i = 0; i < num_fds; i++) {
+		if (fr_event_fd_insert(tls_session->async_fds, request->el, fds[i],
+				       tls_session_async_fd_read, NULL, NULL, tls_session) < 0) {
+			RPERROR("Failed inserting async file descriptor");
+			goto error;
+		}
+	}
+
+	RDEBUG3("Waiting on %zu engine file descriptor(s)", num_fds);
+
+	return UNLANG_ACTION_YIELD;
+}
+
 /** Call SSL_read() to continue the TLS state machine
  *
  * This function may be called multiple times, once after every asynchronous request.
@@ -1226,6 +1336,7 @@ static void tls_session_async_handshake_signal(UNUSED request_t *request, fr_sta
  * @return
  *	- UNLANG_ACTION_CALCULATE_RESULT - We're done with this round.
  *	- UNLANG_ACTION_PUSHED_CHILD - Need to perform more asynchronous actions.
+ *	- UNLANG_ACTION_YIELD - Waiting for an engine to complete a crypto operation.
  */
 static unlang_action_t tls_session_async_handshake_cont(rlm_rcode_t *p_result, int *priority,
 							request_t *request, void *uctx)
@@ -1254,8 +1365,9 @@ static unlang_action_t tls_session_async_handshake_cont(rlm_rcode_t *p_result, i
 	 *	If acting as a server SSL_set_accept_state must have
 	 *	been called before this function.
 	 */
-	tls_session->last_ret = SSL_read(tls_session->ssl, tls_session->clean_out.data + tls_session->clean_out.used,
-					 sizeof(tls_session->clean_out.data) - tls_session->clean_out.used);
+	tls_session->last_ret = SSL_read(tls_session->ssl,
+					 record_buffer(&tls_session->clean_out) + tls_session->clean_out.used,
+					 FR_TLS_MAX_RECORD_SIZE - tls_session->clean_out.used);
 	if (tls_session->last_ret > 0) {
 		tls_session->clean_out.used += tls_session->last_ret;
 
@@ -1277,7 +1389,7 @@ static unlang_action_t tls_session_async_handshake_cont(rlm_rcode_t *p_result, i
 	 *	asynchronously.
 	 */
 	switch (SSL_get_error(tls_session->ssl, tls_session->last_ret)) {
-	case SSL_ERROR_WANT_ASYNC:	/* Certification validation or cache loads */
+	case SSL_ERROR_WANT_ASYNC:	/* Certification validation, cache loads, or engine operations */
 	{
 		unlang_action_t ua;
 
@@ -1319,9 +1431,25 @@ static unlang_action_t tls_session_async_handshake_cont(rlm_rcode_t *p_result, i
 			if (unlang_function_clear(request) < 0) goto error;
 			goto error;
 
-		default:
+		case UNLANG_ACTION_PUSHED_CHILD:
 			return ua;
+
+		default:
+			break;
 		}
+
+		/*
+		 *	Finally, if neither of our callbacks paused
+		 *	the job, an engine is performing the crypto
+		 *	operation asynchronously.  Wait for it to
+		 *	signal completion.
+		 */
+		ua = tls_session_async_fd_wait(request, tls_session);
+		if (ua == UNLANG_ACTION_FAIL) {
+			if (unlang_function_clear(request) < 0) goto error;
+			goto error;
+		}
+		return ua;
 	}
 
 	case SSL_ERROR_WANT_ASYNC_JOB:
@@ -1444,6 +1572,11 @@ static int _fr_tls_session_free(fr_tls_session_t *session)
 		session->ssl = NULL;
 	}
 
+	record_close(&session->clean_in);
+	record_close(&session->clean_out);
+	record_close(&session->dirty_in);
+	record_close(&session->dirty_out);
+
 	return 0;
 }
 
@@ -60,8 +60,10 @@ extern "C" {
  * 	or configure TLS not to exceed FR_TLS_MAX_RECORD_SIZE.
  */
 typedef struct {
-	uint8_t		data[FR_TLS_MAX_RECORD_SIZE];
-	size_t 		used;
+	uint8_t		*data;		//!< FR_TLS_MAX_RECORD_SIZE bytes, only allocated
+					///< while the record holds data.
+	size_t		start;		//!< Offset of the first byte which hasn't been read.
+	size_t 		used;		//!< Number of bytes which haven't been read.
 } fr_tls_record_t;
 
 typedef enum {
@@ -113,6 +115,9 @@ struct fr_tls_session_s {
 	fr_tls_record_t 	dirty_in;			//!< Encrypted data to decrypt.
 	fr_tls_record_t 	dirty_out;			//!< Encrypted data that's been decrypted.
 	int			last_ret;			//!< Last result returned by SSL_read().
+	TALLOC_CTX		*async_fds;			//!< Holds the events for the file descriptors
+								///< of an engine performing an asynchronous
+								///< crypto operation for this session.
 
 	void 			(*record_init)(fr_tls_record_t *buf);
 	void 			(*record_close)(fr_tls_record_t *buf);
@@ -34,11 +34,233 @@
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/unlang/subrequest.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
 
 #include "attrs.h"
 #include "base.h"
+#include "crl.h"
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <pthread.h>
+
+/** A cached chain verification result
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the insertion ordered list.
+	uint8_t			id[SHA256_DIGEST_LENGTH];	//!< Fingerprint of the presented chain.
+	fr_pair_list_t		pairs;			//!< TLS-Certificate attributes extracted from the chain.
+	fr_time_t		expires;		//!< When the chain must be verified again.
+} tls_verify_cache_entry_t;
+
+/** Successful chain verifications, shared by all workers
+ *
+ * Only chains which OpenSSL and our checks accepted are cached.  The
+ * cache belongs to the #fr_tls_conf_t, so it is discarded whenever
+ * the trust store and CRLs are reloaded.
+ */
+struct fr_tls_verify_cache_s {
+	pthread_mutex_t		mutex;			//!< Protects the fields below.
+	uint32_t		max_entries;		//!< Maximum number of results to hold.
+	fr_time_delta_t		lifetime;		//!< Maximum time to hold a result for.
+	fr_hash_table_t		*ht;			//!< Entries, keyed by chain fingerprint.
+	fr_dlist_head_t		order;			//!< Entries, oldest first.
+};
+
+static uint32_t tls_verify_cache_hash(void const *data)
+{
+	tls_verify_cache_entry_t const *a = data;
+
+	return fr_hash(a->id, sizeof(a->id));
+}
+
+static int8_t tls_verify_cache_cmp(void const *one, void const *two)
+{
+	tls_verify_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = memcmp(a->id, b->id, sizeof(a->id));
+	return CMP(ret, 0);
+}
+
+static int _tls_verify_cache_free(fr_tls_verify_cache_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate a chain verification cache
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] max_entries	Maximum number of results to hold.
+ * @param[in] lifetime		Maximum time to hold a result for.
+ * @return
+ *	- A new verification cache on success.
+ *	- NULL on failure.
+ */
+fr_tls_verify_cache_t *fr_tls_verify_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries, fr_time_delta_t lifetime)
+{
+	fr_tls_verify_cache_t	*cache;
+
+	cache = talloc_zero(ctx, fr_tls_verify_cache_t);
+	if (!cache) return NULL;
+
+	cache->max_entries = max_entries;
+	cache->lifetime = lifetime;
+	cache->ht = fr_hash_table_alloc(cache, tls_verify_cache_hash, tls_verify_cache_cmp, NULL);
+	if (!cache->ht) {
+		talloc_free(cache);
+		return NULL;
+	}
+	fr_dlist_talloc_init(&cache->order, tls_verify_cache_entry_t, entry);
+	pthread_mutex_init(&cache->mutex, NULL);
+	talloc_set_destructor(cache, _tls_verify_cache_free);
+
+	return cache;
+}
+
+/** Fingerprint the chain presented by the peer
+ *
+ * @param[out] id		Where to write the fingerprint.
+ * @param[in] x509_ctx		containing the chain to fingerprint.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int tls_verify_cache_id(uint8_t id[static SHA256_DIGEST_LENGTH], X509_STORE_CTX *x509_ctx)
+{
+	X509		*cert = X509_STORE_CTX_get0_cert(x509_ctx);
+	STACK_OF(X509)	*untrusted = X509_STORE_CTX_get0_untrusted(x509_ctx);
+	EVP_MD_CTX	*md_ctx;
+	uint8_t		digest[EVP_MAX_MD_SIZE];
+	unsigned int	len;
+	int		i, num;
+	int		ret = -1;
+
+	if (!cert) return -1;
+
+	md_ctx = EVP_MD_CTX_new();
+	if (!md_ctx) return -1;
+
+	if ((EVP_DigestInit_ex(md_ctx, EVP_sha256(), NULL) != 1) ||
+	    (X509_digest(cert, EVP_sha256(), digest, &len) != 1) ||
+	    (EVP_DigestUpdate(md_ctx, digest, len) != 1)) goto finish;
+
+	num = untrusted ? sk_X509_num(untrusted) : 0;
+	for (i = 0; i < num; i++) {
+		if ((X509_digest(sk_X509_value(untrusted, i), EVP_sha256(), digest, &len) != 1) ||
+		    (EVP_DigestUpdate(md_ctx, digest, len) != 1)) goto finish;
+	}
+
+	if (EVP_DigestFinal_ex(md_ctx, id, &len) != 1) goto finish;
+	ret = 0;
+
+finish:
+	EVP_MD_CTX_free(md_ctx);
+
+	return ret;
+}
+
+/** Remove an entry from the verification cache
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void tls_verify_cache_entry_free(fr_tls_verify_cache_t *cache, tls_verify_cache_entry_t *entry)
+{
+	fr_hash_table_remove(cache->ht, entry);
+	fr_dlist_remove(&cache->order, entry);
+	talloc_free(entry);
+}
+
+/** Record a chain which passed verification
+ *
+ * @param[in] cache		to add the result to.
+ * @param[in] id		from #tls_verify_cache_id.
+ * @param[in] cert		Leaf certificate of the chain.
+ * @param[in] pairs		TLS-Certificate attributes extracted from the chain.
+ */
+static void tls_verify_cache_store(fr_tls_verify_cache_t *cache, uint8_t const id[static SHA256_DIGEST_LENGTH],
+				   X509 *cert, fr_pair_list_t *pairs)
+{
+	tls_verify_cache_entry_t	*entry, *old;
+	fr_time_t			now = fr_time();
+	fr_time_t			expires = now + cache->lifetime;
+	time_t				not_after;
+
+	/*
+	 *	Never cache past the point where the
+	 *	certificate itself expires.
+	 */
+	if (fr_tls_utils_asn1time_to_epoch(&not_after, X509_get0_notAfter(cert)) < 0) return;
+	if (fr_time_from_sec(not_after) < expires) expires = fr_time_from_sec(not_after);
+	if (expires <= now) return;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	entry = talloc_zero(cache->ht, tls_verify_cache_entry_t);
+	if (!entry) {
+	error:
+		talloc_free(entry);
+		pthread_mutex_unlock(&cache->mutex);
+		return;
+	}
+	memcpy(entry->id, id, sizeof(entry->id));
+	entry->expires = expires;
+	fr_pair_list_init(&entry->pairs);
+	if (fr_pair_list_copy_by_da(entry, &entry->pairs, pairs, attr_tls_certificate, 0) < 0) goto error;
+
+	old = fr_hash_table_find(cache->ht, entry);
+	if (old) tls_verify_cache_entry_free(cache, old);
+
+	while ((old = fr_dlist_head(&cache->order)) &&
+	       ((old->expires <= now) || (fr_dlist_num_elements(&cache->order) >= cache->max_entries))) {
+		tls_verify_cache_entry_free(cache, old);
+	}
+
+	if (!fr_hash_table_insert(cache->ht, entry)) goto error;
+	fr_dlist_insert_tail(&cache->order, entry);
+
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Retrieve the attributes of a chain which previously passed verification
+ *
+ * @param[in] ctx		to allocate the attributes in.
+ * @param[out] out		Where to write the TLS-Certificate attributes.
+ * @param[in] cache		to search.
+ * @param[in] id		from #tls_verify_cache_id.
+ * @return
+ *	- true if the chain was found.
+ *	- false if the chain must be verified.
+ */
+static bool tls_verify_cache_load(TALLOC_CTX *ctx, fr_pair_list_t *out,
+				  fr_tls_verify_cache_t *cache, uint8_t const id[static SHA256_DIGEST_LENGTH])
+{
+	tls_verify_cache_entry_t	*entry, find;
+	bool				found = false;
+
+	memcpy(find.id, id, sizeof(find.id));
+
+	pthread_mutex_lock(&cache->mutex);
+
+	entry = fr_hash_table_find(cache->ht, &find);
+	if (entry) {
+		if (entry->expires <= fr_time()) {
+			tls_verify_cache_entry_free(cache, entry);
+		} else {
+			found = (fr_pair_list_copy(ctx, out, &entry->pairs) >= 0);
+		}
+	}
+
+	pthread_mutex_unlock(&cache->mutex);
+
+	return found;
+}
 
 /** Check to see if a verification operation should apply to a certificate
  *
@@ -63,6 +285,112 @@ bool verify_applies(fr_tls_verify_mode_t mode, int depth, int untrusted)
 	return false;
 }
 
+/** Complete validation of the leaf certificate
+ *
+ * Calls the `verify certificate { ... }` section if one is configured,
+ * and records the result in the tls_session.
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	The current TLS session.
+ * @param[in] conf		The TLS configuration.
+ * @param[in] x509_ctx		containing the chain being verified.
+ * @param[in] my_ok		Result of verifying the chain so far.
+ * @return
+ *	- 0 if not valid.
+ *	- 1 if valid.
+ */
+static int tls_verify_leaf_done(request_t *request, fr_tls_session_t *tls_session, fr_tls_conf_t *conf,
+				X509_STORE_CTX *x509_ctx, int my_ok)
+{
+	/*
+	 *	This is a client cert, call our
+	 *	virtual server here.
+	 */
+	if (conf->virtual_server && tls_session->verify_client_cert) {
+		RDEBUG2("Requesting certificate validation");
+
+		/*
+		 *	This sets the validation state of the tls_session
+		 *	so that when we call ASYNC_pause_job(), and execution
+		 *	jumps back to tls_session_async_handshake_cont
+		 *	(just under SSL_read())
+		 *	the code there knows what job it needs to push onto
+		 *	the unlang stack.
+		 */
+		fr_tls_verify_client_cert_request(tls_session, SSL_session_reused(tls_session->ssl));
+
+		ASYNC_pause_job();	/* Jumps back to SSL_read() in session.c */
+
+		/*
+		 *	Just try and bail out as quickly as possible.
+		 */
+		if (unlang_request_is_cancelled(request)) {
+			X509_STORE_CTX_set_error(x509_ctx, 0);
+			fr_tls_verify_client_cert_reset(tls_session);
+			return 1;
+		}
+
+
+		/*
+		 *	If we couldn't validate the client certificate
+		 *	then validation overall fails.
+		 */
+		if (!fr_tls_verify_client_cert_result(tls_session)) {
+			REDEBUG("Certificate validation failed");
+			my_ok = 0;
+			X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_APPLICATION_VERIFICATION);
+		}
+	}
+
+	tls_session->client_cert_ok = (my_ok > 0);
+	RDEBUG2("[verify] = %s", my_ok ? "ok" : "invalid");
+
+	return my_ok;
+}
+
+/** Check a certificate against the indexed revocation lists
+ *
+ * @param[in] request		The current request.
+ * @param[in] conf		The TLS configuration.
+ * @param[in] x509_ctx		containing the chain being verified.
+ * @param[in] cert		to check.
+ * @param[in] depth		of the certificate in the chain.
+ * @param[in] untrusted		The number of untrusted certificates.
+ * @return
+ *	- 0 if the certificate should be accepted.
+ *	- -1 if the certificate has been revoked.
+ */
+static int tls_verify_crl(request_t *request, fr_tls_conf_t *conf, X509_STORE_CTX *x509_ctx,
+			  X509 *cert, int depth, int untrusted)
+{
+	int err;
+
+	switch (fr_tls_crl_check(conf->verify.crl, cert)) {
+	case FR_TLS_CRL_GOOD:
+		return 0;
+
+	case FR_TLS_CRL_REVOKED:
+		err = X509_V_ERR_CERT_REVOKED;
+		break;
+
+	case FR_TLS_CRL_EXPIRED:
+	default:
+		if (conf->verify.allow_expired_crl) return 0;
+		err = X509_V_ERR_CRL_HAS_EXPIRED;
+		break;
+	}
+
+	if (!verify_applies(conf->verify.mode, depth, untrusted)) {
+		RDEBUG2("Ignoring verification error - %s (%i)", X509_verify_cert_error_string(err), err);
+		return 0;
+	}
+
+	RERROR("Verification error - %s (%i)", X509_verify_cert_error_string(err), err);
+	X509_STORE_CTX_set_error(x509_ctx, err);
+
+	return -1;
+}
+
 DIAG_OFF(DIAG_UNKNOWN_PRAGMAS)
 DIAG_OFF(used-but-marked-unused)	/* fix spurious warnings for sk macros */
 /** Validates a certificate using custom logic
@@ -161,6 +489,11 @@ int fr_tls_verify_cert_cb(int ok, X509_STORE_CTX *x509_ctx)
 		}
 	}
 
+	if (conf->verify.crl && (tls_verify_crl(request, conf, x509_ctx, cert, depth, untrusted) < 0)) {
+		my_ok = 0;
+		goto done;
+	}
+
 	if (verify_applies(conf->verify.pair_mode, depth, untrusted) &&
 	    (!(container = fr_pair_find_by_da(&request->session_state_pairs, attr_tls_certificate, depth)) ||
 	     fr_pair_list_empty(&container->vp_group))) {
@@ -208,49 +541,21 @@ int fr_tls_verify_cert_cb(int ok, X509_STORE_CTX *x509_ctx)
 		log_request_pair(L_DBG_LVL_2, request, NULL, container, "&session-state.");
 	}
 done:
-	/*
-	 *	This is a client cert, call our
-	 *	virtual server here.
-	 */
 	if (depth == 0) {
-		if (conf->virtual_server && tls_session->verify_client_cert) {
-			RDEBUG2("Requesting certificate validation");
-
-			/*
-			 *	This sets the validation state of the tls_session
-			 *	so that when we call ASYNC_pause_job(), and execution
-			 *	jumps back to tls_session_async_handshake_cont
-			 *	(just under SSL_read())
-			 *	the code there knows what job it needs to push onto
-			 *	the unlang stack.
-			 */
-			fr_tls_verify_client_cert_request(tls_session, SSL_session_reused(tls_session->ssl));
-
-			ASYNC_pause_job();	/* Jumps back to SSL_read() in session.c */
-
-			/*
-			 *	Just try and bail out as quickly as possible.
-			 */
-			if (unlang_request_is_cancelled(request)) {
-				X509_STORE_CTX_set_error(x509_ctx, 0);
-				fr_tls_verify_client_cert_reset(tls_session);
-				return 1;
-			}
-
+		/*
+		 *	Every certificate in the chain has been
+		 *	checked, record the result before policy
+		 *	gets a say.
+		 */
+		if (my_ok && conf->verify.cache) {
+			uint8_t id[SHA256_DIGEST_LENGTH];
 
-			/*
-			 *	If we couldn't validate the client certificate
-			 *	then validation overall fails.
-			 */
-			if (!fr_tls_verify_client_cert_result(tls_session)) {
-				REDEBUG("Certificate validation failed");
-				my_ok = 0;
-				X509_STORE_CTX_set_error(x509_ctx, X509_V_ERR_APPLICATION_VERIFICATION);
+			if (tls_verify_cache_id(id, x509_ctx) == 0) {
+				tls_verify_cache_store(conf->verify.cache, id, cert, &request->session_state_pairs);
 			}
 		}
 
-		tls_session->client_cert_ok = (my_ok > 0);
-		RDEBUG2("[verify] = %s", my_ok ? "ok" : "invalid");
+		my_ok = tls_verify_leaf_done(request, tls_session, conf, x509_ctx, my_ok);
 	}
 
 	return my_ok;
@@ -258,6 +563,75 @@ done:
 DIAG_ON(used-but-marked-unused)
 DIAG_ON(DIAG_UNKNOWN_PRAGMAS)
 
+/** Verifies a certificate chain, using the results of previous verifications where possible
+ *
+ * Installed with SSL_CTX_set_cert_verify_callback() when the verification
+ * cache is enabled, and called by OpenSSL in place of X509_verify_cert().
+ *
+ * If an identical chain was recently verified, the chain building, signature
+ * and CRL checks, and the conversion of the certificates to attributes are
+ * all skipped.  The `verify certificate { ... }` section is still called.
+ *
+ * @param[in] x509_ctx	containing certs to verify.
+ * @param[in] arg	UNUSED.
+ * @return
+ *	- 0 if not valid.
+ *	- 1 if valid.
+ */
+int fr_tls_verify_cache_cb(X509_STORE_CTX *x509_ctx, UNUSED void *arg)
+{
+	SSL			*ssl;
+	fr_tls_session_t	*tls_session;
+	fr_tls_conf_t		*conf;
+	request_t		*request;
+	uint8_t			id[SHA256_DIGEST_LENGTH];
+	fr_pair_list_t		pairs;
+
+	ssl = X509_STORE_CTX_get_ex_data(x509_ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
+	conf = fr_tls_session_conf(ssl);
+	tls_session = talloc_get_type_abort(SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TLS_SESSION), fr_tls_session_t);
+	request = fr_tls_session_request(tls_session->ssl);
+
+	if (!conf->verify.cache || unlang_request_is_cancelled(request) ||
+	    (tls_verify_cache_id(id, x509_ctx) < 0)) return X509_verify_cert(x509_ctx);
+
+	fr_pair_list_init(&pairs);
+	if (!tls_verify_cache_load(request->session_state_ctx, &pairs, conf->verify.cache, id)) {
+		return X509_verify_cert(x509_ctx);
+	}
+
+	/*
+	 *	Revocation is always checked, so that a CRL update
+	 *	takes effect immediately.
+	 */
+	if (conf->verify.crl) {
+		STACK_OF(X509)	*chain = X509_STORE_CTX_get0_untrusted(x509_ctx);
+		X509		*cert = X509_STORE_CTX_get0_cert(x509_ctx);
+		int		i, num = chain ? sk_X509_num(chain) : 0;
+
+		if (tls_verify_crl(request, conf, x509_ctx, cert, 0, num) < 0) {
+		revoked:
+			fr_pair_list_free(&pairs);
+			return tls_verify_leaf_done(request, tls_session, conf, x509_ctx, 0);
+		}
+
+		for (i = 0; i < num; i++) {
+			X509 *this_cert = sk_X509_value(chain, i);
+
+			if (X509_cmp(this_cert, cert) == 0) continue;
+			if (tls_verify_crl(request, conf, x509_ctx, this_cert, 1, num) < 0) goto revoked;
+		}
+	}
+
+	RDEBUG2("Certificate chain previously verified, using cached result");
+
+	fr_pair_delete_by_da(&request->session_state_pairs, attr_tls_certificate);
+	fr_pair_list_append(&request->session_state_pairs, &pairs);
+	X509_STORE_CTX_set_error(x509_ctx, X509_V_OK);
+
+	return tls_verify_leaf_done(request, tls_session, conf, x509_ctx, 1);
+}
+
 /** Revalidates the client's certificate chain
  *
  * Wraps the fr_tls_verify_cert_cb callback, allowing us to use the same
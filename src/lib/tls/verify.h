@@ -74,8 +74,12 @@ typedef struct {
 extern "C" {
 #endif
 
+fr_tls_verify_cache_t	*fr_tls_verify_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries, fr_time_delta_t lifetime);
+
 int		fr_tls_verify_cert_cb(int ok, X509_STORE_CTX *ctx);
 
+int		fr_tls_verify_cache_cb(X509_STORE_CTX *ctx, void *arg);
+
 int		fr_tls_verify_client_cert_chain(request_t *request, SSL *ssl);
 
 bool		fr_tls_verify_client_cert_result(fr_tls_session_t *tls_session);
@@ -1779,6 +1779,23 @@ static unlang_t *compile_children(unlang_group_t *g, unlang_compile_t *unlang_ct
 		}
 	}
 
+	/*
+	 *	Resolve where each "if" and "elsif" jumps to when
+	 *	it's taken, so that the interpreter doesn't have to
+	 *	walk over the rest of the chain at run time.
+	 */
+	for (single = g->children; single; single = single->next) {
+		unlang_t *end;
+
+		if ((single->type != UNLANG_TYPE_IF) && (single->type != UNLANG_TYPE_ELSIF)) continue;
+
+		for (end = single->next;
+		     end && ((end->type == UNLANG_TYPE_ELSE) || (end->type == UNLANG_TYPE_ELSIF));
+		     end = end->next);
+
+		unlang_group_to_cond(unlang_generic_to_group(single))->chain_end = end;
+	}
+
 	/*
 	 *	Set the default actions, if they haven't already been
 	 *	set by an "actions" section above.
@@ -1869,6 +1886,58 @@ static int case_to_key(uint8_t **out, size_t *outlen, void const *data)
 
 static unlang_t *compile_case(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs);
 
+/** Build a jump table for switch statements over small ranges of integer values
+ *
+ * Enumerated attributes such as Service-Type or NAS-Port-Type usually
+ * have a handful of 'case' statements with values close together.
+ * For those we can index an array directly, instead of hashing the
+ * value and comparing it against the 'case' entries.
+ *
+ * The htrie is still built and used for everything else.
+ *
+ * @param[in] gext	switch to build the table for.
+ * @return
+ *	- 0 on success, or if no table was needed.
+ *	- -1 on allocation failure.
+ */
+static int compile_switch_jump(unlang_switch_t *gext)
+{
+	unlang_group_t	*g = unlang_switch_to_group(gext);
+	unlang_t	*single;
+	int64_t		value, min = 0, max = 0;
+	bool		first = true;
+
+	for (single = g->children; single; single = single->next) {
+		unlang_case_t *case_gext = unlang_group_to_case(unlang_generic_to_group(single));
+
+		if (!case_gext->vpt) continue;
+
+		if (unlang_switch_jump_value(&value, tmpl_value(case_gext->vpt)) < 0) return 0;
+
+		if (first || (value < min)) min = value;
+		if (first || (value > max)) max = value;
+		first = false;
+	}
+
+	if (first || ((uint64_t)(max - min) >= UNLANG_SWITCH_JUMP_MAX)) return 0;
+
+	gext->jump_min = min;
+	gext->jump_len = (size_t)(max - min) + 1;
+	gext->jump = talloc_zero_array(gext, unlang_t *, gext->jump_len);
+	if (!gext->jump) return -1;
+
+	for (single = g->children; single; single = single->next) {
+		unlang_case_t *case_gext = unlang_group_to_case(unlang_generic_to_group(single));
+
+		if (!case_gext->vpt) continue;
+
+		(void) unlang_switch_jump_value(&value, tmpl_value(case_gext->vpt));
+		gext->jump[value - min] = single;
+	}
+
+	return 0;
+}
+
 static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs)
 {
 	CONF_ITEM		*ci;
@@ -2092,6 +2161,13 @@ static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx,
 		g->num_children++;
 	}
 
+	if (tmpl_is_attr(gext->vpt) && !gext->vpt->cast &&
+	    (compile_switch_jump(gext) < 0)) {
+		cf_log_err(cs, "Failed initializing internal data structures");
+		talloc_free(g);
+		return NULL;
+	}
+
 	compile_action_defaults(c, unlang_ctx);
 
 	return c;
@@ -2511,6 +2587,7 @@ static unlang_t *compile_if_subsection(unlang_t *parent, unlang_compile_t *unlan
 		}
 
 		fr_cond_async_update(cond);
+		fr_cond_cmp_bind(cond);
 		c = compile_section(parent, unlang_ctx, cs, ext);
 	}
 	if (!c) return NULL;
@@ -2794,6 +2871,7 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 
 	bool				clone = true;
 	bool				detach = false;
+	bool				merge = false;
 
 	static unlang_ext_t const 	parallel_ext = {
 						.type = UNLANG_TYPE_PARALLEL,
@@ -2817,6 +2895,10 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 		} else if (strcmp(name2, "detach") == 0) {
 			detach = true;
 
+		} else if (strcmp(name2, "merge") == 0) {
+			clone = false;
+			merge = true;
+
 		} else {
 			cf_log_err(cs, "Invalid argument '%s'", name2);
 			return NULL;
@@ -2839,6 +2921,7 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 	gext = unlang_group_to_parallel(g);
 	gext->clone = clone;
 	gext->detach = detach;
+	gext->merge = merge;
 
 	return c;
 }
@@ -3458,6 +3541,22 @@ static unlang_t *compile_module(unlang_t *parent, unlang_compile_t *unlang_ctx,
 	single->instance = inst;
 	single->method = method;
 
+	/*
+	 *	The method names are only known here, so
+	 *	this is where the call accounting is set up.
+	 */
+	{
+		int idx;
+
+		idx = module_stats_method(inst, unlang_ctx->section_name1, unlang_ctx->section_name2);
+		if (idx < 0) {
+			cf_log_perr(ci, "Failed allocating statistics for module \"%s\"", inst->name);
+			talloc_free(single);
+			return NULL;
+		}
+		single->stats_idx = idx;
+	}
+
 	c = unlang_module_to_generic(single);
 	c->parent = parent;
 	c->next = NULL;
@@ -63,12 +63,12 @@ static unlang_action_t unlang_if(rlm_rcode_t *p_result, request_t *request, unla
 	/*
 	 *	Tell the main interpreter to skip over the else /
 	 *	elsif blocks, as this "if" condition was taken.
+	 *
+	 *	The end of the chain is resolved when the policy is
+	 *	compiled.  If we were pushed without siblings, there's
+	 *	nothing to skip.
 	 */
-	while (frame->next &&
-	       ((frame->next->type == UNLANG_TYPE_ELSE) ||
-		(frame->next->type == UNLANG_TYPE_ELSIF))) {
-		frame->next = frame->next->next;
-	}
+	if (frame->next) frame->next = gext->chain_end;
 
 	/*
 	 *	We took the "if".  Go recurse into its' children.
@@ -32,6 +32,7 @@ extern "C" {
 typedef struct {
 	unlang_group_t	group;
 	fr_cond_t	*cond;
+	unlang_t	*chain_end;	//!< First instruction after this if/elsif/else chain.
 } unlang_cond_t;
 
 /** Cast a group structure to the cond keyword extension
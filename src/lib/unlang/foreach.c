@@ -49,11 +49,16 @@ static int xlat_foreach_inst[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };	/* up to 10 f
  */
 typedef struct {
 	request_t		*request;			//!< The current request.
+	fr_value_box_t		*values;			//!< Snapshot of the values we're iterating over.
+								///< Used for leaf attributes.
+	size_t			num_values;			//!< How many entries there are in values.
+	size_t			idx;				//!< Next entry in values.
 	fr_dcursor_t		cursor;				//!< Used to track our place in the list
 								///< we're iterating over.
 	fr_pair_list_t 		vps;				//!< List containing the attribute(s) we're
-								///< iterating over.
-	fr_pair_t		*variable;			//!< Attribute we update the value of.
+								///< iterating over.  Only used if the
+								///< attributes are structural.
+	fr_value_box_t		*variable;			//!< Value Foreach-Variable-N expands to.
 	int			depth;				//!< Level of nesting of this foreach loop.
 #ifndef NDEBUG
 	int			indent;				//!< for catching indentation issues
@@ -78,32 +83,40 @@ static int _free_unlang_frame_state_foreach(unlang_frame_state_foreach_t *state)
 
 static unlang_action_t unlang_foreach_next(rlm_rcode_t *p_result, request_t *request, unlang_stack_frame_t *frame)
 {
-	fr_pair_t			*vp;
+	fr_value_box_t			*vb;
 	unlang_frame_state_foreach_t	*foreach = talloc_get_type_abort(frame->state, unlang_frame_state_foreach_t);
 	unlang_group_t			*g = unlang_generic_to_group(frame->instruction);
-	vp = fr_dcursor_current(&foreach->cursor);
-	if (!vp) {
+
+	if (foreach->values) {
+		vb = (foreach->idx < foreach->num_values) ? &foreach->values[foreach->idx++] : NULL;
+	} else {
+		fr_pair_t *vp;
+
+		vp = fr_dcursor_current(&foreach->cursor);
+		if (vp) {
+			(void) fr_dcursor_next(&foreach->cursor);
+			vb = &vp->data;
+		} else {
+			vb = NULL;
+		}
+	}
+
+	if (!vb) {
 		*p_result = frame->result;
 #ifndef NDEBUG
 		fr_assert(foreach->indent == request->log.unlang_indent);
 #endif
 		return UNLANG_ACTION_CALCULATE_RESULT;
 	}
-	(void) fr_dcursor_next(&foreach->cursor);
 
 #ifndef NDEBUG
-	RDEBUG2("# looping with: Foreach-Variable-%d = %pV", foreach->depth, &vp->data);
+	RDEBUG2("# looping with: Foreach-Variable-%d = %pV", foreach->depth, vb);
 #endif
 
-	fr_assert(vp);
-
 	/*
-	 *	Add the vp to the request, so that
-	 *	xlat.c, xlat_foreach() can find it.
+	 *	Update the value xlat_foreach() will find.
 	 */
-	foreach->variable = vp;
-	request_data_add(request, FOREACH_REQUEST_DATA, foreach->depth, &foreach->variable,
-			 false, false, false);
+	foreach->variable = vb;
 
 	/*
 	 *	Push the child, and yield for a later return.
@@ -118,6 +131,72 @@ static unlang_action_t unlang_foreach_next(rlm_rcode_t *p_result, request_t *req
 	return UNLANG_ACTION_PUSHED_CHILD;
 }
 
+/** Take a snapshot of the values of leaf attributes matching the foreach tmpl
+ *
+ * The loop needs to be isolated from changes the body makes to the attributes
+ * we're iterating over.  For leaf attributes only the values are needed, so
+ * these are copied into a single array which shares a pool with the frame
+ * state, instead of duplicating every pair.
+ *
+ * @return
+ *	- 1 if the attributes were copied to foreach->values.
+ *	- 0 if one or more of the attributes is structural.
+ *	- -1 if there are no matching attributes.
+ */
+static int unlang_foreach_values(unlang_frame_state_foreach_t **out, request_t *request, tmpl_t const *vpt)
+{
+	unlang_frame_state_foreach_t	*foreach;
+	fr_pair_t			*vp;
+	fr_dcursor_t			cursor;
+	tmpl_pair_cursor_ctx_t		cc;
+	size_t				num = 0, num_buffers = 0, buffers_len = 0, i = 0;
+	int				err;
+
+	for (vp = tmpl_pair_cursor_init(&err, NULL, &cc, &cursor, request, vpt);
+	     vp;
+	     vp = fr_dcursor_next(&cursor)) {
+		switch (vp->da->type) {
+		case FR_TYPE_STRUCTURAL:
+			tmpl_pair_cursor_clear(&cc);
+			return 0;
+
+		case FR_TYPE_STRING:
+		case FR_TYPE_OCTETS:
+			num_buffers++;
+			buffers_len += vp->vp_length + 1;
+			break;
+
+		default:
+			break;
+		}
+		num++;
+	}
+	tmpl_pair_cursor_clear(&cc);
+
+	if (!num) return -1;
+
+	MEM(foreach = talloc_zero_pooled_object(request->stack, unlang_frame_state_foreach_t,
+						1 + num_buffers, (sizeof(fr_value_box_t) * num) + buffers_len));
+	MEM(foreach->values = talloc_zero_array(foreach, fr_value_box_t, num));
+
+	for (vp = tmpl_pair_cursor_init(&err, NULL, &cc, &cursor, request, vpt);
+	     vp && (i < num);
+	     vp = fr_dcursor_next(&cursor)) {
+		if (unlikely(fr_value_box_copy(foreach, &foreach->values[i], &vp->data) < 0)) {
+			tmpl_pair_cursor_clear(&cc);
+			talloc_free(foreach);
+			return -1;
+		}
+		i++;
+	}
+	tmpl_pair_cursor_clear(&cc);
+
+	foreach->num_values = i;
+	fr_pair_list_init(&foreach->vps);
+	*out = foreach;
+
+	return 1;
+}
 
 static unlang_action_t unlang_foreach(rlm_rcode_t *p_result, request_t *request, unlang_stack_frame_t *frame)
 {
@@ -152,28 +231,53 @@ static unlang_action_t unlang_foreach(rlm_rcode_t *p_result, request_t *request,
 		return UNLANG_ACTION_CALCULATE_RESULT;
 	}
 
-	MEM(frame->state = foreach = talloc_zero(request->stack, unlang_frame_state_foreach_t));
-	fr_pair_list_init(&foreach->vps);
-
 	/*
-	 *	Copy the VPs from the original request, this ensures deterministic
+	 *	Copy the values from the original request, this ensures deterministic
 	 *	behaviour if someone decides to add or remove VPs in the set we're
 	 *	iterating over.
 	 */
-	if (tmpl_copy_pairs(frame->state, &vps, request, gext->vpt) < 0) {	/* nothing to loop over */
+	switch (unlang_foreach_values(&foreach, request, gext->vpt)) {
+	case 1:
+		frame->state = foreach;
+		break;
+
+	case 0:
+		/*
+		 *	Structural attributes, copy the pairs.
+		 */
+		MEM(frame->state = foreach = talloc_zero(request->stack, unlang_frame_state_foreach_t));
+		fr_pair_list_init(&foreach->vps);
+
+		if (tmpl_copy_pairs(frame->state, &vps, request, gext->vpt) < 0) {	/* nothing to loop over */
+			*p_result = RLM_MODULE_NOOP;
+			return UNLANG_ACTION_CALCULATE_RESULT;
+		}
+
+		fr_assert(!fr_pair_list_empty(&vps));
+
+		fr_pair_list_append(&foreach->vps, &vps);
+		fr_dcursor_talloc_init(&foreach->cursor, &foreach->vps, fr_pair_t);
+		break;
+
+	default:	/* nothing to loop over */
 		*p_result = RLM_MODULE_NOOP;
 		return UNLANG_ACTION_CALCULATE_RESULT;
 	}
 
-	fr_assert(!fr_pair_list_empty(&vps));
-
 	foreach->request = request;
 	foreach->depth = foreach_depth;
-	fr_pair_list_append(&foreach->vps, &vps);
-	fr_dcursor_talloc_init(&foreach->cursor, &foreach->vps, fr_pair_t);
 #ifndef NDEBUG
 	foreach->indent = request->log.unlang_indent;
 #endif
+
+	/*
+	 *	Add the variable to the request, so that
+	 *	xlat.c, xlat_foreach() can find it.  This only
+	 *	needs doing once, as the address doesn't change
+	 *	between iterations.
+	 */
+	request_data_add(request, FOREACH_REQUEST_DATA, foreach->depth, &foreach->variable,
+			 false, false, false);
 	talloc_set_destructor(foreach, _free_unlang_frame_state_foreach);
 
 	frame->process = unlang_foreach_next;
@@ -201,15 +305,15 @@ static xlat_action_t unlang_foreach_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out, req
 					 void const *xlat_inst, UNUSED void *xlat_thread_inst,
 					 UNUSED fr_value_box_list_t *in)
 {
-	fr_pair_t			**pvp;
+	fr_value_box_t			**pvb;
 	int const			*inst = xlat_inst;
 	fr_value_box_t			*vb;
 
-	pvp = (fr_pair_t **) request_data_reference(request, FOREACH_REQUEST_DATA, *inst);
-	if (!pvp || !*pvp) return XLAT_ACTION_FAIL;
+	pvb = (fr_value_box_t **) request_data_reference(request, FOREACH_REQUEST_DATA, *inst);
+	if (!pvb || !*pvb) return XLAT_ACTION_FAIL;
 
 	MEM(vb = fr_value_box_alloc_null(ctx));
-	fr_value_box_copy(ctx, vb, &(*pvp)->data);
+	fr_value_box_copy(ctx, vb, *pvb);
 	fr_dcursor_append(out, vb);
 	return XLAT_ACTION_DONE;
 }
@@ -55,6 +55,72 @@ static fr_table_num_ordered_t const unlang_frame_action_table[] = {
 };
 static size_t unlang_frame_action_table_len = NUM_ELEMENTS(unlang_frame_action_table);
 
+static fr_table_num_ordered_t const unlang_trace_event_table[] = {
+	{ L("enter"),		UNLANG_TRACE_ENTER		},
+	{ L("exit"),		UNLANG_TRACE_EXIT		},
+	{ L("yield"),		UNLANG_TRACE_YIELD		},
+	{ L("resume"),		UNLANG_TRACE_RESUME		}
+};
+static size_t unlang_trace_event_table_len = NUM_ELEMENTS(unlang_trace_event_table);
+
+/** Record a trace event, if the request is being traced
+ *
+ * @param[in] stack		of the request.
+ * @param[in] type		of event.
+ * @param[in] instruction	the event is for.
+ * @param[in] rcode		of the instruction, for exit events.
+ */
+static inline CC_HINT(always_inline)
+void trace_record(unlang_stack_t *stack, unlang_trace_event_type_t type,
+		  unlang_t const *instruction, rlm_rcode_t rcode)
+{
+	unlang_trace_t	*trace = stack->trace;
+
+	if (likely(!trace)) return;
+
+	if (trace->num_events >= UNLANG_TRACE_MAX) {
+		trace->dropped++;
+		return;
+	}
+
+	trace->event[trace->num_events++] = (unlang_trace_event_t){
+		.instruction = instruction,
+		.when = fr_time(),
+		.type = type,
+		.depth = stack->depth,
+		.rcode = rcode
+	};
+}
+
+/** Write out the trace events for a request, and stop tracing
+ *
+ * @param[in] request	which was traced.
+ * @param[in] stack	of the request.
+ */
+static void trace_emit(request_t *request, unlang_stack_t *stack)
+{
+	unlang_trace_t	*trace = stack->trace;
+	uint32_t	i;
+
+	RINFO("Trace - %u events, %u dropped, %" PRId64 "us total", trace->num_events, trace->dropped,
+	      fr_time_delta_to_usec(fr_time() - trace->start));
+
+	for (i = 0; i < trace->num_events; i++) {
+		unlang_trace_event_t const *ev = &trace->event[i];
+
+		RINFO("Trace - +%" PRId64 "us [%u] %s %s%s%s%s",
+		      fr_time_delta_to_usec(ev->when - trace->start),
+		      ev->depth,
+		      fr_table_str_by_value(unlang_trace_event_table, ev->type, "<INVALID>"),
+		      ev->instruction->debug_name,
+		      (ev->type == UNLANG_TRACE_EXIT) ? " (" : "",
+		      (ev->type == UNLANG_TRACE_EXIT) ? fr_table_str_by_value(mod_rcode_table, ev->rcode, "<invalid>") : "",
+		      (ev->type == UNLANG_TRACE_EXIT) ? ")" : "");
+	}
+
+	TALLOC_FREE(stack->trace);
+}
+
 #ifndef NDEBUG
 static void instruction_dump(request_t *request, unlang_t const *instruction)
 {
@@ -351,6 +417,9 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 		if (is_yielded(frame)) {
 			RDEBUG("%s - Resuming execution", instruction->debug_name);
 			yielded_clear(frame);
+			trace_record(stack, UNLANG_TRACE_RESUME, instruction, RLM_MODULE_NOT_SET);
+		} else if (!is_repeatable(frame)) {
+			trace_record(stack, UNLANG_TRACE_ENTER, instruction, RLM_MODULE_NOT_SET);
 		}
 
 		/*
@@ -439,6 +508,7 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 		 */
 		case UNLANG_ACTION_YIELD:
 			yielded_set(frame);
+			trace_record(stack, UNLANG_TRACE_YIELD, instruction, frame->result);
 			RDEBUG4("** [%i] %s - yielding with current (%s %d)", stack->depth, __FUNCTION__,
 				fr_table_str_by_value(mod_rcode_table, frame->result, "<invalid>"),
 				frame->priority);
@@ -459,6 +529,8 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 		 *	the section rcode and priority.
 		 */
 		case UNLANG_ACTION_CALCULATE_RESULT:
+			trace_record(stack, UNLANG_TRACE_EXIT, instruction, *result);
+
 			if (unlang_ops[instruction->type].debug_braces) {
 				REXDENT();
 
@@ -593,6 +665,8 @@ CC_HINT(hot) rlm_rcode_t unlang_interpret(request_t *request)
 				continue;
 			}
 
+			trace_record(stack, UNLANG_TRACE_EXIT, frame->instruction, stack->result);
+
 			/*
 			 *	Close out the section we entered earlier
 			 */
@@ -808,6 +882,8 @@ void unlang_interpret_request_done(request_t *request)
 
 	intp = stack->intp;
 
+	if (unlikely(stack->trace != NULL)) trace_emit(request, stack);
+
 	switch (request->type) {
 	case REQUEST_TYPE_EXTERNAL:
 		intp->funcs.done_external(request, stack->result, intp->uctx);
@@ -1101,6 +1177,73 @@ TALLOC_CTX *unlang_interpret_frame_talloc_ctx(request_t *request)
 	return (TALLOC_CTX *)request;
 }
 
+/** Start recording trace events for a request
+ *
+ * Events are recorded into a fixed size per-request buffer as the
+ * request is evaluated, and are only formatted and logged when the
+ * request is done.  This is much cheaper than request debugging, so
+ * it can be left enabled for a sample of production traffic.
+ *
+ * @param[in] request	to trace.
+ * @return
+ *	- 0 on success (or if the request is already being traced).
+ *	- -1 on failure.
+ */
+int unlang_interpret_trace_start(request_t *request)
+{
+	unlang_stack_t	*stack = request->stack;
+
+	if (stack->trace) return 0;
+
+	stack->trace = talloc_zero(request, unlang_trace_t);
+	if (!stack->trace) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+	stack->trace->start = fr_time();
+
+	return 0;
+}
+
+static xlat_arg_parser_t const unlang_interpret_trace_xlat_args[] = {
+	{ .single = true, .type = FR_TYPE_UINT32 },
+	XLAT_ARG_PARSER_TERMINATOR
+};
+
+/** Start tracing the current request
+ *
+ * Takes an optional percentage.  If given, the request is only traced
+ * that percentage of the time.
+ *
+ * Example:
+@verbatim
+"%(interpreter_trace:5)" == yes
+@endverbatim
+ *
+ * @ingroup xlat_functions
+ */
+static xlat_action_t unlang_interpret_trace_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out, request_t *request,
+						 UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
+						 fr_value_box_list_t *in)
+{
+	fr_value_box_t	*arg = fr_dlist_head(in);
+	fr_value_box_t	*vb;
+	bool		sampled = true;
+
+	if (arg && (arg->vb_uint32 < 100)) sampled = ((fr_rand() % 100) < arg->vb_uint32);
+
+	if (sampled && (unlang_interpret_trace_start(request) < 0)) {
+		RPEDEBUG("Failed starting trace");
+		return XLAT_ACTION_FAIL;
+	}
+
+	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_BOOL, NULL, false));
+	vb->vb_bool = sampled;
+	fr_dcursor_append(out, vb);
+
+	return XLAT_ACTION_DONE;
+}
+
 static xlat_arg_parser_t const unlang_interpret_xlat_args[] = {
 	{ .required = true, .single = true, .type = FR_TYPE_STRING },
 	XLAT_ARG_PARSER_TERMINATOR
@@ -1317,4 +1460,7 @@ void unlang_interpret_init_global(void)
 	xlat_t	*xlat;
 	xlat = xlat_register(NULL, "interpreter", unlang_interpret_xlat, false);
 	xlat_func_args(xlat, unlang_interpret_xlat_args);
+
+	xlat = xlat_register(NULL, "interpreter_trace", unlang_interpret_trace_xlat, false);
+	xlat_func_args(xlat, unlang_interpret_trace_xlat_args);
 }
@@ -165,6 +165,8 @@ void			unlang_interpret_stack_result_set(request_t *request, rlm_rcode_t code);
 
 TALLOC_CTX		*unlang_interpret_frame_talloc_ctx(request_t *request);
 
+int			unlang_interpret_trace_start(request_t *request);
+
 void			unlang_interpret_init_global(void);
 #ifdef __cplusplus
 }
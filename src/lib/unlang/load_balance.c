@@ -31,6 +31,48 @@
 
 #define unlang_redundant_load_balance unlang_load_balance
 
+/** Choose the child module which says it's the cheapest to call
+ *
+ * Only used when every child is a module call which exports a cost
+ * callback, e.g. a set of rlm_radius instances.  Ties are broken
+ * randomly, so that equally good children share the load.
+ *
+ * @return
+ *	- The chosen child.
+ *	- NULL if the children can't be compared.
+ */
+static unlang_t *load_balance_cheapest(unlang_group_t *g)
+{
+	unlang_t	*child, *found = NULL;
+	uint64_t	best = UINT64_MAX;
+	uint32_t	ties = 0;
+
+	for (child = g->children; child != NULL; child = child->next) {
+		unlang_module_t	*mc;
+		uint64_t	cost;
+
+		if (child->type != UNLANG_TYPE_MODULE) return NULL;
+
+		mc = unlang_generic_to_module(child);
+		if (!mc->instance->module->cost) return NULL;
+
+		cost = mc->instance->module->cost(mc->instance->dl_inst->data, module_thread(mc->instance)->data);
+		if (!found || (cost < best)) {
+			found = child;
+			best = cost;
+			ties = 1;
+			continue;
+		}
+
+		if (cost > best) continue;
+
+		ties++;
+		if ((ties * (fr_rand() & 0xffffff)) < (uint32_t) 0x1000000) found = child;
+	}
+
+	return found;
+}
+
 static unlang_action_t unlang_load_balance_next(rlm_rcode_t *p_result, request_t *request,
 						unlang_stack_frame_t *frame)
 {
@@ -194,6 +236,9 @@ static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *req
 			}
 		}
 
+	} else if ((redundant->found = load_balance_cheapest(g)) != NULL) {
+		RDEBUG3("load-balance chose %s, which has the lowest cost", redundant->found->debug_name);
+
 	} else {
 	randomly_choose:
 		count = 0;
@@ -31,6 +31,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/request_data.h>
 #include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/probe.h>
 
 #include "module_priv.h"
 #include "subrequest_priv.h"
@@ -578,6 +579,95 @@ unlang_action_t unlang_module_yield(request_t *request,
 	return UNLANG_ACTION_YIELD;
 }
 
+/** State for a blocking call running on an offload helper thread
+ *
+ */
+typedef struct {
+	fr_offload_job_t	*job;		//!< The blocking call.
+	void			*uctx;		//!< Owned by the job until it completes.
+	unlang_module_resume_t	resume;		//!< The module's resume function.
+} unlang_module_offload_t;
+
+/** The blocking call has completed
+ *
+ * Take uctx back from the job, so that it lives as long as the frame
+ * does.  The module's resume function can then yield again if it needs to.
+ */
+static unlang_action_t unlang_module_offload_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+						    request_t *request, void *rctx)
+{
+	unlang_module_offload_t	*ctx = talloc_get_type_abort(rctx, unlang_module_offload_t);
+
+	talloc_steal(ctx, ctx->uctx);
+	TALLOC_FREE(ctx->job);
+
+	return ctx->resume(p_result, mctx, request, ctx->uctx);
+}
+
+/** The request was cancelled while the blocking call was running
+ *
+ * uctx is freed along with the job, which may happen on the helper thread.
+ */
+static void unlang_module_offload_signal(UNUSED module_ctx_t const *mctx, UNUSED request_t *request,
+					 void *rctx, fr_state_signal_t action)
+{
+	unlang_module_offload_t	*ctx = talloc_get_type_abort(rctx, unlang_module_offload_t);
+
+	if ((action != FR_SIGNAL_CANCEL) || !ctx->job) return;
+
+	fr_offload_cancel(ctx->job);
+	ctx->job = NULL;
+}
+
+/** Run a blocking call on a helper thread, and yield until it completes
+ *
+ * This lets modules which use blocking libraries avoid stalling every
+ * other request on the worker, without being rewritten as state machines.
+ * The module moves the blocking part of its method into func, and the
+ * part which processes the results into resume.
+ *
+ * func must follow the rules for #fr_offload_func_t.  In particular, it
+ * can't use the request, and so can't log against it.  Anything it needs
+ * to report should be written to uctx, and logged from resume.
+ *
+ * @note The module function which calls #unlang_module_offload should return
+ *	its result immediately, i.e. ``return unlang_module_offload(...)``.
+ *
+ * @param[out] p_result		set to RLM_MODULE_FAIL if the call can't be offloaded.
+ * @param[in] request		The current request.
+ * @param[in] ol		Helper threads to run func on.
+ * @param[in] func		The blocking call.
+ * @param[in] resume		Called with uctx once func has returned.
+ * @param[in] uctx		Passed to func and resume.  Must be a talloc chunk
+ *				with no parent.  If the request is cancelled
+ *				while func is running, it's freed when func
+ *				returns, possibly by the helper thread.
+ *				Otherwise it's freed with the module's frame.
+ * @return
+ *	- UNLANG_ACTION_YIELD on success.
+ *	- UNLANG_ACTION_CALCULATE_RESULT on failure, and uctx is freed.
+ */
+unlang_action_t unlang_module_offload(rlm_rcode_t *p_result, request_t *request, fr_offload_t *ol,
+				      fr_offload_func_t func, unlang_module_resume_t resume, void *uctx)
+{
+	unlang_module_offload_t	*ctx;
+
+	MEM(ctx = talloc_zero(unlang_interpret_frame_talloc_ctx(request), unlang_module_offload_t));
+	ctx->uctx = uctx;
+	ctx->resume = resume;
+
+	ctx->job = fr_offload_push(ol, request, func, uctx);
+	if (!ctx->job) {
+		RPERROR("Failed offloading blocking call");
+		talloc_free(uctx);
+		talloc_free(ctx);
+		*p_result = RLM_MODULE_FAIL;
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+
+	return unlang_module_yield(request, unlang_module_offload_resume, unlang_module_offload_signal, ctx);
+}
+
 /*
  *	Lock the mutex for the module
  */
@@ -632,6 +722,11 @@ static void unlang_module_signal(request_t *request, unlang_stack_frame_t *frame
 	if (action == FR_SIGNAL_CANCEL) {
 		state->thread->active_callers--;
 		state->signal = NULL;
+
+		if (state->stats) {
+			FR_STATS_COUNTER_INC(state->stats, MODULE_STATS_CANCELLED);
+			FR_STATS_COUNTER_ADD(state->stats, MODULE_STATS_WALL_NSEC, fr_time() - state->called);
+		}
 	}
 }
 
@@ -653,6 +748,11 @@ static unlang_action_t unlang_module_done(rlm_rcode_t *p_result, request_t *requ
 	RDEBUG("%s (%s)", frame->instruction->name ? frame->instruction->name : "",
 	       fr_table_str_by_value(mod_rcode_table, rcode, "<invalid>"));
 
+	if (state->stats) {
+		FR_STATS_COUNTER_INC(state->stats, MODULE_STATS_RCODE + rcode);
+		FR_STATS_COUNTER_ADD(state->stats, MODULE_STATS_WALL_NSEC, fr_time() - state->called);
+	}
+
 	request->rcode = rcode;
 	if (state->p_result) *state->p_result = rcode;	/* Inform our caller if we have one */
 	*p_result = rcode;
@@ -684,6 +784,7 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 	unlang_module_resume_t		resume;
 	char const 			*caller;
 	unlang_action_t			ua;
+	fr_time_delta_t			cpu = 0;
 
 	/*
 	 *	Update the rcode from any child calls that
@@ -711,6 +812,12 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 	 */
 	state->resume = NULL;
 
+	if (state->stats) {
+		FR_STATS_COUNTER_INC(state->stats, MODULE_STATS_RESUMES);
+		cpu = fr_time_thread_cpu();
+	}
+
+	FR_PROBE3(module_enter, request->number, mc->instance->name, 1);
 	safe_lock(mc->instance);
 	ua = resume(&state->rcode,
 		    &(module_ctx_t){
@@ -718,6 +825,9 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 			.thread = state->thread->data
 		    }, request, state->rctx);
 	safe_unlock(mc->instance);
+	FR_PROBE4(module_exit, request->number, mc->instance->name, ua, state->rcode);
+
+	if (state->stats) FR_STATS_COUNTER_ADD(state->stats, MODULE_STATS_CPU_NSEC, fr_time_thread_cpu() - cpu);
 
 	request->rcode = state->rcode;
 	request->module = caller;
@@ -733,6 +843,8 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 		return UNLANG_ACTION_STOP_PROCESSING;
 
 	case UNLANG_ACTION_YIELD:
+		if (state->stats) FR_STATS_COUNTER_INC(state->stats, MODULE_STATS_YIELDS);
+
 		/*
 		 *	The module yielded but didn't set a
 		 *	resume function, this means it's done
@@ -805,6 +917,7 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request,
 	unlang_frame_state_module_t	*state = talloc_get_type_abort(frame->state, unlang_frame_state_module_t);
 	char const 			*caller;
 	unlang_action_t			ua;
+	fr_time_delta_t			cpu = 0;
 
 	*p_result = state->rcode = RLM_MODULE_NOOP;
 	state->set_rcode = true;
@@ -829,6 +942,16 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request,
 	state->p_result = NULL;
 	fr_assert(state->thread != NULL);
 
+	/*
+	 *	Call accounting.  The wall clock time runs
+	 *	until the module returns a final result.
+	 */
+	state->stats = module_thread_stats(state->thread, mc->stats_idx);
+	if (state->stats) {
+		FR_STATS_COUNTER_INC(state->stats, MODULE_STATS_CALLS);
+		state->called = fr_time();
+	}
+
 	/*
 	 *	Return administratively configured return code
 	 */
@@ -850,6 +973,9 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request,
 
 	caller = request->module;
 	request->module = mc->instance->name;
+	if (state->stats) cpu = fr_time_thread_cpu();
+
+	FR_PROBE3(module_enter, request->number, mc->instance->name, 0);
 	safe_lock(mc->instance);	/* Noop unless instance->mutex set */
 	ua = mc->method(&state->rcode,
 			&(module_ctx_t){
@@ -858,6 +984,9 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request,
 			},
 			request);
 	safe_unlock(mc->instance);
+	FR_PROBE4(module_exit, request->number, mc->instance->name, ua, state->rcode);
+
+	if (state->stats) FR_STATS_COUNTER_ADD(state->stats, MODULE_STATS_CPU_NSEC, fr_time_thread_cpu() - cpu);
 	request->module = caller;
 
 	if (request->master_state == REQUEST_STOP_PROCESSING) ua = UNLANG_ACTION_STOP_PROCESSING;
@@ -875,6 +1004,7 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request,
 
 	case UNLANG_ACTION_YIELD:
 		state->thread->active_callers++;
+		if (state->stats) FR_STATS_COUNTER_INC(state->stats, MODULE_STATS_YIELDS);
 
 		/*
 		 *	The module yielded but didn't set a
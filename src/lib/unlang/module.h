@@ -31,6 +31,7 @@ extern "C" {
 #endif
 
 #include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/offload.h>
 #include <freeradius-devel/server/rcode.h>
 #include <freeradius-devel/unlang/subrequest.h>
 
@@ -139,6 +140,9 @@ unlang_action_t	unlang_module_yield(request_t *request,
 				    unlang_module_resume_t resume,
 				    unlang_module_signal_t signal, void *rctx);
 
+unlang_action_t	unlang_module_offload(rlm_rcode_t *p_result, request_t *request, fr_offload_t *ol,
+				      fr_offload_func_t func, unlang_module_resume_t resume, void *uctx);
+
 #ifdef __cplusplus
 }
 #endif
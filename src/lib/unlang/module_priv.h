@@ -36,6 +36,8 @@ typedef struct {
 	unlang_t			self;			//!< Common fields in all #unlang_t tree nodes.
 	module_instance_t		*instance;		//!< Global instance of the module we're calling.
 	module_method_t			method;			//!< The entry point into the module.
+	unsigned int			stats_idx;		//!< Which of the module's call accounting
+								///< counters to update.
 } unlang_module_t;
 
 /** A module stack entry
@@ -69,6 +71,13 @@ typedef struct {
 	unlang_module_resume_t		resume;			//!< resumption handler
 	unlang_module_signal_t		signal;			//!< for signal handlers
 	/** @} */
+
+	/** @name Call accounting
+	 * @{
+ 	 */
+	fr_stats_slot_t			*stats;			//!< This thread's counters for the method.
+	fr_time_t			called;			//!< When the method was called.
+	/** @} */
 } unlang_frame_state_module_t;
 
 static inline unlang_module_t *unlang_generic_to_module(unlang_t const *p)
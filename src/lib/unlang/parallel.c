@@ -187,6 +187,32 @@ static unlang_action_t unlang_parallel_child_done(UNUSED rlm_rcode_t *p_result,
 	return UNLANG_ACTION_CALCULATE_RESULT;
 }
 
+/** Move attributes from a child's list into the parent's list
+ *
+ * Attributes which the parent already has are left in the child, and
+ * are freed with it.  The check is made against the parent's list before
+ * any of this child's attributes are added, so that a child can return
+ * multiple instances of an attribute.
+ */
+static void unlang_parallel_merge_list(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t *from)
+{
+	fr_pair_list_t	merged;
+	fr_pair_t	*vp, *next;
+
+	fr_pair_list_init(&merged);
+
+	for (vp = fr_pair_list_head(from); vp; vp = next) {
+		next = fr_pair_list_next(from, vp);
+
+		if (fr_pair_find_by_da(to, vp->da, 0)) continue;
+
+		fr_pair_remove(from, vp);
+		(void) fr_pair_steal_append(ctx, &merged, vp);
+	}
+
+	fr_pair_list_append(to, &merged);
+}
+
 static unlang_action_t unlang_parallel_resume(rlm_rcode_t *p_result, request_t *request, unlang_stack_frame_t *frame)
 {
 	unlang_parallel_state_t		*state = talloc_get_type_abort(frame->state, unlang_parallel_state_t);
@@ -236,6 +262,21 @@ static unlang_action_t unlang_parallel_resume(rlm_rcode_t *p_result, request_t *
 		}
 	}
 
+	/*
+	 *	Merge the results of the children, in the order
+	 *	that they're listed, not the order that they
+	 *	finished.  So when children return the same
+	 *	attribute, the first child listed always wins.
+	 */
+	if (state->merge) for (i = 0; i < state->num_children; i++) {
+		request_t *child = state->children[i].request;
+
+		if (!child) continue;
+
+		unlang_parallel_merge_list(request->reply_ctx, &request->reply_pairs, &child->reply_pairs);
+		unlang_parallel_merge_list(request->control_ctx, &request->control_pairs, &child->control_pairs);
+	}
+
 	/*
 	 *	Reap the children....
 	 */
@@ -325,6 +366,20 @@ static unlang_action_t unlang_parallel_process(rlm_rcode_t *p_result, request_t
 
 				RETURN_MODULE_FAIL;
 			}
+
+		/*
+		 *	The children only read the request, and their
+		 *	results are merged into the parent when
+		 *	they're done.  So they don't need copies of
+		 *	anything else.
+		 */
+		} else if (state->merge) {
+			if (fr_pair_list_copy(child->request_ctx,
+					      &child->request_pairs,
+					      &request->request_pairs) < 0) {
+				REDEBUG("failed copying request list");
+				goto error;
+			}
 		}
 
 		/*
@@ -478,6 +533,7 @@ static unlang_action_t unlang_parallel(rlm_rcode_t *p_result, request_t *request
 	state->priority = -1;				/* as-yet unset */
 	state->detach = gext->detach;
 	state->clone = gext->clone;
+	state->merge = gext->merge;
 	state->num_children = g->num_children;
 
 	/*
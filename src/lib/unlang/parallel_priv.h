@@ -65,6 +65,8 @@ typedef struct {
 
 	bool				detach;		//!< are we creating the child detached
 	bool				clone;		//!< are the children cloned
+	bool				merge;		//!< merge the children's reply and control
+							///< lists back into the parent.
 
 	unlang_parallel_child_t		children[];	//!< Array of children.
 } unlang_parallel_state_t;
@@ -73,6 +75,8 @@ typedef struct {
 	unlang_group_t			group;
 	bool				detach;		//!< are we creating the child detached
 	bool				clone;
+	bool				merge;		//!< children only get the request list,
+							///< and their results are merged.
 } unlang_parallel_t;
 
 /** Cast a group structure to the parallel keyword extension
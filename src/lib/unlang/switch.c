@@ -75,6 +75,24 @@ static unlang_action_t unlang_switch(rlm_rcode_t *p_result, request_t *request,
 			box = &vp->data;
 		}
 
+		/*
+		 *	Dense integer 'case' values are looked up
+		 *	directly, without mocking up a 'case' or
+		 *	hashing the value.
+		 */
+		if (switch_gext->jump && (box->type == tmpl_da(switch_gext->vpt)->type)) {
+			int64_t value;
+
+			if (unlang_switch_jump_value(&value, box) == 0) {
+				if ((value >= switch_gext->jump_min) &&
+				    ((uint64_t)(value - switch_gext->jump_min) < switch_gext->jump_len)) {
+					found = switch_gext->jump[value - switch_gext->jump_min];
+				}
+				if (!found) found = switch_gext->default_case;
+				goto do_null_case;
+			}
+		}
+
 	/*
 	 *	Expand the template if necessary, so that it
 	 *	is evaluated once instead of for each 'case'
@@ -29,13 +29,63 @@ extern "C" {
 #include <freeradius-devel/server/tmpl.h>
 #include <freeradius-devel/util/htrie.h>
 
+/** Largest span of integer 'case' values we'll build a jump table for
+ *
+ */
+#define UNLANG_SWITCH_JUMP_MAX	(256)
+
 typedef struct {
 	unlang_group_t	group;
 	unlang_t	*default_case;
 	tmpl_t		*vpt;
 	fr_htrie_t	*ht;
+
+	unlang_t	**jump;		//!< Direct lookup table for dense integer 'case' values.
+					///< NULL entries go to the default case.
+	int64_t		jump_min;	//!< Value of the first entry in the jump table.
+	size_t		jump_len;	//!< Number of entries in the jump table.
 } unlang_switch_t;
 
+/** Get a box's value as the index type used by the jump table
+ *
+ * @param[out] out	Where to write the value.
+ * @param[in] box	to get the value of.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the box isn't a type we build jump tables for.
+ */
+static inline int unlang_switch_jump_value(int64_t *out, fr_value_box_t const *box)
+{
+	switch (box->type) {
+	case FR_TYPE_UINT8:
+		*out = box->vb_uint8;
+		return 0;
+
+	case FR_TYPE_UINT16:
+		*out = box->vb_uint16;
+		return 0;
+
+	case FR_TYPE_UINT32:
+		*out = box->vb_uint32;
+		return 0;
+
+	case FR_TYPE_INT8:
+		*out = box->vb_int8;
+		return 0;
+
+	case FR_TYPE_INT16:
+		*out = box->vb_int16;
+		return 0;
+
+	case FR_TYPE_INT32:
+		*out = box->vb_int32;
+		return 0;
+
+	default:
+		return -1;
+	}
+}
+
 /** Cast a group structure to the switch keyword extension
  *
  */
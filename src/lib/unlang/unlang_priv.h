@@ -255,6 +255,42 @@ struct unlang_stack_frame_s {
 	uint8_t			uflags;				//!< Unwind markers
 };
 
+#define UNLANG_TRACE_MAX	256				//!< Maximum number of trace events recorded
+								///< for a single request.
+
+/** Types of events recorded when a request is being traced
+ *
+ */
+typedef enum {
+	UNLANG_TRACE_ENTER = 0,					//!< Started executing an instruction.
+	UNLANG_TRACE_EXIT,					//!< Finished executing an instruction.
+	UNLANG_TRACE_YIELD,					//!< Instruction yielded.
+	UNLANG_TRACE_RESUME					//!< Instruction was resumed.
+} unlang_trace_event_type_t;
+
+/** A single trace event
+ *
+ * Fixed size, and cheap to record.  Nothing is formatted until the
+ * request is done.
+ */
+typedef struct {
+	unlang_t const		*instruction;			//!< Instruction the event is for.
+	fr_time_t		when;				//!< When the event occurred.
+	uint8_t			type;				//!< One of #unlang_trace_event_type_t.
+	uint8_t			depth;				//!< Stack depth of the instruction.
+	uint8_t			rcode;				//!< Result of the instruction, for exit events.
+} unlang_trace_event_t;
+
+/** Trace buffer for a sampled request
+ *
+ */
+typedef struct {
+	fr_time_t		start;				//!< When tracing started.
+	uint32_t		num_events;			//!< How many events we've recorded.
+	uint32_t		dropped;			//!< How many events didn't fit in the buffer.
+	unlang_trace_event_t	event[UNLANG_TRACE_MAX];	//!< The events.
+} unlang_trace_t;
+
 /** An unlang stack associated with a request
  *
  */
@@ -266,6 +302,7 @@ typedef struct {
 	int			depth;				//!< Current depth we're executing at.
 	uint8_t			unwind;				//!< Unwind to this frame if it exists.
 								///< This is used for break and return.
+	unlang_trace_t		*trace;				//!< Trace events, if this request is being traced.
 	unlang_stack_frame_t	frame[UNLANG_STACK_MAX];	//!< The stack...
 } unlang_stack_t;
 
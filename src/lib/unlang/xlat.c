@@ -439,6 +439,89 @@ xlat_action_t unlang_xlat_yield(request_t *request,
 	return XLAT_ACTION_YIELD;
 }
 
+/** State for a blocking call running on an offload helper thread
+ *
+ */
+typedef struct {
+	fr_offload_job_t	*job;		//!< The blocking call.
+	void			*uctx;		//!< Owned by the job until it completes.
+	xlat_func_resume_t	resume;		//!< The xlat's resume function.
+} unlang_xlat_offload_t;
+
+/** The blocking call has completed
+ *
+ * Take uctx back from the job, so that it lives as long as the frame
+ * does, then call the xlat's resume function.
+ */
+static xlat_action_t unlang_xlat_offload_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
+						request_t *request, void const *xlat_inst, void *xlat_thread_inst,
+						fr_value_box_list_t *in, void *rctx)
+{
+	unlang_xlat_offload_t	*state = talloc_get_type_abort(rctx, unlang_xlat_offload_t);
+
+	talloc_steal(state, state->uctx);
+	TALLOC_FREE(state->job);
+
+	return state->resume(ctx, out, request, xlat_inst, xlat_thread_inst, in, state->uctx);
+}
+
+/** The request was cancelled while the blocking call was running
+ *
+ * uctx is freed along with the job, which may happen on the helper thread.
+ */
+static void unlang_xlat_offload_signal(UNUSED request_t *request, UNUSED void *xlat_inst, UNUSED void *xlat_thread_inst,
+				       void *rctx, fr_state_signal_t action)
+{
+	unlang_xlat_offload_t	*state = talloc_get_type_abort(rctx, unlang_xlat_offload_t);
+
+	if ((action != FR_SIGNAL_CANCEL) || !state->job) return;
+
+	fr_offload_cancel(state->job);
+	state->job = NULL;
+}
+
+/** Run a blocking call on a helper thread, and yield until it completes
+ *
+ * The xlat equivalent of #unlang_module_offload.  func must follow the
+ * rules for #fr_offload_func_t, and resume is called with uctx once
+ * func has returned.
+ *
+ * @note The xlat function which calls #unlang_xlat_offload should return
+ *	its result immediately, i.e. ``return unlang_xlat_offload(...)``.
+ *
+ * @param[in] request		The current request.
+ * @param[in] ol		Helper threads to run func on.
+ * @param[in] func		The blocking call.
+ * @param[in] resume		Called with uctx once func has returned.
+ * @param[in] uctx		Passed to func and resume.  Must be a talloc chunk
+ *				with no parent.  If the request is cancelled
+ *				while func is running, it's freed when func
+ *				returns, possibly by the helper thread.
+ *				Otherwise it's freed with the xlat's frame.
+ * @return
+ *	- XLAT_ACTION_YIELD on success.
+ *	- XLAT_ACTION_FAIL on failure, and uctx is freed.
+ */
+xlat_action_t unlang_xlat_offload(request_t *request, fr_offload_t *ol,
+				  fr_offload_func_t func, xlat_func_resume_t resume, void *uctx)
+{
+	unlang_xlat_offload_t	*state;
+
+	MEM(state = talloc_zero(unlang_interpret_frame_talloc_ctx(request), unlang_xlat_offload_t));
+	state->uctx = uctx;
+	state->resume = resume;
+
+	state->job = fr_offload_push(ol, request, func, uctx);
+	if (!state->job) {
+		RPERROR("Failed offloading blocking call");
+		talloc_free(uctx);
+		talloc_free(state);
+		return XLAT_ACTION_FAIL;
+	}
+
+	return unlang_xlat_yield(request, unlang_xlat_offload_resume, unlang_xlat_offload_signal, state);
+}
+
 
 /** Register xlat operation with the interpreter
  *
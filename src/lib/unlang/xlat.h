@@ -50,6 +50,7 @@ typedef struct xlat_thread_inst xlat_thread_inst_t;
 typedef struct xlat_exp xlat_exp_t;
 
 #include <freeradius-devel/server/cf_util.h>
+#include <freeradius-devel/server/offload.h>
 #include <freeradius-devel/server/request.h>
 #include <freeradius-devel/server/signal.h>
 
@@ -67,6 +68,9 @@ struct xlat_inst {
 
 	xlat_exp_t const	*node;		//!< Node this data relates to.
 	void			*data;		//!< xlat node specific instance data.
+
+	bool			memoize;	//!< Function is pure and all its arguments are constant,
+						///< so the result can be cached after the first call.
 };
 
 /** Thread specific instance data for xlat expansion node
@@ -80,6 +84,9 @@ struct xlat_thread_inst {
 
 	uint64_t		total_calls;	//! total number of times we've been called
 	uint64_t		active_callers; //! number of active callers.  i.e. number of current yields
+
+	bool			memo_valid;	//!< memo contains the result of a previous call.
+	fr_value_box_list_t	memo;		//!< Cached result of a memoized call.
 };
 
 typedef struct xlat_s xlat_t;
@@ -370,6 +377,8 @@ int		xlat_func_mono(xlat_t *xlat, xlat_arg_parser_t const *arg) CC_HINT(nonnull)
 
 void		xlat_internal(xlat_t *xlat);
 
+void		xlat_func_pure(xlat_t *xlat);
+
 /** Set a callback for global instantiation of xlat functions
  *
  * @param[in] _xlat		function to set the callback for (as returned by xlat_register).
@@ -448,6 +457,9 @@ int		unlang_xlat_push(TALLOC_CTX *ctx, fr_value_box_list_t *out,
 xlat_action_t	unlang_xlat_yield(request_t *request,
 				  xlat_func_resume_t callback, xlat_func_signal_t signal,
 				  void *rctx);
+
+xlat_action_t	unlang_xlat_offload(request_t *request, fr_offload_t *ol,
+				    fr_offload_func_t func, xlat_func_resume_t resume, void *uctx);
 #ifdef __cplusplus
 }
 #endif
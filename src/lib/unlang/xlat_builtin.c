@@ -407,6 +407,21 @@ void xlat_internal(xlat_t *xlat)
 	xlat->internal = true;
 }
 
+/** Mark an xlat function as pure
+ *
+ * Pure functions have no side effects, and their output depends only
+ * on their arguments.  When all the arguments of a call are constant,
+ * the result is computed once per thread and reused.
+ *
+ * @param[in] xlat to mark as pure.
+ */
+void xlat_func_pure(xlat_t *xlat)
+{
+	fr_assert(xlat->type == XLAT_FUNC_NORMAL);
+
+	xlat->pure = true;
+}
+
 /** Set global instantiation/detach callbacks
  *
  * All functions registered must be needs_async.
@@ -3334,19 +3349,25 @@ do { \
 	xlat_func_args(xlat, _args); \
 } while (0)
 
-	XLAT_REGISTER_ARGS("concat", xlat_func_concat, xlat_func_concat_args);
+#define XLAT_REGISTER_ARGS_PURE(_xlat, _func, _args) \
+do { \
+	XLAT_REGISTER_ARGS(_xlat, _func, _args); \
+	xlat_func_pure(xlat); \
+} while (0)
+
+	XLAT_REGISTER_ARGS_PURE("concat", xlat_func_concat, xlat_func_concat_args);
 	XLAT_REGISTER_ARGS("debug", xlat_func_debug, xlat_func_debug_args);
 	XLAT_REGISTER_ARGS("debug_attr", xlat_func_debug_attr, xlat_func_debug_attr_args);
 	XLAT_REGISTER_ARGS("explode", xlat_func_explode, xlat_func_explode_args);
-	XLAT_REGISTER_ARGS("hmacmd5", xlat_func_hmac_md5, xlat_hmac_args);
-	XLAT_REGISTER_ARGS("hmacsha1", xlat_func_hmac_sha1, xlat_hmac_args);
-	XLAT_REGISTER_ARGS("integer", xlat_func_integer, xlat_func_integer_args);
+	XLAT_REGISTER_ARGS_PURE("hmacmd5", xlat_func_hmac_md5, xlat_hmac_args);
+	XLAT_REGISTER_ARGS_PURE("hmacsha1", xlat_func_hmac_sha1, xlat_hmac_args);
+	XLAT_REGISTER_ARGS_PURE("integer", xlat_func_integer, xlat_func_integer_args);
 	XLAT_REGISTER_ARGS("join", xlat_func_join, xlat_func_join_args);
-	XLAT_REGISTER_ARGS("length", xlat_func_length, xlat_func_length_args);
+	XLAT_REGISTER_ARGS_PURE("length", xlat_func_length, xlat_func_length_args);
 	XLAT_REGISTER_ARGS("nexttime", xlat_func_next_time, xlat_func_next_time_args);
 	XLAT_REGISTER_ARGS("pairs", xlat_func_pairs, xlat_func_pairs_args);
-	XLAT_REGISTER_ARGS("lpad", xlat_func_lpad, xlat_func_pad_args);
-	XLAT_REGISTER_ARGS("rpad", xlat_func_rpad, xlat_func_pad_args);
+	XLAT_REGISTER_ARGS_PURE("lpad", xlat_func_lpad, xlat_func_pad_args);
+	XLAT_REGISTER_ARGS_PURE("rpad", xlat_func_rpad, xlat_func_pad_args);
 	XLAT_REGISTER_ARGS("trigger", trigger_xlat, trigger_xlat_args);
 
 #define XLAT_REGISTER_MONO(_xlat, _func, _arg) \
@@ -3355,13 +3376,19 @@ do { \
 	xlat_func_mono(xlat, &_arg); \
 } while (0)
 
-	XLAT_REGISTER_MONO("base64", xlat_func_base64_encode, xlat_func_base64_encode_arg);
-	XLAT_REGISTER_MONO("base64decode", xlat_func_base64_decode, xlat_func_base64_decode_arg);
-	XLAT_REGISTER_MONO("bin", xlat_func_bin, xlat_func_bin_arg);
-	XLAT_REGISTER_MONO("hex", xlat_func_hex, xlat_func_hex_arg);
+#define XLAT_REGISTER_MONO_PURE(_xlat, _func, _arg) \
+do { \
+	XLAT_REGISTER_MONO(_xlat, _func, _arg); \
+	xlat_func_pure(xlat); \
+} while (0)
+
+	XLAT_REGISTER_MONO_PURE("base64", xlat_func_base64_encode, xlat_func_base64_encode_arg);
+	XLAT_REGISTER_MONO_PURE("base64decode", xlat_func_base64_decode, xlat_func_base64_decode_arg);
+	XLAT_REGISTER_MONO_PURE("bin", xlat_func_bin, xlat_func_bin_arg);
+	XLAT_REGISTER_MONO_PURE("hex", xlat_func_hex, xlat_func_hex_arg);
 	XLAT_REGISTER_MONO("map", xlat_func_map, xlat_func_map_arg);
-	XLAT_REGISTER_MONO("md4", xlat_func_md4, xlat_func_md4_arg);
-	XLAT_REGISTER_MONO("md5", xlat_func_md5, xlat_func_md5_arg);
+	XLAT_REGISTER_MONO_PURE("md4", xlat_func_md4, xlat_func_md4_arg);
+	XLAT_REGISTER_MONO_PURE("md5", xlat_func_md5, xlat_func_md5_arg);
 	xlat_register(NULL, "module", xlat_func_module, false);
 	XLAT_REGISTER_MONO("pack", xlat_func_pack, xlat_func_pack_arg);
 	XLAT_REGISTER_MONO("rand", xlat_func_rand, xlat_func_rand_arg);
@@ -3369,32 +3396,32 @@ do { \
 #if defined(HAVE_REGEX_PCRE) || defined(HAVE_REGEX_PCRE2)
 	xlat_register(NULL, "regex", xlat_func_regex, false);
 #endif
-	XLAT_REGISTER_MONO("sha1", xlat_func_sha1, xlat_func_sha_arg);
+	XLAT_REGISTER_MONO_PURE("sha1", xlat_func_sha1, xlat_func_sha_arg);
 
 #ifdef HAVE_OPENSSL_EVP_H
-	XLAT_REGISTER_MONO("sha2_224", xlat_func_sha2_224, xlat_func_sha_arg);
-	XLAT_REGISTER_MONO("sha2_256", xlat_func_sha2_256, xlat_func_sha_arg);
-	XLAT_REGISTER_MONO("sha2_384", xlat_func_sha2_384, xlat_func_sha_arg);
-	XLAT_REGISTER_MONO("sha2_512", xlat_func_sha2_512, xlat_func_sha_arg);
+	XLAT_REGISTER_MONO_PURE("sha2_224", xlat_func_sha2_224, xlat_func_sha_arg);
+	XLAT_REGISTER_MONO_PURE("sha2_256", xlat_func_sha2_256, xlat_func_sha_arg);
+	XLAT_REGISTER_MONO_PURE("sha2_384", xlat_func_sha2_384, xlat_func_sha_arg);
+	XLAT_REGISTER_MONO_PURE("sha2_512", xlat_func_sha2_512, xlat_func_sha_arg);
 
-	XLAT_REGISTER_MONO("blake2s_256", xlat_func_blake2s_256, xlat_func_sha_arg);
-	XLAT_REGISTER_MONO("blake2b_512", xlat_func_blake2b_512, xlat_func_sha_arg);
+	XLAT_REGISTER_MONO_PURE("blake2s_256", xlat_func_blake2s_256, xlat_func_sha_arg);
+	XLAT_REGISTER_MONO_PURE("blake2b_512", xlat_func_blake2b_512, xlat_func_sha_arg);
 
 #  if OPENSSL_VERSION_NUMBER >= 0x10101000L
-	XLAT_REGISTER_MONO("sha3_224", xlat_func_sha3_224, xlat_func_sha_arg);
-	XLAT_REGISTER_MONO("sha3_256", xlat_func_sha3_256, xlat_func_sha_arg);
-	XLAT_REGISTER_MONO("sha3_384", xlat_func_sha3_384, xlat_func_sha_arg);
-	XLAT_REGISTER_MONO("sha3_512", xlat_func_sha3_512, xlat_func_sha_arg);
+	XLAT_REGISTER_MONO_PURE("sha3_224", xlat_func_sha3_224, xlat_func_sha_arg);
+	XLAT_REGISTER_MONO_PURE("sha3_256", xlat_func_sha3_256, xlat_func_sha_arg);
+	XLAT_REGISTER_MONO_PURE("sha3_384", xlat_func_sha3_384, xlat_func_sha_arg);
+	XLAT_REGISTER_MONO_PURE("sha3_512", xlat_func_sha3_512, xlat_func_sha_arg);
 #  endif
 #endif
 
-	XLAT_REGISTER_MONO("string", xlat_func_string, xlat_func_string_arg);
-	XLAT_REGISTER_MONO("strlen", xlat_func_strlen, xlat_func_strlen_arg);
+	XLAT_REGISTER_MONO_PURE("string", xlat_func_string, xlat_func_string_arg);
+	XLAT_REGISTER_MONO_PURE("strlen", xlat_func_strlen, xlat_func_strlen_arg);
 	XLAT_REGISTER_ARGS("sub", xlat_func_sub, xlat_func_sub_args);
-	XLAT_REGISTER_MONO("tolower", xlat_func_tolower, xlat_change_case_arg);
-	XLAT_REGISTER_MONO("toupper", xlat_func_toupper, xlat_change_case_arg);
-	XLAT_REGISTER_MONO("urlquote", xlat_func_urlquote, xlat_func_urlquote_arg);
-	XLAT_REGISTER_MONO("urlunquote", xlat_func_urlunquote, xlat_func_urlunquote_arg);
+	XLAT_REGISTER_MONO_PURE("tolower", xlat_func_tolower, xlat_change_case_arg);
+	XLAT_REGISTER_MONO_PURE("toupper", xlat_func_toupper, xlat_change_case_arg);
+	XLAT_REGISTER_MONO_PURE("urlquote", xlat_func_urlquote, xlat_func_urlquote_arg);
+	XLAT_REGISTER_MONO_PURE("urlunquote", xlat_func_urlunquote, xlat_func_urlunquote_arg);
 
 	return 0;
 }
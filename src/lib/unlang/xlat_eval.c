@@ -987,6 +987,59 @@ xlat_action_t xlat_frame_eval_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
 
 	return xa;
 }
+
+/** Record the output of a memoized function call
+ *
+ * @param[in] thread_inst	to store the result in.
+ * @param[in] out		positioned at the first box the function produced.
+ */
+static void xlat_memo_store(xlat_thread_inst_t *thread_inst, fr_dcursor_t const *out)
+{
+	fr_dcursor_t	cursor;
+	fr_value_box_t	*vb, *memo;
+
+	fr_dcursor_copy(&cursor, out);
+	for (vb = fr_dcursor_current(&cursor); vb; vb = fr_dcursor_next(&cursor)) {
+		MEM(memo = fr_value_box_alloc_null(thread_inst));
+		if (fr_value_box_copy(memo, memo, vb) < 0) {
+			talloc_free(memo);
+			fr_dlist_talloc_free(&thread_inst->memo);
+			return;
+		}
+		fr_dlist_insert_tail(&thread_inst->memo, memo);
+	}
+
+	thread_inst->memo_valid = true;
+}
+
+/** Copy the cached output of a memoized function call
+ *
+ * @param[in] ctx		to allocate value boxes in.
+ * @param[out] out		a list of #fr_value_box_t to append to.
+ * @param[in] request		the current request.
+ * @param[in] thread_inst	holding the cached result.
+ * @return
+ *	- XLAT_ACTION_DONE on success.
+ *	- XLAT_ACTION_FAIL on failure.
+ */
+static xlat_action_t xlat_memo_copy(TALLOC_CTX *ctx, fr_dcursor_t *out, request_t *request,
+				    xlat_thread_inst_t *thread_inst)
+{
+	fr_value_box_t	*vb = NULL, *value;
+
+	while ((vb = fr_dlist_next(&thread_inst->memo, vb))) {
+		MEM(value = fr_value_box_alloc_null(ctx));
+		if (fr_value_box_copy(value, value, vb) < 0) {
+			talloc_free(value);
+			return XLAT_ACTION_FAIL;
+		}
+		fr_dcursor_append(out, value);
+		xlat_debug_log_result(request, value);
+	}
+
+	return XLAT_ACTION_DONE;
+}
+
 /** Process the result of a previous nested expansion
  *
  * @param[in] ctx		to allocate value boxes in.
@@ -1127,6 +1180,7 @@ xlat_action_t xlat_frame_eval_repeat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 
 			case XLAT_ACTION_DONE:				/* Process the result */
 				fr_dcursor_next(out);
+				if (node->call.inst->memoize && !thread_inst->memo_valid) xlat_memo_store(thread_inst, out);
 				xlat_debug_log_result(request, fr_dcursor_current(out));
 				break;
 			}
@@ -1340,6 +1394,20 @@ xlat_action_t xlat_frame_eval(TALLOC_CTX *ctx, fr_dcursor_t *out, xlat_exp_t con
 			XLAT_DEBUG("** [%i] %s(func) - %%{%s:...}", unlang_interpret_stack_depth(request), __FUNCTION__,
 				   node->fmt);
 
+			/*
+			 *	The function is pure and its arguments
+			 *	are constant.  If we've already called
+			 *	it in this thread, reuse the result.
+			 */
+			if (node->call.inst && node->call.inst->memoize) {
+				xlat_thread_inst_t *thread_inst = xlat_thread_instance_find(node);
+
+				if (thread_inst->memo_valid) {
+					if (xlat_memo_copy(ctx, out, request, thread_inst) != XLAT_ACTION_DONE) goto fail;
+					continue;
+				}
+			}
+
 			/*
 			 *	Hand back the child node to the caller
 			 *	for evaluation.
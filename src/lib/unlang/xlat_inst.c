@@ -120,6 +120,7 @@ static xlat_thread_inst_t *xlat_thread_inst_alloc(TALLOC_CTX *ctx, xlat_inst_t *
 	}
 
 	thread_inst->node = inst->node;
+	fr_value_box_list_init(&thread_inst->memo);
 
 	fr_assert(inst->node->type == XLAT_FUNC);
 	fr_assert(!inst->node->call.thread_inst);		/* May be missing inst, but this is OK */
@@ -391,9 +392,48 @@ static int xlat_instantiate_init(void)
 	return 0;
 }
 
+/** Check whether an xlat expansion always produces the same output
+ *
+ * @param[in] head	of the expansion list to check.
+ * @return
+ *	- true if every node is a literal, or a call to a pure function
+ *	  with constant arguments.
+ *	- false otherwise.
+ */
+static bool xlat_is_constant(xlat_exp_t const *head)
+{
+	xlat_exp_t const *node;
+
+	for (node = head; node; node = node->next) {
+		switch (node->type) {
+		case XLAT_LITERAL:
+			break;
+
+		case XLAT_GROUP:
+			if (!xlat_is_constant(node->child)) return false;
+			break;
+
+		case XLAT_FUNC:
+			if (!node->call.func->pure) return false;
+			if (!xlat_is_constant(node->child)) return false;
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
 /** Call instantiation functions for "permanent" xlats
  *
  * Should be called after module instantiation is complete.
+ *
+ * Calls to pure functions with constant arguments are also marked for
+ * memoization here, as by now all the functions have been resolved.
+ * The result is computed the first time the call is evaluated in each
+ * thread, and copied into subsequent expansions.
  */
 int xlat_instantiate(void)
 {
@@ -407,6 +447,9 @@ int xlat_instantiate(void)
 	     data = fr_rb_iter_next_preorder(&iter)) {
 		xlat_inst_t *inst = talloc_get_type_abort(data, xlat_inst_t);
 
+		inst->memoize = inst->node->call.func->pure && xlat_is_constant(inst->node->child);
+		if (inst->memoize) DEBUG3("Memoizing xlat \"%s\" node %p", inst->node->call.func->name, inst->node);
+
 		if (inst->node->call.func->instantiate &&
 		    (inst->node->call.func->instantiate(inst->data, inst->node, inst->node->call.func->uctx) < 0)) {
 			return -1;
@@ -55,6 +55,8 @@ typedef struct xlat_s {
 	xlat_func_legacy_type_t	type;			//!< Type of xlat function.
 
 	bool			internal;		//!< If true, cannot be redefined.
+	bool			pure;			//!< Output depends only on the arguments, so calls
+							///< with constant arguments can be memoized.
 
 	xlat_instantiate_t	instantiate;		//!< Instantiation function.
 	xlat_detach_t		detach;			//!< Destructor for when xlat instances are freed.
@@ -1,12 +1,15 @@
 SUBMAKEFILES := \
 	base_16_32_64_tests.mk \
+	btree_tests.mk \
 	cursor_tests.mk \
 	dbuff_tests.mk \
 	dcursor_tests.mk \
 	dlist_tests.mk \
+	ds_perf_test.mk \
 	heap_tests.mk \
 	libfreeradius-util.mk \
 	lst_tests.mk \
+	oa_hash_tests.mk \
 	pair_legacy_tests.mk \
 	pair_list_perf_test.mk \
 	pair_tests.mk \
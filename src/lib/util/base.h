@@ -52,6 +52,7 @@ RCSIDH(libradius_h, "$Id$")
 #include <freeradius-devel/util/lsan.h>
 #include <freeradius-devel/util/md4.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/oa_hash.h>
 #include <freeradius-devel/util/packet.h>
 #include <freeradius-devel/util/pair.h>
 #include <freeradius-devel/util/pair_legacy.h>
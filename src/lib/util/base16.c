@@ -116,9 +116,38 @@ ssize_t fr_base16_encode_nstd(fr_sbuff_t *out, fr_dbuff_t *in, char const alphab
 {
 	fr_sbuff_t	our_out = FR_SBUFF_NO_ADVANCE(out);
 	fr_dbuff_t	our_in = FR_DBUFF(in);
+	size_t		len, room;
+
+	while ((len = fr_dbuff_extend(&our_in)) > 0) {
+		uint8_t a;
+
+		/*
+		 *	Encode as much of the input as will fit in the
+		 *	output, without checking the buffers for every
+		 *	byte.
+		 */
+		room = fr_sbuff_extend_lowat(NULL, &our_out, len << 1) >> 1;
+		if (room < len) len = room;
+		if (len > 0) {
+			uint8_t const	*p = fr_dbuff_current(&our_in);
+			char		*q = fr_sbuff_current(&our_out);
+			size_t		i;
+
+			for (i = 0; i < len; i++) {
+				*q++ = alphabet[us(p[i] >> 4)];
+				*q++ = alphabet[us(p[i] & 0x0f)];
+			}
+
+			fr_dbuff_advance(&our_in, len);
+			fr_sbuff_advance(&our_out, len << 1);
+			continue;
+		}
 
-	while (fr_dbuff_extend(&our_in)) {
-		uint8_t a = *fr_dbuff_current(&our_in);
+		/*
+		 *	Not enough room for even one byte, this
+		 *	returns how much more space we need.
+		 */
+		a = *fr_dbuff_current(&our_in);
 
 		FR_SBUFF_IN_CHAR_RETURN(&our_out, alphabet[us(a >> 4)], (alphabet[us(a & 0x0f)]));
 		fr_dbuff_advance(&our_in, 1);
@@ -146,11 +175,42 @@ ssize_t fr_base16_decode_nstd(fr_sbuff_parse_error_t *err, fr_dbuff_t *out, fr_s
 {
 	fr_sbuff_t	our_in = FR_SBUFF_NO_ADVANCE(in);
 	fr_dbuff_t	our_out = FR_DBUFF(out);
+	size_t		len, room;
 
-	while (fr_sbuff_extend_lowat(NULL, &our_in, 2) >= 2) {
-		char	*p = fr_sbuff_current(&our_in);
+	while ((len = (fr_sbuff_extend_lowat(NULL, &our_in, 2) >> 1)) > 0) {
+		char	*p;
 		bool	a, b;
 
+		/*
+		 *	Decode as many pairs as will fit in the
+		 *	output, stopping at the first invalid one.
+		 */
+		room = fr_dbuff_extend_lowat(NULL, &our_out, len);
+		if (room < len) len = room;
+		if (len > 0) {
+			uint8_t	*q = fr_dbuff_current(&our_out);
+			size_t	i;
+
+			p = fr_sbuff_current(&our_in);
+			for (i = 0; i < len; i++, p += 2) {
+				if (!fr_is_base16_nstd(p[0], alphabet) || !fr_is_base16_nstd(p[1], alphabet)) break;
+
+				q[i] = (alphabet[us(p[0])] << 4) | alphabet[us(p[1])];
+			}
+
+			if (i > 0) {
+				fr_sbuff_advance(&our_in, i << 1);
+				fr_dbuff_advance(&our_out, i);
+				continue;
+			}
+		}
+
+		/*
+		 *	The next pair is invalid, or there's no room
+		 *	for it.  Handle it the slow way.
+		 */
+		p = fr_sbuff_current(&our_in);
+
 		a = fr_is_base16_nstd(p[0], alphabet);
 		b = fr_is_base16_nstd(p[1], alphabet);
 		if (!a || !b) {
@@ -158,6 +218,7 @@ ssize_t fr_base16_decode_nstd(fr_sbuff_parse_error_t *err, fr_dbuff_t *out, fr_s
 		   		if (err) *err = FR_SBUFF_PARSE_ERROR_TRAILING;
 		   		return -fr_sbuff_used(&our_in);
 		   	}
+			break;
 		}
 
 		FR_DBUFF_IN_BYTES_RETURN(&our_out, (alphabet[us(p[0])] << 4) | alphabet[us(p[1])]);
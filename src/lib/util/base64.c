@@ -334,12 +334,42 @@ ssize_t fr_base64_encode_nstd(fr_sbuff_t *out, fr_dbuff_t *in,
 
 	for (;;) {
 		uint8_t a, b, c;
+		size_t	len, room;
 
-		switch (fr_dbuff_extend_lowat(NULL, &our_in, 3)) {
+		switch ((len = fr_dbuff_extend_lowat(NULL, &our_in, 3))) {
 		/*
 		 *	Enough bytes for a 24bit quanta
 		 */
 		default:
+			/*
+			 *	Encode as many complete quanta as will
+			 *	fit in the output, without checking the
+			 *	buffers for every byte.
+			 */
+			len /= 3;
+			room = fr_sbuff_extend_lowat(NULL, &our_out, len << 2) >> 2;
+			if (room < len) len = room;
+			if (len > 0) {
+				uint8_t const	*p = fr_dbuff_current(&our_in);
+				char		*q = fr_sbuff_current(&our_out);
+				size_t		i;
+
+				for (i = 0; i < len; i++, p += 3) {
+					*q++ = alphabet[(p[0] >> 2) & 0x3f];
+					*q++ = alphabet[((p[0] << 4) | (p[1] >> 4)) & 0x3f];
+					*q++ = alphabet[((p[1] << 2) | (p[2] >> 6)) & 0x3f];
+					*q++ = alphabet[p[2] & 0x3f];
+				}
+
+				fr_dbuff_advance(&our_in, len * 3);
+				fr_sbuff_advance(&our_out, len << 2);
+				continue;
+			}
+
+			/*
+			 *	Not enough room for a quantum, this
+			 *	returns how much more space we need.
+			 */
 			a = *fr_dbuff_current(&our_in);
 			b = *(fr_dbuff_current(&our_in) + 1);
 			c = *(fr_dbuff_current(&our_in) + 2);
@@ -406,12 +436,48 @@ ssize_t	fr_base64_decode_nstd(fr_sbuff_parse_error_t *err, fr_dbuff_t *out, fr_s
 	fr_dbuff_t		our_out = FR_DBUFF(out);
 	fr_sbuff_marker_t	m_final;
 	uint8_t			pad;
+	size_t			len, room;
 
 	/*
 	 *	Process complete 24bit quanta
 	 */
-	while (fr_sbuff_extend_lowat(NULL, &our_in, 4) >= 4) {
-		char *p = fr_sbuff_current(&our_in);
+	while ((len = (fr_sbuff_extend_lowat(NULL, &our_in, 4) >> 2)) > 0) {
+		char *p;
+
+		/*
+		 *	Decode as many quanta as will fit in the
+		 *	output, stopping at the first invalid one.
+		 */
+		room = fr_dbuff_extend_lowat(NULL, &our_out, len * 3) / 3;
+		if (room < len) len = room;
+		if (len > 0) {
+			uint8_t	*q = fr_dbuff_current(&our_out);
+			size_t	i;
+
+			p = fr_sbuff_current(&our_in);
+			for (i = 0; i < len; i++, p += 4, q += 3) {
+				if (!fr_is_base64_nstd(p[0], alphabet) ||
+				    !fr_is_base64_nstd(p[1], alphabet) ||
+				    !fr_is_base64_nstd(p[2], alphabet) ||
+				    !fr_is_base64_nstd(p[3], alphabet)) break;
+
+				q[0] = (alphabet[us(p[0])] << 2) | (alphabet[us(p[1])] >> 4);
+				q[1] = ((alphabet[us(p[1])] << 4) & 0xf0) | (alphabet[us(p[2])] >> 2);
+				q[2] = ((alphabet[us(p[2])] << 6) & 0xc0) | alphabet[us(p[3])];
+			}
+
+			if (i > 0) {
+				fr_sbuff_advance(&our_in, i << 2);
+				fr_dbuff_advance(&our_out, i * 3);
+				continue;
+			}
+		}
+
+		/*
+		 *	The next quantum is invalid, or there's no
+		 *	room for it.  Handle it the slow way.
+		 */
+		p = fr_sbuff_current(&our_in);
 
 		if (!fr_is_base64_nstd(p[0], alphabet) ||
 		    !fr_is_base64_nstd(p[1], alphabet) ||
@@ -1,5 +1,6 @@
 #include <freeradius-devel/util/acutest.h>
 #include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/time.h>
 
 #include "base16.h"
 #include "base32.h"
@@ -243,6 +244,151 @@ static void test_base64_decode(void)
 	}
 }
 
+/*
+ *	Long enough that the encoders and decoders spend most of
+ *	their time in their bulk loops.
+ */
+#define BLOB_LEN 4096
+
+static void blob_init(uint8_t *blob, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) blob[i] = (uint8_t)((i * 7) + (i >> 8));
+}
+
+static void test_base16_blob(void)
+{
+	uint8_t		blob[BLOB_LEN + 1], decoded[BLOB_LEN + 1];
+	char		encoded[(BLOB_LEN * 2) + 1];
+	size_t		len;
+
+	blob_init(blob, sizeof(blob));
+
+	/*
+	 *	Odd lengths and non-aligned starts
+	 */
+	for (len = BLOB_LEN - 3; len <= BLOB_LEN + 1; len++) {
+		TEST_CHECK_SLEN(fr_base16_encode(&FR_SBUFF_OUT(encoded, sizeof(encoded)),
+						 &FR_DBUFF_TMP(blob, len)), (ssize_t)(len * 2));
+		TEST_CHECK_SLEN(fr_base16_decode(NULL, &FR_DBUFF_TMP(decoded, sizeof(decoded)),
+						 &FR_SBUFF_IN(encoded, len * 2), true), (ssize_t)len);
+		TEST_CHECK(memcmp(blob, decoded, len) == 0);
+	}
+
+	/*
+	 *	Output too small, the encoder should tell us how
+	 *	much more it needs, and the decoder should error.
+	 */
+	TEST_CHECK(fr_base16_encode(&FR_SBUFF_OUT(encoded, 100), &FR_DBUFF_TMP(blob, BLOB_LEN)) < 0);
+	TEST_CHECK(fr_base16_decode(NULL, &FR_DBUFF_TMP(decoded, 100), &FR_SBUFF_IN(encoded, 400), true) < 0);
+
+	/*
+	 *	Invalid char half way through the input
+	 */
+	encoded[201] = 'x';
+	TEST_CHECK_SLEN(fr_base16_decode(NULL, &FR_DBUFF_TMP(decoded, sizeof(decoded)),
+					 &FR_SBUFF_IN(encoded, 400), true), -200);
+	TEST_CHECK_SLEN(fr_base16_decode(NULL, &FR_DBUFF_TMP(decoded, sizeof(decoded)),
+					 &FR_SBUFF_IN(encoded, 400), false), 100);
+}
+
+static void test_base64_blob(void)
+{
+	uint8_t		blob[BLOB_LEN + 1], decoded[BLOB_LEN + 1];
+	char		encoded[(((BLOB_LEN + 3) / 3) * 4) + 1];
+	size_t		len;
+
+	blob_init(blob, sizeof(blob));
+
+	for (len = BLOB_LEN - 3; len <= BLOB_LEN + 1; len++) {
+		ssize_t slen;
+
+		slen = fr_base64_encode(&FR_SBUFF_OUT(encoded, sizeof(encoded)), &FR_DBUFF_TMP(blob, len), true);
+		TEST_CHECK_SLEN(slen, (ssize_t)(((len + 2) / 3) * 4));
+		TEST_MSG("%s", fr_strerror());
+
+		TEST_CHECK_SLEN(fr_base64_decode(&FR_DBUFF_TMP(decoded, sizeof(decoded)),
+						 &FR_SBUFF_IN(encoded, (size_t)slen), true, true), (ssize_t)len);
+		TEST_MSG("%s", fr_strerror());
+		TEST_CHECK(memcmp(blob, decoded, len) == 0);
+	}
+
+	TEST_CHECK(fr_base64_encode(&FR_SBUFF_OUT(encoded, 100), &FR_DBUFF_TMP(blob, BLOB_LEN), true) < 0);
+	TEST_CHECK_SLEN(fr_base64_decode(&FR_DBUFF_TMP(decoded, 99),
+					 &FR_SBUFF_IN(encoded, 400), true, true), -132);
+}
+
+static void test_base16_benchmark(void)
+{
+	uint8_t		blob[BLOB_LEN], decoded[BLOB_LEN];
+	char		encoded[(BLOB_LEN * 2) + 1];
+	int		i;
+	fr_time_t	start, stop;
+	uint64_t	rate;
+
+	blob_init(blob, sizeof(blob));
+
+	start = fr_time();
+	for (i = 0; i < 10000; i++) {
+		fr_base16_encode(&FR_SBUFF_OUT(encoded, sizeof(encoded)), &FR_DBUFF_TMP(blob, sizeof(blob)));
+	}
+	stop = fr_time();
+
+	rate = (uint64_t)((float)NSEC / ((stop - start) / 10000));
+	printf("base16 encode rate %" PRIu64 " x %u bytes\n", rate, BLOB_LEN);
+
+	TEST_CHECK(rate > 10000);
+
+	start = fr_time();
+	for (i = 0; i < 10000; i++) {
+		fr_base16_decode(NULL, &FR_DBUFF_TMP(decoded, sizeof(decoded)),
+				 &FR_SBUFF_IN(encoded, BLOB_LEN * 2), true);
+	}
+	stop = fr_time();
+
+	rate = (uint64_t)((float)NSEC / ((stop - start) / 10000));
+	printf("base16 decode rate %" PRIu64 " x %u bytes\n", rate, BLOB_LEN);
+
+	TEST_CHECK(rate > 10000);
+}
+
+static void test_base64_benchmark(void)
+{
+	uint8_t		blob[BLOB_LEN], decoded[BLOB_LEN];
+	char		encoded[(((BLOB_LEN + 2) / 3) * 4) + 1];
+	int		i;
+	fr_time_t	start, stop;
+	uint64_t	rate;
+	ssize_t		slen = 0;
+
+	blob_init(blob, sizeof(blob));
+
+	start = fr_time();
+	for (i = 0; i < 10000; i++) {
+		slen = fr_base64_encode(&FR_SBUFF_OUT(encoded, sizeof(encoded)), &FR_DBUFF_TMP(blob, sizeof(blob)), true);
+	}
+	stop = fr_time();
+
+	rate = (uint64_t)((float)NSEC / ((stop - start) / 10000));
+	printf("base64 encode rate %" PRIu64 " x %u bytes\n", rate, BLOB_LEN);
+
+	TEST_CHECK(rate > 10000);
+	TEST_CHECK(slen > 0);
+
+	start = fr_time();
+	for (i = 0; i < 10000; i++) {
+		fr_base64_decode(&FR_DBUFF_TMP(decoded, sizeof(decoded)),
+				 &FR_SBUFF_IN(encoded, (size_t)slen), true, true);
+	}
+	stop = fr_time();
+
+	rate = (uint64_t)((float)NSEC / ((stop - start) / 10000));
+	printf("base64 decode rate %" PRIu64 " x %u bytes\n", rate, BLOB_LEN);
+
+	TEST_CHECK(rate > 10000);
+}
+
 TEST_LIST = {
 	{ "base16_encode",		test_base16_encode },
 	{ "base16_decode",		test_base16_decode },
@@ -254,5 +400,10 @@ TEST_LIST = {
 
 	{ "base64_encode",		test_base64_encode },
 	{ "base64_decode",		test_base64_decode },
+
+	{ "base16_blob",		test_base16_blob },
+	{ "base64_blob",		test_base64_blob },
+	{ "base16_benchmark",		test_base16_benchmark },
+	{ "base64_benchmark",		test_base64_benchmark },
 	{ NULL }
 };
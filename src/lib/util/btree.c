@@ -0,0 +1,1028 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** In-memory B+trees
+ *
+ * An ordered container with the same find/insert/remove API as #fr_rb_tree_t,
+ * but with much better locality for large sets.
+ *
+ * All elements are in the leaves, which are linked together for in-order
+ * iteration.  Each slot in a node holds a pointer to an element, and a 64bit
+ * prefix of its key, so a search mostly compares prefixes which are already
+ * in the cache line it is looking at.  The comparator is only called when
+ * two prefixes are equal.  With a node size of 32, a tree of 10M entries
+ * is five levels deep, where an rb tree is ~24.
+ *
+ * Internal nodes don't have copies of keys, as we don't know how to copy
+ * them.  Instead, entry[i] of an internal node is the smallest element in
+ * child[i], and entry[0] is unused.  Keeping that exact lets deletions fix
+ * up the separators which pointed to a removed element.
+ *
+ * @file src/lib/util/btree.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/btree.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/strerror.h>
+
+#include <string.h>
+
+/*
+ *	Maximum number of elements in a leaf, and children of an
+ *	internal node.  Nodes other than the root always have at
+ *	least BTREE_MIN.
+ */
+#define BTREE_MAX		(32)
+#define BTREE_MIN		(BTREE_MAX / 2)
+
+/*
+ *	A tree of depth 16 with nodes half full holds 16^16 elements,
+ *	which is more than a uint32_t can count.
+ */
+#define BTREE_MAX_DEPTH		(16)
+
+typedef struct {
+	uint64_t		prefix;		//!< Of the element's key.
+	void			*data;		//!< The element.
+} btree_entry_t;
+
+struct fr_btree_node_s {
+	uint16_t		num;		//!< Elements in a leaf, or children of an internal node.
+	bool			leaf;		//!< Whether this is a leaf.
+
+	fr_btree_node_t		*prev;		//!< Previous leaf.
+	fr_btree_node_t		*next;		//!< Next leaf.
+
+	btree_entry_t		entry[BTREE_MAX];	//!< Elements, or separators.
+
+	fr_btree_node_t		*child[];	//!< Children of an internal node.
+};
+
+struct fr_btree_s {
+	fr_btree_node_t		*root;		//!< Root node.  NULL if the tree is empty.
+	uint32_t		num_elements;	//!< How many elements are in the tree.
+
+	fr_cmp_t		data_cmp;	//!< Callback to compare elements.
+	fr_btree_prefix_t	data_prefix;	//!< Callback to return the prefix of an element.
+	fr_free_t		data_free;	//!< Callback to free elements.
+
+	char const		*type;		//!< Talloc type to check elements against.
+	bool			being_freed;	//!< Prevent re-entrant modifications from the free callback.
+};
+
+static inline CC_HINT(always_inline) uint64_t data_prefix(fr_btree_t const *tree, void const *data)
+{
+	return tree->data_prefix ? tree->data_prefix(data) : 0;
+}
+
+static inline CC_HINT(always_inline) int8_t entry_cmp(fr_btree_t const *tree,
+						      uint64_t prefix, void const *data, btree_entry_t const *entry)
+{
+	int8_t ret;
+
+	ret = CMP(prefix, entry->prefix);
+	if (ret != 0) return ret;
+
+	return tree->data_cmp(data, entry->data);
+}
+
+/** Return the child of an internal node which may contain data
+ *
+ * i.e. the largest i where entry[i] <= data, or 0.
+ */
+static inline CC_HINT(always_inline) unsigned int internal_search(fr_btree_t const *tree, fr_btree_node_t const *node,
+								  uint64_t prefix, void const *data)
+{
+	unsigned int lo = 1, hi = node->num;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (entry_cmp(tree, prefix, data, &node->entry[mid]) < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return lo - 1;
+}
+
+/** Return the position of the first element in a leaf which is >= data
+ *
+ */
+static inline CC_HINT(always_inline) unsigned int leaf_search(bool *exact, fr_btree_t const *tree,
+							      fr_btree_node_t const *node,
+							      uint64_t prefix, void const *data)
+{
+	unsigned int lo = 0, hi = node->num;
+
+	*exact = false;
+
+	while (lo < hi) {
+		unsigned int	mid = (lo + hi) / 2;
+		int8_t		ret;
+
+		ret = entry_cmp(tree, prefix, data, &node->entry[mid]);
+		if (ret == 0) {
+			*exact = true;
+			return mid;
+		}
+
+		if (ret < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return lo;
+}
+
+static fr_btree_node_t *node_alloc(fr_btree_t *tree, bool leaf)
+{
+	fr_btree_node_t	*node;
+	size_t		size = sizeof(*node);
+
+	if (!leaf) size += sizeof(node->child[0]) * BTREE_MAX;
+
+	node = talloc_zero_size(tree, size);
+	if (unlikely(!node)) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+	talloc_set_name_const(node, "fr_btree_node_t");
+	node->leaf = leaf;
+
+	return node;
+}
+
+static inline fr_btree_node_t *leftmost_leaf(fr_btree_node_t *node)
+{
+	while (!node->leaf) node = node->child[0];
+
+	return node;
+}
+
+static inline fr_btree_node_t *rightmost_leaf(fr_btree_node_t *node)
+{
+	while (!node->leaf) node = node->child[node->num - 1];
+
+	return node;
+}
+
+/** Free the elements, if there's a free function
+ *
+ * The nodes are talloc children of the tree, and are freed with it.
+ */
+static int _tree_free(fr_btree_t *tree)
+{
+	fr_btree_node_t	*leaf;
+	unsigned int	i;
+
+	tree->being_freed = true;
+
+	if (!tree->data_free || !tree->root) return 0;
+
+	for (leaf = leftmost_leaf(tree->root); leaf; leaf = leaf->next) {
+		for (i = 0; i < leaf->num; i++) tree->data_free(leaf->entry[i].data);
+	}
+
+	return 0;
+}
+
+/** Alloc a new B+tree
+ *
+ * @param[in] ctx		to tie tree lifetime to.
+ *				If ctx is freed, tree will free any nodes, calling the
+ *				free function if set.
+ * @param[in] type		of element.  May be NULL.
+ * @param[in] data_cmp		Callback to compare the key in two elements.
+ * @param[in] data_prefix	Callback to return a prefix of the key.  May be NULL.
+ * @param[in] data_free		Optional callback to free elements.
+ * @return
+ *	- A new B+tree on success.
+ *	- NULL on failure.
+ */
+fr_btree_t *_fr_btree_alloc(TALLOC_CTX *ctx, char const *type,
+			    fr_cmp_t data_cmp, fr_btree_prefix_t data_prefix, fr_free_t data_free)
+{
+	fr_btree_t *tree;
+
+	tree = talloc(ctx, fr_btree_t);
+	if (unlikely(!tree)) return NULL;
+
+	*tree = (fr_btree_t){
+		.data_cmp = data_cmp,
+		.data_prefix = data_prefix,
+		.data_free = data_free,
+		.type = type
+	};
+	talloc_set_destructor(tree, _tree_free);
+
+	return tree;
+}
+
+/** Fix the separators which point to one element
+ *
+ * @param[in] tree	to fix.
+ * @param[in] prefix	of data.
+ * @param[in] data	to route by.
+ * @param[in] old	element which may be a separator.
+ * @param[in] new	element to replace it with.  If NULL, the
+ *			separator is set to the smallest element
+ *			in the subtree.
+ */
+static void separator_fix(fr_btree_t *tree, uint64_t prefix, void const *data, void const *old, void *new)
+{
+	fr_btree_node_t *node = tree->root;
+
+	while (!node->leaf) {
+		unsigned int i;
+
+		i = internal_search(tree, node, prefix, data);
+		if ((i > 0) && (node->entry[i].data == old)) {
+			if (new) {
+				node->entry[i].data = new;
+			} else {
+				node->entry[i] = leftmost_leaf(node->child[i])->entry[0];
+			}
+		}
+		node = node->child[i];
+	}
+}
+
+/** Find the leaf containing data, or where it would be inserted
+ *
+ */
+static inline CC_HINT(always_inline) fr_btree_node_t *leaf_find(fr_btree_node_t *path[], unsigned int idx[],
+								unsigned int *depth,
+								fr_btree_t const *tree, uint64_t prefix, void const *data)
+{
+	fr_btree_node_t	*node = tree->root;
+	unsigned int	d;
+
+	for (d = 0; !node->leaf; d++) {
+		unsigned int i;
+
+		i = internal_search(tree, node, prefix, data);
+		if (path) {
+			path[d] = node;
+			idx[d] = i;
+		}
+		node = node->child[i];
+	}
+	if (depth) *depth = d;
+
+	return node;
+}
+
+/** Split a full leaf, inserting a new entry
+ *
+ * The left node keeps the smaller half.
+ */
+static void leaf_split(fr_btree_node_t *left, fr_btree_node_t *right, unsigned int pos, btree_entry_t const *entry)
+{
+	btree_entry_t	tmp[BTREE_MAX + 1];
+	unsigned int	left_num = (BTREE_MAX + 1) / 2;
+
+	memcpy(tmp, left->entry, sizeof(tmp[0]) * pos);
+	tmp[pos] = *entry;
+	memcpy(tmp + pos + 1, left->entry + pos, sizeof(tmp[0]) * (BTREE_MAX - pos));
+
+	memcpy(left->entry, tmp, sizeof(tmp[0]) * left_num);
+	left->num = left_num;
+
+	memcpy(right->entry, tmp + left_num, sizeof(tmp[0]) * (BTREE_MAX + 1 - left_num));
+	right->num = BTREE_MAX + 1 - left_num;
+
+	right->next = left->next;
+	if (right->next) right->next->prev = right;
+	right->prev = left;
+	left->next = right;
+}
+
+/** Split a full internal node, inserting a new child
+ *
+ * @param[in] left	Full node to split.
+ * @param[in] right	Empty node, which gets the larger half.
+ * @param[in] pos	Where the new child goes.
+ * @param[in,out] entry	Smallest element of the new child.  On return, the
+ *			smallest element of right.
+ * @param[in] child	to insert.
+ */
+static void internal_split(fr_btree_node_t *left, fr_btree_node_t *right, unsigned int pos,
+			   btree_entry_t *entry, fr_btree_node_t *child)
+{
+	btree_entry_t	tmp[BTREE_MAX + 1];
+	fr_btree_node_t	*tmp_child[BTREE_MAX + 1];
+	unsigned int	left_num = (BTREE_MAX + 1) / 2;
+	unsigned int	i;
+
+	memcpy(tmp, left->entry, sizeof(tmp[0]) * pos);
+	memcpy(tmp_child, left->child, sizeof(tmp_child[0]) * pos);
+	tmp[pos] = *entry;
+	tmp_child[pos] = child;
+	memcpy(tmp + pos + 1, left->entry + pos, sizeof(tmp[0]) * (BTREE_MAX - pos));
+	memcpy(tmp_child + pos + 1, left->child + pos, sizeof(tmp_child[0]) * (BTREE_MAX - pos));
+
+	memcpy(left->entry, tmp, sizeof(tmp[0]) * left_num);
+	memcpy(left->child, tmp_child, sizeof(tmp_child[0]) * left_num);
+	left->num = left_num;
+
+	right->num = BTREE_MAX + 1 - left_num;
+	for (i = 0; i < right->num; i++) {
+		right->entry[i] = tmp[left_num + i];
+		right->child[i] = tmp_child[left_num + i];
+	}
+
+	*entry = right->entry[0];
+	right->entry[0] = (btree_entry_t){};
+}
+
+/** Insert an element, or return the existing one
+ *
+ * @return
+ *	- 1 if existing data was found, found will be populated.
+ *	- 0 if the data was inserted.
+ *	- -1 on error.
+ */
+static int insert_internal(void **found, fr_btree_t *tree, void *data)
+{
+	fr_btree_node_t	*path[BTREE_MAX_DEPTH];
+	unsigned int	idx[BTREE_MAX_DEPTH];
+	fr_btree_node_t	*spare[BTREE_MAX_DEPTH + 1];
+	unsigned int	depth, pos, num_spare = 0, needed, d;
+	fr_btree_node_t	*node, *right;
+	btree_entry_t	entry;
+	uint64_t	prefix;
+	bool		exact;
+
+	if (unlikely(tree->being_freed)) {
+		fr_strerror_const("Tree is being freed");
+		return -1;
+	}
+
+#ifndef TALLOC_GET_TYPE_ABORT_NOOP
+	if (tree->type) (void)_talloc_get_type_abort(data, tree->type, __location__);
+#endif
+
+	prefix = data_prefix(tree, data);
+	entry = (btree_entry_t){ .prefix = prefix, .data = data };
+
+	if (!tree->root) {
+		tree->root = node_alloc(tree, true);
+		if (!tree->root) return -1;
+
+		tree->root->entry[0] = entry;
+		tree->root->num = 1;
+		tree->num_elements = 1;
+		return 0;
+	}
+
+	node = leaf_find(path, idx, &depth, tree, prefix, data);
+	pos = leaf_search(&exact, tree, node, prefix, data);
+	if (exact) {
+		if (found) *found = node->entry[pos].data;
+		return 1;
+	}
+
+	if (node->num < BTREE_MAX) {
+		memmove(&node->entry[pos + 1], &node->entry[pos], sizeof(node->entry[0]) * (node->num - pos));
+		node->entry[pos] = entry;
+		node->num++;
+		tree->num_elements++;
+		return 0;
+	}
+
+	/*
+	 *	Allocate all of the nodes we need before changing
+	 *	anything, so that a failure doesn't leave the tree
+	 *	half split.
+	 */
+	needed = 1;
+	for (d = depth; d > 0; d--) {
+		if (path[d - 1]->num < BTREE_MAX) break;
+		needed++;
+	}
+	if (d == 0) needed++;	/* New root */
+
+	if (unlikely(needed > NUM_ELEMENTS(spare))) {
+		fr_strerror_const("Tree is too deep");
+		return -1;
+	}
+
+	for (num_spare = 0; num_spare < needed; num_spare++) {
+		spare[num_spare] = node_alloc(tree, num_spare > 0 ? false : true);
+		if (!spare[num_spare]) {
+			while (num_spare > 0) talloc_free(spare[--num_spare]);
+			return -1;
+		}
+	}
+	num_spare = 0;
+
+	right = spare[num_spare++];
+	leaf_split(node, right, pos, &entry);
+	entry = right->entry[0];
+
+	/*
+	 *	Insert the new node into its parent, splitting
+	 *	the parent if it's full.
+	 */
+	while (depth > 0) {
+		fr_btree_node_t *parent;
+		unsigned int	i;
+
+		depth--;
+		parent = path[depth];
+		i = idx[depth] + 1;
+
+		if (parent->num < BTREE_MAX) {
+			memmove(&parent->entry[i + 1], &parent->entry[i], sizeof(parent->entry[0]) * (parent->num - i));
+			memmove(&parent->child[i + 1], &parent->child[i], sizeof(parent->child[0]) * (parent->num - i));
+			parent->entry[i] = entry;
+			parent->child[i] = right;
+			parent->num++;
+			goto done;
+		}
+
+		node = spare[num_spare++];
+		internal_split(parent, node, i, &entry, right);
+		right = node;
+	}
+
+	/*
+	 *	The root was split.
+	 */
+	node = spare[num_spare++];
+	node->child[0] = tree->root;
+	node->child[1] = right;
+	node->entry[1] = entry;
+	node->num = 2;
+	tree->root = node;
+
+done:
+	fr_assert(num_spare == needed);
+	tree->num_elements++;
+
+	return 0;
+}
+
+/** Rebalance a node which has too few entries, and any parents that then have too few
+ *
+ */
+static void rebalance(fr_btree_t *tree, fr_btree_node_t *path[], unsigned int idx[], unsigned int depth,
+		      fr_btree_node_t *node)
+{
+	while ((depth > 0) && (node->num < BTREE_MIN)) {
+		fr_btree_node_t	*parent = path[depth - 1];
+		fr_btree_node_t	*left, *right;
+		unsigned int	sep, i;
+
+		if (idx[depth - 1] > 0) {
+			sep = idx[depth - 1];
+			left = parent->child[sep - 1];
+			right = node;
+		} else {
+			sep = 1;
+			left = node;
+			right = parent->child[1];
+		}
+
+		/*
+		 *	Borrow one entry from the sibling.
+		 */
+		if ((node == left) && (right->num > BTREE_MIN)) {
+			if (left->leaf) {
+				left->entry[left->num++] = right->entry[0];
+				memmove(&right->entry[0], &right->entry[1], sizeof(right->entry[0]) * (right->num - 1));
+				right->num--;
+			} else {
+				left->entry[left->num] = parent->entry[sep];
+				left->child[left->num] = right->child[0];
+				left->num++;
+
+				parent->entry[sep] = right->entry[1];
+				memmove(&right->entry[1], &right->entry[2], sizeof(right->entry[0]) * (right->num - 2));
+				memmove(&right->child[0], &right->child[1], sizeof(right->child[0]) * (right->num - 1));
+				right->num--;
+				right->entry[0] = (btree_entry_t){};
+				return;
+			}
+			parent->entry[sep] = right->entry[0];
+			return;
+		}
+
+		if ((node == right) && (left->num > BTREE_MIN)) {
+			if (right->leaf) {
+				memmove(&right->entry[1], &right->entry[0], sizeof(right->entry[0]) * right->num);
+				right->entry[0] = left->entry[--left->num];
+				right->num++;
+				parent->entry[sep] = right->entry[0];
+			} else {
+				memmove(&right->entry[2], &right->entry[1], sizeof(right->entry[0]) * (right->num - 1));
+				memmove(&right->child[1], &right->child[0], sizeof(right->child[0]) * right->num);
+				right->entry[1] = parent->entry[sep];
+				right->child[0] = left->child[left->num - 1];
+				right->num++;
+
+				parent->entry[sep] = left->entry[left->num - 1];
+				left->num--;
+			}
+			return;
+		}
+
+		/*
+		 *	Neither sibling can spare anything, so
+		 *	merge the right node into the left.
+		 */
+		if (left->leaf) {
+			memcpy(&left->entry[left->num], &right->entry[0], sizeof(right->entry[0]) * right->num);
+			left->num += right->num;
+
+			left->next = right->next;
+			if (left->next) left->next->prev = left;
+		} else {
+			left->entry[left->num] = parent->entry[sep];
+			left->child[left->num] = right->child[0];
+			for (i = 1; i < right->num; i++) {
+				left->entry[left->num + i] = right->entry[i];
+				left->child[left->num + i] = right->child[i];
+			}
+			left->num += right->num;
+		}
+		talloc_free(right);
+
+		memmove(&parent->entry[sep], &parent->entry[sep + 1], sizeof(parent->entry[0]) * (parent->num - sep - 1));
+		memmove(&parent->child[sep], &parent->child[sep + 1], sizeof(parent->child[0]) * (parent->num - sep - 1));
+		parent->num--;
+
+		node = parent;
+		depth--;
+	}
+
+	/*
+	 *	The root can have fewer entries than other nodes,
+	 *	but an internal root needs at least two children.
+	 */
+	node = tree->root;
+	if (node->leaf) {
+		if (node->num == 0) {
+			talloc_free(node);
+			tree->root = NULL;
+		}
+	} else if (node->num == 1) {
+		tree->root = node->child[0];
+		talloc_free(node);
+	}
+}
+
+static void *remove_internal(fr_btree_t *tree, void const *data)
+{
+	fr_btree_node_t	*path[BTREE_MAX_DEPTH];
+	unsigned int	idx[BTREE_MAX_DEPTH];
+	unsigned int	depth, pos;
+	fr_btree_node_t	*node;
+	uint64_t	prefix;
+	void		*found;
+	bool		exact;
+
+	if (unlikely(tree->being_freed) || !tree->root) return NULL;
+
+	prefix = data_prefix(tree, data);
+	node = leaf_find(path, idx, &depth, tree, prefix, data);
+	pos = leaf_search(&exact, tree, node, prefix, data);
+	if (!exact) return NULL;
+
+	found = node->entry[pos].data;
+	memmove(&node->entry[pos], &node->entry[pos + 1], sizeof(node->entry[0]) * (node->num - pos - 1));
+	node->num--;
+	tree->num_elements--;
+
+	rebalance(tree, path, idx, depth, node);
+
+	/*
+	 *	Only the first element of a leaf can be a separator.
+	 */
+	if ((pos == 0) && tree->root) separator_fix(tree, prefix, data, found, NULL);
+
+	return found;
+}
+
+/** Find an element in the tree
+ *
+ * @param[in] tree to search in.
+ * @param[in] data to find.
+ * @return
+ *	- User data matching the data passed in.
+ *	- NULL if nothing matched passed data.
+ */
+void *fr_btree_find(fr_btree_t const *tree, void const *data)
+{
+	fr_btree_node_t	*node;
+	uint64_t	prefix;
+	unsigned int	pos;
+	bool		exact;
+
+	if (unlikely(tree->being_freed) || !tree->root) return NULL;
+
+	prefix = data_prefix(tree, data);
+	node = leaf_find(NULL, NULL, NULL, tree, prefix, data);
+	pos = leaf_search(&exact, tree, node, prefix, data);
+	if (!exact) return NULL;
+
+	return node->entry[pos].data;
+}
+
+/** Attempt to find current data in the tree, if it does not exist insert it
+ *
+ * @param[out] found	Pre-existing data we found.
+ * @param[in] tree	to search/insert into.
+ * @param[in] data	to find.
+ * @return
+ *	- 1 if existing data was found, found will be populated.
+ *	- 0 if no existing data was found.
+ *	- -1 on insert error.
+ */
+int fr_btree_find_or_insert(void **found, fr_btree_t *tree, void const *data)
+{
+	int ret;
+
+	ret = insert_internal(found, tree, UNCONST(void *, data));
+	if ((ret <= 0) && found) *found = NULL;
+
+	return ret;
+}
+
+/** Insert data into a tree
+ *
+ * @param[in] tree	to insert data into.
+ * @param[in] data 	to insert.
+ * @return
+ *	- true if data was inserted.
+ *	- false if data already existed and was not inserted.
+ */
+bool fr_btree_insert(fr_btree_t *tree, void const *data)
+{
+	return (insert_internal(NULL, tree, UNCONST(void *, data)) == 0);
+}
+
+/** Replace old data with new data, OR insert if there is no old
+ *
+ * @param[out] old	data that was replaced.  If this argument
+ *			is not NULL, then the old data will not
+ *			be freed, even if a free function is
+ *			configured.
+ * @param[in] tree	to insert data into.
+ * @param[in] data 	to replace.
+ * @return
+ *      - 1 if data was replaced.
+ *	- 0 if data was inserted.
+ *      - -1 if we failed to replace data
+ */
+int fr_btree_replace(void **old, fr_btree_t *tree, void const *data)
+{
+	fr_btree_node_t	*node;
+	uint64_t	prefix;
+	unsigned int	pos;
+	void		*old_data;
+	bool		exact;
+	int		ret;
+
+	if (old) *old = NULL;
+
+	if (unlikely(tree->being_freed)) return -1;
+
+	if (!tree->root) {
+		ret = insert_internal(NULL, tree, UNCONST(void *, data));
+		return (ret == 0) ? 0 : -1;
+	}
+
+	prefix = data_prefix(tree, data);
+	node = leaf_find(NULL, NULL, NULL, tree, prefix, data);
+	pos = leaf_search(&exact, tree, node, prefix, data);
+	if (!exact) {
+		ret = insert_internal(NULL, tree, UNCONST(void *, data));
+		return (ret == 0) ? 0 : -1;
+	}
+
+#ifndef TALLOC_GET_TYPE_ABORT_NOOP
+	if (tree->type) (void)_talloc_get_type_abort(data, tree->type, __location__);
+#endif
+
+	old_data = node->entry[pos].data;
+	node->entry[pos].data = UNCONST(void *, data);
+	if (pos == 0) separator_fix(tree, prefix, data, old_data, UNCONST(void *, data));
+
+	if (old) {
+		*old = old_data;
+	} else if (tree->data_free) {
+		tree->data_free(old_data);
+	}
+
+	return 1;
+}
+
+/** Remove an entry from the tree, without freeing the data
+ *
+ * @param[in] tree	to remove data from.
+ * @param[in] data 	to remove.
+ * @return
+ *      - The user data we removed.
+ *	- NULL if we couldn't find any matching data.
+ */
+void *fr_btree_remove(fr_btree_t *tree, void const *data)
+{
+	return remove_internal(tree, data);
+}
+
+/** Remove an entry and free the data (if a free function was specified)
+ *
+ * @param[in] tree	to remove data from.
+ * @param[in] data 	to remove/free.
+ * @return
+ *	- true if we removed data.
+ *      - false if we couldn't find any matching data.
+ */
+bool fr_btree_delete(fr_btree_t *tree, void const *data)
+{
+	void *found;
+
+	found = remove_internal(tree, data);
+	if (!found) return false;
+
+	if (tree->data_free) tree->data_free(found);
+
+	return true;
+}
+
+/** How many entries go into node i of n, when spreading num entries over n nodes
+ *
+ * Every node gets at least BTREE_MIN entries, if n > 1.
+ */
+static inline unsigned int bulk_node_num(uint32_t num, uint32_t n, uint32_t i)
+{
+	return (num / n) + ((i < (num % n)) ? 1 : 0);
+}
+
+/** Load a sorted array of elements into an empty tree
+ *
+ * This is much faster than inserting the elements one at a time, and
+ * leaves all of the nodes full.
+ *
+ * @param[in] tree	to load.  Must be empty.
+ * @param[in] data	Array of elements, sorted in ascending order,
+ *			with no duplicates.
+ * @param[in] num	Number of elements in the array.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.  The tree is left empty.
+ */
+int fr_btree_bulk_load(fr_btree_t *tree, void * const *data, uint32_t num)
+{
+	fr_btree_node_t	**level = NULL, **up;
+	btree_entry_t	*mins = NULL;
+	uint32_t	i, j, n, count, used;
+	uint64_t	prefix, prev_prefix = 0;
+
+	if (unlikely(tree->being_freed)) return -1;
+
+	if (tree->root) {
+		fr_strerror_const("Tree must be empty");
+		return -1;
+	}
+
+	if (num == 0) return 0;
+
+	/*
+	 *	Check the elements are in order before allocating
+	 *	anything.
+	 */
+	for (i = 0; i < num; i++) {
+#ifndef TALLOC_GET_TYPE_ABORT_NOOP
+		if (tree->type) (void)_talloc_get_type_abort(data[i], tree->type, __location__);
+#endif
+		prefix = data_prefix(tree, data[i]);
+		if ((i > 0) && (CMP(prev_prefix, prefix) >= 0) &&
+		    ((prev_prefix != prefix) || (tree->data_cmp(data[i - 1], data[i]) >= 0))) {
+			fr_strerror_printf("Element %u is not greater than the previous element", i);
+			return -1;
+		}
+		prev_prefix = prefix;
+	}
+
+	/*
+	 *	Build the leaves.
+	 */
+	n = (num + BTREE_MAX - 1) / BTREE_MAX;
+	level = talloc_array(NULL, fr_btree_node_t *, n);
+	mins = talloc_array(NULL, btree_entry_t, n);
+	if (!level || !mins) {
+	oom:
+		fr_strerror_const("Out of memory");
+
+		/*
+		 *	All the nodes are children of the tree.
+		 */
+		talloc_free_children(tree);
+		tree->root = NULL;
+		tree->num_elements = 0;
+		talloc_free(level);
+		talloc_free(mins);
+		return -1;
+	}
+
+	for (i = 0, used = 0; i < n; i++) {
+		fr_btree_node_t *leaf;
+
+		leaf = node_alloc(tree, true);
+		if (!leaf) goto oom;
+
+		leaf->num = bulk_node_num(num, n, i);
+		for (j = 0; j < leaf->num; j++, used++) {
+			leaf->entry[j] = (btree_entry_t){ .prefix = data_prefix(tree, data[used]), .data = data[used] };
+		}
+
+		if (i > 0) {
+			leaf->prev = level[i - 1];
+			level[i - 1]->next = leaf;
+		}
+		level[i] = leaf;
+		mins[i] = leaf->entry[0];
+	}
+
+	/*
+	 *	Build each level of internal nodes from the one below.
+	 */
+	for (count = n; count > 1; count = n) {
+		n = (count + BTREE_MAX - 1) / BTREE_MAX;
+		up = talloc_array(NULL, fr_btree_node_t *, n);
+		if (!up) goto oom;
+
+		for (i = 0, used = 0; i < n; i++) {
+			fr_btree_node_t *node;
+
+			node = node_alloc(tree, false);
+			if (!node) {
+				talloc_free(up);
+				goto oom;
+			}
+
+			node->num = bulk_node_num(count, n, i);
+			for (j = 0; j < node->num; j++, used++) {
+				node->child[j] = level[used];
+				if (j > 0) node->entry[j] = mins[used];
+			}
+			up[i] = node;
+
+			/*
+			 *	The min of this node is the min of its
+			 *	first child.  We've already used that
+			 *	slot, so it's safe to overwrite.
+			 */
+			mins[i] = mins[used - node->num];
+		}
+
+		talloc_free(level);
+		level = up;
+	}
+
+	tree->root = level[0];
+	tree->num_elements = num;
+
+	talloc_free(level);
+	talloc_free(mins);
+
+	return 0;
+}
+
+/** Return how many elements there are in the tree
+ *
+ * @param[in] tree to return elements for.
+ */
+uint32_t fr_btree_num_elements(fr_btree_t *tree)
+{
+	return tree->num_elements;
+}
+
+/** Return the smallest element in the tree
+ *
+ */
+void *fr_btree_first(fr_btree_t *tree)
+{
+	if (!tree->root) return NULL;
+
+	return leftmost_leaf(tree->root)->entry[0].data;
+}
+
+/** Return the largest element in the tree
+ *
+ */
+void *fr_btree_last(fr_btree_t *tree)
+{
+	fr_btree_node_t *leaf;
+
+	if (!tree->root) return NULL;
+
+	leaf = rightmost_leaf(tree->root);
+
+	return leaf->entry[leaf->num - 1].data;
+}
+
+static inline CC_HINT(always_inline) void *iter_current(fr_btree_iter_t *iter)
+{
+	btree_entry_t const *entry;
+
+	while (iter->leaf && (iter->pos >= iter->leaf->num)) {
+		iter->leaf = iter->leaf->next;
+		iter->pos = 0;
+	}
+	if (!iter->leaf) return NULL;
+
+	entry = &iter->leaf->entry[iter->pos];
+	if (iter->end && (entry_cmp(iter->tree, iter->end_prefix, iter->end, entry) <= 0)) {
+		iter->leaf = NULL;
+		return NULL;
+	}
+
+	return entry->data;
+}
+
+/** Initialise an in-order iterator
+ *
+ * @param[out] iter	to initialise.
+ * @param[in] tree	to iterate over.
+ * @return
+ *	- The first node.
+ *	- NULL if the tree is empty.
+ */
+void *fr_btree_iter_init(fr_btree_iter_t *iter, fr_btree_t *tree)
+{
+	return fr_btree_iter_init_range(iter, tree, NULL, NULL);
+}
+
+/** Initialise an iterator over a range of elements
+ *
+ * @param[out] iter	to initialise.
+ * @param[in] tree	to iterate over.
+ * @param[in] start	Return elements >= start.  If NULL, start at the smallest element.
+ * @param[in] end	Return elements < end.  If NULL, continue to the largest element.
+ * @return
+ *	- The first element in the range.
+ *	- NULL if there are no elements in the range.
+ */
+void *fr_btree_iter_init_range(fr_btree_iter_t *iter, fr_btree_t *tree, void const *start, void const *end)
+{
+	*iter = (fr_btree_iter_t){
+		.tree = tree,
+		.end = end,
+		.end_prefix = end ? data_prefix(tree, end) : 0
+	};
+
+	if (!tree->root) return NULL;
+
+	if (!start) {
+		iter->leaf = leftmost_leaf(tree->root);
+	} else {
+		uint64_t	prefix = data_prefix(tree, start);
+		bool		exact;
+
+		iter->leaf = leaf_find(NULL, NULL, NULL, tree, prefix, start);
+		iter->pos = leaf_search(&exact, tree, iter->leaf, prefix, start);
+	}
+
+	return iter_current(iter);
+}
+
+/** Return the next element
+ *
+ * @param[in] iter	previously initialised with #fr_btree_iter_init
+ *			or #fr_btree_iter_init_range.
+ * @return
+ *	- The next element.
+ *	- NULL if there are no more elements.
+ */
+void *fr_btree_iter_next(fr_btree_iter_t *iter)
+{
+	if (!iter->leaf) return NULL;
+
+	iter->pos++;
+
+	return iter_current(iter);
+}
@@ -0,0 +1,127 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Structures and prototypes for in-memory B+trees
+ *
+ * @file src/lib/util/btree.h
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(btree_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct fr_btree_s fr_btree_t;
+typedef struct fr_btree_node_s fr_btree_node_t;
+
+/** Return a prefix of the key of an element
+ *
+ * The prefix is stored in the tree, next to the pointer to the element,
+ * so that most comparisons don't need to touch the element.  It must
+ * agree with the comparator, i.e. if prefix(a) < prefix(b) then
+ * cmp(a, b) must be negative.  The comparator is only called when
+ * two prefixes are equal.
+ *
+ * For numeric keys, the prefix is usually the key.  For keys which
+ * are compared with memcmp(), the first eight bytes in network order.
+ */
+typedef uint64_t (*fr_btree_prefix_t)(void const *data);
+
+/** Iterator structure for in-order traversal of a B+tree
+ *
+ * @note If the tree is modified the iterator should be considered invalidated.
+ */
+typedef struct {
+	fr_btree_t		*tree;		//!< Tree being iterated over.
+	fr_btree_node_t		*leaf;		//!< Leaf containing the next element.
+	unsigned int		pos;		//!< Of the next element in the leaf.
+	void const		*end;		//!< Stop before this element.  May be NULL.
+	uint64_t		end_prefix;	//!< Prefix of end.
+} fr_btree_iter_t;
+
+/** Creates a B+tree
+ *
+ * @param[in] _ctx		to tie tree lifetime to.
+ *				If ctx is freed, tree will free any nodes, calling the
+ *				free function if set.
+ * @param[in] _data_cmp		Callback to compare the key in two elements.
+ * @param[in] _data_prefix	Callback to return a prefix of the key.  May be NULL.
+ * @param[in] _data_free	Optional callback to free elements.
+ * @return
+ *	- A new B+tree on success.
+ *	- NULL on failure.
+ */
+#define		fr_btree_alloc(_ctx, _data_cmp, _data_prefix, _data_free) \
+		_fr_btree_alloc(_ctx, NULL, _data_cmp, _data_prefix, _data_free)
+
+/** Creates a B+tree that verifies elements are of a specific talloc type
+ *
+ * @param[in] _ctx		to tie tree lifetime to.
+ * @param[in] _type		of element.
+ * @param[in] _data_cmp		Callback to compare the key in two elements.
+ * @param[in] _data_prefix	Callback to return a prefix of the key.  May be NULL.
+ * @param[in] _data_free	Optional callback to free elements.
+ * @return
+ *	- A new B+tree on success.
+ *	- NULL on failure.
+ */
+#define		fr_btree_talloc_alloc(_ctx, _type, _data_cmp, _data_prefix, _data_free) \
+		_fr_btree_alloc(_ctx, #_type, _data_cmp, _data_prefix, _data_free)
+
+fr_btree_t	*_fr_btree_alloc(TALLOC_CTX *ctx, char const *type,
+				 fr_cmp_t data_cmp, fr_btree_prefix_t data_prefix, fr_free_t data_free) CC_HINT(nonnull(3));
+
+void		*fr_btree_find(fr_btree_t const *tree, void const *data) CC_HINT(nonnull);
+
+int		fr_btree_find_or_insert(void **found, fr_btree_t *tree, void const *data) CC_HINT(nonnull(2,3));
+
+bool		fr_btree_insert(fr_btree_t *tree, void const *data) CC_HINT(nonnull);
+
+int		fr_btree_replace(void **old, fr_btree_t *tree, void const *data) CC_HINT(nonnull(2,3));
+
+void		*fr_btree_remove(fr_btree_t *tree, void const *data) CC_HINT(nonnull);
+
+bool		fr_btree_delete(fr_btree_t *tree, void const *data) CC_HINT(nonnull);
+
+int		fr_btree_bulk_load(fr_btree_t *tree, void * const *data, uint32_t num) CC_HINT(nonnull(1));
+
+uint32_t	fr_btree_num_elements(fr_btree_t *tree) CC_HINT(nonnull);
+
+void		*fr_btree_first(fr_btree_t *tree) CC_HINT(nonnull);
+
+void		*fr_btree_last(fr_btree_t *tree) CC_HINT(nonnull);
+
+void		*fr_btree_iter_init(fr_btree_iter_t *iter, fr_btree_t *tree) CC_HINT(nonnull);
+
+void		*fr_btree_iter_init_range(fr_btree_iter_t *iter, fr_btree_t *tree,
+					  void const *start, void const *end) CC_HINT(nonnull(1,2));
+
+void		*fr_btree_iter_next(fr_btree_iter_t *iter) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
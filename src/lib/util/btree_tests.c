@@ -0,0 +1,385 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for B+trees
+ *
+ * @file src/lib/util/btree_tests.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "btree.c"
+
+#define BTREE_TEST_SIZE	(20000)
+
+typedef struct {
+	uint32_t	num;
+} btree_test_item_t;
+
+static int8_t btree_test_cmp(void const *one, void const *two)
+{
+	btree_test_item_t const *a = one, *b = two;
+
+	return CMP(a->num, b->num);
+}
+
+static uint64_t btree_test_prefix(void const *data)
+{
+	btree_test_item_t const *a = data;
+
+	return a->num;
+}
+
+/*
+ *	Only the top bits, so that there are lots of equal
+ *	prefixes, and the comparator gets called.
+ */
+static uint64_t btree_test_prefix_coarse(void const *data)
+{
+	btree_test_item_t const *a = data;
+
+	return a->num >> 8;
+}
+
+/** Check the structure of a node, and return the number of elements under it
+ *
+ */
+static uint32_t btree_verify_node(fr_btree_t *tree, fr_btree_node_t *node, unsigned int depth,
+				  unsigned int *leaf_depth)
+{
+	uint32_t	count = 0;
+	unsigned int	i;
+
+	if (node != tree->root) {
+		TEST_CHECK(node->num >= BTREE_MIN);
+		TEST_MSG("node has %u entries, min is %u", node->num, BTREE_MIN);
+	}
+	TEST_CHECK(node->num <= BTREE_MAX);
+
+	if (node->leaf) {
+		if (*leaf_depth == 0) *leaf_depth = depth;
+		TEST_CHECK(*leaf_depth == depth);
+		TEST_MSG("leaves at depth %u and %u", *leaf_depth, depth);
+
+		for (i = 1; i < node->num; i++) {
+			TEST_CHECK(entry_cmp(tree, node->entry[i - 1].prefix, node->entry[i - 1].data,
+					     &node->entry[i]) < 0);
+		}
+
+		return node->num;
+	}
+
+	for (i = 0; i < node->num; i++) {
+		if (i > 0) {
+			TEST_CHECK(node->entry[i].data == leftmost_leaf(node->child[i])->entry[0].data);
+			TEST_MSG("separator %u is not the smallest element of its child", i);
+		}
+		count += btree_verify_node(tree, node->child[i], depth + 1, leaf_depth);
+	}
+
+	return count;
+}
+
+static void btree_verify(fr_btree_t *tree)
+{
+	unsigned int	leaf_depth = 0;
+	uint32_t	count = 0;
+
+	if (!tree->root) {
+		TEST_CHECK(tree->num_elements == 0);
+		return;
+	}
+
+	count = btree_verify_node(tree, tree->root, 1, &leaf_depth);
+	TEST_CHECK(count == tree->num_elements);
+	TEST_MSG("Expected %u elements, found %u", tree->num_elements, count);
+}
+
+static btree_test_item_t *btree_test_items(unsigned int num)
+{
+	btree_test_item_t	*items;
+	unsigned int		i;
+
+	items = talloc_array(NULL, btree_test_item_t, num);
+	for (i = 0; i < num; i++) items[i].num = i * 2;	/* Leave gaps for range tests */
+
+	/*
+	 *	Shuffle
+	 */
+	for (i = num - 1; i > 0; i--) {
+		unsigned int		j = fr_rand() % (i + 1);
+		btree_test_item_t	tmp = items[i];
+
+		items[i] = items[j];
+		items[j] = tmp;
+	}
+
+	return items;
+}
+
+static void btree_test_basic(fr_btree_prefix_t prefix)
+{
+	fr_btree_t		*tree;
+	btree_test_item_t	*items, *p, find;
+	fr_btree_iter_t		iter;
+	unsigned int		i;
+	uint32_t		last = 0;
+
+	items = btree_test_items(BTREE_TEST_SIZE);
+
+	tree = fr_btree_alloc(NULL, btree_test_cmp, prefix, NULL);
+	TEST_CHECK(tree != NULL);
+
+	TEST_CASE("insert");
+	for (i = 0; i < BTREE_TEST_SIZE; i++) TEST_CHECK(fr_btree_insert(tree, &items[i]));
+	TEST_CHECK(fr_btree_num_elements(tree) == BTREE_TEST_SIZE);
+	btree_verify(tree);
+
+	TEST_CASE("duplicates are rejected");
+	find.num = 0;
+	TEST_CHECK(!fr_btree_insert(tree, &find));
+	TEST_CHECK(fr_btree_num_elements(tree) == BTREE_TEST_SIZE);
+
+	TEST_CASE("find");
+	for (i = 0; i < BTREE_TEST_SIZE; i++) TEST_CHECK(fr_btree_find(tree, &items[i]) == &items[i]);
+	find.num = 1;
+	TEST_CHECK(fr_btree_find(tree, &find) == NULL);
+
+	TEST_CASE("in-order iteration");
+	i = 0;
+	for (p = fr_btree_iter_init(&iter, tree); p; p = fr_btree_iter_next(&iter)) {
+		if (i > 0) TEST_CHECK(p->num > last);
+		last = p->num;
+		i++;
+	}
+	TEST_CHECK(i == BTREE_TEST_SIZE);
+	TEST_MSG("Expected %u elements, got %u", BTREE_TEST_SIZE, i);
+
+	TEST_CHECK(((btree_test_item_t *)fr_btree_first(tree))->num == 0);
+	TEST_CHECK(((btree_test_item_t *)fr_btree_last(tree))->num == (BTREE_TEST_SIZE - 1) * 2);
+
+	TEST_CASE("remove");
+	for (i = 0; i < BTREE_TEST_SIZE; i++) {
+		TEST_CHECK(fr_btree_remove(tree, &items[i]) == &items[i]);
+		if ((i % 1000) == 0) btree_verify(tree);
+	}
+	TEST_CHECK(fr_btree_num_elements(tree) == 0);
+	TEST_CHECK(fr_btree_first(tree) == NULL);
+	btree_verify(tree);
+
+	talloc_free(tree);
+	talloc_free(items);
+}
+
+static void test_btree_basic(void)
+{
+	btree_test_basic(btree_test_prefix);
+}
+
+static void test_btree_basic_coarse_prefix(void)
+{
+	btree_test_basic(btree_test_prefix_coarse);
+}
+
+static void test_btree_basic_no_prefix(void)
+{
+	btree_test_basic(NULL);
+}
+
+/*
+ *	Random inserts and removes, checking against a bitmap of what
+ *	should be in the tree.
+ */
+static void test_btree_churn(void)
+{
+	fr_btree_t		*tree;
+	btree_test_item_t	*items;
+	bool			*present;
+	unsigned int		i, num = 0;
+
+	items = talloc_array(NULL, btree_test_item_t, 4096);
+	present = talloc_zero_array(NULL, bool, 4096);
+	for (i = 0; i < 4096; i++) items[i].num = i;
+
+	tree = fr_btree_alloc(NULL, btree_test_cmp, btree_test_prefix_coarse, NULL);
+	TEST_CHECK(tree != NULL);
+
+	for (i = 0; i < 200000; i++) {
+		unsigned int j = fr_rand() % 4096;
+
+		if (present[j]) {
+			TEST_CHECK(fr_btree_remove(tree, &items[j]) == &items[j]);
+			num--;
+		} else {
+			TEST_CHECK(fr_btree_insert(tree, &items[j]));
+			num++;
+		}
+		present[j] = !present[j];
+
+		if ((i % 10000) == 0) btree_verify(tree);
+	}
+
+	TEST_CHECK(fr_btree_num_elements(tree) == num);
+	btree_verify(tree);
+
+	for (i = 0; i < 4096; i++) {
+		TEST_CHECK((fr_btree_find(tree, &items[i]) != NULL) == present[i]);
+		TEST_MSG("item %u present %s", i, present[i] ? "yes" : "no");
+	}
+
+	talloc_free(tree);
+	talloc_free(present);
+	talloc_free(items);
+}
+
+static void test_btree_range(void)
+{
+	fr_btree_t		*tree;
+	btree_test_item_t	*items, *p, start, end;
+	fr_btree_iter_t		iter;
+	unsigned int		count = 0;
+	unsigned int		i;
+
+	items = btree_test_items(BTREE_TEST_SIZE);
+
+	tree = fr_btree_alloc(NULL, btree_test_cmp, btree_test_prefix, NULL);
+	for (i = 0; i < BTREE_TEST_SIZE; i++) fr_btree_insert(tree, &items[i]);
+
+	/*
+	 *	Neither end is in the tree.  Elements are 0, 2, 4...
+	 */
+	start.num = 1001;
+	end.num = 3001;
+	for (p = fr_btree_iter_init_range(&iter, tree, &start, &end); p; p = fr_btree_iter_next(&iter)) {
+		TEST_CHECK((p->num >= 1002) && (p->num <= 3000));
+		TEST_MSG("Got %u", p->num);
+		count++;
+	}
+	TEST_CHECK(count == 1000);
+	TEST_MSG("Expected 1000, got %u", count);
+
+	/*
+	 *	Start is inclusive, end isn't.
+	 */
+	start.num = 1000;
+	end.num = 1010;
+	count = 0;
+	for (p = fr_btree_iter_init_range(&iter, tree, &start, &end); p; p = fr_btree_iter_next(&iter)) count++;
+	TEST_CHECK(count == 5);
+
+	/*
+	 *	Past the end.
+	 */
+	start.num = BTREE_TEST_SIZE * 2;
+	TEST_CHECK(fr_btree_iter_init_range(&iter, tree, &start, NULL) == NULL);
+
+	talloc_free(tree);
+	talloc_free(items);
+}
+
+static void test_btree_bulk_load(void)
+{
+	fr_btree_t		*tree;
+	btree_test_item_t	*items;
+	void			**sorted;
+	unsigned int		i, sizes[] = { 1, 31, 32, 33, 1000, BTREE_TEST_SIZE };
+	size_t			s;
+
+	items = talloc_array(NULL, btree_test_item_t, BTREE_TEST_SIZE);
+	sorted = talloc_array(NULL, void *, BTREE_TEST_SIZE);
+	for (i = 0; i < BTREE_TEST_SIZE; i++) {
+		items[i].num = i * 2;
+		sorted[i] = &items[i];
+	}
+
+	for (s = 0; s < NUM_ELEMENTS(sizes); s++) {
+		tree = fr_btree_alloc(NULL, btree_test_cmp, btree_test_prefix, NULL);
+
+		TEST_CHECK(fr_btree_bulk_load(tree, sorted, sizes[s]) == 0);
+		TEST_MSG("bulk load of %u failed - %s", sizes[s], fr_strerror());
+		TEST_CHECK(fr_btree_num_elements(tree) == sizes[s]);
+		btree_verify(tree);
+
+		for (i = 0; i < sizes[s]; i++) TEST_CHECK(fr_btree_find(tree, &items[i]) == &items[i]);
+
+		TEST_CHECK(fr_btree_bulk_load(tree, sorted, sizes[s]) < 0);
+		TEST_MSG("bulk load into a non-empty tree should fail");
+
+		/*
+		 *	The tree must still be usable afterwards
+		 */
+		for (i = 0; i < sizes[s]; i += 2) TEST_CHECK(fr_btree_remove(tree, &items[i]) == &items[i]);
+		btree_verify(tree);
+
+		talloc_free(tree);
+	}
+
+	TEST_CASE("unsorted input is rejected");
+	tree = fr_btree_alloc(NULL, btree_test_cmp, btree_test_prefix, NULL);
+	sorted[10] = &items[5];
+	TEST_CHECK(fr_btree_bulk_load(tree, sorted, 100) < 0);
+	TEST_CHECK(fr_btree_num_elements(tree) == 0);
+	talloc_free(tree);
+
+	talloc_free(sorted);
+	talloc_free(items);
+}
+
+static void test_btree_replace(void)
+{
+	fr_btree_t		*tree;
+	btree_test_item_t	*items, *copies;
+	void			*old;
+	unsigned int		i;
+
+	items = btree_test_items(1000);
+	copies = talloc_array(NULL, btree_test_item_t, 1000);
+	memcpy(copies, items, sizeof(items[0]) * 1000);
+
+	tree = fr_btree_alloc(NULL, btree_test_cmp, btree_test_prefix, NULL);
+	for (i = 0; i < 1000; i++) fr_btree_insert(tree, &items[i]);
+
+	for (i = 0; i < 1000; i++) {
+		TEST_CHECK(fr_btree_replace(&old, tree, &copies[i]) == 1);
+		TEST_CHECK(old == &items[i]);
+	}
+	btree_verify(tree);
+
+	/*
+	 *	Separators must point to the copies, so the
+	 *	originals can be freed.
+	 */
+	memset(items, 0xff, sizeof(items[0]) * 1000);
+	for (i = 0; i < 1000; i++) TEST_CHECK(fr_btree_find(tree, &copies[i]) == &copies[i]);
+
+	talloc_free(tree);
+	talloc_free(copies);
+	talloc_free(items);
+}
+
+TEST_LIST = {
+	{ "btree_basic",		test_btree_basic },
+	{ "btree_basic_coarse_prefix",	test_btree_basic_coarse_prefix },
+	{ "btree_basic_no_prefix",	test_btree_basic_no_prefix },
+	{ "btree_churn",		test_btree_churn },
+	{ "btree_range",		test_btree_range },
+	{ "btree_bulk_load",		test_btree_bulk_load },
+	{ "btree_replace",		test_btree_replace },
+
+	{ NULL }
+};
@@ -1561,6 +1561,107 @@ static inline ssize_t _fr_dbuff_in_uint64v(uint8_t **pos_p, fr_dbuff_t *dbuff, u
 #define FR_DBUFF_IN_UINT64V(_dbuff_or_marker, _num) FR_DBUFF_RETURN(fr_dbuff_in_uint64v, _dbuff_or_marker, _num)
 /** @} */
 
+/** @name "in" functions for space which has already been reserved
+ *
+ * Encoders often write a fixed size header as a sequence of small fields.
+ * Checking for (and attempting to extend) space before every field adds up,
+ * so the space for the whole header can be reserved with a single call to
+ * #FR_DBUFF_RESERVE_RETURN, and the fields written with these functions,
+ * which only check bounds in debug builds.
+ *
+ @code{.c}
+ FR_DBUFF_RESERVE_RETURN(&work_dbuff, 6);
+ fr_dbuff_in_bytes_reserved(&work_dbuff, FR_VENDOR_SPECIFIC, 0);
+ fr_dbuff_in_reserved(&work_dbuff, (uint32_t)vendor);
+ @endcode
+ *
+ * @{
+ */
+
+/** Ensure at least _len bytes are available, returning if they're not
+ *
+ * @param[in] _dbuff_or_marker	to reserve space in.
+ * @param[in] _len		How many bytes the caller is going to write.
+ */
+#define FR_DBUFF_RESERVE_RETURN(_dbuff_or_marker, _len) FR_DBUFF_EXTEND_LOWAT_OR_RETURN(_dbuff_or_marker, (size_t)(_len))
+
+/** Internal function - do not call directly
+ *
+ * @private
+ */
+static inline CC_HINT(always_inline) size_t _fr_dbuff_advance_reserved(uint8_t **pos_p, fr_dbuff_t *out, size_t len)
+{
+	if (out->adv_parent && out->parent) _fr_dbuff_set_recurse(out->parent, out->adv_parent, (*pos_p) + len);
+	(*pos_p) += len;
+
+	return len;
+}
+
+/** Internal function - do not call directly
+ *
+ * @private
+ */
+static inline CC_HINT(always_inline) size_t _fr_dbuff_in_memcpy_reserved(uint8_t **pos_p, fr_dbuff_t *out,
+									  uint8_t const *in, size_t inlen)
+{
+	fr_assert(!out->is_const);
+	fr_assert((size_t)(out->end - (*pos_p)) >= inlen);
+
+	memcpy((*pos_p), in, inlen);
+
+	return _fr_dbuff_advance_reserved(pos_p, out, inlen);
+}
+
+/** Copy a byte sequence into reserved space in a dbuff or marker
+ *
+ * @param[in] _dbuff_or_marker	to copy byte sequence into.
+ * @param[in] ...		bytes to copy.
+ * @return The number of bytes copied.
+ */
+#define fr_dbuff_in_bytes_reserved(_dbuff_or_marker, ...) \
+	_fr_dbuff_in_memcpy_reserved(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), \
+				     ((uint8_t []){ __VA_ARGS__ }), sizeof((uint8_t []){ __VA_ARGS__ }))
+
+/** @cond */
+/** Define integer encoding functions for reserved space
+ * @private
+ */
+#define FR_DBUFF_PARSE_INT_RESERVED_DEF(_type) \
+static inline CC_HINT(always_inline) size_t _fr_dbuff_in_##_type##_reserved(uint8_t **pos_p, fr_dbuff_t *out, _type##_t num) \
+{ \
+	fr_assert(!out->is_const); \
+	fr_assert((size_t)(out->end - (*pos_p)) >= sizeof(_type##_t)); \
+	fr_net_from_##_type((*pos_p), num); \
+	return _fr_dbuff_advance_reserved(pos_p, out, sizeof(_type##_t)); \
+}
+FR_DBUFF_PARSE_INT_RESERVED_DEF(uint16)
+FR_DBUFF_PARSE_INT_RESERVED_DEF(uint32)
+FR_DBUFF_PARSE_INT_RESERVED_DEF(uint64)
+FR_DBUFF_PARSE_INT_RESERVED_DEF(int16)
+FR_DBUFF_PARSE_INT_RESERVED_DEF(int32)
+FR_DBUFF_PARSE_INT_RESERVED_DEF(int64)
+/** @endcond */
+
+/** Copy an integer into reserved space in a dbuff or marker
+ *
+ * @param[out] _dbuff_or_marker		to write to.  Integer types will be automatically
+					converted to big endian byte order.
+ * @param[in] _in			Value to copy.
+ * @return The number of bytes _dbuff_or_marker was advanced by.
+ */
+#define fr_dbuff_in_reserved(_dbuff_or_marker, _in) \
+	_Generic((_in), \
+		int8_t		: fr_dbuff_in_bytes_reserved(_dbuff_or_marker, (int8_t)_in), \
+		int16_t		: _fr_dbuff_in_int16_reserved(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), (int16_t)_in), \
+		int32_t		: _fr_dbuff_in_int32_reserved(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), (int32_t)_in), \
+		int64_t		: _fr_dbuff_in_int64_reserved(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), (int64_t)_in), \
+		uint8_t		: fr_dbuff_in_bytes_reserved(_dbuff_or_marker, (uint8_t)_in), \
+		uint16_t	: _fr_dbuff_in_uint16_reserved(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), (uint16_t)_in), \
+		uint32_t	: _fr_dbuff_in_uint32_reserved(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), (uint32_t)_in), \
+		uint64_t	: _fr_dbuff_in_uint64_reserved(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), (uint64_t)_in) \
+	)
+/** @} */
+
 /** @name "move" functions (copy data between dbuffs and markers)
  * @{
  */
@@ -245,6 +245,35 @@ static void test_dbuff_no_advance(void)
 	TEST_CHECK(init_remaining == fr_dbuff_remaining(&dbuff));
 }
 
+static void test_dbuff_reserved(void)
+{
+	uint8_t		buff[8];
+	uint8_t const	expected[] = { 0x1a, 0x00, 0x00, 0x00, 0x00, 0x09, 0x12, 0x34 };
+	fr_dbuff_t	dbuff, work_dbuff;
+
+	TEST_CASE("Write a header into reserved space");
+	memset(buff, 0xff, sizeof(buff));
+	fr_dbuff_init(&dbuff, buff, sizeof(buff));
+	work_dbuff = FR_DBUFF(&dbuff);
+
+	TEST_CHECK(fr_dbuff_extend_lowat(NULL, &work_dbuff, 8) == 8);
+	TEST_CHECK(fr_dbuff_in_bytes_reserved(&work_dbuff, 0x1a, 0x00) == 2);
+	TEST_CHECK(fr_dbuff_in_reserved(&work_dbuff, (uint32_t)9) == sizeof(uint32_t));
+	TEST_CHECK(fr_dbuff_in_reserved(&work_dbuff, (uint16_t)0x1234) == sizeof(uint16_t));
+	TEST_CHECK(memcmp(buff, expected, sizeof(expected)) == 0);
+	TEST_CHECK(fr_dbuff_used(&work_dbuff) == 8);
+	TEST_CHECK(fr_dbuff_used(&dbuff) == 0);
+
+	TEST_CASE("Reserved writes advance bound parents");
+	fr_dbuff_init(&dbuff, buff, sizeof(buff));
+	work_dbuff = FR_DBUFF_BIND_CURRENT(&dbuff);
+
+	TEST_CHECK(fr_dbuff_in_reserved(&work_dbuff, (uint8_t)0x01) == 1);
+	TEST_CHECK(fr_dbuff_in_reserved(&work_dbuff, (uint16_t)0x0203) == 2);
+	TEST_CHECK(fr_dbuff_used(&dbuff) == 3);
+	TEST_CHECK((buff[0] == 0x01) && (buff[1] == 0x02) && (buff[2] == 0x03));
+}
+
 static void test_dbuff_move(void)
 {
 	uint8_t			buff1[26], buff2[26], buff3[10];
@@ -541,6 +570,7 @@ TEST_LIST = {
 	{ "fr_dbuff_max",				test_dbuff_max },
 	{ "fr_dbuff_in",				test_dbuff_net_encode },
 	{ "fr_dbuff_no_advance",			test_dbuff_no_advance },
+	{ "fr_dbuff_reserved",				test_dbuff_reserved },
 	{ "fr_dbuff_move",				test_dbuff_move },
 	{ "fr_dbuff_talloc_extend",			test_dbuff_talloc_extend },
 	{ "fr_dbuff_talloc_extend_multi_level",		test_dbuff_talloc_extend_multi_level },
@@ -74,6 +74,10 @@ typedef struct {
 	unsigned int 		is_unknown : 1;			//!< This dictionary attribute is ephemeral
 								///< and not part of the main dictionary.
 
+	unsigned int		is_interned : 1;		//!< This unknown attribute is shared, and owned
+								///< by a per-thread intern table.  It must not
+								///< be freed or modified.
+
 	unsigned int		is_raw : 1;			//!< This dictionary attribute was constructed
 								///< from a known attribute to allow the user
 								///< to assign octets values directly.
@@ -365,6 +369,18 @@ fr_dict_attr_t		*fr_dict_unknown_attr_afrom_num(TALLOC_CTX *ctx,
 							fr_dict_attr_t const *parent, unsigned int num)
 							CC_HINT(nonnull(2));
 
+fr_dict_attr_t const	*fr_dict_unknown_vendor_intern_num(TALLOC_CTX *ctx,
+							   fr_dict_attr_t const *parent, unsigned int vendor)
+							   CC_HINT(nonnull(2));
+
+fr_dict_attr_t const	*fr_dict_unknown_tlv_intern_num(TALLOC_CTX *ctx,
+							fr_dict_attr_t const *parent, unsigned int num)
+							CC_HINT(nonnull(2));
+
+fr_dict_attr_t const	*fr_dict_unknown_attr_intern_num(TALLOC_CTX *ctx,
+							 fr_dict_attr_t const *parent, unsigned int num)
+							 CC_HINT(nonnull(2));
+
 fr_dict_attr_t		*fr_dict_unknown_attr_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da)
 						       CC_HINT(nonnull(2));
 
@@ -26,6 +26,7 @@ RCSIDH(dict_ext_h, "$Id$")
 
 #include <freeradius-devel/util/dict.h>
 #include <freeradius-devel/util/ext.h>
+#include <freeradius-devel/util/oa_hash.h>
 
 #include <limits.h>
 
@@ -85,7 +86,7 @@ typedef struct {
  */
 typedef struct {
 	fr_hash_table_t		*value_by_name;			//!< Lookup an enumeration value by name
-	fr_hash_table_t		*name_by_value;			//!< Lookup a name by value
+	fr_oa_hash_t		*name_by_value;			//!< Lookup a name by value
 } fr_dict_attr_ext_enumv_t;
 
 /** Attribute extension - Holds a hash table with the names of all children of this attribute
@@ -576,7 +576,6 @@ static int _dict_attr_fixup_hash_tables(fr_dict_attr_t const *da, UNUSED void *u
 		ext = fr_dict_attr_ext(da, FR_DICT_ATTR_EXT_ENUMV);
 		if (ext) {
 			if (ext->value_by_name) fr_hash_table_fill(ext->value_by_name);
-			if (ext->name_by_value) fr_hash_table_fill(ext->name_by_value);
 		}
 	}
 
@@ -607,7 +606,9 @@ void dict_hash_tables_finalise(fr_dict_t *dict)
 	 *	initialized.  We do this because the threads may perform
 	 *	lookups, and we don't want multi-threaded re-ordering
 	 *	of the table entries.  That would be bad.
+	 *
+	 *	vendors_by_num is an open addressing table, which
+	 *	doesn't need filling.
 	 */
 	fr_hash_table_fill(dict->vendors_by_name);
-	fr_hash_table_fill(dict->vendors_by_num);
 }
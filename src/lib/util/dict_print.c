@@ -162,7 +162,7 @@ typedef struct {
 static int dict_attr_debug(fr_dict_attr_t const *da, void *uctx)
 {
 	fr_dict_attr_debug_t 		*our_uctx = uctx;
-	fr_hash_iter_t			iter;
+	fr_oa_hash_iter_t		iter;
 	fr_dict_enum_t const		*enumv;
 	fr_dict_attr_ext_enumv_t 	*ext;
 
@@ -187,9 +187,9 @@ static int dict_attr_debug(fr_dict_attr_t const *da, void *uctx)
 	ext = fr_dict_attr_ext(da, FR_DICT_ATTR_EXT_ENUMV);
 	if (!ext || !ext->name_by_value) return 0;
 
-	for (enumv = fr_hash_table_iter_init(ext->name_by_value, &iter);
+	for (enumv = fr_oa_hash_iter_init(ext->name_by_value, &iter);
 	     enumv;
-	     enumv = fr_hash_table_iter_next(ext->name_by_value, &iter)) {
+	     enumv = fr_oa_hash_iter_next(ext->name_by_value, &iter)) {
 	     	char *value = fr_asprintf(NULL, "%pV", enumv->value);
 
 		FR_FAULT_LOG("%s    %s -> %s",
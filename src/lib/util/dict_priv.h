@@ -32,6 +32,7 @@ extern "C" {
 #include <freeradius-devel/util/dict_ext_priv.h>
 #include <freeradius-devel/util/dl.h>
 #include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/oa_hash.h>
 
 #define DICT_POOL_SIZE		(1024 * 1024 * 2)
 #define DICT_FIXUP_POOL_SIZE	(1024)
@@ -82,7 +83,7 @@ struct fr_dict {
 	bool			autoloaded;		//!< manual vs autoload
 
 	fr_hash_table_t		*vendors_by_name;	//!< Lookup vendor by name.
-	fr_hash_table_t		*vendors_by_num;	//!< Lookup vendor by PEN.
+	fr_oa_hash_t		*vendors_by_num;	//!< Lookup vendor by PEN.
 
 	fr_dict_attr_t		*root;			//!< Root attribute of this dictionary.
 
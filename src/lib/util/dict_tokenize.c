@@ -28,6 +28,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/dict_priv.h>
 #include <freeradius-devel/util/file.h>
 #include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/startup.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/talloc.h>
 
@@ -2298,6 +2299,7 @@ static int dict_from_file(fr_dict_t *dict,
 			  char const *src_file, int src_line)
 {
 	int ret;
+	int phase;
 	dict_tokenize_ctx_t ctx;
 
 	memset(&ctx, 0, sizeof(ctx));
@@ -2307,9 +2309,11 @@ static int dict_from_file(fr_dict_t *dict,
 	ctx.stack[0].da = dict->root;
 	ctx.stack[0].nest = FR_TYPE_MAX;
 
+	phase = fr_startup_phase_start("dictionary", dir_name);
 	ret = _dict_from_file(&ctx, dir_name, filename, src_file, src_line);
 	if (ret < 0) {
 		talloc_free(ctx.fixup.pool);
+		fr_startup_phase_end(phase);
 		return ret;
 	}
 
@@ -2320,7 +2324,10 @@ static int dict_from_file(fr_dict_t *dict,
 	 *	Fixups should have been applied already to any protocol
 	 *	dictionaries.
 	 */
-	return dict_finalise(&ctx);
+	ret = dict_finalise(&ctx);
+	fr_startup_phase_end(phase);
+
+	return ret;
 }
 
 /** (Re-)Initialize the special internal dictionary
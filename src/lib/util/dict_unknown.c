@@ -23,6 +23,20 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/util/dict_priv.h>
+#include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/hash.h>
+
+/** The maximum number of unknown attributes each thread will intern
+ *
+ * Once the table is full, unknown attributes are allocated as normal.
+ * Entries are never evicted, as pairs may still be using them.
+ */
+#define FR_DICT_UNKNOWN_INTERN_MAX	1024
+
+/** Per-thread table of shared unknown attributes, keyed by parent, number and type
+ *
+ */
+static _Thread_local fr_hash_table_t *dict_unknown_intern_table;
 
 /** Converts an unknown to a known by adding it to the internal dictionaries.
  *
@@ -159,6 +173,12 @@ void fr_dict_unknown_free(fr_dict_attr_t const **da)
 		return;
 	}
 
+	/* Interned DAs are owned by the intern table */
+	if ((*da)->flags.is_interned) {
+		*da = NULL;
+		return;
+	}
+
 	memcpy(&tmp, &da, sizeof(*tmp));
 	talloc_free(*tmp);
 
@@ -181,6 +201,7 @@ fr_dict_attr_t *fr_dict_unknown_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *
 	 *	no longer relevant.
 	 */
 	flags.is_unknown = 1;
+	flags.is_interned = 0;	/* copies are always private */
 	flags.array = 0;
 	flags.has_value = 0;
 	flags.length = 0;	/* unknown length */
@@ -333,6 +354,131 @@ fr_dict_attr_t	*fr_dict_unknown_attr_afrom_num(TALLOC_CTX *ctx, fr_dict_attr_t c
 			       &(dict_attr_args_t){ .flags = &flags });
 }
 
+static uint32_t dict_unknown_intern_hash(void const *data)
+{
+	fr_dict_attr_t const	*da = data;
+	uint32_t		hash;
+
+	hash = fr_hash(&da->parent, sizeof(da->parent));
+	hash = fr_hash_update(&da->attr, sizeof(da->attr), hash);
+	return fr_hash_update(&da->type, sizeof(da->type), hash);
+}
+
+static int8_t dict_unknown_intern_cmp(void const *one, void const *two)
+{
+	fr_dict_attr_t const *a = one, *b = two;
+	int8_t ret;
+
+	ret = CMP(a->parent, b->parent);
+	if (ret != 0) return ret;
+
+	ret = CMP(a->attr, b->attr);
+	if (ret != 0) return ret;
+
+	return CMP(a->type, b->type);
+}
+
+static void _dict_unknown_intern_free_on_exit(void *arg)
+{
+	talloc_free(arg);
+}
+
+/** Find or create a shared unknown attribute
+ *
+ * Unknown attributes are usually allocated for each pair, and freed
+ * with it.  When decoding packets containing the same unknown
+ * attributes over and over again, that's a lot of wasted work.
+ *
+ * Instead, we keep a bounded per-thread table of unknown attributes
+ * which pairs can point to without owning.  If the table is full,
+ * or the parent is a private unknown attribute (which may be freed
+ * at any time), we fall back to allocating an attribute in ctx.
+ *
+ * Interned attributes live until the thread exits, so pairs using
+ * them must not outlive the thread.  fr_dict_unknown_afrom_da() (and
+ * so fr_pair_copy()) always produces a private copy.
+ */
+static fr_dict_attr_t const *dict_unknown_intern(TALLOC_CTX *ctx, fr_dict_attr_t const *parent,
+						 unsigned int num, fr_type_t type,
+						 fr_dict_attr_t *(*alloc)(TALLOC_CTX *, fr_dict_attr_t const *, unsigned int))
+{
+	fr_hash_table_t	*ht = dict_unknown_intern_table;
+	fr_dict_attr_t	*da;
+
+	if (parent->flags.is_unknown && !parent->flags.is_interned) return alloc(ctx, parent, num);
+
+	if (unlikely(!ht)) {
+		ht = fr_hash_table_alloc(NULL, dict_unknown_intern_hash, dict_unknown_intern_cmp, NULL);
+		if (!ht) return alloc(ctx, parent, num);
+		fr_atexit_thread_local(dict_unknown_intern_table, _dict_unknown_intern_free_on_exit, ht);
+	}
+
+	da = fr_hash_table_find(ht, &(fr_dict_attr_t){ .parent = parent, .attr = num, .type = type });
+	if (da) return da;
+
+	if (fr_hash_table_num_elements(ht) >= FR_DICT_UNKNOWN_INTERN_MAX) return alloc(ctx, parent, num);
+
+	da = alloc(ht, parent, num);
+	if (!da) return NULL;
+	da->flags.is_interned = 1;
+
+	if (!fr_hash_table_insert(ht, da)) {
+		talloc_free(da);
+		return alloc(ctx, parent, num);
+	}
+
+	return da;
+}
+
+/** Find or create a shared unknown vendor, parented by a VSA attribute
+ *
+ * @note The result must not be freed or modified.  See dict_unknown_intern().
+ *
+ * @param[in] ctx		to allocate the vendor in, if it can't be shared.
+ * @param[in] parent		of the VSA attribute.
+ * @param[in] vendor		id.
+ * @return
+ *	- The vendor attribute on success.
+ *	- NULL on failure.
+ */
+fr_dict_attr_t const *fr_dict_unknown_vendor_intern_num(TALLOC_CTX *ctx,
+							fr_dict_attr_t const *parent, unsigned int vendor)
+{
+	return dict_unknown_intern(ctx, parent, vendor, FR_TYPE_VENDOR, fr_dict_unknown_vendor_afrom_num);
+}
+
+/** Find or create a shared unknown tlv attribute
+ *
+ * @note The result must not be freed or modified.  See dict_unknown_intern().
+ *
+ * @param[in] ctx		to allocate the attribute in, if it can't be shared.
+ * @param[in] parent		of the unknown attribute (may also be unknown).
+ * @param[in] num		of the unknown attribute.
+ * @return
+ *	- The tlv attribute on success.
+ *	- NULL on failure.
+ */
+fr_dict_attr_t const *fr_dict_unknown_tlv_intern_num(TALLOC_CTX *ctx, fr_dict_attr_t const *parent, unsigned int num)
+{
+	return dict_unknown_intern(ctx, parent, num, FR_TYPE_TLV, fr_dict_unknown_tlv_afrom_num);
+}
+
+/** Find or create a shared unknown octets attribute
+ *
+ * @note The result must not be freed or modified.  See dict_unknown_intern().
+ *
+ * @param[in] ctx		to allocate the attribute in, if it can't be shared.
+ * @param[in] parent		of the unknown attribute (may also be unknown).
+ * @param[in] num		of the unknown attribute.
+ * @return
+ *	- The octets attribute on success.
+ *	- NULL on failure.
+ */
+fr_dict_attr_t const *fr_dict_unknown_attr_intern_num(TALLOC_CTX *ctx, fr_dict_attr_t const *parent, unsigned int num)
+{
+	return dict_unknown_intern(ctx, parent, num, FR_TYPE_OCTETS, fr_dict_unknown_attr_afrom_num);
+}
+
 /** Initialise an octets type attribute from a da
  *
  * @param[in] ctx		to allocate the attribute in.
@@ -352,6 +498,7 @@ fr_dict_attr_t	*fr_dict_unknown_attr_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t co
 	 *	no longer relevant.
 	 */
 	flags.is_unknown = 1;
+	flags.is_interned = 0;	/* copies are always private */
 	flags.array = 0;
 	flags.has_value = 0;
 	flags.length = 0;	/* unknown length */
@@ -40,6 +40,12 @@ RCSID("$Id$")
 
 fr_dict_gctx_t *dict_gctx = NULL;	//!< Top level structure containing global dictionary state.
 
+/** Minimum number of bins in an attribute's children array
+ *
+ * The array is grown (in powers of two) up to 256 bins as children are added.
+ */
+#define DICT_CHILDREN_MIN	(8)
+
 fr_table_num_ordered_t const date_precision_table[] = {
 	{ L("microseconds"),	FR_TIME_RES_USEC },
 	{ L("us"),		FR_TIME_RES_USEC },
@@ -861,7 +867,7 @@ int dict_vendor_add(fr_dict_t *dict, char const *name, unsigned int num)
 	 *	files, but when we're printing them, (and looking up
 	 *	by value) we want to use the NEW name.
 	 */
-	if (fr_hash_table_replace(NULL, dict->vendors_by_num, vendor) < 0) {
+	if (fr_oa_hash_replace(NULL, dict->vendors_by_num, vendor) < 0) {
 		fr_strerror_printf("%s: Failed inserting vendor %s", __FUNCTION__, name);
 		return -1;
 	}
@@ -924,6 +930,7 @@ int dict_attr_child_add(fr_dict_attr_t *parent, fr_dict_attr_t *child)
 	fr_dict_attr_t const * const *bin;
 	fr_dict_attr_t **this;
 	fr_dict_attr_t const **children;
+	size_t len, idx = child->attr & 0xff;
 
 	/*
 	 *	Setup fields in the child
@@ -953,15 +960,29 @@ int dict_attr_child_add(fr_dict_attr_t *parent, fr_dict_attr_t *child)
 	}
 
 	/*
-	 *	We only allocate the pointer array *if* the parent has children.
+	 *	We only allocate the pointer array *if* the parent has
+	 *	children, and then only with as many bins as the
+	 *	children added so far need.  Most vendors and TLVs
+	 *	have a handful of low numbered children, so this
+	 *	saves allocating 256 bins for each of them.
+	 *
+	 *	Children never move between bins, so growing the
+	 *	array doesn't require re-sorting anything.
 	 */
 	children = dict_attr_children(parent);
-	if (!children) {
-		children = talloc_zero_array(parent, fr_dict_attr_t const *, UINT8_MAX + 1);
+	len = children ? talloc_array_length(children) : 0;
+	if (idx >= len) {
+		size_t new_len = DICT_CHILDREN_MIN;
+
+		while (new_len <= idx) new_len <<= 1;
+
+		children = talloc_realloc(parent, children, fr_dict_attr_t const *, new_len);
 		if (!children) {
 			fr_strerror_const("Out of memory");
 			return -1;
 		}
+		memset(children + len, 0, sizeof(children[0]) * (new_len - len));
+
 		if (dict_attr_children_set(parent, children) < 0) return -1;
 	}
 
@@ -981,7 +1002,7 @@ int dict_attr_child_add(fr_dict_attr_t *parent, fr_dict_attr_t *child)
 	 *	Attributes are inserted into the bin in order of their attribute
 	 *	numbers to allow slightly more efficient lookups.
 	 */
-	bin = &children[child->attr & 0xff];
+	bin = &children[idx];
 	for (;;) {
 		bool child_is_struct = false;
 		bool bin_is_struct = false;
@@ -1149,11 +1170,13 @@ int fr_dict_attr_add(fr_dict_t *dict, fr_dict_attr_t const *parent,
 	 */
 	if (!dict_attr_fields_valid(dict, parent, name, &attr, type, &our_flags)) return -1;
 
-	n = dict_attr_alloc(dict->pool, parent, name, attr, type, &(dict_attr_args_t){ .flags = &our_flags});
-	if (!n) return -1;
-
 #define FLAGS_EQUAL(_x) (old->flags._x == flags->_x)
 
+	/*
+	 *	Check for duplicates before allocating anything, so
+	 *	that redefinitions don't leave an unused attribute
+	 *	behind in the dictionary pool.
+	 */
 	old = fr_dict_attr_by_name(NULL, parent, name);
 	if (old) {
 		/*
@@ -1164,7 +1187,12 @@ int fr_dict_attr_add(fr_dict_t *dict, fr_dict_attr_t const *parent,
 		    ((old->attr == (unsigned int) attr) || ((attr < 0) && old->flags.internal))) {
 			return 0;
 		}
+	}
 
+	n = dict_attr_alloc(dict->pool, parent, name, attr, type, &(dict_attr_args_t){ .flags = &our_flags});
+	if (!n) return -1;
+
+	if (old) {
 		/*
 		 *	We have the same name, but different
 		 *	properties.  That's an error.
@@ -1263,8 +1291,8 @@ int dict_attr_enum_add_name(fr_dict_attr_t *da, char const *name,
 			return -1;
 		}
 
-		ext->name_by_value = fr_hash_table_talloc_alloc(da, fr_dict_enum_t, dict_enum_value_hash,
-								dict_enum_value_cmp, NULL);
+		ext->name_by_value = fr_oa_hash_talloc_alloc(da, fr_dict_enum_t, dict_enum_value_hash,
+							     dict_enum_value_cmp, NULL);
 		if (!ext->name_by_value) {
 			fr_strerror_printf("Failed allocating \"name_by_value\" table");
 			return -1;
@@ -1352,12 +1380,12 @@ int dict_attr_enum_add_name(fr_dict_attr_t *da, char const *name,
 	 *	take care of that here.
 	 */
 	if (takes_precedence) {
-		if (fr_hash_table_replace(NULL, ext->name_by_value, enumv) < 0) {
+		if (fr_oa_hash_replace(NULL, ext->name_by_value, enumv) < 0) {
 			fr_strerror_printf("%s: Failed inserting value %s", __FUNCTION__, name);
 			return -1;
 		}
 	} else {
-		(void) fr_hash_table_insert(ext->name_by_value, enumv);
+		(void) fr_oa_hash_insert(ext->name_by_value, enumv);
 	}
 
 	/*
@@ -2086,7 +2114,7 @@ fr_dict_vendor_t const *fr_dict_vendor_by_da(fr_dict_attr_t const *da)
 
 	dict = dict_by_da(da);
 
-	return fr_hash_table_find(dict->vendors_by_num, &dv);
+	return fr_oa_hash_find(dict->vendors_by_num, &dv);
 }
 
 /** Look up a vendor by its name
@@ -2125,7 +2153,7 @@ fr_dict_vendor_t const *fr_dict_vendor_by_num(fr_dict_t const *dict, uint32_t ve
 {
 	INTERNAL_IF_NULL(dict, NULL);
 
-	return fr_hash_table_find(dict->vendors_by_num, &(fr_dict_vendor_t) { .pen = vendor_pen });
+	return fr_oa_hash_find(dict->vendors_by_num, &(fr_dict_vendor_t) { .pen = vendor_pen });
 }
 
 /** Return vendor attribute for the specified dictionary and pen
@@ -2696,10 +2724,11 @@ fr_dict_attr_t *dict_attr_child_by_num(fr_dict_attr_t const *parent, unsigned in
 	if (!children) return NULL;
 
 	/*
-	 *	Child arrays may be trimmed back to save memory.
-	 *	Check that so we don't SEGV.
+	 *	Child arrays only have as many bins as the
+	 *	highest numbered bin in use.  Check that so we
+	 *	don't SEGV.
 	 */
-	if ((attr & 0xff) > talloc_array_length(children)) return NULL;
+	if ((attr & 0xff) >= talloc_array_length(children)) return NULL;
 
 	bin = children[attr & 0xff];
 	for (;;) {
@@ -2768,7 +2797,7 @@ fr_dict_enum_t *fr_dict_enum_by_value(fr_dict_attr_t const *da, fr_value_box_t c
 	 */
 	if (value->type != da->type) return NULL;
 
-	return fr_hash_table_find(ext->name_by_value, &(fr_dict_enum_t){ .value = value });
+	return fr_oa_hash_find(ext->name_by_value, &(fr_dict_enum_t){ .value = value });
 }
 
 /** Lookup the name of an enum value in a #fr_dict_attr_t
@@ -3074,7 +3103,7 @@ fr_dict_t *dict_alloc(TALLOC_CTX *ctx)
 	 *	be vendors of the same value.  If there are, we
 	 *	pick the latest one.
 	 */
-	dict->vendors_by_num = fr_hash_table_alloc(dict, dict_vendor_pen_hash, dict_vendor_pen_cmp, NULL);
+	dict->vendors_by_num = fr_oa_hash_alloc(dict, dict_vendor_pen_hash, dict_vendor_pen_cmp, NULL);
 	if (!dict->vendors_by_num) {
 		fr_strerror_printf("Failed allocating \"vendors_by_num\" table");
 		goto error;
@@ -54,6 +54,9 @@ typedef struct {
 					///< validation.
 	fr_dlist_t	entry;		//!< Struct holding the head and tail of the list.
 	unsigned int	num_elements;	//!< Number of elements contained within the dlist.
+	unsigned int	gen;		//!< Incremented every time the list is modified.
+					///< Allows users to detect stale data derived
+					///< from the list, such as indexes.
 } fr_dlist_head_t;
 
 static_assert(sizeof(unsigned int) >= 4, "Unsigned integer too small on this platform");
@@ -236,6 +239,7 @@ static inline void _fr_dlist_init(fr_dlist_head_t *list_head, size_t offset, cha
 	list_head->offset = offset;
 	list_head->type = type;
 	list_head->num_elements = 0;
+	list_head->gen = 0;
 }
 
 /** Efficiently remove all elements in a dlist
@@ -246,6 +250,7 @@ static inline void fr_dlist_clear(fr_dlist_head_t *list_head)
 {
 	fr_dlist_entry_init(&list_head->entry);
 	list_head->num_elements = 0;
+	list_head->gen++;
 }
 
 /** Verify we're not going to overflow the element count
@@ -291,6 +296,7 @@ static inline CC_HINT(nonnull) int fr_dlist_insert_head(fr_dlist_head_t *list_he
 	head->next = entry;
 
 	list_head->num_elements++;
+	list_head->gen++;
 
 	return 0;
 }
@@ -329,6 +335,7 @@ static inline CC_HINT(nonnull) int fr_dlist_insert_tail(fr_dlist_head_t *list_he
 	head->prev = entry;
 
 	list_head->num_elements++;
+	list_head->gen++;
 
 	return 0;
 }
@@ -365,6 +372,7 @@ static inline CC_HINT(nonnull(1,3)) int fr_dlist_insert_after(fr_dlist_head_t *l
 	fr_dlist_entry_link_after(pos_entry, entry);
 
 	list_head->num_elements++;
+	list_head->gen++;
 
 	return 0;
 }
@@ -401,6 +409,7 @@ static inline CC_HINT(nonnull(1,3)) int fr_dlist_insert_before(fr_dlist_head_t *
 	fr_dlist_entry_link_before(pos_entry, entry);
 
 	list_head->num_elements++;
+	list_head->gen++;
 
 	return 0;
 }
@@ -582,6 +591,7 @@ static inline CC_HINT(nonnull(1)) void *fr_dlist_remove(fr_dlist_head_t *list_he
 	entry->prev = entry->next = entry;
 
 	list_head->num_elements--;
+	list_head->gen++;
 
 	if (prev == head) return NULL;	/* Works with fr_dlist_next so that the next item is the list HEAD */
 
@@ -646,6 +656,7 @@ static inline void *fr_dlist_replace(fr_dlist_head_t *list_head, void *item, voi
 	ptr_entry = fr_dlist_item_to_entry(list_head->offset, ptr);
 
 	fr_dlist_entry_replace(item_entry, ptr_entry);
+	list_head->gen++;
 
 	return item;
 }
@@ -722,9 +733,11 @@ static inline CC_HINT(nonnull) int fr_dlist_move(fr_dlist_head_t *list_dst, fr_d
 	dst->prev = src->prev;
 
 	list_dst->num_elements += list_src->num_elements;
+	list_dst->gen++;
 
 	fr_dlist_entry_init(src);
 	list_src->num_elements = 0;
+	list_src->gen++;
 
 	return 0;
 }
@@ -766,9 +779,11 @@ static inline CC_HINT(nonnull) int fr_dlist_move_head(fr_dlist_head_t *list_dst,
 	dst->next = src->next;
 
 	list_dst->num_elements += list_src->num_elements;
+	list_dst->gen++;
 
 	fr_dlist_entry_init(src);
 	list_src->num_elements = 0;
+	list_src->gen++;
 
 	return 0;
 }
@@ -974,6 +989,7 @@ static inline void fr_dlist_sort(fr_dlist_head_t *list, fr_cmp_t cmp)
 
 	if (fr_dlist_num_elements(list) <= 1) return;
 
+	list->gen++;
 	head = fr_dlist_head(list);
 	/* NULL terminate existing list */
 	list->entry.prev->next = NULL;
@@ -0,0 +1,762 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Performance tests for the util data structures
+ *
+ * Runs insert, find, iterate and delete workloads against each of the
+ * keyed data structures, using the kinds of keys the server actually
+ * stores: client IP addresses, User-Names, and State blobs.
+ *
+ * Each test prints the time per operation, and on Linux the number of
+ * hardware cache misses per operation, e.g.
+ *
+ *	./build/bin/local/ds_perf_test -v rb
+ *
+ * The number of items defaults to PERF_ITEMS, and can be changed with the
+ * DS_PERF_ITEMS environment variable, e.g. to compare rb and btree with
+ * 10M items:
+ *
+ *	DS_PERF_ITEMS=10000000 ./build/bin/local/ds_perf_test -v rb btree
+ *
+ * Each item is ~100 bytes, and there are three sets of items, so 10M
+ * items needs a few GB of memory.
+ *
+ * @file src/lib/util/ds_perf_test.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+
+#include <freeradius-devel/util/btree.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/htrie.h>
+#include <freeradius-devel/util/lst.h>
+#include <freeradius-devel/util/oa_hash.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/rb.h>
+#include <freeradius-devel/util/time.h>
+#include <freeradius-devel/util/trie.h>
+
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#endif
+
+/*
+ *	Number of items in each data structure.  Large enough that
+ *	the structures don't fit in L1/L2, which is the case for
+ *	client, state and cache tables on a busy server.
+ */
+#define PERF_ITEMS	(65536)
+#define PERF_KEY_MAX	(64)
+
+/*
+ *	dlist finds are O(n), so we only do a sample of them.
+ */
+#define PERF_DLIST_FINDS (1024)
+
+typedef struct {
+	uint8_t		key[PERF_KEY_MAX];
+	size_t		keylen;			//!< In bytes.
+
+	fr_rb_node_t	node;			//!< For the rb tree.
+	fr_heap_index_t	heap_idx;		//!< For the heap.
+	fr_lst_index_t	lst_idx;		//!< For the LST.
+	fr_dlist_t	entry;			//!< For the dlist.
+	uint32_t	prio;			//!< Sort order for the heap and LST.
+} perf_item_t;
+
+typedef enum {
+	PERF_KEY_IPV4 = 0,			//!< Client IPv4 addresses, clustered in a few /16s.
+	PERF_KEY_USER_NAME,			//!< user@realm strings.
+	PERF_KEY_STATE,				//!< 16 byte random blobs.
+	PERF_KEY_MAX_TYPE
+} perf_key_type_t;
+
+static char const *perf_key_names[PERF_KEY_MAX_TYPE] = {
+	[PERF_KEY_IPV4] = "ipv4",
+	[PERF_KEY_USER_NAME] = "user_name",
+	[PERF_KEY_STATE] = "state"
+};
+
+static unsigned int	perf_items = PERF_ITEMS;	//!< Number of items in each data structure.
+static perf_item_t	*items[PERF_KEY_MAX_TYPE];	//!< Items to insert.
+static unsigned int	*order;				//!< Random order for finds and deletes.
+
+/** Operations on one data structure
+ *
+ * Callbacks which the structure doesn't support are NULL, and are
+ * skipped.
+ */
+typedef struct {
+	char const	*name;
+	char const	*find_name;		//!< What "find" means for this structure, if not "find".
+	void		*(*alloc)(TALLOC_CTX *ctx);
+	bool		(*insert)(void *ds, perf_item_t *item);
+	void		*(*find)(void *ds, perf_item_t *item);
+	unsigned int	(*iterate)(void *ds);
+	bool		(*remove)(void *ds, perf_item_t *item);
+} perf_ops_t;
+
+/*
+ *	Keys and comparisons.
+ */
+static int8_t perf_item_cmp(void const *one, void const *two)
+{
+	perf_item_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->keylen, b->keylen);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->key, b->key, a->keylen);
+	return CMP(ret, 0);
+}
+
+static int8_t perf_item_prio_cmp(void const *one, void const *two)
+{
+	perf_item_t const *a = one, *b = two;
+
+	return CMP_PREFER_SMALLER(a->prio, b->prio);
+}
+
+/*
+ *	Sorts the same way as perf_item_cmp(), length first.
+ */
+static uint64_t perf_item_prefix(void const *data)
+{
+	perf_item_t const	*item = data;
+	uint64_t		prefix = (uint64_t)item->keylen << 56;
+	size_t			i;
+
+	for (i = 0; (i < 7) && (i < item->keylen); i++) prefix |= (uint64_t)item->key[i] << (48 - (i * 8));
+
+	return prefix;
+}
+
+static uint32_t perf_item_hash(void const *data)
+{
+	perf_item_t const *item = data;
+
+	return fr_hash(item->key, item->keylen);
+}
+
+static int perf_item_key(uint8_t **out, size_t *outlen, void const *data)
+{
+	perf_item_t const *item = data;
+
+	*out = UNCONST(uint8_t *, item->key);
+	*outlen = item->keylen * 8;
+	return 0;
+}
+
+/*
+ *	rb tree, with the node inline in the item.
+ */
+static void *perf_rb_alloc(TALLOC_CTX *ctx)
+{
+	return fr_rb_inline_alloc(ctx, perf_item_t, node, perf_item_cmp, NULL);
+}
+
+static bool perf_rb_insert(void *ds, perf_item_t *item)
+{
+	return fr_rb_insert(ds, item);
+}
+
+static void *perf_rb_find(void *ds, perf_item_t *item)
+{
+	return fr_rb_find(ds, item);
+}
+
+static unsigned int perf_rb_iterate(void *ds)
+{
+	fr_rb_iter_inorder_t	iter;
+	unsigned int		count = 0;
+	void			*data;
+
+	for (data = fr_rb_iter_init_inorder(&iter, ds);
+	     data;
+	     data = fr_rb_iter_next_inorder(&iter)) count++;
+
+	return count;
+}
+
+static bool perf_rb_remove(void *ds, perf_item_t *item)
+{
+	return fr_rb_remove(ds, item) != NULL;
+}
+
+/*
+ *	B+tree, with key prefixes stored in the nodes.
+ */
+static void *perf_btree_alloc(TALLOC_CTX *ctx)
+{
+	return fr_btree_alloc(ctx, perf_item_cmp, perf_item_prefix, NULL);
+}
+
+static bool perf_btree_insert(void *ds, perf_item_t *item)
+{
+	return fr_btree_insert(ds, item);
+}
+
+static void *perf_btree_find(void *ds, perf_item_t *item)
+{
+	return fr_btree_find(ds, item);
+}
+
+static unsigned int perf_btree_iterate(void *ds)
+{
+	fr_btree_iter_t		iter;
+	unsigned int		count = 0;
+	void			*data;
+
+	for (data = fr_btree_iter_init(&iter, ds);
+	     data;
+	     data = fr_btree_iter_next(&iter)) count++;
+
+	return count;
+}
+
+static bool perf_btree_remove(void *ds, perf_item_t *item)
+{
+	return fr_btree_remove(ds, item) != NULL;
+}
+
+/*
+ *	Hash table.
+ */
+static void *perf_hash_alloc(TALLOC_CTX *ctx)
+{
+	return fr_hash_table_alloc(ctx, perf_item_hash, perf_item_cmp, NULL);
+}
+
+static bool perf_hash_insert(void *ds, perf_item_t *item)
+{
+	return fr_hash_table_insert(ds, item);
+}
+
+static void *perf_hash_find(void *ds, perf_item_t *item)
+{
+	return fr_hash_table_find(ds, item);
+}
+
+static unsigned int perf_hash_iterate(void *ds)
+{
+	fr_hash_iter_t	iter;
+	unsigned int	count = 0;
+	void		*data;
+
+	for (data = fr_hash_table_iter_init(ds, &iter);
+	     data;
+	     data = fr_hash_table_iter_next(ds, &iter)) count++;
+
+	return count;
+}
+
+static bool perf_hash_remove(void *ds, perf_item_t *item)
+{
+	return fr_hash_table_remove(ds, item) != NULL;
+}
+
+/*
+ *	Open addressing hash table.
+ */
+static void *perf_oa_hash_alloc(TALLOC_CTX *ctx)
+{
+	return fr_oa_hash_alloc(ctx, perf_item_hash, perf_item_cmp, NULL);
+}
+
+static bool perf_oa_hash_insert(void *ds, perf_item_t *item)
+{
+	return fr_oa_hash_insert(ds, item);
+}
+
+static void *perf_oa_hash_find(void *ds, perf_item_t *item)
+{
+	return fr_oa_hash_find(ds, item);
+}
+
+static unsigned int perf_oa_hash_iterate(void *ds)
+{
+	fr_oa_hash_iter_t	iter;
+	unsigned int		count = 0;
+	void			*data;
+
+	for (data = fr_oa_hash_iter_init(ds, &iter);
+	     data;
+	     data = fr_oa_hash_iter_next(ds, &iter)) count++;
+
+	return count;
+}
+
+static bool perf_oa_hash_remove(void *ds, perf_item_t *item)
+{
+	return fr_oa_hash_remove(ds, item) != NULL;
+}
+
+/*
+ *	Prefix trie.
+ */
+static void *perf_trie_alloc(TALLOC_CTX *ctx)
+{
+	return fr_trie_alloc(ctx, perf_item_key, NULL);
+}
+
+static bool perf_trie_insert(void *ds, perf_item_t *item)
+{
+	return fr_trie_insert(ds, item);
+}
+
+static void *perf_trie_find(void *ds, perf_item_t *item)
+{
+	return fr_trie_find(ds, item);
+}
+
+static int _perf_trie_count(UNUSED uint8_t const *key, UNUSED size_t keylen, UNUSED void *data, void *uctx)
+{
+	unsigned int *count = uctx;
+
+	(*count)++;
+	return 0;
+}
+
+static unsigned int perf_trie_iterate(void *ds)
+{
+	unsigned int count = 0;
+
+	(void) fr_trie_walk(ds, &count, _perf_trie_count);
+
+	return count;
+}
+
+static bool perf_trie_remove(void *ds, perf_item_t *item)
+{
+	return fr_trie_remove(ds, item) != NULL;
+}
+
+/*
+ *	htrie, which dispatches to one of the above.
+ */
+#define PERF_HTRIE_ALLOC(_name, _type) \
+static void *perf_htrie_ ## _name ## _alloc(TALLOC_CTX *ctx) \
+{ \
+	return fr_htrie_alloc(ctx, _type, perf_item_hash, perf_item_cmp, perf_item_key, NULL); \
+}
+
+PERF_HTRIE_ALLOC(hash, FR_HTRIE_HASH)
+PERF_HTRIE_ALLOC(rb, FR_HTRIE_RB)
+PERF_HTRIE_ALLOC(trie, FR_HTRIE_TRIE)
+PERF_HTRIE_ALLOC(oa_hash, FR_HTRIE_OA_HASH)
+
+static bool perf_htrie_insert(void *ds, perf_item_t *item)
+{
+	return fr_htrie_insert(ds, item);
+}
+
+static void *perf_htrie_find(void *ds, perf_item_t *item)
+{
+	return fr_htrie_find(ds, item);
+}
+
+static bool perf_htrie_remove(void *ds, perf_item_t *item)
+{
+	return fr_htrie_remove(ds, item) != NULL;
+}
+
+/*
+ *	Heap and LST.  These are priority queues, so "find" is a
+ *	peek at the head, and "remove" extracts an arbitrary element.
+ */
+static void *perf_heap_alloc(TALLOC_CTX *ctx)
+{
+	return fr_heap_alloc(ctx, perf_item_prio_cmp, perf_item_t, heap_idx, 0);
+}
+
+static bool perf_heap_insert(void *ds, perf_item_t *item)
+{
+	return fr_heap_insert(ds, item) == 0;
+}
+
+static void *perf_heap_find(void *ds, UNUSED perf_item_t *item)
+{
+	return fr_heap_peek(ds);
+}
+
+static unsigned int perf_heap_iterate(void *ds)
+{
+	fr_heap_iter_t	iter;
+	unsigned int	count = 0;
+	void		*data;
+
+	for (data = fr_heap_iter_init(ds, &iter);
+	     data;
+	     data = fr_heap_iter_next(ds, &iter)) count++;
+
+	return count;
+}
+
+static bool perf_heap_remove(void *ds, perf_item_t *item)
+{
+	return fr_heap_extract(ds, item) == 0;
+}
+
+static void *perf_lst_alloc(TALLOC_CTX *ctx)
+{
+	return fr_lst_alloc(ctx, perf_item_prio_cmp, perf_item_t, lst_idx);
+}
+
+static bool perf_lst_insert(void *ds, perf_item_t *item)
+{
+	return fr_lst_insert(ds, item) == 0;
+}
+
+static void *perf_lst_find(void *ds, UNUSED perf_item_t *item)
+{
+	return fr_lst_peek(ds);
+}
+
+static unsigned int perf_lst_iterate(void *ds)
+{
+	fr_lst_iter_t	iter;
+	unsigned int	count = 0;
+	void		*data;
+
+	for (data = fr_lst_iter_init(ds, &iter);
+	     data;
+	     data = fr_lst_iter_next(ds, &iter)) count++;
+
+	return count;
+}
+
+static bool perf_lst_remove(void *ds, perf_item_t *item)
+{
+	return fr_lst_extract(ds, item) == 0;
+}
+
+/*
+ *	dlist, as a baseline for the cost of a linear search.
+ */
+static void *perf_dlist_alloc(TALLOC_CTX *ctx)
+{
+	fr_dlist_head_t *head;
+
+	head = talloc_zero(ctx, fr_dlist_head_t);
+	if (!head) return NULL;
+
+	fr_dlist_init(head, perf_item_t, entry);
+	return head;
+}
+
+static bool perf_dlist_insert(void *ds, perf_item_t *item)
+{
+	return fr_dlist_insert_tail(ds, item) == 0;
+}
+
+static void *perf_dlist_find(void *ds, perf_item_t *item)
+{
+	perf_item_t *p = NULL;
+
+	while ((p = fr_dlist_next(ds, p))) if (perf_item_cmp(p, item) == 0) return p;
+
+	return NULL;
+}
+
+static unsigned int perf_dlist_iterate(void *ds)
+{
+	perf_item_t	*p = NULL;
+	unsigned int	count = 0;
+
+	while ((p = fr_dlist_next(ds, p))) count++;
+
+	return count;
+}
+
+static bool perf_dlist_remove(void *ds, perf_item_t *item)
+{
+	fr_dlist_remove(ds, item);
+	return true;
+}
+
+/*
+ *	Cache miss counting.
+ */
+#ifdef __linux__
+static int perf_cache_fd = -1;
+
+static void perf_cache_open(void)
+{
+	struct perf_event_attr	attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	/*
+	 *	May fail in containers, or if perf_event_paranoid
+	 *	is too high.  We just don't report cache misses.
+	 */
+	perf_cache_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_cache_start(void)
+{
+	if (perf_cache_fd < 0) return;
+
+	(void) ioctl(perf_cache_fd, PERF_EVENT_IOC_RESET, 0);
+	(void) ioctl(perf_cache_fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static int64_t perf_cache_stop(void)
+{
+	uint64_t count;
+
+	if (perf_cache_fd < 0) return -1;
+
+	(void) ioctl(perf_cache_fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(perf_cache_fd, &count, sizeof(count)) != sizeof(count)) return -1;
+
+	return count;
+}
+#else
+static void perf_cache_open(void) {}
+static void perf_cache_start(void) {}
+static int64_t perf_cache_stop(void) { return -1; }
+#endif
+
+static void perf_report(perf_ops_t const *ops, perf_key_type_t type, char const *op,
+			fr_time_delta_t used, int64_t misses, unsigned int count)
+{
+	if (misses < 0) {
+		TEST_MSG_ALWAYS("%s keys=%s op=%s ns_per_op=%0.1lf cache_misses_per_op=n/a",
+				ops->name, perf_key_names[type], op, (double)used / count);
+		return;
+	}
+
+	TEST_MSG_ALWAYS("%s keys=%s op=%s ns_per_op=%0.1lf cache_misses_per_op=%0.2lf",
+			ops->name, perf_key_names[type], op, (double)used / count, (double)misses / count);
+}
+
+/*
+ *	Time one batch of operations
+ */
+#define PERF_RUN(_op, _count, ...) \
+do { \
+	fr_time_t	_start; \
+	int64_t		_misses; \
+	perf_cache_start(); \
+	_start = fr_time(); \
+	__VA_ARGS__; \
+	used = fr_time() - _start; \
+	_misses = perf_cache_stop(); \
+	perf_report(ops, type, _op, used, _misses, _count); \
+} while (0)
+
+static void perf_run(perf_ops_t const *ops)
+{
+	perf_key_type_t	type;
+
+	for (type = 0; type < PERF_KEY_MAX_TYPE; type++) {
+		TALLOC_CTX	*ctx = talloc_init_const("ds_perf_test");
+		void		*ds;
+		unsigned int	i, failed = 0, found = 0, finds = perf_items;
+		fr_time_delta_t	used;
+
+		ds = ops->alloc(ctx);
+		TEST_ASSERT(ds != NULL);
+
+		PERF_RUN("insert", perf_items,
+			 for (i = 0; i < perf_items; i++) if (!ops->insert(ds, &items[type][i])) failed++);
+		TEST_CHECK(failed == 0);
+		TEST_MSG("%u inserts failed", failed);
+
+		if (ops->find) {
+			if (ops->find == perf_dlist_find) finds = PERF_DLIST_FINDS;
+
+			PERF_RUN(ops->find_name ? ops->find_name : "find", finds,
+				 for (i = 0; i < finds; i++) if (ops->find(ds, &items[type][order[i]])) found++);
+			TEST_CHECK(found == finds);
+			TEST_MSG("Expected %u found, got %u", finds, found);
+		}
+
+		if (ops->iterate) {
+			unsigned int count = 0;
+
+			PERF_RUN("iterate", perf_items, count = ops->iterate(ds));
+			TEST_CHECK(count == perf_items);
+			TEST_MSG("Expected %u items, got %u", perf_items, count);
+		}
+
+		failed = 0;
+		PERF_RUN("delete", perf_items,
+			 for (i = 0; i < perf_items; i++) if (!ops->remove(ds, &items[type][order[i]])) failed++);
+		TEST_CHECK(failed == 0);
+		TEST_MSG("%u deletes failed", failed);
+
+		talloc_free(ctx);
+	}
+}
+
+/*
+ *	Generate keys which look like the ones the server stores.
+ *	Every key is unique, as a duplicate would make the insert
+ *	count wrong.
+ */
+static void perf_items_init(void)
+{
+	fr_fast_rand_t	rand_ctx = { .a = 0x1234, .b = 0x5678 };
+	perf_key_type_t	type;
+	unsigned int	i;
+
+	for (type = 0; type < PERF_KEY_MAX_TYPE; type++) {
+		items[type] = talloc_zero_array(NULL, perf_item_t, perf_items);
+		TEST_ASSERT(items[type] != NULL);
+
+		for (i = 0; i < perf_items; i++) {
+			perf_item_t	*item = &items[type][i];
+			uint32_t	r, j;
+
+			item->prio = fr_fast_rand(&rand_ctx);
+
+			switch (type) {
+			/*
+			 *	NASes are usually in a handful of
+			 *	networks.  Here i is unique, so use
+			 *	it to pick the host part.
+			 */
+			case PERF_KEY_IPV4:
+				r = fr_fast_rand(&rand_ctx);
+				item->key[0] = 10;
+				item->key[1] = (perf_items > 65536) ? (i >> 16) : (r % 4);
+				item->key[2] = (i >> 8) & 0xff;
+				item->key[3] = i & 0xff;
+				item->keylen = 4;
+				break;
+
+			case PERF_KEY_USER_NAME:
+				item->keylen = snprintf((char *) item->key, sizeof(item->key), "user%u@realm%u.example.com",
+							i, fr_fast_rand(&rand_ctx) % 16);
+				break;
+
+			/*
+			 *	The first 4 bytes are i, so that the
+			 *	keys are unique.
+			 */
+			case PERF_KEY_STATE:
+				memcpy(item->key, &i, sizeof(i));
+				for (j = sizeof(i); j < 16; j += sizeof(r)) {
+					r = fr_fast_rand(&rand_ctx);
+					memcpy(item->key + j, &r, sizeof(r));
+				}
+				item->keylen = 16;
+				break;
+
+			case PERF_KEY_MAX_TYPE:
+				break;
+			}
+		}
+	}
+
+	/*
+	 *	Shuffle the order for finds and deletes, so that they
+	 *	don't just walk memory in insertion order.
+	 */
+	order = talloc_array(NULL, unsigned int, perf_items);
+	TEST_ASSERT(order != NULL);
+
+	for (i = 0; i < perf_items; i++) order[i] = i;
+	for (i = perf_items - 1; i > 0; i--) {
+		unsigned int j = fr_fast_rand(&rand_ctx) % (i + 1);
+		unsigned int tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+}
+
+static void perf_init(void)
+{
+	static bool done_init = false;
+
+	if (done_init) return;
+	done_init = true;
+
+	if (getenv("DS_PERF_ITEMS")) {
+		perf_items = strtoul(getenv("DS_PERF_ITEMS"), NULL, 10);
+		TEST_ASSERT((perf_items >= PERF_DLIST_FINDS) && (perf_items <= (1 << 24)));
+		TEST_MSG("DS_PERF_ITEMS must be between %u and %u", PERF_DLIST_FINDS, 1 << 24);
+	}
+
+	fr_time_start();
+	perf_cache_open();
+	perf_items_init();
+}
+
+#define PERF_TEST(_name, ...) \
+static void test_ ## _name(void) \
+{ \
+	static perf_ops_t const ops = { .name = #_name, __VA_ARGS__ }; \
+	perf_init(); \
+	perf_run(&ops); \
+}
+
+PERF_TEST(rb, .alloc = perf_rb_alloc, .insert = perf_rb_insert, .find = perf_rb_find,
+	  .iterate = perf_rb_iterate, .remove = perf_rb_remove)
+PERF_TEST(btree, .alloc = perf_btree_alloc, .insert = perf_btree_insert, .find = perf_btree_find,
+	  .iterate = perf_btree_iterate, .remove = perf_btree_remove)
+PERF_TEST(hash, .alloc = perf_hash_alloc, .insert = perf_hash_insert, .find = perf_hash_find,
+	  .iterate = perf_hash_iterate, .remove = perf_hash_remove)
+PERF_TEST(oa_hash, .alloc = perf_oa_hash_alloc, .insert = perf_oa_hash_insert, .find = perf_oa_hash_find,
+	  .iterate = perf_oa_hash_iterate, .remove = perf_oa_hash_remove)
+PERF_TEST(trie, .alloc = perf_trie_alloc, .insert = perf_trie_insert, .find = perf_trie_find,
+	  .iterate = perf_trie_iterate, .remove = perf_trie_remove)
+PERF_TEST(htrie_hash, .alloc = perf_htrie_hash_alloc, .insert = perf_htrie_insert, .find = perf_htrie_find,
+	  .remove = perf_htrie_remove)
+PERF_TEST(htrie_rb, .alloc = perf_htrie_rb_alloc, .insert = perf_htrie_insert, .find = perf_htrie_find,
+	  .remove = perf_htrie_remove)
+PERF_TEST(htrie_trie, .alloc = perf_htrie_trie_alloc, .insert = perf_htrie_insert, .find = perf_htrie_find,
+	  .remove = perf_htrie_remove)
+PERF_TEST(htrie_oa_hash, .alloc = perf_htrie_oa_hash_alloc, .insert = perf_htrie_insert, .find = perf_htrie_find,
+	  .remove = perf_htrie_remove)
+PERF_TEST(heap, .find_name = "peek", .alloc = perf_heap_alloc, .insert = perf_heap_insert, .find = perf_heap_find,
+	  .iterate = perf_heap_iterate, .remove = perf_heap_remove)
+PERF_TEST(lst, .find_name = "peek", .alloc = perf_lst_alloc, .insert = perf_lst_insert, .find = perf_lst_find,
+	  .iterate = perf_lst_iterate, .remove = perf_lst_remove)
+PERF_TEST(dlist, .alloc = perf_dlist_alloc, .insert = perf_dlist_insert, .find = perf_dlist_find,
+	  .iterate = perf_dlist_iterate, .remove = perf_dlist_remove)
+
+TEST_LIST = {
+	{ "rb",			test_rb },
+	{ "btree",		test_btree },
+	{ "hash",		test_hash },
+	{ "oa_hash",		test_oa_hash },
+	{ "trie",		test_trie },
+	{ "htrie_hash",		test_htrie_hash },
+	{ "htrie_rb",		test_htrie_rb },
+	{ "htrie_trie",		test_htrie_trie },
+	{ "htrie_oa_hash",	test_htrie_oa_hash },
+	{ "heap",		test_heap },
+	{ "lst",		test_lst },
+	{ "dlist",		test_dlist },
+
+	{ NULL }
+};
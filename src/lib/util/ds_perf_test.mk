@@ -0,0 +1,6 @@
+TARGET		:= ds_perf_test
+SOURCES		:= ds_perf_test.c
+
+TGT_INSTALLDIR	:=
+TGT_LDLIBS	:= $(LIBS)
+TGT_PREREQS	:= libfreeradius-util.la
@@ -110,6 +110,11 @@ struct fr_event_timer {
 	fr_lst_index_t		lst_id;	     	  	//!< Where to store opaque lst data.
 	fr_dlist_t		entry;			//!< List of deferred timer events.
 
+	bool			coarse;			//!< May fire up to one wheel tick late.
+	uint8_t			wheel_level;		//!< Level of the wheel this event is in.
+	uint8_t			wheel_slot;		//!< Slot of the wheel level this event is in.
+	fr_dlist_t		wheel_entry;		//!< Entry in a wheel slot, or the list of expired events.
+
 	fr_event_list_t		*el;			//!< Event list containing this timer.
 
 #ifndef NDEBUG
@@ -258,10 +263,6 @@ static size_t fr_event_fd_type_table_len = NUM_ELEMENTS(fr_event_fd_type_table);
  *
  */
 struct fr_event_fd {
-	fr_rb_node_t		node;			//!< Entry in the tree of file descriptor handles.
-							///< this should really go away and we should pass around
-							///< handles directly.
-
 	fr_event_list_t		*el;			//!< because talloc_parent() is O(N) in number of objects
 	fr_event_filter_t	filter;
 	int			fd;			//!< File descriptor we're listening for events on.
@@ -347,12 +348,52 @@ typedef struct {
 } fr_event_user_t;
 
 
+/** Number of bits of fr_time_t below the resolution of the timer wheel
+ *
+ * Ticks are 2^20ns, or just over 1ms.
+ */
+#define FR_EVENT_WHEEL_TICK_SHIFT	(20)
+
+/** Number of bits of the tick used to pick a slot on each level
+ *
+ */
+#define FR_EVENT_WHEEL_SLOT_BITS	(6)
+#define FR_EVENT_WHEEL_SLOTS		(1 << FR_EVENT_WHEEL_SLOT_BITS)
+
+/** Number of levels in the timer wheel
+ *
+ * Four levels of 64 slots cover 2^24 ticks, or just under 5 hours.
+ * Coarse timers further out than that go into the lst.
+ */
+#define FR_EVENT_WHEEL_LEVELS		(4)
+
+/** Hierarchical timer wheel for coarse timers
+ *
+ * Insertion and deletion are O(1).  Level 0 holds the events due in
+ * the current block of 64 ticks, one slot per tick.  Each higher
+ * level holds events due in later blocks, one slot per block of the
+ * level below.  When the wheel reaches the start of a block, the
+ * matching slot of the higher level is moved down a level.
+ */
+typedef struct {
+	uint64_t		current;		//!< All ticks up to, and including this one, have been
+							///< processed.
+	uint64_t		num;			//!< Number of events in the wheel, including expired ones.
+	uint64_t		occupied[FR_EVENT_WHEEL_LEVELS];	//!< Bitmap of non-empty slots on each level.
+	fr_dlist_head_t		slots[FR_EVENT_WHEEL_LEVELS][FR_EVENT_WHEEL_SLOTS];
+	fr_dlist_head_t		expired;		//!< Events which are due, in the order they became due.
+} fr_event_wheel_t;
+
 /** Stores all information relating to an event list
  *
  */
 struct fr_event_list {
 	fr_lst_t		*times;			//!< of timer events to be executed.
-	fr_rb_tree_t		*fds;			//!< Tree used to track FDs with filters in kqueue.
+	fr_event_wheel_t	wheel;			//!< of coarse timer events to be executed.
+	fr_event_fd_t		**fds;			//!< Table used to track FDs with filters in kqueue.
+							///< Indexed by (fd * FR_EVENT_FILTER_NUM) + (filter - 1).
+	size_t			fds_len;		//!< Number of slots in the fds table.
+	uint64_t		num_fds;		//!< Number of fd/filter pairs in the fds table.
 #ifdef LOCAL_PID
 	fr_lst_t		*pids;			//!< PIDs to wait for
 #endif
@@ -403,19 +444,401 @@ static int8_t fr_event_timer_cmp(void const *a, void const *b)
 	return fr_time_cmp(ev_a->when, ev_b->when);
 }
 
-/** Compare two file descriptor handles
+/** Convert a time to a wheel tick, rounding down
+ *
+ */
+static inline uint64_t event_wheel_tick(fr_time_t when)
+{
+	if (when < 0) return 0;
+
+	return ((uint64_t) when) >> FR_EVENT_WHEEL_TICK_SHIFT;
+}
+
+/** Convert a time to a wheel tick, rounding up
+ *
+ */
+static inline uint64_t event_wheel_tick_up(fr_time_t when)
+{
+	return event_wheel_tick(when + ((1 << FR_EVENT_WHEEL_TICK_SHIFT) - 1));
+}
+
+/** Whether there are any events in the wheel which are not yet due
+ *
+ */
+static inline bool event_wheel_pending(fr_event_wheel_t const *wheel)
+{
+	unsigned int i;
+
+	for (i = 0; i < FR_EVENT_WHEEL_LEVELS; i++) if (wheel->occupied[i]) return true;
+
+	return false;
+}
+
+/** Put an event into the slot for a particular tick
+ *
+ * Events for ticks which have already been processed go onto the
+ * expired list.
+ *
+ * @param[in] wheel	to insert the event into.
+ * @param[in] ev	to insert.
+ * @param[in] tick	the event is due.
+ * @return
+ *	- true if the event was inserted.
+ *	- false if the event is too far in the future for the wheel.
+ */
+static bool event_wheel_place(fr_event_wheel_t *wheel, fr_event_timer_t *ev, uint64_t tick)
+{
+	unsigned int	level, slot;
+
+	if (tick <= wheel->current) {
+		ev->wheel_level = FR_EVENT_WHEEL_LEVELS;
+		fr_dlist_insert_tail(&wheel->expired, ev);
+		return true;
+	}
+
+	/*
+	 *	The level is picked by the highest bit where the tick
+	 *	differs from the current one.  So an event is only
+	 *	ever in a slot of its own block, or of a later one.
+	 */
+	level = (fr_high_bit_pos(tick ^ wheel->current) - 1) / FR_EVENT_WHEEL_SLOT_BITS;
+	if (level >= FR_EVENT_WHEEL_LEVELS) return false;
+
+	slot = (tick >> (level * FR_EVENT_WHEEL_SLOT_BITS)) & (FR_EVENT_WHEEL_SLOTS - 1);
+
+	ev->wheel_level = level;
+	ev->wheel_slot = slot;
+	fr_dlist_insert_tail(&wheel->slots[level][slot], ev);
+	wheel->occupied[level] |= ((uint64_t) 1) << slot;
+
+	return true;
+}
+
+/** Insert a coarse timer event into the wheel
+ *
+ * The tick is rounded up, so that events never fire early.
+ *
+ * @param[in] el	containing the wheel.
+ * @param[in] ev	to insert.
+ * @return
+ *	- true if the event was inserted.
+ *	- false if the event should go into the lst instead.
+ */
+static bool event_wheel_insert(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	fr_event_wheel_t	*wheel = &el->wheel;
+	uint64_t		tick;
+
+	/*
+	 *	The wheel may not have moved for a while if it was
+	 *	empty, so catch it up to the current time.
+	 */
+	if (!wheel->num) {
+		tick = event_wheel_tick(el->time());
+		if (tick > wheel->current) wheel->current = tick;
+	}
+
+	tick = event_wheel_tick_up(ev->when);
+	if (tick <= wheel->current) tick = wheel->current + 1;
+
+	if (!event_wheel_place(wheel, ev, tick)) return false;
+
+	wheel->num++;
+	return true;
+}
+
+/** Remove a coarse timer event from the wheel
+ *
+ */
+static void event_wheel_remove(fr_event_wheel_t *wheel, fr_event_timer_t *ev)
+{
+	fr_dlist_head_t		*head;
+
+	fr_assert(wheel->num > 0);
+
+	if (ev->wheel_level == FR_EVENT_WHEEL_LEVELS) {
+		(void) fr_dlist_remove(&wheel->expired, ev);
+
+	} else {
+		head = &wheel->slots[ev->wheel_level][ev->wheel_slot];
+
+		(void) fr_dlist_remove(head, ev);
+		if (fr_dlist_empty(head)) wheel->occupied[ev->wheel_level] &= ~(((uint64_t) 1) << ev->wheel_slot);
+	}
+
+	wheel->num--;
+}
+
+/** Move all of the events in a slot either to a lower level, or to the expired list
+ *
+ */
+static void event_wheel_cascade(fr_event_wheel_t *wheel, unsigned int level, unsigned int slot)
+{
+	fr_dlist_head_t		*head = &wheel->slots[level][slot];
+	fr_event_timer_t	*ev;
+
+	while ((ev = fr_dlist_pop_head(head)) != NULL) {
+		bool inserted;
+
+		inserted = event_wheel_place(wheel, ev, event_wheel_tick_up(ev->when));
+		fr_assert(inserted);
+	}
+
+	wheel->occupied[level] &= ~(((uint64_t) 1) << slot);
+}
+
+/** Return the next tick which has to be processed
+ *
+ * This is either the next non-empty slot of level 0, or the start of
+ * the block of the next non-empty slot on a higher level, where it's
+ * cascaded.  Every slot on a level is for a block after the current
+ * one, and shares the higher levels with the current tick, so the
+ * earliest of these is the next tick with work to do.  Blocks whose
+ * slots are empty are skipped entirely.
+ *
+ * @param[in] wheel	to check.  Must have events which are not yet due.
+ */
+static inline uint64_t event_wheel_next_tick(fr_event_wheel_t const *wheel)
+{
+	uint64_t	next = UINT64_MAX;
+	unsigned int	level;
+
+	for (level = 0; level < FR_EVENT_WHEEL_LEVELS; level++) {
+		unsigned int	shift = level * FR_EVENT_WHEEL_SLOT_BITS;
+		unsigned int	digit = (wheel->current >> shift) & (FR_EVENT_WHEEL_SLOTS - 1);
+		uint64_t	bits, tick;
+
+		/*
+		 *	Only the slots after the current one.
+		 */
+		if (digit == (FR_EVENT_WHEEL_SLOTS - 1)) continue;
+		bits = wheel->occupied[level] & (~((uint64_t) 0) << (digit + 1));
+		if (!bits) continue;
+
+		tick = (wheel->current >> (shift + FR_EVENT_WHEEL_SLOT_BITS)) << (shift + FR_EVENT_WHEEL_SLOT_BITS);
+		tick |= ((uint64_t) (fr_high_bit_pos(bits & -bits) - 1)) << shift;
+
+		if (tick < next) next = tick;
+	}
+
+	return next;
+}
+
+/** Process all wheel ticks up to a particular time
+ *
+ * Events which become due are moved to the expired list.  The wheel
+ * jumps straight to the next tick with work to do, whether that's a
+ * non-empty slot of level 0, or a block whose higher level slot has
+ * to be cascaded.
+ *
+ * @param[in] wheel	to advance.
+ * @param[in] now	The current time.
+ */
+static void event_wheel_advance(fr_event_wheel_t *wheel, fr_time_t now)
+{
+	uint64_t	target = event_wheel_tick(now);
+
+	while (wheel->current < target) {
+		uint64_t	next;
+		unsigned int	level;
+
+		if (!event_wheel_pending(wheel)) {
+			wheel->current = target;
+			return;
+		}
+
+		next = event_wheel_next_tick(wheel);
+		if (next > target) {
+			wheel->current = target;
+			return;
+		}
+
+		wheel->current = next;
+
+		/*
+		 *	Cascade the higher levels first, so that their
+		 *	events end up in the right place on level 0.
+		 */
+		for (level = FR_EVENT_WHEEL_LEVELS - 1; level > 0; level--) {
+			unsigned int shift = level * FR_EVENT_WHEEL_SLOT_BITS;
+
+			if (next & ((((uint64_t) 1) << shift) - 1)) continue;
+
+			event_wheel_cascade(wheel, level, (next >> shift) & (FR_EVENT_WHEEL_SLOTS - 1));
+		}
+
+		event_wheel_cascade(wheel, 0, next & (FR_EVENT_WHEEL_SLOTS - 1));
+	}
+}
+
+/** Return when the wheel next has to be advanced
+ *
+ * @param[in] wheel	to check.
+ * @param[out] when	the wheel next has work to do.
+ * @return
+ *	- true if there are events in the wheel.
+ *	- false if the wheel is empty.
+ */
+static bool event_wheel_next(fr_event_wheel_t const *wheel, fr_time_t *when)
+{
+	if (!wheel->num) return false;
+
+	if (!fr_dlist_empty(&wheel->expired)) {
+		*when = (fr_time_t) (wheel->current << FR_EVENT_WHEEL_TICK_SHIFT);
+		return true;
+	}
+
+	*when = (fr_time_t) (event_wheel_next_tick(wheel) << FR_EVENT_WHEEL_TICK_SHIFT);
+	return true;
+}
+
+/** Insert a timer event into the wheel or the lst, as appropriate
+ *
+ */
+static inline int event_timer_insert(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	if (ev->coarse && event_wheel_insert(el, ev)) return 0;
+
+	return fr_lst_insert(el->times, ev);
+}
+
+/** Return when the next timer event is due
+ *
+ * @param[in] el	to check.
+ * @param[out] when	the next timer event is due.
+ * @return
+ *	- true if there are timer events.
+ *	- false if there are no timer events.
+ */
+static bool event_timer_next(fr_event_list_t *el, fr_time_t *when)
+{
+	fr_event_timer_t	*ev;
+	fr_time_t		wheel_when;
+
+	ev = fr_lst_peek(el->times);
+	if (!event_wheel_next(&el->wheel, &wheel_when)) {
+		if (!ev) return false;
+
+		*when = ev->when;
+		return true;
+	}
+
+	*when = (ev && (ev->when < wheel_when)) ? ev->when : wheel_when;
+	return true;
+}
+
+/** Number of filters each file descriptor has a slot for in the fds table
+ *
+ */
+#define FR_EVENT_FILTER_NUM	(FR_EVENT_FILTER_VNODE)
+
+/** Initial number of file descriptors the fds table has room for
+ *
+ */
+#define FR_EVENT_FDS_INIT	(64)
+
+/** Return the fds table slot for a file descriptor/filter pair
+ *
+ * @param[in] fd	file descriptor.
+ * @param[in] filter	the fd is registered with.
+ * @return the index of the slot in el->fds.
+ */
+static inline CC_HINT(always_inline) size_t fr_event_fd_slot(int fd, fr_event_filter_t filter)
+{
+	return ((size_t)fd * FR_EVENT_FILTER_NUM) + (filter - 1);
+}
+
+/** Find the event associated with a file descriptor/filter pair
+ *
+ * This is a direct index into the fds table, so unlike a tree lookup it
+ * costs the same no matter how many file descriptors are registered.
+ *
+ * @param[in] el	to search in.
+ * @param[in] fd	file descriptor.
+ * @param[in] filter	the fd is registered with.
+ * @return
+ *	- The event on success.
+ *	- NULL if no event is registered for the fd/filter pair.
+ */
+static inline CC_HINT(always_inline) fr_event_fd_t *fr_event_fd_find(fr_event_list_t *el, int fd, fr_event_filter_t filter)
+{
+	size_t slot;
+
+	if (unlikely((fd < 0) || (filter < FR_EVENT_FILTER_IO) || (filter > FR_EVENT_FILTER_NUM))) return NULL;
+
+	slot = fr_event_fd_slot(fd, filter);
+	if (slot >= el->fds_len) return NULL;
+
+	return el->fds[slot];
+}
+
+/** Ensure the fds table has room for a file descriptor
+ *
+ * @param[in] el	to grow the table in.
+ * @param[in] fd	file descriptor which needs a slot.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int fr_event_fd_reserve(fr_event_list_t *el, int fd)
+{
+	fr_event_fd_t	**fds;
+	size_t		len;
+
+	if (unlikely(fd < 0)) {
+		fr_strerror_printf("Invalid FD %i", fd);
+		return -1;
+	}
+
+	if (fr_event_fd_slot(fd, FR_EVENT_FILTER_NUM) < el->fds_len) return 0;
+
+	len = el->fds_len ? el->fds_len : (FR_EVENT_FDS_INIT * FR_EVENT_FILTER_NUM);
+	while (len <= fr_event_fd_slot(fd, FR_EVENT_FILTER_NUM)) len *= 2;
+
+	fds = talloc_realloc(el, el->fds, fr_event_fd_t *, len);
+	if (unlikely(!fds)) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+	memset(fds + el->fds_len, 0, (len - el->fds_len) * sizeof(*fds));
+
+	el->fds = fds;
+	el->fds_len = len;
+
+	return 0;
+}
+
+/** Add an event to the fds table
+ *
+ * The caller must have called #fr_event_fd_reserve for the fd first.
  *
- * @param[in] one the first file descriptor handle.
- * @param[in] two the second file descriptor handle.
- * @return CMP(one, two)
+ * @param[in] el	to add the event to.
+ * @param[in] ef	to add.
  */
-static int8_t fr_event_fd_cmp(void const *one, void const *two)
+static inline CC_HINT(always_inline) void fr_event_fd_table_insert(fr_event_list_t *el, fr_event_fd_t *ef)
 {
-	fr_event_fd_t const	*a = one, *b = two;
+	size_t slot = fr_event_fd_slot(ef->fd, ef->filter);
 
-	CMP_RETURN(a, b, fd);
+	fr_assert(slot < el->fds_len);
+	fr_assert(!el->fds[slot]);
 
-	return CMP(a->filter, b->filter);
+	el->fds[slot] = ef;
+	el->num_fds++;
+}
+
+/** Remove an event from the fds table
+ *
+ * @param[in] el	to remove the event from.
+ * @param[in] ef	to remove.
+ */
+static inline CC_HINT(always_inline) void fr_event_fd_table_remove(fr_event_list_t *el, fr_event_fd_t *ef)
+{
+	size_t slot = fr_event_fd_slot(ef->fd, ef->filter);
+
+	if (unlikely((slot >= el->fds_len) || (el->fds[slot] != ef))) return;
+
+	el->fds[slot] = NULL;
+	el->num_fds--;
 }
 
 #ifdef LOCAL_PID
@@ -434,7 +857,7 @@ uint64_t fr_event_list_num_fds(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
-	return fr_rb_num_elements(el->fds);
+	return el->num_fds;
 }
 
 /** Return the number of timer events currently scheduled
@@ -446,7 +869,7 @@ uint64_t fr_event_list_num_timers(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
-	return fr_lst_num_elements(el->times);
+	return fr_lst_num_elements(el->times) + el->wheel.num;
 }
 
 /** Return the kq associated with an event list.
@@ -683,7 +1106,7 @@ static int fr_event_fd_type_set(fr_event_fd_t *ef, int fd)
 	return 0;
 }
 
-/** Remove a file descriptor from the event loop and rbtree but don't explicitly free it
+/** Remove a file descriptor from the event loop and fds table but don't explicitly free it
  *
  *
  * @param[in] ef	to remove.
@@ -725,7 +1148,7 @@ static int _event_fd_delete(fr_event_fd_t *ef)
 			}
 		}
 
-		fr_rb_delete(el->fds, ef);
+		fr_event_fd_table_remove(el, ef);
 		ef->is_registered = false;
 	}
 
@@ -787,7 +1210,7 @@ int _fr_event_fd_move(NDEBUG_LOCATION_ARGS
 	/*
 	 *	Ensure this exists
 	 */
-	ef = fr_rb_find(src->fds, &(fr_event_fd_t){ .fd = fd, .filter = filter });
+	ef = fr_event_fd_find(src, fd, filter);
 	if (unlikely(!ef)) {
 		fr_strerror_printf("No events are registered for fd %i", fd);
 		return -1;
@@ -833,7 +1256,7 @@ int _fr_event_filter_update(NDEBUG_LOCATION_ARGS
 	struct kevent		evset[10];
 	int			count = 0;
 
-	ef = fr_rb_find(el->fds, &(fr_event_fd_t){ .fd = fd, .filter = filter });
+	ef = fr_event_fd_find(el, fd, filter);
 	if (unlikely(!ef)) {
 		fr_strerror_printf("No events are registered for fd %i", fd);
 		return -1;
@@ -929,7 +1352,7 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 	}
 
 	if (!ef_out || !*ef_out) {
-		ef = fr_rb_find(el->fds, &(fr_event_fd_t){ .fd = fd, .filter = filter });
+		ef = fr_event_fd_find(el, fd, filter);
 	} else {
 		ef = *ef_out;
 		fr_assert((fd < 0) || (ef->fd == fd));
@@ -945,7 +1368,7 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 
 	/*
 	 *	No pre-existing event.  Allocate an entry
-	 *	for insertion into the rbtree.
+	 *	for insertion into the fds table.
 	 */
 	if (!ef) {
 		ef = talloc_zero(el, fr_event_fd_t);
@@ -968,7 +1391,7 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 		 *	Determine what type of file descriptor
 		 *	this is.
 		 */
-		if (fr_event_fd_type_set(ef, fd) < 0) {
+		if ((fr_event_fd_type_set(ef, fd) < 0) || (fr_event_fd_reserve(el, fd) < 0)) {
 		free:
 			talloc_free(ef);
 			return -1;
@@ -996,7 +1419,7 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 		}
 
 		ef->filter = filter;
-		fr_rb_insert(el->fds, ef);
+		fr_event_fd_table_insert(el, ef);
 		ef->is_registered = true;
 
 	/*
@@ -1088,7 +1511,7 @@ int fr_event_fd_delete(fr_event_list_t *el, int fd, fr_event_filter_t filter)
 {
 	fr_event_fd_t	*ef;
 
-	ef = fr_rb_find(el->fds, &(fr_event_fd_t){ .fd = fd, .filter = filter });
+	ef = fr_event_fd_find(el, fd, filter);
 	if (unlikely(!ef)) {
 		fr_strerror_printf("No events are registered for fd %i", fd);
 		return -1;
@@ -1126,7 +1549,7 @@ int fr_event_fd_armour(fr_event_list_t *el, int fd, fr_event_filter_t filter, ui
 {
 	fr_event_fd_t	*ef;
 
-	ef = fr_rb_find(el->fds, &(fr_event_fd_t){ .fd = fd, .filter = filter });
+	ef = fr_event_fd_find(el, fd, filter);
 	if (unlikely(!ef)) {
 		fr_strerror_printf("No events are registered for fd %i", fd);
 		return -1;
@@ -1156,7 +1579,7 @@ int fr_event_fd_unarmour(fr_event_list_t *el, int fd, fr_event_filter_t filter,
 {
 	fr_event_fd_t	*ef;
 
-	ef = fr_rb_find(el->fds, &(fr_event_fd_t){ .fd = fd, .filter = filter });
+	ef = fr_event_fd_find(el, fd, filter);
 	if (unlikely(!ef)) {
 		fr_strerror_printf("No events are registered for fd %i", fd);
 		return -1;
@@ -1183,6 +1606,8 @@ static int _event_timer_free(fr_event_timer_t *ev)
 
 	if (fr_dlist_entry_in_list(&ev->entry)) {
 		(void) fr_dlist_remove(&el->ev_to_add, ev);
+	} else if (fr_dlist_entry_in_list(&ev->wheel_entry)) {
+		event_wheel_remove(&el->wheel, ev);
 	} else {
 		int		ret = fr_lst_extract(el->times, ev);
 		char const	*err_file = "not-available";
@@ -1227,9 +1652,9 @@ static int _event_timer_free(fr_event_timer_t *ev)
  *	- 0 on success.
  *	- -1 on failure.
  */
-int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
-		       TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
-		       fr_time_t when, fr_event_timer_cb_t callback, void const *uctx)
+static int event_timer_at(NDEBUG_LOCATION_ARGS
+			  TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
+			  fr_time_t when, fr_event_timer_cb_t callback, void const *uctx, bool coarse)
 {
 	fr_event_timer_t *ev;
 
@@ -1296,7 +1721,10 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 		 *	will no longer be in the event loop, so check
 		 *	if it's in the lst before extracting it.
 		 */
-		if (!fr_dlist_entry_in_list(&ev->entry)) {
+		if (fr_dlist_entry_in_list(&ev->wheel_entry)) {
+			event_wheel_remove(&el->wheel, ev);
+
+		} else if (!fr_dlist_entry_in_list(&ev->entry)) {
 			int		ret;
 			char const	*err_file = "not-available";
 			int		err_line = 0;
@@ -1324,6 +1752,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 	ev->uctx = uctx;
 	ev->linked_ctx = ctx;
 	ev->parent = ev_p;
+	ev->coarse = coarse;
 #ifndef NDEBUG
 	ev->file = file;
 	ev->line = line;
@@ -1336,7 +1765,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 		 *	multiple times.
 		 */
 		if (!fr_dlist_entry_in_list(&ev->entry)) fr_dlist_insert_head(&el->ev_to_add, ev);
-	} else if (unlikely(fr_lst_insert(el->times, ev) < 0)) {
+	} else if (unlikely(event_timer_insert(el, ev) < 0)) {
 		fr_strerror_const_push("Failed inserting event");
 		talloc_set_destructor(ev, NULL);
 		*ev_p = NULL;
@@ -1349,6 +1778,31 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 	return 0;
 }
 
+/** Insert a timer event into an event list
+ *
+ * @note The talloc parent of the memory returned in ev_p must not be changed.
+ *	 If the lifetime of the event needs to be bound to another context
+ *	 this function should be called with the existing event pointed to by
+ *	 ev_p.
+ *
+ * @param[in] ctx		to bind lifetime of the event to.
+ * @param[in] el		to insert event into.
+ * @param[in,out] ev_p		If not NULL modify this event instead of creating a new one.  This is a parent
+ *				in a temporal sense, not in a memory structure or dependency sense.
+ * @param[in] when		we should run the event.
+ * @param[in] callback		function to execute if the event fires.
+ * @param[in] uctx		user data to pass to the event.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
+		       TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
+		       fr_time_t when, fr_event_timer_cb_t callback, void const *uctx)
+{
+	return event_timer_at(NDEBUG_LOCATION_VALS ctx, el, ev_p, when, callback, uctx, false);
+}
+
 /** Insert a timer event into an event list
  *
  * @note The talloc parent of the memory returned in ev_p must not be changed.
@@ -1380,6 +1834,50 @@ int _fr_event_timer_in(NDEBUG_LOCATION_ARGS
 				  ctx, el, ev_p, now, callback, uctx);
 }
 
+/** Insert a coarse timer event into an event list
+ *
+ * Coarse timers go into a timer wheel, where they are cheaper to
+ * insert and delete than in the lst.  The cost is that they may fire
+ * up to one wheel tick (about 1ms) late.  They're intended for
+ * timeouts which are usually deleted before they fire, such as
+ * max_request_time and cleanup_delay.
+ *
+ * @param[in] ctx		to bind lifetime of the event to.
+ * @param[in] el		to insert event into.
+ * @param[in,out] ev_p		If not NULL modify this event instead of creating a new one.
+ * @param[in] when		we should run the event.
+ * @param[in] callback		function to execute if the event fires.
+ * @param[in] uctx		user data to pass to the event.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int _fr_event_timer_coarse_at(NDEBUG_LOCATION_ARGS
+			      TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
+			      fr_time_t when, fr_event_timer_cb_t callback, void const *uctx)
+{
+	return event_timer_at(NDEBUG_LOCATION_VALS ctx, el, ev_p, when, callback, uctx, true);
+}
+
+/** Insert a coarse timer event into an event list
+ *
+ * @param[in] ctx		to bind lifetime of the event to.
+ * @param[in] el		to insert event into.
+ * @param[in,out] ev_p		If not NULL modify this event instead of creating a new one.
+ * @param[in] delta		In how many nanoseconds to wait before should we execute the event.
+ * @param[in] callback		function to execute if the event fires.
+ * @param[in] uctx		user data to pass to the event.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int _fr_event_timer_coarse_in(NDEBUG_LOCATION_ARGS
+			      TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
+			      fr_time_delta_t delta, fr_event_timer_cb_t callback, void const *uctx)
+{
+	return event_timer_at(NDEBUG_LOCATION_VALS ctx, el, ev_p, el->time() + delta, callback, uctx, true);
+}
+
 /** Delete a timer event from the event list
  *
  * @param[in] ev_p	of the event being deleted.
@@ -1692,23 +2190,28 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 
 	if (unlikely(!el)) return 0;
 
-	if (fr_lst_num_elements(el->times) == 0) {
-		*when = 0;
-		return 0;
-	}
+	/*
+	 *	Coarse timers which are due run first.
+	 */
+	event_wheel_advance(&el->wheel, *when);
 
-	ev = fr_lst_peek(el->times);
+	ev = fr_dlist_head(&el->wheel.expired);
 	if (!ev) {
-		*when = 0;
-		return 0;
-	}
+		fr_time_t next;
 
-	/*
-	 *	See if it's time to do this one.
-	 */
-	if (ev->when > *when) {
-		*when = ev->when;
-		return 0;
+		if (!event_timer_next(el, &next)) {
+			*when = 0;
+			return 0;
+		}
+
+		/*
+		 *	See if it's time to do this one.
+		 */
+		ev = fr_lst_peek(el->times);
+		if (!ev || (ev->when > *when)) {
+			*when = next;
+			return 0;
+		}
 	}
 
 	callback = ev->callback;
@@ -1737,12 +2240,11 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
  */
 int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 {
-	fr_time_t		when, *wake;
+	fr_time_t		when, *wake, next;
 	struct timespec		ts_when, *ts_wake;
 	fr_event_pre_t		*pre;
 	int			num_fd_events;
 	bool			timer_event_ready = false;
-	fr_event_timer_t	*ev;
 #ifdef LOCAL_PID
 	fr_event_pid_t		*pid;
 	fr_lst_iter_t		iter;
@@ -1772,13 +2274,12 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	 *	events are in the past.  Or, we wait for a future
 	 *	timer event.
 	 */
-	ev = fr_lst_peek(el->times);
-	if (ev) {
-		if (ev->when <= el->now) {
+	if (event_timer_next(el, &next)) {
+		if (next <= el->now) {
 			timer_event_ready = true;
 
 		} else if (wait) {
-			when = ev->when - el->now;
+			when = next - el->now;
 
 		} /* else we're not waiting, leave "when == 0" */
 
@@ -2130,7 +2631,7 @@ service:
 	 *	Process any deferred frees performed
 	 *	by the I/O handlers.
 	 *
-	 *	The events are removed from the FD rbtree
+	 *	The events are removed from the fds table
 	 *	and kevent immediately, but frees are
 	 *	deferred to allow stale events to be
 	 *	skipped sans SEGV.
@@ -2151,7 +2652,7 @@ service:
 	 *	Run all of the timer events.  Note that these can add
 	 *	new timers!
 	 */
-	if (fr_lst_num_elements(el->times) > 0) {
+	if (fr_event_list_num_timers(el) > 0) {
 		do {
 			when = el->now;
 		} while (fr_event_timer_run(el, &when) == 1);
@@ -2173,7 +2674,7 @@ service:
 	 */
 	while ((ev = fr_dlist_head(&el->ev_to_add)) != NULL) {
 		(void)fr_dlist_remove(&el->ev_to_add, ev);
-		if (unlikely(fr_lst_insert(el->times, ev) < 0)) {
+		if (unlikely(event_timer_insert(el, ev) < 0)) {
 			talloc_free(ev);
 			fr_assert_msg(0, "failed inserting lst event: %s", fr_strerror());	/* Die in debug builds */
 		}
@@ -2244,9 +2745,17 @@ CC_HINT(flatten) int fr_event_loop(fr_event_list_t *el)
 static int _event_list_free(fr_event_list_t *el)
 {
 	fr_event_timer_t const *ev;
+	unsigned int		i, j;
 
 	while ((ev = fr_lst_peek(el->times)) != NULL) fr_event_timer_delete(&ev);
 
+	while ((ev = fr_dlist_head(&el->wheel.expired)) != NULL) fr_event_timer_delete(&ev);
+	for (i = 0; i < FR_EVENT_WHEEL_LEVELS; i++) {
+		for (j = 0; j < FR_EVENT_WHEEL_SLOTS; j++) {
+			while ((ev = fr_dlist_head(&el->wheel.slots[i][j])) != NULL) fr_event_timer_delete(&ev);
+		}
+	}
+
 	talloc_free_children(el);
 
 	if (el->kq >= 0) close(el->kq);
@@ -2267,6 +2776,7 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 {
 	fr_event_list_t		*el;
 	struct kevent		kev;
+	unsigned int		i, j;
 
 	el = talloc_zero(ctx, fr_event_list_t);
 	if (!fr_cond_assert(el)) {
@@ -2285,12 +2795,6 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		return NULL;
 	}
 
-	el->fds = fr_rb_inline_talloc_alloc(el, fr_event_fd_t, node, fr_event_fd_cmp, NULL);
-	if (!el->fds) {
-		fr_strerror_const("Failed allocating FD tree");
-		goto error;
-	}
-
 #ifdef LOCAL_PID
 	el->pids = fr_lst_talloc_alloc(el, fr_event_pid_cmp, fr_event_pid_t, lst_id);
 	if (!el->pids) {
@@ -2309,6 +2813,13 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 	fr_dlist_talloc_init(&el->post_callbacks, fr_event_post_t, entry);
 	fr_dlist_talloc_init(&el->user_callbacks, fr_event_user_t, entry);
 	fr_dlist_talloc_init(&el->ev_to_add, fr_event_timer_t, entry);
+
+	fr_dlist_talloc_init(&el->wheel.expired, fr_event_timer_t, wheel_entry);
+	for (i = 0; i < FR_EVENT_WHEEL_LEVELS; i++) {
+		for (j = 0; j < FR_EVENT_WHEEL_SLOTS; j++) {
+			fr_dlist_talloc_init(&el->wheel.slots[i][j], fr_event_timer_t, wheel_entry);
+		}
+	}
 	if (status) (void) fr_event_pre_insert(el, status, status_uctx);
 
 	/*
@@ -2342,7 +2853,7 @@ void fr_event_list_set_time_func(fr_event_list_t *el, fr_event_time_source_t fun
  */
 bool fr_event_list_empty(fr_event_list_t *el)
 {
-	return !fr_lst_num_elements(el->times) && !fr_rb_num_elements(el->fds);
+	return !fr_event_list_num_timers(el) && !el->num_fds;
 }
 
 #ifdef WITH_EVENT_DEBUG
@@ -243,6 +243,16 @@ int		_fr_event_timer_in(NDEBUG_LOCATION_ARGS
 				   fr_time_delta_t delta, fr_event_timer_cb_t callback, void const *uctx);
 #define		fr_event_timer_in(...) _fr_event_timer_in(NDEBUG_LOCATION_EXP __VA_ARGS__)
 
+int		_fr_event_timer_coarse_at(NDEBUG_LOCATION_ARGS
+					  TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev,
+					  fr_time_t when, fr_event_timer_cb_t callback, void const *uctx);
+#define		fr_event_timer_coarse_at(...) _fr_event_timer_coarse_at(NDEBUG_LOCATION_EXP __VA_ARGS__)
+
+int		_fr_event_timer_coarse_in(NDEBUG_LOCATION_ARGS
+					  TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev,
+					  fr_time_delta_t delta, fr_event_timer_cb_t callback, void const *uctx);
+#define		fr_event_timer_coarse_in(...) _fr_event_timer_coarse_in(NDEBUG_LOCATION_EXP __VA_ARGS__)
+
 int		fr_event_timer_delete(fr_event_timer_t const **ev);
 
 int		_fr_event_pid_wait(NDEBUG_LOCATION_ARGS
@@ -14,7 +14,7 @@
  *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
  */
 
-/** Functions for a basic binary heaps
+/** Functions for a basic binary heaps, and d-ary heaps with inline keys
  *
  * @file src/lib/util/heap.c
  *
@@ -34,7 +34,22 @@ RCSID("$Id$")
  *	of the minimum element.  The heap entry can contain an "int"
  *	field that holds the entries position in the heap.  The offset
  *	of the field is held inside of the heap structure.
+ *
+ *	"keyed" heaps are different.  Each node is a 64bit key, and
+ *	a pointer to the object.  The key is fetched once, when the
+ *	object is inserted, so most comparisons don't need to touch
+ *	the object at all.  Each node has "fanout" children, which
+ *	makes the heap shallower, and means that the children of a
+ *	node are next to each other in memory.
+ */
+
+/** A node in a keyed heap
+ *
  */
+typedef struct {
+	int64_t		key;			//!< Cached from the element when it was inserted.
+	void		*data;			//!< The element.
+} heap_node_t;
 
 struct fr_heap_s {
 	unsigned int	size;			//!< Number of nodes allocated.
@@ -45,6 +60,10 @@ struct fr_heap_s {
 	char const	*type;			//!< Talloc type of elements.
 	fr_heap_cmp_t	cmp;			//!< Comparator function.
 
+	fr_heap_key_t	key;			//!< Key function for keyed heaps.  May be NULL.
+	unsigned int	fanout;			//!< Number of children each node has in keyed heaps.
+	bool		keyed;			//!< p[] is an array of heap_node_t.
+
 	void		*p[];			//!< Array of nodes.
 };
 typedef struct fr_heap_s heap_t;
@@ -61,6 +80,15 @@ typedef struct fr_heap_s heap_t;
 /* #define HEAP_RIGHT(_x) (2 * (_x) + 1 ) */
 #define	HEAP_SWAP(_a, _b) { void *_tmp = _a; _a = _b; _b = _tmp; }
 
+/*
+ *	The same, for keyed heaps.  Children of i are
+ *	fanout * (i - 1) + 2 ... fanout * i + 1.
+ */
+#define DARY_PARENT(_h, _x)	((((_x) - 2) / (_h)->fanout) + 1)
+#define DARY_FIRST(_h, _x)	(((_h)->fanout * ((_x) - 1)) + 2)
+#define DARY_NODES(_h)		((heap_node_t *)(_h)->p)
+#define HEAP_NODE_SIZE(_h)	((_h)->keyed ? sizeof(heap_node_t) : sizeof(void *))
+
 static void fr_heap_bubble(heap_t *h, fr_heap_index_t child);
 
 /** Return how many bytes need to be allocated to hold a heap of a given size
@@ -75,6 +103,16 @@ size_t fr_heap_pre_alloc_size(unsigned int count)
 	return sizeof(fr_heap_t) + sizeof(heap_t) + sizeof(void *) * count;
 }
 
+/** Return how many bytes need to be allocated to hold a keyed heap of a given size
+ *
+ * @param[in] count	The initial element count.
+ * @return The number of bytes to pre-allocate.
+ */
+size_t fr_heap_dary_pre_alloc_size(unsigned int count)
+{
+	return sizeof(fr_heap_t) + sizeof(heap_t) + sizeof(heap_node_t) * count;
+}
+
 fr_heap_t *_fr_heap_alloc(TALLOC_CTX *ctx, fr_heap_cmp_t cmp, char const *type, size_t offset, unsigned int init)
 {
 	fr_heap_t *hp;
@@ -115,6 +153,68 @@ fr_heap_t *_fr_heap_alloc(TALLOC_CTX *ctx, fr_heap_cmp_t cmp, char const *type,
 	return hp;
 }
 
+/** Create a keyed heap
+ *
+ * Elements are ordered by the key returned by the key function.
+ * Elements with equal keys are ordered by the comparator.  The
+ * comparator must therefore agree with the key, i.e. if key(a) < key(b)
+ * then cmp(a, b) must be negative.
+ *
+ * The key is fetched once, when the element is inserted.  If the
+ * key of an element changes, the element must be extracted, and
+ * re-inserted.
+ *
+ * @param[in] ctx		Talloc ctx to allocate heap in.
+ * @param[in] cmp		Used to order elements with equal keys.
+ * @param[in] key		Returns the key of an element.  If NULL, all keys
+ *				are equal, and only the comparator is used.
+ * @param[in] fanout		Number of children each node has.  Must be
+ *				between 2 and 16.  4 is usually the best choice.
+ * @param[in] type		Talloc type of elements.  May be NULL.
+ * @param[in] offset		Offset of the heap index in the element.
+ * @param[in] init		the initial number of elements to allocate.
+ *				Pass 0 to use the default.
+ * @return
+ *	- A new heap.
+ *	- NULL on error.
+ */
+fr_heap_t *_fr_heap_dary_alloc(TALLOC_CTX *ctx, fr_heap_cmp_t cmp, fr_heap_key_t key, unsigned int fanout,
+			       char const *type, size_t offset, unsigned int init)
+{
+	fr_heap_t *hp;
+	heap_t *h;
+
+	if ((fanout < 2) || (fanout > 16)) {
+		fr_strerror_printf("Invalid heap fanout %u, must be between 2 and 16", fanout);
+		return NULL;
+	}
+
+	if (!init) init = INITIAL_CAPACITY;
+
+	hp = talloc(ctx, fr_heap_t);
+	if (unlikely(!hp)) return NULL;
+
+	h = (heap_t *)talloc_array(hp, uint8_t, sizeof(heap_t) + (sizeof(heap_node_t) * (init + 1)));
+	if (unlikely(!h)) return NULL;
+	talloc_set_type(h, heap_t);
+
+	*h = (heap_t){
+		.size = init,
+		.type = type,
+		.cmp = cmp,
+		.key = key,
+		.fanout = fanout,
+		.keyed = true,
+		.offset = offset
+	};
+
+	DARY_NODES(h)[0] = (heap_node_t){ .data = (void *)UINTPTR_MAX };
+
+	*hp = h;
+
+	return hp;
+}
+
 static inline CC_HINT(always_inline, nonnull) fr_heap_index_t index_get(heap_t *h, void *data)
 {
 	return *((fr_heap_index_t const *)(((uint8_t const *)data) + h->offset));
@@ -128,6 +228,74 @@ static inline CC_HINT(always_inline, nonnull) void index_set(heap_t *h, void *da
 #define OFFSET_SET(_heap, _idx) index_set(_heap, _heap->p[_idx], _idx);
 #define OFFSET_RESET(_heap, _idx) index_set(_heap, _heap->p[_idx], 0);
 
+static inline CC_HINT(always_inline, nonnull) int8_t dary_cmp(heap_t *h, heap_node_t const *a, heap_node_t const *b)
+{
+	int8_t ret;
+
+	ret = CMP(a->key, b->key);
+	if (ret != 0) return ret;
+
+	return h->cmp(a->data, b->data);
+}
+
+/** Move a node up from a hole, until it's in the correct place
+ *
+ */
+static inline CC_HINT(always_inline) void dary_sift_up(heap_t *h, fr_heap_index_t child, heap_node_t node)
+{
+	heap_node_t *nodes = DARY_NODES(h);
+
+	while (child > 1) {
+		fr_heap_index_t parent = DARY_PARENT(h, child);
+
+		if (dary_cmp(h, &nodes[parent], &node) < 0) break;
+
+		nodes[child] = nodes[parent];
+		index_set(h, nodes[child].data, child);
+		child = parent;
+	}
+
+	nodes[child] = node;
+	index_set(h, node.data, child);
+}
+
+/** Move a node down from a hole, until it's in the correct place
+ *
+ */
+static inline CC_HINT(always_inline) void dary_sift_down(heap_t *h, fr_heap_index_t parent, heap_node_t node)
+{
+	heap_node_t	*nodes = DARY_NODES(h);
+	fr_heap_index_t	max = h->num_elements;
+
+	for (;;) {
+		fr_heap_index_t first, last, child, i;
+
+		first = DARY_FIRST(h, parent);
+		if (first > max) break;
+
+		last = first + h->fanout - 1;
+		if (last > max) last = max;
+
+		/*
+		 *	Find the smallest child.  They're all
+		 *	next to each other, so this is cheap.
+		 */
+		child = first;
+		for (i = first + 1; i <= last; i++) {
+			if (dary_cmp(h, &nodes[i], &nodes[child]) < 0) child = i;
+		}
+
+		if (dary_cmp(h, &node, &nodes[child]) <= 0) break;
+
+		nodes[parent] = nodes[child];
+		index_set(h, nodes[parent].data, parent);
+		parent = child;
+	}
+
+	nodes[parent] = node;
+	index_set(h, node.data, parent);
+}
+
 /** Insert a new element into the heap
  *
  * Insert element in heap. Normally, p != NULL, we insert p in a
@@ -187,10 +355,10 @@ int fr_heap_insert(fr_heap_t *hp, void *data)
 			n_size = h->size * 2;
 		}
 
-		h = (heap_t *)talloc_realloc(hp, h, uint8_t, sizeof(heap_t) + (sizeof(void *) * (n_size + 1)));
+		h = (heap_t *)talloc_realloc(hp, h, uint8_t, sizeof(heap_t) + (HEAP_NODE_SIZE(*hp) * (n_size + 1)));
 		if (unlikely(!h)) {
 			fr_strerror_printf("Failed expanding heap to %u elements (%u bytes)",
-					   n_size, (n_size * (unsigned int)sizeof(void *)));
+					   n_size, (n_size * (unsigned int)HEAP_NODE_SIZE(*hp)));
 			return -1;
 		}
 		talloc_set_type(h, heap_t);
@@ -198,6 +366,12 @@ int fr_heap_insert(fr_heap_t *hp, void *data)
 		*hp = h;
 	}
 
+	if (h->keyed) {
+		h->num_elements++;
+		dary_sift_up(h, child, (heap_node_t){ .key = h->key ? h->key(data) : 0, .data = data });
+		return 0;
+	}
+
 	h->p[child] = data;
 	h->num_elements++;
 
@@ -231,6 +405,34 @@ static inline CC_HINT(always_inline) void fr_heap_bubble(heap_t *h, fr_heap_inde
 	OFFSET_SET(h, child);
 }
 
+static int dary_extract(heap_t *h, void *data, fr_heap_index_t idx)
+{
+	heap_node_t	*nodes = DARY_NODES(h);
+	heap_node_t	last;
+
+	if (unlikely(data != nodes[idx].data)) {
+		fr_strerror_printf("Invalid heap index.  Expected data %p at offset %i, got %p", data,
+				   idx, nodes[idx].data);
+		return -1;
+	}
+	index_set(h, data, 0);
+
+	last = nodes[h->num_elements--];
+	if (idx > h->num_elements) return 0;	/* We removed the last element */
+
+	/*
+	 *	Fill the hole with the last element.  It may
+	 *	need to go up, or down.
+	 */
+	if ((idx > 1) && (dary_cmp(h, &last, &nodes[DARY_PARENT(h, idx)]) < 0)) {
+		dary_sift_up(h, idx, last);
+	} else {
+		dary_sift_down(h, idx, last);
+	}
+
+	return 0;
+}
+
 /** Remove a node from the heap
  *
  * @param[in] hp	The heap to extract an element from.
@@ -257,6 +459,8 @@ int fr_heap_extract(fr_heap_t *hp, void *data)
 		return -1;
 	}
 
+	if (h->keyed) return dary_extract(h, data, parent);
+
 	if (unlikely(data != h->p[parent])) {
 		fr_strerror_printf("Invalid heap index.  Expected data %p at offset %i, got %p", data,
 				   parent, h->p[parent]);
@@ -304,6 +508,8 @@ void *fr_heap_peek(fr_heap_t *hp)
 
 	if (h->num_elements == 0) return NULL;
 
+	if (h->keyed) return DARY_NODES(h)[1].data;
+
 	return h->p[1];
 }
 
@@ -315,7 +521,7 @@ void *fr_heap_pop(fr_heap_t *hp)
 
 	if (h->num_elements == 0) return NULL;
 
-	data = h->p[1];
+	data = h->keyed ? DARY_NODES(h)[1].data : h->p[1];
 	if (unlikely(fr_heap_extract(hp, data) < 0)) return NULL;
 
 	return data;
@@ -330,6 +536,8 @@ void *fr_heap_peek_tail(fr_heap_t *hp)
 	/*
 	 *	If this is NULL, we have a problem.
 	 */
+	if (h->keyed) return DARY_NODES(h)[h->num_elements].data;
+
 	return h->p[h->num_elements];
 }
 
@@ -363,6 +571,8 @@ void *fr_heap_iter_init(fr_heap_t *hp, fr_heap_iter_t *iter)
 
 	if (h->num_elements == 0) return NULL;
 
+	if (h->keyed) return DARY_NODES(h)[1].data;
+
 	return h->p[1];
 }
 
@@ -384,5 +594,7 @@ void *fr_heap_iter_next(fr_heap_t *hp, fr_heap_iter_t *iter)
 	if ((*iter + 1) > h->num_elements) return NULL;
 	*iter += 1;
 
+	if (h->keyed) return DARY_NODES(h)[*iter].data;
+
 	return h->p[*iter];
 }
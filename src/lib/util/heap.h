@@ -48,6 +48,12 @@ typedef unsigned int fr_heap_iter_t;
  */
 typedef int8_t (*fr_heap_cmp_t)(void const *a, void const *b);
 
+/** Return the key of a heap element
+ *
+ *  Elements with smaller keys go at the top of the heap.
+ */
+typedef int64_t (*fr_heap_key_t)(void const *data);
+
 /** The main heap structure
  *
  */
@@ -84,6 +90,45 @@ size_t fr_heap_pre_alloc_size(unsigned int count);
 
 fr_heap_t	*_fr_heap_alloc(TALLOC_CTX *ctx, fr_heap_cmp_t cmp, char const *talloc_type, size_t offset, unsigned int init) CC_HINT(nonnull(2));
 
+size_t fr_heap_dary_pre_alloc_size(unsigned int count);
+
+/** Creates a keyed d-ary heap that can be used with non-talloced elements
+ *
+ * The key of each element is stored in the heap, next to the pointer
+ * to the element, so most comparisons don't touch the elements.
+ *
+ * @param[in] _ctx		Talloc ctx to allocate heap in.
+ * @param[in] _cmp		Comparator used to order elements with equal keys.
+ * @param[in] _key		Returns the key of an element.  May be NULL.
+ * @param[in] _fanout		Number of children each node has (2-16).
+ * @param[in] _type		Of elements.
+ * @param[in] _field		to store heap indexes in.
+ * @param[in] _init		the initial number of elements to allocate.
+ *				Pass 0 to use the default.
+ */
+#define fr_heap_dary_alloc(_ctx, _cmp, _key, _fanout, _type, _field, _init) \
+	_fr_heap_dary_alloc(_ctx, _cmp, _key, _fanout, NULL, (size_t)offsetof(_type, _field), _init)
+
+/** Creates a keyed d-ary heap that verifies elements are of a specific talloc type
+ *
+ * @param[in] _ctx		Talloc ctx to allocate heap in.
+ * @param[in] _cmp		Comparator used to order elements with equal keys.
+ * @param[in] _key		Returns the key of an element.  May be NULL.
+ * @param[in] _fanout		Number of children each node has (2-16).
+ * @param[in] _talloc_type	of elements.
+ * @param[in] _field		to store heap indexes in.
+ * @param[in] _init		the initial number of elements to allocate.
+ *				Pass 0 to use the default.
+ * @return
+ *	- A new heap.
+ *	- NULL on error.
+ */
+#define fr_heap_dary_talloc_alloc(_ctx, _cmp, _key, _fanout, _talloc_type, _field, _init) \
+	_fr_heap_dary_alloc(_ctx, _cmp, _key, _fanout, #_talloc_type, (size_t)offsetof(_talloc_type, _field), _init)
+
+fr_heap_t	*_fr_heap_dary_alloc(TALLOC_CTX *ctx, fr_heap_cmp_t cmp, fr_heap_key_t key, unsigned int fanout,
+				     char const *talloc_type, size_t offset, unsigned int init) CC_HINT(nonnull(2));
+
 /** Check if an entry is inserted into a heap
  *
  */
@@ -11,7 +11,7 @@ static bool fr_heap_check(fr_heap_t *hp, void *data)
 	if (!h || (h->num_elements == 0)) return false;
 
 	for (i = 0; i < h->num_elements; i++) {
-		if (h->p[i + 1] == data) {
+		if ((h->keyed ? DARY_NODES(h)[i + 1].data : h->p[i + 1]) == data) {
 			return true;
 		}
 	}
@@ -37,9 +37,26 @@ static int8_t heap_cmp(void const *one, void const *two)
 	return CMP_PREFER_SMALLER(a->data, b->data);
 }
 
+static int64_t heap_key(void const *one)
+{
+	heap_thing const *a = one;
+
+	return a->data;
+}
+
+/*
+ *	fanout of 0 means a binary heap without inline keys.
+ */
+static fr_heap_t *heap_test_alloc(unsigned int fanout)
+{
+	if (!fanout) return fr_heap_alloc(NULL, heap_cmp, heap_thing, heap, 0);
+
+	return fr_heap_dary_alloc(NULL, heap_cmp, heap_key, fanout, heap_thing, heap, 0);
+}
+
 #define HEAP_TEST_SIZE (4096)
 
-static void heap_test(int skip)
+static void heap_test(int skip, unsigned int fanout)
 {
 	fr_heap_t	*hp;
 	int		i;
@@ -54,7 +71,7 @@ static void heap_test(int skip)
 		done_init = true;
 	}
 
-	hp = fr_heap_alloc(NULL, heap_cmp, heap_thing, heap, 0);
+	hp = heap_test_alloc(fanout);
 	TEST_CHECK(hp != NULL);
 
 	array = calloc(HEAP_TEST_SIZE, sizeof(heap_thing));
@@ -121,22 +138,37 @@ static void heap_test(int skip)
 
 static void heap_test_skip_0(void)
 {
-	heap_test(1);
+	heap_test(1, 0);
 }
 
 static void heap_test_skip_2(void)
 {
-	heap_test(2);
+	heap_test(2, 0);
 }
 
 static void heap_test_skip_10(void)
 {
-	heap_test(10);
+	heap_test(10, 0);
+}
+
+static void heap_test_dary4_skip_0(void)
+{
+	heap_test(1, 4);
+}
+
+static void heap_test_dary4_skip_2(void)
+{
+	heap_test(2, 4);
+}
+
+static void heap_test_dary8_skip_10(void)
+{
+	heap_test(10, 8);
 }
 
 #define HEAP_CYCLE_SIZE (1600000)
 
-static void heap_test_order(void)
+static void _heap_test_order(unsigned int fanout)
 {
 	fr_heap_t	*hp;
 	int		i;
@@ -153,7 +185,7 @@ static void heap_test_order(void)
 		done_init = true;
 	}
 
-	hp = fr_heap_alloc(NULL, heap_cmp, heap_thing, heap, 0);
+	hp = heap_test_alloc(fanout);
 	TEST_CHECK(hp != NULL);
 
 	array = calloc(HEAP_TEST_SIZE, sizeof(heap_thing));
@@ -189,7 +221,27 @@ static void heap_test_order(void)
 	free(array);
 }
 
-static void heap_cycle(void)
+static void heap_test_order(void)
+{
+	_heap_test_order(0);
+}
+
+static void heap_test_dary2_order(void)
+{
+	_heap_test_order(2);
+}
+
+static void heap_test_dary4_order(void)
+{
+	_heap_test_order(4);
+}
+
+static void heap_test_dary8_order(void)
+{
+	_heap_test_order(8);
+}
+
+static void _heap_cycle(unsigned int fanout)
 {
 	fr_heap_t	*hp;
 	int		i;
@@ -206,7 +258,7 @@ static void heap_cycle(void)
 		done_init = true;
 	}
 
-	hp = fr_heap_alloc(NULL, heap_cmp, heap_thing, heap, 0);
+	hp = heap_test_alloc(fanout);
 	TEST_CHECK(hp != NULL);
 
 	array = calloc(HEAP_CYCLE_SIZE, sizeof(heap_thing));
@@ -270,7 +322,8 @@ static void heap_cycle(void)
 
 	end = fr_time();
 
-	TEST_MSG_ALWAYS("\ncycle size: %d\n", HEAP_CYCLE_SIZE);
+	TEST_MSG_ALWAYS("\ncycle size: %d, fanout: %u%s\n", HEAP_CYCLE_SIZE, fanout ? fanout : 2,
+			fanout ? " (keyed)" : "");
 	TEST_MSG_ALWAYS("insert: %2.2f s\n", ((double)(start_remove - start_insert)) / NSEC);
 	TEST_MSG_ALWAYS("extract: %2.2f s\n", ((double)(start_swap - start_remove)) / NSEC);
 	TEST_MSG_ALWAYS("swap: %2.2f s\n", ((double)(end - start_swap)) / NSEC);
@@ -279,6 +332,21 @@ static void heap_cycle(void)
 	free(array);
 }
 
+static void heap_cycle(void)
+{
+	_heap_cycle(0);
+}
+
+static void heap_cycle_dary4(void)
+{
+	_heap_cycle(4);
+}
+
+static void heap_cycle_dary8(void)
+{
+	_heap_cycle(8);
+}
+
 TEST_LIST = {
 	/*
 	 *	Basic tests
@@ -288,6 +356,17 @@ TEST_LIST = {
 	{ "heap_test_skip_10",		heap_test_skip_10	},
 	{ "heap_test_order",		heap_test_order		},
 	{ "heap_cycle",			heap_cycle		},
+
+	/*
+	 *	Keyed d-ary heaps
+	 */
+	{ "heap_test_dary4_skip_0",	heap_test_dary4_skip_0	},
+	{ "heap_test_dary4_skip_2",	heap_test_dary4_skip_2	},
+	{ "heap_test_dary8_skip_10",	heap_test_dary8_skip_10	},
+	{ "heap_test_dary2_order",	heap_test_dary2_order	},
+	{ "heap_test_dary4_order",	heap_test_dary4_order	},
+	{ "heap_test_dary8_order",	heap_test_dary8_order	},
+	{ "heap_cycle_dary4",		heap_cycle_dary4	},
+	{ "heap_cycle_dary8",		heap_cycle_dary8	},
 	{ NULL }
 };
-
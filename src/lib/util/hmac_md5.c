@@ -32,17 +32,39 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/talloc.h>
 
 #ifdef HAVE_OPENSSL_EVP_H
 #  include <openssl/hmac.h>
 
 static _Thread_local HMAC_CTX *md5_hmac_ctx;
 
+struct fr_hmac_md5_key_s {
+	HMAC_CTX	*ctx;		//!< Initialised with the key, and never updated.
+};
+
 static void _hmac_md5_ctx_free_on_exit(void *arg)
 {
 	HMAC_CTX_free(arg);
 }
 
+/** Return the thread local HMAC ctx, allocating it if required
+ *
+ */
+static inline HMAC_CTX *hmac_md5_ctx(void)
+{
+	HMAC_CTX *ctx;
+
+	if (likely(md5_hmac_ctx != NULL)) return md5_hmac_ctx;
+
+	ctx = HMAC_CTX_new();
+	if (unlikely(!ctx)) return NULL;
+	fr_atexit_thread_local(md5_hmac_ctx, _hmac_md5_ctx_free_on_exit, ctx);
+
+	return ctx;
+}
+
 /** Calculate HMAC using OpenSSL's MD5 implementation
  *
  * @param digest Caller digest to be filled in.
@@ -57,13 +79,8 @@ void fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *in, size_t in
 {
 	HMAC_CTX *ctx;
 
-	if (unlikely(!md5_hmac_ctx)) {
-		ctx = HMAC_CTX_new();
-		if (unlikely(!ctx)) return;
-		fr_atexit_thread_local(md5_hmac_ctx, _hmac_md5_ctx_free_on_exit, ctx);
-	} else {
-		ctx = md5_hmac_ctx;
-	}
+	ctx = hmac_md5_ctx();
+	if (unlikely(!ctx)) return;
 
 #ifdef EVP_MD_CTX_FLAG_NON_FIPS_ALLOW
 	/* Since MD5 is not allowed by FIPS, explicitly allow it. */
@@ -75,7 +92,82 @@ void fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *in, size_t in
 	HMAC_Final(ctx, digest, NULL);
 	HMAC_CTX_reset(ctx);
 }
+
+static int _hmac_md5_key_free(fr_hmac_md5_key_t *hkey)
+{
+	HMAC_CTX_free(hkey->ctx);
+	return 0;
+}
+
+/** Pre-compute the inner and outer digest states for a key
+ *
+ * @param ctx Talloc context to allocate the key in.
+ * @param key Pointer to authentication key.
+ * @param key_len Length of authentication key.
+ * @return
+ *	- The key, for use with fr_hmac_md5_keyed().
+ *	- NULL on error.
+ */
+fr_hmac_md5_key_t *fr_hmac_md5_key_alloc(TALLOC_CTX *ctx, uint8_t const *key, size_t key_len)
+{
+	fr_hmac_md5_key_t *hkey;
+
+	hkey = talloc_zero(ctx, fr_hmac_md5_key_t);
+	if (unlikely(!hkey)) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	hkey->ctx = HMAC_CTX_new();
+	if (unlikely(!hkey->ctx)) {
+		talloc_free(hkey);
+		goto oom;
+	}
+	talloc_set_destructor(hkey, _hmac_md5_key_free);
+
+#ifdef EVP_MD_CTX_FLAG_NON_FIPS_ALLOW
+	/* Since MD5 is not allowed by FIPS, explicitly allow it. */
+	HMAC_CTX_set_flags(hkey->ctx, EVP_MD_CTX_FLAG_NON_FIPS_ALLOW);
+#endif /* EVP_MD_CTX_FLAG_NON_FIPS_ALLOW */
+
+	if (HMAC_Init_ex(hkey->ctx, key, key_len, EVP_md5(), NULL) != 1) {
+		fr_strerror_const("Failed initialising HMAC-MD5 key");
+		talloc_free(hkey);
+		return NULL;
+	}
+
+	return hkey;
+}
+
+/** Calculate HMAC using a key from fr_hmac_md5_key_alloc()
+ *
+ * The key's ctx is copied, so it can be shared between threads.
+ *
+ * @param digest Caller digest to be filled in.
+ * @param in Pointer to data stream.
+ * @param inlen length of data stream.
+ * @param hkey Pre-computed key.
+ */
+void fr_hmac_md5_keyed(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
+		       fr_hmac_md5_key_t const *hkey)
+{
+	HMAC_CTX *ctx;
+
+	ctx = hmac_md5_ctx();
+	if (unlikely(!ctx)) return;
+
+	HMAC_CTX_copy(ctx, UNCONST(HMAC_CTX *, hkey->ctx));
+	HMAC_Update(ctx, in, inlen);
+	HMAC_Final(ctx, digest, NULL);
+	HMAC_CTX_reset(ctx);
+}
 #else
+struct fr_hmac_md5_key_s {
+	fr_md5_ctx_t	*inner;		//!< State after hashing the key XORd with ipad.
+	fr_md5_ctx_t	*outer;		//!< State after hashing the key XORd with opad.
+};
+
 /** Calculate HMAC using internal MD5 implementation
  *
  * @param digest Caller digest to be filled in.
@@ -147,6 +239,96 @@ void fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *in, size_t in
 
 	fr_md5_ctx_free(&ctx);
 }
+
+static int _hmac_md5_key_free(fr_hmac_md5_key_t *hkey)
+{
+	if (hkey->inner) fr_md5_ctx_free(&hkey->inner);
+	if (hkey->outer) fr_md5_ctx_free(&hkey->outer);
+	return 0;
+}
+
+/** Pre-compute the inner and outer digest states for a key
+ *
+ * @param ctx Talloc context to allocate the key in.
+ * @param key Pointer to authentication key.
+ * @param key_len Length of authentication key.
+ * @return
+ *	- The key, for use with fr_hmac_md5_keyed().
+ *	- NULL on error.
+ */
+fr_hmac_md5_key_t *fr_hmac_md5_key_alloc(TALLOC_CTX *ctx, uint8_t const *key, size_t key_len)
+{
+	fr_hmac_md5_key_t *hkey;
+	uint8_t		k_ipad[64];
+	uint8_t		k_opad[64];
+	uint8_t		tk[16];
+	int i;
+
+	hkey = talloc_zero(ctx, fr_hmac_md5_key_t);
+	if (unlikely(!hkey)) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+	talloc_set_destructor(hkey, _hmac_md5_key_free);
+
+	hkey->inner = fr_md5_ctx_alloc(false);
+	hkey->outer = fr_md5_ctx_alloc(false);
+	if (unlikely(!hkey->inner || !hkey->outer)) {
+		talloc_free(hkey);
+		goto oom;
+	}
+
+	/* if key is longer than 64 bytes reset it to key=MD5(key) */
+	if (key_len > 64) {
+		fr_md5_calc(tk, key, key_len);
+
+		key = tk;
+		key_len = 16;
+	}
+
+	memset(k_ipad, 0, sizeof(k_ipad));
+	memset(k_opad, 0, sizeof(k_opad));
+	memcpy(k_ipad, key, key_len);
+	memcpy(k_opad, key, key_len);
+
+	for (i = 0; i < 64; i++) {
+		k_ipad[i] ^= 0x36;
+		k_opad[i] ^= 0x5c;
+	}
+
+	fr_md5_update(hkey->inner, k_ipad, 64);
+	fr_md5_update(hkey->outer, k_opad, 64);
+
+	return hkey;
+}
+
+/** Calculate HMAC using a key from fr_hmac_md5_key_alloc()
+ *
+ * The key's digest states are copied, so it can be shared between threads.
+ *
+ * @param digest Caller digest to be filled in.
+ * @param in Pointer to data stream.
+ * @param inlen length of data stream.
+ * @param hkey Pre-computed key.
+ */
+void fr_hmac_md5_keyed(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
+		       fr_hmac_md5_key_t const *hkey)
+{
+	fr_md5_ctx_t	*ctx;
+
+	ctx = fr_md5_ctx_alloc(true);
+
+	fr_md5_ctx_copy(ctx, hkey->inner);
+	fr_md5_update(ctx, in, inlen);
+	fr_md5_final(digest, ctx);
+
+	fr_md5_ctx_copy(ctx, hkey->outer);
+	fr_md5_update(ctx, digest, 16);
+	fr_md5_final(digest, ctx);
+
+	fr_md5_ctx_free(&ctx);
+}
 #endif /* HAVE_OPENSSL_EVP_H */
 
 /*
@@ -53,6 +53,15 @@ static fr_htrie_funcs_t const default_funcs[] = {
 		FUNC(trie, remove),
 		FUNC(trie, delete),
 		FUNC(trie, num_elements)
+	},
+	[FR_HTRIE_OA_HASH] = {
+		.match = (fr_htrie_find_t) fr_oa_hash_find,
+		FUNC(oa_hash, find),
+		FUNC(oa_hash, insert),
+		FUNC(oa_hash, replace),
+		FUNC(oa_hash, remove),
+		FUNC(oa_hash, delete),
+		FUNC(oa_hash, num_elements)
 	}
 };
 
@@ -67,7 +76,8 @@ static fr_htrie_funcs_t const default_funcs[] = {
  *				- FR_HTRIE_HASH
  *				- FR_HTRIE_RB
  *				- FR_HTRIE_TRIE
- * @param[in] hash_data		Used by FR_HTRIE_HASH to convert the
+ *				- FR_HTRIE_OA_HASH
+ * @param[in] hash_data		Used by FR_HTRIE_HASH and FR_HTRIE_OA_HASH to convert the
  *				data into a 32bit integer used for binning.
  * @param[in] cmp_data		Used to determine exact matched.
  * @param[in] get_key		Used by the prefix trie to extract a key
@@ -133,6 +143,17 @@ fr_htrie_t *fr_htrie_alloc(TALLOC_CTX *ctx,
 		ht->funcs = default_funcs[type];
 		return ht;
 
+	case FR_HTRIE_OA_HASH:
+		if (!hash_data || !cmp_data) {
+			fr_strerror_const("hash_data and cmp_data must not be NULL for FR_HTRIE_OA_HASH");
+			return NULL;
+		}
+
+		ht->store = fr_oa_hash_alloc(ht, hash_data, cmp_data, free_data);
+		if (unlikely(!ht->store)) goto error;
+		ht->funcs = default_funcs[type];
+		return ht;
+
 	default:
 		return NULL;
 	}
@@ -28,6 +28,7 @@ extern "C" {
 #endif
 
 #include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/oa_hash.h>
 #include <freeradius-devel/util/rb.h>
 #include <freeradius-devel/util/trie.h>
 #include <freeradius-devel/util/types.h>
@@ -51,6 +52,7 @@ typedef enum {
 	FR_HTRIE_HASH,		//!< Data is stored in a hash.
 	FR_HTRIE_RB,		//!< Data is stored in a rb tree.
 	FR_HTRIE_TRIE,		//!< Data is stored in a prefix trie.
+	FR_HTRIE_OA_HASH,	//!< Data is stored in an open addressing hash.
 } fr_htrie_type_t;
 
 /** Which functions are used for the different operations
@@ -10,6 +10,7 @@ SOURCES		:= \
 		   base16.c \
 		   base32.c \
 		   base64.c \
+		   btree.c \
 		   cap.c \
 		   cursor.c \
 		   dbuff.c \
@@ -48,6 +49,7 @@ SOURCES		:= \
 		   misc.c \
 		   missing.c \
 		   net.c \
+		   oa_hash.c \
 		   packet.c \
 		   pair.c \
 		   pair_legacy.c \
@@ -67,6 +69,7 @@ SOURCES		:= \
 		   sha1.c \
 		   snprintf.c \
 		   socket.c \
+		   startup.c \
 		   strerror.c \
 		   strlcat.c \
 		   strlcpy.c \
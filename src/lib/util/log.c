@@ -47,6 +47,10 @@ int	fr_debug_lvl = 0;
 
 static _Thread_local TALLOC_CTX *fr_log_pool;
 
+static _Thread_local time_t fr_log_time_last;		//!< When the cached timestamp was generated.
+static _Thread_local bool fr_log_time_utc;		//!< Whether the cached timestamp is UTC.
+static _Thread_local char fr_log_time_buff[50];	//!< Cached timestamp.
+
 static uint32_t location_indent = 30;
 
 /** Canonicalize error strings, removing tabs, and generate spaces for error marker
@@ -240,6 +244,49 @@ TALLOC_CTX *fr_log_pool_init(void)
 	return pool;
 }
 
+/** Return the current time, formatted for a log message
+ *
+ * ctime_r() and friends take a process wide lock in most libcs to
+ * protect the timezone data, so with many threads logging they become
+ * a point of contention.  The formatted string only changes once a
+ * second, so we cache it per thread.
+ *
+ * @param[in] utc	Whether the timestamp should be UTC or local time.
+ * @return A thread local buffer containing the timestamp, without a trailing '\n'.
+ */
+char const *fr_log_time_str(bool utc)
+{
+	time_t	timeval;
+	size_t	len;
+
+	timeval = time(NULL);
+	if ((timeval == fr_log_time_last) && (utc == fr_log_time_utc) && fr_log_time_buff[0]) {
+		return fr_log_time_buff;
+	}
+
+#ifdef HAVE_GMTIME_R
+	if (utc) {
+		struct tm utc_tm;
+		gmtime_r(&timeval, &utc_tm);
+		ASCTIME_R(&utc_tm, fr_log_time_buff, sizeof(fr_log_time_buff));
+	} else
+#endif
+	{
+		CTIME_R(&timeval, fr_log_time_buff, sizeof(fr_log_time_buff));
+	}
+
+	/*
+	 *	ctime adds '\n'
+	 */
+	len = strlen(fr_log_time_buff);
+	if ((len > 0) && (fr_log_time_buff[len - 1] == '\n')) fr_log_time_buff[len - 1] = '\0';
+
+	fr_log_time_last = timeval;
+	fr_log_time_utc = utc;
+
+	return fr_log_time_buff;
+}
+
 /** Send a server log message to its destination
  *
  * @param[in] log	destination.
@@ -257,15 +304,13 @@ int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
 	int		ret = 0;
 	char const	*fmt_colour = "";
 	char const	*fmt_location = "";
-	char		fmt_time[50];
+	char const	*fmt_time = "";
 	char const	*fmt_facility = "";
 	char const	*fmt_type = "";
 	char		*fmt_msg;
 
 	static char const *spaces = "                                    ";	/* 40 */
 
-	fmt_time[0] = '\0';
-
 	/*
 	 *	If we don't want any messages, then
 	 *	throw them away.
@@ -322,28 +367,7 @@ int fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line,
 		FALL_THROUGH;
 
 	case L_TIMESTAMP_ON:
-	{
-		time_t timeval;
-		size_t len;
-
-		timeval = time(NULL);
-#ifdef HAVE_GMTIME_R
-		if (log->dates_utc) {
-			struct tm utc;
-			gmtime_r(&timeval, &utc);
-			ASCTIME_R(&utc, fmt_time, sizeof(fmt_time));
-		} else
-#endif
-		{
-			CTIME_R(&timeval, fmt_time, sizeof(fmt_time));
-		}
-
-		/*
-		 *	ctime adds '\n'
-		 */
-		len = strlen(fmt_time);
-		if ((len > 0) && (fmt_time[len - 1] == '\n')) fmt_time[len - 1] = '\0';
-	}
+		fmt_time = fr_log_time_str(log->dates_utc);
 		break;
 	}
 
@@ -147,6 +147,8 @@ static inline bool fr_rate_limit_enabled(void)
 
 int	fr_log_init(fr_log_t *log, bool daemonize);
 
+char const	*fr_log_time_str(bool utc);
+
 TALLOC_CTX	*fr_log_pool_init(void);
 
 int	fr_vlog(fr_log_t const *log, fr_log_type_t lvl, char const *file, int line, char const *fmt, va_list ap)
@@ -523,6 +523,46 @@ int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags)
 }
 #endif
 
+#ifndef HAVE_RECVMMSG
+/** Emulates the real recvmmsg in userland
+ *
+ * As with sendmmsg(), this doesn't reduce the number of system calls, but
+ * it lets callers use the same batched receive code on all platforms.
+ *
+ * The timeout is ignored.  Receiving stops at the first call to recvmsg()
+ * which fails, which for non-blocking sockets is usually EWOULDBLOCK.
+ *
+ * @param[in] sockfd	to read packets from.
+ * @param[in] msgvec	a pointer to an array of mmsghdr structures.
+ *			The size of this array is specified in vlen.
+ * @param[in] vlen	Length of msgvec.
+ * @param[in] flags	same as for recvmsg(2).
+ * @param[in] timeout	ignored.
+ * @return
+ *	- >= 0 The number of messages received.
+ *	- < 0 on error.  Only returned if first operation errors.
+ */
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, UNUSED struct timespec *timeout)
+{
+	unsigned int i;
+
+	for (i = 0; i < vlen; i++) {
+     		ssize_t slen;
+
+		slen = recvmsg(sockfd, &msgvec[i].msg_hdr, flags);
+		if (slen < 0) {
+			msgvec[i].msg_len = 0;
+
+			if (i == 0) return -1;
+			return i;
+		}
+		msgvec[i].msg_len = (unsigned int)slen;	/* Number of bytes received */
+	}
+
+	return i;
+}
+#endif
+
 /*
  *	So we don't have ifdef's in the rest of the code
  */
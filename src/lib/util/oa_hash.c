@@ -0,0 +1,570 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Open addressing hash tables
+ *
+ * Data pointers are stored directly in an array of slots, with a separate
+ * array of one byte "control" values, one per slot.  A control byte says
+ * whether the slot is empty, deleted, or full, and for full slots holds 7
+ * bits of the hash of the data in the slot.
+ *
+ * Slots are arranged in groups of eight, and we probe a whole group at a
+ * time by loading its control bytes into a 64bit integer, and comparing
+ * them all at once against the 7 hash bits we're looking for.  The data
+ * is only compared for slots where those bits match.  So a lookup usually
+ * touches one cache line of control bytes, and one slot.
+ *
+ * This is the same scheme as Google's "Swiss tables", but using plain
+ * integer operations rather than vector instructions.
+ *
+ * Unlike #fr_hash_table_t, there's no lazy initialisation of buckets, so
+ * the table may be read by multiple threads without synchronisation, as
+ * long as no thread is modifying it.
+ *
+ * @file src/lib/util/oa_hash.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/oa_hash.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <string.h>
+
+/*
+ *	Number of slots in a group.  Must match the width of the
+ *	integer we load the control bytes into.
+ */
+#define OA_GROUP_SIZE		(sizeof(uint64_t))
+
+/*
+ *	Number of slots to start off with.  Must be a power of two,
+ *	and a multiple of OA_GROUP_SIZE.
+ */
+#define OA_NUM_SLOTS		(16)
+
+#define CTRL_EMPTY		(0x80)		//!< Slot has never been used.
+#define CTRL_DELETED		(0xfe)		//!< Slot was used, and should be skipped by lookups.
+
+#define CTRL_IS_FULL(_c)	(((_c) & 0x80) == 0)
+
+#define BYTES_ALL(_x)		((uint64_t)(_x) * 0x0101010101010101ULL)
+
+/*
+ *	The top 7 bits of the hash go in the control byte, the
+ *	bottom bits select the first group to probe.
+ */
+#define HASH_H2(_key)		((uint8_t)((_key) >> 25))
+
+struct fr_oa_hash_s {
+	uint32_t		num_elements;	//!< Number of elements in the hash table.
+	uint32_t		num_slots;	//!< How many slots there are - power of 2.
+	uint32_t		group_mask;	//!< (num_slots / OA_GROUP_SIZE) - 1.
+	uint32_t		growth_left;	//!< How many empty slots we can fill before we
+						///< need to resize.
+
+	fr_free_t		free;		//!< Data free function.
+	fr_hash_t		hash;		//!< Hashing function.
+	fr_cmp_t		cmp;		//!< Comparison function.
+
+	char const		*type;		//!< Talloc type to check elements against.
+
+	uint8_t			*ctrl;		//!< Array of control bytes, one per slot.
+	void			**slots;	//!< Array of data pointers.
+};
+
+/** Keep the table below 7/8ths full, so that every probe sequence ends at an empty slot
+ *
+ */
+static inline CC_HINT(always_inline) uint32_t max_load(uint32_t num_slots)
+{
+	return num_slots - (num_slots / 8);
+}
+
+static inline CC_HINT(always_inline) uint64_t group_load(uint8_t const *ctrl)
+{
+	uint64_t group;
+
+	memcpy(&group, ctrl, sizeof(group));
+
+	return group;
+}
+
+/** Return a mask with the top bit set for each control byte in the group matching h2
+ *
+ * May return false positives, but never false negatives.  The caller
+ * compares the data, so false positives are harmless.
+ */
+static inline CC_HINT(always_inline) uint64_t group_match(uint64_t group, uint8_t h2)
+{
+	uint64_t x = group ^ BYTES_ALL(h2);
+
+	return (x - BYTES_ALL(0x01)) & ~x & BYTES_ALL(0x80);
+}
+
+/** Return a mask with the top bit set for each empty slot in the group
+ *
+ * Both CTRL_EMPTY and CTRL_DELETED have the top bit set, but only
+ * CTRL_DELETED has bit 1 set.
+ */
+static inline CC_HINT(always_inline) uint64_t group_match_empty(uint64_t group)
+{
+	return group & ~(group << 6) & BYTES_ALL(0x80);
+}
+
+/** Return a mask with the top bit set for each empty or deleted slot in the group
+ *
+ */
+static inline CC_HINT(always_inline) uint64_t group_match_free(uint64_t group)
+{
+	return group & BYTES_ALL(0x80);
+}
+
+/** Convert the lowest bit set in a mask into the index of a slot in the group
+ *
+ */
+static inline CC_HINT(always_inline) unsigned int group_index(uint64_t mask)
+{
+	unsigned int idx;
+
+	/*
+	 *	(mask & -mask) isolates the lowest bit, which is
+	 *	always bit 7 of a byte.  Multiplying 1 << (8 * n) by
+	 *	the constant puts n in the top byte.
+	 */
+	idx = (((mask & -mask) >> 7) * 0x0001020304050607ULL) >> 56;
+
+#ifdef WORDS_BIGENDIAN
+	return (OA_GROUP_SIZE - 1) - idx;
+#else
+	return idx;
+#endif
+}
+
+/** Find the first empty or deleted slot in the probe sequence for a key
+ *
+ */
+static uint32_t oa_hash_find_free(uint8_t const *ctrl, uint32_t group_mask, uint32_t key)
+{
+	uint32_t	group = key & group_mask;
+	uint32_t	i;
+
+	/*
+	 *	Triangular probing visits every group, and the load
+	 *	factor guarantees there's always a free slot.
+	 */
+	for (i = 1; ; i++) {
+		uint64_t mask;
+
+		mask = group_match_free(group_load(ctrl + (group * OA_GROUP_SIZE)));
+		if (mask) return (group * OA_GROUP_SIZE) + group_index(mask);
+
+		group = (group + i) & group_mask;
+	}
+}
+
+/** Find the slot holding data matching the search data
+ *
+ * @return
+ *	- The slot index.
+ *	- -1 if no data matches.
+ */
+static inline CC_HINT(always_inline) int64_t oa_hash_find_slot(fr_oa_hash_t *ht, uint32_t key, void const *data)
+{
+	uint32_t	group = key & ht->group_mask;
+	uint8_t		h2 = HASH_H2(key);
+	uint32_t	i;
+
+	for (i = 1; i <= (ht->group_mask + 1); i++) {
+		uint64_t	ctrl, mask;
+		uint32_t	base = group * OA_GROUP_SIZE;
+
+		ctrl = group_load(ht->ctrl + base);
+
+		for (mask = group_match(ctrl, h2); mask; mask &= mask - 1) {
+			uint32_t slot = base + group_index(mask);
+
+			if (ht->cmp(data, ht->slots[slot]) == 0) return slot;
+		}
+
+		/*
+		 *	If the group has an empty slot, the data
+		 *	would have been put there, or in an earlier
+		 *	group.
+		 */
+		if (group_match_empty(ctrl)) break;
+
+		group = (group + i) & ht->group_mask;
+	}
+
+	return -1;
+}
+
+/** Grow the table, or if it's mostly deleted slots, rehash it at the same size
+ *
+ */
+static int oa_hash_resize(fr_oa_hash_t *ht)
+{
+	uint32_t	num_slots = ht->num_slots;
+	uint32_t	group_mask;
+	uint8_t		*ctrl;
+	void		**slots;
+	uint32_t	i;
+
+	if (ht->num_elements >= (max_load(num_slots) / 2)) num_slots <<= 1;
+
+	ctrl = talloc_array(ht, uint8_t, num_slots);
+	if (unlikely(!ctrl)) return -1;
+
+	slots = talloc_array(ht, void *, num_slots);
+	if (unlikely(!slots)) {
+		talloc_free(ctrl);
+		return -1;
+	}
+
+	memset(ctrl, CTRL_EMPTY, num_slots);
+	group_mask = (num_slots / OA_GROUP_SIZE) - 1;
+
+	for (i = 0; i < ht->num_slots; i++) {
+		uint32_t key, slot;
+
+		if (!CTRL_IS_FULL(ht->ctrl[i])) continue;
+
+		key = ht->hash(ht->slots[i]);
+		slot = oa_hash_find_free(ctrl, group_mask, key);
+
+		ctrl[slot] = HASH_H2(key);
+		slots[slot] = ht->slots[i];
+	}
+
+	talloc_free(ht->ctrl);
+	talloc_free(ht->slots);
+
+	ht->ctrl = ctrl;
+	ht->slots = slots;
+	ht->num_slots = num_slots;
+	ht->group_mask = group_mask;
+	ht->growth_left = max_load(num_slots) - ht->num_elements;
+
+	return 0;
+}
+
+static int _fr_oa_hash_free(fr_oa_hash_t *ht)
+{
+	uint32_t i;
+
+	if (ht->free) {
+		for (i = 0; i < ht->num_slots; i++) {
+			if (CTRL_IS_FULL(ht->ctrl[i])) ht->free(ht->slots[i]);
+		}
+	}
+
+	return 0;
+}
+
+/** Allocate a new open addressing hash table
+ *
+ * @param[in] ctx	to allocate the table in.
+ * @param[in] type	Talloc type of the data.  May be NULL.
+ * @param[in] hash_func	to hash the data with.
+ * @param[in] cmp_func	to compare the data with.
+ * @param[in] free_func	called for data which is deleted or replaced,
+ *			and for all data when the table is freed.
+ *			May be NULL.
+ * @return
+ *	- A new hash table.
+ *	- NULL on error.
+ */
+fr_oa_hash_t *_fr_oa_hash_alloc(TALLOC_CTX *ctx,
+				char const *type,
+				fr_hash_t hash_func,
+				fr_cmp_t cmp_func,
+				fr_free_t free_func)
+{
+	fr_oa_hash_t *ht;
+
+	ht = talloc(ctx, fr_oa_hash_t);
+	if (!ht) return NULL;
+
+	*ht = (fr_oa_hash_t){
+		.type = type,
+		.free = free_func,
+		.hash = hash_func,
+		.cmp = cmp_func,
+		.num_slots = OA_NUM_SLOTS,
+		.group_mask = (OA_NUM_SLOTS / OA_GROUP_SIZE) - 1,
+		.growth_left = max_load(OA_NUM_SLOTS),
+		.ctrl = talloc_array(ht, uint8_t, OA_NUM_SLOTS),
+		.slots = talloc_array(ht, void *, OA_NUM_SLOTS)
+	};
+	if (unlikely(!ht->ctrl || !ht->slots)) {
+		talloc_free(ht);
+		return NULL;
+	}
+	memset(ht->ctrl, CTRL_EMPTY, OA_NUM_SLOTS);
+
+	talloc_set_destructor(ht, _fr_oa_hash_free);
+
+	return ht;
+}
+
+/** Find data in a hash table
+ *
+ * @param[in] ht	to find data in.
+ * @param[in] data 	to find.  Will be passed to the
+ *      		hashing function.
+ * @return
+ *      - The user data we found.
+ *	- NULL if we couldn't find any matching data.
+ */
+void *fr_oa_hash_find(fr_oa_hash_t *ht, void const *data)
+{
+	int64_t slot;
+
+	slot = oa_hash_find_slot(ht, ht->hash(data), data);
+	if (slot < 0) return NULL;
+
+	return ht->slots[slot];
+}
+
+/** Hash table lookup with pre-computed key
+ *
+ * @param[in] ht	to find data in.
+ * @param[in] key	the precomputed key.
+ * @param[in] data	for matching.
+ * @return
+ *      - The user data we found.
+ *	- NULL if we couldn't find any matching data.
+ */
+void *fr_oa_hash_find_by_key(fr_oa_hash_t *ht, uint32_t key, void const *data)
+{
+	int64_t slot;
+
+	slot = oa_hash_find_slot(ht, key, data);
+	if (slot < 0) return NULL;
+
+	return ht->slots[slot];
+}
+
+/** Insert data into a hash table
+ *
+ * @param[in] ht	to insert data into.
+ * @param[in] data 	to insert.  Will be passed to the
+ *      		hashing function.
+ * @return
+ *	- true if data was inserted.
+ *	- false if data already existed and was not inserted,
+ *	  or we failed growing the table.
+ */
+bool fr_oa_hash_insert(fr_oa_hash_t *ht, void const *data)
+{
+	uint32_t	key;
+	uint32_t	slot;
+
+#ifndef TALLOC_GET_TYPE_ABORT_NOOP
+	if (ht->type) (void)_talloc_get_type_abort(data, ht->type, __location__);
+#endif
+
+	key = ht->hash(data);
+	if (oa_hash_find_slot(ht, key, data) >= 0) return false;
+
+	slot = oa_hash_find_free(ht->ctrl, ht->group_mask, key);
+
+	/*
+	 *	Re-using a deleted slot doesn't change how many
+	 *	empty slots there are, so only check the load
+	 *	factor if we'd fill an empty one.
+	 */
+	if (ht->ctrl[slot] == CTRL_EMPTY) {
+		if (ht->growth_left == 0) {
+			if (oa_hash_resize(ht) < 0) return false;
+			slot = oa_hash_find_free(ht->ctrl, ht->group_mask, key);
+		}
+		ht->growth_left--;
+	}
+
+	ht->ctrl[slot] = HASH_H2(key);
+	ht->slots[slot] = UNCONST(void *, data);
+	ht->num_elements++;
+
+	return true;
+}
+
+/** Replace old data with new data, OR insert if there is no old
+ *
+ * @param[out] old	data that was replaced.  If this argument
+ *			is not NULL, then the old data will not
+ *			be freed, even if a free function is
+ *			configured.
+ * @param[in] ht	to insert data into.
+ * @param[in] data 	to replace.  Will be passed to the
+ *      		hashing function.
+ * @return
+ *      - 1 if data was replaced.
+ *	- 0 if data was inserted.
+ *      - -1 if we failed to replace data
+ */
+int fr_oa_hash_replace(void **old, fr_oa_hash_t *ht, void const *data)
+{
+	int64_t slot;
+
+	slot = oa_hash_find_slot(ht, ht->hash(data), data);
+	if (slot < 0) {
+		if (old) *old = NULL;
+		return fr_oa_hash_insert(ht, data) ? 0 : -1;
+	}
+
+	if (old) {
+		*old = ht->slots[slot];
+	} else if (ht->free) {
+		ht->free(ht->slots[slot]);
+	}
+
+	ht->slots[slot] = UNCONST(void *, data);
+
+	return 1;
+}
+
+/** Remove an entry from the hash table, without freeing the data
+ *
+ * @param[in] ht	to remove data from.
+ * @param[in] data 	to remove.  Will be passed to the
+ *      		hashing function.
+ * @return
+ *      - The user data we removed.
+ *	- NULL if we couldn't find any matching data.
+ */
+void *fr_oa_hash_remove(fr_oa_hash_t *ht, void const *data)
+{
+	int64_t		slot;
+	uint32_t	base;
+	void		*old;
+
+	slot = oa_hash_find_slot(ht, ht->hash(data), data);
+	if (slot < 0) return NULL;
+
+	old = ht->slots[slot];
+
+	/*
+	 *	If the group still has an empty slot, no lookup
+	 *	has ever probed past it, so this slot can be made
+	 *	empty again.  Otherwise lookups for data in later
+	 *	groups need to skip over it.
+	 */
+	base = slot & ~((uint32_t)OA_GROUP_SIZE - 1);
+	if (group_match_empty(group_load(ht->ctrl + base))) {
+		ht->ctrl[slot] = CTRL_EMPTY;
+		ht->growth_left++;
+	} else {
+		ht->ctrl[slot] = CTRL_DELETED;
+	}
+	ht->num_elements--;
+
+	return old;
+}
+
+/** Remove and free data (if a free function was specified)
+ *
+ * @param[in] ht	to remove data from.
+ * @param[in] data 	to remove/free.
+ * @return
+ *	- true if we removed data.
+ *      - false if we couldn't find any matching data.
+ */
+bool fr_oa_hash_delete(fr_oa_hash_t *ht, void const *data)
+{
+	void *old;
+
+	old = fr_oa_hash_remove(ht, data);
+	if (!old) return false;
+
+	if (ht->free) ht->free(old);
+
+	return true;
+}
+
+/*
+ *	Count number of elements
+ */
+uint32_t fr_oa_hash_num_elements(fr_oa_hash_t *ht)
+{
+	return ht->num_elements;
+}
+
+/** Iterate over entries in a hash table
+ *
+ * @note If the hash table is modified the iterator should be considered invalidated.
+ *
+ * @param[in] ht	to iterate over.
+ * @param[in] iter	Pointer to an iterator struct, used to maintain
+ *			state between calls.
+ * @return
+ *	- User data.
+ *	- NULL if at the end of the table.
+ */
+void *fr_oa_hash_iter_next(fr_oa_hash_t *ht, fr_oa_hash_iter_t *iter)
+{
+	while (iter->slot < ht->num_slots) {
+		uint32_t slot = iter->slot++;
+
+		if (CTRL_IS_FULL(ht->ctrl[slot])) return ht->slots[slot];
+	}
+
+	return NULL;
+}
+
+/** Initialise an iterator
+ *
+ * @note If the hash table is modified the iterator should be considered invalidated.
+ *
+ * @param[in] ht	to iterate over.
+ * @param[out] iter	to initialise.
+ * @return
+ *	- The first entry in the hash table.
+ *	- NULL if the hash table is empty.
+ */
+void *fr_oa_hash_iter_init(fr_oa_hash_t *ht, fr_oa_hash_iter_t *iter)
+{
+	iter->slot = 0;
+
+	return fr_oa_hash_iter_next(ht, iter);
+}
+
+/** Copy all entries out of a hash table into an array
+ *
+ * @param[in] ctx	to allocate array in.
+ * @param[in] out	array of hash table entries.
+ * @param[in] ht	to flatten.
+ * @return
+ *	- 0 on success.
+ *      - -1 on failure.
+ */
+int fr_oa_hash_flatten(TALLOC_CTX *ctx, void **out[], fr_oa_hash_t *ht)
+{
+	uint32_t	i, j;
+	void		**list;
+
+	if (unlikely(!(list = talloc_array(ctx, void *, ht->num_elements)))) return -1;
+
+	for (i = 0, j = 0; i < ht->num_slots; i++) {
+		if (CTRL_IS_FULL(ht->ctrl[i])) list[j++] = ht->slots[i];
+	}
+
+	*out = list;
+
+	return 0;
+}
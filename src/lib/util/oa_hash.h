@@ -0,0 +1,75 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Structures and prototypes for open addressing hash tables
+ *
+ * @file src/lib/util/oa_hash.h
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(oa_hash_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/util/hash.h>
+
+typedef struct fr_oa_hash_s fr_oa_hash_t;
+
+/** Stores the state of the current iteration operation
+ *
+ */
+typedef struct {
+	uint32_t		slot;		//!< Next slot to examine.
+} fr_oa_hash_iter_t;
+
+#define		fr_oa_hash_alloc(_ctx, _hash_node, _cmp_node, _free_node) \
+		_fr_oa_hash_alloc(_ctx, NULL, _hash_node, _cmp_node, _free_node)
+
+#define		fr_oa_hash_talloc_alloc(_ctx, _type, _hash_node, _cmp_node, _free_node) \
+		_fr_oa_hash_alloc(_ctx, #_type, _hash_node, _cmp_node, _free_node)
+
+fr_oa_hash_t	*_fr_oa_hash_alloc(TALLOC_CTX *ctx,
+				   char const *type,
+				   fr_hash_t hash_node,
+				   fr_cmp_t cmp_node,
+				   fr_free_t free_node) CC_HINT(nonnull(3,4));
+
+void		*fr_oa_hash_find(fr_oa_hash_t *ht, void const *data) CC_HINT(nonnull);
+
+void		*fr_oa_hash_find_by_key(fr_oa_hash_t *ht, uint32_t key, void const *data) CC_HINT(nonnull);
+
+bool		fr_oa_hash_insert(fr_oa_hash_t *ht, void const *data) CC_HINT(nonnull);
+
+int		fr_oa_hash_replace(void **old, fr_oa_hash_t *ht, void const *data) CC_HINT(nonnull(2,3));
+
+void		*fr_oa_hash_remove(fr_oa_hash_t *ht, void const *data) CC_HINT(nonnull);
+
+bool		fr_oa_hash_delete(fr_oa_hash_t *ht, void const *data) CC_HINT(nonnull);
+
+uint32_t	fr_oa_hash_num_elements(fr_oa_hash_t *ht) CC_HINT(nonnull);
+
+void		*fr_oa_hash_iter_next(fr_oa_hash_t *ht, fr_oa_hash_iter_t *iter) CC_HINT(nonnull);
+
+void		*fr_oa_hash_iter_init(fr_oa_hash_t *ht, fr_oa_hash_iter_t *iter) CC_HINT(nonnull);
+
+int		fr_oa_hash_flatten(TALLOC_CTX *ctx, void **out[], fr_oa_hash_t *ht) CC_HINT(nonnull(2,3));
+
+#ifdef __cplusplus
+}
+#endif
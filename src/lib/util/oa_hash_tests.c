@@ -0,0 +1,172 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for open addressing hash tables
+ *
+ * @file src/lib/util/oa_hash_tests.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "oa_hash.c"
+
+#define OA_TEST_SIZE	(4096)
+
+typedef struct {
+	uint32_t	num;
+} oa_test_item_t;
+
+static uint32_t oa_test_hash(void const *data)
+{
+	oa_test_item_t const *item = data;
+
+	return fr_hash(&item->num, sizeof(item->num));
+}
+
+/*
+ *	Every item collides, so every lookup has to probe.
+ */
+static uint32_t oa_test_hash_bad(UNUSED void const *data)
+{
+	return 0;
+}
+
+static int8_t oa_test_cmp(void const *one, void const *two)
+{
+	oa_test_item_t const *a = one, *b = two;
+
+	return CMP(a->num, b->num);
+}
+
+static void oa_test_basic(fr_hash_t hash, unsigned int size)
+{
+	fr_oa_hash_t		*ht;
+	oa_test_item_t		*items;
+	oa_test_item_t		*p;
+	fr_oa_hash_iter_t	iter;
+	unsigned int		i, count;
+
+	items = talloc_array(NULL, oa_test_item_t, size);
+	for (i = 0; i < size; i++) items[i].num = i;
+
+	ht = fr_oa_hash_alloc(NULL, hash, oa_test_cmp, NULL);
+	TEST_CHECK(ht != NULL);
+
+	for (i = 0; i < size; i++) {
+		TEST_CHECK(fr_oa_hash_insert(ht, &items[i]));
+		TEST_MSG("insert %u failed", i);
+	}
+	TEST_CHECK(fr_oa_hash_num_elements(ht) == size);
+
+	TEST_CASE("Duplicates are rejected");
+	TEST_CHECK(!fr_oa_hash_insert(ht, &(oa_test_item_t){ .num = 0 }));
+
+	TEST_CASE("Everything can be found");
+	for (i = 0; i < size; i++) {
+		p = fr_oa_hash_find(ht, &(oa_test_item_t){ .num = i });
+		TEST_CHECK(p == &items[i]);
+		TEST_MSG("find %u returned %p, expected %p", i, p, &items[i]);
+	}
+	TEST_CHECK(fr_oa_hash_find(ht, &(oa_test_item_t){ .num = size }) == NULL);
+
+	TEST_CASE("Remove every other item");
+	for (i = 0; i < size; i += 2) TEST_CHECK(fr_oa_hash_remove(ht, &items[i]) == &items[i]);
+	TEST_CHECK(fr_oa_hash_num_elements(ht) == (size / 2));
+
+	for (i = 0; i < size; i++) {
+		p = fr_oa_hash_find(ht, &(oa_test_item_t){ .num = i });
+		TEST_CHECK(p == ((i & 0x01) ? &items[i] : NULL));
+		TEST_MSG("find %u returned %p", i, p);
+	}
+
+	TEST_CASE("Iterate over what's left");
+	for (p = fr_oa_hash_iter_init(ht, &iter), count = 0;
+	     p;
+	     p = fr_oa_hash_iter_next(ht, &iter), count++) TEST_CHECK(p->num & 0x01);
+	TEST_CHECK(count == (size / 2));
+
+	TEST_CASE("Replace, and insert via replace");
+	{
+		oa_test_item_t	dup = { .num = 1 };
+		void		*old;
+
+		TEST_CHECK(fr_oa_hash_replace(&old, ht, &dup) == 1);
+		TEST_CHECK(old == &items[1]);
+		TEST_CHECK(fr_oa_hash_find(ht, &items[1]) == &dup);
+		TEST_CHECK(fr_oa_hash_replace(&old, ht, &items[1]) == 1);
+
+		TEST_CHECK(fr_oa_hash_replace(&old, ht, &items[0]) == 0);
+		TEST_CHECK(old == NULL);
+		TEST_CHECK(fr_oa_hash_find(ht, &(oa_test_item_t){ .num = 0 }) == &items[0]);
+	}
+
+	talloc_free(ht);
+	talloc_free(items);
+}
+
+static void test_oa_hash_basic(void)
+{
+	oa_test_basic(oa_test_hash, OA_TEST_SIZE);
+}
+
+static void test_oa_hash_collisions(void)
+{
+	oa_test_basic(oa_test_hash_bad, 256);
+}
+
+/*
+ *	Insert and remove many more items than are ever in the table
+ *	at once.  Deleted slots should be cleared out, not make the
+ *	table grow forever.
+ */
+static void test_oa_hash_churn(void)
+{
+	fr_oa_hash_t		*ht;
+	oa_test_item_t		*items;
+	unsigned int		i;
+
+	items = talloc_array(NULL, oa_test_item_t, OA_TEST_SIZE * 16);
+	for (i = 0; i < OA_TEST_SIZE * 16; i++) items[i].num = i;
+
+	ht = fr_oa_hash_alloc(NULL, oa_test_hash, oa_test_cmp, NULL);
+	TEST_CHECK(ht != NULL);
+
+	for (i = 0; i < OA_TEST_SIZE * 16; i++) {
+		TEST_CHECK(fr_oa_hash_insert(ht, &items[i]));
+		if (i >= 64) TEST_CHECK(fr_oa_hash_remove(ht, &items[i - 64]) == &items[i - 64]);
+	}
+
+	TEST_CHECK(fr_oa_hash_num_elements(ht) == 64);
+	TEST_CHECK(ht->num_slots <= 256);
+	TEST_MSG("num_slots %u", ht->num_slots);
+
+	for (i = (OA_TEST_SIZE * 16) - 64; i < OA_TEST_SIZE * 16; i++) {
+		TEST_CHECK(fr_oa_hash_find(ht, &items[i]) == &items[i]);
+	}
+
+	talloc_free(ht);
+	talloc_free(items);
+}
+
+TEST_LIST = {
+	{ "oa_hash_basic",		test_oa_hash_basic },
+	{ "oa_hash_collisions",		test_oa_hash_collisions },
+	{ "oa_hash_churn",		test_oa_hash_churn },
+
+	{ NULL }
+};
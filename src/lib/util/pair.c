@@ -23,6 +23,7 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/util/atexit.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/pair.h>
@@ -34,6 +35,78 @@ RCSID("$Id$")
 
 #include <ctype.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** Lists shorter than this are always searched linearly
+ *
+ * Building an index costs about the same as one linear search, so it's
+ * only worthwhile for long lists which are searched repeatedly, like the
+ * request list of a large accounting packet.
+ */
+#define PAIR_LIST_INDEX_MIN	(16)
+
+/** How many indexes each thread keeps
+ *
+ * Enough for the request, reply and control lists of the current request,
+ * plus one spare.
+ */
+#define PAIR_LIST_INDEX_CACHE	(4)
+
+/** How many list identifiers a thread reserves at once
+ *
+ */
+#define PAIR_LIST_ID_BLOCK	(1 << 16)
+
+/** How much space to reserve in string and octets pairs for their value
+ *
+ * Most string and octets values (NAS-Identifier, User-Name, Class, State)
+ * are short.  Allocating the pair as a pool with room for the value means
+ * the value buffer is carved out of the same chunk of memory as the pair,
+ * instead of needing a separate malloc.  Longer values are allocated
+ * normally.
+ */
+#define PAIR_VALUE_POOL_SIZE	(32)
+
+/** Maps a #fr_dict_attr_t to the first pair in a list with that attribute
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*da;		//!< Attribute, NULL if the slot is empty.
+	fr_pair_t		*vp;		//!< First pair in the list with this attribute.
+} fr_pair_list_index_slot_t;
+
+/** A lazily built lookup index for a single pair list
+ *
+ * The index is only valid while the list's id, generation count and
+ * element count match those recorded when it was built.  Inserting,
+ * removing, replacing or moving pairs using the fr_dlist or fr_dcursor
+ * functions changes the generation count, so a stale index is rebuilt
+ * on next use.
+ *
+ * Changing the da of a pair which is already in a list doesn't change the
+ * generation count.  Code doing that must remove the pair first, and insert
+ * it again after.
+ */
+typedef struct {
+	fr_pair_list_t const		*list;		//!< The list this index was built for.
+	uint64_t			id;		//!< The id of the list when the index was built.
+	unsigned int			gen;		//!< Generation count of the list when the index was built.
+	unsigned int			num;		//!< Number of elements in the list when the index was built.
+	size_t				mask;		//!< Number of slots - 1.
+	fr_pair_list_index_slot_t	*slots;		//!< Open addressing table.
+} fr_pair_list_index_t;
+
+static atomic_uint_fast64_t		pair_list_id_next = ATOMIC_VAR_INIT(1);
+static _Thread_local uint64_t		pair_list_id_local;
+static _Thread_local uint64_t		pair_list_id_local_end;
+
+static _Thread_local fr_pair_list_index_t	*pair_list_index_cache;
+static _Thread_local unsigned int	pair_list_index_evict;
+
 /** Initialise a pair list header
  *
  * @param[in,out] list to initialise
@@ -41,6 +114,18 @@ RCSID("$Id$")
 void fr_pair_list_init(fr_pair_list_t *list)
 {
 	fr_dlist_talloc_init(&list->head, fr_pair_t, entry);
+
+	/*
+	 *	Grab ids in blocks so the shared
+	 *	counter is rarely touched.
+	 */
+	if (unlikely(pair_list_id_local == pair_list_id_local_end)) {
+		pair_list_id_local = atomic_fetch_add_explicit(&pair_list_id_next, PAIR_LIST_ID_BLOCK,
+							       memory_order_relaxed);
+		pair_list_id_local_end = pair_list_id_local + PAIR_LIST_ID_BLOCK;
+	}
+	list->id = pair_list_id_local++;
+	list->clean = false;
 }
 
 /** Free a fr_pair_t
@@ -76,6 +161,45 @@ static int _fr_pair_free(fr_pair_t *vp)
 	return 0;
 }
 
+/** Only structural pairs need a destructor
+ *
+ * The destructor exists so that children which aren't talloc parented by
+ * their group are freed with it.  Leaf pairs have nothing to clean up (other
+ * than in debug builds, where we scribble over them to catch use after
+ * free), so removing the destructor avoids an indirect call for every pair
+ * talloc frees.
+ *
+ * @param[in] vp	which has just had its da assigned.
+ */
+static inline CC_HINT(always_inline) void fr_pair_destructor_set(fr_pair_t *vp)
+{
+#ifdef NDEBUG
+	switch (vp->da->type) {
+	case FR_TYPE_STRUCTURAL:
+		break;
+
+	default:
+		talloc_set_destructor(vp, NULL);
+		break;
+	}
+#else
+	(void)vp;
+#endif
+}
+
+/** Initialise the fields of a newly allocated, zeroed, pair
+ *
+ * @param[in] vp	to initialise.
+ */
+static inline CC_HINT(always_inline) void fr_pair_init_null(fr_pair_t *vp)
+{
+	vp->op = T_OP_EQ;
+	vp->type = VT_NONE;
+	fr_dlist_entry_init(&vp->entry);
+
+	talloc_set_destructor(vp, _fr_pair_free);
+}
+
 /** Allocate a new pair list on the heap
  *
  * @param[in] ctx	to allocate the pair list in.
@@ -118,11 +242,29 @@ fr_pair_t *fr_pair_alloc_null(TALLOC_CTX *ctx)
 		return NULL;
 	}
 
-	vp->op = T_OP_EQ;
-	vp->type = VT_NONE;
-	fr_dlist_entry_init(&vp->entry);
+	fr_pair_init_null(vp);
 
-	talloc_set_destructor(vp, _fr_pair_free);
+	return vp;
+}
+
+/** Allocate a new attribute with space for a short value buffer
+ *
+ * @param[in] ctx	to allocate the pair in.
+ * @return
+ *	- A new #fr_pair_t.
+ *	- NULL if an error occurred.
+ */
+static inline CC_HINT(always_inline) fr_pair_t *fr_pair_alloc_pooled(TALLOC_CTX *ctx)
+{
+	fr_pair_t *vp;
+
+	vp = talloc_zero_pooled_object(ctx, fr_pair_t, 1, PAIR_VALUE_POOL_SIZE);
+	if (!vp) {
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+
+	fr_pair_init_null(vp);
 
 	return vp;
 }
@@ -194,7 +336,19 @@ fr_pair_t *fr_pair_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da)
 {
 	fr_pair_t *vp;
 
-	vp = fr_pair_alloc_null(ctx);
+	switch (da->type) {
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+		if (!da->flags.is_unknown) {
+			vp = fr_pair_alloc_pooled(ctx);
+			break;
+		}
+		FALL_THROUGH;
+
+	default:
+		vp = fr_pair_alloc_null(ctx);
+		break;
+	}
 	if (!vp) {
 		fr_strerror_printf("Out of memory");
 		return NULL;
@@ -202,9 +356,10 @@ fr_pair_t *fr_pair_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da)
 
 	/*
 	 *	If we get passed an unknown da, we need to ensure that
-	 *	it's parented by "vp".
+	 *	it's parented by "vp".  Interned unknowns are shared,
+	 *	and are used as-is.
 	 */
-	if (da->flags.is_unknown) {
+	if (da->flags.is_unknown && !da->flags.is_interned) {
 		fr_dict_attr_t const *unknown;
 
 		unknown = fr_dict_unknown_afrom_da(vp, da);
@@ -224,6 +379,7 @@ fr_pair_t *fr_pair_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da)
 	default:
 		break;
 	}
+	fr_pair_destructor_set(vp);
 
 	return vp;
 }
@@ -519,6 +675,150 @@ unsigned int fr_pair_count_by_da(fr_pair_list_t const *list, fr_dict_attr_t cons
 	return count;
 }
 
+/** Free the thread's pair list indexes
+ *
+ */
+static void _pair_list_index_cache_free(void *arg)
+{
+	talloc_free(arg);
+	pair_list_index_cache = NULL;
+}
+
+static inline CC_HINT(always_inline) size_t pair_list_index_hash(fr_dict_attr_t const *da)
+{
+	uint64_t h = (uint64_t)(uintptr_t)da;
+
+	/*
+	 *	Attributes are allocated on at least 8 byte
+	 *	boundaries, so mix the upper bits down.
+	 */
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+
+	return (size_t)h;
+}
+
+/** (Re)build an index for a list
+ *
+ * @param[in] idx	to populate.
+ * @param[in] list	to index.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int pair_list_index_build(fr_pair_list_index_t *idx, fr_pair_list_t const *list)
+{
+	unsigned int	num = fr_dlist_num_elements(&list->head);
+	size_t		size = 1;
+	fr_pair_t	*vp = NULL;
+
+	/*
+	 *	Keep the load factor below 0.5
+	 */
+	while (size < ((size_t)num * 2)) size <<= 1;
+
+	if (!idx->slots || ((idx->mask + 1) < size)) {
+		fr_pair_list_index_slot_t *slots;
+
+		slots = talloc_realloc(pair_list_index_cache, idx->slots, fr_pair_list_index_slot_t, size);
+		if (!slots) return -1;
+		idx->slots = slots;
+	} else {
+		size = idx->mask + 1;
+	}
+	memset(idx->slots, 0, sizeof(idx->slots[0]) * size);
+	idx->mask = size - 1;
+
+	while ((vp = fr_pair_list_next(list, vp))) {
+		size_t i = pair_list_index_hash(vp->da) & idx->mask;
+
+		while (idx->slots[i].da && (idx->slots[i].da != vp->da)) i = (i + 1) & idx->mask;
+		if (idx->slots[i].da) continue;	/* Only record the first instance */
+
+		idx->slots[i].da = vp->da;
+		idx->slots[i].vp = vp;
+	}
+
+	idx->list = list;
+	idx->id = list->id;
+	idx->gen = list->head.gen;
+	idx->num = num;
+
+	return 0;
+}
+
+/** Return a valid index for a list, building one if required
+ *
+ * @param[in] list	to retrieve the index for.
+ * @return
+ *	- The index.
+ *	- NULL if no index could be built, in which case the caller
+ *	  should search the list linearly.
+ */
+static fr_pair_list_index_t *pair_list_index(fr_pair_list_t const *list)
+{
+	fr_pair_list_index_t	*idx;
+	unsigned int		i;
+
+	if (unlikely(!list->id)) return NULL;	/* Not initialised with fr_pair_list_init */
+
+	if (unlikely(!pair_list_index_cache)) {
+		fr_pair_list_index_t *cache;
+
+		cache = talloc_zero_array(NULL, fr_pair_list_index_t, PAIR_LIST_INDEX_CACHE);
+		if (!cache) return NULL;
+		fr_atexit_thread_local(pair_list_index_cache, _pair_list_index_cache_free, cache);
+	}
+
+	for (i = 0; i < PAIR_LIST_INDEX_CACHE; i++) {
+		idx = &pair_list_index_cache[i];
+
+		if ((idx->list != list) || (idx->id != list->id)) continue;
+
+		if ((idx->gen == list->head.gen) && (idx->num == fr_dlist_num_elements(&list->head))) return idx;
+
+		return (pair_list_index_build(idx, list) < 0) ? NULL : idx;
+	}
+
+	idx = &pair_list_index_cache[pair_list_index_evict++ % PAIR_LIST_INDEX_CACHE];
+
+	return (pair_list_index_build(idx, list) < 0) ? NULL : idx;
+}
+
+/** Find the first pair with a given da using an index
+ *
+ */
+static fr_pair_t *pair_list_index_find(fr_pair_list_index_t *idx, fr_dict_attr_t const *da)
+{
+	size_t i;
+
+again:
+	i = pair_list_index_hash(da) & idx->mask;
+	while (idx->slots[i].da) {
+		fr_pair_t *vp;
+
+		if (idx->slots[i].da != da) {
+			i = (i + 1) & idx->mask;
+			continue;
+		}
+
+		vp = idx->slots[i].vp;
+		if (likely(vp->da == da)) return vp;
+
+		/*
+		 *	The pair was converted in place (e.g. by
+		 *	fr_pair_to_unknown).  The list didn't change
+		 *	length, so the rebuild reuses the existing
+		 *	slots and can't fail.
+		 */
+		(void)pair_list_index_build(idx, idx->list);
+		goto again;
+	}
+
+	return NULL;
+}
+
 /** Find a pair with a matching da
  *
  * @param[in] list	to search in.
@@ -540,6 +840,24 @@ fr_pair_t *fr_pair_find_by_da(fr_pair_list_t const *list, fr_dict_attr_t const *
 
 	if (!da) return NULL;
 
+	if (fr_dlist_num_elements(&list->head) >= PAIR_LIST_INDEX_MIN) {
+		fr_pair_list_index_t *idx;
+
+		idx = pair_list_index(list);
+		if (idx) {
+			vp = pair_list_index_find(idx, da);
+			if (!vp) return NULL;
+
+			while (n > 0) {
+				vp = fr_pair_list_next(list, vp);
+				if (!vp) return NULL;
+				if (vp->da == da) n--;
+			}
+			return vp;
+		}
+		vp = NULL;
+	}
+
 	while ((vp = fr_pair_list_next(list, vp))) {
 		if (da == vp->da) {
 			if (n == 0) return vp;
@@ -594,6 +912,13 @@ fr_pair_t *fr_pair_find_by_child_num(fr_pair_list_t *list, fr_dict_attr_t const
 	da = fr_dict_attr_child_by_num(parent, attr);
 	if (!da) return NULL;
 
+	if (fr_dlist_num_elements(&list->head) >= PAIR_LIST_INDEX_MIN) {
+		fr_pair_list_index_t *idx;
+
+		idx = pair_list_index(list);
+		if (idx) return pair_list_index_find(idx, da);
+	}
+
 	for (vp = fr_pair_list_head(list); vp != NULL; vp = fr_pair_list_next(list, vp)) if (da == vp->da) return vp;
 
 	return NULL;
@@ -2587,3 +2912,30 @@ size_t fr_pair_list_len(fr_pair_list_t const *list)
 {
 	return list->head.num_elements;
 }
+
+/** Record that a list matches some external representation, e.g. the packet it was decoded from
+ *
+ * @param[in] list to mark as clean.
+ */
+void fr_pair_list_mark_clean(fr_pair_list_t *list)
+{
+	list->clean = true;
+	list->clean_gen = list->head.gen;
+	list->clean_num = list->head.num_elements;
+}
+
+/** Check whether pairs have been added to, or removed from, a list since it was marked clean
+ *
+ * @note Only changes to the list itself are noticed.  Functions which edit
+ *	the value of a pair in place, or which edit the children of a pair,
+ *	do not make the list dirty.
+ *
+ * @param[in] list to check.
+ * @return
+ *	- true if the list was never marked clean, or has changed since.
+ *	- false if the list hasn't changed.
+ */
+bool fr_pair_list_is_dirty(fr_pair_list_t const *list)
+{
+	return !list->clean || (list->clean_gen != list->head.gen) || (list->clean_num != list->head.num_elements);
+}
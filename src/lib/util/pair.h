@@ -64,6 +64,11 @@ typedef struct value_pair_s fr_pair_t;
 
 typedef struct {
         fr_dlist_head_t head;
+	uint64_t	id;		//!< Unique identifier for this list, assigned when it's
+					///< initialised.  Used to validate cached lookup indexes.
+	bool		clean;		//!< fr_pair_list_mark_clean() has been called.
+	unsigned int	clean_gen;	//!< List generation when it was marked clean.
+	unsigned int	clean_num;	//!< Number of pairs when it was marked clean.
 } fr_pair_list_t;
 
 /** Stores an attribute, a value and various bits of other data
@@ -192,6 +197,10 @@ bool		fr_pair_list_empty(fr_pair_list_t const *list) CC_HINT(nonnull);
 
 size_t		fr_pair_list_len(fr_pair_list_t const *list) CC_HINT(nonnull);
 
+void		fr_pair_list_mark_clean(fr_pair_list_t *list) CC_HINT(nonnull);
+
+bool		fr_pair_list_is_dirty(fr_pair_list_t const *list) CC_HINT(nonnull);
+
 /* Searching and list modification */
 int		fr_pair_to_unknown(fr_pair_t *vp);
 void		*fr_pair_iter_next_by_da(fr_dlist_head_t *list, void *to_eval, void *uctx);
@@ -454,6 +454,40 @@ static void do_test_fr_pair_list_free(unsigned int len, unsigned int perc, unsig
 	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/((double)used / NSEC));
 }
 
+static void do_test_fr_pair_alloc_free(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	fr_pair_list_t  test_vps;
+	unsigned int	i, j;
+	fr_pair_t	*new_vp;
+	fr_time_t	start, end, used = 0;
+	size_t		input_count = talloc_array_length(source_vps);
+
+	fr_pair_list_init(&test_vps);
+	if (input_count > len) input_count = len;
+
+	/*
+	 *  Time allocating the pairs and freeing them again, which
+	 *  is what decoding a packet and tearing down a request costs.
+	 */
+	for (i = 0; i < reps; i++) {
+		start = fr_time();
+		for (j = 0; j < len; j++) {
+			int idx = rand() % input_count;
+			new_vp = fr_pair_afrom_da(autofree, source_vps[idx]->da);
+			fr_pair_append(&test_vps, new_vp);
+		}
+		TEST_CHECK(fr_pair_list_len(&test_vps) == len);
+		fr_pair_list_free(&test_vps);
+		end = fr_time();
+		used += (end - start);
+	}
+	TEST_MSG_ALWAYS("repetitions=%d", reps);
+	TEST_MSG_ALWAYS("perc_rep=%d", perc);
+	TEST_MSG_ALWAYS("list_length=%d", len);
+	TEST_MSG_ALWAYS("used=%"PRId64, used);
+	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/((double)used / NSEC));
+}
+
 #define test_func(_func, _count, _perc, _source_vps) \
 static void test_ ## _func ## _ ## _count ## _ ## _perc(void)\
 {\
@@ -478,6 +512,7 @@ all_test_funcs(fr_pair_append)
 all_test_funcs(fr_pair_find_by_da)
 all_test_funcs(find_nth)
 all_test_funcs(fr_pair_list_free)
+all_test_funcs(fr_pair_alloc_free)
 
 #define repetition_tests(_func, _perc) \
 	{ #_func "_20_" #_perc, test_ ## _func ## _20_ ## _perc},\
@@ -498,6 +533,7 @@ TEST_LIST = {
 	all_repetition_tests(fr_pair_find_by_da)
 	all_repetition_tests(find_nth)
 	all_repetition_tests(fr_pair_list_free)
+	all_repetition_tests(fr_pair_alloc_free)
 
 	{ NULL }
 };
@@ -143,6 +143,37 @@ static void test_fr_pair_copy(void)
 	talloc_free(copy);
 }
 
+static void test_fr_pair_afrom_da_interned(void)
+{
+	fr_dict_attr_t const	*vendor, *da, *again;
+	fr_pair_t		*vp, *copy;
+
+	TEST_CASE("Interning an unknown vendor and attribute");
+	TEST_CHECK((vendor = fr_dict_unknown_vendor_intern_num(autofree, fr_dict_attr_test_vsa, 65530)) != NULL);
+	TEST_CHECK((da = fr_dict_unknown_attr_intern_num(autofree, vendor, 42)) != NULL);
+	TEST_CHECK(da && da->flags.is_unknown && da->flags.is_interned);
+
+	TEST_CASE("Interning the same attribute again returns the same definition");
+	TEST_CHECK((again = fr_dict_unknown_attr_intern_num(autofree, vendor, 42)) == da);
+	TEST_CHECK(fr_dict_unknown_attr_intern_num(autofree, vendor, 43) != da);
+
+	TEST_CASE("Pairs share interned attributes");
+	TEST_CHECK((vp = fr_pair_afrom_da(autofree, da)) != NULL);
+	TEST_CHECK(vp && vp->da == da);
+	VP_VERIFY(vp);
+
+	TEST_CASE("Copies get a private definition");
+	TEST_CHECK((copy = fr_pair_copy(autofree, vp)) != NULL);
+	TEST_CHECK(copy && (copy->da != da) && !copy->da->flags.is_interned);
+	VP_VERIFY(copy);
+
+	talloc_free(vp);
+	talloc_free(copy);
+
+	TEST_CASE("Interned attributes survive their pairs being freed");
+	TEST_CHECK(fr_dict_unknown_attr_intern_num(autofree, vendor, 42) == da);
+}
+
 static void test_fr_pair_steal(void)
 {
 	fr_pair_t  *vp;
@@ -254,6 +285,50 @@ static void test_fr_pair_find_by_child_num(void)
 	TEST_CHECK(vp && vp->da == fr_dict_attr_test_string);
 }
 
+static void test_fr_pair_find_by_da_indexed(void)
+{
+	fr_pair_t	*vp, *first, *last;
+	fr_pair_list_t	local_pairs;
+	int		i;
+
+	TEST_CASE("Build a list long enough to be indexed");
+	fr_pair_list_init(&local_pairs);
+	for (i = 0; i < 32; i++) {
+		fr_pair_append(&local_pairs, fr_pair_afrom_da(autofree, fr_dict_attr_test_uint32));
+		fr_pair_append(&local_pairs, fr_pair_afrom_da(autofree, fr_dict_attr_test_octets));
+	}
+	first = fr_pair_list_head(&local_pairs);
+	last = fr_pair_list_tail(&local_pairs);
+
+	TEST_CASE("Expected first instance of fr_dict_attr_test_uint32");
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, fr_dict_attr_test_uint32, 0) == first);
+
+	TEST_CASE("Expected last instance of fr_dict_attr_test_octets");
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, fr_dict_attr_test_octets, 31) == last);
+
+	TEST_CASE("Expected no 33rd instance of fr_dict_attr_test_octets");
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, fr_dict_attr_test_octets, 32) == NULL);
+
+	TEST_CASE("Expected no fr_dict_attr_test_string");
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, fr_dict_attr_test_string, 0) == NULL);
+
+	TEST_CASE("Index is updated after prepending a pair");
+	vp = fr_pair_afrom_da(autofree, fr_dict_attr_test_string);
+	fr_pair_prepend(&local_pairs, vp);
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, fr_dict_attr_test_string, 0) == vp);
+
+	TEST_CASE("Index is updated after removing the first instance");
+	fr_pair_delete(&local_pairs, first);
+	TEST_CHECK((vp = fr_pair_find_by_da(&local_pairs, fr_dict_attr_test_uint32, 0)) != NULL);
+	TEST_CHECK(vp && (vp != first) && (vp->da == fr_dict_attr_test_uint32));
+
+	TEST_CASE("Pairs converted in place are not returned");
+	TEST_CHECK(fr_pair_to_unknown(vp) == 0);
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, fr_dict_attr_test_uint32, 0) != vp);
+
+	fr_pair_list_free(&local_pairs);
+}
+
 static void test_fr_pair_append(void)
 {
 	fr_dcursor_t   cursor;
@@ -530,6 +605,42 @@ static void test_fr_pair_list_sort(void)
 	fr_pair_list_free(&local_pairs);
 }
 
+static void test_fr_pair_list_mark_clean(void)
+{
+	fr_pair_t	*vp;
+	fr_pair_list_t	local_pairs;
+
+	fr_pair_list_init(&local_pairs);
+
+	TEST_CASE("A new list is dirty");
+	TEST_CHECK(fr_pair_list_is_dirty(&local_pairs));
+
+	TEST_CASE("Copy the test list, and mark it clean");
+	TEST_CHECK(fr_pair_list_copy(autofree, &local_pairs, &test_pairs) > 0);
+	fr_pair_list_mark_clean(&local_pairs);
+	TEST_CHECK(!fr_pair_list_is_dirty(&local_pairs));
+
+	TEST_CASE("Searching the list doesn't make it dirty");
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, fr_dict_attr_test_string, 0) != NULL);
+	TEST_CHECK(!fr_pair_list_is_dirty(&local_pairs));
+
+	TEST_CASE("Appending a pair makes it dirty");
+	TEST_CHECK((vp = fr_pair_afrom_da(autofree, fr_dict_attr_test_uint32)) != NULL);
+	fr_pair_append(&local_pairs, vp);
+	TEST_CHECK(fr_pair_list_is_dirty(&local_pairs));
+
+	TEST_CASE("Deleting a pair makes it dirty");
+	fr_pair_list_mark_clean(&local_pairs);
+	fr_pair_delete(&local_pairs, vp);
+	TEST_CHECK(fr_pair_list_is_dirty(&local_pairs));
+
+	TEST_CASE("Re-initialising a list makes it dirty");
+	fr_pair_list_mark_clean(&local_pairs);
+	fr_pair_list_free(&local_pairs);
+	fr_pair_list_init(&local_pairs);
+	TEST_CHECK(fr_pair_list_is_dirty(&local_pairs));
+}
+
 static void test_fr_pair_value_copy(void)
 {
 	fr_pair_t *vp1, vp2;
@@ -1122,6 +1233,7 @@ TEST_LIST = {
 	{ "fr_pair_afrom_da",                     test_fr_pair_afrom_da },
 	{ "fr_pair_afrom_child_num",              test_fr_pair_afrom_child_num },
 	{ "fr_pair_copy",                         test_fr_pair_copy },
+	{ "fr_pair_afrom_da_interned",            test_fr_pair_afrom_da_interned },
 	{ "fr_pair_steal",                        test_fr_pair_steal },
 
 	/* Searching and list modification */
@@ -1129,6 +1241,7 @@ TEST_LIST = {
 	{ "fr_dcursor_iter_by_ancestor_init",     test_fr_dcursor_iter_by_ancestor_init },
 	{ "fr_pair_to_unknown",                   test_fr_pair_to_unknown },
 	{ "fr_pair_find_by_da",                   test_fr_pair_find_by_da },
+	{ "fr_pair_find_by_da_indexed",           test_fr_pair_find_by_da_indexed },
 	{ "fr_pair_find_by_child_num",            test_fr_pair_find_by_child_num },
 	{ "fr_pair_append",                       test_fr_pair_append },
 	{ "fr_pair_prepend_by_da",                test_fr_pair_prepend_by_da },
@@ -1146,6 +1259,7 @@ TEST_LIST = {
 	{ "fr_pair_list_copy_by_da",              test_fr_pair_list_copy_by_da },
 	{ "fr_pair_list_copy_by_ancestor",        test_fr_pair_list_copy_by_ancestor },
 	{ "fr_pair_list_sort",                    test_fr_pair_list_sort },
+	{ "fr_pair_list_mark_clean",              test_fr_pair_list_mark_clean },
 
 	/* Copy */
 	{ "fr_pair_value_copy",                   test_fr_pair_value_copy },
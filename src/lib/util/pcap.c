@@ -38,6 +38,10 @@
 #include <sys/uio.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#  include <linux/if_packet.h>
+#endif
+
 #ifndef SIOCGIFHWADDR
 #  include <ifaddrs.h>
 #  include <net/if_dl.h>
@@ -418,6 +422,45 @@ int fr_pcap_apply_filter(fr_pcap_t *pcap, char const *expression)
 	return 0;
 }
 
+/** Share the packets arriving on an interface between multiple capture handles
+ *
+ * All handles for an interface which join the same group receive a
+ * disjoint subset of its packets.  Packets are distributed using a
+ * symmetric hash of their addresses and ports, so that a request and
+ * its response are always received by the same handle.
+ *
+ * @param pcap handle to add to the group.  Must be an open interface.
+ * @param group identifies the group.  Must be unique to the interface,
+ *	and to this process.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, or if fanout isn't supported on this platform.
+ */
+int fr_pcap_fanout(fr_pcap_t *pcap, uint16_t group)
+{
+#ifdef PACKET_FANOUT
+	int arg;
+
+	if ((pcap->type != PCAP_INTERFACE_IN) && (pcap->type != PCAP_INTERFACE_IN_OUT)) {
+		fr_strerror_printf("Can't share \"%s\", it's not an interface", pcap->name);
+		return -1;
+	}
+
+	arg = group | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+	if (setsockopt(pcap->fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+		fr_strerror_printf("Failed joining fanout group on \"%s\": %s", pcap->name, fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+#else
+	(void) group;
+
+	fr_strerror_printf("Can't share \"%s\", packet fanout is not supported on this platform", pcap->name);
+	return -1;
+#endif
+}
+
 /** Retrieve list of interface names that will be used for capture.
  * Only used for debugging.
  *
@@ -139,14 +139,44 @@ inline size_t fr_utf8_char(uint8_t const *str, ssize_t inlen)
 	return 0;
 }
 
+#define BYTES_ALL(_x)		((uint64_t)(_x) * 0x0101010101010101ULL)
+
+/** Return the length of the run of printable ASCII chars at the start of a string
+ *
+ * Almost all of the strings we validate are entirely printable ASCII, so we check
+ * eight bytes at a time until we find a byte which isn't.  A word has a byte lower
+ * than 0x20 if (w - 0x20..) & ~w & 0x80.. is non-zero, and a byte higher than 0x7e
+ * if ((w + 0x01..) | w) & 0x80.. is non-zero.
+ *
+ * @param[in] str	input string.
+ * @param[in] len	length of input string.
+ * @return The number of printable ASCII chars at the start of the string.
+ */
+static inline size_t utf8_ascii_span(uint8_t const *str, size_t len)
+{
+	uint8_t const *p = str, *end = str + len;
+
+	while ((size_t)(end - p) >= sizeof(uint64_t)) {
+		uint64_t w;
+
+		memcpy(&w, p, sizeof(w));
+		if ((((w - BYTES_ALL(0x20)) & ~w) | (w + BYTES_ALL(0x01)) | w) & BYTES_ALL(0x80)) break;
+		p += sizeof(w);
+	}
+
+	while ((p < end) && (*p >= 0x20) && (*p <= 0x7e)) p++;
+
+	return p - str;
+}
+
 /** Validate a complete UTF8 string
  *
  * @param[in] str	input string.
  * @param[in] inlen	length of input string.  May be -1 if str
  *			is \0 terminated.
- * @return The number of bytes validated.  If ret == inlen the entire
- *	   string is valid.  Else ret gives the offset at which the
- *	   first invalid byte sequence was found.
+ * @return The number of bytes validated.  If ret == the length of the
+ *	   string, the entire string is valid.  Else ret gives the offset
+ *	   at which the first invalid byte sequence was found.
  */
 ssize_t fr_utf8_str(uint8_t const *str, ssize_t inlen)
 {
@@ -158,15 +188,18 @@ ssize_t fr_utf8_str(uint8_t const *str, ssize_t inlen)
 	p = str;
 	end = p + len;
 
-	do {
+	while (p < end) {
 		size_t clen;
 
+		p += utf8_ascii_span(p, end - p);
+		if (p == end) break;
+
 		clen = fr_utf8_char(p, end - p);
-		if (clen == 0) return end - p;
+		if (clen == 0) return p - str;
 		p += clen;
-	} while (p < end);
+	}
 
-	return inlen;
+	return len;
 }
 
 /** Return a pointer to the first UTF8 char in a string.
@@ -0,0 +1,61 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Static tracepoints (USDT) for use with bpftrace, perf, SystemTap, etc.
+ *
+ * Each probe compiles to a single NOP, and a note in the ELF binary
+ * describing where its arguments can be found.  Nothing is evaluated
+ * unless a tracer is attached, so arguments should be cheap scalars
+ * or pointers which are already to hand.
+ *
+ * If <sys/sdt.h> is not available, the probes are compiled out.
+ *
+ * All probes are in the `freeradius` provider, e.g.
+ *
+ @verbatim
+   bpftrace -e 'usdt:/usr/sbin/radiusd:freeradius:module_enter { @[str(arg1)] = count(); }'
+ @endverbatim
+ *
+ * @file src/lib/util/probe.h
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(probe_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef HAVE_SYS_SDT_H
+#  include <sys/sdt.h>
+
+#  define FR_PROBE0(_name)				DTRACE_PROBE(freeradius, _name)
+#  define FR_PROBE1(_name, _a)				DTRACE_PROBE1(freeradius, _name, _a)
+#  define FR_PROBE2(_name, _a, _b)			DTRACE_PROBE2(freeradius, _name, _a, _b)
+#  define FR_PROBE3(_name, _a, _b, _c)			DTRACE_PROBE3(freeradius, _name, _a, _b, _c)
+#  define FR_PROBE4(_name, _a, _b, _c, _d)		DTRACE_PROBE4(freeradius, _name, _a, _b, _c, _d)
+#else
+#  define FR_PROBE0(_name)
+#  define FR_PROBE1(_name, _a)
+#  define FR_PROBE2(_name, _a, _b)
+#  define FR_PROBE3(_name, _a, _b, _c)
+#  define FR_PROBE4(_name, _a, _b, _c, _d)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
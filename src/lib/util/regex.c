@@ -29,9 +29,18 @@ RCSID("$Id$")
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/talloc.h>
 #include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/talloc.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 #if defined(HAVE_REGEX_PCRE) || (defined(HAVE_REGEX_PCRE2) && defined(PCRE2_CONFIG_JIT))
 #ifndef FR_PCRE_JIT_STACK_MIN
 #  define FR_PCRE_JIT_STACK_MIN	(128 * 1024)
@@ -41,6 +50,18 @@ RCSID("$Id$")
 #endif
 #endif
 
+/** Maximum number of runtime-expanded patterns each thread keeps compiled
+ *
+ * Set to 0 to disable the cache.
+ */
+#ifndef FR_REGEX_CACHE_SIZE
+#  define FR_REGEX_CACHE_SIZE	(128)
+#endif
+
+static atomic_uint_fast64_t	regex_cache_hits = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast64_t	regex_cache_misses = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast64_t	regex_cache_evictions = ATOMIC_VAR_INIT(0);
+
 /*
  *######################################
  *#      FUNCTIONS FOR LIBPCRE2        #
@@ -52,6 +73,16 @@ RCSID("$Id$")
  *	to be binary safe for both patterns and subjects but require
  *	libpcre2.
  */
+/** An entry in the runtime regex cache
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the LRU list.
+	char const		*pattern;	//!< Expanded pattern.
+	size_t			len;		//!< Length of the pattern.
+	uint32_t		key_flags;	//!< Compilation flags the pattern was compiled with.
+	regex_t			*preg;		//!< Compiled, and if possible JIT'd, expression.
+} fr_regex_cache_entry_t;
 
 /** Thread local storage for PCRE2
  *
@@ -68,6 +99,8 @@ typedef struct {
 	pcre2_jit_stack		*jit_stack;	//!< Jit stack for executing jit'd patterns.
 	bool			do_jit;		//!< Whether we have runtime JIT support.
 #endif
+	fr_hash_table_t		*cache;		//!< Runtime-expanded patterns we've already compiled.
+	fr_dlist_head_t		cache_lru;	//!< Cache entries, most recently used first.
 } fr_pcre2_tls_t;
 
 /** Thread local storage for pcre2
@@ -286,6 +319,186 @@ ssize_t regex_compile(TALLOC_CTX *ctx, regex_t **out, char const *pattern, size_
 	return len;
 }
 
+/** Combine the flags which affect compilation into a single value
+ *
+ */
+static inline uint32_t regex_cache_key_flags(fr_regex_flags_t const *flags, bool subcaptures)
+{
+	uint32_t key = subcaptures;
+
+	if (!flags) return key;
+
+	return key | (flags->ignore_case << 1) | (flags->multiline << 2) | (flags->dot_all << 3) |
+	       (flags->unicode << 4) | (flags->extended << 5);
+}
+
+static uint32_t _regex_cache_hash(void const *data)
+{
+	fr_regex_cache_entry_t const *entry = data;
+
+	return fr_hash_update(&entry->key_flags, sizeof(entry->key_flags), fr_hash(entry->pattern, entry->len));
+}
+
+static int8_t _regex_cache_cmp(void const *one, void const *two)
+{
+	fr_regex_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->key_flags, b->key_flags);
+	if (ret != 0) return ret;
+
+	ret = CMP(a->len, b->len);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->pattern, b->pattern, a->len);
+	return CMP(ret, 0);
+}
+
+/** Remove an entry from the cache
+ *
+ * If the expression is still referenced, i.e. by capture groups
+ * of a request, it's freed when the last reference is released.
+ */
+static void regex_cache_evict(fr_pcre2_tls_t *tls, fr_regex_cache_entry_t *entry)
+{
+	fr_hash_table_remove(tls->cache, entry);
+	fr_dlist_remove(&tls->cache_lru, entry);
+
+	if (entry->preg->refs > 0) {
+		entry->preg->evicted = true;
+		talloc_steal(NULL, entry->preg);
+	}
+	talloc_free(entry);
+
+	atomic_fetch_add_explicit(&regex_cache_evictions, 1, memory_order_relaxed);
+}
+
+/** Compile a runtime-expanded pattern, reusing a previous compilation if possible
+ *
+ * Each thread keeps the last #FR_REGEX_CACHE_SIZE patterns it compiled, so
+ * expressions built from attributes which take a small number of values
+ * are compiled, and JIT'd, once, rather than on every evaluation.
+ *
+ * @note Compiled expression must be freed with #regex_release.
+ *
+ * @param[in] ctx		to allocate the expression in, if it can't be cached.
+ * @param[out] out		Where to write out a pointer to the compiled expression.
+ * @param[in] pattern		to compile.
+ * @param[in] len		of pattern.
+ * @param[in] flags		controlling matching. May be NULL.
+ * @param[in] subcaptures	Whether to compile the regular expression to store subcapture
+ *				data.
+ * @return
+ *	- >= 1 on success.
+ *	- <= 0 on error. Negative value is offset of parse error.
+ */
+ssize_t regex_compile_cached(TALLOC_CTX *ctx, regex_t **out, char const *pattern, size_t len,
+			     fr_regex_flags_t const *flags, bool subcaptures)
+{
+	fr_regex_cache_entry_t	*entry;
+	ssize_t			slen;
+
+	*out = NULL;
+
+	if (unlikely(!fr_pcre2_tls) && (fr_pcre2_tls_init() < 0)) return -1;
+
+	if (FR_REGEX_CACHE_SIZE == 0) return regex_compile(ctx, out, pattern, len, flags, subcaptures, true);
+
+	if (!fr_pcre2_tls->cache) {
+		fr_pcre2_tls->cache = fr_hash_table_alloc(fr_pcre2_tls, _regex_cache_hash, _regex_cache_cmp, NULL);
+		if (!fr_pcre2_tls->cache) {
+			fr_strerror_const("Failed allocating regex cache");
+			return -1;
+		}
+		fr_dlist_talloc_init(&fr_pcre2_tls->cache_lru, fr_regex_cache_entry_t, entry);
+	}
+
+	entry = fr_hash_table_find(fr_pcre2_tls->cache, &(fr_regex_cache_entry_t){
+					.pattern = pattern,
+					.len = len,
+					.key_flags = regex_cache_key_flags(flags, subcaptures)
+				   });
+	if (entry) {
+		atomic_fetch_add_explicit(&regex_cache_hits, 1, memory_order_relaxed);
+
+		fr_dlist_remove(&fr_pcre2_tls->cache_lru, entry);
+		fr_dlist_insert_head(&fr_pcre2_tls->cache_lru, entry);
+
+		entry->preg->refs++;
+		*out = entry->preg;
+
+		return len;
+	}
+
+	atomic_fetch_add_explicit(&regex_cache_misses, 1, memory_order_relaxed);
+
+	entry = talloc_zero(fr_pcre2_tls->cache, fr_regex_cache_entry_t);
+	if (!entry) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	slen = regex_compile(entry, &entry->preg, pattern, len, flags, subcaptures, false);
+	if (slen <= 0) {
+		talloc_free(entry);
+		return slen;
+	}
+
+	entry->pattern = talloc_bstrndup(entry, pattern, len);
+	if (!entry->pattern) {
+		fr_strerror_const("Out of memory");
+		talloc_free(entry);
+		return -1;
+	}
+	entry->len = len;
+	entry->key_flags = regex_cache_key_flags(flags, subcaptures);
+	entry->preg->cached = true;
+	entry->preg->refs = 1;
+
+	if (!fr_hash_table_insert(fr_pcre2_tls->cache, entry)) {
+		fr_strerror_const("Failed inserting into regex cache");
+		talloc_free(entry);
+		return -1;
+	}
+	fr_dlist_insert_head(&fr_pcre2_tls->cache_lru, entry);
+
+	if (fr_dlist_num_elements(&fr_pcre2_tls->cache_lru) > FR_REGEX_CACHE_SIZE) {
+		regex_cache_evict(fr_pcre2_tls, fr_dlist_tail(&fr_pcre2_tls->cache_lru));
+	}
+
+	*out = entry->preg;
+
+	return slen;
+}
+
+/** Add a reference to an expression returned by #regex_compile_cached
+ *
+ * @param[in] preg	to add a reference to.
+ */
+void regex_retain(regex_t *preg)
+{
+	fr_assert(preg->cached);
+
+	preg->refs++;
+}
+
+/** Release an expression returned by #regex_compile_cached
+ *
+ * @param[in] preg	to release.  May be NULL.
+ */
+void regex_release(regex_t *preg)
+{
+	if (!preg) return;
+
+	if (!preg->cached) {
+		talloc_free(preg);
+		return;
+	}
+
+	fr_assert(preg->refs > 0);
+	if ((--preg->refs == 0) && preg->evicted) talloc_free(preg);
+}
+
 /** Wrapper around pcre2_exec
  *
  * @param[in] preg	The compiled expression.
@@ -1212,12 +1425,58 @@ fr_regmatch_t *regex_match_data_alloc(TALLOC_CTX *ctx, uint32_t count)
 }
 #  endif
 
+#  ifndef HAVE_REGEX_PCRE2
+/** Compile a runtime-expanded pattern
+ *
+ * Only libpcre2 expressions are cached, so this is equivalent to
+ * calling #regex_compile for one off evaluation.
+ *
+ * @note Compiled expression must be freed with #regex_release.
+ */
+ssize_t regex_compile_cached(TALLOC_CTX *ctx, regex_t **out, char const *pattern, size_t len,
+			     fr_regex_flags_t const *flags, bool subcaptures)
+{
+	atomic_fetch_add_explicit(&regex_cache_misses, 1, memory_order_relaxed);
+
+	return regex_compile(ctx, out, pattern, len, flags, subcaptures, true);
+}
+
+/** Nothing to do, as expressions are never cached
+ *
+ */
+void regex_retain(UNUSED regex_t *preg)
+{
+}
+
+/** Release an expression returned by #regex_compile_cached
+ *
+ * @param[in] preg	to release.  May be NULL.
+ */
+void regex_release(regex_t *preg)
+{
+	talloc_free(preg);
+}
+#  endif
+
 /*
  *########################################
  *#         UNIVERSAL FUNCTIONS          #
  *########################################
  */
 
+/** Return the runtime regex cache statistics, summed over all threads
+ *
+ * @param[out] hits		Number of times a compiled expression was reused.
+ * @param[out] misses		Number of times a pattern had to be compiled.
+ * @param[out] evictions	Number of expressions removed from the cache to make space.
+ */
+void regex_cache_stats(uint64_t *hits, uint64_t *misses, uint64_t *evictions)
+{
+	*hits = atomic_load_explicit(&regex_cache_hits, memory_order_relaxed);
+	*misses = atomic_load_explicit(&regex_cache_misses, memory_order_relaxed);
+	*evictions = atomic_load_explicit(&regex_cache_evictions, memory_order_relaxed);
+}
+
 /** Parse a string containing one or more regex flags
  *
  * @param[out] err		May be NULL. If not NULL will be set to:
@@ -68,6 +68,11 @@ typedef struct {
 	bool			precompiled;	//!< Whether this regex was precompiled,
 						///< or compiled for one off evaluation.
 	bool			jitd;		//!< Whether JIT data is available.
+
+	bool			cached;		//!< Owned by the thread's runtime regex cache.
+						///< Must be released with #regex_release.
+	bool			evicted;	//!< Removed from the cache while still referenced.
+	uint32_t		refs;		//!< References held on a cached regex.
 } regex_t;
 /*
  *######################################
@@ -176,6 +181,12 @@ ssize_t		regex_flags_print(fr_sbuff_t *sbuff, fr_regex_flags_t const flags[stati
 ssize_t		regex_compile(TALLOC_CTX *ctx, regex_t **out, char const *pattern, size_t len,
 			      fr_regex_flags_t const *flags, bool subcaptures, bool runtime);
 int		regex_exec(regex_t *preg, char const *subject, size_t len, fr_regmatch_t *regmatch);
+
+ssize_t		regex_compile_cached(TALLOC_CTX *ctx, regex_t **out, char const *pattern, size_t len,
+				     fr_regex_flags_t const *flags, bool subcaptures);
+void		regex_retain(regex_t *preg);
+void		regex_release(regex_t *preg);
+void		regex_cache_stats(uint64_t *hits, uint64_t *misses, uint64_t *evictions);
 #ifdef HAVE_REGEX_PCRE2
 int		regex_substitute(TALLOC_CTX *ctx, char **out, size_t max_out, regex_t *preg, fr_regex_flags_t *flags,
 		     		 char const *subject, size_t subject_len,
@@ -44,6 +44,10 @@
 
 #include <ifaddrs.h>
 
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
 /** Resolve a named service to a port
  *
  * @param[in] proto	The protocol. Either IPPROTO_TCP or IPPROTO_UDP.
@@ -1046,3 +1050,46 @@ done:
 #endif
 	return 0;
 }
+
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_AD_CPU)
+/** Steer packets received on a SO_REUSEPORT group to the socket matching the receiving CPU
+ *
+ * Attaches a classic BPF program to the reuseport group which returns the
+ * ID of the CPU that received the packet.  The kernel then delivers the
+ * packet to the socket at that index in the group, i.e. the N'th socket
+ * bound to the address gets the packets received on CPU N.
+ *
+ * When each socket in the group is serviced by a process or thread pinned
+ * to the matching CPU, a client's packets (which RSS hashes to the same
+ * receive queue) are always processed by the same reader.
+ *
+ * @param[in] sockfd	a socket which has SO_REUSEPORT set.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_socket_reuseport_cpu_steer(int sockfd)
+{
+	struct sock_filter	code[] = {
+					{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },	/* A = raw_smp_processor_id() */
+					{ BPF_RET | BPF_A, 0, 0, 0 }					/* return A */
+				};
+	struct sock_fprog	prog = {
+					.len = NUM_ELEMENTS(code),
+					.filter = code
+				};
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		fr_strerror_printf("Failed attaching reuseport CPU steering program: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+#else
+int fr_socket_reuseport_cpu_steer(UNUSED int sockfd)
+{
+	fr_strerror_const("Reuseport CPU steering is not supported on this system");
+	return -1;
+}
+#endif
@@ -0,0 +1,290 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Record how long each phase of startup takes
+ *
+ * @file src/lib/util/startup.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/startup.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+#include <pthread.h>
+#include <sys/resource.h>
+
+typedef struct {
+	char const	*phase;			//!< What we were doing, e.g. "instantiate".
+						///< Must be a literal.
+	char		*name;			//!< What we were doing it to, e.g. "sql".  May be NULL.
+	unsigned int	depth;			//!< How many phases this one is nested inside.
+	bool		done;			//!< Whether fr_startup_phase_end() has been called.
+
+	fr_time_t	start;			//!< When the phase started.
+	fr_time_delta_t	elapsed;		//!< How long the phase took.
+
+	size_t		talloc_start;		//!< Bytes allocated from the NULL ctx at the start.
+	int64_t		talloc_delta;		//!< Change in bytes allocated from the NULL ctx.
+
+	long		rss_start;		//!< Peak RSS (KiB) at the start.
+	long		rss_delta;		//!< Increase in peak RSS (KiB).
+} fr_startup_phase_t;
+
+static bool			startup_enabled;
+static pthread_mutex_t		startup_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ *	The phase list uses malloc() so that recording the profile
+ *	doesn't change the talloc totals we're trying to measure.
+ */
+static fr_startup_phase_t	*startup_phases;
+static unsigned int		startup_num;
+static unsigned int		startup_alloced;
+static unsigned int		startup_depth;
+
+static long startup_maxrss(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0) return 0;
+
+	return ru.ru_maxrss;
+}
+
+/** Start recording a profile of startup
+ *
+ * Should be called before anything which is to be profiled.
+ */
+void fr_startup_profile_enable(void)
+{
+	startup_enabled = true;
+}
+
+/** Whether startup is being profiled
+ *
+ */
+bool fr_startup_profile_enabled(void)
+{
+	return startup_enabled;
+}
+
+/** Mark the start of a startup phase
+ *
+ * @param[in] phase	What's being done, e.g. "instantiate".  Must be a literal,
+ *			or otherwise outlive the profile.
+ * @param[in] name	What it's being done to, e.g. a module name.  May be NULL.
+ *			A copy is made.
+ * @return
+ *	- >= 0 an identifier to pass to fr_startup_phase_end().
+ *	- -1 if profiling is disabled, or we ran out of memory.
+ */
+int fr_startup_phase_start(char const *phase, char const *name)
+{
+	fr_startup_phase_t	*p;
+	int			id;
+
+	if (!startup_enabled) return -1;
+
+	pthread_mutex_lock(&startup_mutex);
+	if (startup_num == startup_alloced) {
+		fr_startup_phase_t	*n;
+		unsigned int		alloced = startup_alloced ? (startup_alloced * 2) : 64;
+
+		n = realloc(startup_phases, sizeof(*n) * alloced);
+		if (!n) {
+			pthread_mutex_unlock(&startup_mutex);
+			return -1;
+		}
+		startup_phases = n;
+		startup_alloced = alloced;
+	}
+
+	id = startup_num++;
+	p = &startup_phases[id];
+	*p = (fr_startup_phase_t) {
+		.phase = phase,
+		.name = name ? strdup(name) : NULL,
+		.depth = startup_depth++,
+		.talloc_start = talloc_total_size(NULL),
+		.rss_start = startup_maxrss(),
+		.start = fr_time()
+	};
+	pthread_mutex_unlock(&startup_mutex);
+
+	return id;
+}
+
+/** Mark the end of a startup phase
+ *
+ * Phases should be ended in the reverse order to which they were started.
+ *
+ * @param[in] id	returned by fr_startup_phase_start().  If < 0, this function
+ *			does nothing.
+ */
+void fr_startup_phase_end(int id)
+{
+	fr_startup_phase_t	*p;
+	fr_time_t		now;
+
+	if (id < 0) return;
+
+	now = fr_time();
+
+	pthread_mutex_lock(&startup_mutex);
+	if ((unsigned int)id >= startup_num) {
+		pthread_mutex_unlock(&startup_mutex);
+		return;
+	}
+
+	p = &startup_phases[id];
+	if (!p->done) {
+		p->elapsed = now - p->start;
+		p->talloc_delta = (int64_t)talloc_total_size(NULL) - (int64_t)p->talloc_start;
+		p->rss_delta = startup_maxrss() - p->rss_start;
+		p->done = true;
+		if (startup_depth > 0) startup_depth--;
+	}
+	pthread_mutex_unlock(&startup_mutex);
+}
+
+/** Write the startup profile to a log
+ *
+ * One line per phase, indented by nesting depth.  The talloc column
+ * is only meaningful if talloc NULL tracking was enabled.
+ *
+ * @param[in] log	to write to.  If NULL, the default log is used.
+ */
+void fr_startup_profile_log(fr_log_t const *log)
+{
+	unsigned int	i;
+
+	if (!startup_enabled) return;
+	if (!log) log = &default_log;
+
+	pthread_mutex_lock(&startup_mutex);
+	fr_log(log, L_INFO, __FILE__, __LINE__, "Startup profile");
+	fr_log(log, L_INFO, __FILE__, __LINE__, "  %12s %10s %12s  %s", "msec", "rss KiB", "talloc bytes", "phase");
+
+	for (i = 0; i < startup_num; i++) {
+		fr_startup_phase_t const *p = &startup_phases[i];
+
+		if (!p->done) {
+			fr_log(log, L_INFO, __FILE__, __LINE__, "  %12s %10s %12s  %*s%s%s%s (unfinished)",
+			       "-", "-", "-", (int)(p->depth * 2), "",
+			       p->phase, p->name ? " " : "", p->name ? p->name : "");
+			continue;
+		}
+
+		fr_log(log, L_INFO, __FILE__, __LINE__, "  %12.3f %10ld %12" PRId64 "  %*s%s%s%s",
+		       (double)p->elapsed / (double)NSEC * 1000.0, p->rss_delta, p->talloc_delta,
+		       (int)(p->depth * 2), "", p->phase, p->name ? " " : "", p->name ? p->name : "");
+	}
+	pthread_mutex_unlock(&startup_mutex);
+}
+
+static void startup_json_string(FILE *fp, char const *str)
+{
+	char const *q;
+
+	fputc('"', fp);
+	for (q = str; *q; q++) {
+		switch (*q) {
+		case '"':
+		case '\\':
+			fputc('\\', fp);
+			fputc(*q, fp);
+			break;
+
+		default:
+			if ((uint8_t)*q < 0x20) {
+				fprintf(fp, "\\u%04x", (uint8_t)*q);
+				break;
+			}
+			fputc(*q, fp);
+			break;
+		}
+	}
+	fputc('"', fp);
+}
+
+/** Write the startup profile as JSON
+ *
+ * The output is an array of objects, in the order the phases were started.
+ *
+ @verbatim
+   [
+     { "phase": "instantiate", "name": "sql", "depth": 1, "elapsed_usec": 1234,
+       "rss_kib": 512, "talloc_bytes": 40960 },
+     ...
+   ]
+ @endverbatim
+ *
+ * @param[in] fp	to write to.
+ * @return
+ *	- 0 on success.
+ *	- -1 on write error.
+ */
+int fr_startup_profile_json_fprint(FILE *fp)
+{
+	unsigned int	i;
+
+	pthread_mutex_lock(&startup_mutex);
+	fputs("[\n", fp);
+	for (i = 0; i < startup_num; i++) {
+		fr_startup_phase_t const *p = &startup_phases[i];
+
+		fputs("  { \"phase\": ", fp);
+		startup_json_string(fp, p->phase);
+		fputs(", \"name\": ", fp);
+		if (p->name) {
+			startup_json_string(fp, p->name);
+		} else {
+			fputs("null", fp);
+		}
+		fprintf(fp, ", \"depth\": %u", p->depth);
+
+		if (p->done) {
+			fprintf(fp, ", \"elapsed_usec\": %" PRId64 ", \"rss_kib\": %ld, \"talloc_bytes\": %" PRId64 " }",
+				(int64_t)(p->elapsed / 1000), p->rss_delta, p->talloc_delta);
+		} else {
+			fputs(", \"elapsed_usec\": null, \"rss_kib\": null, \"talloc_bytes\": null }", fp);
+		}
+		fputs((i + 1) < startup_num ? ",\n" : "\n", fp);
+	}
+	fputs("]\n", fp);
+	pthread_mutex_unlock(&startup_mutex);
+
+	return ferror(fp) ? -1 : 0;
+}
+
+/** Free the startup profile, and stop recording
+ *
+ */
+void fr_startup_profile_free(void)
+{
+	unsigned int	i;
+
+	pthread_mutex_lock(&startup_mutex);
+	for (i = 0; i < startup_num; i++) free(startup_phases[i].name);
+	free(startup_phases);
+	startup_phases = NULL;
+	startup_num = startup_alloced = startup_depth = 0;
+	startup_enabled = false;
+	pthread_mutex_unlock(&startup_mutex);
+}
@@ -0,0 +1,59 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Record how long each phase of startup takes
+ *
+ * Phases may be nested, e.g. "instantiate" contains one phase per
+ * module instance.  For each phase we record the wall time, the
+ * change in peak RSS, and the change in memory allocated from the
+ * talloc NULL context (if talloc NULL tracking is enabled).
+ *
+ * Recording is off by default, in which case fr_startup_phase_start()
+ * does nothing, and returns -1.
+ *
+ * @file src/lib/util/startup.h
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(startup_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/util/log.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+
+void	fr_startup_profile_enable(void);
+
+bool	fr_startup_profile_enabled(void);
+
+int	fr_startup_phase_start(char const *phase, char const *name);
+
+void	fr_startup_phase_end(int id);
+
+void	fr_startup_profile_log(fr_log_t const *log);
+
+int	fr_startup_profile_json_fprint(FILE *fp) CC_HINT(nonnull);
+
+void	fr_startup_profile_free(void);
+
+#ifdef __cplusplus
+}
+#endif
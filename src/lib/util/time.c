@@ -28,6 +28,7 @@ RCSID("$Id$")
 #include <freeradius-devel/autoconf.h>
 #include <freeradius-devel/util/dict.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/sbuff.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/time.h>
@@ -536,6 +537,129 @@ void fr_time_elapsed_fprint(FILE *fp, fr_time_elapsed_t const *elapsed, char con
 	}
 }
 
+/** Record a time delta in a histogram
+ *
+ * @param[in] hist	to update.
+ * @param[in] delta	to record.
+ */
+void fr_time_hist_update(fr_time_hist_t *hist, fr_time_delta_t delta)
+{
+	uint64_t	usec;
+	unsigned int	idx;
+
+	if (delta < 0) delta = 0;
+	if (delta > hist->max) hist->max = delta;
+	hist->count++;
+
+	usec = delta / 1000;
+	if (usec > UINT32_MAX) usec = UINT32_MAX;
+
+	/*
+	 *	Small values get a bucket each.  Larger ones use the
+	 *	position of the high bit to select the power of two,
+	 *	and the next FR_TIME_HIST_SUB_BITS bits to select the
+	 *	bucket within it.
+	 */
+	if (usec < FR_TIME_HIST_SUB) {
+		idx = usec;
+	} else {
+		unsigned int msb = fr_high_bit_pos(usec) - 1;
+
+		idx = ((msb - FR_TIME_HIST_SUB_BITS + 1) * FR_TIME_HIST_SUB) +
+		      ((usec >> (msb - FR_TIME_HIST_SUB_BITS)) & (FR_TIME_HIST_SUB - 1));
+	}
+
+	hist->bucket[idx]++;
+}
+
+/** Return the upper bound of a histogram bucket
+ *
+ */
+static fr_time_delta_t time_hist_bucket_max(unsigned int idx)
+{
+	unsigned int	msb;
+	uint64_t	width, low;
+
+	if (idx < FR_TIME_HIST_SUB) return ((fr_time_delta_t) idx + 1) * 1000 - 1;
+
+	msb = (idx / FR_TIME_HIST_SUB) + FR_TIME_HIST_SUB_BITS - 1;
+	width = ((uint64_t) 1) << (msb - FR_TIME_HIST_SUB_BITS);
+	low = (((uint64_t) 1) << msb) + ((idx % FR_TIME_HIST_SUB) * width);
+
+	return (fr_time_delta_t) (low + width) * 1000 - 1;
+}
+
+/** Get an approximate percentile from a histogram
+ *
+ * @param[in] hist	to read.
+ * @param[in] pct	percentile to return, 0-100.
+ * @return The upper bound of the bucket containing the percentile,
+ *	capped at the largest value recorded.
+ */
+fr_time_delta_t fr_time_hist_percentile(fr_time_hist_t const *hist, double pct)
+{
+	uint64_t	target, seen = 0;
+	unsigned int	i;
+
+	if (!hist->count) return 0;
+
+	target = (uint64_t) ((hist->count * pct) / 100.0);
+	if (target < 1) target = 1;
+	if (target > hist->count) target = hist->count;
+
+	for (i = 0; i < FR_TIME_HIST_BUCKETS; i++) {
+		seen += hist->bucket[i];
+		if (seen >= target) {
+			fr_time_delta_t max = time_hist_bucket_max(i);
+
+			return (max < hist->max) ? max : hist->max;
+		}
+	}
+
+	return hist->max;
+}
+
+static const char *hist_names[] = {
+	"p50", "p90", "p99", "p99.9", "max"
+};
+
+static double const hist_pct[] = {
+	50, 90, 99, 99.9, 100
+};
+
+/** Print the common percentiles of a histogram
+ *
+ * @param[in] fp		to write to.
+ * @param[in] hist		to print.
+ * @param[in] prefix		for each line.
+ * @param[in] tab_offset	column to align the values to.
+ */
+void fr_time_hist_fprint(FILE *fp, fr_time_hist_t const *hist, char const *prefix, int tab_offset)
+{
+	size_t	i, prefix_len;
+
+	if (!hist->count) return;
+
+	if (!prefix) prefix = "hist";
+
+	prefix_len = strlen(prefix);
+
+	for (i = 0; i < NUM_ELEMENTS(hist_names); i++) {
+		fr_time_delta_t	when = fr_time_hist_percentile(hist, hist_pct[i]);
+		size_t		len = prefix_len + strlen(hist_names[i]);
+		int		tabs = 1;
+
+		if (len < (size_t) (tab_offset * 8)) {
+			tabs = ((tab_offset * 8) - len);
+			if ((tabs & 0x07) != 0) tabs += 7;
+			tabs >>= 3;
+		}
+
+		fprintf(fp, "%s.%s%.*s%u.%06u\n", prefix, hist_names[i], tabs, tab_string,
+			(unsigned int) (when / NSEC), (unsigned int) (when % NSEC) / 1000);
+	}
+}
+
 /*
  *	Based on https://blog.reverberate.org/2020/05/12/optimizing-date-algorithms.html
  */
@@ -83,6 +83,25 @@ typedef struct {
 	uint64_t	array[8];		//!< 100ns to 100s
 } fr_time_elapsed_t;
 
+#define FR_TIME_HIST_SUB_BITS	2		//!< log2 of the number of buckets per power of two.
+#define FR_TIME_HIST_SUB	(1 << FR_TIME_HIST_SUB_BITS)
+#define FR_TIME_HIST_BUCKETS	((32 - FR_TIME_HIST_SUB_BITS + 1) * FR_TIME_HIST_SUB)
+
+/** Log-linear histogram of time deltas
+ *
+ * Values are recorded in microseconds.  Each power of two is split into
+ * #FR_TIME_HIST_SUB linear buckets, so any percentile read back is within
+ * 25% of the true value, over a range of 1us to ~70 minutes.
+ *
+ * Recording is a handful of integer operations, and the structure is
+ * fixed size, so one can be kept per thread without any locking.
+ */
+typedef struct {
+	uint64_t	count;				//!< Number of values recorded.
+	fr_time_delta_t	max;				//!< Largest value recorded.
+	uint64_t	bucket[FR_TIME_HIST_BUCKETS];	//!< Counts for each bucket.
+} fr_time_hist_t;
+
 #define NSEC	(1000000000)
 #define USEC	(1000000)
 #define MSEC	(1000)
@@ -343,6 +362,24 @@ static inline fr_time_t fr_time(void)
 #endif
 }
 
+/** Return the CPU time used by the calling thread
+ *
+ * Only differences between two calls are meaningful.
+ *
+ * @returns fr_time_delta_t CPU time in nanoseconds, or 0 if there's no
+ *	    per-thread CPU clock.
+ */
+static inline fr_time_delta_t fr_time_thread_cpu(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+	struct timespec ts;
+	(void) clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return fr_time_delta_from_timespec(&ts);
+#else
+	return 0;
+#endif
+}
+
 int		fr_time_start(void);
 int		fr_time_sync(void);
 
@@ -354,6 +391,10 @@ size_t		fr_time_strftime_utc(fr_sbuff_t *out, fr_time_t time, char const *fmt)
 
 void		fr_time_elapsed_update(fr_time_elapsed_t *elapsed, fr_time_t start, fr_time_t end) CC_HINT(nonnull);
 void		fr_time_elapsed_fprint(FILE *fp, fr_time_elapsed_t const *elapsed, char const *prefix, int tabs) CC_HINT(nonnull(1,2));
+
+void		fr_time_hist_update(fr_time_hist_t *hist, fr_time_delta_t delta) CC_HINT(nonnull);
+fr_time_delta_t	fr_time_hist_percentile(fr_time_hist_t const *hist, double pct) CC_HINT(nonnull);
+void		fr_time_hist_fprint(FILE *fp, fr_time_hist_t const *hist, char const *prefix, int tabs) CC_HINT(nonnull(1,2));
 time_t		fr_time_from_utc(struct tm *tm) CC_HINT(nonnull);
 
 #ifdef __cplusplus
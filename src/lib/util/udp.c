@@ -28,6 +28,10 @@ RCSID("$Id$")
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/udp.h>
 
+#ifdef HAVE_SYS_UIO_H
+#  include <sys/uio.h>
+#endif
+
 #define FR_DEBUG_STRERROR_PRINTF if (fr_debug_lvl) fr_strerror_printf
 
 /** Send a packet via a UDP socket.
@@ -213,3 +217,436 @@ done:
 
 	return slen;
 }
+
+/*
+ *	Enough room for IP_PKTINFO / IPV6_PKTINFO and SO_TIMESTAMP.
+ */
+#define UDP_BATCH_CBUF_SIZE	(256)
+
+struct udp_batch_s {
+	int			sockfd;			//!< we're reading from.
+
+	unsigned int		num;			//!< maximum number of packets to read at once.
+	unsigned int		received;		//!< number of packets read by the last recvmmsg().
+	unsigned int		next;			//!< the next packet to return to the caller.
+	bool			drained;		//!< all packets in the batch have been returned.
+
+	size_t			max_packet_size;	//!< size of each packet buffer.
+	fr_time_t		when;			//!< when the current batch was read.
+
+	struct sockaddr_storage	local;			//!< the address the socket is bound to.
+	socklen_t		local_len;		//!< length of the local address.
+
+	struct mmsghdr		*msgvec;		//!< one entry per packet.
+	struct iovec		*iov;			//!< one entry per packet.
+	struct sockaddr_storage	*src;			//!< source address of each packet.
+	uint8_t			*cbuf;			//!< control messages for each packet.
+	uint8_t			*data;			//!< packet buffers.
+};
+
+/** Allocate a cache of packets which are read from a socket in batches
+ *
+ * The socket must be unconnected, bound, and have had udpfromto_init()
+ * called on it.  The local address is looked up once here, instead of once
+ * per packet as is done by recvfromto().
+ *
+ * @param[in] ctx		to allocate the batch in.
+ * @param[in] sockfd		we're reading from.
+ * @param[in] num		maximum number of packets to read with one system call.
+ * @param[in] max_packet_size	the largest packet we accept.  Anything larger is truncated.
+ * @return
+ *	- A new batch on success.
+ *	- NULL on failure.
+ */
+udp_batch_t *udp_batch_alloc(TALLOC_CTX *ctx, int sockfd, unsigned int num, size_t max_packet_size)
+{
+	udp_batch_t	*batch;
+	unsigned int	i;
+
+	if (!num || !max_packet_size) {
+		fr_strerror_const("Invalid arguments");
+		return NULL;
+	}
+
+	batch = talloc_zero(ctx, udp_batch_t);
+	if (!batch) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	batch->sockfd = sockfd;
+	batch->num = num;
+	batch->max_packet_size = max_packet_size;
+	batch->drained = true;
+
+	batch->local_len = sizeof(batch->local);
+	if (getsockname(sockfd, (struct sockaddr *) &batch->local, &batch->local_len) < 0) {
+		fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+	error:
+		talloc_free(batch);
+		return NULL;
+	}
+
+	if ((batch->local.ss_family != AF_INET) && (batch->local.ss_family != AF_INET6)) {
+		fr_strerror_printf("Unsupported address family %u", batch->local.ss_family);
+		goto error;
+	}
+
+	batch->msgvec = talloc_zero_array(batch, struct mmsghdr, num);
+	batch->iov = talloc_zero_array(batch, struct iovec, num);
+	batch->src = talloc_zero_array(batch, struct sockaddr_storage, num);
+	batch->cbuf = talloc_zero_array(batch, uint8_t, num * UDP_BATCH_CBUF_SIZE);
+	batch->data = talloc_array(batch, uint8_t, num * max_packet_size);
+	if (!batch->msgvec || !batch->iov || !batch->src || !batch->cbuf || !batch->data) {
+		talloc_free(batch);
+		goto oom;
+	}
+
+	for (i = 0; i < num; i++) {
+		batch->iov[i].iov_base = batch->data + (i * max_packet_size);
+		batch->iov[i].iov_len = max_packet_size;
+	}
+
+	return batch;
+}
+
+/** Read one UDP packet, using a cache of packets which were read in a batch
+ *
+ * When the cache is empty, up to batch->num packets are read from the socket
+ * with a single call to recvmmsg().  The packets are then returned one at a
+ * time on subsequent calls.
+ *
+ * After the last packet of a batch has been returned, the next call returns
+ * 0 with errno set to EWOULDBLOCK, exactly as if the socket had no more data.
+ * That lets the caller go service other sockets before the next batch is read.
+ *
+ * @param[in] batch		we're reading from.
+ * @param[out] socket_out	Information about the src/dst address of the packet
+ *				and the interface it was received on.
+ * @param[out] data		pointer where data will be written
+ * @param[in] data_len		length of data to read
+ * @param[out] when		the packet was received.
+ * @return
+ *	- > 0 on success (number of bytes read).
+ *	- 0 for "no data".
+ *	- < 0 on failure.
+ */
+ssize_t udp_batch_recv(udp_batch_t *batch,
+		       fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when)
+{
+	struct msghdr		*msgh;
+	struct sockaddr_storage	dst;
+	socklen_t		sizeof_dst;
+	size_t			packet_len;
+	int			ret;
+
+	if (when) *when = 0;
+
+	*socket_out = (fr_socket_t){
+		.fd = batch->sockfd,
+		.proto = IPPROTO_UDP
+	};
+
+	if (batch->next >= batch->received) {
+		unsigned int i;
+
+		/*
+		 *	Tell the caller that we've run out of cached
+		 *	packets.  The next call will read more.
+		 */
+		if (!batch->drained) {
+			batch->drained = true;
+			errno = EWOULDBLOCK;
+			return 0;
+		}
+
+		for (i = 0; i < batch->num; i++) {
+			batch->msgvec[i] = (struct mmsghdr) {
+				.msg_hdr = {
+					.msg_name = &batch->src[i],
+					.msg_namelen = sizeof(batch->src[i]),
+					.msg_iov = &batch->iov[i],
+					.msg_iovlen = 1,
+					.msg_control = batch->cbuf + (i * UDP_BATCH_CBUF_SIZE),
+					.msg_controllen = UDP_BATCH_CBUF_SIZE,
+				}
+			};
+		}
+
+		batch->next = batch->received = 0;
+
+		ret = recvmmsg(batch->sockfd, batch->msgvec, batch->num, MSG_DONTWAIT, NULL);
+		if (ret < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
+			fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+			return ret;
+		}
+		if (ret == 0) return 0;
+
+		batch->received = ret;
+		batch->drained = false;
+		batch->when = fr_time();
+	}
+
+	msgh = &batch->msgvec[batch->next].msg_hdr;
+	packet_len = batch->msgvec[batch->next].msg_len;
+
+	/*
+	 *	The destination address starts off as the address
+	 *	the socket is bound to.  It may be INADDR_ANY, with a
+	 *	more specific address given in the control messages.
+	 */
+	memcpy(&dst, &batch->local, batch->local_len);
+	sizeof_dst = batch->local_len;
+
+	udpfromto_cmsg_parse(msgh, &socket_out->inet.ifindex,
+			     (struct sockaddr *) &dst, &sizeof_dst, when);
+
+	if (fr_ipaddr_from_sockaddr(&socket_out->inet.src_ipaddr, &socket_out->inet.src_port,
+				    (struct sockaddr_storage *) msgh->msg_name, msgh->msg_namelen) < 0) {
+		batch->next++;
+		fr_strerror_const_push("Failed converting src sockaddr to ipaddr");
+		return -1;
+	}
+	if (fr_ipaddr_from_sockaddr(&socket_out->inet.dst_ipaddr, &socket_out->inet.dst_port,
+				    &dst, sizeof_dst) < 0) {
+		batch->next++;
+		fr_strerror_const_push("Failed converting dst sockaddr to ipaddr");
+		return -1;
+	}
+
+	/*
+	 *	The OS discards any data in the packet after
+	 *	"max_packet_size" bytes.  We do the same for the
+	 *	caller's buffer.
+	 */
+	if (packet_len > data_len) packet_len = data_len;
+	memcpy(data, msgh->msg_iov->iov_base, packet_len);
+
+	batch->next++;
+
+	if (when && !*when) *when = batch->when;
+
+	return packet_len;
+}
+
+struct udp_send_batch_s {
+	int			sockfd;			//!< we're writing to.
+
+	unsigned int		num;			//!< maximum number of packets to write at once.
+	unsigned int		queued;			//!< number of packets waiting to be written.
+	bool			no_src;			//!< don't set the source address of packets.
+
+	size_t			max_packet_size;	//!< size of each packet buffer.
+
+	struct mmsghdr		*msgvec;		//!< one entry per packet.
+	struct iovec		*iov;			//!< one entry per packet.
+	struct sockaddr_storage	*dst;			//!< destination address of each packet.
+	uint8_t			*cbuf;			//!< control messages for each packet.
+	uint8_t			*data;			//!< packet buffers.
+};
+
+/** Allocate a queue of packets which are written to a socket in batches
+ *
+ * @param[in] ctx		to allocate the batch in.
+ * @param[in] sockfd		we're writing to.  Must be unconnected.
+ * @param[in] num		maximum number of packets to write with one system call.
+ * @param[in] max_packet_size	the largest packet we send.
+ * @return
+ *	- A new batch on success.
+ *	- NULL on failure.
+ */
+udp_send_batch_t *udp_send_batch_alloc(TALLOC_CTX *ctx, int sockfd, unsigned int num, size_t max_packet_size)
+{
+	udp_send_batch_t	*batch;
+	unsigned int		i;
+
+	if (!num || !max_packet_size) {
+		fr_strerror_const("Invalid arguments");
+		return NULL;
+	}
+
+	batch = talloc_zero(ctx, udp_send_batch_t);
+	if (!batch) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	batch->sockfd = sockfd;
+	batch->num = num;
+	batch->max_packet_size = max_packet_size;
+
+#ifdef __FreeBSD__
+	/*
+	 *	See sendfromto().  The socket won't be re-bound, so
+	 *	we only need to check this once.
+	 */
+	{
+		struct sockaddr_storage	bound;
+		socklen_t		bound_len = sizeof(bound);
+
+		if (getsockname(sockfd, (struct sockaddr *) &bound, &bound_len) < 0) {
+			fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+			talloc_free(batch);
+			return NULL;
+		}
+
+		switch (bound.ss_family) {
+		case AF_INET:
+			if (((struct sockaddr_in *) &bound)->sin_addr.s_addr != INADDR_ANY) batch->no_src = true;
+			break;
+
+		case AF_INET6:
+			if (!IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *) &bound)->sin6_addr)) batch->no_src = true;
+			break;
+		}
+	}
+#endif
+
+	batch->msgvec = talloc_zero_array(batch, struct mmsghdr, num);
+	batch->iov = talloc_zero_array(batch, struct iovec, num);
+	batch->dst = talloc_zero_array(batch, struct sockaddr_storage, num);
+	batch->cbuf = talloc_zero_array(batch, uint8_t, num * UDP_BATCH_CBUF_SIZE);
+	batch->data = talloc_array(batch, uint8_t, num * max_packet_size);
+	if (!batch->msgvec || !batch->iov || !batch->dst || !batch->cbuf || !batch->data) {
+		talloc_free(batch);
+		goto oom;
+	}
+
+	for (i = 0; i < num; i++) {
+		batch->iov[i].iov_base = batch->data + (i * max_packet_size);
+	}
+
+	return batch;
+}
+
+/** Queue a UDP packet to be written by udp_send_batch_flush()
+ *
+ * The packet data is copied, so the caller can free or re-use its buffer
+ * as soon as this function returns.  If the queue is full, the queued
+ * packets are written first.
+ *
+ * @param[in] batch		to add the packet to.
+ * @param[in] socket		the src/dst address of the packet, and the interface
+ *				to send it on.
+ * @param[in] data		to send.
+ * @param[in] data_len		length of data to send.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int udp_send_batch_add(udp_send_batch_t *batch, fr_socket_t const *socket, void const *data, size_t data_len)
+{
+	struct sockaddr_storage	src;
+	socklen_t		sizeof_src, sizeof_dst;
+	struct msghdr		*msgh;
+	unsigned int		i;
+
+	if (unlikely(socket->proto != IPPROTO_UDP)) {
+		fr_strerror_printf("Invalid proto type %u", socket->proto);
+		return -1;
+	}
+
+	if (unlikely(data_len > batch->max_packet_size)) {
+		fr_strerror_printf("Packet too large (%zu > %zu)", data_len, batch->max_packet_size);
+		return -1;
+	}
+
+	if ((batch->queued == batch->num) && (udp_send_batch_flush(batch) < 0)) return -1;
+
+	i = batch->queued;
+
+	if (fr_ipaddr_to_sockaddr(&batch->dst[i], &sizeof_dst,
+				  &socket->inet.dst_ipaddr, socket->inet.dst_port) < 0) return -1;
+	if (fr_ipaddr_to_sockaddr(&src, &sizeof_src,
+				  &socket->inet.src_ipaddr, socket->inet.src_port) < 0) return -1;
+
+	memcpy(batch->iov[i].iov_base, data, data_len);
+	batch->iov[i].iov_len = data_len;
+
+	batch->msgvec[i] = (struct mmsghdr) {
+		.msg_hdr = {
+			.msg_name = &batch->dst[i],
+			.msg_namelen = sizeof_dst,
+			.msg_iov = &batch->iov[i],
+			.msg_iovlen = 1,
+		}
+	};
+	msgh = &batch->msgvec[i].msg_hdr;
+
+	if (!batch->no_src) (void) udpfromto_cmsg_set(msgh, batch->cbuf + (i * UDP_BATCH_CBUF_SIZE),
+						      UDP_BATCH_CBUF_SIZE, socket->inet.ifindex,
+						      (struct sockaddr *) &src);
+
+	batch->queued++;
+
+	return 0;
+}
+
+/** Write all queued packets with sendmmsg()
+ *
+ * UDP is unreliable, so if the socket can't take all of the packets,
+ * the remaining ones are discarded.  A packet which fails for any
+ * other reason (e.g. an unreachable destination) is logged and
+ * skipped, and the rest of the batch is still sent.
+ *
+ * @param[in] batch		to write.
+ * @return
+ *	- >= 0 the number of packets which were processed.
+ *	- -1 if the socket is full.  The queue is empty after this call.
+ */
+int udp_send_batch_flush(udp_send_batch_t *batch)
+{
+	unsigned int	sent = 0;
+	int		ret;
+
+	while (sent < batch->queued) {
+		ret = sendmmsg(batch->sockfd, batch->msgvec + sent, batch->queued - sent, 0);
+		if (ret < 0) {
+			switch (errno) {
+			case EINTR:
+				continue;
+
+			case EAGAIN:
+#if defined(EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
+			case EWOULDBLOCK:
+#endif
+			case ENOBUFS:
+				fr_strerror_printf("udp_send_batch_flush failed, discarding %u packet(s): %s",
+						   batch->queued - sent, fr_syserror(errno));
+				batch->queued = 0;
+				return -1;
+
+			default:
+				break;
+			}
+
+			/*
+			 *	The error is specific to the first
+			 *	packet, so skip it and send the rest.
+			 *	Returning -1 here would get a healthy
+			 *	socket closed by the caller.
+			 */
+			fr_log(&default_log, L_ERR, __FILE__, __LINE__,
+			       "udp_send_batch_flush failed, discarding packet %u of %u: %s",
+			       sent + 1, batch->queued, fr_syserror(errno));
+			sent++;
+			continue;
+		}
+		if (ret == 0) break;
+
+		/*
+		 *	sendmmsg() returns an error only if the first
+		 *	packet couldn't be sent.  Go back and find out
+		 *	what happened to the remaining ones.
+		 */
+		sent += ret;
+	}
+
+	batch->queued = 0;
+
+	return sent;
+}
@@ -162,6 +162,81 @@ int udpfromto_init(int s)
 	return setsockopt(s, proto, flag, &opt, sizeof(opt));
 }
 
+/** Extract the destination address, interface and timestamp from a received message
+ *
+ * Used by recvfromto(), and by callers which receive many packets at once
+ * with recvmmsg().
+ *
+ * @param[in] msgh	as filled in by recvmsg() or recvmmsg().
+ * @param[out] ifindex	The interface the packet was received on (may be NULL).
+ * @param[in,out] to	Pre-populated with the address the socket is bound to.
+ *			The destination address is written here.
+ * @param[out] to_len	Length of the destination address.
+ * @param[out] when	the packet was received (may be NULL).  Set to 0 if there
+ *			was no SO_TIMESTAMP control message.
+ */
+void udpfromto_cmsg_parse(struct msghdr *msgh, int *ifindex,
+			  struct sockaddr *to, socklen_t *to_len, fr_time_t *when)
+{
+	struct cmsghdr		*cmsg;
+
+	if (ifindex) *ifindex = 0;
+	if (when) *when = 0;
+
+	/* Process auxiliary received data in msgh */
+	for (cmsg = CMSG_FIRSTHDR(msgh);
+	     cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+
+#ifdef IP_PKTINFO
+		if ((cmsg->cmsg_level == SOL_IP) &&
+		    (cmsg->cmsg_type == IP_PKTINFO)) {
+			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
+			*to_len = sizeof(struct sockaddr_in);
+
+			if (ifindex) *ifindex = i->ipi_ifindex;
+
+			break;
+		}
+#endif
+
+#ifdef IP_RECVDSTADDR
+		if ((cmsg->cmsg_level == IPPROTO_IP) &&
+		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
+			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in *)to)->sin_addr = *i;
+
+			*to_len = sizeof(struct sockaddr_in);
+
+			break;
+		}
+#endif
+
+#ifdef IPV6_PKTINFO
+		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
+		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
+			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
+			*to_len = sizeof(struct sockaddr_in6);
+
+			if (ifindex) *ifindex = i->ipi6_ifindex;
+
+			break;
+		}
+#endif
+
+#ifdef SO_TIMESTAMP
+		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
+			*when = fr_time_from_timeval((struct timeval *)CMSG_DATA(cmsg));
+		}
+#endif
+	}
+}
+
 /** Read a packet from a file descriptor, retrieving additional header information
  *
  * Abstracts away the complexity of using the complexity of using recvmsg().
@@ -196,7 +271,6 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 	       fr_time_t *when)
 {
 	struct msghdr		msgh;
-	struct cmsghdr		*cmsg;
 	struct iovec		iov;
 	char			cbuf[256];
 	int			ret;
@@ -299,65 +373,111 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 
 	if (from_len) *from_len = msgh.msg_namelen;
 
-	if (ifindex) *ifindex = 0;
-	if (when) *when = 0;
+	udpfromto_cmsg_parse(&msgh, ifindex, to, to_len, when);
 
-	/* Process auxiliary received data in msgh */
-	for (cmsg = CMSG_FIRSTHDR(&msgh);
-	     cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
+	if (when && !*when) *when = fr_time();
 
-#ifdef IP_PKTINFO
-		if ((cmsg->cmsg_level == SOL_IP) &&
-		    (cmsg->cmsg_type == IP_PKTINFO)) {
-			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
+	return ret;
+}
 
-			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
-			*to_len = sizeof(struct sockaddr_in);
+/** Add the source address and outbound interface to a message which is about to be sent
+ *
+ * Used by sendfromto(), and by callers which send many packets at once
+ * with sendmmsg().
+ *
+ * @param[in,out] msgh	to add the control message to.
+ * @param[in] cbuf	where the control message is written.
+ * @param[in] cbuf_len	length of cbuf.  Must be at least 256 bytes.
+ * @param[in] ifindex	The interface on which to send the datagram.
+ *			If automatic interface selection is desired, value should be 0.
+ * @param[in] from	The source address.
+ * @return
+ *	- true if a control message was added.
+ *	- false if the source address can't be set on this platform, in which
+ *	  case the caller should send the packet without one.
+ */
+bool udpfromto_cmsg_set(struct msghdr *msgh, void *cbuf, size_t cbuf_len, int ifindex, struct sockaddr *from)
+{
+	/*
+	 *	If the sendmsg() flags aren't defined, fall back to
+	 *	using sendto().  These flags are defined on FreeBSD,
+	 *	but laying it out this way simplifies the look of the
+	 *	code.
+	 */
+#  if !defined(IP_PKTINFO) && !defined(IP_SENDSRCADDR)
+	if (from->sa_family == AF_INET) return false;
+#  endif
 
-			if (ifindex) *ifindex = i->ipi_ifindex;
+#  if !defined(IPV6_PKTINFO)
+	if (from->sa_family == AF_INET6) return false;
+#  endif
 
-			break;
-		}
-#endif
+	if ((from->sa_family != AF_INET) && (from->sa_family != AF_INET6)) return false;
 
-#ifdef IP_RECVDSTADDR
-		if ((cmsg->cmsg_level == IPPROTO_IP) &&
-		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
-			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+	memset(cbuf, 0, cbuf_len);
 
-			((struct sockaddr_in *)to)->sin_addr = *i;
+# if defined(IP_PKTINFO) || defined(IP_SENDSRCADDR)
+	if (from->sa_family == AF_INET) {
+		struct sockaddr_in *s4 = (struct sockaddr_in *) from;
 
-			*to_len = sizeof(struct sockaddr_in);
+#  ifdef IP_PKTINFO
+		struct cmsghdr *cmsg;
+		struct in_pktinfo *pkt;
 
-			break;
-		}
-#endif
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
 
-#ifdef IPV6_PKTINFO
-		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
-		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
-			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = SOL_IP;
+		cmsg->cmsg_type = IP_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
 
-			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
-			*to_len = sizeof(struct sockaddr_in6);
+		pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+		memset(pkt, 0, sizeof(*pkt));
+		pkt->ipi_spec_dst = s4->sin_addr;
+		pkt->ipi_ifindex = ifindex;
 
-			if (ifindex) *ifindex = i->ipi6_ifindex;
+#  elif defined(IP_SENDSRCADDR)
+		struct cmsghdr *cmsg;
+		struct in_addr *in;
 
-			break;
-		}
-#endif
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*in));
 
-#ifdef SO_TIMESTAMP
-		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
-			*when = fr_time_from_timeval((struct timeval *)CMSG_DATA(cmsg));
-		}
-#endif
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = IPPROTO_IP;
+		cmsg->cmsg_type = IP_SENDSRCADDR;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
+
+		in = (struct in_addr *) CMSG_DATA(cmsg);
+		*in = s4->sin_addr;
+#  endif
 	}
+#endif
 
-	if (when && !*when) *when = fr_time();
+#  if defined(IPV6_PKTINFO)
+	if (from->sa_family == AF_INET6) {
+		struct sockaddr_in6 *s6 = (struct sockaddr_in6 *) from;
 
-	return ret;
+		struct cmsghdr *cmsg;
+		struct in6_pktinfo *pkt;
+
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
+
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = IPPROTO_IPV6;
+		cmsg->cmsg_type = IPV6_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
+
+		pkt = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+		memset(pkt, 0, sizeof(*pkt));
+		pkt->ipi6_addr = s6->sin6_addr;
+		pkt->ipi6_ifindex = ifindex;
+	}
+#  endif	/* IPV6_PKTINFO */
+
+	return true;
 }
 
 /** Send packet via a file descriptor, setting the src address and outbound interface
@@ -424,27 +544,12 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 	}
 #endif	/* !__FreeBSD__ */
 
-	/*
-	 *	If the sendmsg() flags aren't defined, fall back to
-	 *	using sendto().  These flags are defined on FreeBSD,
-	 *	but laying it out this way simplifies the look of the
-	 *	code.
-	 */
-#  if !defined(IP_PKTINFO) && !defined(IP_SENDSRCADDR)
-	if (from && from->sa_family == AF_INET) from = NULL;
-#  endif
-
-#  if !defined(IPV6_PKTINFO)
-	if (from && from->sa_family == AF_INET6) from = NULL;
-#  endif
-
 	/*
 	 *	No "from", just use regular sendto.
 	 */
 	if (!from || (from_len == 0)) return sendto(fd, buf, len, flags, to, to_len);
 
-	/* Set up control buffer iov and msgh structures. */
-	memset(&cbuf, 0, sizeof(cbuf));
+	/* Set up iov and msgh structures. */
 	memset(&msgh, 0, sizeof(msgh));
 	memset(&iov, 0, sizeof(iov));
 	iov.iov_base = buf;
@@ -455,66 +560,11 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 	msgh.msg_name = to;
 	msgh.msg_namelen = to_len;
 
-# if defined(IP_PKTINFO) || defined(IP_SENDSRCADDR)
-	if (from->sa_family == AF_INET) {
-		struct sockaddr_in *s4 = (struct sockaddr_in *) from;
-
-#  ifdef IP_PKTINFO
-		struct cmsghdr *cmsg;
-		struct in_pktinfo *pkt;
-
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
-
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = SOL_IP;
-		cmsg->cmsg_type = IP_PKTINFO;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
-
-		pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
-		memset(pkt, 0, sizeof(*pkt));
-		pkt->ipi_spec_dst = s4->sin_addr;
-		pkt->ipi_ifindex = ifindex;
-
-#  elif defined(IP_SENDSRCADDR)
-		struct cmsghdr *cmsg;
-		struct in_addr *in;
-
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*in));
-
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = IPPROTO_IP;
-		cmsg->cmsg_type = IP_SENDSRCADDR;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
-
-		in = (struct in_addr *) CMSG_DATA(cmsg);
-		*in = s4->sin_addr;
-#  endif
-	}
-#endif
-
-#  if defined(IPV6_PKTINFO)
-	if (from->sa_family == AF_INET6) {
-		struct sockaddr_in6 *s6 = (struct sockaddr_in6 *) from;
-
-		struct cmsghdr *cmsg;
-		struct in6_pktinfo *pkt;
-
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
-
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = IPPROTO_IPV6;
-		cmsg->cmsg_type = IPV6_PKTINFO;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
-
-		pkt = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-		memset(pkt, 0, sizeof(*pkt));
-		pkt->ipi6_addr = s6->sin6_addr;
-		pkt->ipi6_ifindex = ifindex;
-	}
-#  endif	/* IPV6_PKTINFO */
+	/*
+	 *	If we can't set the source address, just use regular
+	 *	sendto.
+	 */
+	if (!udpfromto_cmsg_set(&msgh, cbuf, sizeof(cbuf), ifindex, from)) return sendto(fd, buf, len, flags, to, to_len);
 
 	return sendmsg(fd, &msgh, flags);
 }
@@ -34,11 +34,18 @@ extern "C" {
 #include <freeradius-devel/util/time.h>
 
 #include <netinet/in.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 
 int	udpfromto_init(int s);
 
+void	udpfromto_cmsg_parse(struct msghdr *msgh, int *ifindex,
+			     struct sockaddr *to, socklen_t *to_len, fr_time_t *when);
+
+bool	udpfromto_cmsg_set(struct msghdr *msgh, void *cbuf, size_t cbuf_len, int ifindex, struct sockaddr *from);
+
 int	recvfromto(int s, void *buf, size_t len, int flags,
 		   int *ifindex,
 	       	   struct sockaddr *from, socklen_t *fromlen,
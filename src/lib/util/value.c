@@ -4234,6 +4234,106 @@ void fr_value_box_increment(fr_value_box_t *vb)
 	}
 }
 
+/** Parse a plain decimal integer directly into a fr_value_box_t
+ *
+ * Most integer values we see (SQL results, casts in conditions and maps)
+ * are short decimal strings.  These can be converted without copying
+ * them to a temporary buffer, and without going through strtoull and errno.
+ *
+ * Anything else (hex, whitespace, signs other than a leading '-', too many
+ * digits, or values which are out of range) is left for
+ * #fr_value_box_from_integer_str, which also produces the error messages.
+ *
+ * @param[out] dst		where to write parsed value.
+ * @param[in] dst_type		type of integer to convert string to.
+ * @param[in] in		String to convert to integer.
+ * @param[in] inlen		Length of the string.
+ * @return
+ *	- true if the value was parsed.
+ *	- false if the caller should use the generic parser.
+ */
+static inline bool fr_value_box_from_decimal_str(fr_value_box_t *dst, fr_type_t dst_type,
+						 char const *in, size_t inlen)
+{
+	char const	*p = in, *end = in + inlen;
+	bool		negative = false;
+	uint64_t	uinteger = 0;
+	int64_t		sinteger = 0;
+
+	if ((p < end) && (*p == '-')) {
+		if (fr_value_box_integer_min[dst_type] == 0) return false;
+		negative = true;
+		p++;
+	}
+
+	/*
+	 *	19 digits always fit in a uint64_t, so there's no
+	 *	need to check for overflow as we go.
+	 */
+	if ((p == end) || ((end - p) > 19)) return false;
+
+	while (p < end) {
+		if ((*p < '0') || (*p > '9')) return false;
+		uinteger = (uinteger * 10) + (*p++ - '0');
+	}
+
+	if (fr_value_box_integer_min[dst_type] == 0) {
+		if (uinteger > fr_value_box_integer_max[dst_type]) return false;
+	} else {
+		if (uinteger > ((uint64_t)INT64_MAX + negative)) return false;
+
+		if (!negative) {
+			sinteger = (int64_t)uinteger;
+		} else if (uinteger == ((uint64_t)INT64_MAX + 1)) {
+			sinteger = INT64_MIN;
+		} else {
+			sinteger = -(int64_t)uinteger;
+		}
+
+		if ((sinteger < fr_value_box_integer_min[dst_type]) ||
+		    (sinteger > (int64_t)fr_value_box_integer_max[dst_type])) return false;
+	}
+
+	switch (dst_type) {
+	case FR_TYPE_UINT8:
+		dst->vb_uint8 = (uint8_t)uinteger;
+		break;
+
+	case FR_TYPE_UINT16:
+		dst->vb_uint16 = (uint16_t)uinteger;
+		break;
+
+	case FR_TYPE_UINT32:
+		dst->vb_uint32 = (uint32_t)uinteger;
+		break;
+
+	case FR_TYPE_UINT64:
+		dst->vb_uint64 = uinteger;
+		break;
+
+	case FR_TYPE_INT8:
+		dst->vb_int8 = (int8_t)sinteger;
+		break;
+
+	case FR_TYPE_INT16:
+		dst->vb_int16 = (int16_t)sinteger;
+		break;
+
+	case FR_TYPE_INT32:
+		dst->vb_int32 = (int32_t)sinteger;
+		break;
+
+	case FR_TYPE_INT64:
+		dst->vb_int64 = sinteger;
+		break;
+
+	default:
+		return false;
+	}
+
+	return true;
+}
+
 /** Convert integer encoded as string to a fr_value_box_t type
  *
  * @param[out] dst		where to write parsed value.
@@ -4535,6 +4635,21 @@ parse:
 		if (fr_inet_pton6(&dst->vb_ip, in, inlen, fr_hostname_lookups, false, true) < 0) return -1;
 		goto finish;
 
+	/*
+	 *	Plain decimal integers don't need copying
+	 *	to the temporary buffer below.
+	 */
+	case FR_TYPE_UINT8:
+	case FR_TYPE_UINT16:
+	case FR_TYPE_UINT32:
+	case FR_TYPE_UINT64:
+	case FR_TYPE_INT8:
+	case FR_TYPE_INT16:
+	case FR_TYPE_INT32:
+	case FR_TYPE_INT64:
+		if (fr_value_box_from_decimal_str(dst, dst_type, in, len)) goto finish;
+		break;
+
 	/*
 	 *	Dealt with below
 	 */
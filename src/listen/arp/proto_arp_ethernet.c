@@ -25,6 +25,9 @@
 #include <netdb.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/protocol.h>
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/net.h>
 #include <freeradius-devel/util/trie.h>
 #include <freeradius-devel/io/base.h>
@@ -33,6 +36,8 @@
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/util/debug.h>
 
+#include <pthread.h>
+
 #include "proto_arp.h"
 
 extern fr_app_io_t proto_arp_ethernet;
@@ -42,10 +47,37 @@ typedef struct {
 	fr_pcap_t			*pcap;			//!< PCAP handler
 } proto_arp_ethernet_thread_t;
 
+/** An IPv4 to MAC binding which the read path answers for
+ *
+ */
+typedef struct {
+	uint8_t				ipaddr[4];		//!< Network order, as in the packet.
+	uint8_t				mac[ETHER_ADDR_LEN];	//!< To answer with.
+	fr_time_t			expires;		//!< When a learned binding goes stale.
+								///< 0 for static bindings.
+} proto_arp_ethernet_binding_t;
+
+/** Bindings for the fast path
+ *
+ * Shared by the network thread reading the interface, and radmin.
+ */
+typedef struct {
+	pthread_mutex_t			mutex;
+	fr_hash_table_t			*ht;			//!< proto_arp_ethernet_binding_t by ipaddr.
+} proto_arp_ethernet_bindings_t;
+
 typedef struct {
 	CONF_SECTION			*cs;			//!< our configuration
 	char const			*interface;		//!< Interface to bind to.
 	char const			*filter;		//!< Additional PCAP filter
+
+	bool				fast_path;		//!< Answer requests from the bindings table.
+	char const			*bindings_file;		//!< Static bindings to load.
+	bool				learn;			//!< Add bindings from the packets we see.
+	fr_time_delta_t			learn_lifetime;		//!< How long learned bindings are used for.
+	uint32_t			max_bindings;		//!< Maximum size of the table.
+
+	proto_arp_ethernet_bindings_t	*bindings;		//!< NULL if there's no fast path.
 } proto_arp_ethernet_t;
 
 
@@ -58,11 +90,218 @@ static CONF_PARSER const arp_listen_config[] = {
 
 	{ FR_CONF_OFFSET("filter", FR_TYPE_STRING, proto_arp_ethernet_t, filter) },
 
+	{ FR_CONF_OFFSET("fast_path", FR_TYPE_BOOL, proto_arp_ethernet_t, fast_path), .dflt = "no" },
+	{ FR_CONF_OFFSET("bindings", FR_TYPE_FILE_INPUT, proto_arp_ethernet_t, bindings_file) },
+	{ FR_CONF_OFFSET("learn", FR_TYPE_BOOL, proto_arp_ethernet_t, learn), .dflt = "no" },
+	{ FR_CONF_OFFSET("learn_lifetime", FR_TYPE_TIME_DELTA, proto_arp_ethernet_t, learn_lifetime), .dflt = "300" },
+	{ FR_CONF_OFFSET("max_bindings", FR_TYPE_UINT32, proto_arp_ethernet_t, max_bindings), .dflt = "65536" },
+
 	CONF_PARSER_TERMINATOR
 };
 
+static uint32_t binding_hash(void const *data)
+{
+	proto_arp_ethernet_binding_t const *binding = data;
+
+	return fr_hash(binding->ipaddr, sizeof(binding->ipaddr));
+}
+
+static int8_t binding_cmp(void const *one, void const *two)
+{
+	proto_arp_ethernet_binding_t const *a = one, *b = two;
+	int ret;
+
+	ret = memcmp(a->ipaddr, b->ipaddr, sizeof(a->ipaddr));
+	return CMP(ret, 0);
+}
+
+static void binding_free(void *data)
+{
+	talloc_free(data);
+}
+
+/** Add or replace a binding
+ *
+ * Must be called with the mutex held.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the table is full.
+ */
+static int binding_set(proto_arp_ethernet_t const *inst, uint8_t const ipaddr[static 4],
+		       uint8_t const mac[static ETHER_ADDR_LEN], fr_time_t expires)
+{
+	proto_arp_ethernet_bindings_t	*bindings = inst->bindings;
+	proto_arp_ethernet_binding_t	find, *binding;
+
+	memcpy(find.ipaddr, ipaddr, sizeof(find.ipaddr));
+	binding = fr_hash_table_find(bindings->ht, &find);
+	if (binding) {
+		memcpy(binding->mac, mac, sizeof(binding->mac));
+		binding->expires = expires;
+		return 0;
+	}
+
+	if (fr_hash_table_num_elements(bindings->ht) >= inst->max_bindings) {
+		fr_strerror_printf("Too many ARP bindings (%u)", inst->max_bindings);
+		return -1;
+	}
+
+	MEM(binding = talloc(bindings->ht, proto_arp_ethernet_binding_t));
+	memcpy(binding->ipaddr, ipaddr, sizeof(binding->ipaddr));
+	memcpy(binding->mac, mac, sizeof(binding->mac));
+	binding->expires = expires;
+
+	if (!fr_hash_table_insert(bindings->ht, binding)) {
+		talloc_free(binding);
+		fr_strerror_const("Failed inserting ARP binding");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Learn the sender's binding from a packet
+ *
+ * Must be called with the mutex held.  Static bindings are never
+ * replaced by learned ones.
+ */
+static void binding_learn(proto_arp_ethernet_t const *inst, fr_arp_packet_t const *arp, fr_time_t now)
+{
+	proto_arp_ethernet_binding_t	find, *binding;
+	static uint8_t const		zero[4] = { 0 };
+
+	/*
+	 *	Probes have no sender address, and
+	 *	multicast MACs aren't hosts.
+	 */
+	if ((memcmp(arp->spa, zero, sizeof(zero)) == 0) || (arp->sha[0] & 0x01)) return;
+
+	memcpy(find.ipaddr, arp->spa, sizeof(find.ipaddr));
+	binding = fr_hash_table_find(inst->bindings->ht, &find);
+	if (binding && !binding->expires) return;
+
+	(void) binding_set(inst, arp->spa, arp->sha, now + inst->learn_lifetime);
+}
+
+/** Send an ARP packet out of the interface
+ *
+ * The ethernet destination is the target hardware address in the packet.
+ */
+static int arp_ethernet_send(proto_arp_ethernet_thread_t *thread, uint8_t const *buffer, size_t buffer_len)
+{
+	int			ret;
+	uint8_t			arp_packet[64] = { 0 };
+	ethernet_header_t	*eth_hdr;
+	fr_arp_packet_t		*arp;
+	/* Pointer to the current position in the frame */
+	uint8_t			*end = arp_packet;
+
+	/* fill in Ethernet layer (L2) */
+	eth_hdr = (ethernet_header_t *)arp_packet;
+	eth_hdr->ether_type = htons(ETH_TYPE_ARP);
+	end += ETHER_ADDR_LEN + ETHER_ADDR_LEN + sizeof(eth_hdr->ether_type);
+
+	/*
+	 *	Just copy what FreeRADIUS has encoded for us.
+	 */
+	arp = (fr_arp_packet_t *) end;
+	memcpy(arp, buffer, buffer_len);
+
+	/*
+	 *	Set our MAC address as the ethernet source.
+	 *
+	 *	Set the destination MAC as the target address from
+	 *	ARP.
+	 */
+	memcpy(eth_hdr->src_addr, thread->pcap->ether_addr, ETHER_ADDR_LEN);
+	memcpy(eth_hdr->dst_addr, arp->tha, ETHER_ADDR_LEN);
+
+	ret = pcap_inject(thread->pcap->handle, arp_packet, (end - arp_packet + buffer_len));
+	if (ret < 0) {
+		fr_strerror_printf("Error sending packet with pcap: %d, %s", ret, pcap_geterr(thread->pcap->handle));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Answer an ARP request from the bindings table, without creating a request
+ *
+ * @return
+ *	- true if the packet was dealt with.
+ *	- false if it should be passed to the virtual server.
+ */
+static bool mod_read_fast_path(fr_listen_t *li, proto_arp_ethernet_t const *inst,
+			       proto_arp_ethernet_thread_t *thread, uint8_t const *data)
+{
+	proto_arp_t const		*app = talloc_get_type_abort_const(li->app_instance, proto_arp_t);
+	proto_arp_ethernet_bindings_t	*bindings = inst->bindings;
+	fr_arp_packet_t const		*arp = (fr_arp_packet_t const *) data;
+	fr_arp_packet_t			reply;
+	proto_arp_ethernet_binding_t	find, *binding;
+	fr_time_t			now;
+	bool				found = false;
+
+	/*
+	 *	Only ethernet and IPv4.
+	 */
+	if ((arp->htype[0] != 0) || (arp->htype[1] != 1) ||
+	    (arp->ptype[0] != 0x08) || (arp->ptype[1] != 0x00) ||
+	    (arp->hlen != ETHER_ADDR_LEN) || (arp->plen != 4)) return false;
+
+	now = fr_time();
+	memcpy(find.ipaddr, arp->tpa, sizeof(find.ipaddr));
+
+	pthread_mutex_lock(&bindings->mutex);
+	if (inst->learn) binding_learn(inst, arp, now);
+
+	if (app->active && (arp->op[0] == 0) && (arp->op[1] == FR_ARP_REQUEST)) {
+		binding = fr_hash_table_find(bindings->ht, &find);
+		if (binding && binding->expires && (binding->expires <= now)) {
+			fr_hash_table_delete(bindings->ht, binding);
+			binding = NULL;
+		}
+
+		/*
+		 *	Don't answer gratuitous ARPs, or hosts
+		 *	checking their own address.
+		 */
+		if (binding && (memcmp(arp->spa, arp->tpa, sizeof(arp->spa)) != 0) &&
+		    (memcmp(binding->mac, arp->sha, sizeof(binding->mac)) != 0)) {
+			memcpy(reply.sha, binding->mac, sizeof(reply.sha));
+			found = true;
+		}
+	}
+	pthread_mutex_unlock(&bindings->mutex);
+
+	if (!found) return false;
+
+	memcpy(reply.htype, arp->htype, sizeof(reply.htype));
+	memcpy(reply.ptype, arp->ptype, sizeof(reply.ptype));
+	reply.hlen = arp->hlen;
+	reply.plen = arp->plen;
+	reply.op[0] = 0;
+	reply.op[1] = FR_ARP_REPLY;
+	memcpy(reply.spa, arp->tpa, sizeof(reply.spa));
+	memcpy(reply.tha, arp->sha, sizeof(reply.tha));
+	memcpy(reply.tpa, arp->spa, sizeof(reply.tpa));
+
+	/*
+	 *	If we can't send the reply, let the virtual
+	 *	server see the request instead.
+	 */
+	if (arp_ethernet_send(thread, (uint8_t const *) &reply, FR_ARP_PACKET_SIZE) < 0) {
+		PERROR("Failed sending ARP reply");
+		return false;
+	}
+
+	return true;
+}
+
 static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len, size_t *leftover, UNUSED uint32_t *priority, UNUSED bool *is_dup)
 {
+	proto_arp_ethernet_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_arp_ethernet_t);
 	proto_arp_ethernet_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_arp_ethernet_thread_t);
 	int				ret;
 	uint8_t const			*data;
@@ -101,6 +340,12 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 		return 0;
 	}
 
+	/*
+	 *	Requests we have a binding for are answered
+	 *	here.  Everything else goes to the virtual server.
+	 */
+	if (inst->bindings && mod_read_fast_path(li, inst, thread, p)) return 0;
+
 	memcpy(buffer, p, FR_ARP_PACKET_SIZE);
 
 	// @todo - talloc packet_ctx which is the ethernet header, so we know what kind of VLAN, etc. to encode?
@@ -115,48 +360,17 @@ static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, UNUSED fr_tim
 {
 	proto_arp_ethernet_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_arp_ethernet_thread_t);
 
-	int			ret;
-	uint8_t			arp_packet[64] = { 0 };
-	ethernet_header_t	*eth_hdr;
-	fr_arp_packet_t		*arp;
-	/* Pointer to the current position in the frame */
-	uint8_t			*end = arp_packet;
-
 	/*
 	 *	Don't write anything.
 	 */
 	if (buffer_len == 1) return buffer_len;
 
-	/* fill in Ethernet layer (L2) */
-	eth_hdr = (ethernet_header_t *)arp_packet;
-	eth_hdr->ether_type = htons(ETH_TYPE_ARP);
-	end += ETHER_ADDR_LEN + ETHER_ADDR_LEN + sizeof(eth_hdr->ether_type);
-
-	/*
-	 *	Just copy what FreeRADIUS has encoded for us.
-	 */
-	arp = (fr_arp_packet_t *) end;
-	memcpy(arp, buffer, buffer_len);
-
-	/*
-	 *	Set our MAC address as the ethernet source.
-	 *
-	 *	Set the destination MAC as the target address from
-	 *	ARP.
-	 */
-	memcpy(eth_hdr->src_addr, thread->pcap->ether_addr, ETHER_ADDR_LEN);
-	memcpy(eth_hdr->dst_addr, arp->tha, ETHER_ADDR_LEN);
-
 	/*
 	 *	If we fail injecting the reply, just ignore it.
 	 *	Returning <0 means "close the socket", which is likely
 	 *	not what we want.
 	 */
-	ret = pcap_inject(thread->pcap->handle, arp_packet, (end - arp_packet + buffer_len));
-	if (ret < 0) {
-		fr_strerror_printf("Error sending packet with pcap: %d, %s", ret, pcap_geterr(thread->pcap->handle));
-		return 0;
-	}
+	if (arp_ethernet_send(thread, buffer, buffer_len) < 0) return 0;
 
 	/*
 	 *	@todo - mirror src/protocols/dhcpv4/pcap.c for ARP send / receive.
@@ -229,6 +443,204 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	return 0;
 }
 
+static int cmd_show_bindings(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	proto_arp_ethernet_t const	*inst = ctx;
+	proto_arp_ethernet_bindings_t	*bindings = inst->bindings;
+	proto_arp_ethernet_binding_t	*binding;
+	fr_hash_iter_t			iter;
+	fr_time_t			now = fr_time();
+
+	pthread_mutex_lock(&bindings->mutex);
+	for (binding = fr_hash_table_iter_init(bindings->ht, &iter);
+	     binding;
+	     binding = fr_hash_table_iter_next(bindings->ht, &iter)) {
+		if (binding->expires && (binding->expires <= now)) continue;
+
+		fprintf(fp, "%u.%u.%u.%u\t%02x:%02x:%02x:%02x:%02x:%02x\t%s\n",
+			binding->ipaddr[0], binding->ipaddr[1], binding->ipaddr[2], binding->ipaddr[3],
+			binding->mac[0], binding->mac[1], binding->mac[2],
+			binding->mac[3], binding->mac[4], binding->mac[5],
+			binding->expires ? "learned" : "static");
+	}
+	pthread_mutex_unlock(&bindings->mutex);
+
+	return 0;
+}
+
+static int cmd_set_bind(UNUSED FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
+{
+	proto_arp_ethernet_t const	*inst = ctx;
+	int				ret;
+
+	pthread_mutex_lock(&inst->bindings->mutex);
+	ret = binding_set(inst, (uint8_t const *) &info->box[0]->vb_ip.addr.v4.s_addr, info->box[1]->vb_ether, 0);
+	pthread_mutex_unlock(&inst->bindings->mutex);
+
+	if (ret < 0) {
+		fprintf(fp_err, "%s\n", fr_strerror());
+		return -1;
+	}
+
+	return 0;
+}
+
+static int cmd_set_unbind(UNUSED FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
+{
+	proto_arp_ethernet_t const	*inst = ctx;
+	proto_arp_ethernet_binding_t	find;
+	bool				deleted;
+
+	memcpy(find.ipaddr, &info->box[0]->vb_ip.addr.v4.s_addr, sizeof(find.ipaddr));
+
+	pthread_mutex_lock(&inst->bindings->mutex);
+	deleted = fr_hash_table_delete(inst->bindings->ht, &find);
+	pthread_mutex_unlock(&inst->bindings->mutex);
+
+	if (!deleted) {
+		fprintf(fp_err, "No binding for %s\n", info->argv[0]);
+		return -1;
+	}
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_arp_table[] = {
+	{
+		.parent = "show",
+		.name = "arp",
+		.help = "Show the ARP fast path.",
+		.read_only = true
+	},
+
+	{
+		.parent = "show arp",
+		.add_name = true,
+		.name = "bindings",
+		.func = cmd_show_bindings,
+		.help = "Show the IP to MAC bindings ARP requests are answered from.",
+		.read_only = true
+	},
+
+	{
+		.parent = "set",
+		.name = "arp",
+		.help = "Change the ARP fast path.",
+		.read_only = false
+	},
+
+	{
+		.parent = "set arp",
+		.add_name = true,
+		.name = "bind",
+		.syntax = "IPV4ADDR ETHER",
+		.func = cmd_set_bind,
+		.help = "Add or replace a static binding.",
+		.read_only = false
+	},
+
+	{
+		.parent = "set arp",
+		.add_name = true,
+		.name = "unbind",
+		.syntax = "IPV4ADDR",
+		.func = cmd_set_unbind,
+		.help = "Remove a static or learned binding.",
+		.read_only = false
+	},
+
+	CMD_TABLE_END
+};
+
+/** Load static bindings from a file
+ *
+ * Each line is an IPv4 address, then a MAC address.  Blank lines and
+ * lines starting with '#' are ignored.
+ */
+static int bindings_load(proto_arp_ethernet_t const *inst)
+{
+	FILE		*fp;
+	char		buffer[256];
+	int		lineno = 0;
+	int		ret = -1;
+
+	fp = fopen(inst->bindings_file, "r");
+	if (!fp) {
+		cf_log_err(inst->cs, "Failed opening %s: %s", inst->bindings_file, fr_syserror(errno));
+		return -1;
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp)) {
+		char		*p = buffer, *ip, *mac;
+		fr_value_box_t	ip_box, mac_box;
+
+		lineno++;
+
+		fr_skip_whitespace(p);
+		if (!*p || (*p == '#')) continue;
+
+		ip = p;
+		fr_skip_not_whitespace(p);
+		if (*p) *p++ = '\0';
+
+		fr_skip_whitespace(p);
+		mac = p;
+		fr_skip_not_whitespace(p);
+		*p = '\0';
+
+		if ((fr_value_box_from_str(NULL, &ip_box, FR_TYPE_IPV4_ADDR, NULL, ip, -1, '\0', false) < 0) ||
+		    (fr_value_box_from_str(NULL, &mac_box, FR_TYPE_ETHERNET, NULL, mac, -1, '\0', false) < 0)) {
+			cf_log_perr(inst->cs, "%s[%d]: Invalid binding", inst->bindings_file, lineno);
+			goto finish;
+		}
+
+		if (binding_set(inst, (uint8_t const *) &ip_box.vb_ip.addr.v4.s_addr, mac_box.vb_ether, 0) < 0) {
+			cf_log_perr(inst->cs, "%s[%d]: Failed adding binding", inst->bindings_file, lineno);
+			goto finish;
+		}
+	}
+	ret = 0;
+
+finish:
+	fclose(fp);
+
+	return ret;
+}
+
+static int _bindings_free(proto_arp_ethernet_bindings_t *bindings)
+{
+	pthread_mutex_destroy(&bindings->mutex);
+
+	return 0;
+}
+
+static int mod_instantiate(void *instance, UNUSED CONF_SECTION *cs)
+{
+	proto_arp_ethernet_t		*inst = talloc_get_type_abort(instance, proto_arp_ethernet_t);
+	proto_arp_ethernet_bindings_t	*bindings;
+
+	if (!inst->fast_path) return 0;
+
+	MEM(bindings = talloc_zero(inst, proto_arp_ethernet_bindings_t));
+	pthread_mutex_init(&bindings->mutex, NULL);
+	talloc_set_destructor(bindings, _bindings_free);
+
+	bindings->ht = fr_hash_table_alloc(bindings, binding_hash, binding_cmp, binding_free);
+	if (!bindings->ht) {
+		cf_log_err(inst->cs, "Failed allocating ARP bindings");
+		return -1;
+	}
+	inst->bindings = bindings;
+
+	if (inst->bindings_file && (bindings_load(inst) < 0)) return -1;
+
+	if (fr_command_register_hook(NULL, inst->interface, inst, cmd_arp_table) < 0) {
+		cf_log_perr(inst->cs, "Failed registering radmin commands for the ARP fast path");
+	}
+
+	return 0;
+}
+
 
 fr_app_io_t proto_arp_ethernet = {
 	.magic			= RLM_MODULE_INIT,
@@ -237,6 +649,7 @@ fr_app_io_t proto_arp_ethernet = {
 	.inst_size		= sizeof(proto_arp_ethernet_t),
 	.thread_inst_size	= sizeof(proto_arp_ethernet_thread_t),
 	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
 
 	.default_message_size	= FR_ARP_PACKET_SIZE,
 
@@ -46,7 +46,40 @@
 #include <pwd.h>
 #include <grp.h>
 
+typedef struct proto_control_unix_thread_s proto_control_unix_thread_t;
+
+/** One sample of a subscribed command's output
+ *
+ */
+typedef struct {
+	char const			*name;			//!< first word of the line.
+	char const			*value;			//!< rest of the line.
+	bool				is_number;		//!< whether value is numeric.
+	bool				is_integer;		//!< whether value is an unsigned integer.
+	uint64_t			integer;
+	double				number;
+} proto_control_unix_stat_t;
+
+/** A command whose output is sent to the client at a regular interval
+ *
+ */
 typedef struct {
+	proto_control_unix_thread_t	*thread;		//!< the connection we're writing to.
+	char				*command;		//!< to run.
+	fr_time_delta_t			interval;		//!< how often we run it.
+	bool				json;			//!< output format.
+	fr_time_t			next;			//!< when we next run it.
+	fr_event_timer_t const		*ev;
+
+	fr_cmd_info_t			*info;			//!< for running the command.
+	FILE				*fp;			//!< writes to buffer.
+	char				*buffer;		//!< output of the command.
+	size_t				used;			//!< bytes of buffer in use.
+
+	proto_control_unix_stat_t	*prev;			//!< last sample, for computing deltas.
+} proto_control_unix_subscription_t;
+
+struct proto_control_unix_thread_s {
 	char const			*name;			//!< socket name
 
 	int				sockfd;
@@ -65,7 +98,10 @@ typedef struct {
 	fr_cmd_info_t			*info;			//!< for running commands
 
 	RADCLIENT			radclient;		//!< for faking out clients
-} proto_control_unix_thread_t;
+
+	fr_event_list_t			*el;			//!< for running subscriptions.
+	proto_control_unix_subscription_t *subscription;	//!< periodic command, if any.
+};
 
 typedef struct {
 	CONF_SECTION			*cs;			//!< our configuration
@@ -140,6 +176,372 @@ static SINT write_misc(void *instance, char const *buffer, INT buffer_size)
 }
 
 
+/*
+ *	The connection which is running a command, so that the
+ *	subscription commands know where to send their output.
+ */
+static _Thread_local proto_control_unix_thread_t *control_thread;
+
+static SINT write_subscription(void *instance, char const *buffer, INT buffer_size)
+{
+	proto_control_unix_subscription_t *sub = talloc_get_type_abort(instance, proto_control_unix_subscription_t);
+	size_t len = talloc_array_length(sub->buffer);
+
+	if ((sub->used + buffer_size + 1) > len) {
+		while ((sub->used + buffer_size + 1) > len) len *= 2;
+		MEM(sub->buffer = talloc_realloc(sub, sub->buffer, char, len));
+	}
+
+	memcpy(sub->buffer + sub->used, buffer, buffer_size);
+	sub->used += buffer_size;
+	sub->buffer[sub->used] = '\0';
+
+	return buffer_size;
+}
+
+static int _subscription_free(proto_control_unix_subscription_t *sub)
+{
+	if (sub->fp) fclose(sub->fp);
+
+	return 0;
+}
+
+/** Split the output of a command into "name value" lines
+ *
+ *  Lines which are empty, or which start with '#' are ignored.
+ */
+static proto_control_unix_stat_t *subscription_parse(TALLOC_CTX *ctx, char const *buffer, size_t len)
+{
+	proto_control_unix_stat_t	*stats;
+	char				*text, *p, *eol;
+	size_t				num = 0, lines = 1;
+
+	for (p = memchr(buffer, '\n', len); p; p = memchr(p + 1, '\n', len - (p + 1 - buffer))) lines++;
+
+	MEM(stats = talloc_zero_array(ctx, proto_control_unix_stat_t, lines));
+	MEM(text = talloc_memdup(stats, buffer, len + 1));
+
+	for (p = text; p && *p; p = eol) {
+		proto_control_unix_stat_t	*stat;
+		char				*end;
+
+		eol = strchr(p, '\n');
+		if (eol) *eol++ = '\0';
+
+		fr_skip_whitespace(p);
+		if (!*p || (*p == '#')) continue;
+
+		stat = &stats[num++];
+		stat->name = p;
+		while (*p && !isspace((uint8_t)*p)) p++;
+		if (*p) *p++ = '\0';
+		fr_skip_whitespace(p);
+
+		stat->value = p;
+		end = p + strlen(p);
+		while ((end > p) && isspace((uint8_t)end[-1])) *--end = '\0';
+		if (!*p) continue;
+
+		if (strspn(p, "0123456789") == (size_t)(end - p)) {
+			stat->integer = strtoull(p, NULL, 10);
+			stat->number = stat->integer;
+			stat->is_integer = stat->is_number = true;
+		} else {
+			stat->number = strtod(p, &end);
+			stat->is_number = (*end == '\0');
+		}
+	}
+
+	if (num < lines) MEM(stats = talloc_realloc(ctx, stats, proto_control_unix_stat_t, num));
+
+	return stats;
+}
+
+/** Find the previous value of a statistic
+ *
+ * The output of a command is usually the same every time, so we
+ * check the same position first.
+ */
+static proto_control_unix_stat_t const *subscription_prev(proto_control_unix_subscription_t const *sub,
+							   size_t i, char const *name)
+{
+	size_t j, num;
+
+	if (!sub->prev) return NULL;
+
+	num = talloc_array_length(sub->prev);
+	if ((i < num) && (strcmp(sub->prev[i].name, name) == 0)) return &sub->prev[i];
+
+	for (j = 0; j < num; j++) {
+		if (strcmp(sub->prev[j].name, name) == 0) return &sub->prev[j];
+	}
+
+	return NULL;
+}
+
+static void subscription_json_string(FILE *fp, char const *str)
+{
+	char const *p;
+
+	fputc('"', fp);
+	for (p = str; *p; p++) {
+		if ((*p == '"') || (*p == '\\')) {
+			fprintf(fp, "\\%c", *p);
+
+		} else if ((uint8_t)*p < 0x20) {
+			fprintf(fp, "\\u%04x", (uint8_t)*p);
+
+		} else {
+			fputc(*p, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+static void subscription_value_print(FILE *fp, proto_control_unix_stat_t const *stat)
+{
+	if (stat->is_integer) {
+		fprintf(fp, "%" PRIu64, stat->integer);
+	} else {
+		fprintf(fp, "%.9g", stat->number);
+	}
+}
+
+static void subscription_delta_print(FILE *fp, proto_control_unix_stat_t const *stat,
+				     proto_control_unix_stat_t const *prev, bool json)
+{
+	if (stat->is_integer && prev->is_integer) {
+		fprintf(fp, json ? "%" PRId64 : "%+" PRId64, (int64_t)(stat->integer - prev->integer));
+	} else {
+		fprintf(fp, json ? "%.9g" : "%+.9g", stat->number - prev->number);
+	}
+}
+
+/** Run the subscribed command, and send its output to the client
+ *
+ * The commands read the counters kept by the network and worker
+ * threads directly, in the same way as when they're run
+ * interactively.  So the other threads are never blocked.
+ */
+static void subscription_run(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	proto_control_unix_subscription_t	*sub = talloc_get_type_abort(uctx, proto_control_unix_subscription_t);
+	proto_control_unix_thread_t		*thread = sub->thread;
+	FILE					*fp = thread->stdout;
+	proto_control_unix_stat_t		*stats;
+	struct timeval				when;
+	size_t					i, num;
+	char					command[1024];
+
+	strlcpy(command, sub->command, sizeof(command));
+	sub->used = 0;
+	sub->buffer[0] = '\0';
+
+	/*
+	 *	Commands run from a subscription can't change
+	 *	subscriptions, or do anything other than read.
+	 */
+	control_thread = NULL;
+	if (fr_radmin_run(sub->info, sub->fp, sub->fp, command, true) <= 0) {
+		fflush(sub->fp);
+		fprintf(thread->stderr, "Subscribed command \"%s\" failed: %s\n", sub->command, sub->buffer);
+	cancel:
+		thread->subscription = NULL;
+		talloc_free(sub);
+		return;
+	}
+	fflush(sub->fp);
+
+	stats = subscription_parse(sub, sub->buffer, sub->used);
+	num = talloc_array_length(stats);
+	when = fr_time_to_timeval(now);
+
+	if (sub->json) {
+		fprintf(fp, "{\"time\":%" PRIu64 ".%06u,\"stats\":{", (uint64_t)when.tv_sec, (unsigned int)when.tv_usec);
+		for (i = 0; i < num; i++) {
+			proto_control_unix_stat_t const *prev;
+
+			if (i > 0) fputc(',', fp);
+			subscription_json_string(fp, stats[i].name);
+			fputs(":{\"value\":", fp);
+
+			if (!stats[i].is_number) {
+				subscription_json_string(fp, stats[i].value);
+				fputc('}', fp);
+				continue;
+			}
+
+			subscription_value_print(fp, &stats[i]);
+			prev = subscription_prev(sub, i, stats[i].name);
+			if (prev && prev->is_number) {
+				fputs(",\"delta\":", fp);
+				subscription_delta_print(fp, &stats[i], prev, true);
+			}
+			fputc('}', fp);
+		}
+		fputs("}}\n", fp);
+
+	} else {
+		fprintf(fp, "time\t%" PRIu64 ".%06u\n", (uint64_t)when.tv_sec, (unsigned int)when.tv_usec);
+		for (i = 0; i < num; i++) {
+			proto_control_unix_stat_t const *prev;
+
+			if (!stats[i].is_number) {
+				fprintf(fp, "%s\t%s\n", stats[i].name, stats[i].value);
+				continue;
+			}
+
+			fprintf(fp, "%s\t", stats[i].name);
+			subscription_value_print(fp, &stats[i]);
+			prev = subscription_prev(sub, i, stats[i].name);
+			if (prev && prev->is_number) {
+				fputc('\t', fp);
+				subscription_delta_print(fp, &stats[i], prev, false);
+			}
+			fputc('\n', fp);
+		}
+		fputc('\n', fp);
+	}
+	fflush(fp);
+
+	talloc_free(sub->prev);
+	sub->prev = stats;
+
+	/*
+	 *	The client has gone away, or isn't reading.
+	 */
+	if (ferror(fp)) {
+		clearerr(fp);
+		goto cancel;
+	}
+
+	/*
+	 *	Run at fixed intervals from the start, unless we've
+	 *	fallen behind.
+	 */
+	sub->next += sub->interval;
+	if (sub->next <= now) sub->next = now + sub->interval;
+
+	if (fr_event_timer_at(sub, el, &sub->ev, sub->next, subscription_run, sub) < 0) {
+		fprintf(thread->stderr, "Failed rescheduling subscription: %s\n", fr_strerror());
+		goto cancel;
+	}
+}
+
+static int cmd_subscribe(UNUSED FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
+{
+	proto_control_unix_thread_t		*thread = control_thread;
+	proto_control_unix_subscription_t	*sub;
+	cookie_io_functions_t			io;
+	uint32_t				notify;
+	int					i;
+
+	if (!thread || !thread->el) {
+		fprintf(fp_err, "Subscriptions can only be made from a control socket.\n");
+		return -1;
+	}
+
+	if (info->box[0]->vb_uint32 < 100) {
+		fprintf(fp_err, "Interval must be at least 100 milliseconds.\n");
+		return -1;
+	}
+
+	TALLOC_FREE(thread->subscription);
+
+	MEM(sub = talloc_zero(thread, proto_control_unix_subscription_t));
+	talloc_set_destructor(sub, _subscription_free);
+	sub->thread = thread;
+	sub->interval = fr_time_delta_from_msec(info->box[0]->vb_uint32);
+	sub->json = (strcmp(info->argv[1], "json") == 0);
+
+	MEM(sub->command = talloc_strdup(sub, info->argv[2]));
+	for (i = 3; i < info->argc; i++) {
+		MEM(sub->command = talloc_asprintf_append_buffer(sub->command, " %s", info->argv[i]));
+	}
+	if (talloc_array_length(sub->command) > 1024) {
+		fprintf(fp_err, "Command is too long.\n");
+		talloc_free(sub);
+		return -1;
+	}
+
+	MEM(sub->info = talloc_zero(sub, fr_cmd_info_t));
+	fr_command_info_init(sub, sub->info);
+	MEM(sub->buffer = talloc_array(sub, char, 4096));
+	sub->buffer[0] = '\0';
+
+	io.read = NULL;
+	io.seek = NULL;
+	io.close = NULL;
+	io.write = write_subscription;
+	sub->fp = fopencookie(sub, "w", io);
+	if (!sub->fp) {
+		fprintf(fp_err, "Failed opening subscription output: %s\n", fr_syserror(errno));
+		talloc_free(sub);
+		return -1;
+	}
+
+	/*
+	 *	Run the command immediately, so that the client
+	 *	sees the first values without waiting.
+	 */
+	sub->next = fr_time();
+	if (fr_event_timer_at(sub, thread->el, &sub->ev, sub->next, subscription_run, sub) < 0) {
+		fprintf(fp_err, "Failed scheduling subscription: %s\n", fr_strerror());
+		talloc_free(sub);
+		return -1;
+	}
+	thread->subscription = sub;
+
+	/*
+	 *	Tell radmin to keep reading output after the
+	 *	command has finished.
+	 */
+	notify = htonl(FR_NOTIFY_UNBUFFERED);
+	(void) fr_conduit_write(thread->sockfd, FR_CONDUIT_NOTIFY, &notify, sizeof(notify));
+
+	return 0;
+}
+
+static int cmd_unsubscribe(UNUSED FILE *fp, FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	proto_control_unix_thread_t	*thread = control_thread;
+	uint32_t			notify;
+
+	if (!thread || !thread->subscription) {
+		fprintf(fp_err, "There is no subscription.\n");
+		return -1;
+	}
+
+	TALLOC_FREE(thread->subscription);
+
+	notify = htonl(FR_NOTIFY_BUFFERED);
+	(void) fr_conduit_write(thread->sockfd, FR_CONDUIT_NOTIFY, &notify, sizeof(notify));
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_subscribe_table[] = {
+	{
+		.name = "subscribe",
+		.syntax = "INTEGER (text|json) STRING ...",
+		.func = cmd_subscribe,
+		.help = "Run a command every INTEGER milliseconds, and send its output, along with "
+			"the change in each numeric value since the last run.  e.g. "
+			"'subscribe 1000 json stats network 0 self'.",
+		.read_only = true
+	},
+
+	{
+		.name = "unsubscribe",
+		.func = cmd_unsubscribe,
+		.help = "Stop running the subscribed command.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+
 /*
  *	Run a command.
  */
@@ -209,7 +611,9 @@ static ssize_t mod_read_command(fr_listen_t *li, UNUSED void **packet_ctx, UNUSE
 
 	DEBUG("radmin-remote> %.*s", (int) hdr->length, cmd);
 
+	control_thread = thread;
 	rcode = fr_radmin_run(thread->info, thread->stdout, thread->stderr, string, inst->read_only);
+	control_thread = NULL;
 	if (rcode < 0) {
 fail:
 		status = FR_CONDUIT_FAIL;
@@ -1105,6 +1509,13 @@ static int mod_fd_set(fr_listen_t *li, int fd)
 	return 0;
 }
 
+static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, UNUSED void *nr)
+{
+	proto_control_unix_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_control_unix_thread_t);
+
+	thread->el = el;
+}
+
 static char const *mod_name(fr_listen_t *li)
 {
 	proto_control_unix_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_control_unix_thread_t);
@@ -1115,6 +1526,7 @@ static char const *mod_name(fr_listen_t *li)
 
 static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 {
+	static bool		cmds_registered = false;
 	proto_control_unix_t	*inst = talloc_get_type_abort(instance, proto_control_unix_t);
 
 	inst->cs = cs;
@@ -1175,6 +1587,18 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	/*
+	 *	There may be many control sockets, but the
+	 *	commands are global.
+	 */
+	if (!cmds_registered) {
+		if (fr_command_register_hook(NULL, NULL, NULL, cmd_subscribe_table) < 0) {
+			PERROR("Failed registering subscription commands");
+			return -1;
+		}
+		cmds_registered = true;
+	}
+
 	return 0;
 }
 
@@ -1200,6 +1624,7 @@ fr_app_io_t proto_control_unix = {
 	.read			= mod_read,
 	.write			= mod_write,
 	.fd_set			= mod_fd_set,
+	.event_list_set		= mod_event_list_set,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
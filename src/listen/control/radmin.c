@@ -1132,8 +1132,12 @@ int main(int argc, char **argv)
 			}
 		}
 
+		/*
+		 *	e.g. "subscribe".  Keep printing output until
+		 *	the server closes the connection.
+		 */
 		if (unbuffered) {
-			while (true) flush_conduits(sockfd, io_buffer, sizeof(io_buffer));
+			while (flush_conduits(sockfd, io_buffer, sizeof(io_buffer)) > 0);
 		}
 
 		/*
@@ -1311,6 +1315,17 @@ int main(int argc, char **argv)
 				add_history(cmd_buffer);
 				write_history(history_file);
 			}
+
+			/*
+			 *	The server is streaming output to us, so
+			 *	print it until the connection is closed,
+			 *	or we're interrupted.
+			 */
+			if (unbuffered) {
+				while (flush_conduits(sockfd, io_buffer, sizeof(io_buffer)) > 0);
+				radmin_free(line);
+				break;
+			}
 		}
 
 		/*
@@ -223,11 +223,6 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 		thread->leftover = 0;
 	}
 
-	/*
-	 *	Seek to the current read offset.
-	 */
-	(void) lseek(thread->fd, thread->read_offset, SEEK_SET);
-
 	/*
 	 *	There will be "leftover" bytes left over in the buffer
 	 *	from any previous read.  At the start of the file,
@@ -239,10 +234,20 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 
 	/*
 	 *	Try to read as much data as possible.
+	 *
+	 *	Each read fills the buffer, so it usually holds many
+	 *	records.  Only read more data once there's no complete
+	 *	record left in the buffer, instead of reading (and
+	 *	seeking) for every record.
 	 */
-	if (!thread->eof) {
+	if (!thread->eof && !memmem(buffer, *leftover, "\n\n", 2)) {
 		size_t room;
 
+		/*
+		 *	Seek to the current read offset.
+		 */
+		(void) lseek(thread->fd, thread->read_offset, SEEK_SET);
+
 		room = buffer_len - *leftover;
 
 		data_size = read(thread->fd, partial, room);
@@ -270,7 +275,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 		end = partial + data_size;
 
 	} else {
-		MPRINT("READ UNTIL EOF");
+		MPRINT("READ FROM BUFFER");
 		/*
 		 *	We didn't read any more data from the file,
 		 *	but there should be data left in the buffer.
@@ -626,14 +631,13 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	} else if (inst->track_progress && (track->done_offset > 0)) {
 	mark_done:
 		/*
-		 *	Seek to the entry, mark it as done, and then seek to
-		 *	the point in the file where we were reading from.
+		 *	Mark the entry as done.  pwrite() doesn't move
+		 *	the file offset, so we don't need to seek back to
+		 *	where we were reading from.
 		 */
-		(void) lseek(thread->fd, track->done_offset, SEEK_SET);
-		if (write(thread->fd, "Done", 4) < 0) {
+		if (pwrite(thread->fd, "Done", 4, track->done_offset) < 0) {
 			ERROR("%s - Failed marking entry as done: %s", thread->name, fr_syserror(errno));
 		}
-		(void) lseek(thread->fd, thread->read_offset, SEEK_SET);
 	}
 
 free_track:
@@ -45,6 +45,12 @@ typedef struct {
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+	udp_batch_t			*batch;			//!< packets read with recvmmsg().
+
+#ifdef PACKET_TX_RING
+	fr_dhcpv4_raw_ring_t		*ring;			//!< for replies to clients which have no IP address.
+#endif
+
 	fr_stats_t			stats;			//!< statistics for this socket
 }  proto_dhcpv4_udp_thread_t;
 
@@ -63,13 +69,21 @@ typedef struct {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			read_batch;		//!< Maximum number of packets to read at once.
+
+	uint32_t			raw_ring_frames;	//!< Size of the raw transmit ring.
+
 	uint16_t			port;			//!< Port to listen on.
 
 	bool				broadcast;		//!< whether we listen for broadcast packets
+	bool				raw_transmit;		//!< send replies to clients without an IP address
+								//!< as ethernet frames.
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a receive
 								//!< buffer value.
 	bool				dynamic_clients;	//!< whether we have dynamic clients
+	bool				reuseport_cpu_steering;	//!< steer packets to the socket in the reuseport
+								//!< group matching the receiving CPU.
 
 	RADCLIENT_LIST			*clients;		//!< local clients
 	RADCLIENT			*default_client;	//!< default 0/0 client
@@ -102,11 +116,17 @@ static const CONF_PARSER udp_listen_config[] = {
 
 	{ FR_CONF_OFFSET("broadcast", FR_TYPE_BOOL, proto_dhcpv4_udp_t, broadcast) } ,
 
+	{ FR_CONF_OFFSET("reuseport_cpu_steering", FR_TYPE_BOOL, proto_dhcpv4_udp_t, reuseport_cpu_steering) } ,
+
 	{ FR_CONF_OFFSET("dynamic_clients", FR_TYPE_BOOL, proto_dhcpv4_udp_t, dynamic_clients) } ,
 	{ FR_CONF_POINTER("networks", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_dhcpv4_udp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_dhcpv4_udp_t, max_attributes), .dflt = STRINGIFY(DHCPV4_MAX_ATTRIBUTES) } ,
+	{ FR_CONF_OFFSET("read_batch", FR_TYPE_UINT32, proto_dhcpv4_udp_t, read_batch), .dflt = "16" } ,
+
+	{ FR_CONF_OFFSET("raw_transmit", FR_TYPE_BOOL, proto_dhcpv4_udp_t, raw_transmit) } ,
+	{ FR_CONF_OFFSET("raw_ring_frames", FR_TYPE_UINT32, proto_dhcpv4_udp_t, raw_ring_frames), .dflt = "1024" } ,
 
 	CONF_PARSER_TERMINATOR
 };
@@ -156,7 +176,11 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	if (thread->batch) {
+		data_size = udp_batch_recv(thread->batch, &address->socket, buffer, buffer_len, recv_time_p);
+	} else {
+		data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	}
 	if (data_size < 0) {
 		RATE_LIMIT_GLOBAL(PERROR, "Read error (%zd)", data_size);
 		return data_size;
@@ -401,6 +425,31 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 			 *	are broadcast.
 			 */
 		case FR_DHCP_OFFER:
+#ifdef PACKET_TX_RING
+			/*
+			 *	The client has no IP address, so we
+			 *	send the ethernet frame straight to
+			 *	its hardware address.  This doesn't
+			 *	need ARP, or another system call to
+			 *	update the ARP table.
+			 */
+			if (thread->ring) {
+			raw_send:
+				memcpy(&socket.inet.dst_ipaddr.addr.v4.s_addr, &packet->yiaddr, 4);
+				if (fr_dhcpv4_raw_ring_send(thread->ring, packet->chaddr, &socket, buffer, buffer_len) == 0) {
+					DEBUG("Reply will be sent to YIADDR as a raw frame.");
+					return buffer_len;
+				}
+
+				RATE_LIMIT_GLOBAL(PWARN, "Failed sending raw frame");
+				if (code[2] == FR_DHCP_ACK) goto send_reply;
+
+				DEBUG("Reply will be broadcast.");
+				socket.inet.dst_ipaddr.addr.v4.s_addr = INADDR_BROADCAST;
+				break;
+			}
+#endif
+
 			/*
 			 *	If the packet was unicast from the
 			 *	client, unicast it back without
@@ -452,6 +501,9 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 			 *	ACKs are unicast to YIADDR
 			 */
 		case FR_DHCP_ACK:
+#ifdef PACKET_TX_RING
+			if (thread->ring) goto raw_send;
+#endif
 			DEBUG("Reply will be unicast to YIADDR.");
 			memcpy(&socket.inet.dst_ipaddr.addr.v4.s_addr, &packet->yiaddr, 4);
 			break;
@@ -547,8 +599,46 @@ static int mod_open(fr_listen_t *li)
 		goto error;
 	}
 
+	/*
+	 *	Each socket bound to this address with SO_REUSEPORT
+	 *	gets the packets received on the CPU matching its
+	 *	position in the group, so clients stay pinned to one
+	 *	reader.
+	 */
+	if (inst->reuseport_cpu_steering && (fr_socket_reuseport_cpu_steer(sockfd) < 0)) {
+		close(sockfd);
+		PERROR("Failed setting 'reuseport_cpu_steering'");
+		goto error;
+	}
+
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Read many packets with one system call.  Connected
+	 *	sockets are opened via mod_fd_set(), and don't use
+	 *	batching.
+	 */
+	if (inst->read_batch > 1) {
+		thread->batch = udp_batch_alloc(thread, sockfd, inst->read_batch, inst->max_packet_size);
+		if (!thread->batch) {
+			close(sockfd);
+			PERROR("Failed allocating receive batch");
+			goto error;
+		}
+		li->read_batch = inst->read_batch;
+	}
+
+#ifdef PACKET_TX_RING
+	if (inst->raw_transmit) {
+		thread->ring = fr_dhcpv4_raw_ring_alloc(thread, inst->interface, inst->raw_ring_frames);
+		if (!thread->ring) {
+			close(sockfd);
+			PERROR("Failed opening raw transmit ring");
+			goto error;
+		}
+	}
+#endif
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_dhcpv4_udp,
@@ -703,6 +793,24 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, MIN_PACKET_SIZE);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("read_batch", inst->read_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("read_batch", inst->read_batch, <=, 1024);
+
+	if (inst->raw_transmit) {
+#ifdef PACKET_TX_RING
+		if (!inst->interface) {
+			cf_log_err(cs, "'raw_transmit' requires an 'interface' to be set");
+			return -1;
+		}
+
+		FR_INTEGER_BOUND_CHECK("raw_ring_frames", inst->raw_ring_frames, >=, 32);
+		FR_INTEGER_BOUND_CHECK("raw_ring_frames", inst->raw_ring_frames, <=, 65536);
+#else
+		cf_log_err(cs, "'raw_transmit' is not supported on this system");
+		return -1;
+#endif
+	}
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -812,6 +920,7 @@ fr_app_io_t proto_dhcpv4_udp = {
 
 	.default_message_size	= 4096,
 	.track_duplicates	= true,
+	.single_socket		= true,		/* broadcast / multicast */
 
 	.open			= mod_open,
 	.read			= mod_read,
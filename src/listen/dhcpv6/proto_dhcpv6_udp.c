@@ -43,6 +43,8 @@ typedef struct {
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+	udp_batch_t			*batch;			//!< packets read with recvmmsg().
+
 	fr_stats_t			stats;			//!< statistics for this socket
 }  proto_dhcpv6_udp_thread_t;
 
@@ -63,6 +65,8 @@ typedef struct {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			read_batch;		//!< Maximum number of packets to read at once.
+
 	uint16_t			port;			//!< Port to listen on.
 
 	bool				multicast;		//!< whether or not we listen for multicast packets
@@ -107,6 +111,7 @@ static const CONF_PARSER udp_listen_config[] = {
 
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_dhcpv6_udp_t, max_packet_size), .dflt = "8192" } ,
 	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_dhcpv6_udp_t, max_attributes), .dflt = STRINGIFY(DHCPV4_MAX_ATTRIBUTES) } ,
+	{ FR_CONF_OFFSET("read_batch", FR_TYPE_UINT32, proto_dhcpv6_udp_t, read_batch), .dflt = "16" } ,
 
 	CONF_PARSER_TERMINATOR
 };
@@ -158,7 +163,11 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	if (thread->batch) {
+		data_size = udp_batch_recv(thread->batch, &address->socket, buffer, buffer_len, recv_time_p);
+	} else {
+		data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	}
 	if (data_size < 0) {
 		RATE_LIMIT_GLOBAL(PERROR, "Read error (%zd)", data_size);
 		return data_size;
@@ -351,6 +360,21 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Read many packets with one system call.  Connected
+	 *	sockets are opened via mod_fd_set(), and don't use
+	 *	batching.
+	 */
+	if (inst->read_batch > 1) {
+		thread->batch = udp_batch_alloc(thread, sockfd, inst->read_batch, inst->max_packet_size);
+		if (!thread->batch) {
+			close(sockfd);
+			PERROR("Failed allocating receive batch");
+			goto error;
+		}
+		li->read_batch = inst->read_batch;
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_dhcpv6_udp,
@@ -558,6 +582,9 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 4);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("read_batch", inst->read_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("read_batch", inst->read_batch, <=, 1024);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -660,6 +687,7 @@ fr_app_io_t proto_dhcpv6_udp = {
 
 	.default_message_size	= 4096,
 	.track_duplicates	= true,
+	.single_socket		= true,		/* broadcast / multicast */
 
 	.open			= mod_open,
 	.read			= mod_read,
@@ -26,6 +26,7 @@
 #include <fcntl.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/protocol.h>
+#include <freeradius-devel/server/command.h>
 #include <freeradius-devel/radius/radius.h>
 #include <freeradius-devel/io/base.h>
 #include <freeradius-devel/io/application.h>
@@ -40,6 +41,29 @@ extern fr_app_io_t proto_load_step;
 
 typedef struct proto_load_step_s proto_load_step_t;
 
+/** Statistics for one packet
+ *
+ *  These are updated by the network thread which runs the load
+ *  generator, and read (without locking) by radmin.
+ */
+typedef struct {
+	uint64_t			sent;			//!< packets sent using this input packet
+	fr_load_hist_t			hist;			//!< response times of the replies
+} proto_load_step_packet_stats_t;
+
+/** One input packet, and how often it is sent
+ *
+ */
+typedef struct {
+	char const     			*filename;		//!< where to read input packet from
+	uint32_t			weight;			//!< relative to the other packets
+
+	fr_pair_list_t			pair_list;		//!< for input packet
+	int				code;			//!< Packet-Type of the input packet, if any
+
+	proto_load_step_packet_stats_t	*stats;			//!< statistics for this packet
+} proto_load_step_packet_t;
+
 typedef struct {
 	fr_event_list_t			*el;			//!< event list
 	fr_network_t			*nr;			//!< network handler
@@ -67,21 +91,32 @@ struct proto_load_step_s {
 	CONF_SECTION			*cs;			//!< our configuration
 
 	char const     			*filename;		//!< where to read input packet from
-	fr_pair_list_t			pair_list;		//!< for input packet
+	proto_load_step_packet_t	**packet;		//!< input packets, from "packet" subsections
+	uint32_t			total_weight;		//!< sum of the weights of all packets
 
-	int				code;
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes
 
 	RADCLIENT			*client;		//!< static client
 
 	fr_load_config_t		load;			//!< load configuration
+	char const			*arrival;		//!< arrival process, "constant", "poisson", or "bursty"
 	bool				repeat;			//!, do we repeat the load generation
+	bool				exit_when_done;		//!< stop the server once the test finishes
 	char const     			*csv;			//!< where to write CSV stats
 };
 
 
+static const CONF_PARSER load_packet_config[] = {
+	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_INPUT | FR_TYPE_REQUIRED | FR_TYPE_NOT_EMPTY, proto_load_step_packet_t, filename) },
+	{ FR_CONF_OFFSET("weight", FR_TYPE_UINT32, proto_load_step_packet_t, weight), .dflt = "1" },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER load_listen_config[] = {
-	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_INPUT | FR_TYPE_REQUIRED | FR_TYPE_NOT_EMPTY, proto_load_step_t, filename) },
+	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_INPUT | FR_TYPE_NOT_EMPTY, proto_load_step_t, filename) },
+	{ FR_CONF_SUBSECTION_ALLOC("packet", FR_TYPE_SUBSECTION | FR_TYPE_MULTI, proto_load_step_t, packet, load_packet_config),
+	  .subcs_type = "proto_load_step_packet_t" },
 	{ FR_CONF_OFFSET("csv", FR_TYPE_STRING, proto_load_step_t, csv) },
 
 	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_load_step_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
@@ -92,12 +127,33 @@ static const CONF_PARSER load_listen_config[] = {
 	{ FR_CONF_OFFSET("step", FR_TYPE_UINT32, proto_load_step_t, load.step) },
 	{ FR_CONF_OFFSET("max_backlog", FR_TYPE_UINT32, proto_load_step_t, load.milliseconds) },
 	{ FR_CONF_OFFSET("parallel", FR_TYPE_UINT32, proto_load_step_t, load.parallel) },
+	{ FR_CONF_OFFSET("arrival", FR_TYPE_STRING, proto_load_step_t, arrival), .dflt = "constant" },
 	{ FR_CONF_OFFSET("repeat", FR_TYPE_BOOL, proto_load_step_t, repeat) },
+	{ FR_CONF_OFFSET("exit_when_done", FR_TYPE_BOOL, proto_load_step_t, exit_when_done) },
 
 	CONF_PARSER_TERMINATOR
 };
 
 
+/** Pick an input packet at random, according to the weights
+ *
+ */
+static uint16_t packet_pick(proto_load_step_t const *inst)
+{
+	size_t		i, num = talloc_array_length(inst->packet);
+	uint32_t	r;
+
+	if (num == 1) return 0;
+
+	r = fr_rand() % inst->total_weight;
+	for (i = 0; i < (num - 1); i++) {
+		if (r < inst->packet[i]->weight) break;
+		r -= inst->packet[i]->weight;
+	}
+
+	return i;
+}
+
 static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len, size_t *leftover, UNUSED uint32_t *priority, UNUSED bool *is_dup)
 {
 	proto_load_step_t const		*inst = talloc_get_type_abort_const(li->app_io_instance, proto_load_step_t);
@@ -137,6 +193,15 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	address->socket.inet.dst_ipaddr.af = AF_INET;
 	address->radclient = inst->client;
 
+	/*
+	 *	The address is copied into the tracking structure for
+	 *	this packet, so we use the source port to remember
+	 *	which input packet is being sent.  mod_decode() and
+	 *	mod_write() then look it up again.
+	 */
+	address->socket.inet.src_port = packet_pick(inst);
+	inst->packet[address->socket.inet.src_port]->stats->sent++;
+
 	*recv_time_p = thread->recv_time;
 
 	if (buffer_len < 1) {
@@ -156,10 +221,12 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 }
 
 
-static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, fr_time_t request_time,
+static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_time,
 			 UNUSED uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
 {
 	proto_load_step_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_step_thread_t);
+	fr_io_track_t const		*track = talloc_get_type_abort_const(packet_ctx, fr_io_track_t);
+	proto_load_step_packet_t const	*packet = thread->inst->packet[track->address->socket.inet.src_port];
 	fr_load_reply_t state;
 
 	/*
@@ -168,6 +235,7 @@ static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, fr_time_t req
 	 *	can update them, too.. <sigh>
 	 */
 	thread->stats.total_responses++;
+	fr_load_hist_add(&packet->stats->hist, fr_time() - request_time);
 
 	/*
 	 *	Tell the load generatopr subsystem that we have a
@@ -178,6 +246,26 @@ static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, fr_time_t req
 	if (state == FR_LOAD_DONE) {
 		if (!thread->inst->repeat) {
 			thread->done = true;
+
+			/*
+			 *	Write the final statistics, as the
+			 *	timer may not fire again before we
+			 *	exit.
+			 */
+			if (thread->inst->csv && (thread->fd >= 0)) {
+				char	stats[1024];
+				size_t	len;
+
+				len = fr_load_generator_stats_sprint(thread->l, fr_time(), stats, sizeof(stats));
+				if (write(thread->fd, stats, len) < 0) {
+					DEBUG("Failed writing to %s - %s", thread->inst->csv, fr_syserror(errno));
+				}
+			}
+
+			if (thread->inst->exit_when_done) {
+				INFO("%s - load test complete, exiting", thread->name);
+				main_loop_signal_raise(RADIUS_SIGNAL_SELF_TERM);
+			}
 		} else {
 			(void) fr_load_generator_stop(thread->l); /* ensure l->ev is gone */
 			(void) fr_load_generator_start(thread->l);
@@ -202,7 +290,7 @@ static int mod_open(fr_listen_t *li)
 	 *	We never read or write to this file, but we need a
 	 *	readable FD in order to bootstrap the process.
 	 */
-	li->fd = open(inst->filename, O_RDONLY);
+	li->fd = open(inst->packet[0]->filename, O_RDONLY);
 
 	memset(&ipaddr, 0, sizeof(ipaddr));
 	ipaddr.af = AF_INET;
@@ -210,7 +298,7 @@ static int mod_open(fr_listen_t *li)
 
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
-	thread->name = talloc_typed_asprintf(thread, "load_step from filename %s", inst->filename ? inst->filename : "none");
+	thread->name = talloc_typed_asprintf(thread, "load_step from filename %s", inst->packet[0]->filename);
 	thread->parent = talloc_parent(li);
 
 	return 0;
@@ -259,6 +347,7 @@ static int mod_decode(void const *instance, request_t *request, UNUSED uint8_t *
 	proto_load_step_t const	*inst = talloc_get_type_abort_const(instance, proto_load_step_t);
 	fr_io_track_t const	*track = talloc_get_type_abort_const(request->async->packet_ctx, fr_io_track_t);
 	fr_io_address_t const  	*address = track->address;
+	proto_load_step_packet_t const *packet = inst->packet[address->socket.inet.src_port];
 
 	/*
 	 *	Set the request dictionary so that we can do
@@ -270,7 +359,7 @@ static int mod_decode(void const *instance, request_t *request, UNUSED uint8_t *
 	/*
 	 *	Hacks for now until we have a lower-level decode routine.
 	 */
-	if (inst->code) request->packet->code = inst->code;
+	if (packet->code) request->packet->code = packet->code;
 	request->packet->id = fr_rand() & 0xff;
 	request->reply->id = request->packet->id;
 	memset(request->packet->vector, 0, sizeof(request->packet->vector));
@@ -283,7 +372,7 @@ static int mod_decode(void const *instance, request_t *request, UNUSED uint8_t *
 	 *	That MUST be set and checked in the underlying
 	 *	transport, via a call to fr_radius_ok().
 	 */
-	(void) fr_pair_list_copy(request->request_ctx, &request->request_pairs, &inst->pair_list);
+	(void) fr_pair_list_copy(request->request_ctx, &request->request_pairs, &packet->pair_list);
 
 	/*
 	 *	Set the rest of the fields.
@@ -309,7 +398,7 @@ static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, void *nr)
 	proto_load_step_t const       *inst = talloc_get_type_abort_const(li->app_io_instance, proto_load_step_t);
 	proto_load_step_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_step_thread_t);
 	size_t len;
-	char buffer[256];
+	char buffer[1024];
 
 	thread->el = el;
 	thread->nr = nr;
@@ -349,6 +438,7 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 {
 	proto_load_step_t	*inst = talloc_get_type_abort(instance, proto_load_step_t);
 	dl_module_inst_t const	*dl_inst;
+	int			arrival;
 
 	/*
 	 *	Find the dl_module_inst_t holding our instance data
@@ -381,6 +471,24 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_backlog", inst->load.milliseconds, >=, 1);
 	FR_INTEGER_BOUND_CHECK("max_backlog", inst->load.milliseconds, <, 100000);
 
+	arrival = fr_table_value_by_str(fr_load_arrival_table, inst->arrival, -1);
+	if (arrival < 0) {
+		cf_log_err(cs, "Invalid value for 'arrival = %s'.  Expected one of 'constant', 'poisson', or 'bursty'",
+			   inst->arrival);
+		return -1;
+	}
+	inst->load.arrival = arrival;
+
+	if (inst->filename && inst->packet) {
+		cf_log_err(cs, "Cannot use both 'filename' and 'packet { ... }'");
+		return -1;
+	}
+
+	if (!inst->filename && !inst->packet) {
+		cf_log_err(cs, "One of 'filename' or 'packet { ... }' must be set");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -392,47 +500,129 @@ static RADCLIENT *mod_client_find(fr_listen_t *li, UNUSED fr_ipaddr_t const *ipa
 }
 
 
+static int cmd_stats_packets(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	proto_load_step_t const	*inst = ctx;
+	size_t			i;
+
+	for (i = 0; i < talloc_array_length(inst->packet); i++) {
+		proto_load_step_packet_t const	*packet = inst->packet[i];
+		fr_load_hist_t const		*hist = &packet->stats->hist;
+
+		fprintf(fp, "packet.%zu.filename\t%s\n", i, packet->filename);
+		fprintf(fp, "packet.%zu.weight\t%u\n", i, packet->weight);
+		fprintf(fp, "packet.%zu.sent\t%" PRIu64 "\n", i, packet->stats->sent);
+		fprintf(fp, "packet.%zu.received\t%" PRIu64 "\n", i, hist->count);
+		fprintf(fp, "packet.%zu.p50_us\t%" PRIu64 "\n", i, fr_load_hist_percentile(hist, 500));
+		fprintf(fp, "packet.%zu.p90_us\t%" PRIu64 "\n", i, fr_load_hist_percentile(hist, 900));
+		fprintf(fp, "packet.%zu.p99_us\t%" PRIu64 "\n", i, fr_load_hist_percentile(hist, 990));
+		fprintf(fp, "packet.%zu.p999_us\t%" PRIu64 "\n", i, fr_load_hist_percentile(hist, 999));
+	}
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_load_step_table[] = {
+	{
+		.parent = "stats",
+		.name = "load",
+		.help = "Statistics for load generators.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats load",
+		.add_name = true,
+		.name = "packets",
+		.func = cmd_stats_packets,
+		.help = "Show per-packet statistics for the load generator in a virtual server.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Read one input packet from a file
+ *
+ */
+static int packet_load(proto_load_step_t *inst, CONF_SECTION *cs, proto_load_step_packet_t *packet)
+{
+	FILE		*fp;
+	bool		done = false;
+	fr_pair_t	*vp;
+
+	fr_pair_list_init(&packet->pair_list);
+	MEM(packet->stats = talloc_zero(packet, proto_load_step_packet_stats_t));
+
+	fp = fopen(packet->filename, "r");
+	if (!fp) {
+		cf_log_err(cs, "Failed reading %s - %s",
+			   packet->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fr_pair_list_afrom_file(packet, inst->parent->dict, &packet->pair_list, fp, &done) < 0) {
+		cf_log_perr(cs, "Failed reading %s", packet->filename);
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+
+	vp = fr_pair_find_by_da(&packet->pair_list, inst->parent->attr_packet_type, 0);
+	if (vp) packet->code = vp->vp_uint32;
+
+	return 0;
+}
+
 static int mod_instantiate(void *instance, CONF_SECTION *cs)
 {
 	proto_load_step_t	*inst = talloc_get_type_abort(instance, proto_load_step_t);
 	RADCLIENT		*client;
-	fr_pair_t		*vp;
+	size_t			i;
+
+	/*
+	 *	A plain "filename" is the same as one "packet"
+	 *	subsection.
+	 */
+	if (!inst->packet) {
+		MEM(inst->packet = talloc_zero_array(inst, proto_load_step_packet_t *, 1));
+		MEM(inst->packet[0] = talloc_zero(inst->packet, proto_load_step_packet_t));
+		inst->packet[0]->filename = inst->filename;
+		inst->packet[0]->weight = 1;
+	}
+
+	if (talloc_array_length(inst->packet) > UINT16_MAX) {
+		cf_log_err(cs, "Too many 'packet' subsections");
+		return -1;
+	}
+
+	inst->total_weight = 0;
+	for (i = 0; i < talloc_array_length(inst->packet); i++) {
+		if (!inst->packet[i]->weight) {
+			cf_log_err(cs, "Invalid value for 'weight = 0' in the packet from %s", inst->packet[i]->filename);
+			return -1;
+		}
+		inst->total_weight += inst->packet[i]->weight;
+
+		if (packet_load(inst, cs, inst->packet[i]) < 0) return -1;
+	}
 
-	fr_pair_list_init(&inst->pair_list);
 	inst->client = client = talloc_zero(inst, RADCLIENT);
 	if (!inst->client) return 0;
 
 	client->ipaddr.af = AF_INET;
 	client->src_ipaddr = client->ipaddr;
 
-	client->longname = client->shortname = inst->filename;
+	client->longname = client->shortname = inst->packet[0]->filename;
 	client->secret = talloc_strdup(client, "testing123");
 	client->nas_type = talloc_strdup(client, "load");
 	client->use_connected = false;
 
-	if (inst->filename) {
-		FILE *fp;
-		bool done = false;
-
-		fp = fopen(inst->filename, "r");
-		if (!fp) {
-			cf_log_err(cs, "Failed reading %s - %s",
-				   inst->filename, fr_syserror(errno));
-			return -1;
-		}
-
-		if (fr_pair_list_afrom_file(inst, inst->parent->dict, &inst->pair_list, fp, &done) < 0) {
-			cf_log_perr(cs, "Failed reading %s", inst->filename);
-			fclose(fp);
-			return -1;
-		}
-
-		fclose(fp);
+	if (fr_command_register_hook(NULL, cf_section_name2(inst->parent->server_cs), inst, cmd_load_step_table) < 0) {
+		cf_log_perr(cs, "Failed registering radmin commands for the load generator");
 	}
 
-	vp = fr_pair_find_by_da(&inst->pair_list, inst->parent->attr_packet_type, 0);
-	if (vp) inst->code = vp->vp_uint32;
-
 	return 0;
 }
 
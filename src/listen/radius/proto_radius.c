@@ -83,6 +83,18 @@ static CONF_PARSER const proto_radius_config[] = {
 	 */
 	{ FR_CONF_OFFSET("tunnel_password_zeros", FR_TYPE_BOOL, proto_radius_t, tunnel_password_zeros) } ,
 
+	/*
+	 *	Answer Status-Server in the network thread, without
+	 *	running "recv Status-Server".
+	 */
+	{ FR_CONF_OFFSET("status_server_fast_path", FR_TYPE_BOOL, proto_radius_t, status_server_fast_path) } ,
+
+	/*
+	 *	Cache encoded reply attributes, and copy them into
+	 *	replies with the same attributes.
+	 */
+	{ FR_CONF_OFFSET("encode_cache", FR_TYPE_BOOL, proto_radius_t, encode_cache) } ,
+
 	{ FR_CONF_POINTER("limit", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) limit_config },
 	{ FR_CONF_POINTER("priority", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) priority_config },
 
@@ -279,6 +291,14 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 				}
 			}
 		}
+
+	/*
+	 *	The request list now matches the packet.  So long as
+	 *	it isn't changed, modules can forward the packet data
+	 *	instead of encoding the list again.
+	 */
+	} else {
+		fr_pair_list_mark_clean(&request->request_pairs);
 	}
 
 	if (!inst->io.app_io->decode) return 0;
@@ -367,16 +387,38 @@ static ssize_t mod_encode(void const *instance, request_t *request, uint8_t *buf
 		request->reply->socket.inet.src_ipaddr = client->src_ipaddr;
 	}
 
-	data_len = fr_radius_encode(buffer, buffer_len, request->packet->data,
-				    client->secret, talloc_array_length(client->secret) - 1,
-				    request->reply->code, request->reply->id, &request->reply_pairs);
-	if (data_len < 0) {
-		RPEDEBUG("Failed encoding RADIUS reply");
-		return -1;
+	/*
+	 *	A module has left us the attributes of a reply it
+	 *	received, and the reply list hasn't been changed since
+	 *	it was decoded from them.  So just copy them.
+	 */
+	if (request->reply->data && (request->reply->data[0] == request->reply->code) &&
+	    (request->reply->data_len <= buffer_len) && !fr_pair_list_is_dirty(&request->reply_pairs)) {
+		data_len = request->reply->data_len;
+		memcpy(buffer, request->reply->data, data_len);
+		buffer[1] = request->reply->id;
+
+		RDEBUG3("Reply attributes are unchanged, copying them instead of encoding the reply");
+
+	} else {
+		if (inst->encode_cache) {
+			data_len = fr_radius_encode_cached(buffer, buffer_len, request->packet->data,
+							   client->secret, talloc_array_length(client->secret) - 1,
+							   request->reply->code, request->reply->id, &request->reply_pairs);
+		} else {
+			data_len = fr_radius_encode(buffer, buffer_len, request->packet->data,
+						    client->secret, talloc_array_length(client->secret) - 1,
+						    request->reply->code, request->reply->id, &request->reply_pairs);
+		}
+		if (data_len < 0) {
+			RPEDEBUG("Failed encoding RADIUS reply");
+			return -1;
+		}
 	}
 
-	if (fr_radius_sign(buffer, request->packet->data,
-			   (uint8_t const *) client->secret, talloc_array_length(client->secret) - 1) < 0) {
+	if (fr_radius_sign_hmac(buffer, request->packet->data,
+				(uint8_t const *) client->secret, talloc_array_length(client->secret) - 1,
+				client->secret_hmac) < 0) {
 		RPEDEBUG("Failed signing RADIUS reply");
 		return -1;
 	}
@@ -425,6 +467,53 @@ static int mod_priority_set(void const *instance, uint8_t const *buffer, UNUSED
 	return inst->priorities[buffer[0]];
 }
 
+/** Reply to Status-Server packets without using a worker
+ *
+ * The reply is an Access-Accept containing only a Message-Authenticator,
+ * which is the same as the default "recv Status-Server" section produces.
+ * It's built from a template, and signed with the client's secret.
+ */
+static ssize_t mod_reply(void const *instance, RADCLIENT const *client,
+			 uint8_t *packet, size_t packet_len, uint8_t *reply, size_t reply_len)
+{
+	proto_radius_t const	*inst = talloc_get_type_abort_const(instance, proto_radius_t);
+	size_t			len = packet_len;
+	decode_fail_t		reason;
+
+	static uint8_t const	status_server_reply[RADIUS_HEADER_LENGTH + 2 + RADIUS_AUTH_VECTOR_LENGTH] = {
+		FR_RADIUS_CODE_ACCESS_ACCEPT, 0x00, 0x00, sizeof(status_server_reply),
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		FR_MESSAGE_AUTHENTICATOR, 2 + RADIUS_AUTH_VECTOR_LENGTH,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+	};
+
+	if (!inst->status_server_fast_path || (packet[0] != FR_RADIUS_CODE_STATUS_SERVER)) return 0;
+
+	if (reply_len < sizeof(status_server_reply)) return 0;
+
+	/*
+	 *	RFC 5997 Section 3 - Status-Server packets without a
+	 *	valid Message-Authenticator are silently discarded.
+	 */
+	if (!fr_radius_ok(packet, &len, RADIUS_MAX_ATTRIBUTES, true, &reason)) {
+		fr_strerror_const("Status-Server has no Message-Authenticator");
+		return -1;
+	}
+
+	if (fr_radius_verify_hmac(packet, NULL, (uint8_t const *) client->secret,
+				  talloc_array_length(client->secret) - 1, client->secret_hmac) < 0) return -1;
+
+	memcpy(reply, status_server_reply, sizeof(status_server_reply));
+	reply[1] = packet[1];
+
+	if (fr_radius_sign_hmac(reply, packet, (uint8_t const *) client->secret,
+				talloc_array_length(client->secret) - 1, client->secret_hmac) < 0) return -1;
+
+	return sizeof(status_server_reply);
+}
+
 /** Open listen sockets/connect to external event source
  *
  * @param[in] instance	Ctx data for this application.
@@ -579,5 +668,6 @@ fr_app_t proto_radius = {
 	.open			= mod_open,
 	.decode			= mod_decode,
 	.encode			= mod_encode,
-	.priority		= mod_priority_set
+	.priority		= mod_priority_set,
+	.reply			= mod_reply
 };
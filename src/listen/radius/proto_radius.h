@@ -36,6 +36,8 @@ typedef struct {
 	uint32_t			num_messages;			//!< for message ring buffer.
 
 	bool				tunnel_password_zeros;		//!< check for trailing zeroes in Tunnel-Password.
+	bool				status_server_fast_path;	//!< answer Status-Server in the network thread.
+	bool				encode_cache;			//!< re-use encoded reply attributes.
 
 	uint32_t			priorities[FR_RADIUS_CODE_MAX];	//!< priorities for individual packets
 
@@ -43,6 +43,10 @@ typedef struct {
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+	uint8_t				*send_buff;		//!< replies queued by mod_write().
+	size_t				send_len;		//!< how much data is in send_buff.
+	size_t				send_size;		//!< how large send_buff is.
+
 	fr_stats_t			stats;			//!< statistics for this socket
 } proto_radius_tcp_thread_t;
 
@@ -59,6 +63,8 @@ typedef struct {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			write_batch;		//!< Maximum number of replies to write at once.
+
 	uint16_t			port;			//!< Port to listen on.
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a recv_buff
@@ -97,6 +103,8 @@ static const CONF_PARSER tcp_listen_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_radius_tcp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_radius_tcp_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
 
+	{ FR_CONF_OFFSET("write_batch", FR_TYPE_UINT32, proto_radius_tcp_t, write_batch), .dflt = "16" } ,
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -109,11 +117,28 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 	size_t				packet_len, in_buffer;
 	decode_fail_t			reason;
 
+	/*
+	 *	Clients which pipeline requests send many packets in
+	 *	one segment.  If the previous read left a complete
+	 *	packet in the buffer, return it without going back to
+	 *	the socket.
+	 */
+	in_buffer = *leftover;
+	if ((in_buffer >= RADIUS_HEADER_LENGTH) &&
+	    ((size_t) ((buffer[2] << 8) | buffer[3]) <= in_buffer)) goto check_packet;
+
 	/*
 	 *      Read data into the buffer.
 	 */
 	data_size = read(thread->sockfd, buffer + *leftover, buffer_len - *leftover);
 	if (data_size < 0) {
+		/*
+		 *	Nothing more to read, but there may be a
+		 *	partial packet in the buffer.  Keep it for
+		 *	the next read.
+		 */
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
 		PDEBUG2("proto_radius_tcp got read error %zd", data_size);
 		return data_size;
 	}
@@ -132,6 +157,9 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 		return -1;
 	}
 
+	in_buffer = data_size + *leftover;
+
+check_packet:
 	/*
 	 *	We MUST always start with a known RADIUS packet.
 	 */
@@ -141,12 +169,10 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 		return -1;
 	}
 
-	in_buffer = data_size + *leftover;
-
 	/*
 	 *	Not enough for one packet.  Tell the caller that we need to read more.
 	 */
-	if (in_buffer < 20) {
+	if (in_buffer < RADIUS_HEADER_LENGTH) {
 		*leftover = in_buffer;
 		return 0;
 	}
@@ -156,6 +182,17 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 	 */
 	packet_len = (buffer[2] << 8) | buffer[3];
 
+	/*
+	 *	A length which can never fit into the buffer means
+	 *	the stream is corrupt.  We would otherwise wait
+	 *	forever for the rest of the packet.
+	 */
+	if ((packet_len < RADIUS_HEADER_LENGTH) || (packet_len > buffer_len)) {
+		DEBUG("proto_radius_tcp got invalid packet length %zu", packet_len);
+		thread->stats.total_malformed_requests++;
+		return -1;
+	}
+
 	/*
 	 *	We don't have a complete RADIUS packet.  Tell the
 	 *	caller that we need to read more.
@@ -166,12 +203,12 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 	}
 
 	/*
-	 *	We've read more than one packet.  Tell the caller that
-	 *	there's more data available, and return only one packet.
+	 *	We may have read more than one packet.  Tell the
+	 *	caller how much data is left over, and return only one
+	 *	packet.  The network side feeds the remainder back to
+	 *	us, and we return each complete packet in turn.
 	 */
-	if (in_buffer > packet_len) {
-		*leftover = in_buffer - packet_len;
-	}
+	*leftover = in_buffer - packet_len;
 
 	/*
 	 *      If it's not a RADIUS packet, ignore it.
@@ -203,6 +240,49 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 }
 
 
+/** Write all of the replies queued by mod_write()
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.  errno is EWOULDBLOCK if the socket couldn't
+ *	  take all of the data, and the rest is still queued.
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	proto_radius_tcp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_tcp_thread_t);
+	size_t				sent = 0;
+	ssize_t				data_size;
+
+	while (sent < thread->send_len) {
+		data_size = write(thread->sockfd, thread->send_buff + sent, thread->send_len - sent);
+		if (data_size < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) break;
+
+			fr_strerror_printf("proto_radius_tcp failed writing replies: %s", fr_syserror(errno));
+			thread->send_len = 0;
+			return -1;
+		}
+		if (data_size == 0) break;
+
+		sent += data_size;
+	}
+
+	/*
+	 *	Keep the rest for when the socket becomes writable.
+	 */
+	if (sent < thread->send_len) {
+		memmove(thread->send_buff, thread->send_buff + sent, thread->send_len - sent);
+		thread->send_len -= sent;
+		errno = EWOULDBLOCK;
+		return -1;
+	}
+
+	thread->send_len = 0;
+	return 0;
+}
+
+
 static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t request_time,
 			 uint8_t *buffer, size_t buffer_len, size_t written)
 {
@@ -237,6 +317,31 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	fr_assert(buffer_len >= 20);
 	fr_assert(written < buffer_len);
 
+	/*
+	 *	The reply is copied, and written by mod_flush() once
+	 *	the network side has processed all of the replies it
+	 *	has.  If the queue is full, and the socket can't take
+	 *	it, the network side tries again when the socket
+	 *	becomes writable.
+	 */
+	if (thread->send_buff && !written && (buffer_len <= thread->send_size)) {
+		if (((thread->send_len + buffer_len) > thread->send_size) && (mod_flush(li) < 0)) return -1;
+
+		if ((thread->send_len + buffer_len) > thread->send_size) {
+			errno = EWOULDBLOCK;
+			return -1;
+		}
+
+		memcpy(thread->send_buff + thread->send_len, buffer, buffer_len);
+		thread->send_len += buffer_len;
+		return buffer_len;
+	}
+
+	/*
+	 *	Don't re-order replies which are still queued.
+	 */
+	if (thread->send_len && (mod_flush(li) < 0)) return -1;
+
 	/*
 	 *	Only write replies if they're RADIUS packets.
 	 *	sometimes we want to NOT send a reply...
@@ -337,6 +442,19 @@ static int mod_fd_set(fr_listen_t *li, int fd)
 
 	thread->sockfd = fd;
 
+	/*
+	 *	Replies to pipelined requests are queued, and written
+	 *	to the connection with one system call.
+	 */
+	if (inst->write_batch > 1) {
+		thread->send_size = (size_t) inst->max_packet_size * inst->write_batch;
+		thread->send_buff = talloc_array(thread, uint8_t, thread->send_size);
+		if (!thread->send_buff) {
+			PERROR("Failed allocating reply buffer");
+			return -1;
+		}
+	}
+
 	thread->name = fr_app_io_socket_name(thread, &proto_radius_tcp,
 					     &thread->connection->socket.inet.src_ipaddr, thread->connection->socket.inet.src_port,
 					     &inst->ipaddr, inst->port,
@@ -407,6 +525,9 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("write_batch", inst->write_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("write_batch", inst->write_batch, <=, 1024);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -593,6 +714,7 @@ fr_app_io_t proto_radius_tcp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.compare		= mod_compare,
 	.connection_set		= mod_connection_set,
@@ -44,6 +44,9 @@ typedef struct {
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+	udp_batch_t			*batch;			//!< packets read with recvmmsg().
+	udp_send_batch_t		*send_batch;		//!< replies written with sendmmsg().
+
 	fr_stats_t			stats;			//!< statistics for this socket
 } proto_radius_udp_thread_t;
 
@@ -61,11 +64,16 @@ typedef struct {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			read_batch;		//!< Maximum number of packets to read at once.
+	uint32_t			write_batch;		//!< Maximum number of replies to write at once.
+
 	uint16_t			port;			//!< Port to listen on.
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a recv_buff
 	bool				send_buff_is_set;	//!< Whether we were provided with a send_buff
 	bool				dynamic_clients;	//!< whether we have dynamic clients
+	bool				reuseport_cpu_steering;	//!< steer packets to the socket in the reuseport
+								//!< group matching the receiving CPU.
 	bool				dedup_authenticator;	//!< dedup using the request authenticator
 
 	RADCLIENT_LIST			*clients;		//!< local clients
@@ -98,11 +106,15 @@ static const CONF_PARSER udp_listen_config[] = {
 	{ FR_CONF_OFFSET_IS_SET("send_buff", FR_TYPE_UINT32, proto_radius_udp_t, send_buff) },
 
 	{ FR_CONF_OFFSET("accept_conflicting_packets", FR_TYPE_BOOL, proto_radius_udp_t, dedup_authenticator) } ,
+	{ FR_CONF_OFFSET("reuseport_cpu_steering", FR_TYPE_BOOL, proto_radius_udp_t, reuseport_cpu_steering) } ,
+
 	{ FR_CONF_OFFSET("dynamic_clients", FR_TYPE_BOOL, proto_radius_udp_t, dynamic_clients) } ,
 	{ FR_CONF_POINTER("networks", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_radius_udp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_radius_udp_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
+	{ FR_CONF_OFFSET("read_batch", FR_TYPE_UINT32, proto_radius_udp_t, read_batch), .dflt = "16" } ,
+	{ FR_CONF_OFFSET("write_batch", FR_TYPE_UINT32, proto_radius_udp_t, write_batch), .dflt = "16" } ,
 
 	CONF_PARSER_TERMINATOR
 };
@@ -134,7 +146,11 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	if (thread->batch) {
+		data_size = udp_batch_recv(thread->batch, &address->socket, buffer, buffer_len, recv_time_p);
+	} else {
+		data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	}
 	if (data_size < 0) {
 		PDEBUG2("proto_radius_udp got read error");
 		return data_size;
@@ -235,7 +251,11 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 
 			memcpy(&packet, &track->reply, sizeof(packet)); /* const issues */
 
-			(void) udp_send(&socket, flags, packet, track->reply_len);
+			if (thread->send_batch) {
+				(void) udp_send_batch_add(thread->send_batch, &socket, packet, track->reply_len);
+			} else {
+				(void) udp_send(&socket, flags, packet, track->reply_len);
+			}
 		}
 
 		return buffer_len;
@@ -250,7 +270,17 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	 *	Only write replies if they're RADIUS packets.
 	 *	sometimes we want to NOT send a reply...
 	 */
-	data_size = udp_send(&socket, flags, buffer, buffer_len);
+	if (thread->send_batch) {
+		/*
+		 *	The reply is copied, and written by
+		 *	mod_flush() once the network side has
+		 *	processed all of the replies it has.
+		 */
+		if (udp_send_batch_add(thread->send_batch, &socket, buffer, buffer_len) < 0) return -1;
+		data_size = buffer_len;
+	} else {
+		data_size = udp_send(&socket, flags, buffer, buffer_len);
+	}
 
 	/*
 	 *	This socket is dead.  That's an error...
@@ -269,6 +299,18 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 }
 
 
+/** Write all of the replies queued by mod_write()
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+
+	if (!thread->send_batch) return 0;
+
+	return udp_send_batch_flush(thread->send_batch);
+}
+
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
 	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
@@ -349,8 +391,44 @@ static int mod_open(fr_listen_t *li)
 		goto error;
 	}
 
+	/*
+	 *	Each socket bound to this address with SO_REUSEPORT
+	 *	gets the packets received on the CPU matching its
+	 *	position in the group, so clients stay pinned to one
+	 *	reader.
+	 */
+	if (inst->reuseport_cpu_steering && (fr_socket_reuseport_cpu_steer(sockfd) < 0)) {
+		close(sockfd);
+		PERROR("Failed setting 'reuseport_cpu_steering'");
+		goto error;
+	}
+
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Read many packets with one system call.  Connected
+	 *	sockets are opened via mod_fd_set(), and don't use
+	 *	batching.
+	 */
+	if (inst->read_batch > 1) {
+		thread->batch = udp_batch_alloc(thread, sockfd, inst->read_batch, inst->max_packet_size);
+		if (!thread->batch) {
+			close(sockfd);
+			PERROR("Failed allocating receive batch");
+			goto error;
+		}
+		li->read_batch = inst->read_batch;
+	}
+
+	if (inst->write_batch > 1) {
+		thread->send_batch = udp_send_batch_alloc(thread, sockfd, inst->write_batch, inst->max_packet_size);
+		if (!thread->send_batch) {
+			close(sockfd);
+			PERROR("Failed allocating send batch");
+			goto error;
+		}
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_radius_udp,
@@ -414,6 +492,21 @@ static int mod_compare(void const *instance, UNUSED void *thread_instance, UNUSE
 	return (a[0] < b[0]) - (a[0] > b[0]);
 }
 
+static uint32_t mod_hash(void const *instance, void const *packet)
+{
+	proto_radius_udp_t const *inst = talloc_get_type_abort_const(instance, proto_radius_udp_t);
+	uint8_t const *p = packet;
+	uint32_t hash;
+
+	/*
+	 *	Hash the same fields which mod_compare() checks.
+	 */
+	hash = fr_hash(p, 2);
+	if (!inst->dedup_authenticator) return hash;
+
+	return fr_hash_update(p + 4, RADIUS_AUTH_VECTOR_LENGTH, hash);
+}
+
 
 static char const *mod_name(fr_listen_t *li)
 {
@@ -453,6 +546,12 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("read_batch", inst->read_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("read_batch", inst->read_batch, <=, 1024);
+
+	FR_INTEGER_BOUND_CHECK("write_batch", inst->write_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("write_batch", inst->write_batch, <=, 1024);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -542,9 +641,11 @@ fr_app_io_t proto_radius_udp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.track			= mod_track_create,
 	.compare		= mod_compare,
+	.hash			= mod_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
@@ -76,11 +76,13 @@ fr_dict_autoload_t proto_tacacs_dict[] = {
 
 static fr_dict_attr_t const *attr_packet_type;
 static fr_dict_attr_t const *attr_tacacs_user_name;
+static fr_dict_attr_t const *attr_tacacs_authentication_status;
 
 extern fr_dict_attr_autoload_t proto_tacacs_dict_attr[];
 fr_dict_attr_autoload_t proto_tacacs_dict_attr[] = {
 	{ .out = &attr_packet_type, .name = "Packet-Type", .type = FR_TYPE_UINT32, .dict = &dict_tacacs},
 	{ .out = &attr_tacacs_user_name, .name = "User-Name", .type = FR_TYPE_STRING, .dict = &dict_tacacs },
+	{ .out = &attr_tacacs_authentication_status, .name = "Authentication-Status", .type = FR_TYPE_UINT8, .dict = &dict_tacacs },
 	{ NULL }
 };
 
@@ -304,7 +306,7 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 		    ((pkt->hdr.flags & FR_FLAGS_VALUE_UNENCRYPTED) == 0) &&
 		    RDEBUG_ENABLED2 &&
 		    ((vp = fr_pair_find_by_da(&request->request_pairs, attr_tacacs_user_name, 0)) != NULL) &&
-		    (fr_utf8_str((uint8_t const *) vp->vp_strvalue, vp->vp_length) < 0)) {
+		    (fr_utf8_str((uint8_t const *) vp->vp_strvalue, vp->vp_length) != (ssize_t)vp->vp_length)) {
 			RWDEBUG("Unprintable characters in the %s. "
 				"Double-check the shared secret on the server "
 				"and the TACACS+ Client!", attr_tacacs_user_name->name);
@@ -369,6 +371,32 @@ static ssize_t mod_encode(void const *instance, request_t *request, uint8_t *buf
 		return sizeof(new_client);
 	}
 
+	/*
+	 *	Tell the transport whether or not this reply ends the
+	 *	session.  Authorization and accounting are one packet
+	 *	each way.  Authentication is done only when the status
+	 *	says so.
+	 */
+	if (track->packet) {
+		proto_tacacs_track_t *tracking = talloc_get_type_abort(track->packet, proto_tacacs_track_t);
+		fr_pair_t *vp;
+
+		switch (request->reply->code) {
+		case FR_PACKET_TYPE_VALUE_AUTHENTICATION_START_REPLY:
+		case FR_PACKET_TYPE_VALUE_AUTHENTICATION_CONTINUE_REPLY:
+			vp = fr_pair_find_by_da(&request->reply_pairs, attr_tacacs_authentication_status, 0);
+			tracking->finished = !vp ||
+					     ((vp->vp_uint8 != FR_TAC_PLUS_AUTHEN_STATUS_GETDATA) &&
+					      (vp->vp_uint8 != FR_TAC_PLUS_AUTHEN_STATUS_GETUSER) &&
+					      (vp->vp_uint8 != FR_TAC_PLUS_AUTHEN_STATUS_GETPASS));
+			break;
+
+		default:
+			tracking->finished = true;
+			break;
+		}
+	}
+
 	/*
 	 *	If the app_io encodes the packet, then we don't need
 	 *	to do that.
@@ -46,5 +46,8 @@ typedef struct {
  */
 typedef struct {
 	uint8_t		type;
+	uint8_t		seq_no;				//!< so that each step of a session is tracked separately
 	uint32_t	session_id;
+
+	bool		finished;			//!< the reply ends the session
 } proto_tacacs_track_t;
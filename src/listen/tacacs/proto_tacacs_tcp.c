@@ -112,14 +112,34 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 {
 	// proto_tacacs_tcp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_tacacs_tcp_t);
 	proto_tacacs_tcp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_tacacs_tcp_thread_t);
-	ssize_t				data_size;
-	size_t				packet_len, in_buffer;
+	ssize_t				data_size, packet_len;
+	size_t				in_buffer;
+
+	/*
+	 *	A multiplexed connection can have many packets sitting
+	 *	in the buffer from one read.  If there's already a
+	 *	complete packet there, return it without reading more
+	 *	data.  The socket is probably empty, and read() would
+	 *	just return EAGAIN.
+	 */
+	if (*leftover) {
+		packet_len = fr_tacacs_length(buffer, *leftover);
+		if (packet_len < 0) goto invalid;
+
+		if ((size_t) packet_len <= *leftover) {
+			in_buffer = *leftover;
+			*leftover = 0;
+			goto have_packet;
+		}
+	}
 
 	/*
 	 *      Read data into the buffer.
 	 */
 	data_size = read(thread->sockfd, buffer + *leftover, buffer_len - *leftover);
 	if (data_size < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return 0;
+
 		PDEBUG2("proto_tacacs_tcp got read error %zd", data_size);
 		return data_size;
 	}
@@ -145,16 +165,23 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 	 *	caller that we need to read more.
 	 */
 	packet_len = fr_tacacs_length(buffer, in_buffer);
-	if (in_buffer < packet_len) {
+	if (packet_len < 0) {
+	invalid:
+		PERROR("proto_tacacs_tcp - Invalid TACACS+ packet");
+		return -1;
+	}
+
+	if (in_buffer < (size_t) packet_len) {
 		*leftover = in_buffer;
 		return 0;
 	}
 
+have_packet:
 	/*
 	 *	We've read more than one packet.  Tell the caller that
 	 *	there's more data available, and return only one packet.
 	 */
-	if (in_buffer > packet_len) {
+	if (in_buffer > (size_t) packet_len) {
 		*leftover = in_buffer - packet_len;
 	}
 
@@ -188,10 +215,12 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 	return packet_len;
 }
 
-static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, UNUSED fr_time_t request_time,
+static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t request_time,
 			 uint8_t *buffer, size_t buffer_len, size_t written)
 {
 	proto_tacacs_tcp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_tacacs_tcp_thread_t);
+	fr_io_track_t const		*track = talloc_get_type_abort_const(packet_ctx, fr_io_track_t);
+	proto_tacacs_track_t const	*tracking = talloc_get_type_abort_const(track->packet, proto_tacacs_track_t);
 	ssize_t				data_size;
 	fr_tacacs_packet_t		*pkt;
 
@@ -224,14 +253,13 @@ static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, UNUSED fr_tim
 
 	/*
 	 *	If the "use single connection" flag is clear, then we
-	 *	are only doing a single session.  In which case,
-	 *	return 0, which tells the caller to close the socket.
+	 *	are only doing a single session.  Once that session
+	 *	is finished, return 0, which tells the caller to close
+	 *	the socket.  Replies which ask for more data leave the
+	 *	connection open for the next Authentication-Continue.
 	 */
 	if (((pkt->hdr.flags & FR_FLAGS_VALUE_SINGLE_CONNECT) == 0) &&
-	    (data_size + written) >= buffer_len) {
-		// @todo - check status for pass / fail / error, which
-		// cause the connection to be closed.  Everything else
-		// leaves it open.
+	    ((data_size + written) >= buffer_len) && tracking->finished) {
 		return 0;
 	}
 
@@ -353,6 +381,7 @@ static void *mod_track_create(TALLOC_CTX *ctx, uint8_t const *buffer, UNUSED siz
 	}
 
 	track->session_id = pkt->hdr.session_id;
+	track->seq_no = pkt->hdr.seq_no;
 
 	return track;
 }
@@ -373,7 +402,15 @@ static int mod_compare(UNUSED void const *instance, UNUSED void *thread_instance
 	/*
 	 *	Then ordered by our synthetic packet type.
 	 */
-	return (a->type < b->type) - (a->type > b->type);
+	ret = (a->type < b->type) - (a->type > b->type);
+	if (ret != 0) return ret;
+
+	/*
+	 *	Each Authentication-Continue in a session has a new
+	 *	seq_no.  It's a new packet, not a duplicate of the
+	 *	previous one.
+	 */
+	return (a->seq_no < b->seq_no) - (a->seq_no > b->seq_no);
 }
 
 static char const *mod_name(fr_listen_t *li)
@@ -66,6 +66,8 @@ typedef struct {
 	bool				recv_buff_is_set;	//!< Whether we were provided with a receive
 								//!< buffer value.
 	bool				dynamic_clients;	//!< whether we have dynamic clients
+	bool				reuseport_cpu_steering;	//!< steer packets to the socket in the reuseport
+								//!< group matching the receiving CPU.
 
 	fr_trie_t			*trie;			//!< for parsed networks
 	fr_ipaddr_t			*allow;			//!< allowed networks for dynamic clients
@@ -94,6 +96,8 @@ static const CONF_PARSER udp_listen_config[] = {
 	{ FR_CONF_OFFSET("port", FR_TYPE_UINT16, proto_vmps_udp_t, port) },
 	{ FR_CONF_OFFSET_IS_SET("recv_buff", FR_TYPE_UINT32, proto_vmps_udp_t, recv_buff) },
 
+	{ FR_CONF_OFFSET("reuseport_cpu_steering", FR_TYPE_BOOL, proto_vmps_udp_t, reuseport_cpu_steering) } ,
+
 	{ FR_CONF_OFFSET("dynamic_clients", FR_TYPE_BOOL, proto_vmps_udp_t, dynamic_clients) } ,
 	{ FR_CONF_POINTER("networks", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
@@ -318,6 +322,18 @@ static int mod_open(fr_listen_t *li)
 		goto error;
 	}
 
+	/*
+	 *	Each socket bound to this address with SO_REUSEPORT
+	 *	gets the packets received on the CPU matching its
+	 *	position in the group, so clients stay pinned to one
+	 *	reader.
+	 */
+	if (inst->reuseport_cpu_steering && (fr_socket_reuseport_cpu_steer(sockfd) < 0)) {
+		close(sockfd);
+		PERROR("Failed setting 'reuseport_cpu_steering'");
+		goto error;
+	}
+
 	thread->sockfd = sockfd;
 
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
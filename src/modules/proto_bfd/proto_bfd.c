@@ -29,14 +29,24 @@
 
 #include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/base16.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/sha1.h>
 #include <freeradius-devel/util/socket.h>
 #include <freeradius-devel/util/time.h>
+#include <freeradius-devel/util/udp.h>
 
 #define BFD_MAX_SECRET_LENGTH 20
 
+/** Maximum number of control packets written with one sendmmsg call
+ *
+ * Periodic packets for many sessions often become due in the same
+ * timer wheel tick.  They're queued, and written together once the
+ * timers for that tick have run.
+ */
+#define BFD_SEND_BATCH_MAX 64
+
 typedef enum bfd_session_state_t {
 	BFD_STATE_ADMIN_DOWN = 0,
 	BFD_STATE_DOWN,
@@ -68,11 +78,13 @@ typedef enum bfd_auth_type_t {
 #define BFD_AUTH_INVALID (BFD_AUTH_MET_KEYED_SHA1 + 1)
 
 typedef struct {
-	fr_rb_node_t	node;		//!< Entry in the tree of sessions.
+	fr_rb_node_t	node;		//!< Entry in the tree of sessions, by peer address.
 
 	int		number;
 
 	fr_socket_t socket;
+	udp_send_batch_t *batch;	//!< Queue of control packets to write, or NULL to
+					///< write each packet as it's sent.
 
 	fr_event_list_t *el;
 	CONF_SECTION	*server_cs;
@@ -228,7 +240,10 @@ typedef struct {
 	uint8_t		secret[BFD_MAX_SECRET_LENGTH];
 	size_t		secret_len;
 
-	fr_rb_tree_t	*session_tree;
+	fr_rb_tree_t	*session_tree;	//!< Sessions, by peer address.
+	fr_hash_table_t	*disc_table;	//!< Sessions, by local discriminator.
+
+	udp_send_batch_t *batch;	//!< Control packets waiting to be written.
 } bfd_socket_t;
 
 static fr_dict_t const *dict_bfd;
@@ -485,7 +500,15 @@ static bfd_state_t *bfd_new_session(bfd_socket_t *sock, int sockfd,
 	session->session_state = BFD_STATE_DOWN;
 	session->server_cs = sock->server_cs;
 	session->unlang = sock->unlang;
-	session->local_disc = fr_rand();
+
+	/*
+	 *	Packets from the peer are found by the discriminator
+	 *	we chose, so it has to be unique.
+	 */
+	do {
+		session->local_disc = fr_rand();
+	} while ((session->local_disc == 0) || fr_hash_table_find(sock->disc_table, session));
+
 	session->remote_disc = 0;
 	session->local_diag = BFD_DIAG_NONE;
 	session->desired_min_tx_interval = sock->min_tx_interval * 1000;
@@ -583,12 +606,20 @@ static bfd_state_t *bfd_new_session(bfd_socket_t *sock, int sockfd,
 
 	session->socket.inet.src_ipaddr = sock->my_ipaddr;
 	session->socket.inet.src_port = sock->my_port;
+	session->socket.proto = IPPROTO_UDP;
 
 	fr_ipaddr_to_sockaddr(&session->remote_sockaddr, &session->salen,
 			      ipaddr, port);
 
+	if (!fr_hash_table_insert(sock->disc_table, session)) {
+		ERROR("FAILED creating new session!");
+		talloc_free(session);
+		return NULL;
+	}
+
 	if (!fr_rb_insert(sock->session_tree, session)) {
 		ERROR("FAILED creating new session!");
+		fr_hash_table_delete(sock->disc_table, session);
 		talloc_free(session);
 		return NULL;
 	}
@@ -600,6 +631,7 @@ static bfd_state_t *bfd_new_session(bfd_socket_t *sock, int sockfd,
 	 */
 	if (event_list) {
 		session->el = event_list;
+		session->batch = sock->batch;
 
 		bfd_start_control(session);
 
@@ -607,6 +639,7 @@ static bfd_state_t *bfd_new_session(bfd_socket_t *sock, int sockfd,
 		session->pthread_id = pthread_self();
 	} else {
 		if (!bfd_pthread_create(session)) {
+			fr_hash_table_delete(sock->disc_table, session);
 			fr_rb_delete(sock->session_tree, session);
 			talloc_free(session);
 			return NULL;
@@ -873,6 +906,34 @@ static void bfd_sign(bfd_state_t *session, bfd_packet_t *bfd)
 }
 
 
+/*
+ *	Write a packet, or queue it to be written with the
+ *	other packets which are due in this timer tick.
+ */
+static int bfd_write(bfd_state_t *session, bfd_packet_t const *bfd)
+{
+	if (session->batch) return udp_send_batch_add(session->batch, &session->socket, bfd, bfd->length);
+
+	if (sendto(session->socket.fd, bfd, bfd->length, 0,
+		   (struct sockaddr *) &session->remote_sockaddr,
+		   session->salen) < 0) {
+		fr_strerror_printf("%s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ *	Write all of the packets queued by the timers.
+ */
+static void bfd_flush(UNUSED fr_event_list_t *eel, UNUSED fr_time_t now, void *ctx)
+{
+	bfd_socket_t *sock = ctx;
+
+	if (udp_send_batch_flush(sock->batch) < 0) PERROR("Failed sending packets");
+}
+
 /*
  *	Send a packet.
  */
@@ -895,11 +956,7 @@ static void bfd_send_packet(UNUSED fr_event_list_t *eel, UNUSED fr_time_t now, v
 
 	DEBUG("BFD %d sending packet state %s",
 	      session->number, bfd_state[session->session_state]);
-	if (sendto(session->socket.fd, &bfd, bfd.length, 0,
-		   (struct sockaddr *) &session->remote_sockaddr,
-		   session->salen) < 0) {
-		ERROR("Failed sending packet: %s", fr_syserror(errno));
-	}
+	if (bfd_write(session, &bfd) < 0) PERROR("Failed sending packet");
 }
 
 static int bfd_start_packets(bfd_state_t *session)
@@ -935,9 +992,15 @@ static int bfd_start_packets(bfd_state_t *session)
 	interval = base;
 	interval += jitter;
 
-	if (fr_event_timer_in(session, session->el, &session->ev_packet,
-			      fr_time_delta_from_usec(interval),
-			      bfd_send_packet, session) < 0) {
+	/*
+	 *	The interval is already jittered by up to 25%, so a
+	 *	wheel tick either way doesn't matter.  Coarse timers
+	 *	are O(1) to insert, which matters with thousands of
+	 *	sessions.
+	 */
+	if (fr_event_timer_coarse_in(session, session->el, &session->ev_packet,
+				     fr_time_delta_from_usec(interval),
+				     bfd_send_packet, session) < 0) {
 		fr_assert("Failed to insert event" == NULL);
 	}
 
@@ -963,8 +1026,8 @@ static void bfd_set_timeout(bfd_state_t *session, fr_time_t when)
 		session->next_recv += fr_time_delta_from_usec(delay);
 	}
 
-	if (fr_event_timer_at(session, session->el, &session->ev_timeout,
-			      now, bfd_detection_timeout, session) < 0) {
+	if (fr_event_timer_coarse_at(session, session->el, &session->ev_timeout,
+				     now, bfd_detection_timeout, session) < 0) {
 		fr_assert("Failed to insert event" == NULL);
 	}
 }
@@ -1139,11 +1202,7 @@ static void bfd_poll_response(bfd_state_t *session)
 
 	bfd_sign(session, &bfd);
 
-	if (sendto(session->socket.fd, &bfd, bfd.length, 0,
-		   (struct sockaddr *) &session->remote_sockaddr,
-		   session->salen) < 0) {
-		ERROR("Failed sending poll response: %s", fr_syserror(errno));
-	}
+	if (bfd_write(session, &bfd) < 0) PERROR("Failed sending poll response");
 }
 
 
@@ -1482,16 +1541,33 @@ static int bfd_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
-	/*
-	 *	We SHOULD use "your_disc", but what the heck.
-	 */
 	fr_ipaddr_from_sockaddr(&my_session.socket.inet.dst_ipaddr,
 				&my_session.socket.inet.dst_port, &src, sizeof_src);
 
-	session = fr_rb_find(sock->session_tree, &my_session);
-	if (!session) {
-		DEBUG("BFD unknown peer");
-		return 0;
+	/*
+	 *	Once the peer knows our discriminator, the session
+	 *	is found using it (RFC 5880 Section 6.8.6).  Until
+	 *	then, the session is found by the peer address.
+	 */
+	if (bfd.your_disc != 0) {
+		my_session.local_disc = bfd.your_disc;
+
+		session = fr_hash_table_find(sock->disc_table, &my_session);
+		if (!session) {
+			DEBUG("BFD packet has unknown your-disc");
+			return 0;
+		}
+
+		if (fr_ipaddr_cmp(&session->socket.inet.dst_ipaddr, &my_session.socket.inet.dst_ipaddr) != 0) {
+			DEBUG("BFD %d packet is from the wrong peer", session->number);
+			return 0;
+		}
+	} else {
+		session = fr_rb_find(sock->session_tree, &my_session);
+		if (!session) {
+			DEBUG("BFD unknown peer");
+			return 0;
+		}
 	}
 
 	if (!event_list) {
@@ -1633,6 +1709,20 @@ static int8_t bfd_session_cmp(const void *one, const void *two)
 	return fr_ipaddr_cmp(&a->socket.inet.dst_ipaddr, &b->socket.inet.dst_ipaddr);
 }
 
+static uint32_t bfd_disc_hash(void const *data)
+{
+	bfd_state_t const *session = data;
+
+	return fr_hash(&session->local_disc, sizeof(session->local_disc));
+}
+
+static int8_t bfd_disc_cmp(void const *one, void const *two)
+{
+	bfd_state_t const *a = one, *b = two;
+
+	return CMP(a->local_disc, b->local_disc);
+}
+
 static fr_table_num_sorted_t const auth_types[] = {
 	{ L("keyed-md5"),		BFD_AUTH_KEYED_MD5	},
 	{ L("keyed-sha1"),		BFD_AUTH_KEYED_SHA1	},
@@ -1721,6 +1811,15 @@ static int bfd_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
 		return -1;
 	}
 
+	/*
+	 *	The tree owns the sessions.
+	 */
+	sock->disc_table = fr_hash_table_talloc_alloc(sock, bfd_state_t, bfd_disc_hash, bfd_disc_cmp, NULL);
+	if (!sock->disc_table) {
+		ERROR("Failed creating session table!");
+		return -1;
+	}
+
 	/*
 	 *	Find the sibling "bfd" section of the "listen" section.
 	 */
@@ -1761,6 +1860,26 @@ static int bfd_socket_open(CONF_SECTION *cs, rad_listen_t *this)
 		return -1;
 	}
 
+	/*
+	 *	When all of the sessions share one event list, their
+	 *	periodic packets are written in batches, once per
+	 *	loop.  Threaded sessions write their own packets.
+	 */
+	if (event_list) {
+		sock->batch = udp_send_batch_alloc(sock, this->fd, BFD_SEND_BATCH_MAX, sizeof(bfd_packet_t));
+		if (!sock->batch) {
+			PERROR("Failed allocating send batch");
+			close(this->fd);
+			return -1;
+		}
+
+		if (fr_event_post_insert(event_list, bfd_flush, sock) < 0) {
+			PERROR("Failed inserting post-processing callback");
+			close(this->fd);
+			return -1;
+		}
+	}
+
 	/*
 	 *	Bootstrap the initial set of connections.
 	 */
@@ -52,6 +52,9 @@ typedef struct {
 
 	fr_event_timer_t const		*conn_retry_ev;		//!< When to retry re-establishing the conn.
 
+	fr_event_timer_t const		*drain_ev;		//!< When to process the rest of the messages
+								//!< we didn't get to on the last read.
+
 	/*
 	 *	Connection
 	 */
@@ -74,6 +77,9 @@ typedef struct {
 	fr_time_delta_t			conn_retry_interval;	//!< How long to wait before trying to re-establish
 								//!< a connection.
 
+	uint32_t			messages_per_read;	//!< Maximum number of LDAP messages to process
+								//!< before going back to the event loop.
+
 	/*
 	 *	Global config
 	 */
@@ -123,6 +129,8 @@ static CONF_PARSER ldap_sync_search_config[] = {
 
 	{ FR_CONF_OFFSET("allow_refresh", FR_TYPE_BOOL, sync_config_t, allow_refresh), .dflt = "no" },
 
+	{ FR_CONF_OFFSET("cookie_interval", FR_TYPE_UINT32, sync_config_t, cookie_interval), .dflt = "100" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -183,6 +191,8 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("sync_retry_interval", FR_TYPE_TIME_DELTA, proto_ldap_inst_t, sync_retry_interval), .dflt = "5" },
 	{ FR_CONF_OFFSET("conn_retry_interval", FR_TYPE_TIME_DELTA, proto_ldap_inst_t, conn_retry_interval), .dflt = "5" },
 
+	{ FR_CONF_OFFSET("messages_per_read", FR_TYPE_UINT32, proto_ldap_inst_t, messages_per_read), .dflt = "256" },
+
 	/*
 	 *	Areas of the DIT to listen on
 	 */
@@ -901,6 +911,24 @@ finish:
  *	- 1 on success.
  *	- 0 on failure.
  */
+static int proto_ldap_socket_recv(rad_listen_t *listen);
+
+/** Process messages left over from the last call to proto_ldap_socket_recv
+ *
+ * libldap may already have read them from the socket, in which case the
+ * FD won't become readable again until the server sends more.
+ *
+ * @param[in] el	the event list managing listen event.
+ * @param[in] now	current time.
+ * @param[in] user_ctx	Listener.
+ */
+static void proto_ldap_socket_drain(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *user_ctx)
+{
+	rad_listen_t		*listen = talloc_get_type_abort(user_ctx, rad_listen_t);
+
+	(void) proto_ldap_socket_recv(listen);
+}
+
 static int proto_ldap_socket_recv(rad_listen_t *listen)
 {
 	proto_ldap_inst_t	*inst = talloc_get_type_abort(listen->data, proto_ldap_inst_t);
@@ -914,10 +942,22 @@ static int proto_ldap_socket_recv(rad_listen_t *listen)
 	 *
 	 *	Multiple requests may be created from one call to sync_demux.
 	 */
- 	switch (sync_demux(&sync_id, inst->conn)) {
+ 	switch (sync_demux(&sync_id, inst->conn, inst->messages_per_read)) {
  	default:
 		return 1;
 
+	/*
+	 *	There may be more messages waiting.  Go back to the
+	 *	event loop so other work can get done, and come back
+	 *	for the rest.
+	 */
+	case 1:
+		if (fr_event_timer_in(inst, inst->el, &inst->drain_ev, 0,
+				      proto_ldap_socket_drain, listen) < 0) {
+			FATAL("Failed inserting event: %s", fr_strerror());
+		}
+		return 1;
+
  	case -1:
 		PERROR("Sync failed - will retry in %pV seconds", fr_box_time_delta(inst->sync_retry_interval));
 
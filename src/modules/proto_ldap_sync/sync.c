@@ -46,6 +46,10 @@ struct sync_state_s {
 	int				msgid;			//!< The unique identifier for this sync session.
 
 	uint8_t				*cookie;		//!< Opaque cookie, used to resume synchronisation.
+	bool				cookie_pending;		//!< We have a cookie which hasn't been passed
+								//!< to the cookie callback yet.
+	uint32_t			changes;		//!< Entries received since the cookie callback
+								//!< was last called.
 
 	sync_phases_t			phase;
 };
@@ -122,7 +126,7 @@ static int sync_new_cookie(bool *new_cookie, sync_state_t *sync, BerElement *ber
 	if (sync->cookie) {
 		if (talloc_array_length(sync->cookie) == cookie.bv_len) {
 			cookie_len = talloc_array_length(sync->cookie);
-			if (memcmp(sync->cookie, cookie.bv_val, cookie.bv_len)) {
+			if (memcmp(sync->cookie, cookie.bv_val, cookie.bv_len) == 0) {
 				WARN("Ignoring new cookie \"%pV\": Identical to old cookie",
 				     fr_box_strvalue_len((char const *)sync->cookie, cookie_len));
 				return 0;
@@ -136,11 +140,38 @@ static int sync_new_cookie(bool *new_cookie, sync_state_t *sync, BerElement *ber
 	DEBUG3("Got new cookie value \"%pV\" (%zu)",
 	       fr_box_strvalue_len((char const *)sync->cookie, cookie_len), cookie_len);
 
+	sync->cookie_pending = true;
 	if (new_cookie) *new_cookie = true;
 
 	return 0;
 }
 
+/** Pass the current cookie to the cookie callback
+ *
+ * During a refresh, every entry may carry a new cookie.  Storing each one
+ * costs a request per entry, for no real benefit.  The cookie only limits
+ * how much is re-sent if the sync is restarted, so we only hand it over
+ * every cookie_interval entries, or when the server tells us a phase is
+ * complete.
+ *
+ * @param[in] sync	to store the cookie for.
+ * @param[in] force	store the cookie even if cookie_interval hasn't been reached.
+ * @return
+ *	- 0 on success, or if there was nothing to store.
+ *	- -1 if the cookie callback failed.
+ */
+static int sync_cookie_store(sync_state_t *sync, bool force)
+{
+	if (!sync->cookie_pending || !sync->config->cookie) return 0;
+
+	if (!force && (sync->changes < sync->config->cookie_interval)) return 0;
+
+	sync->cookie_pending = false;
+	sync->changes = 0;
+
+	return sync->config->cookie(sync->conn, sync->config, sync->msgid, sync->cookie, sync->config->user_ctx);
+}
+
 /** Handle a LDAP_RES_SEARCH_ENTRY (SearchResultEntry) or LDAP_RES_SEARCH_REFRENCE (SearchResultReference) response
  *
  * Upon receipt of a search request containing the syncControl the server provides the initial
@@ -183,7 +214,6 @@ static int sync_search_entry_or_reference(sync_state_t *sync, LDAPMessage *msg,
 	BerElement		*ber = NULL;
 	struct berval		entry_uuid = { 0 };
 	sync_states_t		state = SYNC_STATE_INVALID;
-	bool			new_cookie;
 
 	fr_assert(sync->conn);
 	fr_assert(sync);
@@ -227,7 +257,7 @@ static int sync_search_entry_or_reference(sync_state_t *sync, LDAPMessage *msg,
 		goto error;
 	}
 
-	if (sync_new_cookie(&new_cookie, sync, ber) < 0) goto error;
+	if (sync_new_cookie(NULL, sync, ber) < 0) goto error;
 
 	if (ber_scanf(ber, "}") == LBER_ERROR ) {
 		ERROR("Malformed syncStatevalue sequence");
@@ -316,9 +346,8 @@ static int sync_search_entry_or_reference(sync_state_t *sync, LDAPMessage *msg,
 		}
 	}
 
-	if ((ret == 0) && new_cookie && sync->config->cookie) {
-		ret = sync->config->cookie(sync->conn, sync->config, sync->msgid, sync->cookie, sync->config->user_ctx);
-	}
+	sync->changes++;
+	if (ret == 0) ret = sync_cookie_store(sync, false);
 	ber_free(ber, 1);
 
 	return ret;
@@ -550,7 +579,7 @@ static int sync_intermediate(sync_state_t *sync, LDAPMessage *msg, UNUSED LDAPCo
 			ret = sync->config->entry(sync->conn, sync->config, sync->msgid, sync->phase,
 						  (uint8_t const *)sync_uuids[i].bv_val, NULL, SYNC_STATE_DELETE,
 						  sync->config->user_ctx);
-			if (!ret) goto error;
+			if (ret < 0) goto error;
 		}
 
 		ber_bvarray_free(sync_uuids);
@@ -563,9 +592,7 @@ static int sync_intermediate(sync_state_t *sync, LDAPMessage *msg, UNUSED LDAPCo
 
 	}
 
-	if (new_cookie && sync->config->cookie) {
-		ret = sync->config->cookie(sync->conn, sync->config, sync->msgid, sync->cookie, sync->config->user_ctx);
-	}
+	if (ret == 0) ret = sync_cookie_store(sync, true);
 
 	if (ber) ber_free(ber, 1);
 	if (oid) ldap_memfree(oid);
@@ -607,7 +634,6 @@ static int sync_search_result(sync_state_t *sync, LDAPMessage *msg, LDAPControl
 	int		i;
 	BerElement	*ber = NULL;
 	ber_len_t	len;
-	bool		new_cookie;
 
 	fr_assert(sync->conn);
 	fr_assert(sync);
@@ -646,7 +672,7 @@ static int sync_search_result(sync_state_t *sync, LDAPMessage *msg, LDAPControl
 
 	if (ber_scanf( ber, "{" /*"}"*/) == LBER_ERROR) goto error;
 
-	if (sync_new_cookie(&new_cookie, sync, ber) < 0) goto error;
+	if (sync_new_cookie(NULL, sync, ber) < 0) goto error;
 
 	if (ber_peek_tag(ber, &len) == LDAP_TAG_REFRESHDELETES) {
 		if (ber_scanf(ber, "b", &refresh_deletes) == LBER_ERROR) {
@@ -698,30 +724,60 @@ static int sync_search_result(sync_state_t *sync, LDAPMessage *msg, LDAPControl
 		if (ret != 0) goto error;
 	}
 
-	if (new_cookie && sync->config->cookie) {
-		ret = sync->config->cookie(sync->conn, sync->config, sync->msgid, sync->cookie, sync->config->user_ctx);
-	}
-	if (msg) ldap_memfree(msg);
+	if (ret == 0) ret = sync_cookie_store(sync, true);
 
 	sync->phase = SYNC_PHASE_DONE;
 
 	return ret;
 }
 
+/** Pass any cookies we've been holding on to, to the cookie callback
+ *
+ * Called once the connection has been drained, so that a quiet directory
+ * doesn't leave the last cookie of a burst of changes unstored.
+ *
+ * @param[in] tree	of syncs associated with the connection.
+ * @return
+ *	- 0 on success.
+ *	- -1 if a cookie callback failed.
+ */
+static int sync_cookie_flush(fr_rb_tree_t *tree)
+{
+	fr_rb_iter_inorder_t	iter;
+	sync_state_t		*sync;
+
+	for (sync = fr_rb_iter_init_inorder(&iter, tree);
+	     sync;
+	     sync = fr_rb_iter_next_inorder(&iter)) {
+		if (sync_cookie_store(sync, true) < 0) return -1;
+	}
+
+	return 0;
+}
+
 /** Function to call when the LDAP handle's FD is readable
+ *
+ * Messages are retrieved and processed one at a time, so that a refresh
+ * of a large directory doesn't need every entry to be held in memory at
+ * once.  At most max_msgs are processed per call.  Anything left over
+ * stays in libldap (or in the socket buffer, which pushes back on the
+ * server), and the caller is told to call us again.
  *
  * @param[out] sync_id		the last sync_id serviced.
  * @param[in] conn		to service.
+ * @param[in] max_msgs		the maximum number of messages to process.  0 means no limit.
  * @return
+ *	- 1 if we processed max_msgs messages, and there may be more waiting.
  *	- 0 on success.
  *	- -1 on sync error.
  *	- -2 on conn error.  Requires the handle to be destroyed.
  */
-int sync_demux(int *sync_id, fr_ldap_connection_t *conn)
+int sync_demux(int *sync_id, fr_ldap_connection_t *conn, uint32_t max_msgs)
 {
-	struct	timeval		poll = { 1, 0 };	/* Poll */
-	LDAPMessage		*msg, *head = NULL;
+	struct	timeval		poll = { 0, 0 };	/* Poll */
+	LDAPMessage		*msg = NULL;
 	int			ret = 0;
+	uint32_t		processed;
 	fr_ldap_rcode_t		rcode;
 	sync_state_t		find = { .msgid = -1 }, *sync = NULL;
 	fr_rb_tree_t		*tree;
@@ -730,40 +786,41 @@ int sync_demux(int *sync_id, fr_ldap_connection_t *conn)
 
 	fr_assert(conn);
 
-	/*
-	 *	Drain any messages outstanding on this connection
-	 */
-	ret = ldap_result(conn->handle, LDAP_RES_ANY, LDAP_MSG_RECEIVED, &poll, &head);
-	switch (ret) {
-	case 0:	/* timeout - shouldn't happen */
-		fr_assert(0);
-		return -2;
-
-	case -1:
-		rcode = fr_ldap_error_check(NULL, conn, NULL, NULL);
-		if (rcode == LDAP_PROC_BAD_CONN) return -2;
-		return -1;
-
-	default:
-		break;
-	}
-
 	/*
 	 *	De-multiplex based on msgid
 	 */
-	for (msg = ldap_first_message(conn->handle, head);
-	     msg;
-	     msg = ldap_next_message(conn->handle, msg)) {
+	for (processed = 0; !max_msgs || (processed < max_msgs); processed++) {
 		int		type;
 		int		msgid;
 		LDAPControl	**ctrls;
 
+		ret = ldap_result(conn->handle, LDAP_RES_ANY, LDAP_MSG_ONE, &poll, &msg);
+		switch (ret) {
+		/*
+		 *	No complete messages left.  Either we've
+		 *	drained everything the server sent, or
+		 *	only part of the next message has arrived.
+		 */
+		case 0:
+			if (sync_cookie_flush(tree) < 0) return -1;
+			return 0;
+
+		case -1:
+			rcode = fr_ldap_error_check(NULL, conn, NULL, NULL);
+			if (rcode == LDAP_PROC_BAD_CONN) return -2;
+			return -1;
+
+		default:
+			break;
+		}
+
 		*sync_id = msgid = ldap_msgid(msg);
 		type = ldap_msgtype(msg);
 
 		if (msgid == 0) {
 			WARN("Ignoring unsolicited %s message",
 			     fr_table_str_by_value(sync_protocol_op_table, type, "<invalid>"));
+			ldap_msgfree(msg);
 			continue;
 		}
 
@@ -778,6 +835,7 @@ int sync_demux(int *sync_id, fr_ldap_connection_t *conn)
 			if (!sync) {
 				WARN("Ignoring msgid %i, doesn't match any outstanding syncs",
 				     find.msgid);
+				ldap_msgfree(msg);
 				continue;
 			}
 		}
@@ -792,6 +850,8 @@ int sync_demux(int *sync_id, fr_ldap_connection_t *conn)
 			break;
 
 		case LDAP_PROC_REFRESH_REQUIRED:
+			if (ctrls) ldap_controls_free(ctrls);
+			ldap_msgfree(msg);
 			if (!sync->config->refresh_required) return -1;
 
 			DEBUG2("LDAP Server returned e-syncRefreshRequired");
@@ -804,12 +864,14 @@ int sync_demux(int *sync_id, fr_ldap_connection_t *conn)
 		 */
 		case LDAP_PROC_BAD_CONN:
 			if (ctrls) ldap_controls_free(ctrls);
+			ldap_msgfree(msg);
 			PERROR("Connection unusable");
 			return -2;
 
 		default:
 		sync_error:
 			if (ctrls) ldap_controls_free(ctrls);
+			ldap_msgfree(msg);
 			PERROR("Sync error");
 			return -1;
 		}
@@ -840,11 +902,10 @@ int sync_demux(int *sync_id, fr_ldap_connection_t *conn)
 		}
 
 		ldap_controls_free(ctrls);
+		ldap_msgfree(msg);
 	}
 
-	ldap_msgfree(head);
-
-	return 0;
+	return 1;
 }
 
 /** Tell the remote server to stop the sync
@@ -145,6 +145,8 @@ struct sync_config_s {
 								//!< refreshes.
 	bool				allow_refresh;		//!< If false, we synthesize the cookie value
 								//!< when no cookie is available.
+	uint32_t			cookie_interval;	//!< Only call the cookie callback once every
+								//!< this many entries.
 
 	/*
 	 *	LDAP attribute to RADIUS map
@@ -181,7 +183,7 @@ extern size_t sync_protocol_op_table_len;
 extern fr_table_num_sorted_t sync_info_tag_table[];
 extern size_t sync_info_tag_table_len;
 
-int			sync_demux(int *sync_id, fr_ldap_connection_t *conn);
+int			sync_demux(int *sync_id, fr_ldap_connection_t *conn, uint32_t max_msgs);
 
 void			sync_state_destroy(fr_ldap_connection_t *conn, int msgid);
 
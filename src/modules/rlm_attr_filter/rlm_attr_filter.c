@@ -37,15 +37,44 @@ RCSID("$Id$")
 #include	<ctype.h>
 #include	<fcntl.h>
 
+/** The rules for one attribute in a filter entry
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;		//!< Entry in the rules tree.
+	fr_dict_attr_t const	*da;		//!< Attribute the rules apply to.
+	fr_pair_list_t		check;		//!< Check items for this attribute.
+} attr_filter_rule_t;
+
+/** A filter entry, compiled when the module is instantiated
+ *
+ * Entries with values which have to be expanded at run time are
+ * marked as dynamic, and their maps are evaluated for each request.
+ */
+typedef struct {
+	PAIR_LIST const		*pl;		//!< Entry in the "attrs" file.
+	bool			dynamic;	//!< Rules must be expanded for each request.
+
+	bool			fall_through;	//!< Continue to the next matching entry.
+	int			relax_filter;	//!< Value of Relax-Filter, or -1 if not set.
+
+	fr_pair_list_t		set;		//!< ":=" items to add to the output list.
+
+	fr_rb_tree_t		*rules;		//!< attr_filter_rule_t, by attribute.
+	unsigned int		num_rules;	//!< Number of attributes in the rules tree.
+	unsigned int		vsa_any;	//!< Number of "Vendor-Specific =* ANY" rules.
+} attr_filter_entry_t;
+
 /*
  *	Define a structure with the module configuration, so it can
  *	be used as the instance handle.
  */
 typedef struct {
-	char const	*filename;
-	tmpl_t		*key;
-	bool		relaxed;
-	PAIR_LIST_LIST	attrs;
+	char const		*filename;
+	tmpl_t			*key;
+	bool			relaxed;
+	PAIR_LIST_LIST		attrs;
+	attr_filter_entry_t	**entries;	//!< Compiled entries, in the same order as attrs.
 } rlm_attr_filter_t;
 
 static const CONF_PARSER module_config[] = {
@@ -101,17 +130,100 @@ static void check_pair(request_t *request, fr_pair_t *check_item, fr_pair_t *rep
 	return;
 }
 
+static int8_t attr_filter_rule_cmp(void const *one, void const *two)
+{
+	attr_filter_rule_t const *a = one, *b = two;
+
+	return CMP(a->da, b->da);
+}
+
+/** Compile a filter entry
+ *
+ * The check items for each attribute are created from the maps now, so
+ * that filtering a list is one lookup per attribute.
+ */
+static int attr_filter_compile(rlm_attr_filter_t *inst, attr_filter_entry_t **out, PAIR_LIST const *pl, char const *filename)
+{
+	attr_filter_entry_t	*entry;
+	map_t			*map = NULL;
+
+	MEM(entry = talloc_zero(inst->entries, attr_filter_entry_t));
+	entry->pl = pl;
+	entry->relax_filter = -1;
+	fr_pair_list_init(&entry->set);
+	MEM(entry->rules = fr_rb_inline_talloc_alloc(entry, attr_filter_rule_t, node, attr_filter_rule_cmp, NULL));
+
+	*out = entry;
+
+	while ((map = fr_dlist_next(&pl->reply, map))) {
+		fr_dict_attr_t const	*da = tmpl_da(map->lhs);
+		attr_filter_rule_t	*rule, find = { .da = da };
+		fr_pair_t		*vp;
+
+		/*
+		 *	Anything other than a fixed value has to be
+		 *	expanded for every request.
+		 */
+		if ((map->op == T_OP_CMP_FALSE) ||
+		    ((map->op != T_OP_CMP_TRUE) && !tmpl_is_data(map->rhs))) {
+			entry->dynamic = true;
+			return 0;
+		}
+
+		MEM(vp = fr_pair_afrom_da(entry, da));
+		vp->op = map->op;
+
+		if ((map->op != T_OP_CMP_TRUE) &&
+		    (fr_value_box_cast(vp, &vp->data, da->type, da, tmpl_value(map->rhs)) < 0)) {
+			PERROR("%s[%d] Invalid value for %s", filename, pl->lineno, map->lhs->name);
+			return -1;
+		}
+
+		if (da == attr_fall_through) {
+			if (vp->vp_bool) {
+				entry->fall_through = true;
+				talloc_free(vp);
+				continue;
+			}
+		} else if (da == attr_relax_filter) {
+			entry->relax_filter = vp->vp_bool;
+		}
+
+		if (vp->op == T_OP_SET) {
+			fr_pair_append(&entry->set, vp);
+			continue;
+		}
+
+		if ((da == attr_vendor_specific) && (vp->op == T_OP_CMP_TRUE)) entry->vsa_any++;
+
+		rule = fr_rb_find(entry->rules, &find);
+		if (!rule) {
+			MEM(rule = talloc_zero(entry, attr_filter_rule_t));
+			rule->da = da;
+			fr_pair_list_init(&rule->check);
+			fr_rb_insert(entry->rules, rule);
+			entry->num_rules++;
+		}
+		fr_pair_append(&rule->check, vp);
+	}
+
+	return 0;
+}
+
 static int attr_filter_getfile(TALLOC_CTX *ctx, rlm_attr_filter_t *inst, char const *filename, PAIR_LIST_LIST *pair_list)
 {
 	int rcode;
 	PAIR_LIST *entry = NULL;
 	map_t *map;
+	size_t i = 0;
 
 	rcode = pairlist_read(ctx, dict_radius, filename, pair_list, 1);
 	if (rcode < 0) {
 		return -1;
 	}
 
+	MEM(inst->entries = talloc_zero_array(ctx, attr_filter_entry_t *, fr_dlist_num_elements(&pair_list->head)));
+
 	/*
 	 *	Walk through the 'attrs' file list.
 	 */
@@ -155,6 +267,8 @@ static int attr_filter_getfile(TALLOC_CTX *ctx, rlm_attr_filter_t *inst, char co
 				return -1;
 			}
 		}
+
+		if (attr_filter_compile(inst, &inst->entries[i++], entry, filename) < 0) return -1;
 	}
 
 	return 0;
@@ -181,6 +295,184 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
 }
 
 
+/** Move an input item to the output list if it passed the rules
+ *
+ * @return the item before the one which was moved, or the input item
+ *	if it was not moved.
+ */
+static fr_pair_t *attr_filter_move(request_t *request, fr_pair_list_t *output, fr_pair_list_t *list,
+				   fr_pair_t *input_item, int pass, int fail, bool relax_filter)
+{
+	fr_pair_t *prev;
+
+	RDEBUG3("Attribute \"%s\" allowed by %i rules, disallowed by %i rules",
+		input_item->da->name, pass, fail);
+
+	/*
+	 *  Only move attribute if it passed all rules, or if the config says we
+	 *  should copy unmatched attributes ('relaxed' mode).
+	 */
+	if ((fail != 0) || (!pass && !relax_filter)) return input_item;
+
+	prev = fr_pair_list_prev(list, input_item);
+
+	if (!pass) {
+		RDEBUG3("Attribute \"%s\" allowed by relaxed mode", input_item->da->name);
+	}
+	fr_pair_remove(list, input_item);
+	fr_pair_append(output, input_item);
+
+	return prev; /* Set input_item to previous in the list for outer loop */
+}
+
+/** Filter a list using an entry which needs expanding at run time
+ *
+ */
+static void attr_filter_dynamic(request_t *request, fr_radius_packet_t *packet, fr_pair_list_t *output,
+				fr_pair_list_t *list, PAIR_LIST const *pl, int relax_filter, bool *fall_through)
+{
+	map_t *map = NULL;
+	fr_pair_list_t tmp_list;
+	fr_pair_t *check_item, *input_item;
+	fr_pair_list_t check_list;
+	int pass, fail;
+
+	fr_pair_list_init(&tmp_list);
+	fr_pair_list_init(&check_list);
+
+	while ((map = fr_dlist_next(&pl->reply, map))) {
+		if (map_to_vp(packet, &tmp_list, request, map, NULL) < 0) {
+			RPWARN("Failed parsing map %s for check item, skipping it", map->lhs->name);
+			continue;
+		}
+
+		check_item = fr_pair_list_head(&tmp_list);
+		if (check_item->da == attr_fall_through) {
+			if (check_item->vp_uint32 == 1) {
+				*fall_through = true;
+				fr_pair_list_free(&tmp_list);
+				continue;
+			}
+		} else if (check_item->da == attr_relax_filter) {
+			relax_filter = check_item->vp_uint32;
+		}
+
+		/*
+		 *	Remove pair from temporary list ready to
+		 *	add to the correct destination
+		 */
+		fr_pair_remove(&tmp_list, check_item);
+
+		/*
+		 *    If it is a SET operator, add the attribute to
+		 *    the output list without checking it.
+		 */
+		if (check_item->op == T_OP_SET ) {
+			fr_pair_append(output, check_item);
+			continue;
+		}
+
+		/*
+		 *	Append the realized VP to the check list.
+		 */
+		fr_pair_append(&check_list, check_item);
+	}
+
+	/*
+	 *	Iterate through the input items, comparing
+	 *	each item to every rule, then moving it to the
+	 *	output list only if it matches all rules
+	 *	for that attribute.  IE, Idle-Timeout is moved
+	 *	only if it matches all rules that describe an
+	 *	Idle-Timeout.
+	 */
+	for (input_item = fr_pair_list_head(list);
+	     input_item;
+	     input_item = fr_pair_list_next(list, input_item)) {
+		pass = fail = 0; /* reset the pass,fail vars for each reply item */
+
+		/*
+		 *  Reset the check_item pointer to beginning of the list
+		 */
+		for (check_item = fr_pair_list_head(&check_list);
+		     check_item;
+		     check_item = fr_pair_list_next(&check_list, check_item)) {
+			/*
+			 *  Vendor-Specific is special, and matches any VSA if the
+			 *  comparison is always true.
+			 */
+			if ((check_item->da == attr_vendor_specific) &&
+			    (fr_dict_vendor_num_by_da(input_item->da) != 0) &&
+			    (check_item->op == T_OP_CMP_TRUE)) {
+				pass++;
+				continue;
+			}
+
+			if (input_item->da == check_item->da) {
+				check_pair(request, check_item, input_item, &pass, &fail);
+			}
+		}
+
+		input_item = attr_filter_move(request, output, list, input_item, pass, fail, relax_filter);
+	}
+
+	fr_pair_list_free(&check_list);
+}
+
+/** Filter a list using a compiled entry
+ *
+ * Each input item is checked against only the rules for its attribute.
+ */
+static int attr_filter_compiled(request_t *request, fr_radius_packet_t *packet, fr_pair_list_t *output,
+				fr_pair_list_t *list, attr_filter_entry_t const *entry, int relax_filter)
+{
+	fr_pair_t *input_item;
+
+	if (entry->relax_filter >= 0) relax_filter = entry->relax_filter;
+
+	/*
+	 *	":=" items are added to the output list without
+	 *	checking them.
+	 */
+	if (fr_pair_list_copy(packet, output, &entry->set) < 0) {
+		RPEDEBUG("Failed copying attributes");
+		return -1;
+	}
+
+	/*
+	 *	No rules, so there's nothing to move.  Everything
+	 *	left in the input list is dropped.
+	 */
+	if (!entry->num_rules && !relax_filter) return 0;
+
+	for (input_item = fr_pair_list_head(list);
+	     input_item;
+	     input_item = fr_pair_list_next(list, input_item)) {
+		attr_filter_rule_t	*rule;
+		fr_pair_t		*check_item;
+		int			pass = 0, fail = 0;
+
+		/*
+		 *  Vendor-Specific is special, and matches any VSA if the
+		 *  comparison is always true.
+		 */
+		if (entry->vsa_any && (fr_dict_vendor_num_by_da(input_item->da) != 0)) pass += entry->vsa_any;
+
+		rule = fr_rb_find(entry->rules, &(attr_filter_rule_t){ .da = input_item->da });
+		if (rule) {
+			for (check_item = fr_pair_list_head(&rule->check);
+			     check_item;
+			     check_item = fr_pair_list_next(&rule->check, check_item)) {
+				check_pair(request, check_item, input_item, &pass, &fail);
+			}
+		}
+
+		input_item = attr_filter_move(request, output, list, input_item, pass, fail, relax_filter);
+	}
+
+	return 0;
+}
+
 /*
  *	Common attr_filter checks
  */
@@ -190,9 +482,8 @@ static unlang_action_t CC_HINT(nonnull(1,2)) attr_filter_common(rlm_rcode_t *p_r
 {
 	rlm_attr_filter_t const *inst = talloc_get_type_abort_const(instance, rlm_attr_filter_t);
 	fr_pair_list_t	output;
-	PAIR_LIST	*pl = NULL;
+	size_t		i, num_entries;
 	int		found = 0;
-	int		pass, fail = 0;
 	char const	*keyname = NULL;
 	char		buffer[256];
 	ssize_t		slen;
@@ -218,15 +509,12 @@ static unlang_action_t CC_HINT(nonnull(1,2)) attr_filter_common(rlm_rcode_t *p_r
 	/*
 	 *      Find the attr_filter profile entry for the entry.
 	 */
-	while ((pl = fr_dlist_next(&inst->attrs.head, pl))) {
-		int fall_through = 0;
-		int relax_filter = inst->relaxed;
-		map_t *map = NULL;
-		fr_pair_list_t tmp_list;
-		fr_pair_t *check_item, *input_item;
-		fr_pair_list_t check_list;
-
-		fr_pair_list_init(&tmp_list);
+	num_entries = talloc_array_length(inst->entries);
+	for (i = 0; i < num_entries; i++) {
+		attr_filter_entry_t const	*entry = inst->entries[i];
+		PAIR_LIST const			*pl = entry->pl;
+		bool				fall_through = entry->fall_through;
+
 		/*
 		 *  If the current entry is NOT a default,
 		 *  AND the realm does NOT match the current entry,
@@ -240,98 +528,12 @@ static unlang_action_t CC_HINT(nonnull(1,2)) attr_filter_common(rlm_rcode_t *p_r
 		RDEBUG2("Matched entry %s at line %d", pl->name, pl->lineno);
 		found = 1;
 
-		fr_pair_list_init(&check_list);
+		if (entry->dynamic) {
+			attr_filter_dynamic(request, packet, &output, list, pl, inst->relaxed, &fall_through);
 
-		while ((map = fr_dlist_next(&pl->reply, map))) {
-			if (map_to_vp(packet, &tmp_list, request, map, NULL) < 0) {
-				RPWARN("Failed parsing map %s for check item, skipping it", map->lhs->name);
-				continue;
-			}
-
-			check_item = fr_pair_list_head(&tmp_list);
-		     	if (check_item->da == attr_fall_through) {
-				if (check_item->vp_uint32 == 1) {
-					fall_through = 1;
-					fr_pair_list_free(&tmp_list);
-					continue;
-				}
-		     	} else if (check_item->da == attr_relax_filter) {
-				relax_filter = check_item->vp_uint32;
-		     	}
-
-			/*
-			 *	Remove pair from temporary list ready to
-			 *	add to the correct destination
-			 */
-			fr_pair_remove(&tmp_list, check_item);
-
-			/*
-			 *    If it is a SET operator, add the attribute to
-			 *    the output list without checking it.
-			 */
-			if (check_item->op == T_OP_SET ) {
-				fr_pair_append(&output, check_item);
-				continue;
-			}
-
-			/*
-			 *	Append the realized VP to the check list.
-			 */
-			fr_pair_append(&check_list, check_item);
-		}
-
-		/*
-		 *	Iterate through the input items, comparing
-		 *	each item to every rule, then moving it to the
-		 *	output list only if it matches all rules
-		 *	for that attribute.  IE, Idle-Timeout is moved
-		 *	only if it matches all rules that describe an
-		 *	Idle-Timeout.
-		 */
-		for (input_item = fr_pair_list_head(list);
-		     input_item;
-		     input_item = fr_pair_list_next(list, input_item)) {
-			pass = fail = 0; /* reset the pass,fail vars for each reply item */
-
-			/*
-			 *  Reset the check_item pointer to beginning of the list
-			 */
-			for (check_item = fr_pair_list_head(&check_list);
-			     check_item;
-			     check_item = fr_pair_list_next(&check_list, check_item)) {
-				/*
-				 *  Vendor-Specific is special, and matches any VSA if the
-				 *  comparison is always true.
-				 */
-				if ((check_item->da == attr_vendor_specific) &&
-				    (fr_dict_vendor_num_by_da(input_item->da) != 0) &&
-				    (check_item->op == T_OP_CMP_TRUE)) {
-					pass++;
-					continue;
-				}
-
-				if (input_item->da == check_item->da) {
-					check_pair(request, check_item, input_item, &pass, &fail);
-				}
-			}
-
-			RDEBUG3("Attribute \"%s\" allowed by %i rules, disallowed by %i rules",
-				input_item->da->name, pass, fail);
-			/*
-			 *  Only move attribute if it passed all rules, or if the config says we
-			 *  should copy unmatched attributes ('relaxed' mode).
-			 */
-			if (fail == 0 && (pass > 0 || relax_filter)) {
-				fr_pair_t *prev = fr_pair_list_prev(list, input_item);
-
-				if (!pass) {
-					RDEBUG3("Attribute \"%s\" allowed by relaxed mode", input_item->da->name);
-				}
-				fr_pair_remove(list, input_item);
-				fr_assert(input_item != NULL);
-				fr_pair_append(&output, input_item);
-				input_item = prev; /* Set input_item to previous in the list for outer loop */
-			}
+		} else if (attr_filter_compiled(request, packet, &output, list, entry, inst->relaxed) < 0) {
+			fr_pair_list_free(&output);
+			RETURN_MODULE_FAIL;
 		}
 
 		/* If we shouldn't fall through, break */
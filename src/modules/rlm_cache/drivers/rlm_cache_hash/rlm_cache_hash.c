@@ -0,0 +1,474 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_hash.c
+ * @brief Sharded hash table based cache, with LRU eviction bounded by memory.
+ *
+ * Entries are spread over a number of shards by the hash of their key.
+ * Each shard has its own mutex, hash table, LRU list and expiry heap,
+ * so requests operating on different keys rarely contend with each other,
+ * and lookups are O(1) regardless of the number of entries.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/debug.h>
+#include "../../rlm_cache.h"
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protect the shard from multiple readers/writers.
+
+	fr_hash_table_t		*cache;		//!< Hash table for looking up cache keys.
+	fr_heap_t		*heap;		//!< For managing entry expiry.
+	fr_dlist_head_t		lru;		//!< Entries ordered by last use, least recently
+						///< used at the head.
+
+	size_t			size;		//!< Memory used by entries in this shard.
+} rlm_cache_hash_shard_t;
+
+typedef struct {
+	uint32_t		num_shards;	//!< How many shards to split the cache into.
+	size_t			max_size;	//!< Maximum memory entries may use, 0 for no limit.
+
+	size_t			shard_max_size;	//!< Maximum memory entries in each shard may use.
+	rlm_cache_hash_shard_t	*shards;	//!< Array of shards.
+
+	atomic_uint_fast64_t	num_entries;	//!< Number of entries across all shards.
+} rlm_cache_hash_t;
+
+typedef struct {
+	rlm_cache_entry_t	fields;		//!< Entry data.
+
+	fr_heap_index_t		heap_id;	//!< Offset used for expiry heap.
+	fr_dlist_t		entry;		//!< Entry in the LRU list.
+	size_t			size;		//!< Memory used by the entry.
+} rlm_cache_hash_entry_t;
+
+/** Handle to the shard a request is operating on
+ *
+ * rlm_cache only operates on a single key between acquiring and
+ * releasing a handle, so the lock for the shard is taken on first
+ * use, and held until the handle is released.
+ */
+typedef struct {
+	rlm_cache_hash_shard_t	*shard;		//!< Shard currently locked, if any.
+} rlm_cache_hash_handle_t;
+
+static CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, rlm_cache_hash_t, num_shards), .dflt = "64" },
+	{ FR_CONF_OFFSET("max_size", FR_TYPE_SIZE, rlm_cache_hash_t, max_size), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Hash an entry by key
+ *
+ */
+static uint32_t cache_entry_hash(void const *data)
+{
+	rlm_cache_entry_t const *c = data;
+
+	return fr_hash(c->key, c->key_len);
+}
+
+/** Compare two entries by key
+ *
+ * There may only be one entry with the same key.
+ */
+static int8_t cache_entry_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, key, key_len);
+	return 0;
+}
+
+/** Compare two entries by expiry time
+ *
+ * There may be multiple entries with the same expiry time.
+ */
+static int8_t cache_heap_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	return CMP(a->expires, b->expires);
+}
+
+/** Lock the shard a key belongs to
+ *
+ * If the handle already holds the lock for a different shard, that lock is
+ * released first.
+ */
+static rlm_cache_hash_shard_t *cache_shard_lock(rlm_cache_hash_t *driver, rlm_cache_hash_handle_t *h,
+						uint8_t const *key, size_t key_len)
+{
+	rlm_cache_hash_shard_t *shard = &driver->shards[fr_hash(key, key_len) % driver->num_shards];
+
+	if (h->shard == shard) return shard;
+
+	if (h->shard) pthread_mutex_unlock(&h->shard->mutex);
+	pthread_mutex_lock(&shard->mutex);
+	h->shard = shard;
+
+	return shard;
+}
+
+/** Remove an entry from all the indexes of its shard and free it
+ *
+ */
+static void cache_entry_remove(rlm_cache_hash_t *driver, rlm_cache_hash_shard_t *shard, rlm_cache_hash_entry_t *c)
+{
+	fr_hash_table_remove(shard->cache, c);
+	fr_heap_extract(shard->heap, c);
+	fr_dlist_remove(&shard->lru, c);
+	shard->size -= c->size;
+	atomic_fetch_sub_explicit(&driver->num_entries, 1, memory_order_relaxed);
+
+	talloc_free(c);
+}
+
+/** Cleanup a cache_hash instance
+ *
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_hash_t	*driver = talloc_get_type_abort(instance, rlm_cache_hash_t);
+	uint32_t		i;
+
+	if (!driver->shards) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_hash_shard_t	*shard = &driver->shards[i];
+		rlm_cache_hash_entry_t	*c;
+
+		while ((c = fr_dlist_head(&shard->lru))) cache_entry_remove(driver, shard, c);
+
+		pthread_mutex_destroy(&shard->mutex);
+	}
+
+	return 0;
+}
+
+/** Create a new cache_hash instance
+ *
+ * @param instance	A uint8_t array of inst_size if inst_size > 0, else NULL,
+ *			this should contain the result of parsing the driver's
+ *			CONF_PARSER array that it specified in the interface struct.
+ * @param conf		section holding driver specific #CONF_PAIR (s).
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
+{
+	rlm_cache_hash_t	*driver = talloc_get_type_abort(instance, rlm_cache_hash_t);
+	uint32_t		i;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, 1024);
+
+	driver->shard_max_size = driver->max_size / driver->num_shards;
+	if (driver->max_size && !driver->shard_max_size) driver->shard_max_size = 1;
+
+	MEM(driver->shards = talloc_zero_array(driver, rlm_cache_hash_shard_t, driver->num_shards));
+	atomic_init(&driver->num_entries, 0);
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_hash_shard_t *shard = &driver->shards[i];
+
+		/*
+		 *	The cache.
+		 */
+		shard->cache = fr_hash_table_alloc(driver->shards, cache_entry_hash, cache_entry_cmp, NULL);
+		if (!shard->cache) {
+			ERROR("Failed to create cache");
+			return -1;
+		}
+
+		/*
+		 *	The heap of entries to expire.
+		 */
+		shard->heap = fr_heap_talloc_alloc(driver->shards, cache_heap_cmp, rlm_cache_hash_entry_t, heap_id, 0);
+		if (!shard->heap) {
+			ERROR("Failed to create heap for the cache");
+			return -1;
+		}
+
+		fr_dlist_init(&shard->lru, rlm_cache_hash_entry_t, entry);
+
+		if (pthread_mutex_init(&shard->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    request_t *request)
+{
+	rlm_cache_hash_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_hash_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+	fr_dlist_entry_init(&c->entry);
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       rlm_cache_config_t const *config, void *instance,
+				       request_t *request, void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_hash_t	*driver = talloc_get_type_abort(instance, rlm_cache_hash_t);
+	rlm_cache_hash_shard_t	*shard;
+	rlm_cache_hash_entry_t	*c;
+
+	shard = cache_shard_lock(driver, handle, key, key_len);
+
+	/*
+	 *	Clear out old entries
+	 */
+	c = fr_heap_peek(shard->heap);
+	if (c && (cache_entry_retain(config, &c->fields) < fr_time_to_unix_time(request->packet->timestamp))) {
+		cache_entry_remove(driver, shard, c);
+	}
+
+	/*
+	 *	Is there an entry for this key?
+	 */
+	c = fr_hash_table_find(shard->cache, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
+	if (!c) {
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	/*
+	 *	Most recently used entries live at the tail
+	 */
+	fr_dlist_remove(&shard->lru, c);
+	fr_dlist_insert_tail(&shard->lru, c);
+
+	*out = (rlm_cache_entry_t *)c;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_hash_t	*driver = talloc_get_type_abort(instance, rlm_cache_hash_t);
+	rlm_cache_hash_shard_t	*shard;
+	rlm_cache_hash_entry_t	*c;
+
+	if (!request) return CACHE_ERROR;
+
+	shard = cache_shard_lock(driver, handle, key, key_len);
+
+	c = fr_hash_table_find(shard->cache, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
+	if (!c) return CACHE_MISS;
+
+	cache_entry_remove(driver, shard, c);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * If the shard would exceed its share of max_size, the least recently
+ * used entries in the shard are evicted to make room.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, void *handle,
+					 rlm_cache_entry_t const *entry)
+{
+	rlm_cache_hash_t	*driver = talloc_get_type_abort(instance, rlm_cache_hash_t);
+	rlm_cache_hash_shard_t	*shard;
+	rlm_cache_hash_entry_t	*c = UNCONST(rlm_cache_hash_entry_t *, entry), *old;
+
+	if (!request) return CACHE_ERROR;
+
+	shard = cache_shard_lock(driver, handle, c->fields.key, c->fields.key_len);
+
+	/*
+	 *	Allow overwriting
+	 */
+	old = fr_hash_table_find(shard->cache, c);
+	if (old) cache_entry_remove(driver, shard, old);
+
+	c->size = talloc_total_size(c);
+	if (driver->shard_max_size) {
+		if (c->size > driver->shard_max_size) {
+			RERROR("Entry too large (%zu bytes), max_size allows %zu bytes per shard",
+			       c->size, driver->shard_max_size);
+			return CACHE_ERROR;
+		}
+
+		while ((shard->size + c->size) > driver->shard_max_size) {
+			rlm_cache_hash_entry_t *lru = fr_dlist_head(&shard->lru);
+
+			RDEBUG3("Evicting least recently used entry to make room");
+			cache_entry_remove(driver, shard, lru);
+		}
+	}
+
+	if (!fr_hash_table_insert(shard->cache, c)) {
+		RERROR("Failed adding entry");
+		return CACHE_ERROR;
+	}
+
+	if (fr_heap_insert(shard->heap, c) < 0) {
+		fr_hash_table_remove(shard->cache, c);
+		RERROR("Failed adding entry to expiry heap");
+		return CACHE_ERROR;
+	}
+
+	fr_dlist_insert_tail(&shard->lru, c);
+	shard->size += c->size;
+	atomic_fetch_add_explicit(&driver->num_entries, 1, memory_order_relaxed);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
+					  request_t *request, void *handle,
+					  rlm_cache_entry_t *entry)
+{
+	rlm_cache_hash_t	*driver = talloc_get_type_abort(instance, rlm_cache_hash_t);
+	rlm_cache_hash_shard_t	*shard;
+	rlm_cache_hash_entry_t	*c = (rlm_cache_hash_entry_t *)entry;
+
+#ifdef NDEBUG
+	if (!request) return CACHE_ERROR;
+#endif
+
+	shard = cache_shard_lock(driver, handle, c->fields.key, c->fields.key_len);
+
+	if (!fr_cond_assert(fr_heap_extract(shard->heap, c) == 0)) {
+		RERROR("Entry not in heap");
+		return CACHE_ERROR;
+	}
+
+	if (fr_heap_insert(shard->heap, c) < 0) {
+		RERROR("Failed updating entry TTL.  Entry was forcefully expired");
+		cache_entry_remove(driver, shard, c);	/* make sure we don't leak entries... */
+		return CACHE_ERROR;
+	}
+
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint64_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  request_t *request, UNUSED void *handle)
+{
+	rlm_cache_hash_t *driver = talloc_get_type_abort(instance, rlm_cache_hash_t);
+
+	if (!request) return CACHE_ERROR;
+
+	return atomic_load_explicit(&driver->num_entries, memory_order_relaxed);
+}
+
+/** Allocate a handle
+ *
+ * Shard locks are acquired lazily, when we know which key we're operating on.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+			 request_t *request)
+{
+	rlm_cache_hash_handle_t *h;
+
+	MEM(h = talloc_zero(request, rlm_cache_hash_handle_t));
+	*handle = h;
+
+	return 0;
+}
+
+/** Release the handle, unlocking the shard it was operating on
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, request_t *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_hash_handle_t *h = talloc_get_type_abort(handle, rlm_cache_hash_handle_t);
+
+	if (h->shard) {
+		pthread_mutex_unlock(&h->shard->mutex);
+		RDEBUG3("Mutex released");
+	}
+
+	talloc_free(h);
+}
+
+extern rlm_cache_driver_t rlm_cache_hash;
+rlm_cache_driver_t rlm_cache_hash = {
+	.name		= "rlm_cache_hash",
+	.magic		= RLM_MODULE_INIT,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_hash_t),
+	.config		= driver_config,
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
@@ -39,14 +39,37 @@ typedef struct {
 
 typedef struct {
 	char const 		*options;	//!< Connection options
+	fr_time_delta_t		timeout;	//!< Maximum time to wait for a server to respond.
+	uint32_t		failure_limit;	//!< How many consecutive failures before we stop
+						//!< sending requests to a server.
+	fr_time_delta_t		retry_delay;	//!< How long to wait before trying a disabled server again.
 	fr_pool_t	*pool;
 } rlm_cache_memcached_t;
 
 static const CONF_PARSER driver_config[] = {
 	{ FR_CONF_OFFSET("options", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_cache_memcached_t, options), .dflt = "--SERVER=localhost" },
+	{ FR_CONF_OFFSET("timeout", FR_TYPE_TIME_DELTA, rlm_cache_memcached_t, timeout), .dflt = "0" },
+	{ FR_CONF_OFFSET("failure_limit", FR_TYPE_UINT32, rlm_cache_memcached_t, failure_limit), .dflt = "0" },
+	{ FR_CONF_OFFSET("retry_delay", FR_TYPE_TIME_DELTA, rlm_cache_memcached_t, retry_delay), .dflt = "2" },
 	CONF_PARSER_TERMINATOR
 };
 
+/** Set a behaviour on a memcached handle, logging any errors
+ *
+ */
+static int mod_behavior_set(memcached_st *sandle, memcached_behavior_t flag, uint64_t data)
+{
+	memcached_return_t ret;
+
+	ret = memcached_behavior_set(sandle, flag, data);
+	if (ret != MEMCACHED_SUCCESS) {
+		ERROR("%s: %s", memcached_strerror(sandle, ret), memcached_last_error_message(sandle));
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Free a connection handle
  *
  * @param mandle to free.
@@ -76,14 +99,38 @@ static void *mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t ti
 		return NULL;
 	}
 
-	ret = memcached_behavior_set(sandle, MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT, fr_time_delta_to_msec(timeout));
-	if (ret != MEMCACHED_SUCCESS) {
-		ERROR("%s: %s", memcached_strerror(sandle, ret), memcached_last_error_message(sandle));
+	if (mod_behavior_set(sandle, MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT, fr_time_delta_to_msec(timeout)) < 0) {
 	error:
 		memcached_free(sandle);
 		return NULL;
 	}
 
+	/*
+	 *	Bound how long a slow server can block the worker
+	 *	for.  Without this libmemcached waits for its own
+	 *	(multi-second) default on every operation.
+	 */
+	if (driver->timeout > 0) {
+		if ((mod_behavior_set(sandle, MEMCACHED_BEHAVIOR_POLL_TIMEOUT,
+				      fr_time_delta_to_msec(driver->timeout)) < 0) ||
+		    (mod_behavior_set(sandle, MEMCACHED_BEHAVIOR_RCV_TIMEOUT,
+				      fr_time_delta_to_usec(driver->timeout)) < 0) ||
+		    (mod_behavior_set(sandle, MEMCACHED_BEHAVIOR_SND_TIMEOUT,
+				      fr_time_delta_to_usec(driver->timeout)) < 0)) goto error;
+	}
+
+	/*
+	 *	Once a server has failed enough times in a row,
+	 *	libmemcached fails operations against it immediately
+	 *	until retry_delay has passed, so a server that's
+	 *	timing out costs one timeout, not one per request.
+	 */
+	if (driver->failure_limit > 0) {
+		if ((mod_behavior_set(sandle, MEMCACHED_BEHAVIOR_SERVER_FAILURE_LIMIT, driver->failure_limit) < 0) ||
+		    (mod_behavior_set(sandle, MEMCACHED_BEHAVIOR_RETRY_TIMEOUT,
+				      fr_time_delta_to_sec(driver->retry_delay)) < 0)) goto error;
+	}
+
 	ret = memcached_version(sandle);
 	if (ret != MEMCACHED_SUCCESS) {
 		ERROR("%s: %s", memcached_strerror(sandle, ret), memcached_last_error_message(sandle));
@@ -125,6 +172,11 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	if ((driver->failure_limit > 0) && (driver->retry_delay < fr_time_delta_from_sec(1))) {
+		cf_log_err(conf, "retry_delay must be at least 1 second when failure_limit is set");
+		return -1;
+	}
+
 	driver->pool = module_connection_pool_init(conf, driver, mod_conn_create, NULL,
 						   buffer, "modules.rlm_cache.pool", NULL);
 	if (!driver->pool) return -1;
@@ -204,7 +256,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
  *
  * @copydetails cache_entry_insert_t
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, UNUSED void *instance,
 					 request_t *request, void *handle, const rlm_cache_entry_t *c)
 {
 	rlm_cache_memcached_handle_t *mandle = handle;
@@ -225,7 +277,7 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 
 	ret = memcached_set(mandle->handle, (char const *)c->key, c->key_len,
 		            to_store ? to_store : "",
-		            to_store ? talloc_array_length(to_store) - 1 : 0, c->expires, 0);
+		            to_store ? talloc_array_length(to_store) - 1 : 0, cache_entry_retain(config, c), 0);
 	talloc_free(pool);
 	if (ret != MEMCACHED_SUCCESS) {
 		RERROR("Failed storing entry: %s: %s", memcached_strerror(mandle->handle, ret),
@@ -31,6 +31,8 @@ typedef struct {
 	fr_heap_t		*heap;		//!< For managing entry expiry.
 
 	pthread_mutex_t		mutex;		//!< Protect the tree from multiple readers/writers.
+
+	fr_stats_counters_t	*memory;	//!< Memory used by the entries, if memory_accounting is set.
 } rlm_cache_rbtree_t;
 
 typedef struct {
@@ -70,6 +72,8 @@ static int mod_detach(void *instance)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
 
+	TALLOC_FREE(driver->memory);
+
 	if (driver->cache) {
 		fr_rb_iter_inorder_t	iter;
 		void			*data;
@@ -87,6 +91,25 @@ static int mod_detach(void *instance)
 	return 0;
 }
 
+/** Measure the memory used by the cache entries
+ *
+ */
+static void _cache_memory_read(uint64_t *out, void *uctx)
+{
+	rlm_cache_rbtree_t	*driver = talloc_get_type_abort(uctx, rlm_cache_rbtree_t);
+	fr_rb_iter_inorder_t	iter;
+	void			*data;
+
+	pthread_mutex_lock(&driver->mutex);
+	for (data = fr_rb_iter_init_inorder(&iter, driver->cache);
+	     data;
+	     data = fr_rb_iter_next_inorder(&iter)) {
+		out[FR_STATS_MEMORY_BYTES] += talloc_total_size(data);
+		out[FR_STATS_MEMORY_BLOCKS] += talloc_total_blocks(data);
+	}
+	pthread_mutex_unlock(&driver->mutex);
+}
+
 /** Create a new cache_rbtree instance
  *
  * @param instance	A uint8_t array of inst_size if inst_size > 0, else NULL,
@@ -124,6 +147,24 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
 		return -1;
 	}
 
+	/*
+	 *	The entries are only measured when someone
+	 *	asks, as walking the tree holds the mutex.
+	 */
+	if (main_config->memory_accounting) {
+		module_instance_t	*mi = module_by_data(instance);
+		char			*name;
+
+		name = talloc_asprintf(NULL, "cache.%s", mi ? mi->name : "rbtree");
+		if (name) driver->memory = fr_stats_memory_alloc(driver, name);
+		talloc_free(name);
+		if (!driver->memory) {
+			ERROR("Failed allocating memory accounting counters");
+			return -1;
+		}
+		fr_stats_counters_read_func_set(driver->memory, _cache_memory_read, driver);
+	}
+
 	return 0;
 }
 
@@ -154,7 +195,7 @@ static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *con
  * @copydetails cache_entry_find_t
  */
 static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
-				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       rlm_cache_config_t const *config, void *instance,
 				       request_t *request, UNUSED void *handle, uint8_t const *key, size_t key_len)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
@@ -167,7 +208,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 	 *	Clear out old entries
 	 */
 	c = fr_heap_peek(driver->heap);
-	if (c && (c->expires < fr_time_to_unix_time(request->packet->timestamp))) {
+	if (c && (cache_entry_retain(config, c) < fr_time_to_unix_time(request->packet->timestamp))) {
 		fr_heap_extract(driver->heap, c);
 		fr_rb_delete(driver->cache, c);
 		talloc_free(c);
@@ -255,7 +255,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
  *
  * @copydetails cache_entry_insert_t
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void *instance,
 					 request_t *request, UNUSED void *handle, const rlm_cache_entry_t *c)
 {
 	rlm_cache_redis_t	*driver = instance;
@@ -398,12 +398,17 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 		 *	Set the expiry time and close out the transaction.
 		 */
 		if (c->expires > 0) {
+			/*
+			 *	Keep the entry for stale_ttl after it
+			 *	expires, so it can be served while it's
+			 *	refreshed.
+			 */
 			RDEBUG3("EXPIREAT \"%pV\" %" PRIu64,
 				fr_box_strvalue_len((char const *)c->key, c->key_len),
-				fr_unix_time_to_sec(c->expires));
+				fr_unix_time_to_sec(cache_entry_retain(config, c)));
 			if (redisAppendCommand(conn->handle, "EXPIREAT %b %" PRIu64, c->key,
 					       c->key_len,
-					       fr_unix_time_to_sec(c->expires)) != REDIS_OK) goto append_error;
+					       fr_unix_time_to_sec(cache_entry_retain(config, c))) != REDIS_OK) goto append_error;
 			pipelined++;
 			RDEBUG3("EXEC");
 			if (redisAppendCommand(conn->handle, "EXEC") != REDIS_OK) goto append_error;
@@ -26,14 +26,53 @@ RCSID("$Id$")
 #define LOG_PREFIX "%s - "
 #define LOG_PREFIX_ARGS inst->config.name
 
+#include <freeradius-devel/internal/internal.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/dl_module.h>
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/debug.h>
 
 #include "rlm_cache.h"
 
+/** How often requests waiting for another request to refresh an entry check the cache
+ *
+ */
+#define CACHE_COALESCE_INTERVAL	fr_time_delta_from_msec(10)
+
+/** A key which a request is refreshing
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the claims tree.
+	fr_dlist_t		entry;			//!< Entry in the expiry list.
+
+	uint8_t			*key;			//!< Key of the entry being refreshed.
+	size_t			key_len;		//!< Length of the key.
+
+	request_t const		*owner;			//!< Request refreshing the entry.
+	uint64_t		number;			//!< Number of the request refreshing the entry.
+	fr_time_t		expires;		//!< When the claim lapses.
+} cache_claim_t;
+
+/** Keys which requests are refreshing
+ *
+ * Shared between all threads, as that's where concurrent misses come from.
+ */
+struct cache_claims_s {
+	pthread_mutex_t		mutex;			//!< Protects the tree and the list.
+	fr_rb_tree_t		*tree;			//!< cache_claim_t, by key.
+	fr_dlist_head_t		expiry;			//!< cache_claim_t, oldest first.
+};
+
+/** State for a request waiting on another request's refresh
+ *
+ */
+typedef struct {
+	fr_time_t		deadline;		//!< When we stop waiting.
+} cache_wait_t;
+
 extern module_t rlm_cache;
 
 static const CONF_PARSER module_config[] = {
@@ -45,6 +84,9 @@ static const CONF_PARSER module_config[] = {
 	/* Should be a type which matches time_t, @fixme before 2038 */
 	{ FR_CONF_OFFSET("epoch", FR_TYPE_INT32, rlm_cache_config_t, epoch), .dflt = "0" },
 	{ FR_CONF_OFFSET("add_stats", FR_TYPE_BOOL, rlm_cache_config_t, stats), .dflt = "no" },
+	{ FR_CONF_OFFSET("stale_ttl", FR_TYPE_UINT32, rlm_cache_config_t, stale_ttl), .dflt = "0" },
+	{ FR_CONF_OFFSET("coalesce", FR_TYPE_BOOL, rlm_cache_config_t, coalesce), .dflt = "no" },
+	{ FR_CONF_OFFSET("refresh_timeout", FR_TYPE_TIME_DELTA, rlm_cache_config_t, refresh_timeout), .dflt = "2.0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -109,6 +151,109 @@ static int cache_reconnect(rlm_cache_handle_t **handle, rlm_cache_t const *inst,
 	return inst->driver->reconnect(handle, &inst->config, inst->driver_inst->dl_inst->data, request);
 }
 
+static int8_t cache_claim_cmp(void const *one, void const *two)
+{
+	cache_claim_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, key, key_len);
+	return 0;
+}
+
+/** Free any claims which are still outstanding
+ *
+ */
+static int _cache_claims_free(cache_claims_t *claims)
+{
+	cache_claim_t *claim;
+
+	while ((claim = fr_dlist_pop_head(&claims->expiry))) talloc_free(claim);
+
+	pthread_mutex_destroy(&claims->mutex);
+
+	return 0;
+}
+
+/** Claim the right to refresh an entry
+ *
+ * Only one request at a time refreshes an entry, so that when a popular
+ * entry expires, the backend isn't hit by every request which wants it.
+ *
+ * If the request refreshing the entry never inserts a new one, its claim
+ * lapses after refresh_timeout, and another request may try.
+ *
+ * @return
+ *	- true if this request should refresh the entry.
+ *	- false if another request is already refreshing it.
+ */
+static bool cache_claim(rlm_cache_t const *inst, request_t *request, uint8_t const *key, size_t key_len)
+{
+	cache_claims_t	*claims = inst->claims;
+	cache_claim_t	*claim;
+	fr_time_t	now;
+	bool		ret = true;
+
+	if (!claims) return true;
+
+	now = fr_time();
+
+	pthread_mutex_lock(&claims->mutex);
+
+	/*
+	 *	All claims have the same lifetime, so the lapsed
+	 *	ones are at the head of the list.
+	 */
+	while ((claim = fr_dlist_head(&claims->expiry)) && (claim->expires <= now)) {
+		fr_dlist_remove(&claims->expiry, claim);
+		fr_rb_delete(claims->tree, claim);
+		talloc_free(claim);
+	}
+
+	claim = fr_rb_find(claims->tree, &(cache_claim_t){ .key = UNCONST(uint8_t *, key), .key_len = key_len });
+	if (claim) {
+		if ((claim->owner != request) || (claim->number != request->number)) {
+			ret = false;
+			goto done;
+		}
+		fr_dlist_remove(&claims->expiry, claim);
+	} else {
+		MEM(claim = talloc_zero(NULL, cache_claim_t));
+		MEM(claim->key = talloc_memdup(claim, key, key_len));
+		claim->key_len = key_len;
+		fr_rb_insert(claims->tree, claim);
+	}
+
+	claim->owner = request;
+	claim->number = request->number;
+	claim->expires = now + inst->config.refresh_timeout;
+	fr_dlist_insert_tail(&claims->expiry, claim);
+
+done:
+	pthread_mutex_unlock(&claims->mutex);
+
+	return ret;
+}
+
+/** Release a claim once an entry has been refreshed
+ *
+ * Any request may release the claim, as any insert refreshes the entry.
+ */
+static void cache_claim_release(rlm_cache_t const *inst, uint8_t const *key, size_t key_len)
+{
+	cache_claims_t	*claims = inst->claims;
+	cache_claim_t	*claim;
+
+	if (!claims) return;
+
+	pthread_mutex_lock(&claims->mutex);
+	claim = fr_rb_find(claims->tree, &(cache_claim_t){ .key = UNCONST(uint8_t *, key), .key_len = key_len });
+	if (claim) {
+		fr_dlist_remove(&claims->expiry, claim);
+		fr_rb_delete(claims->tree, claim);
+		talloc_free(claim);
+	}
+	pthread_mutex_unlock(&claims->mutex);
+}
+
 /** Allocate a cache entry
  *
  *  This is used so that drivers may use their own allocation functions
@@ -146,6 +291,101 @@ static void cache_free(rlm_cache_t const *inst, rlm_cache_entry_t **c)
 	*c = NULL;
 }
 
+/** Merge the packed form of a cache entry into a #request_t
+ *
+ * Each record in the packed data is a one byte #tmpl_pair_list_t, a one
+ * byte operator, and a single pair encoded with the internal protocol.
+ *
+ * All records are decoded before any of them are applied, so that if
+ * decoding fails (the dictionaries changed underneath us, or the pair
+ * came from a dictionary other than the request's) the caller can fall
+ * back to merging the entry's maps without the request having been
+ * partially updated.
+ *
+ * @return
+ *	- >= 0 the number of pairs merged.
+ *	- -1 if the packed data couldn't be decoded.
+ */
+static int cache_merge_packed(request_t *request, rlm_cache_entry_t *c)
+{
+	fr_pair_list_t	decoded[PAIR_LIST_STATE + 1];
+	fr_dbuff_t	dbuff;
+	fr_pair_t	*vp;
+	int		merged = 0;
+	size_t		i;
+
+	for (i = 0; i < NUM_ELEMENTS(decoded); i++) fr_pair_list_init(&decoded[i]);
+
+	fr_dbuff_init(&dbuff, c->packed, c->packed_len);
+	while (fr_dbuff_remaining(&dbuff) > 0) {
+		uint8_t		list, op;
+		TALLOC_CTX	*ctx;
+		fr_dcursor_t	cursor;
+
+		if ((fr_dbuff_out(&list, &dbuff) < 0) || (fr_dbuff_out(&op, &dbuff) < 0) ||
+		    (list >= NUM_ELEMENTS(decoded))) {
+			fr_strerror_const("Truncated or malformed cache entry");
+		error:
+			for (i = 0; i < NUM_ELEMENTS(decoded); i++) fr_pair_list_free(&decoded[i]);
+			return -1;
+		}
+
+		ctx = tmpl_list_ctx(request, list);
+		if (!ctx) {
+			fr_strerror_printf("List \"%s\" not available in this request",
+					   fr_table_str_by_value(pair_list_table, list, "<INVALID>"));
+			goto error;
+		}
+
+		fr_dcursor_init(&cursor, &decoded[list]);
+		fr_dcursor_tail(&cursor);
+		if (fr_internal_decode_pair_dbuff(ctx, &cursor, request->dict, &dbuff, NULL) <= 0) goto error;
+
+		vp = fr_dcursor_tail(&cursor);
+		if (!vp) goto error;
+		vp->op = op;
+	}
+
+	for (i = 0; i < NUM_ELEMENTS(decoded); i++) {
+		fr_pair_list_t *list;
+
+		if (fr_pair_list_empty(&decoded[i])) continue;
+
+		list = tmpl_list_head(request, i);
+		fr_assert(list);
+
+		while ((vp = fr_pair_list_head(&decoded[i]))) {
+			fr_pair_remove(&decoded[i], vp);
+
+			RDEBUG2("&%s.%pP", fr_table_str_by_value(pair_list_table, i, "<INVALID>"), vp);
+
+			switch (vp->op) {
+			/*
+			 *	Replace the first existing instance,
+			 *	the same as map_to_request does.
+			 */
+			case T_OP_SET:
+				fr_pair_replace(list, vp);
+				break;
+
+			case T_OP_EQ:
+				if (fr_pair_find_by_da(list, vp->da, 0)) {
+					talloc_free(vp);
+					continue;
+				}
+				FALL_THROUGH;
+
+			default:
+				fr_pair_append(list, vp);
+				break;
+			}
+			merged++;
+		}
+	}
+
+	return merged;
+}
+
 /** Merge a cached entry into a #request_t
  *
  * @return
@@ -161,6 +401,19 @@ static rlm_rcode_t cache_merge(rlm_cache_t const *inst, request_t *request, rlm_
 
 	RDEBUG2("Merging cache entry into request");
 	RINDENT();
+
+	/*
+	 *	Fast path.  Decode the pre-encoded pairs
+	 *	instead of evaluating each of the maps.
+	 */
+	if (c->packed) {
+		merged = cache_merge_packed(request, c);
+		if (merged >= 0) goto done;
+
+		RPWDEBUG("Failed decoding packed cache entry, merging maps instead");
+		merged = 0;
+	}
+
 	while ((map = fr_dlist_next(&c->maps, map))) {
 		/*
 		 *	The only reason that the application of a map entry
@@ -179,6 +432,8 @@ static rlm_rcode_t cache_merge(rlm_cache_t const *inst, request_t *request, rlm_
 		}
 		merged++;
 	}
+
+done:
 	REXDENT();
 
 	if (inst->config.stats) {
@@ -194,6 +449,19 @@ static rlm_rcode_t cache_merge(rlm_cache_t const *inst, request_t *request, rlm_
 
 /** Find a cached entry.
  *
+ * If stale_ttl is set, expired entries are returned for that long after
+ * they expire, unless this request should be the one to refresh them.
+ *
+ * @param[out] p_result	the result of the lookup.
+ * @param[out] out	where to write the entry.
+ * @param[in] inst	Module instance.
+ * @param[in] request	The current request.
+ * @param[in] handle	to access the cache with.
+ * @param[in] key	to look up.
+ * @param[in] key_len	the length of the key.
+ * @param[out] busy	if not NULL, the request may claim the right to refresh
+ *			the entry.  Set to true if the entry wasn't found, and
+ *			another request is already refreshing it.
  * @return
  *	- #RLM_MODULE_OK on cache hit.
  *	- #RLM_MODULE_FAIL on failure.
@@ -201,13 +469,15 @@ static rlm_rcode_t cache_merge(rlm_cache_t const *inst, request_t *request, rlm_
  */
 static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out,
 				  rlm_cache_t const *inst, request_t *request,
-				  rlm_cache_handle_t **handle, uint8_t const *key, size_t key_len)
+				  rlm_cache_handle_t **handle, uint8_t const *key, size_t key_len, bool *busy)
 {
 	cache_status_t ret;
 
 	rlm_cache_entry_t *c;
+	fr_unix_time_t now;
 
 	*out = NULL;
+	if (busy) *busy = false;
 
 	for (;;) {
 		ret = inst->driver->find(&c, &inst->config, inst->driver_inst->dl_inst->data, request, *handle, key, key_len);
@@ -222,7 +492,7 @@ static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out
 
 		case CACHE_MISS:
 			RDEBUG2("No cache entry found for \"%pV\"", fr_box_strvalue_len((char const *)key, key_len));
-			RETURN_MODULE_NOTFOUND;
+			goto notfound;
 
 		default:
 			RETURN_MODULE_FAIL;
@@ -232,24 +502,54 @@ static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out
 		break;
 	}
 
+	now = fr_time_to_unix_time(request->packet->timestamp);
+
+	/*
+	 *	It expired, but it's still within stale_ttl.  One
+	 *	request refreshes it, everyone else gets the old
+	 *	entry in the meantime.
+	 */
+	if ((c->expires < now) && (now < cache_entry_retain(&inst->config, c)) &&
+	    (c->created >= fr_unix_time_from_sec(inst->config.epoch))) {
+		if (busy && cache_claim(inst, request, key, key_len)) {
+			RDEBUG2("Found stale entry for \"%pV\", refreshing it",
+				fr_box_strvalue_len((char const *)key, key_len));
+			cache_free(inst, &c);
+			RETURN_MODULE_NOTFOUND;
+		}
+
+		RDEBUG2("Found stale entry for \"%pV\", using it while it's refreshed",
+			fr_box_strvalue_len((char const *)key, key_len));
+		goto found;
+	}
+
 	/*
 	 *	Yes, but it expired, OR the "forget all" epoch has
 	 *	passed.  Delete it, and pretend it doesn't exist.
 	 */
-	if ((c->expires < fr_time_to_unix_time(request->packet->timestamp)) ||
+	if ((c->expires < now) ||
 	    (c->created < fr_unix_time_from_sec(inst->config.epoch))) {
 		RDEBUG2("Found entry for \"%pV\", but it expired %pV seconds ago.  Removing it",
 			fr_box_strvalue_len((char const *)key, key_len),
 			fr_box_date(fr_time_to_unix_time(request->packet->timestamp -
 							 fr_time_delta_from_sec(c->expires))));
 
-		inst->driver->expire(&inst->config, inst->driver_inst->dl_inst->data, request, handle, c->key, c->key_len);
+		inst->driver->expire(&inst->config, inst->driver_inst->dl_inst->data, request, *handle, c->key, c->key_len);
 		cache_free(inst, &c);
+
+	notfound:
+		/*
+		 *	Only one request at a time should go off and
+		 *	create the entry, the others wait for it.
+		 */
+		if (busy && inst->config.coalesce && !cache_claim(inst, request, key, key_len)) *busy = true;
+
 		RETURN_MODULE_NOTFOUND;	/* Couldn't find a non-expired entry */
 	}
 
 	RDEBUG2("Found entry for \"%pV\"", fr_box_strvalue_len((char const *)key, key_len));
 
+found:
 	c->hits++;
 	*out = c;
 
@@ -285,6 +585,48 @@ static unlang_action_t cache_expire(rlm_rcode_t *p_result,
 	}
 }
 
+/** Whether the output of a map can be stored in the packed form of an entry
+ *
+ * @param[in] map	from the module's update section.
+ * @return
+ *	- true if #cache_merge_packed can apply the pairs the map produces.
+ *	- false if the entry must be merged with #map_to_request.
+ */
+static bool cache_map_packable(map_t const *map)
+{
+	switch (map->op) {
+	case T_OP_SET:
+	case T_OP_EQ:
+	case T_OP_ADD:
+		break;
+
+	default:
+		return false;
+	}
+
+	switch (map->lhs->type) {
+	case TMPL_TYPE_ATTR:
+		if (!tmpl_da(map->lhs)->parent->flags.is_root) return false;
+		break;
+
+	/*
+	 *	map_to_request empties the destination list
+	 *	for &list := ..., merging pair by pair would
+	 *	leave the existing attributes in place.
+	 */
+	case TMPL_TYPE_LIST:
+		if (map->op == T_OP_SET) return false;
+		break;
+
+	default:
+		return false;
+	}
+
+	if ((tmpl_request_ref_count(map->lhs) != 1) || (tmpl_request(map->lhs) != REQUEST_CURRENT)) return false;
+
+	return (tmpl_list(map->lhs) <= PAIR_LIST_STATE);
+}
+
 /** Create and insert a cache entry
  *
  * @return
@@ -305,9 +647,14 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 
 	TALLOC_CTX		*pool;
 
+	fr_dbuff_t		packed;
+	fr_dbuff_uctx_talloc_t	tctx;
+	bool			pack;
+
 	if ((inst->config.max_entries > 0) && inst->driver->count &&
 	    (inst->driver->count(&inst->config, inst->driver_inst->dl_inst->data, request, handle) > inst->config.max_entries)) {
 		RWDEBUG("Cache is full: %d entries", inst->config.max_entries);
+		cache_claim_release(inst, key, key_len);
 		RETURN_MODULE_FAIL;
 	}
 
@@ -327,6 +674,14 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 
 	RDEBUG2("Creating new cache entry");
 
+	/*
+	 *	As well as the maps (which drivers serialise, and
+	 *	which the xlat searches) we build an encoded copy
+	 *	of the pairs, so merging on a hit doesn't need to
+	 *	evaluate templates or copy values out of maps.
+	 */
+	pack = (fr_dbuff_init_talloc(c, &packed, &tctx, 256, SIZE_MAX) != NULL);
+
 	/*
 	 *	Alloc a pool so we don't have excessive allocs when
 	 *	gathering fr_pair_ts to cache.
@@ -334,10 +689,18 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 	pool = talloc_pool(NULL, 2048);
 	while ((map = fr_dlist_next(&inst->maps, map))) {
 		fr_pair_list_t	to_cache;
+		fr_dcursor_t	cursor;
 
 		fr_pair_list_init(&to_cache);
 		fr_assert(map->lhs && map->rhs);
 
+		/*
+		 *	Only maps which write to a top level list of the
+		 *	current request, with operators we can apply
+		 *	without map_to_request, can be packed.
+		 */
+		if (pack) pack = cache_map_packable(map);
+
 		/*
 		 *	Calling map_to_vp gives us exactly the same result,
 		 *	as if this were an update section.
@@ -421,11 +784,29 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 			}
 			MAP_VERIFY(c_map);
 			fr_dlist_insert_tail(&c->maps, c_map);
+
+			if (!pack) continue;
+
+			fr_dcursor_init(&cursor, &to_cache);
+			fr_dcursor_set_current(&cursor, vp);
+			if ((fr_dbuff_in(&packed, (uint8_t)tmpl_list(map->lhs)) <= 0) ||
+			    (fr_dbuff_in(&packed, (uint8_t)map->op) <= 0) ||
+			    (fr_internal_encode_pair(&packed, &cursor, NULL) <= 0)) {
+				RPDEBUG2("Not packing cache entry");
+				pack = false;
+			}
 		}
 		talloc_free_children(pool); /* reset pool state */
 	}
 	talloc_free(pool);
 
+	if (pack && (fr_dbuff_used(&packed) > 0)) {
+		c->packed_len = fr_dbuff_used(&packed);
+		MEM(c->packed = talloc_realloc(c, fr_dbuff_buff(&packed), uint8_t, c->packed_len));
+	} else {
+		fr_dbuff_free_talloc(&packed);
+	}
+
 	/*
 	 *	Check to see if we need to merge the entry into the request
 	 */
@@ -441,15 +822,22 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 		switch (ret) {
 		case CACHE_RECONNECT:
 			if (cache_reconnect(handle, inst, request) == 0) continue;
+			cache_claim_release(inst, key, key_len);
 			RETURN_MODULE_FAIL;
 
 		case CACHE_OK:
 			RDEBUG2("Committed entry, TTL %d seconds", ttl);
 			cache_free(inst, &c);
+			cache_claim_release(inst, key, key_len);
 			RETURN_MODULE_RCODE(merge ? RLM_MODULE_UPDATED : RLM_MODULE_OK);
 
 		default:
 			talloc_free(c);	/* Failed insertion - use talloc_free not the driver free */
+
+			/*
+			 *	Let any waiting requests try for themselves.
+			 */
+			cache_claim_release(inst, key, key_len);
 			RETURN_MODULE_FAIL;
 		}
 	}
@@ -525,6 +913,60 @@ static int cache_verify(map_t *map, void *ctx)
 	return 0;
 }
 
+/** Check the cache again, after waiting for another request to refresh an entry
+ *
+ */
+static void _cache_wait_done(UNUSED module_ctx_t const *mctx, request_t *request, UNUSED void *rctx,
+			     UNUSED fr_time_t fired)
+{
+	unlang_interpret_mark_runnable(request);
+}
+
+static void mod_cache_wait_cancel(UNUSED module_ctx_t const *mctx, request_t *request, void *rctx,
+				  fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	(void) unlang_module_timeout_delete(request, rctx);
+}
+
+/** Decide whether to wait for another request to refresh an entry
+ *
+ * @param[in] inst	Module instance.
+ * @param[in] request	The current request.
+ * @param[in,out] wait	State for the wait, allocated on the first call.
+ * @return
+ *	- true if the request should yield, and check the cache again later.
+ *	- false if the request should treat the entry as missing.
+ */
+static bool cache_coalesce(rlm_cache_t const *inst, request_t *request, cache_wait_t **wait)
+{
+	fr_time_t	now = fr_time();
+	fr_time_t	when;
+
+	if (!*wait) {
+		MEM(*wait = talloc(request, cache_wait_t));
+		(*wait)->deadline = now + inst->config.refresh_timeout;
+	}
+
+	if (now >= (*wait)->deadline) {
+		RWDEBUG("Gave up waiting for another request to refresh the entry");
+		return false;
+	}
+
+	when = now + CACHE_COALESCE_INTERVAL;
+	if (when > (*wait)->deadline) when = (*wait)->deadline;
+
+	if (unlang_module_timeout_add(request, _cache_wait_done, *wait, when) < 0) {
+		RPWDEBUG("Failed adding event");
+		return false;
+	}
+
+	RDEBUG2("Another request is refreshing the entry, waiting for it");
+
+	return true;
+}
+
 /** Do caching checks
  *
  * Since we can update ANY VP list, we do exactly the same thing for all sections
@@ -532,8 +974,29 @@ static int cache_verify(map_t *map, void *ctx)
  *
  * If you want to cache something different in different sections, configure
  * another cache module.
+ *
+ * @param[out] p_result	the result of the cache operations.
+ * @param[in] mctx	module calling ctx.
+ * @param[in] request	The current request.
+ * @param[in] wait	if we're resuming after waiting for another request to refresh
+ *			the entry, otherwise NULL.
  */
+static unlang_action_t cache_it(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+				cache_wait_t *wait);
+
+static unlang_action_t mod_cache_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+					void *rctx)
+{
+	return cache_it(p_result, mctx, request, talloc_get_type_abort(rctx, cache_wait_t));
+}
+
 static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	return cache_it(p_result, mctx, request, NULL);
+}
+
+static unlang_action_t cache_it(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+				cache_wait_t *wait)
 {
 	rlm_cache_entry_t	*c = NULL;
 	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_cache_t);
@@ -544,6 +1007,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	fr_pair_t		*vp;
 
 	bool			merge = true, insert = true, expire = false, set_ttl = false;
+	bool			busy = false;
 	int			exists = -1;
 
 	uint8_t			buffer[1024];
@@ -578,10 +1042,12 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 			RETURN_MODULE_FAIL;
 		}
 
-		cache_find(&rcode, &c, inst, request, &handle, key, key_len);
+		cache_find(&rcode, &c, inst, request, &handle, key, key_len, &busy);
 		if (rcode == RLM_MODULE_FAIL) goto finish;
 		fr_assert(!inst->driver->acquire || handle);
 
+		if (busy && cache_coalesce(inst, request, &wait)) goto yield;
+
 		rcode = c ? RLM_MODULE_OK:
 			    RLM_MODULE_NOTFOUND;
 		goto finish;
@@ -625,7 +1091,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	 *	recording whether the entry existed.
 	 */
 	if (merge) {
-		cache_find(&rcode, &c, inst, request, &handle, key, key_len);
+		cache_find(&rcode, &c, inst, request, &handle, key, key_len, &busy);
 		switch (rcode) {
 		case RLM_MODULE_FAIL:
 			goto finish;
@@ -636,6 +1102,8 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 			break;
 
 		case RLM_MODULE_NOTFOUND:
+			if (busy && cache_coalesce(inst, request, &wait)) goto yield;
+
 			rcode = RLM_MODULE_NOTFOUND;
 			exists = 0;
 			break;
@@ -690,7 +1158,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	if ((exists < 0) && (insert || set_ttl)) {
 		rlm_rcode_t tmp;
 
-		cache_find(&tmp, &c, inst, request, &handle, key, key_len);
+		cache_find(&tmp, &c, inst, request, &handle, key, key_len, &busy);
 		switch (tmp) {
 		case RLM_MODULE_FAIL:
 			rcode = RLM_MODULE_FAIL;
@@ -767,10 +1235,10 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 		goto finish;
 	}
 
-
 finish:
 	cache_free(inst, &c);
 	cache_release(inst, request, &handle);
+	talloc_free(wait);
 
 	/*
 	 *	Clear control attributes
@@ -797,6 +1265,15 @@ finish:
 	}
 
 	RETURN_MODULE_RCODE(rcode);
+
+	/*
+	 *	The control attributes are left alone, as we'll
+	 *	need them again when we resume.
+	 */
+yield:
+	cache_release(inst, request, &handle);
+
+	return unlang_module_yield(request, mod_cache_resume, mod_cache_wait_cancel, wait);
 }
 
 static int mod_xlat_thread_instantiate(UNUSED void *xlat_inst, void *xlat_thread_inst,
@@ -862,7 +1339,7 @@ static xlat_action_t cache_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out, request_t *r
 		return XLAT_ACTION_FAIL;
 	}
 
-	cache_find(&rcode, &c, xti->inst, request, &handle, key, key_len);
+	cache_find(&rcode, &c, xti->inst, request, &handle, key, key_len, NULL);
 	switch (rcode) {
 	case RLM_MODULE_OK:		/* found */
 		break;
@@ -1031,6 +1508,31 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	/*
+	 *	Track which keys are being refreshed, so that only
+	 *	one request goes to the backend for each.
+	 */
+	if (inst->config.stale_ttl || inst->config.coalesce) {
+		cache_claims_t *claims;
+
+		if (inst->config.refresh_timeout <= 0) {
+			cf_log_err(conf, "Must set 'refresh_timeout' to non-zero");
+			return -1;
+		}
+
+		MEM(claims = talloc_zero(inst, cache_claims_t));
+		if (pthread_mutex_init(&claims->mutex, NULL) < 0) {
+			cf_log_err(conf, "Failed initializing mutex: %s", fr_syserror(errno));
+			talloc_free(claims);
+			return -1;
+		}
+		MEM(claims->tree = fr_rb_inline_talloc_alloc(claims, cache_claim_t, node, cache_claim_cmp, NULL));
+		fr_dlist_talloc_init(&claims->expiry, cache_claim_t, entry);
+		talloc_set_destructor(claims, _cache_claims_free);
+
+		inst->claims = claims;
+	}
+
 	return 0;
 }
 
@@ -34,6 +34,8 @@ typedef struct rlm_cache_driver_s rlm_cache_driver_t;
 
 typedef void rlm_cache_handle_t;
 
+typedef struct cache_claims_s cache_claims_t;
+
 #define MAX_ATTRMAP	128
 
 typedef enum {
@@ -56,6 +58,13 @@ typedef struct {
 	uint32_t		max_entries;		//!< Maximum entries allowed.
 	int32_t			epoch;			//!< Time after which entries are considered valid.
 	bool			stats;			//!< Generate statistics.
+
+	uint32_t		stale_ttl;		//!< How long expired entries may be served for,
+							//!< while another request refreshes them.
+	bool			coalesce;		//!< Whether concurrent misses on the same key wait
+							//!< for the first request to insert an entry.
+	fr_time_delta_t		refresh_timeout;	//!< How long a request has to refresh an entry
+							//!< before another request may try.
 } rlm_cache_config_t;
 
 /*
@@ -74,6 +83,8 @@ typedef struct {
 	fr_map_list_t		maps;			//!< Attribute map applied to users.
 							//!< and profiles.
 	CONF_SECTION		*cs;
+
+	cache_claims_t		*claims;		//!< Keys which requests are currently refreshing.
 } rlm_cache_t;
 
 typedef struct {
@@ -84,12 +95,29 @@ typedef struct {
 	fr_unix_time_t		expires;		//!< When the entry expires.
 
 	fr_map_list_t		maps;			//!< Head of the maps list.
+
+	uint8_t			*packed;		//!< Cached attributes encoded with the internal
+							//!< protocol, so they can be merged without
+							//!< evaluating maps.  NULL if the entry couldn't
+							//!< be packed, or the driver materialised it
+							//!< from its own serialisation format.
+	size_t			packed_len;		//!< Length of the packed data.
 } rlm_cache_entry_t;
 
 typedef struct {
 	rlm_cache_t		*inst;			//!< Instance of rlm_cache
 } cache_xlat_thread_inst_t;
 
+/** When a driver may discard an entry
+ *
+ * Entries are kept for stale_ttl after they expire, so that they can be
+ * served while another request refreshes them.
+ */
+static inline fr_unix_time_t cache_entry_retain(rlm_cache_config_t const *config, rlm_cache_entry_t const *c)
+{
+	return c->expires + fr_time_delta_from_sec(config->stale_ttl);
+}
+
 /** Allocate a new cache entry
  *
  */
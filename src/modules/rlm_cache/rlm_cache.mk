@@ -1,3 +1,4 @@
 TARGET		:= rlm_cache.a
 SOURCES		:= rlm_cache.c
 TGT_LDLIBS	:= $(LIBS)
+TGT_PREREQS	:= libfreeradius-internal.a
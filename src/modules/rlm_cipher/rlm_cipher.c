@@ -29,11 +29,14 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/offload.h>
 #include <freeradius-devel/tls/base.h>
 #include <freeradius-devel/tls/log.h>
+#include <freeradius-devel/util/atexit.h>
 #include <freeradius-devel/util/debug.h>
 
 #include <openssl/crypto.h>
+#include <openssl/err.h>
 #include <openssl/pem.h>
 #include <openssl/evp.h>
 #include <openssl/rsa.h>
@@ -123,6 +126,9 @@ typedef struct {
 	EVP_MD			*sig_digest;			//!< Signature digest type.
 
 	cipher_rsa_oaep_t	*oaep;				//!< OAEP can use a configurable message digest type
+
+	uint32_t		threads;			//!< Number of offload helper threads.
+	fr_offload_t		*offload;			//!< Helper threads for private key operations.
 } cipher_rsa_t;
 
 /** Instance configuration
@@ -140,6 +146,23 @@ typedef struct {
 	};
 } rlm_cipher_t;
 
+/** A private key operation running on an offload helper thread
+ *
+ */
+typedef struct {
+	rlm_cipher_t const	*inst;				//!< Module instance.
+
+	uint8_t			*in;				//!< Ciphertext or digest.
+	size_t			in_len;
+
+	uint8_t			*out;				//!< Plaintext or signature.  Allocated by
+								///< the worker, and filled in by the helper.
+	size_t			out_len;
+
+	bool			failed;				//!< Whether the operation failed.
+	unsigned long		error;				//!< OpenSSL error, if there was one.
+} cipher_rsa_offload_t;
+
 /** Configuration for the RSA-PCKS1-OAEP padding scheme
  *
  */
@@ -168,6 +191,8 @@ static const CONF_PARSER rsa_config[] = {
 	{ FR_CONF_OFFSET("oaep", FR_TYPE_SUBSECTION, cipher_rsa_t, oaep),
 			 .subcs_size = sizeof(cipher_rsa_oaep_t), .subcs_type = "cipher_rsa_oaep_t", .subcs = (void const *) rsa_oaep_config },
 
+	{ FR_CONF_OFFSET("threads", FR_TYPE_UINT32, cipher_rsa_t, threads), .dflt = "0" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -537,12 +562,148 @@ static xlat_action_t cipher_rsa_encrypt_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 }
 
 
+/** Pre-initialised EVP_PKEY_CTXs for an offload helper thread
+ *
+ * Each instance has its own helper threads, so each helper thread only
+ * ever needs one set.
+ */
+typedef struct {
+	EVP_PKEY_CTX		*evp_decrypt_ctx;		//!< Pre-allocated evp_pkey_ctx.
+	EVP_PKEY_CTX		*evp_sign_ctx;			//!< Pre-allocated evp_pkey_ctx.
+} cipher_rsa_helper_t;
+
+static _Thread_local cipher_rsa_helper_t *cipher_rsa_helper;
+
+static int cipher_rsa_private_ctx_alloc(TALLOC_CTX *ctx, EVP_PKEY_CTX **decrypt_out, EVP_PKEY_CTX **sign_out,
+					rlm_cipher_t const *inst);
+
+static void _cipher_rsa_helper_free(void *arg)
+{
+	talloc_free(arg);
+	cipher_rsa_helper = NULL;
+}
+
+/** Get the EVP_PKEY_CTXs for this helper thread, allocating them on first use
+ *
+ * They're allocated by the helper thread, so that OpenSSL's allocations
+ * aren't parented by anything the worker threads are using.
+ */
+static cipher_rsa_helper_t *cipher_rsa_helper_get(rlm_cipher_t const *inst)
+{
+	cipher_rsa_helper_t *helper;
+
+	if (cipher_rsa_helper) return cipher_rsa_helper;
+
+	MEM(helper = talloc_zero(NULL, cipher_rsa_helper_t));
+	if (cipher_rsa_private_ctx_alloc(helper, &helper->evp_decrypt_ctx, &helper->evp_sign_ctx, inst) < 0) {
+		talloc_free(helper);
+		return NULL;
+	}
+	fr_atexit_thread_local(cipher_rsa_helper, _cipher_rsa_helper_free, helper);
+
+	return helper;
+}
+
+/** Allocate the state for a private key operation, copying its input
+ *
+ * The input is copied, as the request may be cancelled (and its input
+ * freed) while the operation is running.
+ */
+static cipher_rsa_offload_t *cipher_rsa_offload_alloc(rlm_cipher_t const *inst,
+						      uint8_t const *in, size_t in_len, size_t out_len)
+{
+	cipher_rsa_offload_t *job;
+
+	MEM(job = talloc_zero(NULL, cipher_rsa_offload_t));
+	job->inst = inst;
+	MEM(job->in = talloc_memdup(job, in, in_len));
+	job->in_len = in_len;
+	MEM(job->out = talloc_array(job, uint8_t, out_len));
+	job->out_len = out_len;
+
+	return job;
+}
+
+/** Record why a private key operation failed, for logging by the worker
+ *
+ */
+static void cipher_rsa_offload_error(cipher_rsa_offload_t *job)
+{
+	job->failed = true;
+	job->error = ERR_peek_last_error();
+	ERR_clear_error();
+}
+
+/** Log a failed private key operation
+ *
+ */
+static void cipher_rsa_offload_log_error(request_t *request, cipher_rsa_offload_t const *job, char const *msg)
+{
+	char buffer[256];
+
+	if (!job->error) {
+		REDEBUG("%s", msg);
+		return;
+	}
+
+	ERR_error_string_n(job->error, buffer, sizeof(buffer));
+	REDEBUG("%s: %s", msg, buffer);
+}
+
+/** Decrypt on a helper thread
+ *
+ */
+static void cipher_rsa_decrypt_offload(void *uctx)
+{
+	cipher_rsa_offload_t	*job = talloc_get_type_abort(uctx, cipher_rsa_offload_t);
+	cipher_rsa_helper_t	*helper;
+
+	helper = cipher_rsa_helper_get(job->inst);
+	if (!helper || (EVP_PKEY_decrypt(helper->evp_decrypt_ctx, job->out, &job->out_len,
+					 job->in, job->in_len) <= 0)) cipher_rsa_offload_error(job);
+}
+
+/** Sign on a helper thread
+ *
+ */
+static void cipher_rsa_sign_offload(void *uctx)
+{
+	cipher_rsa_offload_t	*job = talloc_get_type_abort(uctx, cipher_rsa_offload_t);
+	cipher_rsa_helper_t	*helper;
+
+	helper = cipher_rsa_helper_get(job->inst);
+	if (!helper || (EVP_PKEY_sign(helper->evp_sign_ctx, job->out, &job->out_len,
+				      job->in, job->in_len) <= 0)) cipher_rsa_offload_error(job);
+}
+
 static xlat_arg_parser_t const cipher_rsa_sign_xlat_arg = {
 	.required = true,
 	.concat = true,
 	.type = FR_TYPE_STRING,
 };
 
+/** The digest has been signed on a helper thread
+ *
+ */
+static xlat_action_t cipher_rsa_sign_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
+					    request_t *request, UNUSED void const *xlat_inst,
+					    UNUSED void *xlat_thread_inst, UNUSED fr_value_box_list_t *in, void *rctx)
+{
+	cipher_rsa_offload_t	*job = talloc_get_type_abort(rctx, cipher_rsa_offload_t);
+	fr_value_box_t		*vb;
+
+	if (job->failed) {
+		cipher_rsa_offload_log_error(request, job, "Failed signing message digest");
+		return XLAT_ACTION_FAIL;
+	}
+
+	MEM(vb = fr_value_box_alloc_null(ctx));
+	MEM(fr_value_box_memdup(vb, vb, NULL, job->out, job->out_len, false) == 0);
+	fr_dcursor_append(out, vb);
+
+	return XLAT_ACTION_DONE;
+}
+
 /** Sign input data
  *
  * Arguments are @verbatim(<plaintext>...)@endverbatim
@@ -605,6 +766,15 @@ static xlat_action_t cipher_rsa_sign_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		return XLAT_ACTION_FAIL;
 	}
 
+	/*
+	 *	Private key operations are expensive, so do
+	 *	them on a helper thread if we have any.
+	 */
+	if (inst->rsa->offload) {
+		return unlang_xlat_offload(request, inst->rsa->offload, cipher_rsa_sign_offload, cipher_rsa_sign_resume,
+					   cipher_rsa_offload_alloc(inst, xt->digest_buff, digest_len, sig_len));
+	}
+
 	MEM(vb = fr_value_box_alloc_null(ctx));
 	MEM(fr_value_box_mem_alloc(vb, &sig, vb, NULL, sig_len, false) == 0);
 	if (EVP_PKEY_sign(xt->evp_sign_ctx, sig, &sig_len, xt->digest_buff, (size_t)digest_len) <= 0) {
@@ -624,6 +794,29 @@ static xlat_arg_parser_t const cipher_rsa_decrypt_xlat_arg = {
 	.type = FR_TYPE_OCTETS
 };
 
+/** The ciphertext has been decrypted on a helper thread
+ *
+ */
+static xlat_action_t cipher_rsa_decrypt_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
+					       request_t *request, UNUSED void const *xlat_inst,
+					       UNUSED void *xlat_thread_inst, UNUSED fr_value_box_list_t *in, void *rctx)
+{
+	cipher_rsa_offload_t	*job = talloc_get_type_abort(rctx, cipher_rsa_offload_t);
+	fr_value_box_t		*vb;
+
+	if (job->failed) {
+		cipher_rsa_offload_log_error(request, job, "Failed decrypting ciphertext");
+		return XLAT_ACTION_FAIL;
+	}
+	RHEXDUMP3(job->out, job->out_len, "Plaintext (%zu bytes)", job->out_len);
+
+	MEM(vb = fr_value_box_alloc_null(ctx));
+	MEM(fr_value_box_bstrndup(vb, vb, NULL, (char const *)job->out, job->out_len, true) == 0);
+	fr_dcursor_append(out, vb);
+
+	return XLAT_ACTION_DONE;
+}
+
 /** Decrypt input data
  *
  * Arguments are @verbatim(<ciphertext\>...)@endverbatim
@@ -637,9 +830,11 @@ static xlat_arg_parser_t const cipher_rsa_decrypt_xlat_arg = {
  * @ingroup xlat_functions
  */
 static xlat_action_t cipher_rsa_decrypt_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
-					     request_t *request, UNUSED void const *xlat_inst, void *xlat_thread_inst,
+					     request_t *request, void const *xlat_inst, void *xlat_thread_inst,
 					     fr_value_box_list_t *in)
 {
+	rlm_cipher_t const		*inst = talloc_get_type_abort_const(*((void const * const *)xlat_inst),
+									    rlm_cipher_t);
 	rlm_cipher_rsa_thread_inst_t	*xt = talloc_get_type_abort(*((void **)xlat_thread_inst),
 								    rlm_cipher_rsa_thread_inst_t);
 
@@ -664,6 +859,15 @@ static xlat_action_t cipher_rsa_decrypt_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		return XLAT_ACTION_FAIL;
 	}
 
+	/*
+	 *	Private key operations are expensive, so do
+	 *	them on a helper thread if we have any.
+	 */
+	if (inst->rsa->offload) {
+		return unlang_xlat_offload(request, inst->rsa->offload, cipher_rsa_decrypt_offload, cipher_rsa_decrypt_resume,
+					   cipher_rsa_offload_alloc(inst, ciphertext, ciphertext_len, plaintext_len));
+	}
+
 	MEM(vb = fr_value_box_alloc_null(ctx));
 	MEM(fr_value_box_bstr_alloc(vb, &plaintext, vb, NULL, plaintext_len, true) == 0);
 	if (EVP_PKEY_decrypt(xt->evp_decrypt_ctx, (unsigned char *)plaintext, &plaintext_len,
@@ -1004,6 +1208,91 @@ static int cipher_rsa_padding_params_set(EVP_PKEY_CTX *evp_pkey_ctx, cipher_rsa_
 	}
 }
 
+/** Pre-initialises the EVP_PKEY_CTXs needed for private key operations (decrypt and sign)
+ *
+ * @param[in] ctx		to bind the lifetime of the EVP_PKEY_CTXs to.
+ * @param[out] decrypt_out	Where to write the decrypt EVP_PKEY_CTX.
+ * @param[out] sign_out		Where to write the sign EVP_PKEY_CTX.
+ * @param[in] inst		Module instance.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int cipher_rsa_private_ctx_alloc(TALLOC_CTX *ctx, EVP_PKEY_CTX **decrypt_out, EVP_PKEY_CTX **sign_out,
+					rlm_cipher_t const *inst)
+{
+	EVP_PKEY_CTX	*decrypt, *sign;
+
+	/*
+	 *	Alloc decrypt
+	 */
+	decrypt = EVP_PKEY_CTX_new(inst->rsa->private_key_file, NULL);
+	if (!decrypt) {
+		fr_tls_log_strerror_printf(NULL);
+		PERROR("%s: Failed allocating decrypt EVP_PKEY_CTX", __FUNCTION__);
+		return -1;
+	}
+	talloc_set_type(decrypt, EVP_PKEY_CTX);
+	decrypt = talloc_steal(ctx, decrypt);	/* Bind lifetime to ctx */
+	talloc_set_destructor(decrypt, _evp_pkey_ctx_free);	/* Free ctx correctly on chunk free */
+
+	/*
+	 *	Configure decrypt
+	 */
+	if (unlikely(EVP_PKEY_decrypt_init(decrypt) <= 0)) {
+		fr_tls_log_strerror_printf(NULL);
+		PERROR("%s: Failed initialising decrypt EVP_PKEY_CTX", __FUNCTION__);
+		return -1;
+	}
+	if (unlikely(cipher_rsa_padding_params_set(decrypt, inst->rsa) < 0)) {
+		ERROR("%s: Failed setting padding for decrypt EVP_PKEY_CTX", __FUNCTION__);
+		return -1;
+	}
+
+	/*
+	 *	Alloc sign
+	 */
+	sign = EVP_PKEY_CTX_new(inst->rsa->private_key_file, NULL);
+	if (!sign) {
+		fr_tls_log_strerror_printf(NULL);
+		PERROR("%s: Failed allocating sign EVP_PKEY_CTX", __FUNCTION__);
+		return -1;
+	}
+	talloc_set_type(sign, EVP_PKEY_CTX);
+	sign = talloc_steal(ctx, sign);		/* Bind lifetime to ctx */
+	talloc_set_destructor(sign, _evp_pkey_ctx_free);	/* Free ctx correctly on chunk free */
+
+	/*
+	 *	Configure sign
+	 */
+	if (unlikely(EVP_PKEY_sign_init(sign) <= 0)) {
+		fr_tls_log_strerror_printf(NULL);
+		PERROR("%s: Failed initialising sign EVP_PKEY_CTX", __FUNCTION__);
+		return -1;
+	}
+
+	/*
+	 *	OAEP not valid for signing or verification
+	 */
+	if (inst->rsa->padding != RSA_PKCS1_OAEP_PADDING) {
+		if (unlikely(cipher_rsa_padding_params_set(sign, inst->rsa) < 0)) {
+			ERROR("%s: Failed setting padding for sign EVP_PKEY_CTX", __FUNCTION__);
+			return -1;
+		}
+	}
+
+	if (unlikely(EVP_PKEY_CTX_set_signature_md(sign, inst->rsa->sig_digest)) <= 0) {
+		fr_tls_log_strerror_printf(NULL);
+		PERROR("%s: Failed setting signature digest type", __FUNCTION__);
+		return -1;
+	}
+
+	*decrypt_out = decrypt;
+	*sign_out = sign;
+
+	return 0;
+}
+
 /** Pre-initialises the EVP_PKEY_CTX necessary for performing RSA encryption/decryption/sign/verify
  *
  * If reference counting is used for EVP_PKEY structs, should also prevent any mutex contention
@@ -1092,69 +1381,7 @@ static int cipher_rsa_thread_instantiate(UNUSED CONF_SECTION const *conf, void *
 	}
 
 	if (inst->rsa->private_key_file) {
-		/*
-		 *	Alloc decrypt
-		 */
-		ti->evp_decrypt_ctx = EVP_PKEY_CTX_new(inst->rsa->private_key_file, NULL);
-		if (!ti->evp_decrypt_ctx) {
-			fr_tls_log_strerror_printf(NULL);
-			PERROR("%s: Failed allocating decrypt EVP_PKEY_CTX", __FUNCTION__);
-			return -1;
-		}
-		talloc_set_type(ti->evp_decrypt_ctx, EVP_PKEY_CTX);
-		ti->evp_decrypt_ctx = talloc_steal(ti, ti->evp_decrypt_ctx);	/* Bind lifetime to instance */
-		talloc_set_destructor(ti->evp_decrypt_ctx, _evp_pkey_ctx_free);	/* Free ctx correctly on chunk free */
-
-		/*
-		 *	Configure decrypt
-		 */
-		if (unlikely(EVP_PKEY_decrypt_init(ti->evp_decrypt_ctx) <= 0)) {
-			fr_tls_log_strerror_printf(NULL);
-			PERROR("%s: Failed initialising decrypt EVP_PKEY_CTX", __FUNCTION__);
-			return XLAT_ACTION_FAIL;
-		}
-		if (unlikely(cipher_rsa_padding_params_set(ti->evp_decrypt_ctx, inst->rsa) < 0)) {
-			ERROR("%s: Failed setting padding for decrypt EVP_PKEY_CTX", __FUNCTION__);
-			return -1;
-		}
-
-		/*
-		 *	Alloc sign
-		 */
-		ti->evp_sign_ctx = EVP_PKEY_CTX_new(inst->rsa->private_key_file, NULL);
-		if (!ti->evp_sign_ctx) {
-			fr_tls_log_strerror_printf(NULL);
-			PERROR("%s: Failed allocating sign EVP_PKEY_CTX", __FUNCTION__);
-			return -1;
-		}
-		talloc_set_type(ti->evp_sign_ctx, EVP_PKEY_CTX);
-		ti->evp_sign_ctx = talloc_steal(ti, ti->evp_sign_ctx);		/* Bind lifetime to instance */
-		talloc_set_destructor(ti->evp_sign_ctx, _evp_pkey_ctx_free);	/* Free ctx correctly on chunk free */
-
-		/*
-		 *	Configure sign
-		 */
-		if (unlikely(EVP_PKEY_sign_init(ti->evp_sign_ctx) <= 0)) {
-			fr_tls_log_strerror_printf(NULL);
-			PERROR("%s: Failed initialising sign EVP_PKEY_CTX", __FUNCTION__);
-			return XLAT_ACTION_FAIL;
-		}
-
-		/*
-		 *	OAEP not valid for signing or verification
-		 */
-		if (inst->rsa->padding != RSA_PKCS1_OAEP_PADDING) {
-			if (unlikely(cipher_rsa_padding_params_set(ti->evp_sign_ctx, inst->rsa) < 0)) {
-				ERROR("%s: Failed setting padding for sign EVP_PKEY_CTX", __FUNCTION__);
-				return -1;
-			}
-		}
-
-		if (unlikely(EVP_PKEY_CTX_set_signature_md(ti->evp_sign_ctx, inst->rsa->sig_digest)) <= 0) {
-			fr_tls_log_strerror_printf(NULL);
-			PERROR("%s: Failed setting signature digest type", __FUNCTION__);
-			return XLAT_ACTION_FAIL;
-		}
+		if (cipher_rsa_private_ctx_alloc(ti, &ti->evp_decrypt_ctx, &ti->evp_sign_ctx, inst) < 0) return -1;
 
 		/*
 		 *	Alloc digest ctx for signing and verification
@@ -1350,6 +1577,42 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_cipher_t	*inst = talloc_get_type_abort(instance, rlm_cipher_t);
+
+	switch (inst->type) {
+	case RLM_CIPHER_TYPE_RSA:
+		/*
+		 *	Only private key operations are slow
+		 *	enough to be worth offloading.
+		 */
+		if (!inst->rsa->threads || !inst->rsa->private_key_file) break;
+
+		inst->rsa->offload = fr_offload_alloc(inst, "cipher", inst->rsa->threads);
+		if (!inst->rsa->offload) {
+			cf_log_perr(conf, "Unable to initialise cipher helper threads");
+			return -1;
+		}
+		break;
+
+	default:
+		fr_assert(0);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_cipher_t	*inst = talloc_get_type_abort(instance, rlm_cipher_t);
+
+	if (inst->type == RLM_CIPHER_TYPE_RSA) TALLOC_FREE(inst->rsa->offload);
+
+	return 0;
+}
+
 /*
  *	The module name should be the only globally exported symbol.
  *	That is, everything else should be 'static'.
@@ -1368,5 +1631,7 @@ module_t rlm_cipher = {
 	.thread_inst_size	= sizeof(rlm_cipher_rsa_thread_inst_t),
 	.config			= module_config,
 	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
+	.detach			= mod_detach,
 	.thread_instantiate	= mod_thread_instantiate,
 };
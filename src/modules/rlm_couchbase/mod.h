@@ -27,6 +27,7 @@
 RCSIDH(mod_h, "$Id$")
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/offload.h>
 #include <freeradius-devel/server/pool.h>
 
 #include <freeradius-devel/json/base.h>
@@ -59,6 +60,8 @@ typedef struct {
 
 	json_object		*map;           	//!< Json object to hold user defined attribute map.
 	fr_pool_t		*pool;			//!< Connection pool.
+	uint32_t		threads;		//!< Number of offload helper threads.
+	fr_offload_t		*offload;		//!< Helper threads which run the blocking libcouchbase calls.
 	char const		*name;			//!< Module instance name.
 	void			*api_opts;		//!< Couchbase API internal options.
 } rlm_couchbase_t;
@@ -64,6 +64,8 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("user_key", FR_TYPE_TMPL, rlm_couchbase_t, user_key), .dflt = "raduser_%{md5:%{tolower:%{%{Stripped-User-Name}:-%{User-Name}}}}", .quote = T_DOUBLE_QUOTED_STRING },
 	{ FR_CONF_OFFSET("read_clients", FR_TYPE_BOOL, rlm_couchbase_t, read_clients) }, /* NULL defaults to "no" */
 	{ FR_CONF_POINTER("client", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) client_config },
+
+	{ FR_CONF_OFFSET("threads", FR_TYPE_UINT32, rlm_couchbase_t, threads), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -87,61 +89,90 @@ fr_dict_attr_autoload_t rlm_couchbase_dict_attr[] = {
 	{ NULL }
 };
 
-/** Handle authorization requests using Couchbase document data
+/** A blocking libcouchbase call running on an offload helper thread
  *
- * Attempt to fetch the document assocaited with the requested user by
- * using the deterministic key defined in the configuration.  When a valid
- * document is found it will be parsed and the containing value pairs will be
- * injected into the request.
+ */
+typedef struct {
+	rlm_couchbase_t const	*inst;
+	rlm_couchbase_handle_t	*handle;		//!< Held until the offload context is freed.
+	char			*dockey;		//!< Document key.
+	char			*document;		//!< Document body to store, NULL for fetches.
+	int			status;			//!< Acct-Status-Type, for accounting.
+	lcb_error_t		cb_error;		//!< Result of the call.
+} rlm_couchbase_offload_t;
+
+/** Free any fetched document, and release the handle
  *
- * @param[out] p_result		Operation status (#rlm_rcode_t).
- * @param[in] mctx		module calling context.
- * @param[in] request		The authorization request.
+ * May be called from a helper thread if the request was cancelled.
  */
-static unlang_action_t mod_authorize(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+static int _couchbase_offload_free(rlm_couchbase_offload_t *ctx)
 {
-	rlm_couchbase_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_couchbase_t);		/* our module instance */
-	rlm_couchbase_handle_t	*handle = NULL;			/* connection pool handle */
-	char			buffer[MAX_KEY_SIZE];
-	char const		*dockey;			/* our document key */
-	lcb_error_t		cb_error = LCB_SUCCESS;		/* couchbase error holder */
-	rlm_rcode_t		rcode = RLM_MODULE_OK;		/* return code */
-	ssize_t			slen;
+	cookie_t *cookie = ctx->handle->cookie;
 
-	/* assert packet as not null */
-	fr_assert(request->packet != NULL);
-
-	/* attempt to build document key */
-	slen = tmpl_expand(&dockey, buffer, sizeof(buffer), request, inst->user_key, NULL, NULL);
-	if (slen < 0) RETURN_MODULE_FAIL;
-	if ((dockey == buffer) && is_truncated((size_t)slen, sizeof(buffer))) {
-		REDEBUG("Key too long, expected < " STRINGIFY(sizeof(buffer)) " bytes, got %zi bytes", slen);
-		RETURN_MODULE_FAIL;
+	if (cookie->jobj) {
+		json_object_put(cookie->jobj);
+		cookie->jobj = NULL;
 	}
 
-	/* get handle */
-	handle = fr_pool_connection_get(inst->pool, request);
+	fr_pool_connection_release(ctx->inst->pool, NULL, ctx->handle);
 
-	/* check handle */
-	if (!handle) RETURN_MODULE_FAIL;
+	return 0;
+}
 
-	/* set couchbase instance */
-	lcb_t cb_inst = handle->handle;
+/** Fetch a document on a helper thread
+ *
+ */
+static void couchbase_offload_get(void *uctx)
+{
+	rlm_couchbase_offload_t *ctx = talloc_get_type_abort(uctx, rlm_couchbase_offload_t);
 
-	/* set cookie */
-	cookie_t *cookie = handle->cookie;
+	ctx->cb_error = couchbase_get_key(ctx->handle->handle, ctx->handle->cookie, ctx->dockey);
+}
 
-	/* fetch document */
-	cb_error = couchbase_get_key(cb_inst, cookie, dockey);
+/** Store a document on a helper thread
+ *
+ */
+static void couchbase_offload_set(void *uctx)
+{
+	rlm_couchbase_offload_t *ctx = talloc_get_type_abort(uctx, rlm_couchbase_offload_t);
+
+	ctx->cb_error = couchbase_set_key(ctx->handle->handle, ctx->dockey, ctx->document, ctx->inst->expire);
+}
+
+/** Allocate an offload context, which takes ownership of the handle
+ *
+ */
+static rlm_couchbase_offload_t *couchbase_offload_alloc(rlm_couchbase_t const *inst,
+							rlm_couchbase_handle_t *handle, char const *dockey)
+{
+	rlm_couchbase_offload_t *ctx;
+
+	MEM(ctx = talloc_zero(NULL, rlm_couchbase_offload_t));
+	ctx->inst = inst;
+	ctx->handle = handle;
+	MEM(ctx->dockey = talloc_strdup(ctx, dockey));
+	talloc_set_destructor(ctx, _couchbase_offload_free);
 
+	return ctx;
+}
+
+/** Add the attributes from a fetched user document to the request
+ *
+ * @param[in] inst		our module instance.
+ * @param[in] request		The authorization request.
+ * @param[in] cb_error		result of fetching the document.
+ * @param[in] cookie		holding the fetched document.
+ * @return the result of the authorization.
+ */
+static rlm_rcode_t couchbase_authorize_process(rlm_couchbase_t const *inst, request_t *request,
+					       lcb_error_t cb_error, cookie_t *cookie)
+{
 	/* check error */
 	if (cb_error != LCB_SUCCESS || !cookie->jobj) {
 		/* log error */
 		RERROR("failed to fetch document or parse return");
-		/* set return */
-		rcode = RLM_MODULE_FAIL;
 		/* return */
-		goto finish;
+		return RLM_MODULE_FAIL;
 	}
 
 	/* debugging */
@@ -167,8 +198,7 @@ static unlang_action_t mod_authorize(rlm_rcode_t *p_result, module_ctx_t const *
 		    (mod_json_object_to_map(pool, &maps, request, cookie->jobj, PAIR_LIST_STATE) < 0)) {
 		invalid:
 			talloc_free(pool);
-			rcode = RLM_MODULE_INVALID;
-			goto finish;
+			return RLM_MODULE_INVALID;
 		}
 
 		fr_dlist_init(&vlm_head, vp_list_mod_t, entry);
@@ -185,8 +215,7 @@ static unlang_action_t mod_authorize(rlm_rcode_t *p_result, module_ctx_t const *
 		if (fr_dlist_empty(&vlm_head)) {
 			RDEBUG2("Nothing to update");
 			talloc_free(pool);
-			rcode = RLM_MODULE_NOOP;
-			goto finish;
+			return RLM_MODULE_NOOP;
 		}
 
 		/*
@@ -198,77 +227,62 @@ static unlang_action_t mod_authorize(rlm_rcode_t *p_result, module_ctx_t const *
 			ret = map_list_mod_apply(request, vlm);	/* SHOULD NOT FAIL */
 			if (!fr_cond_assert(ret == 0)) {
 				talloc_free(pool);
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
+				return RLM_MODULE_FAIL;
 			}
 		}
 
 		talloc_free(pool);
 	}
 
-finish:
-	/* free json object */
-	if (cookie->jobj) {
-		json_object_put(cookie->jobj);
-		cookie->jobj = NULL;
-	}
+	return RLM_MODULE_OK;
+}
 
-	/* release handle */
-	if (handle) fr_pool_connection_release(inst->pool, request, handle);
+/** The user document has been fetched on a helper thread
+ *
+ */
+static unlang_action_t mod_authorize_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					    request_t *request, void *rctx)
+{
+	rlm_couchbase_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_couchbase_t);
+	rlm_couchbase_offload_t	*ctx = talloc_get_type_abort(rctx, rlm_couchbase_offload_t);
+	rlm_rcode_t		rcode;
+
+	rcode = couchbase_authorize_process(inst, request, ctx->cb_error, ctx->handle->cookie);
+	talloc_free(ctx);
 
-	/* return */
 	RETURN_MODULE_RCODE(rcode);
 }
 
-/** Write accounting data to Couchbase documents
- *
- * Handle accounting requests and store the associated data into JSON documents
- * in couchbase mapping attribute names to JSON element names per the module configuration.
+/** Handle authorization requests using Couchbase document data
  *
- * When an existing document already exists for the same accounting section the new attributes
- * will be merged with the currently existing data.  When conflicts arrise the new attribute
- * value will replace or be added to the existing value.
+ * Attempt to fetch the document assocaited with the requested user by
+ * using the deterministic key defined in the configuration.  When a valid
+ * document is found it will be parsed and the containing value pairs will be
+ * injected into the request.
  *
- * @param[out] p_result		Result of calling the module.
- * @param mctx			module calling context.
- * @param request		The accounting request object.
+ * @param[out] p_result		Operation status (#rlm_rcode_t).
+ * @param[in] mctx		module calling context.
+ * @param[in] request		The authorization request.
  */
-static unlang_action_t mod_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+static unlang_action_t mod_authorize(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_couchbase_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_couchbase_t);       /* our module instance */
-	rlm_couchbase_handle_t *handle = NULL;  /* connection pool handle */
-	rlm_rcode_t rcode = RLM_MODULE_OK;      /* return code */
-	fr_pair_t *vp;                         /* radius value pair linked list */
-	char buffer[MAX_KEY_SIZE];
-	char const *dockey;			/* our document key */
-	char document[MAX_VALUE_SIZE];          /* our document body */
-	char element[MAX_KEY_SIZE];             /* mapped radius attribute to element name */
-	int status = 0;                         /* account status type */
-	int docfound = 0;                       /* document found toggle */
-	lcb_error_t cb_error = LCB_SUCCESS;     /* couchbase error holder */
-	ssize_t slen;
-
+	rlm_couchbase_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_couchbase_t);		/* our module instance */
+	rlm_couchbase_handle_t	*handle = NULL;			/* connection pool handle */
+	char			buffer[MAX_KEY_SIZE];
+	char const		*dockey;			/* our document key */
+	lcb_error_t		cb_error = LCB_SUCCESS;		/* couchbase error holder */
+	rlm_rcode_t		rcode = RLM_MODULE_OK;		/* return code */
+	ssize_t			slen;
 
 	/* assert packet as not null */
 	fr_assert(request->packet != NULL);
 
-	/* sanity check */
-	if ((vp = fr_pair_find_by_da(&request->request_pairs, attr_acct_status_type, 0)) == NULL) {
-		/* log debug */
-		RDEBUG2("could not find status type in packet");
-		/* return */
-		RETURN_MODULE_NOOP;
-	}
-
-	/* set status */
-	status = vp->vp_uint32;
-
-	/* acknowledge the request but take no action */
-	if (status == FR_STATUS_ACCOUNTING_ON || status == FR_STATUS_ACCOUNTING_OFF) {
-		/* log debug */
-		RDEBUG2("handling accounting on/off request without action");
-		/* return */
-		RETURN_MODULE_OK;
+	/* attempt to build document key */
+	slen = tmpl_expand(&dockey, buffer, sizeof(buffer), request, inst->user_key, NULL, NULL);
+	if (slen < 0) RETURN_MODULE_FAIL;
+	if ((dockey == buffer) && is_truncated((size_t)slen, sizeof(buffer))) {
+		REDEBUG("Key too long, expected < " STRINGIFY(sizeof(buffer)) " bytes, got %zi bytes", slen);
+		RETURN_MODULE_FAIL;
 	}
 
 	/* get handle */
@@ -277,27 +291,58 @@ static unlang_action_t mod_accounting(rlm_rcode_t *p_result, module_ctx_t const
 	/* check handle */
 	if (!handle) RETURN_MODULE_FAIL;
 
-	/* set couchbase instance */
-	lcb_t cb_inst = handle->handle;
+	/*
+	 *	Waiting for the document may take a while.  Do it on
+	 *	a helper thread, so that the worker can get on with
+	 *	other requests.  The handle is now owned by the
+	 *	offload context.
+	 */
+	if (inst->offload) {
+		RDEBUG3("fetching document %s on a helper thread", dockey);
+		return unlang_module_offload(p_result, request, inst->offload, couchbase_offload_get,
+					     mod_authorize_resume, couchbase_offload_alloc(inst, handle, dockey));
+	}
 
 	/* set cookie */
 	cookie_t *cookie = handle->cookie;
 
-	/* attempt to build document key */
-	slen = tmpl_expand(&dockey, buffer, sizeof(buffer), request, inst->acct_key, NULL, NULL);
-	if (slen < 0) {
-		rcode = RLM_MODULE_FAIL;
-		goto finish;
-	}
-	if ((dockey == buffer) && is_truncated((size_t)slen, sizeof(buffer))) {
-		REDEBUG("Key too long, expected < " STRINGIFY(sizeof(buffer)) " bytes, got %zi bytes", slen);
-		rcode = RLM_MODULE_FAIL;
-		/* return */
-		goto finish;
+	/* fetch document */
+	cb_error = couchbase_get_key(handle->handle, cookie, dockey);
+
+	rcode = couchbase_authorize_process(inst, request, cb_error, cookie);
+
+	/* free json object */
+	if (cookie->jobj) {
+		json_object_put(cookie->jobj);
+		cookie->jobj = NULL;
 	}
 
-	/* attempt to fetch document */
-	cb_error = couchbase_get_key(cb_inst, cookie, dockey);
+	/* release handle */
+	fr_pool_connection_release(inst->pool, request, handle);
+
+	/* return */
+	RETURN_MODULE_RCODE(rcode);
+}
+
+/** Merge the accounting data into a fetched document
+ *
+ * @param[out] out		the JSON document to store.
+ * @param[in] inst		our module instance.
+ * @param[in] request		The accounting request.
+ * @param[in] status		Acct-Status-Type of the request.
+ * @param[in] cb_error		result of fetching the existing document.
+ * @param[in] cookie		holding the existing document, if there is one.
+ * @return
+ *	- RLM_MODULE_OK if there's a document to store.
+ *	- Another return code on failure, or if there's nothing to store.
+ */
+static rlm_rcode_t couchbase_accounting_document(char **out, rlm_couchbase_t const *inst, request_t *request,
+						 int status, lcb_error_t cb_error, cookie_t *cookie)
+{
+	fr_pair_t *vp;                          /* radius value pair linked list */
+	char element[MAX_KEY_SIZE];             /* mapped radius attribute to element name */
+	char const *document;                   /* our document body */
+	int docfound = 0;                       /* document found toggle */
 
 	/* check error and object */
 	if (cb_error != LCB_SUCCESS || cookie->jerr != json_tokener_success || !cookie->jobj) {
@@ -361,9 +406,7 @@ static unlang_action_t mod_accounting(rlm_rcode_t *p_result, module_ctx_t const
 
 	default:
 		/* don't doing anything */
-		rcode = RLM_MODULE_NOOP;
-		/* return */
-		goto finish;
+		return RLM_MODULE_NOOP;
 	}
 
 	/* loop through pairs and add to json document */
@@ -379,21 +422,172 @@ static unlang_action_t mod_accounting(rlm_rcode_t *p_result, module_ctx_t const
 		}
 	}
 
-	/* copy json string to document and check size */
-	if (strlcpy(document, json_object_to_json_string(cookie->jobj), sizeof(document)) >= sizeof(document)) {
+	/* check document size */
+	document = json_object_to_json_string(cookie->jobj);
+	if (strlen(document) >= MAX_VALUE_SIZE) {
 		/* this isn't good */
 		RERROR("could not write json document - insufficient buffer space");
-		/* set return */
-		rcode = RLM_MODULE_FAIL;
 		/* return */
-		goto finish;
+		return RLM_MODULE_FAIL;
+	}
+
+	/* copy the json string, as it belongs to the json object */
+	MEM(*out = talloc_strdup(NULL, document));
+
+	return RLM_MODULE_OK;
+}
+
+/** The accounting document has been stored on a helper thread
+ *
+ */
+static unlang_action_t mod_accounting_stored(rlm_rcode_t *p_result, UNUSED module_ctx_t const *mctx,
+					     request_t *request, void *rctx)
+{
+	rlm_couchbase_offload_t	*ctx = talloc_get_type_abort(rctx, rlm_couchbase_offload_t);
+
+	/* check return */
+	if (ctx->cb_error != LCB_SUCCESS) {
+		RERROR("failed to store document (%s): %s (0x%x)", ctx->dockey,
+		       lcb_strerror(NULL, ctx->cb_error), ctx->cb_error);
+	}
+	talloc_free(ctx);
+
+	RETURN_MODULE_OK;
+}
+
+/** The existing accounting document has been fetched on a helper thread
+ *
+ * Merge in the data from the request, and go back to a helper thread to
+ * store the result.
+ */
+static unlang_action_t mod_accounting_fetched(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					      request_t *request, void *rctx)
+{
+	rlm_couchbase_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_couchbase_t);
+	rlm_couchbase_offload_t	*ctx = talloc_get_type_abort(rctx, rlm_couchbase_offload_t);
+	cookie_t		*cookie = ctx->handle->cookie;
+	char			*document = NULL;
+	rlm_rcode_t		rcode;
+
+	rcode = couchbase_accounting_document(&document, inst, request, ctx->status, ctx->cb_error, cookie);
+
+	/* free and reset json object */
+	if (cookie->jobj) {
+		json_object_put(cookie->jobj);
+		cookie->jobj = NULL;
+	}
+
+	if (rcode != RLM_MODULE_OK) {
+		talloc_free(ctx);
+		RETURN_MODULE_RCODE(rcode);
 	}
 
+	RDEBUG3("setting '%s' => '%s' on a helper thread", ctx->dockey, document);
+	ctx->document = talloc_steal(ctx, document);
+
+	/*
+	 *	The context is owned by the previous offload frame,
+	 *	and must have no parent to be offloaded again.
+	 */
+	talloc_steal(NULL, ctx);
+
+	return unlang_module_offload(p_result, request, inst->offload, couchbase_offload_set,
+				     mod_accounting_stored, ctx);
+}
+
+/** Write accounting data to Couchbase documents
+ *
+ * Handle accounting requests and store the associated data into JSON documents
+ * in couchbase mapping attribute names to JSON element names per the module configuration.
+ *
+ * When an existing document already exists for the same accounting section the new attributes
+ * will be merged with the currently existing data.  When conflicts arrise the new attribute
+ * value will replace or be added to the existing value.
+ *
+ * @param[out] p_result		Result of calling the module.
+ * @param mctx			module calling context.
+ * @param request		The accounting request object.
+ */
+static unlang_action_t mod_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_couchbase_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_couchbase_t);       /* our module instance */
+	rlm_couchbase_handle_t *handle = NULL;  /* connection pool handle */
+	rlm_rcode_t rcode = RLM_MODULE_OK;      /* return code */
+	fr_pair_t *vp;                         /* radius value pair linked list */
+	char buffer[MAX_KEY_SIZE];
+	char const *dockey;			/* our document key */
+	char *document = NULL;			/* our document body */
+	int status = 0;                         /* account status type */
+	lcb_error_t cb_error = LCB_SUCCESS;     /* couchbase error holder */
+	ssize_t slen;
+
+
+	/* assert packet as not null */
+	fr_assert(request->packet != NULL);
+
+	/* sanity check */
+	if ((vp = fr_pair_find_by_da(&request->request_pairs, attr_acct_status_type, 0)) == NULL) {
+		/* log debug */
+		RDEBUG2("could not find status type in packet");
+		/* return */
+		RETURN_MODULE_NOOP;
+	}
+
+	/* set status */
+	status = vp->vp_uint32;
+
+	/* acknowledge the request but take no action */
+	if (status == FR_STATUS_ACCOUNTING_ON || status == FR_STATUS_ACCOUNTING_OFF) {
+		/* log debug */
+		RDEBUG2("handling accounting on/off request without action");
+		/* return */
+		RETURN_MODULE_OK;
+	}
+
+	/* attempt to build document key */
+	slen = tmpl_expand(&dockey, buffer, sizeof(buffer), request, inst->acct_key, NULL, NULL);
+	if (slen < 0) RETURN_MODULE_FAIL;
+	if ((dockey == buffer) && is_truncated((size_t)slen, sizeof(buffer))) {
+		REDEBUG("Key too long, expected < " STRINGIFY(sizeof(buffer)) " bytes, got %zi bytes", slen);
+		RETURN_MODULE_FAIL;
+	}
+
+	/* get handle */
+	handle = fr_pool_connection_get(inst->pool, request);
+
+	/* check handle */
+	if (!handle) RETURN_MODULE_FAIL;
+
+	/*
+	 *	Fetch the existing document on a helper thread, then
+	 *	merge in the request data on the worker, then store
+	 *	it on a helper thread again.
+	 */
+	if (inst->offload) {
+		rlm_couchbase_offload_t *ctx;
+
+		ctx = couchbase_offload_alloc(inst, handle, dockey);
+		ctx->status = status;
+
+		RDEBUG3("fetching document %s on a helper thread", dockey);
+		return unlang_module_offload(p_result, request, inst->offload, couchbase_offload_get,
+					     mod_accounting_fetched, ctx);
+	}
+
+	/* set cookie */
+	cookie_t *cookie = handle->cookie;
+
+	/* attempt to fetch document */
+	cb_error = couchbase_get_key(handle->handle, cookie, dockey);
+
+	rcode = couchbase_accounting_document(&document, inst, request, status, cb_error, cookie);
+	if (rcode != RLM_MODULE_OK) goto finish;
+
 	/* debugging */
 	RDEBUG3("setting '%s' => '%s'", dockey, document);
 
 	/* store document/key in couchbase */
-	cb_error = couchbase_set_key(cb_inst, dockey, document, inst->expire);
+	cb_error = couchbase_set_key(handle->handle, dockey, document, inst->expire);
 
 	/* check return */
 	if (cb_error != LCB_SUCCESS) {
@@ -401,6 +595,8 @@ static unlang_action_t mod_accounting(rlm_rcode_t *p_result, module_ctx_t const
 	}
 
 finish:
+	talloc_free(document);
+
 	/* free and reset json object */
 	if (cookie->jobj) {
 		json_object_put(cookie->jobj);
@@ -408,15 +604,12 @@ finish:
 	}
 
 	/* release our connection handle */
-	if (handle) {
-		fr_pool_connection_release(inst->pool, request, handle);
-	}
+	fr_pool_connection_release(inst->pool, request, handle);
 
 	/* return */
 	RETURN_MODULE_RCODE(rcode);
 }
 
-
 /** Detach the module
  *
  * Detach the module instance and free any allocated resources.
@@ -428,6 +621,12 @@ static int mod_detach(void *instance)
 {
 	rlm_couchbase_t *inst = instance;
 
+	/*
+	 *	Helper threads hold handles, so must be
+	 *	stopped before the pool is freed.
+	 */
+	TALLOC_FREE(inst->offload);
+
 	if (inst->map) json_object_put(inst->map);
 	if (inst->pool) fr_pool_free(inst->pool);
 	if (inst->api_opts) mod_free_api_opts(inst);
@@ -521,6 +720,15 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	/* start helper threads for blocking calls if requested */
+	if (inst->threads) {
+		inst->offload = fr_offload_alloc(inst, "couchbase", inst->threads);
+		if (!inst->offload) {
+			cf_log_perr(conf, "Unable to initialise couchbase helper threads");
+			return -1;
+		}
+	}
+
 	/* load clients if requested */
 	if (inst->read_clients) {
 		CONF_SECTION *cs, *map, *tmpl; /* conf section */
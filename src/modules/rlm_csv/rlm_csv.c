@@ -25,7 +25,9 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/line_index.h>
 #include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/reload.h>
 #include <freeradius-devel/util/htrie.h>
 #include <freeradius-devel/util/debug.h>
 
@@ -34,6 +36,27 @@ RCSID("$Id$")
 static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, request_t *request,
 				fr_value_box_list_t *key, fr_map_list_t const *maps);
 
+/** How keys are matched against the index field
+ *
+ */
+typedef enum {
+	CSV_MATCH_EXACT = 0,				//!< Key must equal the index field.
+	CSV_MATCH_PREFIX,				//!< Longest index field which is a prefix of the key.
+	CSV_MATCH_SUFFIX				//!< Longest index field which is a suffix of the key.
+} rlm_csv_match_t;
+
+static fr_table_num_sorted_t const csv_match_table[] = {
+	{ L("exact"),	CSV_MATCH_EXACT		},
+	{ L("prefix"),	CSV_MATCH_PREFIX	},
+	{ L("suffix"),	CSV_MATCH_SUFFIX	}
+};
+static size_t csv_match_table_len = NUM_ELEMENTS(csv_match_table);
+
+/** Longest prefix or suffix which can be stored in the trie
+ *
+ */
+#define CSV_MATCH_KEY_MAX	(256)
+
 /*
  *	Define a structure for our module configuration.
  *
@@ -47,10 +70,16 @@ typedef struct {
 	char const	*delimiter;
 	char const	*fields;
 	char const	*index_field_name;
+	char const	*index_match_name;
+	rlm_csv_match_t	index_match;
 
 	bool		header;
 	bool		allow_multiple_keys;
 	bool		multiple_index_fields;
+	bool		mmap;				//!< Map the file, and parse entries on lookup.
+	char const	*index_file;			//!< Where to save the index of the mapped file.
+	bool		reload;				//!< Re-read the file when it changes.
+	fr_time_delta_t	reload_delay;			//!< How long the file must be unchanged before reloading.
 
 	int		num_fields;
 	int		used_fields;
@@ -60,7 +89,10 @@ typedef struct {
 	int		*field_offsets; /* field X from the file maps to array entry Y here */
 	fr_type_t	*field_types;
 	fr_rb_tree_t	*tree;
-	fr_htrie_t	*trie;
+	fr_htrie_type_t	htype;
+	fr_reload_t	*trie;				//!< Current fr_htrie_t of entries, or
+							///< fr_line_index_t of lines.
+	CONF_SECTION	*cs;				//!< For errors when the file is reloaded.
 
 	tmpl_t		*key;
 	fr_type_t	key_data_type;
@@ -86,14 +118,19 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("header", FR_TYPE_BOOL, rlm_csv_t, header) },
 	{ FR_CONF_OFFSET("allow_multiple_keys", FR_TYPE_BOOL, rlm_csv_t, allow_multiple_keys) },
 	{ FR_CONF_OFFSET("index_field", FR_TYPE_STRING | FR_TYPE_REQUIRED | FR_TYPE_NOT_EMPTY, rlm_csv_t, index_field_name) },
+	{ FR_CONF_OFFSET("index_match", FR_TYPE_STRING | FR_TYPE_NOT_EMPTY, rlm_csv_t, index_match_name), .dflt = "exact" },
 	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL, rlm_csv_t, key) },
+	{ FR_CONF_OFFSET("mmap", FR_TYPE_BOOL, rlm_csv_t, mmap), .dflt = "no" },
+	{ FR_CONF_OFFSET("index_file", FR_TYPE_STRING, rlm_csv_t, index_file) },
+	{ FR_CONF_OFFSET("reload", FR_TYPE_BOOL, rlm_csv_t, reload), .dflt = "no" },
+	{ FR_CONF_OFFSET("reload_delay", FR_TYPE_TIME_DELTA, rlm_csv_t, reload_delay), .dflt = "1" },
 	CONF_PARSER_TERMINATOR
 };
 
 /*
  *	Allow for quotation marks.
  */
-static bool buf2entry(rlm_csv_t *inst, char *buf, char **out)
+static bool buf2entry(rlm_csv_t const *inst, char *buf, char **out)
 {
 	char *p, *q;
 
@@ -186,13 +223,49 @@ static int csv_to_key(uint8_t **out, size_t *outlen, void const *data)
 }
 
 
-static bool insert_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t *e, int lineno)
+/** Reverse the bytes of a key
+ *
+ * Suffix matches are done by looking up the reversed key in a prefix trie.
+ * out and in may be the same buffer.
+ */
+static void csv_key_reverse(uint8_t *out, uint8_t const *in, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < (len / 2); i++) {
+		uint8_t c = in[i];
+
+		out[i] = in[len - 1 - i];
+		out[len - 1 - i] = c;
+	}
+	if (len & 0x01) out[len / 2] = in[len / 2];
+}
+
+static bool insert_entry(CONF_SECTION *conf, rlm_csv_t const *inst, fr_htrie_t *trie, rlm_csv_entry_t *e, int lineno)
 {
 	rlm_csv_entry_t *old;
 
 	fr_assert(e != NULL);
 
-	old = fr_htrie_find(inst->trie, e);
+	if (inst->index_match != CSV_MATCH_EXACT) {
+		if (e->key->vb_length > CSV_MATCH_KEY_MAX) {
+			cf_log_err(conf, "%s[%d]: Index field is longer than %u bytes, and cannot be used for %s matches",
+				   inst->filename, lineno, CSV_MATCH_KEY_MAX, inst->index_match_name);
+			goto fail;
+		}
+
+		if (inst->index_match == CSV_MATCH_SUFFIX) {
+			uint8_t *p = UNCONST(uint8_t *, e->key->datum.ptr);
+
+			csv_key_reverse(p, p, e->key->vb_length);
+		}
+	}
+
+	/*
+	 *	Check for an exact duplicate.  fr_htrie_find() would
+	 *	return enclosing prefixes from tries.
+	 */
+	old = fr_htrie_match(trie, e);
 	if (old) {
 		if (!inst->allow_multiple_keys && !inst->multiple_index_fields) {
 			cf_log_err(conf, "%s[%d]: Multiple entries are disallowed", inst->filename, lineno);
@@ -208,7 +281,7 @@ static bool insert_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t *e
 		return true;
 	}
 
-	if (!fr_htrie_insert(inst->trie, e)) {
+	if (!fr_htrie_insert(trie, e)) {
 		cf_log_err(conf, "Failed inserting entry for file %s line %d: %s",
 			   inst->filename, lineno, fr_strerror());
 fail:
@@ -220,13 +293,14 @@ fail:
 }
 
 
-static bool duplicate_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t *old, char *p, int lineno)
+static bool duplicate_entry(CONF_SECTION *conf, rlm_csv_t const *inst, fr_htrie_t *trie,
+			    rlm_csv_entry_t *old, char *p, int lineno)
 {
 	int i;
 	fr_type_t type = inst->key_data_type;
 	rlm_csv_entry_t *e;
 
-	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(inst, uint8_t,
+	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(trie, uint8_t,
 						     sizeof(*e) + (inst->used_fields * sizeof(e->data[0]))));
 	talloc_set_type(e, rlm_csv_entry_t);
 
@@ -244,19 +318,19 @@ static bool duplicate_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t
 		if (old->data[i]) e->data[i] = old->data[i]; /* no need to dup it, it's never freed... */
 	}
 
-	return insert_entry(conf, inst, e, lineno);
+	return insert_entry(conf, inst, trie, e, lineno);
 }
 
 /*
  *	Convert a buffer to a CSV entry
  */
-static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buffer)
+static bool file2csv(CONF_SECTION *conf, rlm_csv_t const *inst, fr_htrie_t *trie, int lineno, char *buffer)
 {
 	rlm_csv_entry_t *e;
 	int i;
 	char *p, *q;
 
-	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(inst, uint8_t,
+	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(trie, uint8_t,
 						     sizeof(*e) + (inst->used_fields * sizeof(e->data[0]))));
 	talloc_set_type(e, rlm_csv_entry_t);
 
@@ -302,7 +376,7 @@ static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buff
 				while (l) {
 					*l = '\0';
 
-					if (!duplicate_entry(conf, inst, e, p, lineno)) goto fail;
+					if (!duplicate_entry(conf, inst, trie, e, p, lineno)) goto fail;
 
 					if (!l) break;
 					p = l + 1;
@@ -353,7 +427,98 @@ static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buff
 		goto fail;
 	}
 
-	return insert_entry(conf, inst, e, lineno);
+	return insert_entry(conf, inst, trie, e, lineno);
+}
+
+/** Find the index field of a line in a mapped file
+ *
+ * Quoted keys may not contain quotation marks, as the key has to be
+ * compared in place.
+ */
+static int csv_line_key(char const **key, size_t *keylen, char const *line, size_t len, void *uctx)
+{
+	rlm_csv_t const	*inst = talloc_get_type_abort_const(uctx, rlm_csv_t);
+	char const	*p = line, *end = line + len, *q;
+	int		i;
+
+	for (i = 0; p <= end; i++) {
+		if ((p < end) && (*p == '"')) {
+			q = memchr(p + 1, '"', end - (p + 1));
+			if (!q) return -1;
+
+			if (i == inst->index_field) {
+				if (((q + 1) < end) && (q[1] != *inst->delimiter)) return -1;
+
+				*key = p + 1;
+				*keylen = q - (p + 1);
+				return 1;
+			}
+
+			/*
+			 *	Skip over doubled quotes in other fields.
+			 */
+			while (((q + 1) < end) && (q[1] == '"')) {
+				q = memchr(q + 2, '"', end - (q + 2));
+				if (!q) return -1;
+			}
+			q++;
+		} else {
+			/*
+			 *	Same as buf2entry(), so that keys are
+			 *	found the same way as when the file is
+			 *	parsed into memory.
+			 */
+			q = (p < end) ? memchr(p + 1, *inst->delimiter, end - (p + 1)) : NULL;
+			if (!q) q = end;
+
+			if (i == inst->index_field) {
+				*key = p;
+				*keylen = q - p;
+				return 1;
+			}
+		}
+
+		p = q + 1;
+	}
+
+	return -1;
+}
+
+/** Parse a line from a mapped file into a temporary entry
+ *
+ * Only the data fields are filled in.  Field types are checked when
+ * the values are mapped to attributes.
+ */
+static rlm_csv_entry_t *csv_line_to_entry(TALLOC_CTX *ctx, rlm_csv_t const *inst, char const *line, size_t len)
+{
+	rlm_csv_entry_t	*e;
+	char		buffer[8192];
+	char		*p, *q;
+	int		i;
+
+	if (len >= sizeof(buffer)) return NULL;
+
+	memcpy(buffer, line, len);
+	buffer[len] = '\0';
+
+	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(ctx, uint8_t,
+						     sizeof(*e) + (inst->used_fields * sizeof(e->data[0]))));
+	talloc_set_type(e, rlm_csv_entry_t);
+
+	for (p = buffer, i = 0; p != NULL; p = q, i++) {
+		if (!buf2entry(inst, p, &q) || (i >= inst->num_fields)) {
+			talloc_free(e);
+			return NULL;
+		}
+
+		if (q) *(q++) = '\0';
+
+		if ((i == inst->index_field) || (inst->field_offsets[i] < 0)) continue;
+
+		MEM(e->data[inst->field_offsets[i]] = talloc_typed_strdup(e, p));
+	}
+
+	return e;
 }
 
 
@@ -516,7 +681,6 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	char const *p;
 	char *q;
 	char *fields;
-	fr_htrie_type_t	htype;
 
 	inst->name = cf_section_name2(conf);
 	if (!inst->name) inst->name = cf_section_name1(conf);
@@ -546,24 +710,49 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 		inst->key_data_type = FR_TYPE_STRING;
 	}
 
+	inst->index_match = fr_table_value_by_str(csv_match_table, inst->index_match_name, -1);
+	if ((int) inst->index_match < 0) {
+		cf_log_err(conf, "Invalid value '%s' for 'index_match'.  Must be one of 'exact', 'prefix' or 'suffix'",
+			   inst->index_match_name);
+		return -1;
+	}
+
 	/*
 	 *	IP addresses go into tries.  Everything else into binary tries.
+	 *
+	 *	Prefix and suffix matches on strings also use tries.
+	 *	Suffixes are stored reversed.
 	 */
-	htype = fr_htrie_hint(inst->key_data_type);
-	if (htype == FR_HTRIE_INVALID) {
+	if (inst->index_match != CSV_MATCH_EXACT) {
+		if ((inst->key_data_type != FR_TYPE_STRING) && (inst->key_data_type != FR_TYPE_OCTETS)) {
+			cf_log_err(conf, "'index_match = %s' can only be used with 'string' or 'octets' keys",
+				   inst->index_match_name);
+			return -1;
+		}
+		inst->htype = FR_HTRIE_TRIE;
+	} else {
+		inst->htype = fr_htrie_hint(inst->key_data_type);
+	}
+	if (inst->htype == FR_HTRIE_INVALID) {
 		cf_log_err(conf, "Invalid data type '%s' used for CSV file.",
 			   fr_table_str_by_value(fr_value_box_type_table, inst->key_data_type, "???"));
 		return -1;
 	}
 
-	inst->trie = fr_htrie_alloc(inst, htype,
-				    (fr_hash_t) csv_hash,
-				    (fr_cmp_t) csv_cmp,
-				    (fr_trie_key_t) csv_to_key,
-				    NULL);
-	if (!inst->trie) {
-		cf_log_err(conf, "Failed creating internal trie: %s", fr_strerror());
-		return -1;
+	/*
+	 *	Mapped files are searched by comparing the text of
+	 *	the key field.
+	 */
+	if (inst->mmap) {
+		if (inst->key_data_type != FR_TYPE_STRING) {
+			cf_log_err(conf, "'mmap = yes' can only be used with 'string' keys");
+			return -1;
+		}
+
+		if (inst->index_match != CSV_MATCH_EXACT) {
+			cf_log_err(conf, "'mmap = yes' can only be used with 'index_match = exact'");
+			return -1;
+		}
 	}
 
 	if ((*inst->index_field_name == ',') || (*inst->index_field_name == *inst->delimiter)) {
@@ -728,6 +917,11 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	if (inst->mmap && inst->multiple_index_fields) {
+		cf_log_err(conf, "'mmap = yes' cannot be used with multiple index fields");
+		return -1;
+	}
+
 	/*
 	 *	Set the data type of the index field.
 	 */
@@ -742,6 +936,95 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 }
 
 
+/** (Re-)read the CSV file into a new trie
+ *
+ * This is called from the reload thread, and so must not modify
+ * the instance data.
+ */
+static void *csv_load(TALLOC_CTX *ctx, void *uctx)
+{
+	rlm_csv_t const	*inst = talloc_get_type_abort_const(uctx, rlm_csv_t);
+	fr_htrie_t	*trie;
+	int		lineno;
+	FILE		*fp;
+	char		buffer[8192];
+
+	if (inst->mmap) {
+		fr_line_index_t	*idx;
+		char		*params;
+
+		/*
+		 *	The index depends on the position of the key
+		 *	field, which may come from the header.
+		 */
+		MEM(params = talloc_asprintf(ctx, "csv:%d:%c:%d", inst->index_field, *inst->delimiter, inst->header));
+
+		idx = fr_line_index_alloc(ctx, &(fr_line_index_config_t){
+						.filename = inst->filename,
+						.index_file = inst->index_file,
+						.params = params,
+						.skip_lines = inst->header ? 1 : 0,
+						.unique = !inst->allow_multiple_keys,
+						.key = csv_line_key,
+						.uctx = UNCONST(rlm_csv_t *, inst)
+					  });
+		if (!idx) {
+			cf_log_perr(inst->cs, "Failed indexing %s", inst->filename);
+			return NULL;
+		}
+
+		DEBUG("%s - Indexed %zu entries in %s", inst->name, fr_line_index_num_lines(idx), inst->filename);
+
+		return idx;
+	}
+
+	trie = fr_htrie_alloc(ctx, inst->htype,
+			      (fr_hash_t) csv_hash,
+			      (fr_cmp_t) csv_cmp,
+			      (fr_trie_key_t) csv_to_key,
+			      NULL);
+	if (!trie) {
+		cf_log_err(inst->cs, "Failed creating internal trie: %s", fr_strerror());
+		return NULL;
+	}
+
+	fp = fopen(inst->filename, "r");
+	if (!fp) {
+		cf_log_err(inst->cs, "Error opening filename %s: %s", inst->filename, fr_syserror(errno));
+		return NULL;
+	}
+	lineno = 1;
+
+	/*
+	 *	If there is a header in the file, then read that first.
+	 *	This time we just ignore it.
+	 */
+	if (inst->header) {
+		char *p = fgets(buffer, sizeof(buffer), fp);
+		if (!p) {
+			cf_log_err(inst->cs, "Error reading filename %s: Unexpected EOF", inst->filename);
+			fclose(fp);
+			return NULL;
+		}
+		lineno++;
+	}
+
+	/*
+	 *	Read the rest of the file.
+	 */
+	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+		if (!file2csv(inst->cs, inst, trie, lineno, buffer)) {
+			fclose(fp);
+			return NULL;
+		}
+
+		lineno++;
+	}
+	fclose(fp);
+
+	return trie;
+}
+
 /** Instantiate the module
  *
  * Creates a new instance of the module reading parameters from a configuration section.
@@ -756,12 +1039,11 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 {
 	rlm_csv_t *inst = instance;
 	CONF_SECTION *cs;
-	int lineno;
-	FILE *fp;
 	tmpl_rules_t	parse_rules = {
 		.allow_foreign = true	/* Because we don't know where we'll be called */
 	};
-	char buffer[8192];
+
+	inst->cs = conf;
 
 	fr_map_list_init(&inst->map);
 	/*
@@ -791,42 +1073,27 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		cf_log_warn(conf, "Ignoring 'key', as no 'update' section has been defined.");
 	}
 
+	FR_TIME_DELTA_BOUND_CHECK("reload_delay", inst->reload_delay, >=, fr_time_delta_from_msec(100));
+
 	/*
 	 *	Re-open the file and read it all.
 	 */
-	fp = fopen(inst->filename, "r");
-	if (!fp) {
-		cf_log_err(conf, "Error opening filename %s: %s", inst->filename, fr_syserror(errno));
-		return -1;
-	}
-	lineno = 1;
+	inst->trie = fr_reload_alloc(inst, inst->name, &inst->filename, inst->reload ? 1 : 0,
+				     inst->reload_delay, csv_load, inst);
+	if (!inst->trie) return -1;
 
-	/*
-	 *	If there is a header in the file, then read that first.
-	 *	This time we just ignore it.
-	 */
-	if (inst->header) {
-		char *p = fgets(buffer, sizeof(buffer), fp);
-		if (!p) {
-			cf_log_err(conf, "Error reading filename %s: Unexpected EOF", inst->filename);
-			fclose(fp);
-			return -1;
-		}
-		lineno++;
-	}
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_csv_t *inst = instance;
 
 	/*
-	 *	Read the rest of the file.
+	 *	Stop the reload thread before the rest
+	 *	of the instance data goes away.
 	 */
-	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-		if (!file2csv(conf, inst, lineno, buffer)) {
-			fclose(fp);
-			return -1;
-		}
-
-		lineno++;
-	}
-	fclose(fp);
+	TALLOC_FREE(inst->trie);
 
 	return 0;
 }
@@ -897,13 +1164,67 @@ static rlm_rcode_t mod_map_apply(rlm_csv_t const *inst, request_t *request,
 				fr_value_box_t const *key, fr_map_list_t const *maps)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_UPDATED;
-	rlm_csv_entry_t		*e;
+	rlm_csv_entry_t		*e = NULL;
 	map_t const		*map = NULL;
+	fr_value_box_t		partial;
+	uint8_t			buffer[CSV_MATCH_KEY_MAX];
+	fr_line_index_t		*idx = NULL;
+	char const		*line;
+	size_t			pos, len;
+	fr_reload_ref_t		ref;
+	void			*data;
 
-	e = fr_htrie_find(inst->trie, &(rlm_csv_entry_t) { .key = UNCONST(fr_value_box_t *, key) } );
-	if (!e) {
-		rcode = RLM_MODULE_NOOP;
-		goto finish;
+	/*
+	 *	Only the first (or last) CSV_MATCH_KEY_MAX bytes of
+	 *	the key can match an entry in the trie.
+	 */
+	if ((inst->index_match == CSV_MATCH_SUFFIX) ||
+	    ((inst->index_match == CSV_MATCH_PREFIX) && (key->vb_length > sizeof(buffer)))) {
+		size_t		len = key->vb_length;
+		uint8_t const	*p = key->datum.ptr;
+
+		if (len > sizeof(buffer)) {
+			if (inst->index_match == CSV_MATCH_SUFFIX) p += len - sizeof(buffer);
+			len = sizeof(buffer);
+		}
+
+		if (inst->index_match == CSV_MATCH_SUFFIX) {
+			csv_key_reverse(buffer, p, len);
+			p = buffer;
+		}
+
+		if (key->type == FR_TYPE_STRING) {
+			fr_value_box_bstrndup_shallow(&partial, NULL, (char const *) p, len, key->tainted);
+		} else {
+			fr_value_box_memdup_shallow(&partial, NULL, p, len, key->tainted);
+		}
+		key = &partial;
+	}
+
+	data = fr_reload_acquire(&ref, inst->trie);
+
+	if (inst->mmap) {
+		idx = data;
+
+		line = fr_line_index_find(idx, &pos, &len, key->vb_strvalue, key->vb_length);
+		if (!line) {
+			rcode = RLM_MODULE_NOOP;
+			goto finish;
+		}
+
+	parse:
+		e = csv_line_to_entry(request, inst, line, len);
+		if (!e) {
+			REDEBUG("Malformed entry for key %pV in %s", key, inst->filename);
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+	} else {
+		e = fr_htrie_find(data, &(rlm_csv_entry_t) { .key = UNCONST(fr_value_box_t *, key) } );
+		if (!e) {
+			rcode = RLM_MODULE_NOOP;
+			goto finish;
+		}
 	}
 
 redo:
@@ -950,12 +1271,27 @@ redo:
 
 	REXDENT();
 
+	/*
+	 *	Entries from mapped files are temporary.
+	 */
+	if (idx) {
+		TALLOC_FREE(e);
+
+		line = fr_line_index_next(idx, &pos, &len, key->vb_strvalue, key->vb_length);
+		if (line) goto parse;
+
+		goto finish;
+	}
+
 	if (e->next) {
 		e = e->next;
 		goto redo;
 	}
 
 finish:
+	if (idx) talloc_free(e);
+	fr_reload_release(&ref);
+
 	return rcode;
 }
 
@@ -1050,6 +1386,7 @@ module_t rlm_csv = {
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
 
 	.method_names = (module_method_names_t[]){
 		{ .name1 = CF_IDENT_ANY,	.name2 = CF_IDENT_ANY,	.method = mod_process },
@@ -46,6 +46,25 @@ RCSID("$Id$")
 
 #define DIRLEN	8192		//!< Maximum path length.
 
+/** Shared state for group commit of synchronous writes
+ *
+ * Threads which finish writing to a file while another thread is
+ * calling fdatasync() on it wait for the next fdatasync(), and share
+ * it, instead of each calling fdatasync() in turn.
+ */
+typedef struct {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+
+	bool		syncing;	//!< A thread is calling fdatasync().
+	uint64_t	started;	//!< Number of syncs started.
+	uint64_t	completed;	//!< Number of the last sync which completed.
+	int		error;		//!< errno from the last sync which completed, or 0.
+
+	dev_t		dev;		//!< Device of the file being, or last, synced.
+	ino_t		ino;		//!< Inode of the file being, or last, synced.
+} detail_sync_t;
+
 /** Instance configuration for rlm_detail
  *
  * Holds the configuration and preparsed data for a instance of rlm_detail.
@@ -54,13 +73,17 @@ typedef struct {
 	char const	*name;		//!< Instance name.
 	char const	*filename;	//!< File/path to write to.
 	uint32_t	perm;		//!< Permissions to use for new files.
-	char const	*group;		//!< Group to use for new files.
+	char const	*group_str;	//!< Group to use for new files.
+	gid_t		group;		//!< Resolved gid.
 
 	tmpl_t		*header;	//!< Header format.
 	bool		locking;	//!< Whether the file should be locked.
 
 	bool		log_srcdst;	//!< Add IP src/dst attributes to entries.
 
+	bool		sync;		//!< fdatasync() entries before returning.
+	detail_sync_t	*sync_state;	//!< Group commit state.
+
 	bool		escape;		//!< do filename escaping, yes / no
 
 	xlat_escape_legacy_t	escape_func; //!< escape function
@@ -75,10 +98,11 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("header", FR_TYPE_TMPL | FR_TYPE_XLAT | FR_TYPE_NON_BLOCKING, rlm_detail_t, header),
 	  .dflt = "%t", .quote = T_DOUBLE_QUOTED_STRING },
 	{ FR_CONF_OFFSET("permissions", FR_TYPE_UINT32, rlm_detail_t, perm), .dflt = "0600" },
-	{ FR_CONF_OFFSET("group", FR_TYPE_STRING, rlm_detail_t, group) },
+	{ FR_CONF_OFFSET("group", FR_TYPE_STRING, rlm_detail_t, group_str) },
 	{ FR_CONF_OFFSET("locking", FR_TYPE_BOOL, rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", FR_TYPE_BOOL, rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", FR_TYPE_BOOL, rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("sync", FR_TYPE_BOOL, rlm_detail_t, sync), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -128,6 +152,95 @@ static int8_t detail_cmp(void const *a, void const *b)
 	return CMP(a, b);
 }
 
+static int _detail_sync_free(detail_sync_t *sync)
+{
+	pthread_mutex_destroy(&sync->mutex);
+	pthread_cond_destroy(&sync->cond);
+
+	return 0;
+}
+
+/** Wait until everything written to a file is on disk
+ *
+ * If another thread is already syncing the same file, we wait for it
+ * to finish, and then for a sync which started after our write.  That
+ * sync may be done by us, or by another thread which wrote after us,
+ * in which case one fdatasync() covers all of the writes.
+ *
+ * @param[in] sync	state shared by all threads using this instance.
+ * @param[in] fd	we wrote to.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+static int detail_sync(detail_sync_t *sync, int fd)
+{
+	struct stat	st;
+	uint64_t	target, gen;
+	int		ret;
+
+	if (fstat(fd, &st) < 0) return -1;
+
+	pthread_mutex_lock(&sync->mutex);
+
+	/*
+	 *	Any sync which is already running may have
+	 *	started before our write, so it doesn't count.
+	 */
+	target = sync->started + 1;
+
+	for (;;) {
+		if ((sync->completed >= target) && (sync->dev == st.st_dev) && (sync->ino == st.st_ino) && !sync->syncing) {
+			ret = sync->error;
+			pthread_mutex_unlock(&sync->mutex);
+			if (ret) {
+				errno = ret;
+				return -1;
+			}
+			return 0;
+		}
+
+		/*
+		 *	Nothing running, so we do the sync, and
+		 *	everyone who wrote before us shares it.
+		 */
+		if (!sync->syncing) {
+			sync->syncing = true;
+			gen = ++sync->started;
+			sync->dev = st.st_dev;
+			sync->ino = st.st_ino;
+			pthread_mutex_unlock(&sync->mutex);
+
+			ret = fdatasync(fd);
+
+			pthread_mutex_lock(&sync->mutex);
+			sync->syncing = false;
+			sync->completed = gen;
+			sync->error = (ret < 0) ? errno : 0;
+			ret = sync->error;
+			pthread_cond_broadcast(&sync->cond);
+			pthread_mutex_unlock(&sync->mutex);
+
+			if (ret) {
+				errno = ret;
+				return -1;
+			}
+			return 0;
+		}
+
+		/*
+		 *	A different file is being synced, there's
+		 *	nothing to share.
+		 */
+		if ((sync->dev != st.st_dev) || (sync->ino != st.st_ino)) {
+			pthread_mutex_unlock(&sync->mutex);
+			return fdatasync(fd);
+		}
+
+		pthread_cond_wait(&sync->cond, &sync->mutex);
+	}
+}
+
 /*
  *	(Re-)read radiusd.conf into memory.
  */
@@ -154,6 +267,29 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	if (inst->sync) {
+		MEM(inst->sync_state = talloc_zero(inst, detail_sync_t));
+		pthread_mutex_init(&inst->sync_state->mutex, NULL);
+		pthread_cond_init(&inst->sync_state->cond, NULL);
+		talloc_set_destructor(inst->sync_state, _detail_sync_free);
+	}
+
+	/*
+	 *	Resolve the group once, instead of for every
+	 *	entry we write.
+	 */
+	if (inst->group_str) {
+		char *endptr;
+
+		inst->group = strtol(inst->group_str, &endptr, 10);
+		if (*endptr != '\0') {
+			if (fr_perm_gid_from_str(inst, &inst->group, inst->group_str) < 0) {
+				cf_log_err(conf, "Unable to find system group \"%s\"", inst->group_str);
+				return -1;
+			}
+		}
+	}
+
 	/*
 	 *	Suppress certain attributes.
 	 */
@@ -213,7 +349,7 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 /*
  *	Wrapper for VPs allocated on the stack.
  */
-static void detail_fr_pair_fprint(TALLOC_CTX *ctx, FILE *out, fr_pair_t const *stacked)
+static void detail_fr_pair_print(TALLOC_CTX *ctx, fr_sbuff_t *out, fr_pair_t const *stacked)
 {
 	fr_pair_t *vp;
 
@@ -222,12 +358,17 @@ static void detail_fr_pair_fprint(TALLOC_CTX *ctx, FILE *out, fr_pair_t const *s
 
 	memcpy(vp, stacked, sizeof(*vp));
 	vp->op = T_OP_EQ;
-	fr_pair_fprint(out, vp);
+	(void) fr_sbuff_in_char(out, '\t');
+	(void) fr_pair_print(out, NULL, vp);
+	(void) fr_sbuff_in_char(out, '\n');
 	talloc_free(vp);
 }
 
 
-/** Write a single detail entry to file pointer
+/** Format a single detail entry into a buffer
+ *
+ * The entry is built in memory so that the file only has to be
+ * held for the duration of a single write().
  *
  * @param[in] out Where to write entry.
  * @param[in] inst Instance of rlm_detail.
@@ -235,7 +376,7 @@ static void detail_fr_pair_fprint(TALLOC_CTX *ctx, FILE *out, fr_pair_t const *s
  * @param[in] packet associated with the request (request, reply...).
  * @param[in] compat Write out entry in compatibility mode.
  */
-static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
+static int detail_write(fr_sbuff_t *out, rlm_detail_t const *inst, request_t *request,
 			fr_radius_packet_t *packet, fr_pair_list_t *list, bool compat)
 {
 	fr_pair_t *vp;
@@ -252,8 +393,8 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 	}
 
 #define WRITE(fmt, ...) do {\
-	if (fprintf(out, fmt, ## __VA_ARGS__) < 0) {\
-		RERROR("Failed writing to detail file: %s", fr_syserror(errno));\
+	if (fr_sbuff_in_sprintf(out, fmt, ## __VA_ARGS__) < 0) {\
+		RERROR("Failed formatting detail entry");\
 		return -1;\
 	}\
 } while(0)
@@ -308,8 +449,8 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 			break;
 		}
 
-		detail_fr_pair_fprint(request, out, &src_vp);
-		detail_fr_pair_fprint(request, out, &dst_vp);
+		detail_fr_pair_print(request, out, &src_vp);
+		detail_fr_pair_print(request, out, &dst_vp);
 
 		src_vp.da = attr_packet_src_port;
 		fr_value_box_shallow(&src_vp.data, packet->socket.inet.src_port, true);
@@ -317,8 +458,8 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 		dst_vp.da = attr_packet_dst_port;
 		fr_value_box_shallow(&dst_vp.data, packet->socket.inet.dst_port, true);
 
-		detail_fr_pair_fprint(request, out, &src_vp);
-		detail_fr_pair_fprint(request, out, &dst_vp);
+		detail_fr_pair_print(request, out, &src_vp);
+		detail_fr_pair_print(request, out, &dst_vp);
 	}
 
 	{
@@ -340,7 +481,13 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 			 */
 			op = vp->op;
 			vp->op = T_OP_EQ;
-			fr_pair_fprint(out, vp);
+			WRITE("\t");
+			if (fr_pair_print(out, NULL, vp) < 0) {
+				vp->op = op;
+				RERROR("Failed formatting detail entry");
+				return -1;
+			}
+			WRITE("\n");
 			vp->op = op;
 		}
 	}
@@ -365,15 +512,11 @@ static unlang_action_t CC_HINT(nonnull) detail_do(rlm_rcode_t *p_result, module_
 						  fr_radius_packet_t *packet, fr_pair_list_t *list,
 						  bool compat)
 {
-	int		outfd, dupfd;
-	char		buffer[DIRLEN];
-
-	FILE		*outfp;
-
-#ifdef HAVE_GRP_H
-	gid_t		gid;
-	char		*endptr;
-#endif
+	int			outfd, syncfd = -1;
+	char			buffer[DIRLEN];
+	fr_sbuff_t		entry;
+	fr_sbuff_uctx_talloc_t	tctx;
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
 
 	rlm_detail_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_detail_t);
 
@@ -388,58 +531,67 @@ static unlang_action_t CC_HINT(nonnull) detail_do(rlm_rcode_t *p_result, module_
 
 	RDEBUG2("%s expands to %s", inst->filename, buffer);
 
+	/*
+	 *	Format the entry before opening the file.  When
+	 *	locking is enabled, the file is exclusive to us
+	 *	between exfile_open() and exfile_close(), so we do as
+	 *	little as possible while holding it.
+	 */
+	if (!fr_sbuff_init_talloc(request, &entry, &tctx, 1024, SIZE_MAX)) {
+		RERROR("Failed allocating detail entry buffer");
+		RETURN_MODULE_FAIL;
+	}
+
+	if (detail_write(&entry, inst, request, packet, list, compat) < 0) {
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	/*
+	 *	Nothing to write, e.g. an empty packet.
+	 */
+	if (fr_sbuff_used(&entry) == 0) goto finish;
+
 	outfd = exfile_open(inst->ef, request, buffer, inst->perm);
 	if (outfd < 0) {
 		RPERROR("Couldn't open file %s", buffer);
+		rcode = RLM_MODULE_FAIL;
 		/* coverity[missing_unlock] */
-		RETURN_MODULE_FAIL;
+		goto finish;
 	}
 
-	if (inst->group != NULL) {
-		gid = strtol(inst->group, &endptr, 10);
-		if (*endptr != '\0') {
-			if (fr_perm_gid_from_str(request, &gid, inst->group) < 0) {
-				RDEBUG2("Unable to find system group '%s'", inst->group);
-				goto skip_group;
-			}
-		}
-
-		if (chown(buffer, -1, gid) == -1) {
-			RDEBUG2("Unable to change system group of '%s'", buffer);
-		}
+	if (inst->group_str && (fchown(outfd, -1, inst->group) == -1)) {
+		RDEBUG2("Unable to change system group of '%s'", buffer);
 	}
 
-skip_group:
-	outfp = NULL;
-	dupfd = dup(outfd);
-	if (dupfd < 0) {
-		RERROR("Failed to dup() file descriptor for detail file");
-		goto fail;
-	}
+	if (write(outfd, fr_sbuff_start(&entry), fr_sbuff_used(&entry)) < 0) {
+		RERROR("Failed writing to detail file %s: %s", buffer, fr_syserror(errno));
+		rcode = RLM_MODULE_FAIL;
 
 	/*
-	 *	Open the output fp for buffering.
+	 *	Sync on a duplicate of the FD, so that other
+	 *	threads can write to the file (and share our
+	 *	sync) once it's been released.
 	 */
-	if ((outfp = fdopen(dupfd, "a")) == NULL) {
-		RERROR("Couldn't open file %s: %s", buffer, fr_syserror(errno));
-	fail:
-		if (outfp) fclose(outfp);
-		exfile_close(inst->ef, request, outfd);
-		RETURN_MODULE_FAIL;
+	} else if (inst->sync && ((syncfd = dup(outfd)) < 0)) {
+		RERROR("Failed duplicating detail file descriptor: %s", fr_syserror(errno));
+		rcode = RLM_MODULE_FAIL;
 	}
 
-	if (detail_write(outfp, inst, request, packet, list, compat) < 0) goto fail;
-
-	/*
-	 *	Flush everything
-	 */
-	fclose(outfp);
 	exfile_close(inst->ef, request, outfd);
 
-	/*
-	 *	And everything is fine.
-	 */
-	RETURN_MODULE_OK;
+	if (syncfd >= 0) {
+		if (detail_sync(inst->sync_state, syncfd) < 0) {
+			RERROR("Failed syncing detail file %s: %s", buffer, fr_syserror(errno));
+			rcode = RLM_MODULE_FAIL;
+		}
+		close(syncfd);
+	}
+
+finish:
+	talloc_free(entry.buff);
+
+	RETURN_MODULE_RCODE(rcode);
 }
 
 /*
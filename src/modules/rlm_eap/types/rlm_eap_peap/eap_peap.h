@@ -54,6 +54,7 @@ typedef struct {
 	char const	*soh_virtual_server;
 	fr_pair_list_t	soh_reply_vps;
 	peap_resumption	session_resumption_state;
+	request_t	*inner;			//!< Reused for every round of the conversation.
 } peap_tunnel_t;
 
 extern fr_dict_attr_t const *attr_auth_type;
@@ -463,6 +463,23 @@ static char const *peap_state(peap_tunnel_t *t)
 	return "?";
 }
 
+/*
+ *	The inner request lives as long as the tunnel, so its stack
+ *	and pair lists are allocated once per conversation, instead
+ *	of once per round.
+ */
+static request_t *peap_inner_request(request_t *request, peap_tunnel_t *t)
+{
+	if (!t->inner) {
+		t->inner = request_alloc_internal(t, &(request_init_args_t){ .parent = request });
+		return t->inner;
+	}
+
+	request_child_reuse(t->inner, request);
+
+	return t->inner;
+}
+
 /*
  *	Process the pseudo-EAP contents of the tunneled data.
  */
@@ -647,7 +664,7 @@ unlang_action_t eap_peap_process(rlm_rcode_t *p_result, request_t *request,
 			goto finish;
 	}
 
-	fake = request_alloc_internal(request, &(request_init_args_t){ .parent = request });
+	fake = peap_inner_request(request, t);
 	fr_assert(fr_pair_list_empty(&fake->request_pairs));
 
 	switch (t->status) {
@@ -683,7 +700,6 @@ unlang_action_t eap_peap_process(rlm_rcode_t *p_result, request_t *request,
 		eap_peap_inner_to_pairs(fake->request_ctx, &fake->request_pairs,
 					eap_round, data, data_len);
 		if (fr_pair_list_empty(&fake->request_pairs)) {
-			talloc_free(fake);
 			RDEBUG2("Unable to convert tunneled EAP packet to internal server data structures");
 			rcode = RLM_MODULE_REJECT;
 			goto finish;
@@ -738,7 +754,14 @@ unlang_action_t eap_peap_process(rlm_rcode_t *p_result, request_t *request,
 	}
 
 finish:
-	talloc_free(fake);
+	/*
+	 *	Keep the inner request for the next round,
+	 *	but not the pairs from this one.
+	 */
+	if (fake) {
+		fr_pair_list_free(&fake->request_pairs);
+		fr_pair_list_free(&fake->reply_pairs);
+	}
 
 	RETURN_MODULE_RCODE(rcode);
 }
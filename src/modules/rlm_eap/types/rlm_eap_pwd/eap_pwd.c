@@ -245,24 +245,17 @@ fail:
 	return ret;
 }
 
-int compute_password_element (request_t *request, pwd_session_t *session, uint16_t grp_num,
-			      char const *password, int password_len,
-			      char const *id_server, int id_server_len,
-			      char const *id_peer, int id_peer_len,
-			      uint32_t *token, BN_CTX *bnctx)
+/** Create the group, and the group parameters for a session
+ *
+ * @param[in] session	to initialise.
+ * @param[in] grp_num	from the IANA registry for IKE D-H groups.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  Anything allocated is freed with the session.
+ */
+static int pwd_group_init(pwd_session_t *session, uint16_t grp_num)
 {
-	BIGNUM *x_candidate = NULL, *rnd = NULL, *y_sqrd = NULL, *qr = NULL, *qnr = NULL;
-	HMAC_CTX *ctx = NULL;
-	uint8_t pwe_digest[SHA256_DIGEST_LENGTH], *prfbuf = NULL, *xbuf = NULL, *pm1buf = NULL, ctr;
-	int nid, is_odd, primebitlen, primebytelen, ret = 0, found = 0, mask;
-	int save, i, rbits, qr_or_qnr, save_is_odd = 0, cmp;
-	unsigned int skip;
-
-	ctx = HMAC_CTX_new();
-	if (ctx == NULL) {
-		DEBUG("failed allocating HMAC context");
-		goto fail;
-	}
+	int nid;
 
 	switch (grp_num) { /* from IANA registry for IKE D-H groups */
 	case 19:
@@ -287,7 +280,7 @@ int compute_password_element (request_t *request, pwd_session_t *session, uint16
 
 	default:
 		DEBUG("unknown group %d", grp_num);
-		goto fail;
+		return -1;
 	}
 
 	session->pwe = NULL;
@@ -296,28 +289,56 @@ int compute_password_element (request_t *request, pwd_session_t *session, uint16
 
 	if ((session->group = EC_GROUP_new_by_curve_name(nid)) == NULL) {
 		DEBUG("unable to create EC_GROUP");
-		goto fail;
+		return -1;
 	}
 
-	if (((rnd = consttime_BN()) == NULL) ||
-	    ((session->pwe = EC_POINT_new(session->group)) == NULL) ||
+	if (((session->pwe = EC_POINT_new(session->group)) == NULL) ||
 	    ((session->order = consttime_BN()) == NULL) ||
-	    ((session->prime = consttime_BN()) == NULL) ||
-	    ((qr = consttime_BN()) == NULL) ||
-	    ((qnr = consttime_BN()) == NULL) ||
-	    ((x_candidate = consttime_BN()) == NULL) ||
-	    ((y_sqrd = consttime_BN()) == NULL)) {
+	    ((session->prime = consttime_BN()) == NULL)) {
 		DEBUG("unable to create bignums");
-		goto fail;
+		return -1;
 	}
 
 	if (!EC_GROUP_get_curve_GFp(session->group, session->prime, NULL, NULL, NULL)) {
 		DEBUG("unable to get prime for GFp curve");
-		goto fail;
+		return -1;
 	}
 
 	if (!EC_GROUP_get_order(session->group, session->order, NULL)) {
 		DEBUG("unable to get order for curve");
+		return -1;
+	}
+
+	return 0;
+}
+
+int compute_password_element (request_t *request, pwd_session_t *session, uint16_t grp_num,
+			      char const *password, int password_len,
+			      char const *id_server, int id_server_len,
+			      char const *id_peer, int id_peer_len,
+			      uint32_t *token, BN_CTX *bnctx)
+{
+	BIGNUM *x_candidate = NULL, *rnd = NULL, *y_sqrd = NULL, *qr = NULL, *qnr = NULL;
+	HMAC_CTX *ctx = NULL;
+	uint8_t pwe_digest[SHA256_DIGEST_LENGTH], *prfbuf = NULL, *xbuf = NULL, *pm1buf = NULL, ctr;
+	int is_odd, primebitlen, primebytelen, ret = 0, found = 0, mask;
+	int save, i, rbits, qr_or_qnr, save_is_odd = 0, cmp;
+	unsigned int skip;
+
+	ctx = HMAC_CTX_new();
+	if (ctx == NULL) {
+		DEBUG("failed allocating HMAC context");
+		goto fail;
+	}
+
+	if (pwd_group_init(session, grp_num) < 0) goto fail;
+
+	if (((rnd = consttime_BN()) == NULL) ||
+	    ((qr = consttime_BN()) == NULL) ||
+	    ((qnr = consttime_BN()) == NULL) ||
+	    ((x_candidate = consttime_BN()) == NULL) ||
+	    ((y_sqrd = consttime_BN()) == NULL)) {
+		DEBUG("unable to create bignums");
 		goto fail;
 	}
 
@@ -474,6 +495,67 @@ int compute_password_element (request_t *request, pwd_session_t *session, uint16
 	return ret;
 }
 
+/** Serialise the password element of a session, so it can be cached
+ *
+ * @param[in] ctx	to allocate the buffer in.
+ * @param[out] out	Where to write the buffer.
+ * @param[out] outlen	Where to write the length of the buffer.
+ * @param[in] session	with a computed password element.
+ * @param[in] bnctx	to use for bignum operations.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int export_password_element(TALLOC_CTX *ctx, uint8_t **out, size_t *outlen,
+			    pwd_session_t *session, BN_CTX *bnctx)
+{
+	size_t len;
+
+	len = EC_POINT_point2oct(session->group, session->pwe, POINT_CONVERSION_UNCOMPRESSED, NULL, 0, bnctx);
+	if (!len) return -1;
+
+	MEM(*out = talloc_array(ctx, uint8_t, len));
+	if (EC_POINT_point2oct(session->group, session->pwe, POINT_CONVERSION_UNCOMPRESSED,
+			       *out, len, bnctx) != len) {
+		TALLOC_FREE(*out);
+		return -1;
+	}
+	*outlen = len;
+
+	return 0;
+}
+
+/** Restore a password element previously serialised with #export_password_element
+ *
+ * Sets up the session exactly as #compute_password_element would, without
+ * repeating the hunting and pecking.
+ *
+ * @param[in] request	The current request.
+ * @param[in] session	to restore the password element into.
+ * @param[in] grp_num	the password element was computed for.
+ * @param[in] in	serialised password element.
+ * @param[in] inlen	Length of the serialised password element.
+ * @param[in] bnctx	to use for bignum operations.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int restore_password_element(request_t *request, pwd_session_t *session, uint16_t grp_num,
+			     uint8_t const *in, size_t inlen, BN_CTX *bnctx)
+{
+	if (pwd_group_init(session, grp_num) < 0) return -1;
+
+	if (!EC_POINT_oct2point(session->group, session->pwe, in, inlen, bnctx) ||
+	    !EC_POINT_is_on_curve(session->group, session->pwe, bnctx)) {
+		REDEBUG("Cached password element is invalid");
+		return -1;
+	}
+
+	session->group_num = grp_num;
+
+	return 0;
+}
+
 int compute_scalar_element(request_t *request, pwd_session_t *session, BN_CTX *bn_ctx)
 {
 	BIGNUM *mask = NULL;
@@ -105,6 +105,10 @@ int compute_password_element(request_t *request, pwd_session_t *sess, uint16_t g
 			     char const *id_server, int id_server_len,
 			     char const *id_peer, int id_peer_len,
 			     uint32_t *token, BN_CTX *bnctx);
+int export_password_element(TALLOC_CTX *ctx, uint8_t **out, size_t *outlen,
+			    pwd_session_t *sess, BN_CTX *bnctx);
+int restore_password_element(request_t *request, pwd_session_t *sess, uint16_t grp_num,
+			     uint8_t const *in, size_t inlen, BN_CTX *bnctx);
 int compute_scalar_element(request_t *request, pwd_session_t *sess, BN_CTX *bnctx);
 int process_peer_commit(request_t *request, pwd_session_t *sess, uint8_t *in, size_t in_len, BN_CTX *bnctx);
 int compute_server_confirm(request_t *request, pwd_session_t *sess, uint8_t *out, BN_CTX *bnctx);
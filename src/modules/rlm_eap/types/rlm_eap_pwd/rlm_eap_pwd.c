@@ -35,9 +35,11 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 
 #define LOG_PREFIX "rlm_eap_pwd - "
 
+#include <freeradius-devel/server/auth_cache.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/tls/base.h>
+#include <freeradius-devel/util/sha1.h>
 
 #include "eap_pwd.h"
 
@@ -48,8 +50,16 @@ typedef struct {
     uint32_t	fragment_size;
     char const	*server_id;
     char const	*virtual_server;
+
+    fr_auth_cache_config_t	cache;		//!< Of password elements.
+    uint32_t		token;			//!< Used for all sessions if password elements are cached.
 } rlm_eap_pwd_t;
 
+typedef struct {
+	fr_auth_cache_t		*cache;			//!< Of serialised password elements, by HMAC
+							///< of the peer identity, keyed by the password.
+} rlm_eap_pwd_thread_t;
+
 #define MPPE_KEY_LEN    32
 #define MSK_EMSK_LEN    (2 * MPPE_KEY_LEN)
 
@@ -57,6 +67,7 @@ static CONF_PARSER submodule_config[] = {
 	{ FR_CONF_OFFSET("group", FR_TYPE_UINT32, rlm_eap_pwd_t, group), .dflt = "19" },
 	{ FR_CONF_OFFSET("fragment_size", FR_TYPE_UINT32, rlm_eap_pwd_t, fragment_size), .dflt = "1020" },
 	{ FR_CONF_OFFSET("server_id", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_eap_pwd_t, server_id) },
+	FR_AUTH_CACHE_CONF(rlm_eap_pwd_t, cache),
 	CONF_PARSER_TERMINATOR
 };
 
@@ -84,6 +95,73 @@ fr_dict_attr_autoload_t rlm_eap_pwd_dict_attr[] = {
 	{ NULL }
 };
 
+static int pwd_compute_password_element(request_t *request, rlm_eap_pwd_t const *inst, pwd_session_t *session,
+					fr_pair_t const *known_good)
+{
+	return compute_password_element(request, session, session->group_num,
+					known_good->vp_strvalue, known_good->vp_length,
+					inst->server_id, strlen(inst->server_id),
+					session->peer_id, strlen(session->peer_id),
+					&session->token, inst->bnctx);
+}
+
+/** Find the password element for a peer, or compute and cache it
+ *
+ * The password element only depends on the password, the identities,
+ * the group and the token.  When caching is enabled, the token is fixed
+ * for the module instance, so the expensive hunting and pecking only
+ * has to be done once per user.  The cache key is an HMAC of the peer's
+ * identity, keyed by the password, so a password change is a cache miss.
+ */
+static int pwd_password_element(request_t *request, module_ctx_t const *mctx, pwd_session_t *session,
+				fr_pair_t const *known_good)
+{
+	rlm_eap_pwd_t const		*inst = talloc_get_type_abort_const(mctx->instance, rlm_eap_pwd_t);
+	rlm_eap_pwd_thread_t		*t = talloc_get_type_abort(mctx->thread, rlm_eap_pwd_thread_t);
+	uint8_t				key[FR_AUTH_CACHE_KEY_LEN];
+	uint8_t const			*pwe;
+	uint8_t				*out;
+	size_t				pwe_len, out_len;
+
+	if (!t->cache) return pwd_compute_password_element(request, inst, session, known_good);
+
+	fr_hmac_sha1(key, (uint8_t const *)session->peer_id, session->peer_id_len,
+		     known_good->vp_octets, known_good->vp_length);
+
+	if (fr_auth_cache_find(&pwe, &pwe_len, t->cache, key)) {
+		RDEBUG2("Using cached password element");
+		if (restore_password_element(request, session, session->group_num,
+					     pwe, pwe_len, inst->bnctx) == 0) return 0;
+
+		/*
+		 *	Start again from scratch
+		 */
+		EC_GROUP_free(session->group);
+		session->group = NULL;
+		EC_POINT_clear_free(session->pwe);
+		session->pwe = NULL;
+		BN_clear_free(session->order);
+		session->order = NULL;
+		BN_clear_free(session->prime);
+		session->prime = NULL;
+
+		fr_auth_cache_remove(t->cache, key);
+	}
+
+	if (pwd_compute_password_element(request, inst, session, known_good) < 0) return -1;
+
+	/*
+	 *	Still have a usable password element if
+	 *	this fails, it just isn't cached.
+	 */
+	if (export_password_element(NULL, &out, &out_len, session, inst->bnctx) < 0) return 0;
+
+	fr_auth_cache_insert(t->cache, key, out, out_len);
+	talloc_free(out);
+
+	return 0;
+}
+
 static int send_pwd_request(request_t *request, pwd_session_t *session, eap_round_t *eap_round)
 {
 	size_t		len;
@@ -329,11 +407,7 @@ static unlang_action_t mod_process(rlm_rcode_t *p_result, module_ctx_t const *mc
 			RETURN_MODULE_FAIL;
 		}
 
-		ret = compute_password_element(request, session, session->group_num,
-					       known_good->vp_strvalue, known_good->vp_length,
-					       inst->server_id, strlen(inst->server_id),
-					       session->peer_id, strlen(session->peer_id),
-					       &session->token, inst->bnctx);
+		ret = pwd_password_element(request, mctx, session, known_good);
 		if (ephemeral) TALLOC_FREE(known_good);
 		if (ret < 0) {
 			REDEBUG("Failed to obtain password element");
@@ -532,7 +606,7 @@ static unlang_action_t mod_session_init(rlm_rcode_t *p_result, module_ctx_t cons
 	packet->group_num = htons(session->group_num);
 	packet->random_function = EAP_PWD_DEF_RAND_FUN;
 	packet->prf = EAP_PWD_DEF_PRF;
-	session->token = fr_rand();
+	session->token = inst->cache.lifetime ? inst->token : fr_rand();
 	memcpy(packet->token, (char *)&session->token, 4);
 	packet->prep = EAP_PWD_PREP_NONE;
 	memcpy(packet->identity, inst->server_id, session->out_len - sizeof(pwd_id_packet_t) );
@@ -577,6 +651,9 @@ static int mod_instantiate(void *instance, CONF_SECTION *cs)
 		return -1;
 	}
 
+	if (fr_auth_cache_config_check(cs, &inst->cache) < 0) return -1;
+	if (inst->cache.lifetime) inst->token = fr_rand();
+
 	inst->bnctx = BN_CTX_new();
 	if (!inst->bnctx) {
 		ERROR("Failed to get BN context");
@@ -586,6 +663,17 @@ static int mod_instantiate(void *instance, CONF_SECTION *cs)
 	return 0;
 }
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
+				  UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_eap_pwd_t		*inst = talloc_get_type_abort(instance, rlm_eap_pwd_t);
+	rlm_eap_pwd_thread_t	*t = talloc_get_type_abort(thread, rlm_eap_pwd_thread_t);
+
+	t->cache = fr_auth_cache_alloc(t, &inst->cache);
+
+	return 0;
+}
+
 extern rlm_eap_submodule_t rlm_eap_pwd;
 rlm_eap_submodule_t rlm_eap_pwd = {
 	.name		= "eap_pwd",
@@ -597,6 +685,10 @@ rlm_eap_submodule_t rlm_eap_pwd = {
 	.instantiate	= mod_instantiate,	/* Create new submodule instance */
 	.detach		= mod_detach,
 
+	.thread_inst_size	= sizeof(rlm_eap_pwd_thread_t),
+	.thread_inst_type	= "rlm_eap_pwd_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
+
 	.session_init	= mod_session_init,	/* Create the initial request */
 };
 
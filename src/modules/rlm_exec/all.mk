@@ -1,2 +1,2 @@
 TARGET		:= rlm_exec.a
-SOURCES		:= rlm_exec.c
+SOURCES		:= rlm_exec.c coproc.c
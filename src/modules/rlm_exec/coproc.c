@@ -0,0 +1,612 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_exec/coproc.c
+ * @brief Persistent co-processes for rlm_exec.
+ *
+ * Forking a new program for every call is expensive, both for the fork
+ * itself, and for the copy-on-write faults as the server and child touch
+ * their shared pages.  Instead, each worker thread can keep a pool of
+ * long-lived co-processes, and send them requests over a pipe.
+ *
+ * A request is a header line, followed by zero or more attributes, one
+ * per line, in the same "Attribute = value" format used for program output,
+ * and is terminated by an empty line:
+ *
+@verbatim
+module authorize
+User-Name = "bob"
+NAS-IP-Address = 192.0.2.1
+
+@endverbatim
+ *
+ * The co-process replies with a line containing a decimal status, which has
+ * the same meaning as a program exit code, followed by zero or more lines
+ * of output, terminated by an empty line:
+ *
+@verbatim
+0
+Reply-Message = "Hello bob"
+
+@endverbatim
+ *
+ * Each co-process handles one request at a time, and requests are queued
+ * when every co-process is busy.  Responses are read by the worker's event
+ * loop so the worker carries on processing other requests in the meantime.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/exec.h>
+#include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <sys/wait.h>
+#include <signal.h>
+
+#include "coproc.h"
+
+#define EXEC_COPROC_BUFFER_SIZE	16384
+
+typedef struct {
+	exec_coproc_pool_t	*pool;			//!< The pool this co-process belongs to.
+
+	pid_t			pid;			//!< Of the co-process, or -1 if it's not running.
+	int			stdin_fd;		//!< For writing requests.
+	int			stdout_fd;		//!< For reading responses.
+
+	bool			busy;			//!< Processing a request.
+	bool			writing;		//!< Waiting for stdin to become writable.
+	size_t			written;		//!< How much of the current request has been written.
+	exec_coproc_request_t	*current;		//!< The request being processed.  NULL if the
+							///< request went away, and the response should be discarded.
+	fr_event_timer_t const	*ev;			//!< For timing out the response.
+
+	char			buffer[EXEC_COPROC_BUFFER_SIZE];	//!< Partial response.
+	size_t			used;			//!< How much of the buffer is used.
+} exec_coproc_t;
+
+struct exec_coproc_pool_s {
+	fr_event_list_t		*el;			//!< The worker's event list.
+	char const		*program;		//!< To run.
+	fr_time_delta_t		timeout;		//!< How long to wait for a response.
+
+	exec_coproc_t		*coprocs;		//!< Array of co-processes.
+	uint32_t		num_coprocs;		//!< How many co-processes there are.
+
+	fr_dlist_head_t		queue;			//!< Requests waiting for an idle co-process.
+};
+
+struct exec_coproc_request_s {
+	fr_dlist_t		entry;			//!< Entry in the queue.
+	exec_coproc_pool_t	*pool;			//!< The pool this request was pushed to.
+	exec_coproc_t		*coproc;		//!< The co-process handling this request.
+	request_t		*request;		//!< To mark runnable when we have a response.
+
+	char const		*query;			//!< To write to the co-process.
+	size_t			query_len;		//!< Length of query.
+
+	bool			done;			//!< We have a response, or an error.
+	int			status;			//!< From the first line of the response.
+	char			*body;			//!< The rest of the response.
+	char			*error;			//!< If we couldn't get a response.
+};
+
+static void coproc_dispatch(exec_coproc_pool_t *pool);
+
+/** Stop a co-process, making sure it doesn't linger
+ *
+ */
+static void coproc_stop(exec_coproc_t *coproc)
+{
+	fr_event_list_t *el = coproc->pool->el;
+
+	if (coproc->ev) fr_event_timer_delete(&coproc->ev);
+
+	if (coproc->stdout_fd >= 0) {
+		(void) fr_event_fd_delete(el, coproc->stdout_fd, FR_EVENT_FILTER_IO);
+		close(coproc->stdout_fd);
+		coproc->stdout_fd = -1;
+	}
+
+	if (coproc->stdin_fd >= 0) {
+		if (coproc->writing) (void) fr_event_fd_delete(el, coproc->stdin_fd, FR_EVENT_FILTER_IO);
+		close(coproc->stdin_fd);
+		coproc->stdin_fd = -1;
+	}
+
+	if (coproc->pid > 0) {
+		kill(coproc->pid, SIGKILL);
+		while ((waitpid(coproc->pid, NULL, 0) < 0) && (errno == EINTR));
+		coproc->pid = -1;
+	}
+
+	coproc->busy = false;
+	coproc->writing = false;
+	coproc->used = 0;
+}
+
+/** Complete the current request on a co-process
+ *
+ */
+static void coproc_request_done(exec_coproc_t *coproc)
+{
+	exec_coproc_request_t *creq = coproc->current;
+
+	if (coproc->ev) fr_event_timer_delete(&coproc->ev);
+
+	coproc->current = NULL;
+	coproc->busy = false;
+	coproc->used = 0;
+
+	if (!creq) return;
+
+	creq->coproc = NULL;
+	creq->done = true;
+	unlang_interpret_mark_runnable(creq->request);
+}
+
+/** Something went wrong talking to a co-process, kill it, and fail the request
+ *
+ */
+static void coproc_fail(exec_coproc_t *coproc, char const *error)
+{
+	exec_coproc_request_t *creq = coproc->current;
+
+	if (creq) MEM(creq->error = talloc_strdup(creq, error));
+
+	coproc_stop(coproc);
+	coproc_request_done(coproc);
+}
+
+/** Parse a complete response
+ *
+ * @param[in] creq	to write the results to.  May be NULL if the
+ *			request went away.
+ * @param[in] buffer	containing the response, without the terminating
+ *			empty line.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the status line is invalid.
+ */
+static int coproc_parse(exec_coproc_request_t *creq, char *buffer)
+{
+	char	*p, *end;
+	long	status;
+
+	p = strchr(buffer, '\n');
+	if (p) *p++ = '\0';
+
+	status = strtol(buffer, &end, 10);
+	if ((end == buffer) || (*end != '\0') || (status < 0) || (status > INT_MAX)) return -1;
+
+	if (!creq) return 0;
+
+	creq->status = status;
+	MEM(creq->body = talloc_strdup(creq, p ? p : ""));
+
+	return 0;
+}
+
+/** Read a response from a co-process
+ *
+ */
+static void coproc_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	exec_coproc_t	*coproc = uctx;
+	ssize_t		slen;
+	char		*end;
+
+	for (;;) {
+		if (coproc->used >= (sizeof(coproc->buffer) - 1)) {
+			coproc_fail(coproc, "Response from co-process too long");
+			goto dispatch;
+		}
+
+		slen = read(fd, coproc->buffer + coproc->used, sizeof(coproc->buffer) - 1 - coproc->used);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+
+			coproc_fail(coproc, fr_syserror(errno));
+			goto dispatch;
+		}
+
+		if (slen == 0) {
+			coproc_fail(coproc, "Co-process exited");
+			goto dispatch;
+		}
+
+		coproc->used += slen;
+		coproc->buffer[coproc->used] = '\0';
+
+		/*
+		 *	Output from an idle co-process, or before
+		 *	it's heard the whole request, means it's
+		 *	lost track of the framing.
+		 */
+		if (!coproc->busy || coproc->writing) {
+			coproc_fail(coproc, "Unexpected output from co-process");
+			goto dispatch;
+		}
+
+		/*
+		 *	The status line can't be empty, so the first
+		 *	empty line terminates the response.
+		 */
+		end = strstr(coproc->buffer, "\n\n");
+		if (!end) continue;
+
+		if ((size_t)((end + 2) - coproc->buffer) != coproc->used) {
+			coproc_fail(coproc, "Unexpected output from co-process");
+			goto dispatch;
+		}
+
+		*end = '\0';
+		if (coproc_parse(coproc->current, coproc->buffer) < 0) {
+			coproc_fail(coproc, "Invalid status line from co-process");
+			goto dispatch;
+		}
+		coproc_request_done(coproc);
+		break;
+	}
+
+dispatch:
+	coproc_dispatch(coproc->pool);
+}
+
+static void coproc_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	exec_coproc_t	*coproc = uctx;
+
+	coproc_fail(coproc, fr_syserror(fd_errno));
+	coproc_dispatch(coproc->pool);
+}
+
+static void coproc_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	exec_coproc_t	*coproc = uctx;
+
+	coproc_fail(coproc, "Timeout waiting for co-process");
+	coproc_dispatch(coproc->pool);
+}
+
+static void coproc_writable(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx);
+
+/** Write as much of the current request as the pipe will take
+ *
+ * @return
+ *	- 0 if the whole request has been written.
+ *	- 1 if we're waiting for the pipe to drain.
+ *	- -1 on error.
+ */
+static int coproc_write(exec_coproc_t *coproc)
+{
+	exec_coproc_request_t	*creq = coproc->current;
+	ssize_t			slen;
+
+	fr_assert(creq);
+
+	while (coproc->written < creq->query_len) {
+		slen = write(coproc->stdin_fd, creq->query + coproc->written, creq->query_len - coproc->written);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+
+			return -1;
+		}
+		coproc->written += slen;
+	}
+
+	if (coproc->written == creq->query_len) {
+		if (coproc->writing) {
+			(void) fr_event_fd_delete(coproc->pool->el, coproc->stdin_fd, FR_EVENT_FILTER_IO);
+			coproc->writing = false;
+		}
+		return 0;
+	}
+
+	if (!coproc->writing) {
+		if (fr_event_fd_insert(coproc->pool, coproc->pool->el, coproc->stdin_fd,
+				       NULL, coproc_writable, coproc_error, coproc) < 0) return -1;
+		coproc->writing = true;
+	}
+
+	return 1;
+}
+
+static void coproc_writable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	exec_coproc_t	*coproc = uctx;
+
+	if (coproc_write(coproc) < 0) {
+		coproc_fail(coproc, "Failed writing to co-process");
+		coproc_dispatch(coproc->pool);
+	}
+}
+
+/** Start a co-process
+ *
+ * @param[in] coproc	to start.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int coproc_start(exec_coproc_t *coproc)
+{
+	exec_coproc_pool_t *pool = coproc->pool;
+
+	coproc->pid = radius_start_program(&coproc->stdin_fd, &coproc->stdout_fd, NULL,
+					   pool->program, NULL, true, NULL, false);
+	if (coproc->pid < 0) {
+		coproc->pid = -1;
+		coproc->stdin_fd = coproc->stdout_fd = -1;
+		fr_strerror_printf("Failed starting co-process \"%s\"", pool->program);
+		return -1;
+	}
+
+	if ((fr_nonblock(coproc->stdin_fd) < 0) || (fr_nonblock(coproc->stdout_fd) < 0)) {
+		fr_strerror_printf("Failed setting co-process pipes to non-blocking: %s", fr_syserror(errno));
+	error:
+		coproc_stop(coproc);
+		return -1;
+	}
+
+	if (fr_event_fd_insert(pool, pool->el, coproc->stdout_fd, coproc_read, NULL, coproc_error, coproc) < 0) {
+		fr_strerror_const_push("Failed listening to co-process");
+		goto error;
+	}
+
+	DEBUG2("Started co-process \"%s\", pid %u", pool->program, (unsigned int) coproc->pid);
+
+	return 0;
+}
+
+/** Send queued requests to idle co-processes
+ *
+ */
+static void coproc_dispatch(exec_coproc_pool_t *pool)
+{
+	exec_coproc_request_t	*creq;
+	exec_coproc_t		*coproc;
+	request_t		*request;
+	uint32_t		i;
+
+	while ((creq = fr_dlist_head(&pool->queue))) {
+		coproc = NULL;
+		for (i = 0; i < pool->num_coprocs; i++) {
+			if (!pool->coprocs[i].busy) {
+				coproc = &pool->coprocs[i];
+				break;
+			}
+		}
+		if (!coproc) return;
+
+		fr_dlist_remove(&pool->queue, creq);
+		request = creq->request;
+
+		/*
+		 *	Restart co-processes which have exited,
+		 *	or were killed.
+		 */
+		if ((coproc->pid < 0) && (coproc_start(coproc) < 0)) {
+			RPERROR("Co-process unavailable");
+			MEM(creq->error = talloc_strdup(creq, "Failed starting co-process"));
+			creq->done = true;
+			unlang_interpret_mark_runnable(request);
+			continue;
+		}
+
+		coproc->busy = true;
+		coproc->current = creq;
+		coproc->written = 0;
+		coproc->used = 0;
+		creq->coproc = coproc;
+
+		if (fr_event_timer_in(pool, pool->el, &coproc->ev, pool->timeout, coproc_timeout, coproc) < 0) {
+			coproc_fail(coproc, "Failed inserting co-process timeout");
+			continue;
+		}
+
+		if (coproc_write(coproc) < 0) {
+			coproc_fail(coproc, "Failed writing to co-process");
+			continue;
+		}
+
+		RDEBUG2("Sent request to co-process, pid %u", (unsigned int) coproc->pid);
+	}
+}
+
+static int _exec_coproc_pool_free(exec_coproc_pool_t *pool)
+{
+	uint32_t i;
+
+	for (i = 0; i < pool->num_coprocs; i++) coproc_stop(&pool->coprocs[i]);
+
+	return 0;
+}
+
+/** Allocate a per-thread pool of co-processes, and start them
+ *
+ * Co-processes which fail to start are retried when they're next needed.
+ *
+ * @param[in] ctx		to allocate the pool in.
+ * @param[in] el		The worker's event list.
+ * @param[in] program		to run.  Must not contain expansions.
+ * @param[in] num_coprocs	how many co-processes to run.
+ * @param[in] timeout		How long to wait for each response.
+ * @return the new pool.
+ */
+exec_coproc_pool_t *exec_coproc_pool_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, char const *program,
+					   uint32_t num_coprocs, fr_time_delta_t timeout)
+{
+	exec_coproc_pool_t	*pool;
+	uint32_t		i;
+
+	MEM(pool = talloc_zero(ctx, exec_coproc_pool_t));
+	pool->el = el;
+	pool->program = program;
+	pool->timeout = timeout;
+	pool->num_coprocs = num_coprocs;
+	MEM(pool->coprocs = talloc_zero_array(pool, exec_coproc_t, num_coprocs));
+	fr_dlist_init(&pool->queue, exec_coproc_request_t, entry);
+
+	for (i = 0; i < num_coprocs; i++) {
+		pool->coprocs[i].pool = pool;
+		pool->coprocs[i].pid = -1;
+		pool->coprocs[i].stdin_fd = -1;
+		pool->coprocs[i].stdout_fd = -1;
+	}
+	talloc_set_destructor(pool, _exec_coproc_pool_free);
+
+	for (i = 0; i < num_coprocs; i++) {
+		if (coproc_start(&pool->coprocs[i]) < 0) PWARN("Will retry on first use");
+	}
+
+	return pool;
+}
+
+/** Detach a request from the pool if it goes away before the co-process responds
+ *
+ */
+static int _exec_coproc_request_free(exec_coproc_request_t *creq)
+{
+	exec_coproc_t *coproc = creq->coproc;
+
+	if (creq->done) return 0;
+
+	if (!coproc) {
+		fr_dlist_remove(&creq->pool->queue, creq);
+		return 0;
+	}
+
+	/*
+	 *	The co-process has only heard part of the
+	 *	request, and we're about to free the rest.
+	 *	There's no way to resynchronise, so it has
+	 *	to go.
+	 */
+	if (coproc->writing) {
+		coproc->current = NULL;
+		coproc_stop(coproc);
+		coproc_dispatch(coproc->pool);
+		return 0;
+	}
+
+	coproc->current = NULL;		/* Response will be discarded */
+
+	return 0;
+}
+
+/** Queue a request to a co-process
+ *
+ * The header line is sent first, then one line for each of input_pairs,
+ * then an empty line.  The request is written to the first idle
+ * co-process in the pool, or queued until one becomes idle.
+ *
+ * The request is marked runnable once a complete response has been read,
+ * or the co-process has failed.  #exec_coproc_result then returns the
+ * status line and body.
+ *
+ * @param[in] ctx		to allocate the co-process request in.  If it's
+ *				freed before the co-process responds, the response
+ *				is discarded.
+ * @param[in] pool		this thread's co-process pool.
+ * @param[in] request		The current request.
+ * @param[in] header		First line of the request.  Must not contain
+ *				new lines.
+ * @param[in] input_pairs	to send, may be NULL.
+ * @return
+ *	- The co-process request on success.
+ *	- NULL on failure.
+ */
+exec_coproc_request_t *exec_coproc_push(TALLOC_CTX *ctx, exec_coproc_pool_t *pool, request_t *request,
+					char const *header, fr_pair_list_t *input_pairs)
+{
+	exec_coproc_request_t	*creq;
+	fr_sbuff_t		sbuff;
+	fr_sbuff_uctx_talloc_t	tctx;
+	fr_pair_t		*vp;
+
+	fr_assert(!strchr(header, '\n'));
+
+	MEM(creq = talloc_zero(ctx, exec_coproc_request_t));
+	creq->pool = pool;
+	creq->request = request;
+
+	MEM(fr_sbuff_init_talloc(creq, &sbuff, &tctx, 1024, SIZE_MAX));
+
+	if ((fr_sbuff_in_strcpy(&sbuff, header) < 0) || (fr_sbuff_in_char(&sbuff, '\n') <= 0)) {
+	error:
+		RPEDEBUG("Failed creating co-process request");
+		talloc_free(creq);
+		return NULL;
+	}
+
+	/*
+	 *	Values are quoted and escaped, so they
+	 *	can't break the framing.
+	 */
+	if (input_pairs) for (vp = fr_pair_list_head(input_pairs);
+			      vp;
+			      vp = fr_pair_list_next(input_pairs, vp)) {
+		if ((fr_pair_print(&sbuff, NULL, vp) < 0) || (fr_sbuff_in_char(&sbuff, '\n') <= 0)) goto error;
+	}
+
+	if (fr_sbuff_in_char(&sbuff, '\n') <= 0) goto error;
+
+	creq->query = fr_sbuff_buff(&sbuff);
+	creq->query_len = fr_sbuff_used(&sbuff);
+
+	fr_dlist_insert_tail(&pool->queue, creq);
+	talloc_set_destructor(creq, _exec_coproc_request_free);
+
+	coproc_dispatch(pool);
+
+	return creq;
+}
+
+/** Get the result of a request to a co-process
+ *
+ * @param[out] status	The status line from the response.
+ * @param[out] body	The rest of the response.  Parented by creq.
+ * @param[in] request	The current request.
+ * @param[in] creq	which has completed.
+ * @return
+ *	- 0 on success.
+ *	- -1 if there was no response.
+ */
+int exec_coproc_result(int *status, char **body, request_t *request, exec_coproc_request_t *creq)
+{
+	fr_assert(creq->done);
+
+	if (creq->error) {
+		REDEBUG("%s", creq->error);
+		return -1;
+	}
+
+	*status = creq->status;
+	*body = creq->body;
+
+	return 0;
+}
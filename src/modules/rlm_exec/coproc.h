@@ -0,0 +1,40 @@
+#pragma once
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_exec/coproc.h
+ * @brief Persistent co-processes for rlm_exec.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(coproc_h, "$Id$")
+
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/pair.h>
+
+typedef struct exec_coproc_pool_s exec_coproc_pool_t;
+typedef struct exec_coproc_request_s exec_coproc_request_t;
+
+exec_coproc_pool_t	*exec_coproc_pool_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, char const *program,
+						uint32_t num_coprocs, fr_time_delta_t timeout);
+
+exec_coproc_request_t	*exec_coproc_push(TALLOC_CTX *ctx, exec_coproc_pool_t *pool, request_t *request,
+					  char const *header, fr_pair_list_t *input_pairs);
+
+int			exec_coproc_result(int *status, char **body, request_t *request, exec_coproc_request_t *creq);
@@ -32,6 +32,8 @@ RCSID("$Id$")
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/debug.h>
 
+#include "coproc.h"
+
 /*
  *	Define a structure for our module configuration.
  */
@@ -46,10 +48,16 @@ typedef struct {
 	bool			shell_escape;
 	fr_time_delta_t		timeout;
 	bool			timeout_is_set;
+	bool			coprocess;
+	uint32_t		processes;
 
 	tmpl_t	*tmpl;
 } rlm_exec_t;
 
+typedef struct {
+	exec_coproc_pool_t	*coprocs;	//!< This thread's co-processes.
+} rlm_exec_thread_t;
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("wait", FR_TYPE_BOOL, rlm_exec_t, wait), .dflt = "yes" },
 	{ FR_CONF_OFFSET("program", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_exec_t, program) },
@@ -57,6 +65,8 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("output_pairs", FR_TYPE_STRING, rlm_exec_t, output) },
 	{ FR_CONF_OFFSET("shell_escape", FR_TYPE_BOOL, rlm_exec_t, shell_escape), .dflt = "yes" },
 	{ FR_CONF_OFFSET_IS_SET("timeout", FR_TYPE_TIME_DELTA, rlm_exec_t, timeout) },
+	{ FR_CONF_OFFSET("coprocess", FR_TYPE_BOOL, rlm_exec_t, coprocess), .dflt = "no" },
+	{ FR_CONF_OFFSET("processes", FR_TYPE_UINT32, rlm_exec_t, processes), .dflt = "2" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -95,6 +105,94 @@ static xlat_action_t exec_xlat_resume(TALLOC_CTX *ctx, fr_dcursor_t *out, reques
 	return XLAT_ACTION_DONE;
 }
 
+static xlat_action_t exec_xlat_coproc_resume(TALLOC_CTX *ctx, fr_dcursor_t *out, request_t *request,
+					     UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
+					     UNUSED fr_value_box_list_t *in, void *rctx)
+{
+	exec_coproc_request_t	*creq = rctx;
+	fr_value_box_t		*vb;
+	int			status;
+	char			*body;
+	size_t			len;
+
+	if (exec_coproc_result(&status, &body, request, creq) < 0) {
+	fail:
+		talloc_free(creq);
+		return XLAT_ACTION_FAIL;
+	}
+
+	/*
+	 *	Same as exit codes, 3 is also success.
+	 */
+	if ((status != 0) && (status != 3)) {
+		REDEBUG("Co-process returned %d", status);
+		goto fail;
+	}
+
+	len = strlen(body);
+	while ((len > 0) && ((body[len - 1] == '\n') || (body[len - 1] == '\r'))) len--;
+
+	MEM(vb = fr_value_box_alloc_null(ctx));
+	if (fr_value_box_bstrndup(vb, vb, NULL, body, len, true) < 0) {
+		talloc_free(vb);
+		goto fail;
+	}
+	fr_dcursor_append(out, vb);
+	talloc_free(creq);
+
+	return XLAT_ACTION_DONE;
+}
+
+static void exec_xlat_coproc_signal(UNUSED request_t *request, UNUSED void *xlat_inst, UNUSED void *xlat_thread_inst,
+				    void *rctx, fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	talloc_free(rctx);
+}
+
+/** Send the xlat arguments to a co-process
+ *
+ * The header line is "xlat", followed by each argument as a double
+ * quoted string.
+ */
+static xlat_action_t exec_xlat_coproc(request_t *request, rlm_exec_t const *inst,
+				      fr_value_box_list_t *in, fr_pair_list_t *input_pairs)
+{
+	rlm_exec_thread_t	*t = talloc_get_type_abort(module_thread_by_data(inst)->data, rlm_exec_thread_t);
+	exec_coproc_request_t	*creq;
+	fr_value_box_t		*vb = NULL;
+	fr_sbuff_t		sbuff;
+	fr_sbuff_uctx_talloc_t	tctx;
+	char			*arg;
+
+	MEM(fr_sbuff_init_talloc(request, &sbuff, &tctx, 128, SIZE_MAX));
+	if (fr_sbuff_in_strcpy_literal(&sbuff, "xlat") <= 0) {
+	error:
+		RPEDEBUG("Failed creating co-process request");
+		talloc_free(fr_sbuff_buff(&sbuff));
+		return XLAT_ACTION_FAIL;
+	}
+
+	while ((vb = fr_dlist_next(in, vb))) {
+		arg = fr_value_box_list_aprint(request, &vb->vb_group, NULL, NULL);
+		if (!arg) goto error;
+
+		if ((fr_sbuff_in_char(&sbuff, ' ') <= 0) ||
+		    (fr_value_box_print_quoted(&sbuff, fr_box_strvalue_buffer(arg), T_DOUBLE_QUOTED_STRING) < 0)) {
+			talloc_free(arg);
+			goto error;
+		}
+		talloc_free(arg);
+	}
+
+	creq = exec_coproc_push(request, t->coprocs, request, fr_sbuff_buff(&sbuff), input_pairs);
+	talloc_free(fr_sbuff_buff(&sbuff));
+	if (!creq) return XLAT_ACTION_FAIL;
+
+	return unlang_xlat_yield(request, exec_xlat_coproc_resume, exec_xlat_coproc_signal, creq);
+}
+
 static xlat_arg_parser_t const exec_xlat_args[] = {
 	{ .required = true, .type = FR_TYPE_STRING },
 	{ .variadic = true, .type = FR_TYPE_VOID},
@@ -131,6 +229,8 @@ static xlat_action_t exec_xlat(TALLOC_CTX *ctx, UNUSED fr_dcursor_t *out, reques
 		}
 	}
 
+	if (inst->coprocess) return exec_xlat_coproc(request, inst, in, input_pairs);
+
 	if (!inst->wait) {
 		/* Not waiting for the response */
 		fr_exec_nowait(request, in, input_pairs);
@@ -207,6 +307,32 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	/*
+	 *	Co-processes are started once per thread, so
+	 *	the command line can't depend on the request.
+	 */
+	if (inst->coprocess) {
+		if (!inst->program) {
+			cf_log_err(conf, "Must set 'program' if coprocess = yes");
+			return -1;
+		}
+
+		if (!inst->wait) {
+			cf_log_err(conf, "Cannot use coprocess = yes if wait = no");
+			return -1;
+		}
+
+		if (strchr(inst->program, '%')) {
+			cf_log_err(conf, "'program' must not contain expansions if coprocess = yes");
+			return -1;
+		}
+
+		if (!inst->processes) {
+			cf_log_err(conf, "'processes' must be at least 1");
+			return -1;
+		}
+	}
+
 	if (!inst->timeout_is_set || !inst->timeout) {
 		/*
 		 *	Pick the shorter one
@@ -407,6 +533,58 @@ static unlang_action_t mod_exec_wait_resume(rlm_rcode_t *p_result, module_ctx_t
 	RETURN_MODULE_RCODE(rlm_exec_status2rcode(request, fr_dlist_head(&m->box), status));
 }
 
+static unlang_action_t mod_exec_coproc_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					      request_t *request, void *rctx)
+{
+	rlm_exec_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_exec_t);
+	exec_coproc_request_t	*creq = rctx;
+	fr_value_box_t		*box = NULL;
+	int			status;
+	char			*body;
+	rlm_rcode_t		rcode;
+
+	if (exec_coproc_result(&status, &body, request, creq) < 0) {
+		talloc_free(creq);
+		RETURN_MODULE_FAIL;
+	}
+
+	if (*body) {
+		MEM(box = fr_value_box_alloc_null(creq));
+		MEM(fr_value_box_strdup(box, box, NULL, body, true) == 0);
+	}
+
+	if (inst->output && box) {
+		TALLOC_CTX *ctx;
+		fr_pair_list_t vps, *output_pairs;
+
+		RDEBUG("EXEC GOT -- %pV", box);
+
+		fr_pair_list_init(&vps);
+		output_pairs = tmpl_list_head(request, inst->output_list);
+		fr_assert(output_pairs != NULL);
+
+		ctx = tmpl_list_ctx(request, inst->output_list);
+
+		fr_pair_list_afrom_box(ctx, &vps, request->dict, box);
+		if (!fr_pair_list_empty(&vps)) fr_pair_list_move(output_pairs, &vps, T_OP_ADD);
+
+		box = NULL;	/* has been consumed */
+	}
+
+	rcode = rlm_exec_status2rcode(request, box, status);
+	talloc_free(creq);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+static void mod_exec_coproc_signal(UNUSED module_ctx_t const *mctx, UNUSED request_t *request,
+				   void *rctx, fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	talloc_free(rctx);
+}
+
 /*
  *  Dispatch an async exec method
  */
@@ -451,12 +629,53 @@ static unlang_action_t CC_HINT(nonnull) mod_exec_dispatch(rlm_rcode_t *p_result,
 		}
 	}
 
+	/*
+	 *	The header line tells the co-process which
+	 *	section it's being called from.
+	 */
+	if (inst->coprocess) {
+		rlm_exec_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_exec_thread_t);
+		exec_coproc_request_t	*creq;
+		char			header[128];
+
+		snprintf(header, sizeof(header), "module %s", request->component ? request->component : "-");
+
+		creq = exec_coproc_push(ctx, t->coprocs, request, header, env_pairs);
+		if (!creq) RETURN_MODULE_FAIL;
+
+		return unlang_module_yield(request, mod_exec_coproc_resume, mod_exec_coproc_signal, creq);
+	}
+
 	m = talloc_zero(ctx, rlm_exec_ctx_t);
 	fr_value_box_list_init(&m->box);
 	return unlang_module_yield_to_tmpl(m, &m->box, &m->status, request, inst->tmpl, env_pairs, mod_exec_wait_resume, NULL, &m->box);
 }
 
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_exec_t const	*inst = talloc_get_type_abort(instance, rlm_exec_t);
+	rlm_exec_thread_t	*t = talloc_get_type_abort(thread, rlm_exec_thread_t);
+
+	if (!inst->coprocess) return 0;
+
+	t->coprocs = exec_coproc_pool_alloc(t, el, inst->program, inst->processes, inst->timeout);
+
+	return 0;
+}
+
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_exec_thread_t	*t = talloc_get_type_abort(thread, rlm_exec_thread_t);
+
+	/*
+	 *	Stops the co-processes.
+	 */
+	TALLOC_FREE(t->coprocs);
+
+	return 0;
+}
+
 /*
  *	The module name should be the only globally exported symbol.
  *	That is, everything else should be 'static'.
@@ -475,6 +694,10 @@ module_t rlm_exec = {
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_exec_thread_t),
+	.thread_inst_type	= "rlm_exec_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_exec_dispatch,
 		[MOD_AUTHORIZE]		= mod_exec_dispatch,
@@ -27,39 +27,51 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/pairmove.h>
+#include <freeradius-devel/server/reload.h>
 #include <freeradius-devel/server/users_file.h>
 #include <freeradius-devel/util/htrie.h>
 
 #include <ctype.h>
 #include <fcntl.h>
 
+/** The contents of all of the files
+ *
+ * Replaced as a whole when the files are reloaded.
+ */
 typedef struct {
-	tmpl_t *key;
-	fr_type_t	key_data_type;
-
-	char const *filename;
 	fr_htrie_t *common;
 	PAIR_LIST_LIST *common_def;
 
 	/* autz */
-	char const *usersfile;
 	fr_htrie_t *users;
 	PAIR_LIST_LIST *users_def;
 
 	/* authenticate */
-	char const *auth_usersfile;
 	fr_htrie_t *auth_users;
 	PAIR_LIST_LIST *auth_users_def;
 
 	/* preacct */
-	char const *acct_usersfile;
 	fr_htrie_t *acct_users;
 	PAIR_LIST_LIST *acct_users_def;
 
 	/* post-authenticate */
-	char const *postauth_usersfile;
 	fr_htrie_t *postauth_users;
 	PAIR_LIST_LIST *postauth_users_def;
+} rlm_files_data_t;
+
+typedef struct {
+	tmpl_t *key;
+	fr_type_t	key_data_type;
+
+	char const *filename;
+	char const *usersfile;			/* autz */
+	char const *auth_usersfile;		/* authenticate */
+	char const *acct_usersfile;		/* preacct */
+	char const *postauth_usersfile;		/* post-authenticate */
+
+	bool		reload;			//!< Re-read the files when they change.
+	fr_time_delta_t	reload_delay;		//!< How long the files must be unchanged before reloading.
+	fr_reload_t	*data;			//!< Current #rlm_files_data_t.
 } rlm_files_t;
 
 static fr_dict_t const *dict_freeradius;
@@ -91,6 +103,8 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("auth_usersfile", FR_TYPE_FILE_INPUT, rlm_files_t, auth_usersfile) },
 	{ FR_CONF_OFFSET("postauth_usersfile", FR_TYPE_FILE_INPUT, rlm_files_t, postauth_usersfile) },
 	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL | FR_TYPE_NOT_EMPTY, rlm_files_t, key), .dflt = "%{%{Stripped-User-Name}:-%{User-Name}}", .quote = T_DOUBLE_QUOTED_STRING },
+	{ FR_CONF_OFFSET("reload", FR_TYPE_BOOL, rlm_files_t, reload), .dflt = "no" },
+	{ FR_CONF_OFFSET("reload_delay", FR_TYPE_TIME_DELTA, rlm_files_t, reload_delay), .dflt = "1" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -113,7 +127,100 @@ static int pairlist_to_key(uint8_t **out, size_t *outlen, void const *a)
 	return fr_value_box_to_key(out, outlen, ((PAIR_LIST_LIST const *)a)->box);
 }
 
-static int getusersfile(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **ptree, PAIR_LIST_LIST **pdefault, fr_type_t data_type)
+/*
+ *	Only this many distinct attributes are tracked per list, so
+ *	that file_common() can use a bitmap.
+ */
+#define MAX_REQUIRED	64
+
+/** Find a request attribute which each entry needs in order to match
+ *
+ * A check item which compares a request attribute can't match if the
+ * request doesn't have that attribute.  Record one such attribute for
+ * each entry, so that file_common() can skip the entry without
+ * evaluating any of its check items.  Each distinct attribute is only
+ * looked for once per request.
+ *
+ * This is used for the DEFAULT entries, which are checked for every
+ * request.
+ */
+static void pairlist_required(PAIR_LIST_LIST *list)
+{
+	PAIR_LIST	*pl = NULL;
+	unsigned int	num = 0, i;
+
+	while ((pl = fr_dlist_next(&list->head, pl))) {
+		map_t *map = NULL;
+
+		while ((map = fr_dlist_next(&pl->check, map))) {
+			fr_dict_attr_t const *da;
+
+			/*
+			 *	These operators are false if the
+			 *	attribute doesn't exist.
+			 */
+			switch (map->op) {
+			case T_OP_CMP_EQ:
+			case T_OP_LT:
+			case T_OP_LE:
+			case T_OP_GT:
+			case T_OP_GE:
+			case T_OP_REG_EQ:
+			case T_OP_CMP_TRUE:
+				break;
+
+			default:
+				continue;
+			}
+
+			/*
+			 *	Only simple references to the request
+			 *	list, which this module never changes.
+			 */
+			if (!tmpl_is_attr(map->lhs) ||
+			    (tmpl_request(map->lhs) != REQUEST_CURRENT) ||
+			    (tmpl_list(map->lhs) != PAIR_LIST_REQUEST) ||
+			    (tmpl_attr_count(map->lhs) != 1)) continue;
+
+			da = tmpl_da(map->lhs);
+
+			for (i = 0; i < num; i++) {
+				if (list->required[i] == da) break;
+			}
+
+			if (i == num) {
+				if (num == MAX_REQUIRED) continue;
+
+				if (!list->required) {
+					MEM(list->required = talloc_zero_array(list, fr_dict_attr_t const *, MAX_REQUIRED));
+				}
+				list->required[num++] = da;
+			}
+
+			pl->required = i + 1;
+			break;
+		}
+	}
+}
+
+/** Whether a check or reply item can be used from a reloaded file
+ *
+ * Reloaded files are parsed on the reload thread, after the server has
+ * started.  Expansions in them would never be instantiated, so only
+ * literal values are allowed.  The same rules apply to the first load,
+ * so that a file which works at startup also works when it's reloaded.
+ */
+static int pairlist_check_literal(PAIR_LIST const *entry, map_t const *map, char const *type)
+{
+	if (!map->rhs || !tmpl_contains_xlat(map->rhs)) return 0;
+
+	ERROR("%s[%d] %s item %s uses an expansion.  Only literal values can be used with \"reload = yes\"",
+	      entry->filename, entry->lineno, type, map->lhs->name);
+	return -1;
+}
+
+static int getusersfile(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **ptree, PAIR_LIST_LIST **pdefault,
+			fr_type_t data_type, bool reload)
 {
 	int rcode;
 	PAIR_LIST_LIST users;
@@ -161,6 +268,8 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **ptre
 			}
 			da = tmpl_da(map->lhs);
 
+			if (reload && (pairlist_check_literal(entry, map, "Check") < 0)) return -1;
+
 			/*
 			 *	Ignore attributes which are set
 			 *	properly.
@@ -201,6 +310,8 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **ptre
 			}
 			da = tmpl_da(map->lhs);
 
+			if (reload && (pairlist_check_literal(entry, map, "Reply") < 0)) return -1;
+
 			if ((htype != FR_HTRIE_TRIE) && (da == attr_next_shortest_prefix)) {
 				ERROR("%s[%d] Cannot use %s when key is not an IP / IP prefix",
 				      entry->filename, entry->lineno, da->name);
@@ -339,6 +450,8 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **ptre
 		fr_dlist_insert_tail(&user_list->head, entry);
 	}
 
+	if (default_list) pairlist_required(default_list);
+
 	*ptree = tree;
 
 	return 0;
@@ -348,10 +461,36 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **ptre
 
 /*
  *	(Re-)read the "users" file into memory.
+ *
+ *	This is called from the reload thread, and so must not modify
+ *	the instance data.
  */
+static void *files_load(TALLOC_CTX *ctx, void *uctx)
+{
+	rlm_files_t const	*inst = talloc_get_type_abort_const(uctx, rlm_files_t);
+	rlm_files_data_t	*data;
+
+	MEM(data = talloc_zero(ctx, rlm_files_data_t));
+
+#undef READFILE
+#define READFILE(_x, _y, _d) do { if (getusersfile(data, inst->_x, &data->_y, &data->_d, inst->key_data_type, inst->reload) != 0) { ERROR("Failed reading %s", inst->_x); return NULL;} } while (0)
+
+	READFILE(filename, common, common_def);
+	READFILE(usersfile, users, users_def);
+	READFILE(acct_usersfile, acct_users, acct_users_def);
+	READFILE(auth_usersfile, auth_users, auth_users_def);
+	READFILE(postauth_usersfile, postauth_users, postauth_users_def);
+
+	return data;
+}
+
 static int mod_instantiate(void *instance, CONF_SECTION *conf)
 {
-	rlm_files_t *inst = instance;
+	rlm_files_t	*inst = instance;
+	char const	*files[5];
+	unsigned int	num_files = 0;
+
+	FR_TIME_DELTA_BOUND_CHECK("reload_delay", inst->reload_delay, >=, fr_time_delta_from_msec(100));
 
 	inst->key_data_type = tmpl_expanded_type(inst->key);
 	if (fr_htrie_hint(inst->key_data_type) == FR_HTRIE_INVALID) {
@@ -360,14 +499,33 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
-#undef READFILE
-#define READFILE(_x, _y, _d) do { if (getusersfile(inst, inst->_x, &inst->_y, &inst->_d, inst->key_data_type) != 0) { ERROR("Failed reading %s", inst->_x); return -1;} } while (0)
+	if (inst->reload) {
+		if (inst->filename) files[num_files++] = inst->filename;
+		if (inst->usersfile) files[num_files++] = inst->usersfile;
+		if (inst->acct_usersfile) files[num_files++] = inst->acct_usersfile;
+		if (inst->auth_usersfile) files[num_files++] = inst->auth_usersfile;
+		if (inst->postauth_usersfile) files[num_files++] = inst->postauth_usersfile;
+	}
 
-	READFILE(filename, common, common_def);
-	READFILE(usersfile, users, users_def);
-	READFILE(acct_usersfile, acct_users, acct_users_def);
-	READFILE(auth_usersfile, auth_users, auth_users_def);
-	READFILE(postauth_usersfile, postauth_users, postauth_users_def);
+	inst->data = fr_reload_alloc(inst, cf_section_name(conf), files, num_files, inst->reload_delay,
+				     files_load, inst);
+	if (!inst->data) {
+		cf_log_perr(conf, "Failed loading files");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_files_t *inst = instance;
+
+	/*
+	 *	Stop the reload thread before the rest
+	 *	of the instance data goes away.
+	 */
+	TALLOC_FREE(inst->data);
 
 	return 0;
 }
@@ -384,6 +542,7 @@ static unlang_action_t file_common(rlm_rcode_t *p_result, rlm_files_t const *ins
 	PAIR_LIST_LIST		my_list;
 	uint8_t			key_buffer[16], *key;
 	size_t			keylen = 0;
+	uint64_t		checked = 0, present = 0;	/* bitmaps of default_list->required */
 
 	if (!tree && !default_list) RETURN_MODULE_NOOP;
 
@@ -470,6 +629,26 @@ redo:
 			default_pl = fr_dlist_next(&default_list->head, default_pl);
 		}
 
+		/*
+		 *	Skip DEFAULT entries which test for a request
+		 *	attribute we don't have.
+		 */
+		if (pl->required) {
+			uint64_t bit = ((uint64_t) 1) << (pl->required - 1);
+
+			if (!(checked & bit)) {
+				checked |= bit;
+				if (fr_pair_find_by_da(&request->request_pairs,
+						       default_list->required[pl->required - 1], 0)) present |= bit;
+			}
+
+			if (!(present & bit)) {
+				RDEBUG3("Skipping entry on line %d of %s, request has no %s",
+					pl->lineno, filename, default_list->required[pl->required - 1]->name);
+				continue;
+			}
+		}
+
 		fr_pair_list_init(&list);
 
 		/*
@@ -625,10 +804,16 @@ redo:
 static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_files_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_files_t);
+	fr_reload_ref_t ref;
+	rlm_files_data_t const *data = fr_reload_acquire(&ref, inst->data);
+	unlang_action_t ret;
+
+	ret = file_common(p_result, inst, request, inst->filename,
+			  data->users ? data->users : data->common,
+			  data->users ? data->users_def : data->common_def);
+	fr_reload_release(&ref);
 
-	return file_common(p_result, inst, request, inst->filename,
-			   inst->users ? inst->users : inst->common,
-			   inst->users ? inst->users_def : inst->common_def);
+	return ret;
 }
 
 
@@ -640,28 +825,46 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 static unlang_action_t CC_HINT(nonnull) mod_preacct(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_files_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_files_t);
+	fr_reload_ref_t ref;
+	rlm_files_data_t const *data = fr_reload_acquire(&ref, inst->data);
+	unlang_action_t ret;
 
-	return file_common(p_result, inst, request, inst->acct_usersfile,
-			   inst->acct_users ? inst->acct_users : inst->common,
-			   inst->acct_users ? inst->acct_users_def : inst->common_def);
+	ret = file_common(p_result, inst, request, inst->acct_usersfile,
+			  data->acct_users ? data->acct_users : data->common,
+			  data->acct_users ? data->acct_users_def : data->common_def);
+	fr_reload_release(&ref);
+
+	return ret;
 }
 
 static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_files_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_files_t);
+	fr_reload_ref_t ref;
+	rlm_files_data_t const *data = fr_reload_acquire(&ref, inst->data);
+	unlang_action_t ret;
+
+	ret = file_common(p_result, inst, request, inst->auth_usersfile,
+			  data->auth_users ? data->auth_users : data->common,
+			  data->auth_users ? data->auth_users_def : data->common_def);
+	fr_reload_release(&ref);
 
-	return file_common(p_result, inst, request, inst->auth_usersfile,
-			   inst->auth_users ? inst->auth_users : inst->common,
-			   inst->auth_users ? inst->auth_users_def : inst->common_def);
+	return ret;
 }
 
 static unlang_action_t CC_HINT(nonnull) mod_post_auth(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_files_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_files_t);
+	fr_reload_ref_t ref;
+	rlm_files_data_t const *data = fr_reload_acquire(&ref, inst->data);
+	unlang_action_t ret;
+
+	ret = file_common(p_result, inst, request, inst->postauth_usersfile,
+			  data->postauth_users ? data->postauth_users : data->common,
+			  data->postauth_users ? data->postauth_users_def : data->common_def);
+	fr_reload_release(&ref);
 
-	return file_common(p_result, inst, request, inst->postauth_usersfile,
-			   inst->postauth_users ? inst->postauth_users : inst->common,
-			   inst->postauth_users ? inst->postauth_users_def : inst->common_def);
+	return ret;
 }
 
 
@@ -673,6 +876,7 @@ module_t rlm_files = {
 	.inst_size	= sizeof(rlm_files_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize,
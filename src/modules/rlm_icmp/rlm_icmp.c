@@ -29,6 +29,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/atexit.h>
 #include <freeradius-devel/util/cap.h>
 #include <freeradius-devel/util/debug.h>
 
@@ -43,32 +44,79 @@ typedef struct {
 	char const	*xlat_name;
 	char const	*interface;
 	fr_time_delta_t	timeout;
+	fr_time_delta_t	cache_ttl;
 	fr_ipaddr_t	src_ipaddr;
 } rlm_icmp_t;
 
+/** An ICMP socket, shared by all instances in a thread with the same source address and interface
+ *
+ */
 typedef struct {
-	rlm_icmp_t	*inst;
-	fr_rb_tree_t	*tree;
-	int		fd;
+	fr_dlist_t	entry;			//!< Entry in the thread's list of sockets.
+	unsigned int	refs;			//!< How many module thread instances are using it.
+
+	char const	*name;			//!< Of the instance which opened the socket, for log messages.
 	fr_event_list_t *el;
+	int		fd;
+	fr_ipaddr_t	src_ipaddr;
+	char const	*interface;
+
+	fr_rb_tree_t	*tree;			//!< Outstanding echo requests, for every instance.
 
 	uint32_t	data;
 	uint16_t	ident;
-	uint32_t	counter;
+	uint32_t	counter;		//!< Shared by all instances, so echo requests are
+						///< unique on the socket.
 
 	fr_type_t	ipaddr_type;
 	uint8_t		request_type;
 	uint8_t		reply_type;
+} rlm_icmp_socket_t;
+
+static _Thread_local fr_dlist_head_t *icmp_sockets;
+
+typedef struct {
+	rlm_icmp_t	*inst;
+	rlm_icmp_socket_t *sock;		//!< Socket the echo requests are sent on.
+
+	fr_rb_tree_t	*cache;			//!< Recent results, by address.
+	fr_dlist_head_t	cache_expiry;		//!< Recent results, oldest first.
 } rlm_icmp_thread_t;
 
+typedef struct rlm_icmp_probe_s rlm_icmp_probe_t;
+
 typedef struct {
 	fr_rb_node_t	node;			//!< Entry in the outstanding list of echo requests.
+	bool		pending;		//!< Are we still in the outstanding list?
 	bool		replied;		//!< do we have a reply?
+	bool		cached;			//!< was the result taken from the cache?
 	fr_value_box_t	*ip;			//!< the IP we're pinging
 	uint32_t	counter;	       	//!< for pinging the same IP multiple times
-	request_t	*request;		//!< so it can be resumed when we get the echo reply
+	rlm_icmp_probe_t *probe;		//!< so it can be resumed when we get the echo reply
 } rlm_icmp_echo_t;
 
+/** Echo requests sent by one call to the xlat
+ *
+ */
+struct rlm_icmp_probe_s {
+	rlm_icmp_thread_t	*t;
+	request_t		*request;	//!< so it can be resumed when we get the last echo reply
+	unsigned int		outstanding;	//!< How many echo requests are still waiting for a reply.
+	unsigned int		num;		//!< Number of addresses being pinged.
+	rlm_icmp_echo_t		*echo;		//!< One per address, in argument order.
+};
+
+/** A recent result for an address
+ *
+ */
+typedef struct {
+	fr_rb_node_t	node;			//!< Entry in the cache tree.
+	fr_dlist_t	entry;			//!< Entry in the expiry list.
+	fr_ipaddr_t	ipaddr;
+	bool		replied;
+	fr_time_t	expires;
+} rlm_icmp_cache_t;
+
 /** Wrapper around the module thread stuct for individual xlats
  *
  */
@@ -120,130 +168,173 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("interface", FR_TYPE_STRING, rlm_icmp_t, interface) },
 	{ FR_CONF_OFFSET("src_ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_icmp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_TIME_DELTA, rlm_icmp_t, timeout), .dflt = "1s" },
+	{ FR_CONF_OFFSET("cache_ttl", FR_TYPE_TIME_DELTA, rlm_icmp_t, cache_ttl), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
+static int8_t cache_cmp(void const *one, void const *two)
+{
+	rlm_icmp_cache_t const *a = one;
+	rlm_icmp_cache_t const *b = two;
+
+	return fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
+}
+
+/** Remove results which are older than cache_ttl
+ *
+ * All entries have the same TTL, so the expiry list is in expiry order.
+ */
+static void icmp_cache_expire(rlm_icmp_thread_t *t, fr_time_t now)
+{
+	rlm_icmp_cache_t *c;
+
+	while ((c = fr_dlist_head(&t->cache_expiry)) && (c->expires <= now)) {
+		fr_dlist_remove(&t->cache_expiry, c);
+		(void) fr_rb_delete(t->cache, c);
+		talloc_free(c);
+	}
+}
+
+/** Find a recent result for an address
+ *
+ */
+static rlm_icmp_cache_t *icmp_cache_find(rlm_icmp_thread_t *t, fr_ipaddr_t const *ipaddr, fr_time_t now)
+{
+	rlm_icmp_cache_t my_c;
+
+	if (!t->cache) return NULL;
+
+	icmp_cache_expire(t, now);
+
+	my_c.ipaddr = *ipaddr;
+	return fr_rb_find(t->cache, &my_c);
+}
+
+/** Record the result for an address
+ *
+ */
+static void icmp_cache_update(rlm_icmp_thread_t *t, fr_ipaddr_t const *ipaddr, bool replied, fr_time_t now)
+{
+	rlm_icmp_cache_t *c;
+
+	if (!t->cache) return;
+
+	c = icmp_cache_find(t, ipaddr, now);
+	if (c) {
+		fr_dlist_remove(&t->cache_expiry, c);
+	} else {
+		MEM(c = talloc_zero(t, rlm_icmp_cache_t));
+		c->ipaddr = *ipaddr;
+		(void) fr_rb_insert(t->cache, c);
+	}
+
+	c->replied = replied;
+	c->expires = now + t->inst->cache_ttl;
+	fr_dlist_insert_tail(&t->cache_expiry, c);
+}
+
+/** Remove any echo requests which are still outstanding
+ *
+ */
+static int _icmp_probe_free(rlm_icmp_probe_t *probe)
+{
+	unsigned int i;
+
+	for (i = 0; i < probe->num; i++) {
+		if (!probe->echo[i].pending) continue;
+
+		(void) fr_rb_delete(probe->t->sock->tree, &probe->echo[i]);
+		probe->echo[i].pending = false;
+	}
+	probe->outstanding = 0;
+
+	return 0;
+}
+
 static xlat_action_t xlat_icmp_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
 				      UNUSED request_t *request,
-				      UNUSED void const *xlat_inst, void *xlat_thread_inst,
+				      UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
 				      UNUSED fr_value_box_list_t *in, void *rctx)
 {
-	rlm_icmp_echo_t *echo = talloc_get_type_abort(rctx, rlm_icmp_echo_t);
-	xlat_icmp_thread_inst_t	*thread = talloc_get_type_abort(xlat_thread_inst, xlat_icmp_thread_inst_t);
-	fr_value_box_t	*vb;
+	rlm_icmp_probe_t	*probe = talloc_get_type_abort(rctx, rlm_icmp_probe_t);
+	fr_value_box_t		*vb;
+	fr_time_t		now = fr_time();
+	unsigned int		i;
 
-	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_BOOL, NULL, false));
-	vb->vb_bool = echo->replied;
+	for (i = 0; i < probe->num; i++) {
+		rlm_icmp_echo_t *echo = &probe->echo[i];
 
-	(void) fr_rb_delete(thread->t->tree, echo);
-	talloc_free(echo);
+		if (!echo->cached) icmp_cache_update(probe->t, &echo->ip->vb_ip, echo->replied, now);
+
+		MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_BOOL, NULL, false));
+		vb->vb_bool = echo->replied;
+		fr_dcursor_append(out, vb);
+	}
 
-	fr_dcursor_insert(out, vb);
+	talloc_free(probe);
 
 	return XLAT_ACTION_DONE;
 }
 
-static void xlat_icmp_cancel(request_t *request, UNUSED void *xlat_inst, void *xlat_thread_inst,
+static void xlat_icmp_cancel(request_t *request, UNUSED void *xlat_inst, UNUSED void *xlat_thread_inst,
 			     void *rctx, fr_state_signal_t action)
 {
-	rlm_icmp_echo_t *echo = talloc_get_type_abort(rctx, rlm_icmp_echo_t);
-	xlat_icmp_thread_inst_t	*thread = talloc_get_type_abort(xlat_thread_inst, xlat_icmp_thread_inst_t);
+	rlm_icmp_probe_t *probe = talloc_get_type_abort(rctx, rlm_icmp_probe_t);
 
 	if (action != FR_SIGNAL_CANCEL) return;
 
-	RDEBUG2("Cancelling ICMP request for %pV (counter=%d)", echo->ip, echo->counter);
+	RDEBUG2("Cancelling %u ICMP request(s)", probe->outstanding);
 
-	(void) fr_rb_delete(thread->t->tree, echo);
-	talloc_free(echo);
+	talloc_free(probe);
 }
 
 
 static void _xlat_icmp_timeout(request_t *request,
 			     UNUSED void *xlat_inst, UNUSED void *xlat_thread_inst, void *rctx, UNUSED fr_time_t fired)
 {
-	rlm_icmp_echo_t *echo = talloc_get_type_abort(rctx, rlm_icmp_echo_t);
+	rlm_icmp_probe_t	*probe = talloc_get_type_abort(rctx, rlm_icmp_probe_t);
+	unsigned int		i;
+
+	if (!probe->outstanding) return; /* it MUST already have been marked resumable. */
 
-	if (echo->replied) return; /* it MUST already have been marked resumable. */
+	for (i = 0; i < probe->num; i++) {
+		rlm_icmp_echo_t *echo = &probe->echo[i];
 
-	RDEBUG2("No response to ICMP request for %pV (counter=%d)", echo->ip, echo->counter);
+		if (!echo->pending) continue;
+
+		RDEBUG2("No response to ICMP request for %pV (counter=%d)", echo->ip, echo->counter);
+	}
+
+	/*
+	 *	Late replies are ignored.
+	 */
+	_icmp_probe_free(probe);
 
 	unlang_interpret_mark_runnable(request);
 }
 
 static xlat_arg_parser_t const xlat_icmp_args[] = {
-	{ .required = true, .single = true, .type = FR_TYPE_STRING },
+	{ .required = true, .variadic = true, .type = FR_TYPE_STRING },
 	XLAT_ARG_PARSER_TERMINATOR
 };
 
-/** Xlat to ping a specified ip address
- *
- * Example (ping 192.0.2.1):
-@verbatim
-"%(icmp:192.0.2.1)"
-@endverbatim
+/** Send an echo request to one address
  *
- * @ingroup xlat_functions
  */
-static xlat_action_t xlat_icmp(TALLOC_CTX *ctx, UNUSED fr_dcursor_t *out,
-			       request_t *request, void const *xlat_inst, void *xlat_thread_inst,
-			       fr_value_box_list_t *in)
+static int icmp_send(request_t *request, rlm_icmp_socket_t *sock, rlm_icmp_echo_t *echo)
 {
-	void			*instance;
-	rlm_icmp_t const	*inst;
-	xlat_icmp_thread_inst_t	*thread = talloc_get_type_abort(xlat_thread_inst, xlat_icmp_thread_inst_t);
-	rlm_icmp_echo_t		*echo;
 	icmp_header_t		icmp;
 	uint16_t		checksum;
 	ssize_t			rcode;
 	socklen_t      		salen;
 	struct sockaddr_storage	dst;
-	fr_value_box_t		*in_head = fr_dlist_head(in);
-
-	memcpy(&instance, xlat_inst, sizeof(instance));	/* Stupid const issues */
-
-	inst = talloc_get_type_abort(instance, rlm_icmp_t);
-
-	/*
-	 *	If there's no input, do we can't ping anything.
-	 */
-	if (!in_head) return XLAT_ACTION_FAIL;
-
-	if (fr_value_box_cast_in_place(ctx, in_head, thread->t->ipaddr_type, NULL) < 0) {
-		RPEDEBUG("Failed casting result to IP address");
-		return XLAT_ACTION_FAIL;
-	}
-
-	MEM(echo = talloc_zero(ctx, rlm_icmp_echo_t));
-	echo->ip = in_head;
-	echo->request = request;
-	echo->counter = thread->t->counter++;
-
-	/*
-	 *	Add the IP to the local tracking heap, so that the IO
-	 *	functions can find it.
-	 *
-	 *	This insert will never fail, because of the unique
-	 *	counter above.
-	 */
-	if (!fr_rb_insert(thread->t->tree, echo)) {
-		RPEDEBUG("Failed inserting IP into tracking table");
-		talloc_free(echo);
-		return XLAT_ACTION_FAIL;
-	}
-
-	if (unlang_xlat_event_timeout_add(request, _xlat_icmp_timeout, echo, fr_time() + inst->timeout) < 0) {
-		RPEDEBUG("Failed adding timeout");
-		(void) fr_rb_delete(thread->t->tree, echo);
-		talloc_free(echo);
-		return XLAT_ACTION_FAIL;
-	}
 
 	RDEBUG("Sending ICMP request to %pV (counter=%d)", echo->ip, echo->counter);
 
 	icmp = (icmp_header_t) {
-		.type = thread->t->request_type,
-		.ident = thread->t->ident,
-		.data = thread->t->data,
+		.type = sock->request_type,
+		.ident = sock->ident,
+		.data = sock->data,
 		.counter = echo->counter
 	};
 
@@ -257,8 +348,8 @@ static xlat_action_t xlat_icmp(TALLOC_CTX *ctx, UNUSED fr_dcursor_t *out,
 	/*
 	 *	Start off with the IPv6 pseudo-header checksum
 	 */
-	if (thread->t->ipaddr_type == FR_TYPE_IPV6_ADDR) {
-		checksum = fr_ip6_pesudo_header_checksum(&thread->t->inst->src_ipaddr.addr.v6, &echo->ip->vb_ip.addr.v6,
+	if (sock->ipaddr_type == FR_TYPE_IPV6_ADDR) {
+		checksum = fr_ip6_pesudo_header_checksum(&sock->src_ipaddr.addr.v6, &echo->ip->vb_ip.addr.v6,
 							 sizeof(ip_header6_t) + sizeof(icmp), IPPROTO_ICMPV6);
 	}
 
@@ -267,22 +358,134 @@ static xlat_action_t xlat_icmp(TALLOC_CTX *ctx, UNUSED fr_dcursor_t *out,
 	 */
 	icmp.checksum = htons(icmp_checksum((uint8_t *) &icmp, sizeof(icmp), checksum));
 
-	rcode = sendto(thread->t->fd, &icmp, sizeof(icmp), 0, (struct sockaddr *) &dst, salen);
+	rcode = sendto(sock->fd, &icmp, sizeof(icmp), 0, (struct sockaddr *) &dst, salen);
 	if (rcode < 0) {
 		REDEBUG("Failed sending ICMP request to %pV: %s", echo->ip, fr_syserror(errno));
-		(void) fr_rb_delete(thread->t->tree, echo);
-		talloc_free(echo);
-		return XLAT_ACTION_FAIL;
+		return -1;
 	}
 
 	if ((size_t) rcode < sizeof(icmp)) {
 		REDEBUG("Failed sending entire ICMP packet");
-		(void) fr_rb_delete(thread->t->tree, echo);
-		talloc_free(echo);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Xlat to ping one or more ip addresses
+ *
+ * Each address is pinged in parallel, and the result is a list of
+ * booleans, one for each address, in the same order.
+ *
+ * Example (ping 192.0.2.1):
+@verbatim
+"%(icmp:192.0.2.1)"
+@endverbatim
+ *
+ * Example (ping 192.0.2.1 and 192.0.2.2):
+@verbatim
+"%(icmp:192.0.2.1 192.0.2.2)"
+@endverbatim
+ *
+ * @ingroup xlat_functions
+ */
+static xlat_action_t xlat_icmp(TALLOC_CTX *ctx, fr_dcursor_t *out,
+			       request_t *request, void const *xlat_inst, void *xlat_thread_inst,
+			       fr_value_box_list_t *in)
+{
+	void			*instance;
+	rlm_icmp_t const	*inst;
+	xlat_icmp_thread_inst_t	*thread = talloc_get_type_abort(xlat_thread_inst, xlat_icmp_thread_inst_t);
+	rlm_icmp_socket_t	*sock = thread->t->sock;
+	rlm_icmp_probe_t	*probe;
+	rlm_icmp_echo_t		*echo;
+	rlm_icmp_cache_t	*c;
+	fr_value_box_t		*arg = NULL, *vb;
+	fr_time_t		now = fr_time();
+	unsigned int		num = 0;
+
+	memcpy(&instance, xlat_inst, sizeof(instance));	/* Stupid const issues */
+
+	inst = talloc_get_type_abort(instance, rlm_icmp_t);
+
+	/*
+	 *	Each argument may expand to several addresses.
+	 */
+	while ((arg = fr_dlist_next(in, arg))) num += fr_dlist_num_elements(&arg->vb_group);
+
+	/*
+	 *	If there's no input, do we can't ping anything.
+	 */
+	if (!num) return XLAT_ACTION_FAIL;
+
+	if (sock->fd < 0) {
+		REDEBUG("ICMP socket is closed");
 		return XLAT_ACTION_FAIL;
 	}
 
-	return unlang_xlat_yield(request, xlat_icmp_resume, xlat_icmp_cancel, echo);
+	MEM(probe = talloc_zero(ctx, rlm_icmp_probe_t));
+	MEM(probe->echo = talloc_zero_array(probe, rlm_icmp_echo_t, num));
+	probe->t = thread->t;
+	probe->request = request;
+	talloc_set_destructor(probe, _icmp_probe_free);
+
+	while ((arg = fr_dlist_next(in, arg))) {
+		vb = NULL;
+		while ((vb = fr_dlist_next(&arg->vb_group, vb))) {
+			if (fr_value_box_cast_in_place(ctx, vb, sock->ipaddr_type, NULL) < 0) {
+				RPEDEBUG("Failed casting result to IP address");
+			error:
+				talloc_free(probe);
+				return XLAT_ACTION_FAIL;
+			}
+
+			echo = &probe->echo[probe->num++];
+			echo->ip = vb;
+			echo->probe = probe;
+
+			/*
+			 *	We pinged this address recently, so
+			 *	there's no need to do it again.
+			 */
+			c = icmp_cache_find(thread->t, &vb->vb_ip, now);
+			if (c) {
+				RDEBUG2("Using cached ICMP result for %pV", echo->ip);
+				echo->replied = c->replied;
+				echo->cached = true;
+				continue;
+			}
+
+			echo->counter = sock->counter++;
+
+			/*
+			 *	Add the IP to the local tracking heap, so that the IO
+			 *	functions can find it.
+			 *
+			 *	This insert will never fail, because of the unique
+			 *	counter above.
+			 */
+			if (!fr_rb_insert(sock->tree, echo)) {
+				RPEDEBUG("Failed inserting IP into tracking table");
+				goto error;
+			}
+			echo->pending = true;
+			probe->outstanding++;
+
+			if (icmp_send(request, sock, echo) < 0) goto error;
+		}
+	}
+
+	/*
+	 *	Everything was in the cache.
+	 */
+	if (!probe->outstanding) return xlat_icmp_resume(ctx, out, request, xlat_inst, xlat_thread_inst, in, probe);
+
+	if (unlang_xlat_event_timeout_add(request, _xlat_icmp_timeout, probe, fr_time() + inst->timeout) < 0) {
+		RPEDEBUG("Failed adding timeout");
+		goto error;
+	}
+
+	return unlang_xlat_yield(request, xlat_icmp_resume, xlat_icmp_cancel, probe);
 }
 
 static int8_t echo_cmp(void const *one, void const *two)
@@ -298,14 +501,15 @@ static int8_t echo_cmp(void const *one, void const *two)
 
 static void mod_icmp_read(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUSED int flags, void *ctx)
 {
-	rlm_icmp_thread_t *t = talloc_get_type_abort(ctx, rlm_icmp_thread_t);
-	rlm_icmp_t *inst = t->inst;
+	rlm_icmp_socket_t *sock = talloc_get_type_abort(ctx, rlm_icmp_socket_t);
+	rlm_icmp_socket_t *inst = sock;		/* for LOG_PREFIX_ARGS */
 	ssize_t len;
 	icmp_header_t *icmp;
 	rlm_icmp_echo_t my_echo, *echo;
+	rlm_icmp_probe_t *probe;
 	uint64_t buffer[256];
 
-	len = read(t->fd, (char *) buffer, sizeof(buffer));
+	len = read(sock->fd, (char *) buffer, sizeof(buffer));
 	if (len <= 0) return;
 
 	HEXDUMP4((uint8_t const *)buffer, len, "received icmp packet ");
@@ -313,12 +517,12 @@ static void mod_icmp_read(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUSED
 	/*
 	 *	Ignore packets if we haven't sent any requests.
 	 */
-	if (fr_rb_num_elements(t->tree) == 0) {
+	if (fr_rb_num_elements(sock->tree) == 0) {
 		return;
 	}
 
 	// buffer is actually the IP header + the ICMP packet
-	if (t->ipaddr_type == FR_TYPE_IPV4_ADDR) {
+	if (sock->ipaddr_type == FR_TYPE_IPV4_ADDR) {
 		ip_header_t *ip = (ip_header_t *) buffer;
 
 		if (IP_V(ip) != 4) {
@@ -330,7 +534,7 @@ static void mod_icmp_read(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUSED
 		}
 
 		icmp = (icmp_header_t *) (((uint8_t *) buffer) + IP_HL(ip));
-	} else if (t->ipaddr_type == FR_TYPE_IPV6_ADDR) {
+	} else if (sock->ipaddr_type == FR_TYPE_IPV6_ADDR) {
 		/*
 		 *	Outgoing packets automatically have an IPv6 header prepended to them
 		 *	(based on the destination address).  ICMPv6 pseudo header checksum field
@@ -356,8 +560,8 @@ static void mod_icmp_read(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUSED
 	 *	up in the rbtree, as these checks ensure that the
 	 *	packet is for this specific thread.
 	 */
-	if ((icmp->type != t->reply_type) ||
-	    (icmp->ident != t->ident) || (icmp->data != t->data)) {
+	if ((icmp->type != sock->reply_type) ||
+	    (icmp->ident != sock->ident) || (icmp->data != sock->data)) {
 		return;
 	}
 
@@ -365,75 +569,102 @@ static void mod_icmp_read(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUSED
 	 *	Look up the packet by the fields which determine *our* ICMP packets.
 	 */
 	my_echo.counter = icmp->counter;
-	echo = fr_rb_find(t->tree, &my_echo);
+	echo = fr_rb_find(sock->tree, &my_echo);
 	if (!echo) {
 		DEBUG("Can't find packet counter=%d in tree", icmp->counter);
 		return;
 	}
 
-	(void) fr_rb_delete(t->tree, echo);
+	(void) fr_rb_delete(sock->tree, echo);
+	echo->pending = false;
 
 	/*
 	 *	We have a reply!
 	 */
 	echo->replied = true;
-	unlang_interpret_mark_runnable(echo->request);
+
+	/*
+	 *	Only resume the request when all of its echo
+	 *	requests have been answered.
+	 */
+	probe = echo->probe;
+	if (--probe->outstanding == 0) unlang_interpret_mark_runnable(probe->request);
 }
 
 static void mod_icmp_error(fr_event_list_t *el, UNUSED int sockfd, UNUSED int flags,
 			   UNUSED int fd_errno, void *ctx)
 {
-	rlm_icmp_thread_t *t = talloc_get_type_abort(ctx, rlm_icmp_thread_t);
-	rlm_icmp_t *inst = t->inst;
+	rlm_icmp_socket_t *sock = talloc_get_type_abort(ctx, rlm_icmp_socket_t);
+	rlm_icmp_socket_t *inst = sock;		/* for LOG_PREFIX_ARGS */
 
 	ERROR("Failed reading from ICMP socket - Closing it");
 
-	(void) fr_event_fd_delete(el, t->fd, FR_EVENT_FILTER_IO);
-	close(t->fd);
-	t->fd = -1;
+	(void) fr_event_fd_delete(el, sock->fd, FR_EVENT_FILTER_IO);
+	close(sock->fd);
+	sock->fd = -1;
 }
 
-/** Resolves and caches the module's thread instance for use by a specific xlat instance
- *
- * @param[in] xlat_inst			UNUSED.
- * @param[in] xlat_thread_inst		pre-allocated structure to hold pointer to module's
- *					thread instance.
- * @param[in] exp			UNUSED.
- * @param[in] uctx			Module's global instance.  Used to lookup thread
- *					specific instance.
- * @return 0.
- */
-static int mod_xlat_thread_instantiate(UNUSED void *xlat_inst, void *xlat_thread_inst,
-				       UNUSED xlat_exp_t const *exp, void *uctx)
+static int _icmp_socket_free(rlm_icmp_socket_t *sock)
 {
-	rlm_icmp_t		*inst = talloc_get_type_abort(uctx, rlm_icmp_t);
-	xlat_icmp_thread_inst_t	*xt = xlat_thread_inst;
+	if (sock->fd >= 0) {
+		(void) fr_event_fd_delete(sock->el, sock->fd, FR_EVENT_FILTER_IO);
+		close(sock->fd);
+	}
 
-	xt->inst = inst;
-	xt->t = talloc_get_type_abort(module_thread_by_data(inst)->data, rlm_icmp_thread_t);
+	if (icmp_sockets) fr_dlist_remove(icmp_sockets, sock);
 
 	return 0;
 }
 
-static int mod_xlat_instantiate(void *xlat_inst, UNUSED xlat_exp_t const *exp, void *uctx)
+/** Free any sockets left on the thread's list
+ *
+ */
+static void _icmp_sockets_free(void *arg)
 {
-	*((void **)xlat_inst) = talloc_get_type_abort(uctx, rlm_icmp_t);
-	return 0;
+	fr_dlist_head_t *list = arg;
+
+	icmp_sockets = NULL;
+	fr_dlist_talloc_free(list);
+	talloc_free(list);
 }
 
-/** Instantiate thread data for the submodule.
+/** Find or open the ICMP socket for this thread, source address and interface
  *
+ * Instances with the same settings share one socket, so the number of raw
+ * sockets doesn't grow with the number of instances.
  */
-static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+static rlm_icmp_socket_t *icmp_socket_get(rlm_icmp_t const *inst, fr_event_list_t *el)
 {
-	int fd, af, proto;
-	rlm_icmp_t *inst = talloc_get_type_abort(instance, rlm_icmp_t);
-	rlm_icmp_thread_t *t = talloc_get_type_abort(thread, rlm_icmp_thread_t);
-	fr_ipaddr_t ipaddr, *src;
+	rlm_icmp_socket_t	*sock = NULL;
+	int			fd, af, proto;
+	fr_ipaddr_t		ipaddr, *src;
 
-	MEM(t->tree = fr_rb_inline_alloc(t, rlm_icmp_echo_t, node, echo_cmp, NULL));
-	t->inst = inst;
-	t->el = el;
+	if (!icmp_sockets) {
+		fr_dlist_head_t *list;
+
+		MEM(list = talloc_zero(NULL, fr_dlist_head_t));
+		fr_dlist_talloc_init(list, rlm_icmp_socket_t, entry);
+		fr_atexit_thread_local(icmp_sockets, _icmp_sockets_free, list);
+	}
+
+	while ((sock = fr_dlist_next(icmp_sockets, sock))) {
+		if ((sock->el == el) &&
+		    (fr_ipaddr_cmp(&sock->src_ipaddr, &inst->src_ipaddr) == 0) &&
+		    ((sock->interface == inst->interface) ||
+		     (sock->interface && inst->interface && (strcmp(sock->interface, inst->interface) == 0)))) {
+			sock->refs++;
+			return sock;
+		}
+	}
+
+	MEM(sock = talloc_zero(NULL, rlm_icmp_socket_t));
+	MEM(sock->tree = fr_rb_inline_alloc(sock, rlm_icmp_echo_t, node, echo_cmp, NULL));
+	MEM(sock->name = talloc_strdup(sock, inst->name));
+	if (inst->interface) MEM(sock->interface = talloc_strdup(sock, inst->interface));
+	sock->src_ipaddr = inst->src_ipaddr;
+	sock->el = el;
+	sock->fd = -1;
+	talloc_set_destructor(sock, _icmp_socket_free);
 
 	/*
 	 *      Since these fields are random numbers, we don't care
@@ -446,31 +677,33 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 	 *      tcpdump, etc. may show the ident as 0xcdab.  That's
 	 *      fine.
 	 */
-	t->data = fr_rand();
-	t->ident = fr_rand();
+	sock->data = fr_rand();
+	sock->ident = fr_rand();
 
 	af = inst->src_ipaddr.af;
 
 	switch (af) {
 	default:
 		fr_strerror_const("Unsupported address family");
-		return -1;
+	error:
+		talloc_free(sock);
+		return NULL;
 
 	case AF_UNSPEC:
 	case AF_INET:
 		af = AF_INET;
 		proto = IPPROTO_ICMP;
-		t->request_type = ICMP_ECHOREQUEST;
-		t->reply_type = ICMP_ECHOREPLY;
-		t->ipaddr_type = FR_TYPE_IPV4_ADDR;
+		sock->request_type = ICMP_ECHOREQUEST;
+		sock->reply_type = ICMP_ECHOREPLY;
+		sock->ipaddr_type = FR_TYPE_IPV4_ADDR;
 		break;
 
 	case AF_INET6:
 		af = AF_INET6;
 		proto = IPPROTO_ICMPV6;
-		t->request_type = ICMPV6_ECHOREQUEST;
-		t->reply_type = ICMPV6_ECHOREPLY;
-		t->ipaddr_type = FR_TYPE_IPV6_ADDR;
+		sock->request_type = ICMPV6_ECHOREQUEST;
+		sock->reply_type = ICMPV6_ECHOREPLY;
+		sock->ipaddr_type = FR_TYPE_IPV6_ADDR;
 		break;
 	}
 
@@ -491,7 +724,7 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 				   fr_table_str_by_value(fr_net_af_table, af, "<INVALID>"),
 				   fr_table_str_by_value(fr_net_ip_proto_table, proto, "<INVALID>"),
 				   fr_syserror(errno));
-		return -1;
+		goto error;
 	}
 
 #ifndef FD_CLOEXEC
@@ -512,23 +745,75 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 	 */
 	if (src && inst->interface && (fr_socket_bind(fd, src, NULL, inst->interface) < 0)) {
 		close(fd);
-		return -1;
+		goto error;
 	}
 
 	/*
 	 *	We assume that the outbound socket is always writable.
 	 *	If not, too bad.  Packets will get lost.
 	 */
-	if (fr_event_fd_insert(t, el, fd,
+	if (fr_event_fd_insert(sock, el, fd,
 			       mod_icmp_read,
 			       NULL,
 			       mod_icmp_error,
-			       t) < 0) {
+			       sock) < 0) {
 		fr_strerror_const_push("Failed adding socket to event loop");
 		close(fd);
-		return -1;
+		goto error;
+	}
+	sock->fd = fd;
+
+	sock->refs = 1;
+	fr_dlist_insert_tail(icmp_sockets, sock);
+
+	return sock;
+}
+
+/** Resolves and caches the module's thread instance for use by a specific xlat instance
+ *
+ * @param[in] xlat_inst			UNUSED.
+ * @param[in] xlat_thread_inst		pre-allocated structure to hold pointer to module's
+ *					thread instance.
+ * @param[in] exp			UNUSED.
+ * @param[in] uctx			Module's global instance.  Used to lookup thread
+ *					specific instance.
+ * @return 0.
+ */
+static int mod_xlat_thread_instantiate(UNUSED void *xlat_inst, void *xlat_thread_inst,
+				       UNUSED xlat_exp_t const *exp, void *uctx)
+{
+	rlm_icmp_t		*inst = talloc_get_type_abort(uctx, rlm_icmp_t);
+	xlat_icmp_thread_inst_t	*xt = xlat_thread_inst;
+
+	xt->inst = inst;
+	xt->t = talloc_get_type_abort(module_thread_by_data(inst)->data, rlm_icmp_thread_t);
+
+	return 0;
+}
+
+static int mod_xlat_instantiate(void *xlat_inst, UNUSED xlat_exp_t const *exp, void *uctx)
+{
+	*((void **)xlat_inst) = talloc_get_type_abort(uctx, rlm_icmp_t);
+	return 0;
+}
+
+/** Instantiate thread data for the submodule.
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_icmp_t *inst = talloc_get_type_abort(instance, rlm_icmp_t);
+	rlm_icmp_thread_t *t = talloc_get_type_abort(thread, rlm_icmp_thread_t);
+
+	t->inst = inst;
+
+	if (inst->cache_ttl) {
+		MEM(t->cache = fr_rb_inline_alloc(t, rlm_icmp_cache_t, node, cache_cmp, NULL));
+		fr_dlist_talloc_init(&t->cache_expiry, rlm_icmp_cache_t, entry);
 	}
-	t->fd = fd;
+
+	t->sock = icmp_socket_get(inst, el);
+	if (!t->sock) return -1;
 
 	return 0;
 }
@@ -550,6 +835,8 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	FR_TIME_DELTA_BOUND_CHECK("timeout", inst->timeout, >=, fr_time_delta_from_msec(100)); /* 1/10s minimum timeout */
 	FR_TIME_DELTA_BOUND_CHECK("timeout", inst->timeout, <=, fr_time_delta_from_sec(10));
 
+	FR_TIME_DELTA_BOUND_CHECK("cache_ttl", inst->cache_ttl, <=, fr_time_delta_from_sec(3600));
+
 #ifdef __linux__
 #  ifndef HAVE_CAPABILITY_H
 	if ((geteuid() != 0)) PWARN("Server not built with cap interface, opening raw sockets will likely fail");
@@ -571,15 +858,12 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 /** Destroy thread data for the submodule.
  *
  */
-static int mod_thread_detach(fr_event_list_t *el, void *thread)
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 {
 	rlm_icmp_thread_t *t = talloc_get_type_abort(thread, rlm_icmp_thread_t);
 
-	if (t->fd < 0) return 0;
-
-	(void) fr_event_fd_delete(el, t->fd, FR_EVENT_FILTER_IO);
-	close(t->fd);
-	t->fd = -1;
+	if (t->sock && (--t->sock->refs == 0)) talloc_free(t->sock);
+	t->sock = NULL;
 
 	return 0;
 }
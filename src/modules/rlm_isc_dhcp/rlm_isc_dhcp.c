@@ -195,6 +195,7 @@ struct rlm_isc_dhcp_info_s {
 	fr_hash_table_t		*hosts_by_ether;  //!< by MAC address
 	fr_hash_table_t		*hosts_by_uid;	//!< by client identifier
 	fr_pair_list_t		options;	//!< DHCP options
+	fr_pair_list_t		flat;		//!< subnet options, plus inherited ones
 	fr_trie_t		*subnets;
 	rlm_isc_dhcp_info_t	*child;
 	rlm_isc_dhcp_info_t	**last;		//!< pointer to last child
@@ -1282,6 +1283,7 @@ static int match_keyword(rlm_isc_dhcp_info_t *parent, rlm_isc_dhcp_tokenizer_t *
 
 	info = talloc_zero(parent, rlm_isc_dhcp_info_t);
 	fr_pair_list_init(&info->options);
+	fr_pair_list_init(&info->flat);
 	if (tokens[half].max_argc) {
 		info->argv = talloc_zero_array(info, fr_value_box_t *, tokens[half].max_argc);
 	}
@@ -1793,11 +1795,84 @@ static int apply_fixed_ip(rlm_isc_dhcp_t const *inst, request_t *request)
 /** Apply all rules *except* fixed IP
  *
  */
+/** Copy options to a list, unless the list already has them
+ *
+ *  Multiple options of the same type are copied as a group.
+ *
+ * @return
+ *	- <0 on error.
+ *	- 0 on success.
+ */
+static int copy_options(TALLOC_CTX *ctx, fr_pair_list_t *out, fr_pair_list_t *in)
+{
+	fr_pair_t *vp = NULL;
+
+	/*
+	 *	Walk over the input list, adding the options only if
+	 *	they don't already exist in the output.
+	 *
+	 *	This is O(O*P), complexity is (output VPs * option
+	 *	VPs).  Since the options for a subnet are flattened
+	 *	when the module is instantiated, we only do this for
+	 *	the matching host and subnet, and not for each
+	 *	enclosing section.
+	 */
+	for (vp = fr_pair_list_head(in);
+	     vp != NULL;
+	     vp = fr_pair_list_next(in, vp)) {
+		fr_pair_t *found;
+
+		found = fr_pair_find_by_da(out, vp->da, 0);
+		if (found) continue;
+
+		/*
+		 *	Copy all of the same options to the output.
+		 */
+		while (vp) {
+			fr_pair_t *next, *copy;
+
+			copy = fr_pair_copy(ctx, vp);
+			if (!copy) return -1;
+
+			fr_pair_append(out, copy);
+
+			next = fr_pair_list_next(in, vp);
+			if (!next) break;
+			if (next->da != vp->da) break;
+
+			vp = next;
+		}
+	}
+
+	return 0;
+}
+
+/** Flatten the options for a subnet
+ *
+ *  The subnet options are more specific than the ones in the
+ *  enclosing section, so they go first.  Any options which are
+ *  only in the enclosing section are then inherited.
+ */
+static int flatten_subnet(UNUSED uint8_t const *key, UNUSED size_t keylen, void *data, UNUSED void *uctx)
+{
+	rlm_isc_dhcp_info_t *info = talloc_get_type_abort(data, rlm_isc_dhcp_info_t);
+
+	if (copy_options(info, &info->flat, &info->options) < 0) return -1;
+
+	if (!info->parent) return 0;
+
+	if (copy_options(info, &info->flat, &info->parent->options) < 0) return -1;
+
+	return 0;
+}
+
 static int apply(rlm_isc_dhcp_t const *inst, request_t *request, rlm_isc_dhcp_info_t *head)
 {
 	int ret, child_ret;
 	rlm_isc_dhcp_info_t *info;
 	fr_pair_t *yiaddr;
+	fr_pair_list_t *options;
+	bool inherited = false;
 
 	ret = 0;
 	yiaddr = fr_pair_find_by_da(&request->reply_pairs, attr_your_ip_address, 0);
@@ -1831,6 +1906,12 @@ subnet:
 		child_ret = apply(inst, request, info);
 		if (child_ret < 0) return child_ret;
 		if (child_ret == 1) ret = 1;
+
+		/*
+		 *	The subnet options were flattened, and already
+		 *	include our options.
+		 */
+		inherited = true;
 	}
 
 recurse:
@@ -1846,59 +1927,15 @@ recurse:
 		ret = 1;
 	}
 
+	if (inherited) return ret;
+
 	/*
 	 *	Now that our children have added options, see if we
 	 *	can add some, too.
 	 */
-	if (!fr_pair_list_empty(&head->options)) {
-		fr_pair_t *vp = NULL;
-
-		/*
-		 *	Walk over the input list, adding the options
-		 *	only if they don't already exist in the reply.
-		 *
-		 *	Yes, we know that this is O(R*P*D), complexity
-		 *	is (reply VPs * option VPs * depth of options).
-		 *
-		 *	Unless we make the code a lot smarter, this is
-		 *	the best we can do.  Since there are likely
-		 *	only a few options (i.e. less than 100), this
-		 *	is deemed to be OK.
-		 *
-		 *	In order to fix this, we would need to sort
-		 *	all of the options first, sort the reply VPs,
-		 *	then walk over the reply VPs, and look at each
-		 *	option list in turn, seeing if there are
-		 *	options that match.  This would likely be
-		 *	faster.
-		 */
-		for (vp = fr_pair_list_head(&head->options);
-		     vp != NULL;
-		     vp = fr_pair_list_next(&head->options, vp)) {
-			fr_pair_t *reply;
-
-			reply = fr_pair_find_by_da(&request->reply_pairs, vp->da, 0);
-			if (reply) continue;
-
-			/*
-			 *	Copy all of the same options to the
-			 *	reply.
-			 */
-			while (vp) {
-				fr_pair_t *next, *copy;
-
-				copy = fr_pair_copy(request->reply_ctx, vp);
-				if (!copy) return -1;
-
-				fr_pair_append(&request->reply_pairs, copy);
-
-				next = fr_pair_list_next(&head->options, vp);
-				if (!next) break;
-				if (next->da != vp->da) break;
-
-				vp = fr_pair_list_next(&head->options, vp);
-			}
-		}
+	options = (head->cmd && (head->cmd->type == ISC_SUBNET)) ? &head->flat : &head->options;
+	if (!fr_pair_list_empty(options)) {
+		if (copy_options(request->reply_ctx, &request->reply_pairs, options) < 0) return -1;
 
 		/*
 		 *	We applied some options.
@@ -2187,6 +2224,7 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 
 	inst->head = info = talloc_zero(inst, rlm_isc_dhcp_info_t);
 	fr_pair_list_init(&info->options);
+	fr_pair_list_init(&info->flat);
 	info->last = &(info->child);
 
 	inst->hosts_by_ether = fr_hash_table_alloc(inst, host_ether_hash, host_ether_cmp, NULL);
@@ -2206,6 +2244,15 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return 0;
 	}
 
+	/*
+	 *	Flatten the subnet options now, so that we don't have
+	 *	to walk the configuration for every packet.
+	 */
+	if (info->subnets && (fr_trie_walk(info->subnets, NULL, flatten_subnet) < 0)) {
+		cf_log_err(conf, "Failed flattening subnet options");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -90,6 +90,16 @@ typedef struct {
 	json_object		*root;
 } rlm_json_jpath_to_eval_t;
 
+/** The last JSON document a map of this instance parsed for a request
+ *
+ * Policies often call several maps against the same document, e.g. a
+ * REST response, so we only parse it again if the text changes.
+ */
+typedef struct {
+	char			*json_str;	//!< Text the document was parsed from.
+	json_object		*root;		//!< Parsed document.
+} rlm_json_doc_t;
+
 static xlat_arg_parser_t const json_quote_xlat_arg = {
 	.concat = true, .type = FR_TYPE_STRING
 };
@@ -438,9 +448,62 @@ static int _json_map_proc_get_value(TALLOC_CTX *ctx, fr_pair_list_t *out, reques
 	return 0;
 }
 
+static int _json_doc_free(rlm_json_doc_t *doc)
+{
+	json_object_put(doc->root);
+
+	return 0;
+}
+
+/** Return the parsed form of a JSON string, parsing it only if it differs from the last one
+ *
+ * @param[in] inst	the document cache is keyed on.
+ * @param[in] request	the document is cached in.
+ * @param[in] json_str	to parse.
+ * @param[in] len	of json_str.
+ * @return
+ *	- The parsed document.  Owned by the request, so must not be freed.
+ *	- NULL on parse error.
+ */
+static json_object *json_doc_parse(void const *inst, request_t *request, char const *json_str, size_t len)
+{
+	rlm_json_doc_t		*doc;
+	struct json_tokener	*tok;
+
+	doc = request_data_reference(request, inst, 0);
+	if (doc && (talloc_array_length(doc->json_str) == (len + 1)) && (memcmp(doc->json_str, json_str, len) == 0)) {
+		RDEBUG3("Using previously parsed JSON document");
+		return doc->root;
+	}
+
+	tok = json_tokener_new();
+	MEM(doc = talloc_zero(request, rlm_json_doc_t));
+	doc->root = json_tokener_parse_ex(tok, json_str, (int)len);
+	if (!doc->root) {
+		REMARKER(json_str, tok->char_offset, "%s", json_tokener_error_desc(json_tokener_get_error(tok)));
+		json_tokener_free(tok);
+		talloc_free(doc);
+		return NULL;
+	}
+	json_tokener_free(tok);
+
+	talloc_set_destructor(doc, _json_doc_free);
+	MEM(doc->json_str = talloc_bstrndup(doc, json_str, len));
+
+	/*
+	 *	Replaces, and frees, any previous document.
+	 */
+	if (request_data_talloc_add(request, inst, 0, rlm_json_doc_t, doc, true, false, false) < 0) {
+		talloc_free(doc);
+		return NULL;
+	}
+
+	return doc->root;
+}
+
 /** Parses a JSON string, and executes jpath queries against it to map values to attributes
  *
- * @param mod_inst	unused.
+ * @param mod_inst	the parsed document is cached against.
  * @param proc_inst	cached jpath sequences.
  * @param request	The current request.
  * @param json		JSON string to parse.
@@ -450,11 +513,10 @@ static int _json_map_proc_get_value(TALLOC_CTX *ctx, fr_pair_list_t *out, reques
  *	- #RLM_MODULE_UPDATED if one or more #fr_pair_t were added to the #request_t.
  *	- #RLM_MODULE_FAIL if a fault occurred.
  */
-static rlm_rcode_t mod_map_proc(UNUSED void *mod_inst, void *proc_inst, request_t *request,
+static rlm_rcode_t mod_map_proc(void *mod_inst, void *proc_inst, request_t *request,
 			      	fr_value_box_list_t *json, fr_map_list_t const *maps)
 {
 	rlm_rcode_t			rcode = RLM_MODULE_UPDATED;
-	struct json_tokener		*tok;
 
 	rlm_json_jpath_cache_t		*cache = proc_inst;
 	map_t const			*map = NULL;
@@ -480,13 +542,8 @@ static rlm_rcode_t mod_map_proc(UNUSED void *mod_inst, void *proc_inst, request_
 		return RLM_MODULE_FAIL;
 	}
 
-	tok = json_tokener_new();
-	to_eval.root = json_tokener_parse_ex(tok, json_str, (int)(talloc_array_length(json_str) - 1));
-	if (!to_eval.root) {
-		REMARKER(json_str, tok->char_offset, "%s", json_tokener_error_desc(json_tokener_get_error(tok)));
-		rcode = RLM_MODULE_FAIL;
-		goto finish;
-	}
+	to_eval.root = json_doc_parse(mod_inst, request, json_str, talloc_array_length(json_str) - 1);
+	if (!to_eval.root) return RLM_MODULE_FAIL;
 
 	while ((map = fr_dlist_next(maps, map))) {
 		switch (map->rhs->type) {
@@ -539,11 +596,7 @@ static rlm_rcode_t mod_map_proc(UNUSED void *mod_inst, void *proc_inst, request_
 		}
 	}
 
-
 finish:
-	json_object_put(to_eval.root);
-	json_tokener_free(tok);
-
 	return rcode;
 }
 
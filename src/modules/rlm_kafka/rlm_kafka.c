@@ -0,0 +1,607 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_kafka.c
+ * @brief Produce messages to Apache Kafka.
+ *
+ * Each worker thread has its own producer.  librdkafka batches and
+ * sends the messages from its own threads, and tells us about
+ * delivery reports by writing to a pipe, which we watch in the
+ * thread's event loop.  Requests only wait for a delivery report
+ * if the module is configured to require acknowledgements.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/debug.h>
+
+#include <librdkafka/rdkafka.h>
+
+/** Counters kept for each thread, and summed by "stats counters"
+ *
+ */
+typedef enum {
+	KAFKA_STATS_PRODUCED = 0,		//!< Messages handed to librdkafka.
+	KAFKA_STATS_DROPPED,			//!< Messages dropped because the queue was full.
+	KAFKA_STATS_DELIVERED,			//!< Messages acknowledged by the brokers.
+	KAFKA_STATS_FAILED,			//!< Messages which librdkafka gave up on.
+	KAFKA_STATS_MAX
+} rlm_kafka_stats_t;
+
+static char const *kafka_stats_names[KAFKA_STATS_MAX] = {
+	[KAFKA_STATS_PRODUCED]	= "produced",
+	[KAFKA_STATS_DROPPED]	= "dropped",
+	[KAFKA_STATS_DELIVERED]	= "delivered",
+	[KAFKA_STATS_FAILED]	= "failed",
+};
+
+/** kafka module instance
+ *
+ */
+typedef struct {
+	char const		*name;			//!< Module instance name.
+
+	char const		*server;		//!< Bootstrap brokers.
+	char const		*topic;			//!< Topic to produce to.
+
+	tmpl_t			*format;		//!< Default message.
+	tmpl_t			*reference;		//!< Path to a #CONF_PAIR to use as the message.
+	tmpl_t			*key;			//!< Message key, used for partitioning.
+
+	bool			require_ack;		//!< Wait for the brokers to acknowledge the message.
+
+	char const		*compression;		//!< Compression codec.
+	fr_time_delta_t		linger;			//!< How long to wait for a batch to fill.
+	uint32_t		batch_size;		//!< Maximum number of messages in a batch.
+	uint32_t		queue_max;		//!< Maximum number of messages queued in each thread.
+	fr_time_delta_t		timeout;		//!< How long librdkafka tries to deliver a message.
+
+	CONF_SECTION		*cs;			//!< Root for #reference lookups.
+
+	rd_kafka_conf_t		*kconf;			//!< Template for the per-thread producers.
+	fr_stats_counters_t	*counters;		//!< Per-thread statistics.
+} rlm_kafka_t;
+
+typedef struct {
+	rlm_kafka_t const	*inst;			//!< Instance data.
+	fr_event_list_t		*el;			//!< Thread's event list.
+
+	rd_kafka_t		*rk;			//!< This thread's producer.
+	rd_kafka_topic_t	*rkt;			//!< Topic handle.
+
+	int			event_fd[2];		//!< librdkafka writes to [1] when there are events
+							///< to serve, and we watch [0].
+
+	fr_stats_slot_t		*stats;			//!< This thread's counters.
+} rlm_kafka_thread_t;
+
+/** Tracks a message a request is waiting on
+ *
+ * It's allocated in the thread context, not the request, as librdkafka
+ * holds a pointer to it until the delivery report has been served.
+ */
+typedef struct {
+	request_t		*request;		//!< NULL if the request was cancelled.
+	rd_kafka_resp_err_t	err;			//!< Result of delivery.
+} rlm_kafka_rctx_t;
+
+static const CONF_PARSER properties_config[] = {
+	CONF_PARSER_TERMINATOR
+};
+
+static const CONF_PARSER module_config[] = {
+	{ FR_CONF_OFFSET("server", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_kafka_t, server) },
+	{ FR_CONF_OFFSET("topic", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_kafka_t, topic) },
+
+	{ FR_CONF_OFFSET("format", FR_TYPE_TMPL, rlm_kafka_t, format) },
+	{ FR_CONF_OFFSET("reference", FR_TYPE_TMPL, rlm_kafka_t, reference) },
+	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL, rlm_kafka_t, key) },
+
+	{ FR_CONF_OFFSET("require_ack", FR_TYPE_BOOL, rlm_kafka_t, require_ack), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("compression", FR_TYPE_STRING, rlm_kafka_t, compression), .dflt = "lz4" },
+	{ FR_CONF_OFFSET("linger", FR_TYPE_TIME_DELTA, rlm_kafka_t, linger), .dflt = "0.005" },
+	{ FR_CONF_OFFSET("batch_size", FR_TYPE_UINT32, rlm_kafka_t, batch_size), .dflt = "10000" },
+	{ FR_CONF_OFFSET("queue_max", FR_TYPE_UINT32, rlm_kafka_t, queue_max), .dflt = "100000" },
+	{ FR_CONF_OFFSET("timeout", FR_TYPE_TIME_DELTA, rlm_kafka_t, timeout), .dflt = "5" },
+
+	{ FR_CONF_POINTER("properties", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) properties_config },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Called by librdkafka when a message has been delivered, or has failed
+ *
+ * Only ever called from rd_kafka_poll(), which we call from the thread
+ * which owns the producer.
+ */
+static void _kafka_delivery(UNUSED rd_kafka_t *rk, rd_kafka_message_t const *msg, void *opaque)
+{
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(opaque, rlm_kafka_thread_t);
+	rlm_kafka_rctx_t	*rctx = msg->_private;
+
+	if (msg->err) {
+		FR_STATS_COUNTER_INC(t->stats, KAFKA_STATS_FAILED);
+		RATE_LIMIT_GLOBAL(ERROR, "%s - Failed delivering message to topic \"%s\": %s",
+				  t->inst->name, t->inst->topic, rd_kafka_err2str(msg->err));
+	} else {
+		FR_STATS_COUNTER_INC(t->stats, KAFKA_STATS_DELIVERED);
+	}
+
+	if (!rctx) return;
+
+	/*
+	 *	The request went away while waiting.
+	 */
+	if (!rctx->request) {
+		talloc_free(rctx);
+		return;
+	}
+
+	rctx->err = msg->err;
+	unlang_interpret_mark_runnable(rctx->request);
+}
+
+/** Log messages from librdkafka
+ *
+ * This may be called from one of librdkafka's internal threads.
+ */
+static void _kafka_log(rd_kafka_t const *rk, int level, char const *fac, char const *buf)
+{
+	if (level <= 3) {
+		ERROR("%s - %s: %s", rd_kafka_name(rk), fac, buf);
+	} else if (level == 4) {
+		WARN("%s - %s: %s", rd_kafka_name(rk), fac, buf);
+	} else {
+		DEBUG2("%s - %s: %s", rd_kafka_name(rk), fac, buf);
+	}
+}
+
+/** Serve delivery reports when librdkafka tells us there are some
+ *
+ */
+static void _kafka_event(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(uctx, rlm_kafka_thread_t);
+	uint8_t			buff[64];
+
+	/*
+	 *	Drain the pipe first, so that we're woken up again
+	 *	for anything which arrives while we're polling.
+	 */
+	while (read(fd, buff, sizeof(buff)) > 0);
+
+	while (rd_kafka_poll(t->rk, 0) > 0);
+}
+
+static void _kafka_event_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+			       int fd_errno, void *uctx)
+{
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(uctx, rlm_kafka_thread_t);
+
+	ERROR("%s - Error on librdkafka event pipe: %s", t->inst->name, fr_syserror(fd_errno));
+}
+
+static unlang_action_t mod_kafka_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					request_t *request, void *rctx)
+{
+	rlm_kafka_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_kafka_t);
+	rlm_kafka_rctx_t	*krctx = talloc_get_type_abort(rctx, rlm_kafka_rctx_t);
+	rd_kafka_resp_err_t	err = krctx->err;
+
+	talloc_free(krctx);
+
+	if (err) {
+		REDEBUG("Failed delivering message to topic \"%s\": %s", inst->topic, rd_kafka_err2str(err));
+		RETURN_MODULE_FAIL;
+	}
+
+	RDEBUG2("Message delivered to topic \"%s\"", inst->topic);
+	RETURN_MODULE_OK;
+}
+
+static void mod_kafka_signal(UNUSED module_ctx_t const *mctx, UNUSED request_t *request,
+			     void *rctx, fr_state_signal_t action)
+{
+	rlm_kafka_rctx_t	*krctx = talloc_get_type_abort(rctx, rlm_kafka_rctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	/*
+	 *	librdkafka still has a pointer to rctx, so
+	 *	the delivery callback frees it.
+	 */
+	krctx->request = NULL;
+}
+
+/** Find the template to use for the message
+ *
+ * Uses the same rules as the linelog module.  If "reference" is set,
+ * it's expanded to the path of a #CONF_PAIR in the module configuration,
+ * the value of which is the message.  Otherwise the "format" is used.
+ *
+ * @param[out] out	the template to expand.  If it's not the one in the
+ *			instance data, it must be freed by the caller.
+ * @param[in] inst	of the kafka module.
+ * @param[in] request	The current request.
+ * @return
+ *	- 1 on success.
+ *	- 0 if there's nothing to send.
+ *	- -1 on failure.
+ */
+static int kafka_message_tmpl(tmpl_t const **out, rlm_kafka_t const *inst, request_t *request)
+{
+	CONF_ITEM	*ci;
+	CONF_PAIR	*cp;
+	char const	*tmpl_str;
+	char		*path;
+	char const	*p;
+	tmpl_t		*vpt;
+	ssize_t		slen;
+
+	if (!inst->reference) goto default_msg;
+
+	if (tmpl_aexpand(request, &path, request, inst->reference, NULL, NULL) < 0) return -1;
+
+	/*
+	 *	Relative to the module section, and don't go back up.
+	 */
+	p = path;
+	if (*p == '.') p++;
+	if (*p == '.') {
+		REDEBUG("Invalid path \"%s\"", path);
+		talloc_free(path);
+		return -1;
+	}
+
+	ci = cf_reference_item(NULL, inst->cs, p);
+	if (!ci) {
+		RDEBUG2("Path \"%s\" doesn't exist", p);
+		talloc_free(path);
+		goto default_msg;
+	}
+
+	if (!cf_item_is_pair(ci)) {
+		REDEBUG("Path \"%s\" resolves to a section (should be a pair)", p);
+		talloc_free(path);
+		return -1;
+	}
+	talloc_free(path);
+
+	cp = cf_item_to_pair(ci);
+	tmpl_str = cf_pair_value(cp);
+	if (!tmpl_str || (tmpl_str[0] == '\0')) {
+		RDEBUG2("Reference resolves to an empty config pair");
+		return 0;
+	}
+
+	slen = tmpl_afrom_substr(request, &vpt,
+				 &FR_SBUFF_IN(tmpl_str, talloc_array_length(tmpl_str) - 1),
+				 cf_pair_value_quote(cp),
+				 NULL,
+				 &(tmpl_rules_t){
+					.dict_def = request->dict,
+					.allow_unknown = true,
+					.allow_unresolved = false,
+					.at_runtime = true
+				 });
+	if (!vpt) {
+		REMARKER(tmpl_str, -slen, "%s", fr_strerror());
+		return -1;
+	}
+
+	*out = vpt;
+	return 1;
+
+default_msg:
+	if (!inst->format) {
+		RDEBUG2("No default message configured");
+		return 0;
+	}
+
+	*out = inst->format;
+	return 1;
+}
+
+/** Produce a message to Kafka
+ *
+ * @param[in] p_result	the result of the module call:
+ *			- #RLM_MODULE_NOOP if there's no message to send.
+ *			- #RLM_MODULE_FAIL if the message couldn't be queued, or
+ *			  if require_ack is set, and it couldn't be delivered.
+ *			- #RLM_MODULE_OK on success.
+ * @param[in] mctx	module calling context.
+ * @param[in] request	The current request.
+ */
+static unlang_action_t CC_HINT(nonnull) mod_kafka(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_kafka_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_kafka_t);
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_kafka_thread_t);
+	tmpl_t const		*vpt = NULL;
+	char			*payload = NULL, *key = NULL;
+	ssize_t			payload_len, key_len = 0;
+	rlm_kafka_rctx_t	*rctx = NULL;
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+
+	switch (kafka_message_tmpl(&vpt, inst, request)) {
+	case 0:
+		RETURN_MODULE_NOOP;
+
+	case 1:
+		break;
+
+	default:
+		RETURN_MODULE_FAIL;
+	}
+
+	payload_len = tmpl_aexpand(request, &payload, request, vpt, NULL, NULL);
+	if (vpt != inst->format) talloc_const_free(vpt);
+	if (payload_len < 0) RETURN_MODULE_FAIL;
+
+	if (inst->key) {
+		key_len = tmpl_aexpand(request, &key, request, inst->key, NULL, NULL);
+		if (key_len < 0) {
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+	}
+
+	if (inst->require_ack) MEM(rctx = talloc_zero(t, rlm_kafka_rctx_t));
+
+	/*
+	 *	librdkafka copies the payload and key, so we can
+	 *	free them as soon as this returns.
+	 */
+	if (rd_kafka_produce(t->rkt, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY,
+			     payload, payload_len, key, key_len, rctx) < 0) {
+		rd_kafka_resp_err_t err = rd_kafka_last_error();
+
+		if (err == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+			FR_STATS_COUNTER_INC(t->stats, KAFKA_STATS_DROPPED);
+			RWARN("Queue is full, dropping message");
+		} else {
+			REDEBUG("Failed queueing message for topic \"%s\": %s", inst->topic, rd_kafka_err2str(err));
+		}
+
+		talloc_free(rctx);
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+	FR_STATS_COUNTER_INC(t->stats, KAFKA_STATS_PRODUCED);
+
+	RDEBUG2("Queued %zd byte message for topic \"%s\"", payload_len, inst->topic);
+
+	if (rctx) {
+		talloc_free(payload);
+		talloc_free(key);
+
+		rctx->request = request;
+		return unlang_module_yield(request, mod_kafka_resume, mod_kafka_signal, rctx);
+	}
+
+finish:
+	talloc_free(payload);
+	talloc_free(key);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+/** Set a librdkafka configuration property
+ *
+ */
+static int kafka_conf_set(rd_kafka_conf_t *kconf, CONF_SECTION *cs, char const *name, char const *value)
+{
+	char errstr[512];
+
+	if (rd_kafka_conf_set(kconf, name, value, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+		cf_log_err(cs, "Invalid Kafka property %s = \"%s\": %s", name, value, errstr);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_kafka_t		*inst = talloc_get_type_abort(instance, rlm_kafka_t);
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(thread, rlm_kafka_thread_t);
+	rd_kafka_conf_t		*kconf;
+	rd_kafka_queue_t	*rkqu;
+	char			errstr[512];
+
+	t->inst = inst;
+	t->el = el;
+	t->event_fd[0] = t->event_fd[1] = -1;
+
+	t->stats = fr_stats_counters_slot(inst->counters);
+	if (!t->stats) return -1;
+
+	kconf = rd_kafka_conf_dup(inst->kconf);
+	rd_kafka_conf_set_opaque(kconf, t);
+	rd_kafka_conf_set_dr_msg_cb(kconf, _kafka_delivery);
+
+	/*
+	 *	On success, the producer owns kconf.
+	 */
+	t->rk = rd_kafka_new(RD_KAFKA_PRODUCER, kconf, errstr, sizeof(errstr));
+	if (!t->rk) {
+		ERROR("%s - Failed creating Kafka producer: %s", inst->name, errstr);
+		rd_kafka_conf_destroy(kconf);
+		return -1;
+	}
+
+	t->rkt = rd_kafka_topic_new(t->rk, inst->topic, NULL);
+	if (!t->rkt) {
+		ERROR("%s - Failed creating handle for topic \"%s\": %s", inst->name, inst->topic,
+		      rd_kafka_err2str(rd_kafka_last_error()));
+	error:
+		if (t->rkt) rd_kafka_topic_destroy(t->rkt);
+		rd_kafka_destroy(t->rk);
+		t->rkt = NULL;
+		t->rk = NULL;
+		if (t->event_fd[0] >= 0) close(t->event_fd[0]);
+		if (t->event_fd[1] >= 0) close(t->event_fd[1]);
+		return -1;
+	}
+
+	/*
+	 *	Have librdkafka wake us up when there are delivery
+	 *	reports to serve, instead of polling on a timer.
+	 */
+	if (pipe(t->event_fd) < 0) {
+		ERROR("%s - Failed creating event pipe: %s", inst->name, fr_syserror(errno));
+		t->event_fd[0] = t->event_fd[1] = -1;
+		goto error;
+	}
+
+	if ((fr_nonblock(t->event_fd[0]) < 0) || (fr_nonblock(t->event_fd[1]) < 0)) {
+		PERROR("%s - Failed setting event pipe non-blocking", inst->name);
+		goto error;
+	}
+
+	if (fr_event_fd_insert(t, el, t->event_fd[0], _kafka_event, NULL, _kafka_event_error, t) < 0) {
+		PERROR("%s - Failed inserting event pipe", inst->name);
+		goto error;
+	}
+
+	rkqu = rd_kafka_queue_get_main(t->rk);
+	rd_kafka_queue_io_event_enable(rkqu, t->event_fd[1], "1", 1);
+	rd_kafka_queue_destroy(rkqu);
+
+	return 0;
+}
+
+static int mod_thread_detach(fr_event_list_t *el, void *thread)
+{
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(thread, rlm_kafka_thread_t);
+
+	if (!t->rk) return 0;
+
+	/*
+	 *	Give the queued messages a chance to go out.  Any
+	 *	delivery reports are served by rd_kafka_flush().
+	 */
+	if (rd_kafka_flush(t->rk, fr_time_delta_to_msec(t->inst->timeout)) != RD_KAFKA_RESP_ERR_NO_ERROR) {
+		WARN("%s - %d message(s) were not delivered before shutdown", t->inst->name, rd_kafka_outq_len(t->rk));
+	}
+
+	(void) fr_event_fd_delete(el, t->event_fd[0], FR_EVENT_FILTER_IO);
+
+	rd_kafka_topic_destroy(t->rkt);
+	rd_kafka_destroy(t->rk);
+
+	close(t->event_fd[0]);
+	close(t->event_fd[1]);
+
+	return 0;
+}
+
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_kafka_t	*inst = instance;
+	CONF_SECTION	*props;
+	CONF_PAIR	*cp = NULL;
+	char		buff[32];
+
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+	inst->cs = conf;
+
+	if (!inst->format && !inst->reference) {
+		cf_log_err(conf, "Must specify a 'format' or a 'reference'");
+		return -1;
+	}
+
+	FR_INTEGER_BOUND_CHECK("batch_size", inst->batch_size, >=, 1);
+	FR_INTEGER_BOUND_CHECK("queue_max", inst->queue_max, >=, inst->batch_size);
+	FR_TIME_DELTA_BOUND_CHECK("timeout", inst->timeout, >=, fr_time_delta_from_msec(100));
+
+	inst->kconf = rd_kafka_conf_new();
+	rd_kafka_conf_set_log_cb(inst->kconf, _kafka_log);
+
+	if (kafka_conf_set(inst->kconf, conf, "client.id", inst->name) < 0) return -1;
+	if (kafka_conf_set(inst->kconf, conf, "bootstrap.servers", inst->server) < 0) return -1;
+	if (kafka_conf_set(inst->kconf, conf, "compression.codec", inst->compression) < 0) return -1;
+
+	snprintf(buff, sizeof(buff), "%" PRIu64, (uint64_t) fr_time_delta_to_msec(inst->linger));
+	if (kafka_conf_set(inst->kconf, conf, "linger.ms", buff) < 0) return -1;
+
+	snprintf(buff, sizeof(buff), "%u", inst->batch_size);
+	if (kafka_conf_set(inst->kconf, conf, "batch.num.messages", buff) < 0) return -1;
+
+	snprintf(buff, sizeof(buff), "%u", inst->queue_max);
+	if (kafka_conf_set(inst->kconf, conf, "queue.buffering.max.messages", buff) < 0) return -1;
+
+	snprintf(buff, sizeof(buff), "%" PRIu64, (uint64_t) fr_time_delta_to_msec(inst->timeout));
+	if (kafka_conf_set(inst->kconf, conf, "message.timeout.ms", buff) < 0) return -1;
+
+	/*
+	 *	Anything else is passed through to librdkafka as-is,
+	 *	and overrides the settings above.
+	 */
+	props = cf_section_find(conf, "properties", NULL);
+	if (props) while ((cp = cf_pair_find_next(props, cp, NULL))) {
+		if (kafka_conf_set(inst->kconf, props, cf_pair_attr(cp), cf_pair_value(cp)) < 0) return -1;
+	}
+
+	inst->counters = fr_stats_counters_alloc(inst, "module", inst->name, kafka_stats_names, KAFKA_STATS_MAX);
+	if (!inst->counters) return -1;
+
+	INFO("%s - Using librdkafka %s", inst->name, rd_kafka_version_str());
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_kafka_t	*inst = talloc_get_type_abort(instance, rlm_kafka_t);
+
+	if (inst->kconf) rd_kafka_conf_destroy(inst->kconf);
+
+	return 0;
+}
+
+/*
+ *	Externally visible module definition.
+ */
+extern module_t rlm_kafka;
+module_t rlm_kafka = {
+	.magic			= RLM_MODULE_INIT,
+	.name			= "kafka",
+	.type			= RLM_TYPE_THREAD_SAFE,
+	.inst_size		= sizeof(rlm_kafka_t),
+	.config			= module_config,
+	.instantiate		= mod_instantiate,
+	.detach			= mod_detach,
+
+	.thread_inst_size	= sizeof(rlm_kafka_thread_t),
+	.thread_inst_type	= "rlm_kafka_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+
+	.methods = {
+		[MOD_AUTHENTICATE]	= mod_kafka,
+		[MOD_AUTHORIZE]		= mod_kafka,
+		[MOD_PREACCT]		= mod_kafka,
+		[MOD_ACCOUNTING]	= mod_kafka,
+		[MOD_POST_AUTH]		= mod_kafka,
+	},
+};
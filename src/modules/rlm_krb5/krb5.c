@@ -99,6 +99,58 @@ static int _mod_conn_free(rlm_krb5_handle_t *conn) {
 	return 0;
 }
 
+/** Copy the keytab into a MEMORY keytab
+ *
+ * Verifying credentials looks up the service key in the keytab, which for
+ * a file keytab means opening and reading the file for every authentication.
+ * Copying the entries once, when the context is created, avoids that.
+ *
+ * On success conn->keytab is replaced with the MEMORY keytab.
+ */
+static krb5_error_code krb5_keytab_preload(rlm_krb5_handle_t *conn)
+{
+	krb5_error_code		ret;
+	krb5_keytab		keytab;
+	krb5_kt_cursor		cursor;
+	krb5_keytab_entry	entry;
+	char			name[64];
+
+	/*
+	 *	MEMORY keytabs with the same name are shared,
+	 *	so make sure each context gets its own.
+	 */
+	snprintf(name, sizeof(name), "MEMORY:rlm_krb5_%p", conn);
+	ret = krb5_kt_resolve(conn->context, name, &keytab);
+	if (ret) return ret;
+
+	ret = krb5_kt_start_seq_get(conn->context, conn->keytab, &cursor);
+	if (ret) {
+		krb5_kt_close(conn->context, keytab);
+		return ret;
+	}
+
+	while ((ret = krb5_kt_next_entry(conn->context, conn->keytab, &entry, &cursor)) == 0) {
+		ret = krb5_kt_add_entry(conn->context, keytab, &entry);
+#ifdef HEIMDAL_KRB5
+		krb5_kt_free_entry(conn->context, &entry);
+#else
+		krb5_free_keytab_entry_contents(conn->context, &entry);
+#endif
+		if (ret) break;
+	}
+	krb5_kt_end_seq_get(conn->context, conn->keytab, &cursor);
+
+	if (ret != KRB5_KT_END) {
+		krb5_kt_close(conn->context, keytab);
+		return ret;
+	}
+
+	krb5_kt_close(conn->context, conn->keytab);
+	conn->keytab = keytab;
+
+	return 0;
+}
+
 /** Create and return a new connection
  *
  * libkrb5(s) can talk to the KDC over TCP. Were assuming something sane is implemented
@@ -129,6 +181,15 @@ void *krb5_mod_conn_create(TALLOC_CTX *ctx, void *instance, UNUSED fr_time_delta
 		goto cleanup;
 	}
 
+	if (inst->preload_keytab) {
+		ret = krb5_keytab_preload(conn);
+		if (ret) {
+			ERROR("Preloading keytab failed: %s", rlm_krb5_error(inst, conn->context, ret));
+
+			goto cleanup;
+		}
+	}
+
 #ifdef HEIMDAL_KRB5
 	ret = krb5_cc_new_unique(conn->context, "MEMORY", NULL, &conn->ccache);
 	if (ret) {
@@ -29,7 +29,10 @@ RCSIDH(krb5_h, "$Id$")
 USES_APPLE_DEPRECATED_API
 #include <krb5.h>
 
+#include <freeradius-devel/server/auth_cache.h>
+
 #ifdef KRB5_IS_THREAD_SAFE
+#  include <freeradius-devel/server/offload.h>
 #  include <freeradius-devel/server/pool.h>
 #endif
 
@@ -50,6 +53,7 @@ typedef struct {
 typedef struct {
 #ifdef KRB5_IS_THREAD_SAFE
 	fr_pool_t	*pool;		//!< Connection pool instance.
+	fr_offload_t	*offload;	//!< Helper threads which talk to the KDC.
 #else
 	rlm_krb5_handle_t	*conn;
 #endif
@@ -58,6 +62,10 @@ typedef struct {
 	char const		*keytabname;	//!< The keytab to resolve the service in.
 	char const		*service_princ;	//!< The service name provided by the
 						//!< config parser.
+	uint32_t		threads;	//!< Number of offload helper threads.
+	bool			preload_keytab;	//!< Copy the keytab into memory for each context.
+	fr_auth_cache_config_t	cache;		//!< Of successful authentications.
+	uint8_t			cache_key[16];	//!< For hashing the passwords of cached authentications.
 
 	char			*hostname;	//!< The hostname component of
 						//!< service_princ, or NULL.
@@ -31,12 +31,24 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
+#include <freeradius-devel/unlang/module.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/sha1.h>
 #include "krb5.h"
 
+typedef struct {
+	rlm_krb5_t const	*inst;
+	fr_auth_cache_t		*cache;		//!< Recent successful authentications, by keyed
+						///< hash of the User-Name and password.
+} rlm_krb5_thread_t;
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("keytab", FR_TYPE_STRING, rlm_krb5_t, keytabname) },
 	{ FR_CONF_OFFSET("service_principal", FR_TYPE_STRING, rlm_krb5_t, service_princ) },
+	{ FR_CONF_OFFSET("threads", FR_TYPE_UINT32, rlm_krb5_t, threads), .dflt = "0" },
+	{ FR_CONF_OFFSET("preload_keytab", FR_TYPE_BOOL, rlm_krb5_t, preload_keytab), .dflt = "no" },
+	FR_AUTH_CACHE_CONF(rlm_krb5_t, cache),
 	CONF_PARSER_TERMINATOR
 };
 
@@ -74,6 +86,11 @@ static int mod_detach(void *instance)
 
 	if (inst->context) krb5_free_context(inst->context);
 #ifdef KRB5_IS_THREAD_SAFE
+	/*
+	 *	Stop the helpers before freeing the handles
+	 *	they may be using.
+	 */
+	TALLOC_FREE(inst->offload);
 	fr_pool_free(inst->pool);
 #endif
 
@@ -127,6 +144,14 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->name = cf_section_name2(conf);
 	if (!inst->name) inst->name = cf_section_name1(conf);
 
+	FR_TIME_DELTA_BOUND_CHECK("cache_lifetime", inst->cache.lifetime, <=, fr_time_delta_from_sec(300));
+	if (fr_auth_cache_config_check(conf, &inst->cache) < 0) return -1;
+	if (inst->cache.lifetime) {
+		size_t i;
+
+		for (i = 0; i < sizeof(inst->cache_key); i++) inst->cache_key[i] = fr_rand();
+	}
+
 	ret = krb5_init_context(&inst->context);
 	if (ret) {
 		ERROR("Context initialisation failed: %s", rlm_krb5_error(inst, NULL, ret));
@@ -228,13 +253,81 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	 */
 	inst->pool = module_connection_pool_init(conf, inst, krb5_mod_conn_create, NULL, NULL, NULL, NULL);
 	if (!inst->pool) return -1;
+
+	if (inst->threads) {
+		inst->offload = fr_offload_alloc(inst, "krb5", inst->threads);
+		if (!inst->offload) {
+			cf_log_perr(conf, "Unable to initialise krb5 helper threads");
+			return -1;
+		}
+	}
 #else
+	if (inst->threads) WARN("libkrb5 is not threadsafe, ignoring 'threads'");
+
 	inst->conn = krb5_mod_conn_create(inst, inst, 0);
 	if (!inst->conn) return -1;
 #endif
 	return 0;
 }
 
+/** Derive the cache key for a User-Name and password
+ *
+ * Only a keyed hash of the password is kept, never the password itself.
+ */
+static bool krb5_cache_key(uint8_t key[static FR_AUTH_CACHE_KEY_LEN], rlm_krb5_t const *inst,
+			   request_t *request, fr_pair_t const *password)
+{
+	fr_pair_t	*username;
+	uint8_t		digest[SHA1_DIGEST_LENGTH];
+
+	username = fr_pair_find_by_da(&request->request_pairs, attr_user_name, 0);
+	if (!username) return false;
+
+	fr_hmac_sha1(digest, (uint8_t const *)password->vp_strvalue, password->vp_length,
+		     inst->cache_key, sizeof(inst->cache_key));
+	fr_hmac_sha1(key, (uint8_t const *)username->vp_strvalue, username->vp_length,
+		     digest, sizeof(digest));
+
+	return true;
+}
+
+/** Check whether the user recently authenticated with the same password
+ *
+ */
+static bool krb5_cache_check(rlm_krb5_thread_t *t, request_t *request, fr_pair_t const *password)
+{
+	uint8_t	key[FR_AUTH_CACHE_KEY_LEN];
+
+	if (!krb5_cache_key(key, t->inst, request, password)) return false;
+
+	return fr_auth_cache_find(NULL, NULL, t->cache, key);
+}
+
+/** Remember that the user authenticated successfully with this password
+ *
+ */
+static void krb5_cache_insert(rlm_krb5_thread_t *t, request_t *request, fr_pair_t const *password)
+{
+	uint8_t	key[FR_AUTH_CACHE_KEY_LEN];
+
+	if (!krb5_cache_key(key, t->inst, request, password)) return;
+
+	fr_auth_cache_insert(t->cache, key, NULL, 0);
+}
+
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
+				  UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_krb5_t		*inst = talloc_get_type_abort(instance, rlm_krb5_t);
+	rlm_krb5_thread_t	*t = talloc_get_type_abort(thread, rlm_krb5_thread_t);
+
+	t->inst = inst;
+
+	t->cache = fr_auth_cache_alloc(t, &inst->cache);
+
+	return 0;
+}
+
 /** Common function for transforming a User-Name string into a principal.
  *
  * @param[out] client Where to write the client principal.
@@ -315,61 +408,20 @@ static rlm_rcode_t krb5_process_error(rlm_krb5_t const *inst, request_t *request
 }
 
 #ifdef HEIMDAL_KRB5
-
-/*
- *	Validate user/pass (Heimdal)
+/** Validate user/pass (Heimdal)
+ *
+ * May be called from an offload helper thread, so must not use the request.
  */
-static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+static krb5_error_code krb5_auth(UNUSED rlm_krb5_t const *inst, rlm_krb5_handle_t *conn,
+				 krb5_principal client, char const *password)
 {
-	rlm_krb5_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_krb5_t);
-	rlm_rcode_t		rcode;
 	krb5_error_code		ret;
-	rlm_krb5_handle_t	*conn;
-	krb5_principal		client = NULL;
-	fr_pair_t		*password;
-
-	password = fr_pair_find_by_da(&request->request_pairs, attr_user_password, 0);
-
-	if (!password) {
-		REDEBUG("Attribute \"User-Password\" is required for authentication");
-		RETURN_MODULE_INVALID;
-	}
-
-	/*
-	 *	Make sure the supplied password isn't empty
-	 */
-	if (password->vp_length == 0) {
-		REDEBUG("User-Password must not be empty");
-		RETURN_MODULE_INVALID;
-	}
-
-	/*
-	 *	Log the password
-	 */
-	if (RDEBUG_ENABLED3) {
-		RDEBUG("Login attempt with password \"%pV\"", &password->data);
-	} else {
-		RDEBUG2("Login attempt with password");
-	}
-
-#  ifdef KRB5_IS_THREAD_SAFE
-	conn = fr_pool_connection_get(inst->pool, request);
-	if (!conn) RETURN_MODULE_FAIL;
-#  else
-	conn = inst->conn;
-#  endif
-
-	rcode = krb5_parse_user(&client, inst, request, conn->context);
-	if (rcode != RLM_MODULE_OK) goto cleanup;
 
 	/*
 	 *	Verify the user, using the options we set in instantiate
 	 */
-	ret = krb5_verify_user_opt(conn->context, client, password->vp_strvalue, &conn->options);
-	if (ret) {
-		rcode = krb5_process_error(inst, request, conn, ret);
-		goto cleanup;
-	}
+	ret = krb5_verify_user_opt(conn->context, client, password, &conn->options);
+	if (ret) return ret;
 
 	/*
 	 *	krb5_verify_user_opt adds the credentials to the ccache
@@ -394,32 +446,105 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		krb5_cc_end_seq_get(conn->context, conn->ccache, &cursor);
 	}
 
-cleanup:
-	if (client) {
-		krb5_free_principal(conn->context, client);
-	}
-
-#  ifdef KRB5_IS_THREAD_SAFE
-	fr_pool_connection_release(inst->pool, request, conn);
-#  endif
-	RETURN_MODULE_RCODE(rcode);
+	return 0;
 }
 
 #else  /* HEIMDAL_KRB5 */
 
-/*
- *  Validate userid/passwd (MIT)
+/** Validate userid/passwd (MIT)
+ *
+ * May be called from an offload helper thread, so must not use the request.
  */
+static krb5_error_code krb5_auth(rlm_krb5_t const *inst, rlm_krb5_handle_t *conn,
+				 krb5_principal client, char const *password)
+{
+	krb5_error_code		ret;
+	krb5_creds		init_creds;
+
+	/*
+	 *	Zero out local storage
+	 */
+	memset(&init_creds, 0, sizeof(init_creds));
+
+	/*
+	 * 	Retrieve the TGT from the TGS/KDC and check we can decrypt it,
+	 *	then authenticate against the service principal.
+	 */
+	ret = krb5_get_init_creds_password(conn->context, &init_creds, client, UNCONST(char *, password),
+					   NULL, NULL, 0, NULL, inst->gic_options);
+	if (!ret) ret = krb5_verify_init_creds(conn->context, &init_creds, inst->server, conn->keytab,
+					       NULL, inst->vic_options);
+
+	krb5_free_cred_contents(conn->context, &init_creds);
+
+	return ret;
+}
+#endif /* MIT_KRB5 */
+
+#ifdef KRB5_IS_THREAD_SAFE
+/** Authentication running on an offload helper thread
+ *
+ */
+typedef struct {
+	rlm_krb5_t const	*inst;
+	rlm_krb5_handle_t	*conn;		//!< Held until the authentication is freed.
+	krb5_principal		client;
+	char			*password;
+	krb5_error_code		ret;		//!< Result of krb5_auth.
+} rlm_krb5_offload_t;
+
+/** Free the client principal, and release the handle
+ *
+ * May be called from a helper thread if the request was cancelled.
+ */
+static int _krb5_offload_free(rlm_krb5_offload_t *auth)
+{
+	memset(auth->password, 0, talloc_array_length(auth->password) - 1);
+
+	krb5_free_principal(auth->conn->context, auth->client);
+	fr_pool_connection_release(auth->inst->pool, NULL, auth->conn);
+
+	return 0;
+}
+
+static void krb5_offload_auth(void *uctx)
+{
+	rlm_krb5_offload_t	*auth = talloc_get_type_abort(uctx, rlm_krb5_offload_t);
+
+	auth->ret = krb5_auth(auth->inst, auth->conn, auth->client, auth->password);
+}
+
+/** Offloaded authentication has completed
+ *
+ */
+static unlang_action_t mod_authenticate_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					       request_t *request, void *rctx)
+{
+	rlm_krb5_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_krb5_t);
+	rlm_krb5_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_krb5_thread_t);
+	rlm_krb5_offload_t	*auth = talloc_get_type_abort(rctx, rlm_krb5_offload_t);
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	fr_pair_t		*password;
+
+	if (auth->ret) {
+		rcode = krb5_process_error(inst, request, auth->conn, auth->ret);
+	} else if (t->cache && (password = fr_pair_find_by_da(&request->request_pairs, attr_user_password, 0))) {
+		krb5_cache_insert(t, request, password);
+	}
+	talloc_free(auth);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+#endif
+
 static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_krb5_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_krb5_t);
+	rlm_krb5_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_krb5_thread_t);
 	rlm_rcode_t		rcode;
 	krb5_error_code		ret;
-
 	rlm_krb5_handle_t	*conn;
-
-	krb5_principal		client = NULL;	/* actually a pointer value */
-	krb5_creds		init_creds;
+	krb5_principal		client = NULL;
 	fr_pair_t		*password;
 
 	password = fr_pair_find_by_da(&request->request_pairs, attr_user_password, 0);
@@ -446,17 +571,21 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		RDEBUG2("Login attempt with password");
 	}
 
-#  ifdef KRB5_IS_THREAD_SAFE
+	/*
+	 *	The user authenticated with the same password
+	 *	recently, so there's no need to ask the KDC again.
+	 */
+	if (t->cache && krb5_cache_check(t, request, password)) {
+		RDEBUG2("Using cached authentication result");
+		RETURN_MODULE_OK;
+	}
+
+#ifdef KRB5_IS_THREAD_SAFE
 	conn = fr_pool_connection_get(inst->pool, request);
 	if (!conn) RETURN_MODULE_FAIL;
-#  else
+#else
 	conn = inst->conn;
-#  endif
-
-	/*
-	 *	Zero out local storage
-	 */
-	memset(&init_creds, 0, sizeof(init_creds));
+#endif
 
 	/*
 	 *	Check we have all the required VPs, and convert the username
@@ -465,33 +594,45 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 	rcode = krb5_parse_user(&client, inst, request, conn->context);
 	if (rcode != RLM_MODULE_OK) goto cleanup;
 
+#ifdef KRB5_IS_THREAD_SAFE
 	/*
-	 * 	Retrieve the TGT from the TGS/KDC and check we can decrypt it.
+	 *	Talking to the KDC may take a while.  Do it on a
+	 *	helper thread, so that the worker can get on with
+	 *	other requests.  The handle and principal are now
+	 *	owned by the offloaded authentication.
 	 */
-	RDEBUG2("Retrieving and decrypting TGT");
-	ret = krb5_get_init_creds_password(conn->context, &init_creds, client, UNCONST(char *, password->vp_strvalue),
-					   NULL, NULL, 0, NULL, inst->gic_options);
+	if (inst->offload) {
+		rlm_krb5_offload_t	*auth;
+
+		MEM(auth = talloc_zero(NULL, rlm_krb5_offload_t));
+		auth->inst = inst;
+		auth->conn = conn;
+		auth->client = client;
+		MEM(auth->password = talloc_bstrndup(auth, password->vp_strvalue, password->vp_length));
+		talloc_set_destructor(auth, _krb5_offload_free);
+
+		RDEBUG2("Authenticating against the KDC on a helper thread");
+		return unlang_module_offload(p_result, request, inst->offload, krb5_offload_auth,
+					     mod_authenticate_resume, auth);
+	}
+#endif
+
+	ret = krb5_auth(inst, conn, client, password->vp_strvalue);
 	if (ret) {
 		rcode = krb5_process_error(inst, request, conn, ret);
-		goto cleanup;
+	} else if (t->cache) {
+		krb5_cache_insert(t, request, password);
 	}
 
-	RDEBUG2("Attempting to authenticate against service principal");
-	ret = krb5_verify_init_creds(conn->context, &init_creds, inst->server, conn->keytab, NULL, inst->vic_options);
-	if (ret) rcode = krb5_process_error(inst, request, conn, ret);
-
 cleanup:
 	if (client) krb5_free_principal(conn->context, client);
-	krb5_free_cred_contents(conn->context, &init_creds);
 
-#  ifdef KRB5_IS_THREAD_SAFE
+#ifdef KRB5_IS_THREAD_SAFE
 	fr_pool_connection_release(inst->pool, request, conn);
-#  endif
+#endif
 	RETURN_MODULE_RCODE(rcode);
 }
 
-#endif /* MIT_KRB5 */
-
 extern module_t rlm_krb5;
 module_t rlm_krb5 = {
 	.magic		= RLM_MODULE_INIT,
@@ -503,6 +644,10 @@ module_t rlm_krb5 = {
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
+
+	.thread_inst_size	= sizeof(rlm_krb5_thread_t),
+	.thread_inst_type	= "rlm_krb5_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate
 	},
@@ -97,6 +97,101 @@ static int _get_client_value(char **out, CONF_PAIR const *cp, void *data)
 	return 0;
 }
 
+/*
+ *	Client objects are retrieved a page at a time, so large
+ *	directories don't need the whole result set held in memory.
+ */
+#define LDAP_CLIENT_PAGE_SIZE	(500)
+
+typedef struct {
+	rlm_ldap_t const	*inst;
+	CONF_SECTION		*tmpl;			//!< to use as the base for new clients.
+	CONF_SECTION		*map;			//!< client attribute/LDAP attribute mappings.
+	unsigned int		count;			//!< Number of clients added.
+} ldap_client_load_ctx_t;
+
+/** Create a client from an LDAP entry, and add it to the global client list
+ *
+ * @param[in] conn	the entry was received on.
+ * @param[in] entry	to create the client from.
+ * @param[in] uctx	a #ldap_client_load_ctx_t.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int _ldap_client_load_entry(fr_ldap_connection_t *conn, LDAPMessage *entry, void *uctx)
+{
+	ldap_client_load_ctx_t	*ctx = uctx;
+	rlm_ldap_t const	*inst = ctx->inst;
+	ldap_client_data_t	data;
+
+	CONF_SECTION		*client;
+	CONF_PAIR		*cp;
+	char			*dn, *id;
+	struct berval		**values;
+
+	RADCLIENT		*c;
+
+	id = dn = ldap_get_dn(conn->handle, entry);
+	if (!dn) {
+		int ldap_errno;
+
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		ERROR("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
+
+		return -1;
+	}
+	fr_ldap_util_normalise_dn(dn, dn);
+
+	cp = cf_pair_find(ctx->map, "identifier");
+	if (cp) {
+		values = ldap_get_values_len(conn->handle, entry, cf_pair_value(cp));
+		if (values) id = fr_ldap_berval_to_string(NULL, values[0]);
+		ldap_value_free_len(values);
+	}
+
+	/*
+	 *	Iterate over mapping sections
+	 */
+	client = ctx->tmpl ? cf_section_dup(NULL, NULL, ctx->tmpl, "client", id, true) :
+			     cf_section_alloc(NULL, NULL, "client", id);
+
+	data.conn = conn;
+	data.entry = entry;
+
+	if (client_map_section(client, ctx->map, _get_client_value, &data) < 0) {
+	error:
+		talloc_free(client);
+		ldap_memfree(dn);
+		return -1;
+	}
+
+	/*
+	 *@todo these should be parented from something
+	 */
+	c = client_afrom_cs(NULL, client, NULL);
+	if (!c) goto error;
+
+	/*
+	 *	Client parents the CONF_SECTION which defined it
+	 */
+	talloc_steal(c, client);
+
+	if (!client_add(NULL, c)) {
+		ERROR("Failed to add client \"%s\", possible duplicate?", dn);
+		client_free(c);
+		ldap_memfree(dn);
+		return -1;
+	}
+
+	DEBUG("Client \"%s\" added", dn);
+	ctx->count++;
+
+	ldap_memfree(dn);
+
+	return 0;
+}
+
 /** Load clients from LDAP on server start
  *
  * @param[in] inst rlm_ldap configuration.
@@ -108,20 +203,19 @@ static int _get_client_value(char **out, CONF_PAIR const *cp, void *data)
  */
 int rlm_ldap_client_load(rlm_ldap_t const *inst, CONF_SECTION *tmpl, CONF_SECTION *map)
 {
-	int 		ret = 0;
-	fr_ldap_rcode_t	status;
+	int 			ret = 0;
+	fr_ldap_rcode_t		status;
 	fr_ldap_connection_t	*conn = NULL;
 
-	char const	**attrs = NULL;
-
-	CONF_PAIR	*cp;
-	int		count = 0, idx = 0;
+	char const		**attrs = NULL;
 
-	LDAPMessage	*result = NULL;
-	LDAPMessage	*entry;
-	char		*dn = NULL;
+	int			count = 0, idx = 0;
 
-	RADCLIENT	*c;
+	ldap_client_load_ctx_t	ctx = {
+					.inst = inst,
+					.tmpl = tmpl,
+					.map = map
+				};
 
 	DEBUG("Loading dynamic clients");
 
@@ -146,128 +240,29 @@ int rlm_ldap_client_load(rlm_ldap_t const *inst, CONF_SECTION *tmpl, CONF_SECTIO
 	}
 
 	/*
-	 *	Perform all searches as the admin user.
+	 *	Each page of entries is turned into clients
+	 *	before the next page is requested.
 	 */
-	if (conn->rebound) {
-		status = fr_ldap_bind(NULL, &conn,
-				      conn->config->admin_identity, conn->config->admin_password,
-				      &(conn->config->admin_sasl),
-				      NULL,
-				      NULL, NULL);
-		if (status != LDAP_PROC_SUCCESS) {
-			ret = -1;
-			goto finish;
-		}
-
-		fr_assert(conn);
-
-		conn->rebound = false;
-	}
-
-	status = fr_ldap_search(&result, NULL, &conn, inst->clientobj_base_dn, inst->clientobj_scope,
-				inst->clientobj_filter, attrs, NULL, NULL);
+	status = fr_ldap_search_paged(NULL, &conn, inst->clientobj_base_dn, inst->clientobj_scope,
+				      inst->clientobj_filter, attrs, LDAP_CLIENT_PAGE_SIZE,
+				      _ldap_client_load_entry, &ctx);
 	switch (status) {
 	case LDAP_PROC_SUCCESS:
+		DEBUG("Loaded %u clients", ctx.count);
 		break;
 
 	case LDAP_PROC_NO_RESULT:
 		INFO("No clients were found in the directory");
-		ret = 0;
-		goto finish;
+		break;
 
 	default:
 		ret = -1;
-		goto finish;
-	}
-
-	fr_assert(conn);
-	entry = ldap_first_entry(conn->handle, result);
-	if (!entry) {
-		int ldap_errno;
-
-		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		ERROR("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
-
-		ret = -1;
-		goto finish;
+		break;
 	}
 
-	do {
-		ldap_client_data_t	data;
-
-		CONF_SECTION		*client;
-		char			*id;
-
-		struct berval		**values;
-
-		id = dn = ldap_get_dn(conn->handle, entry);
-		if (!dn) {
-			int ldap_errno;
-
-			ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-			ERROR("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
-
-			goto finish;
-		}
-		fr_ldap_util_normalise_dn(dn, dn);
-
-		cp = cf_pair_find(map, "identifier");
-		if (cp) {
-			values = ldap_get_values_len(conn->handle, entry, cf_pair_value(cp));
-			if (values) id = fr_ldap_berval_to_string(NULL, values[0]);
-			ldap_value_free_len(values);
-		}
-
-		/*
-		 *	Iterate over mapping sections
-		 */
-		client = tmpl ? cf_section_dup(NULL, NULL, tmpl, "client", id, true) :
-				cf_section_alloc(NULL, NULL, "client", id);
-
-		data.conn = conn;
-		data.entry = entry;
-
-		if (client_map_section(client, map, _get_client_value, &data) < 0) {
-			talloc_free(client);
-			ret = -1;
-			goto finish;
-		}
-
-		/*
-		 *@todo these should be parented from something
-		 */
-		c = client_afrom_cs(NULL, client, NULL);
-		if (!c) {
-			talloc_free(client);
-			ret = -1;
-			goto finish;
-		}
-
-		/*
-		 *	Client parents the CONF_SECTION which defined it
-		 */
-		talloc_steal(c, client);
-
-		if (!client_add(NULL, c)) {
-			ERROR("Failed to add client \"%s\", possible duplicate?", dn);
-			ret = -1;
-			client_free(c);
-			goto finish;
-		}
-
-		DEBUG("Client \"%s\" added", dn);
-
-		ldap_memfree(dn);
-		dn = NULL;
-	} while ((entry = ldap_next_entry(conn->handle, entry)));
-
-finish:
 	talloc_free(attrs);
-	if (dn) ldap_memfree(dn);
-	if (result) ldap_msgfree(result);
 
-	mod_conn_release(inst, NULL, conn);
+	ldap_mod_conn_release(inst, NULL, conn);
 
 	return ret;
 }
-
@@ -32,8 +32,119 @@ USES_APPLE_DEPRECATED_API
 
 #include <freeradius-devel/util/debug.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 #include "rlm_ldap.h"
 
+/** A single LDAP server, with its own connection pool
+ *
+ * Used when the module is configured to distribute requests across
+ * all of its servers, instead of relying on libldap's failover.
+ */
+struct rlm_ldap_server_s {
+	fr_ldap_config_t	config;			//!< Copy of the module's connection configuration,
+							///< with only this server in the server string.
+	fr_pool_t		*pool;			//!< Connections to this server.
+
+	atomic_uint_fast64_t	latency;		//!< Moving average of how long handles to this
+							///< server are held for.
+	atomic_uint_fast32_t	in_flight;		//!< Handles currently in use.
+	atomic_int_fast64_t	retry_at;		//!< Avoid this server until this time, as we
+							///< recently failed to get a connection to it.
+};
+
+/** How long to avoid a server after failing to get a connection to it
+ *
+ */
+#define LDAP_SERVER_RETRY_DELAY	fr_time_delta_from_sec(5)
+
+/** Score a server, lower is better
+ *
+ * Servers which respond quickly and have few outstanding requests
+ * are preferred.  Servers we recently failed to connect to are only
+ * used if there's nothing else.
+ */
+static uint64_t ldap_server_score(rlm_ldap_server_t *srv, fr_time_t now)
+{
+	if (atomic_load(&srv->retry_at) > now) return UINT64_MAX;
+
+	return (atomic_load(&srv->latency) + 1) * (atomic_load(&srv->in_flight) + 1);
+}
+
+/** Get a connection from the least loaded server
+ *
+ * If no connection can be obtained from the best server, the others
+ * are tried in turn.
+ */
+static fr_ldap_connection_t *ldap_server_conn_get(rlm_ldap_t const *inst, request_t *request)
+{
+	size_t			i, num = talloc_array_length(inst->servers), best = 0;
+	uint64_t		score, best_score = UINT64_MAX;
+	fr_time_t		now = fr_time();
+	fr_ldap_connection_t	*conn;
+	fr_ldap_config_t const	*handle_config = &inst->handle_config;
+
+	for (i = 0; i < num; i++) {
+		score = ldap_server_score(inst->servers[i], now);
+		if (score < best_score) {
+			best_score = score;
+			best = i;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		rlm_ldap_server_t *srv = inst->servers[(best + i) % num];
+
+		conn = fr_pool_connection_get(srv->pool, request);
+		if (conn) {
+			atomic_fetch_add(&srv->in_flight, 1);
+			conn->uctx = srv;
+			conn->acquired = fr_time();
+			return conn;
+		}
+
+		/*
+		 *	Start with a clean slate when the
+		 *	server comes back.
+		 */
+		atomic_store(&srv->retry_at, now + LDAP_SERVER_RETRY_DELAY);
+		atomic_store(&srv->latency, 0);
+
+		ROPTIONAL(RWDEBUG, WARN, "No connections available to \"%s\"", srv->config.server);
+	}
+
+	return NULL;
+}
+
+/** Record how long a connection was used for, and return the pool it came from
+ *
+ */
+static fr_pool_t *ldap_server_conn_done(rlm_ldap_t const *inst, fr_ldap_connection_t *conn)
+{
+	rlm_ldap_server_t	*srv;
+	uint64_t		held, latency;
+
+	if (!inst->servers) return inst->pool;
+
+	srv = conn->uctx;
+	held = fr_time() - conn->acquired;
+
+	/*
+	 *	Exponentially weighted, so a slow server
+	 *	sheds load quickly, but a single slow
+	 *	search doesn't.
+	 */
+	latency = atomic_load(&srv->latency);
+	atomic_store(&srv->latency, latency ? ((latency * 7) + held) / 8 : held);
+	atomic_fetch_sub(&srv->in_flight, 1);
+
+	return srv->pool;
+}
+
 /** Gets an LDAP socket from the connection pool
  *
  * Retrieve a socket from the connection pool, or NULL on error (of if no sockets are available).
@@ -45,7 +156,11 @@ fr_ldap_connection_t *mod_conn_get(rlm_ldap_t const *inst, request_t *request)
 {
 	fr_ldap_connection_t *conn;
 
-	conn = fr_pool_connection_get(inst->pool, request);
+	if (inst->servers) {
+		conn = ldap_server_conn_get(inst, request);
+	} else {
+		conn = fr_pool_connection_get(inst->pool, request);
+	}
 
 	fr_assert(!conn || conn->config);
 
@@ -57,7 +172,7 @@ fr_ldap_connection_t *mod_conn_get(rlm_ldap_t const *inst, request_t *request)
 	 */
 	if ((conn != NULL) && (request != NULL) && inst->session_tracking) {
 		if (fr_ldap_control_add_session_tracking(conn, request) < 0) {
-			fr_pool_connection_release(inst->pool, request, conn);
+			fr_pool_connection_release(ldap_server_conn_done(inst, conn), request, conn);
 			return NULL;
 		}
 	}
@@ -76,11 +191,15 @@ fr_ldap_connection_t *mod_conn_get(rlm_ldap_t const *inst, request_t *request)
  */
 void ldap_mod_conn_release(rlm_ldap_t const *inst, request_t *request, fr_ldap_connection_t *conn)
 {
+	fr_pool_t *pool;
+
 	/*
 	 *	Could have already been free'd due to a previous error.
 	 */
 	if (!conn) return;
 
+	pool = ldap_server_conn_done(inst, conn);
+
 	/*
 	 *	Clear any client/server controls associated with the connection.
 	 */
@@ -97,11 +216,11 @@ void ldap_mod_conn_release(rlm_ldap_t const *inst, request_t *request, fr_ldap_c
 	 *	Instead, we let the next caller do the rebind.
 	 */
 	if (conn->referred) {
-		fr_pool_connection_close(inst->pool, request, conn);
+		fr_pool_connection_close(pool, request, conn);
 		return;
 	}
 
-	fr_pool_connection_release(inst->pool, request, conn);
+	fr_pool_connection_release(pool, request, conn);
 	return;
 }
 
@@ -155,3 +274,89 @@ void *ldap_mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t time
 
 	return conn;
 }
+
+/** Create the connection pool(s) for a module instance
+ *
+ * Normally a single pool is used, and libldap is left to fail over between
+ * the configured servers.  If server_distribute is enabled, and more than
+ * one server is configured, each server gets its own pool (using the
+ * settings in the pool section), and requests are spread between them.
+ *
+ * @param[in] inst	to create pools for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int ldap_mod_conn_pool_init(rlm_ldap_t *inst)
+{
+	fr_ldap_config_t const	*handle_config = &inst->handle_config;
+	CONF_SECTION	*cs;
+	char const	*p, *q;
+	char		log_prefix[128];
+	char		trigger_prefix[128];
+	size_t		num = 0;
+
+	if (!inst->server_distribute || !inst->handle_config.server ||
+	    !strchr(inst->handle_config.server, ' ')) {
+		inst->pool = module_connection_pool_init(inst->cs, &inst->handle_config,
+							 ldap_mod_conn_create, NULL, NULL, NULL, NULL);
+		return inst->pool ? 0 : -1;
+	}
+
+	cs = cf_section_find(inst->cs, "pool", NULL);
+	if (!cs) cs = cf_section_alloc(inst->cs, inst->cs, "pool", NULL);
+
+	snprintf(trigger_prefix, sizeof(trigger_prefix), "modules.%s.pool", cf_section_name1(inst->cs));
+
+	for (p = inst->handle_config.server; *p; p = q) {
+		rlm_ldap_server_t *srv;
+
+		while (*p == ' ') p++;
+		if (!*p) break;
+
+		q = strchr(p, ' ');
+		if (!q) q = p + strlen(p);
+
+		MEM(srv = talloc_zero(inst, rlm_ldap_server_t));
+		srv->config = inst->handle_config;
+		MEM(srv->config.server = talloc_bstrndup(srv, p, q - p));
+		atomic_init(&srv->latency, 0);
+		atomic_init(&srv->in_flight, 0);
+		atomic_init(&srv->retry_at, 0);
+
+		snprintf(log_prefix, sizeof(log_prefix), "rlm_ldap (%s) - %s", inst->name, srv->config.server);
+
+		srv->pool = fr_pool_init(srv, cs, &srv->config, ldap_mod_conn_create, NULL, log_prefix);
+		if (!srv->pool) return -1;
+
+		fr_pool_enable_triggers(srv->pool, trigger_prefix, NULL);
+
+		if (fr_pool_start(srv->pool) < 0) {
+			ERROR("Starting initial connections to %s failed", srv->config.server);
+			return -1;
+		}
+
+		MEM(inst->servers = talloc_realloc(inst, inst->servers, rlm_ldap_server_t *, num + 1));
+		inst->servers[num++] = srv;
+	}
+
+	DEBUG2("Distributing requests across %zu servers", num);
+
+	return 0;
+}
+
+/** Free the connection pool(s) for a module instance
+ *
+ * @param[in] inst	to free pools for.
+ */
+void ldap_mod_conn_pool_free(rlm_ldap_t *inst)
+{
+	size_t i;
+
+	if (!inst->servers) {
+		fr_pool_free(inst->pool);
+		return;
+	}
+
+	for (i = 0; i < talloc_array_length(inst->servers); i++) fr_pool_free(inst->servers[i]->pool);
+}
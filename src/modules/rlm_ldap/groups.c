@@ -36,6 +36,303 @@ USES_APPLE_DEPRECATED_API
 
 #include "rlm_ldap.h"
 
+#include <pthread.h>
+
+/** What a group cache entry maps its key to
+ *
+ */
+typedef enum {
+	LDAP_GROUP_CACHE_MEMBERSHIP = 0,			//!< User DN and group, to whether the user is a member.
+	LDAP_GROUP_CACHE_NAME2DN,				//!< Group name, to group DN.
+	LDAP_GROUP_CACHE_DN2NAME				//!< Group DN, to group name.
+} rlm_ldap_group_cache_type_t;
+
+typedef struct {
+	fr_rb_node_t			node;			//!< Entry in the cache tree.
+	fr_dlist_t			entry;			//!< Entry in the LRU list.
+
+	rlm_ldap_group_cache_type_t	type;			//!< What the key maps to.
+	uint8_t				*key;			//!< What we look the entry up by.
+	size_t				key_len;		//!< Length of the key.
+	char				*value;			//!< Name or DN the key resolves to.
+	bool				member;			//!< Whether the user is a member of the group.
+
+	fr_time_t			expires;		//!< When the entry should no longer be used.
+} rlm_ldap_group_cache_entry_t;
+
+struct rlm_ldap_group_cache_s {
+	pthread_mutex_t			mutex;			//!< The cache is shared between workers.
+	fr_rb_tree_t			*tree;			//!< Of entries, by type and key.
+	fr_dlist_head_t			lru;			//!< Of entries, least recently used first.
+};
+
+static int8_t rlm_ldap_group_cache_cmp(void const *one, void const *two)
+{
+	rlm_ldap_group_cache_entry_t const	*a = one, *b = two;
+	int					ret;
+
+	ret = CMP(a->type, b->type);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->key, b->key, a->key_len < b->key_len ? a->key_len : b->key_len);
+	if (ret != 0) return CMP(ret, 0);
+
+	return CMP(a->key_len, b->key_len);
+}
+
+static int _rlm_ldap_group_cache_free(rlm_ldap_group_cache_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate the cache of group memberships, and group name/DN mappings
+ *
+ * The cache is shared between all workers, so that a user who
+ * authenticates repeatedly doesn't cause the same searches on
+ * every worker.
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @return
+ *	- 0 on success, or if caching is disabled.
+ *	- -1 on failure.
+ */
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst)
+{
+	rlm_ldap_group_cache_t	*cache;
+
+	if (!inst->group_cache_lifetime && !inst->group_cache_negative_lifetime) return 0;
+
+	if (!inst->group_cache_size) {
+		cf_log_err(inst->cs, "'group.cache_size' must be non-zero when group caching is enabled");
+		return -1;
+	}
+
+	MEM(cache = talloc_zero(inst, rlm_ldap_group_cache_t));
+	cache->tree = fr_rb_inline_talloc_alloc(cache, rlm_ldap_group_cache_entry_t, node,
+						rlm_ldap_group_cache_cmp, NULL);
+	if (!cache->tree) {
+		talloc_free(cache);
+		return -1;
+	}
+	fr_dlist_init(&cache->lru, rlm_ldap_group_cache_entry_t, entry);
+	pthread_mutex_init(&cache->mutex, NULL);
+	talloc_set_destructor(cache, _rlm_ldap_group_cache_free);
+
+	inst->group_cache = cache;
+
+	return 0;
+}
+
+/** Remove an entry from the cache
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void rlm_ldap_group_cache_remove(rlm_ldap_group_cache_t *cache, rlm_ldap_group_cache_entry_t *c)
+{
+	fr_rb_remove(cache->tree, c);
+	fr_dlist_remove(&cache->lru, c);
+	talloc_free(c);
+}
+
+/** Find an unexpired cache entry
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static rlm_ldap_group_cache_entry_t *rlm_ldap_group_cache_find(rlm_ldap_group_cache_t *cache,
+							      rlm_ldap_group_cache_type_t type,
+							      uint8_t const *key, size_t key_len)
+{
+	rlm_ldap_group_cache_entry_t	*c;
+
+	c = fr_rb_find(cache->tree, &(rlm_ldap_group_cache_entry_t){
+				.type = type,
+				.key = UNCONST(uint8_t *, key),
+				.key_len = key_len
+			});
+	if (!c) return NULL;
+
+	if (c->expires <= fr_time()) {
+		rlm_ldap_group_cache_remove(cache, c);
+		return NULL;
+	}
+
+	fr_dlist_remove(&cache->lru, c);
+	fr_dlist_insert_tail(&cache->lru, c);
+
+	return c;
+}
+
+/** Add or update a cache entry
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void rlm_ldap_group_cache_insert(rlm_ldap_t const *inst, rlm_ldap_group_cache_type_t type,
+					uint8_t const *key, size_t key_len,
+					char const *value, bool member, fr_time_delta_t lifetime)
+{
+	rlm_ldap_group_cache_t		*cache = inst->group_cache;
+	rlm_ldap_group_cache_entry_t	*c;
+
+	c = rlm_ldap_group_cache_find(cache, type, key, key_len);
+	if (c) rlm_ldap_group_cache_remove(cache, c);
+
+	while ((c = fr_dlist_head(&cache->lru)) && (fr_dlist_num_elements(&cache->lru) >= inst->group_cache_size)) {
+		rlm_ldap_group_cache_remove(cache, c);
+	}
+
+	MEM(c = talloc_zero(cache, rlm_ldap_group_cache_entry_t));
+	c->type = type;
+	MEM(c->key = talloc_memdup(c, key, key_len));
+	c->key_len = key_len;
+	if (value) MEM(c->value = talloc_strdup(c, value));
+	c->member = member;
+	c->expires = fr_time() + lifetime;
+
+	if (!fr_rb_insert(cache->tree, c)) {
+		talloc_free(c);
+		return;
+	}
+	fr_dlist_insert_tail(&cache->lru, c);
+}
+
+/** Look up a cached group name for a DN, or a cached DN for a name
+ *
+ * @param[in] ctx	to allocate the result in.
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] type	LDAP_GROUP_CACHE_NAME2DN or LDAP_GROUP_CACHE_DN2NAME.
+ * @param[in] key	the name or DN to resolve.
+ * @return
+ *	- The name or DN.
+ *	- NULL if there's no cached mapping.
+ */
+static char *rlm_ldap_group_cache_value(TALLOC_CTX *ctx, rlm_ldap_t const *inst,
+					rlm_ldap_group_cache_type_t type, char const *key)
+{
+	rlm_ldap_group_cache_entry_t	*c;
+	char				*value = NULL;
+
+	if (!inst->group_cache || !inst->group_cache_lifetime) return NULL;
+
+	pthread_mutex_lock(&inst->group_cache->mutex);
+	c = rlm_ldap_group_cache_find(inst->group_cache, type, (uint8_t const *)key, strlen(key));
+	if (c) MEM(value = talloc_strdup(ctx, c->value));
+	pthread_mutex_unlock(&inst->group_cache->mutex);
+
+	return value;
+}
+
+/** Cache a group name to DN mapping, in both directions
+ *
+ */
+static void rlm_ldap_group_cache_mapping(rlm_ldap_t const *inst, char const *name, char const *dn)
+{
+	if (!inst->group_cache || !inst->group_cache_lifetime) return;
+
+	pthread_mutex_lock(&inst->group_cache->mutex);
+	rlm_ldap_group_cache_insert(inst, LDAP_GROUP_CACHE_NAME2DN, (uint8_t const *)name, strlen(name),
+				    dn, false, inst->group_cache_lifetime);
+	rlm_ldap_group_cache_insert(inst, LDAP_GROUP_CACHE_DN2NAME, (uint8_t const *)dn, strlen(dn),
+				    name, false, inst->group_cache_lifetime);
+	pthread_mutex_unlock(&inst->group_cache->mutex);
+}
+
+/** Build the key for a cached membership
+ *
+ * The user DN and the group, separated by a nul, so that
+ * no two different pairs produce the same key.
+ */
+static uint8_t *rlm_ldap_group_cache_membership_key(char const *user_dn, fr_pair_t const *check)
+{
+	size_t	dn_len = strlen(user_dn);
+	uint8_t	*key;
+
+	MEM(key = talloc_array(NULL, uint8_t, dn_len + 1 + check->vp_length));
+	memcpy(key, user_dn, dn_len + 1);
+	memcpy(key + dn_len + 1, check->vp_strvalue, check->vp_length);
+
+	return key;
+}
+
+/** Check whether we recently determined that a user is, or is not, a member of a group
+ *
+ * @param[out] p_result		Result of the check:
+ *				- RLM_MODULE_OK if the user is a member.
+ *				- RLM_MODULE_NOTFOUND if the user is not a member.
+ *				- RLM_MODULE_NOOP if nothing is cached.
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] request		Current request.
+ * @param[in] user_dn		of the user object.
+ * @param[in] check		vp containing the group value (name or dn).
+ */
+unlang_action_t rlm_ldap_group_cache_check(rlm_rcode_t *p_result, rlm_ldap_t const *inst, request_t *request,
+					   char const *user_dn, fr_pair_t const *check)
+{
+	rlm_ldap_group_cache_entry_t	*c;
+	uint8_t				*key;
+	rlm_rcode_t			rcode = RLM_MODULE_NOOP;
+
+	if (!inst->group_cache) RETURN_MODULE_NOOP;
+
+	key = rlm_ldap_group_cache_membership_key(user_dn, check);
+
+	pthread_mutex_lock(&inst->group_cache->mutex);
+	c = rlm_ldap_group_cache_find(inst->group_cache, LDAP_GROUP_CACHE_MEMBERSHIP,
+				      key, talloc_array_length(key));
+	if (c) rcode = c->member ? RLM_MODULE_OK : RLM_MODULE_NOTFOUND;
+	pthread_mutex_unlock(&inst->group_cache->mutex);
+
+	talloc_free(key);
+
+	switch (rcode) {
+	case RLM_MODULE_OK:
+		RDEBUG2("User found in group \"%pV\". Matched cached membership", &check->data);
+		break;
+
+	case RLM_MODULE_NOTFOUND:
+		RDEBUG2("User not found in group \"%pV\". Matched cached non-membership", &check->data);
+		break;
+
+	default:
+		break;
+	}
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+/** Record whether a user is a member of a group
+ *
+ * Memberships are cached for group.cache_lifetime, and non-memberships
+ * for group.cache_negative_lifetime.  Either may be zero to disable
+ * caching that result.
+ *
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] user_dn		of the user object.
+ * @param[in] check		vp containing the group value (name or dn).
+ * @param[in] member		Whether the user is a member.
+ */
+void rlm_ldap_group_cache_membership(rlm_ldap_t const *inst, char const *user_dn,
+				     fr_pair_t const *check, bool member)
+{
+	fr_time_delta_t	lifetime;
+	uint8_t		*key;
+
+	if (!inst->group_cache) return;
+
+	lifetime = member ? inst->group_cache_lifetime : inst->group_cache_negative_lifetime;
+	if (!lifetime) return;
+
+	key = rlm_ldap_group_cache_membership_key(user_dn, check);
+
+	pthread_mutex_lock(&inst->group_cache->mutex);
+	rlm_ldap_group_cache_insert(inst, LDAP_GROUP_CACHE_MEMBERSHIP, key, talloc_array_length(key),
+				    NULL, member, lifetime);
+	pthread_mutex_unlock(&inst->group_cache->mutex);
+
+	talloc_free(key);
+}
+
 /** Convert multiple group names into a DNs
  *
  * Given an array of group names, builds a filter matching all names, then retrieves all group objects
@@ -46,8 +343,8 @@ USES_APPLE_DEPRECATED_API
  * @param[in] request		Current request.
  * @param[in,out] pconn		to use. May change as this function calls functions which auto re-connect.
  * @param[in] names		to convert to DNs (NULL terminated).
- * @param[out] out		Where to write the DNs. DNs must be freed with
- *				ldap_memfree(). Will be NULL terminated.
+ * @param[out] out		Where to write the DNs.  DNs are allocated in the request,
+ *				and must be freed with talloc_free().  Will be NULL terminated.
  * @param[in] outlen		Size of out.
  * @return One of the RLM_MODULE_* values.
  */
@@ -61,7 +358,7 @@ static unlang_action_t rlm_ldap_group_name2dn(rlm_rcode_t *p_result, rlm_ldap_t
 
 	unsigned int name_cnt = 0;
 	unsigned int entry_cnt;
-	char const *attrs[] = { NULL };
+	char const *attrs[] = { inst->groupobj_name_attr, NULL };
 
 	LDAPMessage *result = NULL, *entry;
 
@@ -71,7 +368,8 @@ static unlang_action_t rlm_ldap_group_name2dn(rlm_rcode_t *p_result, rlm_ldap_t
 	char base_dn_buff[LDAP_MAX_DN_STR_LEN];
 	char buffer[LDAP_MAX_GROUP_NAME_LEN + 1];
 
-	char *filter;
+	char *filter = NULL;
+	char *uncached[LDAP_MAX_CACHEABLE + 1];
 
 	*dn = NULL;
 
@@ -85,6 +383,27 @@ static unlang_action_t rlm_ldap_group_name2dn(rlm_rcode_t *p_result, rlm_ldap_t
 
 	RDEBUG2("Converting group name(s) to group DN(s)");
 
+	/*
+	 *	Only search for the names we don't have
+	 *	cached mappings for.
+	 */
+	for (name = names; *name; name++) {
+		if ((size_t)(dn - out) >= (outlen - 1)) break;
+
+		*dn = rlm_ldap_group_cache_value(request, inst, LDAP_GROUP_CACHE_NAME2DN, *name);
+		if (!*dn) {
+			uncached[name_cnt++] = *name;
+			continue;
+		}
+
+		RDEBUG2("Group name \"%s\" resolves to DN \"%s\" (cached)", *name, *dn);
+		dn++;
+	}
+	uncached[name_cnt] = NULL;
+	*dn = NULL;
+
+	if (!name_cnt) RETURN_MODULE_OK;
+
 	/*
 	 *	It'll probably only save a few ms in network latency, but it means we can send a query
 	 *	for the entire group list at once.
@@ -92,16 +411,14 @@ static unlang_action_t rlm_ldap_group_name2dn(rlm_rcode_t *p_result, rlm_ldap_t
 	filter = talloc_typed_asprintf(request, "%s%s%s",
 				 inst->groupobj_filter ? "(&" : "",
 				 inst->groupobj_filter ? inst->groupobj_filter : "",
-				 names[0] && names[1] ? "(|" : "");
-	while (*name) {
-		fr_ldap_escape_func(request, buffer, sizeof(buffer), *name++, NULL);
+				 name_cnt > 1 ? "(|" : "");
+	for (name = uncached; *name; name++) {
+		fr_ldap_escape_func(request, buffer, sizeof(buffer), *name, NULL);
 		filter = talloc_asprintf_append_buffer(filter, "(%s=%s)", inst->groupobj_name_attr, buffer);
-
-		name_cnt++;
 	}
 	filter = talloc_asprintf_append_buffer(filter, "%s%s",
 					       inst->groupobj_filter ? ")" : "",
-					       names[0] && names[1] ? ")" : "");
+					       name_cnt > 1 ? ")" : "");
 
 	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
 			inst->groupobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
@@ -133,7 +450,7 @@ static unlang_action_t rlm_ldap_group_name2dn(rlm_rcode_t *p_result, rlm_ldap_t
 		goto finish;
 	}
 
-	if (entry_cnt > (outlen - 1)) {
+	if (((dn - out) + entry_cnt) > (outlen - 1)) {
 		REDEBUG("Number of DNs exceeds limit (%zu)", outlen - 1);
 		rcode = RLM_MODULE_INVALID;
 
@@ -155,17 +472,35 @@ static unlang_action_t rlm_ldap_group_name2dn(rlm_rcode_t *p_result, rlm_ldap_t
 	}
 
 	do {
-		*dn = ldap_get_dn((*pconn)->handle, entry);
-		if (!*dn) {
+		char		*entry_dn;
+		struct berval	**values;
+
+		entry_dn = ldap_get_dn((*pconn)->handle, entry);
+		if (!entry_dn) {
 			ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 			REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
 
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
 		}
-		fr_ldap_util_normalise_dn(*dn, *dn);
+		fr_ldap_util_normalise_dn(entry_dn, entry_dn);
+		MEM(*dn = talloc_strdup(request, entry_dn));
+		ldap_memfree(entry_dn);
 
 		RDEBUG2("Got group DN \"%s\"", *dn);
+
+		/*
+		 *	Remember which name this was, so the next
+		 *	request doesn't have to ask.
+		 */
+		values = ldap_get_values_len((*pconn)->handle, entry, inst->groupobj_name_attr);
+		if (values) {
+			char *entry_name = fr_ldap_berval_to_string(request, values[0]);
+
+			rlm_ldap_group_cache_mapping(inst, entry_name, *dn);
+			talloc_free(entry_name);
+			ldap_value_free_len(values);
+		}
 		dn++;
 	} while((entry = ldap_next_entry((*pconn)->handle, entry)));
 
@@ -179,14 +514,58 @@ finish:
 	 *	Be nice and cleanup the output array if we error out.
 	 */
 	if (rcode != RLM_MODULE_OK) {
-		dn = out;
-		while(*dn) ldap_memfree(*dn++);
 		*dn = NULL;
+		dn = out;
+		while(*dn) TALLOC_FREE(*dn++);
+		*out = NULL;
 	}
 
 	RETURN_MODULE_RCODE(rcode);
 }
 
+/** Extract the group name from the result of a base search on a group DN
+ *
+ * @param[out] p_result		The result of trying to resolve a dn to a group name.
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] request		Current request.
+ * @param[in] conn		the search was performed on.
+ * @param[in] dn		that was resolved.
+ * @param[in] result		of the base search.
+ * @param[out] out		Where to write group name (must be freed with talloc_free).
+ * @return One of the RLM_MODULE_* values.
+ */
+static unlang_action_t rlm_ldap_group_dn2name_result(rlm_rcode_t *p_result, rlm_ldap_t const *inst,
+						     request_t *request, fr_ldap_connection_t const *conn,
+						     char const *dn, LDAPMessage *result, char **out)
+{
+	int		ldap_errno;
+	struct berval	**values;
+	LDAPMessage	*entry;
+
+	entry = ldap_first_entry(conn->handle, result);
+	if (!entry) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+
+		RETURN_MODULE_INVALID;
+	}
+
+	values = ldap_get_values_len(conn->handle, entry, inst->groupobj_name_attr);
+	if (!values) {
+		REDEBUG("No %s attributes found in object", inst->groupobj_name_attr);
+
+		RETURN_MODULE_INVALID;
+	}
+
+	*out = fr_ldap_berval_to_string(request, values[0]);
+	RDEBUG2("Group DN \"%s\" resolves to name \"%s\"", dn, *out);
+	rlm_ldap_group_cache_mapping(inst, *out, dn);
+
+	ldap_value_free_len(values);
+
+	RETURN_MODULE_OK;
+}
+
 /** Convert a single group name into a DN
  *
  * Unlike the inverse conversion of a name to a DN, most LDAP directories don't allow filtering by DN,
@@ -203,13 +582,11 @@ finish:
 static unlang_action_t rlm_ldap_group_dn2name(rlm_rcode_t *p_result, rlm_ldap_t const *inst, request_t *request,
 					      fr_ldap_connection_t **pconn, char const *dn, char **out)
 {
-	rlm_rcode_t rcode = RLM_MODULE_OK;
+	rlm_rcode_t rcode;
 	fr_ldap_rcode_t status;
-	int ldap_errno;
 
-	struct berval **values = NULL;
 	char const *attrs[] = { inst->groupobj_name_attr, NULL };
-	LDAPMessage *result = NULL, *entry;
+	LDAPMessage *result = NULL;
 
 	*out = NULL;
 
@@ -221,6 +598,12 @@ static unlang_action_t rlm_ldap_group_dn2name(rlm_rcode_t *p_result, rlm_ldap_t
 
 	RDEBUG2("Resolving group DN \"%s\" to group name", dn);
 
+	*out = rlm_ldap_group_cache_value(request, inst, LDAP_GROUP_CACHE_DN2NAME, dn);
+	if (*out) {
+		RDEBUG2("Group DN \"%s\" resolves to name \"%s\" (cached)", dn, *out);
+		RETURN_MODULE_OK;
+	}
+
 	status = fr_ldap_search(&result, request, pconn, dn, LDAP_SCOPE_BASE, NULL, attrs, NULL, NULL);
 	switch (status) {
 	case LDAP_PROC_SUCCESS:
@@ -234,30 +617,157 @@ static unlang_action_t rlm_ldap_group_dn2name(rlm_rcode_t *p_result, rlm_ldap_t
 		RETURN_MODULE_FAIL;
 	}
 
-	entry = ldap_first_entry((*pconn)->handle, result);
-	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+	rlm_ldap_group_dn2name_result(&rcode, inst, request, *pconn, dn, result, out);
+	ldap_msgfree(result);
 
-		rcode = RLM_MODULE_INVALID;
-		goto finish;
+	RETURN_MODULE_RCODE(rcode);
+}
+
+/** Convert multiple group DNs to group names, with all searches outstanding at once
+ *
+ * Only Active Directory supports filtering on DN, so each group has to be
+ * resolved with its own base search.  Rather than waiting for each search
+ * to complete before sending the next, all searches are sent, and the
+ * responses are then matched back to their DNs by msgid.  This turns N
+ * round trips to the directory into one.
+ *
+ * @param[out] p_result		The result of trying to resolve the dns to group names.
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] request		Current request.
+ * @param[in,out] pconn		to use. May change as this function calls functions which auto re-connect.
+ * @param[in] dns		NULL terminated array of DNs to resolve.
+ * @param[out] out		Where to write the group names.  Entries for dangling group
+ *				references are set to NULL.  Names must be freed with talloc_free.
+ * @return One of the RLM_MODULE_* values.
+ */
+static unlang_action_t rlm_ldap_group_dn2name_multi(rlm_rcode_t *p_result, rlm_ldap_t const *inst,
+						    request_t *request, fr_ldap_connection_t **pconn,
+						    char * const *dns, char **out)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	fr_ldap_rcode_t		status;
+	fr_ldap_connection_t	*conn = *pconn;
+	int			msgid[LDAP_MAX_CACHEABLE];
+	size_t			i, j, sent, count;
+
+	char const	*attrs[] = { inst->groupobj_name_attr, NULL };
+	LDAPMessage	*result;
+
+	for (count = 0; dns[count]; count++) out[count] = NULL;
+	fr_assert(count <= LDAP_MAX_CACHEABLE);
+
+	if (!count) RETURN_MODULE_OK;
+
+	if (!inst->groupobj_name_attr) {
+		REDEBUG("Told to resolve group DN to name but missing 'group.name_attribute' directive");
+
+		RETURN_MODULE_INVALID;
 	}
 
-	values = ldap_get_values_len((*pconn)->handle, entry, inst->groupobj_name_attr);
-	if (!values) {
-		REDEBUG("No %s attributes found in object", inst->groupobj_name_attr);
+	for (sent = 0; sent < count; sent++) {
+		RDEBUG2("Resolving group DN \"%s\" to group name", dns[sent]);
 
-		rcode = RLM_MODULE_INVALID;
+		out[sent] = rlm_ldap_group_cache_value(request, inst, LDAP_GROUP_CACHE_DN2NAME, dns[sent]);
+		if (out[sent]) {
+			RDEBUG2("Group DN \"%s\" resolves to name \"%s\" (cached)", dns[sent], out[sent]);
+			msgid[sent] = -1;
+			continue;
+		}
 
-		goto finish;
+		if (fr_ldap_search_async(&msgid[sent], request, pconn, dns[sent], LDAP_SCOPE_BASE,
+					 NULL, attrs, NULL, NULL) != LDAP_PROC_SUCCESS) {
+			if (*pconn != conn) for (j = 0; j < sent; j++) msgid[j] = -1;
+
+			rcode = RLM_MODULE_FAIL;
+			goto abandon;
+		}
+
+		if (*pconn == conn) continue;
+
+		/*
+		 *	The connection was re-opened while sending this
+		 *	search.  The searches sent before it went with
+		 *	the old connection, so send them again.
+		 */
+		RDEBUG2("LDAP connection was re-opened, resending group DN searches");
+		conn = *pconn;
+
+		for (i = 0; i < sent; i++) {
+			if (msgid[i] < 0) continue;
+
+			status = fr_ldap_search_async(&msgid[i], request, pconn, dns[i], LDAP_SCOPE_BASE,
+						      NULL, attrs, NULL, NULL);
+			if ((status == LDAP_PROC_SUCCESS) && (*pconn == conn)) continue;
+
+			/*
+			 *	Only searches sent on the current
+			 *	connection can be abandoned.
+			 */
+			if (*pconn != conn) {
+				for (j = 0; j <= sent; j++) msgid[j] = -1;
+			} else {
+				for (j = i; j < sent; j++) msgid[j] = -1;
+			}
+
+			rcode = RLM_MODULE_FAIL;
+			sent++;
+			goto abandon;
+		}
 	}
 
-	*out = fr_ldap_berval_to_string(request, values[0]);
-	RDEBUG2("Group DN \"%s\" resolves to name \"%s\"", dn, *out);
+	for (i = 0; i < count; i++) {
+		if (msgid[i] < 0) continue;
 
-finish:
-	if (result) ldap_msgfree(result);
-	if (values) ldap_value_free_len(values);
+		result = NULL;
+
+		status = fr_ldap_result(&result, NULL, *pconn, msgid[i], 1, dns[i], 0);
+		switch (status) {
+		case LDAP_PROC_SUCCESS:
+			if (ldap_count_entries((*pconn)->handle, result) > 0) break;
+			FALL_THROUGH;
+
+		case LDAP_PROC_BAD_DN:
+		case LDAP_PROC_NO_RESULT:
+			if (result) ldap_msgfree(result);
+
+			REDEBUG("Group DN \"%s\" did not resolve to an object", dns[i]);
+			if (inst->allow_dangling_group_refs) continue;
+
+			rcode = RLM_MODULE_INVALID;
+			goto error;
+
+		default:
+			RPEDEBUG("Failed resolving group DN \"%s\"", dns[i]);
+			if (result) ldap_msgfree(result);
+
+			rcode = RLM_MODULE_FAIL;
+			goto error;
+		}
+
+		rlm_ldap_group_dn2name_result(&rcode, inst, request, *pconn, dns[i], result, &out[i]);
+		ldap_msgfree(result);
+
+		if (rcode != RLM_MODULE_OK) goto error;
+	}
+
+	RETURN_MODULE_OK;
+
+error:
+	/*
+	 *	Tell the server we're no longer interested in
+	 *	the responses we haven't collected.
+	 */
+	while (++i < count) if (msgid[i] >= 0) ldap_abandon_ext((*pconn)->handle, msgid[i], NULL, NULL);
+
+	for (i = 0; i < count; i++) TALLOC_FREE(out[i]);
+
+	RETURN_MODULE_RCODE(rcode);
+
+abandon:
+	for (i = 0; i < sent; i++) {
+		if (msgid[i] >= 0) ldap_abandon_ext((*pconn)->handle, msgid[i], NULL, NULL);
+		TALLOC_FREE(out[i]);
+	}
 
 	RETURN_MODULE_RCODE(rcode);
 }
@@ -286,7 +796,9 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t con
 	char *group_dn[LDAP_MAX_CACHEABLE + 1];
 	char **dn_p;
 
-	char *name;
+	char *group_resolve[LDAP_MAX_CACHEABLE + 1];
+	char **resolve_p = group_resolve;
+	char *group_resolved[LDAP_MAX_CACHEABLE];
 
 	fr_pair_t *vp;
 	fr_pair_list_t *list, groups;
@@ -357,35 +869,40 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t con
 			 *	We were told to cache names but we got a DN, we now need to resolve
 			 *	this to a name.
 			 *	Only Active Directory supports filtering on DN, so we have to search
-			 *	for each individual group.
+			 *	for each individual group.  Store the DNs so the searches can all
+			 *	be sent at once.
 			 */
 			} else {
-				char *dn;
-
-				dn = fr_ldap_berval_to_string(value_ctx, values[i]);
-				rlm_ldap_group_dn2name(&rcode, inst, request, pconn, dn, &name);
-				talloc_free(dn);
+				*resolve_p++ = fr_ldap_berval_to_string(value_ctx, values[i]);
+			}
+		}
+	}
+	*resolve_p = NULL;
 
-				if (rcode == RLM_MODULE_NOOP) continue;
+	/*
+	 *	Resolve the DNs of any groups we need names for,
+	 *	with all the searches in flight at once.
+	 */
+	rlm_ldap_group_dn2name_multi(&rcode, inst, request, pconn, group_resolve, group_resolved);
+	if (rcode != RLM_MODULE_OK) {
+		ldap_value_free_len(values);
+		talloc_free(value_ctx);
+		fr_pair_list_free(&groups);
 
-				if (rcode != RLM_MODULE_OK) {
-					ldap_value_free_len(values);
-					talloc_free(value_ctx);
-					fr_pair_list_free(&groups);
+		RETURN_MODULE_RCODE(rcode);
+	}
 
-					RETURN_MODULE_RCODE(rcode);
-				}
+	for (i = 0; i < (resolve_p - group_resolve); i++) {
+		if (!group_resolved[i]) continue;	/* Dangling group reference */
 
-				MEM(vp = fr_pair_afrom_da(list_ctx, inst->cache_da));
-				fr_pair_value_bstrdup_buffer(vp, name, true);
-				fr_pair_append(&groups, vp);
-				talloc_free(name);
-			}
-		}
+		MEM(vp = fr_pair_afrom_da(list_ctx, inst->cache_da));
+		fr_pair_value_bstrdup_buffer(vp, group_resolved[i], true);
+		fr_pair_append(&groups, vp);
+		talloc_free(group_resolved[i]);
 	}
 	*name_p = NULL;
 
-	rlm_ldap_group_name2dn(&rcode, inst, request, pconn, group_name, group_dn, sizeof(group_dn));
+	rlm_ldap_group_name2dn(&rcode, inst, request, pconn, group_name, group_dn, NUM_ELEMENTS(group_dn));
 
 	ldap_value_free_len(values);
 	talloc_free(value_ctx);
@@ -410,7 +927,7 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t con
 		fr_pair_append(list, vp);
 
 		RDEBUG2("&control.%s += \"%pV\"", inst->cache_da->name, &vp->data);
-		ldap_memfree(*dn_p);
+		talloc_free(*dn_p);
 	}
 	REXDENT();
 
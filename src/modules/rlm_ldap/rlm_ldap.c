@@ -121,6 +121,9 @@ static CONF_PARSER group_config[] = {
 	{ FR_CONF_OFFSET("cache_attribute", FR_TYPE_STRING, rlm_ldap_t, cache_attribute) },
 	{ FR_CONF_OFFSET("group_attribute", FR_TYPE_STRING, rlm_ldap_t, group_attribute) },
 	{ FR_CONF_OFFSET("allow_dangling_group_ref", FR_TYPE_BOOL, rlm_ldap_t, allow_dangling_group_refs), .dflt = "no" },
+	{ FR_CONF_OFFSET("cache_lifetime", FR_TYPE_TIME_DELTA, rlm_ldap_t, group_cache_lifetime), .dflt = "0" },
+	{ FR_CONF_OFFSET("cache_negative_lifetime", FR_TYPE_TIME_DELTA, rlm_ldap_t, group_cache_negative_lifetime), .dflt = "0" },
+	{ FR_CONF_OFFSET("cache_size", FR_TYPE_UINT32, rlm_ldap_t, group_cache_size), .dflt = "4096" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -194,6 +197,8 @@ static const CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("port", FR_TYPE_UINT16, rlm_ldap_t, handle_config.port) },
 
+	{ FR_CONF_OFFSET("server_distribute", FR_TYPE_BOOL, rlm_ldap_t, server_distribute), .dflt = "no" },
+
 	{ FR_CONF_OFFSET("identity", FR_TYPE_STRING, rlm_ldap_t, handle_config.admin_identity) },
 	{ FR_CONF_OFFSET("password", FR_TYPE_STRING | FR_TYPE_SECRET, rlm_ldap_t, handle_config.admin_password) },
 
@@ -673,6 +678,27 @@ static int rlm_ldap_groupcmp(void *instance, request_t *request, UNUSED fr_pair_
 
 	fr_assert(conn);
 
+	/*
+	 *	Check whether we've recently been told the
+	 *	answer, by this or any other worker.
+	 */
+	{
+		rlm_rcode_t our_rcode;
+
+		rlm_ldap_group_cache_check(&our_rcode, inst, request, user_dn, check);
+		switch (our_rcode) {
+		case RLM_MODULE_OK:
+			found = true;
+			goto finish;
+
+		case RLM_MODULE_NOTFOUND:
+			goto finish;
+
+		default:
+			break;
+		}
+	}
+
 	/*
 	 *	Check groupobj user membership
 	 */
@@ -686,6 +712,7 @@ static int rlm_ldap_groupcmp(void *instance, request_t *request, UNUSED fr_pair_
 
 		case RLM_MODULE_OK:
 			found = true;
+			rlm_ldap_group_cache_membership(inst, user_dn, check, true);
 			FALL_THROUGH;
 
 		default:
@@ -708,6 +735,7 @@ static int rlm_ldap_groupcmp(void *instance, request_t *request, UNUSED fr_pair_
 
 		case RLM_MODULE_OK:
 			found = true;
+			rlm_ldap_group_cache_membership(inst, user_dn, check, true);
 			FALL_THROUGH;
 
 		default:
@@ -717,6 +745,11 @@ static int rlm_ldap_groupcmp(void *instance, request_t *request, UNUSED fr_pair_
 
 	fr_assert(conn);
 
+	/*
+	 *	Every check completed, and none found the user.
+	 */
+	rlm_ldap_group_cache_membership(inst, user_dn, check, false);
+
 finish:
 	if (conn) ldap_mod_conn_release(inst, request, conn);
 
@@ -1450,7 +1483,7 @@ static int mod_detach(void *instance)
 	if (inst->userobj_sort_ctrl) ldap_control_free(inst->userobj_sort_ctrl);
 #endif
 
-	fr_pool_free(inst->pool);
+	ldap_mod_conn_pool_free(inst);
 
 	return 0;
 }
@@ -2036,9 +2069,9 @@ if (inst->handle_config.tls_min_version_str) {
 	/*
 	 *	Initialize the socket pool.
 	 */
-	inst->pool = module_connection_pool_init(inst->cs, &inst->handle_config,
-						 ldap_mod_conn_create, NULL, NULL, NULL, NULL);
-	if (!inst->pool) goto error;
+	if (ldap_mod_conn_pool_init(inst) < 0) goto error;
+
+	if (rlm_ldap_group_cache_init(inst) < 0) goto error;
 
 	fr_ldap_global_config(inst->ldap_debug, inst->tls_random_file);
 
@@ -19,6 +19,10 @@
 
 typedef struct ldap_inst_s rlm_ldap_t;
 
+typedef struct rlm_ldap_group_cache_s rlm_ldap_group_cache_t;
+
+typedef struct rlm_ldap_server_s rlm_ldap_server_t;
+
 typedef struct {
 	tmpl_t	*mech;				//!< SASL mech(s) to try.
 	tmpl_t	*proxy;				//!< Identity to proxy.
@@ -112,6 +116,12 @@ struct ldap_inst_s {
 	bool		allow_dangling_group_refs;	//!< Don't error if we fail to resolve a group DN referenced
 														///< from a user object.
 
+	fr_time_delta_t	group_cache_lifetime;		//!< How long group memberships, and group name/DN
+							//!< mappings are cached for.
+	fr_time_delta_t	group_cache_negative_lifetime;	//!< How long group non-memberships are cached for.
+	uint32_t	group_cache_size;		//!< Maximum number of cache entries.
+	rlm_ldap_group_cache_t	*group_cache;		//!< Shared between all workers.
+
 	/*
 	 *	Profiles
 	 */
@@ -140,6 +150,9 @@ struct ldap_inst_s {
 #endif
 
 	fr_pool_t	*pool;				//!< Connection pool instance.
+	bool		server_distribute;		//!< Give each server its own connection pool, and
+							//!< spread requests between them.
+	rlm_ldap_server_t **servers;			//!< Per-server connection pools, if distributing.
 	fr_ldap_config_t handle_config;			//!< Connection configuration instance.
 
 	/*
@@ -192,6 +205,14 @@ unlang_action_t rlm_ldap_check_userobj_dynamic(rlm_rcode_t *p_result,
 unlang_action_t rlm_ldap_check_cached(rlm_rcode_t *p_result,
 				      rlm_ldap_t const *inst, request_t *request, fr_pair_t const *check);
 
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst);
+
+unlang_action_t rlm_ldap_group_cache_check(rlm_rcode_t *p_result, rlm_ldap_t const *inst, request_t *request,
+					   char const *user_dn, fr_pair_t const *check);
+
+void rlm_ldap_group_cache_membership(rlm_ldap_t const *inst, char const *user_dn,
+				     fr_pair_t const *check, bool member);
+
 /*
  *	conn.c - Connection wrappers.
  */
@@ -200,3 +221,7 @@ fr_ldap_connection_t	*mod_conn_get(rlm_ldap_t const *inst, request_t *request);
 void		ldap_mod_conn_release(rlm_ldap_t const *inst, request_t *request, fr_ldap_connection_t *conn);
 
 void		*ldap_mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t timeout);
+
+int		ldap_mod_conn_pool_init(rlm_ldap_t *inst);
+
+void		ldap_mod_conn_pool_free(rlm_ldap_t *inst);
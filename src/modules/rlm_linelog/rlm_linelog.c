@@ -670,7 +670,7 @@ build_vector:
 			goto finish;
 		}
 
-		if (inst->file.group_str && (chown(path, -1, inst->file.group) == -1)) {
+		if (inst->file.group_str && (fchown(fd, -1, inst->file.group) == -1)) {
 			RPWARN("Unable to change system group of \"%s\": %s", path, fr_strerror());
 		}
 
@@ -448,9 +448,9 @@ static int _lua_pair_iterator_init(lua_State *L)
 	 *	This function should only be called as a closure.
 	 *	As we control the upvalues, we should assert on errors.
 	 */
-	fr_assert(lua_isuserdata(L, lua_upvalueindex(2)));
+	fr_assert(lua_isuserdata(L, lua_upvalueindex(1)));
 
-	da = lua_touserdata(L, lua_upvalueindex(2));
+	da = lua_touserdata(L, lua_upvalueindex(1));
 	fr_assert(da);
 
 	cursor = (fr_dcursor_t*) lua_newuserdata(L, sizeof(fr_dcursor_t));
@@ -501,6 +501,8 @@ static int _lua_list_iterator_init(lua_State *L)
 	request_t			*request = fr_lua_util_get_request();
 	fr_dcursor_t		*cursor;
 
+	if (!request) return luaL_error(L, "fr.request is only available when processing a request");
+
 	cursor = (fr_dcursor_t*) lua_newuserdata(L, sizeof(fr_dcursor_t));
 	if (!cursor) {
 		REDEBUG("Failed allocating user data to hold cursor");
@@ -508,15 +510,22 @@ static int _lua_list_iterator_init(lua_State *L)
 	}
 	fr_dcursor_init(cursor, &request->request_pairs);	/* @FIXME: Shouldn't use list head */
 
-	lua_pushlightuserdata(L, cursor);
 	lua_pushcclosure(L, _lua_list_iterator, 1);
 
 	return 1;
 }
 
-/** Initialise and return a new accessor table
+/** Return the accessor table for an attribute, creating it if required
  *
+ * @note Should only be present in the Lua environment as a closure.
+ * @note Takes one upvalue - a table of accessors keyed by fr_dict_attr_t.
+ * @note Is called as an __index metamethod, so takes the table (can be ignored)
+ *	 and the field (the attribute name).
  *
+ * The attribute name is resolved in the dictionary of the current request
+ * each time, as the same name may refer to different attributes in different
+ * protocols.  The accessors themselves only carry the fr_dict_attr_t, so
+ * they're cached for the lifetime of the interpreter.
  */
 static int _lua_pair_accessor_init(lua_State *L)
 {
@@ -525,19 +534,20 @@ static int _lua_pair_accessor_init(lua_State *L)
 	fr_dict_attr_t const	*da;
 	fr_dict_attr_t		*up;
 
-	attr = lua_tostring(L, -1);
-	if (!attr) {
-		REDEBUG("Failed retrieving field name \"%s\"", attr);
-		return -1;
-	}
+	if (!request) return luaL_error(L, "fr.request is only available when processing a request");
+
+	attr = lua_tostring(L, 2);
+	if (!attr) return luaL_error(L, "Attribute name must be a string");
 
 	da = fr_dict_attr_by_name(NULL, fr_dict_root(request->dict), attr);
-	if (!da) {
-		REDEBUG("Unknown or invalid attribute name \"%s\"", attr);
-		return -1;
-	}
+	if (!da) return luaL_error(L, "Unknown or invalid attribute name \"%s\"", attr);
 	up = UNCONST(fr_dict_attr_t *, da);
 
+	lua_pushlightuserdata(L, up);
+	lua_rawget(L, lua_upvalueindex(1));
+	if (!lua_isnil(L, -1)) return 1;
+	lua_pop(L, 1);
+
 	/*
 	 *	Add the pairs method to the main table, this allows
 	 *	easy iteration over multiple values of the same
@@ -546,9 +556,8 @@ static int _lua_pair_accessor_init(lua_State *L)
 	 *	for v in request[User-Name].pairs() do
 	 */
 	lua_newtable(L);
-	lua_pushlightuserdata(L, &request->request_pairs);
 	lua_pushlightuserdata(L, up);
-	lua_pushcclosure(L, _lua_pair_iterator_init, 2);
+	lua_pushcclosure(L, _lua_pair_iterator_init, 1);
 	lua_setfield(L, -2, "pairs");
 
 	/*
@@ -564,10 +573,20 @@ static int _lua_pair_accessor_init(lua_State *L)
 	lua_setfield(L, -2, "__newindex");
 
 	lua_setmetatable(L, -2);
-	lua_settable(L, -3);		/* Cache the attribute manipulation object */
-	lua_getfield(L, -1, attr);	/* and return it */
 
-	return 1;
+	lua_pushlightuserdata(L, up);	/* Cache the attribute manipulation object */
+	lua_pushvalue(L, -2);
+	lua_rawset(L, lua_upvalueindex(1));
+
+	return 1;			/* and return it */
+}
+
+/** Stop scripts storing values in fr.request, as it's shared between requests
+ *
+ */
+static int _lua_request_newindex(lua_State *L)
+{
+	return luaL_error(L, "fr.request is read-only, assign to fr.request['<attribute>'][<index>] instead");
 }
 
 /** Check whether the Lua interpreter were actually linked to is LuaJIT
@@ -609,28 +628,53 @@ char const *fr_lua_version(lua_State *L)
 	return version;
 }
 
-/** Check if a given function was loaded into an index in the global table
+/** Resolve a path string to a function, and store a reference to it in the registry
  *
- * Also check what was loaded there is a function and that it accepts the correct arguments.
+ * Parses a string in the format
+ * @verbatim obj0[.obj1][.objN] @endverbatim, traversing tables from
+ * the global table, and checks what was found there is a function.
  *
- * @param inst Current instance of fr_lua
- * @param L the lua state
- * @param name of function to check.
- * @returns 0 on success (function is present and correct), or -1 on failure.
+ * @param[in] inst	Current instance of fr_lua.
+ * @param[in] L		the lua state.
+ * @param[out] ref	Where to write the registry reference.  Set to
+ *			LUA_NOREF if name is NULL.  May be NULL to only
+ *			check the function exists.
+ * @param[in] name	of function to resolve.
+ * @return
+ *	- 0 on success (function is present and correct).
+ *	- -1 on failure.
  */
-static int fr_lua_check_func(rlm_lua_t const *inst, lua_State *L, char const *name)
+static int fr_lua_func_ref(rlm_lua_t const *inst, lua_State *L, int *ref, char const *name)
 {
-	int ret;
-	int type;
+	char		buff[512];
+	char const	*p = name, *q;
+	int		ret = -1;
+	int		type;
 
 	RLM_LUA_STACK_SET();
 
-	if (name == NULL) return 0;
+	if (ref) *ref = LUA_NOREF;
+	if (!name) return 0;
 
-	lua_getglobal(L, name);
+	lua_pushvalue(L, LUA_GLOBALSINDEX);
+	while ((q = strchr(p, '.'))) {
+		if ((size_t) (q - p) >= sizeof(buff)) {
+			ERROR("Field name too long, expected < %zu, got %zu", sizeof(buff), (size_t) (q - p));
+			goto done;
+		}
+
+		strlcpy(buff, p, (q - p) + 1);
+		lua_getfield(L, -1, buff);
+		if (!lua_istable(L, -1)) {
+			ERROR("Field \"%s\" in \"%s\" is not a table", buff, name);
+			goto done;
+		}
+		p = q + 1;	/* Skip the '.' */
+	}
+	lua_getfield(L, -1, p);
 
 	/*
-	 *	Check the global is a function.
+	 *	Check the field is a function.
 	 */
 	type = lua_type(L, -1);
 	switch (type) {
@@ -639,73 +683,28 @@ static int fr_lua_check_func(rlm_lua_t const *inst, lua_State *L, char const *na
 
 	case LUA_TNIL:
 		ERROR("Function \"%s\" not found ", name);
-		ret = -1;
 		goto done;
 
 	default:
 		ERROR("Value found at index \"%s\" is not a function (is a %s)", name, lua_typename(L, type));
-		ret = -1;
 		goto done;
 	}
+
+	if (ref) *ref = luaL_ref(L, LUA_REGISTRYINDEX);
 	ret = 0;
 done:
 	RLM_LUA_STACK_RESET();
 	return ret;
 }
 
-/** Resolve a path string to a field value in Lua
- *
- * Parses a string in the format
- * @verbatim obj0[.obj1][.objN] @endverbatim, adding all tables it traverses
- * to the stack.
- *
- * All paths are assumed to start at a global, so the first field
- * will be looked up in the global table.
+/** Register the "fr.request" table
  *
+ * This is done once per interpreter.  Attributes are looked up in the
+ * dictionary of the current request when they're accessed, and values
+ * are read from the current request, so nothing needs to be rebuilt
+ * for each call.
  */
-static int fr_lua_get_field(lua_State *L, request_t *request, char const *field)
-{
-	char buff[512];
-	char const *p = field, *q;
-
-	q = strchr(p, '.');
-	if (!q) {	/* No field, just global */
-		lua_getglobal(L, p);
-		if (lua_isnil(L, -1)) {
-		does_not_exist:
-			REMARKER(field, p - field, "Field does not exist");
-			return -1;
-		}
-		return 0;
-	}
-
-	if ((size_t) (q - p) >= sizeof(buff)) {
-	too_long:
-		REDEBUG("Field name too long, expected < %zu, got %zu", q - p, sizeof(buff));
-		return -1;
-	}
-
-	strlcpy(buff, p, (q - p) + 1);
-	lua_getglobal(L, buff);
-	if (lua_isnil(L, -1)) goto does_not_exist;
-	p = q + 1;	/* Skip the '.' */
-
-	while ((q = strchr(p, '.'))) {
-		if ((size_t) (q - p) >= sizeof(buff)) goto too_long;
-
-		strlcpy(buff, p, (q - p) + 1);
-		lua_getfield(L, -1, buff);
-		if (lua_isnil(L, -1)) goto does_not_exist;
-		p = q + 1;
-	}
-
-	lua_getfield(L, -1, p);
-	if (lua_isnil(L, -1)) goto does_not_exist;
-
-	return 0;
-}
-
-static void _lua_fr_request_register(lua_State *L, request_t *request)
+static void fr_lua_request_register(lua_State *L)
 {
 	/* fr = {} */
 	lua_getglobal(L, "fr");
@@ -714,60 +713,54 @@ static void _lua_fr_request_register(lua_State *L, request_t *request)
 	/* fr = { request {} } */
 	lua_newtable(L);
 
-	if (request) {
-		fr_dcursor_t 	cursor;
-
-		/* Attribute list table */
-		fr_pair_list_sort(&request->request_pairs, fr_pair_cmp_by_da);
-		fr_dcursor_init(&cursor, &request->request_pairs);
+	/*
+	 *	Setup the environment
+	 */
+	lua_pushcfunction(L, _lua_list_iterator_init);
+	lua_setfield(L, -2, "pairs");
 
-		/*
-		 *	Setup the environment
-		 */
-		lua_pushlightuserdata(L, &cursor);
-		lua_pushcclosure(L, _lua_list_iterator_init, 1);
-		lua_setfield(L, -2, "pairs");
-
-		lua_newtable(L);		/* Attribute list meta-table */
-		lua_pushinteger(L, PAIR_LIST_REQUEST);
-		lua_pushcclosure(L, _lua_pair_accessor_init, 1);
-		lua_setfield(L, -2, "__index");
-		lua_setmetatable(L, -2);
-	}
+	lua_newtable(L);		/* Attribute list meta-table */
+	lua_newtable(L);		/* Accessor cache */
+	lua_pushcclosure(L, _lua_pair_accessor_init, 1);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, _lua_request_newindex);
+	lua_setfield(L, -2, "__newindex");
+	lua_setmetatable(L, -2);
 
 	lua_setfield(L, -2, "request");
+	lua_pop(L, 1);
 }
 
-unlang_action_t fr_lua_run(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request, char const *funcname)
+unlang_action_t fr_lua_run(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+			   char const *funcname, int funcref)
 {
 	rlm_lua_t const		*inst = talloc_get_type_abort_const(mctx->instance, rlm_lua_t);
 	rlm_lua_thread_t	*thread = talloc_get_type_abort(mctx->thread, rlm_lua_thread_t);
 	lua_State		*L = thread->interpreter;
 	rlm_rcode_t		rcode = RLM_MODULE_OK;
 
+	RLM_LUA_STACK_SET();
+
 	fr_lua_util_set_inst(inst);
 	fr_lua_util_set_request(request);
 
 	ROPTIONAL(RDEBUG2, DEBUG2, "Calling %s() in interpreter %p", funcname, L);
 
-	_lua_fr_request_register(L, request);
-
 	/*
-	 *	Get the function were going to be calling
+	 *	Get the function were going to be calling,
+	 *	resolved when the interpreter was created.
 	 */
-	if (fr_lua_get_field(L, request, funcname) < 0) {
-error:
-		fr_lua_util_set_inst(NULL);
-		fr_lua_util_set_request(NULL);
-
-		RETURN_MODULE_FAIL;
-	}
-
+	lua_rawgeti(L, LUA_REGISTRYINDEX, funcref);
 	if (!lua_isfunction(L, -1)) {
 		int type = lua_type(L, -1);
 
 		ROPTIONAL(RDEBUG2, DEBUG2, "'%s' is not a function, is a %s (%i)", funcname, lua_typename(L, type), type);
-		goto error;
+	error:
+		RLM_LUA_STACK_RESET();
+		fr_lua_util_set_inst(NULL);
+		fr_lua_util_set_request(NULL);
+
+		RETURN_MODULE_FAIL;
 	}
 
 	if (lua_pcall(L, 0, 1, 0) != 0) {
@@ -802,6 +795,7 @@ error:
 	}
 
 done:
+	RLM_LUA_STACK_RESET();
 	fr_lua_util_set_inst(NULL);
 	fr_lua_util_set_request(NULL);
 
@@ -872,15 +866,16 @@ static void fr_lua_rcode_register(lua_State *L, char const *name)
 
 /** Initialise a new Lua/LuaJIT interpreter
  *
- * Creates a new lua_State and verifies all required functions have been loaded correctly.
+ * Creates a new lua_State, verifies all required functions have been loaded correctly,
+ * and stores references to them so they can be called without being looked up again.
  *
- * @param[in] out	Where to write a pointer to the new state.
+ * @param[in] out	Where to write a pointer to the new state, and the function references.
  * @param[in] instance	Current instance of fr_lua, a talloc marker
  *			context will be inserted into the context of instance
  *			to ensure the interpreter is freed when instance data is freed.
  * @return 0 on success else -1.
  */
-int fr_lua_init(lua_State **out, rlm_lua_t const *instance)
+int fr_lua_init(rlm_lua_thread_t *out, rlm_lua_t const *instance)
 {
 	rlm_lua_t const		*inst = talloc_get_type_abort_const(instance, rlm_lua_t);
 	lua_State		*L;
@@ -902,7 +897,7 @@ int fr_lua_init(lua_State **out, rlm_lua_t const *instance)
 		ERROR("Failed loading file: %s", lua_gettop(L) ? lua_tostring(L, -1) : "Unknown error");
 
 	error:
-		*out = NULL;
+		out->interpreter = NULL;
 		fr_lua_util_set_inst(NULL);
 		lua_close(L);
 		return -1;
@@ -937,19 +932,26 @@ int fr_lua_init(lua_State **out, rlm_lua_t const *instance)
 	fr_lua_rcode_register(L, "rcode");
 
 	/*
-	 *	Verify all the functions were provided.
+	 *	Setup "fr.request.{}"
 	 */
-	if (fr_lua_check_func(inst, L, inst->func_authorize)
-	    || fr_lua_check_func(inst, L, inst->func_authenticate)
-	    || fr_lua_check_func(inst, L, inst->func_preacct)
-	    || fr_lua_check_func(inst, L, inst->func_accounting)
-	    || fr_lua_check_func(inst, L, inst->func_post_auth)
-	    || fr_lua_check_func(inst, L, inst->func_instantiate)
-	    || fr_lua_check_func(inst, L, inst->func_detach)
-	    || fr_lua_check_func(inst, L, inst->func_xlat)) {
+	fr_lua_request_register(L);
+
+	/*
+	 *	Verify all the functions were provided, and
+	 *	grab references to the ones we call.
+	 */
+	if (fr_lua_func_ref(inst, L, &out->ref_authorize, inst->func_authorize)
+	    || fr_lua_func_ref(inst, L, &out->ref_authenticate, inst->func_authenticate)
+	    || fr_lua_func_ref(inst, L, &out->ref_preacct, inst->func_preacct)
+	    || fr_lua_func_ref(inst, L, &out->ref_accounting, inst->func_accounting)
+	    || fr_lua_func_ref(inst, L, &out->ref_post_auth, inst->func_post_auth)
+	    || fr_lua_func_ref(inst, L, &out->ref_instantiate, inst->func_instantiate)
+	    || fr_lua_func_ref(inst, L, &out->ref_detach, inst->func_detach)
+	    || fr_lua_func_ref(inst, L, NULL, inst->func_xlat)) {
 	 	goto error;
 	}
 
-	*out = L;
+	fr_lua_util_set_inst(NULL);
+	out->interpreter = L;
 	return 0;
 }
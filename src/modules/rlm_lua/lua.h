@@ -41,7 +41,20 @@ RCSIDH(lua_h, "$Id$")
  *	be used as the instance handle.
  */
 typedef struct {
-	lua_State	*interpreter;		//!< Interpreter used for single threaded mode, and environment tests.
+	lua_State	*interpreter;		//!< Thread specific interpreter.
+
+	int		ref_instantiate;	//!< Registry references to the functions we call.
+	int		ref_detach;		//!< Resolved once when the interpreter is created,
+	int		ref_authorize;		//!< so calls don't need to walk the global table.
+	int		ref_authenticate;
+	int		ref_preacct;
+	int		ref_accounting;
+	int		ref_post_auth;
+} rlm_lua_thread_t;
+
+typedef struct {
+	rlm_lua_thread_t *global;		//!< Interpreter used for instantiate, detach, and
+						//!< environment tests.
 	bool 		threads;		//!< Whether to create new interpreters on a per-instance/per-thread
 						//!< basis, or use a single mutex protected interpreter.
 
@@ -60,13 +73,10 @@ typedef struct {
 	const char	*func_xlat;		//!< Name of function to be called for string expansions.
 } rlm_lua_t;
 
-typedef struct {
-	lua_State	*interpreter;		//!< Thread specific interpreter.
-} rlm_lua_thread_t;
-
 /* lua.c */
-int		fr_lua_init(lua_State **out, rlm_lua_t const *instance);
-unlang_action_t fr_lua_run(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request, char const *funcname);
+int		fr_lua_init(rlm_lua_thread_t *out, rlm_lua_t const *instance);
+unlang_action_t fr_lua_run(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+			   char const *funcname, int funcref);
 bool		fr_lua_isjit(lua_State *L);
 char const	*fr_lua_version(lua_State *L);
 
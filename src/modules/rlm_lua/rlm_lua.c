@@ -60,8 +60,9 @@ static const CONF_PARSER module_config[] = {
 static unlang_action_t mod_##_s(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request) \
 {\
 	rlm_lua_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_lua_t);\
+	rlm_lua_thread_t *thread = talloc_get_type_abort(mctx->thread, rlm_lua_thread_t);\
 	if (!inst->func_##_s) RETURN_MODULE_NOOP;\
-	return fr_lua_run(p_result, mctx, request, inst->func_##_s);\
+	return fr_lua_run(p_result, mctx, request, inst->func_##_s, thread->ref_##_s);\
 }
 
 DO_LUA(authorize)
@@ -101,7 +102,7 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instanc
 {
 	rlm_lua_thread_t *this_thread = thread;
 
-	if (fr_lua_init(&this_thread->interpreter, instance) < 0) return -1;
+	if (fr_lua_init(this_thread, instance) < 0) return -1;
 
 	return 0;
 }
@@ -117,17 +118,15 @@ static int mod_detach(void *instance)
 	/*
 	 *	May be NULL if fr_lua_init failed
 	 */
-	if (inst->interpreter) {
+	if (inst->global && inst->global->interpreter) {
 		if (inst->func_detach) {
 			fr_lua_run(&ret, &(module_ctx_t){
 						.instance = inst,
-						.thread = &(rlm_lua_thread_t){
-							.interpreter = inst->interpreter
-						}
+						.thread = inst->global
 					},
-					NULL, inst->func_detach);
+					NULL, inst->func_detach, inst->global->ref_detach);
 		}
-		lua_close(inst->interpreter);
+		lua_close(inst->global->interpreter);
 	}
 
 	return ret;
@@ -144,20 +143,19 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	/*
 	 *	Get an instance global interpreter to use with various things...
 	 */
-	if (fr_lua_init(&inst->interpreter, inst) < 0) return -1;
-	inst->jit = fr_lua_isjit(inst->interpreter);
+	MEM(inst->global = talloc_zero(inst, rlm_lua_thread_t));
+	if (fr_lua_init(inst->global, inst) < 0) return -1;
+	inst->jit = fr_lua_isjit(inst->global->interpreter);
 	if (!inst->jit) WARN("Using standard Lua interpreter, performance will be suboptimal");
 
-	DEBUG("Using %s interpreter", fr_lua_version(inst->interpreter));
+	DEBUG("Using %s interpreter", fr_lua_version(inst->global->interpreter));
 
 	if (inst->func_instantiate) {
 		fr_lua_run(&rcode, &(module_ctx_t){
 					.instance = inst,
-					.thread = &(rlm_lua_thread_t){
-				   		.interpreter = inst->interpreter
-					}
+					.thread = inst->global
 				    },
-			  NULL, inst->func_instantiate);
+			  NULL, inst->func_instantiate, inst->global->ref_instantiate);
 	}
 
 	return 0;
@@ -77,40 +77,67 @@ static char *wbclient_normalise_username(TALLOC_CTX *ctx, struct wbcContext *wb_
 	return res;
 }
 
-/** Check NTLM authentication direct to winbind via Samba's libwbclient library
+/** Everything needed to authenticate against winbind without touching the request
+ *
+ * Filled in on the worker, and then passed to #wbclient_auth, which may run on
+ * an offload helper thread.
+ */
+struct mschap_wbclient_s {
+	fr_pool_t			*pool;			//!< To get winbind connections from.
+	struct wbcAuthUserParams	authparams;		//!< Request to send to winbind.
+	uint8_t				resp[NT_LENGTH];	//!< NT-Response, pointed to by authparams.
+
+	/*
+	 *	For recalculating the challenge if we retry
+	 *	with a normalised username.
+	 */
+	bool				retry;			//!< Whether to retry with a normalised username.
+	uint8_t				peer_challenge[MSCHAP_PEER_CHALLENGE_LENGTH];
+	uint8_t				auth_challenge[MSCHAP_PEER_AUTHENTICATOR_CHALLENGE_LENGTH];
+
+	/*
+	 *	Results
+	 */
+	bool				no_connection;		//!< Couldn't get a connection from the pool.
+	wbcErr				err;			//!< From wbcCtxAuthenticateUserEx.
+	uint32_t			nt_status;		//!< From the error info, if there was any.
+	char				*display_string;	//!< From the error info, if there was any.
+	char				*normalised_username;	//!< The username we retried with.
+	uint8_t				nthashhash[NT_DIGEST_LENGTH];	//!< On success.
+};
+
+/** Build the winbind authentication parameters
  *
  * @return
- *	- 0 success.
- *	- -1 auth failure.
- *	- -648 password expired.
+ *	- The new context on success.  Has no talloc parent.
+ *	- NULL on failure.
  */
-int do_auth_wbclient(rlm_mschap_t const *inst, request_t *request,
-		     uint8_t const *challenge, uint8_t const *response,
-		     uint8_t nthashhash[NT_DIGEST_LENGTH])
+static mschap_wbclient_t *wbclient_prepare(rlm_mschap_t const *inst, request_t *request,
+					   uint8_t const *challenge, uint8_t const *response)
 {
-	int				ret = -1;
-	struct wbcContext		*wb_ctx = NULL;
+	mschap_wbclient_t		*wbc;
 	struct wbcAuthUserParams	*authparams;
-	wbcErr				err;
 	ssize_t				slen;
-	struct wbcAuthUserInfo		*info = NULL;
-	struct wbcAuthErrorInfo		*error = NULL;
-	uint8_t				resp[NT_LENGTH];
 
 	/*
 	 *	wb_username must be set for this function to be called
 	 */
 	fr_assert(inst->wb_username);
 
-	MEM(authparams = talloc_zero_pooled_object(NULL, struct wbcAuthUserParams, 2, 1024));
+	MEM(wbc = talloc_zero_pooled_object(NULL, mschap_wbclient_t, 3, 1024));
+	wbc->pool = inst->wb_pool;
+	authparams = &wbc->authparams;
+
 	/*
 	 *	Domain first so we don't leave holes in the pool
 	 */
 	if (inst->wb_domain) {
-		slen = tmpl_aexpand(authparams, &authparams->domain_name, request, inst->wb_domain, NULL, NULL);
+		slen = tmpl_aexpand(wbc, &authparams->domain_name, request, inst->wb_domain, NULL, NULL);
 		if (slen < 0) {
 			REDEBUG2("Unable to expand winbind_domain");
-			goto finish;
+		error:
+			talloc_free(wbc);
+			return NULL;
 		}
 	} else {
 		RWDEBUG2("No domain specified; authentication may fail because of this");
@@ -119,10 +146,10 @@ int do_auth_wbclient(rlm_mschap_t const *inst, request_t *request,
 	/*
 	 *	Get the username and domain from the configuration
 	 */
-	slen = tmpl_aexpand(authparams, &authparams->account_name, request, inst->wb_username, NULL, NULL);
+	slen = tmpl_aexpand(wbc, &authparams->account_name, request, inst->wb_username, NULL, NULL);
 	if (slen < 0) {
 		REDEBUG2("Unable to expand winbind_username");
-		goto finish;
+		goto error;
 	}
 
 	/*
@@ -131,8 +158,8 @@ int do_auth_wbclient(rlm_mschap_t const *inst, request_t *request,
 	authparams->level = WBC_AUTH_USER_LEVEL_RESPONSE;
 	authparams->password.response.nt_length = NT_LENGTH;
 
-	memcpy(resp, response, NT_LENGTH);
-	authparams->password.response.nt_data = resp;
+	memcpy(wbc->resp, response, NT_LENGTH);
+	authparams->password.response.nt_data = wbc->resp;
 
 	memcpy(authparams->password.response.challenge, challenge, sizeof(authparams->password.response.challenge));
 
@@ -141,81 +168,136 @@ int do_auth_wbclient(rlm_mschap_t const *inst, request_t *request,
 					WBC_MSV1_0_ALLOW_SERVER_TRUST_ACCOUNT;
 
 	/*
-	 * Send auth request across to winbind
+	 *	Grab what we need to recalculate the challenge now,
+	 *	the retry may happen on a thread which can't look
+	 *	at the request.
 	 */
-	wb_ctx = fr_pool_connection_get(inst->wb_pool, request);
-	if (wb_ctx == NULL) {
-		RERROR("Unable to get winbind connection from pool");
-		goto finish;
+	if (inst->wb_retry_with_normalised_username) {
+		fr_pair_t *vp_challenge, *vp_response;
+
+		vp_challenge = fr_pair_find_by_da(&request->request_pairs, attr_ms_chap_challenge, 0);
+		vp_response = fr_pair_find_by_da(&request->request_pairs, attr_ms_chap2_response, 0);
+		if (!vp_challenge || (vp_challenge->vp_length < sizeof(wbc->auth_challenge))) {
+			RWDEBUG2("Unable to get MS-CHAP-Challenge, won't retry with normalised username");
+		} else if (!vp_response || (vp_response->vp_length < (2 + sizeof(wbc->peer_challenge)))) {
+			RWDEBUG2("Unable to get MS-CHAP2-Response, won't retry with normalised username");
+		} else {
+			memcpy(wbc->auth_challenge, vp_challenge->vp_octets, sizeof(wbc->auth_challenge));
+			memcpy(wbc->peer_challenge, vp_response->vp_octets + 2, sizeof(wbc->peer_challenge));
+			wbc->retry = true;
+		}
 	}
 
 	RDEBUG2("Sending authentication request user \"%pV\" domain \"%pV\"",
 		fr_box_strvalue_buffer(authparams->account_name),
 		fr_box_strvalue_buffer(authparams->domain_name));
 
-	err = wbcCtxAuthenticateUserEx(wb_ctx, authparams, &info, &error);
-	if (err == WBC_ERR_AUTH_ERROR && inst->wb_retry_with_normalised_username) {
-		fr_pair_t 	*vp_response;
-		fr_pair_t	*vp_challenge;
-		fr_pair_t	*vp_chap_user_name;
-		char		*normalised_username = NULL;
+	return wbc;
+}
 
-		normalised_username = wbclient_normalise_username(authparams, wb_ctx, authparams->domain_name,
+/** Send the authentication request to winbind
+ *
+ * Blocks until winbind responds.  Doesn't touch the request, so may be
+ * run on an offload helper thread.
+ *
+ * @param[in] uctx	The #mschap_wbclient_t to authenticate.
+ */
+static void wbclient_auth(void *uctx)
+{
+	mschap_wbclient_t		*wbc = talloc_get_type_abort(uctx, mschap_wbclient_t);
+	struct wbcAuthUserParams	*authparams = &wbc->authparams;
+	struct wbcContext		*wb_ctx;
+	struct wbcAuthUserInfo		*info = NULL;
+	struct wbcAuthErrorInfo		*error = NULL;
+	char				*normalised_username;
+
+	wb_ctx = fr_pool_connection_get(wbc->pool, NULL);
+	if (!wb_ctx) {
+		wbc->no_connection = true;
+		return;
+	}
+
+	wbc->err = wbcCtxAuthenticateUserEx(wb_ctx, authparams, &info, &error);
+	if ((wbc->err == WBC_ERR_AUTH_ERROR) && wbc->retry) {
+		normalised_username = wbclient_normalise_username(wbc, wb_ctx, authparams->domain_name,
 								  authparams->account_name);
 		if (!normalised_username) goto release;
 
-		RDEBUG2("Starting retry, normalised username \"%pV\" -> \"%pV\"",
-			fr_box_strvalue_buffer(authparams->account_name),
-			fr_box_strvalue_buffer(normalised_username));
-
-		if (talloc_memcmp_bstr(authparams->account_name, normalised_username) == 0) goto release;
+		if (talloc_memcmp_bstr(authparams->account_name, normalised_username) == 0) {
+			talloc_free(normalised_username);
+			goto release;
+		}
 
-		talloc_const_free(authparams->account_name);
+		wbc->normalised_username = normalised_username;
 		authparams->account_name = normalised_username;
 
-		/* Set MS-CHAP-USER-NAME */
-		MEM(pair_update_request(&vp_chap_user_name, attr_ms_chap_user_name) >= 0);
-		fr_pair_value_bstrdup_buffer(vp_chap_user_name, normalised_username, true);
-
-		RDEBUG2("Retrying authentication request user \"%pV\" domain \"%pV\"",
-			fr_box_strvalue_buffer(authparams->account_name),
-			fr_box_strvalue_buffer(normalised_username));
-
 		/* Recalculate hash */
-		vp_challenge = fr_pair_find_by_da(&request->request_pairs, attr_ms_chap_challenge, 0);
-		if (!vp_challenge) {
-			RERROR("Unable to get MS-CHAP-Challenge");
-			goto release;
-		}
+		mschap_challenge_hash(authparams->password.response.challenge,
+				      wbc->peer_challenge, wbc->auth_challenge,
+				      normalised_username, talloc_array_length(normalised_username) - 1);
 
-		vp_response = fr_pair_find_by_da(&request->request_pairs, attr_ms_chap2_response, 0);
-		if (!vp_response) {
-			RERROR("Unable to get MS-CHAP2-Response");
-			goto release;
-		}
+		if (info) wbcFreeMemory(info);
+		if (error) wbcFreeMemory(error);
+		info = NULL;
+		error = NULL;
 
-		mschap_challenge_hash(authparams->password.response.challenge,
-				      vp_response->vp_octets + 2,
-				      vp_challenge->vp_octets,
-				      vp_chap_user_name->vp_strvalue, vp_chap_user_name->vp_length);
+		wbc->err = wbcCtxAuthenticateUserEx(wb_ctx, authparams, &info, &error);
+	}
 
-		err = wbcCtxAuthenticateUserEx(wb_ctx, authparams, &info, &error);
 release:
-		talloc_free(normalised_username);
+	fr_pool_connection_release(wbc->pool, NULL, wb_ctx);
+
+	/* Grab the nthashhash from the result */
+	if ((wbc->err == WBC_ERR_SUCCESS) && info) memcpy(wbc->nthashhash, info->user_session_key, NT_DIGEST_LENGTH);
+
+	if (error) {
+		wbc->nt_status = error->nt_status;
+		if (error->display_string) MEM(wbc->display_string = talloc_strdup(wbc, error->display_string));
+	}
+
+	if (info) wbcFreeMemory(info);
+	if (error) wbcFreeMemory(error);
+}
+
+/** Log the result of a winbind authentication, and convert it to an MSCHAP result
+ *
+ * Also used to retrieve the result of an offloaded authentication, after
+ * which the offload job should be freed.
+ *
+ * @return
+ *	- 0 success.
+ *	- -1 auth failure.
+ *	- -648 password expired.
+ */
+int do_auth_wbclient_result(request_t *request, mschap_wbclient_t *wbc, uint8_t nthashhash[NT_DIGEST_LENGTH])
+{
+	int ret = -1;
+
+	if (wbc->no_connection) {
+		RERROR("Unable to get winbind connection from pool");
+		return -1;
 	}
 
-	fr_pool_connection_release(inst->wb_pool, request, wb_ctx);
+	if (wbc->normalised_username) {
+		fr_pair_t	*vp_chap_user_name;
+
+		RDEBUG2("Retried authentication with normalised username \"%pV\"",
+			fr_box_strvalue_buffer(wbc->normalised_username));
+
+		/* Set MS-CHAP-USER-NAME */
+		MEM(pair_update_request(&vp_chap_user_name, attr_ms_chap_user_name) >= 0);
+		fr_pair_value_bstrdup_buffer(vp_chap_user_name, wbc->normalised_username, true);
+	}
 
 	/*
 	 * Try and give some useful feedback on what happened. There are only
 	 * a few errors that can actually be returned from wbcCtxAuthenticateUserEx.
 	 */
-	switch (err) {
+	switch (wbc->err) {
 	case WBC_ERR_SUCCESS:
 		ret = 0;
 		RDEBUG2("Authenticated successfully");
-		/* Grab the nthashhash from the result */
-		memcpy(nthashhash, info->user_session_key, NT_DIGEST_LENGTH);
+		memcpy(nthashhash, wbc->nthashhash, NT_DIGEST_LENGTH);
 		break;
 
 	case WBC_ERR_WINBIND_NOT_AVAILABLE:
@@ -229,7 +311,7 @@ release:
 		break;
 
 	case WBC_ERR_AUTH_ERROR:
-		if (!error) {
+		if (!wbc->nt_status && !wbc->display_string) {
 			REDEBUG2("Authentication failed");
 			break;
 		}
@@ -237,18 +319,18 @@ release:
 		/*
 		 * The password needs to be changed, so set ret appropriately.
 		 */
-		if (error->nt_status == NT_STATUS_PASSWORD_EXPIRED ||
-		    error->nt_status == NT_STATUS_PASSWORD_MUST_CHANGE) {
+		if (wbc->nt_status == NT_STATUS_PASSWORD_EXPIRED ||
+		    wbc->nt_status == NT_STATUS_PASSWORD_MUST_CHANGE) {
 			ret = -648;
 		}
 
 		/*
 		 * Return the NT_STATUS human readable error string, if there is one.
 		 */
-		if (error->display_string) {
-			REDEBUG2("%s [0x%X]", error->display_string, error->nt_status);
+		if (wbc->display_string) {
+			REDEBUG2("%s [0x%X]", wbc->display_string, wbc->nt_status);
 		} else {
-			REDEBUG2("Authentication failed [0x%X]", error->nt_status);
+			REDEBUG2("Authentication failed [0x%X]", wbc->nt_status);
 		}
 		break;
 
@@ -259,19 +341,81 @@ release:
 		 *   WBC_ERR_NO_MEMORY
 		 * neither of which are particularly likely.
 		 */
-		if (error && error->display_string) {
-			REDEBUG2("libwbclient error: wbcErr %d (%s)", err, error->display_string);
+		if (wbc->display_string) {
+			REDEBUG2("libwbclient error: wbcErr %d (%s)", wbc->err, wbc->display_string);
 		} else {
-			REDEBUG2("libwbclient error: wbcErr %d", err);
+			REDEBUG2("libwbclient error: wbcErr %d", wbc->err);
 		}
 		break;
 	}
 
-finish:
-	talloc_free(authparams);
-	if (info) wbcFreeMemory(info);
-	if (error) wbcFreeMemory(error);
+	return ret;
+}
+
+/** Check NTLM authentication direct to winbind via Samba's libwbclient library
+ *
+ * @return
+ *	- 0 success.
+ *	- -1 auth failure.
+ *	- -648 password expired.
+ */
+int do_auth_wbclient(rlm_mschap_t const *inst, request_t *request,
+		     uint8_t const *challenge, uint8_t const *response,
+		     uint8_t nthashhash[NT_DIGEST_LENGTH])
+{
+	mschap_wbclient_t	*wbc;
+	int			ret;
+
+	wbc = wbclient_prepare(inst, request, challenge, response);
+	if (!wbc) return -1;
+
+	wbclient_auth(wbc);
+	ret = do_auth_wbclient_result(request, wbc, nthashhash);
+	talloc_free(wbc);
 
 	return ret;
 }
 
+/** Queue NTLM authentication to winbind on one of the offload helper threads
+ *
+ * The username and domain are expanded here, on the worker.  The helper
+ * thread calls wbcCtxAuthenticateUserEx(), and if that fails and
+ * wb_retry_with_normalised_username is set, retries with the username
+ * winbind normalises it to.  See #fr_offload_push for
+ * when the request is resumed, and how the job must be freed.
+ * #do_auth_wbclient_result then converts winbind's answer into an MS-CHAP
+ * result.
+ *
+ * @param[out] job_out	The offload job.  Must be passed to #fr_offload_cancel
+ *			if the request is cancelled.
+ * @param[out] wbc_out	Authentication context to pass to #do_auth_wbclient_result.
+ * @param[in] inst	of rlm_mschap.
+ * @param[in] request	The current request.
+ * @param[in] challenge	MS-CHAP challenge.
+ * @param[in] response	NT-Response.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int do_auth_wbclient_push(fr_offload_job_t **job_out, mschap_wbclient_t **wbc_out,
+			  rlm_mschap_t const *inst, request_t *request,
+			  uint8_t const *challenge, uint8_t const *response)
+{
+	mschap_wbclient_t	*wbc;
+	fr_offload_job_t	*job;
+
+	wbc = wbclient_prepare(inst, request, challenge, response);
+	if (!wbc) return -1;
+
+	job = fr_offload_push(inst->wb_offload, request, wbclient_auth, wbc);
+	if (!job) {
+		RPERROR("Failed queueing winbind authentication");
+		talloc_free(wbc);
+		return -1;
+	}
+
+	*job_out = job;
+	*wbc_out = wbc;
+
+	return 0;
+}
@@ -2,6 +2,16 @@
 /* @copyright 2015 The FreeRADIUS server project */
 RCSIDH(auth_wbclient_h, "$Id$")
 
+#include <freeradius-devel/server/offload.h>
+
+typedef struct mschap_wbclient_s mschap_wbclient_t;
+
 int do_auth_wbclient(rlm_mschap_t const *inst, request_t *request,
 		     uint8_t const *challenge, uint8_t const *response,
 		     uint8_t nthashhash[NT_DIGEST_LENGTH]);
+
+int do_auth_wbclient_push(fr_offload_job_t **job_out, mschap_wbclient_t **wbc_out,
+			  rlm_mschap_t const *inst, request_t *request,
+			  uint8_t const *challenge, uint8_t const *response);
+
+int do_auth_wbclient_result(request_t *request, mschap_wbclient_t *wbc, uint8_t nthashhash[NT_DIGEST_LENGTH]);
@@ -0,0 +1,582 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file ntlm_helper.c
+ * @brief NTLM authentication via persistent ntlm_auth helper processes
+ *
+ * Rather than running ntlm_auth once per authentication, each worker
+ * thread keeps a small pool of `ntlm_auth --helper-protocol=ntlm-server-1`
+ * processes.  Requests are written to an idle helper's stdin, and the
+ * response is read from its stdout by the worker's event loop, so the
+ * worker carries on processing other requests in the meantime.
+ *
+ * The ntlm-server-1 protocol is a series of "Key: value" lines, or
+ * "Key:: base64" lines, terminated by a line containing a single ".".
+ * A helper handles one request at a time.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/exec.h>
+#include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/util/base16.h>
+#include <freeradius-devel/util/base64.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <sys/wait.h>
+#include <signal.h>
+
+#include "rlm_mschap.h"
+#include "mschap.h"
+#include "ntlm_helper.h"
+
+#define NTLM_HELPER_BUFFER_SIZE 4096
+
+typedef struct {
+	ntlm_helper_pool_t	*pool;			//!< The pool this helper belongs to.
+
+	pid_t			pid;			//!< Of the helper process, or -1 if it's not running.
+	int			stdin_fd;		//!< For writing requests.
+	int			stdout_fd;		//!< For reading responses.
+
+	bool			busy;			//!< Waiting for a response.
+	ntlm_helper_request_t	*current;		//!< The request the response is for.  NULL if the
+							///< request went away, and the response should be discarded.
+	fr_event_timer_t const	*ev;			//!< For timing out the response.
+
+	char			buffer[NTLM_HELPER_BUFFER_SIZE];	//!< Partial response.
+	size_t			used;			//!< How much of the buffer is used.
+} ntlm_helper_t;
+
+struct ntlm_helper_pool_s {
+	rlm_mschap_t const	*inst;			//!< Module instance.
+	fr_event_list_t		*el;			//!< The worker's event list.
+
+	ntlm_helper_t		*helpers;		//!< Array of helpers.
+	uint32_t		num_helpers;		//!< How many helpers there are.
+
+	fr_dlist_head_t		queue;			//!< Requests waiting for an idle helper.
+};
+
+struct ntlm_helper_request_s {
+	fr_dlist_t		entry;			//!< Entry in the queue.
+	ntlm_helper_pool_t	*pool;			//!< The pool this request was pushed to.
+	ntlm_helper_t		*helper;		//!< The helper processing this request.
+	request_t		*request;		//!< To mark runnable when we have a response.
+
+	char			*query;			//!< To write to the helper.
+	size_t			query_len;		//!< Length of query.
+
+	bool			done;			//!< We have a response, or an error.
+	bool			authenticated;		//!< "Authenticated: Yes".
+	bool			have_key;		//!< Whether nthashhash is valid.
+	uint8_t			nthashhash[NT_DIGEST_LENGTH];	//!< From User-Session-Key.
+	char			*error;			//!< Authentication-Error, or our own error.
+};
+
+static void ntlm_helper_dispatch(ntlm_helper_pool_t *pool);
+
+/** Stop a helper process, making sure it doesn't linger
+ *
+ */
+static void ntlm_helper_stop(ntlm_helper_t *helper)
+{
+	fr_event_list_t *el = helper->pool->el;
+
+	if (helper->ev) fr_event_timer_delete(&helper->ev);
+
+	if (helper->stdout_fd >= 0) {
+		(void) fr_event_fd_delete(el, helper->stdout_fd, FR_EVENT_FILTER_IO);
+		close(helper->stdout_fd);
+		helper->stdout_fd = -1;
+	}
+
+	if (helper->stdin_fd >= 0) {
+		close(helper->stdin_fd);
+		helper->stdin_fd = -1;
+	}
+
+	if (helper->pid > 0) {
+		kill(helper->pid, SIGKILL);
+		while ((waitpid(helper->pid, NULL, 0) < 0) && (errno == EINTR));
+		helper->pid = -1;
+	}
+
+	helper->busy = false;
+	helper->used = 0;
+}
+
+/** Complete the current request on a helper
+ *
+ */
+static void ntlm_helper_request_done(ntlm_helper_t *helper)
+{
+	ntlm_helper_request_t *hreq = helper->current;
+
+	if (helper->ev) fr_event_timer_delete(&helper->ev);
+
+	helper->current = NULL;
+	helper->busy = false;
+	helper->used = 0;
+
+	if (!hreq) return;
+
+	hreq->helper = NULL;
+	hreq->done = true;
+	unlang_interpret_mark_runnable(hreq->request);
+}
+
+/** Something went wrong talking to a helper, kill it, and fail the request
+ *
+ */
+static void ntlm_helper_fail(ntlm_helper_t *helper, char const *error)
+{
+	ntlm_helper_request_t *hreq = helper->current;
+
+	if (hreq) MEM(hreq->error = talloc_strdup(hreq, error));
+
+	ntlm_helper_stop(helper);
+	ntlm_helper_request_done(helper);
+}
+
+/** Parse a complete response from the helper
+ *
+ * @param[in] hreq	to write the results to.  May be NULL if the
+ *			request went away.
+ * @param[in] buffer	containing the response, without the
+ *			terminating ".\n".
+ */
+static void ntlm_helper_parse(ntlm_helper_request_t *hreq, char *buffer)
+{
+	char	*line, *next, *value;
+	size_t	len;
+
+	if (!hreq) return;
+
+	for (line = buffer; *line; line = next) {
+		next = strchr(line, '\n');
+		if (next) {
+			*next++ = '\0';
+		} else {
+			next = line + strlen(line);
+		}
+
+		value = strchr(line, ':');
+		if (!value) continue;
+		*value++ = '\0';
+		if (*value == ':') value++;	/* We never ask for anything we'd expect base64 for */
+		while (*value == ' ') value++;
+		len = strlen(value);
+
+		if (strcasecmp(line, "Authenticated") == 0) {
+			hreq->authenticated = (strcasecmp(value, "Yes") == 0);
+
+		} else if (strcasecmp(line, "User-Session-Key") == 0) {
+			hreq->have_key = (fr_base16_decode(NULL, &FR_DBUFF_TMP(hreq->nthashhash, NT_DIGEST_LENGTH),
+							   &FR_SBUFF_IN(value, len), false) == NT_DIGEST_LENGTH);
+
+		} else if ((strcasecmp(line, "Authentication-Error") == 0) ||
+			   (strcasecmp(line, "Error") == 0)) {
+			talloc_free(hreq->error);
+			MEM(hreq->error = talloc_bstrndup(hreq, value, len));
+		}
+	}
+}
+
+/** Read a response from a helper
+ *
+ */
+static void ntlm_helper_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	ntlm_helper_t	*helper = uctx;
+	ssize_t		slen;
+	char		*end;
+
+	for (;;) {
+		if (helper->used >= (sizeof(helper->buffer) - 1)) {
+			ntlm_helper_fail(helper, "Response from ntlm_auth helper too long");
+			goto dispatch;
+		}
+
+		slen = read(fd, helper->buffer + helper->used, sizeof(helper->buffer) - 1 - helper->used);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+
+			ntlm_helper_fail(helper, fr_syserror(errno));
+			goto dispatch;
+		}
+
+		if (slen == 0) {
+			ntlm_helper_fail(helper, "ntlm_auth helper exited");
+			goto dispatch;
+		}
+
+		helper->used += slen;
+		helper->buffer[helper->used] = '\0';
+
+		/*
+		 *	An idle helper shouldn't be saying anything.
+		 */
+		if (!helper->busy) {
+			ntlm_helper_fail(helper, "Unexpected output from ntlm_auth helper");
+			goto dispatch;
+		}
+
+		/*
+		 *	Responses are terminated by a line
+		 *	containing a single ".".
+		 */
+		if (strncmp(helper->buffer, ".\n", 2) == 0) {
+			end = helper->buffer;
+		} else {
+			end = strstr(helper->buffer, "\n.\n");
+			if (!end) continue;
+			end++;
+		}
+
+		/*
+		 *	Anything after the terminator means the
+		 *	helper has lost the plot.
+		 */
+		if ((size_t)((end + 2) - helper->buffer) != helper->used) {
+			ntlm_helper_fail(helper, "Unexpected output from ntlm_auth helper");
+			goto dispatch;
+		}
+
+		*end = '\0';
+		ntlm_helper_parse(helper->current, helper->buffer);
+		ntlm_helper_request_done(helper);
+		break;
+	}
+
+dispatch:
+	ntlm_helper_dispatch(helper->pool);
+}
+
+/** Helper didn't respond in time
+ *
+ */
+static void ntlm_helper_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	ntlm_helper_t *helper = uctx;
+
+	ntlm_helper_fail(helper, "Timeout waiting for ntlm_auth helper");
+	ntlm_helper_dispatch(helper->pool);
+}
+
+/** Start a helper process
+ *
+ * @param[in] helper	to start.
+ * @param[in] request	which caused the helper to be started.  Only used
+ *			for logging, the helper outlives it.
+ */
+static int ntlm_helper_start(ntlm_helper_t *helper, request_t *request)
+{
+	ntlm_helper_pool_t *pool = helper->pool;
+
+	helper->pid = radius_start_program(&helper->stdin_fd, &helper->stdout_fd, NULL,
+					   pool->inst->ntlm_helper, request, true, NULL, false);
+	if (helper->pid < 0) {
+		helper->pid = -1;
+		helper->stdin_fd = helper->stdout_fd = -1;
+		REDEBUG("Failed starting ntlm_auth helper");
+		return -1;
+	}
+
+	if ((fr_nonblock(helper->stdin_fd) < 0) || (fr_nonblock(helper->stdout_fd) < 0)) {
+		RERROR("Failed setting ntlm_auth helper pipes to non-blocking: %s", fr_syserror(errno));
+	error:
+		ntlm_helper_stop(helper);
+		return -1;
+	}
+
+	if (fr_event_fd_insert(pool, pool->el, helper->stdout_fd, ntlm_helper_read, NULL, NULL, helper) < 0) {
+		RPERROR("Failed listening to ntlm_auth helper");
+		goto error;
+	}
+
+	RDEBUG2("Started ntlm_auth helper, pid %u", (unsigned int) helper->pid);
+
+	return 0;
+}
+
+/** Send queued requests to idle helpers
+ *
+ */
+static void ntlm_helper_dispatch(ntlm_helper_pool_t *pool)
+{
+	ntlm_helper_request_t	*hreq;
+	ntlm_helper_t		*helper;
+	request_t		*request;
+	uint32_t		i;
+	ssize_t			slen;
+
+	while ((hreq = fr_dlist_head(&pool->queue))) {
+		helper = NULL;
+		for (i = 0; i < pool->num_helpers; i++) {
+			if (!pool->helpers[i].busy) {
+				helper = &pool->helpers[i];
+				break;
+			}
+		}
+		if (!helper) return;
+
+		fr_dlist_remove(&pool->queue, hreq);
+		request = hreq->request;
+
+		if ((helper->pid < 0) && (ntlm_helper_start(helper, request) < 0)) {
+			MEM(hreq->error = talloc_strdup(hreq, "Failed starting ntlm_auth helper"));
+			hreq->done = true;
+			unlang_interpret_mark_runnable(request);
+			continue;
+		}
+
+		helper->busy = true;
+		helper->current = hreq;
+		helper->used = 0;
+		hreq->helper = helper;
+
+		/*
+		 *	The helper is idle, so there's nothing
+		 *	else in the pipe, and the whole query
+		 *	will fit.
+		 */
+		while (((slen = write(helper->stdin_fd, hreq->query, hreq->query_len)) < 0) && (errno == EINTR));
+		if (slen != (ssize_t)hreq->query_len) {
+			ntlm_helper_fail(helper, "Failed writing to ntlm_auth helper");
+			continue;
+		}
+
+		if (fr_event_timer_in(pool, pool->el, &helper->ev, pool->inst->ntlm_auth_timeout,
+				      ntlm_helper_timeout, helper) < 0) {
+			ntlm_helper_fail(helper, "Failed inserting ntlm_auth helper timeout");
+			continue;
+		}
+
+		RDEBUG2("Sent authentication request to ntlm_auth helper, pid %u", (unsigned int) helper->pid);
+	}
+}
+
+static int _ntlm_helper_pool_free(ntlm_helper_pool_t *pool)
+{
+	uint32_t i;
+
+	for (i = 0; i < pool->num_helpers; i++) ntlm_helper_stop(&pool->helpers[i]);
+
+	return 0;
+}
+
+/** Allocate a per-thread pool of ntlm_auth helpers
+ *
+ * Helpers are started on demand, the first time they're needed.
+ *
+ * @param[in] ctx	to allocate the pool in.
+ * @param[in] inst	of rlm_mschap.
+ * @param[in] el	The worker's event list.
+ * @return the new pool.
+ */
+ntlm_helper_pool_t *ntlm_helper_pool_alloc(TALLOC_CTX *ctx, rlm_mschap_t const *inst, fr_event_list_t *el)
+{
+	ntlm_helper_pool_t	*pool;
+	uint32_t		i;
+
+	MEM(pool = talloc_zero(ctx, ntlm_helper_pool_t));
+	pool->inst = inst;
+	pool->el = el;
+	pool->num_helpers = inst->ntlm_helper_processes;
+	MEM(pool->helpers = talloc_zero_array(pool, ntlm_helper_t, pool->num_helpers));
+	for (i = 0; i < pool->num_helpers; i++) {
+		pool->helpers[i].pool = pool;
+		pool->helpers[i].pid = -1;
+		pool->helpers[i].stdin_fd = -1;
+		pool->helpers[i].stdout_fd = -1;
+	}
+	fr_dlist_init(&pool->queue, ntlm_helper_request_t, entry);
+	talloc_set_destructor(pool, _ntlm_helper_pool_free);
+
+	return pool;
+}
+
+/** Detach a request from the pool if it goes away before the helper responds
+ *
+ */
+static int _ntlm_helper_request_free(ntlm_helper_request_t *hreq)
+{
+	if (hreq->done) return 0;
+
+	if (hreq->helper) {
+		hreq->helper->current = NULL;	/* Response will be discarded */
+	} else {
+		fr_dlist_remove(&hreq->pool->queue, hreq);
+	}
+
+	return 0;
+}
+
+/** Add a "Key:: base64" line to the query
+ *
+ */
+static int ntlm_helper_query_b64(fr_sbuff_t *sbuff, char const *key, char const *value, size_t len)
+{
+	if ((fr_sbuff_in_sprintf(sbuff, "%s:: ", key) <= 0) ||
+	    (fr_base64_encode(sbuff, &FR_DBUFF_TMP((uint8_t const *)value, len), true) < 0) ||
+	    (fr_sbuff_in_char(sbuff, '\n') <= 0)) return -1;
+
+	return 0;
+}
+
+/** Queue an NTLM authentication to a helper
+ *
+ * Expands the username and domain, and builds an ntlm_auth
+ * `--helper-protocol=ntlm-server-1` query from them and the challenge and
+ * response.  The query is written to the first idle helper, starting one
+ * if necessary, or queued until a helper becomes idle.
+ *
+ * The request is marked runnable once the helper has answered, or if it
+ * couldn't be started.  #ntlm_helper_result then converts the answer into
+ * an MS-CHAP result.
+ *
+ * @param[in] ctx	to allocate the helper request in.  If it's freed
+ *			before the helper responds, the response is discarded.
+ * @param[in] pool	this thread's helper pool.
+ * @param[in] request	The current request.
+ * @param[in] challenge	8 byte MS-CHAP challenge.
+ * @param[in] response	24 byte NT-Response.
+ * @return
+ *	- The helper request on success.
+ *	- NULL on failure.
+ */
+ntlm_helper_request_t *ntlm_helper_push(TALLOC_CTX *ctx, ntlm_helper_pool_t *pool, request_t *request,
+					uint8_t const *challenge, uint8_t const *response)
+{
+	rlm_mschap_t const	*inst = pool->inst;
+	ntlm_helper_request_t	*hreq;
+	char			*username = NULL, *domain = NULL;
+	char			buffer[1024];
+	fr_sbuff_t		sbuff = FR_SBUFF_OUT(buffer, sizeof(buffer));
+
+	MEM(hreq = talloc_zero(ctx, ntlm_helper_request_t));
+	hreq->pool = pool;
+	hreq->request = request;
+
+	if (tmpl_aexpand(hreq, &username, request, inst->ntlm_helper_username, NULL, NULL) < 0) {
+		REDEBUG2("Unable to expand ntlm_auth_helper username");
+	error:
+		talloc_free(hreq);
+		return NULL;
+	}
+
+	if (inst->ntlm_helper_domain &&
+	    (tmpl_aexpand(hreq, &domain, request, inst->ntlm_helper_domain, NULL, NULL) < 0)) {
+		REDEBUG2("Unable to expand ntlm_auth_helper domain");
+		goto error;
+	}
+
+	/*
+	 *	Usernames and domains are base64 encoded, so
+	 *	they can't inject lines into the query.
+	 */
+	if ((ntlm_helper_query_b64(&sbuff, "Username", username, talloc_array_length(username) - 1) < 0) ||
+	    (domain && (ntlm_helper_query_b64(&sbuff, "NT-Domain", domain, talloc_array_length(domain) - 1) < 0)) ||
+	    (fr_sbuff_in_strcpy_literal(&sbuff, "LANMAN-Challenge: ") <= 0) ||
+	    (fr_base16_encode(&sbuff, &FR_DBUFF_TMP(challenge, MSCHAP_CHALLENGE_LENGTH)) < 0) ||
+	    (fr_sbuff_in_strcpy_literal(&sbuff, "\nNT-Response: ") <= 0) ||
+	    (fr_base16_encode(&sbuff, &FR_DBUFF_TMP(response, 24)) < 0) ||
+	    (fr_sbuff_in_strcpy_literal(&sbuff, "\nRequest-User-Session-Key: Yes\n.\n") <= 0)) {
+		REDEBUG("ntlm_auth helper request too long");
+		goto error;
+	}
+
+	RDEBUG2("Queueing authentication request for user \"%pV\" domain \"%pV\" to ntlm_auth helper",
+		fr_box_strvalue_buffer(username), fr_box_strvalue_buffer(domain));
+
+	MEM(hreq->query = talloc_bstrndup(hreq, buffer, fr_sbuff_used(&sbuff)));
+	hreq->query_len = fr_sbuff_used(&sbuff);
+	talloc_free(username);
+	talloc_free(domain);
+
+	fr_dlist_insert_tail(&pool->queue, hreq);
+	talloc_set_destructor(hreq, _ntlm_helper_request_free);
+
+	ntlm_helper_dispatch(pool);
+
+	return hreq;
+}
+
+/** Convert the response from the helper to an MSCHAP result
+ *
+ * @note The helper request should be freed after this is called.
+ *
+ * @return
+ *	- 0 success.
+ *	- -1 auth failure.
+ *	- -2 no logon servers.
+ *	- -647 account locked out.
+ *	- -648 password expired.
+ *	- -691 account disabled.
+ */
+int ntlm_helper_result(request_t *request, ntlm_helper_request_t *hreq, uint8_t nthashhash[NT_DIGEST_LENGTH])
+{
+	char const *error = hreq->error;
+
+	fr_assert(hreq->done);
+
+	if (hreq->authenticated) {
+		if (!hreq->have_key) {
+			REDEBUG("Invalid output from ntlm_auth helper: missing or bad User-Session-Key");
+			return -1;
+		}
+
+		RDEBUG2("Authenticated successfully");
+		memcpy(nthashhash, hreq->nthashhash, NT_DIGEST_LENGTH);
+		return 0;
+	}
+
+	if (!error) {
+		REDEBUG2("Authentication failed");
+		return -1;
+	}
+
+	REDEBUG2("%s", error);
+
+	/*
+	 *	Samba prints NT_STATUS_* names, and sometimes
+	 *	the numeric code.  Match either.
+	 */
+	if (strcasestr(error, "NT_STATUS_PASSWORD_EXPIRED") ||
+	    strcasestr(error, "NT_STATUS_PASSWORD_MUST_CHANGE") ||
+	    strcasestr(error, "0xC0000071") ||
+	    strcasestr(error, "0xC0000224")) return -648;
+
+	if (strcasestr(error, "NT_STATUS_ACCOUNT_LOCKED_OUT") ||
+	    strcasestr(error, "0xC0000234")) return -647;
+
+	if (strcasestr(error, "NT_STATUS_ACCOUNT_DISABLED") ||
+	    strcasestr(error, "0xC0000072")) return -691;
+
+	if (strcasestr(error, "NT_STATUS_NO_LOGON_SERVERS") ||
+	    strcasestr(error, "0xC000005E")) return -2;
+
+	return -1;
+}
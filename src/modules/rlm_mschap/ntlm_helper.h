@@ -0,0 +1,15 @@
+#pragma once
+/* @copyright 2021 The FreeRADIUS server project */
+RCSIDH(ntlm_helper_h, "$Id$")
+
+#include <freeradius-devel/util/event.h>
+
+typedef struct ntlm_helper_request_s ntlm_helper_request_t;
+
+ntlm_helper_pool_t	*ntlm_helper_pool_alloc(TALLOC_CTX *ctx, rlm_mschap_t const *inst, fr_event_list_t *el);
+
+ntlm_helper_request_t	*ntlm_helper_push(TALLOC_CTX *ctx, ntlm_helper_pool_t *pool, request_t *request,
+					  uint8_t const *challenge, uint8_t const *response);
+
+int			ntlm_helper_result(request_t *request, ntlm_helper_request_t *hreq,
+					   uint8_t nthashhash[NT_DIGEST_LENGTH]);
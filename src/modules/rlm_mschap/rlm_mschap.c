@@ -31,6 +31,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/password.h>
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/radius/defs.h>
 
@@ -46,6 +47,7 @@ RCSID("$Id$")
 #include "rlm_mschap.h"
 #include "mschap.h"
 #include "smbdes.h"
+#include "ntlm_helper.h"
 
 #ifdef WITH_AUTH_WINBIND
 #include "auth_wbclient.h"
@@ -82,11 +84,20 @@ static const CONF_PARSER passchange_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const CONF_PARSER ntlm_helper_config[] = {
+	{ FR_CONF_OFFSET("program", FR_TYPE_STRING, rlm_mschap_t, ntlm_helper) },
+	{ FR_CONF_OFFSET("username", FR_TYPE_TMPL, rlm_mschap_t, ntlm_helper_username) },
+	{ FR_CONF_OFFSET("domain", FR_TYPE_TMPL, rlm_mschap_t, ntlm_helper_domain) },
+	{ FR_CONF_OFFSET("processes", FR_TYPE_UINT32, rlm_mschap_t, ntlm_helper_processes), .dflt = "2" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER winbind_config[] = {
 	{ FR_CONF_OFFSET("username", FR_TYPE_TMPL, rlm_mschap_t, wb_username) },
 	{ FR_CONF_OFFSET("domain", FR_TYPE_TMPL, rlm_mschap_t, wb_domain) },
 #ifdef WITH_AUTH_WINBIND
 	{ FR_CONF_OFFSET("retry_with_normalised_username", FR_TYPE_BOOL, rlm_mschap_t, wb_retry_with_normalised_username), .dflt = "no" },
+	{ FR_CONF_OFFSET("threads", FR_TYPE_UINT32, rlm_mschap_t, wb_threads), .dflt = "0" },
 #endif
 	CONF_PARSER_TERMINATOR
 };
@@ -103,6 +114,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("with_ntdomain_hack", FR_TYPE_BOOL, rlm_mschap_t, with_ntdomain_hack), .dflt = "yes" },
 	{ FR_CONF_OFFSET("ntlm_auth", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_mschap_t, ntlm_auth) },
 	{ FR_CONF_OFFSET("ntlm_auth_timeout", FR_TYPE_TIME_DELTA, rlm_mschap_t, ntlm_auth_timeout) },
+	{ FR_CONF_POINTER("ntlm_auth_helper", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) ntlm_helper_config },
 
 	{ FR_CONF_POINTER("passchange", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) passchange_config },
 	{ FR_CONF_OFFSET("allow_retry", FR_TYPE_BOOL, rlm_mschap_t, allow_retry), .dflt = "yes" },
@@ -1774,21 +1786,272 @@ static unlang_action_t CC_HINT(nonnull) mschap_process_cpw_request(rlm_rcode_t *
 	RETURN_MODULE_OK;
 }
 
-static CC_HINT(nonnull(1,2,3,4,5,8,9)) unlang_action_t mschap_process_response(rlm_rcode_t *p_result,
-									       int *mschap_version,
-									       uint8_t nthashhash[static NT_DIGEST_LENGTH],
-									       rlm_mschap_t const *inst,
-									       request_t *request,
-									       fr_pair_t *smb_ctrl,
-									       fr_pair_t *nt_password,
-									       fr_pair_t *challenge,
-									       fr_pair_t *response,
-									       MSCHAP_AUTH_METHOD method)
+/** State needed to finish MS-CHAP authentication
+ *
+ * Lives on the stack of mod_authenticate, unless we yield waiting
+ * for an offloaded winbind call, or an ntlm_auth helper, in which
+ * case it's copied to the heap.
+ */
+typedef struct {
+	rlm_mschap_t const	*inst;			//!< Module instance.
+	rlm_mschap_thread_t	*t;			//!< Thread instance.
+	MSCHAP_AUTH_METHOD	method;			//!< How we're authenticating the user.
+	int			mschap_version;		//!< 1 or 2.
+
+	fr_pair_t		*smb_ctrl;		//!< SMB-Account-Ctrl.
+	fr_pair_t		*nt_password;		//!< Known good NT-Password, may be NULL.
+	bool			ephemeral;		//!< Whether we created nt_password, and must free it.
+	fr_pair_t		*challenge;		//!< MS-CHAP-Challenge.
+	fr_pair_t		*response;		//!< MS-CHAP-Response or MS-CHAP2-Response.
+
+	char const		*username_str;		//!< MS-CHAPv2 username, without the domain.
+	size_t			username_len;		//!< Length of username_str.
+	uint8_t const		*peer_challenge;	//!< MS-CHAPv2 peer challenge.
+
+	uint8_t			nthashhash[NT_DIGEST_LENGTH];	//!< For generating the MPPE keys.
+
+#ifdef WITH_AUTH_WINBIND
+	fr_offload_job_t	*job;			//!< Offloaded winbind authentication.
+	mschap_wbclient_t	*wbc;			//!< Winbind authentication context, owned by job.
+#endif
+	ntlm_helper_request_t	*hreq;			//!< Outstanding ntlm_auth helper request.
+} mschap_auth_ctx_t;
+
+/** Check the result of authentication, and add the MS-CHAP2-Success and MPPE keys
+ *
+ */
+static unlang_action_t CC_HINT(nonnull) mschap_auth_finish(rlm_rcode_t *p_result, request_t *request,
+							   mschap_auth_ctx_t *auth_ctx, int mschap_result)
 {
-	int			offset;
-	rlm_rcode_t		mschap_result;
+	rlm_mschap_t const	*inst = auth_ctx->inst;
+	fr_pair_t		*response = auth_ctx->response;
+	rlm_rcode_t		rcode;
+
+	/*
+	 *	Check for errors, and add MSCHAP-Error if necessary.
+	 */
+	mschap_error(&rcode, inst, request, *response->vp_octets,
+		     mschap_result, auth_ctx->mschap_version, auth_ctx->smb_ctrl);
+	if (rcode != RLM_MODULE_OK) RETURN_MODULE_RCODE(rcode);
+
+	if (auth_ctx->mschap_version == 2) {
+		char const	*username_str = auth_ctx->username_str;
+		size_t		username_len = auth_ctx->username_len;
+		char		msch2resp[42];
+
+#ifdef WITH_AUTH_WINBIND
+		if (inst->wb_retry_with_normalised_username) {
+			fr_pair_t *response_name;
+
+			response_name = fr_pair_find_by_da(&request->request_pairs, attr_ms_chap_user_name, 0);
+			if (response_name) {
+				if (strcmp(username_str, response_name->vp_strvalue)) {
+					RDEBUG2("Normalising username %pV -> %pV",
+						fr_box_strvalue_len(username_str, username_len),
+						&response_name->data);
+					username_str = response_name->vp_strvalue;
+				}
+			}
+		}
+#endif
+
+		mschap_auth_response(username_str,		/* without the domain */
+				     username_len,		/* Length of username str */
+				     auth_ctx->nthashhash,	/* nt-hash-hash */
+				     response->vp_octets + 26,	/* peer response */
+				     auth_ctx->peer_challenge,	/* peer challenge */
+				     auth_ctx->challenge->vp_octets,	/* our challenge */
+				     msch2resp);		/* calculated MPPE key */
+		mschap_add_reply(request, *response->vp_octets, attr_ms_chap2_success, msch2resp, 42);
+	}
 
-	*mschap_version = 1;
+	/* now create MPPE attributes */
+	if (inst->use_mppe) {
+		fr_pair_t	*vp;
+		uint8_t		mppe_sendkey[34];
+		uint8_t		mppe_recvkey[34];
+
+		switch (auth_ctx->mschap_version) {
+		case 1:
+			RDEBUG2("Generating MS-CHAPv1 MPPE keys");
+			memset(mppe_sendkey, 0, 32);
+
+			/*
+			 *	According to RFC 2548 we
+			 *	should send NT hash.  But in
+			 *	practice it doesn't work.
+			 *	Instead, we should send nthashhash
+			 *
+			 *	This is an error in RFC 2548.
+			 */
+			/*
+			 *	do_mschap cares to zero nthashhash if NT hash
+			 *	is not available.
+			 */
+			memcpy(mppe_sendkey + 8, auth_ctx->nthashhash, NT_DIGEST_LENGTH);
+			mppe_add_reply(inst, request, attr_ms_chap_mppe_keys, mppe_sendkey, 24);	//-V666
+			break;
+
+		case 2:
+			RDEBUG2("Generating MS-CHAPv2 MPPE keys");
+			mppe_chap2_gen_keys128(auth_ctx->nthashhash, response->vp_octets + 26, mppe_sendkey, mppe_recvkey);
+
+			mppe_add_reply(inst, request, attr_ms_mppe_recv_key, mppe_recvkey, 16);
+			mppe_add_reply(inst, request, attr_ms_mppe_send_key, mppe_sendkey, 16);
+			break;
+
+		default:
+			fr_assert(0);
+			break;
+		}
+
+		MEM(pair_update_reply(&vp, attr_ms_mppe_encryption_policy) >= 0);
+		vp->vp_uint32 = inst->require_encryption ? 2 : 1;
+
+		MEM(pair_update_reply(&vp, attr_ms_mppe_encryption_types) >= 0);
+		vp->vp_uint32 = inst->require_strong ? 4 : 6;
+	} /* else we weren't asked to use MPPE */
+
+	RETURN_MODULE_OK;
+}
+
+#ifdef WITH_AUTH_WINBIND
+/** Offloaded winbind authentication has completed
+ *
+ */
+static unlang_action_t mschap_wbclient_resume(rlm_rcode_t *p_result, UNUSED module_ctx_t const *mctx,
+					      request_t *request, void *rctx)
+{
+	mschap_auth_ctx_t	*auth_ctx = talloc_get_type_abort(rctx, mschap_auth_ctx_t);
+	int			mschap_result;
+	unlang_action_t		ua;
+
+	mschap_result = do_auth_wbclient_result(request, auth_ctx->wbc, auth_ctx->nthashhash);
+	TALLOC_FREE(auth_ctx->job);
+
+	ua = mschap_auth_finish(p_result, request, auth_ctx, mschap_result);
+	if (auth_ctx->ephemeral) TALLOC_FREE(auth_ctx->nt_password);
+	talloc_free(auth_ctx);
+
+	return ua;
+}
+
+/** The request was cancelled while winbind authentication was in progress
+ *
+ */
+static void mschap_wbclient_signal(UNUSED module_ctx_t const *mctx, UNUSED request_t *request,
+				   void *rctx, fr_state_signal_t action)
+{
+	mschap_auth_ctx_t	*auth_ctx = talloc_get_type_abort(rctx, mschap_auth_ctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	fr_offload_cancel(auth_ctx->job);
+	auth_ctx->job = NULL;
+}
+#endif
+
+/** An ntlm_auth helper has responded, or failed
+ *
+ */
+static unlang_action_t mschap_ntlm_helper_resume(rlm_rcode_t *p_result, UNUSED module_ctx_t const *mctx,
+						 request_t *request, void *rctx)
+{
+	mschap_auth_ctx_t	*auth_ctx = talloc_get_type_abort(rctx, mschap_auth_ctx_t);
+	int			mschap_result;
+	unlang_action_t		ua;
+
+	mschap_result = ntlm_helper_result(request, auth_ctx->hreq, auth_ctx->nthashhash);
+	TALLOC_FREE(auth_ctx->hreq);
+
+	ua = mschap_auth_finish(p_result, request, auth_ctx, mschap_result);
+	if (auth_ctx->ephemeral) TALLOC_FREE(auth_ctx->nt_password);
+	talloc_free(auth_ctx);
+
+	return ua;
+}
+
+/** The request was cancelled while waiting for an ntlm_auth helper
+ *
+ * The helper's response, when it arrives, is discarded.
+ */
+static void mschap_ntlm_helper_signal(UNUSED module_ctx_t const *mctx, UNUSED request_t *request,
+				      void *rctx, fr_state_signal_t action)
+{
+	mschap_auth_ctx_t	*auth_ctx = talloc_get_type_abort(rctx, mschap_auth_ctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	TALLOC_FREE(auth_ctx->hreq);
+}
+
+/** Authenticate the NT-Response, and finish up
+ *
+ * If winbind authentication is offloaded to helper threads, or
+ * we're using persistent ntlm_auth helpers, this yields until
+ * they respond.
+ */
+static unlang_action_t CC_HINT(nonnull) mschap_auth(rlm_rcode_t *p_result, request_t *request,
+						    mschap_auth_ctx_t *auth_ctx,
+						    uint8_t const *challenge, uint8_t const *nt_response)
+{
+	rlm_mschap_t const	*inst = auth_ctx->inst;
+	int			mschap_result;
+
+#ifdef WITH_AUTH_WINBIND
+	if ((auth_ctx->method == AUTH_WBCLIENT) && inst->wb_offload) {
+		mschap_auth_ctx_t *rctx;
+
+		MEM(rctx = talloc(unlang_interpret_frame_talloc_ctx(request), mschap_auth_ctx_t));
+		*rctx = *auth_ctx;
+
+		if (do_auth_wbclient_push(&rctx->job, &rctx->wbc, inst, request, challenge, nt_response) < 0) {
+			talloc_free(rctx);
+			return mschap_auth_finish(p_result, request, auth_ctx, -1);
+		}
+
+		/*
+		 *	rctx now owns the ephemeral NT-Password.
+		 */
+		auth_ctx->ephemeral = false;
+
+		return unlang_module_yield(request, mschap_wbclient_resume, mschap_wbclient_signal, rctx);
+	}
+#endif
+
+	if (auth_ctx->method == AUTH_NTLMAUTH_HELPER) {
+		mschap_auth_ctx_t *rctx;
+
+		MEM(rctx = talloc(unlang_interpret_frame_talloc_ctx(request), mschap_auth_ctx_t));
+		*rctx = *auth_ctx;
+
+		rctx->hreq = ntlm_helper_push(rctx, auth_ctx->t->ntlm_helpers, request, challenge, nt_response);
+		if (!rctx->hreq) {
+			talloc_free(rctx);
+			return mschap_auth_finish(p_result, request, auth_ctx, -1);
+		}
+
+		/*
+		 *	rctx now owns the ephemeral NT-Password.
+		 */
+		auth_ctx->ephemeral = false;
+
+		return unlang_module_yield(request, mschap_ntlm_helper_resume, mschap_ntlm_helper_signal, rctx);
+	}
+
+	mschap_result = do_mschap(inst, request, auth_ctx->nt_password, challenge,
+				  nt_response, auth_ctx->nthashhash, auth_ctx->method);
+
+	return mschap_auth_finish(p_result, request, auth_ctx, mschap_result);
+}
+
+static unlang_action_t CC_HINT(nonnull) mschap_process_response(rlm_rcode_t *p_result, request_t *request,
+								mschap_auth_ctx_t *auth_ctx)
+{
+	fr_pair_t	*challenge = auth_ctx->challenge;
+	fr_pair_t	*response = auth_ctx->response;
+
+	auth_ctx->mschap_version = 1;
 
 	RDEBUG2("Processing MS-CHAPv1 response");
 
@@ -1817,41 +2080,28 @@ static CC_HINT(nonnull(1,2,3,4,5,8,9)) unlang_action_t mschap_process_response(r
 		RETURN_MODULE_FAIL;
 	}
 
-	offset = 26;
-
 	/*
 	 *	Do the MS-CHAP authentication.
 	 */
-	mschap_result = do_mschap(inst, request, nt_password, challenge->vp_octets,
-				  response->vp_octets + offset, nthashhash, method);
-
-	/*
-	 *	Check for errors, and add MSCHAP-Error if necessary.
-	 */
-	return mschap_error(p_result, inst, request, *response->vp_octets, mschap_result, *mschap_version, smb_ctrl);
+	return mschap_auth(p_result, request, auth_ctx, challenge->vp_octets, response->vp_octets + 26);
 }
 
-static unlang_action_t CC_HINT(nonnull(1,2,3,4,5,8,9)) mschap_process_v2_response(rlm_rcode_t *p_result,
-										  int *mschap_version,
-									    	  uint8_t nthashhash[static NT_DIGEST_LENGTH],
-									    	  rlm_mschap_t const *inst,
-									    	  request_t *request,
-									    	  fr_pair_t *smb_ctrl,
-									   	  fr_pair_t *nt_password,
-									    	  fr_pair_t *challenge,
-									    	  fr_pair_t *response,
-									    	  MSCHAP_AUTH_METHOD method)
+static unlang_action_t CC_HINT(nonnull) mschap_process_v2_response(rlm_rcode_t *p_result, request_t *request,
+								   mschap_auth_ctx_t *auth_ctx)
 {
-		uint8_t		mschap_challenge[16];
-		fr_pair_t	*user_name, *name_vp, *response_name, *peer_challenge_attr;
-		uint8_t const	*peer_challenge;
-		char const	*username_str;
-		size_t		username_len;
-		int		mschap_result;
-		rlm_rcode_t	rcode;
-		char		msch2resp[42];
+		rlm_mschap_t const	*inst = auth_ctx->inst;
+		fr_pair_t		*challenge = auth_ctx->challenge;
+		fr_pair_t		*response = auth_ctx->response;
+		uint8_t			mschap_challenge[16];
+		fr_pair_t		*user_name, *name_vp, *response_name, *peer_challenge_attr;
+		uint8_t const		*peer_challenge;
+		char const		*username_str;
+		size_t			username_len;
+#ifdef __APPLE__
+		rlm_rcode_t		rcode;
+#endif
 
-		*mschap_version = 2;
+		auth_ctx->mschap_version = 2;
 
 		RDEBUG2("Processing MS-CHAPv2 response");
 
@@ -1918,7 +2168,7 @@ static unlang_action_t CC_HINT(nonnull(1,2,3,4,5,8,9)) mschap_process_v2_respons
 		 *  indicates the auth process should continue directly to AD.
 		 *  Otherwise OD will determine auth success/fail.
 		 */
-		if (!nt_password && inst->open_directory) {
+		if (!auth_ctx->nt_password && inst->open_directory) {
 			RDEBUG2("No NT-Password available. Trying OpenDirectory Authentication");
 			rcode = od_mschap_auth(request, challenge, user_name);
 			if (rcode != RLM_MODULE_NOOP) RETURN_MODULE_RCODE(rcode);
@@ -1946,40 +2196,11 @@ static unlang_action_t CC_HINT(nonnull(1,2,3,4,5,8,9)) mschap_process_v2_respons
 				      challenge->vp_octets,		/* our challenge */
 				      username_str, username_len);	/* user name */
 
-		mschap_result = do_mschap(inst, request, nt_password, mschap_challenge,
-					  response->vp_octets + 26, nthashhash, method);
-
-		/*
-		 *	Check for errors, and add MSCHAP-Error if necessary.
-		 */
-		mschap_error(&rcode, inst, request, *response->vp_octets,
-			     mschap_result, *mschap_version, smb_ctrl);
-		if (rcode != RLM_MODULE_OK) RETURN_MODULE_RCODE(rcode);
+		auth_ctx->username_str = username_str;
+		auth_ctx->username_len = username_len;
+		auth_ctx->peer_challenge = peer_challenge;
 
-#ifdef WITH_AUTH_WINBIND
-		if (inst->wb_retry_with_normalised_username) {
-			response_name = fr_pair_find_by_da(&request->request_pairs, attr_ms_chap_user_name, 0);
-			if (response_name) {
-				if (strcmp(username_str, response_name->vp_strvalue)) {
-					RDEBUG2("Normalising username %pV -> %pV",
-						fr_box_strvalue_len(username_str, username_len),
-						&response_name->data);
-					username_str = response_name->vp_strvalue;
-				}
-			}
-		}
-#endif
-
-		mschap_auth_response(username_str,		/* without the domain */
-				     username_len,		/* Length of username str */
-				     nthashhash,		/* nt-hash-hash */
-				     response->vp_octets + 26,	/* peer response */
-				     peer_challenge,		/* peer challenge */
-				     challenge->vp_octets,	/* our challenge */
-				     msch2resp);		/* calculated MPPE key */
-		mschap_add_reply(request, *response->vp_octets, attr_ms_chap2_success, msch2resp, 42);
-
-		RETURN_MODULE_OK;
+		return mschap_auth(p_result, request, auth_ctx, mschap_challenge, response->vp_octets + 26);
 }
 
 /*
@@ -2005,12 +2226,12 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 	fr_pair_t		*response = NULL;
 	fr_pair_t		*cpw = NULL;
 	fr_pair_t		*nt_password = NULL, *smb_ctrl;
-	uint8_t			nthashhash[NT_DIGEST_LENGTH];
-	int			mschap_version = 0;
+	mschap_auth_ctx_t	auth_ctx;
 
 	MSCHAP_AUTH_METHOD	method;
 	bool			ephemeral = false;
 	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	unlang_action_t		ua;
 
 	/*
 	 *	If we have ntlm_auth configured, use it unless told
@@ -2109,25 +2330,23 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		goto finish;
 	}
 
+	auth_ctx = (mschap_auth_ctx_t) {
+		.inst = inst,
+		.t = talloc_get_type_abort(mctx->thread, rlm_mschap_thread_t),
+		.method = method,
+		.smb_ctrl = smb_ctrl,
+		.nt_password = nt_password,
+		.ephemeral = ephemeral,
+		.challenge = challenge
+	};
+
 	/*
 	 *	We also require an MS-CHAP-Response.
 	 */
-	if ((response = fr_pair_find_by_da(&request->request_pairs, attr_ms_chap_response, 0))) {
-		mschap_process_response(&rcode,
-					&mschap_version, nthashhash,
-					inst, request,
-					smb_ctrl, nt_password,
-					challenge, response,
-					method);
-		if (rcode != RLM_MODULE_OK) goto finish;
-	} else if ((response = fr_pair_find_by_da(&request->request_pairs, attr_ms_chap2_response, 0))) {
-		mschap_process_v2_response(&rcode,
-					   &mschap_version, nthashhash,
-					   inst, request,
-					   smb_ctrl, nt_password,
-					   challenge, response,
-					   method);
-		if (rcode != RLM_MODULE_OK) goto finish;
+	if ((auth_ctx.response = fr_pair_find_by_da(&request->request_pairs, attr_ms_chap_response, 0))) {
+		ua = mschap_process_response(&rcode, request, &auth_ctx);
+	} else if ((auth_ctx.response = fr_pair_find_by_da(&request->request_pairs, attr_ms_chap2_response, 0))) {
+		ua = mschap_process_v2_response(&rcode, request, &auth_ctx);
 	} else {		/* Neither CHAPv1 or CHAPv2 response: die */
 		REDEBUG("&control.Auth-Type = %s set for a request that does not contain &%s or &%s attributes",
 			inst->name, attr_ms_chap_response->name, attr_ms_chap2_response->name);
@@ -2135,52 +2354,13 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		goto finish;
 	}
 
-	/* now create MPPE attributes */
-	if (inst->use_mppe) {
-		fr_pair_t	*vp;
-		uint8_t		mppe_sendkey[34];
-		uint8_t		mppe_recvkey[34];
-
-		switch (mschap_version) {
-		case 1:
-			RDEBUG2("Generating MS-CHAPv1 MPPE keys");
-			memset(mppe_sendkey, 0, 32);
-
-			/*
-			 *	According to RFC 2548 we
-			 *	should send NT hash.  But in
-			 *	practice it doesn't work.
-			 *	Instead, we should send nthashhash
-			 *
-			 *	This is an error in RFC 2548.
-			 */
-			/*
-			 *	do_mschap cares to zero nthashhash if NT hash
-			 *	is not available.
-			 */
-			memcpy(mppe_sendkey + 8, nthashhash, NT_DIGEST_LENGTH);
-			mppe_add_reply(inst, request, attr_ms_chap_mppe_keys, mppe_sendkey, 24);	//-V666
-			break;
-
-		case 2:
-			RDEBUG2("Generating MS-CHAPv2 MPPE keys");
-			mppe_chap2_gen_keys128(nthashhash, response->vp_octets + 26, mppe_sendkey, mppe_recvkey);
-
-			mppe_add_reply(inst, request, attr_ms_mppe_recv_key, mppe_recvkey, 16);
-			mppe_add_reply(inst, request, attr_ms_mppe_send_key, mppe_sendkey, 16);
-			break;
-
-		default:
-			fr_assert(0);
-			break;
-		}
-
-		MEM(pair_update_reply(&vp, attr_ms_mppe_encryption_policy) >= 0);
-		vp->vp_uint32 = inst->require_encryption ? 2 : 1;
+	/*
+	 *	Waiting for winbind or an ntlm_auth helper,
+	 *	the resume function finishes up.
+	 */
+	if (ua == UNLANG_ACTION_YIELD) return ua;
 
-		MEM(pair_update_reply(&vp, attr_ms_mppe_encryption_types) >= 0);
-		vp->vp_uint32 = inst->require_strong ? 4 : 6;
-	} /* else we weren't asked to use MPPE */
+	ephemeral = auth_ctx.ephemeral;
 
 finish:
 	if (ephemeral) TALLOC_FREE(nt_password);
@@ -2216,6 +2396,14 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 			cf_log_err(conf, "Unable to initialise winbind connection pool");
 			return -1;
 		}
+
+		if (inst->wb_threads) {
+			inst->wb_offload = fr_offload_alloc(inst, "winbind", inst->wb_threads);
+			if (!inst->wb_offload) {
+				cf_log_perr(conf, "Unable to initialise winbind helper threads");
+				return -1;
+			}
+		}
 #else
 		cf_log_err(conf, "'winbind' auth not enabled at compiled time");
 		return -1;
@@ -2227,6 +2415,30 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		inst->method = AUTH_NTLMAUTH_EXEC;
 	}
 
+	/*
+	 *	Persistent helpers are preferred over running
+	 *	ntlm_auth for every request.
+	 */
+	if (inst->ntlm_helper) {
+		if (strchr(inst->ntlm_helper, '%')) {
+			cf_log_err(conf, "ntlm_auth_helper.program must not contain expansions, "
+				   "as the helper is shared by many requests");
+			return -1;
+		}
+
+		if (!inst->ntlm_helper_username) {
+			cf_log_err(conf, "ntlm_auth_helper.username must be set");
+			return -1;
+		}
+
+		if (!inst->ntlm_helper_processes) {
+			cf_log_err(conf, "ntlm_auth_helper.processes must be at least 1");
+			return -1;
+		}
+
+		inst->method = AUTH_NTLMAUTH_HELPER;
+	}
+
 	switch (inst->method) {
 	case AUTH_INTERNAL:
 		DEBUG("Using internal authentication");
@@ -2234,6 +2446,9 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	case AUTH_NTLMAUTH_EXEC:
 		DEBUG("Authenticating by calling 'ntlm_auth'");
 		break;
+	case AUTH_NTLMAUTH_HELPER:
+		DEBUG("Authenticating via persistent 'ntlm_auth' helpers");
+		break;
 #ifdef WITH_AUTH_WINBIND
 	case AUTH_WBCLIENT:
 		DEBUG("Authenticating directly to winbind");
@@ -2281,6 +2496,30 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_mschap_t const	*inst = talloc_get_type_abort(instance, rlm_mschap_t);
+	rlm_mschap_thread_t	*t = talloc_get_type_abort(thread, rlm_mschap_thread_t);
+
+	t->el = el;
+	if (inst->method == AUTH_NTLMAUTH_HELPER) t->ntlm_helpers = ntlm_helper_pool_alloc(t, inst, el);
+
+	return 0;
+}
+
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_mschap_thread_t	*t = talloc_get_type_abort(thread, rlm_mschap_thread_t);
+
+	/*
+	 *	Stops the helper processes.
+	 */
+	TALLOC_FREE(t->ntlm_helpers);
+
+	return 0;
+}
+
 /*
  *	Tidy up instance
  */
@@ -2293,6 +2532,10 @@ static int mod_detach(
 #ifdef WITH_AUTH_WINBIND
 	rlm_mschap_t *inst = instance;
 
+	/*
+	 *	Stop the helper threads first, they use the pool.
+	 */
+	TALLOC_FREE(inst->wb_offload);
 	fr_pool_free(inst->wb_pool);
 #endif
 
@@ -2310,6 +2553,10 @@ module_t rlm_mschap = {
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
+	.thread_inst_size	= sizeof(rlm_mschap_thread_t),
+	.thread_inst_type	= "rlm_mschap_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize
@@ -7,16 +7,18 @@ RCSIDH(rlm_mschap_h, "$Id$")
 #ifdef WITH_AUTH_WINBIND
 #  include <wbclient.h>
 
+#include <freeradius-devel/server/offload.h>
 #include <freeradius-devel/server/pool.h>
 #endif
 
 /* Method of authentication we are going to use */
 typedef enum {
 	AUTH_INTERNAL		= 0,
-	AUTH_NTLMAUTH_EXEC	= 1
+	AUTH_NTLMAUTH_EXEC	= 1,
 #ifdef WITH_AUTH_WINBIND
-	,AUTH_WBCLIENT       	= 2
+	AUTH_WBCLIENT       	= 2,
 #endif
+	AUTH_NTLMAUTH_HELPER	= 3
 } MSCHAP_AUTH_METHOD;
 
 extern fr_dict_attr_t const *attr_auth_type;
@@ -67,6 +69,11 @@ typedef struct {
 	char const		*ntlm_cpw_domain;
 	char const		*local_cpw;
 
+	char const		*ntlm_helper;
+	tmpl_t			*ntlm_helper_username;
+	tmpl_t			*ntlm_helper_domain;
+	uint32_t		ntlm_helper_processes;
+
 	bool			allow_retry;
 	char const		*retry_msg;
 	MSCHAP_AUTH_METHOD	method;
@@ -75,8 +82,17 @@ typedef struct {
 #ifdef WITH_AUTH_WINBIND
 	fr_pool_t		*wb_pool;
 	bool			wb_retry_with_normalised_username;
+	uint32_t		wb_threads;
+	fr_offload_t		*wb_offload;
 #endif
 #ifdef __APPLE__
 	bool			open_directory;
 #endif
 } rlm_mschap_t;
+
+typedef struct ntlm_helper_pool_s ntlm_helper_pool_t;
+
+typedef struct {
+	fr_event_list_t		*el;			//!< This thread's event list.
+	ntlm_helper_pool_t	*ntlm_helpers;		//!< Persistent ntlm_auth helpers.
+} rlm_mschap_thread_t;
@@ -27,7 +27,8 @@
 /* NOTES:
 
    This code makes no attempt to be fast! In fact, it is a very
-   slow implementation
+   slow implementation.  Where OpenSSL provides DES, smbhash() uses
+   that instead, and this code is only used as a fallback.
 
    This code is NOT a complete DES implementation. It implements only
    the minimum necessary for SMB authentication, as used by all SMB
@@ -52,7 +53,21 @@ RCSID("$Id$")
 #include <ctype.h>
 #include "smbdes.h"
 
+/*
+ *	The low level DES API is used in preference to EVP, as
+ *	OpenSSL >= 3.0 only provides single DES via EVP when the
+ *	legacy provider is loaded, which it isn't by default.
+ */
+#ifdef HAVE_OPENSSL_EVP_H
+#  include <openssl/opensslconf.h>
+#  ifndef OPENSSL_NO_DES
+#    include <openssl/des.h>
+#    define HAVE_OPENSSL_DES 1
+#  endif
+#endif
+
 
+#ifndef HAVE_OPENSSL_DES
 #define uchar unsigned char
 
 static const uchar perm1[56] = {57, 49, 41, 33, 25, 17,  9,
@@ -264,6 +279,7 @@ static void dohash(char *out, char *in, char *key)
 
 	permute(out, rl, perm6, 64);
 }
+#endif
 
 static void str_to_key(unsigned char *str,unsigned char *key)
 {
@@ -285,6 +301,22 @@ static void str_to_key(unsigned char *str,unsigned char *key)
 
 void smbhash(unsigned char *out, unsigned char const *in, unsigned char *key)
 {
+#ifdef HAVE_OPENSSL_DES
+	DES_cblock		key2, inb;
+	DES_key_schedule	ks;
+
+	str_to_key(key, key2);
+	memcpy(inb, in, sizeof(inb));	/* const_DES_cblock isn't actually const */
+
+	/*
+	 *	The parity bits str_to_key() leaves clear are
+	 *	ignored by DES, so don't make OpenSSL check them.
+	 */
+DIAG_OFF(deprecated-declarations)
+	DES_set_key_unchecked(&key2, &ks);
+	DES_ecb_encrypt(&inb, (DES_cblock *)out, &ks, DES_ENCRYPT);
+DIAG_ON(deprecated-declarations)
+#else
 	int i;
 	char outb[64];
 	char inb[64];
@@ -309,6 +341,7 @@ void smbhash(unsigned char *out, unsigned char const *in, unsigned char *key)
 		if (outb[i])
 			out[i/8] |= (1<<(7-(i%8)));
 	}
+#endif
 }
 
 /*
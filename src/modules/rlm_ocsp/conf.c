@@ -10,6 +10,9 @@ static CONF_PARSER ocsp_config[] = {
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, timeout), .dflt = "yes" },
 	{ FR_CONF_OFFSET("softfail", FR_TYPE_BOOL, fr_tls_ocsp_conf_t, softfail), .dflt = "no" },
 
+	{ FR_CONF_OFFSET("cache_max_entries", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, cache_max_entries), .dflt = "1024" },
+	{ FR_CONF_OFFSET("cache_refresh", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, cache_refresh), .dflt = "60" },
+
 	CONF_PARSER_TERMINATOR
 };
 #endif
@@ -60,11 +63,21 @@ static CONF_PARSER ocsp_config[] = {
 	if (conf->ocsp.enable) {
 		conf->ocsp.store = conf_ocsp_revocation_store(conf);
 		if (conf->ocsp.store == NULL) goto error;
+
+		if (conf->ocsp.cache_max_entries) {
+			conf->ocsp.local = fr_tls_ocsp_cache_alloc(conf, conf->ocsp.cache_max_entries);
+			if (!conf->ocsp.local) goto error;
+		}
 	}
 
 	if (conf->staple.enable) {
 		conf->staple.store = conf_ocsp_revocation_store(conf);
 		if (conf->staple.store == NULL) goto error;
+
+		if (conf->staple.cache_max_entries) {
+			conf->staple.local = fr_tls_ocsp_cache_alloc(conf, conf->staple.cache_max_entries);
+			if (!conf->staple.local) goto error;
+		}
 	}
 #endif /*HAVE_OPENSSL_OCSP_H*/
 
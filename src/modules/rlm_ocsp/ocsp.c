@@ -34,6 +34,8 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/server/pair.h>
 #include <freeradius-devel/util/debug.h>
 
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/misc.h>
 
 #include <freeradius-devel/unlang/compile.h>
@@ -44,6 +46,8 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include "base.h"
 #include "log.h"
 
+#include <pthread.h>
+
 /** Rcodes returned by the OCSP check function
  */
 typedef enum {
@@ -58,6 +62,233 @@ typedef enum {
  */
 #define OCSP_MAX_VALIDITY_PERIOD (5 * 60)
 
+/** How long a request has to refresh a cached response before another request may try
+ *
+ */
+#define OCSP_CACHE_REFRESH_HOLDOFF fr_time_delta_from_sec(10)
+
+/** A cached OCSP response
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the insertion ordered list.
+	uint8_t const		*id;			//!< DER encoded OCSP_CERTID (issuer hashes and serial).
+	uint8_t			*resp;			//!< DER encoded OCSP response.
+	ocsp_status_t		status;			//!< Status of the certificate.
+	fr_time_t		next_update;		//!< nextUpdate from the response.
+	fr_time_t		refreshing;		//!< When a request started refreshing this entry.
+} ocsp_cache_entry_t;
+
+/** In-memory OCSP response cache, shared by all workers
+ *
+ * Responses are cached until their nextUpdate time.  Shortly before
+ * then, one request is told the entry is missing so that it fetches a
+ * fresh response, while every other request continues to use the
+ * cached one.  A popular entry is therefore refreshed before it
+ * expires, and only one request ever waits on the responder for it.
+ */
+struct fr_tls_ocsp_cache_s {
+	pthread_mutex_t		mutex;			//!< Protects the fields below.
+	uint32_t		max_entries;		//!< Maximum number of responses to hold.
+	fr_hash_table_t		*ht;			//!< Entries, keyed by OCSP_CERTID.
+	fr_dlist_head_t		order;			//!< Entries, oldest first.
+};
+
+static uint32_t ocsp_cache_hash(void const *data)
+{
+	ocsp_cache_entry_t const *a = data;
+
+	return fr_hash(a->id, talloc_array_length(a->id));
+}
+
+static int8_t ocsp_cache_cmp(void const *one, void const *two)
+{
+	ocsp_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(talloc_array_length(a->id), talloc_array_length(b->id));
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->id, b->id, talloc_array_length(a->id));
+	return CMP(ret, 0);
+}
+
+static int _ocsp_cache_free(fr_tls_ocsp_cache_t *local)
+{
+	pthread_mutex_destroy(&local->mutex);
+
+	return 0;
+}
+
+/** Allocate an OCSP response cache
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] max_entries	Maximum number of responses to hold.
+ * @return
+ *	- A new response cache on success.
+ *	- NULL on failure.
+ */
+fr_tls_ocsp_cache_t *fr_tls_ocsp_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries)
+{
+	fr_tls_ocsp_cache_t	*local;
+
+	local = talloc_zero(ctx, fr_tls_ocsp_cache_t);
+	if (!local) return NULL;
+
+	local->max_entries = max_entries;
+	local->ht = fr_hash_table_alloc(local, ocsp_cache_hash, ocsp_cache_cmp, NULL);
+	if (!local->ht) {
+		talloc_free(local);
+		return NULL;
+	}
+	fr_dlist_talloc_init(&local->order, ocsp_cache_entry_t, entry);
+	pthread_mutex_init(&local->mutex, NULL);
+	talloc_set_destructor(local, _ocsp_cache_free);
+
+	return local;
+}
+
+/** Produce the key for a certificate's entry in the response cache
+ *
+ * @param[in] ctx		to allocate the key in.
+ * @param[in] client_cert	being checked.
+ * @param[in] issuer_cert	of the certificate being checked.
+ * @return
+ *	- The DER encoded OCSP_CERTID.
+ *	- NULL on error.
+ */
+static uint8_t *ocsp_cache_id(TALLOC_CTX *ctx, X509 *client_cert, X509 *issuer_cert)
+{
+	OCSP_CERTID	*certid;
+	uint8_t		*id = NULL, *p;
+	int		len;
+
+	certid = OCSP_cert_to_id(NULL, client_cert, issuer_cert);
+	if (!certid) return NULL;
+
+	len = i2d_OCSP_CERTID(certid, NULL);
+	if (len > 0) {
+		MEM(id = p = talloc_array(ctx, uint8_t, len));
+		if (i2d_OCSP_CERTID(certid, &p) != len) TALLOC_FREE(id);
+	}
+	OCSP_CERTID_free(certid);
+
+	return id;
+}
+
+/** Remove an entry from the response cache
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void ocsp_cache_entry_free(fr_tls_ocsp_cache_t *local, ocsp_cache_entry_t *entry)
+{
+	fr_hash_table_remove(local->ht, entry);
+	fr_dlist_remove(&local->order, entry);
+	talloc_free(entry);
+}
+
+/** Add a response to the cache
+ *
+ * @param[in] local		cache to add the response to.
+ * @param[in] id		from #ocsp_cache_id.
+ * @param[in] resp		to cache.
+ * @param[in] status		of the certificate.
+ * @param[in] next_update	when the response should no longer be used.
+ */
+static void ocsp_cache_store(fr_tls_ocsp_cache_t *local, uint8_t const *id,
+			     OCSP_RESPONSE *resp, ocsp_status_t status, fr_time_t next_update)
+{
+	ocsp_cache_entry_t	*entry, *old;
+	fr_time_t		now = fr_time();
+	uint8_t			*p;
+	int			len;
+
+	len = i2d_OCSP_RESPONSE(resp, NULL);
+	if (len <= 0) return;
+
+	pthread_mutex_lock(&local->mutex);
+
+	entry = talloc_zero(local->ht, ocsp_cache_entry_t);
+	if (!entry) {
+	error:
+		talloc_free(entry);
+		pthread_mutex_unlock(&local->mutex);
+		return;
+	}
+
+	entry->id = talloc_memdup(entry, id, talloc_array_length(id));
+	entry->resp = p = talloc_array(entry, uint8_t, len);
+	if (!entry->id || !entry->resp || (i2d_OCSP_RESPONSE(resp, &p) != len)) goto error;
+
+	entry->status = status;
+	entry->next_update = next_update;
+
+	old = fr_hash_table_find(local->ht, entry);
+	if (old) ocsp_cache_entry_free(local, old);
+
+	/*
+	 *	Make room by discarding expired entries, and then
+	 *	the oldest ones.
+	 */
+	while ((old = fr_dlist_head(&local->order)) &&
+	       ((old->next_update <= now) || (fr_dlist_num_elements(&local->order) >= local->max_entries))) {
+		ocsp_cache_entry_free(local, old);
+	}
+
+	if (!fr_hash_table_insert(local->ht, entry)) goto error;
+	fr_dlist_insert_tail(&local->order, entry);
+
+	pthread_mutex_unlock(&local->mutex);
+}
+
+/** Retrieve a response from the cache
+ *
+ * If the entry is due to be refreshed, and no other request is already
+ * refreshing it, the caller is told there's no entry so that it fetches
+ * a new response.
+ *
+ * @param[in] ctx		to allocate the copy of the response in.
+ * @param[out] status_out	Status of the certificate.
+ * @param[out] next_update_out	When the response should no longer be used.
+ * @param[in] local		cache to search.
+ * @param[in] id		from #ocsp_cache_id.
+ * @param[in] refresh		How long before next_update the entry should be refreshed.
+ * @return
+ *	- A copy of the DER encoded response.
+ *	- NULL if there's no usable response, and the caller should perform an OCSP check.
+ */
+static uint8_t *ocsp_cache_load(TALLOC_CTX *ctx, ocsp_status_t *status_out, fr_time_t *next_update_out,
+				fr_tls_ocsp_cache_t *local, uint8_t const *id, fr_time_delta_t refresh)
+{
+	ocsp_cache_entry_t	*entry, find = { .id = id };
+	fr_time_t		now = fr_time();
+	uint8_t			*resp = NULL;
+
+	pthread_mutex_lock(&local->mutex);
+
+	entry = fr_hash_table_find(local->ht, &find);
+	if (!entry) goto done;
+
+	if (entry->next_update <= now) {
+		ocsp_cache_entry_free(local, entry);
+		goto done;
+	}
+
+	if (((entry->next_update - now) < refresh) && ((now - entry->refreshing) > OCSP_CACHE_REFRESH_HOLDOFF)) {
+		entry->refreshing = now;
+		goto done;
+	}
+
+	resp = talloc_memdup(ctx, entry->resp, talloc_array_length(entry->resp));
+	*status_out = entry->status;
+	*next_update_out = entry->next_update;
+
+done:
+	pthread_mutex_unlock(&local->mutex);
+
+	return resp;
+}
+
 DIAG_OFF(DIAG_UNKNOWN_PRAGMAS)
 DIAG_OFF(used-but-marked-unused)	/* fix spurious warnings for sk macros */
 /** Extract components of OCSP responser URL from a certificate
@@ -362,6 +593,9 @@ int fr_tls_ocsp_check(request_t *request, SSL *ssl,
 	fr_time_t	start;
 	fr_pair_t	*vp;
 
+	uint8_t		*cache_id = NULL;
+	fr_time_t	cache_next_update = 0;
+
 	if (conf->cache_server) {
 		rlm_rcode_t rcode;
 
@@ -431,6 +665,39 @@ int fr_tls_ocsp_check(request_t *request, SSL *ssl,
 		goto skipped;
 	}
 
+	/*
+	 *	Check for a response we've already retrieved
+	 */
+	if (conf->local) {
+		uint8_t		*cached;
+
+		cache_id = ocsp_cache_id(request, client_cert, issuer_cert);
+		if (cache_id && (cached = ocsp_cache_load(request, &ocsp_status, &cache_next_update,
+							  conf->local, cache_id,
+							  fr_time_delta_from_sec(conf->cache_refresh)))) {
+			RDEBUG2("Using cached OCSP response");
+
+			if (staple_response) {
+				MEM(pair_update_request(&vp, attr_tls_ocsp_response) >= 0);
+				MEM(fr_pair_value_memdup(vp, cached, talloc_array_length(cached), false) == 0);
+				if (ocsp_staple_from_pair(request, ssl, vp) < 0) {
+					RWDEBUG("Failed setting OCSP staple response in SSL session");
+					ocsp_status = OCSP_STATUS_FAILED;
+				}
+			}
+			talloc_free(cached);
+
+			MEM(pair_update_request(&vp, attr_tls_ocsp_next_update) >= 0);
+			vp->vp_uint32 = fr_time_delta_to_sec(cache_next_update - fr_time());
+
+			MEM(pair_update_request(&vp, attr_tls_ocsp_cert_valid) >= 0);
+			vp->vp_uint32 = (ocsp_status == OCSP_STATUS_OK) ? 1 : 0;
+
+			talloc_free(cache_id);
+			return ocsp_status;
+		}
+	}
+
 	/*
 	 *	Setup logging for this OCSP operation
 	 */
@@ -635,6 +902,8 @@ int fr_tls_ocsp_check(request_t *request, SSL *ssl,
 			goto finish;
 		}
 		if (fr_time_to_sec(now) < next){
+			cache_next_update = fr_time_from_sec(next);
+
 			RDEBUG2("Adding OCSP TTL attribute");
 
 			MEM(pair_update_request(&vp, attr_tls_ocsp_next_update) >= 0);
@@ -674,6 +943,14 @@ int fr_tls_ocsp_check(request_t *request, SSL *ssl,
 		break;
 	}
 
+	/*
+	 *	We have a verified response with a nextUpdate time,
+	 *	other requests for the same certificate can use it.
+	 */
+	if (cache_id && cache_next_update) {
+		ocsp_cache_store(conf->local, cache_id, resp, ocsp_status, cache_next_update);
+	}
+
 finish:
 	switch (ocsp_status) {
 	case OCSP_STATUS_OK:
@@ -752,6 +1029,7 @@ finish:
 	OPENSSL_free(path);
 	BIO_free_all(conn);
 	BIO_free(ssl_log);
+	talloc_free(cache_id);
 
 	return ocsp_status;
 }
@@ -1,3 +1,5 @@
+typedef struct fr_tls_ocsp_cache_s fr_tls_ocsp_cache_t;
+
 /** OCSP Configuration
  *
  */
@@ -12,6 +14,10 @@ typedef struct {
 	uint32_t	timeout;
 	bool		softfail;
 
+	uint32_t	cache_max_entries;		//!< Maximum number of responses to hold in memory.
+	uint32_t	cache_refresh;			//!< How many seconds before nextUpdate a cached
+							///< response should be refreshed.
+	fr_tls_ocsp_cache_t	*local;			//!< In-memory response cache, shared by all workers.
 
 	fr_tls_cache_t	cache;				//!< Cached cache section pointers.  Means we don't have
 							///< to look them up at runtime.
@@ -33,6 +39,8 @@ int		fr_tls_ocsp_check(request_t *request, SSL *ssl,
 			       X509_STORE *store, X509 *issuer_cert, X509 *client_cert,
 			       fr_tls_ocsp_conf_t *conf, bool staple_response);
 
+fr_tls_ocsp_cache_t	*fr_tls_ocsp_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries);
+
 int		fr_tls_ocsp_state_cache_compile(fr_tls_cache_t *sections, CONF_SECTION *server_cs);
 
 int		fr_tls_ocsp_staple_cache_compile(fr_tls_cache_t *sections, CONF_SECTION *server_cs);
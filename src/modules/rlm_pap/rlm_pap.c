@@ -26,9 +26,11 @@
 RCSID("$Id$")
 USES_APPLE_DEPRECATED_API
 
+#include <freeradius-devel/server/auth_cache.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/password.h>
+#include <freeradius-devel/unlang/module.h>
 #include <freeradius-devel/tls/base.h>
 
 #include <freeradius-devel/util/base64.h>
@@ -70,12 +72,25 @@ typedef struct {
 	char const		*name;
 	fr_dict_enum_t		*auth_type;
 	bool			normify;
+
+	uint32_t		threads;		//!< Number of helper threads for slow hashes.
+	uint32_t		max_queued;		//!< Maximum verifications waiting for a helper.
+	fr_offload_t		*offload;		//!< Helper threads, if threads > 0.
+
+	fr_auth_cache_config_t	cache;			//!< Of successful verifications of slow hashes.
 } rlm_pap_t;
 
-typedef unlang_action_t (*pap_auth_func_t)(rlm_rcode_t *p_result, rlm_pap_t const *inst, request_t *request, fr_pair_t const *, fr_pair_t const *);
+typedef struct {
+	fr_auth_cache_t		*cache;			//!< Of successful verifications, by key.
+} rlm_pap_thread_t;
+
+typedef unlang_action_t (*pap_auth_func_t)(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request, fr_pair_t const *, fr_pair_t const *);
 
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("normalise", FR_TYPE_BOOL, rlm_pap_t, normify), .dflt = "yes" },
+	{ FR_CONF_OFFSET("threads", FR_TYPE_UINT32, rlm_pap_t, threads), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_queued", FR_TYPE_UINT32, rlm_pap_t, max_queued), .dflt = "1024" },
+	FR_AUTH_CACHE_CONF(rlm_pap_t, cache),
 	CONF_PARSER_TERMINATOR
 };
 
@@ -128,6 +143,183 @@ static size_t pbkdf2_passlib_names_len = NUM_ELEMENTS(pbkdf2_passlib_names);
 
 static fr_dict_attr_t const **pap_alloweds;
 
+/** Verification of a slow hash, which may be run on a helper thread
+ *
+ * Holds copies of everything the hash needs, as the "known good"
+ * password may be freed before verification completes.
+ */
+typedef struct {
+	char const		*name;			//!< Of the password type, for debug messages.
+	fr_offload_func_t	func;			//!< Which does the hashing.
+	uint8_t			key[SHA1_DIGEST_LENGTH]; //!< To cache the result with.
+
+	char			*password;		//!< What the user supplied.
+	char			*known_good;		//!< Crypt string.
+
+#ifdef HAVE_OPENSSL_EVP_H
+	EVP_MD const		*evp_md;		//!< PBKDF2 digest.
+	uint8_t			*salt;			//!< PBKDF2 salt.
+	uint32_t		iterations;		//!< PBKDF2 rounds.
+	size_t			digest_len;		//!< Length of the PBKDF2 hash and digest.
+	uint8_t			hash[EVP_MAX_MD_SIZE];	//!< "known good" PBKDF2 hash.
+	uint8_t			digest[EVP_MAX_MD_SIZE]; //!< Calculated PBKDF2 hash.
+#endif
+
+	rlm_rcode_t		rcode;			//!< Result of the verification.
+} pap_verify_t;
+
+static int _pap_verify_free(pap_verify_t *verify)
+{
+	memset(verify->password, 0, talloc_array_length(verify->password) - 1);
+
+	return 0;
+}
+
+/** Allocate a verification, which isn't parented by the request
+ *
+ */
+static pap_verify_t *pap_verify_alloc(char const *name, fr_offload_func_t func,
+				      uint8_t const key[static SHA1_DIGEST_LENGTH], fr_pair_t const *password)
+{
+	pap_verify_t	*verify;
+
+	MEM(verify = talloc_zero(NULL, pap_verify_t));
+	verify->name = name;
+	verify->func = func;
+	verify->rcode = RLM_MODULE_FAIL;
+	memcpy(verify->key, key, sizeof(verify->key));
+	MEM(verify->password = talloc_bstrndup(verify, password->vp_strvalue, password->vp_length));
+	talloc_set_destructor(verify, _pap_verify_free);
+
+	return verify;
+}
+
+/** Look for a previous successful verification of this password against this "known good" password
+ *
+ * The key is an HMAC of the "known good" password, keyed by the password
+ * the user supplied, so the cache never holds either of them.
+ *
+ * @param[out] key		Written with the cache key, for use by #pap_cache_insert.
+ * @param[in] mctx		Module context.
+ * @param[in] known_good	password.
+ * @param[in] password		The user supplied.
+ * @return
+ *	- true if the password was recently verified.
+ *	- false if it wasn't, or caching is disabled.
+ */
+static bool pap_cache_find(uint8_t key[static SHA1_DIGEST_LENGTH], module_ctx_t const *mctx,
+			   fr_pair_t const *known_good, fr_pair_t const *password)
+{
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
+
+	memset(key, 0, SHA1_DIGEST_LENGTH);
+	if (!t->cache) return false;
+
+	fr_hmac_sha1(key, known_good->vp_octets, known_good->vp_length,
+		     password->vp_octets, password->vp_length);
+
+	return fr_auth_cache_find(NULL, NULL, t->cache, key);
+}
+
+/** Remember a successful verification
+ *
+ */
+static void pap_cache_insert(module_ctx_t const *mctx, uint8_t const key[static SHA1_DIGEST_LENGTH])
+{
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
+
+	if (!t->cache) return;
+
+	fr_auth_cache_insert(t->cache, key, NULL, 0);
+}
+
+/** Log the result of a verification, and cache it if it was successful
+ *
+ * Frees the verification.
+ */
+static rlm_rcode_t pap_verify_done(module_ctx_t const *mctx, request_t *request, pap_verify_t *verify)
+{
+	rlm_rcode_t	rcode = verify->rcode;
+
+	switch (rcode) {
+	case RLM_MODULE_OK:
+		pap_cache_insert(mctx, verify->key);
+		break;
+
+	case RLM_MODULE_REJECT:
+		REDEBUG("%s digest does not match \"known good\" digest", verify->name);
+#ifdef HAVE_OPENSSL_EVP_H
+		if (verify->salt) {
+			REDEBUG3("Salt       : %pH", fr_box_octets(verify->salt, talloc_array_length(verify->salt)));
+			REDEBUG3("Calculated : %pH", fr_box_octets(verify->digest, verify->digest_len));
+			REDEBUG3("Expected   : %pH", fr_box_octets(verify->hash, verify->digest_len));
+		}
+#endif
+		break;
+
+	default:
+		REDEBUG("%s digest failure", verify->name);
+		break;
+	}
+
+	talloc_free(verify);
+
+	return rcode;
+}
+
+/** Log the final result of authentication
+ *
+ */
+static unlang_action_t pap_auth_return(rlm_rcode_t *p_result, request_t *request, rlm_rcode_t rcode)
+{
+	switch (rcode) {
+	case RLM_MODULE_REJECT:
+		REDEBUG("Password incorrect");
+		break;
+
+	case RLM_MODULE_OK:
+		RDEBUG2("User authenticated successfully");
+		break;
+
+	default:
+		break;
+	}
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+/** Verification on a helper thread has completed
+ *
+ */
+static unlang_action_t mod_authenticate_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					       request_t *request, void *rctx)
+{
+	pap_verify_t	*verify = talloc_get_type_abort(rctx, pap_verify_t);
+
+	return pap_auth_return(p_result, request, pap_verify_done(mctx, request, verify));
+}
+
+/** Run a verification, either here, or on a helper thread
+ *
+ * Slow hashes can take tens of milliseconds each, for which time
+ * every other request on this worker would otherwise wait.
+ */
+static unlang_action_t pap_verify_start(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+					pap_verify_t *verify)
+{
+	rlm_pap_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_pap_t);
+
+	if (inst->offload) {
+		RDEBUG2("Verifying %s on a helper thread", verify->name);
+		return unlang_module_offload(p_result, request, inst->offload, verify->func,
+					     mod_authenticate_resume, verify);
+	}
+
+	verify->func(verify);
+
+	RETURN_MODULE_RCODE(pap_verify_done(mctx, request, verify));
+}
+
 /*
  *	Authorize the user for PAP authentication.
  *
@@ -166,7 +358,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
  */
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_clear(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
+						       UNUSED module_ctx_t const *mctx, request_t *request,
 						       fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	if ((known_good->vp_length != password->vp_length) ||
@@ -180,48 +372,63 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_clear(rlm_rcode_t *p_result,
 }
 
 #ifdef HAVE_CRYPT
-static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
-						       fr_pair_t const *known_good, fr_pair_t const *password)
+/** Run crypt(), possibly on a helper thread
+ *
+ */
+static void pap_verify_crypt(void *uctx)
 {
-	char	*crypt_out;
-	int	cmp = 0;
+	pap_verify_t	*verify = talloc_get_type_abort(uctx, pap_verify_t);
+	char		*crypt_out;
+	int		cmp = 0;
 
 #ifdef HAVE_CRYPT_R
 	struct crypt_data crypt_data = { .initialized = 0 };
 
-	crypt_out = crypt_r(password->vp_strvalue, known_good->vp_strvalue, &crypt_data);
-	if (crypt_out) cmp = strcmp(known_good->vp_strvalue, crypt_out);
+	crypt_out = crypt_r(verify->password, verify->known_good, &crypt_data);
+	if (crypt_out) cmp = strcmp(verify->known_good, crypt_out);
 #else
 	/*
 	 *	Ensure we're thread-safe, as crypt() isn't.
 	 */
 	pthread_mutex_lock(&fr_crypt_mutex);
-	crypt_out = crypt(password->vp_strvalue, known_good->vp_strvalue);
+	crypt_out = crypt(verify->password, verify->known_good);
 
 	/*
 	 *	Got something, check it within the lock.  This is
 	 *	faster than copying it to a local buffer, and the
 	 *	time spent within the lock is critical.
 	 */
-	if (crypt_out) cmp = strcmp(known_good->vp_strvalue, crypt_out);
+	if (crypt_out) cmp = strcmp(verify->known_good, crypt_out);
 	pthread_mutex_unlock(&fr_crypt_mutex);
 #endif
 
 	/*
 	 *	Error.
 	 */
-	if (!crypt_out || (cmp != 0)) {
-		REDEBUG("Crypt digest does not match \"known good\" digest");
-		RETURN_MODULE_REJECT;
+	verify->rcode = (!crypt_out || (cmp != 0)) ? RLM_MODULE_REJECT : RLM_MODULE_OK;
+}
+
+static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(rlm_rcode_t *p_result,
+						       module_ctx_t const *mctx, request_t *request,
+						       fr_pair_t const *known_good, fr_pair_t const *password)
+{
+	pap_verify_t	*verify;
+	uint8_t		key[SHA1_DIGEST_LENGTH];
+
+	if (pap_cache_find(key, mctx, known_good, password)) {
+		RDEBUG2("Password was recently verified, not running crypt()");
+		RETURN_MODULE_OK;
 	}
 
-	RETURN_MODULE_OK;
+	verify = pap_verify_alloc("Crypt", pap_verify_crypt, key, password);
+	MEM(verify->known_good = talloc_bstrndup(verify, known_good->vp_strvalue, known_good->vp_length));
+
+	return pap_verify_start(p_result, mctx, request, verify);
 }
 #endif
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_md5(rlm_rcode_t *p_result,
-						     UNUSED rlm_pap_t const *inst, request_t *request,
+						     UNUSED module_ctx_t const *mctx, request_t *request,
 						     fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	uint8_t digest[MD5_DIGEST_LENGTH];
@@ -246,7 +453,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_md5(rlm_rcode_t *p_result,
 
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_smd5(rlm_rcode_t *p_result,
-						      UNUSED rlm_pap_t const *inst, request_t *request,
+						      UNUSED module_ctx_t const *mctx, request_t *request,
 						      fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	fr_md5_ctx_t	*md5_ctx;
@@ -278,7 +485,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_smd5(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_sha1(rlm_rcode_t *p_result,
-						      UNUSED rlm_pap_t const *inst, request_t *request,
+						      UNUSED module_ctx_t const *mctx, request_t *request,
 						      fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	fr_sha1_ctx	sha1_context;
@@ -305,7 +512,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_sha1(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_ssha1(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
+						       UNUSED module_ctx_t const *mctx, request_t *request,
 						       fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	fr_sha1_ctx	sha1_context;
@@ -337,7 +544,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_ssha1(rlm_rcode_t *p_result,
 
 #ifdef HAVE_OPENSSL_EVP_H
 static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md(rlm_rcode_t *p_result,
-						    	UNUSED rlm_pap_t const *inst, request_t *request,
+						    	UNUSED module_ctx_t const *mctx, request_t *request,
 						    	fr_pair_t const *known_good, fr_pair_t const *password,
 						    	char const *name, EVP_MD const *md)
 {
@@ -365,7 +572,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md_salted(rlm_rcode_t *p_result,
-							       UNUSED rlm_pap_t const *inst, request_t *request,
+							       UNUSED module_ctx_t const *mctx, request_t *request,
 							       fr_pair_t const *known_good, fr_pair_t const *password,
 							       char const *name, EVP_MD const *md)
 {
@@ -404,10 +611,10 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_evp_md_salted(rlm_rcode_t *p_re
  */
 #define PAP_AUTH_EVP_MD(_func, _new_func, _name, _md) \
 static unlang_action_t CC_HINT(nonnull) _new_func(rlm_rcode_t *p_result, \
-					          rlm_pap_t const *inst, request_t *request, \
+					          module_ctx_t const *mctx, request_t *request, \
 						  fr_pair_t const *known_good, fr_pair_t const *password) \
 { \
-	return _func(p_result, inst, request, known_good, password, _name, _md); \
+	return _func(p_result, mctx, request, known_good, password, _name, _md); \
 }
 
 PAP_AUTH_EVP_MD(pap_auth_evp_md, pap_auth_sha2_224, "SHA2-224", EVP_sha224())
@@ -430,9 +637,33 @@ PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_384, "SSHA3-384", EVP_sha
 PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_512, "SSHA3-512", EVP_sha3_512())
 #  endif
 
+/** Hash and compare, possibly on a helper thread
+ *
+ */
+static void pap_verify_pbkdf2(void *uctx)
+{
+	pap_verify_t	*verify = talloc_get_type_abort(uctx, pap_verify_t);
+
+	if (PKCS5_PBKDF2_HMAC(verify->password, (int)(talloc_array_length(verify->password) - 1),
+			      (unsigned char const *)verify->salt, (int)talloc_array_length(verify->salt),
+			      (int)verify->iterations,
+			      verify->evp_md,
+			      (int)verify->digest_len, (unsigned char *)verify->digest) == 0) {
+		verify->rcode = RLM_MODULE_INVALID;
+		return;
+	}
+
+	verify->rcode = (fr_digest_cmp(verify->digest, verify->hash, verify->digest_len) != 0) ?
+			RLM_MODULE_REJECT : RLM_MODULE_OK;
+}
+
 /** Validates Crypt::PBKDF2 LDAP format strings
+ *
+ * The string is parsed here, and the hashing is done by #pap_verify_pbkdf2,
+ * which may run on a helper thread.
  *
  * @param[out] p_result		The result of comparing the pbkdf2 hash with the password.
+ * @param[in] mctx		Module context.
  * @param[in] request		The current request.
  * @param[in] str		Raw PBKDF2 string.
  * @param[in] len		Length of string.
@@ -443,15 +674,18 @@ PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_512, "SSHA3-512", EVP_sha
  * @param[in] salt_sep		Separation character between the salt and the next component.
  * @param[in] iter_is_base64	Whether the iterations is are encoded as base64.
  * @param[in] password		to validate.
+ * @param[in] key		to cache a successful verification with.
  * @return
  *	- RLM_MODULE_REJECT
  *	- RLM_MODULE_OK
  */
 static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t *p_result,
+								     module_ctx_t const *mctx,
 								     request_t *request, const uint8_t *str, size_t len,
 								     fr_table_num_sorted_t const hash_names[], size_t hash_names_len,
 								     char scheme_sep, char iter_sep, char salt_sep,
-								     bool iter_is_base64, fr_pair_t const *password)
+								     bool iter_is_base64, fr_pair_t const *password,
+								     uint8_t const key[static SHA1_DIGEST_LENGTH])
 {
 	rlm_rcode_t		rcode = RLM_MODULE_INVALID;
 
@@ -464,13 +698,12 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 
 	uint32_t		iterations = 0;
 
-	uint8_t			*salt = NULL;
-	size_t			salt_len;
-	uint8_t			hash[EVP_MAX_MD_SIZE];
-	uint8_t			digest[EVP_MAX_MD_SIZE];
+	pap_verify_t		*verify;
 
 	RDEBUG2("Comparing with \"known-good\" PBKDF2-Password");
 
+	verify = pap_verify_alloc("PBKDF2", pap_verify_pbkdf2, key, password);
+
 	if (len <= 1) {
 		REDEBUG("PBKDF2-Password is too short");
 		goto finish;
@@ -601,14 +834,14 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 		goto finish;
 	}
 
-	MEM(salt = talloc_array(request, uint8_t, FR_BASE64_DEC_LENGTH(q - p)));
-	slen = fr_base64_decode(&FR_DBUFF_TMP(salt, talloc_array_length(salt)),
+	MEM(verify->salt = talloc_array(verify, uint8_t, FR_BASE64_DEC_LENGTH(q - p)));
+	slen = fr_base64_decode(&FR_DBUFF_TMP(verify->salt, talloc_array_length(verify->salt)),
 				&FR_SBUFF_IN((char const *) p, (char const *)q), false, false);
 	if (slen <= 0) {
 		RPEDEBUG("Failed decoding PBKDF2-Password salt component");
 		goto finish;
 	}
-	salt_len = (size_t)slen;
+	MEM(verify->salt = talloc_realloc(verify, verify->salt, uint8_t, (size_t)slen));
 
 	p = q + 1;
 
@@ -617,7 +850,7 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 		goto finish;
 	}
 
-	slen = fr_base64_decode(&FR_DBUFF_TMP(hash, sizeof(hash)),
+	slen = fr_base64_decode(&FR_DBUFF_TMP(verify->hash, sizeof(verify->hash)),
 				&FR_SBUFF_IN((char const *)p, (char const *)end), false, false);
 	if (slen <= 0) {
 		RPEDEBUG("Failed decoding PBKDF2-Password hash component");
@@ -628,55 +861,45 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 		REDEBUG("PBKDF2-Password hash component length is incorrect for hash type, expected %zu, got %zd",
 			digest_len, slen);
 
-		RHEXDUMP2(hash, slen, "hash component");
+		RHEXDUMP2(verify->hash, slen, "hash component");
 
 		goto finish;
 	}
 
 	RDEBUG2("PBKDF2 %s: Iterations %u, salt length %zu, hash length %zd",
 		fr_table_str_by_value(pbkdf2_crypt_names, digest_type, "<UNKNOWN>"),
-		iterations, salt_len, slen);
+		iterations, talloc_array_length(verify->salt), slen);
 
-	/*
-	 *	Hash and compare
-	 */
-	if (PKCS5_PBKDF2_HMAC((char const *)password->vp_octets, (int)password->vp_length,
-			      (unsigned char const *)salt, (int)salt_len,
-			      (int)iterations,
-			      evp_md,
-			      (int)digest_len, (unsigned char *)digest) == 0) {
-		REDEBUG("PBKDF2 digest failure");
-		goto finish;
-	}
+	verify->evp_md = evp_md;
+	verify->iterations = iterations;
+	verify->digest_len = digest_len;
 
-	if (fr_digest_cmp(digest, hash, (size_t)digest_len) != 0) {
-		REDEBUG("PBKDF2 digest does not match \"known good\" digest");
-		REDEBUG3("Salt       : %pH", fr_box_octets(salt, salt_len));
-		REDEBUG3("Calculated : %pH", fr_box_octets(digest, digest_len));
-		REDEBUG3("Expected   : %pH", fr_box_octets(hash, slen));
-		rcode = RLM_MODULE_REJECT;
-	} else {
-		rcode = RLM_MODULE_OK;
-	}
+	return pap_verify_start(p_result, mctx, request, verify);
 
 finish:
-	talloc_free(salt);
+	talloc_free(verify);
 
 	RETURN_MODULE_RCODE(rcode);
 }
 
 static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_result,
-							       UNUSED rlm_pap_t const *inst,
+							       module_ctx_t const *mctx,
 							       request_t *request,
 							       fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	uint8_t const *p = known_good->vp_octets, *q, *end = p + known_good->vp_length;
+	uint8_t key[SHA1_DIGEST_LENGTH];
 
 	if (end - p < 2) {
 		REDEBUG("PBKDF2-Password too short");
 		RETURN_MODULE_INVALID;
 	}
 
+	if (pap_cache_find(key, mctx, known_good, password)) {
+		RDEBUG2("Password was recently verified, not running PBKDF2");
+		RETURN_MODULE_OK;
+	}
+
 	/*
 	 *	If it doesn't begin with a $ assume
 	 *	It's Crypt::PBKDF2 LDAP format
@@ -691,9 +914,9 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 			q = memchr(p, '}', end - p);
 			p = q + 1;
 		}
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+		return pap_auth_pbkdf2_parse(p_result, mctx, request, p, end - p,
 					     pbkdf2_crypt_names, pbkdf2_crypt_names_len,
-					     ':', ':', ':', true, password);
+					     ':', ':', ':', true, password, key);
 	}
 
 	/*
@@ -703,9 +926,9 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 	 */
 	if ((size_t)(end - p) >= sizeof("$PBKDF2$") && (memcmp(p, "$PBKDF2$", sizeof("$PBKDF2$") - 1) == 0)) {
 		p += sizeof("$PBKDF2$") - 1;
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+		return pap_auth_pbkdf2_parse(p_result, mctx, request, p, end - p,
 					     pbkdf2_crypt_names, pbkdf2_crypt_names_len,
-					     ':', ':', '$', false, password);
+					     ':', ':', '$', false, password, key);
 	}
 
 	/*
@@ -717,9 +940,9 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 	 */
 	if ((size_t)(end - p) >= sizeof("$pbkdf2-") && (memcmp(p, "$pbkdf2-", sizeof("$pbkdf2-") - 1) == 0)) {
 		p += sizeof("$pbkdf2-") - 1;
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
+		return pap_auth_pbkdf2_parse(p_result, mctx, request, p, end - p,
 					     pbkdf2_passlib_names, pbkdf2_passlib_names_len,
-					     '$', '$', '$', false, password);
+					     '$', '$', '$', false, password, key);
 	}
 
 	REDEBUG("Can't determine format of PBKDF2-Password");
@@ -729,7 +952,7 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 #endif
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_nt(rlm_rcode_t *p_result,
-						    UNUSED rlm_pap_t const *inst, request_t *request,
+						    UNUSED module_ctx_t const *mctx, request_t *request,
 						    fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	ssize_t len;
@@ -765,7 +988,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_nt(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_lm(rlm_rcode_t *p_result,
-						    UNUSED rlm_pap_t const *inst, request_t *request,
+						    UNUSED module_ctx_t const *mctx, request_t *request,
 						    fr_pair_t const *known_good, UNUSED fr_pair_t const *password)
 {
 	uint8_t	digest[MD4_DIGEST_LENGTH];
@@ -795,7 +1018,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_lm(rlm_rcode_t *p_result,
 }
 
 static unlang_action_t CC_HINT(nonnull) pap_auth_ns_mta_md5(rlm_rcode_t *p_result,
-							    UNUSED rlm_pap_t const *inst, request_t *request,
+							    UNUSED module_ctx_t const *mctx, request_t *request,
 							    fr_pair_t const *known_good, fr_pair_t const *password)
 {
 	uint8_t digest[128];
@@ -859,7 +1082,7 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_ns_mta_md5(rlm_rcode_t *p_resul
  *
  */
 static unlang_action_t CC_HINT(nonnull) pap_auth_dummy(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, UNUSED request_t *request,
+						       UNUSED module_ctx_t const *mctx, UNUSED request_t *request,
 						       UNUSED fr_pair_t const *known_good, UNUSED fr_pair_t const *password)
 {
 	RETURN_MODULE_FAIL;
@@ -920,6 +1143,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 	rlm_rcode_t		rcode = RLM_MODULE_INVALID;
 	pap_auth_func_t		auth_func;
 	bool			ephemeral;
+	unlang_action_t		ua;
 
 	password = fr_pair_find_by_da(&request->request_pairs, attr_user, 0);
 	if (!password) {
@@ -969,22 +1193,16 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 	/*
 	 *	Authenticate, and return.
 	 */
-	auth_func(&rcode, inst, request, known_good, password);
+	ua = auth_func(&rcode, mctx, request, known_good, password);
 	if (ephemeral) TALLOC_FREE(known_good);
-	switch (rcode) {
-	case RLM_MODULE_REJECT:
-		REDEBUG("Password incorrect");
-		break;
-
-	case RLM_MODULE_OK:
-		RDEBUG2("User authenticated successfully");
-		break;
 
-	default:
-		break;
-	}
+	/*
+	 *	Slow hashes may be verified on a helper thread,
+	 *	in which case mod_authenticate_resume finishes up.
+	 */
+	if (ua == UNLANG_ACTION_YIELD) return ua;
 
-	RETURN_MODULE_RCODE(rcode);
+	return pap_auth_return(p_result, request, rcode);
 }
 
 static int mod_bootstrap(void *instance, CONF_SECTION *conf)
@@ -1002,7 +1220,7 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
-static int mod_instantiate(void *instance, UNUSED CONF_SECTION *cs)
+static int mod_instantiate(void *instance, CONF_SECTION *cs)
 {
 	rlm_pap_t	*inst = talloc_get_type_abort(instance, rlm_pap_t);
 
@@ -1012,6 +1230,28 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *cs)
 		     inst->name);
 	}
 
+	if (inst->threads) {
+		inst->offload = fr_offload_alloc(inst, "pap", inst->threads);
+		if (!inst->offload) {
+			cf_log_perr(cs, "Unable to initialise pap helper threads");
+			return -1;
+		}
+		fr_offload_max_queued_set(inst->offload, inst->max_queued);
+	}
+
+	if (fr_auth_cache_config_check(cs, &inst->cache) < 0) return -1;
+
+	return 0;
+}
+
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
+				  UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_pap_t		*inst = talloc_get_type_abort(instance, rlm_pap_t);
+	rlm_pap_thread_t	*t = talloc_get_type_abort(thread, rlm_pap_thread_t);
+
+	t->cache = fr_auth_cache_alloc(t, &inst->cache);
+
 	return 0;
 }
 
@@ -1090,6 +1330,9 @@ module_t rlm_pap = {
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_pap_thread_t),
+	.thread_inst_type	= "rlm_pap_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize
@@ -26,7 +26,9 @@ RCSID("$Id$")
 #define LOG_PREFIX "rlm_passwd - "
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/line_index.h>
 #include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/reload.h>
 #include <freeradius-devel/util/debug.h>
 
 struct mypasswd {
@@ -152,10 +154,14 @@ static void release_hash_table(struct hashtable * ht){
 	ht->tablesize = 0;
 }
 
-static void release_ht(struct hashtable * ht){
-	if (!ht) return;
+/*
+ *	The entries aren't parented by the table, so free them
+ *	explicitly when the table is freed.
+ */
+static int _ht_free(struct hashtable *ht)
+{
 	release_hash_table(ht);
-	talloc_free(ht);
+	return 0;
 }
 
 static struct hashtable * build_hash_table (char const * file, int num_fields,
@@ -171,6 +177,7 @@ static struct hashtable * build_hash_table (char const * file, int num_fields,
 	char buffer[1024];
 
 	MEM(ht = talloc_zero(NULL, struct hashtable));
+	talloc_set_destructor(ht, _ht_free);
 	MEM(ht->filename = talloc_typed_strdup(ht, file));
 
 	ht->tablesize = tablesize;
@@ -352,12 +359,12 @@ int main(void){
 		printpw(pw,4);
 		while ((pw = get_next(buffer, ht, &last_found))) printpw(pw,4);
 	}
-	release_ht(ht);
+	talloc_free(ht);
 }
 
 #else  /* TEST */
 typedef struct {
-	struct hashtable	*ht;
+	fr_reload_t		*ht;		//!< Current struct hashtable, or fr_line_index_t.
 	struct mypasswd		*pwd_fmt;
 	char const		*filename;
 	char const		*format;
@@ -370,6 +377,10 @@ typedef struct {
 	uint32_t		listable;
 	fr_dict_attr_t const		*keyattr;
 	bool			ignore_empty;
+	bool			mmap;
+	char const		*index_file;
+	bool			reload;
+	fr_time_delta_t		reload_delay;
 } rlm_passwd_t;
 
 static const CONF_PARSER module_config[] = {
@@ -384,9 +395,114 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("allow_multiple_keys", FR_TYPE_BOOL, rlm_passwd_t, allow_multiple), .dflt = "no" },
 
 	{ FR_CONF_OFFSET("hash_size", FR_TYPE_UINT32, rlm_passwd_t, hash_size), .dflt = "100" },
+
+	{ FR_CONF_OFFSET("mmap", FR_TYPE_BOOL, rlm_passwd_t, mmap), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("index_file", FR_TYPE_STRING, rlm_passwd_t, index_file) },
+
+	{ FR_CONF_OFFSET("reload", FR_TYPE_BOOL, rlm_passwd_t, reload), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("reload_delay", FR_TYPE_TIME_DELTA, rlm_passwd_t, reload_delay), .dflt = "1" },
 	CONF_PARSER_TERMINATOR
 };
 
+/** Find the key field of a line in a mapped passwd file
+ *
+ */
+static int passwd_line_key(char const **key, size_t *keylen, char const *line, size_t len, void *uctx)
+{
+	rlm_passwd_t const	*inst = talloc_get_type_abort_const(uctx, rlm_passwd_t);
+	char const		*p = line, *end = line + len, *q;
+	uint32_t		i;
+
+	if (inst->ignore_nislike && ((*line == '+') || (*line == '-'))) return 0;
+
+	for (i = 0; i < inst->key_field; i++) {
+		p = memchr(p, *inst->delimiter, end - p);
+		if (!p) return 0;
+		p++;
+	}
+
+	/*
+	 *	The last field gets the rest of the line.
+	 */
+	q = (inst->key_field + 1 < inst->num_fields) ? memchr(p, *inst->delimiter, end - p) : NULL;
+	if (!q) q = end;
+
+	if (q == p) return 0;
+
+	*key = p;
+	*keylen = q - p;
+
+	return 1;
+}
+
+/** Parse a line from a mapped passwd file into a temporary entry
+ *
+ */
+static struct mypasswd *passwd_line_to_entry(rlm_passwd_t const *inst, char const *line, size_t len)
+{
+	struct mypasswd	*pw;
+	char		buffer[1024];
+	size_t		pwlen;
+
+	if (len >= sizeof(buffer)) return NULL;
+
+	memcpy(buffer, line, len);
+	buffer[len] = '\0';
+
+	pw = mypasswd_alloc(buffer, inst->num_fields, &pwlen);
+	if (!string_to_entry(buffer, inst->num_fields, *inst->delimiter, pw, pwlen)) {
+		talloc_free(pw);
+		return NULL;
+	}
+
+	return pw;
+}
+
+/** (Re-)read the passwd file into a new hash table
+ *
+ * This is called from the reload thread, and so must not modify
+ * the instance data.
+ */
+static void *passwd_load(TALLOC_CTX *ctx, void *uctx)
+{
+	rlm_passwd_t const	*inst = talloc_get_type_abort_const(uctx, rlm_passwd_t);
+	struct hashtable	*ht;
+
+	if (inst->mmap) {
+		fr_line_index_t	*idx;
+		char		*params;
+
+		MEM(params = talloc_asprintf(ctx, "passwd:%u:%u:%c:%d", inst->num_fields, inst->key_field,
+					     *inst->delimiter, inst->ignore_nislike));
+
+		idx = fr_line_index_alloc(ctx, &(fr_line_index_config_t){
+						.filename = inst->filename,
+						.index_file = inst->index_file,
+						.params = params,
+						.key = passwd_line_key,
+						.uctx = UNCONST(rlm_passwd_t *, inst)
+					  });
+		if (!idx) {
+			PERROR("Can't index passwd file");
+			return NULL;
+		}
+
+		return idx;
+	}
+
+	ht = build_hash_table(inst->filename, inst->num_fields, inst->key_field, inst->listable,
+			      inst->hash_size, inst->ignore_nislike, *inst->delimiter);
+	if (!ht) {
+		ERROR("Can't build hashtable from passwd file");
+		return NULL;
+	}
+	talloc_steal(ctx, ht);
+
+	return ht;
+}
+
 static int mod_instantiate(void *instance, CONF_SECTION *conf)
 {
 	int			num_fields = 0, key_field = -1, listable = 0;
@@ -442,24 +558,13 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
-	inst->ht = build_hash_table(inst->filename, num_fields, key_field, listable,
-				    inst->hash_size, inst->ignore_nislike, *inst->delimiter);
-	if (!inst->ht){
-		ERROR("Can't build hashtable from passwd file");
-		return -1;
-	}
-
 	inst->pwd_fmt = mypasswd_alloc(inst->format, num_fields, &len);
 	if (!inst->pwd_fmt){
 		ERROR("Memory allocation failed");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 	if (!string_to_entry(inst->format, num_fields, ':', inst->pwd_fmt , len)) {
 		ERROR("Unable to convert format entry");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 
@@ -474,8 +579,6 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	}
 	if (!*inst->pwd_fmt->field[key_field]) {
 		cf_log_err(conf, "key field is empty");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 
@@ -483,8 +586,6 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 						  inst->pwd_fmt->field[key_field], true, true);
 	if (!da) {
 		PERROR("Unable to resolve attribute");
-		release_ht(inst->ht);
-		inst->ht = NULL;
 		return -1;
 	}
 
@@ -493,6 +594,17 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->key_field = key_field;
 	inst->listable = listable;
 
+	if (inst->mmap && listable) {
+		cf_log_err(conf, "'mmap = yes' cannot be used with a listable key field");
+		return -1;
+	}
+
+	FR_TIME_DELTA_BOUND_CHECK("reload_delay", inst->reload_delay, >=, fr_time_delta_from_msec(100));
+
+	inst->ht = fr_reload_alloc(inst, cf_section_name(conf), &inst->filename, inst->reload ? 1 : 0,
+				   inst->reload_delay, passwd_load, inst);
+	if (!inst->ht) return -1;
+
 	DEBUG3("num_fields: %d key_field %d(%s) listable: %s", num_fields, key_field,
 	       inst->pwd_fmt->field[key_field], listable ? "yes" : "no");
 
@@ -503,10 +615,7 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 
 static int mod_detach (void *instance) {
 #define inst ((rlm_passwd_t *)instance)
-	if(inst->ht) {
-		release_ht(inst->ht);
-		inst->ht = NULL;
-	}
+	TALLOC_FREE(inst->ht);
 	talloc_free(inst->pwd_fmt);
 	return 0;
 #undef inst
@@ -533,6 +642,13 @@ static void result_add(TALLOC_CTX *ctx, rlm_passwd_t const *inst, request_t *req
 	}
 }
 
+static void result_add_all(request_t *request, rlm_passwd_t const *inst, struct mypasswd *pw)
+{
+	result_add(request->control_ctx, inst, request, &request->control_pairs, pw, 0, "config");
+	result_add(request->reply_ctx, inst, request, &request->reply_pairs, pw, 1, "reply_items");
+	result_add(request->request_ctx, inst, request, &request->request_pairs, pw, 2, "request_items");
+}
+
 static unlang_action_t CC_HINT(nonnull) mod_passwd_map(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_passwd_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_passwd_t);
@@ -542,10 +658,14 @@ static unlang_action_t CC_HINT(nonnull) mod_passwd_map(rlm_rcode_t *p_result, mo
 	struct mypasswd		*pw, *last_found;
 	fr_dcursor_t		cursor;
 	int			found = 0;
+	fr_reload_ref_t		ref;
+	void			*data;
 
 	key = fr_pair_find_by_da(&request->request_pairs, inst->keyattr, 0);
 	if (!key) RETURN_MODULE_NOTFOUND;
 
+	data = fr_reload_acquire(&ref, inst->ht);
+
 	for (i = fr_dcursor_iter_by_da_init(&cursor, &request->request_pairs, inst->keyattr);
 	     i;
 	     i = fr_dcursor_next(&cursor)) {
@@ -560,20 +680,40 @@ static unlang_action_t CC_HINT(nonnull) mod_passwd_map(rlm_rcode_t *p_result, mo
 		buffer[0] = '\0';
 #endif
 		fr_pair_print_value_quoted(&FR_SBUFF_OUT(buffer, sizeof(buffer)), i, T_BARE_WORD);
-		pw = get_pw_nam(buffer, inst->ht, &last_found);
-		if (!pw) continue;
+		if (inst->mmap) {
+			fr_line_index_t	*idx = data;
+			char const	*line;
+			size_t		pos, len, keylen = strlen(buffer);
+
+			line = fr_line_index_find(idx, &pos, &len, buffer, keylen);
+			if (!line) continue;
+
+			do {
+				pw = passwd_line_to_entry(inst, line, len);
+				if (!pw) {
+					RWDEBUG("Ignoring malformed entry for %s", buffer);
+					continue;
+				}
+
+				result_add_all(request, inst, pw);
+				talloc_free(pw);
+			} while ((line = fr_line_index_next(idx, &pos, &len, buffer, keylen)));
+		} else {
+			pw = get_pw_nam(buffer, data, &last_found);
+			if (!pw) continue;
 
-		do {
-			result_add(request->control_ctx, inst, request, &request->control_pairs, pw, 0, "config");
-			result_add(request->reply_ctx, inst, request, &request->reply_pairs, pw, 1, "reply_items");
-			result_add(request->request_ctx, inst, request, &request->request_pairs, pw, 2, "request_items");
-		} while ((pw = get_next(buffer, inst->ht, &last_found)));
+			do {
+				result_add_all(request, inst, pw);
+			} while ((pw = get_next(buffer, data, &last_found)));
+		}
 
 		found++;
 
 		if (!inst->allow_multiple) break;
 	}
 
+	fr_reload_release(&ref);
+
 	if (!found) RETURN_MODULE_NOTFOUND;
 
 	RETURN_MODULE_OK;
@@ -26,6 +26,7 @@ RCSID("$Id$")
 
 #define LOG_PREFIX "rlm_perl - "
 
+#include <freeradius-devel/io/lang_pool.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/util/debug.h>
@@ -74,12 +75,41 @@ typedef struct {
 	bool		perl_parsed;
 	HV		*rad_perlconf_hv;	//!< holds "config" items (perl %RAD_PERLCONF hash).
 
+	bool		lazy_pairs;		//!< Tie the %RAD_* hashes to the request's pair lists.
+
+	bool		out_of_process;		//!< Run the interpreter in child processes.
+	size_t		ring_size;		//!< Of the rings to and from each child.
+	fr_lang_pool_t	*pool;			//!< The child processes.
 } rlm_perl_t;
 
+/** State of one of the tied %RAD_* hashes
+ *
+ */
+typedef struct {
+	char const		*hash_name;	//!< Name of the hash, for debug messages.
+	tmpl_pair_list_t	list;		//!< Pair list of the current request the hash refers to.
+	unsigned int		iter;		//!< Position of the next key returned by each().
+} rlm_perl_pairs_t;
+
 typedef struct {
 	PerlInterpreter		*perl;	//!< Thread specific perl interpreter.
+	rlm_perl_pairs_t	pairs[4];	//!< Tied hash state, when lazy_pairs is set.
+	fr_lang_pool_thread_t	*pool;	//!< With out_of_process, our child.
 } rlm_perl_thread_t;
 
+/** Functions which can be run in a child process
+ *
+ */
+typedef enum {
+	PERL_METHOD_AUTHORIZE = 0,
+	PERL_METHOD_AUTHENTICATE,
+	PERL_METHOD_POST_AUTH,
+	PERL_METHOD_PREACCT,
+	PERL_METHOD_ACCOUNTING,
+	PERL_METHOD_START_ACCOUNTING,
+	PERL_METHOD_STOP_ACCOUNTING
+} rlm_perl_method_t;
+
 typedef struct {
 	rlm_perl_t		*inst;	//!< Module global instance
 } rlm_perl_xlat_t;
@@ -108,6 +138,11 @@ static const CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("perl_flags", FR_TYPE_STRING, rlm_perl_t, perl_flags) },
 
+	{ FR_CONF_OFFSET("lazy_pairs", FR_TYPE_BOOL, rlm_perl_t, lazy_pairs), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("out_of_process", FR_TYPE_BOOL, rlm_perl_t, out_of_process), .dflt = "no" },
+	{ FR_CONF_OFFSET("ring_size", FR_TYPE_SIZE, rlm_perl_t, ring_size), .dflt = "1M" },
+
 	{ FR_CONF_OFFSET("func_start_accounting", FR_TYPE_STRING, rlm_perl_t, func_start_accounting) },
 
 	{ FR_CONF_OFFSET("func_stop_accounting", FR_TYPE_STRING, rlm_perl_t, func_stop_accounting) },
@@ -143,6 +178,9 @@ EXTERN_C void boot_DynaLoader(pTHX_ CV* cv);
 
 static _Thread_local request_t *rlm_perl_request;
 
+static int pairadd_sv(TALLOC_CTX *ctx, request_t *request, fr_pair_list_t *vps, char *key, SV *sv, fr_token_t op,
+		      const char *hash_name, const char *list_name);
+
 #  define dl_librefs "DynaLoader::dl_librefs"
 #  define dl_modules "DynaLoader::dl_modules"
 static void rlm_perl_clear_handles(pTHX)
@@ -261,6 +299,388 @@ static XS(XS_radiusd_xlat)
 	XSRETURN(1);
 }
 
+/*
+ *	Tied hashes giving access to the pair lists of the current
+ *	request, used when "lazy_pairs" is set.
+ *
+ *	Rather than converting every list into a hash before each
+ *	call, and converting the hashes back afterwards, values are
+ *	converted when a key is read, and only the keys which are
+ *	written to are changed in the request.
+ */
+#define PERL_PAIRS_CLASS "radiusd::PairList"
+
+/** Convert a pair's value to a new SV
+ *
+ */
+static SV *perl_vp_to_sv(pTHX_ fr_pair_t const *vp)
+{
+	SV *sv;
+
+	switch (vp->vp_type) {
+	case FR_TYPE_STRING:
+		sv = newSVpvn(vp->vp_strvalue, vp->vp_length);
+		break;
+
+	case FR_TYPE_OCTETS:
+		sv = newSVpvn((char const *)vp->vp_octets, vp->vp_length);
+		break;
+
+	default:
+	{
+		char	buffer[1024];
+		ssize_t	slen;
+
+		slen = fr_pair_print_value_quoted(&FR_SBUFF_OUT(buffer, sizeof(buffer)), vp, T_BARE_WORD);
+		if (slen < 0) return newSV(0);
+
+		sv = newSVpvn(buffer, (size_t)slen);
+	}
+		break;
+	}
+
+	SvTAINT(sv);
+	return sv;
+}
+
+/** Set a pair's value from a string provided by Perl
+ *
+ */
+static int perl_pair_value_set(fr_pair_t *vp, char const *val, STRLEN len)
+{
+	switch (vp->vp_type) {
+	case FR_TYPE_STRING:
+		fr_pair_value_bstrndup(vp, val, len, true);
+		break;
+
+	case FR_TYPE_OCTETS:
+		fr_pair_value_memdup(vp, (uint8_t const *)val, len, true);
+		break;
+
+	default:
+		if (fr_pair_value_from_str(vp, val, len, '\0', false) < 0) return -1;
+	}
+
+	VP_VERIFY(vp);
+
+	return 0;
+}
+
+/** Retrieve the pair list a tied hash refers to, croaking if we're not processing a request
+ *
+ */
+static rlm_perl_pairs_t *perl_pairs_from_sv(pTHX_ SV *self, request_t **request,
+					    fr_pair_list_t **list, TALLOC_CTX **ctx)
+{
+	rlm_perl_pairs_t *pairs = INT2PTR(rlm_perl_pairs_t *, SvIV(SvRV(self)));
+
+	*request = rlm_perl_request;
+	if (!*request) croak("%%%s is only available when processing a request", pairs->hash_name);
+
+	*list = tmpl_list_head(*request, pairs->list);
+	if (ctx) *ctx = tmpl_list_ctx(*request, pairs->list);
+	if (!*list || (ctx && !*ctx)) croak("%%%s is not available for this request", pairs->hash_name);
+
+	return pairs;
+}
+
+/** Resolve a hash key to an attribute in the dictionary of the current request
+ *
+ */
+static fr_dict_attr_t const *perl_pairs_key_to_da(request_t *request, char const *key)
+{
+	return fr_dict_attr_search_by_qualified_oid(NULL, request->dict, key, true, true);
+}
+
+/** Return the pair list as the value of a hash key
+ *
+ * Single instances are returned as a scalar, multiple instances as an
+ * array ref, in the same way as the hashes are populated when
+ * "lazy_pairs" isn't set.
+ */
+static SV *perl_pairs_fetch(pTHX_ fr_pair_list_t *list, fr_dict_attr_t const *da)
+{
+	fr_dcursor_t	cursor;
+	fr_pair_t	*vp, *next;
+	AV		*av;
+
+	vp = fr_dcursor_iter_by_da_init(&cursor, list, da);
+	if (!vp) return NULL;
+
+	next = fr_dcursor_next(&cursor);
+	if (!next) return perl_vp_to_sv(aTHX_ vp);
+
+	av = newAV();
+	av_push(av, perl_vp_to_sv(aTHX_ vp));
+	do {
+		av_push(av, perl_vp_to_sv(aTHX_ next));
+	} while ((next = fr_dcursor_next(&cursor)));
+
+	return newRV_noinc((SV *)av);
+}
+
+/** Return the nth distinct attribute in the list
+ *
+ * Keys are returned in the order of the first instance of each attribute,
+ * which is stable as long as existing keys are only modified.
+ */
+static fr_pair_t *perl_pairs_key_at(fr_pair_list_t *list, unsigned int n)
+{
+	fr_pair_t	*vp;
+
+	for (vp = fr_pair_list_head(list); vp; vp = fr_pair_list_next(list, vp)) {
+		if (fr_pair_find_by_da(list, vp->da, 0) != vp) continue;	/* Not the first instance */
+		if (n-- == 0) return vp;
+	}
+
+	return NULL;
+}
+
+/** Return the position of an attribute in the key order
+ *
+ */
+static unsigned int perl_pairs_key_index(fr_pair_list_t *list, fr_pair_t const *first)
+{
+	fr_pair_t	*vp;
+	unsigned int	n = 0;
+
+	for (vp = fr_pair_list_head(list); vp && (vp != first); vp = fr_pair_list_next(list, vp)) {
+		if (fr_pair_find_by_da(list, vp->da, 0) == vp) n++;
+	}
+
+	return n;
+}
+
+static XS(XS_pairlist_fetch)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+	request_t		*request;
+	fr_pair_list_t		*list;
+	fr_dict_attr_t const	*da;
+	SV			*sv;
+
+	if (items != 2) croak("Usage: " PERL_PAIRS_CLASS "::FETCH(self, key)");
+
+	pairs = perl_pairs_from_sv(aTHX_ ST(0), &request, &list, NULL);
+
+	da = perl_pairs_key_to_da(request, SvPV_nolen(ST(1)));
+	if (!da) XSRETURN_UNDEF;
+
+	sv = perl_pairs_fetch(aTHX_ list, da);
+	if (!sv) XSRETURN_UNDEF;
+
+	RDEBUG3("$%s{'%s'} <- &%s.%s", pairs->hash_name, da->name,
+		fr_table_str_by_value(pair_list_table, pairs->list, "<INVALID>"), da->name);
+
+	ST(0) = sv_2mortal(sv);
+	XSRETURN(1);
+}
+
+static XS(XS_pairlist_store)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+	request_t		*request;
+	fr_pair_list_t		*list;
+	TALLOC_CTX		*ctx;
+	fr_dict_attr_t const	*da;
+	fr_pair_t		*vp;
+	char			*key;
+	SV			*value;
+	SV			**values;
+	I32			num, i = 0;
+	char const		*list_name;
+
+	if (items != 3) croak("Usage: " PERL_PAIRS_CLASS "::STORE(self, key, value)");
+
+	pairs = perl_pairs_from_sv(aTHX_ ST(0), &request, &list, &ctx);
+	list_name = fr_table_str_by_value(pair_list_table, pairs->list, "<INVALID>");
+	key = SvPV_nolen(ST(1));
+	value = ST(2);
+
+	if (SvROK(value) && (SvTYPE(SvRV(value)) == SVt_PVAV)) {
+		AV *av = (AV *)SvRV(value);
+
+		values = AvARRAY(av);
+		num = av_len(av) + 1;
+	} else {
+		values = &value;
+		num = 1;
+	}
+
+	/*
+	 *	Modify the first instance in place, so that
+	 *	the key keeps its position if someone is
+	 *	iterating over the hash, then replace the
+	 *	remaining instances.
+	 */
+	da = perl_pairs_key_to_da(request, key);
+	if (da && (vp = fr_pair_find_by_da(list, da, 0))) {
+		fr_pair_t	*next;
+		char const	*val;
+		STRLEN		len;
+
+		while ((next = fr_pair_find_by_da(list, da, 1))) talloc_free(fr_pair_remove(list, next));
+
+		while ((i < num) && (!values[i] || !SvOK(values[i]))) i++;
+
+		/*
+		 *	Storing undef removes the attribute
+		 */
+		if (i == num) {
+			if (perl_pairs_key_index(list, vp) < pairs->iter) pairs->iter--;
+			talloc_free(fr_pair_remove(list, vp));
+			XSRETURN_EMPTY;
+		}
+
+		val = SvPV(values[i], len);
+		if (perl_pair_value_set(vp, val, len) < 0) {
+			RPEDEBUG("Failed setting &%s.%s from $%s{'%s'}", list_name, key, pairs->hash_name, key);
+		} else {
+			RDEBUG2("&%s.%s := $%s{'%s'} -> '%s'", list_name, key, pairs->hash_name, key, val);
+		}
+		i++;
+	}
+
+	for (; i < num; i++) {
+		if (!values[i]) continue;
+		(void)pairadd_sv(ctx, request, list, key, values[i], T_OP_ADD, pairs->hash_name, list_name);
+	}
+
+	XSRETURN_EMPTY;
+}
+
+static XS(XS_pairlist_exists)
+{
+	dXSARGS;
+	request_t		*request;
+	fr_pair_list_t		*list;
+	fr_dict_attr_t const	*da;
+
+	if (items != 2) croak("Usage: " PERL_PAIRS_CLASS "::EXISTS(self, key)");
+
+	(void)perl_pairs_from_sv(aTHX_ ST(0), &request, &list, NULL);
+
+	da = perl_pairs_key_to_da(request, SvPV_nolen(ST(1)));
+	if (!da || !fr_pair_find_by_da(list, da, 0)) XSRETURN_NO;
+
+	XSRETURN_YES;
+}
+
+static XS(XS_pairlist_delete)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+	request_t		*request;
+	fr_pair_list_t		*list;
+	fr_dict_attr_t const	*da;
+	fr_pair_t		*first;
+	SV			*sv;
+
+	if (items != 2) croak("Usage: " PERL_PAIRS_CLASS "::DELETE(self, key)");
+
+	pairs = perl_pairs_from_sv(aTHX_ ST(0), &request, &list, NULL);
+
+	da = perl_pairs_key_to_da(request, SvPV_nolen(ST(1)));
+	if (!da || !(first = fr_pair_find_by_da(list, da, 0))) XSRETURN_UNDEF;
+
+	/*
+	 *	Deleting the key we just returned from
+	 *	each() must not skip the next one.
+	 */
+	if (perl_pairs_key_index(list, first) < pairs->iter) pairs->iter--;
+
+	sv = perl_pairs_fetch(aTHX_ list, da);
+	fr_pair_delete_by_da(list, da);
+
+	RDEBUG2("&%s.%s !* ANY <- delete $%s{'%s'}",
+		fr_table_str_by_value(pair_list_table, pairs->list, "<INVALID>"), da->name,
+		pairs->hash_name, da->name);
+
+	if (!sv) XSRETURN_UNDEF;
+	ST(0) = sv_2mortal(sv);
+	XSRETURN(1);
+}
+
+static XS(XS_pairlist_clear)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+	request_t		*request;
+	fr_pair_list_t		*list;
+
+	if (items != 1) croak("Usage: " PERL_PAIRS_CLASS "::CLEAR(self)");
+
+	pairs = perl_pairs_from_sv(aTHX_ ST(0), &request, &list, NULL);
+
+	fr_pair_list_free(list);
+	pairs->iter = 0;
+
+	XSRETURN_EMPTY;
+}
+
+static XS(XS_pairlist_firstkey)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+	request_t		*request;
+	fr_pair_list_t		*list;
+	fr_pair_t		*vp;
+
+	if (items != 1) croak("Usage: " PERL_PAIRS_CLASS "::FIRSTKEY(self)");
+
+	pairs = perl_pairs_from_sv(aTHX_ ST(0), &request, &list, NULL);
+	pairs->iter = 0;
+
+	vp = perl_pairs_key_at(list, pairs->iter);
+	if (!vp) XSRETURN_UNDEF;
+	pairs->iter++;
+
+	XST_mPV(0, vp->da->name);
+	XSRETURN(1);
+}
+
+static XS(XS_pairlist_nextkey)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+	request_t		*request;
+	fr_pair_list_t		*list;
+	fr_pair_t		*vp;
+
+	if (items != 2) croak("Usage: " PERL_PAIRS_CLASS "::NEXTKEY(self, lastkey)");
+
+	pairs = perl_pairs_from_sv(aTHX_ ST(0), &request, &list, NULL);
+
+	vp = perl_pairs_key_at(list, pairs->iter);
+	if (!vp) XSRETURN_UNDEF;
+	pairs->iter++;
+
+	XST_mPV(0, vp->da->name);
+	XSRETURN(1);
+}
+
+/** Tie one of the %RAD_* hashes to a pair list of the current request
+ *
+ */
+static void perl_pairs_tie(pTHX_ char const *hash_name, rlm_perl_pairs_t *pairs, tmpl_pair_list_t list)
+{
+	HV	*hv = get_hv(hash_name, 1);
+	SV	*obj;
+
+	pairs->hash_name = hash_name;
+	pairs->list = list;
+	pairs->iter = 0;
+
+	hv_clear(hv);
+
+	obj = newSV(0);
+	sv_setref_pv(obj, PERL_PAIRS_CLASS, pairs);
+	sv_magic((SV *)hv, obj, PERL_MAGIC_tied, NULL, 0);
+	SvREFCNT_dec(obj);		/* sv_magic holds a reference */
+}
+
 static void xs_init(pTHX)
 {
 	char const *file = __FILE__;
@@ -270,6 +690,14 @@ static void xs_init(pTHX)
 
 	newXS("radiusd::log",XS_radiusd_log, "rlm_perl");
 	newXS("radiusd::xlat",XS_radiusd_xlat, "rlm_perl");
+
+	newXS(PERL_PAIRS_CLASS "::FETCH", XS_pairlist_fetch, "rlm_perl");
+	newXS(PERL_PAIRS_CLASS "::STORE", XS_pairlist_store, "rlm_perl");
+	newXS(PERL_PAIRS_CLASS "::EXISTS", XS_pairlist_exists, "rlm_perl");
+	newXS(PERL_PAIRS_CLASS "::DELETE", XS_pairlist_delete, "rlm_perl");
+	newXS(PERL_PAIRS_CLASS "::CLEAR", XS_pairlist_clear, "rlm_perl");
+	newXS(PERL_PAIRS_CLASS "::FIRSTKEY", XS_pairlist_firstkey, "rlm_perl");
+	newXS(PERL_PAIRS_CLASS "::NEXTKEY", XS_pairlist_nextkey, "rlm_perl");
 }
 
 /** Convert a list of value boxes to a Perl array for passing to subroutines
@@ -530,7 +958,9 @@ static xlat_action_t perl_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out, request_t *re
 
 		PUTBACK;
 
+		rlm_perl_request = request;
 		count = call_pv(func->vb_strvalue, G_ARRAY | G_EVAL);
+		rlm_perl_request = NULL;
 
 		SPAGAIN;
 		if (SvTRUE(ERRSV)) {
@@ -790,20 +1220,7 @@ static int pairadd_sv(TALLOC_CTX *ctx, request_t *request, fr_pair_list_t *vps,
 		return -1;
 	}
 
-	switch (vp->vp_type) {
-	case FR_TYPE_STRING:
-		fr_pair_value_bstrndup(vp, val, len, true);
-		break;
-
-	case FR_TYPE_OCTETS:
-		fr_pair_value_memdup(vp, (uint8_t const *)val, len, true);
-		break;
-
-	default:
-		if (fr_pair_value_from_str(vp, val, len, '\0', false) < 0) goto fail;
-	}
-
-	VP_VERIFY(vp);
+	if (perl_pair_value_set(vp, val, len) < 0) goto fail;
 
 	RDEBUG2("&%s.%s %s $%s{'%s'} -> '%s'", list_name, key, fr_table_str_by_value(fr_tokens_table, op, "<INVALID>"),
 	        hash_name, key, val);
@@ -880,10 +1297,16 @@ static unlang_action_t do_perl(rlm_rcode_t *p_result, void *instance, request_t
 		rad_request_hv = get_hv("RAD_REQUEST", 1);
 		rad_state_hv = get_hv("RAD_STATE", 1);
 
-		perl_store_vps(request->request_ctx, request, &request->request_pairs, rad_request_hv, "RAD_REQUEST", "request");
-		perl_store_vps(request->reply_ctx, request, &request->reply_pairs, rad_reply_hv, "RAD_REPLY", "reply");
-		perl_store_vps(request->control_ctx, request, &request->control_pairs, rad_config_hv, "RAD_CONFIG", "control");
-		perl_store_vps(request->session_state_ctx, request, &request->session_state_pairs, rad_state_hv, "RAD_STATE", "session-state");
+		/*
+		 *	If the hashes are tied to the request,
+		 *	values are converted as they're accessed.
+		 */
+		if (!inst->lazy_pairs) {
+			perl_store_vps(request->request_ctx, request, &request->request_pairs, rad_request_hv, "RAD_REQUEST", "request");
+			perl_store_vps(request->reply_ctx, request, &request->reply_pairs, rad_reply_hv, "RAD_REPLY", "reply");
+			perl_store_vps(request->control_ctx, request, &request->control_pairs, rad_config_hv, "RAD_CONFIG", "control");
+			perl_store_vps(request->session_state_ctx, request, &request->session_state_pairs, rad_state_hv, "RAD_STATE", "session-state");
+		}
 
 		/*
 		 * Store pointer to request structure globally so radiusd::xlat works
@@ -922,6 +1345,11 @@ static unlang_action_t do_perl(rlm_rcode_t *p_result, void *instance, request_t
 		FREETMPS;
 		LEAVE;
 
+		/*
+		 *	...and changes were made as they were stored.
+		 */
+		if (inst->lazy_pairs) RETURN_MODULE_RCODE(ret);
+
 		fr_pair_list_init(&vps);
 		if ((get_hv_content(request->request_ctx, request, rad_request_hv, &vps, "RAD_REQUEST", "request")) == 0) {
 			fr_pair_list_free(&request->request_pairs);
@@ -950,19 +1378,62 @@ static unlang_action_t do_perl(rlm_rcode_t *p_result, void *instance, request_t
 	RETURN_MODULE_RCODE(ret);
 }
 
-#define RLM_PERL_FUNC(_x) \
+static char const *perl_method_func(rlm_perl_t const *inst, unsigned int method)
+{
+	switch (method) {
+	case PERL_METHOD_AUTHORIZE:
+		return inst->func_authorize;
+
+	case PERL_METHOD_AUTHENTICATE:
+		return inst->func_authenticate;
+
+	case PERL_METHOD_POST_AUTH:
+		return inst->func_post_auth;
+
+	case PERL_METHOD_PREACCT:
+		return inst->func_preacct;
+
+	case PERL_METHOD_ACCOUNTING:
+		return inst->func_accounting;
+
+	case PERL_METHOD_START_ACCOUNTING:
+		return inst->func_start_accounting;
+
+	case PERL_METHOD_STOP_ACCOUNTING:
+		return inst->func_stop_accounting;
+
+	default:
+		return NULL;
+	}
+}
+
+/** Call a function, either in our interpreter, or in our child
+ *
+ */
+static unlang_action_t perl_method_call(rlm_rcode_t *p_result, rlm_perl_t *inst, rlm_perl_thread_t *t,
+					request_t *request, rlm_perl_method_t method)
+{
+	char const *func = perl_method_func(inst, method);
+
+	if (!func) RETURN_MODULE_FAIL;
+
+	if (t->pool) return fr_lang_pool_call(p_result, t->pool, request, method);
+
+	return do_perl(p_result, inst, request, t->perl, func);
+}
+
+#define RLM_PERL_FUNC(_x, _method) \
 static unlang_action_t CC_HINT(nonnull) mod_##_x(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request) \
 { \
 	rlm_perl_t *inst = talloc_get_type_abort(mctx->instance, rlm_perl_t); \
-	return do_perl(p_result, inst, request, \
-		       ((rlm_perl_thread_t *)talloc_get_type_abort(mctx->thread, rlm_perl_thread_t))->perl, \
-		       inst->func_##_x); \
+	return perl_method_call(p_result, inst, talloc_get_type_abort(mctx->thread, rlm_perl_thread_t), \
+				request, _method); \
 }
 
-RLM_PERL_FUNC(authorize)
-RLM_PERL_FUNC(authenticate)
-RLM_PERL_FUNC(post_auth)
-RLM_PERL_FUNC(preacct)
+RLM_PERL_FUNC(authorize, PERL_METHOD_AUTHORIZE)
+RLM_PERL_FUNC(authenticate, PERL_METHOD_AUTHENTICATE)
+RLM_PERL_FUNC(post_auth, PERL_METHOD_POST_AUTH)
+RLM_PERL_FUNC(preacct, PERL_METHOD_PREACCT)
 
 /*
  *	Write accounting information to this modules database.
@@ -972,7 +1443,7 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 	rlm_perl_t	 	*inst = talloc_get_type_abort(mctx->instance, rlm_perl_t);
 	fr_pair_t		*pair;
 	int 			acct_status_type = 0;
-	char const		*func;
+	rlm_perl_method_t	method;
 
 	pair = fr_pair_find_by_da(&request->request_pairs, attr_acct_status_type, 0);
 	if (pair != NULL) {
@@ -985,27 +1456,64 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 	switch (acct_status_type) {
 	case FR_STATUS_START:
 		if (inst->func_start_accounting) {
-			func = inst->func_start_accounting;
+			method = PERL_METHOD_START_ACCOUNTING;
 		} else {
-			func = inst->func_accounting;
+			method = PERL_METHOD_ACCOUNTING;
 		}
 		break;
 
 	case FR_STATUS_STOP:
 		if (inst->func_stop_accounting) {
-			func = inst->func_stop_accounting;
+			method = PERL_METHOD_STOP_ACCOUNTING;
 		} else {
-			func = inst->func_accounting;
+			method = PERL_METHOD_ACCOUNTING;
 		}
 		break;
 
 	default:
-		func = inst->func_accounting;
+		method = PERL_METHOD_ACCOUNTING;
 		break;
 	}
 
-	return do_perl(p_result, inst, request,
-		       ((rlm_perl_thread_t *)talloc_get_type_abort(mctx->thread, rlm_perl_thread_t))->perl, func);
+	return perl_method_call(p_result, inst, talloc_get_type_abort(mctx->thread, rlm_perl_thread_t),
+				request, method);
+}
+
+/** Run a function in a child process
+ *
+ * The child has a single thread, so it uses the interpreter the
+ * script was parsed with.
+ */
+static rlm_rcode_t perl_lang_pool_call(request_t *request, unsigned int method, void *uctx)
+{
+	rlm_perl_t	*inst = talloc_get_type_abort(uctx, rlm_perl_t);
+	rlm_rcode_t	rcode;
+
+	do_perl(&rcode, inst, request, inst->perl, perl_method_func(inst, method));
+
+	return rcode;
+}
+
+/*
+ *	With lazy_pairs, the hashes are tied once, in
+ *	each child.
+ */
+static void perl_post_fork_child(void *uctx)
+{
+	rlm_perl_t		*inst = talloc_get_type_abort(uctx, rlm_perl_t);
+	static rlm_perl_pairs_t	pairs[4];
+
+	if (!inst->lazy_pairs) return;
+
+	{
+		dTHXa(inst->perl);
+		PERL_SET_CONTEXT(inst->perl);
+
+		perl_pairs_tie(aTHX_ "RAD_REQUEST", &pairs[0], PAIR_LIST_REQUEST);
+		perl_pairs_tie(aTHX_ "RAD_REPLY", &pairs[1], PAIR_LIST_REPLY);
+		perl_pairs_tie(aTHX_ "RAD_CONFIG", &pairs[2], PAIR_LIST_CONTROL);
+		perl_pairs_tie(aTHX_ "RAD_STATE", &pairs[3], PAIR_LIST_STATE);
+	}
 }
 
 DIAG_OFF(DIAG_UNKNOWN_PRAGMAS)
@@ -1039,13 +1547,25 @@ DIAG_ON(shadow)
 DIAG_ON(DIAG_UNKNOWN_PRAGMAS)
 
 static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
-				  UNUSED fr_event_list_t *el, void *thread)
+				  fr_event_list_t *el, void *thread)
 {
 	rlm_perl_t		*inst = talloc_get_type_abort(instance, rlm_perl_t);
 	rlm_perl_thread_t	*t = talloc_get_type_abort(thread, rlm_perl_thread_t);
 	PerlInterpreter		*interp;
 	UV			clone_flags = 0;
 
+	/*
+	 *	Module methods run in our child, but
+	 *	the xlat still needs an interpreter.
+	 */
+	if (inst->pool) {
+		t->pool = fr_lang_pool_thread_alloc(t, inst->pool, el);
+		if (!t->pool) {
+			PERROR("Failed claiming worker process");
+			return -1;
+		}
+	}
+
 	PERL_SET_CONTEXT(inst->perl);
 
 	interp = perl_clone(inst->perl, clone_flags);
@@ -1063,6 +1583,17 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 
 	t->perl = interp;			/* Store perl interp for easy freeing later */
 
+	/*
+	 *	Tie the hashes once, they stay tied for the
+	 *	lifetime of the interpreter.
+	 */
+	if (inst->lazy_pairs) {
+		perl_pairs_tie(aTHX_ "RAD_REQUEST", &t->pairs[0], PAIR_LIST_REQUEST);
+		perl_pairs_tie(aTHX_ "RAD_REPLY", &t->pairs[1], PAIR_LIST_REPLY);
+		perl_pairs_tie(aTHX_ "RAD_CONFIG", &t->pairs[2], PAIR_LIST_CONTROL);
+		perl_pairs_tie(aTHX_ "RAD_STATE", &t->pairs[3], PAIR_LIST_STATE);
+	}
+
 	return 0;
 }
 
@@ -1159,6 +1690,25 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 
 	PL_endav = end_AV;
 
+	/*
+	 *	The children inherit the interpreter as
+	 *	the script's top level code left it.
+	 */
+	if (inst->out_of_process) {
+		inst->pool = fr_lang_pool_alloc(inst, "perl",
+						&(fr_lang_pool_config_t){
+							.ring_size = inst->ring_size,
+							.copy_request = true,
+							.func = perl_lang_pool_call,
+							.post_fork_child = perl_post_fork_child,
+							.uctx = inst
+						});
+		if (!inst->pool) {
+			PERROR("Failed starting worker processes");
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
@@ -1171,6 +1721,11 @@ static int mod_detach(void *instance)
 	rlm_perl_t	*inst = (rlm_perl_t *) instance;
 	int 		ret = 0, count = 0;
 
+	/*
+	 *	Stop the children before the interpreter
+	 *	they were forked from goes away.
+	 */
+	TALLOC_FREE(inst->pool);
 
 	if (inst->perl_parsed) {
 		dTHXa(inst->perl);
@@ -30,6 +30,7 @@ RCSID("$Id$")
 #define LOG_PREFIX "rlm_python (%s) - "
 #define LOG_PREFIX_ARGS inst->name
 
+#include <freeradius-devel/io/lang_pool.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/pairmove.h>
@@ -52,18 +53,15 @@ typedef struct {
 	char const	*function_name;		//!< String name of function in module.
 } python_func_def_t;
 
-/** An instance of the rlm_python module
+/** Everything which exists once per interpreter
  *
+ * Normally there's one interpreter per module instance, shared by all
+ * threads.  With interpreter_per_thread, each thread gets its own.
  */
 typedef struct {
-	char const	*name;			//!< Name of the module instance
-	PyThreadState	*interpreter;		//!< The interpreter used for this instance of rlm_python.
-	char const	*python_path;		//!< Path to search for python files in.
-	bool		python_path_include_conf_dir;	//!< Include the directory of the current
-							///< rlm_python module config in the python path.
-	bool		python_path_include_default;	//!< Include the default python path
-							///< in the python path.
+	PyThreadState	*interpreter;		//!< The thread state the interpreter was created with.
 	PyObject	*module;		//!< Local, interpreter specific module.
+	PyTypeObject	*pairs_type;		//!< For lazily converted pair lists.
 
 	python_func_def_t
 	instantiate,
@@ -76,6 +74,28 @@ typedef struct {
 
 	PyObject	*pythonconf_dict;	//!< Configuration parameters defined in the module
 						//!< made available to the python script.
+} python_interp_t;
+
+/** An instance of the rlm_python module
+ *
+ */
+typedef struct {
+	char const	*name;			//!< Name of the module instance
+	python_interp_t	interp;			//!< The interpreter used for this instance of rlm_python.
+						///< Function names are always read into this one.
+	char const	*python_path;		//!< Path to search for python files in.
+	bool		python_path_include_conf_dir;	//!< Include the directory of the current
+							///< rlm_python module config in the python path.
+	bool		python_path_include_default;	//!< Include the default python path
+							///< in the python path.
+	char		*path;			//!< The full python path, built at instantiation.
+
+	bool		interpreter_per_thread;	//!< Give each thread its own interpreter, and GIL.
+	bool		lazy_pairs;		//!< Convert the request list to Python objects on demand.
+
+	bool		out_of_process;		//!< Run the interpreter in child processes.
+	size_t		ring_size;		//!< Of the rings to and from each child.
+	fr_lang_pool_t	*pool;			//!< The child processes.
 } rlm_python_t;
 
 /** Tracks a python module inst/thread state pair
@@ -85,31 +105,59 @@ typedef struct {
  */
 typedef struct {
 	PyThreadState	*state;			//!< Module instance/thread specific state.
+	python_interp_t	*interp;		//!< The instance's interpreter, or with
+						///< interpreter_per_thread, our own.
+	fr_lang_pool_thread_t *pool;		//!< With out_of_process, our child.
 } rlm_python_thread_t;
 
+/** Methods which can be run in a child process
+ *
+ */
+typedef enum {
+	PYTHON_METHOD_AUTHENTICATE = 0,
+	PYTHON_METHOD_AUTHORIZE,
+	PYTHON_METHOD_PREACCT,
+	PYTHON_METHOD_ACCOUNTING,
+	PYTHON_METHOD_POST_AUTH
+} python_method_t;
+
+/** Lazily converted list of (attribute, value) tuples
+ *
+ * Behaves like the tuple of tuples normally passed to functions, but
+ * only converts the pairs which are accessed.  Is only valid for the
+ * duration of the call it was passed to.
+ */
+typedef struct {
+	PyObject_HEAD
+	rlm_python_t const	*inst;		//!< For error logging.
+	request_t		*request;	//!< NULL once the call has returned.
+	fr_pair_list_t		*list;		//!< Being converted.
+	fr_pair_t		*vp;		//!< Last pair accessed, makes iteration O(n).
+	Py_ssize_t		idx;		//!< Index of vp.
+	Py_ssize_t		len;		//!< Number of pairs in list.
+} python_pairs_t;
+
 static void		*python_dlhandle;
 static PyThreadState	*global_interpreter;	//!< Our first interpreter.
 
-static rlm_python_t	*current_inst;		//!< Used for communication with inittab functions.
-static CONF_SECTION	*current_conf;		//!< Used for communication with inittab functions.
 static char		*default_path;		//!< The default python path.
 
 /*
- *	As of Python 3.8 the GIL will be per-interpreter
- *	If there are still issues with CEXTs,
- *	multiple interpreters and the GIL at that point
- *	users can build rlm_python against Python 3.8
- *	and the horrible hack of using a single interpreter
- *	for all instances of rlm_python will no longer be
- *	required.
+ *	Before Python 3.12 all interpreters share a single GIL,
+ *	so however many workers we have, only one of them can
+ *	be running Python code at any one time.
+ *
+ *	As of Python 3.12 (PEP 684) each sub-interpreter can
+ *	have its own GIL.  With interpreter_per_thread, every
+ *	worker gets its own interpreter, and they run in
+ *	parallel.  The cost is that C extensions must support
+ *	multi-phase initialisation, and that Python objects
+ *	can't be shared between workers.
  *
- *	As Python 3.x module initialisation is significantly
- *	different than Python 2.x initialisation,
- *	it'd be a pain to retain the cext_compat for
- *	Python 3 and as Python 3 users have the option of
- *	using as version of Python which fixes the underlying
- *	issue, we only support using a global interpreter
- *	for Python 2.7 and below.
+ *	Free-threaded builds of Python (3.13+, Py_GIL_DISABLED)
+ *	have no GIL at all, so the normal shared interpreter
+ *	already runs in parallel, as long as every module which
+ *	is imported declares it's safe to do so.
  */
 
 /*
@@ -117,8 +165,8 @@ static char		*default_path;		//!< The default python path.
  */
 static CONF_PARSER module_config[] = {
 
-#define A(x) { FR_CONF_OFFSET("mod_" #x, FR_TYPE_STRING, rlm_python_t, x.module_name), .dflt = "${.module}" }, \
-	{ FR_CONF_OFFSET("func_" #x, FR_TYPE_STRING, rlm_python_t, x.function_name) },
+#define A(x) { FR_CONF_OFFSET("mod_" #x, FR_TYPE_STRING, rlm_python_t, interp.x.module_name), .dflt = "${.module}" }, \
+	{ FR_CONF_OFFSET("func_" #x, FR_TYPE_STRING, rlm_python_t, interp.x.function_name) },
 
 	A(instantiate)
 	A(authorize)
@@ -134,6 +182,12 @@ static CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("python_path_include_conf_dir", FR_TYPE_BOOL, rlm_python_t, python_path_include_conf_dir), .dflt = "yes" },
 	{ FR_CONF_OFFSET("python_path_include_default", FR_TYPE_BOOL, rlm_python_t, python_path_include_default), .dflt = "yes" },
 
+	{ FR_CONF_OFFSET("interpreter_per_thread", FR_TYPE_BOOL, rlm_python_t, interpreter_per_thread), .dflt = "no" },
+	{ FR_CONF_OFFSET("lazy_pairs", FR_TYPE_BOOL, rlm_python_t, lazy_pairs), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("out_of_process", FR_TYPE_BOOL, rlm_python_t, out_of_process), .dflt = "no" },
+	{ FR_CONF_OFFSET("ring_size", FR_TYPE_SIZE, rlm_python_t, ring_size), .dflt = "1M" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -466,8 +520,108 @@ static int mod_populate_vptuple(rlm_python_t const *inst, request_t *request, Py
 	return 0;
 }
 
-static unlang_action_t do_python_single(rlm_rcode_t *p_result,
-					rlm_python_t const *inst, request_t *request, PyObject *p_func, char const *funcname)
+static Py_ssize_t python_pairs_length(PyObject *self)
+{
+	python_pairs_t *pairs = (python_pairs_t *)self;
+
+	if (!pairs->request) {
+		PyErr_SetString(PyExc_RuntimeError, "Pair list is only valid during the call it was passed to");
+		return -1;
+	}
+
+	return pairs->len;
+}
+
+static PyObject *python_pairs_item(PyObject *self, Py_ssize_t i)
+{
+	python_pairs_t	*pairs = (python_pairs_t *)self;
+	PyObject	*pp;
+
+	if (!pairs->request) {
+		PyErr_SetString(PyExc_RuntimeError, "Pair list is only valid during the call it was passed to");
+		return NULL;
+	}
+
+	if ((i < 0) || (i >= pairs->len)) {
+		PyErr_SetString(PyExc_IndexError, "Pair list index out of range");
+		return NULL;
+	}
+
+	/*
+	 *	Usually we're being iterated over, so we only
+	 *	need to go back to the start for random access.
+	 */
+	if (!pairs->vp || (i < pairs->idx)) {
+		pairs->vp = fr_pair_list_head(pairs->list);
+		pairs->idx = 0;
+	}
+	while (pairs->idx < i) {
+		pairs->vp = fr_pair_list_next(pairs->list, pairs->vp);
+		pairs->idx++;
+	}
+
+	if ((pp = PyTuple_New(2)) == NULL) return NULL;
+
+	/*
+	 *	Same as the tuple version, pairs which
+	 *	can't be converted are None.
+	 */
+	if (mod_populate_vptuple(pairs->inst, pairs->request, pp, pairs->vp) < 0) {
+		Py_DECREF(pp);
+		Py_RETURN_NONE;
+	}
+
+	return pp;
+}
+
+static void python_pairs_dealloc(PyObject *self)
+{
+	PyTypeObject *type = Py_TYPE(self);
+
+	PyObject_Free(self);
+	Py_DECREF(type);	/* Instances of heap types hold a reference to them */
+}
+
+static PyType_Slot python_pairs_slots[] = {
+	{ Py_tp_dealloc, python_pairs_dealloc },
+	{ Py_sq_length, python_pairs_length },
+	{ Py_sq_item, python_pairs_item },
+	{ 0, NULL }
+};
+
+/*
+ *	A heap type, so each interpreter gets its own.
+ */
+static PyType_Spec python_pairs_spec = {
+	.name = "freeradius.Pairs",
+	.basicsize = sizeof(python_pairs_t),
+	.flags = Py_TPFLAGS_DEFAULT,
+	.slots = python_pairs_slots
+};
+
+/** Wrap a pair list so that it's converted lazily
+ *
+ */
+static PyObject *python_pairs_alloc(rlm_python_t const *inst, python_interp_t const *interp,
+				    request_t *request, fr_pair_list_t *list, Py_ssize_t len)
+{
+	python_pairs_t *pairs;
+
+	pairs = PyObject_New(python_pairs_t, interp->pairs_type);
+	if (!pairs) return NULL;
+
+	pairs->inst = inst;
+	pairs->request = request;
+	pairs->list = list;
+	pairs->vp = NULL;
+	pairs->idx = 0;
+	pairs->len = len;
+
+	return (PyObject *)pairs;
+}
+
+static unlang_action_t do_python_single(rlm_rcode_t *p_result, rlm_python_t const *inst, python_interp_t const *interp,
+					request_t *request, PyObject *p_func, char const *funcname)
 {
 	fr_pair_t	*vp;
 	PyObject	*p_ret = NULL;
@@ -491,6 +645,11 @@ static unlang_action_t do_python_single(rlm_rcode_t *p_result,
 	if (tuple_len == 0) {
 		Py_INCREF(Py_None);
 		p_arg = Py_None;
+	} else if (inst->lazy_pairs) {
+		if ((p_arg = python_pairs_alloc(inst, interp, request, &request->request_pairs, tuple_len)) == NULL) {
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
 	} else {
 		int i = 0;
 		if ((p_arg = PyTuple_New(tuple_len)) == NULL) {
@@ -587,6 +746,12 @@ static unlang_action_t do_python_single(rlm_rcode_t *p_result,
 
 finish:
 	if (rcode == RLM_MODULE_FAIL) python_error_log(inst, request);
+
+	/*
+	 *	The function may have kept a reference to the
+	 *	pair list, but the request is about to move on.
+	 */
+	if (p_arg && (Py_TYPE(p_arg) == interp->pairs_type)) ((python_pairs_t *)p_arg)->request = NULL;
 	Py_XDECREF(p_arg);
 	Py_XDECREF(p_ret);
 
@@ -610,25 +775,94 @@ static unlang_action_t do_python(rlm_rcode_t *p_result, rlm_python_t const *inst
 	RDEBUG3("Using thread state %p/%p", inst, this_thread->state);
 
 	PyEval_RestoreThread(this_thread->state);	/* Swap in our local thread state */
-	do_python_single(&rcode, inst, request, p_func, funcname);
+	do_python_single(&rcode, inst, this_thread->interp, request, p_func, funcname);
 	(void)fr_cond_assert(PyEval_SaveThread() == this_thread->state);
 
 	RETURN_MODULE_RCODE(rcode);
 }
 
-#define MOD_FUNC(x) \
+#define MOD_FUNC(x, _method) \
 static unlang_action_t CC_HINT(nonnull) mod_##x(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request) \
 { \
 	rlm_python_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_python_t); \
 	rlm_python_thread_t *thread = talloc_get_type_abort(mctx->thread, rlm_python_thread_t); \
-	return do_python(p_result, inst, thread, request, inst->x.function, #x);\
+	if (thread->pool) { \
+		if (!inst->interp.x.function) RETURN_MODULE_NOOP; \
+		return fr_lang_pool_call(p_result, thread->pool, request, _method); \
+	} \
+	return do_python(p_result, inst, thread, request, thread->interp->x.function, #x);\
+}
+
+MOD_FUNC(authenticate, PYTHON_METHOD_AUTHENTICATE)
+MOD_FUNC(authorize, PYTHON_METHOD_AUTHORIZE)
+MOD_FUNC(preacct, PYTHON_METHOD_PREACCT)
+MOD_FUNC(accounting, PYTHON_METHOD_ACCOUNTING)
+MOD_FUNC(post_auth, PYTHON_METHOD_POST_AUTH)
+
+/** Run a method in a child process
+ *
+ * The child has a single thread, which was the main thread of the
+ * server, so it uses the instance's interpreter directly.
+ */
+static rlm_rcode_t python_lang_pool_call(request_t *request, unsigned int method, void *uctx)
+{
+	rlm_python_t const	*inst = talloc_get_type_abort_const(uctx, rlm_python_t);
+	python_func_def_t const	*def;
+	char const		*funcname;
+	rlm_rcode_t		rcode;
+
+	switch (method) {
+#define METHOD(_x, _method) case _method: def = &inst->interp._x; funcname = #_x; break
+	METHOD(authenticate, PYTHON_METHOD_AUTHENTICATE);
+	METHOD(authorize, PYTHON_METHOD_AUTHORIZE);
+	METHOD(preacct, PYTHON_METHOD_PREACCT);
+	METHOD(accounting, PYTHON_METHOD_ACCOUNTING);
+	METHOD(post_auth, PYTHON_METHOD_POST_AUTH);
+#undef METHOD
+
+	default:
+		return RLM_MODULE_FAIL;
+	}
+
+	if (!def->function) return RLM_MODULE_NOOP;
+
+	PyEval_RestoreThread(inst->interp.interpreter);
+	do_python_single(&rcode, inst, &inst->interp, request, def->function, funcname);
+	PyEval_SaveThread();
+
+	return rcode;
+}
+
+/*
+ *	Python has to be told about the fork, so that
+ *	the child can reset its locks, and its record
+ *	of which thread is the main thread.
+ */
+static void python_pre_fork(UNUSED void *uctx)
+{
+	PyEval_RestoreThread(global_interpreter);
+#if PY_VERSION_HEX >= 0x03070000
+	PyOS_BeforeFork();
+#endif
 }
 
-MOD_FUNC(authenticate)
-MOD_FUNC(authorize)
-MOD_FUNC(preacct)
-MOD_FUNC(accounting)
-MOD_FUNC(post_auth)
+static void python_post_fork_parent(UNUSED void *uctx)
+{
+#if PY_VERSION_HEX >= 0x03070000
+	PyOS_AfterFork_Parent();
+#endif
+	PyEval_SaveThread();
+}
+
+static void python_post_fork_child(UNUSED void *uctx)
+{
+#if PY_VERSION_HEX >= 0x03070000
+	PyOS_AfterFork_Child();
+#else
+	PyOS_AfterFork();
+#endif
+	PyEval_SaveThread();
+}
 
 static void python_obj_destroy(PyObject **ob)
 {
@@ -647,7 +881,7 @@ static void python_function_destroy(python_func_def_t *def)
 /** Import a user module and load a function from it
  *
  */
-static int python_function_load(rlm_python_t *inst, python_func_def_t *def)
+static int python_function_load(rlm_python_t const *inst, python_func_def_t *def)
 {
 	char const *funcname = "python_function_load";
 
@@ -684,7 +918,7 @@ static int python_function_load(rlm_python_t *inst, python_func_def_t *def)
  *	Parse a configuration section, and populate a dict.
  *	This function is recursively called (allows to have nested dicts.)
  */
-static int python_parse_config(rlm_python_t *inst, CONF_SECTION *cs, int lvl, PyObject *dict)
+static int python_parse_config(rlm_python_t const *inst, CONF_SECTION *cs, int lvl, PyObject *dict)
 {
 	int		indent_section = (lvl * 4);
 	int		indent_item = (lvl + 1) * 4;
@@ -767,7 +1001,8 @@ static int python_parse_config(rlm_python_t *inst, CONF_SECTION *cs, int lvl, Py
 /** Make the current instance's config available within the module we're initialising
  *
  */
-static int python_module_import_config(rlm_python_t *inst, CONF_SECTION *conf, PyObject *module)
+static int python_module_import_config(rlm_python_t const *inst, python_interp_t *interp,
+				       CONF_SECTION const *conf, PyObject *module)
 {
 	CONF_SECTION *cs;
 
@@ -775,12 +1010,12 @@ static int python_module_import_config(rlm_python_t *inst, CONF_SECTION *conf, P
 	 *	Convert a FreeRADIUS config structure into a python
 	 *	dictionary.
 	 */
-	inst->pythonconf_dict = PyDict_New();
-	if (!inst->pythonconf_dict) {
+	interp->pythonconf_dict = PyDict_New();
+	if (!interp->pythonconf_dict) {
 		ERROR("Unable to create python dict for config");
 	error:
-		Py_XDECREF(inst->pythonconf_dict);
-		inst->pythonconf_dict = NULL;
+		Py_XDECREF(interp->pythonconf_dict);
+		interp->pythonconf_dict = NULL;
 		python_error_log(inst, NULL);
 		return -1;
 	}
@@ -788,13 +1023,13 @@ static int python_module_import_config(rlm_python_t *inst, CONF_SECTION *conf, P
 	cs = cf_section_find(conf, "config", NULL);
 	if (cs) {
 		DEBUG("Inserting \"config\" section into python environment as radiusd.config");
-		if (python_parse_config(inst, cs, 0, inst->pythonconf_dict) < 0) goto error;
+		if (python_parse_config(inst, cs, 0, interp->pythonconf_dict) < 0) goto error;
 	}
 
 	/*
 	 *	Add module configuration as a dict
 	 */
-	if (PyModule_AddObject(module, "config", inst->pythonconf_dict) < 0) goto error;
+	if (PyModule_AddObject(module, "config", interp->pythonconf_dict) < 0) goto error;
 
 	return 0;
 }
@@ -802,7 +1037,7 @@ static int python_module_import_config(rlm_python_t *inst, CONF_SECTION *conf, P
 /** Import integer constants into the module we're initialising
  *
  */
-static int python_module_import_constants(rlm_python_t *inst, PyObject *module)
+static int python_module_import_constants(rlm_python_t const *inst, PyObject *module)
 {
 	size_t i;
 
@@ -826,7 +1061,15 @@ static char *python_path_build(TALLOC_CTX *ctx, rlm_python_t *inst, CONF_SECTION
 		MEM(path = talloc_asprintf_append_buffer(path, "%s:", inst->python_path));
 	}
 	if (inst->python_path_include_conf_dir) {
-		MEM(path = talloc_asprintf_append_buffer(path, "%s:", dirname(UNCONST(char *, cf_filename(conf)))));
+		char *filename;
+
+		/*
+		 *	dirname() may modify its argument, and the
+		 *	filename is shared with other config items.
+		 */
+		MEM(filename = talloc_typed_strdup(ctx, cf_filename(conf)));
+		MEM(path = talloc_asprintf_append_buffer(path, "%s:", dirname(filename)));
+		talloc_free(filename);
 	}
 	if (inst->python_path_include_default) {
 		MEM(path = talloc_asprintf_append_buffer(path, "%s:", default_path));
@@ -841,60 +1084,122 @@ static char *python_path_build(TALLOC_CTX *ctx, rlm_python_t *inst, CONF_SECTION
 /*
  *	Python 3 interpreter initialisation and destruction
  */
+static PyModuleDef_Slot module_slots[] = {
+#if PY_VERSION_HEX >= 0x030C0000
+	{ Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED },
+#endif
+#ifdef Py_GIL_DISABLED
+	{ Py_mod_gil, Py_MOD_GIL_NOT_USED },
+#endif
+	{ 0, NULL }
+};
+
+/** Initialise the freeradius module
+ *
+ * Uses multi-phase initialisation, so the module may be imported
+ * into interpreters with their own GIL, and into free-threaded
+ * builds without re-enabling the GIL.  Nothing instance specific
+ * is done here, that's all added after the module is imported.
+ */
 static PyObject *python_module_init(void)
 {
-	rlm_python_t	*inst = current_inst;
-	PyObject	*module;
-
 	static struct PyModuleDef py_module_def = {
 		PyModuleDef_HEAD_INIT,
 		.m_name = "freeradius",
 		.m_doc = "freeRADIUS python module",
-		.m_size = -1,
-		.m_methods = module_methods
+		.m_size = 0,
+		.m_methods = module_methods,
+		.m_slots = module_slots
 	};
 
-	fr_assert(inst);
+	return PyModuleDef_Init(&py_module_def);
+}
 
-	module = PyModule_Create(&py_module_def);
-	if (!module) {
-		python_error_log(inst, NULL);
-		Py_RETURN_NONE;
+/** Create a new interpreter sharing the main interpreter's GIL
+ *
+ * @note Must be called from the main thread.  On success the new
+ *	interpreter's thread state is current.
+ */
+static PyThreadState *python_interpreter_shared_alloc(void)
+{
+	PyThreadState *state;
+
+	PyEval_RestoreThread(global_interpreter);
+	LSAN_DISABLE(state = Py_NewInterpreter());
+	if (!state) {
+		PyEval_SaveThread();
+		return NULL;
 	}
+	PyEval_SaveThread();		/* Unlock GIL */
 
-	return module;
+	PyEval_RestoreThread(state);
+
+	return state;
 }
 
-static int python_interpreter_init(rlm_python_t *inst, CONF_SECTION *conf)
+#if PY_VERSION_HEX >= 0x030C0000
+/** Create a new interpreter with its own GIL
+ *
+ * May be called from any thread.  On success the new interpreter's
+ * thread state is current.
+ */
+static PyThreadState *python_interpreter_own_gil_alloc(void)
 {
-	char		*path;
-	PyObject	*module;
-	wchar_t	        *wide_path;
+	PyThreadState		*main_state, *state = NULL;
+	PyStatus		status;
+	PyInterpreterConfig	config = {
+		.use_main_obmalloc = 0,
+		.allow_fork = 0,
+		.allow_exec = 0,
+		.allow_threads = 1,
+		.allow_daemon_threads = 0,
+		.check_multi_interp_extensions = 1,
+		.gil = PyInterpreterConfig_OWN_GIL,
+	};
 
 	/*
-	 *	python_module_init takes no args, so we need
-	 *	to set these globals so that when it's
-	 *	called during interpreter initialisation
-	 *	it can get at the current instance config.
+	 *	global_interpreter belongs to the main thread,
+	 *	so we need our own thread state in the main
+	 *	interpreter to create the sub-interpreter from.
 	 */
-	current_inst = inst;
-	current_conf = conf;
-
-	PyEval_RestoreThread(global_interpreter);
-	LSAN_DISABLE(inst->interpreter = Py_NewInterpreter());
-	if (!inst->interpreter) {
-		ERROR("Failed creating new interpreter");
-		return -1;
+	main_state = PyThreadState_New(global_interpreter->interp);
+	if (!main_state) return NULL;
+
+	PyEval_RestoreThread(main_state);
+	LSAN_DISABLE(status = Py_NewInterpreterFromConfig(&state, &config));
+	if (PyStatus_Exception(status)) {
+		PyThreadState_Clear(main_state);	/* main_state is current again */
+		PyThreadState_DeleteCurrent();
+		return NULL;
 	}
-	DEBUG3("Created new interpreter %p", inst->interpreter);
-	PyEval_SaveThread();		/* Unlock GIL */
 
-	PyEval_RestoreThread(inst->interpreter);
+	/*
+	 *	We're holding the new interpreter's GIL, and
+	 *	the main interpreter's has been released.
+	 *	Swap back to tidy up main_state.
+	 */
+	PyEval_SaveThread();
+	PyEval_RestoreThread(main_state);
+	PyThreadState_Clear(main_state);
+	PyThreadState_DeleteCurrent();
+
+	PyEval_RestoreThread(state);
 
-	path = python_path_build(inst, inst, conf);
-	DEBUG3("Setting python path to \"%s\"", path);
-	wide_path = Py_DecodeLocale(path, NULL);
-	talloc_free(path);
+	return state;
+}
+#endif
+
+/** Populate a new interpreter, load the functions, and call instantiate
+ *
+ * @note Must be called with the interpreter's thread state current.
+ */
+static int python_interpreter_init(rlm_python_t const *inst, python_interp_t *interp, CONF_SECTION const *conf)
+{
+	PyObject	*module;
+	wchar_t	        *wide_path;
+
+	DEBUG3("Setting python path to \"%s\"", inst->path);
+	wide_path = Py_DecodeLocale(inst->path, NULL);
 	PySys_SetPath(wide_path);
 	PyMem_RawFree(wide_path);
 
@@ -906,28 +1211,94 @@ static int python_interpreter_init(rlm_python_t *inst, CONF_SECTION *conf)
 	 */
  	module = PyImport_ImportModule("freeradius");
  	if (!module) {
- 		ERROR("Failed importing \"freeradius\" module into interpreter %p", inst->interpreter);
+ 		ERROR("Failed importing \"freeradius\" module into interpreter %p", interp->interpreter);
+		python_error_log(inst, NULL);
  		return -1;
  	}
-	if ((python_module_import_config(inst, conf, module) < 0) ||
+	if ((python_module_import_config(inst, interp, conf, module) < 0) ||
 	    (python_module_import_constants(inst, module) < 0)) {
 		Py_DECREF(module);
 		return -1;
 	}
-	inst->module = module;
-	PyEval_SaveThread();
+	interp->module = module;
+
+	if (inst->lazy_pairs) {
+		interp->pairs_type = (PyTypeObject *)PyType_FromSpec(&python_pairs_spec);
+		if (!interp->pairs_type) {
+			ERROR("Failed creating pair list type");
+			python_error_log(inst, NULL);
+			return -1;
+		}
+	}
+
+	/*
+	 *	Process the various sections
+	 */
+#define PYTHON_FUNC_LOAD(_x) if (python_function_load(inst, &interp->_x) < 0) return -1
+	PYTHON_FUNC_LOAD(instantiate);
+	PYTHON_FUNC_LOAD(authenticate);
+	PYTHON_FUNC_LOAD(authorize);
+	PYTHON_FUNC_LOAD(preacct);
+	PYTHON_FUNC_LOAD(accounting);
+	PYTHON_FUNC_LOAD(post_auth);
+	PYTHON_FUNC_LOAD(detach);
+
+	/*
+	 *	Call the instantiate function.
+	 */
+	if (interp->instantiate.function) {
+		rlm_rcode_t rcode;
+
+		do_python_single(&rcode, inst, interp, NULL, interp->instantiate.function, "instantiate");
+		switch (rcode) {
+		case RLM_MODULE_FAIL:
+		case RLM_MODULE_REJECT:
+			return -1;
+
+		default:
+			break;
+		}
+	}
 
 	return 0;
 }
 
-static void python_interpreter_free(rlm_python_t *inst, PyThreadState *interp)
+/** Call the detach function, and release everything the interpreter holds
+ *
+ * @note Must be called with the interpreter's thread state current.
+ */
+static void python_interpreter_clear(rlm_python_t const *inst, python_interp_t *interp)
 {
+	/*
+	 *	We don't care if this fails.
+	 */
+	if (interp->detach.function) {
+		rlm_rcode_t rcode;
+
+		(void)do_python_single(&rcode, inst, interp, NULL, interp->detach.function, "detach");
+	}
+
+#define PYTHON_FUNC_DESTROY(_x) python_function_destroy(&interp->_x)
+	PYTHON_FUNC_DESTROY(instantiate);
+	PYTHON_FUNC_DESTROY(authorize);
+	PYTHON_FUNC_DESTROY(authenticate);
+	PYTHON_FUNC_DESTROY(preacct);
+	PYTHON_FUNC_DESTROY(accounting);
+	PYTHON_FUNC_DESTROY(post_auth);
+	PYTHON_FUNC_DESTROY(detach);
+
+	Py_XDECREF(interp->pythonconf_dict);
+	Py_XDECREF(interp->pairs_type);
+
 	/*
 	 *	We incremented the reference count earlier
 	 *	during module initialisation.
 	 */
-	Py_XDECREF(inst->module);
+	Py_XDECREF(interp->module);
+}
 
+static void python_interpreter_free(PyThreadState *interp)
+{
 	PyEval_RestoreThread(interp);	/* Switches thread state and locks GIL */
 	Py_EndInterpreter(interp);	/* Destroys interpreter (GIL still locked) - sets thread state to NULL */
 	PyThreadState_Swap(global_interpreter);	/* Get a none-null thread state */
@@ -952,48 +1323,67 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->name = cf_section_name2(conf);
 	if (!inst->name) inst->name = cf_section_name1(conf);
 
-	if (python_interpreter_init(inst, conf) < 0) return -1;
-
 	/*
-	 *	Switch to our module specific interpreter
+	 *	Built once, as dirname() mangles the
+	 *	config filename.
 	 */
-	PyEval_RestoreThread(inst->interpreter);
+	inst->path = python_path_build(inst, inst, conf);
 
 	/*
-	 *	Process the various sections
+	 *	Each thread creates its own interpreter,
+	 *	and calls instantiate itself.
 	 */
-#define PYTHON_FUNC_LOAD(_x) if (python_function_load(inst, &inst->_x) < 0) goto error
-	PYTHON_FUNC_LOAD(instantiate);
-	PYTHON_FUNC_LOAD(authenticate);
-	PYTHON_FUNC_LOAD(authorize);
-	PYTHON_FUNC_LOAD(preacct);
-	PYTHON_FUNC_LOAD(accounting);
-	PYTHON_FUNC_LOAD(post_auth);
-	PYTHON_FUNC_LOAD(detach);
+	if (inst->interpreter_per_thread) {
+		if (inst->out_of_process) {
+			cf_log_err(conf, "interpreter_per_thread and out_of_process are mutually exclusive");
+			return -1;
+		}
 
-	/*
-	 *	Call the instantiate function.
-	 */
-	if (inst->instantiate.function) {
-		rlm_rcode_t rcode;
+#if PY_VERSION_HEX >= 0x030C0000
+		return 0;
+#else
+		cf_log_err(conf, "interpreter_per_thread requires Python 3.12 or later, we have %s",
+			   Py_GetVersion());
+		return -1;
+#endif
+	}
 
-		do_python_single(&rcode, inst, NULL, inst->instantiate.function, "instantiate");
-		switch (rcode) {
-		case RLM_MODULE_FAIL:
-		case RLM_MODULE_REJECT:
-		error:
-			fr_cond_assert(PyEval_SaveThread() == inst->interpreter);
-			return -1;
+	inst->interp.interpreter = python_interpreter_shared_alloc();
+	if (!inst->interp.interpreter) {
+		ERROR("Failed creating new interpreter");
+		return -1;
+	}
+	DEBUG3("Created new interpreter %p", inst->interp.interpreter);
 
-		default:
-			break;
-		}
+	if (python_interpreter_init(inst, &inst->interp, conf) < 0) {
+		fr_cond_assert(PyEval_SaveThread() == inst->interp.interpreter);
+		return -1;
 	}
 
 	/*
 	 *	Switch back to the global interpreter
 	 */
-	if (!fr_cond_assert(PyEval_SaveThread() == inst->interpreter)) goto error;
+	if (!fr_cond_assert(PyEval_SaveThread() == inst->interp.interpreter)) return -1;
+
+	/*
+	 *	The children inherit the interpreter as
+	 *	instantiate left it.
+	 */
+	if (inst->out_of_process) {
+		inst->pool = fr_lang_pool_alloc(inst, inst->name,
+						&(fr_lang_pool_config_t){
+							.ring_size = inst->ring_size,
+							.func = python_lang_pool_call,
+							.pre_fork = python_pre_fork,
+							.post_fork_parent = python_post_fork_parent,
+							.post_fork_child = python_post_fork_child,
+							.uctx = inst
+						});
+		if (!inst->pool) {
+			PERROR("Failed starting worker processes");
+			return -1;
+		}
+	}
 
 	return 0;
 }
@@ -1008,50 +1398,99 @@ static int mod_detach(void *instance)
 	 *	instantiation to generate things
 	 *	we need to clean up...
 	 */
-	if (!inst->interpreter) return 0;
+	if (!inst->interp.interpreter) return 0;
+
+	/*
+	 *	Stop the children before the interpreter
+	 *	they were forked from goes away.
+	 */
+	TALLOC_FREE(inst->pool);
 
 	/*
 	 *	Call module destructor
 	 */
-	PyEval_RestoreThread(inst->interpreter);
+	PyEval_RestoreThread(inst->interp.interpreter);
+	python_interpreter_clear(inst, &inst->interp);
+	PyEval_SaveThread();
 
 	/*
-	 *	We don't care if this fails.
+	 *	Free the module specific interpreter
 	 */
-	if (inst->detach.function) {
-		rlm_rcode_t rcode;
+	python_interpreter_free(inst->interp.interpreter);
 
-		(void)do_python_single(&rcode, inst, NULL, inst->detach.function, "detach");
-	}
+	return 0;
+}
 
-#define PYTHON_FUNC_DESTROY(_x) python_function_destroy(&inst->_x)
-	PYTHON_FUNC_DESTROY(instantiate);
-	PYTHON_FUNC_DESTROY(authorize);
-	PYTHON_FUNC_DESTROY(authenticate);
-	PYTHON_FUNC_DESTROY(preacct);
-	PYTHON_FUNC_DESTROY(accounting);
-	PYTHON_FUNC_DESTROY(post_auth);
-	PYTHON_FUNC_DESTROY(detach);
+#if PY_VERSION_HEX >= 0x030C0000
+/** Create an interpreter with its own GIL for this thread
+ *
+ */
+static int python_thread_interpreter_init(rlm_python_t const *inst, rlm_python_thread_t *this_thread,
+					  CONF_SECTION const *conf)
+{
+	python_interp_t	*interp;
 
-	Py_XDECREF(inst->pythonconf_dict);
-	PyEval_SaveThread();
+	MEM(interp = talloc_zero(this_thread, python_interp_t));
 
 	/*
-	 *	Free the module specific interpreter
+	 *	Function names were parsed into the
+	 *	instance's interp.
 	 */
-	python_interpreter_free(inst, inst->interpreter);
+#define PYTHON_FUNC_NAMES(_x) interp->_x.module_name = inst->interp._x.module_name; \
+			      interp->_x.function_name = inst->interp._x.function_name
+	PYTHON_FUNC_NAMES(instantiate);
+	PYTHON_FUNC_NAMES(authenticate);
+	PYTHON_FUNC_NAMES(authorize);
+	PYTHON_FUNC_NAMES(preacct);
+	PYTHON_FUNC_NAMES(accounting);
+	PYTHON_FUNC_NAMES(post_auth);
+	PYTHON_FUNC_NAMES(detach);
+
+	interp->interpreter = python_interpreter_own_gil_alloc();
+	if (!interp->interpreter) {
+		ERROR("Failed creating new interpreter");
+		return -1;
+	}
+	DEBUG3("Created new interpreter %p with its own GIL", interp->interpreter);
+
+	this_thread->interp = interp;
+	this_thread->state = interp->interpreter;
+
+	if (python_interpreter_init(inst, interp, conf) < 0) {
+		PyEval_SaveThread();
+		return -1;
+	}
+	PyEval_SaveThread();
 
 	return 0;
 }
+#endif
 
 static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
-				  UNUSED fr_event_list_t *el, void *thread)
+				  fr_event_list_t *el, void *thread)
 {
 	PyThreadState		*state;
 	rlm_python_t		*inst = instance;
 	rlm_python_thread_t	*this_thread = thread;
 
-	state = PyThreadState_New(inst->interpreter->interp);
+	/*
+	 *	Python only runs in our child, so
+	 *	we don't need a thread state.
+	 */
+	if (inst->pool) {
+		this_thread->pool = fr_lang_pool_thread_alloc(this_thread, inst->pool, el);
+		if (!this_thread->pool) {
+			PERROR("Failed claiming worker process");
+			return -1;
+		}
+		return 0;
+	}
+
+#if PY_VERSION_HEX >= 0x030C0000
+	if (inst->interpreter_per_thread) return python_thread_interpreter_init(inst, this_thread, conf);
+#endif
+
+	state = PyThreadState_New(inst->interp.interpreter->interp);
 	if (!state) {
 		ERROR("Failed initialising local PyThreadState");
 		return -1;
@@ -1059,6 +1498,7 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instanc
 
 	DEBUG3("Initialised new thread state %p", state);
 	this_thread->state = state;
+	this_thread->interp = &inst->interp;
 
 	return 0;
 }
@@ -1067,6 +1507,24 @@ static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 {
 	rlm_python_thread_t	*this_thread = thread;
 
+	if (!this_thread->state) return 0;
+
+	/*
+	 *	Our own interpreter, with its own GIL.  Once
+	 *	it's gone there's nothing left to unlock.
+	 */
+	if (this_thread->interp && (this_thread->state == this_thread->interp->interpreter)) {
+		python_interp_t		*interp = this_thread->interp;
+		rlm_python_t const	*inst = talloc_get_type_abort_const(module_thread_by_data(thread)->mod_inst,
+									   rlm_python_t);
+
+		PyEval_RestoreThread(this_thread->state);
+		python_interpreter_clear(inst, interp);
+		Py_EndInterpreter(this_thread->state);
+
+		return 0;
+	}
+
 	PyEval_RestoreThread(this_thread->state);	/* Swap in our local thread state */
 	PyThreadState_Clear(this_thread->state);
 	PyEval_SaveThread();
@@ -391,6 +391,19 @@ static unlang_action_t mod_radius_resume(rlm_rcode_t *p_result, module_ctx_t con
 	return inst->io->resume(p_result, &(module_ctx_t){.instance = inst->io_instance, .thread = t->io_thread }, request, ctx);
 }
 
+/** Let "load-balance" sections choose the home server which is likely to answer soonest
+ *
+ */
+static uint64_t mod_cost(void const *instance, void *thread)
+{
+	rlm_radius_t const *inst = talloc_get_type_abort_const(instance, rlm_radius_t);
+	rlm_radius_thread_t *t = talloc_get_type_abort(thread, rlm_radius_thread_t);
+
+	if (!inst->io->cost) return 0;
+
+	return inst->io->cost(inst->io_instance, t->io_thread);
+}
+
 /** Do any RADIUS-layer fixups for proxying.
  *
  */
@@ -802,6 +815,7 @@ module_t rlm_radius = {
 	.thread_inst_type = "rlm_radius_thread_t",
 	.thread_instantiate = mod_thread_instantiate,
 	.thread_detach	= mod_thread_detach,
+	.cost		= mod_cost,
 	.methods = {
 		[MOD_PREACCT]		= mod_process,
 		[MOD_ACCOUNTING]	= mod_process,
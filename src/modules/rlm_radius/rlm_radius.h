@@ -97,4 +97,5 @@ struct rlm_radius_io_s {
 	rlm_radius_io_enqueue_t		enqueue;	//!< Enqueue a request_t with an IO submodule.
 	unlang_module_signal_t	signal;		//!< Send a signal to an IO module.
 	unlang_module_resume_t	resume;		//!< Resume a request, and get rcode.
+	module_cost_t			cost;		//!< Estimate how long a new request would take.
 };
@@ -0,0 +1,2236 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_radius_tcp.c
+ * @brief RADIUS TCP and RADIUS/TLS transport
+ *
+ * Many requests are multiplexed over each connection, using the RADIUS
+ * ID to match replies to requests.  As TCP is reliable, requests are
+ * never retransmitted (RFC 6613 Section 2.6.1).  Instead each request
+ * gets a single response window, and is failed if no reply arrives
+ * within it.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/application.h>
+#include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/io/pair.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/server/connection.h>
+#include <freeradius-devel/tls/base.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/socket.h>
+
+#ifdef WITH_TLS
+#  include <freeradius-devel/tls/log.h>
+#  include <openssl/x509v3.h>
+#endif
+
+#include <sys/socket.h>
+
+#include "rlm_radius.h"
+#include "track.h"
+
+/** Static configuration for the module.
+ *
+ */
+typedef struct {
+	rlm_radius_t		*parent;		//!< rlm_radius instance.
+	CONF_SECTION		*config;
+
+	fr_ipaddr_t		dst_ipaddr;		//!< IP of the home server.
+	fr_ipaddr_t		src_ipaddr;		//!< IP we open our socket on.
+	uint16_t		dst_port;		//!< Port of the home server.
+	char const		*secret;		//!< Shared secret.
+	fr_hmac_md5_key_t	*secret_hmac;		//!< The secret, pre-computed for signing packets.
+
+	uint32_t		recv_buff;		//!< How big the kernel's receive buffer should be.
+	uint32_t		send_buff;		//!< How big the kernel's send buffer should be.
+
+	uint32_t		max_packet_size;	//!< Maximum packet size.
+	uint16_t		max_send_coalesce;	//!< Maximum number of packets to write to the
+							///< connection in one system call.
+
+	bool			recv_buff_is_set;	//!< Whether we were provided with a recv_buf
+	bool			send_buff_is_set;	//!< Whether we were provided with a send_buf
+
+#ifdef WITH_TLS
+	fr_tls_conf_t		*tls_conf;		//!< From the "tls" subsection.  NULL for plain TCP.
+	bool			ktls;			//!< Ask OpenSSL to hand record encryption
+							///< to the kernel, where it can.
+	char const		*tls_server_name;	//!< Name the home server's certificate must
+							///< contain.  If not set, it must contain
+							///< dst_ipaddr.
+#endif
+
+	fr_trunk_conf_t		*trunk_conf;		//!< trunk configuration
+} rlm_radius_tcp_t;
+
+typedef struct {
+	fr_event_list_t		*el;			//!< Event list.
+
+	rlm_radius_tcp_t const	*inst;			//!< our instance
+
+	fr_trunk_t		*trunk;			//!< trunk handler
+
+	fr_time_delta_t		rtt;			//!< Smoothed round trip time to the home server.
+	uint32_t		backoff;		//!< The cost is doubled this many times.  Raised when
+							///< a connection becomes a zombie, lowered by replies.
+
+#ifdef WITH_TLS
+	SSL_CTX			*ssl_ctx;		//!< Client context, shared by all connections
+							///< in this thread.
+	SSL_SESSION		*tls_session;		//!< The most recent session the home server gave us.
+							///< Used to resume the session on new connections.
+#endif
+} tcp_thread_t;
+
+typedef struct {
+	fr_trunk_request_t	*treq;
+	rlm_rcode_t		rcode;			//!< from the transport
+} tcp_result_t;
+
+typedef struct tcp_request_s tcp_request_t;
+
+/** Track the handle, which is tightly correlated with the FD
+ *
+ */
+typedef struct {
+	char const     		*name;			//!< From IP PORT to IP PORT.
+	char const		*module_name;		//!< the module that opened the connection
+
+	int			fd;			//!< File descriptor.
+
+#ifdef WITH_TLS
+	SSL			*ssl;			//!< TLS session.  NULL for plain TCP.
+#endif
+
+	rlm_radius_tcp_t const	*inst;			//!< Our module instance.
+	tcp_thread_t		*thread;
+
+	fr_ipaddr_t		src_ipaddr;		//!< Source IP address.  May be altered on bind
+							//!< to be the actual IP address packets will be
+							//!< sent on.  This is why we can't use the inst
+							//!< src_ipaddr field.
+	uint16_t		src_port;		//!< Source port specific to this connection.
+
+	uint8_t			*recv_buf;		//!< Data read from the connection, which may end
+							///< part way through a packet.
+	size_t			recv_size;		//!< Size of the receive buffer.
+	size_t			recv_len;		//!< How much data is in the receive buffer.
+
+	uint8_t			*send_buf;		//!< Encoded packets waiting to be written.
+	size_t			send_size;		//!< Size of the send buffer.
+	size_t			send_len;		//!< How much data is in the send buffer.
+	size_t			send_off;		//!< How much of that data has been written.
+
+	fr_trunk_connection_event_t events;		//!< The events the trunk last asked us to watch for.
+
+	radius_track_t		*tt;			//!< RADIUS ID tracking structure.
+
+	fr_time_t		last_reply;		//!< When we last received a reply.
+	fr_time_t		first_sent;		//!< first time we sent a packet since going idle
+	fr_time_t		last_sent;		//!< last time we sent a packet.
+	fr_time_t		last_idle;		//!< last time we had nothing to do
+
+	uint64_t		num_sent;		//!< Requests sent on this connection.
+	uint64_t		num_replies;		//!< Replies received on this connection.
+
+	fr_event_timer_t const	*zombie_ev;		//!< Zombie timeout.
+} tcp_handle_t;
+
+
+/** Connect request_t to local tracking structure
+ *
+ */
+struct tcp_request_s {
+	uint32_t		priority;		//!< copied from request->async->priority
+	fr_time_t		recv_time;		//!< copied from request->async->recv_time
+
+	bool			require_ma;		//!< saved from the original packet.
+
+	fr_pair_list_t		extra;			//!< VPs for debugging, like Proxy-State.
+
+	uint8_t			code;			//!< Packet code.
+	uint8_t			id;			//!< ID assigned to this packet.
+	fr_time_t		start;			//!< When we encoded the packet.
+
+	radius_track_entry_t	*rr;			//!< ID tracking, resend count, etc.
+	fr_event_timer_t const	*ev;			//!< response timer
+};
+
+/** Maximum value of tcp_thread_t->backoff
+ *
+ */
+#define TCP_MAX_BACKOFF		(16)
+
+static const CONF_PARSER module_config[] = {
+	{ FR_CONF_OFFSET("ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_radius_tcp_t, dst_ipaddr), },
+	{ FR_CONF_OFFSET("ipv4addr", FR_TYPE_IPV4_ADDR, rlm_radius_tcp_t, dst_ipaddr) },
+	{ FR_CONF_OFFSET("ipv6addr", FR_TYPE_IPV6_ADDR, rlm_radius_tcp_t, dst_ipaddr) },
+
+	{ FR_CONF_OFFSET("port", FR_TYPE_UINT16, rlm_radius_tcp_t, dst_port) },
+
+	{ FR_CONF_OFFSET("secret", FR_TYPE_STRING, rlm_radius_tcp_t, secret) },
+
+	{ FR_CONF_OFFSET_IS_SET("recv_buff", FR_TYPE_UINT32, rlm_radius_tcp_t, recv_buff) },
+	{ FR_CONF_OFFSET_IS_SET("send_buff", FR_TYPE_UINT32, rlm_radius_tcp_t, send_buff) },
+
+	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, rlm_radius_tcp_t, max_packet_size), .dflt = "4096" },
+	{ FR_CONF_OFFSET("max_send_coalesce", FR_TYPE_UINT16, rlm_radius_tcp_t, max_send_coalesce), .dflt = "32" },
+
+	{ FR_CONF_OFFSET("src_ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_radius_tcp_t, src_ipaddr) },
+	{ FR_CONF_OFFSET("src_ipv4addr", FR_TYPE_IPV4_ADDR, rlm_radius_tcp_t, src_ipaddr) },
+	{ FR_CONF_OFFSET("src_ipv6addr", FR_TYPE_IPV6_ADDR, rlm_radius_tcp_t, src_ipaddr) },
+
+#ifdef WITH_TLS
+	{ FR_CONF_OFFSET("ktls", FR_TYPE_BOOL, rlm_radius_tcp_t, ktls), .dflt = "no" },
+	{ FR_CONF_OFFSET("tls_server_name", FR_TYPE_STRING | FR_TYPE_NOT_EMPTY, rlm_radius_tcp_t, tls_server_name) },
+#endif
+
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_dict_t const *dict_radius;
+
+extern fr_dict_autoload_t rlm_radius_tcp_dict[];
+fr_dict_autoload_t rlm_radius_tcp_dict[] = {
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_acct_delay_time;
+static fr_dict_attr_t const *attr_extended_attribute_1;
+static fr_dict_attr_t const *attr_message_authenticator;
+static fr_dict_attr_t const *attr_original_packet_code;
+static fr_dict_attr_t const *attr_proxy_state;
+static fr_dict_attr_t const *attr_packet_type;
+
+extern fr_dict_attr_autoload_t rlm_radius_tcp_dict_attr[];
+fr_dict_attr_autoload_t rlm_radius_tcp_dict_attr[] = {
+	{ .out = &attr_acct_delay_time, .name = "Acct-Delay-Time", .type = FR_TYPE_UINT32, .dict = &dict_radius},
+	{ .out = &attr_extended_attribute_1, .name = "Extended-Attribute-1", .type = FR_TYPE_TLV, .dict = &dict_radius},
+	{ .out = &attr_message_authenticator, .name = "Message-Authenticator", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
+	{ .out = &attr_original_packet_code, .name = "Extended-Attribute-1.Original-Packet-Code", .type = FR_TYPE_UINT32, .dict = &dict_radius},
+	{ .out = &attr_proxy_state, .name = "Proxy-State", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
+	{ .out = &attr_packet_type, .name = "Packet-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ NULL }
+};
+
+/** If we get a reply, the request must come from one of a small
+ * number of packet types.
+ */
+static fr_radius_packet_code_t allowed_replies[FR_RADIUS_CODE_MAX] = {
+	[FR_RADIUS_CODE_ACCESS_ACCEPT]		= FR_RADIUS_CODE_ACCESS_REQUEST,
+	[FR_RADIUS_CODE_ACCESS_CHALLENGE]	= FR_RADIUS_CODE_ACCESS_REQUEST,
+	[FR_RADIUS_CODE_ACCESS_REJECT]		= FR_RADIUS_CODE_ACCESS_REQUEST,
+
+	[FR_RADIUS_CODE_ACCOUNTING_RESPONSE]	= FR_RADIUS_CODE_ACCOUNTING_REQUEST,
+
+	[FR_RADIUS_CODE_COA_ACK]		= FR_RADIUS_CODE_COA_REQUEST,
+	[FR_RADIUS_CODE_COA_NAK]		= FR_RADIUS_CODE_COA_REQUEST,
+
+	[FR_RADIUS_CODE_DISCONNECT_ACK]	= FR_RADIUS_CODE_DISCONNECT_REQUEST,
+	[FR_RADIUS_CODE_DISCONNECT_NAK]	= FR_RADIUS_CODE_DISCONNECT_REQUEST,
+
+	[FR_RADIUS_CODE_PROTOCOL_ERROR]	= FR_RADIUS_CODE_PROTOCOL_ERROR,	/* Any */
+};
+
+/** Turn a reply code into a module rcode;
+ *
+ */
+static rlm_rcode_t radius_code_to_rcode[FR_RADIUS_CODE_MAX] = {
+	[FR_RADIUS_CODE_ACCESS_ACCEPT]		= RLM_MODULE_OK,
+	[FR_RADIUS_CODE_ACCESS_CHALLENGE]	= RLM_MODULE_UPDATED,
+	[FR_RADIUS_CODE_ACCESS_REJECT]		= RLM_MODULE_REJECT,
+
+	[FR_RADIUS_CODE_ACCOUNTING_RESPONSE]	= RLM_MODULE_OK,
+
+	[FR_RADIUS_CODE_COA_ACK]		= RLM_MODULE_OK,
+	[FR_RADIUS_CODE_COA_NAK]		= RLM_MODULE_REJECT,
+
+	[FR_RADIUS_CODE_DISCONNECT_ACK]	= RLM_MODULE_OK,
+	[FR_RADIUS_CODE_DISCONNECT_NAK]	= RLM_MODULE_REJECT,
+
+	[FR_RADIUS_CODE_PROTOCOL_ERROR]	= RLM_MODULE_HANDLED,
+};
+
+static void		conn_events_update(fr_trunk_connection_t *tconn, tcp_handle_t *h);
+
+static void		request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx);
+
+#ifndef NDEBUG
+/** Log additional information about a tracking entry
+ *
+ * @param[in] te	Tracking entry we're logging information for.
+ * @param[in] log	destination.
+ * @param[in] log_type	Type of log message.
+ * @param[in] file	the logging request was made in.
+ * @param[in] line 	logging request was made on.
+ */
+static void tcp_tracking_entry_log(fr_log_t const *log, fr_log_type_t log_type, char const *file, int line,
+				   radius_track_entry_t *te)
+{
+	request_t			*request;
+
+	if (!te->request) return;	/* Free entry */
+
+	request = talloc_get_type_abort(te->request, request_t);
+
+	fr_log(log, log_type, file, line, "request %s, allocated %s:%u", request->name,
+	       request->alloc_file, request->alloc_line);
+
+	fr_trunk_request_state_log(log, log_type, file, line, talloc_get_type_abort(te->uctx, fr_trunk_request_t));
+}
+#endif
+
+/** Clear out any connection specific resources from a tcp request
+ *
+ */
+static void tcp_request_reset(tcp_request_t *u)
+{
+	fr_pair_list_free(&u->extra);
+	if (u->rr) radius_track_entry_release(&u->rr);
+}
+
+/** Write data to the connection
+ *
+ * @return
+ *	- >0 the number of bytes written.
+ *	- 0 if the connection isn't writable.
+ *	- -1 on error.
+ */
+static ssize_t conn_write(tcp_handle_t *h, uint8_t const *data, size_t data_len)
+{
+	ssize_t slen;
+
+#ifdef WITH_TLS
+	if (h->ssl) {
+		ERR_clear_error();
+
+		slen = SSL_write(h->ssl, data, data_len);
+		if (slen > 0) return slen;
+
+		switch (SSL_get_error(h->ssl, slen)) {
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			return 0;
+
+		default:
+			fr_tls_log_error(NULL, "%s - Failed writing to connection %s", h->module_name, h->name);
+			return -1;
+		}
+	}
+#endif
+
+	slen = write(h->fd, data, data_len);
+	if (slen >= 0) return slen;
+
+	switch (errno) {
+#if defined(EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
+	case EWOULDBLOCK:
+#endif
+	case EAGAIN:
+	case EINTR:
+		return 0;
+
+	default:
+		ERROR("%s - Failed writing to connection %s: %s", h->module_name, h->name, fr_syserror(errno));
+		return -1;
+	}
+}
+
+/** Read data from the connection
+ *
+ * @return
+ *	- >0 the number of bytes read.
+ *	- 0 if there's no more data to read.
+ *	- -1 on error, or if the home server closed the connection.
+ */
+static ssize_t conn_read(tcp_handle_t *h, uint8_t *buffer, size_t buflen)
+{
+	ssize_t slen;
+
+#ifdef WITH_TLS
+	if (h->ssl) {
+		ERR_clear_error();
+
+		slen = SSL_read(h->ssl, buffer, buflen);
+		if (slen > 0) return slen;
+
+		switch (SSL_get_error(h->ssl, slen)) {
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			return 0;
+
+		case SSL_ERROR_ZERO_RETURN:
+			ERROR("%s - Connection %s closed by home server", h->module_name, h->name);
+			return -1;
+
+		default:
+			fr_tls_log_error(NULL, "%s - Failed reading from connection %s", h->module_name, h->name);
+			return -1;
+		}
+	}
+#endif
+
+	slen = read(h->fd, buffer, buflen);
+	if (slen > 0) return slen;
+
+	if (slen == 0) {
+		ERROR("%s - Connection %s closed by home server", h->module_name, h->name);
+		return -1;
+	}
+
+	switch (errno) {
+#if defined(EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
+	case EWOULDBLOCK:
+#endif
+	case EAGAIN:
+	case EINTR:
+		return 0;
+
+	default:
+		ERROR("%s - Failed reading from connection %s: %s", h->module_name, h->name, fr_syserror(errno));
+		return -1;
+	}
+}
+
+/** Write out as much of the send buffer as the connection will take
+ *
+ * @return
+ *	- 0 on success.  There may still be data left in the buffer.
+ *	- -1 on error.  The connection has been signalled to reconnect,
+ *	  and the handle may have been freed.
+ */
+static int conn_flush(fr_trunk_connection_t *tconn, tcp_handle_t *h)
+{
+	while (h->send_off < h->send_len) {
+		ssize_t slen;
+
+		slen = conn_write(h, h->send_buf + h->send_off, h->send_len - h->send_off);
+		if (slen < 0) {
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return -1;
+		}
+		if (slen == 0) return 0;
+
+		h->send_off += slen;
+	}
+
+	h->send_off = h->send_len = 0;
+
+	return 0;
+}
+
+/** Free a connection handle, closing associated resources
+ *
+ */
+static int _tcp_handle_free(tcp_handle_t *h)
+{
+	fr_assert(h->fd >= 0);
+
+	fr_event_fd_delete(h->thread->el, h->fd, FR_EVENT_FILTER_IO);
+
+#ifdef WITH_TLS
+	if (h->ssl) {
+		/*
+		 *	Best effort.  We don't wait for the home
+		 *	server to acknowledge the close_notify.
+		 */
+		(void) SSL_shutdown(h->ssl);
+		SSL_free(h->ssl);
+		h->ssl = NULL;
+	}
+#endif
+
+	if (shutdown(h->fd, SHUT_RDWR) < 0) {
+		DEBUG3("%s - Failed shutting down connection %s: %s",
+		       h->module_name, h->name, fr_syserror(errno));
+	}
+
+	if (close(h->fd) < 0) {
+		DEBUG3("%s - Failed closing connection %s: %s",
+		       h->module_name, h->name, fr_syserror(errno));
+	}
+
+	h->fd = -1;
+
+	DEBUG("%s - Connection closed - %s", h->module_name, h->name);
+
+	return 0;
+}
+
+#ifdef WITH_TLS
+/** Connection errored during the TLS handshake
+ *
+ * @param[in] el	The event list signalling.
+ * @param[in] fd	that errored.
+ * @param[in] flags	El flags.
+ * @param[in] fd_errno	The nature of the error.
+ * @param[in] uctx	The connection.
+ */
+static void conn_error_handshake(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	fr_connection_t		*conn = talloc_get_type_abort(uctx, fr_connection_t);
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+
+	fr_assert(conn->state == FR_CONNECTION_STATE_CONNECTING);
+
+	ERROR("%s - Connection %s failed: %s", h->module_name, h->name, fr_syserror(fd_errno));
+
+	fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+}
+
+/** Tell OpenSSL which name or address the home server's certificate must contain
+ *
+ * The certificate must match tls_server_name if it's set (which is also
+ * sent as SNI), and the home server's IP address otherwise.
+ */
+static int tcp_tls_identity_set(tcp_handle_t *h)
+{
+	X509_VERIFY_PARAM	*param = SSL_get0_param(h->ssl);
+	fr_ipaddr_t const	*ipaddr = &h->inst->dst_ipaddr;
+	int			ret;
+
+	X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
+
+	if (h->inst->tls_server_name) {
+		ret = X509_VERIFY_PARAM_set1_host(param, h->inst->tls_server_name, 0) &&
+		      SSL_set_tlsext_host_name(h->ssl, h->inst->tls_server_name);
+	} else if (ipaddr->af == AF_INET) {
+		ret = X509_VERIFY_PARAM_set1_ip(param, (unsigned char const *) &ipaddr->addr.v4,
+						sizeof(ipaddr->addr.v4));
+	} else {
+		ret = X509_VERIFY_PARAM_set1_ip(param, (unsigned char const *) &ipaddr->addr.v6,
+						sizeof(ipaddr->addr.v6));
+	}
+	if (!ret) {
+		fr_tls_log_error(NULL, "%s - Failed setting the identity to check the home server's "
+				 "certificate against", h->module_name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Drive the TLS handshake, and signal the connection as open once it completes
+ *
+ * The first call happens when the socket becomes writable, i.e. when
+ * the TCP connection has been established.
+ */
+static void conn_handshake(fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	fr_connection_t		*conn = talloc_get_type_abort(uctx, fr_connection_t);
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+	int			ret;
+
+	ERR_clear_error();
+
+	ret = SSL_connect(h->ssl);
+	if (ret == 1) {
+		fr_event_fd_delete(el, fd, FR_EVENT_FILTER_IO);
+
+		DEBUG("%s - Connection open - %s (TLS session %s, %s)", h->module_name, h->name,
+		      SSL_session_reused(h->ssl) ? "resumed" : "established", SSL_get_version(h->ssl));
+
+#ifdef SSL_OP_ENABLE_KTLS
+		/*
+		 *	OpenSSL silently falls back to doing the
+		 *	crypto itself if the kernel or the cipher
+		 *	can't be offloaded, so say what we got.
+		 */
+		if (h->inst->ktls) {
+			DEBUG("%s - Kernel TLS - %s (send %s, recv %s)", h->module_name, h->name,
+			      BIO_get_ktls_send(SSL_get_wbio(h->ssl)) ? "yes" : "no",
+			      BIO_get_ktls_recv(SSL_get_rbio(h->ssl)) ? "yes" : "no");
+		}
+#endif
+
+		fr_connection_signal_connected(conn);
+		return;
+	}
+
+	switch (SSL_get_error(h->ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		if (fr_event_fd_insert(h, el, fd, conn_handshake, NULL, conn_error_handshake, conn) < 0) break;
+		return;
+
+	case SSL_ERROR_WANT_WRITE:
+		if (fr_event_fd_insert(h, el, fd, NULL, conn_handshake, conn_error_handshake, conn) < 0) break;
+		return;
+
+	default:
+		fr_tls_log_error(NULL, "%s - TLS handshake failed on connection %s", h->module_name, h->name);
+		break;
+	}
+
+	fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+}
+
+/** Remember the session the home server gave us, so that new connections can resume it
+ *
+ */
+static int tls_session_new_cb(SSL *ssl, SSL_SESSION *sess)
+{
+	tcp_handle_t		*h = talloc_get_type_abort(SSL_get_app_data(ssl), tcp_handle_t);
+
+	if (h->thread->tls_session) SSL_SESSION_free(h->thread->tls_session);
+	h->thread->tls_session = sess;
+
+	return 1;		/* We keep the reference */
+}
+#endif
+
+/** Initialise a new outbound connection
+ *
+ * @param[out] h_out	Where to write the new file descriptor.
+ * @param[in] conn	to initialise.
+ * @param[in] uctx	A #tcp_thread_t
+ */
+static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void *uctx)
+{
+	int			fd;
+	tcp_handle_t		*h;
+	tcp_thread_t		*thread = talloc_get_type_abort(uctx, tcp_thread_t);
+	struct sockaddr_storage	salocal;
+	socklen_t		salen;
+
+	MEM(h = talloc_zero(conn, tcp_handle_t));
+	h->fd = -1;
+	h->thread = thread;
+	h->inst = thread->inst;
+	h->module_name = h->inst->parent->name;
+	h->src_ipaddr = h->inst->src_ipaddr;
+	h->src_port = 0;
+	h->last_idle = fr_time();
+
+	/*
+	 *	The send buffer holds the packets from one call
+	 *	to request_mux().  The receive buffer is the same
+	 *	size, so that we can pick up a similar number of
+	 *	replies with one read.
+	 */
+	h->send_size = h->recv_size = (size_t)h->inst->max_packet_size * h->inst->max_send_coalesce;
+	MEM(h->send_buf = talloc_array(h, uint8_t, h->send_size));
+	MEM(h->recv_buf = talloc_array(h, uint8_t, h->recv_size));
+
+	MEM(h->tt = radius_track_alloc(h));
+
+	/*
+	 *	Open the outgoing socket.
+	 */
+	fd = fr_socket_client_tcp(&h->src_ipaddr, &h->inst->dst_ipaddr, h->inst->dst_port, true);
+	if (fd < 0) {
+		PERROR("%s - Failed opening socket", h->module_name);
+	fail:
+		talloc_free(h);
+		return FR_CONNECTION_STATE_FAILED;
+	}
+	h->fd = fd;
+
+	talloc_set_destructor(h, _tcp_handle_free);
+
+	/*
+	 *	The connect() is still in progress, but the local
+	 *	port has been picked.
+	 */
+	salen = sizeof(salocal);
+	if ((getsockname(fd, (struct sockaddr *) &salocal, &salen) == 0)) {
+		(void) fr_ipaddr_from_sockaddr(&h->src_ipaddr, &h->src_port, &salocal, salen);
+	}
+
+	/*
+	 *	Set the connection name.
+	 */
+	h->name = fr_asprintf(h, "proto %s local %pV port %u remote %pV port %u",
+#ifdef WITH_TLS
+			      h->inst->tls_conf ? "tls" : "tcp",
+#else
+			      "tcp",
+#endif
+			      fr_box_ipaddr(h->src_ipaddr), h->src_port,
+			      fr_box_ipaddr(h->inst->dst_ipaddr), h->inst->dst_port);
+
+#ifdef SO_RCVBUF
+	if (h->inst->recv_buff_is_set) {
+		int opt;
+
+		opt = h->inst->recv_buff;
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opt, sizeof(int)) < 0) {
+			WARN("%s - Failed setting 'SO_RCVBUF': %s", h->module_name, fr_syserror(errno));
+		}
+	}
+#endif
+
+#ifdef SO_SNDBUF
+	if (h->inst->send_buff_is_set) {
+		int opt;
+
+		opt = h->inst->send_buff;
+		if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt, sizeof(int)) < 0) {
+			WARN("%s - Failed setting 'SO_SNDBUF', write performance may be sub-optimal: %s",
+			     h->module_name, fr_syserror(errno));
+		}
+	}
+#endif
+
+#ifdef WITH_TLS
+	/*
+	 *	Run the TLS handshake with our own I/O handlers,
+	 *	and only signal that the connection is open
+	 *	once it's done.  A home server which never
+	 *	completes the handshake is caught by the
+	 *	connection timeout.
+	 */
+	if (h->inst->tls_conf) {
+		h->ssl = SSL_new(thread->ssl_ctx);
+		if (!h->ssl) {
+			fr_tls_log_error(NULL, "%s - Failed allocating TLS session", h->module_name);
+			goto fail;
+		}
+
+		SSL_set_app_data(h->ssl, h);
+		SSL_set_ex_data(h->ssl, FR_TLS_EX_INDEX_CONF, UNCONST(void *, h->inst->tls_conf));
+		SSL_set_connect_state(h->ssl);
+
+		/*
+		 *	Verifying the chain only shows that the CA
+		 *	issued the certificate, not that it was issued
+		 *	to this home server.
+		 */
+		if (tcp_tls_identity_set(h) < 0) goto fail;
+
+		if (!SSL_set_fd(h->ssl, fd)) {
+			fr_tls_log_error(NULL, "%s - Failed binding TLS session to socket", h->module_name);
+			goto fail;
+		}
+
+		/*
+		 *	Try to resume the last session.  If the home
+		 *	server has forgotten it, we just get a full
+		 *	handshake.
+		 */
+		if (thread->tls_session) (void) SSL_set_session(h->ssl, thread->tls_session);
+
+		if (fr_event_fd_insert(h, conn->el, fd, NULL, conn_handshake, conn_error_handshake, conn) < 0) {
+			PERROR("%s - Failed inserting FD event", h->module_name);
+			goto fail;
+		}
+	} else
+#endif
+	/*
+	 *	Signal the connection as open as soon as the
+	 *	connect() completes.
+	 */
+	if (fr_connection_signal_on_fd(conn, fd) < 0) goto fail;
+
+	*h_out = h;
+
+	return FR_CONNECTION_STATE_CONNECTING;
+}
+
+/** Shutdown/close a file descriptor
+ *
+ */
+static void conn_close(UNUSED fr_event_list_t *el, void *handle, UNUSED void *uctx)
+{
+	tcp_handle_t *h = talloc_get_type_abort(handle, tcp_handle_t);
+
+	/*
+	 *	There's tracking entries still allocated
+	 *	this is bad, they should have all been
+	 *	released.
+	 */
+	if (h->tt && (h->tt->num_requests != 0)) {
+#ifndef NDEBUG
+		radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__, h->tt, tcp_tracking_entry_log);
+#endif
+		fr_assert_fail("%u tracking entries still allocated at conn close", h->tt->num_requests);
+	}
+
+	DEBUG2("%s - Connection %s sent %" PRIu64 " requests, received %" PRIu64 " replies",
+	       h->module_name, h->name, h->num_sent, h->num_replies);
+
+	DEBUG4("Freeing rlm_radius_tcp handle %p", handle);
+
+	talloc_free(h);
+}
+
+static fr_connection_t *thread_conn_alloc(fr_trunk_connection_t *tconn, fr_event_list_t *el,
+					  fr_connection_conf_t const *conf,
+					  char const *log_prefix, void *uctx)
+{
+	fr_connection_t		*conn;
+	tcp_thread_t		*thread = talloc_get_type_abort(uctx, tcp_thread_t);
+
+	conn = fr_connection_alloc(tconn, el,
+				   &(fr_connection_funcs_t){
+					.init = conn_init,
+					.close = conn_close,
+				   },
+				   conf,
+				   log_prefix,
+				   thread);
+	if (!conn) {
+		PERROR("%s - Failed allocating state handler for new connection", thread->inst->parent->name);
+		return NULL;
+	}
+
+	return conn;
+}
+
+/** Read and discard late replies
+ *
+ * Nothing is outstanding on the connection, so anything we read is a
+ * reply which arrived too late.  We still need to read it, to notice
+ * when the home server closes the connection, and we still need to
+ * frame it, so that we stay in step with the stream.  request_demux()
+ * does both, and ignores the replies as it can't find their IDs.
+ */
+static void conn_discard(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	request_demux(tconn, tconn->conn, NULL);
+}
+
+/** Standard I/O read function
+ *
+ * Underlying FD in now readable, so call the trunk to read any pending requests
+ * from this connection.
+ *
+ * @param[in] el	The event list signalling.
+ * @param[in] fd	that's now readable.
+ * @param[in] flags	describing the read event.
+ * @param[in] uctx	The trunk connection handle (tconn).
+ */
+static void conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	fr_trunk_connection_signal_readable(tconn);
+}
+
+/** Standard I/O write function
+ *
+ * Underlying FD is now writable.  Finish writing out anything left over
+ * from the last call to request_mux(), then call the trunk to write any
+ * pending requests to this connection.
+ *
+ * @param[in] el	The event list signalling.
+ * @param[in] fd	that's now writable.
+ * @param[in] flags	describing the write event.
+ * @param[in] uctx	The trunk connection handle (tcon).
+ */
+static void conn_writable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	tcp_handle_t		*h = talloc_get_type_abort(tconn->conn->h, tcp_handle_t);
+
+	if (h->send_off < h->send_len) {
+		if (conn_flush(tconn, h) < 0) return;
+		if (h->send_off < h->send_len) return;
+
+		/*
+		 *	Stop watching for writability if the trunk
+		 *	doesn't need it.
+		 */
+		conn_events_update(tconn, h);
+	}
+
+	if ((h->events == FR_TRUNK_CONN_EVENT_WRITE) || (h->events == FR_TRUNK_CONN_EVENT_BOTH)) {
+		fr_trunk_connection_signal_writable(tconn);
+	}
+}
+
+/** Connection errored
+ *
+ * We were signalled by the event loop that a fatal error occurred on this connection.
+ *
+ * @param[in] el	The event list signalling.
+ * @param[in] fd	that errored.
+ * @param[in] flags	El flags.
+ * @param[in] fd_errno	The nature of the error.
+ * @param[in] uctx	The trunk connection handle (tconn).
+ */
+static void conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	fr_connection_t		*conn = tconn->conn;
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+
+	ERROR("%s - Connection %s failed: %s", h->module_name, h->name, fr_syserror(fd_errno));
+
+	fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+}
+
+/** Install I/O handlers for what the trunk wants, and for any data we still have to write
+ *
+ */
+static void conn_events_update(fr_trunk_connection_t *tconn, tcp_handle_t *h)
+{
+	fr_event_fd_cb_t	read_fn = NULL;
+	fr_event_fd_cb_t	write_fn = NULL;
+
+	switch (h->events) {
+	case FR_TRUNK_CONN_EVENT_NONE:
+		read_fn = conn_discard;
+		break;
+
+	case FR_TRUNK_CONN_EVENT_READ:
+		read_fn = conn_readable;
+		break;
+
+	case FR_TRUNK_CONN_EVENT_WRITE:
+		read_fn = conn_discard;
+		write_fn = conn_writable;
+		break;
+
+	case FR_TRUNK_CONN_EVENT_BOTH:
+		read_fn = conn_readable;
+		write_fn = conn_writable;
+		break;
+	}
+
+	if (h->send_off < h->send_len) write_fn = conn_writable;
+
+	if (fr_event_fd_insert(h, h->thread->el, h->fd,
+			       read_fn,
+			       write_fn,
+			       conn_error,
+			       tconn) < 0) {
+		PERROR("%s - Failed inserting FD event", h->module_name);
+
+		/*
+		 *	May free the connection!
+		 */
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+	}
+}
+
+static void thread_conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *conn,
+			       UNUSED fr_event_list_t *el,
+			       fr_trunk_connection_event_t notify_on, UNUSED void *uctx)
+{
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+
+	h->events = notify_on;
+	conn_events_update(tconn, h);
+}
+
+/*
+ *  Return negative numbers to put 'a' at the top of the heap.
+ *  Return positive numbers to put 'b' at the top of the heap.
+ *
+ *  We want the value with the lowest timestamp to be prioritized at
+ *  the top of the heap.
+ */
+static int8_t request_prioritise(void const *one, void const *two)
+{
+	tcp_request_t const *a = one;
+	tcp_request_t const *b = two;
+	int8_t ret;
+
+	/*
+	 *	Larger priority is more important.
+	 */
+	ret = (a->priority < b->priority) - (a->priority > b->priority);
+	if (ret != 0) return ret;
+
+	/*
+	 *	Smaller timestamp (i.e. earlier) is more important.
+	 */
+	return (a->recv_time > b->recv_time) - (a->recv_time < b->recv_time);
+}
+
+/** Decode response packet data, extracting relevant information and validating the packet
+ *
+ * @param[in] ctx			to allocate pairs in.
+ * @param[out] reply			Pointer to head of pair list to add reply attributes to.
+ * @param[out] response_code		The type of response packet.
+ * @param[in] h				connection handle.
+ * @param[in] request			the request.
+ * @param[in] u				TCP request.
+ * @param[in] request_authenticator	from the original request.
+ * @param[in] data			to decode.
+ * @param[in] data_len			Length of input data.
+ * @return
+ *	- DECODE_FAIL_NONE on success.
+ *	- DECODE_FAIL_* on failure.
+ */
+static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *response_code,
+			    tcp_handle_t *h, request_t *request, tcp_request_t *u,
+			    uint8_t const request_authenticator[static RADIUS_AUTH_VECTOR_LENGTH],
+			    uint8_t *data, size_t data_len)
+{
+	rlm_radius_tcp_t const *inst = h->thread->inst;
+	size_t			packet_len;
+	decode_fail_t		reason;
+	uint8_t			code;
+	uint8_t			original[RADIUS_HEADER_LENGTH];
+	fr_dcursor_t		cursor;
+
+	*response_code = 0;	/* Initialise to keep the rest of the code happy */
+
+	packet_len = data_len;
+	if (!fr_radius_ok(data, &packet_len, inst->parent->max_attributes, false, &reason)) {
+		RWARN("Ignoring malformed packet");
+		return reason;
+	}
+
+	RHEXDUMP3(data, packet_len, "Read packet");
+
+	original[0] = u->code;
+	original[1] = 0;			/* not looked at by fr_radius_verify() */
+	original[2] = 0;
+	original[3] = RADIUS_HEADER_LENGTH;	/* for debugging */
+	memcpy(original + RADIUS_AUTH_VECTOR_OFFSET, request_authenticator, RADIUS_AUTH_VECTOR_LENGTH);
+
+	if (fr_radius_verify_hmac(data, original,
+				  (uint8_t const *) inst->secret, talloc_array_length(inst->secret) - 1,
+				  inst->secret_hmac) < 0) {
+		RPWDEBUG("Ignoring response with invalid signature");
+		return DECODE_FAIL_MA_INVALID;
+	}
+
+	code = data[0];
+	if (!code || (code >= FR_RADIUS_CODE_MAX)) {
+		REDEBUG("Unknown reply code %d", code);
+		return DECODE_FAIL_UNKNOWN_PACKET_CODE;
+	}
+
+	if (!allowed_replies[code]) {
+		REDEBUG("%s packet received invalid reply code %s",
+			fr_packet_codes[u->code], fr_packet_codes[code]);
+		return DECODE_FAIL_UNKNOWN_PACKET_CODE;
+	}
+
+	/*
+	 *	Protocol error is allowed as a response to any
+	 *	packet code.
+	 */
+	if ((code != FR_RADIUS_CODE_PROTOCOL_ERROR) && (allowed_replies[code] != (fr_radius_packet_code_t) u->code)) {
+		REDEBUG("%s packet received invalid reply code %s",
+			fr_packet_codes[u->code], fr_packet_codes[code]);
+		return DECODE_FAIL_UNKNOWN_PACKET_CODE;
+	}
+
+	/*
+	 *	Decode the attributes, in the context of the reply.
+	 *	This only fails if the packet is strangely malformed,
+	 *	or if we run out of memory.
+	 */
+	fr_dcursor_init(&cursor, reply);
+	if (fr_radius_decode(ctx, data, packet_len, original,
+			     inst->secret, talloc_array_length(inst->secret) - 1, &cursor) < 0) {
+		REDEBUG("Failed decoding attributes for packet");
+		fr_pair_list_free(reply);
+		return DECODE_FAIL_UNKNOWN;
+	}
+
+	RDEBUG("Received %s ID %d length %ld reply packet on connection %s",
+	       fr_packet_codes[code], data[1], packet_len, h->name);
+	log_request_pair_list(L_DBG_LVL_2, request, NULL, reply, NULL);
+
+	*response_code = code;
+
+	return DECODE_FAIL_NONE;
+}
+
+/** Encode a request directly into the connection's send buffer
+ *
+ * @param[in] inst	of the transport.
+ * @param[in] request	the request.
+ * @param[in] u		TCP request.
+ * @param[in] id	to put in the packet.
+ * @param[in] now	the time we're sending the packet.
+ * @param[out] out	where to write the packet.
+ * @param[in] outlen	room available in out.
+ * @return
+ *	- >0 the length of the packet.
+ *	- -1 on failure.
+ */
+static ssize_t encode(rlm_radius_tcp_t const *inst, request_t *request, tcp_request_t *u, uint8_t id,
+		      fr_time_t now, uint8_t *out, size_t outlen)
+{
+	ssize_t			packet_len;
+	uint8_t			*msg = NULL;
+	int			message_authenticator = u->require_ma * (RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2);
+	int			proxy_state = 7;
+
+	fr_assert(inst->parent->allowed[u->code]);
+
+	/*
+	 *	All proxied Access-Request packets MUST have a
+	 *	Message-Authenticator, otherwise they're insecure.
+	 *
+	 *	And we set the authentication vector to a random
+	 *	number...
+	 */
+	if (u->code == FR_RADIUS_CODE_ACCESS_REQUEST) {
+		size_t i;
+		uint32_t hash, base;
+
+		message_authenticator = RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2;
+
+		base = fr_rand();
+		for (i = 0; i < RADIUS_AUTH_VECTOR_LENGTH; i += sizeof(uint32_t)) {
+			hash = fr_rand() ^ base;
+			memcpy(out + RADIUS_AUTH_VECTOR_OFFSET + i, &hash, sizeof(hash));
+		}
+	}
+
+	/*
+	 *	We're originating packets instead of proxying
+	 *	them.  We don't add a Proxy-State attribute.
+	 */
+	if (inst->parent->originate) proxy_state = 0;
+
+	/*
+	 *	We should have at minimum 64-byte packets, so don't
+	 *	bother doing run-time checks here.
+	 */
+	fr_assert(outlen >= (size_t) (RADIUS_HEADER_LENGTH + proxy_state + message_authenticator));
+
+	/*
+	 *	Encode it, leaving room for Proxy-State and
+	 *	Message-Authenticator if necessary.
+	 */
+	packet_len = fr_radius_encode(out, outlen - (proxy_state + message_authenticator), NULL,
+				      inst->secret, talloc_array_length(inst->secret) - 1,
+				      u->code, id, &request->request_pairs);
+	if (fr_pair_encode_is_error(packet_len)) {
+		RPERROR("Failed encoding packet");
+		return -1;
+	}
+
+	if (packet_len < 0) {
+		size_t have;
+		size_t need;
+
+		have = outlen - (proxy_state + message_authenticator);
+		need = have - packet_len;
+
+		if (need > RADIUS_MAX_PACKET_SIZE) {
+			RERROR("Failed encoding packet.  Have %zu bytes of buffer, need %zu bytes",
+			       have, need);
+		} else {
+			RERROR("Failed encoding packet.  Have %zu bytes of buffer, need %zu bytes.  "
+			       "Increase 'max_packet_size'", have, need);
+		}
+
+		return -1;
+	}
+
+	/*
+	 *	Add Proxy-State to the tail end of the packet.
+	 *
+	 *	We need to add it here, and NOT in
+	 *	request->request_pairs, because multiple modules
+	 *	may be sending the packets at the same time.
+	 */
+	if (proxy_state) {
+		uint8_t		*attr = out + packet_len;
+		fr_pair_t	*vp;
+		fr_dcursor_t	cursor;
+		int		count = 0;
+
+		/*
+		 *	Count how many Proxy-State attributes have
+		 *	*our* magic number.  Note that we also add a
+		 *	counter to each Proxy-State, so we're double
+		 *	sure that it's a loop.
+		 */
+		if (DEBUG_ENABLED) {
+			for (vp = fr_dcursor_iter_by_da_init(&cursor, &request->request_pairs, attr_proxy_state);
+			     vp;
+			     vp = fr_dcursor_next(&cursor)) {
+				if ((vp->vp_length == 5) && (memcmp(vp->vp_octets, &inst->parent->proxy_state, 4) == 0)) {
+					count++;
+				}
+			}
+
+			if (count >= 4) RWARN("Potential proxy loop detected!  Please recheck your configuration.");
+		}
+
+		attr[0] = (uint8_t)attr_proxy_state->attr;
+		attr[1] = 7;
+		memcpy(attr + 2, &inst->parent->proxy_state, 4);
+		attr[6] = count & 0xff;
+		packet_len += 7;
+
+		MEM(vp = fr_pair_afrom_da(u, attr_proxy_state));
+		fr_pair_value_memdup(vp, attr + 2, 5, true);
+		fr_pair_append(&u->extra, vp);
+	}
+
+	/*
+	 *	Add Message-Authenticator manually.
+	 */
+	if (message_authenticator) {
+		msg = out + packet_len;
+
+		msg[0] = (uint8_t) attr_message_authenticator->attr;
+		msg[1] = RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2;
+		memset(msg + 2, 0,  RADIUS_MESSAGE_AUTHENTICATOR_LENGTH);
+
+		packet_len += msg[1];
+	}
+
+	/*
+	 *	Update the packet header based on the new attributes.
+	 */
+	out[2] = (packet_len >> 8) & 0xff;
+	out[3] = packet_len & 0xff;
+
+	/*
+	 *	Ensure that we update the Acct-Delay-Time based on the
+	 *	time difference between now, and when we originally
+	 *	received the request.
+	 */
+	if ((u->code == FR_RADIUS_CODE_ACCOUNTING_REQUEST) &&
+	    (fr_pair_find_by_da(&request->request_pairs, attr_acct_delay_time, 0) != NULL)) {
+		uint8_t *attr, *end;
+		uint32_t delay;
+
+		end = out + packet_len;
+
+		for (attr = out + RADIUS_HEADER_LENGTH;
+		     attr < end;
+		     attr += attr[1]) {
+			if (attr[0] != attr_acct_delay_time->attr) continue;
+			if (attr[1] != 6) continue;
+
+			memcpy(&delay, attr + 2, 4);
+			delay = ntohl(delay);
+			delay += fr_time_delta_to_sec(now - u->recv_time);
+			delay = htonl(delay);
+			memcpy(attr + 2, &delay, 4);
+			break;
+		}
+	}
+
+	/*
+	 *	Only certain types of packet, and those with a
+	 *	message_authenticator need signing.
+	 */
+	if (message_authenticator) goto sign;
+	switch (u->code) {
+	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
+	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
+	case FR_RADIUS_CODE_COA_REQUEST:
+	sign:
+		if (fr_radius_sign_hmac(out, NULL, (uint8_t const *) inst->secret,
+					talloc_array_length(inst->secret) - 1, inst->secret_hmac) < 0) {
+			RERROR("Failed signing packet");
+			fr_pair_list_free(&u->extra);
+			return -1;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return packet_len;
+}
+
+/** Revive a connection after "revive_interval"
+ *
+ */
+static void revive_timer(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	tcp_handle_t	 	*h = talloc_get_type_abort(tconn->conn->h, tcp_handle_t);
+
+	INFO("%s - Shutting down and reviving connection %s", h->module_name, h->name);
+	fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+}
+
+/** See if the connection is zombied.
+ *
+ * As with UDP, a connection is a zombie if we've sent packets, and
+ * there have been no replies for "zombie_period".  We check when a
+ * request times out, and when we're sending.
+ *
+ * @return
+ *	- true if a connection state change was triggered.
+ *	- false if the connection did not change state.
+ */
+static bool check_for_zombie(fr_event_list_t *el, fr_trunk_connection_t *tconn, fr_time_t now)
+{
+	tcp_handle_t	*h = talloc_get_type_abort(tconn->conn->h, tcp_handle_t);
+	fr_time_t	when;
+
+	if (h->zombie_ev || !h->last_sent || (h->last_sent <= h->last_idle) ||
+	    (h->last_reply && (h->last_reply <= h->last_idle))) {
+		return false;
+	}
+
+	if (now == 0) now = fr_time();
+
+	if (h->last_reply) {
+		if ((h->last_reply + h->inst->parent->zombie_period) >= now) return false;
+		DEBUG2("%s - We have passed 'zombie_period' time since the last reply on connection %s",
+		       h->module_name, h->name);
+	} else {
+		if ((h->first_sent + h->inst->parent->zombie_period) >= now) return false;
+		DEBUG2("%s - We have passed 'zombie_period' time since we first sent a packet, and "
+		       "there have been no replies on connection %s", h->module_name, h->name);
+	}
+
+	/*
+	 *	Make "load-balance" sections avoid this home
+	 *	server, more so each time it goes bad.
+	 */
+	if (h->thread->backoff < TCP_MAX_BACKOFF) h->thread->backoff++;
+
+	/*
+	 *	Move everything to the other connections, and
+	 *	reconnect this one later.
+	 */
+	WARN("%s - Connection failed.  Reviving it in %pVs", h->module_name,
+	     fr_box_time_delta(h->inst->parent->revive_interval));
+	fr_trunk_connection_signal_inactive(tconn);
+	(void) fr_trunk_connection_requests_requeue(tconn, FR_TRUNK_REQUEST_STATE_ALL, 0, false);
+
+	when = now + h->inst->parent->revive_interval;
+	if (fr_event_timer_at(h, el, &h->zombie_ev, when, revive_timer, tconn) < 0) {
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+	}
+
+	return true;
+}
+
+/** Update the smoothed round trip time with a new sample
+ *
+ * As with TCP's SRTT, new samples get a weight of 1/8.
+ */
+static inline CC_HINT(always_inline) void rtt_update(tcp_thread_t *t, fr_time_delta_t sample)
+{
+	if (!t->rtt) {
+		t->rtt = sample;
+		return;
+	}
+
+	t->rtt += (sample - t->rtt) / 8;
+}
+
+/** No reply arrived within the response window
+ *
+ */
+static void request_timeout(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_trunk_request_t	*treq = talloc_get_type_abort(uctx, fr_trunk_request_t);
+	tcp_handle_t		*h;
+	tcp_request_t		*u = talloc_get_type_abort(treq->preq, tcp_request_t);
+	tcp_result_t		*r = talloc_get_type_abort(treq->rctx, tcp_result_t);
+	request_t		*request = treq->request;
+	fr_trunk_connection_t	*tconn = treq->tconn;
+
+	fr_assert(treq->state == FR_TRUNK_REQUEST_STATE_SENT);		/* No other states should be timing out */
+	fr_assert(u->rr);
+	fr_assert(tconn);
+
+	h = talloc_get_type_abort(tconn->conn->h, tcp_handle_t);
+
+	/*
+	 *	If the connection just became a zombie, the
+	 *	request has been moved elsewhere.
+	 */
+	if (check_for_zombie(el, tconn, now)) return;
+
+	REDEBUG("No response within %pVs, failing request",
+		fr_box_time_delta(h->inst->parent->retry[u->code].mrd));
+
+	/*
+	 *	A lost request took at least this long.
+	 */
+	rtt_update(h->thread, now - u->start);
+
+	r->rcode = RLM_MODULE_FAIL;
+	fr_trunk_request_signal_complete(treq);
+}
+
+static void request_mux(fr_event_list_t *el,
+			fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+	rlm_radius_tcp_t const	*inst = h->inst;
+	uint16_t		i;
+	fr_time_t		now;
+
+	/*
+	 *	If the connection just became a zombie
+	 *	don't try and enqueue things on it!
+	 */
+	if (check_for_zombie(el, tconn, 0)) return;
+
+	/*
+	 *	Packets in the send buffer are committed to the
+	 *	stream.  Finish writing them before we encode
+	 *	anything else.
+	 */
+	if (h->send_off < h->send_len) {
+		if (conn_flush(tconn, h) < 0) return;
+		if (h->send_off < h->send_len) return;
+	}
+
+	now = fr_time();
+
+	/*
+	 *	Encode as many packets as will fit, so that they
+	 *	can all go out in one write.
+	 */
+	for (i = 0;
+	     (i < inst->max_send_coalesce) && ((h->send_len + inst->max_packet_size) <= h->send_size);
+	     i++) {
+		fr_trunk_request_t	*treq;
+		tcp_request_t		*u;
+		request_t		*request;
+		uint8_t			*packet = h->send_buf + h->send_len;
+		ssize_t			packet_len;
+		fr_time_delta_t		mrd;
+
+ 		if (unlikely(fr_trunk_connection_pop_request(&treq, tconn) < 0)) return;
+
+		/*
+		 *	No more requests to send
+		 */
+		if (!treq) break;
+
+ 		fr_assert((treq->state == FR_TRUNK_REQUEST_STATE_PENDING) ||
+			   (treq->state == FR_TRUNK_REQUEST_STATE_PARTIAL));
+
+		request = treq->request;
+		u = talloc_get_type_abort(treq->preq, tcp_request_t);
+
+		fr_assert(!u->rr);
+
+		if (unlikely(radius_track_entry_reserve(&u->rr, treq, h->tt, request, u->code, treq) < 0)) {
+#ifndef NDEBUG
+			radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__,
+					       h->tt, tcp_tracking_entry_log);
+#endif
+			fr_assert_fail("Tracking entry allocation failed: %s", fr_strerror());
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+		u->id = u->rr->id;
+		u->start = now;
+
+		packet_len = encode(inst, request, u, u->id, now, packet, inst->max_packet_size);
+		if (packet_len < 0) {
+			tcp_request_reset(u);
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+
+		RDEBUG("Sending %s ID %d length %zd over connection %s",
+		       fr_packet_codes[u->code], u->id, packet_len, h->name);
+		RHEXDUMP3(packet, packet_len, "Encoded packet");
+
+		log_request_pair_list(L_DBG_LVL_2, request, NULL, &request->request_pairs, NULL);
+		if (!fr_pair_list_empty(&u->extra)) log_request_pair_list(L_DBG_LVL_2, request, NULL, &u->extra, NULL);
+
+		/*
+		 *	Remember the authentication vector, which now has the
+		 *	packet signature.
+		 */
+		(void) radius_track_entry_update(u->rr, packet + RADIUS_AUTH_VECTOR_OFFSET);
+
+		h->send_len += packet_len;
+		h->num_sent++;
+		h->last_sent = now;
+		if (h->first_sent <= h->last_idle) h->first_sent = h->last_sent;
+
+		/*
+		 *	The packet is in the stream now.  Even if the
+		 *	write below is short, the rest of it goes out
+		 *	before anything else.
+		 */
+		fr_trunk_request_signal_sent(treq);
+
+		mrd = inst->parent->retry[u->code].mrd;
+		if (!mrd) {
+			RDEBUG("%s request.  Relying on max_request_time", inst->parent->originate ? "Originated" : "Proxied");
+			continue;
+		}
+
+		RDEBUG("%s request.  Expecting response within %pVs", inst->parent->originate ? "Originated" : "Proxied",
+		       fr_box_time_delta(mrd));
+
+		if (fr_event_timer_at(u, el, &u->ev, now + mrd, request_timeout, treq) < 0) {
+			RERROR("Failed inserting response timeout for connection");
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+	}
+
+	/*
+	 *	Verify nothing accidentally freed the connection handle
+	 */
+	(void)talloc_get_type_abort(h, tcp_handle_t);
+
+	if (!h->send_len) return;	/* No work */
+
+	if (conn_flush(tconn, h) < 0) return;
+
+	/*
+	 *	The kernel buffer is full.  Watch for the
+	 *	connection becoming writable, so we can finish.
+	 */
+	if (h->send_off < h->send_len) conn_events_update(tconn, h);
+}
+
+/** Deal with Protocol-Error replies
+ *
+ * Unlike UDP, there's no buffer to resize.  The receive buffer is
+ * sized by max_packet_size, and the home server can't send us anything
+ * bigger than that without breaking the stream.
+ */
+static void protocol_error_reply(tcp_request_t *u, tcp_result_t *r, uint8_t const *packet)
+{
+	uint8_t const	*attr, *end;
+
+	end = packet + ((packet[2] << 8) | packet[3]);
+
+	for (attr = packet + RADIUS_HEADER_LENGTH;
+	     attr < end;
+	     attr += attr[1]) {
+		/*
+		 *	Protocol-Error packets MUST contain an
+		 *	Original-Packet-Code attribute.
+		 *
+		 *	The attribute containing the
+		 *	Original-Packet-Code is an extended
+		 *	attribute.
+		 */
+		if (attr[0] != attr_extended_attribute_1->attr) continue;
+
+		/*
+		 *	ATTR + LEN + EXT-Attr + uint32
+		 */
+		if (attr[1] != 7) continue;
+
+		/*
+		 *	See if there's an Original-Packet-Code.
+		 */
+		if (attr[2] != (uint8_t)attr_original_packet_code->attr) continue;
+
+		/*
+		 *	Has to be an 8-bit number, and has to match.
+		 */
+		if ((attr[3] != 0) || (attr[4] != 0) || (attr[5] != 0) || (attr[6] != u->code)) {
+			r->rcode = RLM_MODULE_FAIL;
+			return;
+		}
+	}
+
+	/*
+	 *	The response is valid, but not useful for anything.
+	 */
+	r->rcode = RLM_MODULE_HANDLED;
+}
+
+/** Process one reply packet
+ *
+ */
+static void packet_received(tcp_handle_t *h, uint8_t *packet, size_t packet_len)
+{
+	fr_trunk_request_t	*treq;
+	request_t		*request;
+	tcp_request_t		*u;
+	tcp_result_t		*r;
+	radius_track_entry_t	*rr;
+	decode_fail_t		reason;
+	uint8_t			code = 0;
+	fr_pair_list_t		reply;
+	fr_time_t		now;
+
+	fr_pair_list_init(&reply);
+
+	/*
+	 *	Note that we don't care about packet codes.  All
+	 *	packet codes share the same ID space.
+	 */
+	rr = radius_track_entry_find(h->tt, packet[1], NULL);
+	if (!rr) {
+		WARN("%s - Ignoring reply with ID %i that arrived too late",
+		     h->module_name, packet[1]);
+		return;
+	}
+
+	treq = talloc_get_type_abort(rr->uctx, fr_trunk_request_t);
+	request = treq->request;
+	fr_assert(request != NULL);
+	u = talloc_get_type_abort(treq->preq, tcp_request_t);
+	r = talloc_get_type_abort(treq->rctx, tcp_result_t);
+
+	/*
+	 *	Validate and decode the incoming packet
+	 */
+	reason = decode(request->reply_ctx, &reply, &code, h, request, u, rr->vector, packet, packet_len);
+	if (reason != DECODE_FAIL_NONE) return;
+
+	/*
+	 *	Only valid packets are processed.
+	 */
+	h->last_reply = now = fr_time();
+	h->num_replies++;
+
+	rtt_update(h->thread, now - u->start);
+	if (h->thread->backoff) h->thread->backoff--;
+
+	if (code == FR_RADIUS_CODE_PROTOCOL_ERROR) protocol_error_reply(u, r, packet);
+
+	/*
+	 *	Mark up the request as being an Access-Challenge, if
+	 *	required.
+	 */
+	if ((u->code == FR_RADIUS_CODE_ACCESS_REQUEST) && (code == FR_RADIUS_CODE_ACCESS_CHALLENGE)) {
+		fr_pair_t	*vp;
+
+		vp = fr_pair_find_by_da(&request->reply_pairs, attr_packet_type, 0);
+		if (!vp) {
+			MEM(vp = fr_pair_afrom_da(request->reply_ctx, attr_packet_type));
+			vp->vp_uint32 = FR_RADIUS_CODE_ACCESS_CHALLENGE;
+			fr_pair_append(&request->reply_pairs, vp);
+		}
+	}
+
+	/*
+	 *	Delete Proxy-State attributes from the reply.
+	 */
+	fr_pair_delete_by_da(&reply, attr_proxy_state);
+
+	/*
+	 *	If the reply has Message-Authenticator, delete
+	 *	it from the proxy reply so that it isn't
+	 *	copied over to our reply.  But also create a
+	 *	reply.Message-Authenticator attribute, so that
+	 *	it ends up in our reply.
+	 */
+	if (fr_pair_find_by_da(&reply, attr_message_authenticator, 0)) {
+		fr_pair_t *vp;
+
+		fr_pair_delete_by_da(&reply, attr_message_authenticator);
+
+		MEM(vp = fr_pair_afrom_da(request->reply_ctx, attr_message_authenticator));
+		(void) fr_pair_value_memdup(vp, (uint8_t const *) "", 1, false);
+		fr_pair_append(&request->reply_pairs, vp);
+	}
+
+	treq->request->reply->code = code;
+	if (code != FR_RADIUS_CODE_PROTOCOL_ERROR) r->rcode = radius_code_to_rcode[code];
+	fr_pair_list_append(&request->reply_pairs, &reply);
+	fr_trunk_request_signal_complete(treq);
+}
+
+static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+
+	DEBUG3("%s - Reading data for connection %s", h->module_name, h->name);
+
+	while (true) {
+		ssize_t		slen;
+		uint8_t		*p, *end;
+
+		slen = conn_read(h, h->recv_buf + h->recv_len, h->recv_size - h->recv_len);
+		if (slen < 0) {
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+		}
+		if (slen == 0) return;
+
+		h->recv_len += slen;
+
+		/*
+		 *	Process every complete packet in the buffer.
+		 */
+		p = h->recv_buf;
+		end = p + h->recv_len;
+		while ((end - p) >= RADIUS_HEADER_LENGTH) {
+			size_t packet_len = (p[2] << 8) | p[3];
+
+			/*
+			 *	There's no way to find the start of
+			 *	the next packet, so the stream is
+			 *	unusable.
+			 */
+			if ((packet_len < RADIUS_HEADER_LENGTH) || (packet_len > h->inst->max_packet_size)) {
+				ERROR("%s - Received packet with invalid length %zu on connection %s",
+				      h->module_name, packet_len, h->name);
+				fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+				return;
+			}
+
+			if ((size_t)(end - p) < packet_len) break;
+
+			packet_received(h, p, packet_len);
+			p += packet_len;
+		}
+
+		/*
+		 *	Move any partial packet to the start of the
+		 *	buffer.
+		 */
+		h->recv_len = end - p;
+		if (h->recv_len && (p != h->recv_buf)) memmove(h->recv_buf, p, h->recv_len);
+	}
+}
+
+/** Remove the request from any tracking structures
+ *
+ * The request is being moved to a new connection, so it will be
+ * encoded again, with a new ID.
+ */
+static void request_cancel(UNUSED fr_connection_t *conn, void *preq_to_reset,
+			   fr_trunk_cancel_reason_t reason, UNUSED void *uctx)
+{
+	tcp_request_t	*u = talloc_get_type_abort(preq_to_reset, tcp_request_t);
+
+	if (reason == FR_TRUNK_CANCEL_REASON_REQUEUE) {
+		if (u->ev) (void) fr_event_timer_delete(&u->ev);
+		tcp_request_reset(u);
+	}
+
+	/*
+	 *      Other cancellations are dealt with by
+	 *      request_conn_release as the request is removed
+	 *	from the trunk.
+	 */
+}
+
+/** Clear out anything associated with the handle from the request
+ *
+ */
+static void request_conn_release(fr_connection_t *conn, void *preq_to_reset, UNUSED void *uctx)
+{
+	tcp_request_t		*u = talloc_get_type_abort(preq_to_reset, tcp_request_t);
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+
+	if (u->ev) (void)fr_event_timer_delete(&u->ev);
+	tcp_request_reset(u);
+
+	/*
+	 *	If there are no outstanding tracking entries
+	 *	allocated then the connection is "idle".
+	 */
+	if (h->tt->num_requests == 0) h->last_idle = fr_time();
+}
+
+/** Write out a canned failure
+ *
+ */
+static void request_fail(request_t *request, void *preq, void *rctx,
+			 NDEBUG_UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	tcp_result_t		*r = talloc_get_type_abort(rctx, tcp_result_t);
+	tcp_request_t		*u = talloc_get_type_abort(preq, tcp_request_t);
+
+	fr_assert(!u->rr && fr_pair_list_empty(&u->extra) && !u->ev);	/* Dealt with by request_conn_release */
+
+	fr_assert(state != FR_TRUNK_REQUEST_STATE_INIT);
+
+	r->rcode = RLM_MODULE_FAIL;
+	r->treq = NULL;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Response has already been written to the rctx at this point
+ *
+ */
+static void request_complete(request_t *request, void *preq, void *rctx, UNUSED void *uctx)
+{
+	tcp_result_t		*r = talloc_get_type_abort(rctx, tcp_result_t);
+	tcp_request_t		*u = talloc_get_type_abort(preq, tcp_request_t);
+
+	fr_assert(!u->rr && fr_pair_list_empty(&u->extra) && !u->ev);	/* Dealt with by request_conn_release */
+
+	r->treq = NULL;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Explicitly free resources associated with the protocol request
+ *
+ */
+static void request_free(UNUSED request_t *request, void *preq_to_free, UNUSED void *uctx)
+{
+	tcp_request_t		*u = talloc_get_type_abort(preq_to_free, tcp_request_t);
+
+	fr_assert(!u->rr && fr_pair_list_empty(&u->extra) && !u->ev);	/* Dealt with by request_conn_release */
+
+	talloc_free(u);
+}
+
+/** Resume execution of the request, returning the rcode set during trunk execution
+ *
+ */
+static unlang_action_t mod_resume(rlm_rcode_t *p_result, UNUSED module_ctx_t const *mctx, UNUSED request_t *request, void *rctx)
+{
+	tcp_result_t	*r = talloc_get_type_abort(rctx, tcp_result_t);
+	rlm_rcode_t	rcode = r->rcode;
+
+	talloc_free(rctx);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+static void mod_signal(UNUSED module_ctx_t const *mctx, UNUSED request_t *request,
+		       void *rctx, fr_state_signal_t action)
+{
+	tcp_result_t		*r = talloc_get_type_abort(rctx, tcp_result_t);
+
+	/*
+	 *	If we don't have a treq associated with the
+	 *	rctx it's likely because the request was
+	 *	scheduled, but hasn't yet been resumed.
+	 */
+	if (!r->treq) {
+		talloc_free(rctx);
+		return;
+	}
+
+	switch (action) {
+	/*
+	 *	The request is being cancelled, tell the
+	 *	trunk so it can clean up the treq.
+	 */
+	case FR_SIGNAL_CANCEL:
+		fr_trunk_request_signal_cancel(r->treq);
+		r->treq = NULL;
+		talloc_free(r);		/* Should be freed soon anyway, but better to be explicit */
+		return;
+
+	/*
+	 *	The transport is reliable, so duplicates from the
+	 *	NAS are never turned into retransmissions.
+	 */
+	case FR_SIGNAL_DUP:
+	default:
+		return;
+	}
+}
+
+#ifndef NDEBUG
+/** Free a tcp_result_t
+ *
+ * Allows us to set break points for debugging.
+ */
+static int _tcp_result_free(tcp_result_t *r)
+{
+	fr_trunk_request_t	*treq;
+	tcp_request_t		*u;
+
+	if (!r->treq) return 0;
+
+	treq = talloc_get_type_abort(r->treq, fr_trunk_request_t);
+	u = talloc_get_type_abort(treq->preq, tcp_request_t);
+
+	fr_assert_msg(!u->ev, "tcp_result_t freed with active timer");
+
+	return 0;
+}
+#endif
+
+/** Estimate how long a new request would take on this thread's trunk
+ *
+ * The same estimate as the UDP transport uses, so that TCP and UDP
+ * home servers can be mixed in one "load-balance" section.
+ */
+static uint64_t mod_cost(UNUSED void const *instance, void *thread)
+{
+	tcp_thread_t	*t = talloc_get_type_abort(thread, tcp_thread_t);
+	uint64_t	cost;
+
+	cost = fr_trunk_request_count_by_state(t->trunk, FR_TRUNK_CONN_ALL, FR_TRUNK_REQUEST_STATE_ALL) + 1;
+	if (t->rtt > 0) cost *= (uint64_t) t->rtt;
+
+	if (cost > (UINT64_MAX >> t->backoff)) return UINT64_MAX;
+
+	return cost << t->backoff;
+}
+
+/** Free a tcp_request_t
+ */
+static int _tcp_request_free(tcp_request_t *u)
+{
+	if (u->ev) (void) fr_event_timer_delete(&u->ev);
+
+	fr_assert(u->rr == NULL);
+
+	return 0;
+}
+
+static unlang_action_t mod_enqueue(rlm_rcode_t *p_result, void **rctx_out, UNUSED void *instance, void *thread, request_t *request)
+{
+	tcp_thread_t			*t = talloc_get_type_abort(thread, tcp_thread_t);
+	tcp_result_t			*r;
+	tcp_request_t			*u;
+	fr_trunk_request_t		*treq;
+
+	fr_assert(request->packet->code > 0);
+	fr_assert(request->packet->code < FR_RADIUS_CODE_MAX);
+
+	if (request->packet->code == FR_RADIUS_CODE_STATUS_SERVER) {
+		RWDEBUG("Status-Server is reserved for internal use, and cannot be sent manually.");
+		RETURN_MODULE_NOOP;
+	}
+
+	treq = fr_trunk_request_alloc(t->trunk, request);
+	if (!treq) RETURN_MODULE_FAIL;
+
+	MEM(r = talloc_zero(request, tcp_result_t));
+#ifndef NDEBUG
+	talloc_set_destructor(r, _tcp_result_free);
+#endif
+
+	MEM(u = talloc(treq, tcp_request_t));
+	*u = (tcp_request_t){
+		.code = request->packet->code,
+		.priority = request->async->priority,
+		.recv_time = request->async->recv_time
+	};
+	fr_pair_list_init(&u->extra);
+
+	r->rcode = RLM_MODULE_FAIL;
+
+	/*
+	 *	If the caller asked for a Message-Authenticator,
+	 *	delete theirs (which has a bad value), and
+	 *	remember to add one manually when we encode the
+	 *	packet.
+	 */
+	if (fr_pair_find_by_da(&request->request_pairs, attr_message_authenticator, 0)) {
+		u->require_ma = true;
+		pair_delete_request(attr_message_authenticator);
+	}
+
+	if (fr_trunk_request_enqueue(&treq, t->trunk, request, u, r) < 0) {
+		fr_assert(!u->rr);			/* Should not have been fed to the muxer */
+		fr_trunk_request_free(&treq);		/* Return to the free list */
+		talloc_free(r);
+		RETURN_MODULE_FAIL;
+	}
+
+	r->treq = treq;	/* Remember for signalling purposes */
+
+	talloc_set_destructor(u, _tcp_request_free);
+
+	*rctx_out = r;
+
+	return UNLANG_ACTION_YIELD;
+}
+
+/** Instantiate thread data for the submodule.
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *tctx)
+{
+	rlm_radius_tcp_t		*inst = talloc_get_type_abort(instance, rlm_radius_tcp_t);
+	tcp_thread_t			*thread = talloc_get_type_abort(tctx, tcp_thread_t);
+
+	static fr_trunk_io_funcs_t	io_funcs = {
+						.connection_alloc = thread_conn_alloc,
+						.connection_notify = thread_conn_notify,
+						.request_prioritise = request_prioritise,
+						.request_mux = request_mux,
+						.request_demux = request_demux,
+						.request_conn_release = request_conn_release,
+						.request_complete = request_complete,
+						.request_fail = request_fail,
+						.request_cancel = request_cancel,
+						.request_free = request_free
+					};
+
+	inst->trunk_conf = &inst->parent->trunk_conf;
+
+	inst->trunk_conf->req_pool_headers = 3;	/* One for the request, one for the tracking binding, one for Proxy-State VP */
+	inst->trunk_conf->req_pool_size = sizeof(tcp_request_t) + sizeof(radius_track_entry_t ***) + sizeof(fr_pair_t) + 20;
+
+	thread->el = el;
+	thread->inst = inst;
+
+#ifdef WITH_TLS
+	if (inst->tls_conf) {
+		thread->ssl_ctx = fr_tls_ctx_alloc(inst->tls_conf, true);
+		if (!thread->ssl_ctx) return -1;
+
+		/*
+		 *	The library callbacks expect an EAP or
+		 *	listener session, with a request bound to
+		 *	it.  We have neither, so use OpenSSL's
+		 *	own certificate checks, along with the
+		 *	identity check set on each session.  The
+		 *	options only the library callbacks implement
+		 *	are refused in mod_bootstrap().
+		 */
+		SSL_CTX_set_msg_callback(thread->ssl_ctx, NULL);
+		SSL_CTX_set_info_callback(thread->ssl_ctx, NULL);
+		SSL_CTX_set_verify(thread->ssl_ctx, SSL_VERIFY_PEER, NULL);
+		SSL_CTX_set_cert_verify_callback(thread->ssl_ctx, NULL, NULL);
+
+		/*
+		 *	We write straight out of the send buffer,
+		 *	and retry short writes from where they
+		 *	stopped.
+		 */
+		SSL_CTX_set_mode(thread->ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+		/*
+		 *	The socket is bound directly to the SSL
+		 *	session, so once the handshake is done the
+		 *	kernel can encrypt and decrypt records for us.
+		 */
+		if (inst->ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+			SSL_CTX_set_options(thread->ssl_ctx, SSL_OP_ENABLE_KTLS);
+#else
+			WARN("%s - Ignoring 'ktls = yes', OpenSSL was built without kernel TLS support",
+			     inst->parent->name);
+#endif
+		}
+
+		SSL_CTX_set_session_cache_mode(thread->ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(thread->ssl_ctx, tls_session_new_cb);
+	}
+#endif
+
+	thread->trunk = fr_trunk_alloc(thread, el, &io_funcs,
+				       inst->trunk_conf, inst->parent->name, thread, false);
+	if (!thread->trunk) return -1;
+
+	return 0;
+}
+
+/** Free thread data for the submodule.
+ *
+ */
+static int mod_thread_detach(UNUSED fr_event_list_t *el, UNUSED void *tctx)
+{
+#ifdef WITH_TLS
+	tcp_thread_t			*thread = talloc_get_type_abort(tctx, tcp_thread_t);
+
+	/*
+	 *	Connections which are still open hold their
+	 *	own references to the SSL_CTX.
+	 */
+	if (thread->tls_session) SSL_SESSION_free(thread->tls_session);
+	thread->tls_session = NULL;
+
+	if (thread->ssl_ctx) SSL_CTX_free(thread->ssl_ctx);
+	thread->ssl_ctx = NULL;
+#endif
+
+	return 0;
+}
+
+/** Instantiate the module
+ *
+ * @param[in] instance	data for this module
+ * @param[in] conf	our configuration section parsed to give us instance.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_radius_t		*parent = talloc_get_type_abort(dl_module_parent_data_by_child_data(instance),
+								rlm_radius_t);
+	rlm_radius_tcp_t	*inst = talloc_get_type_abort(instance, rlm_radius_tcp_t);
+
+	if (!parent) {
+		ERROR("IO module cannot be instantiated directly");
+		return -1;
+	}
+
+	inst->parent = parent;
+
+	if (parent->replicate) {
+		cf_log_err(conf, "'replicate' is not supported with the TCP transport");
+		return -1;
+	}
+
+	if (parent->status_check) {
+		cf_log_warn(conf, "Ignoring 'status_check', it is not supported with the TCP transport.  "
+			    "Unresponsive connections are closed after 'zombie_period'");
+	}
+
+	/*
+	 *	RADIUS/TLS uses a well known secret (RFC 6614
+	 *	Section 2.3).
+	 */
+	if (!inst->secret) {
+#ifdef WITH_TLS
+		if (inst->tls_conf) {
+			inst->secret = talloc_typed_strdup(inst, "radsec");
+		} else
+#endif
+		{
+			cf_log_err(conf, "A value must be given for 'secret'");
+			return -1;
+		}
+	}
+
+	if (inst->max_send_coalesce == 0) inst->max_send_coalesce = 1;
+
+	inst->secret_hmac = fr_hmac_md5_key_alloc(inst, (uint8_t const *) inst->secret,
+						  talloc_array_length(inst->secret) - 1);
+	if (!inst->secret_hmac) {
+		cf_log_perr(conf, "Failed pre-computing HMAC key for secret");
+		return -1;
+	}
+
+	/*
+	 *	Ensure that we have a destination address.
+	 */
+	if (inst->dst_ipaddr.af == AF_UNSPEC) {
+		cf_log_err(conf, "A value must be given for 'ipaddr'");
+		return -1;
+	}
+
+	/*
+	 *	If src_ipaddr isn't set, make sure it's INADDR_ANY, of
+	 *	the same address family as dst_ipaddr.
+	 */
+	if (inst->src_ipaddr.af == AF_UNSPEC) {
+		memset(&inst->src_ipaddr, 0, sizeof(inst->src_ipaddr));
+
+		inst->src_ipaddr.af = inst->dst_ipaddr.af;
+
+		if (inst->src_ipaddr.af == AF_INET) {
+			inst->src_ipaddr.prefix = 32;
+		} else {
+			inst->src_ipaddr.prefix = 128;
+		}
+	}
+
+	else if (inst->src_ipaddr.af != inst->dst_ipaddr.af) {
+		cf_log_err(conf, "The 'ipaddr' and 'src_ipaddr' configuration items must "
+			   "be both of the same address family");
+		return -1;
+	}
+
+	if (!inst->dst_port) {
+		cf_log_err(conf, "A value must be given for 'port'");
+		return -1;
+	}
+
+	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 64);
+	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65535);
+
+	FR_INTEGER_BOUND_CHECK("max_send_coalesce", inst->max_send_coalesce, <=, 256);
+
+	if (inst->recv_buff_is_set) {
+		FR_INTEGER_BOUND_CHECK("recv_buff", inst->recv_buff, >=, inst->max_packet_size);
+		FR_INTEGER_BOUND_CHECK("recv_buff", inst->recv_buff, <=, (1 << 30));
+	}
+
+	if (inst->send_buff_is_set) {
+		FR_INTEGER_BOUND_CHECK("send_buff", inst->send_buff, >=, inst->max_packet_size);
+		FR_INTEGER_BOUND_CHECK("send_buff", inst->send_buff, <=, (1 << 30));
+	}
+
+	return 0;
+}
+
+/** Bootstrap the module
+ *
+ * Parse the "tls" subsection, if there is one.
+ *
+ * @param[in] instance	Ctx data for this module
+ * @param[in] conf    our configuration section parsed to give us instance.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_bootstrap(void *instance, CONF_SECTION *conf)
+{
+	rlm_radius_tcp_t	*inst = talloc_get_type_abort(instance, rlm_radius_tcp_t);
+	CONF_SECTION		*tls_cs;
+
+	(void) talloc_set_type(inst, rlm_radius_tcp_t);
+	inst->config = conf;
+
+	tls_cs = cf_section_find(conf, "tls", NULL);
+	if (!tls_cs) return 0;
+
+#ifdef WITH_TLS
+	{
+		static char const *unsupported[] = { "check_cert_cn", "check_cert_issuer", "verify", "ocsp" };
+		CONF_ITEM	*ci;
+		size_t		i;
+
+		/*
+		 *	These are implemented by the library's verify
+		 *	callback, which we can't use.  Don't let anyone
+		 *	think they're being checked.
+		 */
+		for (i = 0; i < NUM_ELEMENTS(unsupported); i++) {
+			ci = cf_pair_to_item(cf_pair_find(tls_cs, unsupported[i]));
+			if (!ci) ci = cf_section_to_item(cf_section_find(tls_cs, unsupported[i], NULL));
+			if (!ci) continue;
+
+			cf_log_err(ci, "'%s' is not supported for RADIUS/TLS home servers.  "
+				   "Use 'tls_server_name' to check the name in the certificate", unsupported[i]);
+			return -1;
+		}
+	}
+
+	inst->tls_conf = fr_tls_conf_parse_client(tls_cs);
+	if (!inst->tls_conf) {
+		cf_log_err(tls_cs, "Failed parsing TLS configuration");
+		return -1;
+	}
+
+	return 0;
+#else
+	cf_log_err(tls_cs, "Server was built without TLS support");
+	return -1;
+#endif
+}
+
+extern rlm_radius_io_t rlm_radius_tcp;
+rlm_radius_io_t rlm_radius_tcp = {
+	.magic			= RLM_MODULE_INIT,
+	.name			= "radius_tcp",
+	.inst_size		= sizeof(rlm_radius_tcp_t),
+
+	.thread_inst_size	= sizeof(tcp_thread_t),
+	.thread_inst_type	= "tcp_thread_t",
+
+	.config			= module_config,
+	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
+	.thread_instantiate 	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+
+	.enqueue		= mod_enqueue,
+	.signal			= mod_signal,
+	.resume			= mod_resume,
+	.cost			= mod_cost,
+};
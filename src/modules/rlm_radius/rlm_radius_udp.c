@@ -39,6 +39,16 @@ RCSID("$Id$")
 #include "rlm_radius.h"
 #include "track.h"
 
+/** Maximum number of replicated packets sent with one sendmmsg call
+ *
+ */
+#define UDP_REPLICA_BATCH_MAX	(256)
+
+/** Maximum amount of replicated packet data sent with one sendmmsg call
+ *
+ */
+#define UDP_REPLICA_BATCH_SIZE	(256 * 1024)
+
 /** Static configuration for the module.
  *
  */
@@ -50,6 +60,7 @@ typedef struct {
 	fr_ipaddr_t		src_ipaddr;		//!< IP we open our socket on.
 	uint16_t		dst_port;		//!< Port of the home server.
 	char const		*secret;		//!< Shared secret.
+	fr_hmac_md5_key_t	*secret_hmac;		//!< The secret, pre-computed for signing packets.
 
 	char const		*interface;		//!< Interface to bind to.
 
@@ -59,9 +70,16 @@ typedef struct {
 	uint32_t		max_packet_size;	//!< Maximum packet size.
 	uint16_t		max_send_coalesce;	//!< Maximum number of packets to coalesce into one mmsg call.
 
+	uint32_t		max_loss;		//!< Reconnect, using a new source port, if more than this
+							///< percentage of requests on a connection get no reply.
+
 	bool			recv_buff_is_set;	//!< Whether we were provided with a recv_buf
 	bool			send_buff_is_set;	//!< Whether we were provided with a send_buf
 	bool			replicate;		//!< Copied from parent->replicate
+	bool			batch_replicas;		//!< Share encoded packets between replicating modules,
+							///< and send all replicas with one sendmmsg call.
+	bool			pass_through;		//!< Forward the attributes of unmodified requests and
+							///< replies, instead of encoding them again.
 
 	fr_trunk_conf_t		*trunk_conf;		//!< trunk configuration
 } rlm_radius_udp_t;
@@ -72,6 +90,14 @@ typedef struct {
 	rlm_radius_udp_t const	*inst;			//!< our instance
 
 	fr_trunk_t		*trunk;			//!< trunk handler
+
+	fr_time_delta_t		rtt;			//!< Smoothed round trip time to the home server.
+	uint32_t		backoff;		//!< The cost is doubled this many times.  Raised when
+							///< a connection becomes a zombie, lowered by replies.
+
+	struct udp_replica_batch_s *batch;		//!< Shared by all batching replicas in this thread.
+	struct sockaddr_storage	replica_dst;		//!< Where this module's replicas are sent.
+	socklen_t		replica_dst_len;	//!< Length of replica_dst.
 } udp_thread_t;
 
 typedef struct {
@@ -127,6 +153,13 @@ typedef struct {
 	fr_time_t		last_sent;		//!< last time we sent a packet.
 	fr_time_t		last_idle;		//!< last time we had nothing to do
 
+	uint64_t		num_sent;		//!< Requests sent on this socket, not counting retransmissions.
+	uint64_t		num_replies;		//!< Replies received on this socket.
+	uint64_t		num_lost;		//!< Requests which got no reply on this socket.
+
+	uint32_t		window_done;		//!< Requests completed in the current loss window.
+	uint32_t		window_lost;		//!< Requests lost in the current loss window.
+
 	fr_event_timer_t const	*zombie_ev;		//!< Zombie timeout.
 
 	bool			status_checking;       	//!< whether we're doing status checks
@@ -162,6 +195,58 @@ struct udp_request_s {
 	fr_retry_t		retry;			//!< retransmission timers
 };
 
+/** Replicated packets waiting to be sent in one sendmmsg call
+ *
+ * There's one of these per thread, and per source address.  It's
+ * shared by every module which has "batch_replicas" set.  Each packet
+ * is copied in, so nothing here refers back to the requests or the
+ * connections which queued it.
+ */
+typedef struct udp_replica_batch_s {
+	fr_dlist_t		entry;			//!< Entry in the thread's list of batches.
+	fr_event_list_t		*el;			//!< Event list the batch is flushed from.
+
+	fr_ipaddr_t		src_ipaddr;		//!< Address the socket is bound to.
+	char const		*interface;		//!< Interface the socket is bound to.
+	int			fd;			//!< Unconnected socket, so each message can
+							///< have its own destination.
+
+	uint16_t		count;			//!< Messages queued.
+	size_t			used;			//!< Bytes of buffer used.
+
+	struct mmsghdr		mmsgvec[UDP_REPLICA_BATCH_MAX];
+	struct iovec		iov[UDP_REPLICA_BATCH_MAX];
+	struct sockaddr_storage	dst[UDP_REPLICA_BATCH_MAX];
+	uint8_t			buffer[UDP_REPLICA_BATCH_SIZE];
+
+	unsigned int		refs;			//!< How many module thread instances are using it.
+} udp_replica_batch_t;
+
+/** The attributes of a request, as encoded by the first replicating module
+ *
+ * Later replicating modules copy this, instead of encoding the
+ * attributes again.
+ */
+typedef struct {
+	uint8_t			code;			//!< Packet code.
+	char const		*secret;		//!< The attributes were encoded using this secret.
+	size_t			num_pairs;		//!< How many request attributes there were.
+	uint8_t			*packet;		//!< Packet without Proxy-State or Message-Authenticator.
+	size_t			packet_len;		//!< Length of the packet.
+} udp_replica_cache_t;
+
+static _Thread_local fr_dlist_head_t *udp_replica_batches;
+
+/** How many requests are completed on a connection before we check its loss rate
+ *
+ */
+#define UDP_LOSS_WINDOW		(100)
+
+/** Maximum value of udp_thread_t->backoff
+ *
+ */
+#define UDP_MAX_BACKOFF		(16)
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_radius_udp_t, dst_ipaddr), },
 	{ FR_CONF_OFFSET("ipv4addr", FR_TYPE_IPV4_ADDR, rlm_radius_udp_t, dst_ipaddr) },
@@ -179,6 +264,12 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, rlm_radius_udp_t, max_packet_size), .dflt = "4096" },
 	{ FR_CONF_OFFSET("max_send_coalesce", FR_TYPE_UINT16, rlm_radius_udp_t, max_send_coalesce), .dflt = "1024" },
 
+	{ FR_CONF_OFFSET("max_loss", FR_TYPE_UINT32, rlm_radius_udp_t, max_loss), .dflt = "0" },
+
+	{ FR_CONF_OFFSET("batch_replicas", FR_TYPE_BOOL, rlm_radius_udp_t, batch_replicas), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("pass_through", FR_TYPE_BOOL, rlm_radius_udp_t, pass_through), .dflt = "no" },
+
 	{ FR_CONF_OFFSET("src_ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_radius_udp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET("src_ipv4addr", FR_TYPE_IPV4_ADDR, rlm_radius_udp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET("src_ipv6addr", FR_TYPE_IPV6_ADDR, rlm_radius_udp_t, src_ipaddr) },
@@ -893,6 +984,9 @@ static void conn_close(UNUSED fr_event_list_t *el, void *handle, UNUSED void *uc
 		fr_assert_fail("%u tracking entries still allocated at conn close", h->tt->num_requests);
 	}
 
+	DEBUG2("%s - Connection %s sent %" PRIu64 " requests, received %" PRIu64 " replies, %" PRIu64 " lost",
+	       h->module_name, h->name, h->num_sent, h->num_replies, h->num_lost);
+
 	DEBUG4("Freeing rlm_radius_udp handle %p", handle);
 
 	talloc_free(h);
@@ -1204,8 +1298,9 @@ static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *res
 	original[3] = RADIUS_HEADER_LENGTH;	/* for debugging */
 	memcpy(original + RADIUS_AUTH_VECTOR_OFFSET, request_authenticator, RADIUS_AUTH_VECTOR_LENGTH);
 
-	if (fr_radius_verify(data, original,
-			     (uint8_t const *) inst->secret, talloc_array_length(inst->secret) - 1) < 0) {
+	if (fr_radius_verify_hmac(data, original,
+				  (uint8_t const *) inst->secret, talloc_array_length(inst->secret) - 1,
+				  inst->secret_hmac) < 0) {
 		RPWDEBUG("Ignoring response with invalid signature");
 		return DECODE_FAIL_MA_INVALID;
 	}
@@ -1268,12 +1363,184 @@ static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *res
 	return DECODE_FAIL_NONE;
 }
 
+/** Copy the attributes encoded by another replicating module
+ *
+ * The copy can only be used if the other module encoded the same
+ * packet type with the same secret, and the request attributes haven't
+ * been added to or removed from since.  Editing an attribute in place
+ * between two replicating modules isn't noticed, so they should be
+ * listed one after the other.
+ *
+ * @return
+ *	- >0 the length of the copied packet.
+ *	- 0 if there's nothing usable to copy.
+ */
+static ssize_t replica_cache_copy(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u,
+				  uint8_t id, size_t outlen)
+{
+	udp_replica_cache_t	*cache;
+
+	cache = request_data_reference(request, &rlm_radius_udp, 0);
+	if (!cache) return 0;
+
+	if ((cache->code != u->code) ||
+	    (cache->num_pairs != fr_pair_list_len(&request->request_pairs)) ||
+	    (cache->packet_len > outlen) ||
+	    (strcmp(cache->secret, inst->secret) != 0)) return 0;
+
+	memcpy(u->packet, cache->packet, cache->packet_len);
+	u->packet[1] = id;
+
+	RDEBUG3("Using attributes encoded by a previous replicating module");
+
+	return cache->packet_len;
+}
+
+/** Save the encoded attributes, so that other replicating modules can copy them
+ *
+ * Access-Request packets aren't saved, as their attributes are
+ * encrypted using a random authenticator, which would then be the same
+ * for every replica.
+ */
+static void replica_cache_save(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, size_t packet_len)
+{
+	udp_replica_cache_t	*cache;
+
+	if (u->code == FR_RADIUS_CODE_ACCESS_REQUEST) return;
+
+	MEM(cache = talloc(request, udp_replica_cache_t));
+	*cache = (udp_replica_cache_t){
+		.code = u->code,
+		.secret = inst->secret,
+		.num_pairs = fr_pair_list_len(&request->request_pairs),
+		.packet_len = packet_len
+	};
+	MEM(cache->packet = talloc_memdup(cache, u->packet, packet_len));
+
+	if (request_data_add(request, &rlm_radius_udp, 0, cache, true, false, false) < 0) talloc_free(cache);
+}
+
+/** Check whether a pair list contains attributes which are encrypted using the shared secret
+ *
+ */
+static bool pair_list_has_encrypted(fr_pair_list_t const *list)
+{
+	fr_pair_t	*vp = NULL;
+
+	while ((vp = fr_pair_list_next(list, vp))) {
+		if (flag_encrypted(&vp->da->flags)) return true;
+	}
+
+	return false;
+}
+
+/** Copy the attributes of the original packet, if the request hasn't been changed
+ *
+ * Message-Authenticator isn't copied, as encode() adds a new one.
+ * Everything else, including any Proxy-State from upstream, is copied
+ * as-is.
+ *
+ * Attributes encrypted with the client's secret can only be copied if
+ * the home server uses the same secret.  For Access-Request packets,
+ * the original Request Authenticator is then used, too.
+ *
+ * @return
+ *	- >0 the length of the copied packet.
+ *	- 0 if the packet has to be encoded.
+ */
+static ssize_t pass_through_copy(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u,
+				 uint8_t id, size_t outlen)
+{
+	uint8_t const	*attr, *end;
+	uint8_t		*p;
+	size_t		packet_len;
+
+	if (!request->packet->data || (request->packet->data_len < RADIUS_HEADER_LENGTH) ||
+	    (request->packet->data[0] != u->code) || fr_pair_list_is_dirty(&request->request_pairs)) return 0;
+
+	packet_len = (request->packet->data[2] << 8) | request->packet->data[3];
+	if ((packet_len < RADIUS_HEADER_LENGTH) || (packet_len > request->packet->data_len) ||
+	    (packet_len > outlen)) return 0;
+
+	if (pair_list_has_encrypted(&request->request_pairs)) {
+		if (!request->client || (strcmp(request->client->secret, inst->secret) != 0)) return 0;
+
+		if (u->code == FR_RADIUS_CODE_ACCESS_REQUEST) {
+			memcpy(u->packet + RADIUS_AUTH_VECTOR_OFFSET, request->packet->vector, RADIUS_AUTH_VECTOR_LENGTH);
+		}
+	}
+
+	u->packet[0] = u->code;
+	u->packet[1] = id;
+
+	p = u->packet + RADIUS_HEADER_LENGTH;
+	end = request->packet->data + packet_len;
+	for (attr = request->packet->data + RADIUS_HEADER_LENGTH; attr < end; attr += attr[1]) {
+		if (attr[0] == attr_message_authenticator->attr) continue;
+
+		memcpy(p, attr, attr[1]);
+		p += attr[1];
+	}
+
+	RDEBUG3("Request attributes are unchanged, copying them instead of encoding the packet");
+
+	return p - u->packet;
+}
+
+/** Save the attributes of a reply, so that proto_radius can copy them
+ *
+ * Proxy-State is removed, as it is from the decoded reply.
+ * Message-Authenticator is zeroed, and recalculated when our reply
+ * is signed.
+ *
+ * Attributes encrypted with the home server's secret can only be
+ * copied if the client uses the same secret, and we sent the client's
+ * Request Authenticator.
+ */
+static void pass_through_save(rlm_radius_udp_t const *inst, request_t *request,
+			      uint8_t const request_authenticator[static RADIUS_AUTH_VECTOR_LENGTH], uint8_t const *data)
+{
+	uint8_t const	*attr, *end;
+	uint8_t		*p, *out;
+	size_t		packet_len = (data[2] << 8) | data[3];
+
+	TALLOC_FREE(request->reply->data);
+	request->reply->data_len = 0;
+
+	if (pair_list_has_encrypted(&request->reply_pairs) &&
+	    (!request->client || (strcmp(request->client->secret, inst->secret) != 0) ||
+	     (memcmp(request_authenticator, request->packet->vector, RADIUS_AUTH_VECTOR_LENGTH) != 0))) return;
+
+	MEM(out = talloc_array(request->reply, uint8_t, packet_len));
+	memcpy(out, data, RADIUS_HEADER_LENGTH);
+
+	p = out + RADIUS_HEADER_LENGTH;
+	end = data + packet_len;
+	for (attr = data + RADIUS_HEADER_LENGTH; attr < end; attr += attr[1]) {
+		if (attr[0] == attr_proxy_state->attr) continue;
+
+		memcpy(p, attr, attr[1]);
+		if (attr[0] == attr_message_authenticator->attr) memset(p + 2, 0, attr[1] - 2);
+		p += attr[1];
+	}
+
+	packet_len = p - out;
+	out[2] = (packet_len >> 8) & 0xff;
+	out[3] = packet_len & 0xff;
+
+	request->reply->data = out;
+	request->reply->data_len = packet_len;
+
+	fr_pair_list_mark_clean(&request->reply_pairs);
+}
+
 static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id)
 {
 	ssize_t			packet_len;
 	uint8_t			*msg = NULL;
 	int			message_authenticator = u->require_ma * (RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2);
 	int			proxy_state = 6;
+	bool			cached = false;
 
 	fr_assert(inst->parent->allowed[u->code]);
 	fr_assert(!u->packet);
@@ -1352,10 +1619,23 @@ static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_
 	/*
 	 *	Encode it, leaving room for Proxy-State and
 	 *	Message-Authenticator if necessary.
-	 */
-	packet_len = fr_radius_encode(u->packet, u->packet_len - (proxy_state + message_authenticator), NULL,
-				      inst->secret, talloc_array_length(inst->secret) - 1,
-				      u->code, id, &request->request_pairs);
+	 *
+	 *	If the request hasn't been changed, or another
+	 *	replicating module has already encoded it, just copy
+	 *	the attributes.
+	 */
+	packet_len = 0;
+	if (inst->pass_through && proxy_state) {
+		packet_len = pass_through_copy(inst, request, u, id, u->packet_len - (proxy_state + message_authenticator));
+		cached = (packet_len > 0);
+	}
+	if (!packet_len && inst->batch_replicas) {
+		packet_len = replica_cache_copy(inst, request, u, id, u->packet_len - (proxy_state + message_authenticator));
+		cached = (packet_len > 0);
+	}
+	if (!packet_len) packet_len = fr_radius_encode(u->packet, u->packet_len - (proxy_state + message_authenticator), NULL,
+						       inst->secret, talloc_array_length(inst->secret) - 1,
+						       u->code, id, &request->request_pairs);
 	if (fr_pair_encode_is_error(packet_len)) {
 		RPERROR("Failed encoding packet");
 
@@ -1386,6 +1666,8 @@ static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_
 	 */
 	fr_assert((size_t) (packet_len + proxy_state + message_authenticator) <= u->packet_len);
 
+	if (inst->batch_replicas && !cached) replica_cache_save(inst, request, u, packet_len);
+
 	/*
 	 *	Add Proxy-State to the tail end of the packet.
 	 *
@@ -1514,8 +1796,8 @@ static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_
 		/*
 		 *	Now that we're done mangling the packet, sign it.
 		 */
-		if (fr_radius_sign(u->packet, NULL, (uint8_t const *) inst->secret,
-				   talloc_array_length(inst->secret) - 1) < 0) {
+		if (fr_radius_sign_hmac(u->packet, NULL, (uint8_t const *) inst->secret,
+					talloc_array_length(inst->secret) - 1, inst->secret_hmac) < 0) {
 			RERROR("Failed signing packet");
 			goto error;
 		}
@@ -1620,6 +1902,12 @@ static bool check_for_zombie(fr_event_list_t *el, fr_trunk_connection_t *tconn,
 		       "there have been no replies on connection %s", h->module_name, h->name);
 	}
 
+	/*
+	 *	Make "load-balance" sections avoid this home
+	 *	server, more so each time it goes bad.
+	 */
+	if (h->thread->backoff < UDP_MAX_BACKOFF) h->thread->backoff++;
+
 	/*
 	 *	No status checks: this connection is dead.
 	 *
@@ -1671,6 +1959,57 @@ static bool check_for_zombie(fr_event_list_t *el, fr_trunk_connection_t *tconn,
 	return true;
 }
 
+/** Update the smoothed round trip time with a new sample
+ *
+ * As with TCP's SRTT, new samples get a weight of 1/8.
+ */
+static inline CC_HINT(always_inline) void rtt_update(udp_thread_t *t, fr_time_delta_t sample)
+{
+	if (!t->rtt) {
+		t->rtt = sample;
+		return;
+	}
+
+	t->rtt += (sample - t->rtt) / 8;
+}
+
+/** Record the outcome of a request, and reconnect if this socket is losing too many packets
+ *
+ * Partial loss is tracked per socket, as a bad path through a NAT or
+ * an ECMP hash is specific to the source port, and reconnecting gets
+ * us a new source port.  A home server which has stopped replying
+ * altogether is handled by check_for_zombie() instead.
+ *
+ * @return
+ *	- true if the connection is being reconnected.
+ *	- false otherwise.
+ */
+static bool check_for_loss(fr_trunk_connection_t *tconn, udp_handle_t *h, bool lost)
+{
+	bool reconnect;
+
+	if (lost) {
+		h->num_lost++;
+		h->window_lost++;
+	} else {
+		h->num_replies++;
+	}
+
+	if (!h->inst->max_loss || (++h->window_done < UDP_LOSS_WINDOW)) return false;
+
+	reconnect = (h->window_lost < h->window_done) &&
+		    (((uint64_t)h->window_lost * 100) > ((uint64_t)h->inst->max_loss * h->window_done));
+	if (reconnect) {
+		WARN("%s - Lost %u of the last %u requests on connection %s, reconnecting",
+		     h->module_name, h->window_lost, h->window_done, h->name);
+	}
+
+	h->window_done = h->window_lost = 0;
+	if (reconnect) fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+
+	return reconnect;
+}
+
 /** Handle retries for a request_t
  *
  */
@@ -1739,7 +2078,14 @@ static void request_timeout(fr_event_list_t *el, fr_time_t now, void *uctx)
 	r->rcode = RLM_MODULE_FAIL;
 	fr_trunk_request_signal_complete(treq);
 
-	if (!u->status_check) return;
+	if (!u->status_check) {
+		/*
+		 *	A lost request took at least this long.
+		 */
+		rtt_update(h->thread, now - u->retry.start);
+		(void) check_for_loss(tconn, h, true);
+		return;
+	}
 
 	WARN("%s - No response to status check, marking connection as dead - %s", h->module_name, h->name);
 
@@ -1831,6 +2177,7 @@ static void request_mux(fr_event_list_t *el,
 				continue;
 			}
 			RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
+			if (!u->status_check) h->num_sent++;
 
 			/*
 			 *	Remember the authentication vector, which now has the
@@ -1996,6 +2343,232 @@ static void request_mux(fr_event_list_t *el,
 	for (i = sent; i < queued; i++) fr_trunk_request_requeue(h->coalesced[i].treq);
 }
 
+/** Send everything in a replica batch
+ *
+ * Replication is best-effort, so failures are logged, and the packets
+ * dropped.
+ */
+static void replica_batch_flush(udp_replica_batch_t *batch)
+{
+	uint16_t	done = 0;
+
+	while (done < batch->count) {
+		int sent;
+
+		sent = sendmmsg(batch->fd, batch->mmsgvec + done, batch->count - done, 0);
+		if (sent >= 0) {
+			done += sent;
+			continue;
+		}
+
+		switch (errno) {
+		case EINTR:
+			continue;
+
+#if defined(EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
+		case EWOULDBLOCK:
+#endif
+		case EAGAIN:
+		case ENOBUFS:
+		case ENOMEM:
+			WARN("Failed sending %u replicated packets: %s", batch->count - done, fr_syserror(errno));
+			done = batch->count;
+			break;
+
+		/*
+		 *	Errors are for the first message,
+		 *	so skip it, and send the rest.
+		 */
+		default:
+			ERROR("Failed sending replicated packet: %s", fr_syserror(errno));
+			done++;
+			break;
+		}
+	}
+
+	DEBUG3("Sent %u replicated packets with one system call", batch->count);
+
+	batch->count = 0;
+	batch->used = 0;
+}
+
+/** Flush the batch once we've finished servicing events
+ *
+ * So replicas queued by all the modules during this pass of the event
+ * loop go out together.
+ */
+static void _replica_batch_post(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	udp_replica_batch_t	*batch = talloc_get_type_abort(uctx, udp_replica_batch_t);
+
+	if (batch->count) replica_batch_flush(batch);
+}
+
+/** Read and discard anything sent to the batch socket
+ *
+ */
+static void replica_batch_discard(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, UNUSED void *uctx)
+{
+	uint8_t			buffer[4096];
+
+	while (read(fd, buffer, sizeof(buffer)) > 0);
+}
+
+static int _replica_batch_free(udp_replica_batch_t *batch)
+{
+	if (batch->count) replica_batch_flush(batch);
+
+	fr_event_post_delete(batch->el, _replica_batch_post, batch);
+
+	if (batch->fd >= 0) {
+		fr_event_fd_delete(batch->el, batch->fd, FR_EVENT_FILTER_IO);
+		close(batch->fd);
+	}
+
+	return 0;
+}
+
+/** Free any batches left on the thread's list
+ *
+ */
+static void _replica_batches_free(void *arg)
+{
+	talloc_free(arg);
+	udp_replica_batches = NULL;
+}
+
+/** Find or create the replica batch for this thread and source address
+ *
+ */
+static udp_replica_batch_t *replica_batch_get(rlm_radius_udp_t const *inst, fr_event_list_t *el)
+{
+	udp_replica_batch_t	*batch = NULL;
+	uint16_t		port = 0;
+	unsigned int		i;
+
+	if (!udp_replica_batches) {
+		fr_dlist_head_t *list;
+
+		MEM(list = talloc_zero(NULL, fr_dlist_head_t));
+		fr_dlist_talloc_init(list, udp_replica_batch_t, entry);
+		fr_atexit_thread_local(udp_replica_batches, _replica_batches_free, list);
+	}
+
+	while ((batch = fr_dlist_next(udp_replica_batches, batch))) {
+		if ((batch->el == el) &&
+		    (fr_ipaddr_cmp(&batch->src_ipaddr, &inst->src_ipaddr) == 0) &&
+		    ((batch->interface == inst->interface) ||
+		     (batch->interface && inst->interface && (strcmp(batch->interface, inst->interface) == 0)))) {
+			batch->refs++;
+			return batch;
+		}
+	}
+
+	MEM(batch = talloc_zero(udp_replica_batches, udp_replica_batch_t));
+	batch->el = el;
+	batch->src_ipaddr = inst->src_ipaddr;
+	batch->interface = inst->interface;
+	batch->fd = -1;
+	talloc_set_destructor(batch, _replica_batch_free);
+
+	for (i = 0; i < UDP_REPLICA_BATCH_MAX; i++) {
+		batch->mmsgvec[i].msg_hdr.msg_iov = &batch->iov[i];
+		batch->mmsgvec[i].msg_hdr.msg_iovlen = 1;
+		batch->mmsgvec[i].msg_hdr.msg_name = &batch->dst[i];
+	}
+
+	batch->fd = fr_socket_server_udp(&batch->src_ipaddr, &port, NULL, true);
+	if ((batch->fd < 0) || (fr_socket_bind(batch->fd, &batch->src_ipaddr, &port, batch->interface) < 0)) {
+		PERROR("Failed opening socket for replicated packets");
+	error:
+		talloc_free(batch);
+		return NULL;
+	}
+
+	if ((fr_event_fd_insert(batch, el, batch->fd, replica_batch_discard, NULL, NULL, batch) < 0) ||
+	    (fr_event_post_insert(el, _replica_batch_post, batch) < 0)) {
+		PERROR("Failed inserting events for replicated packets");
+		goto error;
+	}
+
+	batch->refs = 1;
+	fr_dlist_insert_tail(udp_replica_batches, batch);
+
+	return batch;
+}
+
+/** Copy a packet into the batch, flushing the batch first if it's full
+ *
+ */
+static void replica_batch_add(udp_replica_batch_t *batch, udp_thread_t const *t, uint8_t const *packet, size_t packet_len)
+{
+	uint8_t		*p;
+
+	if ((batch->count == UDP_REPLICA_BATCH_MAX) || ((batch->used + packet_len) > sizeof(batch->buffer))) {
+		replica_batch_flush(batch);
+	}
+
+	p = batch->buffer + batch->used;
+	memcpy(p, packet, packet_len);
+
+	batch->iov[batch->count].iov_base = p;
+	batch->iov[batch->count].iov_len = packet_len;
+	memcpy(&batch->dst[batch->count], &t->replica_dst, t->replica_dst_len);
+	batch->mmsgvec[batch->count].msg_hdr.msg_namelen = t->replica_dst_len;
+
+	batch->count++;
+	batch->used += packet_len;
+}
+
+/** Queue replicated packets on the thread's batch, instead of sending them on the connection
+ *
+ */
+static void request_mux_replicate_batch(UNUSED fr_event_list_t *el,
+					fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
+	rlm_radius_udp_t const	*inst = h->inst;
+	uint16_t		i;
+
+	for (i = 0; i < inst->max_send_coalesce; i++) {
+		fr_trunk_request_t	*treq;
+		udp_request_t		*u;
+		udp_result_t		*r;
+		request_t		*request;
+
+		if (unlikely(fr_trunk_connection_pop_request(&treq, tconn) < 0)) return;
+
+		/*
+		 *	No more requests to send
+		 */
+		if (!treq) break;
+
+		request = treq->request;
+		u = talloc_get_type_abort(treq->preq, udp_request_t);
+		r = talloc_get_type_abort(treq->rctx, udp_result_t);
+
+		if (!u->packet) {
+			u->id = h->last_id++;
+
+			if (encode(h->inst, request, u, u->id) < 0) {
+				fr_trunk_request_signal_fail(treq);
+				continue;
+			}
+		}
+
+		RDEBUG("Queueing %s ID %d length %ld for replication to %s",
+		       fr_packet_codes[u->code], u->id, u->packet_len, h->name);
+		RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
+
+		replica_batch_add(h->thread->batch, h->thread, u->packet, u->packet_len);
+
+		fr_trunk_request_signal_sent(treq);
+
+		r->rcode = RLM_MODULE_OK;
+		fr_trunk_request_signal_complete(treq);
+	}
+}
+
 static void request_mux_replicate(UNUSED fr_event_list_t *el,
 				  fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
 {
@@ -2330,6 +2903,7 @@ static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, U
 		decode_fail_t		reason;
 		uint8_t			code = 0;
 		fr_pair_list_t		reply;
+		bool			pass_through;
 
 		fr_time_t		now;
 
@@ -2389,6 +2963,15 @@ static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, U
 		 */
 		h->last_reply = now = fr_time();
 
+		/*
+		 *	Replies to retransmissions can't be matched to
+		 *	a particular send, so they don't give us an RTT.
+		 */
+		if (u->retry.count == 1) {
+			rtt_update(h->thread, now - u->retry.start);
+			if ((u != h->status_u) && h->thread->backoff) h->thread->backoff--;
+		}
+
 		/*
 		 *	Status-Server can have any reply code, we don't care
 		 *	what it is.  So long as it's signed properly, we
@@ -2403,6 +2986,13 @@ static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, U
 			continue;
 		}
 
+		/*
+		 *	Only pass through replies which are the only
+		 *	thing in the reply list.
+		 */
+		pass_through = h->inst->pass_through && (code != FR_RADIUS_CODE_PROTOCOL_ERROR) &&
+			       fr_pair_list_empty(&request->reply_pairs);
+
 		/*
 		 *	Handle any state changes, etc. needed by receiving a
 		 *	Protocol-Error reply packet.
@@ -2464,7 +3054,18 @@ static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, U
 		treq->request->reply->code = code;
 		r->rcode = radius_code_to_rcode[code];
 		fr_pair_list_append(&request->reply_pairs, &reply);
+
+		/*
+		 *	If the reply list holds nothing but this reply,
+		 *	our reply can be made by copying its attributes.
+		 */
+		if (pass_through) pass_through_save(h->inst, request, rr->vector, h->buffer);
 		fr_trunk_request_signal_complete(treq);
+
+		/*
+		 *	The handle is freed if we reconnect.
+		 */
+		if (check_for_loss(tconn, h, false)) return;
 	}
 }
 
@@ -2677,6 +3278,26 @@ static int _udp_result_free(udp_result_t *r)
 }
 #endif
 
+/** Estimate how long a new request would take on this thread's trunk
+ *
+ * This is the smoothed RTT multiplied by the number of requests
+ * already outstanding on the trunk, and then doubled for each step of
+ * back-off.  Home servers which haven't replied yet have no RTT, and
+ * so are cheap.  That makes sure they get probed.
+ */
+static uint64_t mod_cost(UNUSED void const *instance, void *thread)
+{
+	udp_thread_t	*t = talloc_get_type_abort(thread, udp_thread_t);
+	uint64_t	cost;
+
+	cost = fr_trunk_request_count_by_state(t->trunk, FR_TRUNK_CONN_ALL, FR_TRUNK_REQUEST_STATE_ALL) + 1;
+	if (t->rtt > 0) cost *= (uint64_t) t->rtt;
+
+	if (cost > (UINT64_MAX >> t->backoff)) return UINT64_MAX;
+
+	return cost << t->backoff;
+}
+
 /** Free a udp_request_t
  */
 static int _udp_request_free(udp_request_t *u)
@@ -2786,6 +3407,18 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 						.request_free = request_free
 					};
 
+	static fr_trunk_io_funcs_t	io_funcs_replicate_batch = {
+						.connection_alloc = thread_conn_alloc,
+						.connection_notify = thread_conn_notify_replicate,
+						.request_prioritise = request_prioritise,
+						.request_mux = request_mux_replicate_batch,
+						.request_conn_release = request_conn_release_replicate,
+						.request_complete = request_complete,
+						.request_fail = request_fail,
+						.request_free = request_free
+					};
+	fr_trunk_io_funcs_t const	*funcs = &io_funcs;
+
 	inst->trunk_conf = &inst->parent->trunk_conf;
 
 	inst->trunk_conf->req_pool_headers = 4;	/* One for the request, one for the buffer, one for the tracking binding, one for Proxy-State VP */
@@ -2793,13 +3426,45 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 
 	thread->el = el;
 	thread->inst = inst;
-	thread->trunk = fr_trunk_alloc(thread, el, inst->replicate ? &io_funcs_replicate : &io_funcs,
+
+	if (inst->batch_replicas) {
+		thread->batch = replica_batch_get(inst, el);
+		if (!thread->batch) return -1;
+
+		if (fr_ipaddr_to_sockaddr(&thread->replica_dst, &thread->replica_dst_len,
+					  &inst->dst_ipaddr, inst->dst_port) < 0) {
+			PERROR("%s - Invalid destination address", inst->parent->name);
+			return -1;
+		}
+		funcs = &io_funcs_replicate_batch;
+
+	} else if (inst->replicate) {
+		funcs = &io_funcs_replicate;
+	}
+
+	thread->trunk = fr_trunk_alloc(thread, el, funcs,
 				       inst->trunk_conf, inst->parent->name, thread, false);
 	if (!thread->trunk) return -1;
 
 	return 0;
 }
 
+/** Release our reference to the replica batch
+ *
+ */
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *tctx)
+{
+	udp_thread_t			*thread = talloc_get_type_abort(tctx, udp_thread_t);
+
+	if (thread->batch && (--thread->batch->refs == 0)) {
+		fr_dlist_remove(udp_replica_batches, thread->batch);
+		talloc_free(thread->batch);
+	}
+	thread->batch = NULL;
+
+	return 0;
+}
+
 /** Instantiate the module
  *
  * Instantiate I/O and type submodules.
@@ -2824,11 +3489,27 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->parent = parent;
 	inst->replicate = parent->replicate;
 
+	if (inst->batch_replicas && !inst->replicate) {
+		cf_log_warn(conf, "Ignoring 'batch_replicas', as 'replicate' is not set");
+		inst->batch_replicas = false;
+	}
+
 	/*
 	 *	Always need at least one mmsgvec
 	 */
 	if (inst->max_send_coalesce == 0) inst->max_send_coalesce = 1;
 
+	/*
+	 *	Message-Authenticator is calculated for most packets
+	 *	we send and receive, so hash the padded key once.
+	 */
+	inst->secret_hmac = fr_hmac_md5_key_alloc(inst, (uint8_t const *) inst->secret,
+						  talloc_array_length(inst->secret) - 1);
+	if (!inst->secret_hmac) {
+		cf_log_perr(conf, "Failed pre-computing HMAC key for secret");
+		return -1;
+	}
+
 	/*
 	 *	Ensure that we have a destination address.
 	 */
@@ -2870,6 +3551,8 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 64);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65535);
 
+	FR_INTEGER_BOUND_CHECK("max_loss", inst->max_loss, <=, 100);
+
 
 #ifdef __linux__
 	if (inst->replicate) {
@@ -2937,8 +3620,10 @@ rlm_radius_io_t rlm_radius_udp = {
 	.bootstrap		= mod_bootstrap,
 	.instantiate		= mod_instantiate,
 	.thread_instantiate 	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 
 	.enqueue		= mod_enqueue,
 	.signal			= mod_signal,
 	.resume			= mod_resume,
+	.cost			= mod_cost,
 };
@@ -40,16 +40,15 @@ static char const porttypes[] = "ASITX";
 /*
  *	used for caching radutmp lookups in the accounting component.
  */
-typedef struct nas_port_s NAS_PORT;
-struct nas_port_s {
+typedef struct {
+	fr_rb_node_t		node;		//!< Entry in the NAS / port index.
 	uint32_t		nasaddr;
-	uint16_t		port;
-	off_t			offset;
-	NAS_PORT 		*next;
-};
+	uint32_t		port;
+	off_t			offset;		//!< Of the record for this NAS / port in the file.
+} NAS_PORT;
 
 typedef struct {
-	NAS_PORT	*nas_port_list;
+	fr_rb_tree_t	*nas_ports;		//!< Index of NAS / port to record offset.
 	char const	*filename;
 	char const	*username;
 	bool		check_nas;
@@ -156,20 +155,52 @@ static unlang_action_t radutmp_zap(rlm_rcode_t *p_result, request_t *request, ch
 	RETURN_MODULE_OK;
 }
 
+static int8_t nas_port_cmp(void const *one, void const *two)
+{
+	NAS_PORT const *a = one, *b = two;
+	int8_t ret;
+
+	ret = CMP(a->nasaddr, b->nasaddr);
+	if (ret != 0) return ret;
+
+	return CMP(a->port, b->port);
+}
+
 /*
- *	Lookup a NAS_PORT in the nas_port_list
+ *	Lookup a NAS_PORT in the index
  */
-static NAS_PORT *nas_port_find(NAS_PORT *nas_port_list, uint32_t nasaddr, uint16_t port)
+static NAS_PORT *nas_port_find(fr_rb_tree_t *nas_ports, uint32_t nasaddr, uint32_t port)
 {
-	NAS_PORT	*cl;
+	NAS_PORT	find = { .nasaddr = nasaddr, .port = port };
 
-	for(cl = nas_port_list; cl; cl = cl->next) {
-		if (nasaddr == cl->nasaddr &&
-			port == cl->port)
-			break;
+	return fr_rb_find(nas_ports, &find);
+}
+
+/*
+ *	Remember where the record for a NAS / port is.  If we already
+ *	know, the first record in the file wins, as that's the one a
+ *	scan would find.
+ */
+static NAS_PORT *nas_port_add(fr_rb_tree_t *nas_ports, uint32_t nasaddr, uint32_t port, off_t offset)
+{
+	NAS_PORT	*cache;
+
+	cache = nas_port_find(nas_ports, nasaddr, port);
+	if (cache) return cache;
+
+	cache = talloc_zero(nas_ports, NAS_PORT);
+	if (!cache) return NULL;
+
+	cache->nasaddr = nasaddr;
+	cache->port = port;
+	cache->offset = offset;
+
+	if (!fr_rb_insert(nas_ports, cache)) {
+		talloc_free(cache);
+		return NULL;
 	}
 
-	return cl;
+	return cache;
 }
 
 
@@ -423,18 +454,42 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 	/*
 	 *	Find the entry for this NAS / portno combination.
 	 */
-	if ((cache = nas_port_find(inst->nas_port_list, ut.nas_address, ut.nas_port)) != NULL) {
+	off = 0;
+	if ((cache = nas_port_find(inst->nas_ports, ut.nas_address, ut.nas_port)) != NULL) {
 		if (lseek(fd, (off_t)cache->offset, SEEK_SET) < 0) {
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
 		}
+		off = cache->offset;
 	}
 
 	r = 0;
-	off = 0;
 	while (read(fd, &u, sizeof(u)) == sizeof(u)) {
 		off += sizeof(u);
 		if ((u.nas_address != ut.nas_address) || (u.nas_port != ut.nas_port)) {
+			/*
+			 *	Someone else rewrote the file, and the
+			 *	cached offset is wrong.  Forget it, and
+			 *	go back to scanning the whole file.
+			 */
+			if (cache) {
+				fr_rb_remove(inst->nas_ports, cache);
+				TALLOC_FREE(cache);
+
+				if (lseek(fd, (off_t)0, SEEK_SET) < 0) {
+					rcode = RLM_MODULE_FAIL;
+					goto finish;
+				}
+				off = 0;
+				continue;
+			}
+
+			/*
+			 *	Index the records we walk past, so
+			 *	that the next packet for any of these
+			 *	ports doesn't need to scan the file.
+			 */
+			(void) nas_port_add(inst->nas_ports, u.nas_address, u.nas_port, off - sizeof(u));
 			continue;
 		}
 
@@ -505,16 +560,7 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 		 *	Remember where the entry was, because it's
 		 *	easier than searching through the entire file.
 		 */
-		if (!cache) {
-			cache = talloc_zero(NULL, NAS_PORT);
-			if (cache) {
-				cache->nasaddr = ut.nas_address;
-				cache->port = ut.nas_port;
-				cache->offset = off;
-				cache->next = inst->nas_port_list;
-				inst->nas_port_list = cache;
-			}
-		}
+		if (!cache) cache = nas_port_add(inst->nas_ports, ut.nas_address, ut.nas_port, off);
 
 		ut.type = P_LOGIN;
 		if (write(fd, &ut, sizeof(u)) < 0) {
@@ -556,6 +602,16 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 	RETURN_MODULE_RCODE(rcode);
 }
 
+static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
+{
+	rlm_radutmp_t	*inst = talloc_get_type_abort(instance, rlm_radutmp_t);
+
+	inst->nas_ports = fr_rb_inline_talloc_alloc(inst, NAS_PORT, node, nas_port_cmp, NULL);
+	if (!inst->nas_ports) return -1;
+
+	return 0;
+}
+
 /* globally exported name */
 extern module_t rlm_radutmp;
 module_t rlm_radutmp = {
@@ -564,6 +620,7 @@ module_t rlm_radutmp = {
 	.type		= RLM_TYPE_THREAD_UNSAFE,
 	.inst_size	= sizeof(rlm_radutmp_t),
 	.config		= module_config,
+	.instantiate	= mod_instantiate,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting,
 	},
@@ -35,11 +35,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
-
-static CONF_PARSER module_config[] = {
-	REDIS_COMMON_CONFIG,
-	CONF_PARSER_TERMINATOR
-};
+#include <freeradius-devel/redis/tracking.h>
 
 /** rlm_redis module instance
  *
@@ -50,9 +46,31 @@ typedef struct {
 
 	char const		*name;		//!< Instance name.
 
+	uint32_t		client_cache_size;	//!< Maximum number of replies to cache locally.
+	char const		**client_cache_prefix;	//!< Only cache replies for keys with these prefixes.
+
 	fr_redis_cluster_t	*cluster;	//!< Redis cluster.
 } rlm_redis_t;
 
+/** rlm_redis thread instance
+ *
+ */
+typedef struct {
+	fr_redis_tracking_t	*tracking;	//!< Local cache of replies, invalidated by the server.
+} rlm_redis_thread_t;
+
+static const CONF_PARSER client_cache_config[] = {
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_redis_t, client_cache_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("prefix", FR_TYPE_STRING | FR_TYPE_MULTI, rlm_redis_t, client_cache_prefix) },
+	CONF_PARSER_TERMINATOR
+};
+
+static CONF_PARSER module_config[] = {
+	REDIS_COMMON_CONFIG,
+	{ FR_CONF_POINTER("client_cache", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) client_cache_config },
+	CONF_PARSER_TERMINATOR
+};
+
 /** Change the state of a connection to READONLY execute a command and switch to READWRITE
  *
  * @param[out] status_out Where to write the status from the command.
@@ -158,6 +176,10 @@ static xlat_arg_parser_t const redis_remap_xlat_args[] = {
 @verbatim
 %{redis_remap:<redis server ip>:<redis server port>}
 @endverbatim
+ *
+ * The node is added to the cluster if it's not already known.  The remap
+ * itself is performed asynchronously, so "success" means the remap was
+ * queued, not that the new map has been applied.
  *
  * @ingroup xlat_functions
  */
@@ -171,7 +193,6 @@ static xlat_action_t redis_remap_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 
 	fr_socket_t			node_addr;
 	fr_pool_t			*pool;
-	fr_redis_conn_t			*conn;
 	fr_redis_cluster_rcode_t	rcode;
 	fr_value_box_t			*vb;
 	fr_value_box_t			*in_head = fr_dlist_head(in);
@@ -187,14 +208,7 @@ static xlat_action_t redis_remap_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		return XLAT_ACTION_FAIL;
 	}
 
-	conn = fr_pool_connection_get(pool, request);
-	if (!conn) {
-		REDEBUG("No connections available for cluster node");
-		return XLAT_ACTION_FAIL;
-	}
-
-	rcode = fr_redis_cluster_remap(request, inst->cluster, conn);
-	fr_pool_connection_release(pool, request, conn);
+	rcode = fr_redis_cluster_remap(request, inst->cluster);
 
 	MEM(vb = fr_value_box_alloc_null(ctx));
 	fr_value_box_strdup(vb, vb, NULL, fr_table_str_by_value(fr_redis_cluster_rcodes_table, rcode, "<INVALID>"), false);
@@ -225,7 +239,7 @@ static xlat_action_t redis_node_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 	rlm_redis_t const			*inst = talloc_get_type_abort_const(*((void const * const *)xlat_inst),
 										    rlm_redis_t);
 
-	fr_redis_cluster_key_slot_t const	*key_slot;
+	fr_redis_cluster_key_slot_t		key_slot;
 	fr_redis_cluster_node_t const		*node;
 	fr_ipaddr_t				ipaddr;
 	uint16_t				port;
@@ -237,12 +251,12 @@ static xlat_action_t redis_node_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 
 	if (idx_vb) idx = idx_vb->vb_uint32;
 
-	key_slot = fr_redis_cluster_slot_by_key(inst->cluster, request, (uint8_t const *)key->vb_strvalue,
-						key->vb_length);
+	fr_redis_cluster_slot_by_key(&key_slot, inst->cluster, request, (uint8_t const *)key->vb_strvalue,
+				     key->vb_length);
 	if (idx == 0) {
-		node = fr_redis_cluster_master(inst->cluster, key_slot);
+		node = fr_redis_cluster_master(inst->cluster, &key_slot);
 	} else {
-		node = fr_redis_cluster_slave(inst->cluster, key_slot, idx - 1);
+		node = fr_redis_cluster_slave(inst->cluster, &key_slot, idx - 1);
 	}
 
 	if (!node) {
@@ -295,6 +309,10 @@ static ssize_t redis_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 	char const		*argv[MAX_REDIS_ARGS];
 	char			argv_buf[MAX_REDIS_COMMAND_LEN];
 
+	fr_redis_tracking_t	*tracking = NULL;
+	uint8_t			command[MAX_REDIS_COMMAND_LEN];
+	size_t			command_len = 0;
+
 	if (p[0] == '-') {
 		p++;
 		read_only = true;
@@ -419,6 +437,43 @@ static ssize_t redis_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 		key = (uint8_t const *)argv[1];
 	 	key_len = strlen((char const *)key);
 	}
+
+	/*
+	 *	Only read only commands are served from the client
+	 *	cache, as there's no other way of telling commands
+	 *	with side effects apart.
+	 */
+	if (read_only && key && inst->client_cache_size) {
+		rlm_redis_thread_t	*t = talloc_get_type_abort(module_thread_by_data(inst)->data, rlm_redis_thread_t);
+		uint8_t const		*value;
+		size_t			value_len;
+
+		for (int i = 0; i < argc; i++) {
+			size_t arg_len = strlen(argv[i]) + 1;
+
+			if ((command_len + arg_len) > sizeof(command)) {
+				command_len = 0;
+				break;
+			}
+			memcpy(command + command_len, argv[i], arg_len);
+			command_len += arg_len;
+		}
+
+		if (command_len > 0) {
+			tracking = t->tracking;
+
+			if (fr_redis_tracking_find(&value, &value_len, tracking, command, command_len)) {
+				RDEBUG2("Using cached reply for command: %s", argv[0]);
+
+				len = (value_len >= outlen) ? outlen - 1 : value_len;
+				memcpy(*out, value, len);
+				(*out)[len] = '\0';
+
+				return value_len;
+			}
+		}
+	}
+
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, request, key, key_len, read_only);
 	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
 	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, request, status, &reply)) {
@@ -449,7 +504,14 @@ static ssize_t redis_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 reply_parse:
 	switch (reply->type) {
 	case REDIS_REPLY_INTEGER:
-		ret = snprintf(*out, outlen, "%lld", reply->integer);
+	{
+		char	buffer[21];
+
+		ret = snprintf(buffer, sizeof(buffer), "%lld", reply->integer);
+		strlcpy(*out, buffer, outlen);
+		if (tracking) fr_redis_tracking_insert(tracking, key, key_len, command, command_len,
+						       (uint8_t const *)buffer, ret);
+	}
 		break;
 
 	case REDIS_REPLY_STATUS:
@@ -458,6 +520,10 @@ reply_parse:
 		memcpy(*out, reply->str, len);
 		(*out)[len] = '\0';
 		ret = reply->len;
+		if (tracking && (reply->type == REDIS_REPLY_STRING)) {
+			fr_redis_tracking_insert(tracking, key, key_len, command, command_len,
+						 (uint8_t const *)reply->str, reply->len);
+		}
 		break;
 
 	default:
@@ -511,6 +577,21 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_redis_t		*inst = instance;
+	rlm_redis_thread_t	*t = thread;
+
+	if (!inst->client_cache_size) return 0;
+
+	t->tracking = fr_redis_tracking_alloc(t, el, inst->cluster, &inst->conf, inst->name,
+					      inst->client_cache_size, inst->client_cache_prefix);
+	if (!t->tracking) return -1;
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -528,4 +609,7 @@ module_t rlm_redis = {
 	.onload		= mod_load,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_redis_thread_t),
+	.thread_inst_type	= "rlm_redis_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
 };
@@ -29,11 +29,15 @@ RCSID("$Id$")
 #include <freeradius-devel/server/cf_parse.h>
 #include <freeradius-devel/util/debug.h>
 
+#include <pthread.h>
+
 #include "base.h"
 #include "cluster.h"
 #include "redis_ippool.h"
 
-#define MAX_PIPELINED 100000
+#define DEFAULT_PIPELINE_WINDOW	100000
+#define MAX_PIPELINE_WINDOW	1000000
+#define MAX_THREADS		1024
 
 /** Pool management actions
  *
@@ -126,6 +130,10 @@ do { \
 #define EOL "\n"
 
 static char const *name;
+static unsigned int pipeline_window = DEFAULT_PIPELINE_WINDOW;	//!< Addresses/prefixes per pipeline.
+static unsigned int num_threads = 1;				//!< Connections to use in parallel.
+static bool show_progress = false;				//!< Print progress and throughput.
+
 /** Lua script for releasing a lease
  *
  * - KEYS[1] The pool name.
@@ -198,7 +206,7 @@ static char lua_remove_cmd[] =
 	"return 1" EOL;									/* 12 */
 
 static NEVER_RETURNS void usage(int ret) {
-	INFO("Usage: %s -adrsm range... [-p prefix_len]... [-x]... [-oShf] server[:port] [pool] [range id]", name);
+	INFO("Usage: %s -adrsm range... [-p prefix_len]... [-x]... [-oShfP] [-w window] [-t threads] server[:port] [pool] [range id]", name);
 	INFO("Pool management:");
 	INFO("  -a range               Add address(es)/prefix(es) to the pool.");
 	INFO("  -d range               Delete address(es)/prefix(es) in this range.");
@@ -212,6 +220,11 @@ static NEVER_RETURNS void usage(int ret) {
 	INFO("                         instance of an -adrsm argument, only.");
 	INFO("  -m range               Change the range id to the one specified for addresses");
 	INFO("                         in this range.");
+	INFO("  -w window              Number of addresses/prefixes sent in each pipeline");
+	INFO("                         (defaults to " STRINGIFY(DEFAULT_PIPELINE_WINDOW) ").");
+	INFO("  -t threads             Number of connections used in parallel to add, delete,");
+	INFO("                         release or modify addresses (defaults to 1).");
+	INFO("  -P                     Print progress and throughput while operating on ranges.");
 	INFO("  -l                     List available pools.");
 //	INFO("  -L                     List available ranges in pool [NYI]");
 //	INFO("  -i file                Import entries from ISC lease file [NYI]");
@@ -301,82 +314,236 @@ static bool ipaddr_next(fr_ipaddr_t *ipaddr, fr_ipaddr_t const *end, uint8_t pre
 	}
 }
 
-/** Add a net to the pool
+/** State shared by the threads working through a single operation
  *
- * @return the number of new addresses added.
+ * The operation's addresses are split into blocks of #pipeline_window
+ * addresses/prefixes.  Each thread takes the next block, pipelines the
+ * commands for it on its own connection, and processes the replies.
  */
-static int driver_do_lease(void *out, void *instance, ippool_tool_operation_t const *op,
-			   redis_ippool_queue_t enqueue, redis_ippool_process_t process)
+typedef struct {
+	redis_driver_conf_t		*inst;
+	ippool_tool_operation_t const	*op;
+	redis_ippool_queue_t		enqueue;
+	redis_ippool_process_t		process;
+	void				*out;		//!< Passed to process.
+
+	pthread_mutex_t			mutex;		//!< Protects the fields below, and out.
+	fr_ipaddr_t			next;		//!< First address of the next block.
+	bool				more;		//!< Whether there are any more blocks.
+	bool				failed;		//!< A thread failed, so the others should stop.
+	uint64_t			done;		//!< Addresses/prefixes processed so far.
+	fr_time_t			start;		//!< When we started the operation.
+	fr_time_t			last_report;	//!< When we last printed our progress.
+} ippool_tool_bulk_t;
+
+/** Print how many addresses/prefixes have been processed, and how quickly
+ *
+ * @note Must be called with the bulk mutex held.
+ */
+static void bulk_progress(ippool_tool_bulk_t *bulk, bool final)
 {
-	redis_driver_conf_t		*inst = talloc_get_type_abort(instance, redis_driver_conf_t);
+	fr_time_t	now = fr_time();
+	double		elapsed = (double)(now - bulk->start) / NSEC;
+
+	if (!final && ((now - bulk->last_report) < fr_time_delta_from_sec(1))) return;
+	bulk->last_report = now;
+
+	INFO("%s: %" PRIu64 " address(es)/prefix(es) processed%s in %.2fs (%.0f/s)",
+	     bulk->op->name, bulk->done, final ? "" : " so far", elapsed,
+	     (elapsed > 0) ? bulk->done / elapsed : 0);
+}
+
+/** Take the next block of addresses/prefixes from the operation
+ *
+ * @param[out] start	First address of the block.
+ * @param[out] count	Number of addresses/prefixes in the block.
+ * @param[in] bulk	operation to take the block from.
+ * @return
+ *	- true if there was a block.
+ *	- false if the operation is complete, or has failed.
+ */
+static bool bulk_block_next(fr_ipaddr_t *start, unsigned int *count, ippool_tool_bulk_t *bulk)
+{
+	unsigned int i = 0;
+
+	pthread_mutex_lock(&bulk->mutex);
+	if (!bulk->more || bulk->failed) {
+		pthread_mutex_unlock(&bulk->mutex);
+		return false;
+	}
+
+	*start = bulk->next;
+	do {
+		i++;
+		bulk->more = ipaddr_next(&bulk->next, &bulk->op->end, bulk->op->prefix);
+	} while (bulk->more && (i < pipeline_window));
+	pthread_mutex_unlock(&bulk->mutex);
+
+	*count = i;
+
+	return true;
+}
+
+/** Pipeline the commands for a block of addresses/prefixes, and process the replies
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int bulk_block_do(ippool_tool_bulk_t *bulk, fr_ipaddr_t const *start, unsigned int count)
+{
+	redis_driver_conf_t		*inst = bulk->inst;
+	ippool_tool_operation_t const	*op = bulk->op;
 
-	int				i;
-	bool				more = true;
+	unsigned int			i;
 	fr_redis_conn_t			*conn;
 
 	fr_redis_cluster_state_t	state;
 	fr_redis_rcode_t		status;
 
-	fr_ipaddr_t			ipaddr = op->start;
+	fr_ipaddr_t			ipaddr;
 	fr_redis_rcode_t		s_ret = REDIS_RCODE_SUCCESS;
 	redisReply			**replies = NULL;
+	size_t				reply_cnt = 0;
 
 	unsigned int			pipelined = 0;
 
-	while (more) {
-		fr_ipaddr_t	acked = ipaddr; 	/* Record our progress */
-		size_t		reply_cnt = 0;
+	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, NULL,
+						 op->pool, op->pool_len, false);
+	     s_ret == REDIS_RCODE_TRY_AGAIN;
+	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, NULL, status, &replies[0])) {
+		status = REDIS_RCODE_SUCCESS;
 
-		for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, NULL,
-							 op->pool, op->pool_len, false);
-		     s_ret == REDIS_RCODE_TRY_AGAIN;
-		     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, NULL, status, &replies[0])) {
-		     	more = true;	/* Reset to true, may have errored last loop */
-			status = REDIS_RCODE_SUCCESS;
+		/*
+		 *	If we got a redirect, start back at the beginning of the block.
+		 */
+		ipaddr = *start;
+		pipelined = 0;
 
-			/*
-			 *	If we got a redirect, start back at the beginning of the block.
-			 */
-			ipaddr = acked;
+		for (i = 0; i < count; i++, ipaddr_next(&ipaddr, &op->end, op->prefix)) {
+			int enqueued;
 
-			for (i = 0; (i < MAX_PIPELINED) && more; i++, more = ipaddr_next(&ipaddr, &op->end,
-											 op->prefix)) {
-				int enqueued;
+			enqueued = bulk->enqueue(inst, conn, op->pool, op->pool_len,
+						 op->range, op->range_len, &ipaddr, op->prefix);
+			if (enqueued < 0) break;
+			pipelined += enqueued;
+		}
 
-				enqueued = enqueue(inst, conn, op->pool, op->pool_len,
-						   op->range, op->range_len, &ipaddr, op->prefix);
-				if (enqueued < 0) break;
-				pipelined += enqueued;
-			}
+		/*
+		 *	Allocated in the NULL ctx, as the other
+		 *	threads may be allocating in inst.
+		 */
+		if (!replies) replies = talloc_zero_array(NULL, redisReply *, pipelined);
+		if (!replies) return -1;
 
-			if (!replies) replies = talloc_zero_array(inst, redisReply *, pipelined);
-			if (!replies) return -1;
+		reply_cnt = fr_redis_pipeline_result(&pipelined, &status, replies,
+						     talloc_array_length(replies), conn);
+		for (i = 0; (size_t)i < reply_cnt; i++) fr_redis_reply_print(L_DBG_LVL_3,
+									     replies[i], NULL, i);
+	}
+	if (s_ret != REDIS_RCODE_SUCCESS) {
+		fr_redis_pipeline_free(replies, reply_cnt);
+		talloc_free(replies);
+		return -1;
+	}
 
-			reply_cnt = fr_redis_pipeline_result(&pipelined, &status, replies,
-							     talloc_array_length(replies), conn);
-			for (i = 0; (size_t)i < reply_cnt; i++) fr_redis_reply_print(L_DBG_LVL_3,
-										     replies[i], NULL, i);
-		}
-		if (s_ret != REDIS_RCODE_SUCCESS) {
-			fr_redis_pipeline_free(replies, reply_cnt);
-			talloc_free(replies);
-			return -1;
+	pthread_mutex_lock(&bulk->mutex);
+	if (bulk->process) {
+		fr_ipaddr_t to_process = *start;
+
+		for (i = 0; (size_t)i < reply_cnt; i++) {
+			int ret;
+
+			ret = bulk->process(bulk->out, &to_process, replies[i]);
+			if (ret < 0) continue;
+			ipaddr_next(&to_process, &op->end, op->prefix);
 		}
+	}
+	bulk->done += count;
+	if (show_progress) bulk_progress(bulk, false);
+	pthread_mutex_unlock(&bulk->mutex);
+
+	fr_redis_pipeline_free(replies, reply_cnt);
+	talloc_free(replies);
 
-		if (process) {
-			fr_ipaddr_t to_process = acked;
+	return 0;
+}
+
+static void *bulk_thread(void *arg)
+{
+	ippool_tool_bulk_t	*bulk = arg;
+	fr_ipaddr_t		start;
+	unsigned int		count;
+
+	while (bulk_block_next(&start, &count, bulk)) {
+		if (bulk_block_do(bulk, &start, count) < 0) {
+			pthread_mutex_lock(&bulk->mutex);
+			bulk->failed = true;
+			pthread_mutex_unlock(&bulk->mutex);
+			break;
+		}
+	}
 
-			for (i = 0; (size_t)i < reply_cnt; i++) {
-				int ret;
+	return NULL;
+}
 
-				ret = process(out, &to_process, replies[i]);
-				if (ret < 0) continue;
-				ipaddr_next(&to_process, &op->end, op->prefix);
+/** Perform an operation on a range of addresses/prefixes
+ *
+ * @param[out] out	Passed to process.
+ * @param[in] instance	of the driver.
+ * @param[in] op	to perform.
+ * @param[in] enqueue	function to pipeline the commands for one address/prefix.
+ * @param[in] process	function to process each reply.
+ * @param[in] ordered	whether process must be called in address order.  If true,
+ *			only one thread is used.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int driver_do_lease(void *out, void *instance, ippool_tool_operation_t const *op,
+			   redis_ippool_queue_t enqueue, redis_ippool_process_t process, bool ordered)
+{
+	ippool_tool_bulk_t	bulk = {
+					.inst = talloc_get_type_abort(instance, redis_driver_conf_t),
+					.op = op,
+					.enqueue = enqueue,
+					.process = process,
+					.out = out,
+					.next = op->start,
+					.more = true
+				};
+	unsigned int		threads = ordered ? 1 : num_threads;
+	pthread_t		*tids;
+	unsigned int		i, started = 0;
+
+	pthread_mutex_init(&bulk.mutex, NULL);
+	bulk.start = bulk.last_report = fr_time();
+
+	if (threads == 1) {
+		bulk_thread(&bulk);
+	} else {
+		MEM(tids = talloc_array(NULL, pthread_t, threads));
+		for (i = 0; i < threads; i++) {
+			int ret;
+
+			ret = pthread_create(&tids[i], NULL, bulk_thread, &bulk);
+			if (ret != 0) {
+				ERROR("Failed creating thread: %s", fr_syserror(ret));
+				pthread_mutex_lock(&bulk.mutex);
+				bulk.failed = true;
+				pthread_mutex_unlock(&bulk.mutex);
+				break;
 			}
+			started++;
 		}
-		fr_redis_pipeline_free(replies, reply_cnt);
-		TALLOC_FREE(replies);
+		for (i = 0; i < started; i++) pthread_join(tids[i], NULL);
+		talloc_free(tids);
 	}
+	pthread_mutex_destroy(&bulk.mutex);
+
+	if (bulk.failed) return -1;
+
+	if (show_progress) bulk_progress(&bulk, true);
 
 	return 0;
 }
@@ -463,7 +630,7 @@ static int _driver_show_lease_enqueue(UNUSED redis_driver_conf_t *inst, fr_redis
  */
 static inline int driver_show_lease(void *out, void *instance, ippool_tool_operation_t const *op)
 {
-	return driver_do_lease(out, instance, op, _driver_show_lease_enqueue, _driver_show_lease_process);
+	return driver_do_lease(out, instance, op, _driver_show_lease_enqueue, _driver_show_lease_process, true);
 }
 
 /** Count the number of leases we released
@@ -508,7 +675,7 @@ static int _driver_release_lease_enqueue(UNUSED redis_driver_conf_t *inst, fr_re
 static inline int driver_release_lease(void *out, void *instance, ippool_tool_operation_t const *op)
 {
 	return driver_do_lease(out, instance, op,
-			       _driver_release_lease_enqueue, _driver_release_lease_process);
+			       _driver_release_lease_enqueue, _driver_release_lease_process, false);
 }
 
 /** Count the number of leases we removed
@@ -557,7 +724,7 @@ static int _driver_remove_lease_enqueue(UNUSED redis_driver_conf_t *inst, fr_red
 static int driver_remove_lease(void *out, void *instance, ippool_tool_operation_t const *op)
 {
 	return driver_do_lease(out, instance, op,
-			       _driver_remove_lease_enqueue, _driver_remove_lease_process);
+			       _driver_remove_lease_enqueue, _driver_remove_lease_process, false);
 }
 
 /** Count the number of leases we actually added
@@ -628,7 +795,7 @@ static int _driver_add_lease_enqueue(UNUSED redis_driver_conf_t *inst, fr_redis_
  */
 static int driver_add_lease(void *out, void *instance, ippool_tool_operation_t const *op)
 {
-	return driver_do_lease(out, instance, op, _driver_add_lease_enqueue, _driver_add_lease_process);
+	return driver_do_lease(out, instance, op, _driver_add_lease_enqueue, _driver_add_lease_process, false);
 }
 
 /** Count the number of leases we modified
@@ -685,7 +852,7 @@ static int _driver_modify_lease_enqueue(UNUSED redis_driver_conf_t *inst, fr_red
 static int driver_modify_lease(void *out, void *instance, ippool_tool_operation_t const *op)
 {
 	return driver_do_lease(out, instance, op,
-			       _driver_modify_lease_enqueue, _driver_modify_lease_process);
+			       _driver_modify_lease_enqueue, _driver_modify_lease_process, false);
 }
 
 /** Compare two pool names
@@ -1230,7 +1397,7 @@ do { \
 	need_pool = true; \
 } while (0);
 
-	while ((c = getopt(argc, argv, "a:d:r:s:Sm:p:ilLhxo:f:")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "a:d:r:s:Sm:p:ilLhxo:f:w:t:P")) != -1) switch (c) {
 		case 'a':
 			ADD_ACTION(IPPOOL_TOOL_ADD);
 			break;
@@ -1271,6 +1438,38 @@ do { \
 		}
 			break;
 
+		case 'w':
+		{
+			unsigned long tmp;
+			char *q;
+
+			tmp = strtoul(optarg, &q, 10);
+			if ((q != (optarg + strlen(optarg))) || (tmp == 0) || (tmp > MAX_PIPELINE_WINDOW)) {
+				ERROR("Window must be an integer value between 1 and " STRINGIFY(MAX_PIPELINE_WINDOW));
+				usage(64);
+			}
+			pipeline_window = (unsigned int)tmp;
+		}
+			break;
+
+		case 't':
+		{
+			unsigned long tmp;
+			char *q;
+
+			tmp = strtoul(optarg, &q, 10);
+			if ((q != (optarg + strlen(optarg))) || (tmp == 0) || (tmp > MAX_THREADS)) {
+				ERROR("Threads must be an integer value between 1 and " STRINGIFY(MAX_THREADS));
+				usage(64);
+			}
+			num_threads = (unsigned int)tmp;
+		}
+			break;
+
+		case 'P':
+			show_progress = true;
+			break;
+
 		case 'i':
 			do_import = optarg;
 			break;
@@ -1385,6 +1584,17 @@ do { \
 	if (!cp) {
 		(void) cf_pair_alloc(pool_cs, "min", "0", T_OP_EQ, T_BARE_WORD, T_BARE_WORD);
 	}
+	cp = cf_pair_find(pool_cs, "max");
+	if (!cp && (num_threads > 1)) {
+		char buff[20];
+
+		/*
+		 *	Every thread needs its own connection
+		 *	to the master for the pool.
+		 */
+		snprintf(buff, sizeof(buff), "%u", num_threads);
+		(void) cf_pair_alloc(pool_cs, "max", buff, T_OP_EQ, T_BARE_WORD, T_BARE_WORD);
+	}
 
 	if (driver_init(conf, conf->cs, &conf->driver) < 0) {
 		ERROR("Driver initialisation failed");
@@ -1745,6 +1745,16 @@ int rest_request_config(rlm_rest_t const *inst, rlm_rest_thread_t *t, rlm_rest_s
 	 */
 	if (inst->http_negotiation != CURL_HTTP_VERSION_NONE) FR_CURL_SET_OPTION(CURLOPT_HTTP_VERSION, inst->http_negotiation);
 
+#ifdef CURLPIPE_MULTIPLEX
+	/*
+	 *	Wait for an existing connection to tell us whether
+	 *	it can multiplex, rather than opening (and doing a
+	 *	TLS handshake on) a new connection for every request
+	 *	which arrives before the first response.
+	 */
+	if (inst->multiplex) FR_CURL_SET_OPTION(CURLOPT_PIPEWAIT, 1L);
+#endif
+
 	/*
 	 *	Setup any header options and generic headers.
 	 */
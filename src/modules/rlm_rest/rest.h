@@ -151,6 +151,8 @@ typedef struct {
 
 	bool			multiplex;	//!< Whether to perform multiple requests using a single
 						///< connection.
+	uint32_t		max_streams;	//!< Maximum number of simultaneous requests to run over
+						///< a single multiplexed connection.
 
 	fr_pool_t		*pool;		//!< Pointer to the connection pool.
 
@@ -169,11 +171,15 @@ typedef struct {
 /** Thread specific rlm_rest instance data
  *
  */
+typedef struct rest_shared_mhandle_s rest_shared_mhandle_t;
+
 typedef struct {
 	rlm_rest_t const	*inst;		//!< Instance of rlm_rest.
 	fr_pool_t		*pool;		//!< Thread specific connection pool.
 	fr_curl_handle_t	*mhandle;	//!< Thread specific multi handle.  Serves as the dispatch
 						//!< and coralling structure for REST requests.
+	rest_shared_mhandle_t	*shared;	//!< Reference to the multi handle, which is shared with
+						//!< other rlm_rest instances on this thread.
 } rlm_rest_thread_t;
 
 /** Wrapper around the module thread stuct for individual xlats
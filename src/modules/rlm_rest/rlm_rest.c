@@ -114,6 +114,7 @@ static const CONF_PARSER module_config[] = {
 
 #ifdef CURLPIPE_MULTIPLEX
 	{ FR_CONF_OFFSET("multiplex", FR_TYPE_BOOL, rlm_rest_t, multiplex), .dflt = "yes" },
+	{ FR_CONF_OFFSET("max_streams", FR_TYPE_UINT32, rlm_rest_t, max_streams), .dflt = "100" },
 #endif
 
 #ifndef NDEBUG
@@ -1075,6 +1076,29 @@ static int mod_xlat_thread_instantiate(UNUSED void *xlat_inst, void *xlat_thread
 	return 0;
 }
 
+/** A multi handle shared between rlm_rest instances running on the same thread
+ *
+ */
+struct rest_shared_mhandle_s {
+	fr_dlist_t		entry;		//!< Entry in the thread's list of shared multi handles.
+	fr_event_list_t		*el;		//!< Event list the multi handle is bound to.
+	bool			multiplex;	//!< Whether the multi handle multiplexes requests.
+	uint32_t		max_streams;	//!< Stream limit the multi handle was created with.
+	fr_curl_handle_t	*mhandle;	//!< The multi handle.
+	unsigned int		refs;		//!< How many module thread instances are using it.
+};
+
+static _Thread_local fr_dlist_head_t *rest_shared_mhandles;
+
+/** Free any multi handles left on the thread's list
+ *
+ */
+static void _rest_shared_mhandles_free(void *arg)
+{
+	talloc_free(arg);
+	rest_shared_mhandles = NULL;
+}
+
 /** Create a thread specific multihandle
  *
  * Easy handles representing requests are added to the curl multihandle
@@ -1093,6 +1117,7 @@ static int mod_thread_instantiate(CONF_SECTION const *conf, void *instance, fr_e
 	rlm_rest_t		*inst = instance;
 	rlm_rest_thread_t	*t = thread;
 	fr_curl_handle_t	*mhandle;
+	rest_shared_mhandle_t	*shared = NULL;
 	CONF_SECTION		*my_conf;
 
 	t->inst = instance;
@@ -1115,10 +1140,48 @@ static int mod_thread_instantiate(CONF_SECTION const *conf, void *instance, fr_e
 		return -1;
 	}
 
-	mhandle = fr_curl_io_init(t, el, inst->multiplex);
-	if (!mhandle) return -1;
+	/*
+	 *	libcurl keeps its connection cache in the multi
+	 *	handle, so instances sharing one can reuse each
+	 *	other's connections (and TLS sessions) to the same
+	 *	host.  The cache only matches connections with the
+	 *	same TLS and proxy settings, so this is safe
+	 *	regardless of how the instances are configured.
+	 */
+	if (!rest_shared_mhandles) {
+		fr_dlist_head_t *list;
 
-	t->mhandle = mhandle;
+		MEM(list = talloc_zero(NULL, fr_dlist_head_t));
+		fr_dlist_talloc_init(list, rest_shared_mhandle_t, entry);
+		fr_atexit_thread_local(rest_shared_mhandles, _rest_shared_mhandles_free, list);
+	}
+
+	while ((shared = fr_dlist_next(rest_shared_mhandles, shared))) {
+		if ((shared->el == el) &&
+		    (shared->multiplex == inst->multiplex) &&
+		    (shared->max_streams == inst->max_streams)) break;
+	}
+
+	if (!shared) {
+		MEM(shared = talloc_zero(rest_shared_mhandles, rest_shared_mhandle_t));
+		shared->el = el;
+		shared->multiplex = inst->multiplex;
+		shared->max_streams = inst->max_streams;
+
+		mhandle = fr_curl_io_init(shared, el, inst->multiplex, inst->max_streams);
+		if (!mhandle) {
+			talloc_free(shared);
+			return -1;
+		}
+		shared->mhandle = mhandle;
+		fr_dlist_insert_tail(rest_shared_mhandles, shared);
+	} else {
+		DEBUG3("multi-handle %p - Sharing with %u other instance(s)", shared->mhandle->mandle, shared->refs);
+	}
+
+	shared->refs++;
+	t->shared = shared;
+	t->mhandle = shared->mhandle;
 
 	return 0;
 }
@@ -1135,8 +1198,25 @@ static int mod_thread_instantiate(CONF_SECTION const *conf, void *instance, fr_e
 static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 {
 	rlm_rest_thread_t	*t = thread;
+	rest_shared_mhandle_t	*shared = t->shared;
+
+	if (t->mhandle) {
+		DEBUG2("multi-handle %p - %" PRIu64 " connection(s) opened, %" PRIu64 " transfer(s) reused a connection, "
+		       "%" PRIu64 " of %" PRIu64 " HTTP/2 stream(s) multiplexed onto an existing connection",
+		       t->mhandle->mandle, t->mhandle->conn_opened, t->mhandle->conn_reused,
+		       t->mhandle->streams_reused, t->mhandle->streams);
+	}
 
-	talloc_free(t->mhandle);	/* Ensure this is shutdown before the pool */
+	/*
+	 *	Ensure the multi handle is shutdown before
+	 *	the pool if we're the last user of it.
+	 */
+	if (shared && (--shared->refs == 0)) {
+		fr_dlist_remove(rest_shared_mhandles, shared);
+		talloc_free(shared);
+	}
+	t->mhandle = NULL;
+	t->shared = NULL;
 	fr_pool_free(t->pool);
 
 	return 0;
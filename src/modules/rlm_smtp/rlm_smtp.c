@@ -1024,7 +1024,7 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instanc
 
 	t->inst = instance;
 
-	mhandle = fr_curl_io_init(t, el, false);
+	mhandle = fr_curl_io_init(t, el, false, 0);
 	if (!mhandle) return -1;
 
 	t->mhandle = mhandle;
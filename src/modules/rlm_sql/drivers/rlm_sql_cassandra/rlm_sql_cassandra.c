@@ -132,6 +132,10 @@ typedef struct {
 
 	bool			token_aware_routing;		//!< Whether to use token aware routing.
 
+	uint32_t		async_writes_max;		//!< Maximum number of writes we submit without
+								//!< waiting for the result.  0 disables.
+	atomic_uint_fast32_t	async_writes;			//!< Number of writes currently in flight.
+
 	char const		*lbdc_local_dc;			//!< The primary data center to try first.
 	uint32_t		lbdc_hosts_per_remote_dc;	//!< The number of host used in each remote DC if
 								//!< no hosts are available in the local dc
@@ -266,6 +270,7 @@ static const CONF_PARSER driver_config[] = {
 	{ FR_CONF_OFFSET("load_balance_round_robin", FR_TYPE_BOOL, rlm_sql_cassandra_t, load_balance_round_robin), .dflt = "no" },
 
 	{ FR_CONF_OFFSET("token_aware_routing", FR_TYPE_BOOL, rlm_sql_cassandra_t, token_aware_routing), .dflt = "yes" },
+	{ FR_CONF_OFFSET("async_writes", FR_TYPE_UINT32, rlm_sql_cassandra_t, async_writes_max), .dflt = "0" },
 	{ FR_CONF_POINTER("latency_aware_routing", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) latency_aware_routing_config },
 
 	{ FR_CONF_OFFSET("tcp_keepalive", FR_TYPE_UINT32, rlm_sql_cassandra_t, tcp_keepalive) },
@@ -432,19 +437,26 @@ static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t *c
 	return RLM_SQL_OK;
 }
 
-static sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query)
+/** Create a statement for a query, with the configured consistency level
+ *
+ */
+static CassStatement *sql_statement_alloc(rlm_sql_cassandra_t const *inst, char const *query)
 {
-	rlm_sql_cassandra_conn_t	*conn = handle->conn;
-	rlm_sql_cassandra_t	*conf = config->driver;
-	CassStatement			*statement;
-	CassFuture			*future;
-	CassError			ret;
+	CassStatement	*statement;
 
 	statement = cass_statement_new_n(query, talloc_array_length(query) - 1, 0);
-	if (conf->consistency_str) cass_statement_set_consistency(statement, conf->consistency);
+	if (inst->consistency_str) cass_statement_set_consistency(statement, inst->consistency);
 
-	future = cass_session_execute(conf->session, statement);
-	cass_statement_free(statement);
+	return statement;
+}
+
+/** Wait for a query to complete, and store its result in the connection handle
+ *
+ * Frees the future.
+ */
+static sql_rcode_t sql_query_wait(rlm_sql_cassandra_conn_t *conn, CassFuture *future)
+{
+	CassError			ret;
 
 	ret = cass_future_error_code(future);
 	if (ret != CASS_OK) {
@@ -471,6 +483,87 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
 	return RLM_SQL_OK;
 }
 
+static sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query)
+{
+	rlm_sql_cassandra_conn_t	*conn = handle->conn;
+	rlm_sql_cassandra_t		*conf = config->driver;
+	CassStatement			*statement;
+	CassFuture			*future;
+
+	statement = sql_statement_alloc(conf, query);
+	future = cass_session_execute(conf->session, statement);
+	cass_statement_free(statement);
+
+	return sql_query_wait(conn, future);
+}
+
+/** Called by one of libcassandra's IO threads when an asynchronous write completes
+ *
+ * There's no request left to return the result to, so all we can do is log failures.
+ */
+static void _sql_write_done(CassFuture *future, void *uctx)
+{
+	rlm_sql_cassandra_t	*inst = uctx;
+	CassError		ret;
+
+	ret = cass_future_error_code(future);
+	if (ret != CASS_OK) {
+		char const	*error;
+		size_t		len;
+
+		cass_future_error_message(future, &error, &len);
+		ERROR("Asynchronous write failed: [%x] %.*s", (int)ret, (int)len, error);
+	}
+
+	atomic_fetch_sub_explicit(&inst->async_writes, 1, memory_order_relaxed);
+}
+
+/** Execute a query which doesn't return rows
+ *
+ * Cassandra writes are upserts, and we always report one affected row, so
+ * there's nothing in the result the caller can use.  If async_writes is set,
+ * submit the write and return immediately, leaving the driver's IO threads to
+ * complete it.  This lets the number of writes in progress scale with the
+ * cluster instead of with the number of worker threads blocked on futures.
+ *
+ * Once async_writes writes are in flight, we fall back to waiting for each
+ * result, which applies back pressure to the callers.
+ */
+static sql_rcode_t sql_write_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query)
+{
+	rlm_sql_cassandra_conn_t	*conn = handle->conn;
+	rlm_sql_cassandra_t		*conf = config->driver;
+	CassStatement			*statement;
+	CassFuture			*future;
+
+	if (!conf->async_writes_max) return sql_query(handle, config, query);
+
+	if (atomic_fetch_add_explicit(&conf->async_writes, 1, memory_order_relaxed) >= conf->async_writes_max) {
+		atomic_fetch_sub_explicit(&conf->async_writes, 1, memory_order_relaxed);
+		return sql_query(handle, config, query);
+	}
+
+	statement = sql_statement_alloc(conf, query);
+	future = cass_session_execute(conf->session, statement);
+	cass_statement_free(statement);
+
+	/*
+	 *	If we can't set the callback, we have to wait
+	 *	for the result the old fashioned way.
+	 */
+	if (cass_future_set_callback(future, _sql_write_done, conf) != CASS_OK) {
+		atomic_fetch_sub_explicit(&conf->async_writes, 1, memory_order_relaxed);
+		return sql_query_wait(conn, future);
+	}
+
+	/*
+	 *	The callback holds its own reference to the future.
+	 */
+	cass_future_free(future);
+
+	return RLM_SQL_OK;
+}
+
 static int sql_num_fields(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 	rlm_sql_cassandra_conn_t *conn = handle->conn;
@@ -741,6 +834,7 @@ do {\
 		TALLOC_FREE(inst);
 		return -1;
 	}
+	atomic_init(&inst->async_writes, 0);
 
 	/*
 	 *	This has to be done before we call cf_section_parse
@@ -965,7 +1059,7 @@ rlm_sql_driver_t rlm_sql_cassandra = {
 	.mod_instantiate		= mod_instantiate,
 	.detach				= mod_detach,
 	.sql_socket_init		= sql_socket_init,
-	.sql_query			= sql_query,
+	.sql_query			= sql_write_query,
 	.sql_select_query		= sql_query,
 	.sql_num_fields			= sql_num_fields,
 	.sql_num_rows			= sql_num_rows,
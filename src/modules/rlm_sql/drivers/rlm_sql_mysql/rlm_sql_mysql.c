@@ -156,6 +156,12 @@ static const CONF_PARSER driver_config[] = {
 /* Prototypes */
 static sql_rcode_t sql_free_result(rlm_sql_handle_t*, rlm_sql_config_t*);
 
+/*
+ *  Returned for NULL values, so callers can always treat
+ *  the row as strings.
+ */
+static char sql_null_value[] = "";
+
 static int _sql_socket_destructor(rlm_sql_mysql_conn_t *conn)
 {
 	DEBUG2("Socket destructor called, closing socket");
@@ -561,7 +567,6 @@ static sql_rcode_t sql_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle, r
 	MYSQL_ROW		row;
 	int			ret;
 	unsigned int		num_fields, i;
-	unsigned long		*field_lens;
 
 	*out = NULL;
 
@@ -570,8 +575,6 @@ static sql_rcode_t sql_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle, r
 	 */
 	if (!conn->result) return RLM_SQL_RECONNECT;
 
-	TALLOC_FREE(handle->row);		/* Clear previous row set */
-
 retry_fetch_row:
 	row = mysql_fetch_row(conn->result);
 	if (!row) {
@@ -596,13 +599,24 @@ retry_fetch_row:
 	num_fields = mysql_num_fields(conn->result);
 	if (!num_fields) return RLM_SQL_NO_MORE_ROWS;
 
- 	field_lens = mysql_fetch_lengths(conn->result);
-
-	MEM(*out = handle->row = talloc_zero_array(handle, char *, num_fields + 1));
-	for (i = 0; i < num_fields; i++) {
-		MEM(handle->row[i] = talloc_bstrndup(handle->row, row[i], field_lens[i]));
+	/*
+	 *  One row array per result set, pointing at the values
+	 *  in the MYSQL_ROW.  The client library \0 terminates
+	 *  them, and they live until the next fetch, so there's
+	 *  no need to copy each one.
+	 */
+	if (!handle->row || (talloc_array_length(handle->row) != (num_fields + 1))) {
+		talloc_free(handle->row);
+		MEM(handle->row = talloc_zero_array(handle, char *, num_fields + 1));
 	}
 
+	/*
+	 *  NULL values are returned as "", as they were when
+	 *  each value was copied.
+	 */
+	for (i = 0; i < num_fields; i++) handle->row[i] = row[i] ? row[i] : sql_null_value;
+	*out = handle->row;
+
 	return RLM_SQL_OK;
 }
 
@@ -44,6 +44,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/util/debug.h>
 
+#include <poll.h>
 #include <sys/stat.h>
 
 #include <libpq-fe.h>
@@ -254,6 +255,24 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return 0;
 }
 
+/** Ask the server to stop running the current query
+ *
+ * Used when a query times out, so that the server doesn't carry on
+ * doing work that nothing is waiting for.
+ */
+static void sql_query_cancel(rlm_sql_postgres_conn_t *conn)
+{
+	PGcancel	*cancel;
+	char		errbuf[256];
+
+	cancel = PQgetCancel(conn->db);
+	if (!cancel) return;
+
+	if (!PQcancel(cancel, errbuf, sizeof(errbuf))) WARN("Failed cancelling query: %s", errbuf);
+
+	PQfreeCancel(cancel);
+}
+
 static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
 					      char const *query)
 {
@@ -284,31 +303,38 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_
 
 	/*
 	 *  We try to avoid blocking by waiting until the driver indicates that
-	 *  the result is ready or our timeout expires
+	 *  the result is ready or our timeout expires.
+	 *
+	 *  poll() is used as the socket may be above FD_SETSIZE in a busy
+	 *  server, where select() would write past the end of the fd_set.
 	 */
 	start = fr_time();
 	while (PQisBusy(conn->db)) {
 		int		r;
-		fd_set		read_fd;
-		fr_time_delta_t	elapsed = 0;
-
-		FD_ZERO(&read_fd);
-		FD_SET(sockfd, &read_fd);
+		int		wait = -1;
+		struct pollfd	pfd = { .fd = sockfd, .events = POLLIN };
 
 		if (config->query_timeout) {
-			elapsed = fr_time() - start;
+			fr_time_delta_t	elapsed = fr_time() - start;
+
 			if (elapsed >= timeout) goto too_long;
+
+			/*
+			 *  Round up, so we don't spin on sub-millisecond waits.
+			 */
+			wait = fr_time_delta_to_msec(timeout - elapsed + fr_time_delta_from_msec(1) - 1);
 		}
 
-		r = select(sockfd + 1, &read_fd, NULL, NULL, config->query_timeout ? &fr_time_delta_to_timeval(timeout - elapsed) : NULL);
+		r = poll(&pfd, 1, wait);
 		if (r == 0) {
 		too_long:
 			ERROR("Socket read timeout after %d seconds", config->query_timeout);
+			sql_query_cancel(conn);
 			return RLM_SQL_RECONNECT;
 		}
 		if (r < 0) {
 			if (errno == EINTR) continue;
-			ERROR("Failed in select: %s", fr_syserror(errno));
+			ERROR("Failed in poll: %s", fr_syserror(errno));
 			return RLM_SQL_RECONNECT;
 		}
 		if (!PQconsumeInput(conn->db)) {
@@ -414,7 +440,7 @@ static sql_rcode_t sql_fields(char const **out[], rlm_sql_handle_t *handle, UNUS
 static sql_rcode_t sql_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 
-	int records, i, len;
+	int records, i;
 	rlm_sql_postgres_conn_t *conn = handle->conn;
 
 	*out = NULL;
@@ -422,18 +448,23 @@ static sql_rcode_t sql_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle, U
 
 	if (conn->cur_row >= PQntuples(conn->result)) return RLM_SQL_NO_MORE_ROWS;
 
-	free_result_row(conn);
-
 	records = PQnfields(conn->result);
-	conn->num_fields = records;
 
 	if ((PQntuples(conn->result) > 0) && (records > 0)) {
-		conn->row = talloc_zero_array(conn, char *, records + 1);
-		for (i = 0; i < records; i++) {
-			len = PQgetlength(conn->result, conn->cur_row, i);
-			conn->row[i] = talloc_array(conn->row, char, len + 1);
-			strlcpy(conn->row[i], PQgetvalue(conn->result, conn->cur_row, i), len + 1);
+		/*
+		 *	One row array for the whole result, which
+		 *	points at the values in the PGresult.  They're
+		 *	already \0 terminated, and live until the
+		 *	result is cleared, so there's no need to copy
+		 *	each one.  NULL values are returned as "".
+		 */
+		if (!conn->row || (conn->num_fields != records)) {
+			free_result_row(conn);
+			MEM(conn->row = talloc_zero_array(conn, char *, records + 1));
+			conn->num_fields = records;
 		}
+
+		for (i = 0; i < records; i++) conn->row[i] = PQgetvalue(conn->result, conn->cur_row, i);
 		conn->cur_row++;
 		*out = handle->row = conn->row;
 
@@ -29,6 +29,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/debug.h>
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include <sqlite3.h>
@@ -49,21 +50,88 @@ RCSID("$Id$")
 typedef sqlite_int64 sqlite3_int64;
 #endif
 
+typedef struct rlm_sql_sqlite_write_s rlm_sql_sqlite_write_t;
+
+/** A write queued for the writer thread
+ *
+ * Lives on the stack of the worker which queued it.  The worker
+ * waits until the writer thread marks it done.
+ */
+struct rlm_sql_sqlite_write_s {
+	char const		*query;		//!< To run.
+	sql_rcode_t		rcode;		//!< Of the query.
+	int			changes;	//!< Rows changed by the query.
+	char			error[256];	//!< Error message, if the query failed.
+	bool			taken;		//!< Being written by the writer thread.
+	bool			done;		//!< Set by the writer thread.
+	rlm_sql_sqlite_write_t	*next;		//!< Next write in the queue.
+};
+
+/** The writer thread, and its connection to the database
+ *
+ * All writes are done by this one thread, so workers never contend for
+ * the database lock.  Writes queued while a batch is being written are
+ * written together in the next batch, as one transaction.
+ *
+ * Explicit transactions (BEGIN ... COMMIT) have to see their own writes,
+ * so a connection which starts one borrows the writer's database handle
+ * until the transaction ends.  The writer thread waits while it's
+ * borrowed.
+ *
+ * Workers wait at most busy_timeout for the writer, so a transaction
+ * which is never finished can't hang every worker which writes.
+ */
+typedef struct {
+	pthread_t		thread;
+	pthread_mutex_t		mutex;
+	pthread_cond_t		queued;		//!< Signalled when writes are queued, or
+						///< the database handle is returned.
+	pthread_cond_t		done;		//!< Broadcast when a batch has been written,
+						///< or the database handle is returned.
+
+	sqlite3			*db;		//!< Read/write connection used for all writes.
+	uint32_t		batch_max;	//!< Maximum number of writes per transaction.
+	uint32_t		timeout;	//!< How long (ms) workers wait for the writer.
+
+	rlm_sql_sqlite_write_t	*head;		//!< First queued write.
+	rlm_sql_sqlite_write_t	**tail;		//!< Where to add the next write.
+
+	bool			busy;		//!< Writer thread is using db.
+	bool			borrowed;	//!< A connection is using db for a transaction.
+	bool			shutdown;	//!< Writer thread should exit.
+} rlm_sql_sqlite_writer_t;
+
 typedef struct {
 	sqlite3 *db;
 	sqlite3_stmt *statement;
 	int col_count;
+
+	rlm_sql_sqlite_writer_t	*writer;	//!< Writes are sent here, if set.
+	bool			borrowed;	//!< We're in a transaction on writer->db.
+	bool			written;	//!< Last query was a write, and its result
+						///< is in changes and error.
+	int			changes;	//!< Rows changed by the last write.
+	char			error[256];	//!< Error from the last write.
 } rlm_sql_sqlite_conn_t;
 
 typedef struct {
 	char const	*filename;
 	uint32_t	busy_timeout;
 	bool		bootstrap;
+
+	bool		wal;			//!< Put the database in WAL mode.
+	bool		write_thread;		//!< Send all writes to a dedicated thread.
+	uint32_t	max_write_batch;	//!< Maximum writes per transaction.
+
+	rlm_sql_sqlite_writer_t	*writer;	//!< The writer thread.
 } rlm_sql_sqlite_t;
 
 static const CONF_PARSER driver_config[] = {
 	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_OUTPUT | FR_TYPE_REQUIRED, rlm_sql_sqlite_t, filename) },
 	{ FR_CONF_OFFSET("busy_timeout", FR_TYPE_UINT32, rlm_sql_sqlite_t, busy_timeout), .dflt = "200" },
+	{ FR_CONF_OFFSET("wal", FR_TYPE_BOOL, rlm_sql_sqlite_t, wal), .dflt = "no" },
+	{ FR_CONF_OFFSET("write_thread", FR_TYPE_BOOL, rlm_sql_sqlite_t, write_thread), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_write_batch", FR_TYPE_UINT32, rlm_sql_sqlite_t, max_write_batch), .dflt = "256" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -380,12 +448,97 @@ static int sql_loadfile(TALLOC_CTX *ctx, sqlite3 *db, char const *filename)
 }
 #endif
 
+/** The database handle queries on this connection should use
+ *
+ * Inside a transaction that's the writer's handle, otherwise it's our own.
+ */
+static inline sqlite3 *sql_conn_db(rlm_sql_sqlite_conn_t *conn)
+{
+	return conn->borrowed ? conn->writer->db : conn->db;
+}
+
+/** Work out when a wait for the writer thread should give up
+ *
+ */
+static void sql_writer_deadline(struct timespec *deadline, uint32_t timeout)
+{
+	clock_gettime(CLOCK_REALTIME, deadline);
+
+	deadline->tv_sec += timeout / 1000;
+	deadline->tv_nsec += (timeout % 1000) * 1000000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+/** Wait for one of the writer's conditions, with writer->mutex held
+ *
+ * @return
+ *	- 0 if woken up.
+ *	- -1 if the deadline passed.
+ */
+static inline int sql_writer_wait(rlm_sql_sqlite_writer_t *writer, pthread_cond_t *cond,
+				  struct timespec const *deadline)
+{
+	return (pthread_cond_timedwait(cond, &writer->mutex, deadline) == ETIMEDOUT) ? -1 : 0;
+}
+
+/** Give the writer thread its database handle back, at the end of a transaction
+ *
+ */
+static void sql_writer_return(rlm_sql_sqlite_conn_t *conn)
+{
+	rlm_sql_sqlite_writer_t *writer = conn->writer;
+
+	/*
+	 *	Any statement still open was prepared on the
+	 *	writer's handle, which we're about to give up.
+	 */
+	if (conn->statement) {
+		(void) sqlite3_finalize(conn->statement);
+		conn->statement = NULL;
+		conn->col_count = 0;
+	}
+
+	pthread_mutex_lock(&writer->mutex);
+	writer->borrowed = false;
+	pthread_cond_signal(&writer->queued);
+	pthread_cond_broadcast(&writer->done);
+	pthread_mutex_unlock(&writer->mutex);
+
+	conn->borrowed = false;
+}
+
+/** Roll back a transaction which will never be finished, and give the writer its handle back
+ *
+ */
+static void sql_writer_abandon(rlm_sql_sqlite_conn_t *conn)
+{
+	if (!conn->borrowed) return;
+
+	if (conn->statement) {
+		(void) sqlite3_finalize(conn->statement);
+		conn->statement = NULL;
+	}
+	if (!sqlite3_get_autocommit(conn->writer->db)) {
+		(void) sqlite3_exec(conn->writer->db, "ROLLBACK", NULL, NULL, NULL);
+	}
+	sql_writer_return(conn);
+}
+
 static int _sql_socket_destructor(rlm_sql_sqlite_conn_t *conn)
 {
 	int status = 0;
 
 	DEBUG2("Socket destructor called, closing socket");
 
+	/*
+	 *	Don't leave the writer thread waiting for a
+	 *	transaction which will never finish.
+	 */
+	sql_writer_abandon(conn);
+
 	if (conn->db) {
 		status = sqlite3_close(conn->db);
 		if (status != SQLITE_OK) WARN("Got SQLite error when closing socket: %s",
@@ -410,6 +563,86 @@ static void _sql_greatest(sqlite3_context *ctx, int num_values, sqlite3_value **
 	sqlite3_result_int64(ctx, max);
 }
 
+static int _sql_journal_mode(void *uctx, int argc, char **argv, UNUSED char **columns)
+{
+	bool *wal = uctx;
+
+	*wal = (argc > 0) && argv[0] && (strcasecmp(argv[0], "wal") == 0);
+
+	return 0;
+}
+
+/** Set up a newly opened database handle
+ *
+ * @param inst		sqlite driver instance.
+ * @param db		to set up.
+ * @param writable	whether the handle is used for writes.  Only writable
+ *			handles can change the journal mode.
+ * @return
+ *	- RLM_SQL_OK on success.
+ *	- RLM_SQL_ERROR on failure.
+ */
+static sql_rcode_t sql_db_init(rlm_sql_sqlite_t const *inst, sqlite3 *db, bool writable)
+{
+	int status;
+
+	status = sqlite3_busy_timeout(db, inst->busy_timeout);
+	if (sql_check_error(db, status) != RLM_SQL_OK) {
+		sql_print_error(db, status, "Error setting busy timeout");
+		return RLM_SQL_ERROR;
+	}
+
+	/*
+	 *	Enable extended return codes for extra debugging info.
+	 */
+#ifdef HAVE_SQLITE3_EXTENDED_RESULT_CODES
+	status = sqlite3_extended_result_codes(db, 1);
+	if (sql_check_error(db, status) != RLM_SQL_OK) {
+		sql_print_error(db, status, "Error enabling extended result codes");
+		return RLM_SQL_ERROR;
+	}
+#endif
+
+#ifdef HAVE_SQLITE3_CREATE_FUNCTION_V2
+	status = sqlite3_create_function_v2(db, "GREATEST", -1, SQLITE_ANY, NULL,
+					    _sql_greatest, NULL, NULL, NULL);
+#else
+	status = sqlite3_create_function(db, "GREATEST", -1, SQLITE_ANY, NULL,
+					 _sql_greatest, NULL, NULL);
+#endif
+	if (sql_check_error(db, status) != RLM_SQL_OK) {
+		sql_print_error(db, status, "Failed registering 'GREATEST' sql function");
+		return RLM_SQL_ERROR;
+	}
+
+	if (writable && inst->wal) {
+		bool wal = false;
+
+		status = sqlite3_exec(db, "PRAGMA journal_mode = WAL", _sql_journal_mode, &wal, NULL);
+		if (sql_check_error(db, status) != RLM_SQL_OK) {
+			sql_print_error(db, status, "Error enabling WAL mode");
+			return RLM_SQL_ERROR;
+		}
+
+		if (!wal) {
+			ERROR("SQLite database \"%s\" can't be put in WAL mode", inst->filename);
+			return RLM_SQL_ERROR;
+		}
+
+		/*
+		 *	In WAL mode this can't corrupt the database, and
+		 *	means commits don't wait for the disk.
+		 */
+		status = sqlite3_exec(db, "PRAGMA synchronous = NORMAL", NULL, NULL, NULL);
+		if (sql_check_error(db, status) != RLM_SQL_OK) {
+			sql_print_error(db, status, "Error setting synchronous mode");
+			return RLM_SQL_ERROR;
+		}
+	}
+
+	return RLM_SQL_OK;
+}
+
 static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
 					    UNUSED fr_time_delta_t timeout)
 {
@@ -421,9 +654,18 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_sqlite_conn_t));
 	talloc_set_destructor(conn, _sql_socket_destructor);
 
-	INFO("Opening SQLite database \"%s\"", inst->filename);
+	/*
+	 *	With a writer thread, pooled connections are only
+	 *	used for reads.  In WAL mode they never wait for
+	 *	the writer.
+	 */
+	conn->writer = inst->writer;
+
+	INFO("Opening SQLite database \"%s\"%s", inst->filename, conn->writer ? " read-only" : "");
 #ifdef HAVE_SQLITE3_OPEN_V2
-	status = sqlite3_open_v2(inst->filename, &(conn->db), SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, NULL);
+	status = sqlite3_open_v2(inst->filename, &(conn->db),
+				 (conn->writer ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE) | SQLITE_OPEN_NOMUTEX,
+				 NULL);
 #else
 	status = sqlite3_open(inst->filename, &(conn->db));
 #endif
@@ -437,53 +679,318 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 #endif
 		return RLM_SQL_ERROR;
 	}
-	status = sqlite3_busy_timeout(conn->db, inst->busy_timeout);
-	if (sql_check_error(conn->db, status) != RLM_SQL_OK) {
-		sql_print_error(conn->db, status, "Error setting busy timeout");
-		return RLM_SQL_ERROR;
+
+	return sql_db_init(inst, conn->db, !conn->writer);
+}
+
+/** Run one write to completion
+ *
+ * The result, number of rows changed, and any error are recorded in the write.
+ */
+static void sql_write_exec(sqlite3 *db, rlm_sql_sqlite_write_t *w)
+{
+	sqlite3_stmt	*statement = NULL;
+	char const	*z_tail;
+	int		status;
+
+#ifdef HAVE_SQLITE3_PREPARE_V2
+	status = sqlite3_prepare_v2(db, w->query, strlen(w->query), &statement, &z_tail);
+#else
+	status = sqlite3_prepare(db, w->query, strlen(w->query), &statement, &z_tail);
+#endif
+	w->rcode = sql_check_error(db, status);
+	if (w->rcode == RLM_SQL_OK) {
+		do {
+			status = sqlite3_step(statement);
+		} while (status == SQLITE_ROW);
+		w->rcode = sql_check_error(db, status);
 	}
 
-	/*
-	 *	Enable extended return codes for extra debugging info.
-	 */
-#ifdef HAVE_SQLITE3_EXTENDED_RESULT_CODES
-	status = sqlite3_extended_result_codes(conn->db, 1);
-	if (sql_check_error(conn->db, status) != RLM_SQL_OK) {
-		sql_print_error(conn->db, status, "Error enabling extended result codes");
-		return RLM_SQL_ERROR;
+	if (w->rcode == RLM_SQL_OK) {
+		w->changes = sqlite3_changes(db);
+		w->error[0] = '\0';
+	} else {
+		w->changes = 0;
+		strlcpy(w->error, sqlite3_errmsg(db), sizeof(w->error));
 	}
-#endif
 
-#ifdef HAVE_SQLITE3_CREATE_FUNCTION_V2
-	status = sqlite3_create_function_v2(conn->db, "GREATEST", -1, SQLITE_ANY, NULL,
-					    _sql_greatest, NULL, NULL, NULL);
+	if (statement) (void) sqlite3_finalize(statement);
+}
+
+/** Write a batch of queued writes in one transaction
+ *
+ * Each write still gets its own result.  A write which fails normally
+ * only undoes its own changes, the rest of the batch is still committed.
+ */
+static void sql_writer_batch(rlm_sql_sqlite_writer_t *writer, rlm_sql_sqlite_write_t *head)
+{
+	rlm_sql_sqlite_write_t	*w, *p;
+	bool			transaction = false;
+
+	if (head->next) transaction = (sqlite3_exec(writer->db, "BEGIN IMMEDIATE", NULL, NULL, NULL) == SQLITE_OK);
+
+	for (w = head; w; w = w->next) {
+		sql_write_exec(writer->db, w);
+
+		/*
+		 *	Some errors roll back the whole transaction, not
+		 *	just the failed write.  Anything written before
+		 *	it has been lost, so write it again.
+		 */
+		if (transaction && sqlite3_get_autocommit(writer->db)) {
+			transaction = false;
+			for (p = head; p != w; p = p->next) sql_write_exec(writer->db, p);
+		}
+	}
+
+	if (!transaction || (sqlite3_exec(writer->db, "COMMIT", NULL, NULL, NULL) == SQLITE_OK)) return;
+
+	ERROR("Failed committing batch of writes, retrying them individually: %s", sqlite3_errmsg(writer->db));
+
+	if (!sqlite3_get_autocommit(writer->db)) (void) sqlite3_exec(writer->db, "ROLLBACK", NULL, NULL, NULL);
+
+	for (w = head; w; w = w->next) sql_write_exec(writer->db, w);
+}
+
+static void *sql_writer_thread(void *arg)
+{
+	rlm_sql_sqlite_writer_t	*writer = arg;
+	rlm_sql_sqlite_write_t	*head, *w;
+	struct timespec		deadline;
+	uint32_t		i;
+
+	pthread_mutex_lock(&writer->mutex);
+	for (;;) {
+		while (!writer->head || writer->borrowed) {
+			if (writer->shutdown) goto done;
+
+			if (!writer->head) {
+				pthread_cond_wait(&writer->queued, &writer->mutex);
+				continue;
+			}
+
+			/*
+			 *	Writes are queued behind a transaction.  The
+			 *	workers give up on them after busy_timeout,
+			 *	so say why they're failing.
+			 */
+			sql_writer_deadline(&deadline, writer->timeout);
+			if (sql_writer_wait(writer, &writer->queued, &deadline) < 0) {
+				RATE_LIMIT_GLOBAL(WARN, "Queued writes have waited more than %u ms for a "
+						  "transaction to finish", writer->timeout);
+			}
+		}
+
+		/*
+		 *	Everything queued while the last batch was being
+		 *	written goes in this one, up to batch_max.
+		 */
+		head = writer->head;
+		for (w = head, i = 1; w->next && (i < writer->batch_max); w = w->next, i++) w->taken = true;
+		w->taken = true;
+
+		writer->head = w->next;
+		if (!writer->head) writer->tail = &writer->head;
+		w->next = NULL;
+		writer->busy = true;
+		pthread_mutex_unlock(&writer->mutex);
+
+		sql_writer_batch(writer, head);
+
+		pthread_mutex_lock(&writer->mutex);
+		for (w = head; w; w = w->next) w->done = true;
+		writer->busy = false;
+		pthread_cond_broadcast(&writer->done);
+	}
+
+done:
+	pthread_mutex_unlock(&writer->mutex);
+
+	return NULL;
+}
+
+static int _sql_writer_free(rlm_sql_sqlite_writer_t *writer)
+{
+	int status;
+
+	pthread_mutex_lock(&writer->mutex);
+	writer->shutdown = true;
+	pthread_cond_signal(&writer->queued);
+	pthread_mutex_unlock(&writer->mutex);
+
+	pthread_join(writer->thread, NULL);
+
+	status = sqlite3_close(writer->db);
+	if (status != SQLITE_OK) WARN("Got SQLite error when closing writer: %s", sqlite3_errmsg(writer->db));
+
+	pthread_cond_destroy(&writer->done);
+	pthread_cond_destroy(&writer->queued);
+	pthread_mutex_destroy(&writer->mutex);
+
+	return 0;
+}
+
+/** Open the writer's connection, and start the writer thread
+ *
+ */
+static int sql_writer_start(rlm_sql_sqlite_t *inst)
+{
+	rlm_sql_sqlite_writer_t	*writer;
+	int			status, ret;
+
+	if (!sqlite3_threadsafe()) {
+		ERROR("libsqlite was built without thread support, 'write_thread' can't be used");
+		return -1;
+	}
+
+	MEM(writer = talloc_zero(inst, rlm_sql_sqlite_writer_t));
+	writer->batch_max = inst->max_write_batch;
+	writer->timeout = inst->busy_timeout;
+	writer->tail = &writer->head;
+
+	INFO("Opening SQLite database \"%s\" for writer thread", inst->filename);
+#ifdef HAVE_SQLITE3_OPEN_V2
+	status = sqlite3_open_v2(inst->filename, &writer->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, NULL);
 #else
-	status = sqlite3_create_function(conn->db, "GREATEST", -1, SQLITE_ANY, NULL,
-					 _sql_greatest, NULL, NULL);
+	status = sqlite3_open(inst->filename, &writer->db);
 #endif
-	if (sql_check_error(conn->db, status) != RLM_SQL_OK) {
-		sql_print_error(conn->db, status, "Failed registering 'GREATEST' sql function");
-		return RLM_SQL_ERROR;
+	if (!writer->db || (sql_check_error(writer->db, status) != RLM_SQL_OK)) {
+		sql_print_error(writer->db, status, "Error opening SQLite database \"%s\"", inst->filename);
+	error:
+		if (writer->db) (void) sqlite3_close(writer->db);
+		talloc_free(writer);
+		return -1;
 	}
 
-	return RLM_SQL_OK;
+	if (sql_db_init(inst, writer->db, true) != RLM_SQL_OK) goto error;
+
+	pthread_mutex_init(&writer->mutex, NULL);
+	pthread_cond_init(&writer->queued, NULL);
+	pthread_cond_init(&writer->done, NULL);
+
+	ret = pthread_create(&writer->thread, NULL, sql_writer_thread, writer);
+	if (ret != 0) {
+		ERROR("Failed starting writer thread: %s", fr_syserror(ret));
+		pthread_cond_destroy(&writer->done);
+		pthread_cond_destroy(&writer->queued);
+		pthread_mutex_destroy(&writer->mutex);
+		goto error;
+	}
+	talloc_set_destructor(writer, _sql_writer_free);
+
+	inst->writer = writer;
+
+	return 0;
+}
+
+/** Whether a query starts a transaction
+ *
+ */
+static bool sql_is_begin(char const *query)
+{
+	while (isspace((uint8_t) *query)) query++;
+
+	return (strncasecmp(query, "BEGIN", 5) == 0) || (strncasecmp(query, "SAVEPOINT", 9) == 0);
+}
+
+/** Send a write to the writer thread, and wait for its result
+ *
+ * Writes in a transaction are run directly on the writer's handle,
+ * which this connection has borrowed for the duration.
+ *
+ * If the writer isn't available within busy_timeout, the write fails.
+ */
+static sql_rcode_t sql_write(rlm_sql_sqlite_conn_t *conn, char const *query)
+{
+	rlm_sql_sqlite_writer_t	*writer = conn->writer;
+	rlm_sql_sqlite_write_t	w = { .query = query };
+	rlm_sql_sqlite_write_t	**p;
+	struct timespec		deadline;
+
+	sql_writer_deadline(&deadline, writer->timeout);
+
+	if (!conn->borrowed && sql_is_begin(query)) {
+		pthread_mutex_lock(&writer->mutex);
+		while (writer->busy || writer->borrowed) {
+			if (sql_writer_wait(writer, &writer->done, &deadline) < 0) {
+				pthread_mutex_unlock(&writer->mutex);
+				goto timeout;
+			}
+		}
+		writer->borrowed = true;
+		pthread_mutex_unlock(&writer->mutex);
+
+		conn->borrowed = true;
+	}
+
+	if (conn->borrowed) {
+		sql_write_exec(writer->db, &w);
+
+		/*
+		 *	Committed, or rolled back.
+		 */
+		if (sqlite3_get_autocommit(writer->db)) sql_writer_return(conn);
+	} else {
+		pthread_mutex_lock(&writer->mutex);
+		*writer->tail = &w;
+		writer->tail = &w.next;
+		pthread_cond_signal(&writer->queued);
+		while (!w.done) {
+			if ((sql_writer_wait(writer, &writer->done, &deadline) == 0) || w.done) continue;
+
+			/*
+			 *	The writer thread is running our write, and
+			 *	is using our stack to do it.  It's not stuck,
+			 *	its own waits for locks are bounded by
+			 *	busy_timeout, so wait for it to finish.
+			 */
+			if (w.taken) {
+				pthread_cond_wait(&writer->done, &writer->mutex);
+				continue;
+			}
+
+			for (p = &writer->head; *p != &w; p = &(*p)->next);
+			*p = w.next;
+			if (writer->tail == &w.next) writer->tail = p;
+			pthread_mutex_unlock(&writer->mutex);
+			goto timeout;
+		}
+		pthread_mutex_unlock(&writer->mutex);
+	}
+
+	conn->written = true;
+	conn->changes = w.changes;
+	strlcpy(conn->error, w.error, sizeof(conn->error));
+
+	return w.rcode;
+
+timeout:
+	conn->written = true;
+	conn->changes = 0;
+	snprintf(conn->error, sizeof(conn->error), "Timed out after %u ms waiting for the writer thread",
+		 writer->timeout);
+
+	return RLM_SQL_ERROR;
 }
 
 static sql_rcode_t sql_select_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, char const *query)
 {
 	rlm_sql_sqlite_conn_t	*conn = handle->conn;
+	sqlite3			*db = sql_conn_db(conn);
 	char const		*z_tail;
 	int			status;
 
+	conn->written = false;
+
 #ifdef HAVE_SQLITE3_PREPARE_V2
-	status = sqlite3_prepare_v2(conn->db, query, strlen(query), &conn->statement, &z_tail);
+	status = sqlite3_prepare_v2(db, query, strlen(query), &conn->statement, &z_tail);
 #else
-	status = sqlite3_prepare(conn->db, query, strlen(query), &conn->statement, &z_tail);
+	status = sqlite3_prepare(db, query, strlen(query), &conn->statement, &z_tail);
 #endif
 
 	conn->col_count = 0;
 
-	return sql_check_error(conn->db, status);
+	return sql_check_error(db, status);
 }
 
 
@@ -495,6 +1002,8 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 	char const		*z_tail;
 	int			status;
 
+	if (conn->writer) return sql_write(conn, query);
+
 #ifdef HAVE_SQLITE3_PREPARE_V2
 	status = sqlite3_prepare_v2(conn->db, query, strlen(query), &conn->statement, &z_tail);
 #else
@@ -555,7 +1064,7 @@ static sql_rcode_t sql_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle, r
 	/*
 	 *	Error getting next row
 	 */
-	if (sql_check_error(conn->db, status) != RLM_SQL_OK) return RLM_SQL_ERROR;
+	if (sql_check_error(sql_conn_db(conn), status) != RLM_SQL_OK) return RLM_SQL_ERROR;
 
 	/*
 	 *	No more rows to process (we're done)
@@ -661,8 +1170,17 @@ static size_t sql_error(UNUSED TALLOC_CTX *ctx, sql_log_entry_t out[], NDEBUG_UN
 
 	fr_assert(outlen > 0);
 
-	error = sqlite3_errmsg(conn->db);
-	if (!error) return 0;
+	/*
+	 *	The write was run on the writer's handle, which
+	 *	may be running other writes by now.
+	 */
+	if (conn->written) {
+		if (!conn->error[0]) return 0;
+		error = conn->error;
+	} else {
+		error = sqlite3_errmsg(sql_conn_db(conn));
+		if (!error) return 0;
+	}
 
 	out[0].type = L_ERR;
 	out[0].msg = error;
@@ -675,11 +1193,31 @@ static sql_rcode_t sql_finish_query(rlm_sql_handle_t *handle, rlm_sql_config_t *
 	return sql_free_result(handle, config);
 }
 
+/** Don't let a transaction outlive the request which started it
+ *
+ * If the connection goes back to the pool with a transaction still
+ * open on the writer's handle, nothing will ever finish it, and every
+ * write would queue up behind it.
+ */
+static sql_rcode_t sql_release(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_sqlite_conn_t *conn = handle->conn;
+
+	if (!conn || !conn->borrowed) return RLM_SQL_OK;
+
+	WARN("Connection released in the middle of a transaction, rolling it back");
+	sql_writer_abandon(conn);
+
+	return RLM_SQL_OK;
+}
+
 static int sql_affected_rows(rlm_sql_handle_t *handle,
 			     UNUSED rlm_sql_config_t *config)
 {
 	rlm_sql_sqlite_conn_t *conn = handle->conn;
 
+	if (conn->written) return conn->changes;
+
 	if (conn->db) return sqlite3_changes(conn->db);
 
 	return -1;
@@ -709,6 +1247,16 @@ static int mod_instantiate(rlm_sql_config_t const *config, void *instance, CONF_
 		inst->bootstrap = true;
 	}
 
+	/*
+	 *	Readers would otherwise block the writer thread.
+	 */
+	if (inst->write_thread && !inst->wal) {
+		WARN("Enabling 'wal', as it is required by 'write_thread'");
+		inst->wal = true;
+	}
+
+	FR_INTEGER_BOUND_CHECK("max_write_batch", inst->max_write_batch, >=, 1);
+
 	if (inst->bootstrap && !exists) {
 #ifdef HAVE_SQLITE3_OPEN_V2
 		int		status;
@@ -797,6 +1345,8 @@ static int mod_instantiate(rlm_sql_config_t const *config, void *instance, CONF_
 #endif
 	}
 
+	if (inst->write_thread && (sql_writer_start(inst) < 0)) return -1;
+
 	return 0;
 }
 
@@ -831,5 +1381,6 @@ rlm_sql_driver_t rlm_sql_sqlite = {
 	.sql_free_result		= sql_free_result,
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
-	.sql_finish_select_query	= sql_finish_query
+	.sql_finish_select_query	= sql_finish_query,
+	.sql_release			= sql_release
 };
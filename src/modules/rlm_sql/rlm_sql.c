@@ -45,6 +45,29 @@ RCSID("$Id$")
 
 extern module_t rlm_sql;
 
+typedef struct rlm_sql_thread_s rlm_sql_thread_t;
+
+/** An accounting request waiting for its batch to be written
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;				//!< Entry in the thread's batch.
+	rlm_sql_thread_t	*t;				//!< Thread the batch belongs to.
+	request_t		*request;			//!< Request to resume once the batch is written.
+	char			**query;			//!< Expanded queries of the redundant set.
+	rlm_rcode_t		last;				//!< Result if none of the queries update anything.
+	rlm_rcode_t		rcode;				//!< Result of running the queries.
+	bool			done;				//!< Queries were run outside of the batch's
+								///< transaction, and their result is final.
+} sql_acct_batch_t;
+
+struct rlm_sql_thread_s {
+	rlm_sql_t const		*inst;				//!< Instance of rlm_sql.
+	fr_event_list_t		*el;				//!< This thread's event list.
+	fr_dlist_head_t		batch;				//!< Accounting requests waiting to be written.
+	fr_event_timer_t const	*ev;				//!< Writes the batch when batch_timeout expires.
+};
+
 /*
  *	So we can do pass2 xlat checks on the queries.
  */
@@ -69,6 +92,8 @@ static const CONF_PARSER type_config[] = {
 static const CONF_PARSER acct_config[] = {
 	{ FR_CONF_OFFSET("reference", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, accounting.reference), .dflt = ".query" },
 	{ FR_CONF_OFFSET("logfile", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, accounting.logfile) },
+	{ FR_CONF_OFFSET("batch_size", FR_TYPE_UINT32, rlm_sql_config_t, accounting.batch_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("batch_timeout", FR_TYPE_TIME_DELTA, rlm_sql_config_t, accounting.batch_timeout), .dflt = "0.01" },
 
 	{ FR_CONF_POINTER("type", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) type_config },
 	CONF_PARSER_TERMINATOR
@@ -82,6 +107,14 @@ static const CONF_PARSER postauth_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const CONF_PARSER replica_config[] = {
+	{ FR_CONF_OFFSET("server", FR_TYPE_STRING | FR_TYPE_MULTI, rlm_sql_config_t, replica_server) },
+	{ FR_CONF_OFFSET("lag_query", FR_TYPE_STRING, rlm_sql_config_t, replica_lag_query) },
+	{ FR_CONF_OFFSET("max_lag", FR_TYPE_UINT32, rlm_sql_config_t, replica_max_lag), .dflt = "30" },
+	{ FR_CONF_OFFSET("check_interval", FR_TYPE_TIME_DELTA, rlm_sql_config_t, replica_check_interval), .dflt = "10.0" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("driver", FR_TYPE_STRING, rlm_sql_config_t, sql_driver_name), .dflt = "rlm_sql_null" },
 	{ FR_CONF_OFFSET("server", FR_TYPE_STRING, rlm_sql_config_t, sql_server), .dflt = "" },	/* Must be zero length so drivers can determine if it was set */
@@ -91,6 +124,9 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("radius_db", FR_TYPE_STRING, rlm_sql_config_t, sql_db), .dflt = "radius" },
 	{ FR_CONF_OFFSET("read_groups", FR_TYPE_BOOL, rlm_sql_config_t, read_groups), .dflt = "yes" },
 	{ FR_CONF_OFFSET("read_profiles", FR_TYPE_BOOL, rlm_sql_config_t, read_profiles), .dflt = "yes" },
+	{ FR_CONF_OFFSET("read_clients", FR_TYPE_BOOL, rlm_sql_config_t, read_clients), .dflt = "no" },
+	{ FR_CONF_OFFSET("client_query", FR_TYPE_STRING, rlm_sql_config_t, client_query),
+	  .dflt = "SELECT id, nasname, shortname, type, secret, server FROM nas" },
 	{ FR_CONF_OFFSET("sql_user_name", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, query_user), .dflt = "" },
 	{ FR_CONF_OFFSET("group_attribute", FR_TYPE_STRING, rlm_sql_config_t, group_attribute) },
 	{ FR_CONF_OFFSET("logfile", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, logfile) },
@@ -113,6 +149,8 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_POINTER("accounting", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) acct_config },
 
 	{ FR_CONF_POINTER("post-auth", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) postauth_config },
+
+	{ FR_CONF_POINTER("replicas", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) replica_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -180,11 +218,7 @@ static ssize_t sql_xlat(UNUSED TALLOC_CTX *ctx, char **out, UNUSED size_t outlen
 	sql_rcode_t		rcode;
 	ssize_t			ret = 0;
 	char const		*p;
-
-	handle = fr_pool_connection_get(inst->pool, request);	/* connection pool should produce error */
-	if (!handle) return 0;
-
-	rlm_sql_query_log(inst, request, NULL, fmt);
+	bool			write;
 
 	p = fmt;
 
@@ -195,11 +229,23 @@ static ssize_t sql_xlat(UNUSED TALLOC_CTX *ctx, char **out, UNUSED size_t outlen
 
 	/*
 	 *	If the query starts with any of the following prefixes,
-	 *	then return the number of rows affected
+	 *	then return the number of rows affected.  Anything
+	 *	else is a SELECT, and may be sent to a replica.
 	 */
-	if ((strncasecmp(p, "insert", 6) == 0) ||
-	    (strncasecmp(p, "update", 6) == 0) ||
-	    (strncasecmp(p, "delete", 6) == 0)) {
+	write = ((strncasecmp(p, "insert", 6) == 0) ||
+		 (strncasecmp(p, "update", 6) == 0) ||
+		 (strncasecmp(p, "delete", 6) == 0));
+
+	if (write) {
+		handle = fr_pool_connection_get(inst->pool, request);	/* connection pool should produce error */
+	} else {
+		handle = sql_read_handle_get(inst, request);
+	}
+	if (!handle) return 0;
+
+	rlm_sql_query_log(inst, request, NULL, fmt);
+
+	if (write) {
 		int numaffected;
 
 		rcode = rlm_sql_query(inst, request, &handle, fmt);
@@ -259,7 +305,7 @@ static ssize_t sql_xlat(UNUSED TALLOC_CTX *ctx, char **out, UNUSED size_t outlen
 	(inst->driver->sql_finish_select_query)(handle, inst->config);
 
 finish:
-	fr_pool_connection_release(inst->pool, request, handle);
+	sql_handle_release(inst, request, handle);
 
 	return ret;
 }
@@ -379,7 +425,7 @@ static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, request_
 	 */
 	sql_set_user(inst, request, NULL);
 
-	handle = fr_pool_connection_get(inst->pool, request);		/* connection pool should produce error */
+	handle = sql_read_handle_get(inst, request);		/* connection pool should produce error */
 	if (!handle) {
 		rcode = RLM_MODULE_FAIL;
 		goto finish;
@@ -491,7 +537,7 @@ static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, request_
 
 finish:
 	talloc_free(fields);
-	fr_pool_connection_release(inst->pool, request, handle);
+	sql_handle_release(inst, request, handle);
 
 	return rcode;
 }
@@ -505,9 +551,36 @@ static size_t sql_escape_func(UNUSED request_t *request, char *out, size_t outle
 	rlm_sql_handle_t	*handle = arg;
 	rlm_sql_t const		*inst = talloc_get_type_abort_const(handle->inst, rlm_sql_t);
 	size_t			len = 0;
+	static char const	hextab[] = "0123456789ABCDEF";
 
 	while (in[0]) {
-		size_t utf8_len;
+		size_t		utf8_len;
+		char		esc;
+		char const	*p;
+
+		/*
+		 *	Copy runs of allowed ASCII characters in one go.
+		 *	They're the common case, and are never escaped.
+		 *	The table never allows control characters.
+		 */
+		for (p = in; ((uint8_t) *p < 0x80) && inst->allowed_chars[(uint8_t) *p]; p++);
+		if (p > in) {
+			size_t run = p - in;
+
+			/*
+			 *	Leave room for the '\0'.
+			 */
+			if (outlen <= 1) break;
+			if (run >= outlen) run = outlen - 1;
+
+			memcpy(out, in, run);
+			in += run;
+			out += run;
+
+			outlen -= run;
+			len += run;
+			continue;
+		}
 
 		/*
 		 *	Allow all multi-byte UTF8 characters.
@@ -532,45 +605,39 @@ static size_t sql_escape_func(UNUSED request_t *request, char *out, size_t outle
 		 */
 		switch (in[0]) {
 		case '\n':
-			if (outlen <= 2) break;
-			out[0] = '\\';
-			out[1] = 'n';
-
-			in++;
-			out += 2;
-			outlen -= 2;
-			len += 2;
+			esc = 'n';
 			break;
 
 		case '\r':
-			if (outlen <= 2) break;
-			out[0] = '\\';
-			out[1] = 'r';
-
-			in++;
-			out += 2;
-			outlen -= 2;
-			len += 2;
+			esc = 'r';
 			break;
 
 		case '\t':
+			esc = 't';
+			break;
+
+		default:
+			esc = '\0';
+			break;
+		}
+
+		if (esc) {
 			if (outlen <= 2) break;
 			out[0] = '\\';
-			out[1] = 't';
+			out[1] = esc;
 
 			in++;
 			out += 2;
 			outlen -= 2;
 			len += 2;
-			break;
+			continue;
 		}
 
 		/*
 		 *	Non-printable characters get replaced with their
 		 *	mime-encoded equivalents.
 		 */
-		if ((in[0] < 32) ||
-		    strchr(inst->config->allowed_chars, *in) == NULL) {
+		if (!inst->allowed_chars[(uint8_t) in[0]]) {
 			/*
 			 *	Only 3 or less bytes available.
 			 */
@@ -578,7 +645,9 @@ static size_t sql_escape_func(UNUSED request_t *request, char *out, size_t outle
 				break;
 			}
 
-			snprintf(out, outlen, "=%02X", (unsigned char) in[0]);
+			out[0] = '=';
+			out[1] = hextab[((uint8_t) in[0]) >> 4];
+			out[2] = hextab[((uint8_t) in[0]) & 0x0f];
 			in++;
 			out += 3;
 			outlen -= 3;
@@ -623,7 +692,7 @@ static size_t sql_escape_for_xlat_func(request_t *request, char *out, size_t out
 		return 0;
 	}
 	ret = inst->sql_escape_func(request, out, outlen, in, handle);
-	fr_pool_connection_release(inst->pool, request, handle);
+	sql_handle_release(inst, request, handle);
 
 	return ret;
 }
@@ -763,7 +832,7 @@ static int sql_groupcmp(void *instance, request_t *request, UNUSED fr_pair_list_
 	/*
 	 *	Get a socket for this lookup
 	 */
-	handle = fr_pool_connection_get(inst->pool, request);
+	handle = sql_read_handle_get(inst, request);
 	if (!handle) {
 		return 1;
 	}
@@ -773,7 +842,7 @@ static int sql_groupcmp(void *instance, request_t *request, UNUSED fr_pair_list_
 	 */
 	if (sql_get_grouplist(inst, &handle, request, &head) < 0) {
 		REDEBUG("Error getting group membership");
-		fr_pool_connection_release(inst->pool, request, handle);
+		sql_handle_release(inst, request, handle);
 		return 1;
 	}
 
@@ -782,14 +851,14 @@ static int sql_groupcmp(void *instance, request_t *request, UNUSED fr_pair_list_
 			RDEBUG2("sql_groupcmp finished: User is a member of group %s",
 			       check->vp_strvalue);
 			talloc_free(head);
-			fr_pool_connection_release(inst->pool, request, handle);
+			sql_handle_release(inst, request, handle);
 			return 0;
 		}
 	}
 
 	/* Free the grouplist */
 	talloc_free(head);
-	fr_pool_connection_release(inst->pool, request, handle);
+	sql_handle_release(inst, request, handle);
 
 	RDEBUG2("sql_groupcmp finished: User is NOT a member of group %pV", &check->data);
 
@@ -969,6 +1038,14 @@ static int mod_detach(void *instance)
 
 	if (inst->pool) fr_pool_free(inst->pool);
 
+	if (inst->replicas) {
+		size_t i;
+
+		for (i = 0; i < talloc_array_length(inst->replicas); i++) {
+			if (inst->replicas[i].pool) fr_pool_free(inst->replicas[i].pool);
+		}
+	}
+
 	/*
 	 *	We need to explicitly free all children, so if the driver
 	 *	parented any memory off the instance, their destructors
@@ -1091,6 +1168,86 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 }
 
 
+/** Load all of the clients from the database on startup
+ *
+ * The query is run once, and the rows are streamed from the driver,
+ * so each client is added to the client trie as it is read.  The
+ * columns are:
+ *
+ *	id, nasname, shortname, type, secret, [server]
+ *
+ * @param[in] inst	rlm_sql configuration.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int sql_clients_load(rlm_sql_t *inst)
+{
+	rlm_sql_handle_t	*handle;
+	rlm_sql_row_t		row;
+	sql_rcode_t		ret;
+	int			rcode = 0;
+	unsigned int		count = 0;
+
+	DEBUG("Loading clients from the database");
+
+	handle = fr_pool_connection_get(inst->pool, NULL);
+	if (!handle) return -1;
+
+	if (rlm_sql_select_query(inst, NULL, &handle, inst->config->client_query) != RLM_SQL_OK) {
+		sql_handle_release(inst, NULL, handle);
+		return -1;
+	}
+
+	while ((ret = rlm_sql_fetch_row(&row, inst, NULL, &handle)) == RLM_SQL_OK) {
+		RADCLIENT	*c;
+		char const	*server = NULL;
+		int		num_fields;
+
+		num_fields = (inst->driver->sql_num_fields)(handle, inst->config);
+		if (num_fields < 5) {
+			ERROR("'client_query' must return at least 5 columns, got %d", num_fields);
+			rcode = -1;
+			break;
+		}
+
+		/*
+		 *	id, nasname and secret are required.
+		 */
+		if (!row[0] || !row[1] || !row[4]) {
+			WARN("Ignoring client with missing id, nasname, or secret");
+			continue;
+		}
+
+		if ((num_fields > 5) && row[5] && *row[5]) server = row[5];
+
+		c = client_afrom_query(NULL, row[1], row[4], row[2], row[3], server, false);
+		if (!c) {
+			PERROR("Failed creating client %s (id %s)", row[1], row[0]);
+			rcode = -1;
+			break;
+		}
+
+		if (!client_add(NULL, c)) {
+			ERROR("Failed adding client %s (id %s), possible duplicate?", row[1], row[0]);
+			client_free(c);
+			rcode = -1;
+			break;
+		}
+
+		DEBUG3("Client %s (id %s) added", c->longname, row[0]);
+		count++;
+	}
+	if (ret == RLM_SQL_ERROR) rcode = -1;
+
+	(inst->driver->sql_finish_select_query)(handle, inst->config);
+	sql_handle_release(inst, NULL, handle);
+
+	if (rcode == 0) INFO("Loaded %u clients from the database", count);
+
+	return rcode;
+}
+
 static int mod_instantiate(void *instance, CONF_SECTION *conf)
 {
 	rlm_sql_t *inst = instance;
@@ -1135,6 +1292,17 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->config->accounting.cs = cf_section_find(conf, "accounting", NULL);
 	inst->config->accounting.reference_cp = (cf_pair_find(inst->config->accounting.cs, "reference") != NULL);
 
+	/*
+	 *	Queries are logged as they're run, which needs the
+	 *	request to be running.  Batched requests aren't.
+	 */
+	if ((inst->config->accounting.batch_size > 1) &&
+	    ((inst->config->accounting.logfile && *inst->config->accounting.logfile) ||
+	     (!inst->config->accounting.logfile && inst->config->logfile && *inst->config->logfile))) {
+		cf_log_warn(inst->config->accounting.cs, "Ignoring 'batch_size' as 'logfile' is set");
+		inst->config->accounting.batch_size = 0;
+	}
+
 	inst->config->postauth.cs = cf_section_find(conf, "post-auth", NULL);
 	inst->config->postauth.reference_cp = (cf_pair_find(inst->config->postauth.cs, "reference") != NULL);
 
@@ -1151,6 +1319,7 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->sql_query			= rlm_sql_query;
 	inst->sql_select_query		= rlm_sql_select_query;
 	inst->sql_fetch_row		= rlm_sql_fetch_row;
+	inst->sql_release		= sql_handle_release;
 
 	/*
 	 *	Either use the module specific escape function
@@ -1160,6 +1329,20 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 				inst->driver->sql_escape_func :
 				sql_escape_func;
 
+	/*
+	 *	Build a lookup table of the safe characters, so the
+	 *	default escape function doesn't have to search the
+	 *	list for every character it escapes.  Control
+	 *	characters are always escaped.
+	 */
+	{
+		char const *p;
+
+		for (p = inst->config->allowed_chars; *p; p++) {
+			if ((uint8_t) *p >= 32) inst->allowed_chars[(uint8_t) *p] = true;
+		}
+	}
+
 	inst->ef = module_exfile_init(inst, conf, 256, 30, true, NULL, NULL);
 	if (!inst->ef) {
 		cf_log_err(conf, "Failed creating log file context");
@@ -1174,6 +1357,68 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->pool = module_connection_pool_init(inst->cs, inst, sql_mod_conn_create, NULL, NULL, NULL, NULL);
 	if (!inst->pool) return -1;
 
+	/*
+	 *	Replicas use the same pool configuration as
+	 *	the primary, but each gets its own pool.
+	 */
+	if (inst->config->replica_server) {
+		CONF_SECTION	*pool_cs = cf_section_find(inst->cs, "pool", NULL);
+		size_t		i, num = talloc_array_length(inst->config->replica_server);
+
+		MEM(inst->replicas = talloc_zero_array(inst, rlm_sql_replica_t, num));
+		for (i = 0; i < num; i++) {
+			rlm_sql_replica_t	*replica = &inst->replicas[i];
+			char			*log_prefix;
+
+			replica->inst = inst;
+			replica->config = *inst->config;
+			replica->config.sql_server = inst->config->replica_server[i];
+
+			INFO("Attempting to connect to replica \"%s\"", replica->config.sql_server);
+
+			log_prefix = talloc_typed_asprintf(inst, "rlm_sql (%s) - replica %s",
+							   inst->name, replica->config.sql_server);
+			replica->pool = fr_pool_init(inst, pool_cs, replica, sql_mod_replica_conn_create, NULL, log_prefix);
+			talloc_free(log_prefix);
+			if (!replica->pool) return -1;
+
+			if (fr_pool_start(replica->pool) < 0) {
+				cf_log_err(conf, "Starting initial connections to replica \"%s\" failed",
+					   replica->config.sql_server);
+				return -1;
+			}
+		}
+	}
+
+	if (inst->config->read_clients && (sql_clients_load(inst) < 0)) {
+		cf_log_err(conf, "Failed loading clients");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(thread, rlm_sql_thread_t);
+
+	t->inst = talloc_get_type_abort(instance, rlm_sql_t);
+	t->el = el;
+	fr_dlist_talloc_init(&t->batch, sql_acct_batch_t, entry);
+
+	return 0;
+}
+
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(thread, rlm_sql_thread_t);
+
+	/*
+	 *	Requests still in the batch outlive us, so make
+	 *	sure they don't try and remove themselves later.
+	 */
+	while (fr_dlist_pop_head(&t->batch));
+
 	return 0;
 }
 
@@ -1219,7 +1464,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	 *	After this point use goto error or goto release to cleanup socket temporary pairlists and
 	 *	temporary attributes.
 	 */
-	handle = fr_pool_connection_get(inst->pool, request);
+	handle = sql_read_handle_get(inst, request);
 	if (!handle) {
 		sql_unset_user(inst, request);
 		RETURN_MODULE_FAIL;
@@ -1241,7 +1486,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 			fr_pair_list_free(&reply_tmp);
 			sql_unset_user(inst, request);
 
-			fr_pool_connection_release(inst->pool, request, handle);
+			sql_handle_release(inst, request, handle);
 
 			RETURN_MODULE_RCODE(rcode);
 		}
@@ -1416,47 +1661,29 @@ skip_reply:
 release:
 	if (!user_found) rcode = RLM_MODULE_NOTFOUND;
 
-	fr_pool_connection_release(inst->pool, request, handle);
+	sql_handle_release(inst, request, handle);
 	sql_unset_user(inst, request);
 
 	RETURN_MODULE_RCODE(rcode);
 }
 
 /*
- *	Generic function for failing between a bunch of queries.
- *
- *	Uses the same principle as rlm_linelog, expanding the 'reference' config
- *	item using xlat to figure out what query it should execute.
- *
- *	If the reference matches multiple config items, and a query fails or
- *	doesn't update any rows, the next matching config item is used.
- *
+ *	Find the first query of the redundant set a section's
+ *	'reference' points to.
  */
-static unlang_action_t acct_redundant(rlm_rcode_t *p_result, rlm_sql_t const *inst, request_t *request, sql_acct_section_t *section)
+static rlm_rcode_t acct_redundant_pair(CONF_PAIR **out, request_t *request, sql_acct_section_t *section)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_OK;
-
-	rlm_sql_handle_t	*handle = NULL;
-	int			sql_ret;
-	int			numaffected = 0;
-
 	CONF_ITEM		*item;
-	CONF_PAIR 		*pair;
-	char const		*attr = NULL;
-	char const		*value;
 
 	char			path[FR_MAX_STRING_LEN];
 	char			*p = path;
-	char			*expanded = NULL;
 
 	fr_assert(section);
 
 	if (section->reference[0] != '.') *p++ = '.';
 
 	if (xlat_eval(p, sizeof(path) - (p - path), request, section->reference, NULL, NULL) < 0) {
-		rcode = RLM_MODULE_FAIL;
-
-		goto finish;
+		return RLM_MODULE_FAIL;
 	}
 
 	/*
@@ -1466,106 +1693,155 @@ static unlang_action_t acct_redundant(rlm_rcode_t *p_result, rlm_sql_t const *in
 	item = cf_reference_item(NULL, section->cs, path);
 	if (!item) {
 		RWDEBUG("No such configuration item %s", path);
-		rcode = RLM_MODULE_NOOP;
-
-		goto finish;
+		return RLM_MODULE_NOOP;
 	}
 	if (cf_item_is_section(item)){
 		RWDEBUG("Sections are not supported as references");
-		rcode = RLM_MODULE_NOOP;
-
-		goto finish;
+		return RLM_MODULE_NOOP;
 	}
 
-	pair = cf_item_to_pair(item);
-	attr = cf_pair_attr(pair);
+	*out = cf_item_to_pair(item);
 
-	RDEBUG2("Using query template '%s'", attr);
+	RDEBUG2("Using query template '%s'", cf_pair_attr(*out));
 
-	handle = fr_pool_connection_get(inst->pool, request);
-	if (!handle) {
-		rcode = RLM_MODULE_FAIL;
+	return RLM_MODULE_OK;
+}
 
-		goto finish;
+/*
+ *	Expand one query of a redundant set.
+ *
+ *	Returns RLM_MODULE_OK if there's a query to run, otherwise the
+ *	result the redundant set should finish with.
+ */
+static rlm_rcode_t acct_query_expand(char **out, rlm_sql_t const *inst, request_t *request,
+				     CONF_PAIR *pair, rlm_sql_handle_t *handle)
+{
+	char const *value;
+
+	value = cf_pair_value(pair);
+	if (!value) {
+		RDEBUG2("Ignoring null query");
+		return RLM_MODULE_NOOP;
 	}
 
-	sql_set_user(inst, request, NULL);
+	if (xlat_aeval(request, out, request, value, inst->sql_escape_func, handle) < 0) return RLM_MODULE_FAIL;
 
-	while (true) {
-		value = cf_pair_value(pair);
-		if (!value) {
-			RDEBUG2("Ignoring null query");
-			rcode = RLM_MODULE_NOOP;
+	if (!**out) {
+		RDEBUG2("Ignoring null query");
+		TALLOC_FREE(*out);
+		return RLM_MODULE_NOOP;
+	}
 
-			goto finish;
-		}
+	return RLM_MODULE_OK;
+}
 
-		if (xlat_aeval(request, &expanded, request, value, inst->sql_escape_func, handle) < 0) {
-			rcode = RLM_MODULE_FAIL;
+/*
+ *	Run one query of a redundant set.
+ *
+ *	Returns RLM_MODULE_OK if the query updated something,
+ *	RLM_MODULE_NOOP if the next query in the set should be tried,
+ *	or the result the redundant set should finish with.
+ *
+ *	If the handle is reconnected, *handle is updated.  If
+ *	reconnection fails, *handle is set to NULL.
+ */
+static rlm_rcode_t acct_query(rlm_sql_t const *inst, request_t *request, sql_acct_section_t *section,
+			      rlm_sql_handle_t **handle, char const *query)
+{
+	int	sql_ret;
+	int	numaffected = 0;
 
-			goto finish;
-		}
+	rlm_sql_query_log(inst, request, section, query);
 
-		if (!*expanded) {
-			RDEBUG2("Ignoring null query");
-			rcode = RLM_MODULE_NOOP;
+	sql_ret = rlm_sql_query(inst, request, handle, query);
+	RDEBUG2("SQL query returned: %s", fr_table_str_by_value(sql_rcode_description_table, sql_ret, "<INVALID>"));
 
-			goto finish;
-		}
+	switch (sql_ret) {
+	/*
+	 *  Query was a success! Now we just need to check if it did anything.
+	 */
+	case RLM_SQL_OK:
+		break;
 
-		rlm_sql_query_log(inst, request, section, expanded);
+	/*
+	 *  A general, unrecoverable server fault.
+	 */
+	case RLM_SQL_ERROR:
+	/*
+	 *  If we get RLM_SQL_RECONNECT it means all connections in the pool
+	 *  were exhausted, and we couldn't create a new connection,
+	 *  so we do not need to call fr_pool_connection_release.
+	 */
+	case RLM_SQL_RECONNECT:
+		return RLM_MODULE_FAIL;
 
-		sql_ret = rlm_sql_query(inst, request, &handle, expanded);
-		TALLOC_FREE(expanded);
-		RDEBUG2("SQL query returned: %s", fr_table_str_by_value(sql_rcode_description_table, sql_ret, "<INVALID>"));
+	/*
+	 *  Query was invalid, this is a terminal error, but we still need
+	 *  to do cleanup, as the connection handle is still valid.
+	 */
+	case RLM_SQL_QUERY_INVALID:
+		return RLM_MODULE_INVALID;
 
-		switch (sql_ret) {
-		/*
-		 *  Query was a success! Now we just need to check if it did anything.
-		 */
-		case RLM_SQL_OK:
-			break;
+	/*
+	 *  Driver found an error (like a unique key constraint violation)
+	 *  that hinted it might be a good idea to try an alternative query.
+	 */
+	case RLM_SQL_ALT_QUERY:
+		return RLM_MODULE_NOOP;
+	}
+	fr_assert(*handle);
 
-		/*
-		 *  A general, unrecoverable server fault.
-		 */
-		case RLM_SQL_ERROR:
-		/*
-		 *  If we get RLM_SQL_RECONNECT it means all connections in the pool
-		 *  were exhausted, and we couldn't create a new connection,
-		 *  so we do not need to call fr_pool_connection_release.
-		 */
-		case RLM_SQL_RECONNECT:
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
+	/*
+	 *  We need to have updated something for the query to have been
+	 *  counted as successful.
+	 */
+	numaffected = (inst->driver->sql_affected_rows)(*handle, inst->config);
+	(inst->driver->sql_finish_query)(*handle, inst->config);
+	RDEBUG2("%i record(s) updated", numaffected);
 
-		/*
-		 *  Query was invalid, this is a terminal error, but we still need
-		 *  to do cleanup, as the connection handle is still valid.
-		 */
-		case RLM_SQL_QUERY_INVALID:
-			rcode = RLM_MODULE_INVALID;
-			goto finish;
+	if (numaffected > 0) return RLM_MODULE_OK;	/* A query succeeded, were done! */
 
-		/*
-		 *  Driver found an error (like a unique key constraint violation)
-		 *  that hinted it might be a good idea to try an alternative query.
-		 */
-		case RLM_SQL_ALT_QUERY:
-			goto next;
-		}
-		fr_assert(handle);
+	return RLM_MODULE_NOOP;
+}
 
-		/*
-		 *  We need to have updated something for the query to have been
-		 *  counted as successful.
-		 */
-		numaffected = (inst->driver->sql_affected_rows)(handle, inst->config);
-		(inst->driver->sql_finish_query)(handle, inst->config);
-		RDEBUG2("%i record(s) updated", numaffected);
+/*
+ *	Generic function for failing between a bunch of queries.
+ *
+ *	Uses the same principle as rlm_linelog, expanding the 'reference' config
+ *	item using xlat to figure out what query it should execute.
+ *
+ *	If the reference matches multiple config items, and a query fails or
+ *	doesn't update any rows, the next matching config item is used.
+ *
+ */
+static unlang_action_t acct_redundant(rlm_rcode_t *p_result, rlm_sql_t const *inst, request_t *request, sql_acct_section_t *section)
+{
+	rlm_rcode_t		rcode;
+
+	rlm_sql_handle_t	*handle = NULL;
+
+	CONF_PAIR 		*pair;
+	char const		*attr = NULL;
+	char			*expanded = NULL;
+
+	rcode = acct_redundant_pair(&pair, request, section);
+	if (rcode != RLM_MODULE_OK) RETURN_MODULE_RCODE(rcode);
+
+	attr = cf_pair_attr(pair);
+
+	handle = fr_pool_connection_get(inst->pool, request);
+	if (!handle) RETURN_MODULE_FAIL;
+
+	sql_set_user(inst, request, NULL);
+
+	while (true) {
+		rcode = acct_query_expand(&expanded, inst, request, pair, handle);
+		if (rcode != RLM_MODULE_OK) goto finish;
+
+		rcode = acct_query(inst, request, section, &handle, expanded);
+		TALLOC_FREE(expanded);
+		if (rcode != RLM_MODULE_NOOP) goto finish;
 
-		if (numaffected > 0) break;	/* A query succeeded, were done! */
-	next:
 		/*
 		 *  We assume all entries with the same name form a redundant
 		 *  set of queries.
@@ -1583,13 +1859,259 @@ static unlang_action_t acct_redundant(rlm_rcode_t *p_result, rlm_sql_t const *in
 	}
 
 finish:
-	talloc_free(expanded);
-	fr_pool_connection_release(inst->pool, request, handle);
+	sql_handle_release(inst, request, handle);
 	sql_unset_user(inst, request);
 
 	RETURN_MODULE_RCODE(rcode);
 }
 
+/*
+ *	Run the queries of a request in the accounting batch, in the
+ *	same way as acct_redundant().
+ */
+static rlm_rcode_t acct_batch_query(rlm_sql_t const *inst, sql_acct_section_t *section,
+				    sql_acct_batch_t *batch, rlm_sql_handle_t **handle)
+{
+	request_t	*request = batch->request;
+	size_t		i, len = talloc_array_length(batch->query);
+	rlm_rcode_t	rcode;
+
+	for (i = 0; i < len; i++) {
+		if (i > 0) RDEBUG2("Trying next query...");
+
+		rcode = acct_query(inst, request, section, handle, batch->query[i]);
+		if (rcode != RLM_MODULE_NOOP) return rcode;
+	}
+
+	if (batch->last == RLM_MODULE_NOOP) RDEBUG2("No additional queries configured");
+
+	return batch->last;
+}
+
+/*
+ *	Run one of the statements delimiting an accounting batch.
+ */
+static bool acct_batch_statement(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle,
+				 char const *statement)
+{
+	if (rlm_sql_query(inst, request, handle, statement) != RLM_SQL_OK) return false;
+
+	(inst->driver->sql_finish_query)(*handle, inst->config);
+
+	return true;
+}
+
+/*
+ *	Write all of the accounting requests in this thread's batch.
+ *
+ *	The queries for all requests are run in one transaction, so
+ *	the database only has to commit once for the whole batch.  If
+ *	anything goes wrong the transaction is rolled back, and the
+ *	requests which weren't written are retried one at a time, in
+ *	exactly the same way as when batching is disabled.  Either way
+ *	each request gets the result of its own queries.
+ *
+ *	All of the requests, other than 'current' are then marked
+ *	runnable.
+ */
+static void acct_batch_flush(rlm_sql_thread_t *t, request_t *current)
+{
+	rlm_sql_t const		*inst = t->inst;
+	sql_acct_section_t	*section = &inst->config->accounting;
+	sql_acct_batch_t	*batch;
+	rlm_sql_handle_t	*handle, *begun;
+	request_t		*request;
+	bool			committed = false;
+
+	if (t->ev) (void) fr_event_timer_delete(&t->ev);
+
+	batch = fr_dlist_head(&t->batch);
+	if (!batch) return;
+
+	request = batch->request;
+
+	handle = fr_pool_connection_get(inst->pool, request);
+	if (!handle) goto resume;
+
+	if ((fr_dlist_num_elements(&t->batch) > 1) && acct_batch_statement(inst, request, &handle, "BEGIN")) {
+		RDEBUG2("Writing %u accounting requests in one transaction", fr_dlist_num_elements(&t->batch));
+
+		begun = handle;
+
+		for (batch = fr_dlist_head(&t->batch); batch; batch = fr_dlist_next(&t->batch, batch)) {
+			batch->rcode = acct_batch_query(inst, section, batch, &handle);
+
+			/*
+			 *	The connection was re-opened, so the
+			 *	transaction has gone along with it.  The
+			 *	last query was run outside of the
+			 *	transaction, so its result stands.
+			 */
+			if (handle != begun) {
+				if (handle) batch->done = true;
+				break;
+			}
+
+			if ((batch->rcode == RLM_MODULE_FAIL) || (batch->rcode == RLM_MODULE_INVALID)) break;
+		}
+
+		if (!batch && acct_batch_statement(inst, request, &handle, "COMMIT") && (handle == begun)) {
+			committed = true;
+		} else if (handle == begun) {
+			RWDEBUG("Accounting batch failed, retrying requests individually");
+			(void) acct_batch_statement(inst, request, &handle, "ROLLBACK");
+		}
+	}
+
+	/*
+	 *	Anything which wasn't written as part of a transaction
+	 *	is written one request at a time.
+	 */
+	if (!committed) {
+		for (batch = fr_dlist_head(&t->batch); batch && handle; batch = fr_dlist_next(&t->batch, batch)) {
+			if (batch->done) continue;
+
+			batch->rcode = acct_batch_query(inst, section, batch, &handle);
+			batch->done = true;
+		}
+	}
+
+	sql_handle_release(inst, request, handle);
+
+resume:
+	while ((batch = fr_dlist_pop_head(&t->batch))) {
+		if (!committed && !batch->done) batch->rcode = RLM_MODULE_FAIL;
+		if (batch->request != current) unlang_interpret_mark_runnable(batch->request);
+	}
+}
+
+static void _acct_batch_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(uctx, rlm_sql_thread_t);
+
+	acct_batch_flush(t, NULL);
+}
+
+static unlang_action_t acct_batch_resume(rlm_rcode_t *p_result, UNUSED module_ctx_t const *mctx,
+					 UNUSED request_t *request, void *rctx)
+{
+	sql_acct_batch_t	*batch = talloc_get_type_abort(rctx, sql_acct_batch_t);
+	rlm_rcode_t		rcode = batch->rcode;
+
+	talloc_free(batch);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+static void acct_batch_signal(UNUSED module_ctx_t const *mctx, request_t *request, void *rctx,
+			      fr_state_signal_t action)
+{
+	sql_acct_batch_t	*batch = talloc_get_type_abort(rctx, sql_acct_batch_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	RDEBUG2("Removing request from accounting batch");
+
+	talloc_free(batch);
+}
+
+/*
+ *	Remove a request from the batch if it's freed before the
+ *	batch is written.
+ */
+static int _acct_batch_free(sql_acct_batch_t *batch)
+{
+	rlm_sql_thread_t *t = batch->t;
+
+	if (!fr_dlist_entry_in_list(&batch->entry)) return 0;
+
+	fr_dlist_remove(&t->batch, batch);
+	if (fr_dlist_empty(&t->batch) && t->ev) (void) fr_event_timer_delete(&t->ev);
+
+	return 0;
+}
+
+/*
+ *	Add a request to this thread's accounting batch, and yield
+ *	until the batch has been written.
+ *
+ *	The queries are expanded now, as xlats can't be evaluated
+ *	for the request once it has yielded.
+ */
+static unlang_action_t acct_batch(rlm_rcode_t *p_result, rlm_sql_t const *inst, rlm_sql_thread_t *t,
+				  request_t *request, sql_acct_section_t *section)
+{
+	rlm_rcode_t		rcode;
+	rlm_sql_handle_t	*handle;
+	sql_acct_batch_t	*batch;
+	CONF_PAIR		*pair;
+	char const		*attr;
+	char			*expanded;
+	size_t			len = 0;
+
+	rcode = acct_redundant_pair(&pair, request, section);
+	if (rcode != RLM_MODULE_OK) RETURN_MODULE_RCODE(rcode);
+
+	attr = cf_pair_attr(pair);
+
+	/*
+	 *	The handle is only used to escape values.
+	 */
+	handle = fr_pool_connection_get(inst->pool, request);
+	if (!handle) RETURN_MODULE_FAIL;
+
+	MEM(batch = talloc_zero(request, sql_acct_batch_t));
+	MEM(batch->query = talloc_array(batch, char *, 0));
+	batch->t = t;
+	batch->request = request;
+	talloc_set_destructor(batch, _acct_batch_free);
+
+	sql_set_user(inst, request, NULL);
+
+	do {
+		batch->last = acct_query_expand(&expanded, inst, request, pair, handle);
+		if (batch->last != RLM_MODULE_OK) break;
+
+		MEM(batch->query = talloc_realloc(batch, batch->query, char *, len + 1));
+		batch->query[len++] = talloc_steal(batch->query, expanded);
+
+		batch->last = RLM_MODULE_NOOP;
+	} while ((pair = cf_pair_find_next(section->cs, pair, attr)));
+
+	sql_unset_user(inst, request);
+	sql_handle_release(inst, request, handle);
+
+	/*
+	 *	Nothing to write
+	 */
+	if (len == 0) {
+		rcode = batch->last;
+		talloc_free(batch);
+
+		RETURN_MODULE_RCODE(rcode);
+	}
+
+	fr_dlist_insert_tail(&t->batch, batch);
+
+	/*
+	 *	Batch is full, or we can't wait for any more
+	 *	requests.  Write it now.
+	 */
+	if ((fr_dlist_num_elements(&t->batch) >= section->batch_size) ||
+	    (!t->ev && (fr_event_timer_in(t, t->el, &t->ev, section->batch_timeout, _acct_batch_timeout, t) < 0))) {
+		acct_batch_flush(t, request);
+
+		rcode = batch->rcode;
+		talloc_free(batch);
+
+		RETURN_MODULE_RCODE(rcode);
+	}
+
+	RDEBUG2("Waiting for accounting batch to be written");
+
+	return unlang_module_yield(request, acct_batch_resume, acct_batch_signal, batch);
+}
+
 /*
  *	Accounting: Insert or update session data in our sql table
  */
@@ -1598,6 +2120,11 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 	rlm_sql_t const *inst = talloc_get_type_abort_const(mctx->instance, rlm_sql_t);
 
 	if (inst->config->accounting.reference_cp) {
+		if (inst->config->accounting.batch_size > 1) {
+			return acct_batch(p_result, inst, talloc_get_type_abort(mctx->thread, rlm_sql_thread_t),
+					  request, &inst->config->accounting);
+		}
+
 		return acct_redundant(p_result, inst, request, &inst->config->accounting);
 	}
 
@@ -1633,6 +2160,10 @@ module_t rlm_sql = {
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
+	.thread_inst_size	= sizeof(rlm_sql_thread_t),
+	.thread_inst_type	= "rlm_sql_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 		[MOD_ACCOUNTING]	= mod_accounting,
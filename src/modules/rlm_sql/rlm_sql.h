@@ -32,6 +32,12 @@ RCSIDH(rlm_sql_h, "$Id$")
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/exfile.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 #define FR_ITEM_CHECK 0
 #define FR_ITEM_REPLY 1
 
@@ -82,6 +88,11 @@ typedef struct {
 
 	char const		*logfile;
 
+	uint32_t		batch_size;			//!< Maximum number of requests to write
+								///< in one transaction.
+	fr_time_delta_t		batch_timeout;			//!< Maximum time a request waits for
+								///< its batch to be written.
+
 	char const		**query;			/* for xlat parsing */
 } sql_acct_section_t;
 
@@ -115,6 +126,9 @@ typedef struct {
 								//!< If false, Fall-Through = yes is required
 								//!< in the previous reply list to process
 								//!< profiles.
+	bool			read_clients;			//!< Load clients from the database on startup.
+	char const		*client_query;			//!< Query used to load clients.
+
 	char const		*logfile;			//!< Keep a log of all SQL queries executed
 								//!< Useful for batch insertion with the
 								//!< NULL drivers.
@@ -125,6 +139,12 @@ typedef struct {
 	char const		*connect_query;			//!< Query executed after establishing
 								//!< new connection.
 
+	char const		**replica_server;		//!< Read replicas to send read only queries to.
+	char const		*replica_lag_query;		//!< Query returning how many seconds a replica
+								//!< is behind the primary.
+	uint32_t		replica_max_lag;		//!< Replicas further behind than this aren't used.
+	fr_time_delta_t		replica_check_interval;		//!< How often to run the lag query.
+
 	void			*driver;			//!< Where drivers should write a
 								//!< pointer to their configurations.
 
@@ -142,10 +162,26 @@ typedef struct {
 
 typedef struct sql_inst rlm_sql_t;
 
+/** A read replica, and the pool of connections to it
+ *
+ */
+typedef struct {
+	rlm_sql_t const		*inst;				//!< The rlm_sql instance this replica belongs to.
+	rlm_sql_config_t	config;				//!< Copy of the instance's configuration, with
+								//!< the server changed to the replica's.
+	fr_pool_t		*pool;				//!< Connections to the replica.
+
+	atomic_bool		lagging;			//!< Replica is too far behind the primary,
+								///< or its lag couldn't be determined.
+	atomic_int_fast64_t	next_check;			//!< When the lag query should next be run.
+} rlm_sql_replica_t;
+
 typedef struct {
 	void			*conn;				//!< Database specific connection handle.
 	rlm_sql_row_t		row;				//!< Row data from the last query.
 	rlm_sql_t const		*inst;				//!< The rlm_sql instance this connection belongs to.
+	rlm_sql_replica_t	*replica;			//!< Replica this connection is to.
+								///< NULL if connected to the primary.
 	TALLOC_CTX		*log_ctx;			//!< Talloc pool used to avoid allocing memory
 								//!< when log strings need to be copied.
 } rlm_sql_handle_t;
@@ -209,6 +245,8 @@ typedef struct {
 
 	sql_rcode_t (*sql_finish_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 	sql_rcode_t (*sql_finish_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+	sql_rcode_t (*sql_release)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);	//!< Optional, before the
+											///< pool gets it back.
 
 	xlat_escape_legacy_t	sql_escape_func;
 } rlm_sql_driver_t;
@@ -216,6 +254,7 @@ typedef struct {
 struct sql_inst {
 	rlm_sql_config_t	myconfig; /* HACK */
 	fr_pool_t		*pool;
+	rlm_sql_replica_t	*replicas;		//!< Read replicas, if any are configured.
 	rlm_sql_config_t	*config;
 	CONF_SECTION		*cs;
 
@@ -226,11 +265,15 @@ struct sql_inst {
 	dl_module_inst_t		*driver_inst;		//!< Driver's instance data.
 	rlm_sql_driver_t const	*driver;		//!< Driver's exported interface.
 
+	bool			allowed_chars[UINT8_MAX + 1];	//!< Characters which don't need escaping
+							//!< by the default escape function.
+
 	int (*sql_set_user)(rlm_sql_t const *inst, request_t *request, char const *username);
 	xlat_escape_legacy_t sql_escape_func;
 	sql_rcode_t (*sql_query)(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle, char const *query);
 	sql_rcode_t (*sql_select_query)(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle, char const *query);
 	sql_rcode_t (*sql_fetch_row)(rlm_sql_row_t *out, rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle);
+	void (*sql_release)(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t *handle);
 
 	char const		*name;			//!< Module instance name.
 	fr_dict_attr_t const	*group_da;		//!< Group dictionary attribute.
@@ -243,6 +286,9 @@ struct rlm_sql_grouplist_s {
 };
 
 void		*sql_mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t timeout);
+void		*sql_mod_replica_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t timeout);
+rlm_sql_handle_t *sql_read_handle_get(rlm_sql_t const *inst, request_t *request);
+void		sql_handle_release(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t *handle);
 int		sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle, fr_pair_list_t *out, char const *query);
 void 		rlm_sql_query_log(rlm_sql_t const *inst, request_t *request, sql_acct_section_t *section, char const *query) CC_HINT(nonnull (1, 2, 4));
 sql_rcode_t	rlm_sql_select_query(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle, char const *query) CC_HINT(nonnull (1, 3, 4));
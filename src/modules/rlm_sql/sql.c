@@ -63,10 +63,10 @@ fr_table_num_sorted_t const sql_rcode_table[] = {
 };
 size_t sql_rcode_table_len = NUM_ELEMENTS(sql_rcode_table);
 
-void *sql_mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t timeout)
+static void *sql_conn_create(TALLOC_CTX *ctx, rlm_sql_t *inst, rlm_sql_replica_t *replica,
+			     rlm_sql_config_t *config, fr_time_delta_t timeout)
 {
 	int rcode;
-	rlm_sql_t *inst = instance;
 	rlm_sql_handle_t *handle;
 
 	/*
@@ -87,8 +87,9 @@ void *sql_mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t timeo
 	 *	destructor has access to the module configuration.
 	 */
 	handle->inst = inst;
+	handle->replica = replica;
 
-	rcode = (inst->driver->sql_socket_init)(handle, inst->config, timeout);
+	rcode = (inst->driver->sql_socket_init)(handle, config, timeout);
 	if (rcode != 0) {
 	fail:
 		/*
@@ -106,6 +107,150 @@ void *sql_mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t timeo
 	return handle;
 }
 
+void *sql_mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t timeout)
+{
+	rlm_sql_t *inst = instance;
+
+	return sql_conn_create(ctx, inst, NULL, inst->config, timeout);
+}
+
+/** Create a connection to a read replica
+ *
+ * Only the connection parameters differ from the primary.  Queries are
+ * still run with the instance's configuration.
+ */
+void *sql_mod_replica_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t timeout)
+{
+	rlm_sql_replica_t *replica = instance;
+
+	return sql_conn_create(ctx, UNCONST(rlm_sql_t *, replica->inst), replica, &replica->config, timeout);
+}
+
+/** Return the pool a connection handle belongs to
+ *
+ */
+static inline fr_pool_t *sql_handle_pool(rlm_sql_t const *inst, rlm_sql_handle_t const *handle)
+{
+	return handle->replica ? handle->replica->pool : inst->pool;
+}
+
+/** Check how far behind the primary a replica is
+ *
+ * Replicas are marked as lagging if the lag query fails, returns no
+ * rows, or returns NULL (usually meaning replication has stopped).
+ */
+static void sql_replica_check(rlm_sql_t const *inst, rlm_sql_replica_t *replica)
+{
+	rlm_sql_handle_t	*handle;
+	rlm_sql_row_t		row;
+	bool			lagging = true;
+
+	handle = fr_pool_connection_get(replica->pool, NULL);
+	if (!handle) goto done;
+
+	if (rlm_sql_select_query(inst, NULL, &handle, inst->config->replica_lag_query) != RLM_SQL_OK) goto release;
+
+	if ((rlm_sql_fetch_row(&row, inst, NULL, &handle) == RLM_SQL_OK) && row[0]) {
+		unsigned long lag = strtoul(row[0], NULL, 10);
+
+		lagging = (lag > inst->config->replica_max_lag);
+		if (lagging) WARN("Replica %s is %lu seconds behind the primary, not using it",
+				  replica->config.sql_server, lag);
+	} else {
+		WARN("Failed determining replication lag of replica %s, not using it", replica->config.sql_server);
+	}
+
+	if (handle) (inst->driver->sql_finish_select_query)(handle, inst->config);
+
+release:
+	if (handle) fr_pool_connection_release(replica->pool, NULL, handle);
+
+done:
+	if (!lagging && atomic_load_explicit(&replica->lagging, memory_order_relaxed)) {
+		INFO("Replica %s has caught up, using it again", replica->config.sql_server);
+	}
+	atomic_store_explicit(&replica->lagging, lagging, memory_order_relaxed);
+}
+
+/** Reserve a connection for running read only queries
+ *
+ * If read replicas are configured, the replica with the fewest connections
+ * in use is chosen from those which aren't lagging.  If there are no
+ * replicas, or none of them are usable, a connection to the primary is
+ * returned.
+ *
+ * @param[in] inst	of rlm_sql.
+ * @param[in] request	The current request.
+ * @return
+ *	- A connection handle.  Must be released with #sql_handle_release.
+ *	- NULL if no connections are available.
+ */
+rlm_sql_handle_t *sql_read_handle_get(rlm_sql_t const *inst, request_t *request)
+{
+	rlm_sql_replica_t	*best = NULL;
+	uint32_t		best_active = 0;
+	fr_time_t		now;
+	size_t			i, num;
+	rlm_sql_handle_t	*handle;
+
+	num = talloc_array_length(inst->replicas);
+	if (!num) return fr_pool_connection_get(inst->pool, request);
+
+	now = fr_time();
+	for (i = 0; i < num; i++) {
+		rlm_sql_replica_t	*replica = &inst->replicas[i];
+		uint32_t		active;
+
+		/*
+		 *	Only one thread runs the lag query,
+		 *	the others use the last result.
+		 */
+		if (inst->config->replica_lag_query) {
+			int_fast64_t next = atomic_load_explicit(&replica->next_check, memory_order_relaxed);
+
+			if ((now >= next) &&
+			    atomic_compare_exchange_strong(&replica->next_check, &next,
+							   now + inst->config->replica_check_interval)) {
+				sql_replica_check(inst, replica);
+			}
+		}
+
+		if (atomic_load_explicit(&replica->lagging, memory_order_relaxed)) continue;
+
+		active = fr_pool_state(replica->pool)->active;
+		if (!best || (active < best_active)) {
+			best = replica;
+			best_active = active;
+		}
+	}
+
+	if (best) {
+		handle = fr_pool_connection_get(best->pool, request);
+		if (handle) {
+			ROPTIONAL(RDEBUG3, DEBUG3, "Using replica %s", best->config.sql_server);
+			return handle;
+		}
+		ROPTIONAL(RWDEBUG, WARN, "No connections available to replica %s, using primary",
+			  best->config.sql_server);
+	}
+
+	return fr_pool_connection_get(inst->pool, request);
+}
+
+/** Release a connection reserved with #sql_read_handle_get or fr_pool_connection_get
+ *
+ * The driver gets a chance to clean up first, e.g. to roll back a
+ * transaction the caller didn't finish.
+ */
+void sql_handle_release(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t *handle)
+{
+	if (!handle) return;
+
+	if (inst->driver->sql_release) (void) (inst->driver->sql_release)(handle, inst->config);
+
+	fr_pool_connection_release(sql_handle_pool(inst, handle), request, handle);
+}
+
 /*************************************************************************
  *
  *	Function: sql_pair_afrom_row
@@ -412,6 +557,7 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, request_t *request, rlm_sql_han
 {
 	int ret = RLM_SQL_ERROR;
 	int i, count;
+	fr_pool_t *pool;
 
 	/* Caller should check they have a valid handle */
 	fr_assert(*handle);
@@ -423,9 +569,10 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, request_t *request, rlm_sql_han
 	}
 
 	/*
-	 *  inst->pool may be NULL is this function is called by sql_mod_conn_create.
+	 *  The pool may be NULL if this function is called by sql_mod_conn_create.
 	 */
-	count = inst->pool ? fr_pool_state(inst->pool)->num : 0;
+	pool = sql_handle_pool(inst, *handle);
+	count = pool ? fr_pool_state(pool)->num : 0;
 
 	/*
 	 *  Here we try with each of the existing connections, then try to create
@@ -444,7 +591,7 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, request_t *request, rlm_sql_han
 		 *	sockets in the pool and fail to establish a *new* connection.
 		 */
 		case RLM_SQL_RECONNECT:
-			*handle = fr_pool_connection_reconnect(inst->pool, request, *handle);
+			*handle = fr_pool_connection_reconnect(pool, request, *handle);
 			/* Reconnection failed */
 			if (!*handle) return RLM_SQL_RECONNECT;
 			/* Reconnection succeeded, try again with the new handle */
@@ -513,6 +660,7 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, request_t *request, rlm_
 {
 	int ret = RLM_SQL_ERROR;
 	int i, count;
+	fr_pool_t *pool;
 
 	/* Caller should check they have a valid handle */
 	fr_assert(*handle);
@@ -525,9 +673,10 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, request_t *request, rlm_
 	}
 
 	/*
-	 *  inst->pool may be NULL is this function is called by sql_mod_conn_create.
+	 *  The pool may be NULL if this function is called by sql_mod_conn_create.
 	 */
-	count = inst->pool ? fr_pool_state(inst->pool)->num : 0;
+	pool = sql_handle_pool(inst, *handle);
+	count = pool ? fr_pool_state(pool)->num : 0;
 
 	/*
 	 *  For sanity, for when no connections are viable, and we can't make a new one
@@ -545,7 +694,7 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, request_t *request, rlm_
 		 *	sockets in the pool and fail to establish a *new* connection.
 		 */
 		case RLM_SQL_RECONNECT:
-			*handle = fr_pool_connection_reconnect(inst->pool, request, *handle);
+			*handle = fr_pool_connection_reconnect(pool, request, *handle);
 			/* Reconnection failed */
 			if (!*handle) return RLM_SQL_RECONNECT;
 			/* Reconnection succeeded, try again with the new handle */
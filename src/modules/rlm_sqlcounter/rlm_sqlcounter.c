@@ -29,8 +29,10 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/radius/radius.h>
 
 #include <ctype.h>
+#include <pthread.h>
 
 #define MAX_QUERY_LEN 1024
 
@@ -52,6 +54,42 @@ RCSID("$Id$")
  *	Reset Time.
  */
 
+/** Counters which have recently been read from SQL
+ *
+ * Accounting packets add to the cached counters, so that most
+ * Access-Requests don't need to run the query.  A counter is read from
+ * SQL again once its lifetime is up, which corrects any drift.  All
+ * counters have the same lifetime, so the list is in expiry order.
+ */
+typedef struct {
+	fr_time_delta_t	lifetime;		//!< How long a counter is used before it's read
+						//!< from SQL again.  0 disables the cache.
+	uint32_t	max_entries;		//!< Maximum number of cached counters.
+
+	tmpl_t		*session;		//!< Identifies the session an accounting packet is for.
+	tmpl_t		*value;			//!< The session's contribution to the counter.
+
+	pthread_mutex_t	mutex;			//!< Counters are shared by all workers.
+	fr_hash_table_t	*counters;		//!< Indexed by key.
+	fr_dlist_head_t	expires;		//!< Oldest counter first.
+} rlm_sqlcounter_cache_t;
+
+typedef struct {
+	char const	*key;			//!< Expanded key.
+	uint64_t	counter;		//!< Current value of the counter.
+
+	fr_time_t	expires;		//!< When the counter is read from SQL again.
+	fr_dlist_t	entry;			//!< In the expiry list.
+
+	fr_dlist_head_t	sessions;		//!< Sessions we've seen accounting packets for.
+} sqlcounter_entry_t;
+
+typedef struct {
+	char const	*id;			//!< Expanded session identifier.
+	uint64_t	value;			//!< Last value we saw for the session.
+	fr_dlist_t	entry;			//!< In the counter's list of sessions.
+} sqlcounter_session_t;
+
 /*
  *	Define a structure for our module configuration.
  *
@@ -71,8 +109,20 @@ typedef struct {
 
 	fr_time_t	reset_time;
 	fr_time_t	last_reset;
+
+	rlm_sqlcounter_cache_t	cache;
 } rlm_sqlcounter_t;
 
+static const CONF_PARSER cache_config[] = {
+	{ FR_CONF_OFFSET("lifetime", FR_TYPE_TIME_DELTA, rlm_sqlcounter_cache_t, lifetime), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_sqlcounter_cache_t, max_entries), .dflt = "65536" },
+
+	{ FR_CONF_OFFSET("session", FR_TYPE_TMPL, rlm_sqlcounter_cache_t, session), .dflt = "%{Acct-Unique-Session-Id}", .quote = T_DOUBLE_QUOTED_STRING },
+	{ FR_CONF_OFFSET("value", FR_TYPE_TMPL | FR_TYPE_ATTRIBUTE, rlm_sqlcounter_cache_t, value), .dflt = "&Acct-Session-Time", .quote = T_BARE_WORD },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("sql_module_instance", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_sqlcounter_t, sqlmod_inst) },
 
@@ -88,6 +138,9 @@ static const CONF_PARSER module_config[] = {
 
 	/* Attribute to write remaining session to */
 	{ FR_CONF_OFFSET("reply_name", FR_TYPE_TMPL | FR_TYPE_ATTRIBUTE, rlm_sqlcounter_t, reply_attr) },
+
+	{ FR_CONF_POINTER("cache", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) cache_config,
+	  .offset = offsetof(rlm_sqlcounter_t, cache), },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -101,11 +154,13 @@ fr_dict_autoload_t rlm_sqlcounter_dict[] = {
 	{ NULL }
 };
 
+static fr_dict_attr_t const *attr_acct_status_type;
 static fr_dict_attr_t const *attr_reply_message;
 static fr_dict_attr_t const *attr_session_timeout;
 
 extern fr_dict_attr_autoload_t rlm_sqlcounter_dict_attr[];
 fr_dict_attr_autoload_t rlm_sqlcounter_dict_attr[] = {
+	{ .out = &attr_acct_status_type, .name = "Acct-Status-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ .out = &attr_reply_message, .name = "Reply-Message", .type = FR_TYPE_STRING, .dict = &dict_radius },
 	{ .out = &attr_session_timeout, .name = "Session-Timeout", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ NULL }
@@ -169,7 +224,7 @@ static int find_next_reset(rlm_sqlcounter_t *inst, time_t timeval)
 		return -1;
 	}
 
-	inst->reset_time = fr_time_from_sec(date);
+	inst->reset_time = date;
 
 	len = strftime(sNextTime, sizeof(sNextTime),"%Y-%m-%d %H:%M:%S",tm);
 	if (len == 0) *sNextTime = '\0';
@@ -337,14 +392,17 @@ static ssize_t sqlcounter_expand(char *out, int outlen, rlm_sqlcounter_t const *
 }
 
 
-/*
- *	See if the counter matches.
+/** Run the query to get the current value of the counter
+ *
+ * @param[out] counter	The value of the counter.
+ * @param[in] inst	of rlm_sqlcounter.
+ * @param[in] request	The current request.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
  */
-static int counter_cmp(void *instance, request_t *request, UNUSED fr_pair_list_t *request_list , fr_pair_t const *check)
+static int sqlcounter_query(uint64_t *counter, rlm_sqlcounter_t const *inst, request_t *request)
 {
-	rlm_sqlcounter_t const *inst = talloc_get_type_abort_const(instance, rlm_sqlcounter_t);
-	uint64_t counter;
-
 	char query[MAX_QUERY_LEN], subst[MAX_QUERY_LEN];
 	char *expanded = NULL;
 	size_t len;
@@ -358,7 +416,7 @@ static int counter_cmp(void *instance, request_t *request, UNUSED fr_pair_list_t
 
 	/* Then combine that with the name of the module were using to do the query */
 	len = snprintf(query, sizeof(query), "%%{%s:%s}", inst->sqlmod_inst, subst);
-	if (len >= sizeof(query) - 1) {
+	if (len >= (sizeof(query) - 1)) {
 		REDEBUG("Insufficient query buffer space");
 
 		return -1;
@@ -369,11 +427,168 @@ static int counter_cmp(void *instance, request_t *request, UNUSED fr_pair_list_t
 		return -1;
 	}
 
-	if (sscanf(expanded, "%" PRIu64, &counter) != 1) {
-		RDEBUG2("No integer found in string \"%s\"", expanded);
+	if (sscanf(expanded, "%" PRIu64, counter) != 1) {
+		RDEBUG2("No integer found in result string \"%s\".  May be first session, setting counter to 0",
+			expanded);
+		*counter = 0;
 	}
 	talloc_free(expanded);
 
+	return 0;
+}
+
+static uint32_t counter_hash(void const *data)
+{
+	sqlcounter_entry_t const *entry = data;
+
+	return fr_hash_string(entry->key);
+}
+
+static int8_t counter_key_cmp(void const *one, void const *two)
+{
+	sqlcounter_entry_t const *a = one, *b = two;
+
+	return CMP(strcmp(a->key, b->key), 0);
+}
+
+/** Remove counters which have expired
+ *
+ * Must be called with the cache mutex held.
+ */
+static void sqlcounter_cache_expire(rlm_sqlcounter_cache_t *cache, fr_time_t now)
+{
+	sqlcounter_entry_t *entry;
+
+	while ((entry = fr_dlist_head(&cache->expires)) != NULL) {
+		if (entry->expires > now) break;
+
+		(void) fr_dlist_remove(&cache->expires, entry);
+		(void) fr_hash_table_delete(cache->counters, entry);
+	}
+}
+
+/** Start a new counting period, if the current one has ended
+ *
+ * All cached counters belong to the old period, so they're discarded.
+ */
+static void sqlcounter_reset(rlm_sqlcounter_t *inst, request_t *request)
+{
+	rlm_sqlcounter_cache_t	*cache = &inst->cache;
+	sqlcounter_entry_t	*entry;
+
+	pthread_mutex_lock(&cache->mutex);
+	if (inst->reset_time && (inst->reset_time <= fr_time_to_sec(request->packet->timestamp))) {
+		/*
+		 *	Re-set the next time and prev_time for this counters range
+		 */
+		inst->last_reset = inst->reset_time;
+		find_next_reset(inst, fr_time_to_sec(request->packet->timestamp));
+
+		if (cache->counters) while ((entry = fr_dlist_pop_head(&cache->expires)) != NULL) {
+			(void) fr_hash_table_delete(cache->counters, entry);
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Get the current value of the counter, from the cache if possible
+ *
+ * @param[out] counter	The value of the counter.
+ * @param[in] inst	of rlm_sqlcounter.
+ * @param[in] request	The current request.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int sqlcounter_read(uint64_t *counter, rlm_sqlcounter_t *inst, request_t *request)
+{
+	rlm_sqlcounter_cache_t	*cache = &inst->cache;
+	sqlcounter_entry_t	find, *entry;
+	char			*key;
+	fr_time_t		now;
+	int			ret = 0;
+
+	if (!cache->lifetime) return sqlcounter_query(counter, inst, request);
+
+	if (tmpl_aexpand(request, &key, request, inst->key, NULL, NULL) < 0) {
+		RPEDEBUG("Failed expanding key");
+		return -1;
+	}
+	find.key = key;
+
+	now = fr_time();
+
+	pthread_mutex_lock(&cache->mutex);
+	sqlcounter_cache_expire(cache, now);
+
+	entry = fr_hash_table_find(cache->counters, &find);
+	if (entry) {
+		*counter = entry->counter;
+		pthread_mutex_unlock(&cache->mutex);
+
+		RDEBUG2("Using cached counter value (%" PRIu64 ") for \"%s\"", *counter, key);
+		goto done;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	/*
+	 *	Don't hold the mutex while we're waiting for SQL.
+	 */
+	if (sqlcounter_query(counter, inst, request) < 0) {
+		ret = -1;
+		goto done;
+	}
+
+	pthread_mutex_lock(&cache->mutex);
+
+	/*
+	 *	Another worker got there first.  Its counter may
+	 *	already include accounting we don't know about.
+	 */
+	if (fr_hash_table_find(cache->counters, &find)) goto unlock;
+
+	/*
+	 *	Make room by forgetting the oldest counter.
+	 */
+	if (fr_hash_table_num_elements(cache->counters) >= cache->max_entries) {
+		entry = fr_dlist_pop_head(&cache->expires);
+		if (entry) (void) fr_hash_table_delete(cache->counters, entry);
+	}
+
+	/*
+	 *	Allocated in the shared table, so only while we hold
+	 *	the mutex.
+	 */
+	MEM(entry = talloc_zero(cache->counters, sqlcounter_entry_t));
+	MEM(entry->key = talloc_strdup(entry, key));
+	entry->counter = *counter;
+	entry->expires = now + cache->lifetime;
+	fr_dlist_talloc_init(&entry->sessions, sqlcounter_session_t, entry);
+
+	if (!fr_hash_table_insert(cache->counters, entry)) {
+		talloc_free(entry);
+		goto unlock;
+	}
+	fr_dlist_insert_tail(&cache->expires, entry);
+
+unlock:
+	pthread_mutex_unlock(&cache->mutex);
+
+done:
+	talloc_free(key);
+	return ret;
+}
+
+/*
+ *	See if the counter matches.
+ */
+static int counter_cmp(void *instance, request_t *request, UNUSED fr_pair_list_t *request_list , fr_pair_t const *check)
+{
+	rlm_sqlcounter_t *inst = talloc_get_type_abort(instance, rlm_sqlcounter_t);
+	uint64_t counter;
+
+	if (sqlcounter_read(&counter, inst, request) < 0) return -1;
+
 	if (counter < check->vp_uint64) return -1;
 	if (counter > check->vp_uint64) return 1;
 	return 0;
@@ -394,54 +609,18 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	char			msg[128];
 	int			ret;
 
-	char query[MAX_QUERY_LEN], subst[MAX_QUERY_LEN];
-	char *expanded = NULL;
-
-	size_t len;
-
 	/*
 	 *	Before doing anything else, see if we have to reset
 	 *	the counters.
 	 */
-	if (inst->reset_time && (inst->reset_time <= fr_time_to_sec(request->packet->timestamp))) {
-		/*
-		 *	Re-set the next time and prev_time for this counters range
-		 */
-		inst->last_reset = inst->reset_time;
-		find_next_reset(inst, fr_time_to_sec(request->packet->timestamp));
-	}
+	sqlcounter_reset(inst, request);
 
 	if (tmpl_find_vp(&limit, request, inst->limit_attr) < 0) {
 		RWDEBUG2("Couldn't find limit attribute, %s, doing nothing...", inst->limit_attr->name);
 		RETURN_MODULE_NOOP;
 	}
 
-	/* First, expand %k, %b and %e in query */
-	if (sqlcounter_expand(subst, sizeof(subst), inst, request, inst->query) <= 0) {
-		REDEBUG("Insufficient query buffer space");
-
-		RETURN_MODULE_FAIL;
-	}
-
-	/* Then combine that with the name of the module were using to do the query */
-	len = snprintf(query, sizeof(query), "%%{%s:%s}", inst->sqlmod_inst, subst);
-	if (len >= (sizeof(query) - 1)) {
-		REDEBUG("Insufficient query buffer space");
-
-		RETURN_MODULE_FAIL;
-	}
-
-	/* Finally, xlat resulting SQL query */
-	if (xlat_aeval(request, &expanded, request, query, NULL, NULL) < 0) {
-		RETURN_MODULE_FAIL;
-	}
-	talloc_free(expanded);
-
-	if (sscanf(expanded, "%" PRIu64, &counter) != 1) {
-		RDEBUG2("No integer found in result string \"%s\".  May be first session, setting counter to 0",
-			expanded);
-		counter = 0;
-	}
+	if (sqlcounter_read(&counter, inst, request) < 0) RETURN_MODULE_FAIL;
 
 	/*
 	 *	Check if check item > counter
@@ -521,6 +700,98 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	RETURN_MODULE_OK;
 }
 
+/*
+ *	Add what the session has used since the last accounting packet
+ *	to the cached counter.  Counters which aren't cached are left
+ *	alone.  The next Access-Request reads them from SQL.
+ */
+static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_sqlcounter_t	*inst = talloc_get_type_abort(mctx->instance, rlm_sqlcounter_t);
+	rlm_sqlcounter_cache_t	*cache = &inst->cache;
+	sqlcounter_entry_t	find, *entry;
+	sqlcounter_session_t	*session;
+	fr_pair_t		*vp;
+	char			*key = NULL, *id = NULL;
+	uint64_t		value = 0, delta = 0;
+	uint32_t		status;
+	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
+
+	if (!cache->lifetime) RETURN_MODULE_NOOP;
+
+	vp = fr_pair_find_by_da(&request->request_pairs, attr_acct_status_type, 0);
+	if (!vp) RETURN_MODULE_NOOP;
+
+	status = vp->vp_uint32;
+	if ((status != FR_STATUS_START) && (status != FR_STATUS_ALIVE) && (status != FR_STATUS_STOP)) {
+		RETURN_MODULE_NOOP;
+	}
+
+	sqlcounter_reset(inst, request);
+
+	if (tmpl_aexpand(request, &key, request, inst->key, NULL, NULL) < 0) {
+		RPEDEBUG("Failed expanding key");
+		RETURN_MODULE_FAIL;
+	}
+
+	if (tmpl_aexpand(request, &id, request, cache->session, NULL, NULL) < 0) {
+		RPEDEBUG("Failed expanding session");
+		talloc_free(key);
+		RETURN_MODULE_FAIL;
+	}
+
+	/*
+	 *	Start packets usually don't have a value.
+	 */
+	if (tmpl_expand(&value, NULL, 0, request, cache->value, NULL, NULL) < 0) value = 0;
+
+	find.key = key;
+
+	pthread_mutex_lock(&cache->mutex);
+	sqlcounter_cache_expire(cache, fr_time());
+
+	entry = fr_hash_table_find(cache->counters, &find);
+	if (!entry) goto unlock;
+
+	for (session = fr_dlist_head(&entry->sessions);
+	     session;
+	     session = fr_dlist_next(&entry->sessions, session)) {
+		if (strcmp(session->id, id) == 0) break;
+	}
+
+	if (session) {
+		if (value > session->value) delta = value - session->value;
+		session->value = value;
+	} else {
+		/*
+		 *	A session we haven't seen the start of was
+		 *	already running when the counter was read
+		 *	from SQL, so SQL has already counted it.
+		 */
+		if (status == FR_STATUS_START) delta = value;
+
+		MEM(session = talloc_zero(entry, sqlcounter_session_t));
+		MEM(session->id = talloc_strdup(session, id));
+		session->value = value;
+		fr_dlist_insert_tail(&entry->sessions, session);
+	}
+
+	entry->counter += delta;
+	RDEBUG2("Added %" PRIu64 " to cached counter for \"%s\", now %" PRIu64, delta, key, entry->counter);
+
+	if (status == FR_STATUS_STOP) fr_dlist_talloc_free_item(&entry->sessions, session);
+
+	rcode = RLM_MODULE_UPDATED;
+
+unlock:
+	pthread_mutex_unlock(&cache->mutex);
+
+	talloc_free(key);
+	talloc_free(id);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
 /*
  *	Do any per-module initialization that is separate to each
  *	configured instance of the module.  e.g. set up connections
@@ -556,6 +827,32 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	pthread_mutex_init(&inst->cache.mutex, NULL);
+
+	if (inst->cache.lifetime) {
+		if (!inst->cache.max_entries) {
+			cf_log_err(conf, "cache.max_entries must be greater than zero");
+			return -1;
+		}
+
+		inst->cache.counters = fr_hash_table_alloc(inst, counter_hash, counter_key_cmp, talloc_free_data);
+		if (!inst->cache.counters) {
+			cf_log_err(conf, "Failed creating counter cache");
+			return -1;
+		}
+		fr_dlist_init(&inst->cache.expires, sqlcounter_entry_t, entry);
+	}
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_sqlcounter_t	*inst = talloc_get_type_abort(instance, rlm_sqlcounter_t);
+
+	TALLOC_FREE(inst->cache.counters);
+	pthread_mutex_destroy(&inst->cache.mutex);
+
 	return 0;
 }
 
@@ -618,8 +915,10 @@ module_t rlm_sqlcounter = {
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
 	.methods = {
-		[MOD_AUTHORIZE]		= mod_authorize
+		[MOD_AUTHORIZE]		= mod_authorize,
+		[MOD_ACCOUNTING]	= mod_accounting
 	},
 };
 
@@ -33,6 +33,7 @@ RCSID("$Id$")
 #include <freeradius-devel/radius/radius.h>
 
 #include <ctype.h>
+#include <pthread.h>
 
 
 #define MAX_QUERY_LEN 4096
@@ -93,8 +94,76 @@ typedef struct {
 						/* Reserved to handle 255.255.255.254 Requests */
 	char const	*defaultpool;		//!< Default Pool-Name if there is none in the check items.
 
+						/* In-memory lease store */
+	bool		cache;			//!< whether leases are allocated from memory.
+	tmpl_t		*cache_owner;		//!< owner of the lease.
+	char const	*cache_load;		//!< SQL query to load all leases of a pool.
+	char const	*cache_allocate;	//!< SQL query to record an allocated or renewed lease.
+	char const	*cache_release;		//!< SQL query to record a released lease.
+	char const	*cache_begin;		//!< SQL query to begin a batch of writes.
+	char const	*cache_commit;		//!< SQL query to commit a batch of writes.
+	char const	*cache_rollback;	//!< SQL query to roll back a failed batch of writes.
+	fr_time_delta_t	cache_flush_interval;	//!< how often the writes are sent to the database.
+
+	pthread_mutex_t	pools_mutex;		//!< protects "pools".
+	fr_hash_table_t	*pools;			//!< of sqlippool_pool_t, indexed by name.
+
+	pthread_mutex_t	pending_mutex;		//!< protects "pending".
+	fr_dlist_head_t	pending;		//!< queries waiting to be written to the database.
+	pthread_mutex_t	flush_mutex;		//!< only one thread writes at a time, so writes stay in order.
 } rlm_sqlippool_t;
 
+/** Per-thread instance data
+ *
+ */
+typedef struct {
+	rlm_sqlippool_t		*inst;		//!< instance data.
+	fr_event_list_t		*el;		//!< event list of this thread.
+	fr_event_timer_t const	*ev;		//!< when we next write the pending queries.
+} rlm_sqlippool_thread_t;
+
+/** A lease held in memory
+ *
+ */
+typedef struct {
+	fr_ipaddr_t		address;	//!< of the lease.
+	char			*owner;		//!< of the lease, or NULL if it's free.
+	time_t			expires;	//!< when the lease expires.
+	uint32_t		index;		//!< into the lease array, and the free bitmap.
+	fr_dlist_t		entry;		//!< in the list of allocated leases.
+} sqlippool_lease_t;
+
+/** A pool of leases held in memory
+ *
+ * Allocation first takes a never used, or released, lease from the
+ * free bitmap.  If there aren't any, the lease which expired longest
+ * ago is re-used.  Leases are renewed for lease_duration, so the list
+ * of allocated leases stays (mostly) in expiry order.
+ */
+typedef struct {
+	char const		*name;		//!< of the pool.
+	pthread_mutex_t		mutex;		//!< protects everything below.
+	bool			loaded;		//!< whether the leases have been read from the database.
+
+	sqlippool_lease_t	*leases;	//!< all leases of the pool.
+	uint32_t		num_leases;	//!< number of leases in the pool.
+
+	uint64_t		*free;		//!< bitmap of free leases.
+	uint32_t		free_hint;	//!< no bits are set in the words before this one.
+
+	fr_hash_table_t		*by_owner;	//!< allocated leases, indexed by owner.
+	fr_hash_table_t		*by_address;	//!< all leases, indexed by address.
+	fr_dlist_head_t		allocated;	//!< allocated leases, soonest expiry first.
+} sqlippool_pool_t;
+
+/** A query waiting to be written to the database
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< in the list of pending queries.
+	char			*query;		//!< fully expanded query.
+} sqlippool_write_t;
+
 static CONF_PARSER message_config[] = {
 	{ FR_CONF_OFFSET("exists", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sqlippool_t, log_exists) },
 	{ FR_CONF_OFFSET("success", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sqlippool_t, log_success) },
@@ -104,6 +173,25 @@ static CONF_PARSER message_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static CONF_PARSER cache_config[] = {
+	{ FR_CONF_OFFSET("owner", FR_TYPE_TMPL, rlm_sqlippool_t, cache_owner) },
+
+	{ FR_CONF_OFFSET("load", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sqlippool_t, cache_load) },
+
+	{ FR_CONF_OFFSET("allocate", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sqlippool_t, cache_allocate) },
+
+	{ FR_CONF_OFFSET("release", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sqlippool_t, cache_release) },
+
+	{ FR_CONF_OFFSET("begin", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sqlippool_t, cache_begin), .dflt = "START TRANSACTION" },
+
+	{ FR_CONF_OFFSET("commit", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sqlippool_t, cache_commit), .dflt = "COMMIT" },
+
+	{ FR_CONF_OFFSET("rollback", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sqlippool_t, cache_rollback), .dflt = "ROLLBACK" },
+
+	{ FR_CONF_OFFSET("flush_interval", FR_TYPE_TIME_DELTA, rlm_sqlippool_t, cache_flush_interval), .dflt = "0.1" },
+	CONF_PARSER_TERMINATOR
+};
+
 static CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("sql_module_instance", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_sqlippool_t, sql_instance_name), .dflt = "sql" },
 
@@ -165,6 +253,8 @@ static CONF_PARSER module_config[] = {
 
 
 	{ FR_CONF_POINTER("messages", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) message_config },
+
+	{ FR_CONF_POINTER("cache", FR_TYPE_SUBSECTION | FR_TYPE_OK_MISSING, NULL), .subcs = (void const *) cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -266,6 +356,34 @@ static int sqlippool_expand(char * out, int outlen, char const * fmt,
 	return strlen(out);
 }
 
+/** Expand a query, without running it
+ *
+ * @param ctx to allocate the expanded query in.
+ * @param out where to write the expanded query.
+ * @param fmt sql query to expand.
+ * @param handle sql connection handle, used for escaping.
+ * @param data Instance of rlm_sqlippool.
+ * @param request Current request.
+ * @param param ip address string.
+ * @param param_len ip address string len.
+ * @return
+ *	- >= 0 on success.
+ *	- < 0 on error.
+ */
+static ssize_t sqlippool_aexpand(TALLOC_CTX *ctx, char **out, char const *fmt, rlm_sql_handle_t *handle,
+				 rlm_sqlippool_t const *data, request_t *request,
+				 char *param, int param_len)
+{
+	char query[MAX_QUERY_LEN];
+
+	/*
+	 *	@todo this needs to die (should just be done in xlat expansion)
+	 */
+	sqlippool_expand(query, sizeof(query), fmt, data, param, param_len);
+
+	return xlat_aeval(ctx, out, request, query, data->sql_inst->sql_escape_func, handle);
+}
+
 /** Perform a single sqlippool query
  *
  * Mostly wrapper around sql_query which does some special sqlippool sequence substitutions and expands
@@ -285,7 +403,6 @@ static int sqlippool_command(char const *fmt, rlm_sql_handle_t **handle,
 			     rlm_sqlippool_t const *data, request_t *request,
 			     char *param, int param_len)
 {
-	char query[MAX_QUERY_LEN];
 	char *expanded = NULL;
 
 	int ret;
@@ -301,12 +418,7 @@ static int sqlippool_command(char const *fmt, rlm_sql_handle_t **handle,
 	 */
 	if (!handle || !*handle) return -1;
 
-	/*
-	 *	@todo this needs to die (should just be done in xlat expansion)
-	 */
-	sqlippool_expand(query, sizeof(query), fmt, data, param, param_len);
-
-	if (xlat_aeval(request, &expanded, request, query, data->sql_inst->sql_escape_func, *handle) < 0) return -1;
+	if (sqlippool_aexpand(request, &expanded, fmt, *handle, data, request, param, param_len) < 0) return -1;
 
 	ret = data->sql_inst->sql_query(data->sql_inst, request, handle, expanded);
 	if (ret < 0){
@@ -332,6 +444,27 @@ static int sqlippool_command(char const *fmt, rlm_sql_handle_t **handle,
  */
 #define DO_PART(_x) if(sqlippool_command(inst->_x, &handle, inst, request, NULL, 0) <0) goto error
 
+/** Roll back a failed transaction, and release the connection
+ *
+ * Drivers don't all notice a transaction being left open when the
+ * connection goes back to the pool, and the next user would end up
+ * inside it.
+ *
+ * @param[in] inst	of rlm_sqlippool.
+ * @param[in] request	being processed.
+ * @param[in] handle	to roll back and release.  May be NULL.
+ * @param[in] begin	query which started the transaction, if any.
+ */
+static void sqlippool_abort(rlm_sqlippool_t const *inst, request_t *request, rlm_sql_handle_t *handle,
+			    char const *begin)
+{
+	if (!handle) return;
+
+	if (begin && *begin) (void) sqlippool_command("ROLLBACK", &handle, inst, request, NULL, 0);
+
+	inst->sql_inst->sql_release(inst->sql_inst, request, handle);
+}
+
 /*
  * Query the database expecting a single result row
  */
@@ -397,6 +530,510 @@ finish:
 	return retval;
 }
 
+static uint32_t pool_hash(void const *data)
+{
+	sqlippool_pool_t const *pool = data;
+
+	return fr_hash_string(pool->name);
+}
+
+static int8_t pool_cmp(void const *one, void const *two)
+{
+	sqlippool_pool_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->name, b->name);
+	return CMP(ret, 0);
+}
+
+static uint32_t lease_owner_hash(void const *data)
+{
+	sqlippool_lease_t const *lease = data;
+
+	return fr_hash_string(lease->owner);
+}
+
+static int8_t lease_owner_cmp(void const *one, void const *two)
+{
+	sqlippool_lease_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->owner, b->owner);
+	return CMP(ret, 0);
+}
+
+static uint32_t lease_address_hash(void const *data)
+{
+	sqlippool_lease_t const *lease = data;
+
+	return fr_hash(&lease->address.addr, sizeof(lease->address.addr));
+}
+
+static int8_t lease_address_cmp(void const *one, void const *two)
+{
+	sqlippool_lease_t const *a = one, *b = two;
+
+	return fr_ipaddr_cmp(&a->address, &b->address);
+}
+
+static int lease_expires_cmp(void const *one, void const *two)
+{
+	sqlippool_lease_t const *a = *(sqlippool_lease_t const * const *) one;
+	sqlippool_lease_t const *b = *(sqlippool_lease_t const * const *) two;
+
+	return CMP(a->expires, b->expires);
+}
+
+#define LEASE_FREE_SET(_pool, _lease)	((_pool)->free[(_lease)->index / 64] |= ((uint64_t) 1) << ((_lease)->index % 64))
+#define LEASE_FREE_CLEAR(_pool, _lease)	((_pool)->free[(_lease)->index / 64] &= ~(((uint64_t) 1) << ((_lease)->index % 64)))
+#define LEASE_IS_FREE(_pool, _lease)	(((_pool)->free[(_lease)->index / 64] & (((uint64_t) 1) << ((_lease)->index % 64))) != 0)
+
+/** Forget all of the leases of a pool, so that they're read again on next use
+ *
+ */
+static void pool_unload(sqlippool_pool_t *pool)
+{
+	TALLOC_FREE(pool->by_owner);
+	TALLOC_FREE(pool->by_address);
+	TALLOC_FREE(pool->free);
+	TALLOC_FREE(pool->leases);	/* and the owners */
+
+	pool->num_leases = 0;
+	pool->free_hint = 0;
+	fr_dlist_init(&pool->allocated, sqlippool_lease_t, entry);
+	pool->loaded = false;
+}
+
+static void _pool_free(void *data)
+{
+	sqlippool_pool_t *pool = data;
+
+	pool_unload(pool);
+	pthread_mutex_destroy(&pool->mutex);
+	talloc_free(pool);
+}
+
+static int sqlippool_flush(rlm_sqlippool_t *inst, bool wait);
+
+/** Read all of the leases of a pool from the database
+ *
+ * The "load" query returns one row per lease, with the address, the
+ * owner (empty if the lease is free), and the expiry time in seconds
+ * since the epoch.
+ *
+ * Called with the pool locked.  Writes for the pool are only queued
+ * with it locked, so once the queue has been flushed the database has
+ * all of them.  If any are still pending (e.g. the connection was lost)
+ * the database is behind, and loading it would hand out addresses which
+ * are already allocated.
+ */
+static int pool_load(rlm_sqlippool_t *inst, request_t *request, rlm_sql_handle_t **handle,
+		     sqlippool_pool_t *pool)
+{
+	char			*query;
+	rlm_sql_row_t		row;
+	sqlippool_lease_t	*lease, **allocated;
+	uint32_t		i, num = 0, size = 1024, num_allocated = 0;
+	int			ret;
+
+	pool_unload(pool);
+
+	if (sqlippool_flush(inst, true) < 0) {
+		REDEBUG("Failed writing pending leases, not loading pool %s", pool->name);
+		return -1;
+	}
+
+	if (sqlippool_aexpand(request, &query, inst->cache_load, *handle, inst, request, NULL, 0) < 0) return -1;
+
+	ret = inst->sql_inst->sql_select_query(inst->sql_inst, request, handle, query);
+	talloc_free(query);
+	if ((ret != RLM_SQL_OK) || !*handle) {
+		REDEBUG("Failed loading leases for pool %s", pool->name);
+		return -1;
+	}
+
+	MEM(pool->leases = talloc_array(pool, sqlippool_lease_t, size));
+
+	while ((inst->sql_inst->sql_fetch_row(&row, inst->sql_inst, request, handle) == RLM_SQL_OK) && row) {
+		if (!row[0]) continue;
+
+		if (num == size) {
+			size *= 2;
+			MEM(pool->leases = talloc_realloc(pool, pool->leases, sqlippool_lease_t, size));
+		}
+
+		lease = &pool->leases[num];
+		memset(lease, 0, sizeof(*lease));
+
+		if (fr_inet_pton(&lease->address, row[0], -1, AF_UNSPEC, false, false) < 0) {
+			RWDEBUG("Ignoring invalid address \"%s\" in pool %s", row[0], pool->name);
+			continue;
+		}
+		if (row[1] && *row[1]) MEM(lease->owner = talloc_typed_strdup(pool->leases, row[1]));
+		if (row[2]) lease->expires = (time_t) strtoll(row[2], NULL, 10);
+		lease->index = num++;
+	}
+
+	if (*handle) (inst->sql_inst->driver->sql_finish_select_query)(*handle, inst->sql_inst->config);
+
+	pool->num_leases = num;
+
+	MEM(pool->free = talloc_zero_array(pool, uint64_t, ROUND_UP_DIV(num, 64) + 1));
+	MEM(pool->by_owner = fr_hash_table_alloc(pool, lease_owner_hash, lease_owner_cmp, NULL));
+	MEM(pool->by_address = fr_hash_table_alloc(pool, lease_address_hash, lease_address_cmp, NULL));
+	MEM(allocated = talloc_array(NULL, sqlippool_lease_t *, num + 1));
+
+	for (i = 0; i < num; i++) {
+		lease = &pool->leases[i];
+
+		if (!fr_hash_table_insert(pool->by_address, lease)) {
+			RWDEBUG("Ignoring duplicate address %pV in pool %s", fr_box_ipaddr(lease->address), pool->name);
+			TALLOC_FREE(lease->owner);
+			continue;
+		}
+
+		if (!lease->owner) {
+			LEASE_FREE_SET(pool, lease);
+			continue;
+		}
+
+		/*
+		 *	Only the most recent lease of an owner is
+		 *	found by owner.  The others will expire.
+		 */
+		allocated[num_allocated++] = lease;
+	}
+
+	qsort(allocated, num_allocated, sizeof(allocated[0]), lease_expires_cmp);
+	for (i = 0; i < num_allocated; i++) {
+		sqlippool_lease_t *old;
+
+		lease = allocated[i];
+
+		old = fr_hash_table_find(pool->by_owner, lease);
+		if (old) (void) fr_hash_table_remove(pool->by_owner, old);
+		(void) fr_hash_table_insert(pool->by_owner, lease);
+
+		fr_dlist_insert_tail(&pool->allocated, lease);
+	}
+	talloc_free(allocated);
+
+	RDEBUG2("Loaded %u leases (%u allocated) for pool %s", num, num_allocated, pool->name);
+	pool->loaded = true;
+
+	return 0;
+}
+
+/** Find a pool by name, reading it from the database if necessary
+ *
+ * @return
+ *	- The pool, which is locked.
+ *	- NULL on error.
+ */
+static sqlippool_pool_t *pool_lock(rlm_sqlippool_t *inst, request_t *request, rlm_sql_handle_t **handle,
+				   char const *name)
+{
+	sqlippool_pool_t	*pool;
+
+	pthread_mutex_lock(&inst->pools_mutex);
+	pool = fr_hash_table_find(inst->pools, &(sqlippool_pool_t){ .name = name });
+	if (!pool) {
+		MEM(pool = talloc_zero(NULL, sqlippool_pool_t));
+		MEM(pool->name = talloc_typed_strdup(pool, name));
+		pthread_mutex_init(&pool->mutex, NULL);
+		fr_dlist_init(&pool->allocated, sqlippool_lease_t, entry);
+
+		if (!fr_hash_table_insert(inst->pools, pool)) {
+			pthread_mutex_unlock(&inst->pools_mutex);
+			_pool_free(pool);
+			return NULL;
+		}
+	}
+	pthread_mutex_unlock(&inst->pools_mutex);
+
+	pthread_mutex_lock(&pool->mutex);
+	if (!pool->loaded && (pool_load(inst, request, handle, pool) < 0)) {
+		pthread_mutex_unlock(&pool->mutex);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/** Find a lease which can be given to a new owner
+ *
+ */
+static sqlippool_lease_t *pool_lease_free(sqlippool_pool_t *pool, time_t now)
+{
+	uint32_t		i, words = ROUND_UP_DIV(pool->num_leases, 64);
+	sqlippool_lease_t	*lease;
+
+	for (i = pool->free_hint; i < words; i++) {
+		uint64_t	bits = pool->free[i];
+
+		if (!bits) continue;
+
+		pool->free_hint = i;
+		return &pool->leases[(i * 64) + fr_high_bit_pos(bits & -bits) - 1];
+	}
+	pool->free_hint = words;
+
+	lease = fr_dlist_head(&pool->allocated);
+	if (!lease || (lease->expires > now)) return NULL;
+
+	return lease;
+}
+
+/** Give a lease to an owner, or extend it for the current owner
+ *
+ */
+static void pool_lease_take(rlm_sqlippool_t const *inst, sqlippool_pool_t *pool, sqlippool_lease_t *lease,
+			    char const *owner, time_t now)
+{
+	if (LEASE_IS_FREE(pool, lease)) {
+		LEASE_FREE_CLEAR(pool, lease);
+
+	} else {
+		(void) fr_dlist_remove(&pool->allocated, lease);
+	}
+
+	if (!lease->owner || (strcmp(lease->owner, owner) != 0)) {
+		sqlippool_lease_t *old;
+
+		if (lease->owner) {
+			if (fr_hash_table_find(pool->by_owner, lease) == lease) {
+				(void) fr_hash_table_remove(pool->by_owner, lease);
+			}
+			talloc_free(lease->owner);
+		}
+		MEM(lease->owner = talloc_typed_strdup(pool->leases, owner));
+
+		old = fr_hash_table_find(pool->by_owner, lease);
+		if (old) (void) fr_hash_table_remove(pool->by_owner, old);
+		(void) fr_hash_table_insert(pool->by_owner, lease);
+	}
+
+	lease->expires = now + inst->lease_duration;
+	fr_dlist_insert_tail(&pool->allocated, lease);
+}
+
+/** Put a lease back into the free bitmap
+ *
+ */
+static void pool_lease_release(sqlippool_pool_t *pool, sqlippool_lease_t *lease)
+{
+	if (LEASE_IS_FREE(pool, lease)) return;
+
+	if (fr_hash_table_find(pool->by_owner, lease) == lease) (void) fr_hash_table_remove(pool->by_owner, lease);
+	TALLOC_FREE(lease->owner);
+
+	(void) fr_dlist_remove(&pool->allocated, lease);
+
+	LEASE_FREE_SET(pool, lease);
+	if ((lease->index / 64) < pool->free_hint) pool->free_hint = lease->index / 64;
+}
+
+/** Queue a query to be written to the database later
+ *
+ * The query is expanded now, as the request won't be around when it's
+ * written.
+ */
+static int sqlippool_write_behind(rlm_sqlippool_t *inst, request_t *request, rlm_sql_handle_t *handle,
+				  char const *fmt, char *param, int param_len)
+{
+	sqlippool_write_t	*write;
+
+	if (!fmt || !*fmt) return 0;
+
+	/*
+	 *	Not parented by the instance, as other threads may
+	 *	be allocating or freeing writes at the same time.
+	 */
+	MEM(write = talloc_zero(NULL, sqlippool_write_t));
+	if (sqlippool_aexpand(write, &write->query, fmt, handle, inst, request, param, param_len) < 0) {
+		talloc_free(write);
+		return -1;
+	}
+
+	pthread_mutex_lock(&inst->pending_mutex);
+	fr_dlist_insert_tail(&inst->pending, write);
+	pthread_mutex_unlock(&inst->pending_mutex);
+
+	return 0;
+}
+
+/** Run one of the queries in a batch of writes
+ *
+ * @return
+ *	- true if the query succeeded.
+ *	- false if it failed.  *handle is NULL if the connection was lost.
+ */
+static bool sqlippool_flush_query(rlm_sqlippool_t *inst, rlm_sql_handle_t **handle, char const *query)
+{
+	if (inst->sql_inst->sql_query(inst->sql_inst, NULL, handle, query) != RLM_SQL_OK) return false;
+
+	if (*handle) (inst->sql_inst->driver->sql_finish_query)(*handle, inst->sql_inst->config);
+
+	return true;
+}
+
+/** Write all pending queries to the database, in one transaction
+ *
+ * If any query in the transaction fails, it's rolled back, and the queries
+ * are written one at a time instead.  Some databases (e.g. PostgreSQL)
+ * abort the whole transaction when one statement fails, so carrying on
+ * would lose every write after it.
+ *
+ * Queries which can't be written because the connection was lost are
+ * written by the next flush.  Queries which fail on their own are logged
+ * and discarded.
+ *
+ * @param inst	of rlm_sqlippool.
+ * @param wait	for another thread which is already writing.
+ * @return
+ *	- 0 if everything which was pending has been written (or discarded).
+ *	- -1 if writes are still pending, or another thread is writing.
+ */
+static int sqlippool_flush(rlm_sqlippool_t *inst, bool wait)
+{
+	fr_dlist_head_t		batch;
+	sqlippool_write_t	*write;
+	rlm_sql_handle_t	*handle, *begun = NULL;
+	unsigned int		count = 0, failed = 0;
+	int			ret = 0;
+
+	if (wait) {
+		pthread_mutex_lock(&inst->flush_mutex);
+	} else if (pthread_mutex_trylock(&inst->flush_mutex) != 0) {
+		return -1;
+	}
+
+	fr_dlist_init(&batch, sqlippool_write_t, entry);
+
+	pthread_mutex_lock(&inst->pending_mutex);
+	fr_dlist_move(&batch, &inst->pending);
+	pthread_mutex_unlock(&inst->pending_mutex);
+
+	if (fr_dlist_empty(&batch)) goto done;
+
+	handle = fr_pool_connection_get(inst->sql_inst->pool, NULL);
+	if (!handle) {
+		ERROR("Failed reserving SQL connection, will retry writing %u leases",
+		      fr_dlist_num_elements(&batch));
+		goto requeue;
+	}
+
+	if ((fr_dlist_num_elements(&batch) > 1) &&
+	    inst->cache_begin && *inst->cache_begin && inst->cache_commit && *inst->cache_commit &&
+	    sqlippool_flush_query(inst, &handle, inst->cache_begin) && handle) begun = handle;
+
+	if (begun) {
+		for (write = fr_dlist_head(&batch); write; write = fr_dlist_next(&batch, write)) {
+			bool ok;
+
+			ok = sqlippool_flush_query(inst, &handle, write->query);
+
+			/*
+			 *	The connection was re-opened, and the
+			 *	transaction went with it.  This query
+			 *	was run outside of the transaction, so
+			 *	its result stands.
+			 */
+			if (handle != begun) {
+				if (ok) {
+					(void) fr_dlist_remove(&batch, write);
+					talloc_free(write);
+					count++;
+				}
+				break;
+			}
+
+			if (!ok) break;
+		}
+
+		if (!write && sqlippool_flush_query(inst, &handle, inst->cache_commit) && (handle == begun)) {
+			count += fr_dlist_num_elements(&batch);
+			fr_dlist_talloc_free(&batch);
+		} else if (handle == begun) {
+			WARN("Failed writing batch of %u leases, retrying them individually",
+			     fr_dlist_num_elements(&batch));
+			if (inst->cache_rollback && *inst->cache_rollback) {
+				(void) sqlippool_flush_query(inst, &handle, inst->cache_rollback);
+			}
+		}
+	}
+
+	/*
+	 *	Anything which wasn't committed as part of a
+	 *	transaction is written one query at a time.
+	 */
+	while (handle && (write = fr_dlist_head(&batch))) {
+		if (sqlippool_flush_query(inst, &handle, write->query)) {
+			count++;
+		} else {
+			/*
+			 *	Lost the connection.  Try the rest of
+			 *	the batch again later.
+			 */
+			if (!handle) break;
+
+			ERROR("Failed writing lease: %s", write->query);
+			failed++;
+		}
+
+		(void) fr_dlist_remove(&batch, write);
+		talloc_free(write);
+	}
+
+	if (handle) inst->sql_inst->sql_release(inst->sql_inst, NULL, handle);
+
+	DEBUG3("Wrote %u leases, %u failed", count, failed);
+
+requeue:
+	if (!fr_dlist_empty(&batch)) {
+		pthread_mutex_lock(&inst->pending_mutex);
+		fr_dlist_move_head(&inst->pending, &batch);
+		pthread_mutex_unlock(&inst->pending_mutex);
+		ret = -1;
+	}
+
+done:
+	pthread_mutex_unlock(&inst->flush_mutex);
+
+	return ret;
+}
+
+static void sqlippool_flush_timer(fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	rlm_sqlippool_thread_t	*t = talloc_get_type_abort(uctx, rlm_sqlippool_thread_t);
+	rlm_sqlippool_t		*inst = t->inst;
+
+	(void) sqlippool_flush(inst, false);
+
+	if (fr_event_timer_coarse_in(t, el, &t->ev, inst->cache_flush_interval, sqlippool_flush_timer, t) < 0) {
+		ERROR("Failed inserting flush timer");
+	}
+}
+
+/** Forget the leases of all pools, after they've been changed directly in the database
+ *
+ */
+static void sqlippool_invalidate(rlm_sqlippool_t *inst)
+{
+	fr_hash_iter_t		iter;
+	sqlippool_pool_t	*pool;
+
+	pthread_mutex_lock(&inst->pools_mutex);
+	for (pool = fr_hash_table_iter_init(inst->pools, &iter);
+	     pool;
+	     pool = fr_hash_table_iter_next(inst->pools, &iter)) {
+		pthread_mutex_lock(&pool->mutex);
+		pool_unload(pool);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&inst->pools_mutex);
+}
+
 /*
  *	Do any per-module initialization that is separate to each
  *	configured instance of the module.  e.g. set up connections
@@ -460,6 +1097,64 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	inst->cache = (cf_section_find(conf, "cache", NULL) != NULL);
+	if (inst->cache) {
+		if (!inst->cache_owner || !inst->cache_load || !*inst->cache_load ||
+		    !inst->cache_allocate || !*inst->cache_allocate) {
+			cf_log_err(conf, "'cache' requires 'owner', 'load' and 'allocate' to be set");
+			return -1;
+		}
+
+		pthread_mutex_init(&inst->pools_mutex, NULL);
+		pthread_mutex_init(&inst->pending_mutex, NULL);
+		pthread_mutex_init(&inst->flush_mutex, NULL);
+		fr_dlist_init(&inst->pending, sqlippool_write_t, entry);
+		MEM(inst->pools = fr_hash_table_alloc(inst, pool_hash, pool_cmp, _pool_free));
+	}
+
+	return 0;
+}
+
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_sqlippool_t		*inst = talloc_get_type_abort(instance, rlm_sqlippool_t);
+	rlm_sqlippool_thread_t	*t = talloc_get_type_abort(thread, rlm_sqlippool_thread_t);
+
+	t->inst = inst;
+	t->el = el;
+
+	if (!inst->cache) return 0;
+
+	if (fr_event_timer_coarse_in(t, el, &t->ev, inst->cache_flush_interval, sqlippool_flush_timer, t) < 0) {
+		ERROR("Failed inserting flush timer");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_sqlippool_t		*inst = talloc_get_type_abort(instance, rlm_sqlippool_t);
+	sqlippool_write_t	*write;
+
+	if (!inst->cache) return 0;
+
+	/*
+	 *	Write what we can, and then give up on the rest.
+	 */
+	(void) sqlippool_flush(inst, true);
+	while ((write = fr_dlist_pop_head(&inst->pending)) != NULL) {
+		ERROR("Discarding unwritten lease: %s", write->query);
+		talloc_free(write);
+	}
+
+	TALLOC_FREE(inst->pools);
+
+	pthread_mutex_destroy(&inst->pools_mutex);
+	pthread_mutex_destroy(&inst->pending_mutex);
+	pthread_mutex_destroy(&inst->flush_mutex);
+
 	return 0;
 }
 
@@ -487,6 +1182,208 @@ static unlang_action_t do_logging(rlm_rcode_t *p_result, UNUSED rlm_sqlippool_t
 }
 
 
+/** Expand the owner, and the requested address of a request
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+static int cache_request_expand(char const **owner, char *owner_buff, size_t owner_len,
+				fr_ipaddr_t *requested, bool *has_requested,
+				rlm_sqlippool_t const *inst, request_t *request)
+{
+	char	*ip = NULL;
+	char	buffer[128];
+	ssize_t	slen;
+
+	slen = tmpl_expand(owner, owner_buff, owner_len, request, inst->cache_owner, NULL, NULL);
+	if (slen < 0) return -1;
+	if (slen == 0) {
+		REDEBUG("Lease owner expanded to an empty string");
+		return -1;
+	}
+
+	*has_requested = false;
+	if (!inst->requested_address) return 0;
+
+	slen = tmpl_expand(&ip, buffer, sizeof(buffer), request, inst->requested_address, NULL, NULL);
+	if (slen < 0) return -1;
+	if ((slen > 0) && (fr_inet_pton(requested, ip, slen, AF_UNSPEC, false, false) == 0)) *has_requested = true;
+
+	return 0;
+}
+
+/*
+ *	Allocate an IP address from the pool held in memory.
+ */
+static unlang_action_t mod_alloc_cache(rlm_rcode_t *p_result, rlm_sqlippool_t *inst, request_t *request,
+				       rlm_sql_handle_t **handle, fr_pair_t *pool_vp)
+{
+	sqlippool_pool_t	*pool;
+	sqlippool_lease_t	*lease, find;
+	char			owner_buff[256];
+	char const		*owner;
+	fr_ipaddr_t		requested;
+	bool			has_requested;
+	char			allocation[FR_IPADDR_STRLEN];
+	fr_pair_t		*vp;
+	time_t			now = time(NULL);
+
+	if (cache_request_expand(&owner, owner_buff, sizeof(owner_buff), &requested, &has_requested,
+				 inst, request) < 0) {
+	error:
+		inst->sql_inst->sql_release(inst->sql_inst, request, *handle);
+		RETURN_MODULE_FAIL;
+	}
+
+	pool = pool_lock(inst, request, handle, pool_vp->vp_strvalue);
+	if (!pool) {
+		if (!*handle) RETURN_MODULE_FAIL;
+		goto error;
+	}
+
+	/*
+	 *	An empty pool may be handled by some other instance.
+	 */
+	if (!pool->num_leases) {
+		pthread_mutex_unlock(&pool->mutex);
+		inst->sql_inst->sql_release(inst->sql_inst, request, *handle);
+
+		RDEBUG2("IP address could not be allocated as no pool exists with that name");
+		RETURN_MODULE_NOOP;
+	}
+
+	/*
+	 *	The owner's existing lease, then the requested
+	 *	address, then any free address.
+	 */
+	find.owner = UNCONST(char *, owner);
+	lease = fr_hash_table_find(pool->by_owner, &find);
+
+	if (!lease && has_requested) {
+		find.address = requested;
+		lease = fr_hash_table_find(pool->by_address, &find);
+		if (lease && !LEASE_IS_FREE(pool, lease) && (lease->expires > now)) lease = NULL;
+	}
+
+	if (!lease) lease = pool_lease_free(pool, now);
+
+	if (!lease) {
+		pthread_mutex_unlock(&pool->mutex);
+		inst->sql_inst->sql_release(inst->sql_inst, request, *handle);
+
+		RDEBUG2("pool appears to be full");
+		return do_logging(p_result, inst, request, inst->log_failed, RLM_MODULE_NOTFOUND);
+	}
+
+	fr_inet_ntop(allocation, sizeof(allocation), &lease->address);
+
+	MEM(vp = fr_pair_afrom_da(request->reply_ctx, inst->allocated_address_da));
+	if (fr_pair_value_from_str(vp, allocation, strlen(allocation), '\0', true) < 0) {
+		pthread_mutex_unlock(&pool->mutex);
+		talloc_free(vp);
+		RPEDEBUG("Invalid IP address [%s] in pool %s", allocation, pool_vp->vp_strvalue);
+		goto error;
+	}
+
+	/*
+	 *	Queue the write before taking the lease, so a failure
+	 *	leaves nothing to undo.  Both are done with the pool
+	 *	locked, so a reload can't see one without the other.
+	 */
+	if (sqlippool_write_behind(inst, request, *handle, inst->cache_allocate,
+				   allocation, strlen(allocation)) < 0) {
+		pthread_mutex_unlock(&pool->mutex);
+		talloc_free(vp);
+		goto error;
+	}
+
+	pool_lease_take(inst, pool, lease, owner, now);
+	pthread_mutex_unlock(&pool->mutex);
+
+	RDEBUG2("Allocated IP %s", allocation);
+	fr_pair_append(&request->reply_pairs, vp);
+
+	inst->sql_inst->sql_release(inst->sql_inst, request, *handle);
+
+	return do_logging(p_result, inst, request, inst->log_success, RLM_MODULE_OK);
+}
+
+/*
+ *	Renew or release a lease of the pool held in memory.
+ */
+static unlang_action_t mod_update_cache(rlm_rcode_t *p_result, rlm_sqlippool_t *inst, request_t *request,
+					bool release)
+{
+	rlm_sql_handle_t	*handle;
+	fr_pair_t		*pool_vp;
+	sqlippool_pool_t	*pool;
+	sqlippool_lease_t	*lease, find;
+	char			owner_buff[256];
+	char const		*owner;
+	fr_ipaddr_t		requested;
+	bool			has_requested;
+	char			address[FR_IPADDR_STRLEN];
+	time_t			now = time(NULL);
+	int			ret;
+
+	pool_vp = fr_pair_find_by_da(&request->control_pairs, attr_pool_name, 0);
+	if (!pool_vp) {
+		RDEBUG2("No %s defined", attr_pool_name->name);
+		RETURN_MODULE_NOOP;
+	}
+
+	if (cache_request_expand(&owner, owner_buff, sizeof(owner_buff), &requested, &has_requested,
+				 inst, request) < 0) RETURN_MODULE_FAIL;
+
+	handle = fr_pool_connection_get(inst->sql_inst->pool, request);
+	if (!handle) {
+		REDEBUG("Failed reserving SQL connection");
+		RETURN_MODULE_FAIL;
+	}
+
+	pool = pool_lock(inst, request, &handle, pool_vp->vp_strvalue);
+	if (!pool) {
+		if (handle) inst->sql_inst->sql_release(inst->sql_inst, request, handle);
+		RETURN_MODULE_FAIL;
+	}
+
+	find.owner = UNCONST(char *, owner);
+	lease = fr_hash_table_find(pool->by_owner, &find);
+	if (lease && has_requested && (fr_ipaddr_cmp(&lease->address, &requested) != 0)) lease = NULL;
+
+	if (!lease) {
+		pthread_mutex_unlock(&pool->mutex);
+		inst->sql_inst->sql_release(inst->sql_inst, request, handle);
+
+		if (release) RETURN_MODULE_OK;
+		return do_logging(p_result, inst, request, inst->log_failed, RLM_MODULE_NOTFOUND);
+	}
+
+	fr_inet_ntop(address, sizeof(address), &lease->address);
+
+	/*
+	 *	As with allocations, the lease only changes once its
+	 *	write has been queued.
+	 */
+	ret = sqlippool_write_behind(inst, request, handle, release ? inst->cache_release : inst->cache_allocate,
+				     address, strlen(address));
+	if (ret == 0) {
+		if (release) {
+			pool_lease_release(pool, lease);
+		} else {
+			pool_lease_take(inst, pool, lease, owner, now);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	inst->sql_inst->sql_release(inst->sql_inst, request, handle);
+	if (ret < 0) RETURN_MODULE_FAIL;
+
+	if (release) RETURN_MODULE_OK;
+	return do_logging(p_result, inst, request, inst->log_success, RLM_MODULE_OK);
+}
+
 /*
  *	Allocate an IP number from the pool.
  */
@@ -495,7 +1392,7 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_
 	rlm_sqlippool_t		*inst = talloc_get_type_abort(mctx->instance, rlm_sqlippool_t);
 	char			allocation[FR_MAX_STRING_LEN];
 	int			allocation_len;
-	fr_pair_t		*vp;
+	fr_pair_t		*vp, *pool_vp;
 	rlm_sql_handle_t	*handle;
 
 	/*
@@ -507,7 +1404,8 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_
 		return do_logging(p_result, inst, request, inst->log_exists, RLM_MODULE_NOOP);
 	}
 
-	if (fr_pair_find_by_da(&request->control_pairs, attr_pool_name, 0) == NULL) {
+	pool_vp = fr_pair_find_by_da(&request->control_pairs, attr_pool_name, 0);
+	if (!pool_vp) {
 		RDEBUG2("No %s defined", attr_pool_name->name);
 
 		return do_logging(p_result, inst, request, inst->log_nopool, RLM_MODULE_NOOP);
@@ -520,9 +1418,12 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_
 	}
 
 	if (inst->sql_inst->sql_set_user(inst->sql_inst, request, NULL) < 0) {
+		inst->sql_inst->sql_release(inst->sql_inst, request, handle);
 		RETURN_MODULE_FAIL;
 	}
 
+	if (inst->cache) return mod_alloc_cache(p_result, inst, request, &handle, pool_vp);
+
 	DO_PART(alloc_begin);
 
 	/*
@@ -548,7 +1449,7 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_
 		ssize_t slen;
 
 		slen = tmpl_expand(&ip, buffer, sizeof(buffer), request, inst->requested_address, NULL, NULL);
-		if (slen < 0) RETURN_MODULE_FAIL;
+		if (slen < 0) goto error;
 
 		if (slen > 0) {
 			allocation_len = sqlippool_query1(allocation, sizeof(allocation),
@@ -589,7 +1490,7 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_
 							  (char *) NULL, 0);
 			if (!handle) RETURN_MODULE_FAIL;
 
-			fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+			inst->sql_inst->sql_release(inst->sql_inst, request, handle);
 
 			if (allocation_len) {
 
@@ -616,7 +1517,7 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_
 
 		}
 
-		fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+		inst->sql_inst->sql_release(inst->sql_inst, request, handle);
 
 		RDEBUG2("IP address could not be allocated");
 		return do_logging(p_result, inst, request, inst->log_failed, RLM_MODULE_NOOP);
@@ -631,7 +1532,7 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_
 		DO_PART(alloc_commit);
 
 		RDEBUG2("Invalid IP number [%s] returned from instbase query.", allocation);
-		fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+		inst->sql_inst->sql_release(inst->sql_inst, request, handle);
 		return do_logging(p_result, inst, request, inst->log_failed, RLM_MODULE_NOOP);
 	}
 
@@ -644,13 +1545,13 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_
 	if (sqlippool_command(inst->alloc_update, &handle, inst, request,
 			      allocation, allocation_len) < 0) {
 	error:
-		if (handle) fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+		sqlippool_abort(inst, request, handle, inst->alloc_begin);
 		RETURN_MODULE_FAIL;
 	}
 
 	DO_PART(alloc_commit);
 
-	if (handle) fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+	if (handle) inst->sql_inst->sql_release(inst->sql_inst, request, handle);
 
 	return do_logging(p_result, inst, request, inst->log_success, RLM_MODULE_OK);
 }
@@ -664,6 +1565,8 @@ static unlang_action_t CC_HINT(nonnull) mod_update(rlm_rcode_t *p_result, module
 	rlm_sql_handle_t	*handle;
 	int			affected;
 
+	if (inst->cache) return mod_update_cache(p_result, inst, request, false);
+
 	handle = fr_pool_connection_get(inst->sql_inst->pool, request);
 	if (!handle) {
 		REDEBUG("Failed reserving SQL connection");
@@ -671,6 +1574,7 @@ static unlang_action_t CC_HINT(nonnull) mod_update(rlm_rcode_t *p_result, module
 	}
 
 	if (inst->sql_inst->sql_set_user(inst->sql_inst, request, NULL) < 0) {
+		inst->sql_inst->sql_release(inst->sql_inst, request, handle);
 		RETURN_MODULE_FAIL;
 	}
 
@@ -687,13 +1591,13 @@ static unlang_action_t CC_HINT(nonnull) mod_update(rlm_rcode_t *p_result, module
 
 	if (affected < 0) {
 	error:
-		if (handle) fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+		sqlippool_abort(inst, request, handle, inst->update_begin);
 		RETURN_MODULE_FAIL;
 	}
 
 	DO_PART(update_commit);
 
-	if (handle) fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+	if (handle) inst->sql_inst->sql_release(inst->sql_inst, request, handle);
 
 	if (affected > 0) {
 		/*
@@ -716,6 +1620,8 @@ static unlang_action_t CC_HINT(nonnull) mod_release(rlm_rcode_t *p_result, modul
 	rlm_sqlippool_t		*inst = talloc_get_type_abort(mctx->instance, rlm_sqlippool_t);
 	rlm_sql_handle_t	*handle;
 
+	if (inst->cache) return mod_update_cache(p_result, inst, request, true);
+
 	handle = fr_pool_connection_get(inst->sql_inst->pool, request);
 	if (!handle) {
 		REDEBUG("Failed reserving SQL connection");
@@ -723,6 +1629,7 @@ static unlang_action_t CC_HINT(nonnull) mod_release(rlm_rcode_t *p_result, modul
 	}
 
 	if (inst->sql_inst->sql_set_user(inst->sql_inst, request, NULL) < 0) {
+		inst->sql_inst->sql_release(inst->sql_inst, request, handle);
 		RETURN_MODULE_FAIL;
 	}
 
@@ -730,11 +1637,11 @@ static unlang_action_t CC_HINT(nonnull) mod_release(rlm_rcode_t *p_result, modul
 	DO_PART(release_clear);
 	DO_PART(release_commit);
 
-	if (handle) fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+	if (handle) inst->sql_inst->sql_release(inst->sql_inst, request, handle);
 	RETURN_MODULE_OK;
 
 	error:
-	if (handle) fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+	sqlippool_abort(inst, request, handle, inst->release_begin);
 	RETURN_MODULE_FAIL;
 }
 
@@ -753,18 +1660,30 @@ static unlang_action_t CC_HINT(nonnull) mod_bulk_release(rlm_rcode_t *p_result,
 	}
 
 	if (inst->sql_inst->sql_set_user(inst->sql_inst, request, NULL) < 0) {
+		inst->sql_inst->sql_release(inst->sql_inst, request, handle);
 		RETURN_MODULE_FAIL;
 	}
 
+	/*
+	 *	Make sure the database is up to date before
+	 *	changing it.
+	 */
+	if (inst->cache) (void) sqlippool_flush(inst, true);
+
 	DO_PART(bulk_release_begin);
 	DO_PART(bulk_release_clear);
 	DO_PART(bulk_release_commit);
 
-	if (handle) fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+	if (handle) inst->sql_inst->sql_release(inst->sql_inst, request, handle);
+
+	/*
+	 *	The leases in memory no longer match the database.
+	 */
+	if (inst->cache) sqlippool_invalidate(inst);
 	RETURN_MODULE_OK;
 
 	error:
-	if (handle) fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+	sqlippool_abort(inst, request, handle, inst->bulk_release_begin);
 	RETURN_MODULE_FAIL;
 }
 
@@ -784,18 +1703,30 @@ static unlang_action_t CC_HINT(nonnull) mod_mark(rlm_rcode_t *p_result, module_c
 	}
 
 	if (inst->sql_inst->sql_set_user(inst->sql_inst, request, NULL) < 0) {
+		inst->sql_inst->sql_release(inst->sql_inst, request, handle);
 		RETURN_MODULE_FAIL;
 	}
 
+	/*
+	 *	Make sure the database is up to date before
+	 *	changing it.
+	 */
+	if (inst->cache) (void) sqlippool_flush(inst, true);
+
 	DO_PART(mark_begin);
 	DO_PART(mark_update);
 	DO_PART(mark_commit);
 
-	if (handle) fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+	if (handle) inst->sql_inst->sql_release(inst->sql_inst, request, handle);
+
+	/*
+	 *	The leases in memory no longer match the database.
+	 */
+	if (inst->cache) sqlippool_invalidate(inst);
 	RETURN_MODULE_OK;
 
 	error:
-	if (handle) fr_pool_connection_release(inst->sql_inst->pool, request, handle);
+	sqlippool_abort(inst, request, handle, inst->mark_begin);
 	RETURN_MODULE_FAIL;
 }
 
@@ -851,6 +1782,10 @@ module_t rlm_sqlippool = {
 	.inst_size	= sizeof(rlm_sqlippool_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.thread_inst_size	= sizeof(rlm_sqlippool_thread_t),
+	.thread_inst_type	= "rlm_sqlippool_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting,
 		[MOD_POST_AUTH]		= mod_alloc
@@ -53,7 +53,7 @@ typedef struct {
 	fr_dict_attr_t const	*ipv6_da;			//!< FreeRADIUS-Stats4-IPv6-Address
 	fr_dlist_head_t		list;				//!< for threads to know about each other
 
-	uint64_t		stats[FR_RADIUS_CODE_MAX];
+	fr_stats_counters_t	*counters;			//!< global counters, one slot per thread.
 } rlm_stats_t;
 
 typedef struct {
@@ -68,7 +68,6 @@ typedef struct {
 typedef struct {
 	rlm_stats_t		*inst;
 
-	fr_time_t		last_global_update;
 	fr_dlist_t		entry;				//!< for threads to know about each other
 
 	fr_time_t		last_manage;			//!< when we deleted old things
@@ -76,7 +75,7 @@ typedef struct {
 	fr_rb_tree_t		*src;				//!< stats by source
 	fr_rb_tree_t		*dst;				//!< stats by destination
 
-	uint64_t		stats[FR_RADIUS_CODE_MAX];
+	fr_stats_slot_t		*stats;				//!< this thread's global counters.
 
 	pthread_mutex_t		mutex;
 } rlm_stats_thread_t;
@@ -135,22 +134,23 @@ static void coalesce(uint64_t final_stats[FR_RADIUS_CODE_MAX], rlm_stats_thread_
 	     other = fr_dlist_next(&t->inst->list, other)) {
 		int i;
 
-		pthread_mutex_lock(&other->mutex);
-
 		if (other == t) continue;
 
+		pthread_mutex_lock(&other->mutex);
+
 		tree = (fr_rb_tree_t **) (((uint8_t *) other) + tree_offset);
 		stats = fr_rb_find(*tree, mydata);
 		if (!stats) {
+			pthread_mutex_unlock(&other->mutex);
 			continue;
 		}
 		memcpy(&local_stats, stats->stats, sizeof(stats->stats));
 
+		pthread_mutex_unlock(&other->mutex);
+
 		for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
 			final_stats[i] += local_stats[i];
 		}
-
-		pthread_mutex_unlock(&other->mutex);
 	}
 }
 
@@ -169,7 +169,7 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 	fr_pair_t *vp;
 	rlm_stats_data_t mydata;
 	char buffer[64];
-	uint64_t local_stats[NUM_ELEMENTS(inst->stats)];
+	uint64_t local_stats[FR_RADIUS_CODE_MAX];
 
 	/*
 	 *	Increment counters only in "send foo" sections.
@@ -189,9 +189,10 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 		dst_code = request->reply->code;
 		if (dst_code >= FR_RADIUS_CODE_MAX) dst_code = 0;
 
+		FR_STATS_COUNTER_INC(t->stats, src_code);
+		FR_STATS_COUNTER_INC(t->stats, dst_code);
+
 		pthread_mutex_lock(&t->mutex);
-		t->stats[src_code]++;
-		t->stats[dst_code]++;
 
 		/*
 		 *	Update source statistics
@@ -234,19 +235,6 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 		 *	@todo - periodically clean up old entries.
 		 */
 
-		if ((t->last_global_update + NSEC) > request->async->recv_time) {
-			RETURN_MODULE_UPDATED;
-		}
-
-		t->last_global_update = request->async->recv_time;
-
-		pthread_mutex_lock(&inst->mutex);
-		for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
-			inst->stats[i] += t->stats[i];
-			t->stats[i] = 0;
-		}
-		pthread_mutex_unlock(&inst->mutex);
-
 		RETURN_MODULE_UPDATED;
 	}
 #endif
@@ -274,18 +262,11 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 	switch (stats_type) {
 	case FR_STATS4_TYPE_VALUE_GLOBAL:			/* global */
 		/*
-		 *	Merge our stats with the global stats, and then copy
-		 *	the global stats to a thread-local variable.
-		 *
-		 *	The copy helps minimize mutex contention.
+		 *	Sum the per-thread counters.  Threads never
+		 *	lock to update them, so there's nothing to
+		 *	merge here.
 		 */
-		pthread_mutex_lock(&inst->mutex);
-		for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
-			inst->stats[i] += t->stats[i];
-			t->stats[i] = 0;
-		}
-		memcpy(&local_stats, inst->stats, sizeof(inst->stats));
-		pthread_mutex_unlock(&inst->mutex);
+		fr_stats_counters_read(local_stats, inst->counters);
 		vp = NULL;
 		break;
 
@@ -368,6 +349,13 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 		TALLOC_FREE(t->src);
 		return -1;
 	}
+	t->stats = fr_stats_counters_slot(inst->counters);
+	if (unlikely(!t->stats)) {
+		TALLOC_FREE(t->src);
+		TALLOC_FREE(t->dst);
+		return -1;
+	}
+
 	pthread_mutex_init(&t->mutex, 0);
 
 	pthread_mutex_lock(&inst->mutex);
@@ -385,12 +373,12 @@ static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 {
 	rlm_stats_thread_t	*t = talloc_get_type_abort(thread, rlm_stats_thread_t);
 	rlm_stats_t		*inst = t->inst;
-	int			i;
 
+	/*
+	 *	The counter slot outlives the thread, so its
+	 *	counts are still included in the totals.
+	 */
 	pthread_mutex_lock(&inst->mutex);
-	for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
-		inst->stats[i] += t->stats[i];
-	}
 	fr_dlist_remove(&inst->list, t);
 	pthread_mutex_unlock(&inst->mutex);
 	pthread_mutex_destroy(&t->mutex);
@@ -398,9 +386,16 @@ static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 	return 0;
 }
 
-static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
 {
 	rlm_stats_t	*inst = instance;
+	char const	*name;
+
+	name = cf_section_name2(conf);
+	if (!name) name = cf_section_name1(conf);
+
+	inst->counters = fr_stats_counters_alloc(inst, "module", name, fr_packet_codes, FR_RADIUS_CODE_MAX);
+	if (!inst->counters) return -1;
 
 	pthread_mutex_init(&inst->mutex, NULL);
 	fr_dlist_init(&inst->list, rlm_stats_thread_t, entry);
@@ -0,0 +1,408 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_unbound/cache.c
+ * @brief Answer cache shared by all of the unbound contexts of a module instance.
+ *
+ * Each worker has its own libunbound context, and so its own cache.  After
+ * a restart every worker has to warm its cache separately, so the same
+ * names are resolved once per worker.  This cache sits in front of the
+ * libunbound contexts, and is shared between all of them.
+ *
+ * Answers are stored as wire format packets, keyed by name and record type.
+ * The cache is split into stripes, each with its own mutex and tree, so that
+ * workers looking up different names rarely contend.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#define LOG_PREFIX "rlm_unbound - "
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/net.h>
+#include <freeradius-devel/util/rb.h>
+
+#include <pthread.h>
+
+#include "cache.h"
+
+#define DNS_HDR_LEN	12
+#define DNS_NAME_MAX	255
+
+typedef struct {
+	fr_rb_node_t		node;		//!< Entry in the stripe's tree.
+
+	char			*name;		//!< Lowercased, without a trailing '.'.
+	int			rrtype;		//!< Record type of the query.
+
+	uint8_t			*packet;	//!< Wire format answer, as returned by libunbound.
+	size_t			packet_len;
+
+	fr_time_t		expires;	//!< When the answer must no longer be used.
+	fr_time_delta_t		ttl;		//!< How long the answer was cached for.
+	bool			prefetching;	//!< Whether a worker is already refreshing the answer.
+} unbound_cache_entry_t;
+
+typedef struct {
+	pthread_mutex_t		mutex;
+	fr_rb_tree_t		*tree;
+} unbound_cache_stripe_t;
+
+struct unbound_cache_s {
+	unbound_cache_config_t	config;
+	uint32_t		max_per_stripe;	//!< max_entries split between the stripes.
+	unbound_cache_stripe_t	*stripes;
+};
+
+static int8_t cache_entry_cmp(void const *one, void const *two)
+{
+	unbound_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->rrtype > b->rrtype) - (a->rrtype < b->rrtype);
+	if (ret != 0) return ret;
+
+	ret = strcmp(a->name, b->name);
+	return (ret > 0) - (ret < 0);
+}
+
+/** Entries aren't allocated in the tree, as several workers may be adding to a stripe
+ *
+ */
+static void cache_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+/** Produce the key for a name
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the name is too long to be cached.
+ */
+static int cache_key(char out[static DNS_NAME_MAX + 1], char const *name)
+{
+	size_t len = strlen(name), i;
+
+	if ((len > 0) && (name[len - 1] == '.')) len--;
+	if (len > DNS_NAME_MAX) return -1;
+
+	for (i = 0; i < len; i++) out[i] = tolower((uint8_t) name[i]);
+	out[len] = '\0';
+
+	return 0;
+}
+
+static inline unbound_cache_stripe_t *cache_stripe(unbound_cache_t *cache, char const *key, int rrtype)
+{
+	return &cache->stripes[(fr_hash_string(key) ^ (uint32_t) rrtype) % cache->config.stripes];
+}
+
+/** Advance past a name in a DNS packet
+ *
+ * @return
+ *	- The first byte after the name.
+ *	- NULL if the name runs past the end of the packet.
+ */
+static uint8_t const *cache_skip_name(uint8_t const *p, uint8_t const *end)
+{
+	while (p < end) {
+		if (*p == 0) return p + 1;
+
+		/*
+		 *	A pointer ends the name.
+		 */
+		if ((*p & 0xc0) == 0xc0) return ((p + 2) <= end) ? p + 2 : NULL;
+		if ((*p & 0xc0) != 0) return NULL;
+
+		p += *p + 1;
+	}
+
+	return NULL;
+}
+
+/** Find how long an answer may be cached for
+ *
+ * Positive answers are cached for the lowest TTL of the records in the
+ * answer section.  NXDOMAIN and empty answers are cached for the lowest
+ * TTL of the records in the authority section (i.e. the SOA), which is
+ * close enough to the negative TTL described in RFC 2308.  Both are capped
+ * by the configuration.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the answer shouldn't be cached, e.g. SERVFAIL or a malformed packet.
+ */
+static int cache_packet_ttl(fr_time_delta_t *out, unbound_cache_t *cache, uint8_t const *packet, size_t packet_len)
+{
+	uint8_t const	*p, *end = packet + packet_len;
+	uint16_t	qdcount, ancount, nscount, rdlength;
+	uint32_t	i;
+	uint32_t	ttl, lowest = UINT32_MAX;
+	uint8_t		rcode;
+	bool		negative;
+
+	if (packet_len < DNS_HDR_LEN) return -1;
+
+	rcode = packet[3] & 0x0f;
+	qdcount = fr_net_to_uint16(packet + 4);
+	ancount = fr_net_to_uint16(packet + 6);
+	nscount = fr_net_to_uint16(packet + 8);
+
+	switch (rcode) {
+	case 0:		/* NOERROR */
+		negative = (ancount == 0);
+		break;
+
+	case 3:		/* NXDOMAIN */
+		negative = true;
+		break;
+
+	default:
+		return -1;
+	}
+
+	p = packet + DNS_HDR_LEN;
+	for (i = 0; i < qdcount; i++) {
+		p = cache_skip_name(p, end);
+		if (!p || ((p + 4) > end)) return -1;
+		p += 4;		/* QTYPE and QCLASS */
+	}
+
+	/*
+	 *	Walk the answer section, and for negative answers,
+	 *	the authority section which follows it.
+	 */
+	for (i = 0; i < (negative ? ancount + nscount : ancount); i++) {
+		p = cache_skip_name(p, end);
+		if (!p || ((p + 10) > end)) return -1;
+
+		ttl = fr_net_to_uint32(p + 4);
+		rdlength = fr_net_to_uint16(p + 8);
+		p += 10;
+		if ((p + rdlength) > end) return -1;
+		p += rdlength;
+
+		if (negative && (i < ancount)) continue;
+		if (ttl < lowest) lowest = ttl;
+	}
+
+	if (negative) {
+		*out = cache->config.negative_ttl;
+		if ((lowest != UINT32_MAX) && (fr_time_delta_from_sec(lowest) < *out)) *out = fr_time_delta_from_sec(lowest);
+	} else {
+		*out = fr_time_delta_from_sec(lowest);
+		if (*out > cache->config.max_ttl) *out = cache->config.max_ttl;
+	}
+
+	return (*out > 0) ? 0 : -1;
+}
+
+/** Look up an answer
+ *
+ * @param[in] ctx		to allocate a copy of the answer in.
+ * @param[out] packet		a copy of the cached answer.
+ * @param[out] packet_len	length of the answer.
+ * @param[out] prefetch		true if the caller should refresh the answer, as it's about
+ *				to expire.  Only one caller is told to do so.  It must call
+ *				#unbound_cache_store or #unbound_cache_prefetch_done when
+ *				it's finished.
+ * @param[in] cache		to search.
+ * @param[in] name		being resolved.
+ * @param[in] rrtype		of the query.
+ * @return
+ *	- 1 if an answer was found.
+ *	- 0 if no usable answer was found.
+ */
+int unbound_cache_find(TALLOC_CTX *ctx, uint8_t **packet, size_t *packet_len, bool *prefetch,
+		       unbound_cache_t *cache, char const *name, int rrtype)
+{
+	char			key[DNS_NAME_MAX + 1];
+	unbound_cache_entry_t	find = { .name = key, .rrtype = rrtype }, *found;
+	unbound_cache_stripe_t	*s;
+	fr_time_t		now;
+
+	*prefetch = false;
+
+	if (cache_key(key, name) < 0) return 0;
+	s = cache_stripe(cache, key, rrtype);
+	now = fr_time();
+
+	pthread_mutex_lock(&s->mutex);
+	found = fr_rb_find(s->tree, &find);
+	if (!found) {
+	miss:
+		pthread_mutex_unlock(&s->mutex);
+		return 0;
+	}
+
+	if (found->expires <= now) {
+		fr_rb_delete(s->tree, found);
+		goto miss;
+	}
+
+	if (cache->config.prefetch && !found->prefetching &&
+	    ((found->expires - now) < ((found->ttl / 100) * cache->config.prefetch))) {
+		found->prefetching = true;
+		*prefetch = true;
+	}
+
+	MEM(*packet = talloc_memdup(ctx, found->packet, found->packet_len));
+	*packet_len = found->packet_len;
+	pthread_mutex_unlock(&s->mutex);
+
+	return 1;
+}
+
+/** Add an answer to the cache, replacing any existing answer
+ *
+ * Answers which can't be cached, e.g. SERVFAIL, are ignored.
+ *
+ * @param[in] cache		to add the answer to.
+ * @param[in] name		which was resolved.
+ * @param[in] rrtype		of the query.
+ * @param[in] packet		wire format answer.
+ * @param[in] packet_len	length of the answer.
+ */
+void unbound_cache_store(unbound_cache_t *cache, char const *name, int rrtype,
+			 uint8_t const *packet, size_t packet_len)
+{
+	char			key[DNS_NAME_MAX + 1];
+	unbound_cache_entry_t	*entry, *old;
+	unbound_cache_stripe_t	*s;
+	fr_time_delta_t		ttl;
+
+	if (cache_key(key, name) < 0) return;
+
+	if (cache_packet_ttl(&ttl, cache, packet, packet_len) < 0) {
+		unbound_cache_prefetch_done(cache, name, rrtype);
+		return;
+	}
+
+	MEM(entry = talloc_zero(NULL, unbound_cache_entry_t));
+	MEM(entry->name = talloc_typed_strdup(entry, key));
+	MEM(entry->packet = talloc_memdup(entry, packet, packet_len));
+	entry->packet_len = packet_len;
+	entry->rrtype = rrtype;
+	entry->ttl = ttl;
+	entry->expires = fr_time() + ttl;
+
+	s = cache_stripe(cache, key, rrtype);
+
+	pthread_mutex_lock(&s->mutex);
+
+	/*
+	 *	Make room by removing expired entries.  If that's
+	 *	not enough, the new answer isn't cached.
+	 */
+	if ((fr_rb_num_elements(s->tree) >= cache->max_per_stripe) && !fr_rb_find(s->tree, entry)) {
+		fr_rb_iter_inorder_t	iter;
+		fr_time_t		now = fr_time();
+
+		for (old = fr_rb_iter_init_inorder(&iter, s->tree);
+		     old;
+		     old = fr_rb_iter_next_inorder(&iter)) {
+			if (old->expires <= now) fr_rb_iter_delete_inorder(&iter);
+		}
+
+		if (fr_rb_num_elements(s->tree) >= cache->max_per_stripe) {
+			pthread_mutex_unlock(&s->mutex);
+			talloc_free(entry);
+			return;
+		}
+	}
+
+	/*
+	 *	The tree frees the answer being replaced.
+	 */
+	if (fr_rb_replace(NULL, s->tree, entry) < 0) talloc_free(entry);
+	pthread_mutex_unlock(&s->mutex);
+}
+
+/** Allow another caller to refresh an answer, after a failed prefetch
+ *
+ * @param[in] cache		containing the answer.
+ * @param[in] name		which was resolved.
+ * @param[in] rrtype		of the query.
+ */
+void unbound_cache_prefetch_done(unbound_cache_t *cache, char const *name, int rrtype)
+{
+	char			key[DNS_NAME_MAX + 1];
+	unbound_cache_entry_t	find = { .name = key, .rrtype = rrtype }, *found;
+	unbound_cache_stripe_t	*s;
+
+	if (cache_key(key, name) < 0) return;
+	s = cache_stripe(cache, key, rrtype);
+
+	pthread_mutex_lock(&s->mutex);
+	found = fr_rb_find(s->tree, &find);
+	if (found) found->prefetching = false;
+	pthread_mutex_unlock(&s->mutex);
+}
+
+static int _cache_free(unbound_cache_t *cache)
+{
+	uint32_t i;
+
+	for (i = 0; i < cache->config.stripes; i++) {
+		TALLOC_FREE(cache->stripes[i].tree);
+		pthread_mutex_destroy(&cache->stripes[i].mutex);
+	}
+
+	return 0;
+}
+
+/** Allocate a cache which may be used by many threads at once
+ *
+ * @param[in] ctx	to allocate the cache in.
+ * @param[in] config	for the cache.  Copied.
+ * @return
+ *	- A new cache.
+ *	- NULL on error.
+ */
+unbound_cache_t *unbound_cache_alloc(TALLOC_CTX *ctx, unbound_cache_config_t const *config)
+{
+	unbound_cache_t	*cache;
+	uint32_t	i;
+
+	MEM(cache = talloc_zero(ctx, unbound_cache_t));
+	cache->config = *config;
+	if (cache->config.stripes == 0) cache->config.stripes = 1;
+	if (cache->config.stripes > cache->config.max_entries) cache->config.stripes = cache->config.max_entries;
+
+	cache->max_per_stripe = cache->config.max_entries / cache->config.stripes;
+
+	MEM(cache->stripes = talloc_zero_array(cache, unbound_cache_stripe_t, cache->config.stripes));
+	for (i = 0; i < cache->config.stripes; i++) {
+		pthread_mutex_init(&cache->stripes[i].mutex, NULL);
+		cache->stripes[i].tree = fr_rb_inline_alloc(cache->stripes, unbound_cache_entry_t, node,
+							    cache_entry_cmp, cache_entry_free);
+		if (!cache->stripes[i].tree) {
+			fr_strerror_const("Failed allocating cache tree");
+			cache->config.stripes = i + 1;
+			talloc_set_destructor(cache, _cache_free);
+			talloc_free(cache);
+			return NULL;
+		}
+	}
+	talloc_set_destructor(cache, _cache_free);
+
+	return cache;
+}
@@ -0,0 +1,59 @@
+#pragma once
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Answer cache shared by all of the unbound contexts of a module instance.
+ * @file rlm_unbound/cache.h
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(rlm_unbound_cache_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+typedef struct {
+	uint32_t	max_entries;		//!< Maximum number of answers to cache.  0 disables the cache.
+	uint32_t	stripes;		//!< Number of independently locked parts of the cache.
+	fr_time_delta_t	max_ttl;		//!< Upper bound on how long answers are cached for.
+	fr_time_delta_t	negative_ttl;		//!< Upper bound on how long NXDOMAIN and empty
+						///< answers are cached for.
+	uint32_t	prefetch;		//!< Refresh an answer when less than this percentage
+						///< of its TTL remains.  0 disables prefetching.
+} unbound_cache_config_t;
+
+typedef struct unbound_cache_s unbound_cache_t;
+
+unbound_cache_t	*unbound_cache_alloc(TALLOC_CTX *ctx, unbound_cache_config_t const *config);
+
+int		unbound_cache_find(TALLOC_CTX *ctx, uint8_t **packet, size_t *packet_len, bool *prefetch,
+				   unbound_cache_t *cache, char const *name, int rrtype);
+
+void		unbound_cache_store(unbound_cache_t *cache, char const *name, int rrtype,
+				    uint8_t const *packet, size_t packet_len);
+
+void		unbound_cache_prefetch_done(unbound_cache_t *cache, char const *name, int rrtype);
+
+#ifdef __cplusplus
+}
+#endif
@@ -31,6 +31,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/log.h>
 #include <fcntl.h>
 
+#include "cache.h"
 #include "io.h"
 #include "log.h"
 
@@ -42,12 +43,17 @@ typedef struct {
 	char const	*filename;		//!< Unbound configuration file
 	char const	*resolvconf;		//!< resolv.conf file to use
 	char const	*hosts;			//!< hosts file to load
+
+	unbound_cache_config_t	cache_config;	//!< Configuration for the shared answer cache.
+	unbound_cache_t		*cache;		//!< Answers shared between all of the workers.
+						///< NULL if caching is disabled.
 } rlm_unbound_t;
 
 typedef struct {
 	unbound_io_event_base_t	*ev_b;		//!< Unbound event base
 	rlm_unbound_t		*inst;		//!< Instance data
 	unbound_log_t		*u_log;		//!< Unbound log structure
+	fr_dlist_head_t		prefetch;	//!< Outstanding cache refreshes.
 } rlm_unbound_thread_t;
 
 typedef struct {
@@ -55,6 +61,8 @@ typedef struct {
 	rlm_unbound_thread_t	*t;		//!< Thread structure
 } unbound_xlat_thread_inst_t;
 
+typedef struct unbound_batch_s unbound_batch_t;
+
 typedef struct {
 	int			async_id;	//!< Id of async query
 	request_t		*request;	//!< Current request being processed
@@ -67,8 +75,64 @@ typedef struct {
 	fr_value_box_list_t	list;		//!< Where to put the parsed results
 	TALLOC_CTX		*out_ctx;	//!< CTX to allocate parsed results in
 	fr_event_timer_t const	*ev;		//!< Event for timeout
+
+	char const		*host;		//!< Name being resolved.
+	int			rrtype;		//!< Record type being resolved.
+	unbound_batch_t		*batch;		//!< Batch this query is part of, if any.
 } unbound_request_t;
 
+/** Several queries made by a single xlat call, which are resolved concurrently
+ *
+ */
+struct unbound_batch_s {
+	request_t		*request;	//!< Current request being processed
+	unbound_request_t	**queries;	//!< In the order the names were given.
+	unsigned int		num_queries;
+	unsigned int		pending;	//!< Queries which haven't completed yet.
+	fr_event_timer_t const	*ev;		//!< Event for timeout
+};
+
+/** A query made to refresh a cached answer before it expires
+ *
+ */
+typedef struct {
+	rlm_unbound_thread_t	*t;		//!< Thread running the query.
+	char const		*host;		//!< Name being resolved.
+	int			rrtype;		//!< Record type being resolved.
+	int			async_id;	//!< Id of async query
+	bool			starting;	//!< Whether ub_resolve_event() hasn't returned yet.
+	fr_dlist_t		entry;		//!< Entry in the thread's list of prefetches.
+} unbound_prefetch_t;
+
+/** The record types we know how to parse
+ *
+ */
+typedef struct {
+	char const		*name;		//!< As given in the xlat.
+	int			rrtype;		//!< As sent on the wire.
+	fr_type_t		return_type;	//!< Data type to parse results into
+	bool			has_priority;	//!< Does the returned data start with a priority field
+} unbound_query_type_t;
+
+static unbound_query_type_t const unbound_query_types[] = {
+	{ "A",		1,	FR_TYPE_IPV4_ADDR,	false },
+	{ "AAAA",	28,	FR_TYPE_IPV6_ADDR,	false },
+	{ "PTR",	12,	FR_TYPE_STRING,		false },
+	{ "MX",		15,	FR_TYPE_STRING,		true },
+	{ "SRV",	33,	FR_TYPE_STRING,		true },
+	{ "TXT",	16,	FR_TYPE_STRING,		false },
+	{ "CERT",	37,	FR_TYPE_OCTETS,		false }
+};
+
+static const CONF_PARSER cache_config[] = {
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, unbound_cache_config_t, max_entries), .dflt = "10000" },
+	{ FR_CONF_OFFSET("stripes", FR_TYPE_UINT32, unbound_cache_config_t, stripes), .dflt = "16" },
+	{ FR_CONF_OFFSET("max_ttl", FR_TYPE_TIME_DELTA, unbound_cache_config_t, max_ttl), .dflt = "86400" },
+	{ FR_CONF_OFFSET("negative_ttl", FR_TYPE_TIME_DELTA, unbound_cache_config_t, negative_ttl), .dflt = "60" },
+	{ FR_CONF_OFFSET("prefetch", FR_TYPE_UINT32, unbound_cache_config_t, prefetch), .dflt = "10" },
+	CONF_PARSER_TERMINATOR
+};
+
 /*
  *	A mapping of configuration file names to internal variables.
  */
@@ -77,6 +141,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_UINT32, rlm_unbound_t, timeout), .dflt = "3000" },
 	{ FR_CONF_OFFSET("resolvconf", FR_TYPE_FILE_INPUT, rlm_unbound_t, resolvconf) },
 	{ FR_CONF_OFFSET("hosts", FR_TYPE_FILE_INPUT, rlm_unbound_t, hosts) },
+	{ FR_CONF_OFFSET("cache", FR_TYPE_SUBSECTION, rlm_unbound_t, cache_config), .subcs = (void const *) cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -90,20 +155,20 @@ static int _unbound_request_free(unbound_request_t *ur)
 	return 0;
 }
 
-/**	Callback called by unbound when resolution started with ub_resolve_event() completes
+/**	Parse an answer into value boxes
  *
- * @param mydata	the request tracking structure set up before ub_resolve_event() was called
+ * Sets ur->done to 1 on success, or to a negative error code.
+ *
+ * @param ur		the request tracking structure.
  * @param rcode		should be the rcode from the reply packet, but appears not to be
  * @param packet	wire format reply packet
  * @param packet_len	length of wire format packet
  * @param sec		DNSSEC status code
  * @param why_bogus	String describing DNSSEC issue if sec = 1
- * @param rate_limited	Was the request rate limited due to unbound workload
  */
-static void xlat_unbound_callback(void *mydata, int rcode, void *packet, int packet_len, int sec,
-				  char* why_bogus, UNUSED int rate_limited)
+static void unbound_request_parse(unbound_request_t *ur, int rcode, void *packet, int packet_len, int sec,
+				  char const *why_bogus)
 {
-	unbound_request_t	*ur = talloc_get_type_abort(mydata, unbound_request_t);
 	request_t		*request = ur->request;
 	fr_dbuff_t		dbuff;
 	uint16_t		qdcount = 0, ancount = 0, i, rdlength = 0;
@@ -111,20 +176,13 @@ static void xlat_unbound_callback(void *mydata, int rcode, void *packet, int pac
 	ssize_t			used;
 	fr_value_box_t		*vb;
 
-	/*
-	 *	Request has completed remove timeout event and set
-	 *	async_id to 0 so ub_cancel() is not called when ur is freed
-	 */
-	if (ur->ev) (void)fr_event_timer_delete(&ur->ev);
-	ur->async_id = 0;
-
 	/*
 	 *	Bogus responses have the "sec" flag set to 1
 	 */
 	if (sec == 1) {
 		RERROR("%s", why_bogus);
 		ur->done = -16;
-		goto resume;
+		return;
 	}
 
 	RHEXDUMP4((uint8_t const *)packet, packet_len, "Unbound callback called with packet [length %d]", packet_len);
@@ -143,14 +201,14 @@ static void xlat_unbound_callback(void *mydata, int rcode, void *packet, int pac
 	if (rcode != 0) {
 		ur->done = 0 - rcode;
 		REDEBUG("DNS rcode is %d", rcode);
-		goto resume;
+		return;
 	}
 
 	fr_dbuff_out(&qdcount, &dbuff);
 	if (qdcount > 1) {
 		RERROR("DNS results packet with multiple questions");
 		ur->done = -32;
-		goto resume;
+		return;
 	}
 
 	/*	How many answer records do we have? */
@@ -207,7 +265,7 @@ static void xlat_unbound_callback(void *mydata, int rcode, void *packet, int pac
 				talloc_free(vb);
 				fr_dlist_talloc_free(&ur->list);
 				ur->done = -32;
-				goto resume;
+				return;
 			}
 			fr_dbuff_advance(&dbuff, rdlength);
 			break;
@@ -250,9 +308,190 @@ static void xlat_unbound_callback(void *mydata, int rcode, void *packet, int pac
 	}
 
 	ur->done = 1;
+}
 
-resume:
-	unlang_interpret_mark_runnable(ur->request);
+/**	Tell the request that a query has completed
+ *
+ * Queries which are part of a batch only resume the request once all of
+ * the other queries in the batch have completed.
+ */
+static void unbound_request_done(unbound_request_t *ur)
+{
+	unbound_batch_t	*batch = ur->batch;
+
+	if (!batch) {
+		unlang_interpret_mark_runnable(ur->request);
+		return;
+	}
+
+	fr_assert(batch->pending > 0);
+	if (--batch->pending > 0) return;
+
+	if (batch->ev) (void)fr_event_timer_delete(&batch->ev);
+	unlang_interpret_mark_runnable(batch->request);
+}
+
+/**	Callback called by unbound when resolution started with ub_resolve_event() completes
+ *
+ * @param mydata	the request tracking structure set up before ub_resolve_event() was called
+ * @param rcode		should be the rcode from the reply packet, but appears not to be
+ * @param packet	wire format reply packet
+ * @param packet_len	length of wire format packet
+ * @param sec		DNSSEC status code
+ * @param why_bogus	String describing DNSSEC issue if sec = 1
+ * @param rate_limited	Was the request rate limited due to unbound workload
+ */
+static void xlat_unbound_callback(void *mydata, int rcode, void *packet, int packet_len, int sec,
+				  char* why_bogus, UNUSED int rate_limited)
+{
+	unbound_request_t	*ur = talloc_get_type_abort(mydata, unbound_request_t);
+	rlm_unbound_t		*inst = ur->t->inst;
+
+	/*
+	 *	Request has completed remove timeout event and set
+	 *	async_id to 0 so ub_cancel() is not called when ur is freed
+	 */
+	if (ur->ev) (void)fr_event_timer_delete(&ur->ev);
+	ur->async_id = 0;
+
+	/*
+	 *	Share the answer with the other workers.  Bogus
+	 *	answers are never cached.
+	 */
+	if (inst->cache && (sec != 1) && (packet_len > 0)) {
+		unbound_cache_store(inst->cache, ur->host, ur->rrtype, packet, (size_t)packet_len);
+	}
+
+	unbound_request_parse(ur, rcode, packet, packet_len, sec, why_bogus);
+	unbound_request_done(ur);
+}
+
+static int _unbound_prefetch_free(unbound_prefetch_t *up)
+{
+	if (up->async_id != 0) ub_cancel(up->t->ev_b->ub, up->async_id);
+	fr_dlist_remove(&up->t->prefetch, up);
+
+	/*
+	 *	Let another worker try, if we didn't store a new
+	 *	answer.
+	 */
+	unbound_cache_prefetch_done(up->t->inst->cache, up->host, up->rrtype);
+
+	return 0;
+}
+
+/**	Callback called by unbound when a prefetch completes
+ *
+ */
+static void unbound_prefetch_callback(void *mydata, UNUSED int rcode, void *packet, int packet_len, int sec,
+				      UNUSED char* why_bogus, UNUSED int rate_limited)
+{
+	unbound_prefetch_t	*up = talloc_get_type_abort(mydata, unbound_prefetch_t);
+
+	up->async_id = 0;
+
+	if ((sec != 1) && (packet_len > 0)) {
+		unbound_cache_store(up->t->inst->cache, up->host, up->rrtype, packet, (size_t)packet_len);
+	}
+
+	/*
+	 *	Answered from local data, unbound_prefetch() frees it.
+	 */
+	if (up->starting) return;
+
+	talloc_free(up);
+}
+
+/**	Refresh a cached answer which is about to expire
+ *
+ * Nothing waits for the result, the next query for the name finds it in
+ * the cache.
+ */
+static void unbound_prefetch(rlm_unbound_thread_t *t, char const *host, int rrtype)
+{
+	unbound_prefetch_t	*up;
+	int			res;
+
+	MEM(up = talloc_zero(t, unbound_prefetch_t));
+	up->t = t;
+	MEM(up->host = talloc_typed_strdup(up, host));
+	up->rrtype = rrtype;
+	fr_dlist_insert_tail(&t->prefetch, up);
+	talloc_set_destructor(up, _unbound_prefetch_free);
+
+	DEBUG3("%s - Prefetching %s", t->inst->name, host);
+
+	up->starting = true;
+	res = ub_resolve_event(t->ev_b->ub, host, rrtype, 1, up, unbound_prefetch_callback, &up->async_id);
+	up->starting = false;
+
+	if ((res == 0) && (up->async_id != 0)) return;
+
+	talloc_free(up);
+}
+
+/**	Start resolving a name, using the shared cache if possible
+ *
+ * @return
+ *	- 1 if the query completed immediately.
+ *	- 0 if the query will complete asynchronously.
+ *	- -1 on error.
+ */
+static int unbound_request_start(unbound_request_t *ur, char const *host, unbound_query_type_t const *qt)
+{
+	request_t		*request = ur->request;
+	rlm_unbound_t		*inst = ur->t->inst;
+	int			res;
+
+	ur->return_type = qt->return_type;
+	ur->has_priority = qt->has_priority;
+	ur->rrtype = qt->rrtype;
+	MEM(ur->host = talloc_typed_strdup(ur, host));
+
+	if (inst->cache) {
+		uint8_t		*packet;
+		size_t		packet_len;
+		bool		prefetch;
+
+		if (unbound_cache_find(ur, &packet, &packet_len, &prefetch, inst->cache, host, qt->rrtype) == 1) {
+			RDEBUG3("Found %s %s in cache", qt->name, host);
+
+			unbound_request_parse(ur, 0, packet, (int)packet_len, 0, NULL);
+			talloc_free(packet);
+
+			if (prefetch) unbound_prefetch(ur->t, host, qt->rrtype);
+
+			/*
+			 *	Batches count completions, and there's
+			 *	no callback to do it for us.
+			 */
+			if (ur->batch) unbound_request_done(ur);
+			return 1;
+		}
+	}
+
+	res = ub_resolve_event(ur->t->ev_b->ub, host, qt->rrtype, 1, ur, xlat_unbound_callback, &ur->async_id);
+	if (res != 0) {
+		REDEBUG("%s - Failed resolving %s: %s", inst->name, host, ub_strerror(res));
+		return -1;
+	}
+
+	/*
+	 *	unbound returned before we yielded - This is when
+	 *	serving results from local data.
+	 */
+	return (ur->async_id == 0) ? 1 : 0;
+}
+
+static unbound_query_type_t const *unbound_query_type(char const *name)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_ELEMENTS(unbound_query_types); i++) {
+		if (strcmp(name, unbound_query_types[i].name) == 0) return &unbound_query_types[i];
+	}
+
+	return NULL;
 }
 
 /**	Callback from our timeout event to cancel a request
@@ -352,6 +591,8 @@ static xlat_action_t xlat_unbound(TALLOC_CTX *ctx, fr_dcursor_t *out, request_t
 	fr_value_box_t			*count_vb = fr_dlist_next(in, query_vb);
 	unbound_xlat_thread_inst_t	*xt = talloc_get_type_abort(xlat_thread_inst, unbound_xlat_thread_inst_t);
 	unbound_request_t		*ur;
+	unbound_query_type_t const	*qt;
+	int				ret;
 
 	if (host_vb->length == 0) {
 		REDEBUG("Can't resolve zero length host");
@@ -374,31 +615,22 @@ static xlat_action_t xlat_unbound(TALLOC_CTX *ctx, fr_dcursor_t *out, request_t
 	ur->t = xt->t;
 	ur->out_ctx = ctx;
 
-#define UB_QUERY(_record, _rrvalue, _return, _hasprio) \
-	if (strcmp(query_vb->vb_strvalue, _record) == 0) { \
-		ur->return_type = _return; \
-		ur->has_priority = _hasprio; \
-		ub_resolve_event(xt->t->ev_b->ub, host_vb->vb_strvalue, _rrvalue, 1, ur, \
-				xlat_unbound_callback, &ur->async_id); \
+	qt = unbound_query_type(query_vb->vb_strvalue);
+	if (!qt) {
+		REDEBUG("Invalid / unsupported DNS query type");
+		return XLAT_ACTION_FAIL;
 	}
 
-	UB_QUERY("A", 1, FR_TYPE_IPV4_ADDR, false)
-	else UB_QUERY("AAAA", 28, FR_TYPE_IPV6_ADDR, false)
-	else UB_QUERY("PTR", 12, FR_TYPE_STRING, false)
-	else UB_QUERY("MX", 15, FR_TYPE_STRING, true)
-	else UB_QUERY("SRV", 33, FR_TYPE_STRING, true)
-	else UB_QUERY("TXT", 16, FR_TYPE_STRING, false)
-	else UB_QUERY("CERT", 37, FR_TYPE_OCTETS, false)
-	else {
-		REDEBUG("Invalid / unsupported DNS query type");
+	ret = unbound_request_start(ur, host_vb->vb_strvalue, qt);
+	if (ret < 0) {
+		talloc_free(ur);
 		return XLAT_ACTION_FAIL;
 	}
 
 	/*
-	 *	unbound returned before we yielded - run the callback
-	 *	This is when serving results from local data
+	 *	The answer was cached, or served from local data.
 	 */
-	if (ur->async_id == 0) return xlat_unbound_resume(NULL, out, request, NULL, NULL, NULL, ur);
+	if (ret == 1) return xlat_unbound_resume(NULL, out, request, NULL, NULL, NULL, ur);
 
 	if (fr_event_timer_in(ur, ur->t->ev_b->el, &ur->ev, fr_time_delta_from_msec(xt->inst->timeout),
 			      xlat_unbound_timeout, ur) < 0) {
@@ -410,6 +642,161 @@ static xlat_action_t xlat_unbound(TALLOC_CTX *ctx, fr_dcursor_t *out, request_t
 	return unlang_xlat_yield(request, xlat_unbound_resume, xlat_unbound_signal, ur);
 }
 
+/**	Callback from our timeout event to give up on the rest of a batch
+ *
+ */
+static void xlat_unbound_batch_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	unbound_batch_t	*batch = talloc_get_type_abort(uctx, unbound_batch_t);
+	request_t	*request = batch->request;
+	unsigned int	i;
+
+	REDEBUG("Timeout waiting for DNS resolution");
+
+	for (i = 0; i < batch->num_queries; i++) {
+		unbound_request_t *ur = batch->queries[i];
+
+		if (ur->async_id == 0) continue;
+
+		ub_cancel(ur->t->ev_b->ub, ur->async_id);
+		ur->async_id = 0;
+	}
+	batch->pending = 0;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+static void xlat_unbound_batch_signal(request_t *request, UNUSED void *instance, UNUSED void *thread,
+				      void *rctx, fr_state_signal_t action)
+{
+	unbound_batch_t	*batch = talloc_get_type_abort(rctx, unbound_batch_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	if (batch->ev) (void)fr_event_timer_delete(&batch->ev);
+
+	RDEBUG2("Forcefully cancelling pending unbound requests");
+	talloc_free(batch);
+}
+
+/*
+ *	Xlat resume callback after all of the queries in a batch have
+ *	either returned or timed out.
+ */
+static xlat_action_t xlat_unbound_batch_resume(UNUSED TALLOC_CTX *ctx, fr_dcursor_t *out, request_t *request,
+					       UNUSED void const *xlat_inst, UNUSED void *xlat_thread_inst,
+					       UNUSED fr_value_box_list_t *in, void *rctx)
+{
+	unbound_batch_t	*batch = talloc_get_type_abort(rctx, unbound_batch_t);
+	fr_value_box_t	*vb;
+	unsigned int	i, resolved = 0;
+
+	for (i = 0; i < batch->num_queries; i++) {
+		unbound_request_t *ur = batch->queries[i];
+
+		if (ur->done != 1) {
+			RWDEBUG("%s - Failed resolving %s", ur->t->inst->name, ur->host);
+			continue;
+		}
+
+		while ((vb = fr_dlist_pop_head(&ur->list))) fr_dcursor_append(out, vb);
+		resolved++;
+	}
+
+	talloc_free(batch);
+
+	if (!resolved) {
+		REDEBUG("No names could be resolved");
+		return XLAT_ACTION_FAIL;
+	}
+
+	return XLAT_ACTION_DONE;
+}
+
+static xlat_arg_parser_t const xlat_unbound_batch_args[] = {
+	{ .required = true, .concat = true, .type = FR_TYPE_STRING },
+	{ .required = true, .concat = true, .variadic = true, .type = FR_TYPE_STRING },
+	XLAT_ARG_PARSER_TERMINATOR
+};
+
+/** Resolve several names concurrently using libunbound
+ *
+ * Results are returned in the order the names were given.  Names which
+ * can't be resolved are skipped.
+ *
+@verbatim
+%(<inst>_batch:<type> <name> [<name> ...])
+@endverbatim
+ *
+ * @ingroup xlat_functions
+ */
+static xlat_action_t xlat_unbound_batch(TALLOC_CTX *ctx, fr_dcursor_t *out, request_t *request,
+					UNUSED void const *xlat_inst, void *xlat_thread_inst,
+					fr_value_box_list_t *in)
+{
+	fr_value_box_t			*query_vb = fr_dlist_head(in), *host_vb;
+	unbound_xlat_thread_inst_t	*xt = talloc_get_type_abort(xlat_thread_inst, unbound_xlat_thread_inst_t);
+	unbound_query_type_t const	*qt;
+	unbound_batch_t			*batch;
+	unsigned int			i = 0;
+
+	qt = unbound_query_type(query_vb->vb_strvalue);
+	if (!qt) {
+		REDEBUG("Invalid / unsupported DNS query type");
+		return XLAT_ACTION_FAIL;
+	}
+
+	MEM(batch = talloc_zero(unlang_interpret_frame_talloc_ctx(request), unbound_batch_t));
+	batch->request = request;
+	batch->num_queries = fr_dlist_num_elements(in) - 1;
+	MEM(batch->queries = talloc_zero_array(batch, unbound_request_t *, batch->num_queries));
+
+	/*
+	 *	Hold the batch open until all of the queries have
+	 *	been started, so that queries which complete
+	 *	immediately don't resume the request.
+	 */
+	batch->pending = 1;
+
+	for (host_vb = fr_dlist_next(in, query_vb); host_vb; host_vb = fr_dlist_next(in, host_vb)) {
+		unbound_request_t	*ur;
+
+		MEM(ur = batch->queries[i++] = talloc_zero(batch, unbound_request_t));
+		talloc_set_destructor(ur, _unbound_request_free);
+		fr_value_box_list_init(&ur->list);
+
+		ur->count = UINT16_MAX;
+		ur->request = request;
+		ur->t = xt->t;
+		ur->out_ctx = ctx;
+
+		if (host_vb->length == 0) {
+			RWDEBUG("Can't resolve zero length host");
+			ur->done = -32;
+			continue;
+		}
+
+		batch->pending++;
+		ur->batch = batch;
+
+		if (unbound_request_start(ur, host_vb->vb_strvalue, qt) < 0) {
+			ur->done = -32;
+			batch->pending--;
+		}
+	}
+
+	if (--batch->pending == 0) return xlat_unbound_batch_resume(NULL, out, request, NULL, NULL, NULL, batch);
+
+	if (fr_event_timer_in(batch, xt->t->ev_b->el, &batch->ev, fr_time_delta_from_msec(xt->inst->timeout),
+			      xlat_unbound_batch_timeout, batch) < 0) {
+		REDEBUG("Unable to attach unbound timeout_envent");
+		talloc_free(batch);
+		return XLAT_ACTION_FAIL;
+	}
+
+	return unlang_xlat_yield(request, xlat_unbound_batch_resume, xlat_unbound_batch_signal, batch);
+}
+
 static int mod_xlat_thread_instantiate(UNUSED void *xlat_inst, void *xlat_thread_inst,
 				       UNUSED xlat_exp_t const *exp, void *uctx)
 {
@@ -429,6 +816,8 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 	int			res;
 
 	t->inst = inst;
+	fr_dlist_talloc_init(&t->prefetch, unbound_prefetch_t, entry);
+
 	if (unbound_io_init(t, &t->ev_b, el) < 0) {
 		PERROR("Unable to create unbound event base");
 		return -1;
@@ -478,6 +867,13 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 {
 	rlm_unbound_thread_t	*t = talloc_get_type_abort(thread, rlm_unbound_thread_t);
+	unbound_prefetch_t	*up;
+
+	/*
+	 *	Cancel outstanding prefetches while the unbound
+	 *	context still exists.
+	 */
+	while ((up = fr_dlist_head(&t->prefetch))) talloc_free(up);
 
 	talloc_free(t->u_log);
 	talloc_free(t->ev_b);
@@ -489,6 +885,7 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 {
 	rlm_unbound_t	*inst = instance;
 	xlat_t		*xlat;
+	char		*batch_name;
 
 	inst->name = cf_section_name2(conf);
 	if (!inst->name) inst->name = cf_section_name1(conf);
@@ -498,10 +895,37 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	if (inst->cache_config.prefetch > 100) {
+		cf_log_err(conf, "cache.prefetch must be 0 to 100");
+		return -1;
+	}
+
 	if(!(xlat = xlat_register(NULL, inst->name, xlat_unbound, true))) return -1;
 	xlat_func_args(xlat, xlat_unbound_args);
 	xlat_async_thread_instantiate_set(xlat, mod_xlat_thread_instantiate, unbound_xlat_thread_inst_t, NULL, inst);
 
+	MEM(batch_name = talloc_asprintf(NULL, "%s_batch", inst->name));
+	xlat = xlat_register(NULL, batch_name, xlat_unbound_batch, true);
+	talloc_free(batch_name);
+	if (!xlat) return -1;
+	xlat_func_args(xlat, xlat_unbound_batch_args);
+	xlat_async_thread_instantiate_set(xlat, mod_xlat_thread_instantiate, unbound_xlat_thread_inst_t, NULL, inst);
+
+	return 0;
+}
+
+static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
+{
+	rlm_unbound_t	*inst = instance;
+
+	if (!inst->cache_config.max_entries) return 0;
+
+	inst->cache = unbound_cache_alloc(inst, &inst->cache_config);
+	if (!inst->cache) {
+		PERROR("%s - Failed creating answer cache", inst->name);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -513,6 +937,7 @@ module_t rlm_unbound = {
 	.inst_size		= sizeof(rlm_unbound_t),
 	.config			= module_config,
 	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
 
 	.thread_inst_size	= sizeof(rlm_unbound_thread_t),
 	.thread_inst_type	= "rlm_unbound_thread_t",
@@ -35,100 +35,158 @@ RCSID("$Id$")
 #include "rlm_winbind.h"
 #include "auth_wbclient_pap.h"
 
-/** PAP authentication direct to winbind via Samba's libwbclient library
+/** Everything needed to authenticate against winbind without touching the request
  *
- * @param[in] inst Module instance
- * @param[in] request The current request
- * @param[in] password the User-Password
+ * Filled in on the worker, and then passed to #wbclient_pap_auth, which may run
+ * on an offload helper thread.
+ */
+struct winbind_pap_s {
+	fr_pool_t			*pool;			//!< To get winbind connections from.
+	struct wbcAuthUserParams	authparams;		//!< Request to send to winbind.
+	char				*password;		//!< Copy of the User-Password.
+
+	bool				no_connection;		//!< Couldn't get a connection from the pool.
+	wbcErr				err;			//!< From wbcCtxAuthenticateUserEx.
+	uint32_t			nt_status;		//!< From the error info, if there was any.
+	char				*display_string;	//!< From the error info, if there was any.
+};
+
+static int _winbind_pap_free(winbind_pap_t *wbc)
+{
+	if (wbc->password) memset(wbc->password, 0, talloc_array_length(wbc->password));
+
+	return 0;
+}
+
+/** Build the winbind authentication parameters
  *
  * @return
- *	- 0	Success
- *	- -1	Authentication failure
- *	- -648	Password expired
- *
+ *	- The new context on success.  Has no talloc parent.
+ *	- NULL on failure.
  */
-int do_auth_wbclient_pap(rlm_winbind_t const *inst, request_t *request, fr_pair_t *password)
+static winbind_pap_t *wbclient_pap_prepare(rlm_winbind_t const *inst, request_t *request, fr_pair_t *password)
 {
-	int ret = -1;
-	struct wbcContext *wb_ctx;
-	struct wbcAuthUserParams authparams;
-	wbcErr err;
-	int len;
-	struct wbcAuthUserInfo *info = NULL;
-	struct wbcAuthErrorInfo *error = NULL;
-	char user_name_buf[500];
-	char domain_name_buf[500];
+	winbind_pap_t			*wbc;
+	struct wbcAuthUserParams	*authparams;
+	ssize_t				slen;
 
 	/*
-	 * Clear the auth parameters - this is important, as
-	 * there are options that will cause wbcAuthenticateUserEx
-	 * to bomb out if not zero.
+	 * wb_username must be set for this function to be called
 	 */
-	memset(&authparams, 0, sizeof(authparams));
+	fr_assert(inst->wb_username);
 
 	/*
-	 * wb_username must be set for this function to be called
+	 * The auth parameters are zeroed here - this is important, as
+	 * there are options that will cause wbcAuthenticateUserEx
+	 * to bomb out if not zero.
 	 */
-	fr_assert(inst->wb_username);
+	MEM(wbc = talloc_zero_pooled_object(NULL, winbind_pap_t, 4, 1024));
+	talloc_set_destructor(wbc, _winbind_pap_free);
+	wbc->pool = inst->wb_pool;
+	authparams = &wbc->authparams;
 
 	/*
 	 * Get the username and domain from the configuration
 	 */
-	len = tmpl_expand(&authparams.account_name, user_name_buf, sizeof(user_name_buf),
-			  request, inst->wb_username, NULL, NULL);
-	if (len < 0) {
+	slen = tmpl_aexpand(wbc, &authparams->account_name, request, inst->wb_username, NULL, NULL);
+	if (slen < 0) {
 		REDEBUG2("Unable to expand winbind_username");
-		goto done;
+	error:
+		talloc_free(wbc);
+		return NULL;
 	}
 
 	if (inst->wb_domain) {
-		len = tmpl_expand(&authparams.domain_name, domain_name_buf, sizeof(domain_name_buf),
-				  request, inst->wb_domain, NULL, NULL);
-		if (len < 0) {
+		slen = tmpl_aexpand(wbc, &authparams->domain_name, request, inst->wb_domain, NULL, NULL);
+		if (slen < 0) {
 			REDEBUG2("Unable to expand winbind_domain");
-			goto done;
+			goto error;
 		}
 	} else {
 		RWDEBUG2("No domain specified; authentication may fail because of this");
 	}
 
+	MEM(wbc->password = talloc_bstrndup(wbc, password->vp_strvalue, password->vp_length));
 
 	/*
 	 * Build the wbcAuthUserParams structure with what we know
 	 */
-	authparams.level = WBC_AUTH_USER_LEVEL_PLAIN;
-	authparams.password.plaintext = password->data.vb_strvalue;
+	authparams->level = WBC_AUTH_USER_LEVEL_PLAIN;
+	authparams->password.plaintext = wbc->password;
 
 	/*
 	 * Parameters documented as part of the MSV1_0_SUBAUTH_LOGON structure
 	 * at https://msdn.microsoft.com/aa378767.aspx
 	 */
-	authparams.parameter_control |= WBC_MSV1_0_CLEARTEXT_PASSWORD_ALLOWED |
-					WBC_MSV1_0_ALLOW_WORKSTATION_TRUST_ACCOUNT |
-					WBC_MSV1_0_ALLOW_SERVER_TRUST_ACCOUNT;
+	authparams->parameter_control |= WBC_MSV1_0_CLEARTEXT_PASSWORD_ALLOWED |
+					 WBC_MSV1_0_ALLOW_WORKSTATION_TRUST_ACCOUNT |
+					 WBC_MSV1_0_ALLOW_SERVER_TRUST_ACCOUNT;
 
-	/*
-	 * Send auth request across to winbind
-	 */
-	wb_ctx = fr_pool_connection_get(inst->wb_pool, request);
-	if (wb_ctx == NULL) {
-		RERROR("Unable to get winbind connection from pool");
-		goto done;
+	RDEBUG2("Sending authentication request user='%s' domain='%s'", authparams->account_name,
+									authparams->domain_name);
+
+	return wbc;
+}
+
+/** Send the authentication request to winbind
+ *
+ * Blocks until winbind responds.  Doesn't touch the request, so may be
+ * run on an offload helper thread.
+ *
+ * @param[in] uctx	The #winbind_pap_t to authenticate.
+ */
+static void wbclient_pap_auth(void *uctx)
+{
+	winbind_pap_t		*wbc = talloc_get_type_abort(uctx, winbind_pap_t);
+	struct wbcContext	*wb_ctx;
+	struct wbcAuthUserInfo	*info = NULL;
+	struct wbcAuthErrorInfo	*error = NULL;
+
+	wb_ctx = fr_pool_connection_get(wbc->pool, NULL);
+	if (!wb_ctx) {
+		wbc->no_connection = true;
+		return;
 	}
 
-	RDEBUG2("Sending authentication request user='%s' domain='%s'", authparams.account_name,
-									authparams.domain_name);
+	wbc->err = wbcCtxAuthenticateUserEx(wb_ctx, &wbc->authparams, &info, &error);
+
+	fr_pool_connection_release(wbc->pool, NULL, wb_ctx);
 
-	err = wbcCtxAuthenticateUserEx(wb_ctx, &authparams, &info, &error);
+	if (error) {
+		wbc->nt_status = error->nt_status;
+		if (error->display_string) MEM(wbc->display_string = talloc_strdup(wbc, error->display_string));
+	}
+
+	if (info) wbcFreeMemory(info);
+	if (error) wbcFreeMemory(error);
+}
 
-	fr_pool_connection_release(inst->wb_pool, request, wb_ctx);
+/** Log the result of a winbind PAP authentication
+ *
+ * Also used to retrieve the result of an offloaded authentication, after
+ * which the offload job should be freed.
+ *
+ * @param[in] request	The current request.
+ * @param[in] wbc	Authentication context.
+ * @return
+ *	- 0	Success
+ *	- -1	Authentication failure
+ *	- -648	Password expired
+ */
+int do_auth_wbclient_pap_result(request_t *request, winbind_pap_t *wbc)
+{
+	int ret = -1;
 
+	if (wbc->no_connection) {
+		RERROR("Unable to get winbind connection from pool");
+		return -1;
+	}
 
 	/*
 	 * Try and give some useful feedback on what happened. There are only
 	 * a few errors that can actually be returned from wbcCtxAuthenticateUserEx.
 	 */
-	switch (err) {
+	switch (wbc->err) {
 	case WBC_ERR_SUCCESS:
 		ret = 0;
 		RDEBUG2("Authenticated successfully");
@@ -145,7 +203,7 @@ int do_auth_wbclient_pap(rlm_winbind_t const *inst, request_t *request, fr_pair_
 		break;
 
 	case WBC_ERR_AUTH_ERROR:
-		if (!error) {
+		if (!wbc->nt_status && !wbc->display_string) {
 			REDEBUG2("Authentication failed");
 			break;
 		}
@@ -153,18 +211,18 @@ int do_auth_wbclient_pap(rlm_winbind_t const *inst, request_t *request, fr_pair_
 		/*
 		 * The password needs to be changed, set ret appropriately.
 		 */
-		if (error->nt_status == NT_STATUS_PASSWORD_EXPIRED ||
-		    error->nt_status == NT_STATUS_PASSWORD_MUST_CHANGE) {
+		if (wbc->nt_status == NT_STATUS_PASSWORD_EXPIRED ||
+		    wbc->nt_status == NT_STATUS_PASSWORD_MUST_CHANGE) {
 			ret = -648;
 		}
 
 		/*
 		 * Return the NT_STATUS human readable error string, if there is one.
 		 */
-		if (error->display_string) {
-			REDEBUG2("%s [0x%X]", error->display_string, error->nt_status);
+		if (wbc->display_string) {
+			REDEBUG2("%s [0x%X]", wbc->display_string, wbc->nt_status);
 		} else {
-			REDEBUG2("Unknown authentication failure [0x%X]", error->nt_status);
+			REDEBUG2("Unknown authentication failure [0x%X]", wbc->nt_status);
 		}
 		break;
 
@@ -175,19 +233,80 @@ int do_auth_wbclient_pap(rlm_winbind_t const *inst, request_t *request, fr_pair_
 		 *   WBC_ERR_NO_MEMORY
 		 * neither of which are particularly likely.
 		 */
-		if (error && error->display_string) {
-			REDEBUG2("Failed authenticating user: %s (%s)", error->display_string, wbcErrorString(err));
+		if (wbc->display_string) {
+			REDEBUG2("Failed authenticating user: %s (%s)", wbc->display_string, wbcErrorString(wbc->err));
 		} else {
-			REDEBUG2("Failed authenticating user: Winbind error (%s)", wbcErrorString(err));
+			REDEBUG2("Failed authenticating user: Winbind error (%s)", wbcErrorString(wbc->err));
 		}
 		break;
 	}
 
+	return ret;
+}
 
-done:
-	if (info) wbcFreeMemory(info);
-	if (error) wbcFreeMemory(error);
+/** PAP authentication direct to winbind via Samba's libwbclient library
+ *
+ * @param[in] inst Module instance
+ * @param[in] request The current request
+ * @param[in] password the User-Password
+ *
+ * @return
+ *	- 0	Success
+ *	- -1	Authentication failure
+ *	- -648	Password expired
+ *
+ */
+int do_auth_wbclient_pap(rlm_winbind_t const *inst, request_t *request, fr_pair_t *password)
+{
+	winbind_pap_t	*wbc;
+	int		ret;
+
+	wbc = wbclient_pap_prepare(inst, request, password);
+	if (!wbc) return -1;
+
+	wbclient_pap_auth(wbc);
+	ret = do_auth_wbclient_pap_result(request, wbc);
+	talloc_free(wbc);
 
 	return ret;
 }
 
+/** Queue PAP authentication to winbind on one of the offload helper threads
+ *
+ * The username, domain, and a copy of the password are prepared here, on
+ * the worker.  The copy is zeroed when the authentication context is
+ * freed.  See #fr_offload_push for when the request is resumed, and how
+ * the job must be freed.  #do_auth_wbclient_pap_result then logs any
+ * failure and returns the result.
+ *
+ * @param[out] job_out	The offload job.  Must be passed to #fr_offload_cancel
+ *			if the request is cancelled.
+ * @param[out] wbc_out	Authentication context to pass to #do_auth_wbclient_pap_result.
+ * @param[in] inst	Module instance.
+ * @param[in] request	The current request.
+ * @param[in] password	the User-Password.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int do_auth_wbclient_pap_push(fr_offload_job_t **job_out, winbind_pap_t **wbc_out,
+			      rlm_winbind_t const *inst, request_t *request, fr_pair_t *password)
+{
+	winbind_pap_t		*wbc;
+	fr_offload_job_t	*job;
+
+	wbc = wbclient_pap_prepare(inst, request, password);
+	if (!wbc) return -1;
+
+	job = fr_offload_push(inst->wb_offload, request, wbclient_pap_auth, wbc);
+	if (!job) {
+		RPERROR("Failed queueing winbind authentication");
+		talloc_free(wbc);
+		return -1;
+	}
+
+	*job_out = job;
+	*wbc_out = wbc;
+
+	return 0;
+}
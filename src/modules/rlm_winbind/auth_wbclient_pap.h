@@ -4,4 +4,13 @@
 
 RCSIDH(auth_wbclient_h, "$Id$")
 
+#include <freeradius-devel/server/offload.h>
+
+typedef struct winbind_pap_s winbind_pap_t;
+
 int do_auth_wbclient_pap(rlm_winbind_t const *inst, request_t *request, fr_pair_t *password);
+
+int do_auth_wbclient_pap_push(fr_offload_job_t **job_out, winbind_pap_t **wbc_out,
+			      rlm_winbind_t const *inst, request_t *request, fr_pair_t *password);
+
+int do_auth_wbclient_pap_result(request_t *request, winbind_pap_t *wbc);
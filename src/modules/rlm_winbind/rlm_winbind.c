@@ -29,6 +29,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module.h>
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/debug.h>
 
 #include "rlm_winbind.h"
@@ -46,6 +47,7 @@ static const CONF_PARSER group_config[] = {
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("username", FR_TYPE_TMPL, rlm_winbind_t, wb_username) },
 	{ FR_CONF_OFFSET("domain", FR_TYPE_TMPL, rlm_winbind_t, wb_domain) },
+	{ FR_CONF_OFFSET("threads", FR_TYPE_UINT32, rlm_winbind_t, wb_threads), .dflt = "0" },
 	{ FR_CONF_POINTER("group", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) group_config },
 	CONF_PARSER_TERMINATOR
 };
@@ -376,6 +378,14 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	if (inst->wb_threads) {
+		inst->wb_offload = fr_offload_alloc(inst, "winbind", inst->wb_threads);
+		if (!inst->wb_offload) {
+			cf_log_perr(conf, "Unable to initialise winbind helper threads");
+			return -1;
+		}
+	}
+
 	inst->auth_type = fr_dict_enum_by_name(attr_auth_type, inst->name, -1);
 	if (!inst->auth_type) {
 		WARN("Failed to find 'authenticate %s {...}' section.  Winbind authentication will likely not work",
@@ -449,6 +459,10 @@ static int mod_detach(void *instance)
 {
 	rlm_winbind_t *inst = instance;
 
+	/*
+	 *	Stop the helper threads first, they use the pool.
+	 */
+	TALLOC_FREE(inst->wb_offload);
 	fr_pool_free(inst->wb_pool);
 
 	return 0;
@@ -489,6 +503,49 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 }
 
 
+/** Resume context for offloaded authentication
+ *
+ */
+typedef struct {
+	fr_offload_job_t	*job;			//!< Offloaded winbind authentication.
+	winbind_pap_t		*wbc;			//!< Winbind authentication context, owned by job.
+} winbind_auth_ctx_t;
+
+/** Offloaded winbind authentication has completed
+ *
+ */
+static unlang_action_t mod_authenticate_resume(rlm_rcode_t *p_result, UNUSED module_ctx_t const *mctx,
+					       request_t *request, void *rctx)
+{
+	winbind_auth_ctx_t	*auth_ctx = talloc_get_type_abort(rctx, winbind_auth_ctx_t);
+	int			ret;
+
+	ret = do_auth_wbclient_pap_result(request, auth_ctx->wbc);
+	talloc_free(auth_ctx->job);
+	talloc_free(auth_ctx);
+
+	if (ret == 0) {
+		REDEBUG2("User authenticated successfully using winbind");
+		RETURN_MODULE_OK;
+	}
+
+	RETURN_MODULE_REJECT;
+}
+
+/** The request was cancelled while winbind authentication was in progress
+ *
+ */
+static void mod_authenticate_signal(UNUSED module_ctx_t const *mctx, UNUSED request_t *request,
+				    void *rctx, fr_state_signal_t action)
+{
+	winbind_auth_ctx_t	*auth_ctx = talloc_get_type_abort(rctx, winbind_auth_ctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	fr_offload_cancel(auth_ctx->job);
+	auth_ctx->job = NULL;
+}
+
 /** Authenticate the user via libwbclient and winbind
  *
  * @param[out] p_result		The result of the module call.
@@ -534,6 +591,22 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		RDEBUG2("Login attempt with password");
 	}
 
+	/*
+	 *	Hand the blocking call to a helper thread, and
+	 *	wait for it to finish.
+	 */
+	if (inst->wb_offload) {
+		winbind_auth_ctx_t *auth_ctx;
+
+		MEM(auth_ctx = talloc_zero(unlang_interpret_frame_talloc_ctx(request), winbind_auth_ctx_t));
+		if (do_auth_wbclient_pap_push(&auth_ctx->job, &auth_ctx->wbc, inst, request, password) < 0) {
+			talloc_free(auth_ctx);
+			RETURN_MODULE_REJECT;
+		}
+
+		return unlang_module_yield(request, mod_authenticate_resume, mod_authenticate_signal, auth_ctx);
+	}
+
 	/*
 	 *	Authenticate and return OK if successful. No need for
 	 *	many debug outputs or errors as the auth function is
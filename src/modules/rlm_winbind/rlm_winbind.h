@@ -3,6 +3,7 @@
 
 #include "config.h"
 #include <wbclient.h>
+#include <freeradius-devel/server/offload.h>
 #include <freeradius-devel/server/pool.h>
 
 /*
@@ -11,11 +12,13 @@
 typedef struct {
 	char const		*name;
 	fr_pool_t		*wb_pool;
+	fr_offload_t		*wb_offload;
 	fr_dict_enum_t		*auth_type;
 
 	/* main config */
 	tmpl_t		*wb_username;
 	tmpl_t		*wb_domain;
+	uint32_t		wb_threads;
 
 	/* group config */
 	tmpl_t		*group_username;
@@ -32,6 +32,8 @@
 #include <freeradius-devel/dhcpv4/dhcpv4.h>
 #include <freeradius-devel/protocol/dhcpv4/rfc2131.h>
 
+#include <pthread.h>
+
 static fr_dict_t const *dict_dhcpv4;
 
 extern fr_dict_autoload_t process_dhcpv4_dict[];
@@ -43,12 +45,18 @@ fr_dict_autoload_t process_dhcpv4_dict[] = {
 static fr_dict_attr_t const *attr_message_type;
 static fr_dict_attr_t const *attr_yiaddr;
 static fr_dict_attr_t const *attr_packet_type;
+static fr_dict_attr_t const *attr_client_hardware_address;
+static fr_dict_attr_t const *attr_requested_ip_address;
+static fr_dict_attr_t const *attr_server_identifier;
 
 extern fr_dict_attr_autoload_t process_dhcpv4_dict_attr[];
 fr_dict_attr_autoload_t process_dhcpv4_dict_attr[] = {
 	{ .out = &attr_message_type, .name = "Message-Type", .type = FR_TYPE_UINT8, .dict = &dict_dhcpv4},
 	{ .out = &attr_yiaddr, .name = "Your-IP-Address", .type = FR_TYPE_IPV4_ADDR, .dict = &dict_dhcpv4},
 	{ .out = &attr_packet_type, .name = "Packet-Type", .type = FR_TYPE_UINT32, .dict = &dict_dhcpv4},
+	{ .out = &attr_client_hardware_address, .name = "Client-Hardware-Address", .type = FR_TYPE_ETHERNET, .dict = &dict_dhcpv4},
+	{ .out = &attr_requested_ip_address, .name = "Requested-IP-Address", .type = FR_TYPE_IPV4_ADDR, .dict = &dict_dhcpv4},
+	{ .out = &attr_server_identifier, .name = "Server-Identifier", .type = FR_TYPE_IPV4_ADDR, .dict = &dict_dhcpv4},
 	{ NULL }
 };
 
@@ -131,8 +139,33 @@ typedef struct {
 	CONF_SECTION	*do_not_respond;
 } process_dhcpv4_sections_t;
 
+/** Offers which have recently been sent
+ *
+ * Entries are indexed by client hardware address and transaction ID,
+ * and all have the same lifetime, so the list is in expiry order.
+ */
+typedef struct {
+	fr_time_delta_t	lifetime;		//!< How long an offer is cached for.  0 disables the cache.
+	uint32_t	max_entries;		//!< Maximum number of cached offers.
+
+	pthread_mutex_t	mutex;			//!< Offers are shared by all workers.
+	fr_hash_table_t	*offers;		//!< Indexed by chaddr, and xid.
+	fr_dlist_head_t	expires;		//!< Oldest offer first.
+} process_dhcpv4_offer_cache_t;
+
+typedef struct {
+	uint8_t		chaddr[6];		//!< Client hardware address.
+	uint32_t	xid;			//!< Transaction ID.
+
+	fr_time_t	expires;		//!< When the offer is removed.
+	fr_pair_list_t	reply;			//!< Reply attributes of the offer.
+	fr_dlist_t	entry;			//!< In the expiry list.
+} process_dhcpv4_offer_t;
+
 typedef struct {
-	process_dhcpv4_sections_t sections;
+	process_dhcpv4_sections_t	sections;
+
+	process_dhcpv4_offer_cache_t	offer_cache;
 } process_dhcpv4_t;
 
 #define PROCESS_PACKET_TYPE		fr_dhcpv4_packet_code_t
@@ -142,6 +175,223 @@ typedef struct {
 #define PROCESS_INST			process_dhcpv4_t
 #include <freeradius-devel/server/process.h>
 
+static const CONF_PARSER offer_cache_config[] = {
+	{ FR_CONF_OFFSET("lifetime", FR_TYPE_TIME_DELTA, process_dhcpv4_offer_cache_t, lifetime), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, process_dhcpv4_offer_cache_t, max_entries), .dflt = "65536" },
+
+	CONF_PARSER_TERMINATOR
+};
+
+static const CONF_PARSER config[] = {
+	{ FR_CONF_POINTER("offer_cache", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) offer_cache_config,
+	  .offset = offsetof(process_dhcpv4_t, offer_cache), },
+
+	CONF_PARSER_TERMINATOR
+};
+
+static uint32_t offer_hash(void const *data)
+{
+	process_dhcpv4_offer_t const *offer = data;
+
+	return fr_hash_update(&offer->xid, sizeof(offer->xid), fr_hash(offer->chaddr, sizeof(offer->chaddr)));
+}
+
+static int8_t offer_cmp(void const *one, void const *two)
+{
+	process_dhcpv4_offer_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->xid, b->xid);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->chaddr, b->chaddr, sizeof(a->chaddr));
+	return CMP(ret, 0);
+}
+
+/** Fill in the cache key from a request
+ *
+ * @return
+ *	- true if the request can use the offer cache.
+ *	- false if it can't.
+ */
+static bool offer_key(process_dhcpv4_offer_t *key, process_dhcpv4_offer_cache_t const *cache, request_t *request)
+{
+	fr_pair_t *vp;
+
+	if (!cache->lifetime) return false;
+
+	vp = fr_pair_find_by_da(&request->request_pairs, attr_client_hardware_address, 0);
+	if (!vp) return false;
+
+	memcpy(key->chaddr, vp->vp_ether, sizeof(key->chaddr));
+	key->xid = request->packet->id;
+
+	return true;
+}
+
+/** Remove offers which have expired
+ *
+ * Must be called with the cache mutex held.
+ */
+static void offer_cache_expire(process_dhcpv4_offer_cache_t *cache, fr_time_t now)
+{
+	process_dhcpv4_offer_t *offer;
+
+	while ((offer = fr_dlist_head(&cache->expires)) != NULL) {
+		if (offer->expires > now) break;
+
+		(void) fr_dlist_remove(&cache->expires, offer);
+		(void) fr_hash_table_delete(cache->offers, offer);
+	}
+}
+
+/** Find a cached offer, and add its reply attributes to the request
+ *
+ * @param[in] cache	of offers.
+ * @param[in] request	to add the reply attributes to.
+ * @param[in] remove	the offer from the cache.
+ * @return
+ *	- true if an offer was found.
+ *	- false if it wasn't.
+ */
+static bool offer_cache_find(process_dhcpv4_offer_cache_t *cache, request_t *request, bool remove)
+{
+	process_dhcpv4_offer_t	key, *offer;
+	bool			found = false;
+
+	if (!offer_key(&key, cache, request)) return false;
+
+	pthread_mutex_lock(&cache->mutex);
+	offer_cache_expire(cache, fr_time());
+
+	offer = fr_hash_table_find(cache->offers, &key);
+	if (offer) {
+		if (fr_pair_list_copy(request->reply_ctx, &request->reply_pairs, &offer->reply) >= 0) found = true;
+
+		if (remove) {
+			(void) fr_dlist_remove(&cache->expires, offer);
+			(void) fr_hash_table_delete(cache->offers, offer);
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return found;
+}
+
+/** Remember the offer we're about to send
+ *
+ */
+static void offer_cache_insert(process_dhcpv4_offer_cache_t *cache, request_t *request)
+{
+	process_dhcpv4_offer_t	key, *offer;
+	fr_pair_t		*vp;
+	fr_time_t		now;
+
+	if (!offer_key(&key, cache, request)) return;
+
+	vp = fr_pair_find_by_da(&request->reply_pairs, attr_yiaddr, 0);
+	if (!vp) return;
+
+	now = fr_time();
+
+	pthread_mutex_lock(&cache->mutex);
+	offer_cache_expire(cache, now);
+
+	/*
+	 *	Retransmissions of a cached offer don't extend its
+	 *	lifetime.
+	 */
+	if (fr_hash_table_find(cache->offers, &key)) goto done;
+
+	/*
+	 *	Make room by forgetting the oldest offer.
+	 */
+	if (fr_hash_table_num_elements(cache->offers) >= cache->max_entries) {
+		offer = fr_dlist_pop_head(&cache->expires);
+		if (offer) (void) fr_hash_table_delete(cache->offers, offer);
+	}
+
+	/*
+	 *	Allocated in the shared table, so only while we hold
+	 *	the mutex.
+	 */
+	MEM(offer = talloc_zero(cache->offers, process_dhcpv4_offer_t));
+	memcpy(offer->chaddr, key.chaddr, sizeof(offer->chaddr));
+	offer->xid = key.xid;
+	offer->expires = now + cache->lifetime;
+	fr_pair_list_init(&offer->reply);
+
+	if (fr_pair_list_copy(offer, &offer->reply, &request->reply_pairs) < 0) {
+		talloc_free(offer);
+		goto done;
+	}
+
+	/*
+	 *	The packet type is set from the reply code.
+	 */
+	fr_pair_delete_by_da(&offer->reply, attr_packet_type);
+	fr_pair_delete_by_da(&offer->reply, attr_message_type);
+
+	if (!fr_hash_table_insert(cache->offers, offer)) {
+		talloc_free(offer);
+		goto done;
+	}
+	fr_dlist_insert_tail(&cache->expires, offer);
+
+done:
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+RECV(discover)
+{
+	PROCESS_INST			*inst = UNCONST(PROCESS_INST *, mctx->instance);
+
+	/*
+	 *	A retransmitted Discover gets the same offer, without
+	 *	running "recv Discover" again.
+	 */
+	if (!offer_cache_find(&inst->offer_cache, request, false)) return CALL_RECV(generic);
+
+	RDEBUG("Re-sending cached offer");
+	request->reply->code = FR_DHCP_OFFER;
+
+	return send_generic(p_result, mctx, request, NULL);
+}
+
+RECV(request)
+{
+	PROCESS_INST			*inst = UNCONST(PROCESS_INST *, mctx->instance);
+	fr_pair_t			*vp, *yiaddr;
+
+	if (!offer_cache_find(&inst->offer_cache, request, true)) return CALL_RECV(generic);
+
+	/*
+	 *	The client has to be asking for the address we
+	 *	offered, and from us.  Otherwise we do full
+	 *	processing.
+	 */
+	yiaddr = fr_pair_find_by_da(&request->reply_pairs, attr_yiaddr, 0);
+	vp = fr_pair_find_by_da(&request->request_pairs, attr_requested_ip_address, 0);
+	if (!yiaddr || !vp || (vp->vp_ipv4addr != yiaddr->vp_ipv4addr)) goto full;
+
+	vp = fr_pair_find_by_da(&request->request_pairs, attr_server_identifier, 0);
+	if (vp) {
+		fr_pair_t *server_id;
+
+		server_id = fr_pair_find_by_da(&request->reply_pairs, attr_server_identifier, 0);
+		if (server_id && (server_id->vp_ipv4addr != vp->vp_ipv4addr)) goto full;
+	}
+
+	RDEBUG("Confirming cached offer of %pP", yiaddr);
+	request->reply->code = FR_DHCP_ACK;
+
+	return send_generic(p_result, mctx, request, NULL);
+
+full:
+	fr_pair_list_free(&request->reply_pairs);
+	return CALL_RECV(generic);
+}
+
 RESUME(check_yiaddr)
 {
 	fr_pair_t *vp;
@@ -155,6 +405,24 @@ RESUME(check_yiaddr)
 	return CALL_RESUME(send_generic);
 }
 
+RESUME(send_offer)
+{
+	PROCESS_INST			*inst = UNCONST(PROCESS_INST *, mctx->instance);
+	fr_process_state_t const	*state;
+
+	UPDATE_STATE(reply);
+
+	/*
+	 *	Only cache offers which are actually sent.
+	 */
+	if ((request->reply->code == FR_DHCP_OFFER) &&
+	    (!state->packet_type[*p_result] || (state->packet_type[*p_result] == FR_DHCP_OFFER))) {
+		offer_cache_insert(&inst->offer_cache, request);
+	}
+
+	return CALL_RESUME(check_yiaddr);
+}
+
 static fr_process_state_t const process_state[] = {
 	[FR_DHCP_DISCOVER] = {
 		.packet_type = {
@@ -170,7 +438,7 @@ static fr_process_state_t const process_state[] = {
 		},
 		.rcode = RLM_MODULE_NOOP,
 		.default_reply = FR_DHCP_DO_NOT_RESPOND,
-		.recv = recv_generic,
+		.recv = recv_discover,
 		.resume = resume_recv_generic,
 		.section_offset = PROCESS_CONF_OFFSET(discover),
 	},
@@ -189,7 +457,7 @@ static fr_process_state_t const process_state[] = {
 		.rcode = RLM_MODULE_NOOP,
 		.default_reply = FR_DHCP_DO_NOT_RESPOND,
 		.send = send_generic,
-		.resume = resume_check_yiaddr,
+		.resume = resume_send_offer,
 		.section_offset = PROCESS_CONF_OFFSET(offer),
 	},
 
@@ -207,7 +475,7 @@ static fr_process_state_t const process_state[] = {
 		},
 		.rcode = RLM_MODULE_NOOP,
 		.default_reply = FR_DHCP_DO_NOT_RESPOND,
-		.recv = recv_generic,
+		.recv = recv_request,
 		.resume = resume_recv_generic,
 		.section_offset = PROCESS_CONF_OFFSET(request),
 	},
@@ -326,6 +594,22 @@ static unlang_action_t mod_process(rlm_rcode_t *p_result, module_ctx_t const *mc
 	return state->recv(p_result, mctx, request);
 }
 
+static int mod_instantiate(void *instance, UNUSED CONF_SECTION *process_app_cs)
+{
+	process_dhcpv4_t	*inst = instance;
+
+	if (!inst->offer_cache.lifetime) return 0;
+
+	FR_INTEGER_BOUND_CHECK("offer_cache.max_entries", inst->offer_cache.max_entries, >=, 1);
+
+	pthread_mutex_init(&inst->offer_cache.mutex, NULL);
+	fr_dlist_init(&inst->offer_cache.expires, process_dhcpv4_offer_t, entry);
+	inst->offer_cache.offers = fr_hash_table_alloc(inst, offer_hash, offer_cmp, talloc_free_data);
+	if (!inst->offer_cache.offers) return -1;
+
+	return 0;
+}
+
 static const virtual_server_compile_t compile_list[] = {
 	{
 		.name = "recv",
@@ -456,6 +740,8 @@ fr_process_module_t process_dhcpv4 = {
 	.magic		= RLM_MODULE_INIT,
 	.name		= "process_dhcpv4",
 	.inst_size	= sizeof(process_dhcpv4_t),
+	.config		= config,
+	.instantiate	= mod_instantiate,
 	.process	= mod_process,
 	.compile_list	= compile_list,
 	.dict		= &dict_dhcpv4,
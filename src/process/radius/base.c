@@ -31,8 +31,12 @@
 #include <freeradius-devel/server/protocol.h>
 
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/server/state.h>
 
+#include <pthread.h>
+
 static fr_dict_t const *dict_freeradius;
 static fr_dict_t const *dict_radius;
 
@@ -43,12 +47,21 @@ fr_dict_autoload_t process_radius_dict[] = {
 	{ NULL }
 };
 
+static fr_dict_attr_t const *attr_acct_unique_session_id;
 static fr_dict_attr_t const *attr_auth_type;
 static fr_dict_attr_t const *attr_module_failure_message;
 static fr_dict_attr_t const *attr_module_success_message;
 static fr_dict_attr_t const *attr_stripped_user_name;
 
 static fr_dict_attr_t const *attr_acct_status_type;
+static fr_dict_attr_t const *attr_acct_session_time;
+static fr_dict_attr_t const *attr_acct_input_octets;
+static fr_dict_attr_t const *attr_acct_output_octets;
+static fr_dict_attr_t const *attr_acct_input_gigawords;
+static fr_dict_attr_t const *attr_acct_output_gigawords;
+static fr_dict_attr_t const *attr_acct_input_packets;
+static fr_dict_attr_t const *attr_acct_output_packets;
+static fr_dict_attr_t const *attr_event_timestamp;
 static fr_dict_attr_t const *attr_calling_station_id;
 static fr_dict_attr_t const *attr_chap_password;
 static fr_dict_attr_t const *attr_nas_port;
@@ -62,12 +75,21 @@ static fr_dict_attr_t const *attr_error_cause;
 
 extern fr_dict_attr_autoload_t process_radius_dict_attr[];
 fr_dict_attr_autoload_t process_radius_dict_attr[] = {
+	{ .out = &attr_acct_unique_session_id, .name = "Acct-Unique-Session-Id", .type = FR_TYPE_STRING, .dict = &dict_freeradius },
 	{ .out = &attr_auth_type, .name = "Auth-Type", .type = FR_TYPE_UINT32, .dict = &dict_freeradius },
 	{ .out = &attr_module_failure_message, .name = "Module-Failure-Message", .type = FR_TYPE_STRING, .dict = &dict_freeradius },
 	{ .out = &attr_module_success_message, .name = "Module-Success-Message", .type = FR_TYPE_STRING, .dict = &dict_freeradius },
 	{ .out = &attr_stripped_user_name, .name = "Stripped-User-Name", .type = FR_TYPE_STRING, .dict = &dict_freeradius },
 
 	{ .out = &attr_acct_status_type, .name = "Acct-Status-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_acct_session_time, .name = "Acct-Session-Time", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_acct_input_octets, .name = "Acct-Input-Octets", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_acct_output_octets, .name = "Acct-Output-Octets", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_acct_input_gigawords, .name = "Acct-Input-Gigawords", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_acct_output_gigawords, .name = "Acct-Output-Gigawords", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_acct_input_packets, .name = "Acct-Input-Packets", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_acct_output_packets, .name = "Acct-Output-Packets", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_event_timestamp, .name = "Event-Timestamp", .type = FR_TYPE_DATE, .dict = &dict_radius },
 	{ .out = &attr_calling_station_id, .name = "Calling-Station-Id", .type = FR_TYPE_STRING, .dict = &dict_radius },
 	{ .out = &attr_chap_password, .name = "CHAP-Password", .type = FR_TYPE_OCTETS, .dict = &dict_radius },
 	{ .out = &attr_nas_port, .name = "NAS-Port", .type = FR_TYPE_UINT32, .dict = &dict_radius },
@@ -142,11 +164,37 @@ typedef struct {
 	fr_state_tree_t	*state_tree;		//!< State tree to link multiple requests/responses.
 } process_radius_auth_t;
 
+/** Accounting requests we've already written, and replied to
+ *
+ */
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Workers share one cache per virtual server.
+	fr_hash_table_t		*ht;			//!< Entries, keyed by the serialised accounting data.
+	fr_dlist_head_t		list;			//!< Entries, oldest first.
+} process_radius_acct_dedup_t;
+
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the list of entries, oldest first.
+	fr_time_t		expires;		//!< When this entry should be removed.
+	uint32_t		hash;			//!< Of the key.
+	size_t			key_len;		//!< Length of the key.
+	uint8_t			*key;			//!< Serialised accounting data.
+} process_radius_acct_dedup_entry_t;
+
+typedef struct {
+	uint32_t			dedup_max;	//!< Maximum number of entries in the cache.
+							///< 0 disables duplicate suppression.
+	fr_time_delta_t			dedup_lifetime;	//!< How long entries stay in the cache.
+
+	process_radius_acct_dedup_t	*dedup;		//!< Cache of accounting requests we've replied to.
+} process_radius_acct_t;
+
 typedef struct {
 	CONF_SECTION			*server_cs;	//!< Our virtual server.
 	process_radius_sections_t	sections;	//!< Pointers to various config sections
 							///< we need to execute.
 	process_radius_auth_t		auth;		//!< Authentication configuration.
+	process_radius_acct_t		acct;		//!< Accounting configuration.
 } process_radius_t;
 
 #define PROCESS_PACKET_TYPE		fr_radius_packet_code_t
@@ -184,10 +232,26 @@ static const CONF_PARSER auth_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const CONF_PARSER dedup_config[] = {
+	{ FR_CONF_OFFSET("max", FR_TYPE_UINT32, process_radius_acct_t, dedup_max), .dflt = "0" },
+	{ FR_CONF_OFFSET("lifetime", FR_TYPE_TIME_DELTA, process_radius_acct_t, dedup_lifetime), .dflt = "30" },
+
+	CONF_PARSER_TERMINATOR
+};
+
+static const CONF_PARSER acct_config[] = {
+	{ FR_CONF_POINTER("dedup", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) dedup_config },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER config[] = {
 	{ FR_CONF_POINTER("Access-Request", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) auth_config,
 	  .offset = offsetof(process_radius_t, auth), },
 
+	{ FR_CONF_POINTER("Accounting-Request", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) acct_config,
+	  .offset = offsetof(process_radius_t, acct), },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -627,6 +691,175 @@ RESUME(access_challenge)
 	RETURN_MODULE_OK;
 }
 
+/*
+ *	Attributes which identify one accounting update.
+ *
+ *	Acct-Delay-Time is deliberately not here.  NASes increment it
+ *	when they retransmit, which is why the packet looks new to the
+ *	network layer in the first place.
+ */
+static fr_dict_attr_t const **acct_dedup_attrs[] = {
+	&attr_acct_unique_session_id,
+	&attr_acct_status_type,
+	&attr_event_timestamp,
+	&attr_acct_session_time,
+	&attr_acct_input_octets,
+	&attr_acct_output_octets,
+	&attr_acct_input_gigawords,
+	&attr_acct_output_gigawords,
+	&attr_acct_input_packets,
+	&attr_acct_output_packets,
+};
+
+static uint32_t acct_dedup_hash(void const *data)
+{
+	process_radius_acct_dedup_entry_t const *entry = data;
+
+	return entry->hash;
+}
+
+static int8_t acct_dedup_cmp(void const *one, void const *two)
+{
+	process_radius_acct_dedup_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->key_len, b->key_len);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->key, b->key, a->key_len);
+	return CMP(ret, 0);
+}
+
+static int _acct_dedup_free(process_radius_acct_dedup_t *dedup)
+{
+	pthread_mutex_destroy(&dedup->mutex);
+	return 0;
+}
+
+/** Serialise the attributes which identify an accounting update
+ *
+ * @return
+ *	- > 0 the length of the key.
+ *	- 0 if the request can't be checked for duplicates.
+ */
+static size_t acct_dedup_key(uint8_t *buffer, size_t buflen, request_t *request)
+{
+	fr_dbuff_t	dbuff = FR_DBUFF_TMP(buffer, buflen);
+	size_t		i;
+
+	/*
+	 *	Without a unique session ID, two different sessions
+	 *	could have identical counters.
+	 */
+	if (!fr_pair_find_by_da(&request->request_pairs, attr_acct_unique_session_id, 0)) return 0;
+
+	for (i = 0; i < NUM_ELEMENTS(acct_dedup_attrs); i++) {
+		fr_pair_t *vp;
+
+		vp = fr_pair_find_by_da(&request->request_pairs, *acct_dedup_attrs[i], 0);
+		if (!vp) continue;
+
+		if (fr_dbuff_in(&dbuff, (uint8_t) i) <= 0) return 0;
+		if (fr_value_box_to_network(&dbuff, &vp->data) <= 0) return 0;
+	}
+
+	return fr_dbuff_used(&dbuff);
+}
+
+/** Remove expired entries
+ *
+ * All entries have the same lifetime, so the list is also in order of expiry.
+ */
+static void acct_dedup_expire(process_radius_acct_dedup_t *dedup, fr_time_t now)
+{
+	process_radius_acct_dedup_entry_t *entry;
+
+	while ((entry = fr_dlist_head(&dedup->list)) && (entry->expires <= now)) {
+		fr_dlist_remove(&dedup->list, entry);
+		fr_hash_table_delete(dedup->ht, entry);
+		talloc_free(entry);
+	}
+}
+
+/** See if we've already replied to this accounting update
+ *
+ */
+static bool acct_dedup_find(process_radius_acct_t const *acct, request_t *request)
+{
+	uint8_t					buffer[1024];
+	process_radius_acct_dedup_entry_t	my_entry, *entry;
+
+	if (!acct->dedup) return false;
+
+	my_entry.key_len = acct_dedup_key(buffer, sizeof(buffer), request);
+	if (!my_entry.key_len) return false;
+
+	my_entry.key = buffer;
+	my_entry.hash = fr_hash(buffer, my_entry.key_len);
+
+	pthread_mutex_lock(&acct->dedup->mutex);
+	acct_dedup_expire(acct->dedup, fr_time());
+	entry = fr_hash_table_find(acct->dedup->ht, &my_entry);
+	pthread_mutex_unlock(&acct->dedup->mutex);
+
+	return (entry != NULL);
+}
+
+/** Remember that we've written, and replied to, this accounting update
+ *
+ * If the cache is full, the oldest entry is discarded.
+ */
+static void acct_dedup_insert(process_radius_acct_t const *acct, request_t *request)
+{
+	uint8_t					buffer[1024];
+	process_radius_acct_dedup_entry_t	*entry, *old;
+	process_radius_acct_dedup_t		*dedup = acct->dedup;
+	size_t					key_len;
+	fr_time_t				now;
+
+	if (!dedup) return;
+
+	key_len = acct_dedup_key(buffer, sizeof(buffer), request);
+	if (!key_len) return;
+
+	MEM(entry = talloc_zero(NULL, process_radius_acct_dedup_entry_t));
+	MEM(entry->key = talloc_memdup(entry, buffer, key_len));
+	entry->key_len = key_len;
+	entry->hash = fr_hash(buffer, key_len);
+
+	now = fr_time();
+	entry->expires = now + acct->dedup_lifetime;
+
+	pthread_mutex_lock(&dedup->mutex);
+	acct_dedup_expire(dedup, now);
+
+	/*
+	 *	Two copies of the same packet were processed at
+	 *	the same time.  Keep the first entry.
+	 */
+	if (fr_hash_table_find(dedup->ht, entry)) {
+		pthread_mutex_unlock(&dedup->mutex);
+		talloc_free(entry);
+		return;
+	}
+
+	if (fr_dlist_num_elements(&dedup->list) >= acct->dedup_max) {
+		old = fr_dlist_head(&dedup->list);
+		fr_dlist_remove(&dedup->list, old);
+		fr_hash_table_delete(dedup->ht, old);
+		talloc_free(old);
+	}
+
+	if (!fr_hash_table_insert(dedup->ht, entry)) {
+		pthread_mutex_unlock(&dedup->mutex);
+		talloc_free(entry);
+		return;
+	}
+	talloc_steal(dedup, entry);
+	fr_dlist_insert_tail(&dedup->list, entry);
+	pthread_mutex_unlock(&dedup->mutex);
+}
+
 RESUME(acct_type)
 {
 	static const fr_process_rcode_t acct_type_rcode = {
@@ -695,6 +928,19 @@ RESUME(accounting_request)
 						      NULL, rctx);
 	}
 
+	/*
+	 *	We've already written this update, and replied to
+	 *	it.  The NAS didn't see our reply, and sent the
+	 *	packet again with a new ID.  Don't write the same
+	 *	data to the backends twice, just reply.
+	 */
+	if (acct_dedup_find(&inst->acct, request)) {
+		RDEBUG("Accounting-Request is a duplicate of one we have already replied to - "
+		       "skipping 'accounting' and 'send Accounting-Response' sections");
+		request->reply->code = FR_RADIUS_CODE_ACCOUNTING_RESPONSE;
+		RETURN_MODULE_OK;
+	}
+
 	/*
 	 *	Run accounting foo { ... }
 	 */
@@ -720,6 +966,29 @@ RESUME(accounting_request)
 					      NULL, rctx);
 }
 
+RESUME(accounting_response)
+{
+	rlm_rcode_t			rcode = *p_result;
+	fr_process_state_t const	*state;
+	process_radius_t const		*inst = talloc_get_type_abort_const(mctx->instance, process_radius_t);
+
+	PROCESS_TRACE;
+
+	fr_assert(rcode < RLM_MODULE_NUMCODES);
+
+	/*
+	 *	Only remember the request if the "send" section
+	 *	succeeded.  Otherwise a retransmission has to be
+	 *	written again.
+	 */
+	UPDATE_STATE(reply);
+	if ((request->reply->code == FR_RADIUS_CODE_ACCOUNTING_RESPONSE) && !state->packet_type[rcode]) {
+		acct_dedup_insert(&inst->acct, request);
+	}
+
+	return CALL_RESUME(send_generic);
+}
+
 #if 0
 // @todo - send canned responses like in v3?
 RECV(status_server)
@@ -800,6 +1069,28 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *process_app_cs)
 						   inst->auth.session_timeout, inst->auth.state_server_id,
 						   fr_hash_string(cf_section_name2(inst->server_cs)));
 
+	if (main_config->memory_accounting &&
+	    (fr_state_tree_memory_register(inst->auth.state_tree, cf_section_name2(inst->server_cs)) < 0)) {
+		PERROR("Failed registering memory accounting for the state tree");
+		return -1;
+	}
+
+	if (inst->acct.dedup_max) {
+		process_radius_acct_dedup_t *dedup;
+
+		MEM(dedup = talloc_zero(inst, process_radius_acct_dedup_t));
+		pthread_mutex_init(&dedup->mutex, NULL);
+		talloc_set_destructor(dedup, _acct_dedup_free);
+		fr_dlist_init(&dedup->list, process_radius_acct_dedup_entry_t, entry);
+
+		dedup->ht = fr_hash_table_alloc(dedup, acct_dedup_hash, acct_dedup_cmp, NULL);
+		if (!dedup->ht) {
+			PERROR("Failed creating accounting duplicate cache");
+			return -1;
+		}
+		inst->acct.dedup = dedup;
+	}
+
 	return 0;
 }
 
@@ -901,7 +1192,7 @@ static fr_process_state_t const process_state[] = {
 		},
 		.rcode = RLM_MODULE_NOOP,
 		.send = send_generic,
-		.resume = resume_send_generic,
+		.resume = resume_accounting_response,
 		.section_offset = offsetof(process_radius_sections_t, accounting_response),
 	},
 	[ FR_RADIUS_CODE_STATUS_SERVER ] = { /* @todo - negotiation, stats, etc. */
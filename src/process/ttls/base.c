@@ -669,6 +669,12 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *process_app_cs)
 						   inst->auth.session_timeout, inst->auth.state_server_id,
 						   fr_hash_string(cf_section_name2(inst->server_cs)));
 
+	if (main_config->memory_accounting &&
+	    (fr_state_tree_memory_register(inst->auth.state_tree, cf_section_name2(inst->server_cs)) < 0)) {
+		PERROR("Failed registering memory accounting for the state tree");
+		return -1;
+	}
+
 	return 0;
 }
 
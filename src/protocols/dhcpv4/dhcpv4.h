@@ -190,6 +190,15 @@ int		fr_dhcpv4_raw_packet_send(int sockfd, struct sockaddr_ll *p_ll,
 
 fr_radius_packet_t	*fr_dhcv4_raw_packet_recv(int sockfd, struct sockaddr_ll *p_ll,
 						  fr_radius_packet_t *request, fr_pair_list_t *list);
+
+#  ifdef PACKET_TX_RING
+typedef struct fr_dhcpv4_raw_ring_s fr_dhcpv4_raw_ring_t;
+
+fr_dhcpv4_raw_ring_t	*fr_dhcpv4_raw_ring_alloc(TALLOC_CTX *ctx, char const *interface, uint32_t frames);
+
+int		fr_dhcpv4_raw_ring_send(fr_dhcpv4_raw_ring_t *ring, uint8_t const dst_mac[ETH_ADDR_LEN],
+					fr_socket_t const *socket, uint8_t const *data, size_t data_len);
+#  endif
 #endif
 
 /*
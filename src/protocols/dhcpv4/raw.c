@@ -26,6 +26,7 @@
 #include "attrs.h"
 #include "dhcpv4.h"
 
+#include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/net.h>
 #include <freeradius-devel/util/pair.h>
 #include <freeradius-devel/util/proto.h>
@@ -37,6 +38,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <net/if.h>
 
 #ifdef HAVE_SYS_SOCKET_H
 #  include <sys/socket.h>
@@ -95,43 +98,44 @@ int fr_dhcpv4_raw_socket_open(struct sockaddr_ll *link_layer, int ifindex)
 	return fd;
 }
 
-/** Create the requisite L2/L3 headers, and write a DHCPv4 packet to a raw socket
+/** Create the requisite L2/L3/L4 headers around an encoded DHCPv4 packet
  *
- * @param[in] sockfd		to write to.
- * @param[in] link_layer	information, as returned by fr_dhcpv4_raw_socket_open.
- * @param[in] packet		to write.
- * @param[in] list		to send.
+ * @param[out] frame		to write the ethernet frame to.
+ * @param[in] frame_len		the size of the frame buffer.
+ * @param[in] dst_mac		ethernet destination address.
+ * @param[in] src_mac		ethernet source address.
+ * @param[in] socket		IP addresses and ports to put in the headers.
+ * @param[in] data		encoded DHCPv4 packet.
+ * @param[in] data_len		length of the encoded DHCPv4 packet.
  * @return
- *	- 0 on success.
- *	- -1 on failure.
+ *	- > 0 the length of the frame.
+ *	- -1 if the frame buffer is too small.
  */
-int fr_dhcpv4_raw_packet_send(int sockfd, struct sockaddr_ll *link_layer,
-			      fr_radius_packet_t *packet, fr_pair_list_t *list)
+static ssize_t raw_frame_build(uint8_t *frame, size_t frame_len,
+			       uint8_t const dst_mac[ETH_ADDR_LEN], uint8_t const src_mac[ETH_ADDR_LEN],
+			       fr_socket_t const *socket, uint8_t const *data, size_t data_len)
 {
-	uint8_t			dhcp_packet[1518] = { 0 };
-	ethernet_header_t	*eth_hdr = (ethernet_header_t *)dhcp_packet;
-	ip_header_t		*ip_hdr = (ip_header_t *)(dhcp_packet + ETH_HDR_SIZE);
-	udp_header_t		*udp_hdr = (udp_header_t *) (dhcp_packet + ETH_HDR_SIZE + IP_HDR_SIZE);
-	dhcp_packet_t		*dhcp = (dhcp_packet_t *)(dhcp_packet + ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE);
+	ethernet_header_t	*eth_hdr = (ethernet_header_t *)frame;
+	ip_header_t		*ip_hdr = (ip_header_t *)(frame + ETH_HDR_SIZE);
+	udp_header_t		*udp_hdr = (udp_header_t *) (frame + ETH_HDR_SIZE + IP_HDR_SIZE);
+	uint8_t			*dhcp = frame + ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE;
 
-	uint16_t		l4_len = (UDP_HDR_SIZE + packet->data_len);
-	fr_pair_t		*vp;
+	uint16_t		l4_len = (UDP_HDR_SIZE + data_len);
 
-	/* set ethernet source address to our MAC address (Client-Hardware-Address). */
-	uint8_t dhmac[ETH_ADDR_LEN] = { 0 };
-	if ((vp = fr_pair_find_by_da(list, attr_dhcp_client_hardware_address, 0))) {
-		if (vp->vp_type == FR_TYPE_ETHERNET) memcpy(dhmac, vp->vp_ether, sizeof(vp->vp_ether));
+	if ((ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE + data_len) > frame_len) {
+		fr_strerror_printf("Packet too large (%zu bytes) for frame", data_len);
+		return -1;
 	}
 
 	/* fill in Ethernet layer (L2) */
-	memcpy(eth_hdr->dst_addr, eth_bcast, ETH_ADDR_LEN);
-	memcpy(eth_hdr->src_addr, dhmac, ETH_ADDR_LEN);
+	memcpy(eth_hdr->dst_addr, dst_mac, ETH_ADDR_LEN);
+	memcpy(eth_hdr->src_addr, src_mac, ETH_ADDR_LEN);
 	eth_hdr->ether_type = htons(ETH_TYPE_IP);
 
 	/* fill in IP layer (L3) */
 	ip_hdr->ip_vhl = IP_VHL(4, 5);
 	ip_hdr->ip_tos = 0;
-	ip_hdr->ip_len = htons(IP_HDR_SIZE +  UDP_HDR_SIZE + packet->data_len);
+	ip_hdr->ip_len = htons(IP_HDR_SIZE +  UDP_HDR_SIZE + data_len);
 	ip_hdr->ip_id = 0;
 	ip_hdr->ip_off = 0;
 	ip_hdr->ip_ttl = 64;
@@ -139,16 +143,16 @@ int fr_dhcpv4_raw_packet_send(int sockfd, struct sockaddr_ll *link_layer,
 	ip_hdr->ip_sum = 0; /* Filled later */
 
 	/* saddr: Packet-Src-IP-Address (default: 0.0.0.0). */
-	ip_hdr->ip_src.s_addr = packet->socket.inet.src_ipaddr.addr.v4.s_addr;
+	ip_hdr->ip_src.s_addr = socket->inet.src_ipaddr.addr.v4.s_addr;
 
 	/* daddr: packet destination IP addr (should be 255.255.255.255 for broadcast). */
-	ip_hdr->ip_dst.s_addr = packet->socket.inet.dst_ipaddr.addr.v4.s_addr;
+	ip_hdr->ip_dst.s_addr = socket->inet.dst_ipaddr.addr.v4.s_addr;
 
 	/* IP header checksum */
 	ip_hdr->ip_sum = fr_ip_header_checksum((uint8_t const *)ip_hdr, 5);
 
-	udp_hdr->src = htons(packet->socket.inet.src_port);
-	udp_hdr->dst = htons(packet->socket.inet.dst_port);
+	udp_hdr->src = htons(socket->inet.src_port);
+	udp_hdr->dst = htons(socket->inet.dst_port);
 
 	udp_hdr->len = htons(l4_len);
 	udp_hdr->checksum = 0; /* UDP checksum will be done after dhcp header */
@@ -156,17 +160,231 @@ int fr_dhcpv4_raw_packet_send(int sockfd, struct sockaddr_ll *link_layer,
 	/* DHCP layer (L7) */
 
 	/* just copy what FreeRADIUS has encoded for us. */
-	memcpy(dhcp, packet->data, packet->data_len);
+	memcpy(dhcp, data, data_len);
 
 	/* UDP checksum is done here */
-	udp_hdr->checksum = fr_udp_checksum((uint8_t const *)(dhcp_packet + ETH_HDR_SIZE + IP_HDR_SIZE),
+	udp_hdr->checksum = fr_udp_checksum((uint8_t const *)(frame + ETH_HDR_SIZE + IP_HDR_SIZE),
 					    ntohs(udp_hdr->len), udp_hdr->checksum,
-					    packet->socket.inet.src_ipaddr.addr.v4, packet->socket.inet.dst_ipaddr.addr.v4);
+					    socket->inet.src_ipaddr.addr.v4, socket->inet.dst_ipaddr.addr.v4);
 
-	return sendto(sockfd, dhcp_packet, (ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE + packet->data_len),
+	return ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE + data_len;
+}
+
+/** Create the requisite L2/L3 headers, and write a DHCPv4 packet to a raw socket
+ *
+ * @param[in] sockfd		to write to.
+ * @param[in] link_layer	information, as returned by fr_dhcpv4_raw_socket_open.
+ * @param[in] packet		to write.
+ * @param[in] list		to send.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_dhcpv4_raw_packet_send(int sockfd, struct sockaddr_ll *link_layer,
+			      fr_radius_packet_t *packet, fr_pair_list_t *list)
+{
+	uint8_t			dhcp_packet[1518] = { 0 };
+	ssize_t			frame_len;
+	fr_pair_t		*vp;
+
+	/* set ethernet source address to our MAC address (Client-Hardware-Address). */
+	uint8_t dhmac[ETH_ADDR_LEN] = { 0 };
+	if ((vp = fr_pair_find_by_da(list, attr_dhcp_client_hardware_address, 0))) {
+		if (vp->vp_type == FR_TYPE_ETHERNET) memcpy(dhmac, vp->vp_ether, sizeof(vp->vp_ether));
+	}
+
+	frame_len = raw_frame_build(dhcp_packet, sizeof(dhcp_packet), eth_bcast, dhmac,
+				    &packet->socket, packet->data, packet->data_len);
+	if (frame_len < 0) return -1;
+
+	return sendto(sockfd, dhcp_packet, frame_len,
 		      0, (struct sockaddr *) link_layer, sizeof(struct sockaddr_ll));
 }
 
+#ifdef PACKET_TX_RING
+/** A memory mapped transmit ring
+ *
+ * Frames are written directly into memory shared with the kernel, and
+ * one system call sends all of the frames which are queued.
+ */
+struct fr_dhcpv4_raw_ring_s {
+	int			fd;			//!< AF_PACKET socket.
+	struct sockaddr_ll	link_layer;		//!< interface we send on.
+	uint8_t			mac[ETH_ADDR_LEN];	//!< of the interface.
+
+	uint8_t			*map;			//!< the ring.
+	size_t			map_len;		//!< size of the ring.
+	uint32_t		frame_size;		//!< size of each frame.
+	uint32_t		frames;			//!< number of frames in the ring.
+	uint32_t		next;			//!< next frame to fill in.
+};
+
+#define RAW_RING_FRAME_SIZE	2048
+#define RAW_RING_BLOCK_SIZE	(1 << 16)
+
+static int _raw_ring_free(fr_dhcpv4_raw_ring_t *ring)
+{
+	if (ring->map) munmap(ring->map, ring->map_len);
+	if (ring->fd >= 0) close(ring->fd);
+
+	return 0;
+}
+
+/** Open a memory mapped AF_PACKET transmit ring on an interface
+ *
+ * The socket is bound with protocol 0, so that it never receives
+ * packets.
+ *
+ * @param[in] ctx		to allocate the ring in.
+ * @param[in] interface		to send packets on.
+ * @param[in] frames		minimum number of frames in the ring.
+ * @return
+ *	- A new ring.
+ *	- NULL on error.
+ */
+fr_dhcpv4_raw_ring_t *fr_dhcpv4_raw_ring_alloc(TALLOC_CTX *ctx, char const *interface, uint32_t frames)
+{
+	fr_dhcpv4_raw_ring_t	*ring;
+	struct tpacket_req3	req;
+	struct ifreq		ifr;
+	struct sockaddr_ll	bind_ll;
+	int			version = TPACKET_V3;
+	unsigned int		ifindex;
+	uint32_t		frames_per_block = RAW_RING_BLOCK_SIZE / RAW_RING_FRAME_SIZE;
+
+	ifindex = if_nametoindex(interface);
+	if (!ifindex) {
+		fr_strerror_printf("Unknown interface %s: %s", interface, fr_syserror(errno));
+		return NULL;
+	}
+
+	ring = talloc_zero(ctx, fr_dhcpv4_raw_ring_t);
+	if (!ring) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+	ring->fd = -1;
+	talloc_set_destructor(ring, _raw_ring_free);
+
+	ring->fd = socket(PF_PACKET, SOCK_RAW, 0);
+	if (ring->fd < 0) {
+		fr_strerror_printf("Cannot open socket: %s", fr_syserror(errno));
+	error:
+		talloc_free(ring);
+		return NULL;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, interface, sizeof(ifr.ifr_name));
+	if (ioctl(ring->fd, SIOCGIFHWADDR, &ifr) < 0) {
+		fr_strerror_printf("Cannot get hardware address of %s: %s", interface, fr_syserror(errno));
+		goto error;
+	}
+	if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+		fr_strerror_printf("Interface %s is not an ethernet interface", interface);
+		goto error;
+	}
+	memcpy(ring->mac, ifr.ifr_hwaddr.sa_data, ETH_ADDR_LEN);
+
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		fr_strerror_printf("Cannot set TPACKET_V3: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RAW_RING_BLOCK_SIZE;
+	req.tp_block_nr = ROUND_UP_DIV(frames, frames_per_block);
+	req.tp_frame_size = RAW_RING_FRAME_SIZE;
+	req.tp_frame_nr = req.tp_block_nr * frames_per_block;
+
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+		fr_strerror_printf("Cannot create transmit ring: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	ring->frame_size = req.tp_frame_size;
+	ring->frames = req.tp_frame_nr;
+	ring->map_len = (size_t) req.tp_block_size * req.tp_block_nr;
+	ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (ring->map == MAP_FAILED) {
+		ring->map = NULL;
+		fr_strerror_printf("Cannot map transmit ring: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	memset(&bind_ll, 0, sizeof(bind_ll));
+	bind_ll.sll_family = AF_PACKET;
+	bind_ll.sll_protocol = 0;
+	bind_ll.sll_ifindex = ifindex;
+
+	if (bind(ring->fd, (struct sockaddr *) &bind_ll, sizeof(bind_ll)) < 0) {
+		fr_strerror_printf("Cannot bind raw socket: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	ring->link_layer.sll_family = AF_PACKET;
+	ring->link_layer.sll_protocol = htons(ETH_P_IP);
+	ring->link_layer.sll_ifindex = ifindex;
+	ring->link_layer.sll_halen = ETH_ADDR_LEN;
+
+	return ring;
+}
+
+/** Queue a DHCPv4 packet on the transmit ring, and ask the kernel to send it
+ *
+ * @param[in] ring		to send on.
+ * @param[in] dst_mac		ethernet address of the client.
+ * @param[in] socket		IP addresses and ports of the packet.
+ * @param[in] data		encoded DHCPv4 packet.
+ * @param[in] data_len		length of the encoded DHCPv4 packet.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the ring is full, or the packet can't be sent.
+ */
+int fr_dhcpv4_raw_ring_send(fr_dhcpv4_raw_ring_t *ring, uint8_t const dst_mac[ETH_ADDR_LEN],
+			    fr_socket_t const *socket, uint8_t const *data, size_t data_len)
+{
+	uint8_t			*frame = ring->map + ((size_t) ring->next * ring->frame_size);
+	struct tpacket3_hdr	*hdr = (struct tpacket3_hdr *) frame;
+	size_t			offset = TPACKET3_HDRLEN - sizeof(struct sockaddr_ll);
+	ssize_t			frame_len;
+
+	/*
+	 *	The kernel hasn't sent this frame yet, so the ring
+	 *	is full.
+	 */
+	if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+		(void) sendto(ring->fd, NULL, 0, MSG_DONTWAIT,
+			      (struct sockaddr *) &ring->link_layer, sizeof(ring->link_layer));
+		fr_strerror_const("Transmit ring is full");
+		return -1;
+	}
+
+	frame_len = raw_frame_build(frame + offset, ring->frame_size - offset, dst_mac, ring->mac,
+				    socket, data, data_len);
+	if (frame_len < 0) return -1;
+
+	hdr->tp_len = frame_len;
+	hdr->tp_snaplen = frame_len;
+	hdr->tp_next_offset = 0;
+	__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+	ring->next = (ring->next + 1) % ring->frames;
+
+	/*
+	 *	Sends all queued frames, without copying them.
+	 */
+	if ((sendto(ring->fd, NULL, 0, MSG_DONTWAIT,
+		    (struct sockaddr *) &ring->link_layer, sizeof(ring->link_layer)) < 0) &&
+	    (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ENOBUFS)) {
+		fr_strerror_printf("Failed sending on transmit ring: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
 /*
  *	For a client, receive a DHCP packet from a raw packet
  *	socket. Make sure it matches the ongoing request.
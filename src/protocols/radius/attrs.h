@@ -41,3 +41,5 @@ extern fr_dict_attr_t const *attr_message_authenticator;
 extern fr_dict_attr_t const *attr_state;
 extern fr_dict_attr_t const *attr_vendor_specific;
 extern fr_dict_attr_t const *attr_nas_filter_rule;
+
+extern fr_dict_attr_t const *fr_radius_decode_simple[UINT8_MAX + 1];
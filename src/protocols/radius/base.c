@@ -33,6 +33,8 @@ RCSID("$Id$")
 
 #include <freeradius-devel/io/pair.h>
 #include <freeradius-devel/util/base.h>
+#include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/net.h>
 #include <freeradius-devel/util/talloc.h>
@@ -77,6 +79,15 @@ fr_dict_attr_autoload_t libfreeradius_radius_dict_attr[] = {
 	{ NULL }
 };
 
+/** Standard attributes which can be decoded without consulting their flags
+ *
+ * Indexed by attribute number.  Populated by #fr_radius_init from the
+ * dictionary, so that the decoder can skip the tag, encryption and
+ * type dispatch for the attributes which make up the bulk of most
+ * packets.  Anything not in the table goes through the generic decoder.
+ */
+fr_dict_attr_t const *fr_radius_decode_simple[UINT8_MAX + 1];
+
 /** RADIUS on-the-wire format attribute sizes
  *
  * Holds the min/max sizes of all supported RADIUS attribute values as they
@@ -344,6 +355,24 @@ invalid:
  */
 int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 		   uint8_t const *secret, size_t secret_len)
+{
+	return fr_radius_sign_hmac(packet, original, secret, secret_len, NULL);
+}
+
+/** Sign a previously encoded packet, using a pre-computed HMAC key for the Message-Authenticator
+ *
+ * @param[in,out] packet	(request or response).
+ * @param[in] original		request (only if this is a response).
+ * @param[in] secret		to sign the packet with.
+ * @param[in] secret_len	The length of the secret.
+ * @param[in] hmac		the secret, as returned by fr_hmac_md5_key_alloc().
+ *				If NULL, the HMAC is calculated from the secret.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_radius_sign_hmac(uint8_t *packet, uint8_t const *original,
+			uint8_t const *secret, size_t secret_len, fr_hmac_md5_key_t const *hmac)
 {
 	uint8_t		*msg, *end;
 	size_t		packet_len = (packet[2] << 8) | packet[3];
@@ -429,7 +458,11 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 		 *	Message-Authenticator attribute.
 		 */
 		memset(msg + 2, 0, RADIUS_AUTH_VECTOR_LENGTH);
-		fr_hmac_md5(msg + 2, packet, packet_len, secret, secret_len);
+		if (hmac) {
+			fr_hmac_md5_keyed(msg + 2, packet, packet_len, hmac);
+		} else {
+			fr_hmac_md5(msg + 2, packet, packet_len, secret, secret_len);
+		}
 		break;
 	}
 
@@ -773,6 +806,23 @@ finish:
  */
 int fr_radius_verify(uint8_t *packet, uint8_t const *original,
 		     uint8_t const *secret, size_t secret_len)
+{
+	return fr_radius_verify_hmac(packet, original, secret, secret_len, NULL);
+}
+
+/** Verify a request / response packet, using a pre-computed HMAC key for the Message-Authenticator
+ *
+ * @param packet the raw RADIUS packet (request or response)
+ * @param original the raw original request (if this is a response)
+ * @param secret the shared secret
+ * @param secret_len the length of the secret
+ * @param hmac the secret, as returned by fr_hmac_md5_key_alloc().  May be NULL.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_radius_verify_hmac(uint8_t *packet, uint8_t const *original,
+			  uint8_t const *secret, size_t secret_len, fr_hmac_md5_key_t const *hmac)
 {
 	int rcode;
 	uint8_t *msg, *end;
@@ -828,7 +878,7 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *original,
 	 *	slightly more CPU work than having verify-specific
 	 *	functions, but it ends up being cleaner in the code.
 	 */
-	rcode = fr_radius_sign(packet, original, secret, secret_len);
+	rcode = fr_radius_sign_hmac(packet, original, secret, secret_len, hmac);
 	if (rcode < 0) {
 		fr_strerror_const_push("Failed calculating correct authenticator");
 		return -1;
@@ -895,23 +945,200 @@ void *fr_radius_next_encodable(fr_dlist_head_t *list, void *to_eval, void *uctx)
 }
 
 
+/** The number of encoded attribute blocks each thread caches
+ *
+ */
+#define RADIUS_ENCODE_CACHE_SIZE	256
+
+/** The maximum number of attributes in a block we'll cache
+ *
+ * Larger lists are unlikely to be repeated, and take longer to compare.
+ */
+#define RADIUS_ENCODE_CACHE_MAX_PAIRS	32
+
+/** A block of encoded attributes, and the pairs it was encoded from
+ *
+ */
+typedef struct {
+	TALLOC_CTX		*ctx;		//!< Holds everything below.  NULL if the entry is empty.
+	uint32_t		hash;		//!< Of the attributes and their values.
+	unsigned int		num;		//!< Number of pairs.
+	fr_dict_attr_t const	**da;		//!< Attribute of each pair.
+	fr_value_box_t		*value;		//!< Copy of the value of each pair.
+	uint8_t			*data;		//!< Encoded attributes.
+	size_t			data_len;	//!< Length of the encoded attributes.
+} radius_encode_cache_entry_t;
+
+/** Per-thread cache of encoded attribute blocks, indexed by hash
+ *
+ */
+static _Thread_local radius_encode_cache_entry_t *radius_encode_cache;
+
+static void _radius_encode_cache_free_on_exit(void *arg)
+{
+	talloc_free(arg);
+}
+
+/** Check whether a list can be served from the encode cache, and hash it
+ *
+ * The encoding of most attributes depends only on the attribute and
+ * its value.  The exceptions are encrypted attributes, which depend
+ * on the request authenticator and a random salt.  We also skip
+ * structural attributes, and private unknown attributes, as their
+ * definitions can be freed (and the address reused) at any time.
+ *
+ * @param[out] out	Where to write the pairs to encode.
+ * @param[out] num	Number of pairs written to out.
+ * @param[out] hash	Of the pairs.
+ * @param[in] vps	to check.
+ * @return
+ *	- true if the list can be cached.
+ *	- false if it can't.
+ */
+static bool radius_encode_cacheable(fr_pair_t const *out[static RADIUS_ENCODE_CACHE_MAX_PAIRS], unsigned int *num,
+				    uint32_t *hash, fr_pair_list_t *vps)
+{
+	fr_dcursor_t		cursor;
+	fr_pair_t const		*vp;
+	unsigned int		i = 0;
+	uint32_t		h = 0;
+
+	for (vp = fr_dcursor_talloc_iter_init(&cursor, vps, fr_radius_next_encodable, dict_radius, fr_pair_t);
+	     vp;
+	     vp = fr_dcursor_next(&cursor)) {
+		uint32_t vh;
+
+		if (i == RADIUS_ENCODE_CACHE_MAX_PAIRS) return false;
+		if (flag_encrypted(&vp->da->flags) || fr_type_is_structural(vp->da->type)) return false;
+		if (vp->da->flags.is_unknown && !vp->da->flags.is_interned) return false;
+
+		out[i++] = vp;
+		vh = fr_value_box_hash(&vp->data);
+		h = fr_hash_update(&vp->da, sizeof(vp->da), h);
+		h = fr_hash_update(&vh, sizeof(vh), h);
+	}
+
+	*num = i;
+	*hash = h;
+
+	return true;
+}
+
+/** Find a cached block of attributes matching the pairs
+ *
+ */
+static radius_encode_cache_entry_t *radius_encode_cache_find(fr_pair_t const **vps, unsigned int num, uint32_t hash)
+{
+	radius_encode_cache_entry_t	*entry;
+	unsigned int			i;
+
+	if (!radius_encode_cache) return NULL;
+
+	entry = &radius_encode_cache[hash % RADIUS_ENCODE_CACHE_SIZE];
+	if (!entry->ctx || (entry->hash != hash) || (entry->num != num)) return NULL;
+
+	for (i = 0; i < num; i++) {
+		if (entry->da[i] != vps[i]->da) return NULL;
+		if (fr_value_box_cmp(&entry->value[i], &vps[i]->data) != 0) return NULL;
+	}
+
+	return entry;
+}
+
+/** Remember a block of encoded attributes, replacing any entry with the same index
+ *
+ */
+static void radius_encode_cache_insert(fr_pair_t const **vps, unsigned int num, uint32_t hash,
+				       uint8_t const *data, size_t data_len)
+{
+	radius_encode_cache_entry_t	*entry;
+	TALLOC_CTX			*ctx;
+	unsigned int			i;
+
+	if (unlikely(!radius_encode_cache)) {
+		radius_encode_cache_entry_t *cache;
+
+		cache = talloc_zero_array(NULL, radius_encode_cache_entry_t, RADIUS_ENCODE_CACHE_SIZE);
+		if (!cache) return;
+		fr_atexit_thread_local(radius_encode_cache, _radius_encode_cache_free_on_exit, cache);
+	}
+
+	entry = &radius_encode_cache[hash % RADIUS_ENCODE_CACHE_SIZE];
+	TALLOC_FREE(entry->ctx);
+
+	ctx = talloc_new(radius_encode_cache);
+	if (!ctx) return;
+
+	entry->da = talloc_array(ctx, fr_dict_attr_t const *, num);
+	entry->value = talloc_zero_array(ctx, fr_value_box_t, num);
+	entry->data = talloc_memdup(ctx, data, data_len);
+	if (!entry->da || !entry->value || (data_len && !entry->data)) {
+	error:
+		talloc_free(ctx);
+		return;
+	}
+
+	for (i = 0; i < num; i++) {
+		entry->da[i] = vps[i]->da;
+		if (fr_value_box_copy(ctx, &entry->value[i], &vps[i]->data) < 0) goto error;
+	}
+
+	entry->ctx = ctx;
+	entry->hash = hash;
+	entry->num = num;
+	entry->data_len = data_len;
+}
+
+static ssize_t radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
+				   char const *secret, int code, int id, fr_pair_list_t *vps, bool use_cache);
+
 /** Encode VPS into a raw RADIUS packet.
  *
  */
 ssize_t fr_radius_encode(uint8_t *packet, size_t packet_len, uint8_t const *original,
-			 char const *secret, size_t secret_len, int code, int id, fr_pair_list_t *vps)
+			 char const *secret, UNUSED size_t secret_len, int code, int id, fr_pair_list_t *vps)
+{
+	return radius_encode_dbuff(&FR_DBUFF_TMP(packet, packet_len), original, secret, code, id, vps, false);
+}
+
+/** Encode VPS into a raw RADIUS packet, re-using previously encoded attributes where possible
+ *
+ * Servers often send the same set of reply attributes, e.g. a VLAN and a
+ * Session-Timeout, in many replies.  This function keeps a per-thread cache
+ * of encoded attribute blocks, keyed by the attributes and their values.
+ * If the reply attributes match an entry, the encoded block is copied into
+ * the packet instead of encoding the attributes again.  The header and
+ * authenticator are always filled in for each packet.
+ *
+ * Lists containing encrypted attributes (e.g. Tunnel-Password), structural
+ * attributes, or more than a handful of attributes are always encoded.
+ *
+ * Arguments are the same as for fr_radius_encode().
+ */
+ssize_t fr_radius_encode_cached(uint8_t *packet, size_t packet_len, uint8_t const *original,
+				char const *secret, UNUSED size_t secret_len, int code, int id, fr_pair_list_t *vps)
 {
-	return fr_radius_encode_dbuff(&FR_DBUFF_TMP(packet, packet_len), original, secret, secret_len, code, id, vps);
+	return radius_encode_dbuff(&FR_DBUFF_TMP(packet, packet_len), original, secret, code, id, vps, true);
 }
 
 ssize_t fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
 			 char const *secret, UNUSED size_t secret_len, int code, int id, fr_pair_list_t *vps)
+{
+	return radius_encode_dbuff(dbuff, original, secret, code, id, vps, false);
+}
+
+static ssize_t radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
+				   char const *secret, int code, int id, fr_pair_list_t *vps, bool use_cache)
 {
 	ssize_t			slen;
 	fr_pair_t const	*vp;
 	fr_dcursor_t		cursor;
 	fr_radius_ctx_t		packet_ctx;
 	fr_dbuff_t		work_dbuff, length_dbuff;
+	fr_pair_t const		*cached[RADIUS_ENCODE_CACHE_MAX_PAIRS];
+	unsigned int		num_cached = 0;
+	uint32_t		hash = 0;
+	uint8_t			*attrs;
 
 	memset(&packet_ctx, 0, sizeof(packet_ctx));
 	packet_ctx.secret = secret;
@@ -992,6 +1219,23 @@ ssize_t fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
 					 0x00, 0x00, 0x00, original[0]);
 	}
 
+	/*
+	 *	We've seen these attributes before, copy the
+	 *	encoded block instead of encoding them again.
+	 */
+	if (use_cache && radius_encode_cacheable(cached, &num_cached, &hash, vps)) {
+		radius_encode_cache_entry_t *entry;
+
+		entry = radius_encode_cache_find(cached, num_cached, hash);
+		if (entry) {
+			FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, entry->data, entry->data_len);
+			goto done;
+		}
+	} else {
+		use_cache = false;
+	}
+	attrs = fr_dbuff_current(&work_dbuff);
+
 	/*
 	 *	Loop over the reply attributes for the packet.
 	 */
@@ -1009,6 +1253,9 @@ ssize_t fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
 		}
 	} /* done looping over all attributes */
 
+	if (use_cache) radius_encode_cache_insert(cached, num_cached, hash, attrs, fr_dbuff_current(&work_dbuff) - attrs);
+
+done:
 	/*
 	 *	Fill in the length field we zeroed out earlier.
 	 *
@@ -1022,6 +1269,11 @@ ssize_t fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
 
 /** Decode a raw RADIUS packet into VPs.
  *
+ * All attributes are decoded up front.  Pair lists are plain dlists which
+ * are walked directly by cursors, encoders and the pair list index, so
+ * there's nowhere to hook in decoding of individual attributes on first
+ * use.  Common standard attributes use the fr_radius_decode_simple table,
+ * which keeps the cost of decoding attributes that are never read low.
  */
 ssize_t	fr_radius_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len, uint8_t const *original,
 			 char const *secret, UNUSED size_t secret_len, fr_dcursor_t *cursor)
@@ -1071,6 +1323,53 @@ ssize_t	fr_radius_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_l
 	return packet_len;
 }
 
+/** Build the table of standard attributes which have no special decoding rules
+ *
+ */
+static void radius_decode_simple_init(void)
+{
+	fr_dict_attr_t const	*root = fr_dict_root(dict_radius);
+	unsigned int		i;
+
+	memset(fr_radius_decode_simple, 0, sizeof(fr_radius_decode_simple));
+
+	for (i = 1; i <= UINT8_MAX; i++) {
+		fr_dict_attr_t const *da;
+
+		da = fr_dict_attr_child_by_num(root, i);
+		if (!da || da->flags.is_unknown || da->flags.subtype || da->flags.extra || da->flags.length) continue;
+
+		/*
+		 *	Needs special handling in the decoder.
+		 */
+		if ((da == attr_nas_filter_rule) || (da == attr_chargeable_user_identity)) continue;
+
+		switch (da->type) {
+		case FR_TYPE_STRING:
+		case FR_TYPE_OCTETS:
+		case FR_TYPE_IPV4_ADDR:
+		case FR_TYPE_IPV6_ADDR:
+		case FR_TYPE_IFID:
+		case FR_TYPE_ETHERNET:
+		case FR_TYPE_UINT8:
+		case FR_TYPE_UINT16:
+		case FR_TYPE_UINT32:
+		case FR_TYPE_UINT64:
+		case FR_TYPE_INT8:
+		case FR_TYPE_INT16:
+		case FR_TYPE_INT32:
+		case FR_TYPE_INT64:
+		case FR_TYPE_DATE:
+		case FR_TYPE_TIME_DELTA:
+			fr_radius_decode_simple[i] = da;
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
 int fr_radius_init(void)
 {
 	if (instance_count > 0) {
@@ -1084,6 +1383,8 @@ int fr_radius_init(void)
 		return -1;
 	}
 
+	radius_decode_simple_init();
+
 	instance_count++;
 
 	return 0;
@@ -1093,6 +1394,7 @@ void fr_radius_free(void)
 {
 	if (--instance_count > 0) return;
 
+	memset(fr_radius_decode_simple, 0, sizeof(fr_radius_decode_simple));
 	fr_dict_autofree(libfreeradius_radius_dict);
 }
 
@@ -584,7 +584,7 @@ ssize_t fr_radius_decode_tlv(TALLOC_CTX *ctx, fr_dcursor_t *cursor, fr_dict_t co
 			/*
 			 *	Build an unknown attr
 			 */
-			child = fr_dict_unknown_attr_afrom_num(packet_ctx->tmp_ctx, parent, p[0]);
+			child = fr_dict_unknown_attr_intern_num(packet_ctx->tmp_ctx, parent, p[0]);
 			if (!child) {
 			error:
 				if (!concat) talloc_free(vp);
@@ -685,7 +685,7 @@ static ssize_t decode_vsa_internal(TALLOC_CTX *ctx, fr_dcursor_t *cursor, fr_dic
 	 *	See if the VSA is known.
 	 */
 	da = fr_dict_attr_child_by_num(parent, attribute);
-	if (!da) da = fr_dict_unknown_attr_afrom_num(packet_ctx->tmp_ctx, parent, attribute);
+	if (!da) da = fr_dict_unknown_attr_intern_num(packet_ctx->tmp_ctx, parent, attribute);
 	if (!da) return -1;
 	FR_PROTO_TRACE("decode context changed %s -> %s", da->parent->name, da->name);
 
@@ -835,7 +835,7 @@ static ssize_t decode_wimax(TALLOC_CTX *ctx, fr_dcursor_t *cursor, fr_dict_t con
 	if (((size_t) (data[5] + 4)) != attr_len) return -1;
 
 	da = fr_dict_attr_child_by_num(parent, data[4]);
-	if (!da) da = fr_dict_unknown_attr_afrom_num(packet_ctx->tmp_ctx, parent, data[4]);
+	if (!da) da = fr_dict_unknown_attr_intern_num(packet_ctx->tmp_ctx, parent, data[4]);
 	if (!da) return -1;
 	FR_PROTO_TRACE("decode context changed %s -> %s", da->parent->name, da->name);
 
@@ -1017,7 +1017,6 @@ static ssize_t  CC_HINT(nonnull) decode_vsa(TALLOC_CTX *ctx, fr_dcursor_t *curso
 	 */
 	vendor_da = fr_dict_attr_child_by_num(parent, vendor);
 	if (!vendor_da) {
-		fr_dict_attr_t *n;
 		/*
 		 *	RFC format is 1 octet type, 1 octet length
 		 */
@@ -1026,9 +1025,8 @@ static ssize_t  CC_HINT(nonnull) decode_vsa(TALLOC_CTX *ctx, fr_dcursor_t *curso
 			return -1;
 		}
 
-		n = fr_dict_unknown_vendor_afrom_num(packet_ctx->tmp_ctx, parent, vendor);
-		if (!n) return -1;
-		vendor_da = n;
+		vendor_da = fr_dict_unknown_vendor_intern_num(packet_ctx->tmp_ctx, parent, vendor);
+		if (!vendor_da) return -1;
 
 		/*
 		 *	Create an unknown DV too...
@@ -1438,7 +1436,7 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_dcursor_t *cursor, fr_di
 				 *	fr_dict_unknown_afrom_fields will do the right thing
 				 *	and only create the unknown attr.
 				 */
-				child = fr_dict_unknown_attr_afrom_num(packet_ctx->tmp_ctx, parent, p[4]);
+				child = fr_dict_unknown_attr_intern_num(packet_ctx->tmp_ctx, parent, p[4]);
 				if (!child) {
 					fr_strerror_printf_push("decoder failed creating unknown attribute in %s",
 								parent->name);
@@ -1727,7 +1725,7 @@ ssize_t fr_radius_decode_pair(TALLOC_CTX *ctx, fr_dcursor_t *cursor, fr_dict_t c
 	da = fr_dict_attr_child_by_num(fr_dict_root(dict), data[0]);
 	if (!da) {
 		FR_PROTO_TRACE("Unknown attribute %u", data[0]);
-		da = fr_dict_unknown_attr_afrom_num(packet_ctx->tmp_ctx, fr_dict_root(dict), data[0]);
+		da = fr_dict_unknown_attr_intern_num(packet_ctx->tmp_ctx, fr_dict_root(dict), data[0]);
 	}
 	if (!da) return -1;
 	FR_PROTO_TRACE("decode context changed %s -> %s",da->parent->name, da->name);
@@ -1764,6 +1762,35 @@ ssize_t fr_radius_decode_pair(TALLOC_CTX *ctx, fr_dcursor_t *cursor, fr_dict_t c
 		return 2;
 	}
 
+	/*
+	 *	Fast path for standard attributes with no tags,
+	 *	encryption, or other magic.  These don't need any of
+	 *	the dispatch below.  If the value is malformed, we
+	 *	fall through to the generic path, which creates a raw
+	 *	attribute.
+	 */
+	if ((dict == dict_radius) && (da == fr_radius_decode_simple[data[0]])) {
+		fr_pair_t	*vp;
+		size_t		len = data[1] - 2;
+
+		if ((len == 0) ||
+		    (len < fr_radius_attr_sizes[da->type][0]) || (len > fr_radius_attr_sizes[da->type][1])) goto generic;
+
+		vp = fr_pair_afrom_da(ctx, da);
+		if (!vp) return -1;
+
+		if (fr_value_box_from_network(vp, &vp->data, da->type, da, data + 2, len, true) < 0) {
+			talloc_free(vp);
+			goto generic;
+		}
+
+		vp->type = VT_DATA;
+		vp->vp_tainted = true;
+		fr_dcursor_append(cursor, vp);
+		return data[1];
+	}
+
+generic:
 	/*
 	 *	Pass the entire thing to the decoding function
 	 */
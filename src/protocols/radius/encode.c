@@ -776,16 +776,23 @@ static ssize_t encode_extended(fr_dbuff_t *dbuff,
 	 *	Encode the header for "short" or "long" attributes
 	 */
 	hlen = 3 + extra;
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, (uint8_t)da_stack->da[depth++]->attr);
+
+	/*
+	 *	Reserve space for the header, including the
+	 *	vendor header if there is one.
+	 */
+	FR_DBUFF_RESERVE_RETURN(&work_dbuff, hlen + ((da_stack->da[depth + 1]->type == FR_TYPE_VSA) ? 5 : 0));
+
+	fr_dbuff_in_bytes_reserved(&work_dbuff, (uint8_t)da_stack->da[depth++]->attr);
 	fr_dbuff_marker(&length_field, &work_dbuff);
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, hlen); /* this gets overwritten later*/
+	fr_dbuff_in_bytes_reserved(&work_dbuff, hlen); /* this gets overwritten later*/
 
 	/*
 	 *	Encode which extended attribute it is.
 	 */
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, (uint8_t)da_stack->da[depth]->attr);
+	fr_dbuff_in_bytes_reserved(&work_dbuff, (uint8_t)da_stack->da[depth]->attr);
 
-	if (extra) FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, 0x00);	/* flags start off at zero */
+	if (extra) fr_dbuff_in_bytes_reserved(&work_dbuff, 0x00);	/* flags start off at zero */
 
 	FR_PROTO_STACK_PRINT(da_stack, depth);
 
@@ -795,8 +802,8 @@ static ssize_t encode_extended(fr_dbuff_t *dbuff,
 	if (da_stack->da[depth]->type == FR_TYPE_VSA) {
 		depth++;
 
-		FR_DBUFF_IN_RETURN(&work_dbuff, (uint32_t) da_stack->da[depth++]->attr);
-		FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, (uint8_t)da_stack->da[depth]->attr);
+		fr_dbuff_in_reserved(&work_dbuff, (uint32_t) da_stack->da[depth++]->attr);
+		fr_dbuff_in_bytes_reserved(&work_dbuff, (uint8_t)da_stack->da[depth]->attr);
 
 		hlen += 5;
 		vendor_hdr = 5;
@@ -942,15 +949,23 @@ static ssize_t encode_vendor_attr(fr_dbuff_t *dbuff,
 
 	fr_dbuff_marker(&hdr, &work_dbuff);
 
+	hdr_len = dv->flags.type_size + dv->flags.length;
+
+	/*
+	 *	Reserve space for the whole header, so the
+	 *	individual fields don't need checking.
+	 */
+	FR_DBUFF_RESERVE_RETURN(&work_dbuff, 6 + hdr_len);
+
 	/*
 	 *	Build the Vendor-Specific header
 	 */
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, FR_VENDOR_SPECIFIC);
+	fr_dbuff_in_bytes_reserved(&work_dbuff, FR_VENDOR_SPECIFIC);
 
 	fr_dbuff_marker(&length_field, &work_dbuff);
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, 0);
+	fr_dbuff_in_bytes_reserved(&work_dbuff, 0);
 
-	FR_DBUFF_IN_RETURN(&work_dbuff, (uint32_t)dv->attr);	/* Copy in the 32bit vendor ID */
+	fr_dbuff_in_reserved(&work_dbuff, (uint32_t)dv->attr);	/* Copy in the 32bit vendor ID */
 
 	/*
 	 *	Now we encode one vendor attribute.
@@ -958,8 +973,6 @@ static ssize_t encode_vendor_attr(fr_dbuff_t *dbuff,
 	da = da_stack->da[depth];
 	fr_assert(da != NULL);
 
-	hdr_len = dv->flags.type_size + dv->flags.length;
-
 	/*
 	 *	Vendors use different widths for their
 	 *	attribute number fields.
@@ -970,15 +983,15 @@ static ssize_t encode_vendor_attr(fr_dbuff_t *dbuff,
 		return PAIR_ENCODE_FATAL_ERROR;
 
 	case 4:
-		fr_dbuff_in(&work_dbuff, (uint32_t)da->attr);
+		fr_dbuff_in_reserved(&work_dbuff, (uint32_t)da->attr);
 		break;
 
 	case 2:
-		fr_dbuff_in(&work_dbuff, (uint16_t)da->attr);
+		fr_dbuff_in_reserved(&work_dbuff, (uint16_t)da->attr);
 		break;
 
 	case 1:
-		fr_dbuff_in(&work_dbuff, (uint8_t)da->attr);
+		fr_dbuff_in_reserved(&work_dbuff, (uint8_t)da->attr);
 		break;
 	}
 
@@ -994,7 +1007,7 @@ static ssize_t encode_vendor_attr(fr_dbuff_t *dbuff,
 		break;
 
 	case 2:
-		fr_dbuff_in_bytes(&work_dbuff, 0);
+		fr_dbuff_in_bytes_reserved(&work_dbuff, 0);
 		FALL_THROUGH;
 
 	case 1:
@@ -1003,7 +1016,7 @@ static ssize_t encode_vendor_attr(fr_dbuff_t *dbuff,
 		 *	will get over-ridden later.
 		 */
 		fr_dbuff_marker(&vsa_length_field, &work_dbuff);
-		fr_dbuff_in_bytes(&work_dbuff, 0);
+		fr_dbuff_in_bytes_reserved(&work_dbuff, 0);
 		break;
 	}
 
@@ -1051,19 +1064,21 @@ static ssize_t encode_wimax(fr_dbuff_t *dbuff,
 	/*
 	 *	Build the Vendor-Specific header
 	 */
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, FR_VENDOR_SPECIFIC);
+	FR_DBUFF_RESERVE_RETURN(&work_dbuff, 9);
+
+	fr_dbuff_in_bytes_reserved(&work_dbuff, FR_VENDOR_SPECIFIC);
 	fr_dbuff_marker(&length_field, &work_dbuff);
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, 0x09);
+	fr_dbuff_in_bytes_reserved(&work_dbuff, 0x09);
 
-	FR_DBUFF_IN_RETURN(&work_dbuff, (uint32_t) dv->attr);
+	fr_dbuff_in_reserved(&work_dbuff, (uint32_t) dv->attr);
 
 	/*
 	 *	Encode the first attribute
 	 */
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, (uint8_t)da_stack->da[depth]->attr);
+	fr_dbuff_in_bytes_reserved(&work_dbuff, (uint8_t)da_stack->da[depth]->attr);
 
 	fr_dbuff_marker(&vsa_length_field, &work_dbuff);
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, 0x03, 0x00); /* length + continuation, both may be overwritten later */
+	fr_dbuff_in_bytes_reserved(&work_dbuff, 0x03, 0x00); /* length + continuation, both may be overwritten later */
 
 	/*
 	 *	We don't bound the size of work_dbuff; it can use more than UINT8_MAX bytes
@@ -27,6 +27,7 @@
 #include <freeradius-devel/util/packet.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/dbuff.h>
 
 #define RADIUS_AUTH_VECTOR_OFFSET      		4
@@ -114,6 +115,12 @@ int		fr_radius_sign(uint8_t *packet, uint8_t const *original,
 			       uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
 int		fr_radius_verify(uint8_t *packet, uint8_t const *original,
 				 uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
+int		fr_radius_sign_hmac(uint8_t *packet, uint8_t const *original,
+				    uint8_t const *secret, size_t secret_len,
+				    fr_hmac_md5_key_t const *hmac) CC_HINT(nonnull (1,3));
+int		fr_radius_verify_hmac(uint8_t *packet, uint8_t const *original,
+				      uint8_t const *secret, size_t secret_len,
+				      fr_hmac_md5_key_t const *hmac) CC_HINT(nonnull (1,3));
 bool		fr_radius_ok(uint8_t const *packet, size_t *packet_len_p,
 			     uint32_t max_attributes, bool require_ma, decode_fail_t *reason) CC_HINT(nonnull (1,2));
 
@@ -125,6 +132,9 @@ ssize_t		fr_radius_recv_header(int sockfd, fr_ipaddr_t *src_ipaddr, uint16_t *sr
 ssize_t		fr_radius_encode(uint8_t *packet, size_t packet_len, uint8_t const *original,
 				 char const *secret, size_t secret_len, int code, int id, fr_pair_list_t *vps);
 
+ssize_t		fr_radius_encode_cached(uint8_t *packet, size_t packet_len, uint8_t const *original,
+					char const *secret, size_t secret_len, int code, int id, fr_pair_list_t *vps);
+
 ssize_t		fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
 				 char const *secret, UNUSED size_t secret_len, int code, int id, fr_pair_list_t *vps);
 
@@ -4,6 +4,6 @@
 # Version:      $Id$
 #
 TARGET      := libfreeradius-tftp.a
-SOURCES     := tftp.c base.c
+SOURCES     := tftp.c base.c transfer.c
 SRC_CFLAGS  := -I$(top_builddir)/src -DNO_ASSERT
 TGT_PREREQS := libfreeradius-util.a
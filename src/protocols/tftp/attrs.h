@@ -38,5 +38,6 @@ extern fr_dict_attr_t const *attr_tftp_error_message;
 extern fr_dict_attr_t const *attr_tftp_filename;
 extern fr_dict_attr_t const *attr_tftp_opcode;
 extern fr_dict_attr_t const *attr_tftp_mode;
+extern fr_dict_attr_t const *attr_tftp_window_size;
 
 extern fr_dict_attr_t const *attr_packet_type;
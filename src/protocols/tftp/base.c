@@ -48,6 +48,7 @@ fr_dict_attr_t const *attr_tftp_error_message;
 fr_dict_attr_t const *attr_tftp_filename;
 fr_dict_attr_t const *attr_tftp_opcode;
 fr_dict_attr_t const *attr_tftp_mode;
+fr_dict_attr_t const *attr_tftp_window_size;
 
 fr_dict_attr_t const *attr_packet_type;
 
@@ -61,6 +62,7 @@ fr_dict_attr_autoload_t libfreeradius_tftp_dict_attr[] = {
 	{ .out = &attr_tftp_filename, .name = "Filename", .type = FR_TYPE_STRING, .dict = &dict_tftp },
 	{ .out = &attr_tftp_opcode, .name = "Opcode", .type = FR_TYPE_UINT16, .dict = &dict_tftp },
 	{ .out = &attr_tftp_mode, .name = "Mode", .type = FR_TYPE_UINT8, .dict = &dict_tftp },
+	{ .out = &attr_tftp_window_size, .name = "Window-Size", .type = FR_TYPE_UINT16, .dict = &dict_tftp },
 
 	{ .out = &attr_packet_type, .name = "Packet-Type", .type = FR_TYPE_UINT32, .dict = &dict_tftp },
 
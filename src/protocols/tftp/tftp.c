@@ -34,6 +34,74 @@ RCSID("$Id$")
 #include "tftp.h"
 #include "attrs.h"
 
+/** Decode the options of a RRQ, WRQ or OACK packet
+ *
+ *  As described in https://tools.ietf.org/html/rfc2347
+ *
+ *  Options are appended to the request as pairs of NUL terminated
+ *  strings.  The option names are case insensitive, and options we
+ *  don't recognise are ignored.
+ *
+ *  +-------+---~~---+---+---~~---+---+-->  >-------+---+---~~---+---+
+ *  |  opc  |  opt1  | 0 | value1 | 0 | <  <  optN  | 0 | valueN | 0 |
+ *  +-------+---~~---+---+---~~---+---+-->  >-------+---+---~~---+---+
+ */
+static int tftp_decode_options(TALLOC_CTX *ctx, uint8_t const *p, uint8_t const *end, fr_dcursor_t *cursor)
+{
+	while (p < end) {
+		uint8_t const		*name, *value, *q;
+		fr_dict_attr_t const	*da;
+		fr_pair_t		*vp;
+		char			*p_end = NULL;
+		long			num, min, max;
+
+		/* <option> */
+		q = memchr(p, '\0', (end - p));
+		if (!q) {
+		error_malformed:
+			fr_strerror_printf("Packet contains malformed attribute");
+			return -1;
+		}
+		name = p;
+		p = q + 1;
+
+		/* <value> */
+		if (p >= end) goto error_malformed;
+		q = memchr(p, '\0', (end - p));
+		if (!q || (q == p) || ((q - p) > 5)) goto error_malformed;
+		value = p;
+		p = q + 1;
+
+		if (strcasecmp((char const *)name, "blksize") == 0) {
+			da = attr_tftp_block_size;
+			min = FR_TFTP_BLOCK_MIN_SIZE;
+			max = FR_TFTP_BLOCK_MAX_SIZE;
+
+		} else if (strcasecmp((char const *)name, "windowsize") == 0) {
+			da = attr_tftp_window_size;
+			min = FR_TFTP_WINDOW_MIN_SIZE;
+			max = FR_TFTP_WINDOW_MAX_SIZE;
+
+		} else {
+			continue;
+		}
+
+		num = strtol((char const *)value, &p_end, 10);
+		if ((value == (uint8_t const *)p_end) || (*p_end != '\0') || (num < min) || (num > max)) {
+			fr_strerror_printf("Invalid %s %ld value", da->name, num);
+			return -1;
+		}
+
+		vp = fr_pair_afrom_da(ctx, da);
+		if (!vp) return -1;
+
+		vp->vp_uint16 = (uint16_t)num;
+		fr_dcursor_append(cursor, vp);
+	}
+
+	return 0;
+}
+
 /*
  *  https://tools.ietf.org/html/rfc1350
  *
@@ -159,36 +227,23 @@ int fr_tftp_decode(TALLOC_CTX *ctx, uint8_t const *data, size_t data_len, fr_dcu
 		fr_dcursor_append(cursor, vp);
 		p += 1 /* \0 */;
 
-		if (p >= end) goto done;
-
 		/*
-		 *  Once here, the next 'blksize' is optional.
-		 *  At least: | blksize | \0 | #blksize | \0 |
+		 *  Once here, the options (blksize, windowsize) are optional.
 		 */
-		if ((end - p) < 10) goto error_malformed;
-
-		if (!memcmp(p, "blksize\0", 8)) {
-			char *p_end = NULL;
-			long blksize;
-
-			p += 8;
-
-			if (p >= end || (end - p) < 1 || (end - p) > 6) goto error_malformed;
-
-			vp = fr_pair_afrom_da(ctx, attr_tftp_block_size);
-			if (!vp) goto error;
-
-			blksize = strtol((const char *)p, &p_end, 10);
-
-			if (p == (const uint8_t *)p_end || blksize > FR_TFTP_BLOCK_MAX_SIZE) {
-				fr_strerror_printf("Invalid Block-Size %ld value", blksize);
-				goto error;
-			}
+		if (tftp_decode_options(ctx, p, end, cursor) < 0) goto error;
+		break;
 
-			vp->vp_uint16 = (uint16_t)blksize;
-			fr_dcursor_append(cursor, vp);
-		}
+	case FR_OPCODE_VALUE_OPTION_ACKNOWLEDGEMENT:
+		/*
+		 *  2 bytes    string   1 byte  string  1 byte
+		 *  +-----------------------------------------+
+		 *  | Opcode |  opt1  |   0  | value1 |   0  | ...
+		 *  +-----------------------------------------+
+		 *  Figure 5-5: OACK packet
+		 */
+		if ((p < end) && (*(end - 1) != '\0')) goto error_malformed;
 
+		if (tftp_decode_options(ctx, p, end, cursor) < 0) goto error;
 		break;
 
 	case FR_OPCODE_VALUE_ACKNOWLEDGEMENT:
@@ -271,6 +326,40 @@ done:
 	return data_len;
 }
 
+/** Encode the options of a RRQ, WRQ or OACK packet
+ *
+ */
+static ssize_t tftp_encode_options(fr_dbuff_t *dbuff, fr_pair_list_t *vps)
+{
+	fr_dbuff_t 	work_dbuff = FR_DBUFF(dbuff);
+	fr_pair_t 	*vp;
+	char		tmp[5+1];                                   /* max: 65535 */
+
+	/* <blksize> is optional */
+	vp = fr_pair_find_by_da(vps, attr_tftp_block_size, 0);
+	if (vp) {
+		FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, "blksize", 7);
+		FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, '\0');
+
+		snprintf(tmp, sizeof(tmp), "%d", vp->vp_uint16); /* #blksize */
+		FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, tmp, strlen(tmp));
+		FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, '\0');
+	}
+
+	/* <windowsize> is optional */
+	vp = fr_pair_find_by_da(vps, attr_tftp_window_size, 0);
+	if (vp) {
+		FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, "windowsize", 10);
+		FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, '\0');
+
+		snprintf(tmp, sizeof(tmp), "%d", vp->vp_uint16); /* #windowsize */
+		FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, tmp, strlen(tmp));
+		FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, '\0');
+	}
+
+	return fr_dbuff_set(dbuff, &work_dbuff);
+}
+
 ssize_t fr_tftp_encode(fr_dbuff_t *dbuff, fr_pair_list_t *vps)
 {
 	fr_dbuff_t 	work_dbuff = FR_DBUFF_MAX(dbuff, FR_TFTP_BLOCK_MAX_SIZE);
@@ -326,19 +415,19 @@ ssize_t fr_tftp_encode(fr_dbuff_t *dbuff, fr_pair_list_t *vps)
 		FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, buf, 5);
 		fr_dbuff_in_bytes(&work_dbuff, '\0');
 
-		/* <blksize> is optional */
-		vp = fr_pair_find_by_da(vps, attr_tftp_block_size, 0);
-		if (vp) {
-			char tmp[5+1];                                   /* max: 65535 */
-
-			FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, "blksize", 7);
-			fr_dbuff_in_bytes(&work_dbuff, '\0');
-
-			snprintf(tmp, sizeof(tmp), "%d", vp->vp_uint16); /* #blksize */
-			FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, tmp, strlen(tmp));
-			fr_dbuff_in_bytes(&work_dbuff, '\0');
-		}
+		/* <blksize>, <windowsize> are optional */
+		if (tftp_encode_options(&work_dbuff, vps) < 0) return -1;
+		break;
 
+	case FR_OPCODE_VALUE_OPTION_ACKNOWLEDGEMENT:
+		/*
+		 *  2 bytes    string   1 byte  string  1 byte
+		 *  +-----------------------------------------+
+		 *  | Opcode |  opt1  |   0  | value1 |   0  | ...
+		 *  +-----------------------------------------+
+		 *  Figure 5-5: OACK packet
+		 */
+		if (tftp_encode_options(&work_dbuff, vps) < 0) return -1;
 		break;
 
 	case FR_OPCODE_VALUE_ACKNOWLEDGEMENT:
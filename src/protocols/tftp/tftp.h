@@ -72,6 +72,15 @@ extern "C" {
 #define FR_TFTP_BLOCK_MIN_SIZE				8
 #define FR_TFTP_BLOCK_MAX_SIZE				65464
 
+/*
+ *	As described in https://tools.ietf.org/html/rfc7440
+ *
+ *  The number of blocks in a window, specified in ASCII.  Valid
+ *  values range between "1" and "65535" blocks, inclusive.
+ */
+#define FR_TFTP_WINDOW_MIN_SIZE				1
+#define FR_TFTP_WINDOW_MAX_SIZE				65535
+
 /*
  * The original protocol has a transfer file size limit of 512 bytes/block x 65535 blocks = 32 MB.
  * In 1998 this limit was extended to 65535 bytes/block x 65535 blocks = 4 GB
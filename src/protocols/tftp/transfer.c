@@ -0,0 +1,516 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file src/protocols/tftp/transfer.c
+ * @brief Serve files over TFTP from shared memory mappings.
+ *
+ * When many clients boot at the same time, they all ask for the same
+ * handful of boot images.  Rather than opening and reading each file
+ * once per transfer, every file is mapped into memory once, and all
+ * transfers of that file send their DATA packets directly from the
+ * mapping.  The DATA header and the file contents are passed to the
+ * kernel as separate iovecs, so the file is never copied in user space.
+ *
+ * Each window of blocks (RFC 7440) is written with one sendmmsg() call.
+ *
+ * Only read requests are handled.  Files are sent as-is, so netascii
+ * conversion, if wanted, must be done by the caller.
+ *
+ * A file cache is not thread safe.  Each thread should allocate its own.
+ * The kernel shares the pages of mappings of the same file, so this costs
+ * address space, not memory.
+ * All transfers must be freed before the cache they opened files from.
+ *
+ * @copyright 2021 The FreeRADIUS server project.
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/rb.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/net.h>
+#include <freeradius-devel/util/pair.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "tftp.h"
+#include "transfer.h"
+
+struct fr_tftp_file_cache_s {
+	char const		*root;		//!< Directory which files are served from.
+	uint32_t		max_idle;	//!< Maximum number of unused files to keep mapped.
+
+	fr_rb_tree_t		*files;		//!< All current files, by name.
+	fr_dlist_head_t		idle;		//!< Files with no transfers, least recently used first.
+	uint32_t		num_idle;
+};
+
+struct fr_tftp_file_s {
+	fr_tftp_file_cache_t	*cache;		//!< We belong to.
+	fr_rb_node_t		node;		//!< Entry in the cache of files.
+	fr_dlist_t		entry;		//!< Entry in the idle list.
+
+	char			*name;		//!< As requested by the client.
+	uint8_t const		*data;		//!< Mapping of the file.  NULL if the file is empty.
+	size_t			len;		//!< Length of the file.
+
+	ino_t			ino;		//!< Used to check if the file has changed.
+	dev_t			dev;
+	time_t			mtime;
+
+	uint32_t		refs;		//!< Number of transfers using the file.
+	bool			stale;		//!< The file has changed, and will be unmapped
+						///< when the last transfer finishes.
+};
+
+struct fr_tftp_transfer_s {
+	fr_tftp_file_t		*file;		//!< Being sent.
+
+	uint16_t		block_size;	//!< Negotiated blksize.
+	uint16_t		window_size;	//!< Negotiated windowsize.
+
+	uint32_t		acked;		//!< Last block which was acknowledged.
+	uint32_t		last;		//!< Final block of the file.
+	uint32_t		sent;		//!< Number of blocks of the current window which
+						///< have been sent.
+
+	uint8_t			*hdr;		//!< DATA headers for the window.
+	struct iovec		*iov;		//!< Header and data of each block in the window.
+	struct mmsghdr		*mmsgvec;	//!< One message per block.
+};
+
+static int8_t file_cmp(void const *one, void const *two)
+{
+	fr_tftp_file_t const *a = one;
+	fr_tftp_file_t const *b = two;
+	int ret;
+
+	ret = strcmp(a->name, b->name);
+	return CMP(ret, 0);
+}
+
+static int _file_free(fr_tftp_file_t *file)
+{
+	void *map;
+
+	memcpy(&map, &file->data, sizeof(map));	/* const issues */
+	if (map) munmap(map, file->len);
+
+	return 0;
+}
+
+/** Allocate a cache of files to serve
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] root		directory to serve files from.
+ * @param[in] max_idle		maximum number of files to keep mapped when no
+ *				transfers are using them.
+ * @return
+ *	- A new file cache.
+ *	- NULL on error.
+ */
+fr_tftp_file_cache_t *fr_tftp_file_cache_alloc(TALLOC_CTX *ctx, char const *root, uint32_t max_idle)
+{
+	fr_tftp_file_cache_t *cache;
+
+	cache = talloc_zero(ctx, fr_tftp_file_cache_t);
+	if (!cache) return NULL;
+
+	cache->root = talloc_strdup(cache, root);
+	cache->max_idle = max_idle;
+
+	cache->files = fr_rb_inline_alloc(cache, fr_tftp_file_t, node, file_cmp, NULL);
+	if (!cache->root || !cache->files) {
+		talloc_free(cache);
+		return NULL;
+	}
+	fr_dlist_talloc_init(&cache->idle, fr_tftp_file_t, entry);
+
+	return cache;
+}
+
+/** Check the filename doesn't escape from the root directory
+ *
+ */
+static bool file_name_valid(char const *filename)
+{
+	char const *p = filename;
+
+	if (*p == '/') return false;
+
+	while (*p) {
+		if ((p[0] == '.') && (p[1] == '.') && ((p[2] == '/') || (p[2] == '\0'))) return false;
+
+		p = strchr(p, '/');
+		if (!p) break;
+		p++;
+	}
+
+	return true;
+}
+
+/** Stop tracking a file, and unmap it if nothing is using it
+ *
+ */
+static void file_remove(fr_tftp_file_cache_t *cache, fr_tftp_file_t *file)
+{
+	(void) fr_rb_delete(cache->files, file);
+
+	if (file->refs == 0) {
+		fr_dlist_remove(&cache->idle, file);
+		cache->num_idle--;
+		talloc_free(file);
+		return;
+	}
+
+	file->stale = true;
+}
+
+/** Open a file, or re-use an existing mapping of it
+ *
+ * If the file has been changed on disk since it was mapped, the
+ * file is mapped again.  Transfers which have already started keep
+ * sending the old contents.
+ *
+ * @param[in] cache		to find the file in.
+ * @param[in] filename		relative to the root of the cache.
+ * @return
+ *	- The file.  It must be released with fr_tftp_file_release().
+ *	- NULL if the file doesn't exist, or can't be read.
+ */
+fr_tftp_file_t *fr_tftp_file_open(fr_tftp_file_cache_t *cache, char const *filename)
+{
+	fr_tftp_file_t	*file, find;
+	char		*path;
+	struct stat	st;
+	int		fd;
+	void		*map = NULL;
+
+	if (!file_name_valid(filename)) {
+		fr_strerror_printf("Invalid filename \"%s\"", filename);
+		return NULL;
+	}
+
+	path = talloc_asprintf(NULL, "%s/%s", cache->root, filename);
+	if (!path) return NULL;
+
+	memcpy(&find.name, &filename, sizeof(find.name));	/* const issues */
+	file = fr_rb_find(cache->files, &find);
+
+	/*
+	 *	Checking the file is much cheaper than opening and
+	 *	mapping it again.
+	 */
+	if (file) {
+		if ((stat(path, &st) == 0) && S_ISREG(st.st_mode) &&
+		    (st.st_ino == file->ino) && (st.st_dev == file->dev) &&
+		    (st.st_mtime == file->mtime) && ((size_t) st.st_size == file->len)) {
+			talloc_free(path);
+
+			if (file->refs++ == 0) {
+				fr_dlist_remove(&cache->idle, file);
+				cache->num_idle--;
+			}
+			return file;
+		}
+
+		file_remove(cache, file);
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening \"%s\": %s", path, fr_syserror(errno));
+		talloc_free(path);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		fr_strerror_printf("Failed checking \"%s\": %s", path, fr_syserror(errno));
+	error:
+		close(fd);
+		talloc_free(path);
+		return NULL;
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		fr_strerror_printf("\"%s\" is not a regular file", path);
+		goto error;
+	}
+
+	/*
+	 *	The mapping stays valid after the descriptor is closed,
+	 *	so there's no need to keep one descriptor per file.
+	 */
+	if (st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			fr_strerror_printf("Failed mapping \"%s\": %s", path, fr_syserror(errno));
+			goto error;
+		}
+#ifdef MADV_SEQUENTIAL
+		(void) madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+	}
+	close(fd);
+	talloc_free(path);
+
+	file = talloc_zero(cache, fr_tftp_file_t);
+	if (!file) {
+		if (map) munmap(map, st.st_size);
+		return NULL;
+	}
+	file->cache = cache;
+	file->data = map;
+	file->len = st.st_size;
+	file->ino = st.st_ino;
+	file->dev = st.st_dev;
+	file->mtime = st.st_mtime;
+	file->refs = 1;
+	talloc_set_destructor(file, _file_free);
+
+	file->name = talloc_strdup(file, filename);
+	if (!file->name) {
+		talloc_free(file);
+		return NULL;
+	}
+
+	(void) fr_rb_insert(cache->files, file);
+
+	return file;
+}
+
+/** Release a file which was returned by fr_tftp_file_open()
+ *
+ * Files which aren't being used stay mapped, until there are more
+ * than max_idle of them.
+ */
+void fr_tftp_file_release(fr_tftp_file_t *file)
+{
+	fr_tftp_file_cache_t *cache = file->cache;
+
+	fr_assert(file->refs > 0);
+
+	if (--file->refs > 0) return;
+
+	if (file->stale) {
+		talloc_free(file);
+		return;
+	}
+
+	fr_dlist_insert_tail(&cache->idle, file);
+	cache->num_idle++;
+
+	while (cache->num_idle > cache->max_idle) {
+		fr_tftp_file_t *old = fr_dlist_head(&cache->idle);
+
+		file_remove(cache, old);
+	}
+}
+
+/** Return the length of a file
+ *
+ */
+size_t fr_tftp_file_len(fr_tftp_file_t const *file)
+{
+	return file->len;
+}
+
+static int _transfer_free(fr_tftp_transfer_t *transfer)
+{
+	fr_tftp_file_release(transfer->file);
+
+	return 0;
+}
+
+/** Start sending a file
+ *
+ * The caller should negotiate options, and send the OACK, before
+ * calling fr_tftp_transfer_ack() with block 0.  When no options are
+ * negotiated, the first window can be sent immediately.
+ *
+ * @param[in] ctx		to allocate the transfer in.
+ * @param[in] file		to send.  The transfer holds a reference
+ *				to the file until it's freed.
+ * @param[in] block_size	negotiated blksize, or 0 for the RFC 1350 default.
+ * @param[in] window_size	negotiated windowsize, or 0 for one block per
+ *				window.
+ * @return
+ *	- A new transfer.
+ *	- NULL on error.
+ */
+fr_tftp_transfer_t *fr_tftp_transfer_alloc(TALLOC_CTX *ctx, fr_tftp_file_t *file,
+					   uint16_t block_size, uint16_t window_size)
+{
+	fr_tftp_transfer_t *transfer;
+
+	if (block_size == 0) block_size = 512;
+	if (block_size < FR_TFTP_BLOCK_MIN_SIZE) block_size = FR_TFTP_BLOCK_MIN_SIZE;
+	if (block_size > FR_TFTP_BLOCK_MAX_SIZE) block_size = FR_TFTP_BLOCK_MAX_SIZE;
+
+	if (window_size == 0) window_size = 1;
+	if (window_size > FR_TFTP_TRANSFER_WINDOW_MAX) window_size = FR_TFTP_TRANSFER_WINDOW_MAX;
+
+	/*
+	 *	A file which is an exact multiple of the block size
+	 *	ends with an empty block.
+	 */
+	if ((file->len / block_size) >= UINT32_MAX) {
+		fr_strerror_printf("File \"%s\" is too large to send with blksize %u", file->name, block_size);
+		return NULL;
+	}
+
+	transfer = talloc_zero(ctx, fr_tftp_transfer_t);
+	if (!transfer) return NULL;
+
+	transfer->block_size = block_size;
+	transfer->window_size = window_size;
+	transfer->last = (file->len / block_size) + 1;
+
+	transfer->hdr = talloc_array(transfer, uint8_t, window_size * FR_TFTP_HDR_LEN);
+	transfer->iov = talloc_array(transfer, struct iovec, window_size * 2);
+	transfer->mmsgvec = talloc_array(transfer, struct mmsghdr, window_size);
+	if (!transfer->hdr || !transfer->iov || !transfer->mmsgvec) {
+		talloc_free(transfer);
+		return NULL;
+	}
+
+	transfer->file = file;
+	file->refs++;
+	talloc_set_destructor(transfer, _transfer_free);
+
+	return transfer;
+}
+
+/** Return the windowsize which should be sent in the OACK
+ *
+ */
+uint16_t fr_tftp_transfer_window_size(fr_tftp_transfer_t const *transfer)
+{
+	return transfer->window_size;
+}
+
+/** Send (or re-send) the current window of blocks
+ *
+ * @param[in] transfer		to send.
+ * @param[in] sockfd		connected to the client's TID.
+ * @return
+ *	- >= 0 the number of blocks which were written.  Any which
+ *	  couldn't be written will be sent again on retransmission.
+ *	- -1 on failure.
+ */
+int fr_tftp_transfer_send(fr_tftp_transfer_t *transfer, int sockfd)
+{
+	fr_tftp_file_t const	*file = transfer->file;
+	uint8_t			*data;
+	uint32_t		block, i, count;
+	int			ret;
+
+	memcpy(&data, &file->data, sizeof(data));	/* const issues */
+
+	count = transfer->last - transfer->acked;
+	if (count > transfer->window_size) count = transfer->window_size;
+
+	for (i = 0; i < count; i++) {
+		size_t		offset, len;
+		uint8_t		*p = transfer->hdr + (i * FR_TFTP_HDR_LEN);
+
+		block = transfer->acked + i + 1;
+		offset = (size_t) (block - 1) * transfer->block_size;
+		len = file->len - offset;
+		if (len > transfer->block_size) len = transfer->block_size;
+
+		/*
+		 *	Block numbers wrap around to 0, which is what
+		 *	nearly all clients expect.
+		 */
+		fr_net_from_uint16(p, FR_OPCODE_VALUE_DATA);
+		fr_net_from_uint16(p + 2, block & 0xffff);
+
+		transfer->iov[i * 2] = (struct iovec) {
+			.iov_base = p,
+			.iov_len = FR_TFTP_HDR_LEN
+		};
+		transfer->iov[(i * 2) + 1] = (struct iovec) {
+			.iov_base = len ? data + offset : NULL,
+			.iov_len = len
+		};
+		transfer->mmsgvec[i] = (struct mmsghdr) {
+			.msg_hdr = {
+				.msg_iov = &transfer->iov[i * 2],
+				.msg_iovlen = 2,
+			}
+		};
+	}
+
+	transfer->sent = count;
+
+	i = 0;
+	while (i < count) {
+		ret = sendmmsg(sockfd, transfer->mmsgvec + i, count - i, 0);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+
+			fr_strerror_printf("Failed sending DATA: %s", fr_syserror(errno));
+			return -1;
+		}
+		if (ret == 0) break;
+
+		i += ret;
+	}
+
+	return i;
+}
+
+/** Process an ACK from the client
+ *
+ * The client acknowledges the last block it received in order.  If
+ * that's before the end of the window, the next window starts from
+ * the block after it (RFC 7440 section 4).
+ *
+ * @param[in] transfer		the ACK is for.
+ * @param[in] block		from the ACK.
+ * @return
+ *	- 1 if the whole file has been acknowledged.
+ *	- 0 if the next window should be sent.
+ *	- -1 if the ACK is a duplicate, or isn't for the current window,
+ *	  and should be ignored.
+ */
+int fr_tftp_transfer_ack(fr_tftp_transfer_t *transfer, uint16_t block)
+{
+	uint16_t	offset = block - (uint16_t) (transfer->acked & 0xffff);
+
+	/*
+	 *	Either the ACK of the OACK, or a duplicate ACK.
+	 *	Re-sending on duplicate ACKs causes the "Sorcerer's
+	 *	Apprentice" problem, so we leave that to the timer.
+	 */
+	if (offset == 0) return transfer->sent ? -1 : 0;
+
+	if (offset > transfer->sent) return -1;
+
+	transfer->acked += offset;
+	transfer->sent = 0;
+
+	return (transfer->acked == transfer->last) ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file src/protocols/tftp/transfer.h
+ * @brief Serve files over TFTP from shared memory mappings.
+ *
+ * @copyright 2021 The FreeRADIUS server project.
+ */
+RCSIDH(tftp_transfer_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/util/talloc.h>
+
+/** The largest window we'll send with one sendmmsg() call
+ *
+ * Clients may ask for up to 65535 blocks per window, but the
+ * negotiated size is clamped to this.  The caller should send
+ * the clamped value back in the OACK.
+ */
+#define FR_TFTP_TRANSFER_WINDOW_MAX			64
+
+typedef struct fr_tftp_file_cache_s fr_tftp_file_cache_t;
+typedef struct fr_tftp_file_s fr_tftp_file_t;
+typedef struct fr_tftp_transfer_s fr_tftp_transfer_t;
+
+fr_tftp_file_cache_t	*fr_tftp_file_cache_alloc(TALLOC_CTX *ctx, char const *root, uint32_t max_idle);
+
+fr_tftp_file_t		*fr_tftp_file_open(fr_tftp_file_cache_t *cache, char const *filename) CC_HINT(nonnull);
+
+void			fr_tftp_file_release(fr_tftp_file_t *file) CC_HINT(nonnull);
+
+size_t			fr_tftp_file_len(fr_tftp_file_t const *file) CC_HINT(nonnull);
+
+fr_tftp_transfer_t	*fr_tftp_transfer_alloc(TALLOC_CTX *ctx, fr_tftp_file_t *file,
+						uint16_t block_size, uint16_t window_size) CC_HINT(nonnull);
+
+uint16_t		fr_tftp_transfer_window_size(fr_tftp_transfer_t const *transfer) CC_HINT(nonnull);
+
+int			fr_tftp_transfer_send(fr_tftp_transfer_t *transfer, int sockfd) CC_HINT(nonnull);
+
+int			fr_tftp_transfer_ack(fr_tftp_transfer_t *transfer, uint16_t block) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+#  Answers requests from rlm_exec until stdin is closed.
+#
+while read -r header; do
+	user=""
+	while read -r line && [ -n "$line" ]; do
+		case "$line" in
+		"User-Name = "*)
+			user="${line#User-Name = }"
+			;;
+		esac
+	done
+
+	case "$header" in
+	xlat*)
+		echo 0
+		echo "${header#xlat }"
+		;;
+
+	*)
+		echo 0
+		echo "Tmp-String-4 := $user"
+		;;
+	esac
+	echo
+done
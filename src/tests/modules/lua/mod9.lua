@@ -0,0 +1,25 @@
+function authorize()
+	-- indexed lookups, the second one hits the accessor cache
+	if fr.request['User-Name'][0] ~= "caipirinha" then
+		print("error: fr.request['User-Name'][0] should be 'caipirinha'")
+		return fr.rcode.fail
+	end
+
+	if fr.request['User-Name'][0] ~= "caipirinha" then
+		print("error: fr.request['User-Name'][0] should still be 'caipirinha'")
+		return fr.rcode.fail
+	end
+
+	if fr.request['User-Name'][1] ~= nil then
+		print("error: fr.request['User-Name'][1] should be nil")
+		return fr.rcode.fail
+	end
+
+	-- nothing can be stored in fr.request itself
+	if pcall(function() fr.request.foo = "bar" end) then
+		print("error: fr.request should be read-only")
+		return fr.rcode.fail
+	end
+
+	return fr.rcode.ok
+end
@@ -156,6 +156,24 @@ sub test_call {
 	# Some code goes here
 }
 
+sub lazy_authorize {
+	# Used with lazy_pairs, where the hashes are tied to the request
+	my $seen = 0;
+
+	while (my ($k, $v) = each %RAD_REQUEST) {
+		$seen++ if ($k eq 'User-Name');
+	}
+	return RLM_MODULE_INVALID unless ($seen == 1);
+
+	return RLM_MODULE_INVALID unless (exists $RAD_REQUEST{'User-Password'});
+	delete $RAD_REQUEST{'User-Password'};
+	return RLM_MODULE_INVALID if (exists $RAD_REQUEST{'User-Password'});
+
+	$RAD_REPLY{'Reply-Message'} = "lazy";
+
+	return RLM_MODULE_OK;
+}
+
 sub log_request_attributes {
 	# This shouldn't be done in production environments!
 	# This is only meant for debugging!
@@ -0,0 +1,63 @@
+#
+#	Automated load tests, using the "load" listener.
+#
+#	These tests are NOT run as part of "make test", as the results
+#	depend on the machine which runs them.  Instead, use:
+#
+#		make perf
+#
+#	Each test is a server configuration in load/.  The server
+#	generates its own traffic, and exits once the load generator
+#	reaches max_pps.  The per-second statistics for each test are
+#	written to $(BUILD_DIR)/tests/performance/<test>.csv, and a
+#	one-line-per-test summary to results.csv in the same
+#	directory.  The tests are re-run when the server is rebuilt,
+#	or with "make clean.perf perf".
+#
+
+PERF_DIR    := $(DIR)
+PERF_OUTPUT := $(BUILD_DIR)/tests/performance
+PERF_TESTS  := $(patsubst $(DIR)/load/%.conf,%,$(filter-out $(DIR)/load/common.conf $(DIR)/load/step.conf,$(wildcard $(DIR)/load/*.conf)))
+
+#
+#	Load generator settings.  These can be changed on the command
+#	line, e.g. "make perf PERF_MAX_PPS=50000".
+#
+PERF_START_PPS	?= 1000
+PERF_MAX_PPS	?= 20000
+PERF_STEP	?= 1000
+PERF_DURATION	?= 5
+PERF_PARALLEL	?= 25
+PERF_PORT	?= 12350
+
+$(PERF_OUTPUT):
+	${Q}mkdir -p $@
+
+#
+#	Run one test.  The server exits by itself when the test is done.
+#
+$(PERF_OUTPUT)/%.csv: $(PERF_DIR)/load/%.conf $(PERF_DIR)/load/common.conf $(PERF_DIR)/load/step.conf $(BUILD_DIR)/bin/radiusd | $(PERF_OUTPUT) build.raddb
+	@echo "PERF $*"
+	${Q}rm -f $@ $(PERF_OUTPUT)/$*.db
+	${Q}if ! TESTDIR=$(PERF_DIR) OUTPUT=$(PERF_OUTPUT) PERF_PORT=$(PERF_PORT) \
+		PERF_START_PPS=$(PERF_START_PPS) PERF_MAX_PPS=$(PERF_MAX_PPS) PERF_STEP=$(PERF_STEP) \
+		PERF_DURATION=$(PERF_DURATION) PERF_PARALLEL=$(PERF_PARALLEL) \
+		$(TEST_BIN)/radiusd -f -d $(PERF_DIR)/load -n $* -D $(DICT_PATH) -l $(PERF_OUTPUT)/$*.log; then \
+		echo "FAILED RUNNING PERF TEST $*"; \
+		tail -n 50 $(PERF_OUTPUT)/$*.log; \
+		exit 1; \
+	fi
+	${Q}test -s $@ || (echo "PERF TEST $* wrote no statistics"; exit 1)
+
+$(PERF_OUTPUT)/results.csv: $(addprefix $(PERF_OUTPUT)/,$(addsuffix .csv,$(PERF_TESTS)))
+	${Q}$(PERF_DIR)/summary $^ > $@
+	${Q}cat $@
+
+.PHONY: perf
+perf: $(PERF_OUTPUT)/results.csv
+
+.PHONY: clean.perf
+clean.perf:
+	${Q}rm -rf $(PERF_OUTPUT)
+
+clean.test: clean.perf